@@ -55,6 +55,7 @@ struct list *account_vidcodecl(const struct account *acc);
 struct sip_addr *account_laddr(const struct account *acc);
 uint32_t account_regint(const struct account *acc);
 uint32_t account_pubint(const struct account *acc);
+bool account_mwi(const struct account *acc);
 enum answermode account_answermode(const struct account *acc);
 
 
@@ -70,9 +71,11 @@ enum call_event {
 	CALL_EVENT_CLOSED,
 	CALL_EVENT_TRANSFER,
 	CALL_EVENT_TRANSFER_FAILED,
+	CALL_EVENT_QUALITY,
 };
 
 struct call;
+struct call_stats;
 
 typedef void (call_event_h)(struct call *call, enum call_event ev,
 			    const char *str, void *arg);
@@ -80,26 +83,37 @@ typedef void (call_dtmf_h)(struct call *call, char key, void *arg);
 
 int  call_modify(struct call *call);
 int  call_hold(struct call *call, bool hold);
+int  call_present(struct call *call, bool on);
 int  call_send_digit(struct call *call, char key);
 bool call_has_audio(const struct call *call);
 bool call_has_video(const struct call *call);
 int  call_transfer(struct call *call, const char *uri);
 int  call_status(struct re_printf *pf, const struct call *call);
+int  call_stats_get(const struct call *call, struct call_stats *st);
 int  call_debug(struct re_printf *pf, const struct call *call);
+int  call_info(struct re_printf *pf, const struct call *call);
+int  call_memstat(struct re_printf *pf, const struct call *call);
 void call_set_handlers(struct call *call, call_event_h *eh,
 		       call_dtmf_h *dtmfh, void *arg);
 uint16_t      call_scode(const struct call *call);
 uint32_t      call_duration(const struct call *call);
 uint32_t      call_setup_duration(const struct call *call);
+uint32_t      call_setup_ms(const struct call *call);
 const char   *call_peeruri(const struct call *call);
 const char   *call_peername(const struct call *call);
 const char   *call_localuri(const struct call *call);
+const char   *call_id(const struct call *call);
 struct audio *call_audio(const struct call *call);
 struct video *call_video(const struct call *call);
 struct list  *call_streaml(const struct call *call);
 struct ua    *call_get_ua(const struct call *call);
+struct account *call_account(const struct call *call);
 bool          call_is_onhold(const struct call *call);
 bool          call_is_outgoing(const struct call *call);
+void          call_set_prio(struct call *call, int prio);
+int           call_prio(const struct call *call);
+void          call_set_cplx(struct call *call, unsigned level);
+unsigned      call_cplx(const struct call *call);
 
 
 /*
@@ -115,6 +129,8 @@ int  conf_modules(void);
 void conf_path_set(const char *path);
 int  conf_path_get(char *path, size_t sz);
 int  conf_parse(const char *filename, confline_h *ch);
+int  conf_load(struct mbuf **mbp, const char *filename);
+int  conf_compact(struct mbuf **mbp, const uint8_t *buf, size_t sz);
 int  conf_get_vidsz(const struct conf *conf, const char *name,
 		    struct vidsz *sz);
 int  conf_get_sa(const struct conf *conf, const char *name, struct sa *sa);
@@ -143,7 +159,30 @@ enum audio_mode {
 	AUDIO_MODE_POLL = 0,         /**< Polling mode                  */
 	AUDIO_MODE_THREAD,           /**< Use dedicated thread          */
 	AUDIO_MODE_THREAD_REALTIME,  /**< Use dedicated realtime-thread */
-	AUDIO_MODE_TMR               /**< Use timer                     */
+	AUDIO_MODE_TMR,              /**< Use timer                     */
+	AUDIO_MODE_EVENT,            /**< Thread woken by audio source  */
+	AUDIO_MODE_SCHEDULER         /**< Use shared media scheduler    */
+};
+
+/** Layout of the video displays of several calls */
+enum vidcomp_layout {
+	VIDCOMP_NONE = 0,            /**< One display per call          */
+	VIDCOMP_GRID,                /**< One display, calls in a grid  */
+	VIDCOMP_SPEAKER,             /**< One display, active speaker   */
+};
+
+/** Degradation of the video sent, when the encoder can't keep up */
+enum video_degrade {
+	VIDEO_DEGRADE_OFF = 0,       /**< Lower the bitrate only        */
+	VIDEO_DEGRADE_AUTO,          /**< By content, motion or screen  */
+	VIDEO_DEGRADE_FRAMERATE,     /**< Lower the frame-rate          */
+	VIDEO_DEGRADE_RESOLUTION,    /**< Lower the resolution          */
+};
+
+/** Audio resampler backends */
+enum resamp_backend {
+	RESAMP_POLYPHASE = 0,        /**< Polyphase filter bank, SIMD   */
+	RESAMP_LIBREM,               /**< librem auresamp               */
 };
 
 
@@ -153,11 +192,25 @@ struct config_sip {
 	char uuid[64];          /**< Universally Unique Identifier  */
 	char local[64];         /**< Local SIP Address              */
 	char cert[256];         /**< SIP Certificate                */
+	uint32_t reg_inflight;  /**< Max REGISTERs in progress, 0=off */
+	uint32_t reg_rate;      /**< REGISTERs started per second   */
+	uint32_t msg_inflight;  /**< MESSAGEs in progress per peer, 0=off */
+	uint32_t msg_queue;     /**< MESSAGEs queued per peer, 0=off */
+	uint32_t msg_rxq;       /**< Received MESSAGEs queued, 0=off */
+	uint32_t keepalive;     /**< CRLF keepalive on TCP/TLS [s], 0=off */
+	uint32_t stop_rate;     /**< BYEs/unREGISTERs per sec at exit, 0=off */
+	uint32_t stop_timeout;  /**< Forced exit after [s], 0=off   */
 };
 
 /** Call config */
 struct config_call {
 	uint32_t local_timeout; /**< Incoming call timeout [sec] 0=off */
+	uint32_t max_calls;     /**< Max. calls per account, 0=off  */
+	uint32_t max_calls_total; /**< Max. calls in total, 0=off   */
+	uint32_t max_setups;    /**< Max. calls being set up, 0=off */
+	uint32_t max_lag;       /**< Max. event loop lag [ms], 0=off */
+	uint32_t max_load;      /**< Max. CPU load [%], 0=off       */
+	uint32_t degrade_load;  /**< Codec degrade load [%], 0=off  */
 };
 
 /** Audio */
@@ -177,6 +230,14 @@ struct config_audio {
 	uint32_t channels_src;  /**< Opt. channels for source       */
 	bool src_first;         /**< Audio source opened first      */
 	enum audio_mode txmode; /**< Audio transmit mode            */
+	enum resamp_backend resamp; /**< Audio resampler backend    */
+	bool srate_auto;        /**< Open devices at codec rate     */
+	bool vad;               /**< Suppress silence, send CN      */
+	char moh_mod[16];       /**< Music on hold source module    */
+	char moh_dev[128];      /**< Music on hold source device    */
+	uint32_t moh_srate;     /**< Music on hold rate in [Hz]     */
+	bool rate_adapt;        /**< Adapt encoder rate to the path */
+	bool offload;           /**< Heavy codecs on media scheduler*/
 };
 
 #ifdef USE_VIDEO
@@ -189,6 +250,14 @@ struct config_video {
 	unsigned width, height; /**< Video resolution               */
 	uint32_t bitrate;       /**< Encoder bitrate in [bit/s]     */
 	uint32_t fps;           /**< Video framerate                */
+	uint32_t pacing_factor; /**< Pacing rate in [%] of bitrate  */
+	uint32_t burst_max;     /**< Max pacer burst in [bytes]     */
+	uint32_t pktsize;       /**< Max RTP packet size in [bytes] */
+	bool enc_thread;        /**< Encode in a separate thread    */
+	uint32_t simulcast;     /**< Number of simulcast layers     */
+	uint32_t fec;           /**< FEC protection in [%], 0 is off*/
+	enum vidcomp_layout layout; /**< Display of several calls   */
+	enum video_degrade degrade; /**< Degradation policy         */
 };
 #endif
 
@@ -199,8 +268,15 @@ struct config_avt {
 	struct range rtp_bw;    /**< RTP Bandwidth range [bit/s]    */
 	bool rtcp_enable;       /**< RTCP is enabled                */
 	bool rtcp_mux;          /**< RTP/RTCP multiplexing          */
+	bool bundle;            /**< BUNDLE media, needs rtcp_mux   */
 	struct range jbuf_del;  /**< Delay, number of frames        */
+	bool jbuf_adaptive;     /**< Adaptive jitter buffer delay   */
 	bool rtp_stats;         /**< Enable RTP statistics          */
+	uint32_t media_threads; /**< Media worker threads, 0=auto   */
+	bool media_fast;        /**< Media clock as fast as possible */
+	double mos_alert;       /**< MOS alert threshold, 0 is off  */
+	bool rtcp_xr;           /**< Send RTCP XR VoIP metrics      */
+	uint32_t busy_poll;     /**< Busy poll RTP sockets [us]     */
 };
 
 /* Network */
@@ -210,12 +286,40 @@ struct config_net {
 		char addr[64];
 	} nsv[NET_MAX_NS];      /**< Configured DNS nameservers     */
 	size_t nsc;             /**< Number of DNS nameservers      */
+	bool dns_cache;         /**< Cache DNS answers              */
+};
+
+/** Scheduling policy of a thread */
+enum sched_policy {
+	SCHED_POLICY_DEFAULT = 0,  /**< Inherited, not changed        */
+	SCHED_POLICY_OTHER,        /**< Time-sharing                  */
+	SCHED_POLICY_FIFO,         /**< Real-time, first in first out */
+	SCHED_POLICY_RR,           /**< Real-time, round robin        */
+};
+
+/** Scheduling of a thread */
+struct config_thread {
+	enum sched_policy policy; /**< Scheduling policy            */
+	int prio;               /**< Priority for FIFO and RR       */
+	uint64_t cpus;          /**< CPU affinity mask, 0 is any    */
+};
+
+/** Thread scheduling */
+struct config_sched {
+	struct config_thread main;      /**< Main loop thread       */
+	struct config_thread audio_tx;  /**< Audio transmit thread  */
+	struct config_thread audio_dev; /**< Audio device threads   */
+	struct config_thread video_enc; /**< Video encoder thread   */
+	bool mlockall;          /**< Lock all memory in RAM         */
 };
 
 #ifdef USE_VIDEO
 /* BFCP */
 struct config_bfcp {
 	char proto[16];         /**< BFCP Transport (optional)      */
+	char present_mod[16];   /**< Presentation source module     */
+	char present_dev[128];  /**< Presentation source device     */
+	uint32_t present_fps;   /**< Presentation framerate         */
 };
 #endif
 
@@ -236,6 +340,8 @@ struct config {
 
 	struct config_net net;
 
+	struct config_sched sched;
+
 #ifdef USE_VIDEO
 	struct config_bfcp bfcp;
 #endif
@@ -263,6 +369,7 @@ struct contact;
 int  contact_init(void);
 void contact_close(void);
 int  contact_add(struct contact **contactp, const struct pl *addr);
+int  contact_load(struct mbuf *mb);
 int  contacts_print(struct re_printf *pf, void *unused);
 void contact_set_presence(struct contact *c, enum presence_status status);
 bool contact_block_access(const char *uri);
@@ -307,6 +414,7 @@ struct ausrc_prm {
 	uint32_t   srate;       /**< Sampling rate in [Hz] */
 	uint8_t    ch;          /**< Number of channels    */
 	uint32_t   ptime;       /**< Wanted packet-time in [ms] */
+	uint32_t  *latency;     /**< Device latency in [us], set by driver */
 };
 
 typedef void (ausrc_read_h)(const int16_t *sampv, size_t sampc, void *arg);
@@ -338,6 +446,7 @@ struct auplay_prm {
 	uint32_t   srate;       /**< Sampling rate in [Hz] */
 	uint8_t    ch;          /**< Number of channels    */
 	uint32_t   ptime;       /**< Wanted packet-time in [ms] */
+	uint32_t  *latency;     /**< Device latency in [us], set by driver */
 };
 
 typedef void (auplay_write_h)(int16_t *sampv, size_t sampc, void *arg);
@@ -376,6 +485,9 @@ struct aufilt_prm {
 	uint32_t srate;       /**< Sampling rate in [Hz]        */
 	uint8_t  ch;          /**< Number of channels           */
 	uint32_t ptime;       /**< Wanted packet-time in [ms]   */
+	struct aulevel *level;/**< Output for a level meter     */
+	int *vad;             /**< Output for a VAD, 1 is speech*/
+	const struct account *acc; /**< Account of the call     */
 };
 
 typedef int (aufilt_encupd_h)(struct aufilt_enc_st **stp, void **ctx,
@@ -388,6 +500,17 @@ typedef int (aufilt_decupd_h)(struct aufilt_dec_st **stp, void **ctx,
 typedef int (aufilt_decode_h)(struct aufilt_dec_st *st,
 			      int16_t *sampv, size_t *sampc);
 
+/* Float samples are normalized to [-1.0, 1.0) */
+typedef int (aufilt_encode_float_h)(struct aufilt_enc_st *st,
+				    float *sampv, size_t *sampc);
+typedef int (aufilt_decode_float_h)(struct aufilt_dec_st *st,
+				    float *sampv, size_t *sampc);
+
+/**
+ * Audio filter. All handlers process the samples in-place. A filter may
+ * have int16 handlers, float handlers or both; with both the filter
+ * runs in the sample format of the previous stage.
+ */
 struct aufilt {
 	struct le le;
 	const char *name;
@@ -395,6 +518,8 @@ struct aufilt {
 	aufilt_encode_h *ench;
 	aufilt_decupd_h *decupdh;
 	aufilt_decode_h *dech;
+	aufilt_encode_float_h *enc_floath;  /**< Optional float encode */
+	aufilt_decode_float_h *dec_floath;  /**< Optional float decode */
 };
 
 void aufilt_register(struct aufilt *af);
@@ -418,6 +543,7 @@ typedef void (log_h)(uint32_t level, const char *msg);
 struct log {
 	struct le le;
 	log_h *h;
+	bool thread_safe;  /**< Handler may be called from the log thread */
 };
 
 void log_register_handler(struct log *logh);
@@ -425,6 +551,11 @@ void log_unregister_handler(struct log *logh);
 void log_enable_debug(bool enable);
 void log_enable_info(bool enable);
 void log_enable_stderr(bool enable);
+int  log_enable_async(bool enable);
+void log_set_ratelimit(uint32_t burst);
+void log_set_context(const char *callid, const char *aor);
+void log_context(const char **callid, const char **aor);
+int  log_debug(struct re_printf *pf, void *unused);
 void vlog(enum log_level level, const char *fmt, va_list ap);
 void loglv(enum log_level level, const char *fmt, ...);
 void debug(const char *fmt, ...);
@@ -452,12 +583,20 @@ typedef int  (menc_media_h)(struct menc_media **mp, struct menc_sess *sess,
 			    void *rtpsock, void *rtcpsock,
 			    struct sdp_media *sdpm);
 
+/**
+ * Start or end a burst of outgoing RTP packets. During a burst the
+ * module may hold the RTP packets back and protect them together when
+ * the burst ends. Optional.
+ */
+typedef int  (menc_burst_h)(struct menc_media *m, bool start);
+
 struct menc {
 	struct le le;
 	const char *id;
 	const char *sdp_proto;
 	menc_sess_h *sessh;
 	menc_media_h *mediah;
+	menc_burst_h *bursth;
 };
 
 void menc_register(struct menc *menc);
@@ -471,6 +610,16 @@ const struct menc *menc_find(const char *id);
 
 struct network;
 
+/** NAT behaviour of a local address */
+struct nat_behavior {
+	enum nat_type mapping;    /**< Mapping behaviour (UDP)             */
+	enum nat_type filtering;  /**< Filtering behaviour (UDP)           */
+	int hairpinning;          /**< 1 supported, 0 not, -1 unknown      */
+	uint32_t lifetime;        /**< UDP binding lifetime [s], 0 unknown */
+	bool lifetime_final;      /**< False if only a lower bound         */
+	uint64_t updated;         /**< Time of the last update [ms]        */
+};
+
 typedef void (net_change_h)(void *arg);
 
 int  net_alloc(struct network **netp, const struct config_net *cfg, int af);
@@ -484,6 +633,11 @@ int  net_debug(struct re_printf *pf, const struct network *net);
 const struct sa *net_laddr_af(const struct network *net, int af);
 const char      *net_domain(const struct network *net);
 struct dnsc     *net_dnsc(const struct network *net);
+int  net_nat_set(struct network *net, const struct sa *laddr,
+		 const struct nat_behavior *nb);
+const struct nat_behavior *net_nat_get(const struct network *net,
+				       const struct sa *laddr);
+uint32_t net_keepalive(const struct network *net, int af, uint32_t dflt);
 
 
 /*
@@ -500,6 +654,162 @@ void play_close(void);
 void play_set_path(const char *path);
 
 
+/*
+ * SIMD - instruction set selection
+ */
+
+/** SIMD implementations */
+enum simd_impl {
+	SIMD_C = 0,      /**< Portable C code                */
+	SIMD_SSE2,       /**< x86 SSE2                       */
+	SIMD_AVX2,       /**< x86 AVX2                       */
+	SIMD_NEON,       /**< ARM NEON                       */
+	SIMD_N
+};
+
+bool simd_supported(enum simd_impl impl);
+enum simd_impl simd_best(void);
+const char *simd_name(enum simd_impl impl);
+
+
+/*
+ * Audio level meter
+ */
+
+/** Audio level of one direction, read without locking */
+struct aulevel {
+	int32_t rms;          /**< RMS level in [0.01 dBov]     */
+	int32_t peak;         /**< Peak level in [0.01 dBov]    */
+	uint32_t n;           /**< Number of measured frames    */
+};
+
+void aulevel_calc(const int16_t *sampv, size_t sampc,
+		  uint64_t *sumsq, uint16_t *peak);
+void aulevel_calc_impl(enum simd_impl impl, const int16_t *sampv,
+		       size_t sampc, uint64_t *sumsq, uint16_t *peak);
+void aulevel_update(struct aulevel *lvl, const int16_t *sampv,
+		    size_t sampc);
+int  aulevel_get(const struct aulevel *lvl, double *rms, double *peak);
+uint8_t aulevel_dbov(const int16_t *sampv, size_t sampc);
+
+
+/*
+ * RTP Header Extensions (RFC 8285)
+ */
+
+/** Built-in header extensions */
+enum rtpext_type {
+	RTPEXT_AUDIO_LEVEL = 0,  /**< Audio level (RFC 6464)             */
+	RTPEXT_ABS_SEND_TIME,    /**< Absolute send time                 */
+	RTPEXT_TRANSPORT_CC,     /**< Transport-wide sequence number     */
+
+	RTPEXT_MAX
+};
+
+enum {
+	RTPEXT_TYPE_MAGIC = 0xbede, /**< One-byte header form            */
+	RTPEXT_HDR_SIZE   = 4,      /**< Extension header                */
+	RTPEXT_ID_MIN     = 1,      /**< Lowest ID of an element         */
+	RTPEXT_ID_MAX     = 14,     /**< Highest ID of an element        */
+	RTPEXT_LEN_MAX    = 16,     /**< Longest element data            */
+	RTPEXT_PRESZ      = 16,     /**< Headroom for built-in elements  */
+};
+
+/** One element of a header extension */
+struct rtpext {
+	unsigned id;                   /**< Local identifier, 1-14      */
+	size_t len;                    /**< Length of data, 1-16        */
+	uint8_t data[RTPEXT_LEN_MAX];  /**< Element data                */
+};
+
+const char *rtpext_uri(enum rtpext_type type);
+int  rtpext_find(const struct pl *uri);
+int  rtpext_hdr_encode(struct mbuf *mb, size_t num_bytes);
+int  rtpext_encode(struct mbuf *mb, unsigned id, size_t len,
+		   const uint8_t *data);
+int  rtpext_decode(struct rtpext *ext, struct mbuf *mb);
+uint32_t rtpext_abs_send_time(uint64_t us);
+
+
+/*
+ * Audio mixing
+ */
+
+void aumix_acc(int32_t *accv, const int16_t *sampv, size_t n);
+void aumix_acc_impl(enum simd_impl impl, int32_t *accv,
+		    const int16_t *sampv, size_t n);
+void aumix_mix(int16_t *dst, const int32_t *accv, const int16_t *own,
+	       size_t n);
+void aumix_mix_impl(enum simd_impl impl, int16_t *dst, const int32_t *accv,
+		    const int16_t *own, size_t n);
+
+
+/*
+ * Audio sample format conversion
+ */
+
+void ausamp_to_float(float *dst, const int16_t *src, size_t n);
+void ausamp_to_s16(int16_t *dst, const float *src, size_t n);
+
+
+/*
+ * Audio filter chain
+ */
+
+struct aufilt_chain;
+
+int  aufilt_chain_alloc(struct aufilt_chain **chp, size_t maxc);
+int  aufilt_chain_encode(struct aufilt_chain *ch, const struct list *filtl,
+			 int16_t *sampv, size_t *sampc);
+int  aufilt_chain_decode(struct aufilt_chain *ch, const struct list *filtl,
+			 int16_t *sampv, size_t *sampc);
+uint64_t aufilt_chain_convc(const struct aufilt_chain *ch);
+void aufilt_chain_set_simd(struct aufilt_chain *ch, enum simd_impl impl);
+
+
+/*
+ * G.711 batch kernels
+ */
+
+enum g711_law {
+	G711_ULAW = 0,
+	G711_ALAW,
+};
+
+void g711_batch_init(void);
+void g711_encode_batch(enum g711_law law, uint8_t *dst, const int16_t *src,
+		       size_t n);
+void g711_decode_batch(enum g711_law law, int16_t *dst, const uint8_t *src,
+		       size_t n);
+void g711_decode_batch_impl(enum simd_impl impl, enum g711_law law,
+			    int16_t *dst, const uint8_t *src, size_t n);
+
+
+/*
+ * L16 byte-order kernels
+ */
+
+void l16_encode(uint8_t *dst, const int16_t *src, size_t n);
+void l16_decode(int16_t *dst, const uint8_t *src, size_t n);
+void l16_swap_impl(enum simd_impl impl, uint8_t *dst, const uint8_t *src,
+		   size_t n);
+
+
+/*
+ * Audio resampler
+ */
+
+struct resamp;
+
+int  resamp_alloc(struct resamp **rsp, enum resamp_backend be,
+		  uint32_t irate, unsigned ich, uint32_t orate, unsigned och);
+int  resamp_process(struct resamp *rs, int16_t *outv, size_t *outc,
+		    const int16_t *inv, size_t inc);
+void resamp_set_simd(struct resamp *rs, enum simd_impl impl);
+size_t resamp_outc(const struct resamp *rs, size_t inc);
+const char *resamp_backend_name(enum resamp_backend be);
+
+
 /*
  * User Agent
  */
@@ -523,6 +833,7 @@ enum ua_event {
 	UA_EVENT_CALL_TRANSFER_FAILED,
 	UA_EVENT_CALL_DTMF_START,
 	UA_EVENT_CALL_DTMF_END,
+	UA_EVENT_CALL_QUALITY,
 
 	UA_EVENT_MAX,
 };
@@ -567,6 +878,7 @@ struct account *ua_account(const struct ua *ua);
 const char     *ua_outbound(const struct ua *ua);
 struct call    *ua_call(const struct ua *ua);
 struct call    *ua_prev_call(const struct ua *ua);
+struct call    *ua_find_call(const struct ua *ua, const char *id);
 struct account *ua_prm(const struct ua *ua);
 struct list    *ua_calls(const struct ua *ua);
 enum presence_status ua_presence_status(const struct ua *ua);
@@ -582,6 +894,10 @@ void ua_stop_all(bool forced);
 void uag_set_exit_handler(ua_exit_h *exith, void *arg);
 int  uag_reset_transp(bool reg, bool reinvite);
 int  uag_event_register(ua_event_h *eh, void *arg);
+int  uag_drain(bool enable, const char *uri);
+bool uag_draining(void);
+int  uag_event_subscribe(ua_event_h *eh, void *arg, uint32_t mask,
+			 uint32_t qmax);
 void uag_event_unregister(ua_event_h *eh);
 void uag_set_sub_handler(sip_msg_h *subh);
 int  ua_print_sip_status(struct re_printf *pf, void *unused);
@@ -656,6 +972,8 @@ struct cmd_ctx;
 int  cmd_register(const struct cmd *cmdv, size_t cmdc);
 void cmd_unregister(const struct cmd *cmdv);
 int  cmd_process(struct cmd_ctx **ctxp, char key, struct re_printf *pf);
+int  cmd_exec(char key, const char *prm, struct re_printf *pf);
+unsigned cmd_exec_lines(struct re_printf *pf, struct pl *pl, bool eof);
 int  cmd_print(struct re_printf *pf, void *unused);
 
 
@@ -666,10 +984,20 @@ int  cmd_print(struct re_printf *pf, void *unused);
 struct vidsrc;
 struct vidsrc_st;
 
+/**
+ * Send an encoded access unit of a video source, with no decode and
+ * encode. The timestamp is in the 90 kHz clock of RTP.
+ *
+ * @return 0 if sent, ENOTSUP if the stream encodes another codec
+ */
+typedef int  (vidsrc_packet_h)(const char *codec, const uint8_t *buf,
+			       size_t len, uint32_t ts, void *arg);
+
 /** Video Source parameters */
 struct vidsrc_prm {
 	int orient;       /**< Wanted picture orientation (enum vidorient) */
 	int fps;          /**< Wanted framerate                            */
+	vidsrc_packet_h *pkth; /**< Encoded access units, optional         */
 };
 
 typedef void (vidsrc_frame_h)(struct vidframe *frame, void *arg);
@@ -694,6 +1022,23 @@ int vidsrc_alloc(struct vidsrc_st **stp, const char *name,
 		 const struct vidsz *size, const char *fmt, const char *dev,
 		 vidsrc_frame_h *frameh, vidsrc_error_h *errorh, void *arg);
 
+struct dmabuf;
+
+int vidsrc_dmabuf_add(struct dmabuf **dbp, const void *data, size_t len,
+		      int fd);
+int vidsrc_dmabuf_fd(const struct vidframe *frame, size_t offv[4],
+		     size_t *lenp);
+
+struct vidhub_st;
+
+int  vidhub_alloc(struct vidhub_st **stp, const char *name,
+		  struct vidsrc_prm *prm, const struct vidsz *size,
+		  const char *dev, enum vidfmt fmt,
+		  vidsrc_frame_h *frameh, vidsrc_error_h *errorh, void *arg);
+void vidhub_update(struct vidhub_st *st, struct vidsrc_prm *prm,
+		   const char *dev);
+const struct vidsrc *vidhub_vidsrc(const struct vidhub_st *st);
+
 
 /*
  * Video Display
@@ -705,6 +1050,9 @@ struct vidisp_st;
 /** Video Display parameters */
 struct vidisp_prm {
 	void *view;  /**< Optional view (set by application or module) */
+	unsigned width;   /**< Largest width shown, 0 for any     */
+	unsigned height;  /**< Largest height shown, 0 for any    */
+	unsigned fps;     /**< Highest framerate shown, 0 for any */
 };
 
 typedef void (vidisp_resize_h)(const struct vidsz *size, void *arg);
@@ -719,6 +1067,21 @@ typedef int  (vidisp_disp_h)(struct vidisp_st *st, const char *title,
 			     const struct vidframe *frame);
 typedef void (vidisp_hide_h)(struct vidisp_st *st);
 
+/** A tile of a composed video display, the picture of one call */
+struct vidisp_tile {
+	unsigned id;                   /**< Tile identifier, unique      */
+	const struct vidrect *rect;    /**< Area in the canvas           */
+	const struct vidframe *frame;  /**< New picture, NULL if the same */
+};
+
+/**
+ * Draw all tiles of a composed display. Tiles that are not in the list
+ * any more are removed, and only tiles with a frame have a new picture.
+ */
+typedef int  (vidisp_compose_h)(struct vidisp_st *st, const char *title,
+				const struct vidsz *canvas,
+				const struct vidisp_tile *tilev, size_t tilec);
+
 int vidisp_register(struct vidisp **vp, const char *name,
 		    vidisp_alloc_h *alloch, vidisp_update_h *updateh,
 		    vidisp_disp_h *disph, vidisp_hide_h *hideh);
@@ -728,6 +1091,13 @@ int vidisp_alloc(struct vidisp_st **stp, const char *name,
 int vidisp_display(struct vidisp_st *st, const char *title,
 		   const struct vidframe *frame);
 const struct vidisp *vidisp_find(const char *name);
+void vidisp_set_compose(struct vidisp *vd, vidisp_compose_h *composeh);
+
+int  vidcomp_alloc(struct vidisp_st **stp, const char *name,
+		   struct vidisp_prm *prm, const char *dev,
+		   enum vidcomp_layout layout);
+void vidcomp_set_focus(struct vidisp_st *st);
+const char *vidcomp_layout_name(enum vidcomp_layout layout);
 
 
 /*
@@ -755,6 +1125,18 @@ typedef int (audec_decode_h)(struct audec_state *ads, int16_t *sampv,
 			     size_t *sampc, const uint8_t *buf, size_t len);
 typedef int (audec_plc_h)(struct audec_state *ads,
 			  int16_t *sampv, size_t *sampc);
+typedef int (audec_fec_h)(struct audec_state *ads, int16_t *sampv,
+			  size_t *sampc, const uint8_t *buf, size_t len);
+typedef int (auenc_loss_h)(struct auenc_state *aes, unsigned loss_pct);
+typedef int (auenc_rate_h)(struct auenc_state *aes, int step);
+typedef int (auenc_cplx_h)(struct auenc_state *aes, unsigned level);
+typedef uint32_t (auenc_dur_h)(const struct auenc_state *aes);
+typedef int (audec_reset_h)(struct audec_state *ads);
+
+/** Codec complexity levels, from the configured one down */
+enum {
+	CPLX_LEVEL_MAX = 2,         /* 0=configured, 1=reduced, 2=lowest */
+};
 
 struct aucodec {
 	struct le le;
@@ -771,6 +1153,21 @@ struct aucodec {
 	audec_plc_h    *plch;
 	sdp_fmtp_enc_h *fmtp_ench;
 	sdp_fmtp_cmp_h *fmtp_cmph;
+	uint32_t ptime;             /* Fixed frame length [ms], optional.
+				     * The payload format allows several
+				     * frames per RTP packet */
+	auenc_loss_h   *lossh;      /* Packet loss reported by the peer */
+	audec_fec_h    *fech;       /* Recover lost frame from next one */
+	auenc_rate_h   *rateh;      /* Step the bitrate down (step < 0)
+				     * or up, ERANGE at the limit */
+	auenc_cplx_h   *cplxh;      /* Set the complexity level */
+	auenc_dur_h    *durh;       /* RTP duration of the last encoded
+				     * data, for variable frames */
+	bool heavy;                 /* Much more work per frame than
+				     * G.711, worth a worker thread */
+	audec_reset_h  *resetth;    /* Reset the decoder state, so it is
+				     * kept for a switch back */
+	struct le le_name;          /* Index by name, set on register */
 };
 
 void aucodec_register(struct aucodec *ac);
@@ -778,18 +1175,17 @@ void aucodec_unregister(struct aucodec *ac);
 const struct aucodec *aucodec_find(const char *name, uint32_t srate,
 				   uint8_t ch);
 struct list *aucodec_list(void);
+int  aucodec_bench(struct re_printf *pf, void *unused);
 
 
 /*
  * Video Codec
  */
 
-/** Video Codec parameters */
-struct videnc_param {
-	unsigned bitrate;  /**< Encoder bitrate in [bit/s] */
-	unsigned pktsize;  /**< RTP packetsize in [bytes]  */
-	unsigned fps;      /**< Video framerate            */
-	uint32_t max_fs;
+/** Room around a packet given to videnc_packet_mb_h */
+enum {
+	VIDENC_PRESZ   = 4 + RTP_HEADER_SIZE + RTPEXT_PRESZ, /**< Headroom */
+	VIDENC_TRAILSZ = 12 + 4,            /**< Tailroom for SRTP trailer */
 };
 
 struct videnc_state;
@@ -799,6 +1195,25 @@ struct vidcodec;
 typedef int (videnc_packet_h)(bool marker, const uint8_t *hdr, size_t hdr_len,
 			      const uint8_t *pld, size_t pld_len, void *arg);
 
+/**
+ * Packet handler without copy. The packet is from mb->pos to mb->end,
+ * with at least VIDENC_PRESZ bytes of headroom in front of mb->pos, and
+ * should have VIDENC_TRAILSZ bytes of tailroom, so that SRTP does not
+ * grow the buffer.
+ * The handler keeps a reference to the buffer, so the encoder must
+ * not write to it again.
+ */
+typedef int (videnc_packet_mb_h)(bool marker, struct mbuf *mb, void *arg);
+
+/** Video Codec parameters */
+struct videnc_param {
+	unsigned bitrate;  /**< Encoder bitrate in [bit/s] */
+	unsigned pktsize;  /**< RTP packetsize in [bytes]  */
+	unsigned fps;      /**< Video framerate            */
+	uint32_t max_fs;
+	videnc_packet_mb_h *pkth_mb;  /**< Optional, same arg as pkth */
+};
+
 typedef int (videnc_update_h)(struct videnc_state **vesp,
 			      const struct vidcodec *vc,
 			      struct videnc_param *prm, const char *fmtp,
@@ -810,6 +1225,28 @@ typedef int (viddec_update_h)(struct viddec_state **vdsp,
 			      const struct vidcodec *vc, const char *fmtp);
 typedef int (viddec_decode_h)(struct viddec_state *vds, struct vidframe *frame,
 			      bool marker, uint16_t seq, struct mbuf *mb);
+typedef int (videnc_debug_h)(struct re_printf *pf,
+			     const struct videnc_state *ves);
+typedef int (viddec_debug_h)(struct re_printf *pf,
+			     const struct viddec_state *vds);
+typedef int (videnc_bitrate_h)(struct videnc_state *ves, uint32_t bitrate);
+typedef int (videnc_cplx_h)(struct videnc_state *ves, unsigned level);
+
+/**
+ * Decode at a reduced size of 1/2^lowres, and skip the pictures that
+ * are not references, if the display does not need all of them
+ */
+typedef int (viddec_lowres_h)(struct viddec_state *vds, unsigned lowres,
+			      bool skip_nonref);
+
+/** Reset the decoder, it starts again at the next keyframe */
+typedef int (viddec_reset_h)(struct viddec_state *vds);
+
+/**
+ * Initialise the codec library, before the first encoder or decoder.
+ * Codecs sharing a library may share the handler, it is called once.
+ */
+typedef int (vidcodec_init_h)(void);
 
 struct vidcodec {
 	struct le le;
@@ -823,6 +1260,15 @@ struct vidcodec {
 	viddec_decode_h *dech;
 	sdp_fmtp_enc_h *fmtp_ench;
 	sdp_fmtp_cmp_h *fmtp_cmph;
+	videnc_debug_h *encdebugh;   /**< Optional, e.g. for threads   */
+	viddec_debug_h *decdebugh;   /**< Optional, e.g. for threads   */
+	videnc_bitrate_h *bitrateh;  /**< Optional, bitrate w/o restart */
+	videnc_cplx_h *cplxh;        /**< Optional, complexity level    */
+	viddec_lowres_h *lowresh;    /**< Optional, reduced decoding    */
+	viddec_reset_h *resetth;     /**< Optional, keep for PT flips   */
+	vidcodec_init_h *inith;      /**< Optional, deferred init       */
+	bool enc_nv12;               /**< Encoder also takes NV12 frames */
+	struct le le_name;           /**< Index by name, set on register*/
 };
 
 void vidcodec_register(struct vidcodec *vc);
@@ -830,7 +1276,9 @@ void vidcodec_unregister(struct vidcodec *vc);
 const struct vidcodec *vidcodec_find(const char *name, const char *variant);
 const struct vidcodec *vidcodec_find_encoder(const char *name);
 const struct vidcodec *vidcodec_find_decoder(const char *name);
+int vidcodec_init(const struct vidcodec *vc);
 struct list *vidcodec_list(void);
+struct mbuf *videnc_pkt_get(struct mbuf **pktv, size_t pktc, size_t size);
 
 
 /*
@@ -867,6 +1315,7 @@ struct vidfilt {
 	vidfilt_encode_h *ench;
 	vidfilt_decupd_h *decupdh;
 	vidfilt_decode_h *dech;
+	bool enc_readonly;          /**< Encode handler does not modify frame */
 };
 
 void vidfilt_register(struct vidfilt *vf);
@@ -878,19 +1327,274 @@ int vidfilt_dec_append(struct list *filtl, void **ctx,
 		       const struct vidfilt *vf);
 
 
+/*
+ * Media stream
+ */
+
+struct stream;
+struct impair_prm;
+struct impair_stat;
+
+/** Statistics for one direction of a media stream */
+struct stream_stat {
+	uint32_t n_packets;       /**< Number of packets                */
+	uint32_t n_bytes;         /**< Number of bytes                  */
+	uint32_t n_err;           /**< Number of errors                 */
+	uint32_t bitrate;         /**< Average over 3 seconds [bit/s]    */
+	uint32_t peak_bitrate;    /**< Peak of 100 ms windows [bit/s]    */
+	const struct histo *iat;  /**< Packet inter-arrival time [us]   */
+	const struct histo *jbuf; /**< Jitter-buffer delay [us]         */
+	const struct histo *proc; /**< Encode or decode time [us]       */
+};
+
+/** Continuous quality estimate of a received audio stream */
+struct stream_quality {
+	double mos;               /**< MOS of the last second, 1 to 5   */
+	double mos_min;           /**< Lowest MOS                       */
+	double r_factor;          /**< R-factor of the last second      */
+	double loss;              /**< Smoothed packet loss in [%]      */
+	double jitter;            /**< Interarrival jitter in [ms]      */
+	uint32_t n_alerts;        /**< Times the MOS fell below alert   */
+	bool alert;               /**< MOS is below the alert threshold */
+};
+
+const char *stream_name(const struct stream *s);
+int  stream_stats(const struct stream *s, struct stream_stat *tx,
+		  struct stream_stat *rx);
+int  stream_quality(const struct stream *s, struct stream_quality *q);
+const struct rtcpxr_voip *stream_rtcpxr(const struct stream *s);
+const struct seqwin *stream_seqwin(const struct stream *s);
+const struct rtcp_stats *stream_rtcp_stats(const struct stream *s);
+int  stream_jbuf_stats(const struct stream *s, struct jbuf_stat *stat);
+int  stream_impair(struct stream *s, const struct impair_prm *prm);
+int  stream_impair_stats(const struct stream *s, struct impair_stat *stat);
+
+
+/*
+ * Receive bandwidth estimation
+ */
+
+struct bwe;
+
+int  bwe_alloc(struct bwe **bwep, uint32_t srate, uint32_t rate_min,
+	       uint32_t rate_max);
+void bwe_packet(struct bwe *bwe, uint64_t now, uint32_t ts, size_t size);
+uint32_t bwe_estimate(const struct bwe *bwe);
+int  bwe_remb_encode(struct mbuf *mb, uint32_t bitrate, uint32_t ssrc);
+int  bwe_remb_decode(uint32_t *bitrate, struct mbuf *mb);
+int  bwe_debug(struct re_printf *pf, const struct bwe *bwe);
+
+
+/*
+ * RTCP XR VoIP Metrics (RFC 3611)
+ */
+
+/** VoIP Metrics Report Block, units as on the wire */
+struct rtcpxr_voip {
+	uint32_t ssrc;            /**< SSRC of the reported source      */
+	uint8_t loss_rate;        /**< Lost packets, fraction of 256    */
+	uint8_t discard_rate;     /**< Discarded packets, of 256        */
+	uint8_t burst_density;    /**< Loss in bursts, of 256           */
+	uint8_t gap_density;      /**< Loss in gaps, of 256             */
+	uint16_t burst_duration;  /**< Mean burst duration [ms]         */
+	uint16_t gap_duration;    /**< Mean gap duration [ms]           */
+	uint16_t rtd;             /**< Round-trip delay [ms]            */
+	uint16_t esd;             /**< End-system delay [ms]            */
+	int8_t signal_level;      /**< Signal level [dBm0], 127 is n/a  */
+	int8_t noise_level;       /**< Noise level [dBm0], 127 is n/a   */
+	uint8_t rerl;             /**< Residual echo return loss [dB]   */
+	uint8_t gmin;             /**< Gap threshold in packets         */
+	uint8_t r_factor;         /**< R-factor, 127 is n/a             */
+	uint8_t ext_r_factor;     /**< External R-factor, 127 is n/a    */
+	uint8_t mos_lq;           /**< Listening MOS times 10           */
+	uint8_t mos_cq;           /**< Conversational MOS times 10      */
+	uint8_t rx_config;        /**< PLC and jitter-buffer type       */
+	uint16_t jb_nominal;      /**< Jitter-buffer nominal delay [ms] */
+	uint16_t jb_max;          /**< Jitter-buffer maximum delay [ms] */
+	uint16_t jb_abs_max;      /**< Jitter-buffer absolute max [ms]  */
+};
+
+/** Receive statistics for XR, with O(1) state */
+struct rtcpxr {
+	uint32_t n_rx;            /**< Packets received                 */
+	uint32_t n_lost;          /**< Packets lost                     */
+	uint32_t pkt, lost;       /**< Current run, of RFC 3611 A.2     */
+	uint32_t c11, c13, c14;   /**< Transition counters              */
+	uint32_t c22, c23, c33;
+	uint32_t ptime;           /**< Packet duration [ms]             */
+	uint32_t ts_prev;         /**< RTP timestamp of last packet     */
+	uint16_t seq_max;         /**< Highest sequence number          */
+	bool started;             /**< seq_max is valid                 */
+};
+
+void rtcpxr_packet(struct rtcpxr *xr, uint16_t seq, uint32_t ts,
+		   uint32_t srate);
+void rtcpxr_reorder(struct rtcpxr *xr);
+void rtcpxr_voip_init(struct rtcpxr_voip *v, uint32_t ssrc);
+void rtcpxr_voip_calc(struct rtcpxr_voip *v, const struct rtcpxr *xr,
+		      uint32_t discard);
+int  rtcpxr_voip_encode(struct mbuf *mb, uint32_t ssrc,
+			const struct rtcpxr_voip *v);
+int  rtcpxr_voip_decode(struct rtcpxr_voip *v, struct mbuf *mb);
+int  rtcpxr_voip_debug(struct re_printf *pf, const struct rtcpxr_voip *v);
+
+
+/*
+ * Window of received RTP sequence numbers
+ */
+
+enum {
+	SEQWIN_BURSTS = 8,      /**< Burst lengths 1-4, to 8, 16, 32, more */
+};
+
+/** What a received packet is */
+enum seqwin_res {
+	SEQWIN_NEW = 0,         /**< Newest packet, maybe after a gap */
+	SEQWIN_REORDER,         /**< Older packet that filled a gap   */
+	SEQWIN_DUP,             /**< Received before                  */
+	SEQWIN_LATE,            /**< Older than the window            */
+	SEQWIN_RESTART,         /**< Jump, the window was restarted   */
+};
+
+/** Window of received RTP sequence numbers, zero is initialized */
+struct seqwin {
+	uint64_t bits;          /**< Received, bit 0 is max           */
+	uint32_t valid;         /**< Bits in use                      */
+	uint32_t gap;           /**< Missing before the newest packet */
+	uint16_t max;           /**< Highest sequence number          */
+	bool started;           /**< max is valid                     */
+	uint64_t n_rx;          /**< Packets received, no duplicates  */
+	uint64_t n_final;       /**< Sequence numbers out of window   */
+	uint64_t n_lost;        /**< ... and missing                  */
+	uint32_t n_dup;         /**< Duplicate packets                */
+	uint32_t n_reorder;     /**< Reordered packets                */
+	uint32_t n_late;        /**< Packets older than the window    */
+	uint32_t n_restart;     /**< Sequence number jumps            */
+	uint32_t reorder_max;   /**< Deepest reordering [packets]     */
+	uint32_t burst;         /**< Current loss burst               */
+	uint32_t burstv[SEQWIN_BURSTS]; /**< Loss bursts by length     */
+	uint64_t iv_final;      /**< n_final at start of interval     */
+	uint64_t iv_lost;       /**< n_lost at start of interval      */
+};
+
+enum seqwin_res seqwin_update(struct seqwin *w, uint16_t seq);
+void seqwin_restart(struct seqwin *w);
+uint64_t seqwin_lost(const struct seqwin *w);
+void seqwin_interval(struct seqwin *w, uint64_t *expected, uint64_t *lost);
+int  seqwin_debug(struct re_printf *pf, const struct seqwin *w);
+
+
+/*
+ * RTP retransmission (RFC 4588)
+ */
+
+struct rtx;
+
+int  rtx_alloc(struct rtx **rtxp, uint32_t pktc, uint32_t rate);
+void rtx_store(struct rtx *rtx, bool marker, uint32_t ts,
+	       const struct mbuf *mb);
+void rtx_commit(struct rtx *rtx, uint16_t seq, uint64_t now);
+int  rtx_encode(struct rtx *rtx, struct mbuf **mbp, size_t presz,
+		uint16_t seq, uint64_t now, bool *marker, uint32_t *ts);
+int  rtx_decode(struct mbuf *mb, uint16_t *seq);
+int  rtx_debug(struct re_printf *pf, const struct rtx *rtx);
+
+
+/*
+ * Forward error correction (RFC 8627)
+ */
+
+struct fecenc;
+struct fecdec;
+
+int  fecenc_alloc(struct fecenc **encp, uint32_t ratio);
+void fecenc_set_loss(struct fecenc *enc, uint32_t loss);
+uint32_t fecenc_ratio(const struct fecenc *enc);
+void fecenc_store(struct fecenc *enc, bool marker, uint8_t pt, uint32_t ts,
+		  const struct mbuf *mb);
+int  fecenc_commit(struct fecenc *enc, uint16_t seq, size_t presz,
+		   struct mbuf **mbp);
+int  fecenc_debug(struct re_printf *pf, const struct fecenc *enc);
+int  fecdec_alloc(struct fecdec **decp);
+void fecdec_source(struct fecdec *dec, const struct rtp_header *hdr,
+		   const struct mbuf *mb);
+int  fecdec_repair(struct fecdec *dec, struct mbuf *mb);
+int  fecdec_recover(struct fecdec *dec, struct rtp_header *hdr,
+		    struct mbuf **mbp);
+int  fecdec_debug(struct re_printf *pf, const struct fecdec *dec);
+
+
+/*
+ * RTP demultiplexing by synchronization source
+ */
+
+/** Role of a received synchronization source */
+enum rtp_role {
+	RTP_ROLE_PRIMARY = 0,   /**< Media                          */
+	RTP_ROLE_RTX,           /**< Retransmissions (RFC 4588)     */
+	RTP_ROLE_FEC,           /**< FlexFEC repair packets         */
+};
+
+/** A received synchronization source */
+struct rtpdemux_entry {
+	uint32_t ssrc;          /**< Synchronization source         */
+	uint8_t pt;             /**< Last payload type              */
+	bool used;              /**< Slot is in use                 */
+	enum rtp_role role;     /**< Role of the source             */
+	void *arg;              /**< Stream of the source           */
+	uint64_t last;          /**< Time of the last packet [ms]   */
+	uint32_t ival;          /**< Average packet interval [ms]   */
+	uint32_t n_drop;        /**< Packets dropped                */
+	uint64_t n_pkt;         /**< Packets received               */
+	uint64_t n_bytes;       /**< Bytes received                 */
+};
+
+struct rtpdemux;
+
+int  rtpdemux_alloc(struct rtpdemux **dmp);
+struct rtpdemux_entry *rtpdemux_lookup(const struct rtpdemux *dm,
+				       uint32_t ssrc);
+struct rtpdemux_entry *rtpdemux_add(struct rtpdemux *dm, uint32_t ssrc,
+				    uint8_t pt, enum rtp_role role,
+				    void *arg);
+void rtpdemux_packet(struct rtpdemux_entry *e, size_t len, uint64_t now);
+void rtpdemux_remove(struct rtpdemux *dm, const void *arg);
+uint32_t rtpdemux_count(const struct rtpdemux *dm);
+int  rtpdemux_debug(struct re_printf *pf, const struct rtpdemux *dm);
+
+
 /*
  * Audio stream
  */
 
 struct audio;
 
+/** Counters of the receive direction of an audio stream */
+struct audio_rxstat {
+	uint32_t n_fec;         /**< Frames recovered by FEC         */
+	uint32_t n_late;        /**< Frames late from the jbuf       */
+	uint32_t n_plc;         /**< Frames concealed                */
+	uint32_t n_accel;       /**< Frames shortened                */
+	uint32_t n_expand;      /**< Frames lengthened               */
+};
+
+struct stream *audio_strm(const struct audio *a);
+const struct aucodec *audio_codec(const struct audio *a, bool tx);
+
 void audio_mute(struct audio *a, bool muted);
 bool audio_ismuted(const struct audio *a);
 void audio_set_devicename(struct audio *a, const char *src, const char *play);
 int  audio_set_source(struct audio *au, const char *mod, const char *device);
 int  audio_set_player(struct audio *au, const char *mod, const char *device);
 void audio_encoder_cycle(struct audio *audio);
+int  audio_relay(struct audio *a, struct audio *peer);
+int  audio_moh(struct audio *a, bool enable);
+int  audio_prompt(struct audio *a, const char *filename, int repeat);
 int  audio_debug(struct re_printf *pf, const struct audio *a);
+int  audio_level(const struct audio *a, bool tx, double *rms, double *peak);
+int  audio_level_rtp(const struct audio *a, double *level, bool *voice);
+int  audio_rx_stats(const struct audio *a, struct audio_rxstat *st);
+void audio_set_cplx(struct audio *a, unsigned level);
 
 
 /*
@@ -899,15 +1603,72 @@ int  audio_debug(struct re_printf *pf, const struct audio *a);
 
 struct video;
 
+/** Counters of a video stream */
+struct video_stat {
+	uint32_t n_frames_tx;     /**< Frames sent                      */
+	uint32_t n_frames_rx;     /**< Frames received                  */
+	int efps_tx;              /**< Estimated frame-rate sent        */
+	int efps_rx;              /**< Estimated frame-rate received    */
+	uint32_t n_skip;          /**< Frames skipped by the sender     */
+	uint32_t n_skip_queue;    /**< Skipped, send queue too long     */
+	uint32_t n_decim;         /**< Frames received, not displayed   */
+	uint32_t n_picup;         /**< Picture updates sent             */
+	uint32_t bitrate;         /**< Current encoder bitrate [bit/s]  */
+	unsigned width, height;   /**< Size of the source               */
+	unsigned deg;             /**< Degradation step, 0 is none      */
+};
+
+struct stream *video_strm(const struct video *v);
+
 void  video_mute(struct video *v, bool muted);
 void *video_view(const struct video *v);
 int   video_set_fullscreen(struct video *v, bool fs);
+void  video_set_focus(struct video *v);
+void  video_set_display_limit(struct video *v, unsigned width,
+			      unsigned height, unsigned fps);
 int   video_set_orient(struct video *v, int orient);
 void  video_vidsrc_set_device(struct video *v, const char *dev);
 int   video_set_source(struct video *v, const char *name, const char *dev);
 void  video_set_devicename(struct video *v, const char *src, const char *disp);
 void  video_encoder_cycle(struct video *video);
+int   video_forward(struct video *v, struct video *src);
 int   video_debug(struct re_printf *pf, const struct video *v);
+int   video_stats(const struct video *v, struct video_stat *st);
+void  video_set_cplx(struct video *v, unsigned level);
+
+
+/*
+ * Call statistics
+ */
+
+/** One direction of a media stream of a call */
+struct call_dirstat {
+	uint32_t n_packets;       /**< Number of packets                */
+	uint32_t n_bytes;         /**< Number of bytes                  */
+	uint32_t n_err;           /**< Number of errors                 */
+	uint32_t bitrate;         /**< Average over 3 seconds [bit/s]   */
+	uint32_t peak_bitrate;    /**< Peak of 100 ms windows [bit/s]   */
+};
+
+/** One media stream of a call */
+struct call_mediastat {
+	bool active;              /**< The call has this stream         */
+	struct call_dirstat tx;   /**< Sent                             */
+	struct call_dirstat rx;   /**< Received                         */
+	struct rtcp_stats rtcp;   /**< From the last RTCP report        */
+	struct jbuf_stat jbuf;    /**< Jitter-buffer, if any            */
+};
+
+/** Snapshot of the counters of a call, see call_stats_get() */
+struct call_stats {
+	uint32_t duration;               /**< Call duration in [s]      */
+	struct call_mediastat audio;     /**< Audio stream              */
+	struct call_mediastat video;     /**< Video stream              */
+	struct audio_rxstat audio_rx;    /**< Received audio frames     */
+	struct stream_quality quality;   /**< Received audio quality    */
+	bool quality_valid;              /**< The quality is estimated  */
+	struct video_stat vid;           /**< Video frames              */
+};
 
 
 /*
@@ -942,6 +1703,9 @@ int mnat_register(struct mnat **mnatp, const char *id, const char *ftag,
  * Real-time
  */
 int realtime_enable(bool enable, int fps);
+int realtime_thread(const char *name);
+int realtime_mlockall(void);
+const char *sched_policy_name(enum sched_policy policy);
 
 
 /*
@@ -955,6 +1719,7 @@ int  sdp_fingerprint_decode(const char *attr, struct pl *hash,
 uint32_t sdp_media_rattr_u32(const struct sdp_media *sdpm, const char *name);
 const char *sdp_rattr(const struct sdp_session *s, const struct sdp_media *m,
 		      const char *name);
+int  sdp_bundle_find(const char *val, const char *mid);
 
 
 /*
@@ -1028,9 +1793,18 @@ int h264_fu_hdr_encode(const struct h264_fu *fu, struct mbuf *mb);
 int h264_fu_hdr_decode(struct h264_fu *fu, struct mbuf *mb);
 
 const uint8_t *h264_find_startcode(const uint8_t *p, const uint8_t *end);
+const uint8_t *h264_find_startcode_impl(enum simd_impl impl,
+					const uint8_t *p, const uint8_t *end);
+
+/** H.264 packetization flags */
+enum h264_pkt_flags {
+	H264_PKT_STAP_A = 1<<0,  /**< Aggregate small NAL units (STAP-A) */
+};
 
 int h264_packetize(const uint8_t *buf, size_t len, size_t pktsize,
 		   videnc_packet_h *pkth, void *arg);
+int h264_packetize_ext(const uint8_t *buf, size_t len, size_t pktsize,
+		       unsigned flags, videnc_packet_h *pkth, void *arg);
 int h264_nal_send(bool first, bool last,
 		  bool marker, uint32_t ihdr, const uint8_t *buf,
 		  size_t size, size_t maxsz,
@@ -1041,6 +1815,40 @@ static inline bool h264_is_keyframe(int type)
 }
 
 
+/*
+ * Video conversion
+ */
+
+void vidconv_fast(struct vidframe *dst, const struct vidframe *src,
+		  struct vidrect *r);
+int  vidconv_fast_impl(enum simd_impl impl, struct vidframe *dst,
+		       const struct vidframe *src);
+int  vidconv_scale(struct vidframe *dst, const struct vidframe *src,
+		   const struct vidrect *r);
+int  vidconv_scale_impl(enum simd_impl impl, struct vidframe *dst,
+			const struct vidframe *src, const struct vidrect *r);
+void vidconv_blend(uint8_t *d, size_t ls, const uint16_t *mul,
+		   const uint16_t *add, unsigned w, unsigned h);
+int  vidconv_blend_impl(enum simd_impl impl, uint8_t *d, size_t ls,
+			const uint16_t *mul, const uint16_t *add,
+			unsigned w, unsigned h);
+
+
+/*
+ * Video frame pool
+ */
+
+struct vidframe_pool;
+
+int  vidframe_pool_alloc(struct vidframe_pool **poolp, enum vidfmt fmt,
+			 const struct vidsz *sz, unsigned max);
+int  vidframe_pool_get(struct vidframe_pool *pool, struct vidframe **fp);
+bool vidframe_pool_match(const struct vidframe_pool *pool, enum vidfmt fmt,
+			 const struct vidsz *sz);
+int  vidframe_pool_debug(struct re_printf *pf,
+			 const struct vidframe_pool *pool);
+
+
 /*
  * Modules
  */
@@ -1062,6 +1870,277 @@ int module_preload(const char *module);
 double mos_calculate(double *r_factor, double rtt,
 		     double jitter, uint32_t num_packets_lost);
 
+/** Continuous quality estimate, with O(1) state */
+struct mosq {
+	struct stream_quality q;  /**< Current estimate                 */
+	uint32_t rx_prev;         /**< Packets received at last update  */
+	uint32_t lost_prev;       /**< Packets lost at last update      */
+	uint64_t ts_base;         /**< Arrival time of first packet [us]*/
+	uint32_t srate;           /**< RTP clock rate [Hz]              */
+	uint32_t transit;         /**< Relative transit time, RTP units */
+	uint32_t jit;             /**< Interarrival jitter, times 16    */
+	bool started;             /**< transit is valid                 */
+	bool valid;               /**< q has been calculated            */
+};
+
+void mosq_packet(struct mosq *mq, uint64_t now, uint32_t ts, uint32_t srate);
+bool mosq_update(struct mosq *mq, uint32_t rx, uint32_t lost, double rtt,
+		 double alert);
+
+
+/*
+ * Histogram
+ */
+
+/** Log-linear histogram, precision about 3% of the value */
+enum {
+	HISTO_SUB     = 16,                 /**< Buckets per power of two */
+	HISTO_BUCKETS = (32 - 4 + 1) * HISTO_SUB,
+};
+
+struct histo {
+	uint32_t bucketv[HISTO_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint32_t max;
+};
+
+void     histo_add(struct histo *h, uint32_t v);
+void     histo_reset(struct histo *h);
+uint64_t histo_count(const struct histo *h);
+uint64_t histo_sum(const struct histo *h);
+uint32_t histo_mean(const struct histo *h);
+uint32_t histo_max(const struct histo *h);
+uint32_t histo_percentile(const struct histo *h, unsigned pct);
+int      histo_debug(struct re_printf *pf, const struct histo *h);
+
+
+/*
+ * UDP batch sender
+ */
+
+struct udpbatch;
+
+int  udpbatch_alloc(struct udpbatch **ubp, struct udp_sock *us);
+void udpbatch_start(struct udpbatch *ub);
+int  udpbatch_flush(struct udpbatch *ub);
+bool udpbatch_set_gso(struct udpbatch *ub, bool enable);
+
+
+/*
+ * Network impairment
+ */
+
+/** Parameters of a network impairment, Gilbert-Elliott loss model */
+struct impair_prm {
+	double p_bad;           /**< Good to bad state, per packet  */
+	double p_good;          /**< Bad to good state, per packet  */
+	double loss_good;       /**< Loss in the good state [0-1]   */
+	double loss_bad;        /**< Loss in the bad state [0-1]    */
+	uint32_t delay;         /**< Fixed delay in [ms]            */
+	uint32_t jitter;        /**< Random delay, 0 to jitter [ms] */
+	double reorder;         /**< Share that may be reordered    */
+	uint32_t rate;          /**< Rate cap in [bit/s], 0 is none */
+	uint32_t queue;         /**< Queue at the cap [ms], 0=200   */
+	uint32_t seed;          /**< Seed of the random numbers     */
+};
+
+/** Statistics of a network impairment */
+struct impair_stat {
+	uint32_t n_pkt;         /**< Datagrams sent                 */
+	uint32_t n_lost;        /**< Lost by the loss model         */
+	uint32_t n_drop;        /**< Dropped at the rate cap        */
+	uint32_t n_reorder;     /**< Delivered out of order         */
+	uint32_t n_queued;      /**< Waiting for delivery           */
+};
+
+struct impair;
+
+int impair_alloc(struct impair **imp, struct udp_sock *us,
+		 const struct impair_prm *prm);
+int impair_stats(const struct impair *im, struct impair_stat *stat);
+
+
+/*
+ * Adaptive Jitter Buffer control
+ */
+
+struct ajb;
+
+int      ajb_alloc(struct ajb **ajbp, uint32_t max);
+void     ajb_set_srate(struct ajb *ajb, uint32_t srate);
+void     ajb_put(struct ajb *ajb, const struct rtp_header *hdr,
+		 uint64_t now);
+void     ajb_get(struct ajb *ajb);
+unsigned ajb_release(struct ajb *ajb, bool marker);
+void     ajb_reset(struct ajb *ajb);
+int      ajb_debug(struct re_printf *pf, const struct ajb *ajb);
+
+
+/*
+ * Audio Ring-buffer (single producer, single consumer)
+ */
+
+struct auring;
+
+int    auring_alloc(struct auring **arp, size_t min_sz, size_t max_sz);
+int    auring_write_samp(struct auring *ar, const int16_t *sampv,
+			 size_t sampc);
+void   auring_read_samp(struct auring *ar, int16_t *sampv, size_t sampc);
+size_t auring_cur_size(const struct auring *ar);
+size_t auring_mem(const struct auring *ar);
+int    auring_debug(struct re_printf *pf, const struct auring *ar);
+
+
+/*
+ * Timer wheel
+ */
+
+struct twheel;
+
+typedef void (twheel_h)(void *arg);
+
+/** Timer on a timer wheel, embedded in the owner like struct tmr */
+struct twheel_tmr {
+	struct le le;
+	struct twheel *tw;
+	twheel_h *th;
+	void *arg;
+	uint64_t tick;
+};
+
+int      twheel_alloc(struct twheel **twp, uint32_t res);
+void     twheel_poll(struct twheel *tw, uint64_t jfs);
+uint32_t twheel_count(const struct twheel *tw);
+int      twheel_debug(struct re_printf *pf, const struct twheel *tw);
+void     twheel_tmr_start(struct twheel_tmr *t, struct twheel *tw,
+			  uint64_t delay, twheel_h *th, void *arg);
+void     twheel_tmr_cancel(struct twheel_tmr *t);
+bool     twheel_tmr_isrunning(const struct twheel_tmr *t);
+
+
+/*
+ * Media clock
+ */
+
+/** Media clock modes */
+enum mclock_mode {
+	MCLOCK_REAL = 0,  /**< Wall clock                      */
+	MCLOCK_FAST,      /**< Virtual clock, as fast as possible */
+};
+
+typedef void (mclock_h)(void *arg);
+
+/** Timer on the media clock, embedded in the owner like struct tmr */
+struct mclock_tmr {
+	struct le le;
+	struct tmr tmr;
+	uint64_t ts;      /**< Deadline in [us] */
+	mclock_h *h;
+	void *arg;
+};
+
+void     mclock_set_mode(enum mclock_mode mode);
+enum mclock_mode mclock_mode(void);
+uint64_t mclock_now(void);
+void     mclock_sleep_until(uint64_t ts);
+void     mclock_tmr_start(struct mclock_tmr *t, uint64_t delay,
+			  mclock_h *h, void *arg);
+void     mclock_tmr_cancel(struct mclock_tmr *t);
+bool     mclock_tmr_isrunning(const struct mclock_tmr *t);
+
+
+/*
+ * Registration scheduler
+ */
+
+typedef void (regsched_h)(void *arg);
+
+/** Request on the registration scheduler, embedded in the owner */
+struct regsched_job {
+	struct le le;
+	struct twheel_tmr tmr;
+	regsched_h *h;
+	void *arg;
+};
+
+void regsched_start(struct regsched_job *job, uint64_t delay,
+		    regsched_h *h, void *arg);
+void regsched_cancel(struct regsched_job *job);
+bool regsched_isqueued(const struct regsched_job *job);
+
+
+/*
+ * Call admission
+ */
+
+struct admit;
+
+int      admit_alloc(struct admit **admp, uint32_t max_setups,
+		     uint32_t max_lag, uint32_t max_load);
+void     admit_update(struct admit *adm, uint32_t lag, uint32_t load);
+int      admit_check(struct admit *adm, uint32_t setups,
+		     uint32_t *retry_after);
+uint64_t admit_count(const struct admit *adm, bool rejected);
+int      admit_debug(struct re_printf *pf, const struct admit *adm);
+
+
+/*
+ * CPU governor
+ */
+
+struct cpugov;
+
+int cpugov_alloc(struct cpugov **govp, uint32_t max_load);
+int cpugov_update(struct cpugov *gov, uint32_t load, uint32_t late);
+int cpugov_debug(struct re_printf *pf, const struct cpugov *gov);
+
+
+/*
+ * Main loop lag monitor
+ */
+
+/** A main-loop handler that ran longer than the threshold */
+struct lagmon_slow {
+	const char *name;  /**< Handler name                  */
+	uint32_t count;    /**< Runs above the threshold      */
+	uint32_t max;      /**< Longest run in [us]           */
+};
+
+void     lagmon_reset(void);
+uint64_t lagmon_begin(void);
+void     lagmon_end(const char *name, uint64_t ts);
+const struct histo *lagmon_lag(void);
+const struct histo *lagmon_handlers(void);
+size_t   lagmon_slowest(struct lagmon_slow *slowv, size_t slowc);
+int      lagmon_debug(struct re_printf *pf, void *unused);
+
+
+/*
+ * DNS cache
+ */
+
+struct dnscache;
+
+int      dnscache_alloc(struct dnscache **dcp, const struct sa *srvv,
+			uint32_t srvc);
+int      dnscache_srv_set(struct dnscache *dc, const struct sa *srvv,
+			  uint32_t srvc);
+const struct sa *dnscache_laddr(const struct dnscache *dc);
+void     dnscache_flush(struct dnscache *dc);
+uint32_t dnscache_count(const struct dnscache *dc);
+int      dnscache_debug(struct re_printf *pf, const struct dnscache *dc);
+
+
+/*
+ * Startup timing
+ */
+
+void     startup_phase(const char *name);
+uint64_t startup_time(const char *name);
+void     startup_reset(void);
+int      startup_debug(struct re_printf *pf, void *unused);
+
 
 /*
  * Baresip instance
@@ -1070,6 +2149,7 @@ double mos_calculate(double *r_factor, double rtt,
 int  baresip_init(struct config *cfg, bool prefer_ipv6);
 void baresip_close(void);
 struct network *baresip_network(void);
+struct twheel  *baresip_twheel(void);
 
 
 #ifdef __cplusplus
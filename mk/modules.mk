@@ -159,12 +159,10 @@ HAVE_SPEEXDSP := \
 	$(shell find $(SYSROOT)/lib -name libspeexdsp$(LIB_SUFFIX) 2>/dev/null)
 endif
 ifneq ($(USE_MPG123),)
-ifneq ($(HAVE_SPEEXDSP),)
 USE_MPA  := $(shell [ -f $(SYSROOT)/include/twolame.h ] || \
 	[ -f $(SYSROOT)/local/include/twolame.h ] || \
 	[ -f $(SYSROOT_ALT)/include/twolame.h ] && echo "yes")
 endif
-endif
 USE_SPEEX := $(shell [ -f $(SYSROOT)/include/speex.h ] || \
 	[ -f $(SYSROOT)/include/speex/speex.h ] || \
 	[ -f $(SYSROOT)/local/include/speex.h ] || \
@@ -190,6 +188,9 @@ USE_V4L  := $(shell [ -f $(SYSROOT)/include/libv4l1.h ] || \
 HAVE_LIBV4L2 := $(shell [ -f $(SYSROOT)/include/libv4l2.h ] || \
 	[ -f $(SYSROOT)/local/include/libv4l2.h ] \
 	&& echo "yes")
+HAVE_TURBOJPEG := $(shell [ -f $(SYSROOT)/include/turbojpeg.h ] || \
+	[ -f $(SYSROOT)/local/include/turbojpeg.h ] \
+	&& echo "yes")
 USE_V4L2 := $(shell [ -f $(SYSROOT)/include/linux/videodev2.h ] || \
 	[ -f $(SYSROOT)/local/include/linux/videodev2.h ] || \
 	[ -f $(SYSROOT)/include/sys/videoio.h ] \
@@ -257,12 +258,14 @@ endif
 
 MODULES   += $(EXTRA_MODULES)
 MODULES   += stun turn ice natbd auloop presence
-MODULES   += menu contact vumeter mwi account natpmp httpd
+MODULES   += menu contact vumeter mwi account natpmp httpd ctrl_tcp loadgen
+MODULES   += nullaudio
+MODULES   += conference
 MODULES   += srtp
 MODULES   += uuid
 
 ifneq ($(HAVE_PTHREAD),)
-MODULES   += aubridge aufile
+MODULES   += aubridge aufile cdr
 endif
 ifneq ($(USE_VIDEO),)
 MODULES   += vidloop selfview vidbridge
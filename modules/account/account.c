@@ -3,6 +3,8 @@
  *
  * Copyright (C) 2010 - 2015 Creytiv.com
  */
+#include <ctype.h>
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 
@@ -66,6 +68,7 @@ static int account_write_template(const char *file)
 			 "#    ;mediaenc={srtp,srtp-mand,srtp-mandf"
 			 ",dtls_srtp,zrtp}\n"
 			 "#    ;medianat={stun,turn,ice}\n"
+			 "#    ;mwi=no (no MWI subscription)\n"
 			 "#    ;outbound=\"sip:primary.example.com"
 			 ";transport=tcp\"\n"
 			 "#    ;outbound2=sip:secondary.example.com\n"
@@ -97,20 +100,48 @@ static int account_write_template(const char *file)
 }
 
 
-/**
- * Add a User-Agent (UA)
- *
- * @param addr SIP Address string
- *
- * @return 0 if success, otherwise errorcode
+/*
+ * The accounts file is read into one buffer, and each line is terminated
+ * in place, so there is no copy and no limit on the length of a line.
+ * A bad account is skipped, and does not stop the loading of the others.
  */
-static int line_handler(const struct pl *addr)
+static uint32_t accounts_load(struct mbuf *mb)
 {
-	char buf[512];
+	char *p   = (char *)mb->buf;
+	char *end = (char *)mb->buf + mb->end;
+	uint32_t line = 0, fail = 0;
+
+	while (p < end) {
+
+		char *eol = memchr(p, '\n', end - p);
+		char *e;
+		int err;
+
+		if (!eol)
+			eol = end;
+
+		++line;
+
+		/* strip trailing white-space, including CR */
+		for (e = eol; e > p && isspace((unsigned char)e[-1]); e--)
+			;
 
-	(void)pl_strcpy(addr, buf, sizeof(buf));
+		if (e > p && p[0] != '#') {
 
-	return ua_alloc(NULL, buf);
+			*e = '\0';
+
+			err = ua_alloc(NULL, p);
+			if (err) {
+				warning("account: line %u: %s (%m)\n",
+					line, p, err);
+				++fail;
+			}
+		}
+
+		p = eol + 1;
+	}
+
+	return fail;
 }
 
 
@@ -122,7 +153,9 @@ static int line_handler(const struct pl *addr)
 static int account_read_file(void)
 {
 	char path[256] = "", file[256] = "";
-	uint32_t n;
+	uint64_t ts = tmr_jiffies();
+	struct mbuf *mb;
+	uint32_t n, fail = 0;
 	int err;
 
 	err = conf_path_get(path, sizeof(path));
@@ -143,12 +176,26 @@ static int account_read_file(void)
 			return err;
 	}
 
-	err = conf_parse(file, line_handler);
+	err = conf_load(&mb, file);
+	if (err)
+		return err;
+
+	/* room for the terminator of the last line */
+	if (mb->size <= mb->end)
+		err = mbuf_resize(mb, mb->end + 1);
+	if (!err)
+		fail = accounts_load(mb);
+
+	mem_deref(mb);
 	if (err)
 		return err;
 
 	n = list_count(uag_list());
-	info("Populated %u account%s\n", n, 1==n ? "" : "s");
+	info("Populated %u account%s (%u ms)\n", n, 1==n ? "" : "s",
+	     (uint32_t)(tmr_jiffies() - ts));
+	if (fail)
+		warning("account: %u account%s failed\n",
+			fail, 1==fail ? "" : "s");
 
 	if (list_isempty(uag_list())) {
 		info("account: No SIP accounts found\n"
@@ -8,6 +8,7 @@
 #include <sys/time.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 #include <alsa/asoundlib.h>
 #include <re.h>
 #include <rem.h>
@@ -20,6 +21,21 @@
  *
  * Advanced Linux Sound Architecture (ALSA) audio driver module
  *
+ * By default a period is one packet and the buffer holds 4 periods.
+ * For low latency the period can be made smaller than a packet, the
+ * buffer shorter and the samples transferred with mmap instead of
+ * read/write. Encoding runs in the capture thread when audio_txmode
+ * is poll, so with alsa_realtime that thread gets real-time priority.
+ *
+ * Example config:
+ \verbatim
+  alsa_sample_format      s16      # s16, float or s24_3le
+  alsa_mmap               no       # mmap transfers instead of read/write
+  alsa_period_frames      0        # period in [frames], 0 for one packet
+  alsa_periods            4        # buffer size in periods
+  alsa_realtime           no       # real-time priority for audio threads
+ \endverbatim
+ *
  *
  * References:
  *
@@ -29,6 +45,10 @@
 
 char alsa_dev[64] = "default";
 enum aufmt alsa_sample_format = AUFMT_S16LE;
+bool alsa_mmap = false;
+uint32_t alsa_period_frames = 0;
+uint32_t alsa_periods = 4;
+bool alsa_realtime = false;
 
 static struct ausrc *ausrc;
 static struct auplay *auplay;
@@ -39,9 +59,12 @@ int alsa_reset(snd_pcm_t *pcm, uint32_t srate, uint32_t ch,
 	       snd_pcm_format_t pcmfmt)
 {
 	snd_pcm_hw_params_t *hw_params = NULL;
-	snd_pcm_uframes_t period = num_frames, bufsize = num_frames * 4;
+	snd_pcm_uframes_t period, bufsize;
 	int err;
 
+	period  = alsa_period_frames ? alsa_period_frames : num_frames;
+	bufsize = period * alsa_periods;
+
 	debug("alsa: reset: srate=%u, ch=%u, num_frames=%u, pcmfmt=%s\n",
 	      srate, ch, num_frames, snd_pcm_format_name(pcmfmt));
 
@@ -59,7 +82,8 @@ int alsa_reset(snd_pcm_t *pcm, uint32_t srate, uint32_t ch,
 		goto out;
 	}
 
-	err = snd_pcm_hw_params_set_access(pcm, hw_params,
+	err = snd_pcm_hw_params_set_access(pcm, hw_params, alsa_mmap ?
+					   SND_PCM_ACCESS_MMAP_INTERLEAVED :
 					   SND_PCM_ACCESS_RW_INTERLEAVED);
 	if (err < 0) {
 		warning("alsa: cannot set access type (%s)\n",
@@ -108,6 +132,18 @@ int alsa_reset(snd_pcm_t *pcm, uint32_t srate, uint32_t ch,
 		goto out;
 	}
 
+	(void)snd_pcm_hw_params_get_period_size(hw_params, &period, 0);
+	(void)snd_pcm_hw_params_get_buffer_size(hw_params, &bufsize);
+
+	info("alsa: %s: period=%lu buffer=%lu frames (%s)\n",
+	     snd_pcm_name(pcm), period, bufsize,
+	     alsa_mmap ? "mmap" : "read/write");
+
+	if (num_frames % period) {
+		warning("alsa: packet of %u frames is not a multiple"
+			" of the period\n", num_frames);
+	}
+
 	err = snd_pcm_prepare(pcm);
 	if (err < 0) {
 		warning("alsa: cannot prepare audio interface for use (%s)\n",
@@ -128,6 +164,113 @@ int alsa_reset(snd_pcm_t *pcm, uint32_t srate, uint32_t ch,
 }
 
 
+/**
+ * Transfer interleaved frames through the mmap'ed ring buffer.
+ * Waits for the device until all frames are transferred.
+ *
+ * @param pcm     PCM handle, with mmap access
+ * @param buf     Frames to write, or buffer for read frames
+ * @param frames  Number of frames
+ * @param capture True to read, false to write
+ *
+ * @return Number of frames transferred, or negative ALSA error
+ */
+snd_pcm_sframes_t alsa_mmap_xfer(snd_pcm_t *pcm, void *buf,
+				 snd_pcm_uframes_t frames, bool capture)
+{
+	size_t framesz = snd_pcm_frames_to_bytes(pcm, 1);
+	uint8_t *p = buf;
+	snd_pcm_uframes_t done = 0;
+
+	while (done < frames) {
+
+		const snd_pcm_channel_area_t *areas;
+		snd_pcm_uframes_t offset, n = frames - done;
+		snd_pcm_sframes_t avail, c;
+		uint8_t *area;
+		int err;
+
+		avail = snd_pcm_avail_update(pcm);
+		if (avail < 0)
+			return avail;
+
+		if (avail == 0) {
+			/* a full playback buffer starts the stream */
+			if (!capture &&
+			    snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED) {
+				err = snd_pcm_start(pcm);
+				if (err < 0)
+					return err;
+			}
+
+			err = snd_pcm_wait(pcm, 1000);
+			if (err < 0)
+				return err;
+
+			continue;
+		}
+
+		n = min(n, (snd_pcm_uframes_t)avail);
+
+		err = snd_pcm_mmap_begin(pcm, &areas, &offset, &n);
+		if (err < 0)
+			return err;
+
+		area = (uint8_t *)areas[0].addr +
+			(areas[0].first + offset * areas[0].step) / 8;
+
+		if (capture)
+			memcpy(p + done * framesz, area, n * framesz);
+		else
+			memcpy(area, p + done * framesz, n * framesz);
+
+		c = snd_pcm_mmap_commit(pcm, offset, n);
+		if (c < 0)
+			return c;
+		if ((snd_pcm_uframes_t)c != n)
+			return -EPIPE;
+
+		done += n;
+	}
+
+	/* unlike writei, committing does not start playback */
+	if (!capture && snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED) {
+		int err = snd_pcm_start(pcm);
+		if (err < 0)
+			return err;
+	}
+
+	return done;
+}
+
+
+/**
+ * Recover from an overrun, underrun or suspend
+ *
+ * @param pcm     PCM handle
+ * @param err     Negative ALSA error from a transfer
+ * @param capture True to restart a capture stream
+ * @param xrunc   Number of xruns, incremented on an xrun
+ *
+ * @return 0 if recovered, otherwise negative ALSA error
+ */
+int alsa_recover(snd_pcm_t *pcm, int err, bool capture, uint32_t *xrunc)
+{
+	if (err == -EPIPE)
+		++*xrunc;
+
+	err = snd_pcm_recover(pcm, err, 1);
+	if (err < 0)
+		return err;
+
+	/* read/write restart by themselves, mmap capture does not */
+	if (capture && alsa_mmap)
+		err = snd_pcm_start(pcm);
+
+	return err;
+}
+
+
 snd_pcm_format_t aufmt_to_alsaformat(enum aufmt fmt)
 {
 	switch (fmt) {
@@ -165,6 +308,17 @@ static int alsa_init(void)
 		     aufmt_name(alsa_sample_format));
 	}
 
+	(void)conf_get_bool(conf_cur(), "alsa_mmap", &alsa_mmap);
+	(void)conf_get_u32(conf_cur(), "alsa_period_frames",
+			   &alsa_period_frames);
+	(void)conf_get_u32(conf_cur(), "alsa_periods", &alsa_periods);
+	(void)conf_get_bool(conf_cur(), "alsa_realtime", &alsa_realtime);
+
+	if (alsa_periods < 2) {
+		warning("alsa: alsa_periods must be at least 2\n");
+		return EINVAL;
+	}
+
 	err  = ausrc_register(&ausrc, "alsa", alsa_src_alloc);
 	err |= auplay_register(&auplay, "alsa", alsa_play_alloc);
 
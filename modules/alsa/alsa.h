@@ -7,9 +7,16 @@
 
 extern char alsa_dev[64];
 extern enum aufmt alsa_sample_format;
+extern bool alsa_mmap;
+extern uint32_t alsa_period_frames;
+extern uint32_t alsa_periods;
+extern bool alsa_realtime;
 
 int alsa_reset(snd_pcm_t *pcm, uint32_t srate, uint32_t ch,
 	       uint32_t num_frames, snd_pcm_format_t pcmfmt);
+snd_pcm_sframes_t alsa_mmap_xfer(snd_pcm_t *pcm, void *buf,
+				 snd_pcm_uframes_t frames, bool capture);
+int alsa_recover(snd_pcm_t *pcm, int err, bool capture, uint32_t *xrunc);
 snd_pcm_format_t aufmt_to_alsaformat(enum aufmt fmt);
 int alsa_src_alloc(struct ausrc_st **stp, const struct ausrc *as,
 		   struct media_ctx **ctx,
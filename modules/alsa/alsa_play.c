@@ -29,6 +29,7 @@ struct auplay_st {
 	struct auplay_prm prm;
 	char *device;
 	enum aufmt aufmt;
+	uint32_t xrunc;
 };
 
 
@@ -43,6 +44,11 @@ static void auplay_destructor(void *arg)
 		(void)pthread_join(st->thread, NULL);
 	}
 
+	if (st->xrunc) {
+		info("alsa: player '%s' recovered from %u underruns\n",
+		     st->device, st->xrunc);
+	}
+
 	if (st->write)
 		snd_pcm_close(st->write);
 
@@ -52,6 +58,15 @@ static void auplay_destructor(void *arg)
 }
 
 
+static int write_frames(struct auplay_st *st, void *sampv, int frames)
+{
+	if (alsa_mmap)
+		return (int)alsa_mmap_xfer(st->write, sampv, frames, false);
+	else
+		return (int)snd_pcm_writei(st->write, sampv, frames);
+}
+
+
 static void *write_thread(void *arg)
 {
 	struct auplay_st *st = arg;
@@ -60,6 +75,16 @@ static void *write_thread(void *arg)
 
 	num_frames = st->prm.srate * st->prm.ptime / 1000;
 
+	if (alsa_realtime) {
+		n = realtime_enable(true, 1000 / st->prm.ptime);
+		if (n) {
+			warning("alsa: could not enable real-time"
+				" priority (%m)\n", n);
+		}
+	}
+
+	(void)realtime_thread("audio_dev");
+
 	while (st->run) {
 		const int samples = num_frames;
 		void *sampv;
@@ -75,12 +100,22 @@ static void *write_thread(void *arg)
 					st->sampv, st->sampc);
 		}
 
-		n = snd_pcm_writei(st->write, sampv, samples);
+		n = write_frames(st, sampv, samples);
+
+		if (-EPIPE == n || -ESTRPIPE == n) {
 
-		if (-EPIPE == n) {
-			snd_pcm_prepare(st->write);
+			debug("alsa: player '%s' underrun (%s)\n",
+			      st->device, snd_strerror(n));
+
+			n = alsa_recover(st->write, n, false, &st->xrunc);
+			if (n < 0) {
+				warning("alsa: player '%s' recovery failed"
+					" (%s)\n", st->device,
+					snd_strerror(n));
+				break;
+			}
 
-			n = snd_pcm_writei(st->write, sampv, samples);
+			n = write_frames(st, sampv, samples);
 			if (n != samples) {
 				warning("alsa: write error: %s\n",
 					snd_strerror(n));
@@ -29,6 +29,7 @@ struct ausrc_st {
 	struct ausrc_prm prm;
 	char *device;
 	enum aufmt aufmt;
+	uint32_t xrunc;
 };
 
 
@@ -43,6 +44,11 @@ static void ausrc_destructor(void *arg)
 		(void)pthread_join(st->thread, NULL);
 	}
 
+	if (st->xrunc) {
+		info("alsa: source '%s' recovered from %u overruns\n",
+		     st->device, st->xrunc);
+	}
+
 	if (st->read)
 		snd_pcm_close(st->read);
 
@@ -60,6 +66,17 @@ static void *read_thread(void *arg)
 
 	num_frames = st->prm.srate * st->prm.ptime / 1000;
 
+	/* The read handler may encode in this thread (audio_txmode poll) */
+	if (alsa_realtime) {
+		err = realtime_enable(true, 1000 / st->prm.ptime);
+		if (err) {
+			warning("alsa: could not enable real-time"
+				" priority (%m)\n", err);
+		}
+	}
+
+	(void)realtime_thread("audio_dev");
+
 	/* Start */
 	err = snd_pcm_start(st->read);
 	if (err) {
@@ -77,9 +94,24 @@ static void *read_thread(void *arg)
 		else
 			sampv = st->xsampv;
 
-		err = snd_pcm_readi(st->read, sampv, num_frames);
-		if (err == -EPIPE) {
-			snd_pcm_prepare(st->read);
+		if (alsa_mmap)
+			err = alsa_mmap_xfer(st->read, sampv, num_frames,
+					     true);
+		else
+			err = snd_pcm_readi(st->read, sampv, num_frames);
+
+		if (err == -EPIPE || err == -ESTRPIPE) {
+
+			debug("alsa: source '%s' overrun (%s)\n",
+			      st->device, snd_strerror(err));
+
+			err = alsa_recover(st->read, err, true, &st->xrunc);
+			if (err < 0) {
+				warning("alsa: source '%s' recovery failed"
+					" (%s)\n", st->device,
+					snd_strerror(err));
+				break;
+			}
 			continue;
 		}
 		else if (err <= 0) {
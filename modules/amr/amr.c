@@ -52,13 +52,17 @@
 #endif
 
 enum {
-	FRAMESIZE_NB = 160
+	FRAMESIZE_NB = 160,
+	MODE_MAX_NB  = 7,           /**< 12.2 kbit/s              */
+	MODE_MAX_WB  = 8,           /**< 23.85 kbit/s             */
 };
 
 
 struct auenc_state {
 	const struct aucodec *ac;
 	void *enc;                  /**< Encoder state            */
+	int mode;                   /**< Encoder mode, 0 lowest   */
+	int mode_max;               /**< Highest mode             */
 };
 
 struct audec_state {
@@ -129,6 +133,8 @@ static int encode_update(struct auenc_state **aesp,
 		return ENOMEM;
 
 	st->ac = ac;
+	st->mode_max = ac->srate == 8000 ? MODE_MAX_NB : MODE_MAX_WB;
+	st->mode = st->mode_max;
 
 	switch (ac->srate) {
 
@@ -203,6 +209,24 @@ static int decode_update(struct audec_state **adsp,
 }
 
 
+/* One mode down or up: 12.2 to 4.75 kbit/s for NB, 23.85 to 6.6 for WB */
+static int encode_rate(struct auenc_state *st, int step)
+{
+	int mode;
+
+	if (!st)
+		return EINVAL;
+
+	mode = st->mode + (step < 0 ? -1 : 1);
+	if (mode < 0 || mode > st->mode_max)
+		return ERANGE;
+
+	st->mode = mode;
+
+	return 0;
+}
+
+
 #ifdef AMR_WB
 static int encode_wb(struct auenc_state *st, uint8_t *buf, size_t *len,
 		     const int16_t *sampv, size_t sampc)
@@ -218,7 +242,7 @@ static int encode_wb(struct auenc_state *st, uint8_t *buf, size_t *len,
 	/* CMR value 15 indicates that no mode request is present */
 	buf[0] = 15 << 4;
 
-	n = IF2E_IF_encode(st->enc, 8, sampv, &buf[1], 0);
+	n = IF2E_IF_encode(st->enc, st->mode, sampv, &buf[1], 0);
 	if (n <= 0)
 		return EPROTO;
 
@@ -259,7 +283,8 @@ static int encode_nb(struct auenc_state *st, uint8_t *buf,
 	/* CMR value 15 indicates that no mode request is present */
 	buf[0] = 15 << 4;
 
-	r = Encoder_Interface_Encode(st->enc, MR122, sampv, &buf[1], 0);
+	r = Encoder_Interface_Encode(st->enc, (enum Mode)st->mode, sampv,
+				     &buf[1], 0);
 	if (r <= 0)
 		return EPROTO;
 
@@ -292,18 +317,34 @@ static int decode_nb(struct audec_state *st, int16_t *sampv,
 
 #ifdef AMR_WB
 static struct aucodec amr_wb = {
-	LE_INIT, NULL, "AMR-WB", 16000, 16000, 1, NULL,
-	encode_update, encode_wb,
-	decode_update, decode_wb,
-	NULL, amr_fmtp_enc, amr_fmtp_cmp
+	.name      = "AMR-WB",
+	.srate     = 16000,
+	.crate     = 16000,
+	.ch        = 1,
+	.encupdh   = encode_update,
+	.ench      = encode_wb,
+	.decupdh   = decode_update,
+	.dech      = decode_wb,
+	.fmtp_ench = amr_fmtp_enc,
+	.fmtp_cmph = amr_fmtp_cmp,
+	.rateh     = encode_rate,
+	.heavy     = true,
 };
 #endif
 #ifdef AMR_NB
 static struct aucodec amr_nb = {
-	LE_INIT, NULL, "AMR", 8000, 8000, 1, NULL,
-	encode_update, encode_nb,
-	decode_update, decode_nb,
-	NULL, amr_fmtp_enc, amr_fmtp_cmp
+	.name      = "AMR",
+	.srate     = 8000,
+	.crate     = 8000,
+	.ch        = 1,
+	.encupdh   = encode_update,
+	.ench      = encode_nb,
+	.decupdh   = decode_update,
+	.dech      = decode_nb,
+	.fmtp_ench = amr_fmtp_enc,
+	.fmtp_cmph = amr_fmtp_cmp,
+	.rateh     = encode_rate,
+	.heavy     = true,
 };
 #endif
 
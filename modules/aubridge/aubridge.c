@@ -15,7 +15,8 @@
  *
  * This module can be used to connect two audio devices together,
  * so that all output to AUPLAY device is bridged as the input to
- * a AUSRC device.
+ * a AUSRC device. All devices are driven by one shared 20ms clock,
+ * and each frame is passed on as soon as it is played.
  *
  * Sample config:
  *
@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <time.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -10,17 +11,44 @@
 #include "aubridge.h"
 
 
+/*
+ * All connected devices share one clock thread. On each tick it reads
+ * one frame from every player and passes it straight on to the source
+ * of the same device, so a bridged frame is delayed by one tick at
+ * most and the number of wakeups does not grow with the devices.
+ */
+
+
 /* The packet-time is fixed to 20 milliseconds */
 enum {PTIME = 20};
 
+/* Ticks behind before the clock is reset instead of catching up */
+enum {MAX_LATE = 5};
+
 
 struct device {
 	struct le le;
+	struct le le_run;               /* in the clock's device list */
 	const struct ausrc_st *ausrc;
 	const struct auplay_st *auplay;
+	struct resamp *rs;
+	int16_t *sampv_in;
+	int16_t *sampv_out;
+	size_t sampc_in;
+	size_t sampc_out;
 	char name[64];
+};
+
+
+static struct {
+	pthread_mutex_t mutex;          /* protects devl and run */
+	pthread_cond_t cond;
 	pthread_t thread;
-	volatile bool run;
+	struct list devl;               /* running devices */
+	bool run;
+} clk = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
 };
 
 
@@ -49,81 +77,136 @@ static struct device *find_device(const char *device)
 }
 
 
-static void *device_thread(void *arg)
+/* called with the clock mutex held */
+static void device_process(struct device *dev)
 {
-	uint64_t now, ts = tmr_jiffies();
-	struct device *dev = arg;
-	struct auresamp rs;
-	int16_t *sampv_in, *sampv_out;
-	size_t sampc_in;
-	size_t sampc_out;
-	int err;
+	dev->auplay->wh(dev->sampv_in, dev->sampc_in, dev->auplay->arg);
 
-	sampc_in = dev->auplay->prm.srate * dev->auplay->prm.ch * PTIME/1000;
-	sampc_out = dev->ausrc->prm.srate * dev->ausrc->prm.ch * PTIME/1000;
+	if (dev->rs) {
+		size_t sampc_rs = dev->sampc_out;
+		int err;
 
-	auresamp_init(&rs);
+		err = resamp_process(dev->rs,
+				     dev->sampv_out, &sampc_rs,
+				     dev->sampv_in, dev->sampc_in);
+		if (err) {
+			warning("aubridge: resampler error"
+				" sampc_out=%zu, sampc_in=%zu (%m)\n",
+				dev->sampc_out, dev->sampc_in, err);
+		}
 
-	sampv_in  = mem_alloc(2 * sampc_in, NULL);
-	sampv_out = mem_alloc(2 * sampc_out, NULL);
-	if (!sampv_in || !sampv_out)
-		goto out;
+		dev->ausrc->rh(dev->sampv_out, sampc_rs, dev->ausrc->arg);
+	}
+	else {
+		dev->ausrc->rh(dev->sampv_in, dev->sampc_in,
+			       dev->ausrc->arg);
+	}
+}
 
-	err = auresamp_setup(&rs,
-			     dev->auplay->prm.srate, dev->auplay->prm.ch,
-			     dev->ausrc->prm.srate, dev->ausrc->prm.ch);
-	if (err)
-		goto out;
 
-	while (dev->run) {
+/* wait until the deadline, or until the clock is stopped */
+static void clock_wait(uint64_t deadline)
+{
+	struct timespec ts;
+	uint64_t now = tmr_jiffies();
+	uint32_t ms;
 
-		(void)sys_msleep(4);
+	if (deadline <= now)
+		return;
 
-		if (!dev->run)
-			break;
+	ms = (uint32_t)(deadline - now);
 
-		now = tmr_jiffies();
+	(void)clock_gettime(CLOCK_REALTIME, &ts);
 
-		if (ts > now)
-			continue;
+	ts.tv_sec  += ms / 1000;
+	ts.tv_nsec += (long)(ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec  += 1;
+		ts.tv_nsec -= 1000000000;
+	}
 
-		if (dev->auplay && dev->auplay->wh) {
-			dev->auplay->wh(sampv_in, sampc_in, dev->auplay->arg);
-		}
+	(void)pthread_cond_timedwait(&clk.cond, &clk.mutex, &ts);
+}
 
-		if (rs.resample) {
-			err = auresamp(&rs,
-				       sampv_out, &sampc_out,
-				       sampv_in, sampc_in);
-			if (err) {
-				warning("aubridge: auresamp error"
-					" sampc_out=%zu, sampc_in=%zu (%m)\n",
-					sampc_out, sampc_in, err);
-			}
-
-			if (dev->ausrc && dev->ausrc->rh) {
-				dev->ausrc->rh(sampv_out, sampc_out,
-					       dev->ausrc->arg);
-			}
-		}
-		else {
-			if (dev->ausrc && dev->ausrc->rh) {
-				dev->ausrc->rh(sampv_in, sampc_in,
-					       dev->ausrc->arg);
-			}
+
+static void *clock_thread(void *arg)
+{
+	uint64_t ts = tmr_jiffies();
+	(void)arg;
+
+	pthread_mutex_lock(&clk.mutex);
+
+	while (clk.run) {
+
+		uint64_t now = tmr_jiffies();
+		struct le *le;
+
+		if (now < ts) {
+			clock_wait(ts);
+			continue;
 		}
 
+		if (now - ts > MAX_LATE * PTIME)
+			ts = now;
+
+		for (le = clk.devl.head; le; le = le->next)
+			device_process(le->data);
+
 		ts += PTIME;
 	}
 
- out:
-	mem_deref(sampv_in);
-	mem_deref(sampv_out);
+	pthread_mutex_unlock(&clk.mutex);
 
 	return NULL;
 }
 
 
+static int device_start(struct device *dev)
+{
+	const struct auplay_prm *pprm = &dev->auplay->prm;
+	const struct ausrc_prm *sprm = &dev->ausrc->prm;
+	int err = 0;
+
+	dev->rs        = mem_deref(dev->rs);
+	dev->sampv_in  = mem_deref(dev->sampv_in);
+	dev->sampv_out = mem_deref(dev->sampv_out);
+
+	dev->sampc_in  = pprm->srate * pprm->ch * PTIME/1000;
+	dev->sampc_out = sprm->srate * sprm->ch * PTIME/1000;
+
+	dev->sampv_in  = mem_alloc(2 * dev->sampc_in, NULL);
+	dev->sampv_out = mem_alloc(2 * dev->sampc_out, NULL);
+	if (!dev->sampv_in || !dev->sampv_out)
+		return ENOMEM;
+
+	if (pprm->srate != sprm->srate || pprm->ch != sprm->ch) {
+
+		err = resamp_alloc(&dev->rs, conf_config()->audio.resamp,
+				   pprm->srate, pprm->ch,
+				   sprm->srate, sprm->ch);
+		if (err)
+			return err;
+	}
+
+	pthread_mutex_lock(&clk.mutex);
+
+	list_append(&clk.devl, &dev->le_run, dev);
+
+	if (!clk.run) {
+		clk.run = true;
+		err = pthread_create(&clk.thread, NULL, clock_thread, NULL);
+		if (err) {
+			clk.run = false;
+			list_unlink(&dev->le_run);
+		}
+	}
+
+	pthread_mutex_unlock(&clk.mutex);
+
+	return err;
+}
+
+
 int device_connect(struct device **devp, const char *device,
 		   struct auplay_st *auplay, struct ausrc_st *ausrc)
 {
@@ -159,13 +242,10 @@ int device_connect(struct device **devp, const char *device,
 		dev->ausrc = ausrc;
 
 	/* wait until we have both SRC+PLAY */
-	if (dev->ausrc && dev->auplay && !dev->run) {
+	if (dev->ausrc && dev->auplay && !dev->le_run.list &&
+	    dev->auplay->wh && dev->ausrc->rh) {
 
-		dev->run = true;
-		err = pthread_create(&dev->thread, NULL, device_thread, dev);
-		if (err) {
-			dev->run = false;
-		}
+		err = device_start(dev);
 	}
 
 	return err;
@@ -174,14 +254,30 @@ int device_connect(struct device **devp, const char *device,
 
 void device_stop(struct device *dev)
 {
+	bool join = false;
+
 	if (!dev)
 		return;
 
+	pthread_mutex_lock(&clk.mutex);
+
 	dev->auplay = NULL;
 	dev->ausrc = NULL;
+	list_unlink(&dev->le_run);
 
-	if (dev->run) {
-		dev->run = false;
-		pthread_join(dev->thread, NULL);
+	/* the last device stops the clock */
+	if (clk.run && list_isempty(&clk.devl)) {
+		clk.run = false;
+		pthread_cond_signal(&clk.cond);
+		join = true;
 	}
+
+	pthread_mutex_unlock(&clk.mutex);
+
+	if (join)
+		pthread_join(clk.thread, NULL);
+
+	dev->rs        = mem_deref(dev->rs);
+	dev->sampv_in  = mem_deref(dev->sampv_in);
+	dev->sampv_out = mem_deref(dev->sampv_out);
 }
@@ -16,6 +16,22 @@ typedef void (audiosess_int_h)(bool start, void *arg);
 int  audiosess_alloc(struct audiosess_st **stp,
 		     audiosess_int_h *inth, void *arg);
 void audiosess_interrupt(bool interrupted);
+void audiosess_io_duration(uint32_t ptime);
+uint32_t audiosess_latency(bool input);
+
+
+enum audiounit_dir {
+	AUDIOUNIT_PLAY = 1<<0,
+	AUDIOUNIT_REC  = 1<<1,
+};
+
+struct audiounit_io;
+
+int  audiounit_io_play(struct audiounit_io **iop, struct auplay_prm *prm,
+		       auplay_write_h *wh, void *arg);
+int  audiounit_io_rec(struct audiounit_io **iop, struct ausrc_prm *prm,
+		      ausrc_read_h *rh, void *arg);
+void audiounit_io_stop(struct audiounit_io *io, enum audiounit_dir dir);
 
 
 int audiounit_player_alloc(struct auplay_st **stp, const struct auplay *ap,
@@ -0,0 +1,604 @@
+/**
+ * @file audiounit/io.c  AudioUnit sound driver - I/O unit
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <AudioUnit/AudioUnit.h>
+#include <AudioToolbox/AudioToolbox.h>
+#include <TargetConditionals.h>
+#include <pthread.h>
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "audiounit.h"
+
+
+/*
+ * On iOS the player and the recorder of a call share one Voice
+ * Processing I/O unit. The device then runs one I/O thread, which
+ * renders and records in the same cycle, and the echo canceller gets
+ * the played signal from the same unit. A second player or recorder,
+ * e.g. a ring tone, or one with another format, gets a unit of its own.
+ *
+ * The hardware I/O buffer is set to one packet time, so the device calls
+ * back once per packet.
+ */
+
+
+struct audiounit_io {
+	struct audiosess_st *sess;
+	AudioUnit au;
+	AudioStreamBasicDescription fmt;
+	pthread_mutex_t mutex;
+	uint32_t ptime;
+	unsigned dirs;           /**< Directions enabled in the unit */
+	unsigned users;          /**< Directions with a handler      */
+	bool started;
+	auplay_write_h *wh;
+	void *warg;
+	ausrc_read_h *rh;
+	void *rarg;
+};
+
+
+#if TARGET_OS_IPHONE
+static struct audiounit_io *shared_io;
+#endif
+
+
+static void destructor(void *arg)
+{
+	struct audiounit_io *io = arg;
+
+#if TARGET_OS_IPHONE
+	if (shared_io == io)
+		shared_io = NULL;
+#endif
+
+	if (io->au) {
+		AudioOutputUnitStop(io->au);
+		AudioUnitUninitialize(io->au);
+		AudioComponentInstanceDispose(io->au);
+	}
+
+	mem_deref(io->sess);
+
+	pthread_mutex_destroy(&io->mutex);
+}
+
+
+static OSStatus render_callback(void *inRefCon,
+				AudioUnitRenderActionFlags *ioActionFlags,
+				const AudioTimeStamp *inTimeStamp,
+				UInt32 inBusNumber,
+				UInt32 inNumberFrames,
+				AudioBufferList *ioData)
+{
+	struct audiounit_io *io = inRefCon;
+	auplay_write_h *wh;
+	void *arg;
+	uint32_t i;
+
+	(void)inTimeStamp;
+	(void)inBusNumber;
+	(void)inNumberFrames;
+
+	pthread_mutex_lock(&io->mutex);
+	wh  = io->wh;
+	arg = io->warg;
+	pthread_mutex_unlock(&io->mutex);
+
+	for (i = 0; i < ioData->mNumberBuffers; ++i) {
+
+		AudioBuffer *ab = &ioData->mBuffers[i];
+
+		if (wh)
+			wh(ab->mData, ab->mDataByteSize/2, arg);
+		else
+			memset(ab->mData, 0, ab->mDataByteSize);
+	}
+
+	if (!wh)
+		*ioActionFlags |= kAudioUnitRenderAction_OutputIsSilence;
+
+	return 0;
+}
+
+
+static OSStatus input_callback(void *inRefCon,
+			       AudioUnitRenderActionFlags *ioActionFlags,
+			       const AudioTimeStamp *inTimeStamp,
+			       UInt32 inBusNumber,
+			       UInt32 inNumberFrames,
+			       AudioBufferList *ioData)
+{
+	struct audiounit_io *io = inRefCon;
+	AudioBufferList abl;
+	OSStatus ret;
+	ausrc_read_h *rh;
+	void *arg;
+
+	(void)ioData;
+
+	pthread_mutex_lock(&io->mutex);
+	rh  = io->rh;
+	arg = io->rarg;
+	pthread_mutex_unlock(&io->mutex);
+
+	if (!rh)
+		return 0;
+
+	/* recorded into the buffer of the unit */
+	abl.mNumberBuffers = 1;
+	abl.mBuffers[0].mNumberChannels = io->fmt.mChannelsPerFrame;
+	abl.mBuffers[0].mData = NULL;
+	abl.mBuffers[0].mDataByteSize = inNumberFrames *
+		io->fmt.mBytesPerFrame;
+
+	ret = AudioUnitRender(io->au,
+			      ioActionFlags,
+			      inTimeStamp,
+			      inBusNumber,
+			      inNumberFrames,
+			      &abl);
+	if (ret) {
+		debug("audiounit: record: AudioUnitRender error (%d)\n", ret);
+		return ret;
+	}
+
+	rh(abl.mBuffers[0].mData, abl.mBuffers[0].mDataByteSize/2, arg);
+
+	return 0;
+}
+
+
+static void interrupt_handler(bool interrupted, void *arg)
+{
+	struct audiounit_io *io = arg;
+
+	if (interrupted)
+		AudioOutputUnitStop(io->au);
+	else
+		AudioOutputUnitStart(io->au);
+}
+
+
+#if ! TARGET_OS_IPHONE
+static AudioDeviceID current_device(AudioUnit au)
+{
+	AudioDeviceID dev = kAudioObjectUnknown;
+	UInt32 size = sizeof(dev);
+
+	(void)AudioUnitGetProperty(au, kAudioOutputUnitProperty_CurrentDevice,
+				   kAudioUnitScope_Global, 0, &dev, &size);
+
+	return dev;
+}
+
+
+static UInt32 device_u32(AudioDeviceID dev, AudioObjectPropertySelector sel,
+			 bool input)
+{
+	AudioObjectPropertyAddress addr = {
+		sel,
+		input ? kAudioDevicePropertyScopeInput :
+		kAudioDevicePropertyScopeOutput,
+		kAudioObjectPropertyElementMaster };
+	UInt32 val = 0, size = sizeof(val);
+
+	(void)AudioObjectGetPropertyData(dev, &addr, 0, NULL, &size, &val);
+
+	return val;
+}
+
+
+static Float64 device_srate(AudioDeviceID dev)
+{
+	AudioObjectPropertyAddress addr = {
+		kAudioDevicePropertyNominalSampleRate,
+		kAudioObjectPropertyScopeGlobal,
+		kAudioObjectPropertyElementMaster };
+	Float64 srate = 0;
+	UInt32 size = sizeof(srate);
+
+	(void)AudioObjectGetPropertyData(dev, &addr, 0, NULL, &size, &srate);
+
+	return srate;
+}
+
+
+/* I/O buffer of one packet time, at the rate of the device */
+static void device_io_duration(AudioDeviceID dev, bool input,
+			       uint32_t ptime)
+{
+	AudioObjectPropertyAddress addr = {
+		kAudioDevicePropertyBufferFrameSize,
+		input ? kAudioDevicePropertyScopeInput :
+		kAudioDevicePropertyScopeOutput,
+		kAudioObjectPropertyElementMaster };
+	UInt32 frames = (UInt32)(device_srate(dev) * ptime / 1000);
+	OSStatus ret;
+
+	if (!frames)
+		return;
+
+	ret = AudioObjectSetPropertyData(dev, &addr, 0, NULL,
+					 sizeof(frames), &frames);
+	if (ret)
+		warning("audiounit: BufferFrameSize %u: %d\n", frames, ret);
+}
+
+
+static uint32_t device_latency(AudioDeviceID dev, bool input)
+{
+	const Float64 srate = device_srate(dev);
+	UInt32 frames;
+
+	if (srate <= 0)
+		return 0;
+
+	frames  = device_u32(dev, kAudioDevicePropertyLatency, input);
+	frames += device_u32(dev, kAudioDevicePropertySafetyOffset, input);
+	frames += device_u32(dev, kAudioDevicePropertyBufferFrameSize, input);
+
+	return (uint32_t)(frames * 1000000.0 / srate);
+}
+#endif
+
+
+static uint32_t io_latency(const struct audiounit_io *io, bool input)
+{
+#if TARGET_OS_IPHONE
+	(void)io;
+
+	return audiosess_latency(input);
+#else
+	return device_latency(current_device(io->au), input);
+#endif
+}
+
+
+/* Enable the directions of the unit, and (re)start it */
+static OSStatus io_configure(struct audiounit_io *io, unsigned dirs)
+{
+	AURenderCallbackStruct cb;
+	UInt32 enable;
+	OSStatus ret;
+#if TARGET_OS_IPHONE
+	const bool output = true;   /* the echo canceller needs it */
+#else
+	const bool output = dirs & AUDIOUNIT_PLAY;
+	AudioDeviceID dev;
+#endif
+
+	if (io->started) {
+		AudioOutputUnitStop(io->au);
+		AudioUnitUninitialize(io->au);
+		io->started = false;
+	}
+
+	enable = output;
+	ret = AudioUnitSetProperty(io->au, kAudioOutputUnitProperty_EnableIO,
+				   kAudioUnitScope_Output, 0,
+				   &enable, sizeof(enable));
+	if (ret)
+		return ret;
+
+	enable = !!(dirs & AUDIOUNIT_REC);
+	ret = AudioUnitSetProperty(io->au, kAudioOutputUnitProperty_EnableIO,
+				   kAudioUnitScope_Input, 1,
+				   &enable, sizeof(enable));
+	if (ret)
+		return ret;
+
+#if ! TARGET_OS_IPHONE
+	if (dirs & AUDIOUNIT_REC) {
+		UInt32 ausize = sizeof(AudioDeviceID);
+		AudioDeviceID inputDevice;
+		AudioObjectPropertyAddress auAddress = {
+			kAudioHardwarePropertyDefaultInputDevice,
+			kAudioObjectPropertyScopeGlobal,
+			kAudioObjectPropertyElementMaster };
+
+		ret = AudioObjectGetPropertyData(kAudioObjectSystemObject,
+						 &auAddress, 0, NULL,
+						 &ausize, &inputDevice);
+		if (ret)
+			return ret;
+
+		ret = AudioUnitSetProperty(io->au,
+				kAudioOutputUnitProperty_CurrentDevice,
+				kAudioUnitScope_Global, 0,
+				&inputDevice, sizeof(inputDevice));
+		if (ret)
+			return ret;
+	}
+#endif
+
+	if (output) {
+		ret = AudioUnitSetProperty(io->au,
+					   kAudioUnitProperty_StreamFormat,
+					   kAudioUnitScope_Input, 0,
+					   &io->fmt, sizeof(io->fmt));
+		if (ret)
+			return ret;
+
+		cb.inputProc = render_callback;
+		cb.inputProcRefCon = io;
+		ret = AudioUnitSetProperty(io->au,
+				kAudioUnitProperty_SetRenderCallback,
+				kAudioUnitScope_Input, 0,
+				&cb, sizeof(cb));
+		if (ret)
+			return ret;
+	}
+
+	if (dirs & AUDIOUNIT_REC) {
+		ret = AudioUnitSetProperty(io->au,
+					   kAudioUnitProperty_StreamFormat,
+					   kAudioUnitScope_Output, 1,
+					   &io->fmt, sizeof(io->fmt));
+		if (ret)
+			return ret;
+
+		cb.inputProc = input_callback;
+		cb.inputProcRefCon = io;
+		ret = AudioUnitSetProperty(io->au,
+				kAudioOutputUnitProperty_SetInputCallback,
+				kAudioUnitScope_Global, 1,
+				&cb, sizeof(cb));
+		if (ret)
+			return ret;
+	}
+
+#if TARGET_OS_IPHONE
+	audiosess_io_duration(io->ptime);
+#else
+	dev = current_device(io->au);
+	device_io_duration(dev, dirs & AUDIOUNIT_REC, io->ptime);
+#endif
+
+	ret = AudioUnitInitialize(io->au);
+	if (ret)
+		return ret;
+
+	ret = AudioOutputUnitStart(io->au);
+	if (ret) {
+		AudioUnitUninitialize(io->au);
+		return ret;
+	}
+
+	io->started = true;
+	io->dirs    = dirs;
+
+	return 0;
+}
+
+
+static int io_alloc(struct audiounit_io **iop, uint32_t srate, uint8_t ch,
+		    uint32_t ptime)
+{
+	struct audiounit_io *io;
+	OSStatus ret;
+	int err;
+
+	io = mem_zalloc(sizeof(*io), destructor);
+	if (!io)
+		return ENOMEM;
+
+	err = pthread_mutex_init(&io->mutex, NULL);
+	if (err) {
+		mem_deref(io);
+		return err;
+	}
+
+	io->ptime = ptime ? ptime : 20;
+
+	io->fmt.mSampleRate       = srate;
+	io->fmt.mFormatID         = kAudioFormatLinearPCM;
+#if TARGET_OS_IPHONE
+	io->fmt.mFormatFlags      = kAudioFormatFlagsCanonical;
+#else
+	io->fmt.mFormatFlags      = kLinearPCMFormatFlagIsSignedInteger
+		| kLinearPCMFormatFlagIsPacked;
+#endif
+	io->fmt.mBitsPerChannel   = 16;
+	io->fmt.mChannelsPerFrame = ch;
+	io->fmt.mBytesPerFrame    = 2 * ch;
+	io->fmt.mFramesPerPacket  = 1;
+	io->fmt.mBytesPerPacket   = 2 * ch;
+	io->fmt.mReserved         = 0;
+
+	err = audiosess_alloc(&io->sess, interrupt_handler, io);
+	if (err)
+		goto out;
+
+	ret = AudioComponentInstanceNew(output_comp, &io->au);
+	if (ret) {
+		warning("audiounit: AudioComponentInstanceNew: %d\n", ret);
+		err = ENODEV;
+		goto out;
+	}
+
+ out:
+	if (err)
+		mem_deref(io);
+	else
+		*iop = io;
+
+	return err;
+}
+
+
+/* The shared unit, if it is free for the direction and the format */
+static int io_get(struct audiounit_io **iop, enum audiounit_dir dir,
+		  uint32_t srate, uint8_t ch, uint32_t ptime)
+{
+	int err;
+
+#if TARGET_OS_IPHONE
+	if (shared_io && !(shared_io->users & dir) &&
+	    shared_io->fmt.mSampleRate == srate &&
+	    shared_io->fmt.mChannelsPerFrame == ch) {
+
+		*iop = mem_ref(shared_io);
+		return 0;
+	}
+#endif
+
+	err = io_alloc(iop, srate, ch, ptime);
+	if (err)
+		return err;
+
+#if TARGET_OS_IPHONE
+	if (!shared_io)
+		shared_io = *iop;
+#endif
+
+	return 0;
+}
+
+
+static int io_start(struct audiounit_io *io, enum audiounit_dir dir)
+{
+	OSStatus ret;
+
+	io->users |= dir;
+
+	if ((io->dirs & dir) && io->started)
+		return 0;
+
+	ret = io_configure(io, io->dirs | dir);
+	if (ret) {
+		warning("audiounit: %s failed: %d (%c%c%c%c)\n",
+			dir == AUDIOUNIT_PLAY ? "player" : "record", ret,
+			ret>>24, ret>>16, ret>>8, ret);
+		audiounit_io_stop(io, dir);
+		return ENODEV;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Start playback on an I/O unit
+ *
+ * @param iop Pointer to I/O unit, dereference after audiounit_io_stop()
+ * @param prm Audio player parameters
+ * @param wh  Write handler
+ * @param arg Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int audiounit_io_play(struct audiounit_io **iop, struct auplay_prm *prm,
+		      auplay_write_h *wh, void *arg)
+{
+	struct audiounit_io *io;
+	int err;
+
+	if (!iop || !prm || !wh)
+		return EINVAL;
+
+	err = io_get(&io, AUDIOUNIT_PLAY, prm->srate, prm->ch, prm->ptime);
+	if (err)
+		return err;
+
+	pthread_mutex_lock(&io->mutex);
+	io->wh   = wh;
+	io->warg = arg;
+	pthread_mutex_unlock(&io->mutex);
+
+	err = io_start(io, AUDIOUNIT_PLAY);
+	if (err) {
+		mem_deref(io);
+		return err;
+	}
+
+	if (prm->latency)
+		*prm->latency = io_latency(io, false);
+
+	debug("audiounit: player %u Hz, %u ch%s, latency %u us\n",
+	      prm->srate, prm->ch, io->users & AUDIOUNIT_REC ?
+	      " (shared unit)" : "", io_latency(io, false));
+
+	*iop = io;
+
+	return 0;
+}
+
+
+/**
+ * Start recording on an I/O unit
+ *
+ * @param iop Pointer to I/O unit, dereference after audiounit_io_stop()
+ * @param prm Audio source parameters
+ * @param rh  Read handler
+ * @param arg Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int audiounit_io_rec(struct audiounit_io **iop, struct ausrc_prm *prm,
+		     ausrc_read_h *rh, void *arg)
+{
+	struct audiounit_io *io;
+	int err;
+
+	if (!iop || !prm || !rh)
+		return EINVAL;
+
+	err = io_get(&io, AUDIOUNIT_REC, prm->srate, prm->ch, prm->ptime);
+	if (err)
+		return err;
+
+	pthread_mutex_lock(&io->mutex);
+	io->rh   = rh;
+	io->rarg = arg;
+	pthread_mutex_unlock(&io->mutex);
+
+	err = io_start(io, AUDIOUNIT_REC);
+	if (err) {
+		mem_deref(io);
+		return err;
+	}
+
+	if (prm->latency)
+		*prm->latency = io_latency(io, true);
+
+	debug("audiounit: recorder %u Hz, %u ch%s, latency %u us\n",
+	      prm->srate, prm->ch, io->users & AUDIOUNIT_PLAY ?
+	      " (shared unit)" : "", io_latency(io, true));
+
+	*iop = io;
+
+	return 0;
+}
+
+
+/**
+ * Stop playback or recording on an I/O unit. The unit keeps running for
+ * the other direction.
+ *
+ * @param io  I/O unit
+ * @param dir Direction to stop
+ */
+void audiounit_io_stop(struct audiounit_io *io, enum audiounit_dir dir)
+{
+	if (!io)
+		return;
+
+	pthread_mutex_lock(&io->mutex);
+
+	if (dir == AUDIOUNIT_PLAY) {
+		io->wh   = NULL;
+		io->warg = NULL;
+	}
+	else {
+		io->rh   = NULL;
+		io->rarg = NULL;
+	}
+
+	io->users &= ~dir;
+
+	pthread_mutex_unlock(&io->mutex);
+}
@@ -6,6 +6,7 @@
 
 MOD		:= audiounit
 $(MOD)_SRCS	+= audiounit.c
+$(MOD)_SRCS	+= io.c
 $(MOD)_SRCS	+= sess.c
 $(MOD)_SRCS	+= player.c
 $(MOD)_SRCS	+= recorder.c
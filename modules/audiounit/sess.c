@@ -172,3 +172,68 @@ void audiosess_interrupt(bool start)
 			st->inth(start, st->arg);
 	}
 }
+
+
+/**
+ * Ask for a hardware I/O buffer of one packet time, so the device calls
+ * back once per packet
+ *
+ * @param ptime Packet time in [ms]
+ */
+void audiosess_io_duration(uint32_t ptime)
+{
+#if TARGET_OS_IPHONE
+	Float32 dur = ptime / 1000.0f;
+	UInt32 size = sizeof(dur);
+	OSStatus ret;
+
+	ret = AudioSessionSetProperty(
+		kAudioSessionProperty_PreferredHardwareIOBufferDuration,
+			sizeof(dur), &dur);
+	if (ret) {
+		warning("audiounit: PreferredHardwareIOBufferDuration: %d\n",
+			ret);
+		return;
+	}
+
+	ret = AudioSessionGetProperty(
+			kAudioSessionProperty_CurrentHardwareIOBufferDuration,
+			&size, &dur);
+	if (!ret)
+		debug("audiounit: I/O buffer duration %.1f ms\n",
+		      dur * 1000.0f);
+#else
+	(void)ptime;
+#endif
+}
+
+
+/**
+ * Get the latency of the audio route
+ *
+ * @param input True for the input, false for the output
+ *
+ * @return Latency of the hardware and its I/O buffer in [us]
+ */
+uint32_t audiosess_latency(bool input)
+{
+#if TARGET_OS_IPHONE
+	Float32 lat = 0, dur = 0;
+	UInt32 size = sizeof(lat);
+
+	(void)AudioSessionGetProperty(input ?
+			kAudioSessionProperty_CurrentHardwareInputLatency :
+			kAudioSessionProperty_CurrentHardwareOutputLatency,
+			&size, &lat);
+
+	size = sizeof(dur);
+	(void)AudioSessionGetProperty(
+			kAudioSessionProperty_CurrentHardwareIOBufferDuration,
+			&size, &dur);
+
+	return (uint32_t)((lat + dur) * 1000000.0f);
+#else
+	(void)input;
+	return 0;
+#endif
+}
@@ -5,6 +5,12 @@
  */
 #define _DEFAULT_SOURCE 1
 #define _BSD_SOURCE 1
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <pthread.h>
 #include <re.h>
 #include <rem.h>
@@ -15,17 +21,42 @@
  * @defgroup aufile aufile
  *
  * Audio module for using a WAV-file as audio input
+ *
+ * The file is mapped into memory and streamed from there, so playback
+ * starts at once and sources playing the same file share its pages.
+ * While one window of audio is played the kernel is asked to read the
+ * next one, and the source is paced from the monotonic clock.
  */
 
 
+enum {
+	WINDOW = 1000,      /**< Read-ahead window in [ms]               */
+	MAX_LATE = 10,      /**< Packets behind before skipping ahead    */
+};
+
+/** Mapped WAV file, shared by the sources playing it */
+struct afile {
+	struct le le;
+	char *path;
+	struct aufile_prm prm;
+	void *map;
+	size_t maplen;
+	const uint8_t *data;     /**< Samples, S16LE */
+	size_t size;             /**< Size of samples in [bytes] */
+	time_t mtime;
+	off_t fsize;
+};
+
 struct ausrc_st {
 	const struct ausrc *as;  /* base class */
 	struct tmr tmr;
-	struct aufile *aufile;
-	struct aubuf *aubuf;
+	struct afile *af;
+	size_t pos;              /**< Read position in [bytes] */
+	size_t window;           /**< Read-ahead window in [bytes] */
 	uint32_t ptime;
 	size_t sampc;
 	bool run;
+	bool eof;                /**< End of file reached (atomic) */
 	pthread_t thread;
 	ausrc_read_h *rh;
 	ausrc_error_h *errh;
@@ -34,6 +65,149 @@ struct ausrc_st {
 
 
 static struct ausrc *ausrc;
+static struct list afilel;
+
+
+static uint32_t le32(const uint8_t *p)
+{
+	return (uint32_t)p[0]       | (uint32_t)p[1] << 8 |
+	       (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+/* find the samples of a WAV file */
+static bool wav_data(const uint8_t *p, size_t len, size_t *offp,
+		     size_t *sizep)
+{
+	size_t pos = 12;
+
+	if (len < 12 || memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4))
+		return false;
+
+	while (pos + 8 <= len) {
+
+		uint32_t sz = le32(p + pos + 4);
+
+		if (0 == memcmp(p + pos, "data", 4)) {
+			*offp  = pos + 8;
+			*sizep = min((size_t)sz, len - pos - 8);
+			return true;
+		}
+
+		if (sz > len - pos - 8)
+			break;
+
+		pos += 8 + sz + (sz & 1);
+	}
+
+	return false;
+}
+
+
+static void afile_destructor(void *arg)
+{
+	struct afile *af = arg;
+
+	list_unlink(&af->le);
+
+	if (af->map)
+		(void)munmap(af->map, af->maplen);
+
+	mem_deref(af->path);
+}
+
+
+static int afile_map(struct afile *af)
+{
+	size_t off, sz;
+	void *map;
+	int fd;
+
+	fd = open(af->path, O_RDONLY);
+	if (fd < 0)
+		return errno;
+
+	map = mmap(NULL, (size_t)af->fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+	(void)close(fd);
+	if (map == MAP_FAILED)
+		return errno;
+
+	af->map    = map;
+	af->maplen = (size_t)af->fsize;
+
+	if (!wav_data(map, af->maplen, &off, &sz))
+		return EBADMSG;
+
+	af->data = (uint8_t *)map + off;
+	af->size = sz & ~(size_t)1;
+
+	(void)madvise(map, af->maplen, MADV_SEQUENTIAL);
+
+	return 0;
+}
+
+
+/* get the mapped file, or map it if it is new or has changed */
+static int afile_get(struct afile **afp, const char *path)
+{
+	struct aufile *aufile;
+	struct afile *af;
+	struct stat sb;
+	struct le *le;
+	int err;
+
+	if (stat(path, &sb) < 0)
+		return errno;
+
+	for (le = afilel.head; le; le = le->next) {
+
+		af = le->data;
+
+		if (str_cmp(af->path, path))
+			continue;
+
+		if (af->mtime == sb.st_mtime && af->fsize == sb.st_size) {
+			*afp = mem_ref(af);
+			return 0;
+		}
+
+		/* sources of the old file keep their mapping */
+		list_unlink(&af->le);
+		break;
+	}
+
+	af = mem_zalloc(sizeof(*af), afile_destructor);
+	if (!af)
+		return ENOMEM;
+
+	af->mtime = sb.st_mtime;
+	af->fsize = sb.st_size;
+
+	err = str_dup(&af->path, path);
+	if (err)
+		goto out;
+
+	/* the header is checked by aufile */
+	err = aufile_open(&aufile, &af->prm, path, AUFILE_READ);
+	if (err)
+		goto out;
+
+	mem_deref(aufile);
+
+	err = afile_map(af);
+	if (err)
+		goto out;
+
+	list_append(&afilel, &af->le, af);
+
+ out:
+	if (err)
+		mem_deref(af);
+	else
+		*afp = af;
+
+	return err;
+}
 
 
 static void destructor(void *arg)
@@ -47,35 +221,89 @@ static void destructor(void *arg)
 
 	tmr_cancel(&st->tmr);
 
-	mem_deref(st->aufile);
-	mem_deref(st->aubuf);
+	mem_deref(st->af);
+}
+
+
+/* ask for the window after the one that is being played */
+static void read_ahead(struct ausrc_st *st, size_t pos)
+{
+	const struct afile *af = st->af;
+	size_t pgsz = (size_t)sysconf(_SC_PAGESIZE);
+	size_t start, len;
+	uintptr_t addr;
+
+	start = (pos / st->window + 1) * st->window;
+	if (start >= af->size)
+		return;
+
+	len  = min(st->window, af->size - start);
+	addr = (uintptr_t)(af->data + start);
+
+	/* madvise wants a page aligned address */
+	len  += addr % pgsz;
+	addr -= addr % pgsz;
+
+	(void)madvise((void *)addr, len, MADV_WILLNEED);
+}
+
+
+static void read_samp(struct ausrc_st *st, int16_t *sampv, size_t sampc)
+{
+	const struct afile *af = st->af;
+	size_t n = min(sampc * 2, af->size - st->pos);
+	size_t i;
+
+	if (st->pos / st->window != (st->pos + n) / st->window)
+		read_ahead(st, st->pos + n);
+
+	memcpy(sampv, af->data + st->pos, n);
+	memset((uint8_t *)sampv + n, 0, sampc * 2 - n);
+
+	/* convert from Little-Endian to Native-Endian */
+	if (sys_ltohs(1) != 1) {
+		for (i=0; i<n/2; i++)
+			sampv[i] = sys_ltohs(sampv[i]);
+	}
+
+	st->pos += n;
+
+	if (st->pos >= af->size)
+		__atomic_store_n(&st->eof, true, __ATOMIC_RELAXED);
 }
 
 
 static void *play_thread(void *arg)
 {
-	uint64_t now, ts = tmr_jiffies();
 	struct ausrc_st *st = arg;
+	uint64_t now, ts = mclock_now();
+	const uint64_t ptime = st->ptime * 1000;
 	int16_t *sampv;
 
 	sampv = mem_alloc(st->sampc * 2, NULL);
 	if (!sampv)
 		return NULL;
 
-	while (st->run) {
+	read_ahead(st, 0);
 
-		sys_msleep(4);
+	while (st->run) {
 
-		now = tmr_jiffies();
+		now = mclock_now();
 
-		if (ts > now)
+		/* the deadlines do not drift, a late frame is caught up */
+		if (ts > now) {
+			mclock_sleep_until(ts);
 			continue;
+		}
 
-		aubuf_read_samp(st->aubuf, sampv, st->sampc);
+		if (now - ts > MAX_LATE * ptime)
+			ts = now;
+
+		read_samp(st, sampv, st->sampc);
 
 		st->rh(sampv, st->sampc, st->arg);
 
-		ts += st->ptime;
+		ts += ptime;
 	}
 
 	mem_deref(sampv);
@@ -92,8 +320,7 @@ static void timeout(void *arg)
 
 	tmr_start(&st->tmr, 1000, timeout, st);
 
-	/* check if audio buffer is empty */
-	if (aubuf_cur_size(st->aubuf) < (2 * st->sampc)) {
+	if (__atomic_load_n(&st->eof, __ATOMIC_RELAXED)) {
 
 		info("aufile: end of file\n");
 
@@ -104,47 +331,13 @@ static void timeout(void *arg)
 }
 
 
-static int read_file(struct ausrc_st *st)
-{
-	struct mbuf *mb;
-	int err;
-
-	for (;;) {
-
-		mb = mbuf_alloc(4096);
-		if (!mb)
-			return ENOMEM;
-
-		mb->end = mb->size;
-
-		err = aufile_read(st->aufile, mb->buf, &mb->end);
-		if (err)
-			break;
-
-		if (mb->end == 0) {
-			info("aufile: end of file\n");
-			break;
-		}
-
-		aubuf_append(st->aubuf, mb);
-
-		mb = mem_deref(mb);
-	}
-
-	info("aufile: loaded %zu bytes\n", aubuf_cur_size(st->aubuf));
-
-	mem_deref(mb);
-	return err;
-}
-
-
 static int alloc_handler(struct ausrc_st **stp, const struct ausrc *as,
 			 struct media_ctx **ctx,
 			 struct ausrc_prm *prm, const char *dev,
 			 ausrc_read_h *rh, ausrc_error_h *errh, void *arg)
 {
 	struct ausrc_st *st;
-	struct aufile_prm fprm;
+	const struct aufile_prm *fprm;
 	int err;
 	(void)ctx;
 
@@ -162,52 +355,41 @@ static int alloc_handler(struct ausrc_st **stp, const struct ausrc *as,
 	st->errh = errh;
 	st->arg  = arg;
 
-	err = aufile_open(&st->aufile, &fprm, dev, AUFILE_READ);
+	err = afile_get(&st->af, dev);
 	if (err) {
 		warning("aufile: failed to open file '%s' (%m)\n", dev, err);
 		goto out;
 	}
 
+	fprm = &st->af->prm;
+
 	info("aufile: %s: %u Hz, %d channels\n",
-	     dev, fprm.srate, fprm.channels);
+	     dev, fprm->srate, fprm->channels);
 
-	if (fprm.srate != prm->srate) {
+	if (fprm->srate != prm->srate) {
 		warning("aufile: input file (%s) must have sample-rate"
 			" %u Hz\n", dev, prm->srate);
 		err = ENODEV;
 		goto out;
 	}
-	if (fprm.channels != prm->ch) {
+	if (fprm->channels != prm->ch) {
 		warning("aufile: input file (%s) must have channels = %d\n",
 			dev, prm->ch);
 		err = ENODEV;
 		goto out;
 	}
-	if (fprm.fmt != AUFMT_S16LE) {
+	if (fprm->fmt != AUFMT_S16LE) {
 		warning("aufile: input file must have format S16LE\n");
 		err = ENODEV;
 		goto out;
 	}
 
-	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
-
-	st->ptime = prm->ptime;
+	st->sampc  = prm->srate * prm->ch * prm->ptime / 1000;
+	st->ptime  = prm->ptime;
+	st->window = (size_t)prm->srate * prm->ch * 2 * WINDOW / 1000;
 
-	info("aufile: audio ptime=%u sampc=%zu aubuf=[%u:%u]\n",
-	     st->ptime, st->sampc,
-	     prm->srate * prm->ch * 2,
-	     prm->srate * prm->ch * 40);
-
-	/* 1 - inf seconds of audio */
-	err = aubuf_alloc(&st->aubuf,
-			  prm->srate * prm->ch * 2,
-			  0);
-	if (err)
-		goto out;
-
-	err = read_file(st);
-	if (err)
-		goto out;
+	info("aufile: audio ptime=%u sampc=%zu, %zu bytes\n",
+	     st->ptime, st->sampc, st->af->size);
 
 	tmr_start(&st->tmr, 1000, timeout, st);
 
@@ -230,6 +412,8 @@ static int alloc_handler(struct ausrc_st **stp, const struct ausrc *as,
 
 static int module_init(void)
 {
+	list_init(&afilel);
+
 	return ausrc_register(&ausrc, "aufile", alloc_handler);
 }
 
@@ -238,6 +422,9 @@ static int module_close(void)
 {
 	ausrc = mem_deref(ausrc);
 
+	/* the sources hold the files */
+	list_clear(&afilel);
+
 	return 0;
 }
 
@@ -3,7 +3,11 @@
  *
  * Copyright (C) 2010 - 2015 Creytiv.com
  */
+#define _DEFAULT_SOURCE 1
+#define _BSD_SOURCE 1
 #include <string.h>
+#include <time.h>
+#include <math.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -22,13 +26,23 @@
  \verbatim
  a       Start audio-loop
  A       Stop audio-loop
+ B [n]   Benchmark of n frames, through the filters and the codec
  \endverbatim
+ *
+ * The benchmark runs without the audio devices, as fast as possible. It
+ * prints the time per frame of each stage, the memory blocks taken per
+ * frame (if libre has MEM_DEBUG), and the SNR of the decoded signal.
  */
 
 
 /* Configurable items */
 #define PTIME 20
 
+enum {
+	BENCH_FRAMES = 1000,
+	BENCH_LAG    = 40,     /* Max codec delay [ms]       */
+};
+
 
 /** Audio Loop */
 struct audio_loop {
@@ -248,6 +262,7 @@ static int auloop_reset(struct audio_loop *al)
 	auplay_prm.srate      = al->srate;
 	auplay_prm.ch         = al->ch;
 	auplay_prm.ptime      = PTIME;
+	auplay_prm.latency    = NULL;
 	err = auplay_alloc(&al->auplay, cfg->audio.play_mod, &auplay_prm,
 			   cfg->audio.play_dev, write_handler, al);
 	if (err) {
@@ -260,6 +275,7 @@ static int auloop_reset(struct audio_loop *al)
 	ausrc_prm.srate      = al->srate;
 	ausrc_prm.ch         = al->ch;
 	ausrc_prm.ptime      = PTIME;
+	ausrc_prm.latency    = NULL;
 	err = ausrc_alloc(&al->ausrc, NULL, cfg->audio.src_mod,
 			  &ausrc_prm, cfg->audio.src_dev,
 			  read_handler, error_handler, al);
@@ -360,9 +376,335 @@ static int auloop_stop(struct re_printf *pf, void *arg)
 }
 
 
+/*
+ * Benchmark
+ */
+
+
+enum bench_stage {
+	ST_FILT_ENC = 0,
+	ST_ENCODE,
+	ST_DECODE,
+	ST_FILT_DEC,
+	ST_MAX
+};
+
+static const char *stage_namev[ST_MAX] = {
+	"filter-enc", "encode", "decode", "filter-dec"
+};
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Adds the time since t to a stage, and returns the time now */
+static uint64_t stage_add(uint64_t *nsv, enum bench_stage st, uint64_t t)
+{
+	const uint64_t now = now_ns();
+
+	nsv[st] += now - t;
+
+	return now;
+}
+
+
+/* Two tones with a bit of noise, like a voice frequency signal */
+static void bench_signal(int16_t *sampv, size_t sampc, uint32_t srate,
+			 uint32_t ch)
+{
+	size_t i;
+
+	for (i=0; i<sampc; i++) {
+
+		const double t = (double)(i / ch) / srate;
+
+		sampv[i] = (int16_t)(6000 * sin(2 * M_PI * 440 * t) +
+				     3000 * sin(2 * M_PI * 1250 * t) +
+				     (rand_u16() >> 8) - 128);
+	}
+}
+
+
+static double noise_energy(const int16_t *ref, const int16_t *out,
+			   size_t n)
+{
+	double e = 0;
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		const double d = (double)ref[i] - out[i];
+		e += d * d;
+	}
+
+	return e;
+}
+
+
+/*
+ * SNR of the output against the input, after the delay of the codec,
+ * which is found on a part of the signal and then used on all of it.
+ */
+static double bench_snr(size_t *lagp, const int16_t *ref, const int16_t *out,
+			size_t n, size_t maxlag, size_t ch)
+{
+	const size_t win = min(n / 4, maxlag * 4);
+	double sig = 0, noise, best = -1;
+	size_t lag, i;
+
+	*lagp = 0;
+
+	if (n < 2 * (maxlag + win))
+		return 0;
+
+	for (lag = 0; lag <= maxlag; lag += ch) {
+
+		noise = noise_energy(&ref[n/2], &out[n/2 + lag], win);
+
+		if (best < 0 || noise < best) {
+			best  = noise;
+			*lagp = lag;
+		}
+	}
+
+	for (i=0; i<n - maxlag; i++)
+		sig += (double)ref[i] * ref[i];
+
+	noise = noise_energy(ref, &out[*lagp], n - maxlag);
+	if (noise < 1)
+		noise = 1;
+
+	return 10 * log10(sig / noise);
+}
+
+
+static int filters_alloc(struct list *encl, struct list *decl,
+			 struct aufilt_chain **fchp, uint32_t srate,
+			 uint32_t ch, size_t maxc)
+{
+	struct aufilt_prm prm;
+	struct le *le;
+	int err = 0;
+
+	prm.srate = srate;
+	prm.ch    = ch;
+	prm.ptime = PTIME;
+	prm.level = NULL;
+	prm.vad   = NULL;
+	prm.acc   = NULL;
+
+	for (le = list_head(aufilt_list()); le && !err; le = le->next) {
+		struct aufilt *af = le->data;
+		struct aufilt_enc_st *encst = NULL;
+		struct aufilt_dec_st *decst = NULL;
+		void *ctx = NULL;
+
+		if (af->encupdh) {
+			err = af->encupdh(&encst, &ctx, af, &prm);
+			if (err)
+				break;
+
+			encst->af = af;
+			list_append(encl, &encst->le, encst);
+		}
+
+		if (af->decupdh) {
+			err = af->decupdh(&decst, &ctx, af, &prm);
+			if (err)
+				break;
+
+			decst->af = af;
+			list_append(decl, &decst->le, decst);
+		}
+
+		if ((af->enc_floath || af->dec_floath) && !*fchp)
+			err = aufilt_chain_alloc(fchp, maxc);
+	}
+
+	if (err)
+		warning("auloop: bench: audio-filter failed (%m)\n", err);
+
+	return err;
+}
+
+
+static int auloop_bench(struct re_printf *pf, uint32_t nframes)
+{
+	struct list encl = LIST_INIT, decl = LIST_INIT;
+	struct aufilt_chain *fch = NULL;
+	const struct aucodec *ac = NULL;
+	struct auenc_state *enc = NULL;
+	struct audec_state *dec = NULL;
+	struct auenc_param eprm = {PTIME};
+	struct memstat mst0, mst1;
+	int16_t *inv = NULL, *outv = NULL, *sampv = NULL;
+	uint64_t nsv[ST_MAX] = {0}, total = 0, bytes = 0;
+	uint32_t srate = 48000, ch = 1, i;
+	size_t sampc, lag;
+	bool memst;
+	double snr;
+	int err = 0;
+
+	if (str_isset(aucodec)) {
+
+		ac = aucodec_find(aucodec, 0, 0);
+		if (!ac || !ac->ench || !ac->dech) {
+			warning("auloop: bench: codec not found: %s\n",
+				aucodec);
+			return ENOENT;
+		}
+
+		srate = ac->srate;
+		ch    = ac->ch;
+
+		if (ac->ptime)
+			eprm.ptime = ac->ptime;
+
+		if (ac->encupdh)
+			err |= ac->encupdh(&enc, ac, &eprm, NULL);
+		if (ac->decupdh)
+			err |= ac->decupdh(&dec, ac, NULL);
+		if (err) {
+			warning("auloop: bench: codec update failed (%m)\n",
+				err);
+			goto out;
+		}
+	}
+
+	sampc = srate * ch * eprm.ptime / 1000;
+
+	inv   = mem_alloc(nframes * sampc * sizeof(int16_t), NULL);
+	outv  = mem_zalloc(nframes * sampc * sizeof(int16_t), NULL);
+	sampv = mem_alloc(4 * sampc * sizeof(int16_t), NULL);
+	if (!inv || !outv || !sampv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = filters_alloc(&encl, &decl, &fch, srate, ch, 4 * sampc);
+	if (err)
+		goto out;
+
+	bench_signal(inv, nframes * sampc, srate, ch);
+
+	memst = 0 == mem_get_stat(&mst0);
+
+	for (i=0; i<nframes; i++) {
+
+		uint8_t x[2560];
+		size_t xlen = sizeof(x);
+		size_t n = sampc;
+		uint64_t t;
+
+		memcpy(sampv, &inv[i * sampc], sampc * sizeof(int16_t));
+
+		t = now_ns();
+
+		err = aufilt_chain_encode(fch, &encl, sampv, &n);
+		t = stage_add(nsv, ST_FILT_ENC, t);
+
+		if (ac) {
+			err |= ac->ench(enc, x, &xlen, sampv, n);
+			t = stage_add(nsv, ST_ENCODE, t);
+
+			n = 4 * sampc;
+			err |= ac->dech(dec, sampv, &n, x, xlen);
+			t = stage_add(nsv, ST_DECODE, t);
+
+			bytes += xlen;
+		}
+
+		err |= aufilt_chain_decode(fch, &decl, sampv, &n);
+		stage_add(nsv, ST_FILT_DEC, t);
+
+		if (err) {
+			warning("auloop: bench: frame %u failed (%m)\n",
+				i, err);
+			goto out;
+		}
+
+		memcpy(&outv[i * sampc], sampv,
+		       min(n, sampc) * sizeof(int16_t));
+	}
+
+	memst = memst && 0 == mem_get_stat(&mst1);
+
+	snr = bench_snr(&lag, inv, outv, nframes * sampc,
+			srate * ch * BENCH_LAG / 1000, ch);
+
+	err = re_hprintf(pf, "auloop bench: %s %uHz %uch,"
+			 " %u frames of %u ms\n",
+			 ac ? ac->name : "(no codec)", srate, ch,
+			 nframes, eprm.ptime);
+
+	for (i=0; i<ST_MAX; i++) {
+		total += nsv[i];
+		err |= re_hprintf(pf, "  %-12s %10llu ns/frame\n",
+				  stage_namev[i], nsv[i] / nframes);
+	}
+
+	err |= re_hprintf(pf, "  %-12s %10llu ns/frame (%.0fx realtime)\n",
+			  "total", total / nframes,
+			  total ? 1e6 * nframes * eprm.ptime / total : 0.0);
+	err |= re_hprintf(pf, "  %-12s %10llu bit/s\n", "bitrate",
+			  bytes * 8 * 1000 / ((uint64_t)nframes * eprm.ptime));
+	err |= re_hprintf(pf, "  %-12s %10.1f dB (delay %zu samples)\n",
+			  "snr", snr, lag / ch);
+
+	if (memst) {
+		err |= re_hprintf(pf, "  %-12s %10.2f blocks/frame,"
+				  " peak +%zu blocks\n", "memory",
+				  ((double)mst1.blocks_cur -
+				   (double)mst0.blocks_cur) / nframes,
+				  mst1.blocks_peak - mst0.blocks_peak);
+	}
+	else {
+		err |= re_hprintf(pf, "  %-12s %10s\n", "memory",
+				  "n/a (no MEM_DEBUG)");
+	}
+
+ out:
+	list_flush(&encl);
+	list_flush(&decl);
+	mem_deref(fch);
+	mem_deref(enc);
+	mem_deref(dec);
+	mem_deref(sampv);
+	mem_deref(outv);
+	mem_deref(inv);
+
+	return err;
+}
+
+
+static int auloop_bench_cmd(struct re_printf *pf, void *arg)
+{
+	const struct cmd_arg *carg = arg;
+	uint32_t nframes = BENCH_FRAMES;
+	struct pl pl;
+
+	if (str_isset(carg->prm)) {
+		pl_set_str(&pl, carg->prm);
+		nframes = pl_u32(&pl);
+	}
+
+	if (!nframes)
+		return EINVAL;
+
+	return auloop_bench(pf, nframes);
+}
+
+
 static const struct cmd cmdv[] = {
-	{'a', 0, "Start audio-loop", auloop_start },
-	{'A', 0, "Stop audio-loop",  auloop_stop  },
+	{'a',       0, "Start audio-loop",     auloop_start     },
+	{'A',       0, "Stop audio-loop",      auloop_stop      },
+	{'B', CMD_PRM, "Audio-loop benchmark", auloop_bench_cmd },
 };
 
 
@@ -13,6 +13,11 @@
  * @defgroup avcapture avcapture
  *
  * Video source using OSX/iOS AVFoundation
+ *
+ * The camera delivers NV12, the native format of the capture hardware,
+ * at the framerate of the encoder. The pixel buffers are passed on as
+ * they are, while they are locked, and are converted by the core only
+ * for an encoder that does not take NV12.
  */
 
 
@@ -25,8 +30,10 @@ static struct vidsrc *vidsrc;
 	AVCaptureDeviceInput *input;
 	AVCaptureVideoDataOutput *output;
 	struct vidsrc_st *vsrc;
+	int fps_cur;
 }
 - (void)setCamera:(const char *)name;
+- (void)setFps:(int)fps;
 @end
 
 
@@ -165,9 +172,40 @@ static void vidframe_set_pixbuf(struct vidframe *f, const CVImageBufferRef b)
 }
 
 
+/* Frame duration of the device, for the encoder framerate */
++ (void)set_fps:(AVCaptureDevice *)dev fps:(int)fps
+{
+	const CMTime dur = CMTimeMake(1, fps);
+	AVFrameRateRange *range;
+	bool supported = false;
+
+	if (fps <= 0)
+		return;
+
+	for (range in dev.activeFormat.videoSupportedFrameRateRanges) {
+		if (fps >= range.minFrameRate && fps <= range.maxFrameRate)
+			supported = true;
+	}
+
+	if (!supported) {
+		warning("avcapture: %d fps is not supported\n", fps);
+		return;
+	}
+
+	if (![dev lockForConfiguration:nil])
+		return;
+
+	dev.activeVideoMinFrameDuration = dur;
+	dev.activeVideoMaxFrameDuration = dur;
+
+	[dev unlockForConfiguration];
+}
+
+
 - (id)init:(struct vidsrc_st *)st
        dev:(const char *)name
       size:(const struct vidsz *)sz
+       fps:(int)fps
 {
 	dispatch_queue_t queue;
 	AVCaptureDevice *dev;
@@ -190,6 +228,12 @@ static void vidframe_set_pixbuf(struct vidframe *f, const CVImageBufferRef b)
 
 	output.alwaysDiscardsLateVideoFrames = YES;
 
+	/* the native format, no conversion in the capture pipeline */
+	output.videoSettings = @{
+		(id)kCVPixelBufferPixelFormatTypeKey :
+		@(kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange)
+	};
+
 	queue = dispatch_queue_create("avcapture", NULL);
 	[output setSampleBufferDelegate:self queue:queue];
 	dispatch_release(queue);
@@ -199,6 +243,10 @@ static void vidframe_set_pixbuf(struct vidframe *f, const CVImageBufferRef b)
 	[sess addInput:input];
 	[sess addOutput:output];
 
+	/* after the preset, which sets the active format */
+	fps_cur = fps;
+	[avcap set_fps:dev fps:fps];
+
 	[self start:nil];
 
 	return self;
@@ -272,6 +320,18 @@ didOutputSampleBuffer:(CMSampleBufferRef)sampleBuffer
 	input = [AVCaptureDeviceInput deviceInputWithDevice:dev error:nil];
 	[sess addInput:input];
 	[sess commitConfiguration];
+
+	[avcap set_fps:dev fps:fps_cur];
+}
+
+
+- (void)setFps:(int)fps
+{
+	if (fps == fps_cur)
+		return;
+
+	fps_cur = fps;
+	[avcap set_fps:input.device fps:fps];
 }
 
 
@@ -303,12 +363,11 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 	int err = 0;
 
 	(void)ctx;
-	(void)prm;
 	(void)fmt;
 	(void)dev;
 	(void)errorh;
 
-	if (!stp || !size)
+	if (!stp || !prm || !size)
 		return EINVAL;
 
 	st = mem_zalloc(sizeof(*st), destructor);
@@ -323,7 +382,8 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 
 	st->cap = [[avcap alloc] init:st
 				 dev:dev ? dev : "front"
-				 size:size];
+				 size:size
+				 fps:prm->fps];
 	if (!st->cap) {
 		err = ENODEV;
 		goto out;
@@ -344,13 +404,14 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 static void update(struct vidsrc_st *st, struct vidsrc_prm *prm,
 		   const char *dev)
 {
-	(void)prm;
-
 	if (!st)
 		return;
 
 	if (dev)
 		[st->cap setCamera:dev];
+
+	if (prm)
+		[st->cap setFps:prm->fps];
 }
 
 
@@ -29,6 +29,32 @@
       $ make USE_X264=     ; use H.264 encoder from libavcodec
  \endverbatim
  *
+ * Hardware codecs are used with FFmpeg 4.0 or later, and fall back to
+ * the software codecs if they fail:
+ *
+ \verbatim
+      avcodec_hwaccel     vaapi              # decode on a device type
+      avcodec_hwdevice    /dev/dri/renderD128
+      avcodec_h264dec     h264_v4l2m2m       # H.264 decoder by name
+      avcodec_h264enc     h264_nvenc         # H.264 encoder by name
+ \endverbatim
+ *
+ * Decoding and encoding use several threads:
+ *
+ \verbatim
+      avcodec_dec_threads   0      # 0 is one per core, 1 is no threads
+      avcodec_dec_threading slice  # {slice,frame,auto}
+      avcodec_enc_threads   0      # slice threads, 0 is automatic
+ \endverbatim
+ *
+ * Frame threading delays each picture by one frame per extra thread.
+ * Slice threading adds no delay, but only helps with streams that are
+ * encoded in several slices.
+ *
+ * The hardware device types are those of FFmpeg, e.g. vaapi, cuda,
+ * videotoolbox or qsv. Encoders such as h264_vaapi get their surfaces
+ * from a pool on the device of the same type.
+ *
  *
  * References:
  *
@@ -43,6 +69,8 @@
 
 const uint8_t h264_level_idc = 0x0c;
 
+struct avcodec_conf avcodec_conf;
+
 
 int avcodec_resolve_codecid(const char *s)
 {
@@ -57,6 +85,33 @@ int avcodec_resolve_codecid(const char *s)
 }
 
 
+#ifdef USE_AVCODEC_HW
+int avcodec_hw_device(AVBufferRef **devp, enum AVHWDeviceType type)
+{
+	const char *dev = NULL;
+
+	if (str_isset(avcodec_conf.hwdevice))
+		dev = avcodec_conf.hwdevice;
+
+	if (av_hwdevice_ctx_create(devp, type, dev, NULL, 0) < 0)
+		return ENODEV;
+
+	return 0;
+}
+#endif
+
+
+const char *avcodec_thread_name(int type)
+{
+	if (type & FF_THREAD_FRAME)
+		return "frame";
+	else if (type & FF_THREAD_SLICE)
+		return "slice";
+	else
+		return "none";
+}
+
+
 static uint32_t packetization_mode(const char *fmtp)
 {
 	struct pl pl, mode;
@@ -85,10 +140,11 @@ static int h264_fmtp_enc(struct mbuf *mb, const struct sdp_format *fmt,
 		return 0;
 
 	return mbuf_printf(mb, "a=fmtp:%s"
-			   " packetization-mode=0"
+			   " packetization-mode=%u"
 			   ";profile-level-id=%02x%02x%02x"
 			   "\r\n",
-			   fmt->id, profile_idc, profile_iop, h264_level_idc);
+			   fmt->id, packetization_mode(vc->variant),
+			   profile_idc, profile_iop, h264_level_idc);
 }
 
 
@@ -142,6 +198,37 @@ static struct vidcodec h264 = {
 	decode_h264,
 	h264_fmtp_enc,
 	h264_fmtp_cmp,
+	encode_debug,
+	decode_debug,
+	NULL,
+	encode_cplx,
+	decode_lowres,
+	decode_reset,
+};
+
+/* packetization-mode=1 lets the encoder aggregate NAL units (STAP-A) */
+static struct vidcodec h264_1 = {
+	LE_INIT,
+	NULL,
+	"H264",
+	"packetization-mode=1",
+	NULL,
+	encode_update,
+#ifdef USE_X264
+	encode_x264,
+#else
+	encode,
+#endif
+	decode_update,
+	decode_h264,
+	h264_fmtp_enc,
+	h264_fmtp_cmp,
+	encode_debug,
+	decode_debug,
+	NULL,
+	encode_cplx,
+	decode_lowres,
+	decode_reset,
 };
 
 static struct vidcodec h263 = {
@@ -156,6 +243,12 @@ static struct vidcodec h263 = {
 	decode_h263,
 	h263_fmtp_enc,
 	NULL,
+	encode_debug,
+	decode_debug,
+	NULL,
+	NULL,
+	decode_lowres,
+	decode_reset,
 };
 
 static struct vidcodec mpg4 = {
@@ -170,11 +263,63 @@ static struct vidcodec mpg4 = {
 	decode_mpeg4,
 	mpg4_fmtp_enc,
 	NULL,
+	encode_debug,
+	decode_debug,
+	NULL,
+	NULL,
+	decode_lowres,
+	decode_reset,
 };
 
 
 static int module_init(void)
 {
+	struct conf *conf = conf_cur();
+	struct pl pl;
+
+	conf_get_str(conf, "avcodec_hwaccel", avcodec_conf.hwaccel,
+		     sizeof(avcodec_conf.hwaccel));
+	conf_get_str(conf, "avcodec_hwdevice", avcodec_conf.hwdevice,
+		     sizeof(avcodec_conf.hwdevice));
+	conf_get_str(conf, "avcodec_h264dec", avcodec_conf.h264dec,
+		     sizeof(avcodec_conf.h264dec));
+	conf_get_str(conf, "avcodec_h264enc", avcodec_conf.h264enc,
+		     sizeof(avcodec_conf.h264enc));
+	conf_get_u32(conf, "avcodec_dec_threads", &avcodec_conf.dec_threads);
+	conf_get_u32(conf, "avcodec_enc_threads", &avcodec_conf.enc_threads);
+	conf_get_bool(conf, "avcodec_low_delay", &avcodec_conf.low_delay);
+
+	avcodec_conf.dec_thread_type = FF_THREAD_SLICE;
+	if (0 == conf_get(conf, "avcodec_dec_threading", &pl)) {
+		if (0 == pl_strcasecmp(&pl, "slice"))
+			avcodec_conf.dec_thread_type = FF_THREAD_SLICE;
+		else if (0 == pl_strcasecmp(&pl, "frame"))
+			avcodec_conf.dec_thread_type = FF_THREAD_FRAME;
+		else if (0 == pl_strcasecmp(&pl, "auto"))
+			avcodec_conf.dec_thread_type = FF_THREAD_SLICE |
+				FF_THREAD_FRAME;
+		else
+			warning("avcodec: unknown threading: %r\n", &pl);
+	}
+
+#ifndef USE_AVCODEC_HW
+	if (str_isset(avcodec_conf.hwaccel))
+		warning("avcodec: hardware decoding needs FFmpeg 4.0\n");
+#endif
+
+#ifdef USE_X264
+	/* a named H.264 encoder replaces libx264 */
+	if (str_isset(avcodec_conf.h264enc)) {
+		h264.ench   = encode;
+		h264_1.ench = encode;
+	}
+	else {
+		/* libx264 takes NV12 frames from the source as they are */
+		h264.enc_nv12   = true;
+		h264_1.enc_nv12 = true;
+	}
+#endif
+
 #ifdef USE_X264
 	debug("avcodec: x264 build %d\n", X264_BUILD);
 #else
@@ -185,10 +330,15 @@ static int module_init(void)
 	avcodec_init();
 #endif
 
+	/* FFmpeg 4.0 registers its codecs statically */
+#if LIBAVCODEC_VERSION_INT < ((58<<16)+(9<<8)+100)
 	avcodec_register_all();
+#endif
 
-	if (avcodec_find_decoder(AV_CODEC_ID_H264))
+	if (avcodec_find_decoder(AV_CODEC_ID_H264)) {
 		vidcodec_register(&h264);
+		vidcodec_register(&h264_1);
+	}
 
 	if (avcodec_find_decoder(AV_CODEC_ID_H263))
 		vidcodec_register(&h263);
@@ -204,6 +354,7 @@ static int module_close(void)
 {
 	vidcodec_unregister(&mpg4);
 	vidcodec_unregister(&h263);
+	vidcodec_unregister(&h264_1);
 	vidcodec_unregister(&h264);
 
 	return 0;
@@ -16,9 +16,55 @@
 #endif
 
 
+/* Hardware devices and codec selection (FFmpeg 4.0 and later) */
+#if LIBAVCODEC_VERSION_INT >= ((58<<16)+(18<<8)+100)
+#define USE_AVCODEC_HW 1
+#include <libavutil/hwcontext.h>
+#endif
+
+#ifndef FF_THREAD_FRAME
+#define FF_THREAD_FRAME 1
+#define FF_THREAD_SLICE 2
+#endif
+
+/* decoding of slices before the picture is complete */
+#if !defined(AV_CODEC_FLAG2_CHUNKS) && defined(CODEC_FLAG2_CHUNKS)
+#define AV_CODEC_FLAG2_CHUNKS CODEC_FLAG2_CHUNKS
+#endif
+
+/* thread_type and active_thread_type */
+#if LIBAVCODEC_VERSION_INT >= ((52<<16)+(113<<8)+0)
+#define USE_AVCODEC_THREAD_TYPE 1
+#endif
+
+
 extern const uint8_t h264_level_idc;
 
 
+/*
+ * Configuration
+ */
+
+struct avcodec_conf {
+	char hwaccel[32];      /**< Hardware decode device type, e.g. vaapi */
+	char hwdevice[256];    /**< Device to open, e.g. /dev/dri/renderD128 */
+	char h264dec[32];      /**< H.264 decoder by name, e.g. h264_cuvid  */
+	char h264enc[32];      /**< H.264 encoder by name, e.g. h264_nvenc  */
+	uint32_t dec_threads;  /**< Decoder threads, 0 for one per core     */
+	int dec_thread_type;   /**< FF_THREAD_SLICE and/or FF_THREAD_FRAME  */
+	uint32_t enc_threads;  /**< Encoder slice threads, 0 for automatic  */
+	bool low_delay;        /**< Send and decode each slice when done    */
+};
+
+extern struct avcodec_conf avcodec_conf;
+
+const char *avcodec_thread_name(int type);
+
+#ifdef USE_AVCODEC_HW
+int avcodec_hw_device(AVBufferRef **devp, enum AVHWDeviceType type);
+#endif
+
+
 /*
  * Encode
  */
@@ -29,6 +75,8 @@ int encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 		  struct videnc_param *prm, const char *fmtp,
 		  videnc_packet_h *pkth, void *arg);
 int encode(struct videnc_state *st, bool update, const struct vidframe *frame);
+int encode_debug(struct re_printf *pf, const struct videnc_state *st);
+int encode_cplx(struct videnc_state *st, unsigned level);
 #ifdef USE_X264
 int encode_x264(struct videnc_state *st, bool update,
 		const struct vidframe *frame);
@@ -49,6 +97,10 @@ int decode_h264(struct viddec_state *st, struct vidframe *frame,
 		bool eof, uint16_t seq, struct mbuf *src);
 int decode_mpeg4(struct viddec_state *st, struct vidframe *frame,
 		 bool eof, uint16_t seq, struct mbuf *src);
+int decode_debug(struct re_printf *pf, const struct viddec_state *st);
+int decode_lowres(struct viddec_state *st, unsigned lowres,
+		  bool skip_nonref);
+int decode_reset(struct viddec_state *st);
 int decode_h263_test(struct viddec_state *st, struct vidframe *frame,
 		     bool marker, uint16_t seq, struct mbuf *src);
 
@@ -23,58 +23,191 @@
 #endif
 
 
+/* Failed frames in a row before a hardware decoder is given up */
+enum { HW_MAX_ERRORS = 3 };
+
+
 struct viddec_state {
 	AVCodec *codec;
 	AVCodecContext *ctx;
 	AVFrame *pict;
 	struct mbuf *mb;
 	bool got_keyframe;
+	bool chunks;        /* slices are decoded before the marker */
+	bool nal_done;      /* the last packet completed a slice    */
+	unsigned hw_errors;
+	unsigned lowres;    /* decoded size is 1/2^lowres           */
+	bool skip_nonref;   /* non-reference pictures are skipped   */
+
+#ifdef USE_AVCODEC_HW
+	AVFrame *sw_pict;              /* picture downloaded from the device */
+	enum AVPixelFormat hw_pix_fmt; /* AV_PIX_FMT_NONE in software */
+#endif
 };
 
 
+static void close_decoder(struct viddec_state *st)
+{
+	if (!st->ctx)
+		return;
+
+	if (st->ctx->codec)
+		avcodec_close(st->ctx);
+#ifdef USE_AVCODEC_HW
+	av_buffer_unref(&st->ctx->hw_device_ctx);
+#endif
+	av_free(st->ctx);
+	st->ctx = NULL;
+}
+
+
 static void destructor(void *arg)
 {
 	struct viddec_state *st = arg;
 
 	mem_deref(st->mb);
 
-	if (st->ctx) {
-		if (st->ctx->codec)
-			avcodec_close(st->ctx);
-		av_free(st->ctx);
-	}
+	close_decoder(st);
 
 	if (st->pict)
 		av_free(st->pict);
+
+#ifdef USE_AVCODEC_HW
+	av_frame_free(&st->sw_pict);
+#endif
 }
 
 
-static int init_decoder(struct viddec_state *st, const char *name)
+#ifdef USE_AVCODEC_HW
+static enum AVPixelFormat get_hw_format(AVCodecContext *ctx,
+					const enum AVPixelFormat *fmts)
 {
-	enum AVCodecID codec_id;
+	const struct viddec_state *st = ctx->opaque;
+	const enum AVPixelFormat *p;
 
-	codec_id = avcodec_resolve_codecid(name);
-	if (codec_id == AV_CODEC_ID_NONE)
-		return EINVAL;
+	for (p = fmts; *p != AV_PIX_FMT_NONE; p++) {
+		if (*p == st->hw_pix_fmt)
+			return *p;
+	}
 
-	st->codec = avcodec_find_decoder(codec_id);
-	if (!st->codec)
-		return ENOENT;
+	warning("avcodec: decode: no %s surfaces for this stream\n",
+		av_get_pix_fmt_name(st->hw_pix_fmt));
+
+	return avcodec_default_get_format(ctx, fmts);
+}
+
+
+/* Decode on the configured hardware device, if the decoder can */
+static int init_hw(struct viddec_state *st)
+{
+	enum AVHWDeviceType type;
+	int i, err;
+
+	type = av_hwdevice_find_type_by_name(avcodec_conf.hwaccel);
+	if (type == AV_HWDEVICE_TYPE_NONE)
+		return ENOTSUP;
+
+	for (i=0;; i++) {
+		const AVCodecHWConfig *cfg;
+
+		cfg = avcodec_get_hw_config(st->codec, i);
+		if (!cfg)
+			return ENOTSUP;
+
+		if (cfg->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX &&
+		    cfg->device_type == type) {
+			st->hw_pix_fmt = cfg->pix_fmt;
+			break;
+		}
+	}
+
+	if (!st->sw_pict) {
+		st->sw_pict = av_frame_alloc();
+		if (!st->sw_pict)
+			return ENOMEM;
+	}
+
+	err = avcodec_hw_device(&st->ctx->hw_device_ctx, type);
+	if (err)
+		return err;
+
+	st->ctx->opaque     = st;
+	st->ctx->get_format = get_hw_format;
+
+	return 0;
+}
+#endif
+
+
+static bool decoder_is_hw(const struct viddec_state *st)
+{
+#ifdef USE_AVCODEC_HW
+	if (st->hw_pix_fmt != AV_PIX_FMT_NONE)
+		return true;
+#endif
+	return st->codec != avcodec_find_decoder(st->codec->id);
+}
+
+static int open_decoder(struct viddec_state *st, bool hw)
+{
+	close_decoder(st);
 
 #if LIBAVCODEC_VERSION_INT >= ((52<<16)+(92<<8)+0)
 	st->ctx = avcodec_alloc_context3(st->codec);
 #else
 	st->ctx = avcodec_alloc_context();
 #endif
+	if (!st->ctx)
+		return ENOMEM;
 
-#if LIBAVUTIL_VERSION_INT >= ((52<<16)+(20<<8)+100)
-	st->pict = av_frame_alloc();
+	st->hw_errors = 0;
+
+#ifdef USE_AVCODEC_HW
+	st->hw_pix_fmt = AV_PIX_FMT_NONE;
+
+	if (hw) {
+		int err = init_hw(st);
+		if (err) {
+			warning("avcodec: %s decoding not available (%m),"
+				" using software\n",
+				avcodec_conf.hwaccel, err);
+			st->hw_pix_fmt = AV_PIX_FMT_NONE;
+		}
+		else {
+			info("avcodec: decoding on %s\n",
+			     avcodec_conf.hwaccel);
+		}
+	}
 #else
-	st->pict = avcodec_alloc_frame();
+	(void)hw;
 #endif
 
-	if (!st->ctx || !st->pict)
-		return ENOMEM;
+	/* threads are of no use to hardware */
+	st->ctx->thread_count = decoder_is_hw(st) ? 1
+		: (int)avcodec_conf.dec_threads;
+#ifdef USE_AVCODEC_THREAD_TYPE
+	st->ctx->thread_type  = avcodec_conf.dec_thread_type;
+#endif
+
+	st->chunks = false;
+
+	if (!decoder_is_hw(st))
+		st->ctx->lowres = st->lowres;
+	if (st->skip_nonref)
+		st->ctx->skip_frame = AVDISCARD_NONREF;
+
+#ifdef AV_CODEC_FLAG2_CHUNKS
+	/* frame threads need whole pictures */
+	if (avcodec_conf.low_delay && st->codec->id == AV_CODEC_ID_H264 &&
+	    !decoder_is_hw(st)) {
+
+		st->ctx->flags2 |= AV_CODEC_FLAG2_CHUNKS;
+#ifdef USE_AVCODEC_THREAD_TYPE
+		st->ctx->thread_type = FF_THREAD_SLICE;
+#endif
+		st->chunks = true;
+	}
+#endif
 
 #if LIBAVCODEC_VERSION_INT >= ((53<<16)+(8<<8)+0)
 	if (avcodec_open2(st->ctx, st->codec, NULL) < 0)
@@ -88,6 +221,60 @@ static int init_decoder(struct viddec_state *st, const char *name)
 }
 
 
+static int init_decoder(struct viddec_state *st, const char *name)
+{
+	enum AVCodecID codec_id;
+
+	codec_id = avcodec_resolve_codecid(name);
+	if (codec_id == AV_CODEC_ID_NONE)
+		return EINVAL;
+
+	if (codec_id == AV_CODEC_ID_H264 && str_isset(avcodec_conf.h264dec)) {
+
+		st->codec = avcodec_find_decoder_by_name(avcodec_conf.h264dec);
+		if (!st->codec) {
+			warning("avcodec: decoder %s not found,"
+				" using software\n", avcodec_conf.h264dec);
+		}
+	}
+
+	if (!st->codec)
+		st->codec = avcodec_find_decoder(codec_id);
+	if (!st->codec)
+		return ENOENT;
+
+#if LIBAVUTIL_VERSION_INT >= ((52<<16)+(20<<8)+100)
+	st->pict = av_frame_alloc();
+#else
+	st->pict = avcodec_alloc_frame();
+#endif
+	if (!st->pict)
+		return ENOMEM;
+
+	return open_decoder(st, str_isset(avcodec_conf.hwaccel));
+}
+
+
+/* Give up a hardware or named decoder, for the software one */
+static int fallback_decoder(struct viddec_state *st)
+{
+	enum AVCodecID codec_id = st->codec->id;
+
+	warning("avcodec: %s decoding failed, falling back to software\n",
+		st->codec->name);
+
+	st->codec = avcodec_find_decoder(codec_id);
+	if (!st->codec)
+		return ENOENT;
+
+	/* the new decoder needs the parameter sets again */
+	st->got_keyframe = codec_id != AV_CODEC_ID_H264;
+
+	return open_decoder(st, false);
+}
+
+
+
 int decode_update(struct viddec_state **vdsp, const struct vidcodec *vc,
 		  const char *fmtp)
 {
@@ -130,6 +317,30 @@ int decode_update(struct viddec_state **vdsp, const struct vidcodec *vc,
 }
 
 
+#ifdef USE_AVCODEC_HW
+/* Copy a decoded surface to memory, as YUV420P if the device can */
+static int download_frame(struct viddec_state *st)
+{
+	av_frame_unref(st->sw_pict);
+
+	st->sw_pict->format = AV_PIX_FMT_YUV420P;
+	if (av_hwframe_transfer_data(st->sw_pict, st->pict, 0) >= 0)
+		return 0;
+
+	av_frame_unref(st->sw_pict);
+
+	st->sw_pict->format = AV_PIX_FMT_NONE;
+	if (av_hwframe_transfer_data(st->sw_pict, st->pict, 0) >= 0)
+		return 0;
+
+	warning("avcodec: decode: could not download %s surface\n",
+		av_get_pix_fmt_name(st->pict->format));
+
+	return EBADMSG;
+}
+#endif
+
+
 /*
  * TODO: check input/output size
  */
@@ -148,6 +359,10 @@ static int ffdecode(struct viddec_state *st, struct vidframe *frame,
 
 	st->mb->pos = 0;
 
+	/* the slices were decoded as chunks already */
+	if (!st->mb->end)
+		goto out;
+
 	if (!st->got_keyframe) {
 		err = EPROTO;
 		goto out;
@@ -172,26 +387,47 @@ static int ffdecode(struct viddec_state *st, struct vidframe *frame,
 
 	if (ret < 0) {
 		err = EBADMSG;
+		if (decoder_is_hw(st) && ++st->hw_errors >= HW_MAX_ERRORS)
+			err = fallback_decoder(st) ? ENOENT : EBADMSG;
 		goto out;
 	}
 
+	st->hw_errors = 0;
+
 	mbuf_skip_to_end(src);
 
 	if (got_picture) {
 
+		AVFrame *pict = st->pict;
+
+#ifdef USE_AVCODEC_HW
+		if (pict->format == st->hw_pix_fmt) {
+
+			err = download_frame(st);
+			if (err)
+				goto out;
+
+			pict = st->sw_pict;
+		}
+#endif
+
 #if LIBAVCODEC_VERSION_INT >= ((53<<16)+(5<<8)+0)
-		switch (st->pict->format) {
+		switch (pict->format) {
 
 		case AV_PIX_FMT_YUV420P:
 		case AV_PIX_FMT_YUVJ420P:
 			frame->fmt = VID_FMT_YUV420P;
 			break;
 
+		case AV_PIX_FMT_NV12:
+			frame->fmt = VID_FMT_NV12;
+			break;
+
 		default:
 			warning("avcodec: decode: bad pixel format"
 				" (%i) (%s)\n",
-				st->pict->format,
-				av_get_pix_fmt_name(st->pict->format));
+				pict->format,
+				av_get_pix_fmt_name(pict->format));
 			goto out;
 		}
 #else
@@ -199,8 +435,8 @@ static int ffdecode(struct viddec_state *st, struct vidframe *frame,
 #endif
 
 		for (i=0; i<4; i++) {
-			frame->data[i]     = st->pict->data[i];
-			frame->linesize[i] = st->pict->linesize[i];
+			frame->data[i]     = pict->data[i];
+			frame->linesize[i] = pict->linesize[i];
 		}
 		frame->size.w = st->ctx->width;
 		frame->size.h = st->ctx->height;
@@ -214,12 +450,20 @@ static int ffdecode(struct viddec_state *st, struct vidframe *frame,
 }
 
 
+static inline bool is_slice(unsigned type)
+{
+	return type == H264_NAL_SLICE || type == H264_NAL_IDR_SLICE;
+}
+
+
 int h264_decode(struct viddec_state *st, struct mbuf *src)
 {
 	struct h264_hdr h264_hdr;
 	const uint8_t nal_seq[3] = {0, 0, 1};
 	int err;
 
+	st->nal_done = false;
+
 	err = h264_hdr_decode(&h264_hdr, src);
 	if (err)
 		return err;
@@ -247,6 +491,8 @@ int h264_decode(struct viddec_state *st, struct mbuf *src)
 
 		/* encode NAL header back to buffer */
 		err = h264_hdr_encode(&h264_hdr, st->mb);
+
+		st->nal_done = is_slice(h264_hdr.type);
 	}
 	else if (H264_NAL_FU_A == h264_hdr.type) {
 		struct h264_fu fu;
@@ -263,6 +509,37 @@ int h264_decode(struct viddec_state *st, struct mbuf *src)
 			/* encode NAL header back to buffer */
 			err = h264_hdr_encode(&h264_hdr, st->mb);
 		}
+
+		st->nal_done = fu.e && is_slice(fu.type);
+	}
+	else if (H264_NAL_STAP_A == h264_hdr.type) {
+
+		while (mbuf_get_left(src) >= 2) {
+
+			const uint16_t len = ntohs(mbuf_read_u16(src));
+
+			if (len < 1 || mbuf_get_left(src) < len)
+				return EBADMSG;
+
+			switch (mbuf_buf(src)[0] & 0x1f) {
+
+			case H264_NAL_PPS:
+			case H264_NAL_SPS:
+				st->got_keyframe = true;
+				break;
+			}
+
+			if (is_slice(mbuf_buf(src)[0] & 0x1f))
+				st->nal_done = true;
+
+			/* prepend H.264 NAL start sequence */
+			err  = mbuf_write_mem(st->mb, nal_seq, 3);
+			err |= mbuf_write_mem(st->mb, mbuf_buf(src), len);
+			if (err)
+				return err;
+
+			mbuf_advance(src, len);
+		}
 	}
 	else {
 		warning("avcodec: unknown NAL type %u\n", h264_hdr.type);
@@ -287,6 +564,11 @@ int decode_h264(struct viddec_state *st, struct vidframe *frame,
 	if (err)
 		return err;
 
+	/* with chunks, each slice is decoded when it is complete, and
+	 * the picture comes out with its last slice */
+	if (st->chunks && st->nal_done && st->got_keyframe)
+		eof = true;
+
 	return ffdecode(st, frame, eof, src);
 }
 
@@ -374,3 +656,91 @@ int decode_h263(struct viddec_state *st, struct vidframe *frame,
 
 	return ffdecode(st, frame, marker, src);
 }
+
+
+int decode_debug(struct re_printf *pf, const struct viddec_state *st)
+{
+	int err;
+
+	if (!st || !st->ctx)
+		return 0;
+
+	err = re_hprintf(pf, "%s", st->codec->name);
+#ifdef USE_AVCODEC_HW
+	if (st->hw_pix_fmt != AV_PIX_FMT_NONE)
+		err |= re_hprintf(pf, " on %s", avcodec_conf.hwaccel);
+#endif
+#ifdef USE_AVCODEC_THREAD_TYPE
+	err |= re_hprintf(pf, " threads=%d (%s)", st->ctx->thread_count,
+			  avcodec_thread_name(st->ctx->active_thread_type));
+#else
+	err |= re_hprintf(pf, " threads=%d", st->ctx->thread_count);
+#endif
+
+	return err;
+}
+
+
+/**
+ * Decode at a reduced size and skip non-reference pictures, for a
+ * small or slow display. The reduced size is limited by the decoder,
+ * and is not used in hardware.
+ *
+ * @param st          Decoder state
+ * @param lowres      Decode at 1/2^lowres of the size
+ * @param skip_nonref True to skip the pictures that are not references
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int decode_lowres(struct viddec_state *st, unsigned lowres,
+		  bool skip_nonref)
+{
+	int err = 0;
+
+	if (!st || !st->ctx)
+		return EINVAL;
+
+	if (decoder_is_hw(st))
+		lowres = 0;
+	else
+		lowres = min(lowres, (unsigned)st->codec->max_lowres);
+
+	st->skip_nonref = skip_nonref;
+	st->ctx->skip_frame = skip_nonref ? AVDISCARD_NONREF
+		: AVDISCARD_DEFAULT;
+
+	if (lowres == st->lowres)
+		return 0;
+
+	st->lowres = lowres;
+
+	/* the size is set on open, decoding starts again at a keyframe */
+	err = open_decoder(st, false);
+	if (st->codec->id == AV_CODEC_ID_H264)
+		st->got_keyframe = false;
+
+	return err;
+}
+
+
+/**
+ * Reset a kept decoder, for a switch back to its codec. The pictures
+ * it holds are flushed, and H.264 starts again at the parameter sets.
+ *
+ * @param st Decoder state
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int decode_reset(struct viddec_state *st)
+{
+	if (!st || !st->ctx)
+		return EINVAL;
+
+	avcodec_flush_buffers(st->ctx);
+
+	mbuf_rewind(st->mb);
+	st->nal_done     = false;
+	st->got_keyframe = st->codec->id != AV_CODEC_ID_H264;
+
+	return 0;
+}
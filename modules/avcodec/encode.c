@@ -15,6 +15,12 @@
 #include "avcodec.h"
 
 
+/* Slices from x264 as they are encoded (nalu_process) */
+#if defined(USE_X264) && X264_BUILD >= 115
+#define USE_X264_NALU 1
+#endif
+
+
 #if LIBAVUTIL_VERSION_MAJOR < 52
 #define AV_PIX_FMT_YUV420P PIX_FMT_YUV420P
 #define AV_PIX_FMT_NV12    PIX_FMT_NV12
@@ -23,6 +29,8 @@
 
 enum {
 	DEFAULT_GOP_SIZE =   10,
+	HW_POOL_SIZE     =    4,  /* surfaces of a hardware encoder */
+	FRAG_POOL_SIZE   =   64,  /* H.263 packets queued in the core */
 };
 
 
@@ -40,9 +48,12 @@ struct videnc_state {
 	size_t sz_max; /* todo: figure out proper buffer size */
 	int64_t pts;
 	struct mbuf *mb_frag;
+	struct mbuf *fragv[FRAG_POOL_SIZE]; /* packets passed by reference */
 	struct videnc_param encprm;
 	struct vidsz encsize;
+	enum vidfmt encfmt;       /* pixel format of the open encoder */
 	enum AVCodecID codec_id;
+	unsigned cplx;            /* complexity level, for the preset */
 	videnc_packet_h *pkth;
 	void *arg;
 
@@ -65,29 +76,70 @@ struct videnc_state {
 #ifdef USE_X264
 	x264_t *x264;
 #endif
+
+#ifdef USE_X264_NALU
+	struct {
+		struct lock *lock;    /* set if slices are sent when done */
+		struct list slicel;   /* slices finished out of order     */
+		int next_mb;          /* first macroblock of next slice   */
+		int mb_count;         /* macroblocks in a picture         */
+		int err;
+	} nalu;
+#endif
+
+#ifdef USE_AVCODEC_HW
+	AVBufferRef *hw_frames;   /* surface pool, if frames are uploaded */
+	AVFrame *hw_pict;
+#endif
 };
 
 
+static void close_encoder(struct videnc_state *st)
+{
+	if (st->ctx) {
+		if (st->ctx->codec)
+			avcodec_close(st->ctx);
+#ifdef USE_AVCODEC_HW
+		av_buffer_unref(&st->ctx->hw_frames_ctx);
+#endif
+		av_free(st->ctx);
+		st->ctx = NULL;
+	}
+
+	if (st->pict) {
+		av_free(st->pict);
+		st->pict = NULL;
+	}
+
+#ifdef USE_AVCODEC_HW
+	av_frame_free(&st->hw_pict);
+	av_buffer_unref(&st->hw_frames);
+#endif
+}
+
+
 static void destructor(void *arg)
 {
 	struct videnc_state *st = arg;
+	unsigned i;
 
 	mem_deref(st->mb);
 	mem_deref(st->mb_frag);
 
+	for (i=0; i<FRAG_POOL_SIZE; i++)
+		mem_deref(st->fragv[i]);
+
 #ifdef USE_X264
 	if (st->x264)
 		x264_encoder_close(st->x264);
 #endif
 
-	if (st->ctx) {
-		if (st->ctx->codec)
-			avcodec_close(st->ctx);
-		av_free(st->ctx);
-	}
+#ifdef USE_X264_NALU
+	list_flush(&st->nalu.slicel);
+	mem_deref(st->nalu.lock);
+#endif
 
-	if (st->pict)
-		av_free(st->pict);
+	close_encoder(st);
 }
 
 
@@ -133,6 +185,39 @@ static int decode_sdpparam_h263(struct videnc_state *st, const struct pl *name,
 
 static int init_encoder(struct videnc_state *st)
 {
+	if (st->codec_id == AV_CODEC_ID_H264 &&
+	    str_isset(avcodec_conf.h264enc)) {
+
+		st->codec = avcodec_find_encoder_by_name(avcodec_conf.h264enc);
+		if (!st->codec) {
+			warning("avcodec: encoder %s not found,"
+				" using software\n", avcodec_conf.h264enc);
+		}
+	}
+
+	if (!st->codec)
+		st->codec = avcodec_find_encoder(st->codec_id);
+	if (!st->codec)
+		return ENOENT;
+
+	return 0;
+}
+
+
+static bool encoder_is_hw(const struct videnc_state *st)
+{
+	return st->codec != avcodec_find_encoder(st->codec_id);
+}
+
+
+/* Give up a hardware or named encoder, for the software one */
+static int fallback_encoder(struct videnc_state *st)
+{
+	warning("avcodec: %s encoding failed, falling back to software\n",
+		st->codec->name);
+
+	close_encoder(st);
+
 	st->codec = avcodec_find_encoder(st->codec_id);
 	if (!st->codec)
 		return ENOENT;
@@ -141,6 +226,87 @@ static int init_encoder(struct videnc_state *st)
 }
 
 
+#ifdef USE_AVCODEC_HW
+/*
+ * Encoders that only take device surfaces, such as h264_vaapi, get a
+ * pool of them. The pictures are uploaded into it before encoding.
+ */
+static int init_hw_frames(struct videnc_state *st, const struct vidsz *size,
+			  int pix_fmt)
+{
+	const AVCodecHWConfig *cfg;
+	AVHWFramesContext *fc;
+	AVBufferRef *dev = NULL;
+	int i, err;
+
+	if (st->codec->pix_fmts) {
+		const enum AVPixelFormat *p;
+
+		for (p = st->codec->pix_fmts; *p != AV_PIX_FMT_NONE; p++) {
+			if (*p == pix_fmt)
+				return 0;
+		}
+	}
+
+	for (i=0;; i++) {
+
+		cfg = avcodec_get_hw_config(st->codec, i);
+		if (!cfg)
+			return 0;
+
+		if (cfg->methods & AV_CODEC_HW_CONFIG_METHOD_HW_FRAMES_CTX)
+			break;
+	}
+
+	err = avcodec_hw_device(&dev, cfg->device_type);
+	if (err)
+		return err;
+
+	st->hw_frames = av_hwframe_ctx_alloc(dev);
+	av_buffer_unref(&dev);
+	st->hw_pict = av_frame_alloc();
+	if (!st->hw_frames || !st->hw_pict)
+		return ENOMEM;
+
+	fc = (AVHWFramesContext *)st->hw_frames->data;
+	fc->format            = cfg->pix_fmt;
+	fc->sw_format         = pix_fmt;
+	fc->width             = size->w;
+	fc->height            = size->h;
+	fc->initial_pool_size = HW_POOL_SIZE;
+
+	if (av_hwframe_ctx_init(st->hw_frames) < 0)
+		return ENOTSUP;
+
+	st->ctx->hw_frames_ctx = av_buffer_ref(st->hw_frames);
+	if (!st->ctx->hw_frames_ctx)
+		return ENOMEM;
+
+	st->ctx->pix_fmt = cfg->pix_fmt;
+
+	return 0;
+}
+
+
+static int upload_frame(struct videnc_state *st)
+{
+	av_frame_unref(st->hw_pict);
+
+	if (av_hwframe_get_buffer(st->hw_frames, st->hw_pict, 0) < 0)
+		return ENOMEM;
+
+	if (av_hwframe_transfer_data(st->hw_pict, st->pict, 0) < 0)
+		return EBADMSG;
+
+	st->hw_pict->pts       = st->pict->pts;
+	st->hw_pict->key_frame = st->pict->key_frame;
+	st->hw_pict->pict_type = st->pict->pict_type;
+
+	return 0;
+}
+#endif
+
+
 static int open_encoder(struct videnc_state *st,
 			const struct videnc_param *prm,
 			const struct vidsz *size,
@@ -148,14 +314,7 @@ static int open_encoder(struct videnc_state *st,
 {
 	int err = 0;
 
-	if (st->ctx) {
-		if (st->ctx->codec)
-			avcodec_close(st->ctx);
-		av_free(st->ctx);
-	}
-
-	if (st->pict)
-		av_free(st->pict);
+	close_encoder(st);
 
 #if LIBAVCODEC_VERSION_INT >= ((52<<16)+(92<<8)+0)
 	st->ctx = avcodec_alloc_context3(st->codec);
@@ -190,10 +349,40 @@ static int open_encoder(struct videnc_state *st,
 		st->ctx->max_qdiff = 4;
 	}
 
-#if LIBAVCODEC_VERSION_INT >= ((53<<16)+(8<<8)+0)
-	if (avcodec_open2(st->ctx, st->codec, NULL) < 0) {
-		err = ENOENT;
+	/* slice threads add no delay, as with --tune zerolatency */
+	st->ctx->thread_count = avcodec_conf.enc_threads;
+#ifdef USE_AVCODEC_THREAD_TYPE
+	st->ctx->thread_type  = FF_THREAD_SLICE;
+#endif
+
+	/* no reordering delay on hardware either */
+	if (encoder_is_hw(st))
+		st->ctx->max_b_frames = 0;
+
+#ifdef USE_AVCODEC_HW
+	err = init_hw_frames(st, size, pix_fmt);
+	if (err)
 		goto out;
+#endif
+
+#if LIBAVCODEC_VERSION_INT >= ((53<<16)+(8<<8)+0)
+	{
+		AVDictionary *opts = NULL;
+		int ret;
+
+		/* a faster preset under CPU pressure */
+		if (st->cplx && st->codec_id == AV_CODEC_ID_H264 &&
+		    !encoder_is_hw(st)) {
+			av_dict_set(&opts, "preset", st->cplx > 1 ?
+				    "ultrafast" : "superfast", 0);
+		}
+
+		ret = avcodec_open2(st->ctx, st->codec, &opts);
+		av_dict_free(&opts);
+		if (ret < 0) {
+			err = ENOENT;
+			goto out;
+		}
 	}
 #else
 	if (avcodec_open(st->ctx, st->codec) < 0) {
@@ -209,19 +398,8 @@ static int open_encoder(struct videnc_state *st,
 #endif
 
  out:
-	if (err) {
-		if (st->ctx) {
-			if (st->ctx->codec)
-				avcodec_close(st->ctx);
-			av_free(st->ctx);
-			st->ctx = NULL;
-		}
-
-		if (st->pict) {
-			av_free(st->pict);
-			st->pict = NULL;
-		}
-	}
+	if (err)
+		close_encoder(st);
 	else
 		st->encsize = *size;
 
@@ -235,7 +413,7 @@ int decode_sdpparam_h264(struct videnc_state *st, const struct pl *name,
 	if (0 == pl_strcasecmp(name, "packetization-mode")) {
 		st->u.h264.packetization_mode = pl_u32(val);
 
-		if (st->u.h264.packetization_mode != 0) {
+		if (st->u.h264.packetization_mode > 1) {
 			warning("avcodec: illegal packetization-mode %u\n",
 				st->u.h264.packetization_mode);
 			return EPROTO;
@@ -300,6 +478,39 @@ static int general_packetize(struct mbuf *mb, size_t pktsize,
 }
 
 
+/*
+ * Build one H.263 packet in a pooled buffer with headroom and tailroom
+ * and hand it over to the core, instead of building it in mb_frag which
+ * is then copied. Returns ENOBUFS if no pooled buffer is free.
+ */
+static int h263_frag_send(struct videnc_state *st,
+			  const struct h263_hdr *hdr, bool last,
+			  const uint8_t *pld, size_t pld_len)
+{
+	struct mbuf *mb;
+	int err;
+
+	mb = videnc_pkt_get(st->fragv, FRAG_POOL_SIZE,
+			    H263_HDR_SIZE_MODEC + st->encprm.pktsize);
+	if (!mb)
+		return ENOBUFS;
+
+	err  = h263_hdr_encode(hdr, mb);
+	err |= mbuf_write_mem(mb, pld, pld_len);
+	if (err)
+		goto out;
+
+	mb->pos = VIDENC_PRESZ;
+
+	err = st->encprm.pkth_mb(last, mb, st->arg);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
 static int h263_packetize(struct videnc_state *st, struct mbuf *mb,
 			  videnc_packet_h *pkth, void *arg)
 {
@@ -328,6 +539,21 @@ static int h263_packetize(struct videnc_state *st, struct mbuf *mb,
 
 		sz = last ? left : st->encprm.pktsize;
 
+		if (st->encprm.pkth_mb) {
+			err = h263_frag_send(st, &h263_hdr, last,
+					     mbuf_buf(mb), sz);
+			if (!err) {
+				mbuf_advance(mb, sz);
+				continue;
+			}
+			else if (err != ENOBUFS) {
+				break;
+			}
+
+			/* the core copies it into its own pooled buffer */
+			err = 0;
+		}
+
 		st->mb_frag->pos = st->mb_frag->end = pos;
 		err = mbuf_write_mem(st->mb_frag, mbuf_buf(mb), sz);
 		if (err)
@@ -346,6 +572,136 @@ static int h263_packetize(struct videnc_state *st, struct mbuf *mb,
 
 
 #ifdef USE_X264
+static int nal_send_x264(struct videnc_state *st, const x264_nal_t *nal,
+			 bool marker)
+{
+	const uint8_t hdr = nal->i_ref_idc<<5 | nal->i_type<<0;
+	int offset = 0;
+
+#if X264_BUILD >= 76
+	const uint8_t *p = nal->p_payload;
+
+	/* Find the NAL Escape code [00 00 01] */
+	if (nal->i_payload > 4 && p[0] == 0x00 && p[1] == 0x00) {
+		if (p[2] == 0x00 && p[3] == 0x01)
+			offset = 4 + 1;
+		else if (p[2] == 0x01)
+			offset = 3 + 1;
+	}
+#endif
+
+	/* skip Supplemental Enhancement Information (SEI) */
+	if (nal->i_type == H264_NAL_SEI)
+		return 0;
+
+	return h264_nal_send(true, true, marker, hdr,
+			     nal->p_payload + offset,
+			     nal->i_payload - offset,
+			     st->encprm.pktsize, st->pkth, st->arg);
+}
+
+
+#ifdef USE_X264_NALU
+/* A slice, encoded into the buffer that follows it */
+struct slice {
+	struct le le;
+	x264_nal_t nal;
+};
+
+
+static void slice_destructor(void *arg)
+{
+	struct slice *sl = arg;
+
+	list_unlink(&sl->le);
+}
+
+
+/*
+ * Send the slices that continue the picture, in order of their
+ * macroblocks. With all set, send what is left at the end of the
+ * picture. Must be called with the lock held.
+ */
+static void slices_send(struct videnc_state *st, bool all)
+{
+	struct le *le;
+
+	while ((le = st->nalu.slicel.head)) {
+
+		struct slice *sl = le->data;
+		bool marker;
+
+		if (!all && sl->nal.i_first_mb != st->nalu.next_mb)
+			break;
+
+		st->nalu.next_mb = sl->nal.i_last_mb + 1;
+
+		marker = all ? !le->next
+			: st->nalu.next_mb >= st->nalu.mb_count;
+
+		st->nalu.err |= nal_send_x264(st, &sl->nal, marker);
+
+		mem_deref(sl);
+	}
+}
+
+
+/*
+ * Called by the slice threads of x264 for each NAL unit when it is
+ * done, before the picture is. The packets are queued in the core at
+ * once, which sends them with the next poll of the send queue.
+ */
+static void nalu_handler(x264_t *h, x264_nal_t *nal, void *opaque)
+{
+	struct videnc_state *st = opaque;
+	struct slice *sl;
+	struct le *le;
+
+	/* x264 needs this much for the escaped NAL unit */
+	sl = mem_zalloc(sizeof(*sl) + nal->i_payload * 3 / 2 + 5 + 64,
+			slice_destructor);
+	if (!sl) {
+		lock_write_get(st->nalu.lock);
+		st->nalu.err = ENOMEM;
+		lock_rel(st->nalu.lock);
+		return;
+	}
+
+	x264_nal_encode(h, (uint8_t *)(sl + 1), nal);
+	sl->nal = *nal;
+
+	lock_write_get(st->nalu.lock);
+
+	/* parameter sets come before the slices of the picture */
+	if (nal->i_type != H264_NAL_SLICE &&
+	    nal->i_type != H264_NAL_IDR_SLICE) {
+
+		st->nalu.err |= nal_send_x264(st, &sl->nal, false);
+		mem_deref(sl);
+		goto out;
+	}
+
+	for (le = st->nalu.slicel.head; le; le = le->next) {
+
+		const struct slice *sl2 = le->data;
+
+		if (sl2->nal.i_first_mb > nal->i_first_mb)
+			break;
+	}
+
+	if (le)
+		list_insert_before(&st->nalu.slicel, le, &sl->le, sl);
+	else
+		list_append(&st->nalu.slicel, &sl->le, sl);
+
+	slices_send(st, false);
+
+ out:
+	lock_rel(st->nalu.lock);
+}
+#endif
+
+
 static int open_encoder_x264(struct videnc_state *st, struct videnc_param *prm,
 			     const struct vidsz *size, int csp)
 {
@@ -395,11 +751,29 @@ static int open_encoder_x264(struct videnc_state *st, struct videnc_param *prm,
 	xprm.rc.i_lookahead = 0;
 	xprm.i_sync_lookahead = 0;
 	xprm.i_bframe = 0;
+	xprm.b_sliced_threads = 1;
+	xprm.i_threads = avcodec_conf.enc_threads ? avcodec_conf.enc_threads
+		: X264_THREADS_AUTO;
 #endif
 
 	/* put SPS/PPS before each keyframe */
 	xprm.b_repeat_headers = 1;
 
+#ifdef USE_X264_NALU
+	/* one slice per packet, each sent as soon as it is encoded */
+	if (avcodec_conf.low_delay) {
+
+		if (!st->nalu.lock && lock_alloc(&st->nalu.lock))
+			return ENOMEM;
+
+		xprm.nalu_process     = nalu_handler;
+		xprm.i_slice_max_size = prm->pktsize;
+
+		st->nalu.mb_count = ((size->w + 15) / 16) *
+			((size->h + 15) / 16);
+	}
+#endif
+
 #if X264_BUILD >= 82
 	/* needed for x264_encoder_intra_refresh() */
 	xprm.b_intra_refresh = 1;
@@ -460,6 +834,9 @@ int encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 	if (st->codec_id == AV_CODEC_ID_H264) {
 #ifndef USE_X264
 		err = init_encoder(st);
+#else
+		if (str_isset(avcodec_conf.h264enc))
+			err = init_encoder(st);
 #endif
 	}
 	else
@@ -521,11 +898,14 @@ int encode_x264(struct videnc_state *st, bool update,
 		return ENOTSUP;
 	}
 
-	if (!st->x264 || !vidsz_cmp(&st->encsize, &frame->size)) {
+	if (!st->x264 || !vidsz_cmp(&st->encsize, &frame->size) ||
+	    st->encfmt != frame->fmt) {
 
 		err = open_encoder_x264(st, &st->encprm, &frame->size, csp);
 		if (err)
 			return err;
+
+		st->encfmt = frame->fmt;
 	}
 
 	if (update) {
@@ -548,47 +928,72 @@ int encode_x264(struct videnc_state *st, bool update,
 		pic_in.img.plane[i]    = frame->data[i];
 	}
 
+#ifdef USE_X264_NALU
+	pic_in.opaque = st;
+#endif
+
 	ret = x264_encoder_encode(st->x264, &nal, &i_nal, &pic_in, &pic_out);
 	if (ret < 0) {
 		fprintf(stderr, "x264 [error]: x264_encoder_encode failed\n");
 	}
+
+#ifdef USE_X264_NALU
+	/* the slices were sent by nalu_handler() */
+	if (st->nalu.lock) {
+
+		lock_write_get(st->nalu.lock);
+
+		slices_send(st, true);
+
+		err = st->nalu.err;
+		st->nalu.err = 0;
+		st->nalu.next_mb = 0;
+
+		lock_rel(st->nalu.lock);
+
+		return err;
+	}
+#endif
+
 	if (i_nal == 0)
 		return 0;
 
 	err = 0;
-	for (i=0; i<i_nal && !err; i++) {
-		const uint8_t hdr = nal[i].i_ref_idc<<5 | nal[i].i_type<<0;
-		int offset = 0;
+	for (i=0; i<i_nal && !err; i++)
+		err = nal_send_x264(st, &nal[i], (i+1)==i_nal);
 
-#if X264_BUILD >= 76
-		const uint8_t *p = nal[i].p_payload;
-
-		/* Find the NAL Escape code [00 00 01] */
-		if (nal[i].i_payload > 4 && p[0] == 0x00 && p[1] == 0x00) {
-			if (p[2] == 0x00 && p[3] == 0x01)
-				offset = 4 + 1;
-			else if (p[2] == 0x01)
-				offset = 3 + 1;
-		}
+	return err;
+}
 #endif
 
-		/* skip Supplemental Enhancement Information (SEI) */
-		if (nal[i].i_type == H264_NAL_SEI)
-			continue;
 
-		err = h264_nal_send(true, true, (i+1)==i_nal, hdr,
-				    nal[i].p_payload + offset,
-				    nal[i].i_payload - offset,
-				    st->encprm.pktsize, st->pkth, st->arg);
-	}
+/*
+ * The preset of a software H.264 encoder can only be set when it is
+ * opened, so the encoder is opened again with the next frame. The
+ * direct libx264 encoder always runs the ultrafast preset.
+ */
+int encode_cplx(struct videnc_state *st, unsigned level)
+{
+	if (!st)
+		return EINVAL;
 
-	return err;
+	level = min(level, CPLX_LEVEL_MAX);
+
+	if (level == st->cplx || st->codec_id != AV_CODEC_ID_H264)
+		return 0;
+
+	st->cplx = level;
+
+	if (st->ctx && !encoder_is_hw(st))
+		close_encoder(st);
+
+	return 0;
 }
-#endif
 
 
 int encode(struct videnc_state *st, bool update, const struct vidframe *frame)
 {
+	AVFrame *pict;
 	int i, err, ret;
 	int pix_fmt;
 
@@ -611,13 +1016,20 @@ int encode(struct videnc_state *st, bool update, const struct vidframe *frame)
 		return ENOTSUP;
 	}
 
-	if (!st->ctx || !vidsz_cmp(&st->encsize, &frame->size)) {
+	if (!st->ctx || !vidsz_cmp(&st->encsize, &frame->size) ||
+	    st->encfmt != frame->fmt) {
 
 		err = open_encoder(st, &st->encprm, &frame->size, pix_fmt);
+		if (err && encoder_is_hw(st) && !fallback_encoder(st)) {
+			err = open_encoder(st, &st->encprm, &frame->size,
+					   pix_fmt);
+		}
 		if (err) {
 			warning("avcodec: open_encoder: %m\n", err);
 			return err;
 		}
+
+		st->encfmt = frame->fmt;
 	}
 
 	for (i=0; i<4; i++) {
@@ -639,6 +1051,22 @@ int encode(struct videnc_state *st, bool update, const struct vidframe *frame)
 		st->pict->pict_type = 0;
 	}
 
+	pict = st->pict;
+
+#ifdef USE_AVCODEC_HW
+	if (st->hw_frames) {
+
+		err = upload_frame(st);
+		if (err) {
+			warning("avcodec: upload to %s: %m\n",
+				st->codec->name, err);
+			return fallback_encoder(st);
+		}
+
+		pict = st->hw_pict;
+	}
+#endif
+
 	mbuf_rewind(st->mb);
 
 #if LIBAVCODEC_VERSION_INT >= ((54<<16)+(1<<8)+0)
@@ -652,9 +1080,12 @@ int encode(struct videnc_state *st, bool update, const struct vidframe *frame)
 		avpkt.size = (int)st->mb->size;
 
 		ret = avcodec_encode_video2(st->ctx, &avpkt,
-					    st->pict, &got_packet);
-		if (ret < 0)
+					    pict, &got_packet);
+		if (ret < 0) {
+			if (encoder_is_hw(st))
+				(void)fallback_encoder(st);
 			return EBADMSG;
+		}
 		if (!got_packet)
 			return 0;
 
@@ -663,7 +1094,7 @@ int encode(struct videnc_state *st, bool update, const struct vidframe *frame)
 	} while (0);
 #else
 	ret = avcodec_encode_video(st->ctx, st->mb->buf,
-				   (int)st->mb->size, st->pict);
+				   (int)st->mb->size, pict);
 	if (ret < 0 )
 		return EBADMSG;
 
@@ -684,9 +1115,11 @@ int encode(struct videnc_state *st, bool update, const struct vidframe *frame)
 		break;
 
 	case AV_CODEC_ID_H264:
-		err = h264_packetize(st->mb->buf, st->mb->end,
-				     st->encprm.pktsize,
-				     st->pkth, st->arg);
+		err = h264_packetize_ext(st->mb->buf, st->mb->end,
+					 st->encprm.pktsize,
+					 st->u.h264.packetization_mode == 1
+					 ? H264_PKT_STAP_A : 0,
+					 st->pkth, st->arg);
 		break;
 
 	case AV_CODEC_ID_MPEG4:
@@ -701,3 +1134,33 @@ int encode(struct videnc_state *st, bool update, const struct vidframe *frame)
 
 	return err;
 }
+
+
+int encode_debug(struct re_printf *pf, const struct videnc_state *st)
+{
+	if (!st)
+		return 0;
+
+#ifdef USE_X264
+	if (st->x264) {
+		x264_param_t xprm;
+
+		x264_encoder_parameters(st->x264, &xprm);
+
+		return re_hprintf(pf, "x264 threads=%d (%s)", xprm.i_threads,
+				  xprm.b_sliced_threads ? "slice" : "frame");
+	}
+#endif
+
+	if (!st->ctx)
+		return 0;
+
+#ifdef USE_AVCODEC_THREAD_TYPE
+	return re_hprintf(pf, "%s threads=%d (%s)", st->codec->name,
+			  st->ctx->thread_count,
+			  avcodec_thread_name(st->ctx->active_thread_type));
+#else
+	return re_hprintf(pf, "%s threads=%d", st->codec->name,
+			  st->ctx->thread_count);
+#endif
+}
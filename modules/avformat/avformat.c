@@ -7,6 +7,7 @@
 #define _BSD_SOURCE 1
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include <pthread.h>
 #include <re.h>
 #include <rem.h>
@@ -28,6 +29,20 @@
  \verbatim
   video_source            avformat,/tmp/testfile.mp4
  \endverbatim
+ *
+ * The packets are sent at the time of their timestamps. If the source is
+ * late by more than half a second, e.g. after a stall, or the timestamps
+ * jump, the clock starts again from the next packet.
+ *
+ * With FFmpeg 4.0 or later, an H.264 input is sent as it is while the
+ * stream encodes H.264, with no decode and encode. Other inputs can be
+ * decoded on a hardware device:
+ *
+ \verbatim
+  avformat_hwaccel        vaapi              # decode on a device type
+  avformat_hwdevice       /dev/dri/renderD128
+  avformat_passthrough    yes                # send H.264 undecoded
+ \endverbatim
  */
 
 
@@ -61,6 +76,20 @@
 #endif
 
 
+/* Hardware decoding and bitstream filters (FFmpeg 4.0 and later) */
+#if LIBAVCODEC_VERSION_INT >= ((58<<16)+(18<<8)+100)
+#define USE_AVFORMAT_HW 1
+#include <libavutil/hwcontext.h>
+#endif
+
+
+enum {
+	DRIFT_MAX = 500000,   /**< Max. lateness of a packet in [us]     */
+	JUMP_MAX  = 2000000,  /**< Max. wait for a packet in [us]        */
+	SLEEP_MAX = 100000,   /**< Max. sleep, to see st->run in [us]    */
+};
+
+
 struct vidsrc_st {
 	const struct vidsrc *vs;  /* inheritance */
 	pthread_t thread;
@@ -71,16 +100,48 @@ struct vidsrc_st {
 	struct SwsContext *sws;
 	struct vidsz app_sz;
 	struct vidsz sz;
+	int sws_fmt;               /**< Pixel format of the sws context  */
 	vidsrc_frame_h *frameh;
+	vidsrc_packet_h *pkth;
 	void *arg;
 	int sindex;
 	int fps;
+	AVRational tb;             /**< Time base of the stream          */
+	int64_t dts0;              /**< First timestamp since the start  */
+	int64_t t_loop;            /**< Time of dts0 in the clip [us]    */
+	int64_t t_pkt;             /**< Time of the last packet [us]     */
+	uint64_t t_start;          /**< Wall time of the clip start [us] */
+	unsigned n_resync;         /**< Times the clock started again    */
+#ifdef USE_AVFORMAT_HW
+	enum AVPixelFormat hw_pix_fmt; /**< AV_PIX_FMT_NONE in software  */
+	AVFrame *sw_frame;         /**< Frame downloaded from the device */
+	AVBSFContext *bsf;         /**< H.264 to Annex B, for passthrough*/
+	AVPacket *bsf_pkt;
+	bool pthru;                /**< Sending packets undecoded        */
+	unsigned n_pthru;          /**< Packets sent undecoded           */
+#endif
 };
 
 
+static struct {
+	char hwaccel[32];      /**< Hardware decode device type, e.g. vaapi */
+	char hwdevice[256];    /**< Device to open, e.g. /dev/dri/renderD128 */
+	bool passthrough;      /**< Send H.264 undecoded, if the stream can */
+} avformat_conf = {"", "", true};
+
 static struct vidsrc *mod_avf;
 
 
+static uint64_t time_us(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
 static void destructor(void *arg)
 {
 	struct vidsrc_st *st = arg;
@@ -96,6 +157,21 @@ static void destructor(void *arg)
 	if (st->ctx && st->ctx->codec)
 		avcodec_close(st->ctx);
 
+#ifdef USE_AVFORMAT_HW
+	if (st->ctx)
+		av_buffer_unref(&st->ctx->hw_device_ctx);
+	av_frame_free(&st->sw_frame);
+	av_bsf_free(&st->bsf);
+	av_packet_free(&st->bsf_pkt);
+
+	if (st->n_pthru)
+		debug("avformat: %u packets sent undecoded\n", st->n_pthru);
+#endif
+
+	if (st->n_resync)
+		debug("avformat: clock started again %u times\n",
+		      st->n_resync);
+
 	if (st->ic) {
 #if LIBAVFORMAT_VERSION_INT >= ((53<<16) + (21<<8) + 0)
 		avformat_close_input(&st->ic);
@@ -106,22 +182,179 @@ static void destructor(void *arg)
 }
 
 
+#ifdef USE_AVFORMAT_HW
+static enum AVPixelFormat get_hw_format(AVCodecContext *ctx,
+					const enum AVPixelFormat *fmts)
+{
+	const struct vidsrc_st *st = ctx->opaque;
+	const enum AVPixelFormat *p;
+
+	for (p = fmts; *p != AV_PIX_FMT_NONE; p++) {
+		if (*p == st->hw_pix_fmt)
+			return *p;
+	}
+
+	warning("avformat: no %s surfaces for this stream\n",
+		av_get_pix_fmt_name(st->hw_pix_fmt));
+
+	return avcodec_default_get_format(ctx, fmts);
+}
+
+
+/* Decode on the configured hardware device, if the decoder can */
+static int init_hw(struct vidsrc_st *st)
+{
+	enum AVHWDeviceType type;
+	const char *dev = NULL;
+	int i;
+
+	type = av_hwdevice_find_type_by_name(avformat_conf.hwaccel);
+	if (type == AV_HWDEVICE_TYPE_NONE)
+		return ENOTSUP;
+
+	for (i=0;; i++) {
+		const AVCodecHWConfig *cfg;
+
+		cfg = avcodec_get_hw_config(st->codec, i);
+		if (!cfg)
+			return ENOTSUP;
+
+		if (cfg->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX &&
+		    cfg->device_type == type) {
+			st->hw_pix_fmt = cfg->pix_fmt;
+			break;
+		}
+	}
+
+	st->sw_frame = av_frame_alloc();
+	if (!st->sw_frame)
+		return ENOMEM;
+
+	if (str_isset(avformat_conf.hwdevice))
+		dev = avformat_conf.hwdevice;
+
+	if (av_hwdevice_ctx_create(&st->ctx->hw_device_ctx, type, dev,
+				   NULL, 0) < 0)
+		return ENODEV;
+
+	st->ctx->opaque     = st;
+	st->ctx->get_format = get_hw_format;
+
+	return 0;
+}
+
+
+/* Passthrough needs the SPS and PPS in-band, as an Annex B stream */
+static int init_bsf(struct vidsrc_st *st, const AVStream *strm)
+{
+	const AVBitStreamFilter *filt;
+
+	filt = av_bsf_get_by_name("h264_mp4toannexb");
+	if (!filt)
+		return ENOSYS;
+
+	if (av_bsf_alloc(filt, &st->bsf) < 0)
+		return ENOMEM;
+
+	if (avcodec_parameters_copy(st->bsf->par_in, strm->codecpar) < 0)
+		return ENOMEM;
+
+	st->bsf->time_base_in = strm->time_base;
+
+	if (av_bsf_init(st->bsf) < 0)
+		return EINVAL;
+
+	st->bsf_pkt = av_packet_alloc();
+	if (!st->bsf_pkt)
+		return ENOMEM;
+
+	return 0;
+}
+
+
+/*
+ * Send a packet undecoded, if the stream encodes H.264. Passthrough
+ * starts on a keyframe, and the decoder starts again on the next
+ * keyframe when it stops.
+ *
+ * @return True if the packet was sent
+ */
+static bool send_packet(struct vidsrc_st *st, AVPacket *pkt, int64_t t)
+{
+	AVPacket *out = st->bsf_pkt;
+	bool sent = false;
+	int err;
+
+	if (!st->bsf)
+		return false;
+
+	if (!st->pthru && !(pkt->flags & AV_PKT_FLAG_KEY))
+		return false;
+
+	if (av_packet_ref(out, pkt) < 0)
+		return false;
+
+	if (av_bsf_send_packet(st->bsf, out) < 0) {
+		av_packet_unref(out);
+		return false;
+	}
+
+	while (av_bsf_receive_packet(st->bsf, out) == 0) {
+
+		int64_t pts = t;
+		uint32_t ts;
+
+		/* the RTP timestamp is the presentation time */
+		if (out->pts != AV_NOPTS_VALUE && out->dts != AV_NOPTS_VALUE)
+			pts += av_rescale_q(out->pts - out->dts, st->tb,
+					    AV_TIME_BASE_Q);
+
+		ts = (uint32_t)(pts * 9 / 100);
+
+		err = st->pkth("H264", out->data, out->size, ts, st->arg);
+		if (!err)
+			sent = true;
+		else if (err != ENOTSUP)
+			warning("avformat: passthrough: %m\n", err);
+
+		av_packet_unref(out);
+	}
+
+	if (sent != st->pthru) {
+		info("avformat: %s passthrough\n", sent ? "start" : "stop");
+
+		if (sent)
+			avcodec_flush_buffers(st->ctx);
+
+		st->pthru = sent;
+	}
+
+	if (sent)
+		++st->n_pthru;
+
+	return sent;
+}
+#endif
+
+
 static void handle_packet(struct vidsrc_st *st, AVPacket *pkt)
 {
 	AVPicture pict;
-	AVFrame *frame = NULL;
+	AVFrame *frame = NULL, *src;
 	struct vidframe vf;
 	struct vidsz sz;
 	unsigned i;
 
 	if (st->codec) {
-		int got_pict, ret;
+		int got_pict, ret, pix_fmt;
 
 #if LIBAVUTIL_VERSION_INT >= ((52<<16)+(20<<8)+100)
 		frame = av_frame_alloc();
 #else
 		frame = avcodec_alloc_frame();
 #endif
+		if (!frame)
+			return;
 
 #if LIBAVCODEC_VERSION_INT <= ((52<<16)+(23<<8)+0)
 		ret = avcodec_decode_video(st->ctx, frame, &got_pict,
@@ -131,7 +364,29 @@ static void handle_packet(struct vidsrc_st *st, AVPacket *pkt)
 					    &got_pict, pkt);
 #endif
 		if (ret < 0 || !got_pict)
-			return;
+			goto out;
+
+		src     = frame;
+		pix_fmt = st->ctx->pix_fmt;
+
+#ifdef USE_AVFORMAT_HW
+		if (frame->format == st->hw_pix_fmt) {
+
+			/* in the first format the device can download */
+			av_frame_unref(st->sw_frame);
+
+			if (av_hwframe_transfer_data(st->sw_frame, frame,
+						     0) < 0) {
+				warning("avformat: could not download"
+					" %s surface\n",
+					av_get_pix_fmt_name(frame->format));
+				goto out;
+			}
+
+			src     = st->sw_frame;
+			pix_fmt = st->sw_frame->format;
+		}
+#endif
 
 		sz.w = st->ctx->width;
 		sz.h = st->ctx->height;
@@ -148,28 +403,35 @@ static void handle_packet(struct vidsrc_st *st, AVPacket *pkt)
 			}
 		}
 
+		if (st->sws && pix_fmt != st->sws_fmt) {
+			sws_freeContext(st->sws);
+			st->sws = NULL;
+		}
+
 		if (!st->sws) {
 			info("scaling: %d x %d  --->  %d x %d\n",
 			     st->sz.w, st->sz.h,
 			     st->app_sz.w, st->app_sz.h);
 
 			st->sws = sws_getContext(st->sz.w, st->sz.h,
-						 st->ctx->pix_fmt,
+						 pix_fmt,
 						 st->app_sz.w, st->app_sz.h,
 						 AV_PIX_FMT_YUV420P,
 						 SWS_BICUBIC,
 						 NULL, NULL, NULL);
 			if (!st->sws)
-				return;
+				goto out;
+
+			st->sws_fmt = pix_fmt;
 		}
 
 		ret = avpicture_alloc(&pict, AV_PIX_FMT_YUV420P,
 				      st->app_sz.w, st->app_sz.h);
 		if (ret < 0)
-			return;
+			goto out;
 
 		ret = sws_scale(st->sws,
-				SRCSLICE_CAST frame->data, frame->linesize,
+				SRCSLICE_CAST src->data, src->linesize,
 				0, st->sz.h, pict.data, pict.linesize);
 		if (ret <= 0)
 			goto end;
@@ -192,6 +454,7 @@ static void handle_packet(struct vidsrc_st *st, AVPacket *pkt)
 	if (st->codec)
 		avpicture_free(&pict);
 
+ out:
 	if (frame) {
 #if LIBAVUTIL_VERSION_INT >= ((52<<16)+(20<<8)+100)
 		av_frame_free(&frame);
@@ -202,28 +465,83 @@ static void handle_packet(struct vidsrc_st *st, AVPacket *pkt)
 }
 
 
+/* Time of a packet in the clip in [us], from its decode timestamp */
+static int64_t packet_time(struct vidsrc_st *st, const AVPacket *pkt)
+{
+	int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+
+	if (dts == AV_NOPTS_VALUE)
+		return st->t_pkt + 1000000 / st->fps;
+
+	if (st->dts0 == AV_NOPTS_VALUE)
+		st->dts0 = dts;
+
+	return st->t_loop + av_rescale_q(dts - st->dts0, st->tb,
+					 AV_TIME_BASE_Q);
+}
+
+
+/*
+ * Wait until the time of a packet. The wait is from the start of the
+ * clip, so the oversleeps do not add up. If the packet is very late, or
+ * the timestamps jump, the clock starts again from this packet.
+ */
+static void pace(struct vidsrc_st *st, int64_t t)
+{
+	int64_t wait = t - (int64_t)(time_us() - st->t_start);
+
+	if (wait < -DRIFT_MAX || wait > JUMP_MAX) {
+		st->t_start -= wait;
+		++st->n_resync;
+		return;
+	}
+
+	while (wait > 0 && st->run) {
+
+		sys_usleep((unsigned)min(wait, SLEEP_MAX));
+
+		wait = t - (int64_t)(time_us() - st->t_start);
+	}
+}
+
+
 static void *read_thread(void *data)
 {
 	struct vidsrc_st *st = data;
 
+	st->dts0    = AV_NOPTS_VALUE;
+	st->t_start = time_us();
+
 	while (st->run) {
 		AVPacket pkt;
+		int64_t t;
 
 		av_init_packet(&pkt);
 
 		if (av_read_frame(st->ic, &pkt) < 0) {
 			sys_msleep(1000);
 			av_seek_frame(st->ic, -1, 0, 0);
+
+			/* the clip starts again now */
+			st->t_loop = time_us() - st->t_start;
+			st->dts0   = AV_NOPTS_VALUE;
 			continue;
 		}
 
 		if (pkt.stream_index != st->sindex)
 			goto out;
 
-		handle_packet(st, &pkt);
+		t = packet_time(st, &pkt);
+		st->t_pkt = t;
 
-		/* simulate framerate */
-		sys_msleep(1000/st->fps);
+		pace(st, t);
+
+#ifdef USE_AVFORMAT_HW
+		if (send_packet(st, &pkt, t))
+			goto out;
+#endif
+
+		handle_packet(st, &pkt);
 
 	out:
 		av_free_packet(&pkt);
@@ -262,8 +580,14 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 	st->frameh = frameh;
 	st->arg    = arg;
 
+	st->sws_fmt = -1;
+#ifdef USE_AVFORMAT_HW
+	st->hw_pix_fmt = AV_PIX_FMT_NONE;
+#endif
+
 	if (prm) {
-		st->fps = prm->fps;
+		st->fps  = prm->fps;
+		st->pkth = prm->pkth;
 	}
 	else {
 		st->fps = 25;
@@ -330,6 +654,7 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 		st->sz.h   = ctx->height;
 		st->ctx    = ctx;
 		st->sindex = strm->index;
+		st->tb     = strm->time_base;
 
 		if (ctx->codec_id != AV_CODEC_ID_NONE) {
 
@@ -339,6 +664,37 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 				goto out;
 			}
 
+#ifdef USE_AVFORMAT_HW
+			if (str_isset(avformat_conf.hwaccel)) {
+
+				err = init_hw(st);
+				if (err) {
+					warning("avformat: %s decoding not"
+						" available (%m),"
+						" using software\n",
+						avformat_conf.hwaccel, err);
+					st->hw_pix_fmt = AV_PIX_FMT_NONE;
+					err = 0;
+				}
+				else {
+					info("avformat: decoding on %s\n",
+					     avformat_conf.hwaccel);
+				}
+			}
+
+			if (st->pkth && avformat_conf.passthrough &&
+			    ctx->codec_id == AV_CODEC_ID_H264) {
+
+				err = init_bsf(st, strm);
+				if (err) {
+					warning("avformat: no passthrough"
+						" (%m)\n", err);
+					av_bsf_free(&st->bsf);
+					err = 0;
+				}
+			}
+#endif
+
 #if LIBAVCODEC_VERSION_INT >= ((53<<16)+(8<<8)+0)
 			ret = avcodec_open2(ctx, st->codec, NULL);
 #else
@@ -378,6 +734,20 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 
 static int module_init(void)
 {
+	struct conf *conf = conf_cur();
+
+	conf_get_str(conf, "avformat_hwaccel", avformat_conf.hwaccel,
+		     sizeof(avformat_conf.hwaccel));
+	conf_get_str(conf, "avformat_hwdevice", avformat_conf.hwdevice,
+		     sizeof(avformat_conf.hwdevice));
+	conf_get_bool(conf, "avformat_passthrough",
+		      &avformat_conf.passthrough);
+
+#ifndef USE_AVFORMAT_HW
+	if (str_isset(avformat_conf.hwaccel))
+		warning("avformat: hardware decoding needs FFmpeg 4.0\n");
+#endif
+
 	/* register all codecs, demux and protocols */
 	avcodec_register_all();
 	avdevice_register_all();
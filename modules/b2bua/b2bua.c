@@ -16,6 +16,14 @@
  *
  * N session objects
  * 1 session object has 2 call objects (left, right leg)
+ *
+ * When both legs use the same audio codec, RTP is relayed between them
+ * without decoding. Otherwise audio is transcoded through the aubridge
+ * devices. Relaying can be turned off in the config:
+ *
+ \verbatim
+  b2bua_relay     {yes,no}   # Relay RTP if the codecs match (default yes)
+ \endverbatim
  */
 
 
@@ -27,6 +35,7 @@ struct session {
 
 static struct list sessionl;
 static struct ua *ua_in, *ua_out;
+static bool relay = true;
 
 
 static struct call *other_call(struct session *sess, const struct call *call)
@@ -46,6 +55,7 @@ static void destructor(void *arg)
 	      sess->call_in, sess->call_out);
 
 	list_unlink(&sess->le);
+	(void)audio_relay(call_audio(sess->call_in), NULL);
 	mem_deref(sess->call_out);
 	mem_deref(sess->call_in);
 }
@@ -118,6 +128,13 @@ static int new_session(struct call *call)
 	video_set_devicename(call_video(sess->call_in), a, b);
 	video_set_devicename(call_video(sess->call_out), b, a);
 
+	if (relay) {
+		err = audio_relay(call_audio(sess->call_in),
+				  call_audio(sess->call_out));
+		if (err)
+			goto out;
+	}
+
 	call_set_handlers(sess->call_in, call_event_handler,
 			  call_dtmf_handler, sess);
 	call_set_handlers(sess->call_out, call_event_handler,
@@ -195,6 +212,8 @@ static int module_init(void)
 {
 	int err;
 
+	(void)conf_get_bool(conf_cur(), "b2bua_relay", &relay);
+
 	ua_in  = uag_find_param("b2bua", "inbound");
 	ua_out = uag_find_param("b2bua", "outbound");
 
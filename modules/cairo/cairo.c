@@ -23,8 +23,23 @@
  * Note: This module is very experimental!
  *
  * Use Cairo library to draw graphics into a frame buffer
+ *
+ * With cairo_loop set, a loop of that many frames is drawn and converted
+ * to YUV420P once when the source is opened, and then replayed, so that
+ * a load test with many video calls does not measure the drawing:
+ *
+ \verbatim
+  cairo_loop    50    # Frames in the loop, 0 to draw every frame
+ \endverbatim
+ *
+ * The frames are paced from the monotonic media clock.
  */
 
+
+enum {
+	LOOP_MAX = 600,     /**< Maximum frames in the loop */
+};
+
 struct vidsrc_st {
 	const struct vidsrc *vs;  /* inheritance */
 
@@ -33,6 +48,8 @@ struct vidsrc_st {
 	cairo_surface_t *surface;
 	cairo_t *cr;
 	double step;
+	struct vidframe **loopv;  /* pre-drawn frames, optional */
+	unsigned loopc;
 	bool run;
 	pthread_t thread;
 	vidsrc_frame_h *frameh;
@@ -41,17 +58,24 @@ struct vidsrc_st {
 
 
 static struct vidsrc *vidsrc;
+static uint32_t loop_len;
 
 
 static void destructor(void *arg)
 {
 	struct vidsrc_st *st = arg;
 
+	unsigned i;
+
 	if (st->run) {
 		st->run = false;
 		pthread_join(st->thread, NULL);
 	}
 
+	for (i=0; st->loopv && i<st->loopc; i++)
+		mem_deref(st->loopv[i]);
+	mem_deref(st->loopv);
+
 	if (st->cr)
 		cairo_destroy(st->cr);
 	if (st->surface)
@@ -112,15 +136,56 @@ static void draw_gradient(cairo_t *cr, double step, int width, int height)
 }
 
 
-static void process(struct vidsrc_st *st)
+static void draw(struct vidsrc_st *st, struct vidframe *f)
 {
-	struct vidframe f;
-
 	draw_gradient(st->cr, st->step, st->size.w, st->size.h);
 	st->step += 0.02 / st->prm.fps;
 
-	vidframe_init_buf(&f, VID_FMT_RGB32, &st->size,
+	cairo_surface_flush(st->surface);
+
+	vidframe_init_buf(f, VID_FMT_RGB32, &st->size,
 			  cairo_image_surface_get_data(st->surface));
+}
+
+
+static int loop_alloc(struct vidsrc_st *st)
+{
+	unsigned i;
+	int err;
+
+	st->loopv = mem_zalloc(loop_len * sizeof(*st->loopv), NULL);
+	if (!st->loopv)
+		return ENOMEM;
+
+	st->loopc = loop_len;
+
+	for (i=0; i<st->loopc; i++) {
+
+		struct vidframe f;
+
+		err = vidframe_alloc(&st->loopv[i], VID_FMT_YUV420P,
+				     &st->size);
+		if (err)
+			return err;
+
+		draw(st, &f);
+		vidconv_fast(st->loopv[i], &f, NULL);
+	}
+
+	return 0;
+}
+
+
+static void process(struct vidsrc_st *st, uint64_t n)
+{
+	struct vidframe f;
+
+	if (st->loopc) {
+		st->frameh(st->loopv[n % st->loopc], st->arg);
+		return;
+	}
+
+	draw(st, &f);
 
 	st->frameh(&f, st->arg);
 }
@@ -129,24 +194,19 @@ static void process(struct vidsrc_st *st)
 static void *read_thread(void *arg)
 {
 	struct vidsrc_st *st = arg;
-	uint64_t ts = 0;
+	const uint64_t start = mclock_now();
+	uint64_t n = 0;
 
 	while (st->run) {
 
-		uint64_t now;
-
-		sys_msleep(2);
-
-		now = tmr_jiffies();
-		if (!ts)
-			ts = now;
+		const uint64_t ts = start + n * 1000000 / st->prm.fps;
 
-		if (ts > now)
+		if (mclock_now() < ts) {
+			mclock_sleep_until(ts);
 			continue;
+		}
 
-		process(st);
-
-		ts += 1000/st->prm.fps;
+		process(st, n++);
 	}
 
 	return NULL;
@@ -180,6 +240,8 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 	st->prm    = *prm;
 	st->size   = *size;
 
+	st->prm.fps = max(st->prm.fps, 1);
+
 	st->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
 						 size->w, size->h);
 	st->cr = cairo_create(st->surface);
@@ -192,6 +254,12 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 
 	st->step = rand_u16() / 1000.0;
 
+	if (loop_len) {
+		err = loop_alloc(st);
+		if (err)
+			goto out;
+	}
+
 	st->run = true;
 	err = pthread_create(&st->thread, NULL, read_thread, st);
 	if (err) {
@@ -211,6 +279,14 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 
 static int module_init(void)
 {
+	conf_get_u32(conf_cur(), "cairo_loop", &loop_len);
+
+	if (loop_len > LOOP_MAX) {
+		warning("cairo: loop of %u frames, using %u\n",
+			loop_len, LOOP_MAX);
+		loop_len = LOOP_MAX;
+	}
+
 	return vidsrc_register(&vidsrc, "cairo", alloc, NULL);
 }
 
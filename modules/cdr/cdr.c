@@ -0,0 +1,573 @@
+/**
+ * @file cdr.c  Call Detail Records
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <re.h>
+#include <baresip.h>
+
+
+/**
+ * @defgroup cdr cdr
+ *
+ * Call Detail Records, one record for each call that was closed
+ *
+ * A record has the Call-ID, the direction, the local and the peer URI,
+ * the status code, the setup time in [ms], the duration in [s], the
+ * audio codec, the MOS, the packet loss in [%], the jitter in [ms], and
+ * the packets and bytes sent and received on all the media streams.
+ *
+ * The records are written as JSON lines or as CSV, to a file, or sent
+ * to a UDP collector, one record per datagram, optionally with a syslog
+ * header. The main loop only formats a record and appends it to the
+ * current batch. A batch is handed to a writer thread when it is full
+ * or after cdr_flush milliseconds, so the main loop never waits for the
+ * disk or the network. If the writer falls behind, whole batches are
+ * dropped and counted.
+ *
+ * Example configuration:
+ \verbatim
+  cdr_format      jsonl                   # jsonl or csv
+  cdr_file        /var/log/baresip/cdr.jsonl
+  cdr_udp         127.0.0.1:514           # UDP collector
+  cdr_syslog      no                      # Add a syslog header (UDP)
+  cdr_batch       256                     # Records per batch
+  cdr_flush       1000                    # Max. delay of a record [ms]
+ \endverbatim
+ *
+ * Without cdr_file and cdr_udp, the records are written to the file
+ * cdr.jsonl or cdr.csv in the configuration directory.
+ */
+
+
+enum {
+	BATCH_SIZE  = 256,      /**< Default records per batch       */
+	FLUSH_IVAL  = 1000,     /**< Default flush interval [ms]     */
+	PENDING_MAX = 64,       /**< Batches waiting for the writer  */
+	REC_SIZE    = 384,      /**< Typical size of a record        */
+	SYSLOG_PRI  = 134,      /**< local0.info                     */
+};
+
+enum fmt {
+	FMT_JSONL = 0,
+	FMT_CSV,
+};
+
+struct batch {
+	struct le le;
+	struct mbuf *mb;        /**< Records, one per line           */
+	uint32_t n;             /**< Number of records               */
+};
+
+static struct {
+	pthread_mutex_t mutex;  /**< Protects pendl, pendc and run   */
+	pthread_cond_t cond;
+	pthread_t thread;
+	struct list pendl;      /**< Batches for the writer          */
+	uint32_t pendc;
+	bool run;
+	struct batch *cur;      /**< Batch being filled, main only   */
+	struct tmr tmr;
+	enum fmt fmt;
+	uint32_t batch_max;
+	uint32_t flush_ms;
+	char path[256];
+	struct sa udp;
+	bool syslog;
+	FILE *f;                /**< Writer only                     */
+	int fd;                 /**< Writer only                     */
+	uint64_t n_rec;         /**< Records taken                   */
+	uint64_t n_drop;        /**< Records dropped, writer behind  */
+	uint64_t n_err;         /**< Records not written             */
+} cdr = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+};
+
+static const char csv_header[] =
+	"time,call_id,direction,local,peer,scode,reason,setup_ms,duration,"
+	"codec,mos,mos_min,loss,jitter,tx_packets,tx_bytes,"
+	"rx_packets,rx_bytes,lost\n";
+
+
+static void batch_destructor(void *arg)
+{
+	struct batch *b = arg;
+
+	list_unlink(&b->le);
+	mem_deref(b->mb);
+}
+
+
+static struct batch *batch_alloc(void)
+{
+	struct batch *b;
+
+	b = mem_zalloc(sizeof(*b), batch_destructor);
+	if (!b)
+		return NULL;
+
+	b->mb = mbuf_alloc(cdr.batch_max * REC_SIZE);
+	if (!b->mb)
+		return mem_deref(b);
+
+	return b;
+}
+
+
+static void send_records(const struct batch *b)
+{
+	const uint8_t *p = b->mb->buf;
+	const uint8_t *end = p + b->mb->end;
+	char hdr[32];
+	int hlen = 0;
+
+	if (cdr.syslog)
+		hlen = re_snprintf(hdr, sizeof(hdr), "<%u>baresip-cdr: ",
+				   SYSLOG_PRI);
+
+	while (p < end) {
+
+		const uint8_t *eol = memchr(p, '\n', end - p);
+		const size_t len = (eol ? eol : end) - p;
+		char buf[2048];
+		ssize_t n;
+
+		if (hlen > 0 && hlen + len <= sizeof(buf)) {
+			memcpy(buf, hdr, hlen);
+			memcpy(buf + hlen, p, len);
+			n = sendto(cdr.fd, buf, hlen + len, 0,
+				   &cdr.udp.u.sa, cdr.udp.len);
+		}
+		else {
+			n = sendto(cdr.fd, p, len, 0,
+				   &cdr.udp.u.sa, cdr.udp.len);
+		}
+
+		if (n < 0)
+			++cdr.n_err;
+
+		p += len + 1;
+	}
+}
+
+
+static void write_batch(const struct batch *b)
+{
+	if (cdr.fd >= 0)
+		send_records(b);
+
+	if (cdr.f) {
+		if (fwrite(b->mb->buf, 1, b->mb->end, cdr.f) != b->mb->end ||
+		    fflush(cdr.f))
+			cdr.n_err += b->n;
+	}
+}
+
+
+static void *writer(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&cdr.mutex);
+
+	/* pending batches are still written when stopping */
+	while (cdr.run || cdr.pendc) {
+
+		struct batch *b = list_ledata(list_head(&cdr.pendl));
+
+		if (!b) {
+			pthread_cond_wait(&cdr.cond, &cdr.mutex);
+			continue;
+		}
+
+		list_unlink(&b->le);
+		--cdr.pendc;
+
+		pthread_mutex_unlock(&cdr.mutex);
+
+		write_batch(b);
+		mem_deref(b);
+
+		pthread_mutex_lock(&cdr.mutex);
+	}
+
+	pthread_mutex_unlock(&cdr.mutex);
+
+	return NULL;
+}
+
+
+/* Hand the current batch to the writer */
+static void submit(void)
+{
+	struct batch *b = cdr.cur;
+
+	if (!b || !b->n)
+		return;
+
+	cdr.cur = NULL;
+
+	pthread_mutex_lock(&cdr.mutex);
+
+	if (cdr.pendc < PENDING_MAX) {
+		list_append(&cdr.pendl, &b->le, b);
+		++cdr.pendc;
+		pthread_cond_signal(&cdr.cond);
+		b = NULL;
+	}
+
+	pthread_mutex_unlock(&cdr.mutex);
+
+	if (b) {
+		cdr.n_drop += b->n;
+		warning("cdr: writer is behind, %u records dropped\n", b->n);
+		mem_deref(b);
+	}
+}
+
+
+static void tmr_handler(void *arg)
+{
+	(void)arg;
+
+	tmr_start(&cdr.tmr, cdr.flush_ms, tmr_handler, NULL);
+
+	submit();
+}
+
+
+static int print_str(struct re_printf *pf, const char *str)
+{
+	const char *p;
+	int err = 0;
+
+	if (!str)
+		str = "";
+
+	if (cdr.fmt == FMT_CSV) {
+
+		if (!strpbrk(str, ",\"\r\n"))
+			return re_hprintf(pf, "%s", str);
+
+		err = re_hprintf(pf, "\"");
+		for (p = str; *p && !err; p++) {
+			err = re_hprintf(pf, *p == '"' ? "\"\"" : "%c", *p);
+		}
+		return err | re_hprintf(pf, "\"");
+	}
+
+	err = re_hprintf(pf, "\"");
+
+	for (p = str; *p && !err; p++) {
+
+		if (*p == '"' || *p == '\\')
+			err = re_hprintf(pf, "\\%c", *p);
+		else if ((unsigned char)*p < 0x20)
+			err = re_hprintf(pf, "\\u%04x",
+					 (unsigned char)*p);
+		else
+			err = re_hprintf(pf, "%c", *p);
+	}
+
+	return err | re_hprintf(pf, "\"");
+}
+
+
+struct record {
+	const struct call *call;
+	const char *reason;
+	char codec[64];
+	struct stream_quality q;
+	struct stream_stat tx;
+	struct stream_stat rx;
+	uint64_t lost;
+	uint64_t expected;
+};
+
+
+static void record_collect(struct record *r, const struct call *call)
+{
+	const struct aucodec *ac = audio_codec(call_audio(call), true);
+	const struct stream *as = audio_strm(call_audio(call));
+	struct le *le;
+
+	if (ac)
+		(void)re_snprintf(r->codec, sizeof(r->codec), "%s/%u/%u",
+				  ac->name, ac->srate, ac->ch);
+
+	if (as) {
+		const struct seqwin *w = stream_seqwin(as);
+
+		(void)stream_quality(as, &r->q);
+
+		if (w) {
+			r->lost     = seqwin_lost(w);
+			r->expected = w->n_rx + r->lost;
+		}
+	}
+
+	for (le = list_head(call_streaml(call)); le; le = le->next) {
+
+		struct stream_stat tx, rx;
+
+		if (stream_stats(le->data, &tx, &rx))
+			continue;
+
+		r->tx.n_packets += tx.n_packets;
+		r->tx.n_bytes   += tx.n_bytes;
+		r->rx.n_packets += rx.n_packets;
+		r->rx.n_bytes   += rx.n_bytes;
+	}
+}
+
+
+static int record_print(struct re_printf *pf, const struct record *r)
+{
+	const struct call *call = r->call;
+	const double loss = r->expected ?
+		100.0 * (double)r->lost / (double)r->expected : 0.0;
+
+	if (cdr.fmt == FMT_CSV) {
+		return re_hprintf(pf, "%llu,%H,%s,%H,%H,%u,%H,%u,%u,%H,"
+				  "%.2f,%.2f,%.2f,%.1f,%u,%u,%u,%u,%llu\n",
+				  (uint64_t)time(NULL),
+				  print_str, call_id(call),
+				  call_is_outgoing(call) ? "out" : "in",
+				  print_str, call_localuri(call),
+				  print_str, call_peeruri(call),
+				  call_scode(call),
+				  print_str, r->reason,
+				  call_setup_ms(call), call_duration(call),
+				  print_str, r->codec,
+				  r->q.mos, r->q.mos_min, loss, r->q.jitter,
+				  r->tx.n_packets, r->tx.n_bytes,
+				  r->rx.n_packets, r->rx.n_bytes, r->lost);
+	}
+
+	return re_hprintf(pf, "{\"time\":%llu,\"call_id\":%H,"
+			  "\"direction\":\"%s\",\"local\":%H,\"peer\":%H,"
+			  "\"scode\":%u,\"reason\":%H,\"setup_ms\":%u,"
+			  "\"duration\":%u,\"codec\":%H,"
+			  "\"mos\":%.2f,\"mos_min\":%.2f,\"loss\":%.2f,"
+			  "\"jitter\":%.1f,"
+			  "\"tx_packets\":%u,\"tx_bytes\":%u,"
+			  "\"rx_packets\":%u,\"rx_bytes\":%u,"
+			  "\"lost\":%llu}\n",
+			  (uint64_t)time(NULL),
+			  print_str, call_id(call),
+			  call_is_outgoing(call) ? "out" : "in",
+			  print_str, call_localuri(call),
+			  print_str, call_peeruri(call),
+			  call_scode(call),
+			  print_str, r->reason,
+			  call_setup_ms(call), call_duration(call),
+			  print_str, r->codec,
+			  r->q.mos, r->q.mos_min, loss, r->q.jitter,
+			  r->tx.n_packets, r->tx.n_bytes,
+			  r->rx.n_packets, r->rx.n_bytes, r->lost);
+}
+
+
+static void ua_event_handler(struct ua *ua, enum ua_event ev,
+			     struct call *call, const char *prm, void *arg)
+{
+	struct record r;
+	int err;
+	(void)ua;
+	(void)ev;
+	(void)arg;
+
+	if (!call)
+		return;
+
+	if (!cdr.cur) {
+		cdr.cur = batch_alloc();
+		if (!cdr.cur) {
+			++cdr.n_drop;
+			return;
+		}
+	}
+
+	memset(&r, 0, sizeof(r));
+	r.call   = call;
+	r.reason = prm;
+
+	record_collect(&r, call);
+
+	err = mbuf_printf(cdr.cur->mb, "%H", record_print, &r);
+	if (err) {
+		++cdr.n_drop;
+		return;
+	}
+
+	++cdr.cur->n;
+	++cdr.n_rec;
+
+	if (cdr.cur->n >= cdr.batch_max)
+		submit();
+}
+
+
+static int sink_open(void)
+{
+	char fmt[8] = "";
+	struct pl pl;
+	int err;
+
+	cdr.fd = -1;
+
+	if (0 == conf_get_str(conf_cur(), "cdr_format", fmt, sizeof(fmt))) {
+
+		if (0 == str_casecmp(fmt, "csv"))
+			cdr.fmt = FMT_CSV;
+		else if (0 == str_casecmp(fmt, "jsonl"))
+			cdr.fmt = FMT_JSONL;
+		else
+			warning("cdr: unknown format '%s'\n", fmt);
+	}
+
+	if (0 == conf_get(conf_cur(), "cdr_udp", &pl)) {
+
+		err = sa_decode(&cdr.udp, pl.p, pl.l);
+		if (err) {
+			warning("cdr: invalid cdr_udp '%r'\n", &pl);
+			return err;
+		}
+
+		cdr.fd = socket(sa_af(&cdr.udp), SOCK_DGRAM, 0);
+		if (cdr.fd < 0)
+			return errno;
+
+		(void)conf_get_bool(conf_cur(), "cdr_syslog", &cdr.syslog);
+	}
+
+	if (conf_get_str(conf_cur(), "cdr_file", cdr.path, sizeof(cdr.path))) {
+
+		char dir[256];
+
+		if (cdr.fd >= 0)
+			return 0;
+
+		err = conf_path_get(dir, sizeof(dir));
+		if (err)
+			return err;
+
+		(void)re_snprintf(cdr.path, sizeof(cdr.path), "%s/cdr.%s",
+				  dir, cdr.fmt == FMT_CSV ? "csv" : "jsonl");
+	}
+
+	cdr.f = fopen(cdr.path, "a");
+	if (!cdr.f) {
+		err = errno;
+		warning("cdr: %s: %m\n", cdr.path, err);
+		return err;
+	}
+
+	if (cdr.fmt == FMT_CSV && ftell(cdr.f) == 0)
+		(void)fputs(csv_header, cdr.f);
+
+	return 0;
+}
+
+
+static void sink_close(void)
+{
+	if (cdr.f) {
+		(void)fclose(cdr.f);
+		cdr.f = NULL;
+	}
+
+	if (cdr.fd >= 0) {
+		(void)close(cdr.fd);
+		cdr.fd = -1;
+	}
+}
+
+
+static int module_init(void)
+{
+	int err;
+
+	cdr.batch_max = BATCH_SIZE;
+	cdr.flush_ms  = FLUSH_IVAL;
+
+	(void)conf_get_u32(conf_cur(), "cdr_batch", &cdr.batch_max);
+	(void)conf_get_u32(conf_cur(), "cdr_flush", &cdr.flush_ms);
+
+	cdr.batch_max = max(cdr.batch_max, 1u);
+	cdr.flush_ms  = max(cdr.flush_ms, 10u);
+
+	err = sink_open();
+	if (err)
+		goto out;
+
+	err = uag_event_subscribe(ua_event_handler, NULL,
+				  1u << UA_EVENT_CALL_CLOSED, 0);
+	if (err)
+		goto out;
+
+	cdr.run = true;
+	err = pthread_create(&cdr.thread, NULL, writer, NULL);
+	if (err) {
+		cdr.run = false;
+		uag_event_unregister(ua_event_handler);
+		goto out;
+	}
+
+	tmr_init(&cdr.tmr);
+	tmr_start(&cdr.tmr, cdr.flush_ms, tmr_handler, NULL);
+
+	if (cdr.f)
+		info("cdr: writing records to %s\n", cdr.path);
+	if (cdr.fd >= 0)
+		info("cdr: sending records to %J\n", &cdr.udp);
+
+ out:
+	if (err)
+		sink_close();
+
+	return err;
+}
+
+
+static int module_close(void)
+{
+	uag_event_unregister(ua_event_handler);
+
+	tmr_cancel(&cdr.tmr);
+
+	if (!cdr.run)
+		return 0;
+
+	submit();
+
+	pthread_mutex_lock(&cdr.mutex);
+	cdr.run = false;
+	pthread_cond_signal(&cdr.cond);
+	pthread_mutex_unlock(&cdr.mutex);
+
+	pthread_join(cdr.thread, NULL);
+
+	sink_close();
+
+	info("cdr: %llu records, %llu dropped, %llu not written\n",
+	     cdr.n_rec, cdr.n_drop, cdr.n_err);
+
+	return 0;
+}
+
+
+EXPORT_SYM const struct mod_export DECL_EXPORTS(cdr) = {
+	"cdr",
+	"application",
+	module_init,
+	module_close
+};
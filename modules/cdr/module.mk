@@ -0,0 +1,10 @@
+#
+# module.mk
+#
+# Copyright (C) 2010 Creytiv.com
+#
+
+MOD		:= cdr
+$(MOD)_SRCS	+= cdr.c
+
+include mk/mod.mk
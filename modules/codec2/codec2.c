@@ -161,20 +161,15 @@ static int decode(struct audec_state *ads, int16_t *sampv,
 
 
 static struct aucodec codec2 = {
-	LE_INIT,
-	NULL,
-	"CODEC2",
-	8000,
-	8000,
-	1,
-	NULL,
-	encode_update,
-	encode,
-	decode_update,
-	decode,
-	NULL,
-	NULL,
-	NULL
+	.name      = "CODEC2",
+	.srate     = 8000,
+	.crate     = 8000,
+	.ch        = 1,
+	.encupdh   = encode_update,
+	.ench      = encode,
+	.decupdh   = decode_update,
+	.dech      = decode,
+	.heavy     = true,
 };
 
 
@@ -0,0 +1,502 @@
+/**
+ * @file conference.c  Audio conference
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+
+
+/**
+ * @defgroup conference conference
+ *
+ * Audio conference of all calls
+ *
+ * While the conference is on, every call hears the local user and all
+ * other calls. The module is an audio filter: the decoder side of each
+ * call buffers what the call says, and the encoder side adds the mix of
+ * the other calls to the local audio before it is encoded.
+ *
+ * The mix is computed once per frame: the loudest talkers are added
+ * into one accumulator, and each call gets the accumulator minus its
+ * own frame, so N calls cost O(N) instead of O(N^2). Calls that are
+ * not among the talkers hear the same mix, which is not recomputed.
+ *
+ * The video of the current call is forwarded to all other calls as it
+ * is received, if their encoder uses the same codec; see
+ * video_forward().
+ *
+ * All calls must use the same sampling rate and number of channels as
+ * the first call of the conference; set audio_srate to a fixed rate.
+ *
+ \verbatim
+  conference_speakers     3       # Talkers mixed at once (0 is all)
+ \endverbatim
+ */
+
+
+enum {
+	JITTER_FRAMES = 2,    /**< Frames buffered before mixing   */
+	MAX_FRAMES    = 8,    /**< Frames buffered at most         */
+};
+
+/* mean square of a frame below -60 dBov is no talker */
+#define TALK_MIN  (32767.0 * 32767.0 * 1e-6)
+
+
+/** One call in the conference, shared by its encoder and decoder */
+struct party {
+	struct le le;
+	struct aubuf *ab;     /**< Decoded audio from the call     */
+	int16_t *frame;       /**< Frame of the call in the mix    */
+	size_t framec;        /**< Size of frame in samples        */
+	uint64_t sumsq;       /**< Energy of the frame             */
+	uint32_t srate;
+	uint8_t ch;
+	uint32_t gen;         /**< Last mix the encoder has used   */
+	bool talker;          /**< Frame is in the mix             */
+};
+
+struct conf_enc {
+	struct aufilt_enc_st af;  /* inheritance */
+	struct party *p;
+};
+
+struct conf_dec {
+	struct aufilt_dec_st af;  /* inheritance */
+	struct party *p;
+};
+
+
+static struct {
+	struct lock *lock;    /**< Protects all below, and parties */
+	struct list partl;
+	int32_t *accv;        /**< Sum of the talkers              */
+	size_t accc;          /**< Samples in the current mix      */
+	size_t accsz;         /**< Allocated size of accv          */
+	uint32_t gen;         /**< Mix generation                  */
+	uint32_t srate;
+	uint8_t ch;
+	bool active;          /**< Conference is on (atomic)       */
+} conf;
+
+static uint32_t speakers = 3;
+
+
+static void party_destructor(void *arg)
+{
+	struct party *p = arg;
+
+	lock_write_get(conf.lock);
+	list_unlink(&p->le);
+	lock_rel(conf.lock);
+
+	mem_deref(p->ab);
+	mem_deref(p->frame);
+}
+
+
+static int party_get(struct party **pp, void **ctx,
+		     const struct aufilt_prm *prm)
+{
+	struct party *p;
+	size_t psize;
+	int err;
+
+	if (*ctx) {
+		*pp = mem_ref(*ctx);
+		return 0;
+	}
+
+	p = mem_zalloc(sizeof(*p), party_destructor);
+	if (!p)
+		return ENOMEM;
+
+	p->srate = prm->srate;
+	p->ch    = prm->ch;
+
+	psize = 2 * prm->srate * prm->ch * prm->ptime / 1000;
+
+	err = aubuf_alloc(&p->ab, psize * JITTER_FRAMES, psize * MAX_FRAMES);
+	if (err) {
+		mem_deref(p);
+		return err;
+	}
+
+	lock_write_get(conf.lock);
+	list_append(&conf.partl, &p->le, p);
+	lock_rel(conf.lock);
+
+	*ctx = p;
+	*pp  = p;
+
+	return 0;
+}
+
+
+static bool party_match(const struct party *p)
+{
+	return p->srate == conf.srate && p->ch == conf.ch;
+}
+
+
+/* the frame buffers grow to the largest frame seen */
+static int frame_resize(struct party *p, size_t n)
+{
+	int16_t *frame;
+
+	if (p->framec >= n)
+		return 0;
+
+	frame = mem_realloc(p->frame, n * sizeof(*frame));
+	if (!frame)
+		return ENOMEM;
+
+	p->frame  = frame;
+	p->framec = n;
+
+	return 0;
+}
+
+
+static bool louder(struct le *le1, struct le *le2, void *arg)
+{
+	const struct party *p1 = le1->data, *p2 = le2->data;
+	(void)arg;
+
+	return p1->sumsq >= p2->sumsq;
+}
+
+
+/*
+ * Compute the next mix of n samples. Called with the lock held, by
+ * the encoder that has already used the current mix.
+ */
+static int mix_update(size_t n)
+{
+	struct le *le;
+	uint32_t k = 0;
+	int err = 0;
+
+	if (conf.accsz < n) {
+
+		int32_t *accv = mem_realloc(conf.accv, n * sizeof(*accv));
+		if (!accv)
+			return ENOMEM;
+
+		conf.accv  = accv;
+		conf.accsz = n;
+	}
+
+	for (le = conf.partl.head; le; le = le->next) {
+
+		struct party *p = le->data;
+
+		p->talker = false;
+		p->sumsq  = 0;
+
+		if (!party_match(p))
+			continue;
+
+		err = frame_resize(p, n);
+		if (err)
+			return err;
+
+		aubuf_read_samp(p->ab, p->frame, n);
+		aulevel_calc(p->frame, n, &p->sumsq, &(uint16_t){0});
+	}
+
+	/* the loudest talkers first */
+	list_sort(&conf.partl, louder, NULL);
+
+	memset(conf.accv, 0, n * sizeof(*conf.accv));
+
+	for (le = conf.partl.head; le; le = le->next) {
+
+		struct party *p = le->data;
+
+		if (speakers && k >= speakers)
+			break;
+
+		if (!party_match(p) || (double)p->sumsq < TALK_MIN * n)
+			continue;
+
+		aumix_acc(conf.accv, p->frame, n);
+		p->talker = true;
+		++k;
+	}
+
+	conf.accc = n;
+	++conf.gen;
+
+	return 0;
+}
+
+
+static void enc_destructor(void *arg)
+{
+	struct conf_enc *st = arg;
+
+	list_unlink(&st->af.le);
+	mem_deref(st->p);
+}
+
+
+static void dec_destructor(void *arg)
+{
+	struct conf_dec *st = arg;
+
+	list_unlink(&st->af.le);
+	mem_deref(st->p);
+}
+
+
+static int encode_update(struct aufilt_enc_st **stp, void **ctx,
+			 const struct aufilt *af, struct aufilt_prm *prm)
+{
+	struct conf_enc *st;
+	int err;
+
+	if (!stp || !ctx || !af || !prm)
+		return EINVAL;
+
+	if (*stp)
+		return 0;
+
+	st = mem_zalloc(sizeof(*st), enc_destructor);
+	if (!st)
+		return ENOMEM;
+
+	err = party_get(&st->p, ctx, prm);
+	if (err) {
+		mem_deref(st);
+		return err;
+	}
+
+	*stp = (struct aufilt_enc_st *)st;
+
+	return 0;
+}
+
+
+static int decode_update(struct aufilt_dec_st **stp, void **ctx,
+			 const struct aufilt *af, struct aufilt_prm *prm)
+{
+	struct conf_dec *st;
+	int err;
+
+	if (!stp || !ctx || !af || !prm)
+		return EINVAL;
+
+	if (*stp)
+		return 0;
+
+	st = mem_zalloc(sizeof(*st), dec_destructor);
+	if (!st)
+		return ENOMEM;
+
+	err = party_get(&st->p, ctx, prm);
+	if (err) {
+		mem_deref(st);
+		return err;
+	}
+
+	*stp = (struct aufilt_dec_st *)st;
+
+	return 0;
+}
+
+
+/* Add the other calls to the local audio */
+static int encode(struct aufilt_enc_st *st, int16_t *sampv, size_t *sampc)
+{
+	struct party *p = ((struct conf_enc *)st)->p;
+	size_t n = *sampc;
+	int err = 0;
+
+	if (!__atomic_load_n(&conf.active, __ATOMIC_RELAXED))
+		return 0;
+
+	lock_write_get(conf.lock);
+
+	if (!conf.srate) {
+		conf.srate = p->srate;
+		conf.ch    = p->ch;
+	}
+
+	if (!party_match(p))
+		goto out;
+
+	/* the first encoder to use the mix twice moves it on */
+	if (p->gen == conf.gen || conf.accc != n) {
+		err = mix_update(n);
+		if (err)
+			goto out;
+	}
+
+	p->gen = conf.gen;
+
+	aumix_mix(sampv, conf.accv, p->talker ? p->frame : NULL, n);
+
+ out:
+	lock_rel(conf.lock);
+
+	return err;
+}
+
+
+/* Buffer what the call says, it is played as usual */
+static int decode(struct aufilt_dec_st *st, int16_t *sampv, size_t *sampc)
+{
+	struct party *p = ((struct conf_dec *)st)->p;
+
+	if (!__atomic_load_n(&conf.active, __ATOMIC_RELAXED))
+		return 0;
+
+	return aubuf_write_samp(p->ab, sampv, *sampc);
+}
+
+
+static struct aufilt conference = {
+	LE_INIT, "conference", encode_update, encode, decode_update, decode
+};
+
+
+/*
+ * Resume all calls of all UAs. The video of the presenter is forwarded
+ * to the other calls without transcoding.
+ */
+static void calls_join(struct video *presenter, bool join)
+{
+	struct le *le;
+
+	for (le = list_head(uag_list()); le; le = le->next) {
+
+		struct le *lec;
+
+		for (lec = list_head(ua_calls(le->data)); lec;
+		     lec = lec->next) {
+
+			struct video *v = call_video(lec->data);
+
+			if (join)
+				(void)call_hold(lec->data, false);
+
+			if (!v || v == presenter)
+				continue;
+
+			(void)video_forward(v, join ? presenter : NULL);
+		}
+	}
+}
+
+
+static int conf_start(struct re_printf *pf, void *arg)
+{
+	struct le *le;
+	(void)arg;
+
+	if (conf.active) {
+		__atomic_store_n(&conf.active, false, __ATOMIC_RELAXED);
+		calls_join(NULL, false);
+		return re_hprintf(pf, "conference off\n");
+	}
+
+	lock_write_get(conf.lock);
+
+	conf.srate = 0;
+	conf.ch    = 0;
+
+	/* nothing said before the conference is mixed */
+	for (le = conf.partl.head; le; le = le->next) {
+		struct party *p = le->data;
+
+		aubuf_flush(p->ab);
+	}
+
+	lock_rel(conf.lock);
+
+	__atomic_store_n(&conf.active, true, __ATOMIC_RELAXED);
+
+	calls_join(call_video(ua_call(uag_current())), true);
+
+	return re_hprintf(pf, "conference on\n");
+}
+
+
+static int conf_status(struct re_printf *pf, void *arg)
+{
+	struct le *le;
+	int err;
+	(void)arg;
+
+	lock_read_get(conf.lock);
+
+	err = re_hprintf(pf, "conference: %s, %u calls, %u Hz, %u ch,"
+			 " mix #%u\n",
+			 conf.active ? "on" : "off",
+			 list_count(&conf.partl), conf.srate, conf.ch,
+			 conf.gen);
+
+	for (le = conf.partl.head; le; le = le->next) {
+
+		const struct party *p = le->data;
+
+		err |= re_hprintf(pf, "  %u Hz, %u ch%s%s\n",
+				  p->srate, p->ch,
+				  p->talker ? ", talking" : "",
+				  party_match(p) ? "" : ", not mixed");
+	}
+
+	lock_rel(conf.lock);
+
+	return err;
+}
+
+
+static const struct cmd cmdv[] = {
+	{'j', 0, "Conference of all calls on/off", conf_start  },
+	{'J', 0, "Conference status",              conf_status },
+};
+
+
+static int module_init(void)
+{
+	int err;
+
+	(void)conf_get_u32(conf_cur(), "conference_speakers", &speakers);
+
+	err = lock_alloc(&conf.lock);
+	if (err)
+		return err;
+
+	err = cmd_register(cmdv, ARRAY_SIZE(cmdv));
+	if (err)
+		return err;
+
+	aufilt_register(&conference);
+
+	return 0;
+}
+
+
+static int module_close(void)
+{
+	aufilt_unregister(&conference);
+	cmd_unregister(cmdv);
+
+	conf.accv = mem_deref(conf.accv);
+	conf.lock = mem_deref(conf.lock);
+
+	return 0;
+}
+
+
+EXPORT_SYM const struct mod_export DECL_EXPORTS(conference) = {
+	"conference",
+	"filter",
+	module_init,
+	module_close
+};
@@ -0,0 +1,11 @@
+#
+# module.mk
+#
+# Copyright (C) 2010 Creytiv.com
+#
+
+MOD		:= conference
+$(MOD)_SRCS	+= conference.c
+$(MOD)_LFLAGS	+=
+
+include mk/mod.mk
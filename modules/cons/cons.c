@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 
@@ -23,21 +24,34 @@
   $ netcat -u 127.0.0.1 5555
  \endverbatim
  *
+ * In batch mode the input is read a line at a time, and each line is a
+ * command key and its parameter, e.g. "d sip:bob@example.com". A UDP
+ * datagram or a TCP segment may carry many commands. They are run in
+ * order, and the answers are sent back together, each one followed by
+ * a line "OK" or "ERR <reason>". Log messages are not relayed in batch
+ * mode.
+ *
  * The following options can be configured:
  *
  \verbatim
   cons_listen     0.0.0.0:5555         # IP-address and port to listen on
+  cons_batch      no                   # One command per line
  \endverbatim
  */
 
 
-enum {CONS_PORT = 5555};
+enum {
+	CONS_PORT = 5555,
+	LINE_MAX  = 4096,     /**< Max length of an incomplete line (TCP) */
+};
 
 struct ui_st {
 	struct udp_sock *us;
 	struct tcp_sock *ts;
 	struct tcp_conn *tc;
+	struct mbuf *rxb;     /**< Incomplete line, batch mode (TCP)      */
 	struct sa udp_peer;
+	bool batch;
 };
 
 
@@ -61,7 +75,14 @@ static void udp_recv(const struct sa *src, struct mbuf *mb, void *arg)
 	pf.vph = print_handler;
 	pf.arg = mbr;
 
-	while (mbuf_get_left(mb)) {
+	if (st->batch) {
+		struct pl pl;
+
+		pl_set_mem(&pl, (char *)mbuf_buf(mb), mbuf_get_left(mb));
+		(void)cmd_exec_lines(&pf, &pl, true);
+	}
+
+	while (!st->batch && mbuf_get_left(mb)) {
 		char ch = mbuf_read_u8(mb);
 
 		if (ch == '\r')
@@ -86,6 +107,7 @@ static void cons_destructor(void *arg)
 	mem_deref(st->us);
 	mem_deref(st->tc);
 	mem_deref(st->ts);
+	mem_deref(st->rxb);
 }
 
 
@@ -101,11 +123,63 @@ static int tcp_write_handler(const char *p, size_t size, void *arg)
 }
 
 
+/* The commands of a segment are answered with one send */
+static void tcp_recv_batch(struct ui_st *st, struct mbuf *mb)
+{
+	struct mbuf *mbr;
+	struct re_printf pf;
+	struct pl pl;
+	int err;
+
+	if (!st->rxb) {
+		st->rxb = mbuf_alloc(512);
+		if (!st->rxb)
+			return;
+	}
+
+	st->rxb->pos = st->rxb->end;
+	err = mbuf_write_mem(st->rxb, mbuf_buf(mb), mbuf_get_left(mb));
+	if (err)
+		return;
+
+	mbr = mbuf_alloc(512);
+	if (!mbr)
+		return;
+
+	pf.vph = print_handler;
+	pf.arg = mbr;
+
+	pl_set_mem(&pl, (char *)st->rxb->buf, st->rxb->end);
+	(void)cmd_exec_lines(&pf, &pl, false);
+
+	/* keep the incomplete line */
+	if (pl.l > LINE_MAX) {
+		(void)re_hprintf(&pf, "ERR line too long\n");
+		pl.l = 0;
+	}
+
+	memmove(st->rxb->buf, pl.p, pl.l);
+	st->rxb->end = pl.l;
+
+	if (mbr->end > 0) {
+		mbr->pos = 0;
+		(void)tcp_send(st->tc, mbr);
+	}
+
+	mem_deref(mbr);
+}
+
+
 static void tcp_recv_handler(struct mbuf *mb, void *arg)
 {
 	struct ui_st *st = arg;
 	struct re_printf pf;
 
+	if (st->batch) {
+		tcp_recv_batch(st, mb);
+		return;
+	}
+
 	pf.vph = tcp_write_handler;
 	pf.arg = st->tc;
 
@@ -139,6 +213,8 @@ static void tcp_conn_handler(const struct sa *peer, void *arg)
 
 	/* only one connection allowed */
 	st->tc = mem_deref(st->tc);
+	if (st->rxb)
+		mbuf_rewind(st->rxb);
 	(void)tcp_accept(&st->tc, st->ts, NULL, tcp_recv_handler,
 			 tcp_close_handler, st);
 }
@@ -156,6 +232,8 @@ static int cons_alloc(struct ui_st **stp, const struct sa *laddr)
 	if (!st)
 		return ENOMEM;
 
+	(void)conf_get_bool(conf_cur(), "cons_batch", &st->batch);
+
 	err = udp_listen(&st->us, laddr, udp_recv, st);
 	if (err) {
 		warning("cons: failed to listen on UDP %J (%m)\n",
@@ -219,6 +297,9 @@ static void log_handler(uint32_t level, const char *msg)
 {
 	(void)level;
 
+	if (cons->batch)
+		return;
+
 	output_handler(msg);
 }
 
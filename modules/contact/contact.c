@@ -22,12 +22,6 @@ static const char *chat_peer;         /**< Selected chat peer             */
 static char cmd_desc[128] = "Send MESSAGE to peer";
 
 
-static int confline_handler(const struct pl *addr)
-{
-	return contact_add(NULL, addr);
-}
-
-
 static int cmd_contact(struct re_printf *pf, void *arg)
 {
 	const struct cmd_arg *carg = arg;
@@ -175,6 +169,7 @@ static int write_template(const char *file)
 static int module_init(void)
 {
 	char path[256] = "", file[256] = "";
+	struct mbuf *mb;
 	int err;
 
 	err = conf_path_get(path, sizeof(path));
@@ -193,7 +188,12 @@ static int module_init(void)
 			return err;
 	}
 
-	err = conf_parse(file, confline_handler);
+	err = conf_load(&mb, file);
+	if (err)
+		return err;
+
+	err = contact_load(mb);
+	mem_deref(mb);
 	if (err)
 		return err;
 
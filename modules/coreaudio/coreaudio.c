@@ -37,8 +37,9 @@ static void interruptionListener(void *data, UInt32 inInterruptionState)
 }
 
 
-int audio_session_enable(void)
+int audio_session_enable(uint32_t ptime)
 {
+	Float32 dur = ptime / 1000.0f;
 	OSStatus res;
 	UInt32 category;
 
@@ -54,6 +55,14 @@ int audio_session_enable(void)
 		return ENODEV;
 	}
 
+	/* the hardware calls back once per packet */
+	res = AudioSessionSetProperty(
+		kAudioSessionProperty_PreferredHardwareIOBufferDuration,
+			sizeof(dur), &dur);
+	if (res)
+		warning("coreaudio: IO buffer duration %u ms: %d\n",
+			ptime, res);
+
 	res = AudioSessionSetActive(true);
 	if (res) {
 		warning("coreaudio: AudioSessionSetActive: %d\n", res);
@@ -69,8 +78,9 @@ void audio_session_disable(void)
 	AudioSessionSetActive(false);
 }
 #else
-int audio_session_enable(void)
+int audio_session_enable(uint32_t ptime)
 {
+	(void)ptime;
 	return 0;
 }
 
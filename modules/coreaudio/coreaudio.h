@@ -5,7 +5,7 @@
  */
 
 
-int  audio_session_enable(void);
+int  audio_session_enable(uint32_t ptime);
 void audio_session_disable(void);
 
 
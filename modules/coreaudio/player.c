@@ -11,12 +11,8 @@
 #include "coreaudio.h"
 
 
-/* This value can be tuned */
-#if TARGET_OS_IPHONE
-#define BUFC 20
-#else
-#define BUFC 6
-#endif
+/* Buffers of one packet time, all of them are ahead of the device */
+#define BUFC 3
 
 
 struct auplay_st {
@@ -100,7 +96,7 @@ int coreaudio_player_alloc(struct auplay_st **stp, const struct auplay *ap,
 	if (err)
 		goto out;
 
-	err = audio_session_enable();
+	err = audio_session_enable(prm->ptime);
 	if (err)
 		goto out;
 
@@ -152,6 +148,9 @@ int coreaudio_player_alloc(struct auplay_st **stp, const struct auplay *ap,
 		goto out;
 	}
 
+	if (prm->latency)
+		*prm->latency = BUFC * prm->ptime * 1000;
+
  out:
 	if (err)
 		mem_deref(st);
@@ -4,7 +4,6 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <AudioToolbox/AudioQueue.h>
-#include <unistd.h>
 #include <pthread.h>
 #include <re.h>
 #include <rem.h>
@@ -22,7 +21,6 @@ struct ausrc_st {
 	pthread_mutex_t mutex;
 	ausrc_read_h *rh;
 	void *arg;
-	unsigned int ptime;
 };
 
 
@@ -59,7 +57,6 @@ static void record_handler(void *userData, AudioQueueRef inQ,
 			   const AudioStreamPacketDescription *inPacketDesc)
 {
 	struct ausrc_st *st = userData;
-	unsigned int ptime;
 	ausrc_read_h *rh;
 	void *arg;
 	(void)inStartTime;
@@ -67,7 +64,6 @@ static void record_handler(void *userData, AudioQueueRef inQ,
 	(void)inPacketDesc;
 
 	pthread_mutex_lock(&st->mutex);
-	ptime = st->ptime;
 	rh  = st->rh;
 	arg = st->arg;
 	pthread_mutex_unlock(&st->mutex);
@@ -78,12 +74,6 @@ static void record_handler(void *userData, AudioQueueRef inQ,
 	rh(inQB->mAudioData, inQB->mAudioDataByteSize/2, arg);
 
 	AudioQueueEnqueueBuffer(inQ, inQB, 0, NULL);
-
-	/* Force a sleep here, coreaudio's timing is too fast */
-#if !TARGET_OS_IPHONE
-#define ENCODE_TIME 1000
-	usleep((ptime * 1000) - ENCODE_TIME);
-#endif
 }
 
 
@@ -109,7 +99,6 @@ int coreaudio_recorder_alloc(struct ausrc_st **stp, const struct ausrc *as,
 	if (!st)
 		return ENOMEM;
 
-	st->ptime = prm->ptime;
 	st->as  = as;
 	st->rh  = rh;
 	st->arg = arg;
@@ -121,7 +110,7 @@ int coreaudio_recorder_alloc(struct ausrc_st **stp, const struct ausrc *as,
 	if (err)
 		goto out;
 
-	err = audio_session_enable();
+	err = audio_session_enable(prm->ptime);
 	if (err)
 		goto out;
 
@@ -166,6 +155,9 @@ int coreaudio_recorder_alloc(struct ausrc_st **stp, const struct ausrc *as,
 		goto out;
 	}
 
+	if (prm->latency)
+		*prm->latency = prm->ptime * 1000;
+
  out:
 	if (err)
 		mem_deref(st);
@@ -0,0 +1,747 @@
+/**
+ * @file ctrl_tcp.c  TCP control interface using JSON
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+
+
+/**
+ * @defgroup ctrl_tcp ctrl_tcp
+ *
+ * Control interface for programs, using JSON over a TCP socket
+ *
+ * Each request and each reply is one JSON object on one line. A request
+ * has an "id" of any string or number, which is given back in all its
+ * replies, so requests can be sent without waiting for the reply of
+ * the previous one.
+ *
+ * A command is run with the key of the command, and its parameter:
+ *
+ \verbatim
+  {"id":1,"command":"d"}
+  {"id":2,"command":"o","params":"sip:alice@example.com"}
+ \endverbatim
+ *
+ * The output of the command is sent while it runs, as "data" replies,
+ * and the request is done with a reply that has "ok":
+ *
+ \verbatim
+  {"id":2,"data":"call: connecting to 'sip:alice@example.com'..\n"}
+  {"id":2,"ok":true}
+ \endverbatim
+ *
+ * The calls of all User-Agents can be read without parsing the output
+ * of a command:
+ *
+ \verbatim
+  {"id":3,"get":"calls"}
+  {"id":3,"calls":[{"aor":"sip:bob@example.com","id":"..",
+   "peer":"sip:alice@example.com","outgoing":true,"onhold":false,
+   "duration":12}],"ok":true}
+ \endverbatim
+ *
+ * The User-Agent events are sent on a connection from when it asks for
+ * them, so that there is no need to poll:
+ *
+ \verbatim
+  {"id":4,"subscribe":true}
+  {"event":"CALL_INCOMING","aor":"sip:bob@example.com","call":"..",
+   "param":"sip:alice@example.com"}
+ \endverbatim
+ *
+ * The following options can be configured:
+ *
+ \verbatim
+  ctrl_tcp_listen     127.0.0.1:4444       # IP-address and port
+ \endverbatim
+ */
+
+
+enum {
+	CTRL_PORT  = 4444,
+	CHUNK_SIZE = 1024,       /**< Command output sent at a time  */
+	REQ_MAX    = 8192,       /**< Maximum size of a request      */
+};
+
+struct ctrl_st {
+	struct tcp_sock *ts;
+	struct list connl;
+};
+
+struct ctrl_conn {
+	struct le le;
+	struct tcp_conn *tc;
+	struct mbuf *mb;         /**< Received data, not yet a line  */
+	bool events;             /**< Send the User-Agent events     */
+};
+
+struct request {
+	struct pl id;
+	bool id_str;
+	struct pl command;
+	struct pl params;
+	struct pl get;
+	bool subscribe;
+	bool has_subscribe;
+};
+
+/* A reply being sent while the command runs */
+struct reply {
+	struct ctrl_conn *cc;
+	const struct request *req;
+	struct mbuf *mb;
+};
+
+
+static struct ctrl_st *ctrl = NULL;  /* allow only one instance */
+
+
+/* JSON string, without the quotes */
+static int json_encode_pl(struct re_printf *pf, const struct pl *pl)
+{
+	size_t i, last = 0;
+	int err = 0;
+
+	if (!pl)
+		return 0;
+
+	for (i=0; i<pl->l && !err; i++) {
+
+		const uint8_t ch = pl->p[i];
+		const char *esc = NULL;
+		char ubuf[8];
+
+		switch (ch) {
+
+		case '"':  esc = "\\\""; break;
+		case '\\': esc = "\\\\"; break;
+		case '\b': esc = "\\b";  break;
+		case '\f': esc = "\\f";  break;
+		case '\n': esc = "\\n";  break;
+		case '\r': esc = "\\r";  break;
+		case '\t': esc = "\\t";  break;
+
+		default:
+			if (ch < 0x20) {
+				(void)re_snprintf(ubuf, sizeof(ubuf),
+						  "\\u%04x", ch);
+				esc = ubuf;
+			}
+			break;
+		}
+
+		if (!esc)
+			continue;
+
+		err  = pf->vph(&pl->p[last], i - last, pf->arg);
+		err |= re_hprintf(pf, "%s", esc);
+		last = i + 1;
+	}
+
+	if (!err && last < pl->l)
+		err = pf->vph(&pl->p[last], pl->l - last, pf->arg);
+
+	return err;
+}
+
+
+static int json_encode_str(struct re_printf *pf, const char *str)
+{
+	struct pl pl;
+
+	pl_set_str(&pl, str ? str : "");
+
+	return json_encode_pl(pf, &pl);
+}
+
+
+static size_t utf8_encode(char *p, uint32_t u)
+{
+	if (u < 0x80) {
+		p[0] = u;
+		return 1;
+	}
+	else if (u < 0x800) {
+		p[0] = 0xc0 | (u >> 6);
+		p[1] = 0x80 | (u & 0x3f);
+		return 2;
+	}
+
+	p[0] = 0xe0 | (u >> 12);
+	p[1] = 0x80 | ((u >> 6) & 0x3f);
+	p[2] = 0x80 | (u & 0x3f);
+
+	return 3;
+}
+
+
+/* Decode a JSON string value, that was checked by json_next() */
+static int json_decode_str(char **strp, const struct pl *pl)
+{
+	char *str, *p;
+	size_t i;
+
+	str = mem_alloc(pl->l + 1, NULL);
+	if (!str)
+		return ENOMEM;
+
+	for (i=0, p=str; i<pl->l; i++) {
+
+		char ch = pl->p[i];
+
+		if (ch != '\\' || i+1 >= pl->l) {
+			*p++ = ch;
+			continue;
+		}
+
+		switch (ch = pl->p[++i]) {
+
+		case 'b': *p++ = '\b'; break;
+		case 'f': *p++ = '\f'; break;
+		case 'n': *p++ = '\n'; break;
+		case 'r': *p++ = '\r'; break;
+		case 't': *p++ = '\t'; break;
+
+		case 'u':
+			if (i + 4 < pl->l) {
+				struct pl hex;
+
+				hex.p = &pl->p[i+1];
+				hex.l = 4;
+				p += utf8_encode(p, pl_x32(&hex));
+				i += 4;
+			}
+			break;
+
+		default:
+			*p++ = ch;
+			break;
+		}
+	}
+
+	*p = '\0';
+	*strp = str;
+
+	return 0;
+}
+
+
+static void skip_ws(struct pl *pl)
+{
+	while (pl->l && strchr(" \t\r\n", pl->p[0]))
+		pl_advance(pl, 1);
+}
+
+
+/* String up to the closing quote, with the opening quote skipped */
+static int json_string(struct pl *pl, struct pl *val)
+{
+	size_t i;
+
+	for (i=0; i<pl->l; i++) {
+
+		if (pl->p[i] == '\\') {
+			++i;
+			continue;
+		}
+
+		if (pl->p[i] == '"') {
+			val->p = pl->p;
+			val->l = i;
+			pl_advance(pl, i + 1);
+			return 0;
+		}
+	}
+
+	return EBADMSG;
+}
+
+
+/*
+ * Get the next member of a JSON object that has only strings, numbers,
+ * and literals as values
+ */
+static int json_next(struct pl *obj, struct pl *name, struct pl *val,
+		     bool *str)
+{
+	size_t n;
+
+	skip_ws(obj);
+	if (obj->l && (obj->p[0] == '{' || obj->p[0] == ',')) {
+		pl_advance(obj, 1);
+		skip_ws(obj);
+	}
+
+	if (!obj->l || obj->p[0] == '}')
+		return ENOENT;
+
+	if (obj->p[0] != '"')
+		return EBADMSG;
+	pl_advance(obj, 1);
+
+	if (json_string(obj, name))
+		return EBADMSG;
+
+	skip_ws(obj);
+	if (!obj->l || obj->p[0] != ':')
+		return EBADMSG;
+	pl_advance(obj, 1);
+	skip_ws(obj);
+
+	if (obj->l && obj->p[0] == '"') {
+		pl_advance(obj, 1);
+		*str = true;
+		return json_string(obj, val);
+	}
+
+	for (n=0; n<obj->l; n++) {
+
+		const char ch = obj->p[n];
+
+		if (strchr(",} \t\r\n", ch))
+			break;
+
+		/* numbers and true, false and null */
+		if (!strchr("0123456789+-.eEtruefalsn", ch))
+			return EBADMSG;
+	}
+
+	if (!n)
+		return EBADMSG;
+
+	val->p = obj->p;
+	val->l = n;
+	pl_advance(obj, n);
+	*str = false;
+
+	return 0;
+}
+
+
+static int request_decode(struct request *req, const struct pl *line)
+{
+	struct pl obj = *line, name, val;
+	bool str;
+	int err;
+
+	memset(req, 0, sizeof(*req));
+
+	skip_ws(&obj);
+	if (!obj.l || obj.p[0] != '{')
+		return EBADMSG;
+
+	while (0 == (err = json_next(&obj, &name, &val, &str))) {
+
+		if (0 == pl_strcmp(&name, "id")) {
+			req->id     = val;
+			req->id_str = str;
+		}
+		else if (0 == pl_strcmp(&name, "command") && str) {
+			req->command = val;
+		}
+		else if (0 == pl_strcmp(&name, "params") && str) {
+			req->params = val;
+		}
+		else if (0 == pl_strcmp(&name, "get") && str) {
+			req->get = val;
+		}
+		else if (0 == pl_strcmp(&name, "subscribe") && !str) {
+			req->subscribe     = 0 == pl_strcmp(&val, "true");
+			req->has_subscribe = true;
+		}
+	}
+
+	return err == ENOENT ? 0 : err;
+}
+
+
+static int id_print(struct re_printf *pf, const struct request *req)
+{
+	if (!pl_isset(&req->id))
+		return re_hprintf(pf, "null");
+
+	if (req->id_str)
+		return re_hprintf(pf, "\"%r\"", &req->id);
+
+	return re_hprintf(pf, "%r", &req->id);
+}
+
+
+static int conn_printf(struct ctrl_conn *cc, const char *fmt, ...)
+{
+	struct mbuf *mb;
+	va_list ap;
+	int err;
+
+	mb = mbuf_alloc(128);
+	if (!mb)
+		return ENOMEM;
+
+	va_start(ap, fmt);
+	err = mbuf_vprintf(mb, fmt, ap);
+	va_end(ap);
+
+	if (!err) {
+		mb->pos = 0;
+		err = tcp_send(cc->tc, mb);
+	}
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
+static int reply_flush(struct reply *rp)
+{
+	struct pl data;
+	int err;
+
+	if (!rp->mb->end)
+		return 0;
+
+	data.p = (const char *)rp->mb->buf;
+	data.l = rp->mb->end;
+
+	err = conn_printf(rp->cc, "{\"id\":%H,\"data\":\"%H\"}\n",
+			  id_print, rp->req, json_encode_pl, &data);
+
+	mbuf_rewind(rp->mb);
+
+	return err;
+}
+
+
+static int reply_handler(const char *p, size_t size, void *arg)
+{
+	struct reply *rp = arg;
+	int err;
+
+	err = mbuf_write_mem(rp->mb, (const uint8_t *)p, size);
+	if (err)
+		return err;
+
+	if (rp->mb->end >= CHUNK_SIZE)
+		err = reply_flush(rp);
+
+	return err;
+}
+
+
+static int done_send(struct ctrl_conn *cc, const struct request *req,
+		     int err)
+{
+	if (err) {
+		char buf[64];
+
+		(void)re_snprintf(buf, sizeof(buf), "%m", err);
+
+		return conn_printf(cc, "{\"id\":%H,\"ok\":false"
+				   ",\"error\":\"%H\"}\n",
+				   id_print, req, json_encode_str, buf);
+	}
+
+	return conn_printf(cc, "{\"id\":%H,\"ok\":true}\n", id_print, req);
+}
+
+
+static int command_run(struct ctrl_conn *cc, const struct request *req)
+{
+	struct reply rp;
+	struct re_printf pf;
+	char *prm = NULL;
+	int err;
+
+	if (req->command.l != 1)
+		return EINVAL;
+
+	err = json_decode_str(&prm, &req->params);
+	if (err)
+		return err;
+
+	rp.cc  = cc;
+	rp.req = req;
+	rp.mb  = mbuf_alloc(CHUNK_SIZE);
+	if (!rp.mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	pf.vph = reply_handler;
+	pf.arg = &rp;
+
+	err = cmd_exec(req->command.p[0], prm, &pf);
+	err |= reply_flush(&rp);
+
+ out:
+	mem_deref(rp.mb);
+	mem_deref(prm);
+
+	return err;
+}
+
+
+static int call_print(struct re_printf *pf, const struct call *call)
+{
+	return re_hprintf(pf, "{\"aor\":\"%H\",\"id\":\"%H\""
+			  ",\"peer\":\"%H\",\"outgoing\":%s"
+			  ",\"onhold\":%s,\"duration\":%u}",
+			  json_encode_str, ua_aor(call_get_ua(call)),
+			  json_encode_str, call_id(call),
+			  json_encode_str, call_peeruri(call),
+			  call_is_outgoing(call) ? "true" : "false",
+			  call_is_onhold(call) ? "true" : "false",
+			  call_duration(call));
+}
+
+
+static int calls_print(struct re_printf *pf, void *unused)
+{
+	struct le *le;
+	bool first = true;
+	int err = 0;
+	(void)unused;
+
+	for (le = list_head(uag_list()); le && !err; le = le->next) {
+
+		const struct ua *ua = le->data;
+		struct le *lec;
+
+		for (lec = list_head(ua_calls(ua)); lec; lec = lec->next) {
+
+			err |= re_hprintf(pf, "%s%H", first ? "" : ",",
+					  call_print, lec->data);
+			first = false;
+		}
+	}
+
+	return err;
+}
+
+
+static int request_handle(struct ctrl_conn *cc, const struct pl *line)
+{
+	struct request req;
+	int err;
+
+	err = request_decode(&req, line);
+	if (err) {
+		warning("ctrl_tcp: invalid request: %r\n", line);
+		return done_send(cc, &req, err);
+	}
+
+	if (req.has_subscribe) {
+		cc->events = req.subscribe;
+	}
+	else if (0 == pl_strcmp(&req.get, "calls")) {
+		return conn_printf(cc, "{\"id\":%H,\"calls\":[%H],\"ok\":true}"
+				   "\n", id_print, &req, calls_print, NULL);
+	}
+	else if (pl_isset(&req.get)) {
+		err = ENOENT;
+	}
+	else if (pl_isset(&req.command)) {
+		err = command_run(cc, &req);
+	}
+	else {
+		err = EINVAL;
+	}
+
+	return done_send(cc, &req, err);
+}
+
+
+static void conn_destructor(void *arg)
+{
+	struct ctrl_conn *cc = arg;
+
+	list_unlink(&cc->le);
+	mem_deref(cc->tc);
+	mem_deref(cc->mb);
+}
+
+
+static void tcp_recv_handler(struct mbuf *mb, void *arg)
+{
+	struct ctrl_conn *cc = arg;
+	struct pl buf;
+	int err;
+
+	cc->mb->pos = cc->mb->end;
+	err = mbuf_write_mem(cc->mb, mbuf_buf(mb), mbuf_get_left(mb));
+	if (err)
+		goto out;
+
+	buf.p = (const char *)cc->mb->buf;
+	buf.l = cc->mb->end;
+
+	for (;;) {
+		const char *eol = pl_strchr(&buf, '\n');
+		struct pl line;
+
+		if (!eol)
+			break;
+
+		line.p = buf.p;
+		line.l = eol - buf.p;
+		pl_advance(&buf, line.l + 1);
+
+		if (line.l)
+			(void)request_handle(cc, &line);
+	}
+
+	if (buf.l > REQ_MAX) {
+		warning("ctrl_tcp: request too long\n");
+		err = EOVERFLOW;
+		goto out;
+	}
+
+	/* keep the start of the next request */
+	memmove(cc->mb->buf, buf.p, buf.l);
+	cc->mb->pos = 0;
+	cc->mb->end = buf.l;
+
+ out:
+	if (err)
+		mem_deref(cc);
+}
+
+
+static void tcp_close_handler(int err, void *arg)
+{
+	struct ctrl_conn *cc = arg;
+	(void)err;
+
+	mem_deref(cc);
+}
+
+
+static void tcp_conn_handler(const struct sa *peer, void *arg)
+{
+	struct ctrl_st *st = arg;
+	struct ctrl_conn *cc;
+	int err;
+
+	cc = mem_zalloc(sizeof(*cc), conn_destructor);
+	if (!cc)
+		return;
+
+	cc->mb = mbuf_alloc(256);
+	if (!cc->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = tcp_accept(&cc->tc, st->ts, NULL, tcp_recv_handler,
+			 tcp_close_handler, cc);
+	if (err)
+		goto out;
+
+	list_append(&st->connl, &cc->le, cc);
+
+	debug("ctrl_tcp: connection from %J\n", peer);
+
+ out:
+	if (err) {
+		tcp_reject(st->ts);
+		mem_deref(cc);
+	}
+}
+
+
+static void ua_event_handler(struct ua *ua, enum ua_event ev,
+			     struct call *call, const char *prm, void *arg)
+{
+	struct ctrl_st *st = arg;
+	struct le *le;
+
+	for (le = st->connl.head; le; le = le->next) {
+
+		struct ctrl_conn *cc = le->data;
+
+		if (!cc->events)
+			continue;
+
+		(void)conn_printf(cc, "{\"event\":\"%s\",\"aor\":\"%H\""
+				  ",\"call\":\"%H\",\"param\":\"%H\"}\n",
+				  uag_event_str(ev),
+				  json_encode_str, ua_aor(ua),
+				  json_encode_str,
+				  call ? call_id(call) : NULL,
+				  json_encode_str, prm);
+	}
+}
+
+
+static void ctrl_destructor(void *arg)
+{
+	struct ctrl_st *st = arg;
+
+	uag_event_unregister(ua_event_handler);
+
+	list_flush(&st->connl);
+	mem_deref(st->ts);
+}
+
+
+static int ctrl_alloc(struct ctrl_st **stp, const struct sa *laddr)
+{
+	struct ctrl_st *st;
+	int err;
+
+	st = mem_zalloc(sizeof(*st), ctrl_destructor);
+	if (!st)
+		return ENOMEM;
+
+	err = tcp_listen(&st->ts, laddr, tcp_conn_handler, st);
+	if (err) {
+		warning("ctrl_tcp: failed to listen on TCP %J (%m)\n",
+			laddr, err);
+		goto out;
+	}
+
+	err = uag_event_register(ua_event_handler, st);
+	if (err)
+		goto out;
+
+	debug("ctrl_tcp: listening on %J\n", laddr);
+
+ out:
+	if (err)
+		mem_deref(st);
+	else
+		*stp = st;
+
+	return err;
+}
+
+
+static int ctrl_init(void)
+{
+	struct sa laddr;
+
+	if (conf_get_sa(conf_cur(), "ctrl_tcp_listen", &laddr)) {
+		sa_set_str(&laddr, "127.0.0.1", CTRL_PORT);
+	}
+
+	return ctrl_alloc(&ctrl, &laddr);
+}
+
+
+static int ctrl_close(void)
+{
+	ctrl = mem_deref(ctrl);
+
+	return 0;
+}
+
+
+const struct mod_export DECL_EXPORTS(ctrl_tcp) = {
+	"ctrl_tcp",
+	"application",
+	ctrl_init,
+	ctrl_close
+};
@@ -0,0 +1,10 @@
+#
+# module.mk
+#
+# Copyright (C) 2010 Creytiv.com
+#
+
+MOD		:= ctrl_tcp
+$(MOD)_SRCS	+= ctrl_tcp.c
+
+include mk/mod.mk
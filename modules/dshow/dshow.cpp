@@ -18,6 +18,12 @@
  *
  * Windows DirectShow video-source
  *
+ * The capture pin is set to the size and framerate of the encoder, and
+ * to a native format of the camera if one is known, NV12 first. The
+ * samples are then passed on as they are, and are converted by the
+ * core only for an encoder that does not take them. Other formats are
+ * converted to RGB32 in the filter graph.
+ *
  *
  * References:
  *
@@ -50,6 +56,17 @@ const CLSID CLSID_SampleGrabber = { 0xc1f400a0, 0x3f08, 0x11d3,
 
 class Grabber;
 
+/* Native formats of the camera, in the order of preference */
+static const struct {
+	const GUID *subtype;
+	enum vidfmt fmt;
+} fmtv[] = {
+	{&MEDIASUBTYPE_NV12, VID_FMT_NV12},
+	{&MEDIASUBTYPE_IYUV, VID_FMT_YUV420P},
+	{&MEDIASUBTYPE_YUY2, VID_FMT_YUYV422},
+	{&MEDIASUBTYPE_UYVY, VID_FMT_UYVY422},
+};
+
 struct vidsrc_st {
 	const struct vidsrc *vs;  /* inheritance */
 
@@ -64,6 +81,9 @@ struct vidsrc_st {
 	Grabber *grab;
 
 	struct vidsz size;
+	enum vidfmt fmt;          /* format of the samples */
+	GUID subtype;
+	int fps;
 	vidsrc_frame_h *frameh;
 	void *arg;
 };
@@ -97,8 +117,7 @@ public:
 	{
 		struct vidframe vidframe;
 
-		/* XXX: should be VID_FMT_BGR24 */
-		vidframe_init_buf(&vidframe, VID_FMT_RGB32, &src->size, buf);
+		vidframe_init_buf(&vidframe, src->fmt, &src->size, buf);
 
 		if (src->frameh)
 			src->frameh(&vidframe, src->arg);
@@ -213,7 +232,7 @@ static int add_sample_grabber(struct vidsrc_st *st)
 
 	memset(&mt, 0, sizeof(mt));
 	mt.majortype = MEDIATYPE_Video;
-	mt.subtype = MEDIASUBTYPE_RGB24;  /* XXX: try YUV420P */
+	mt.subtype = st->subtype;
 	hr = st->grabber->SetMediaType(&mt);
 	if (FAILED(hr))
 		return ENODEV;
@@ -244,6 +263,20 @@ static AM_MEDIA_TYPE *free_mt(AM_MEDIA_TYPE *mt)
 }
 
 
+/* Preference of a media type, ARRAY_SIZE(fmtv) if not native */
+static unsigned fmt_rank(const AM_MEDIA_TYPE *mt)
+{
+	unsigned i;
+
+	for (i=0; i<ARRAY_SIZE(fmtv); i++) {
+		if (IsEqualGUID(mt->subtype, *fmtv[i].subtype))
+			break;
+	}
+
+	return i;
+}
+
+
 static int config_pin(struct vidsrc_st *st, IPin *pin)
 {
 	AM_MEDIA_TYPE *mt;
@@ -251,12 +284,13 @@ static int config_pin(struct vidsrc_st *st, IPin *pin)
 	IEnumMediaTypes *media_enum = NULL;
 	IAMStreamConfig *stream_conf = NULL;
 	VIDEOINFOHEADER *vih;
+	REFERENCE_TIME dur;
 	HRESULT hr;
 	int h = st->size.h;
 	int w = st->size.w;
 	int rh, rw;
-	int wh, rwrh;
-	int best_match = 0;
+	int best_diff = 0;
+	unsigned rank, best_rank = 0;
 	int err = 0;
 
 	if (!pin || !st)
@@ -266,41 +300,40 @@ static int config_pin(struct vidsrc_st *st, IPin *pin)
 	if (FAILED(hr))
 		return ENODATA;
 
-	while ((hr = media_enum->Next(1, &mt, NULL)) == S_OK) {
-		if (mt->formattype != FORMAT_VideoInfo)
+	/* the closest size, and the most preferred format of that size */
+	while (media_enum->Next(1, &mt, NULL) == S_OK) {
+
+		int diff;
+
+		if (mt->formattype != FORMAT_VideoInfo) {
+			free_mt(mt);
 			continue;
+		}
 
 		vih = (VIDEOINFOHEADER *) mt->pbFormat;
 		rw = vih->bmiHeader.biWidth;
-		rh = vih->bmiHeader.biHeight;
+		rh = abs(vih->bmiHeader.biHeight);
 
-		wh = w * h;
-		rwrh = rw * rh;
-		if (wh == rwrh) {
-			best_mt = free_mt(best_mt);
-			break;
-		}
-		else {
-			int diff = abs(rwrh - wh);
-
-			if (best_match != 0 && diff >= best_match)
-				mt = free_mt(mt);
-			else {
-				best_match = diff;
-				free_mt(best_mt);
-				best_mt = mt;
-			}
+		diff = abs(rw * rh - w * h);
+		rank = fmt_rank(mt);
+
+		if (best_mt && (diff > best_diff ||
+				(diff == best_diff && rank >= best_rank))) {
+			free_mt(mt);
+			continue;
 		}
+
+		free_mt(best_mt);
+		best_mt   = mt;
+		best_diff = diff;
+		best_rank = rank;
 	}
-	if (hr != S_OK)
-		mt = free_mt(mt);
 
-	if (mt == NULL && best_mt == NULL) {
+	mt = best_mt;
+	if (mt == NULL) {
 		err = ENODATA;
 		goto out;
 	}
-	if (mt == NULL)
-		mt = best_mt;
 
 	hr = pin->QueryInterface(IID_IAMStreamConfig,
 				 (void **) &stream_conf);
@@ -309,8 +342,18 @@ static int config_pin(struct vidsrc_st *st, IPin *pin)
 		goto out;
 	}
 
+	/* capture at the framerate of the encoder, if the camera can */
 	vih = (VIDEOINFOHEADER *) mt->pbFormat;
+	dur = vih->AvgTimePerFrame;
+	if (st->fps > 0)
+		vih->AvgTimePerFrame = 10000000 / st->fps;
+
 	hr = stream_conf->SetFormat(mt);
+	if (FAILED(hr) && vih->AvgTimePerFrame != dur) {
+		warning("dshow: config_pin: %d fps not supported\n", st->fps);
+		vih->AvgTimePerFrame = dur;
+		hr = stream_conf->SetFormat(mt);
+	}
 	mt = free_mt(mt);
 	if (FAILED(hr)) {
 		err = ERANGE;
@@ -329,7 +372,7 @@ static int config_pin(struct vidsrc_st *st, IPin *pin)
 
 	vih = (VIDEOINFOHEADER *)mt->pbFormat;
 	rw = vih->bmiHeader.biWidth;
-	rh = vih->bmiHeader.biHeight;
+	rh = abs(vih->bmiHeader.biHeight);
 
 	if (w != rw || h != rh) {
 		warning("dshow: config_pin: picture size missmatch: "
@@ -339,6 +382,19 @@ static int config_pin(struct vidsrc_st *st, IPin *pin)
 	st->size.w = rw;
 	st->size.h = rh;
 
+	/* other formats are converted by the graph */
+	rank = fmt_rank(mt);
+	if (rank < ARRAY_SIZE(fmtv)) {
+		st->subtype = mt->subtype;
+		st->fmt     = fmtv[rank].fmt;
+	}
+	else {
+		st->subtype = MEDIASUBTYPE_RGB32;
+		st->fmt     = VID_FMT_RGB32;
+	}
+
+	info("dshow: capture %s %d x %d\n", vidfmt_name(st->fmt), rw, rh);
+
  out:
 	if (media_enum)
 		media_enum->Release();
@@ -411,6 +467,7 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 	st->vs = vs;
 
 	st->size   = *size;
+	st->fps    = prm->fps;
 	st->frameh = frameh;
 	st->arg    = arg;
 
@@ -465,12 +522,16 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 		hr = pin_enum->Next(1, &pin, NULL);
 	}
 
-	add_sample_grabber(st);
+	/* the grabber takes the format of the pin */
 	err = config_pin(st, pin);
 	pin->Release();
 	if (err)
 		goto out;
 
+	err = add_sample_grabber(st);
+	if (err)
+		goto out;
+
 	hr = st->capture->RenderStream(&PIN_CATEGORY_CAPTURE,
 				       &MEDIATYPE_Video,
 				       st->dev_filter,
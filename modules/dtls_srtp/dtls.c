@@ -4,48 +4,238 @@
  * Copyright (C) 2010 Creytiv.com
  */
 
+#include <openssl/ssl.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/x509.h>
 #include <re.h>
 #include <baresip.h>
 #include "dtls_srtp.h"
 
 
-int dtls_print_sha1_fingerprint(struct re_printf *pf, const struct tls *tls)
+/*
+ * The certificate is made once when the module is loaded, and its
+ * fingerprints are formatted as they go into SDP. An ECDSA P-256 key
+ * signs the handshake much faster than RSA, and the certificate is
+ * smaller, so the DTLS flight fits in fewer datagrams.
+ */
+
+
+enum {
+	CERT_DAYS = 30,   /**< Validity of the self-signed certificate */
+};
+
+
+static int fp_format(char *str, size_t size, const uint8_t *md, size_t len)
 {
-	uint8_t md[20];
-	unsigned int i;
+	size_t i;
 	int err = 0;
 
-	if (!tls)
+	if (size < 3 * len)
+		return EOVERFLOW;
+
+	for (i=0; i<len; i++) {
+		err |= re_snprintf(str + 3*i, size - 3*i, "%02X%s",
+				   md[i], i+1 < len ? ":" : "") < 0;
+	}
+
+	return err ? EINVAL : 0;
+}
+
+
+static int fp_set(struct dtls_fp *fp, const uint8_t *sha1,
+		  const uint8_t *sha256)
+{
+	int err;
+
+	err  = fp_format(fp->sha1, sizeof(fp->sha1), sha1, 20);
+	err |= fp_format(fp->sha256, sizeof(fp->sha256), sha256, 32);
+
+	return err;
+}
+
+
+static EVP_PKEY *ec_keygen(void)
+{
+	EVP_PKEY_CTX *ctx;
+	EVP_PKEY *key = NULL;
+
+	ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+	if (!ctx)
+		return NULL;
+
+	if (EVP_PKEY_keygen_init(ctx) <= 0)
+		goto out;
+
+	if (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx,
+						   NID_X9_62_prime256v1) <= 0)
+		goto out;
+
+#ifdef EVP_PKEY_CTX_set_ec_param_enc
+	if (EVP_PKEY_CTX_set_ec_param_enc(ctx, OPENSSL_EC_NAMED_CURVE) <= 0)
+		goto out;
+#endif
+
+	if (EVP_PKEY_keygen(ctx, &key) <= 0)
+		key = NULL;
+
+ out:
+	EVP_PKEY_CTX_free(ctx);
+
+	return key;
+}
+
+
+static X509 *cert_selfsign(EVP_PKEY *key, const char *cn)
+{
+	X509_NAME *subj;
+	X509 *cert;
+
+	cert = X509_new();
+	if (!cert)
+		return NULL;
+
+	if (!X509_set_version(cert, 2))
+		goto err;
+
+	if (!ASN1_INTEGER_set(X509_get_serialNumber(cert),
+			      rand_u32() & 0x7fffffff))
+		goto err;
+
+	if (!X509_gmtime_adj(X509_get_notBefore(cert), -3600 * 24) ||
+	    !X509_gmtime_adj(X509_get_notAfter(cert), 3600 * 24 * CERT_DAYS))
+		goto err;
+
+	subj = X509_get_subject_name(cert);
+	if (!X509_NAME_add_entry_by_txt(subj, "CN", MBSTRING_ASC,
+					(const unsigned char *)cn, -1, -1, 0))
+		goto err;
+
+	if (!X509_set_issuer_name(cert, subj) ||
+	    !X509_set_pubkey(cert, key) ||
+	    !X509_sign(cert, key, EVP_sha256()))
+		goto err;
+
+	return cert;
+
+ err:
+	X509_free(cert);
+	return NULL;
+}
+
+
+/**
+ * Use a new self-signed ECDSA P-256 certificate for a DTLS context
+ *
+ * @param tls DTLS context
+ * @param cn  Common name of the certificate
+ * @param fp  Returned fingerprints of the certificate
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dtls_set_selfsigned_ec(struct tls *tls, const char *cn,
+			   struct dtls_fp *fp)
+{
+	uint8_t sha1[20], sha256[32];
+	unsigned sha1_len = sizeof(sha1), sha256_len = sizeof(sha256);
+	SSL_CTX *ctx;
+	EVP_PKEY *key;
+	X509 *cert = NULL;
+	int err = 0;
+
+	if (!tls || !cn || !fp)
 		return EINVAL;
 
-	err = tls_fingerprint(tls, TLS_FINGERPRINT_SHA1, md, sizeof(md));
-	if (err)
-		return err;
+	ctx = tls_openssl_context(tls);
+	if (!ctx)
+		return EINVAL;
+
+	key = ec_keygen();
+	if (!key)
+		return ENOMEM;
 
-	for (i=0; i<sizeof(md); i++) {
-		err |= re_hprintf(pf, "%s%02X", i==0 ? "" : ":", md[i]);
+	cert = cert_selfsign(key, cn);
+	if (!cert) {
+		err = ENOMEM;
+		goto out;
 	}
 
+	if (1 != SSL_CTX_use_certificate(ctx, cert) ||
+	    1 != SSL_CTX_use_PrivateKey(ctx, key)) {
+		err = EINVAL;
+		goto out;
+	}
+
+	if (!X509_digest(cert, EVP_sha1(), sha1, &sha1_len) ||
+	    !X509_digest(cert, EVP_sha256(), sha256, &sha256_len)) {
+		err = EINVAL;
+		goto out;
+	}
+
+	err = fp_set(fp, sha1, sha256);
+
+ out:
+	X509_free(cert);
+	EVP_PKEY_free(key);
+
 	return err;
 }
 
 
-int dtls_print_sha256_fingerprint(struct re_printf *pf, const struct tls *tls)
+/**
+ * Get the fingerprints of the certificate of a DTLS context
+ *
+ * @param tls DTLS context
+ * @param fp  Returned fingerprints of the certificate
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dtls_fingerprints(const struct tls *tls, struct dtls_fp *fp)
 {
-	uint8_t md[32];
-	unsigned int i;
-	int err = 0;
+	uint8_t sha1[20], sha256[32];
+	int err;
 
-	if (!tls)
+	if (!tls || !fp)
 		return EINVAL;
 
-	err = tls_fingerprint(tls, TLS_FINGERPRINT_SHA256, md, sizeof(md));
+	err  = tls_fingerprint(tls, TLS_FINGERPRINT_SHA1, sha1, sizeof(sha1));
+	err |= tls_fingerprint(tls, TLS_FINGERPRINT_SHA256,
+			       sha256, sizeof(sha256));
 	if (err)
 		return err;
 
-	for (i=0; i<sizeof(md); i++) {
-		err |= re_hprintf(pf, "%s%02X", i==0 ? "" : ":", md[i]);
-	}
+	return fp_set(fp, sha1, sha256);
+}
 
-	return err;
+
+/**
+ * Enable DTLS session resumption for incoming handshakes. A peer that
+ * connects again, with a session ticket or a cached session, skips the
+ * key exchange and the certificate signature.
+ *
+ * @param tls DTLS context
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dtls_enable_resumption(struct tls *tls)
+{
+	static const unsigned char sid_ctx[] = "baresip";
+	SSL_CTX *ctx;
+
+	if (!tls)
+		return EINVAL;
+
+	ctx = tls_openssl_context(tls);
+	if (!ctx)
+		return EINVAL;
+
+	/* needed to resume sessions with a verified client */
+	if (1 != SSL_CTX_set_session_id_context(ctx, sid_ctx,
+						sizeof(sid_ctx) - 1))
+		return EINVAL;
+
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+
+	return 0;
 }
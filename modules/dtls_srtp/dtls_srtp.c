@@ -26,6 +26,14 @@
   <sip:user@domain.com>;mediaenc=srtp-mandf
  \endverbatim
  *
+ * The certificate is made once, with an ECDSA P-256 key. With rtcp_mux
+ * enabled and accepted by the peer, each media line needs only one
+ * handshake. Sessions of peers that connect again can be resumed:
+ *
+ \verbatim
+  dtls_srtp_resumption    yes
+ \endverbatim
+ *
  *
  * Internally the protocol stack diagram looks something like this:
  *
@@ -65,7 +73,10 @@ struct dtls_srtp {
 };
 
 static struct tls *tls;
+static struct dtls_fp fp;     /* fingerprints of our certificate */
 static const char* srtp_profiles =
+	"SRTP_AEAD_AES_128_GCM:"
+	"SRTP_AEAD_AES_256_GCM:"
 	"SRTP_AES128_CM_SHA1_80:"
 	"SRTP_AES128_CM_SHA1_32";
 
@@ -175,8 +186,8 @@ static int session_alloc(struct menc_sess **sessp,
 		goto out;
 
 	/* RFC 4572 */
-	err = sdp_session_set_lattr(sdp, true, "fingerprint", "SHA-256 %H",
-				    dtls_print_sha256_fingerprint, tls);
+	err = sdp_session_set_lattr(sdp, true, "fingerprint", "SHA-256 %s",
+				    fp.sha256);
 	if (err)
 		goto out;
 
@@ -190,12 +201,27 @@ static int session_alloc(struct menc_sess **sessp,
 }
 
 
+/* length of the master key and salt, as exported by DTLS (RFC 7714) */
+static size_t get_master_keylen(enum srtp_suite suite)
+{
+	switch (suite) {
+
+	case SRTP_AES_CM_128_HMAC_SHA1_32: return 16 + 14;
+	case SRTP_AES_CM_128_HMAC_SHA1_80: return 16 + 14;
+	case SRTP_AES_128_GCM:             return 16 + 12;
+	case SRTP_AES_256_GCM:             return 32 + 12;
+	default: return 0;
+	}
+}
+
+
 static void dtls_estab_handler(void *arg)
 {
 	struct comp *comp = arg;
 	const struct dtls_srtp *ds = comp->ds;
 	enum srtp_suite suite;
-	uint8_t cli_key[30], srv_key[30];
+	uint8_t cli_key[32 + 12], srv_key[32 + 12];
+	size_t keylen;
 	int err;
 
 	if (!verify_fingerprint(ds->sess->sdp, ds->sdpm, comp->tls_conn)) {
@@ -213,6 +239,13 @@ static void dtls_estab_handler(void *arg)
 		return;
 	}
 
+	keylen = get_master_keylen(suite);
+	if (!keylen) {
+		warning("dtls_srtp: unsupported SRTP profile %s\n",
+			srtp_suite_name(suite));
+		return;
+	}
+
 	comp->negotiated = true;
 
 	info("dtls_srtp: ---> DTLS-SRTP complete (%s/%s) Profile=%s\n",
@@ -220,9 +253,9 @@ static void dtls_estab_handler(void *arg)
 	     comp->is_rtp ? "RTP" : "RTCP", srtp_suite_name(suite));
 
 	err |= srtp_stream_add(&comp->tx, suite,
-			       ds->active ? cli_key : srv_key, 30, true);
+			       ds->active ? cli_key : srv_key, keylen, true);
 	err |= srtp_stream_add(&comp->rx, suite,
-			       ds->active ? srv_key : cli_key, 30, false);
+			       ds->active ? srv_key : cli_key, keylen, false);
 
 	err |= srtp_install(comp);
 	if (err) {
@@ -392,7 +425,10 @@ static int media_alloc(struct menc_media **mp, struct menc_sess *sess,
 		*mp = (struct menc_media *)st;
 
  setup:
-	st->mux = (rtpsock == rtcpsock) || (rtcpsock == NULL);
+	/* with rtcp-mux one handshake covers both RTP and RTCP */
+	st->mux = (rtpsock == rtcpsock) || (rtcpsock == NULL) ||
+		(conf_config()->avt.rtcp_mux &&
+		 sdp_media_rattr(st->sdpm, "rtcp-mux"));
 
 	setup = sdp_media_session_rattr(st->sdpm, st->sess->sdp, "setup");
 	if (setup) {
@@ -415,15 +451,13 @@ static int media_alloc(struct menc_media **mp, struct menc_sess *sess,
 
 		if (0 == pl_strcasecmp(&hash, "SHA-1")) {
 			err = sdp_media_set_lattr(st->sdpm, true,
-						  "fingerprint", "SHA-1 %H",
-						  dtls_print_sha1_fingerprint,
-						  tls);
+						  "fingerprint", "SHA-1 %s",
+						  fp.sha1);
 		}
 		else if (0 == pl_strcasecmp(&hash, "SHA-256")) {
 			err = sdp_media_set_lattr(st->sdpm, true,
-						  "fingerprint", "SHA-256 %H",
-						 dtls_print_sha256_fingerprint,
-						  tls);
+						  "fingerprint", "SHA-256 %s",
+						  fp.sha256);
 		}
 		else {
 			info("dtls_srtp: unsupported fingerprint hash `%r'\n",
@@ -436,22 +470,43 @@ static int media_alloc(struct menc_media **mp, struct menc_sess *sess,
 }
 
 
+/* bursts are protected together once the RTP keys are negotiated */
+static int media_burst(struct menc_media *m, bool start)
+{
+	struct dtls_srtp *st = (struct dtls_srtp *)m;
+	struct comp *comp;
+
+	if (!st)
+		return EINVAL;
+
+	comp = &st->compv[0];
+	if (!comp->tx)
+		return 0;
+
+	return srtp_burst(comp, start);
+}
+
+
 static struct menc dtls_srtp = {
-	LE_INIT, "dtls_srtp",  "UDP/TLS/RTP/SAVP", session_alloc, media_alloc
+	LE_INIT, "dtls_srtp",  "UDP/TLS/RTP/SAVP", session_alloc, media_alloc,
+	media_burst
 };
 
 static struct menc dtls_srtpf = {
-	LE_INIT, "dtls_srtpf", "UDP/TLS/RTP/SAVPF", session_alloc, media_alloc
+	LE_INIT, "dtls_srtpf", "UDP/TLS/RTP/SAVPF", session_alloc, media_alloc,
+	media_burst
 };
 
 static struct menc dtls_srtp2 = {
 	/* note: temp for Webrtc interop */
-	LE_INIT, "srtp-mandf", "RTP/SAVPF", session_alloc, media_alloc
+	LE_INIT, "srtp-mandf", "RTP/SAVPF", session_alloc, media_alloc,
+	media_burst
 };
 
 
 static int module_init(void)
 {
+	bool resumption = false;
 	int err;
 
 	err = tls_alloc(&tls, TLS_METHOD_DTLSV1, NULL, NULL);
@@ -461,11 +516,36 @@ static int module_init(void)
 		return err;
 	}
 
-	err = tls_set_selfsigned(tls, "dtls@baresip");
+	/* one certificate for all calls, RSA if ECDSA is not available */
+	err = dtls_set_selfsigned_ec(tls, "dtls@baresip", &fp);
 	if (err) {
-		warning("dtls_srtp: failed to self-sign certificate (%m)\n",
-			err);
-		return err;
+		info("dtls_srtp: no ECDSA certificate (%m), using RSA\n",
+		     err);
+
+		err = tls_set_selfsigned(tls, "dtls@baresip");
+		if (err) {
+			warning("dtls_srtp: failed to self-sign"
+				" certificate (%m)\n", err);
+			return err;
+		}
+
+		err = dtls_fingerprints(tls, &fp);
+		if (err) {
+			warning("dtls_srtp: no certificate fingerprint"
+				" (%m)\n", err);
+			return err;
+		}
+	}
+
+	(void)conf_get_bool(conf_cur(), "dtls_srtp_resumption", &resumption);
+
+	if (resumption) {
+		err = dtls_enable_resumption(tls);
+		if (err) {
+			warning("dtls_srtp: failed to enable session"
+				" resumption (%m)\n", err);
+			return err;
+		}
 	}
 
 	tls_set_verify_client(tls);
@@ -23,11 +23,19 @@ struct comp {
 };
 
 /* dtls.c */
-int dtls_print_sha1_fingerprint(struct re_printf *pf, const struct tls *tls);
-int dtls_print_sha256_fingerprint(struct re_printf *pf, const struct tls *tls);
+struct dtls_fp {
+	char sha1[3 * 20];     /* "AB:CD:..." as in SDP */
+	char sha256[3 * 32];
+};
+
+int dtls_set_selfsigned_ec(struct tls *tls, const char *cn,
+			   struct dtls_fp *fp);
+int dtls_fingerprints(const struct tls *tls, struct dtls_fp *fp);
+int dtls_enable_resumption(struct tls *tls);
 
 
 /* srtp.c */
 int  srtp_stream_add(struct srtp_stream **sp, enum srtp_suite suite,
 		     const uint8_t *key, size_t key_size, bool tx);
 int  srtp_install(struct comp *comp);
+int  srtp_burst(struct comp *comp, bool start);
@@ -6,6 +6,6 @@
 
 MOD		:= dtls_srtp
 $(MOD)_SRCS	+= dtls_srtp.c srtp.c dtls.c
-$(MOD)_LFLAGS	+=
+$(MOD)_LFLAGS	+= -lssl -lcrypto
 
 include mk/mod.mk
@@ -9,8 +9,21 @@
 #include "dtls_srtp.h"
 
 
+enum {
+	BURST_MAX = 64,      /* RTP packets protected in one batch        */
+	SRTP_TAG_MAX = 16,   /* longest authentication tag of the suites  */
+};
+
+
 struct srtp_stream {
 	struct srtp *srtp;
+
+	/* RTP packets held back during a burst, see srtp_burst() */
+	struct lock *lock;
+	struct mbuf *mbv[BURST_MAX];
+	struct sa dstv[BURST_MAX];
+	size_t n;
+	bool burst;
 };
 
 
@@ -55,19 +68,122 @@ static inline bool is_rtcp_packet(const struct mbuf *mb)
 static void destructor(void *arg)
 {
 	struct srtp_stream *s = arg;
+	size_t i;
 
 	mem_deref(s->srtp);
+
+	for (i=0; i<BURST_MAX; i++)
+		mem_deref(s->mbv[i]);
+	mem_deref(s->lock);
+}
+
+
+/*
+ * Protect a vector of RTP packets with one SRTP context. A packet that
+ * fails is emptied, the others are still protected.
+ */
+static int srtp_encrypt_batch(struct srtp *srtp, struct mbuf **mbv,
+			      size_t n)
+{
+	size_t i;
+	int err = 0;
+
+	for (i=0; i<n; i++) {
+
+		int lerr = srtp_encrypt(srtp, mbv[i]);
+		if (lerr) {
+			mbv[i]->pos = mbv[i]->end;
+			err = lerr;
+		}
+	}
+
+	return err;
+}
+
+
+/* must be called with the stream lock held */
+static int burst_send(struct comp *comp)
+{
+	struct srtp_stream *s = comp->tx;
+	size_t i;
+	int err;
+
+	if (!s->n)
+		return 0;
+
+	err = srtp_encrypt_batch(s->srtp, s->mbv, s->n);
+	if (err) {
+		warning("srtp: srtp_encrypt failed in burst (%m)\n", err);
+	}
+
+	/* on through the UDP helpers below SRTP */
+	for (i=0; i<s->n; i++) {
+
+		if (mbuf_get_left(s->mbv[i]))
+			err |= udp_send_helper(comp->app_sock, &s->dstv[i],
+					       s->mbv[i], comp->uh_srtp);
+	}
+
+	s->n = 0;
+
+	return err;
+}
+
+
+/* copy an RTP packet into the burst, with room for the tag */
+static bool burst_queue(struct comp *comp, const struct sa *dst,
+			const struct mbuf *mb)
+{
+	struct srtp_stream *s = comp->tx;
+	size_t len = mbuf_get_left(mb);
+	struct mbuf *pkt;
+	bool queued = false;
+
+	lock_write_get(s->lock);
+
+	if (!s->burst)
+		goto out;
+
+	if (s->n >= BURST_MAX)
+		(void)burst_send(comp);
+
+	pkt = s->mbv[s->n];
+	if (!pkt) {
+		pkt = mbuf_alloc(len + SRTP_TAG_MAX);
+		if (!pkt)
+			goto out;
+
+		s->mbv[s->n] = pkt;
+	}
+
+	mbuf_rewind(pkt);
+
+	if (mbuf_write_mem(pkt, mbuf_buf(mb), len))
+		goto out;
+
+	pkt->pos = 0;
+	s->dstv[s->n++] = *dst;
+	queued = true;
+
+ out:
+	lock_rel(s->lock);
+
+	return queued;
 }
 
 
 static bool send_handler(int *err, struct sa *dst, struct mbuf *mb, void *arg)
 {
 	struct comp *comp = arg;
-	(void)dst;
 
 	if (!is_rtp_or_rtcp(mb))
 		return false;
 
+	if (!is_rtcp_packet(mb) && burst_queue(comp, dst, mb)) {
+		*err = 0;
+		return true;  /* protected and sent when the burst ends */
+	}
+
 	if (is_rtcp_packet(mb)) {
 		*err = srtcp_encrypt(comp->tx->srtp, mb);
 		if (*err) {
@@ -132,6 +248,10 @@ int srtp_stream_add(struct srtp_stream **sp, enum srtp_suite suite,
 		goto out;
 	}
 
+	err = lock_alloc(&s->lock);
+	if (err)
+		goto out;
+
  out:
 	if (err)
 		mem_deref(s);
@@ -148,3 +268,34 @@ int srtp_install(struct comp *comp)
 				   LAYER_SRTP,
 				   send_handler, recv_handler, comp);
 }
+
+
+/**
+ * Start or end a burst of outgoing RTP packets on a component
+ *
+ * @param comp  DTLS-SRTP component
+ * @param start True to start, false to protect and send the burst
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtp_burst(struct comp *comp, bool start)
+{
+	struct srtp_stream *s;
+	int err = 0;
+
+	if (!comp || !comp->tx)
+		return EINVAL;
+
+	s = comp->tx;
+
+	lock_write_get(s->lock);
+
+	s->burst = start;
+
+	if (!start)
+		err = burst_send(comp);
+
+	lock_rel(s->lock);
+
+	return err;
+}
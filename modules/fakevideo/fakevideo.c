@@ -7,6 +7,7 @@
 #define _BSD_SOURCE 1
 #include <unistd.h>
 #include <pthread.h>
+#include <string.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -20,24 +21,55 @@
  * This module can be used to generate fake video input frames, and to
  * send output video frames to a fake non-existant display.
  *
+ * For load tests the source can replay a loop of moving frames, which
+ * are drawn once when the source is opened, so that the encoder has
+ * real work to do but the source has none. The loop can also be
+ * encoded once with the H.264 encoder, and is then sent as encoded
+ * access units when the call uses H.264, so that neither the source
+ * nor the encoder cost anything. The loop starts with a keyframe; a
+ * picture update request is only served at the next loop start.
+ *
+ * The frames are paced from the monotonic media clock.
+ *
  * Example config:
  \verbatim
-  video_source    fakevideo,nil
-  video_display   fakevideo,nil
+  video_source      fakevideo,nil
+  video_display     fakevideo,nil
+
+  fakevideo_loop    60     # Frames in the loop, 0 for one still frame
+  fakevideo_encoded no     # Replay the loop encoded with H.264
  \endverbatim
  */
 
 
+enum {
+	LOOP_MAX = 600,     /**< Maximum frames in the loop */
+	RTP_SRATE = 90000,  /**< RTP clockrate of video     */
+};
+
+
 struct vidsrc_st {
 	const struct vidsrc *vs;  /* inheritance */
-	struct vidframe *frame;
+	struct vidframe **framev; /* the loop of frames                */
+	unsigned framec;
+	struct mbuf **auv;        /* the loop in H.264, Annex B        */
+	unsigned auc;
 	pthread_t thread;
 	bool run;
 	int fps;
 	vidsrc_frame_h *frameh;
+	vidsrc_packet_h *pkth;
 	void *arg;
 };
 
+/* Collects the packets of the encoder into access units */
+struct enc_loop {
+	struct vidsrc_st *st;
+	struct mbuf *pld;         /* payload of the current packet     */
+	struct mbuf *au;          /* current access unit               */
+	int err;
+};
+
 struct vidisp_st {
 	const struct vidisp *vd;  /* inheritance */
 };
@@ -45,23 +77,255 @@ struct vidisp_st {
 
 static struct vidsrc *vidsrc;
 static struct vidisp *vidisp;
+static uint32_t loop_len;
+static bool loop_encoded;
+
+
+/* Frame i of a loop of n, a diagonal gradient and a box that move */
+static void draw_frame(struct vidframe *f, unsigned i, unsigned n)
+{
+	const unsigned w = f->size.w, h = f->size.h;
+	const unsigned bw = w / 4, bh = h / 4;
+	const unsigned bx = (w - bw) * i / n, by = (h - bh) / 2;
+	unsigned x, y;
+
+	for (y=0; y<h; y++) {
+
+		uint8_t *p = f->data[0] + y * f->linesize[0];
+		const bool row = y >= by && y < by + bh;
+
+		for (x=0; x<w; x++) {
+
+			if (row && x >= bx && x < bx + bw)
+				p[x] = 235;
+			else
+				p[x] = (uint8_t)(16 + (x + y + 4 * i) % 200);
+		}
+	}
+
+	for (y=0; y<(h + 1) / 2; y++) {
+		memset(f->data[1] + y * f->linesize[1], 128, (w + 1) / 2);
+		memset(f->data[2] + y * f->linesize[2], 128, (w + 1) / 2);
+	}
+}
+
+
+static int loop_alloc(struct vidsrc_st *st, const struct vidsz *size)
+{
+	unsigned i;
+	int err;
+
+	st->framec = loop_len ? loop_len : 1;
+
+	st->framev = mem_zalloc(st->framec * sizeof(*st->framev), NULL);
+	if (!st->framev)
+		return ENOMEM;
+
+	for (i=0; i<st->framec; i++) {
+
+		err = vidframe_alloc(&st->framev[i], VID_FMT_YUV420P, size);
+		if (err)
+			return err;
+
+		if (loop_len)
+			draw_frame(st->framev[i], i, st->framec);
+	}
+
+	return 0;
+}
+
+
+/* Append an RTP payload of H.264 to the access unit, in Annex B */
+static int au_append(struct mbuf *au, const uint8_t *p, size_t len)
+{
+	static const uint8_t sc[4] = {0, 0, 0, 1};
+	int err = 0;
+
+	if (!len)
+		return EBADMSG;
+
+	switch (p[0] & 0x1f) {
+
+	case H264_NAL_FU_A:
+		if (len < 2)
+			return EBADMSG;
+
+		if (p[1] & 0x80) {
+			err |= mbuf_write_mem(au, sc, sizeof(sc));
+			err |= mbuf_write_u8(au, (p[0] & 0xe0) |
+					     (p[1] & 0x1f));
+		}
+
+		err |= mbuf_write_mem(au, p + 2, len - 2);
+		break;
+
+	case H264_NAL_STAP_A:
+		++p;
+		--len;
+
+		while (len >= 2 && !err) {
+
+			const size_t n = p[0] << 8 | p[1];
+
+			if (n > len - 2)
+				return EBADMSG;
+
+			err |= mbuf_write_mem(au, sc, sizeof(sc));
+			err |= mbuf_write_mem(au, p + 2, n);
+
+			p   += 2 + n;
+			len -= 2 + n;
+		}
+		break;
+
+	default:
+		err |= mbuf_write_mem(au, sc, sizeof(sc));
+		err |= mbuf_write_mem(au, p, len);
+		break;
+	}
+
+	return err;
+}
+
+
+static int enc_packet(bool marker, const uint8_t *hdr, size_t hdr_len,
+		      const uint8_t *pld, size_t pld_len, void *arg)
+{
+	struct enc_loop *el = arg;
+	struct vidsrc_st *st = el->st;
+	int err;
+
+	if (st->auc >= st->framec)
+		return 0;
+
+	if (!el->au) {
+		el->au = mbuf_alloc(4096);
+		if (!el->au)
+			return ENOMEM;
+	}
+
+	/* the header and payload of a packet, in one piece */
+	mbuf_rewind(el->pld);
+	err = hdr_len ? mbuf_write_mem(el->pld, hdr, hdr_len) : 0;
+	err |= mbuf_write_mem(el->pld, pld, pld_len);
+	err |= au_append(el->au, el->pld->buf, el->pld->end);
+	if (err) {
+		el->err = err;
+		return err;
+	}
+
+	if (marker) {
+		el->au->pos = 0;
+		st->auv[st->auc++] = el->au;
+		el->au = NULL;
+	}
+
+	return 0;
+}
+
+
+static int enc_packet_mb(bool marker, struct mbuf *mb, void *arg)
+{
+	return enc_packet(marker, NULL, 0, mbuf_buf(mb), mbuf_get_left(mb),
+			  arg);
+}
+
+
+/* Encode the loop once, the encoded loop is shorter if it fails */
+static int loop_encode(struct vidsrc_st *st)
+{
+	const struct config *cfg = conf_config();
+	const struct vidcodec *vc;
+	struct videnc_state *enc = NULL;
+	struct videnc_param prm;
+	struct enc_loop el;
+	unsigned i;
+	int err;
+
+	vc = vidcodec_find_encoder("H264");
+	if (!vc)
+		return ENOENT;
+
+	err = vidcodec_init(vc);
+	if (err)
+		return err;
+
+	memset(&el, 0, sizeof(el));
+	el.st  = st;
+	el.pld = mbuf_alloc(2048);
+	if (!el.pld)
+		return ENOMEM;
+
+	st->auv = mem_zalloc(st->framec * sizeof(*st->auv), NULL);
+	if (!st->auv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	prm.bitrate = cfg ? cfg->video.bitrate : 500000;
+	prm.pktsize = 1024;
+	prm.fps     = st->fps;
+	prm.max_fs  = -1;
+	prm.pkth_mb = enc_packet_mb;
+
+	err = vc->encupdh(&enc, vc, &prm, NULL, enc_packet, &el);
+	if (err)
+		goto out;
+
+	for (i=0; i<st->framec && !el.err; i++) {
+
+		/* the loop starts with a keyframe */
+		err = vc->ench(enc, i == 0, st->framev[i]);
+		if (err)
+			goto out;
+	}
+
+ out:
+	/* frames still in the encoder are not in the loop */
+	mem_deref(enc);
+	mem_deref(el.au);
+	mem_deref(el.pld);
+
+	if (!err && !st->auc)
+		err = ENODATA;
+
+	return err ? err : el.err;
+}
+
+
+static void send_frame(struct vidsrc_st *st, uint64_t n)
+{
+	if (st->auc && st->pkth) {
+
+		const struct mbuf *au = st->auv[n % st->auc];
+		const uint32_t ts = (uint32_t)(n * RTP_SRATE / st->fps);
+
+		/* a user of the source wants frames */
+		if (!st->pkth("H264", au->buf, au->end, ts, st->arg))
+			return;
+	}
+
+	st->frameh(st->framev[n % st->framec], st->arg);
+}
 
 
 static void *read_thread(void *arg)
 {
 	struct vidsrc_st *st = arg;
-	uint64_t ts = tmr_jiffies();
+	const uint64_t start = mclock_now();
+	uint64_t n = 0;
 
 	while (st->run) {
 
-		if (tmr_jiffies() < ts) {
-			sys_msleep(4);
+		/* from the start, no drift from rounding */
+		const uint64_t ts = start + n * 1000000 / st->fps;
+
+		if (mclock_now() < ts) {
+			mclock_sleep_until(ts);
 			continue;
 		}
 
-		st->frameh(st->frame, st->arg);
-
-		ts += (1000/st->fps);
+		send_frame(st, n++);
 	}
 
 	return NULL;
@@ -72,12 +336,20 @@ static void src_destructor(void *arg)
 {
 	struct vidsrc_st *st = arg;
 
+	unsigned i;
+
 	if (st->run) {
 		st->run = false;
 		pthread_join(st->thread, NULL);
 	}
 
-	mem_deref(st->frame);
+	for (i=0; st->framev && i<st->framec; i++)
+		mem_deref(st->framev[i]);
+	for (i=0; i<st->auc; i++)
+		mem_deref(st->auv[i]);
+
+	mem_deref(st->framev);
+	mem_deref(st->auv);
 }
 
 
@@ -110,14 +382,28 @@ static int src_alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 		return ENOMEM;
 
 	st->vs     = vs;
-	st->fps    = prm->fps;
+	st->fps    = max(prm->fps, 1);
 	st->frameh = frameh;
+	st->pkth   = prm->pkth;
 	st->arg    = arg;
 
-	err = vidframe_alloc(&st->frame, VID_FMT_YUV420P, size);
+	err = loop_alloc(st, size);
 	if (err)
 		goto out;
 
+	if (loop_encoded && st->pkth) {
+
+		err = loop_encode(st);
+		if (err) {
+			warning("fakevideo: loop not encoded (%m)\n", err);
+			err = 0;
+		}
+		else {
+			info("fakevideo: %u of %u frames encoded\n",
+			     st->auc, st->framec);
+		}
+	}
+
 	st->run = true;
 	err = pthread_create(&st->thread, NULL, read_thread, st);
 	if (err) {
@@ -174,6 +460,19 @@ static int display(struct vidisp_st *st, const char *title,
 static int module_init(void)
 {
 	int err = 0;
+
+	conf_get_u32(conf_cur(), "fakevideo_loop", &loop_len);
+	conf_get_bool(conf_cur(), "fakevideo_encoded", &loop_encoded);
+
+	if (loop_len > LOOP_MAX) {
+		warning("fakevideo: loop of %u frames, using %u\n",
+			loop_len, LOOP_MAX);
+		loop_len = LOOP_MAX;
+	}
+
+	if (loop_encoded && !loop_len)
+		loop_len = 1;
+
 	err |= vidsrc_register(&vidsrc, "fakevideo", src_alloc, NULL);
 	err |= vidisp_register(&vidisp, "fakevideo", disp_alloc, NULL,
 			       display, NULL);
@@ -129,13 +129,16 @@ static int encode(struct auenc_state *st, uint8_t *buf, size_t *len,
 {
 	int n;
 
+	if (!st || !buf || !len || !sampv)
+		return EINVAL;
+
+	/* 64 kbit/s is 4 bits per sample */
+	if (*len < (sampc + 1) / 2)
+		return EOVERFLOW;
+
 	n = g722_encode(&st->enc, buf, sampv, (int)sampc);
-	if (n <= 0) {
+	if (n <= 0)
 		return EPROTO;
-	}
-	else if (n > (int)*len) {
-		return EOVERFLOW;
-	}
 
 	*len = n;
 
@@ -148,9 +151,12 @@ static int decode(struct audec_state *st, int16_t *sampv, size_t *sampc,
 {
 	int n;
 
-	if (!st || !sampv || !buf)
+	if (!st || !sampv || !sampc || !buf)
 		return EINVAL;
 
+	if (*sampc < len * 2)
+		return ENOMEM;
+
 	n = g722_decode(&st->dec, sampv, buf, (int)len);
 	if (n < 0)
 		return EPROTO;
@@ -18,9 +18,6 @@
  */
 
 
-enum { MAX_PACKET = 100 };
-
-
 struct g726_aucodec {
 	struct aucodec ac;
 	int bitrate;
@@ -28,10 +25,12 @@ struct g726_aucodec {
 
 struct auenc_state {
 	g726_state_t st;
+	unsigned bits;      /**< Bits per sample */
 };
 
 struct audec_state {
 	g726_state_t st;
+	unsigned bits;      /**< Bits per sample */
 };
 
 
@@ -70,6 +69,8 @@ static int encode_update(struct auenc_state **aesp,
 	if (!st)
 		return ENOMEM;
 
+	st->bits = gac->bitrate / 8000;
+
 	if (!g726_init(&st->st, gac->bitrate, G726_ENCODING_LINEAR,
 		       G726_PACKING_LEFT)) {
 		err = ENOMEM;
@@ -103,6 +104,8 @@ static int decode_update(struct audec_state **adsp,
 	if (!st)
 		return ENOMEM;
 
+	st->bits = gac->bitrate / 8000;
+
 	if (!g726_init(&st->st, gac->bitrate, G726_ENCODING_LINEAR,
 		       G726_PACKING_LEFT)) {
 		err = ENOMEM;
@@ -122,10 +125,10 @@ static int decode_update(struct audec_state **adsp,
 static int encode(struct auenc_state *st, uint8_t *buf,
 		  size_t *len, const int16_t *sampv, size_t sampc)
 {
-	if (!buf || !len || !sampv)
+	if (!st || !buf || !len || !sampv)
 		return EINVAL;
 
-	if (*len < MAX_PACKET)
+	if (*len < (sampc * st->bits + 7) / 8)
 		return ENOMEM;
 
 	*len = g726_encode(&st->st, buf, sampv, (int)sampc);
@@ -137,9 +140,12 @@ static int encode(struct auenc_state *st, uint8_t *buf,
 static int decode(struct audec_state *st, int16_t *sampv,
 		  size_t *sampc, const uint8_t *buf, size_t len)
 {
-	if (!sampv || !sampc || !buf)
+	if (!st || !sampv || !sampc || !buf)
 		return EINVAL;
 
+	if (*sampc < len * 8 / st->bits)
+		return ENOMEM;
+
 	*sampc = g726_decode(&st->st, sampv, buf, (int)len);
 
 	return 0;
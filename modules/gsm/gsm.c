@@ -16,7 +16,8 @@
 
 
 enum {
-	FRAME_SIZE = 160
+	FRAME_SIZE  = 160,
+	FRAME_PTIME = 20,
 };
 
 
@@ -128,21 +129,30 @@ static int encode(struct auenc_state *st, uint8_t *buf, size_t *len,
 }
 
 
+/* One RTP packet may carry several frames (RFC 3551 section 4.5.8) */
 static int decode(struct audec_state *st, int16_t *sampv, size_t *sampc,
 		  const uint8_t *buf, size_t len)
 {
+	size_t nframe, i;
 	int ret;
 
-	if (*sampc < FRAME_SIZE)
-		return ENOMEM;
-	if (len < sizeof(gsm_frame))
+	nframe = len / sizeof(gsm_frame);
+
+	if (!nframe)
 		return EBADMSG;
+	if (*sampc < FRAME_SIZE * nframe)
+		return ENOMEM;
 
-	ret = gsm_decode(st->dec, (gsm_byte *)buf, (gsm_signal *)sampv);
-	if (ret)
-		return EPROTO;
+	for (i=0; i<nframe; i++) {
+
+		ret = gsm_decode(st->dec,
+				 (gsm_byte *)buf + i * sizeof(gsm_frame),
+				 (gsm_signal *)sampv + i * FRAME_SIZE);
+		if (ret)
+			return EPROTO;
+	}
 
-	*sampc = 160;
+	*sampc = FRAME_SIZE * nframe;
 
 	return 0;
 }
@@ -150,7 +160,8 @@ static int decode(struct audec_state *st, int16_t *sampv, size_t *sampc,
 
 static struct aucodec ac_gsm = {
 	LE_INIT, "3", "GSM", 8000, 8000, 1, NULL,
-	encode_update, encode, decode_update, decode, NULL, NULL, NULL
+	encode_update, encode, decode_update, decode, NULL, NULL, NULL,
+	FRAME_PTIME
 };
 
 
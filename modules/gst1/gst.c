@@ -5,8 +5,6 @@
  */
 #include <stdlib.h>
 #include <string.h>
-#define __USE_POSIX199309
-#include <time.h>
 #include <pthread.h>
 #include <gst/gst.h>
 #include <re.h>
@@ -30,31 +28,62 @@
  */
 
 
+/*
+ * All sources of the same URI and format share one pipeline, so a
+ * network stream used for music on hold is fetched and decoded once for
+ * all calls. The sink runs in sync with the pipeline clock, which paces
+ * files and network streams alike.
+ *
+ * The decoded buffers are mapped, and every whole packet in a buffer is
+ * passed to the read handlers straight from the mapped memory. Only a
+ * packet split over two buffers is copied.
+ */
+
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define PCM_FORMAT "S16LE"
+#else
+#define PCM_FORMAT "S16BE"
+#endif
+
+
 /**
- * Defines the Gstreamer state
+ * Defines the shared Gstreamer pipeline
  *
  * <pre>
  *                ptime=variable             ptime=20ms
  *  .-----------. N kHz          .---------. N kHz
  *  |           | 1-2 channels   |         | 1-2 channels
- *  | Gstreamer |--------------->|Packetize|-------------> [read handler]
- *  |           |                |         |
- *  '-----------'                '---------'
+ *  | Gstreamer |--------------->|Packetize|--+----------> [read handler]
+ *  |           |                |         |  |
+ *  '-----------'                '---------'  '----------> [read handler]
  *
  * </pre>
  */
-struct ausrc_st {
-	const struct ausrc *as;     /**< Inheritance             */
+struct pipe {
+	struct le le;               /**< Member of the pipeline list */
 
 	pthread_t tid;              /**< Thread ID               */
 	bool run;                   /**< Running flag            */
-	ausrc_read_h *rh;           /**< Read handler            */
-	ausrc_error_h *errh;        /**< Error handler           */
-	void *arg;                  /**< Handler argument        */
-	struct ausrc_prm prm;       /**< Read parameters         */
-	struct aubuf *aubuf;        /**< Packet buffer           */
+	pthread_mutex_t mutex;      /**< Protects srcl           */
+	struct list srcl;           /**< Audio sources (readers) */
+	uint32_t srate;             /**< Sampling rate in [Hz]   */
+	uint8_t ch;                 /**< Number of channels      */
+	uint32_t ptime;             /**< Packet time in [ms]     */
+	size_t sampc;               /**< Samples per packet      */
 	size_t psize;               /**< Packet size in bytes    */
-	size_t sampc;
+	int16_t *frame;             /**< Packet split by buffers */
+	size_t framesz;             /**< Bytes in frame          */
+	GstCaps *caps;              /**< Caps of the sink pad    */
+	bool caps_ok;               /**< Caps have our format    */
+
+	/* Statistics */
+	uint64_t n_buffers;         /**< Buffers from the sink   */
+	uint64_t n_bytes;           /**< Bytes from the sink     */
+	uint64_t n_mapped;          /**< Packets read in place   */
+	uint64_t n_copied;          /**< Packets copied          */
+	uint64_t n_dropped;         /**< Buffers of wrong format */
+	uint32_t latency;           /**< Pipeline latency [ms]   */
 
 	/* Gstreamer */
 	char *uri;
@@ -62,35 +91,86 @@ struct ausrc_st {
 	GMainLoop *loop;
 };
 
+struct ausrc_st {
+	const struct ausrc *as;     /**< Inheritance             */
+
+	struct le le;               /**< Member of the pipeline  */
+	struct pipe *pipe;          /**< Shared pipeline         */
+	ausrc_read_h *rh;           /**< Read handler            */
+	ausrc_error_h *errh;        /**< Error handler           */
+	void *arg;                  /**< Handler argument        */
+};
+
 
 typedef struct _GstFakeSink GstFakeSink;
 static char gst_uri[256] = "http://relay1.slayradio.org:8000/";
 static struct ausrc *ausrc;
+static struct list pipel;       /**< Shared pipelines        */
 
 
 static void *thread(void *arg)
 {
-	struct ausrc_st *st = arg;
+	struct pipe *pp = arg;
 
 	/* Now set to playing and iterate. */
-	gst_element_set_state(st->pipeline, GST_STATE_PLAYING);
+	gst_element_set_state(pp->pipeline, GST_STATE_PLAYING);
 
-	while (st->run) {
-		g_main_loop_run(st->loop);
+	while (pp->run) {
+		g_main_loop_run(pp->loop);
 	}
 
 	return NULL;
 }
 
 
+static void pipe_error(struct pipe *pp, int err, const char *str)
+{
+	struct le *le;
+
+	pthread_mutex_lock(&pp->mutex);
+
+	for (le = pp->srcl.head; le; le = le->next) {
+		struct ausrc_st *st = le->data;
+
+		if (st->errh)
+			st->errh(err, str, st->arg);
+	}
+
+	pthread_mutex_unlock(&pp->mutex);
+}
+
+
+static void latency_update(struct pipe *pp)
+{
+	GstClockTime min_lat, max_lat;
+	gboolean live;
+	GstQuery *q;
+
+	q = gst_query_new_latency();
+
+	if (gst_element_query(pp->pipeline, q)) {
+
+		gst_query_parse_latency(q, &live, &min_lat, &max_lat);
+
+		pp->latency = (uint32_t)(min_lat / GST_MSECOND);
+
+		info("gst: %s: latency %u ms%s\n", pp->uri, pp->latency,
+		     live ? " (live)" : "");
+	}
+
+	gst_query_unref(q);
+}
+
+
 static gboolean bus_watch_handler(GstBus *bus, GstMessage *msg, gpointer data)
 {
-	struct ausrc_st *st = data;
-	GMainLoop *loop = st->loop;
+	struct pipe *pp = data;
+	GMainLoop *loop = pp->loop;
 	GstTagList *tag_list;
 	gchar *title;
 	GError *err;
 	gchar *d;
+	gint pct;
 
 	(void)bus;
 
@@ -100,9 +180,9 @@ static gboolean bus_watch_handler(GstBus *bus, GstMessage *msg, gpointer data)
 		/* XXX decrementing repeat count? */
 
 		/* Re-start stream */
-		if (st->run) {
-			gst_element_set_state(st->pipeline, GST_STATE_NULL);
-			gst_element_set_state(st->pipeline, GST_STATE_PLAYING);
+		if (pp->run) {
+			gst_element_set_state(pp->pipeline, GST_STATE_NULL);
+			gst_element_set_state(pp->pipeline, GST_STATE_PLAYING);
 		}
 		else {
 			g_main_loop_quit(loop);
@@ -118,13 +198,12 @@ static gboolean bus_watch_handler(GstBus *bus, GstMessage *msg, gpointer data)
 
 		g_free(d);
 
-		/* Call error handler */
-		if (st->errh)
-			st->errh(err->code, err->message, st->arg);
+		/* Call error handlers */
+		pipe_error(pp, err->code, err->message);
 
 		g_error_free(err);
 
-		st->run = false;
+		pp->run = false;
 		g_main_loop_quit(loop);
 		break;
 
@@ -135,6 +214,23 @@ static gboolean bus_watch_handler(GstBus *bus, GstMessage *msg, gpointer data)
 			info("gst: title: %s\n", title);
 			g_free(title);
 		}
+		gst_tag_list_unref(tag_list);
+		break;
+
+	case GST_MESSAGE_BUFFERING:
+		gst_message_parse_buffering(msg, &pct);
+
+		if (pct < 100)
+			debug("gst: %s: buffering %d%%\n", pp->uri, pct);
+		break;
+
+	case GST_MESSAGE_LATENCY:
+		gst_bin_recalculate_latency(GST_BIN(pp->pipeline));
+		latency_update(pp);
+		break;
+
+	case GST_MESSAGE_ASYNC_DONE:
+		latency_update(pp);
 		break;
 
 	default:
@@ -145,117 +241,169 @@ static gboolean bus_watch_handler(GstBus *bus, GstMessage *msg, gpointer data)
 }
 
 
-static void format_check(struct ausrc_st *st, GstStructure *s)
+static bool format_check(struct pipe *pp, GstStructure *s)
 {
-	int rate, channels, width;
-	gboolean sign;
+	const char *format;
+	int rate = 0, channels = 0;
 
-	if (!st || !s)
-		return;
+	if (!pp || !s)
+		return false;
 
 	gst_structure_get_int(s, "rate", &rate);
 	gst_structure_get_int(s, "channels", &channels);
-	gst_structure_get_int(s, "width", &width);
-	gst_structure_get_boolean(s, "signed", &sign);
+	format = gst_structure_get_string(s, "format");
 
-	if ((int)st->prm.srate != rate) {
-		warning("gst: expected %u Hz (got %u Hz)\n", st->prm.srate,
+	if ((int)pp->srate != rate) {
+		warning("gst: expected %u Hz (got %u Hz)\n", pp->srate,
 			rate);
+		return false;
 	}
-	if (st->prm.ch != channels) {
+	if (pp->ch != channels) {
 		warning("gst: expected %d channels (got %d)\n",
-			st->prm.ch, channels);
-	}
-	if (16 != width) {
-		warning("gst: expected 16-bit width (got %d)\n", width);
+			pp->ch, channels);
+		return false;
 	}
-	if (!sign) {
-		warning("gst: expected signed 16-bit format\n");
+	if (str_cmp(format, PCM_FORMAT)) {
+		warning("gst: expected %s format (got %s)\n",
+			PCM_FORMAT, format);
+		return false;
 	}
+
+	return true;
 }
 
 
-static void play_packet(struct ausrc_st *st)
+/* Pass one packet to all read handlers */
+static void play_packet(struct pipe *pp, const int16_t *sampv)
 {
-	int16_t buf[st->sampc];
+	struct le *le;
 
-	/* timed read from audio-buffer */
-	if (aubuf_get_samp(st->aubuf, st->prm.ptime, buf, st->sampc))
-		return;
+	for (le = pp->srcl.head; le; le = le->next) {
+		struct ausrc_st *st = le->data;
 
-	/* call read handler */
-	if (st->rh)
-		st->rh(buf, st->sampc, st->arg);
+		if (st->rh)
+			st->rh(sampv, pp->sampc, st->arg);
+	}
 }
 
 
-/* Expected format: 16-bit signed PCM */
-static void packet_handler(struct ausrc_st *st, GstBuffer *buffer)
+/* Expected format: 16-bit signed PCM, in native byte order */
+static void packet_handler(struct pipe *pp, GstBuffer *buffer)
 {
 	GstMapInfo info;
-	int err;
+	const uint8_t *p;
+	size_t n;
 
-	if (!st->run)
+	if (!pp->run)
 		return;
 
-	/* NOTE: When streaming from files, the buffer will be filled up
-	 *       pretty quickly..
-	 */
-
 	if (!gst_buffer_map(buffer, &info, GST_MAP_READ)) {
 		warning("gst: gst_buffer_map failed\n");
 		return;
 	}
 
-	err = aubuf_write(st->aubuf, info.data, info.size);
-	if (err) {
-		warning("gst: aubuf_write: %m\n", err);
-	}
+	++pp->n_buffers;
+	pp->n_bytes += info.size;
 
-	gst_buffer_unmap(buffer, &info);
+	p = info.data;
+	n = info.size;
+
+	pthread_mutex_lock(&pp->mutex);
 
-	/* Empty buffer now */
-	while (st->run) {
-		const struct timespec delay = {0, st->prm.ptime*1000000/2};
+	/* complete the packet split by the last buffer */
+	if (pp->framesz) {
+		size_t len = min(n, pp->psize - pp->framesz);
 
-		play_packet(st);
+		memcpy((uint8_t *)pp->frame + pp->framesz, p, len);
+		pp->framesz += len;
+		p += len;
+		n -= len;
 
-		if (aubuf_cur_size(st->aubuf) < st->psize)
-			break;
+		if (pp->framesz == pp->psize) {
+			play_packet(pp, pp->frame);
+			pp->framesz = 0;
+			++pp->n_copied;
+		}
+	}
+
+	/* whole packets, straight from the buffer */
+	if ((uintptr_t)p % sizeof(int16_t) == 0) {
+
+		while (n >= pp->psize) {
+			play_packet(pp, (const int16_t *)p);
+			p += pp->psize;
+			n -= pp->psize;
+			++pp->n_mapped;
+		}
+	}
+	else {
+		while (n >= pp->psize) {
+			memcpy(pp->frame, p, pp->psize);
+			play_packet(pp, pp->frame);
+			p += pp->psize;
+			n -= pp->psize;
+			++pp->n_copied;
+		}
+	}
 
-		(void)nanosleep(&delay, NULL);
+	if (n) {
+		memcpy(pp->frame, p, n);
+		pp->framesz = n;
 	}
+
+	pthread_mutex_unlock(&pp->mutex);
+
+	gst_buffer_unmap(buffer, &info);
 }
 
 
 static void handoff_handler(GstFakeSink *fakesink, GstBuffer *buffer,
 			    GstPad *pad, gpointer user_data)
 {
-	struct ausrc_st *st = user_data;
+	struct pipe *pp = user_data;
 	GstCaps *caps;
 	(void)fakesink;
 
+	/* the format is checked again only if the caps change */
 	caps = gst_pad_get_current_caps(pad);
+	if (!caps) {
+		++pp->n_dropped;
+		return;
+	}
+
+	if (!pp->caps || !gst_caps_is_equal(caps, pp->caps)) {
+
+		pp->caps_ok = format_check(pp, gst_caps_get_structure(caps,
+								      0));
+		gst_caps_replace(&pp->caps, caps);
+	}
 
-	format_check(st, gst_caps_get_structure(caps, 0));
+	gst_caps_unref(caps);
 
-	packet_handler(st, buffer);
+	if (!pp->caps_ok) {
+		++pp->n_dropped;
+		return;
+	}
+
+	packet_handler(pp, buffer);
 }
 
 
-static void set_caps(struct ausrc_st *st)
+static void set_caps(struct pipe *pp)
 {
 	GstCaps *caps;
 
 	/* Set the capabilities we want */
 	caps = gst_caps_new_simple("audio/x-raw",
-				   "rate",     G_TYPE_INT,    st->prm.srate,
-				   "channels", G_TYPE_INT,    st->prm.ch,
-				   "width",    G_TYPE_INT,    16,
-				   "signed",   G_TYPE_BOOLEAN,true,
+				   "format",   G_TYPE_STRING, PCM_FORMAT,
+				   "layout",   G_TYPE_STRING, "interleaved",
+				   "rate",     G_TYPE_INT,    pp->srate,
+				   "channels", G_TYPE_INT,    pp->ch,
 				   NULL);
 
-	g_object_set(G_OBJECT(st->capsfilt), "caps", caps, NULL);
+	g_object_set(G_OBJECT(pp->capsfilt), "caps", caps, NULL);
+
+	gst_caps_unref(caps);
 }
 
 
@@ -276,95 +424,197 @@ static void set_caps(struct ausrc_st *st)
  *  '--------------'    '------------------------------------------'
  * </pre>
  *
- * @param st Audio source state
+ * @param pp Shared pipeline
  *
  * @return 0 if success, otherwise errorcode
  */
-static int gst_setup(struct ausrc_st *st)
+static int gst_setup(struct pipe *pp)
 {
 	GstBus *bus;
 	GstPad *pad;
 
-	st->loop = g_main_loop_new(NULL, FALSE);
+	pp->loop = g_main_loop_new(NULL, FALSE);
 
-	st->pipeline = gst_pipeline_new("pipeline");
-	if (!st->pipeline) {
+	pp->pipeline = gst_pipeline_new("pipeline");
+	if (!pp->pipeline) {
 		warning("gst: failed to create pipeline element\n");
 		return ENOMEM;
 	}
 
 	/********************* Player BIN **************************/
 
-	st->source = gst_element_factory_make("playbin", "source");
-	if (!st->source) {
+	pp->source = gst_element_factory_make("playbin", "source");
+	if (!pp->source) {
 		warning("gst: failed to create playbin source element\n");
 		return ENOMEM;
 	}
 
 	/********************* My BIN **************************/
 
-	st->bin = gst_bin_new("mybin");
+	pp->bin = gst_bin_new("mybin");
 
-	st->capsfilt = gst_element_factory_make("capsfilter", NULL);
-	if (!st->capsfilt) {
+	pp->capsfilt = gst_element_factory_make("capsfilter", NULL);
+	if (!pp->capsfilt) {
 		warning("gst: failed to create capsfilter element\n");
 		return ENOMEM;
 	}
 
-	set_caps(st);
+	set_caps(pp);
 
-	st->sink = gst_element_factory_make("fakesink", "sink");
-	if (!st->sink) {
+	pp->sink = gst_element_factory_make("fakesink", "sink");
+	if (!pp->sink) {
 		warning("gst: failed to create sink element\n");
 		return ENOMEM;
 	}
 
-	gst_bin_add_many(GST_BIN(st->bin), st->capsfilt, st->sink, NULL);
-	gst_element_link_many(st->capsfilt, st->sink, NULL);
+	gst_bin_add_many(GST_BIN(pp->bin), pp->capsfilt, pp->sink, NULL);
+	gst_element_link_many(pp->capsfilt, pp->sink, NULL);
 
 	/* add ghostpad */
-	pad = gst_element_get_static_pad(st->capsfilt, "sink");
-	gst_element_add_pad(st->bin, gst_ghost_pad_new("sink", pad));
+	pad = gst_element_get_static_pad(pp->capsfilt, "sink");
+	gst_element_add_pad(pp->bin, gst_ghost_pad_new("sink", pad));
 	gst_object_unref(GST_OBJECT(pad));
 
 	/* put all elements in a bin */
-	gst_bin_add_many(GST_BIN(st->pipeline), st->source, NULL);
+	gst_bin_add_many(GST_BIN(pp->pipeline), pp->source, NULL);
 
-	/* Override audio-sink handoff handler */
-	g_object_set(G_OBJECT(st->sink), "signal-handoffs", TRUE, NULL);
-	g_signal_connect(st->sink, "handoff", G_CALLBACK(handoff_handler), st);
+	/* Override audio-sink handoff handler, paced by the clock */
+	g_object_set(G_OBJECT(pp->sink), "signal-handoffs", TRUE,
+		     "sync", TRUE, NULL);
+	g_signal_connect(pp->sink, "handoff", G_CALLBACK(handoff_handler), pp);
 
-	g_object_set(G_OBJECT(st->source), "audio-sink", st->bin, NULL);
+	g_object_set(G_OBJECT(pp->source), "audio-sink", pp->bin, NULL);
 
 	/********************* Misc **************************/
 
 	/* Bus watch */
-	bus = gst_pipeline_get_bus(GST_PIPELINE(st->pipeline));
-	gst_bus_add_watch(bus, bus_watch_handler, st);
+	bus = gst_pipeline_get_bus(GST_PIPELINE(pp->pipeline));
+	gst_bus_add_watch(bus, bus_watch_handler, pp);
 	gst_object_unref(bus);
 
 	/* Set URI */
-	g_object_set(G_OBJECT(st->source), "uri", st->uri, NULL);
+	g_object_set(G_OBJECT(pp->source), "uri", pp->uri, NULL);
 
 	return 0;
 }
 
 
+static void pipe_destructor(void *arg)
+{
+	struct pipe *pp = arg;
+
+	list_unlink(&pp->le);
+
+	if (pp->run) {
+		pp->run = false;
+		g_main_loop_quit(pp->loop);
+		pthread_join(pp->tid, NULL);
+	}
+
+	if (pp->n_buffers) {
+		info("gst: %s: %llu buffers, %llu bytes, %llu packets"
+		     " (%llu copied), %llu buffers dropped\n",
+		     pp->uri, pp->n_buffers, pp->n_bytes,
+		     pp->n_mapped + pp->n_copied, pp->n_copied,
+		     pp->n_dropped);
+	}
+
+	if (pp->pipeline) {
+		gst_element_set_state(pp->pipeline, GST_STATE_NULL);
+		gst_object_unref(GST_OBJECT(pp->pipeline));
+	}
+
+	if (pp->caps)
+		gst_caps_unref(pp->caps);
+
+	if (pp->loop)
+		g_main_loop_unref(pp->loop);
+
+	pthread_mutex_destroy(&pp->mutex);
+
+	mem_deref(pp->frame);
+	mem_deref(pp->uri);
+}
+
+
+static struct pipe *pipe_find(const char *uri, const struct ausrc_prm *prm)
+{
+	struct le *le;
+
+	for (le = pipel.head; le; le = le->next) {
+		struct pipe *pp = le->data;
+
+		if (pp->run && pp->srate == prm->srate && pp->ch == prm->ch &&
+		    pp->ptime == prm->ptime && !str_cmp(pp->uri, uri))
+			return pp;
+	}
+
+	return NULL;
+}
+
+
+static int pipe_alloc(struct pipe **ppp, const char *uri,
+		      const struct ausrc_prm *prm)
+{
+	struct pipe *pp;
+	int err;
+
+	pp = mem_zalloc(sizeof(*pp), pipe_destructor);
+	if (!pp)
+		return ENOMEM;
+
+	pthread_mutex_init(&pp->mutex, NULL);
+
+	err = str_dup(&pp->uri, uri);
+	if (err)
+		goto out;
+
+	pp->srate = prm->srate;
+	pp->ch    = prm->ch;
+	pp->ptime = prm->ptime;
+	pp->sampc = prm->srate * prm->ch * prm->ptime / 1000;
+	pp->psize = 2 * pp->sampc;
+
+	pp->frame = mem_alloc(pp->psize, NULL);
+	if (!pp->frame) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = gst_setup(pp);
+	if (err)
+		goto out;
+
+	pp->run = true;
+	err = pthread_create(&pp->tid, NULL, thread, pp);
+	if (err) {
+		pp->run = false;
+		goto out;
+	}
+
+	list_append(&pipel, &pp->le, pp);
+
+ out:
+	if (err)
+		mem_deref(pp);
+	else
+		*ppp = pp;
+
+	return err;
+}
+
+
 static void gst_destructor(void *arg)
 {
 	struct ausrc_st *st = arg;
 
-	if (st->run) {
-		st->run = false;
-		g_main_loop_quit(st->loop);
-		pthread_join(st->tid, NULL);
+	if (st->pipe) {
+		pthread_mutex_lock(&st->pipe->mutex);
+		list_unlink(&st->le);
+		pthread_mutex_unlock(&st->pipe->mutex);
 	}
 
-	gst_element_set_state(st->pipeline, GST_STATE_NULL);
-	gst_object_unref(GST_OBJECT(st->pipeline));
-
-	mem_deref(st->uri);
-	mem_deref(st->aubuf);
+	mem_deref(st->pipe);
 }
 
 
@@ -374,14 +624,15 @@ static int gst_alloc(struct ausrc_st **stp, const struct ausrc *as,
 		     ausrc_read_h *rh, ausrc_error_h *errh, void *arg)
 {
 	struct ausrc_st *st;
-	int err;
+	struct pipe *pp;
+	int err = 0;
 
 	(void)ctx;
 
 	if (!device)
 		device = gst_uri;
 
-	if (!prm)
+	if (!prm || !prm->srate || !prm->ch || !prm->ptime)
 		return EINVAL;
 
 	st = mem_zalloc(sizeof(*st), gst_destructor);
@@ -393,29 +644,19 @@ static int gst_alloc(struct ausrc_st **stp, const struct ausrc *as,
 	st->errh = errh;
 	st->arg  = arg;
 
-	err = str_dup(&st->uri, device);
-	if (err)
-		goto out;
-
-	st->prm   = *prm;
-
-	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
-	st->psize = 2 * st->sampc;
-
-	err = aubuf_alloc(&st->aubuf, st->psize, 0);
-	if (err)
-		goto out;
-
-	err = gst_setup(st);
-	if (err)
-		goto out;
-
-	st->run  = true;
-	err = pthread_create(&st->tid, NULL, thread, st);
-	if (err) {
-		st->run = false;
-		goto out;
+	pp = pipe_find(device, prm);
+	if (pp) {
+		st->pipe = mem_ref(pp);
 	}
+	else {
+		err = pipe_alloc(&st->pipe, device, prm);
+		if (err)
+			goto out;
+	}
+
+	pthread_mutex_lock(&st->pipe->mutex);
+	list_append(&st->pipe->srcl, &st->le, st);
+	pthread_mutex_unlock(&st->pipe->mutex);
 
  out:
 	if (err)
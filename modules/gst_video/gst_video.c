@@ -19,13 +19,22 @@
  *
  * Currently only H.264 encoding is supported, but this can be extended
  * if needed. No decoding is done by this module, so that must be done by
- * another video-codec module.
+ * another video-codec module. GStreamer is initialised when the first
+ * encoder is set up.
  *
  * Thanks to Victor Sergienko and Fadeev Alexander for the
  * initial version, which was based on avcodec module.
  */
 
 
+static int gst_video_init(void)
+{
+	gst_init(NULL, NULL);
+
+	return 0;
+}
+
+
 static struct vidcodec h264 = {
 	.name      = "H264",
 	.variant   = "packetization-mode=0",
@@ -33,13 +42,12 @@ static struct vidcodec h264 = {
 	.ench      = gst_video_encode,
 	.fmtp_ench = gst_video_fmtp_enc,
 	.fmtp_cmph = gst_video_fmtp_cmp,
+	.inith     = gst_video_init,
 };
 
 
 static int module_init(void)
 {
-	gst_init(NULL, NULL);
-
 	vidcodec_register(&h264);
 
 	info("gst_video: using gstreamer H.264 encoder\n");
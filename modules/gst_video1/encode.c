@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <re.h>
@@ -23,6 +24,48 @@
 #include "gst_video.h"
 
 
+/*
+ * The raw frame is not copied. Its planes are wrapped in a GstBuffer,
+ * with a video meta for the line sizes, and the encode call waits
+ * until the pipeline has released the buffer. The encoders are set up
+ * without lookahead or B-frames, so a frame is released once encoded.
+ *
+ * The encoder is a hardware H.264 encoder if one is installed, or
+ * x264enc. The encoded access units from the appsink are packetized
+ * straight from the mapped sample.
+ */
+
+
+enum {
+	KEYFRAME_INTERVAL = 10,     /* Seconds between two key frames */
+	RELEASE_TIMEOUT   = 1000,   /* Max. wait for a frame in [ms]  */
+};
+
+/** Encoder element, with its bitrate and key frame interval */
+struct encoder {
+	const char *name;
+	const char *fmt;            /* printf format of the element   */
+	bool kbps;                  /* bitrate in [kbit/s]            */
+};
+
+static const struct encoder encoderv[] = {
+	{"vaapih264enc",
+	 "vaapih264enc rate-control=cbr bitrate=%u keyframe-period=%u"
+	 " max-bframes=0", true},
+	{"v4l2h264enc",
+	 "v4l2h264enc extra-controls=\"encode,video_bitrate=%u,"
+	 "h264_i_frame_period=%u\"", false},
+	{"omxh264enc",
+	 "omxh264enc control-rate=variable target-bitrate=%u"
+	 " periodicity-idr=%u", false},
+	{"x264enc",
+	 "x264enc byte-stream=TRUE tune=zerolatency rc-lookahead=0"
+	 " sync-lookahead=0 bitrate=%u key-int-max=%u", true},
+};
+
+static char encoder_name[64] = "auto";
+
+
 struct videnc_state {
 
 	struct {
@@ -67,10 +110,65 @@ struct videnc_state {
 			/* 0: no-wait, 1: wait, -1: pipeline destroyed */
 			int flag;
 		} wait;
+
+		/* Planes of the frame still used by the pipeline */
+		struct {
+			pthread_mutex_t mutex;
+			pthread_cond_t cond;
+			unsigned refs;
+		} frame;
+
+		const struct encoder *enc;
 	} streamer;
 };
 
 
+/**
+ * Set the encoder element from the config
+ *
+ * @param name Name of the encoder element, or "auto"
+ */
+void gst_video1_encoder_conf(const char *name)
+{
+	if (str_isset(name))
+		str_ncpy(encoder_name, name, sizeof(encoder_name));
+}
+
+
+static bool element_exists(const char *name)
+{
+	GstElementFactory *factory = gst_element_factory_find(name);
+
+	if (!factory)
+		return false;
+
+	gst_object_unref(factory);
+
+	return true;
+}
+
+
+/* The configured encoder, or the first one installed */
+static const struct encoder *encoder_find(void)
+{
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(encoderv); i++) {
+
+		const struct encoder *enc = &encoderv[i];
+
+		if (str_casecmp(encoder_name, "auto") &&
+		    str_casecmp(encoder_name, enc->name))
+			continue;
+
+		if (element_exists(enc->name))
+			return enc;
+	}
+
+	return NULL;
+}
+
+
 static void appsrc_need_data_cb(GstAppSrc *src, guint size, gpointer user_data)
 {
 	struct videnc_state *st = user_data;
@@ -199,36 +297,49 @@ static void bus_destroy_notify_cb(struct videnc_state *st)
  * The pipeline looks like this:
  *
  * <pre>
- *  .--------.   .-----------.   .----------.
- *  | appsrc |   |  x264enc  |   | appsink  |
- *  |   .----|   |----.  .---|   |----.     |
- *  |   |src |-->|sink|  |src|-->|sink|-----+-->handoff
- *  |   '----|   |----'  '---|   |----'     |   handler
- *  '--------'   '-----------'   '----------'
+ *  .--------.   .-----------.   .----------.   .----------.
+ *  | appsrc |   |  encoder  |   | h264parse|   | appsink  |
+ *  |   .----|   |----.  .---|   |----.  .--|   |----.     |
+ *  |   |src |-->|sink|  |src|-->|sink|  |src-->|sink|-----+-->handoff
+ *  |   '----|   |----'  '---|   |----'  '--|   |----'     |   handler
+ *  '--------'   '-----------'   '----------'   '----------'
  * </pre>
  */
 static int pipeline_init(struct videnc_state *st, const struct vidsz *size)
 {
+	const struct encoder *enc;
 	GstAppSrc *source;
 	GstAppSink *sink;
 	GstBus *bus;
 	GError* gerror = NULL;
 	char pipeline[1024];
+	char encoder[256];
 	GstStateChangeReturn ret;
 	int err = 0;
 
 	if (!st || !size)
 		return EINVAL;
 
+	enc = encoder_find();
+	if (!enc) {
+		warning("gst_video: encoder '%s' not found\n", encoder_name);
+		return ENOENT;
+	}
+
+	snprintf(encoder, sizeof(encoder), enc->fmt,
+		 enc->kbps ? st->encoder.bitrate / 1000 : st->encoder.bitrate,
+		 st->encoder.fps * KEYFRAME_INTERVAL);
+
 	snprintf(pipeline, sizeof(pipeline),
-	 "appsrc name=source is-live=TRUE block=TRUE "
-	 "do-timestamp=TRUE max-bytes=1000000 ! "
-	 "videoparse width=%d height=%d format=i420 framerate=%d/1 ! "
-	 "x264enc byte-stream=TRUE rc-lookahead=0 "
-	 "sync-lookahead=0 bitrate=%d ! "
-	 "appsink name=sink emit-signals=TRUE drop=TRUE",
-	 size->w, size->h,
-	 st->encoder.fps, st->encoder.bitrate / 1000 /* kbit/s */);
+	 "appsrc name=source is-live=TRUE block=TRUE format=time "
+	 "do-timestamp=TRUE max-bytes=1000000 "
+	 "caps=\"video/x-raw,format=I420,width=%d,height=%d,"
+	 "framerate=%d/1\" ! "
+	 "%s ! "
+	 "h264parse config-interval=-1 ! "
+	 "video/x-h264,stream-format=byte-stream,alignment=au ! "
+	 "appsink name=sink emit-signals=TRUE drop=TRUE sync=FALSE",
+	 size->w, size->h, st->encoder.fps, encoder);
 
 	/* Initialize pipeline. */
 	st->streamer.pipeline = gst_parse_launch(pipeline, &gerror);
@@ -278,6 +389,10 @@ static int pipeline_init(struct videnc_state *st, const struct vidsz *size)
 	}
 
 	st->streamer.source = source;
+	st->streamer.enc    = enc;
+
+	info("gst_video: %ux%u encoded by %s\n", size->w, size->h,
+	     enc->name);
 
 	/* Mark pipeline as working */
 	st->streamer.valid = true;
@@ -322,6 +437,9 @@ static void destruct_resources(void *data)
 
 	pthread_mutex_destroy(&st->streamer.wait.mutex);
 	pthread_cond_destroy(&st->streamer.wait.cond);
+
+	pthread_mutex_destroy(&st->streamer.frame.mutex);
+	pthread_cond_destroy(&st->streamer.frame.cond);
 }
 
 
@@ -342,6 +460,8 @@ static int allocate_resources(struct videnc_state **stp)
 	pthread_mutex_init(&st->streamer.wait.mutex, NULL);
 	pthread_cond_init(&st->streamer.wait.cond, NULL);
 
+	pthread_mutex_init(&st->streamer.frame.mutex, NULL);
+	pthread_cond_init(&st->streamer.frame.cond, NULL);
 
 	/* Set appsource callbacks. */
 	st->streamer.appsrcCallbacks.need_data = &appsrc_need_data_cb;
@@ -453,16 +573,53 @@ int gst_video1_encoder_set(struct videnc_state **stp,
 }
 
 
+static void frame_release_cb(gpointer data)
+{
+	struct videnc_state *st = data;
+
+	pthread_mutex_lock(&st->streamer.frame.mutex);
+	if (st->streamer.frame.refs && !--st->streamer.frame.refs)
+		pthread_cond_signal(&st->streamer.frame.cond);
+	pthread_mutex_unlock(&st->streamer.frame.mutex);
+}
+
+
+/* Wait until the pipeline has released all planes of the frame */
+static bool frame_wait(struct videnc_state *st)
+{
+	struct timespec ts;
+	int err = 0;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec  += RELEASE_TIMEOUT / 1000;
+	ts.tv_nsec += (RELEASE_TIMEOUT % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec  += 1;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&st->streamer.frame.mutex);
+	while (st->streamer.frame.refs && !err) {
+		err = pthread_cond_timedwait(&st->streamer.frame.cond,
+					     &st->streamer.frame.mutex, &ts);
+	}
+	pthread_mutex_unlock(&st->streamer.frame.mutex);
+
+	return err == 0;
+}
+
+
 /*
  * couple gstreamer tightly by lock-stepping
  */
 static int pipeline_push(struct videnc_state *st, const struct vidframe *frame)
 {
+	gsize offset[GST_VIDEO_MAX_PLANES];
+	gint stride[GST_VIDEO_MAX_PLANES];
 	GstBuffer *buffer;
-	uint8_t *data;
-	size_t size;
+	size_t size = 0;
 	GstFlowReturn ret;
-	int err = 0;
+	int i, err = 0;
 
 #if 1
 	/* XXX: should not block the function here */
@@ -484,37 +641,33 @@ static int pipeline_push(struct videnc_state *st, const struct vidframe *frame)
 #endif
 
 	/*
-	 * Copy frame into buffer for gstreamer
+	 * Wrap the planes of the frame in a buffer for gstreamer
 	 */
 
 	/* NOTE: I420 (YUV420P): hardcoded. */
-	size = frame->linesize[0] * frame->size.h
-		+ frame->linesize[1] * frame->size.h * 0.5
-		+ frame->linesize[2] * frame->size.h * 0.5;
-
-	/* allocate memory; memory is freed within callback of
-	   gst_memory_new_wrapped of gst_video_push */
-	data = g_try_malloc(size);
-	if (!data)
-		return ENOMEM;
-
-	/* copy content of frame */
-	size = 0;
-	memcpy(&data[size], frame->data[0],
-	       frame->linesize[0] * frame->size.h);
-	size += frame->linesize[0] * frame->size.h;
-	memcpy(&data[size], frame->data[1],
-	       frame->linesize[1] * frame->size.h * 0.5);
-	size += frame->linesize[1] * frame->size.h * 0.5;
-	memcpy(&data[size], frame->data[2],
-	       frame->linesize[2] * frame->size.h * 0.5);
-	size += frame->linesize[2] * frame->size.h * 0.5;
-
-	/* Wrap memory in a gstreamer buffer */
 	buffer = gst_buffer_new();
-	gst_buffer_insert_memory(buffer, -1,
-				 gst_memory_new_wrapped (0, data, size, 0,
-							 size, data, g_free));
+
+	st->streamer.frame.refs = 3;
+
+	for (i=0; i<3; i++) {
+
+		const unsigned h = i ? (frame->size.h + 1) / 2 : frame->size.h;
+		const size_t sz = (size_t)frame->linesize[i] * h;
+
+		offset[i] = size;
+		stride[i] = frame->linesize[i];
+		size += sz;
+
+		gst_buffer_append_memory(buffer,
+			 gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY,
+						frame->data[i], sz, 0, sz,
+						st, frame_release_cb));
+	}
+
+	gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE,
+				       GST_VIDEO_FORMAT_I420,
+				       frame->size.w, frame->size.h,
+				       3, offset, stride);
 
 	/*
 	 * Push data and EOS into gstreamer.
@@ -524,9 +677,19 @@ static int pipeline_push(struct videnc_state *st, const struct vidframe *frame)
 	if (ret != GST_FLOW_OK) {
 		warning("gst_video: pushing buffer failed\n");
 		err = EPROTO;
-		goto out;
 	}
 
+	/* the frame is only valid until we return */
+	if (!frame_wait(st)) {
+		warning("gst_video: %s holds the frame, restarting\n",
+			st->streamer.enc->name);
+		pipeline_close(st);
+		err = ETIMEDOUT;
+	}
+
+	if (err)
+		goto out;
+
 #if 0
 	ret = gst_app_src_end_of_stream(st->streamer.source);
 	if (ret != GST_FLOW_OK) {
@@ -583,14 +746,18 @@ int gst_video1_encode(struct videnc_state *st, bool update,
 		st->encoder.size = frame->size;
 	}
 
+	/* sent upstream from the sink, up to the encoder */
 	if (update) {
-		debug("gst_video: gstreamer picture update"
-		      ", it's not implemented...\n");
+		debug("gst_video: gstreamer picture update\n");
+
+		gst_element_send_event(st->streamer.pipeline,
+			       gst_video_event_new_upstream_force_key_unit(
+				       GST_CLOCK_TIME_NONE, TRUE, 0));
 	}
 
 	/*
 	 * Push frame into pipeline.
-	 * Function call will return once frame has been processed completely.
+	 * Function call will return once the frame has been released.
 	 */
 	err = pipeline_push(st, frame);
 
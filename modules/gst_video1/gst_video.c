@@ -21,11 +21,40 @@
  * if needed. No decoding is done by this module, so that must be done by
  * another video-codec module.
  *
+ * A hardware encoder is used if one is installed, or it can be chosen:
+ \verbatim
+  gst_video_encoder    auto    # {auto,vaapih264enc,v4l2h264enc,
+                               #  omxh264enc,x264enc}
+ \endverbatim
+ *
+ * GStreamer is initialised when the first encoder is set up, so that
+ * the plugin registry is not loaded if no video call is made.
+ *
  * Thanks to Victor Sergienko and Fadeev Alexander for the
  * initial version, which was based on avcodec module.
  */
 
 
+static bool initialised;
+
+
+static int gst_video1_init(void)
+{
+	GError *gerr = NULL;
+
+	if (!gst_init_check(NULL, NULL, &gerr)) {
+		warning("gst_video: init: %s\n",
+			gerr ? gerr->message : "failed");
+		g_clear_error(&gerr);
+		return ENODEV;
+	}
+
+	initialised = true;
+
+	return 0;
+}
+
+
 static struct vidcodec h264 = {
 	.name      = "H264",
 	.variant   = "packetization-mode=0",
@@ -33,12 +62,17 @@ static struct vidcodec h264 = {
 	.ench      = gst_video1_encode,
 	.fmtp_ench = gst_video1_fmtp_enc,
 	.fmtp_cmph = gst_video1_fmtp_cmp,
+	.inith     = gst_video1_init,
 };
 
 
 static int module_init(void)
 {
-	gst_init(NULL, NULL);
+	char encoder[64] = "";
+
+	(void)conf_get_str(conf_cur(), "gst_video_encoder",
+			   encoder, sizeof(encoder));
+	gst_video1_encoder_conf(encoder);
 
 	vidcodec_register(&h264);
 
@@ -52,7 +86,10 @@ static int module_close(void)
 {
 	vidcodec_unregister(&h264);
 
-	gst_deinit();
+	if (initialised) {
+		gst_deinit();
+		initialised = false;
+	}
 
 	return 0;
 }
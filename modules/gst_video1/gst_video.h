@@ -9,6 +9,8 @@
 /* Encode */
 struct videnc_state;
 
+void gst_video1_encoder_conf(const char *name);
+
 int gst_video1_encoder_set(struct videnc_state **stp,
 			  const struct vidcodec *vc,
 			  struct videnc_param *prm, const char *fmtp,
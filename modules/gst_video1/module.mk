@@ -6,8 +6,9 @@
 
 MOD		:= gst_video1
 $(MOD)_SRCS	+= gst_video.c encode.c sdp.c
-$(MOD)_LFLAGS	+= $(shell pkg-config --libs gstreamer-1.0 gstreamer-app-1.0)
-$(MOD)_CFLAGS   += $(shell pkg-config --cflags gstreamer-1.0 gstreamer-app-1.0)
+GST_PKGS	:= gstreamer-1.0 gstreamer-app-1.0 gstreamer-video-1.0
+$(MOD)_LFLAGS	+= $(shell pkg-config --libs $(GST_PKGS))
+$(MOD)_CFLAGS   += $(shell pkg-config --cflags $(GST_PKGS))
 $(MOD)_CFLAGS	+= -Wno-cast-align
 
 include mk/mod.mk
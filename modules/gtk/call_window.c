@@ -25,15 +25,17 @@ struct call_window {
 	GtkWidget *window;
 	GtkLabel *status;
 	GtkLabel *duration;
+	GtkLabel *stats;
 	struct {
 		GtkWidget *hangup, *transfer, *hold, *mute;
 	} buttons;
 	struct {
 		GtkProgressBar *enc, *dec;
 	} progress;
-	guint duration_timer_tag;
 	guint vumeter_timer_tag;
+	bool timing;
 	bool closed;
+	bool destroyed;
 	int cur_key;
 };
 
@@ -50,11 +52,11 @@ static struct vumeter_dec *last_dec = NULL;
 static struct vumeter_enc *last_enc = NULL;
 
 
-static void call_window_update_duration(struct call_window *win)
+static void call_window_update_duration(struct call_window *win,
+					uint32_t dur)
 {
 	gchar buf[32];
 
-	const uint32_t dur = call_duration(win->call);
 	const uint32_t sec = dur%60%60;
 	const uint32_t min = dur/60%60;
 	const uint32_t hrs = dur/60/60;
@@ -79,14 +81,6 @@ static void call_window_update_vumeters(struct call_window *win)
 }
 
 
-static gboolean call_timer(gpointer arg)
-{
-	struct call_window *win = arg;
-	call_window_update_duration(win);
-	return G_SOURCE_CONTINUE;
-}
-
-
 static gboolean vumeter_timer(gpointer arg)
 {
 	struct call_window *win = arg;
@@ -118,12 +112,16 @@ static void vumeter_timer_stop(struct call_window *win)
 }
 
 
+/*
+ * The vumeters are referenced in the main thread, and the window takes
+ * that reference. They are released from the main thread as well.
+ */
+
 static void call_window_set_vu_dec(struct call_window *win,
 				   struct vumeter_dec *dec)
 {
-	if (win->vu.dec)
-		mem_deref(win->vu.dec);
-	win->vu.dec = mem_ref(dec);
+	gtk_mod_release(win->mod, win->vu.dec);
+	win->vu.dec = dec;
 	vumeter_timer_start(win);
 }
 
@@ -131,40 +129,51 @@ static void call_window_set_vu_dec(struct call_window *win,
 static void call_window_set_vu_enc(struct call_window *win,
 				   struct vumeter_enc *enc)
 {
-	if (win->vu.enc)
-		mem_deref(win->vu.enc);
-	win->vu.enc = mem_ref(enc);
+	gtk_mod_release(win->mod, win->vu.enc);
+	win->vu.enc = enc;
 	vumeter_timer_start(win);
 }
 
 
 /* This is a hack to associate a call with its vumeters */
 
-void call_window_got_vu_dec(struct vumeter_dec *dec)
+void call_window_got_vu_dec(struct gtk_mod *mod, struct vumeter_dec *dec)
 {
-	if (last_call_win)
+	if (last_call_win) {
 		call_window_set_vu_dec(last_call_win, dec);
-	else
+	}
+	else {
+		gtk_mod_release(mod, last_dec);
 		last_dec = dec;
+	}
 }
 
 
-void call_window_got_vu_enc(struct vumeter_enc *enc)
+void call_window_got_vu_enc(struct gtk_mod *mod, struct vumeter_enc *enc)
 {
-	if (last_call_win)
+	if (last_call_win) {
 		call_window_set_vu_enc(last_call_win, enc);
-	else
+	}
+	else {
+		gtk_mod_release(mod, last_enc);
 		last_enc = enc;
+	}
 }
 
 
 static void got_call_window(struct call_window *win)
 {
-	if (last_enc)
+	bool both = last_enc && last_dec;
+
+	if (last_enc) {
 		call_window_set_vu_enc(win, last_enc);
-	if (last_dec)
+		last_enc = NULL;
+	}
+	if (last_dec) {
 		call_window_set_vu_dec(win, last_dec);
-	if (!last_enc || !last_dec)
+		last_dec = NULL;
+	}
+	if (!both)
 		last_call_win = win;
 }
 
@@ -272,7 +281,12 @@ static void mqueue_handler(int id, void *data, void *arg)
 			ua_hangup(uag_current(), win->call, 0, NULL);
 			win->closed = true;
 		}
-		mem_deref(win);
+		if (!win->destroyed) {
+			/* the widgets are destroyed in the GTK+ thread */
+			win->destroyed = true;
+			gtk_mod_window_close(win->mod, win);
+			mem_deref(win);
+		}
 		break;
 
 	case MQ_MUTE:
@@ -290,42 +304,50 @@ static void mqueue_handler(int id, void *data, void *arg)
 }
 
 
+/* Called in the main thread, after call_window_destroy() */
 static void call_window_destructor(void *arg)
 {
 	struct call_window *window = arg;
 
-	gdk_threads_enter();
-	gtk_mod_call_window_closed(window->mod, window);
-	gtk_widget_destroy(window->window);
-	mem_deref(window->transfer_dialog);
-	gdk_threads_leave();
-
 	mem_deref(window->call);
 	mem_deref(window->mq);
 	mem_deref(window->vu.enc);
 	mem_deref(window->vu.dec);
-	if (window->duration_timer_tag)
-		g_source_remove(window->duration_timer_tag);
-	if (window->vumeter_timer_tag)
-		g_source_remove(window->vumeter_timer_tag);
-	/* TODO: avoid race conditions here */
-	last_call_win = NULL;
 }
 
 
+/* Called in the GTK+ thread */
+void call_window_destroy(struct call_window *win)
+{
+	if (!win)
+		return;
+
+	gtk_mod_call_window_closed(win->mod, win);
+	gtk_widget_destroy(win->window);
+	win->transfer_dialog = mem_deref(win->transfer_dialog);
+	if (win->vumeter_timer_tag) {
+		g_source_remove(win->vumeter_timer_tag);
+		win->vumeter_timer_tag = 0;
+	}
+	if (last_call_win == win)
+		last_call_win = NULL;
+}
+
+
+/* The call is referenced by the caller, and the window takes it */
 struct call_window *call_window_new(struct call *call, struct gtk_mod *mod)
 {
 	struct call_window *win;
 	GtkWidget *window, *label, *status, *button, *progress, *image;
 	GtkWidget *button_box, *vbox, *hbox;
-	GtkWidget *duration;
+	GtkWidget *duration, *stats;
 	int err = 0;
 
 	win = mem_zalloc(sizeof(*win), call_window_destructor);
 	if (!win)
 		return NULL;
 
-	mqueue_alloc(&win->mq, mqueue_handler, win);
+	err = mqueue_alloc(&win->mq, mqueue_handler, win);
 	if (err)
 		goto out;
 
@@ -348,6 +370,10 @@ struct call_window *call_window_new(struct call *call, struct gtk_mod *mod)
 	duration = gtk_label_new(NULL);
 	gtk_box_pack_start(GTK_BOX(vbox), duration, FALSE, FALSE, 0);
 
+	/* Statistics */
+	stats = gtk_label_new(NULL);
+	gtk_box_pack_start(GTK_BOX(vbox), stats, FALSE, FALSE, 0);
+
 	/* Status */
 	status = gtk_label_new(NULL);
 	gtk_box_pack_start(GTK_BOX(vbox), status, FALSE, FALSE, 0);
@@ -430,14 +456,15 @@ struct call_window *call_window_new(struct call *call, struct gtk_mod *mod)
 	g_signal_connect(window, "key-release-event",
 			G_CALLBACK(call_on_key_release), win);
 
-	win->call = mem_ref(call);
+	win->call = call;
 	win->mod = mod;
 	win->window = window;
 	win->transfer_dialog = NULL;
 	win->status = GTK_LABEL(status);
 	win->duration = GTK_LABEL(duration);
+	win->stats = GTK_LABEL(stats);
 	win->closed = false;
-	win->duration_timer_tag = 0;
+	win->timing = false;
 	win->vumeter_timer_tag = 0;
 	win->vu.enc = NULL;
 	win->vu.dec = NULL;
@@ -446,7 +473,7 @@ struct call_window *call_window_new(struct call *call, struct gtk_mod *mod)
 
 out:
 	if (err)
-		mem_deref(win);
+		win = mem_deref(win);
 
 	return win;
 }
@@ -464,10 +491,7 @@ void call_window_closed(struct call_window *win, const char *reason)
 	const char *status;
 
 	vumeter_timer_stop(win);
-	if (win->duration_timer_tag) {
-		g_source_remove(win->duration_timer_tag);
-		win->duration_timer_tag = 0;
-	}
+	win->timing = false;
 	gtk_widget_set_sensitive(win->buttons.transfer, FALSE);
 	gtk_widget_set_sensitive(win->buttons.hold, FALSE);
 	gtk_widget_set_sensitive(win->buttons.mute, FALSE);
@@ -493,7 +517,7 @@ void call_window_ringing(struct call_window *win)
 
 void call_window_progress(struct call_window *win)
 {
-	win->duration_timer_tag = g_timeout_add_seconds(1, call_timer, win);
+	win->timing = true;
 	last_call_win = win;
 	call_window_set_status(win, "progress");
 }
@@ -501,13 +525,34 @@ void call_window_progress(struct call_window *win)
 
 void call_window_established(struct call_window *win)
 {
-	call_window_update_duration(win);
-	win->duration_timer_tag = g_timeout_add_seconds(1, call_timer, win);
+	win->timing = true;
 	last_call_win = win;
 	call_window_set_status(win, "established");
 }
 
 
+void call_window_stats(struct call_window *win, const struct call_stats *st)
+{
+	gchar buf[64];
+
+	if (!win->timing)
+		return;
+
+	call_window_update_duration(win, st->duration);
+
+	if (st->mos > 0) {
+		re_snprintf(buf, sizeof buf, "%u/%u kbit/s  MOS %.1f",
+			    st->tx_bitrate / 1000, st->rx_bitrate / 1000,
+			    st->mos);
+	}
+	else {
+		re_snprintf(buf, sizeof buf, "%u/%u kbit/s",
+			    st->tx_bitrate / 1000, st->rx_bitrate / 1000);
+	}
+	gtk_label_set_text(win->stats, buf);
+}
+
+
 void call_window_transfer_failed(struct call_window *win, const char *reason)
 {
 	if (win->transfer_dialog) {
@@ -33,8 +33,20 @@
  *
  * Creates a tray icon with a menu for making calls.
  *
+ * The GTK+ widgets are only touched from the GTK+ thread. Events and
+ * statistics from the main thread are put in a queue of updates, where
+ * updates of the same kind replace each other, and the queue is drained
+ * from the GTK+ main loop at most gtk_update_rate times per second.
+ *
+ * Example config:
+ \verbatim
+  gtk_update_rate         10       # max. updates of the GUI per second
+ \endverbatim
  */
 
+#define UPDATE_RATE 10
+#define STATS_INTERVAL 1000  /* [ms] */
+
 struct gtk_mod {
 	pthread_t thread;
 	bool run;
@@ -51,22 +63,59 @@ struct gtk_mod {
 	struct dial_dialog *dial_dialog;
 	GSList *call_windows;
 	GSList *incoming_call_menus;
+
+	/* updates from the main thread, protected by upd_lock */
+	pthread_mutex_t upd_lock;
+	struct list updl;
+	bool upd_sched;
+	uint64_t upd_next;        /* earliest time of the next drain [ms] */
+	uint32_t upd_interval;    /* [ms] */
+	struct tmr tmr_stats;
 };
 
 static struct gtk_mod mod_obj;
 
 enum gtk_mod_events {
-	MQ_POPUP,
 	MQ_CONNECT,
 	MQ_QUIT,
 	MQ_ANSWER,
 	MQ_HANGUP,
 	MQ_SELECT_UA,
+	MQ_RELEASE,
+};
+
+enum gtk_update_type {
+	UPD_EVENT,     /* UA event                  */
+	UPD_CALL,      /* Window of a new call      */
+	UPD_CLOSE,     /* Destroy a call window     */
+	UPD_VU_ENC,    /* Encoding vumeter          */
+	UPD_VU_DEC,    /* Decoding vumeter          */
+	UPD_STATS,     /* Call statistics           */
+	UPD_WARNING,   /* Warning dialog            */
+	UPD_POPUP,     /* Pop up the menu           */
+};
+
+/*
+ * An update of the GUI. The objects are referenced in the main thread,
+ * and released there again after the update was drawn.
+ */
+struct gtk_update {
+	struct le le;
+	enum gtk_update_type type;
+	enum ua_event ev;
+	struct ua *ua;
+	struct call *call;
+	void *obj;
+	char *prm;
+	struct call_stats stats;
 };
 
 static void answer_activated(GSimpleAction *, GVariant *, gpointer);
 static void reject_activated(GSimpleAction *, GVariant *, gpointer);
 static void denotify_incoming_call(struct gtk_mod *, struct call *);
+static void popup_menu(struct gtk_mod *, GtkMenuPositionFunc, gpointer,
+		       guint, guint32);
+static void warning_dialog(const char *title, const char *fmt, ...);
 
 static GActionEntry app_entries[] = {
 	{"answer", answer_activated, "x", NULL, NULL, {0} },
@@ -429,11 +478,12 @@ static void reject_activated(GSimpleAction *action, GVariant *parameter,
 }
 
 
+/* The window takes the reference of the call */
 static struct call_window *new_call_window(struct gtk_mod *mod,
 		struct call *call)
 {
 	struct call_window *win = call_window_new(call, mod);
-	if (call) {
+	if (win) {
 		mod->call_windows = g_slist_append(mod->call_windows, win);
 	}
 	return win;
@@ -455,11 +505,14 @@ static struct call_window *get_call_window(struct gtk_mod *mod,
 
 
 static struct call_window *get_create_call_window(struct gtk_mod *mod,
-		struct call *call)
+		struct gtk_update *u)
 {
-	struct call_window *win = get_call_window(mod, call);
-	if (!win)
-		win = new_call_window(mod, call);
+	struct call_window *win = get_call_window(mod, u->call);
+	if (!win) {
+		win = new_call_window(mod, u->call);
+		if (win)
+			u->call = NULL;
+	}
 	return win;
 }
 
@@ -472,67 +525,348 @@ void gtk_mod_call_window_closed(struct gtk_mod *mod, struct call_window *win)
 }
 
 
-static void ua_event_handler(struct ua *ua,
-		enum ua_event ev,
-		struct call *call,
-		const char *prm,
-		void *arg )
+static void update_destructor(void *arg)
+{
+	struct gtk_update *u = arg;
+
+	mem_deref(u->call);
+	mem_deref(u->obj);
+	mem_deref(u->prm);
+}
+
+
+static struct gtk_update *update_alloc(enum gtk_update_type type,
+				       struct call *call, void *obj,
+				       const char *prm)
+{
+	struct gtk_update *u;
+
+	u = mem_zalloc(sizeof(*u), update_destructor);
+	if (!u)
+		return NULL;
+
+	u->type = type;
+	u->call = mem_ref(call);
+	u->obj  = mem_ref(obj);
+
+	if (prm && str_dup(&u->prm, prm))
+		return mem_deref(u);
+
+	return u;
+}
+
+
+static bool is_reg_event(enum ua_event ev)
+{
+	return ev == UA_EVENT_REGISTERING || ev == UA_EVENT_REGISTER_OK ||
+		ev == UA_EVENT_REGISTER_FAIL || ev == UA_EVENT_UNREGISTERING;
+}
+
+
+static bool is_state_event(enum ua_event ev)
+{
+	return ev == UA_EVENT_CALL_RINGING || ev == UA_EVENT_CALL_PROGRESS ||
+		ev == UA_EVENT_CALL_ESTABLISHED;
+}
+
+
+/* Let a pending update take the state of a newer one of the same kind */
+static bool update_merge(struct gtk_update *old, const struct gtk_update *u)
+{
+	if (old->type != u->type)
+		return false;
+
+	switch (u->type) {
+
+	case UPD_EVENT:
+		if (is_reg_event(old->ev) && is_reg_event(u->ev) &&
+		    old->ua == u->ua) {
+			old->ev = u->ev;
+			return true;
+		}
+		if (is_state_event(old->ev) && is_state_event(u->ev) &&
+		    old->call == u->call) {
+			old->ev = u->ev;
+			return true;
+		}
+		return false;
+
+	case UPD_STATS:
+		if (old->call != u->call)
+			return false;
+		old->stats = u->stats;
+		return true;
+
+	case UPD_POPUP:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+
+static void update_apply(struct gtk_mod *mod, struct gtk_update *u)
 {
-	struct gtk_mod *mod = arg;
 	struct call_window *win;
 
-	gdk_threads_enter();
+	switch (u->type) {
 
-	switch (ev) {
+	case UPD_EVENT:
+		break;
+
+	case UPD_CALL:
+		if (!new_call_window(mod, u->call))
+			mqueue_push(mod->mq, MQ_HANGUP, u->call);
+		else
+			u->call = NULL;
+		return;
+
+	case UPD_CLOSE:
+		call_window_destroy(u->obj);
+		return;
+
+	case UPD_VU_ENC:
+		call_window_got_vu_enc(mod, u->obj);
+		u->obj = NULL;
+		return;
+
+	case UPD_VU_DEC:
+		call_window_got_vu_dec(mod, u->obj);
+		u->obj = NULL;
+		return;
+
+	case UPD_STATS:
+		win = get_call_window(mod, u->call);
+		if (win)
+			call_window_stats(win, &u->stats);
+		return;
+
+	case UPD_WARNING:
+		warning_dialog("Call failed", "%s", u->prm);
+		return;
+
+	case UPD_POPUP:
+		popup_menu(mod, NULL, NULL, 0, GDK_CURRENT_TIME);
+		return;
+	}
+
+	switch (u->ev) {
 
 	case UA_EVENT_REGISTERING:
 	case UA_EVENT_UNREGISTERING:
 	case UA_EVENT_REGISTER_OK:
 	case UA_EVENT_REGISTER_FAIL:
-		accounts_menu_set_status(mod, ua, ev);
+		accounts_menu_set_status(mod, u->ua, u->ev);
 		break;
 
 	case UA_EVENT_CALL_INCOMING:
-		notify_incoming_call(mod, call);
+		notify_incoming_call(mod, u->call);
 		break;
 
 	case UA_EVENT_CALL_CLOSED:
-		win = get_call_window(mod, call);
+		win = get_call_window(mod, u->call);
 		if (win)
-			call_window_closed(win, prm);
+			call_window_closed(win, u->prm);
 		else
-			denotify_incoming_call(mod, call);
+			denotify_incoming_call(mod, u->call);
 		break;
 
 	case UA_EVENT_CALL_RINGING:
-		win = get_create_call_window(mod, call);
+		win = get_create_call_window(mod, u);
 		if (win)
 			call_window_ringing(win);
 		break;
 
 	case UA_EVENT_CALL_PROGRESS:
-		win = get_create_call_window(mod, call);
+		win = get_create_call_window(mod, u);
 		if (win)
 			call_window_progress(win);
 		break;
 
 	case UA_EVENT_CALL_ESTABLISHED:
-		win = get_create_call_window(mod, call);
+		win = get_create_call_window(mod, u);
 		if (win)
 			call_window_established(win);
 		break;
 
 	case UA_EVENT_CALL_TRANSFER_FAILED:
-		win = get_create_call_window(mod, call);
+		win = get_create_call_window(mod, u);
 		if (win)
-			call_window_transfer_failed(win, prm);
+			call_window_transfer_failed(win, u->prm);
 		break;
 
 	default:
 		break;
 	}
+}
+
+
+/* Called from the GTK+ main loop, with the GDK lock held */
+static gboolean update_drain(gpointer arg)
+{
+	struct gtk_mod *mod = arg;
+	struct list updl = LIST_INIT;
+	struct le *le;
+
+	pthread_mutex_lock(&mod->upd_lock);
+
+	while ((le = list_head(&mod->updl))) {
+		list_unlink(le);
+		list_append(&updl, le, le->data);
+	}
+
+	mod->upd_sched = false;
+	mod->upd_next  = tmr_jiffies() + mod->upd_interval;
+
+	pthread_mutex_unlock(&mod->upd_lock);
+
+	while ((le = list_head(&updl))) {
+		struct gtk_update *u = le->data;
+
+		list_unlink(le);
+		update_apply(mod, u);
+		gtk_mod_release(mod, u);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+
+/* Queue an update from the main thread, and take the reference of it */
+static void update_post(struct gtk_mod *mod, struct gtk_update *u)
+{
+	struct le *le;
+	bool merged = false;
+
+	if (!u)
+		return;
+
+	pthread_mutex_lock(&mod->upd_lock);
+
+	for (le = list_head(&mod->updl); le; le = le->next) {
+
+		if (update_merge(le->data, u)) {
+			merged = true;
+			break;
+		}
+	}
+
+	if (!merged)
+		list_append(&mod->updl, &u->le, u);
+
+	if (!mod->upd_sched) {
+		uint64_t now = tmr_jiffies();
+		guint delay = 0;
+
+		if (mod->upd_next > now)
+			delay = (guint)(mod->upd_next - now);
+
+		gdk_threads_add_timeout(delay, update_drain, mod);
+		mod->upd_sched = true;
+	}
+
+	pthread_mutex_unlock(&mod->upd_lock);
+
+	if (merged)
+		mem_deref(u);
+}
+
+
+void gtk_mod_window_close(struct gtk_mod *mod, struct call_window *win)
+{
+	if (!mod)
+		return;
+
+	update_post(mod, update_alloc(UPD_CLOSE, NULL, win, NULL));
+}
+
+
+/* Release an object of the main thread from the GTK+ thread */
+void gtk_mod_release(struct gtk_mod *mod, void *obj)
+{
+	if (!mod || !obj)
+		return;
+
+	if (mqueue_push(mod->mq, MQ_RELEASE, obj))
+		warning("gtk: could not release %p\n", obj);
+}
+
+
+static void ua_event_handler(struct ua *ua,
+		enum ua_event ev,
+		struct call *call,
+		const char *prm,
+		void *arg )
+{
+	struct gtk_mod *mod = arg;
+	struct gtk_update *u;
+
+	switch (ev) {
+
+	case UA_EVENT_REGISTERING:
+	case UA_EVENT_UNREGISTERING:
+	case UA_EVENT_REGISTER_OK:
+	case UA_EVENT_REGISTER_FAIL:
+	case UA_EVENT_CALL_INCOMING:
+	case UA_EVENT_CALL_CLOSED:
+	case UA_EVENT_CALL_RINGING:
+	case UA_EVENT_CALL_PROGRESS:
+	case UA_EVENT_CALL_ESTABLISHED:
+	case UA_EVENT_CALL_TRANSFER_FAILED:
+		break;
+
+	default:
+		return;
+	}
+
+	u = update_alloc(UPD_EVENT, call, NULL, prm);
+	if (!u)
+		return;
+
+	u->ev = ev;
+	u->ua = ua;
+
+	update_post(mod, u);
+}
+
+
+/* Snapshot of the statistics of all calls, drawn in the GTK+ thread */
+static void stats_handler(void *arg)
+{
+	struct gtk_mod *mod = arg;
+	struct le *le, *lec;
+
+	tmr_start(&mod->tmr_stats, STATS_INTERVAL, stats_handler, mod);
+
+	for (le = list_head(uag_list()); le; le = le->next) {
+
+		for (lec = list_head(ua_calls(le->data)); lec;
+		     lec = lec->next) {
 
-	gdk_threads_leave();
+			struct call *call = lec->data;
+			struct stream *strm = audio_strm(call_audio(call));
+			struct stream_stat tx, rx;
+			struct stream_quality q;
+			struct gtk_update *u;
+
+			u = update_alloc(UPD_STATS, call, NULL, NULL);
+			if (!u)
+				return;
+
+			u->stats.duration = call_duration(call);
+
+			if (!stream_stats(strm, &tx, &rx)) {
+				u->stats.tx_bitrate = tx.bitrate;
+				u->stats.rx_bitrate = rx.bitrate;
+			}
+
+			if (!stream_quality(strm, &q))
+				u->stats.mos = q.mos;
+
+			update_post(mod, u);
+		}
+	}
 }
 
 
@@ -644,35 +978,24 @@ static void mqueue_handler(int id, void *data, void *arg)
 	struct gtk_mod *mod = arg;
 	const char *uri;
 	struct call *call;
+	char msg[512];
 	int err;
 	struct ua *ua = uag_current();
-	(void)mod;
 
 	switch ((enum gtk_mod_events)id) {
 
-	case MQ_POPUP:
-		gdk_threads_enter();
-		popup_menu(mod, NULL, NULL, 0, GPOINTER_TO_UINT(data));
-		gdk_threads_leave();
-		break;
-
 	case MQ_CONNECT:
 		uri = data;
 		err = ua_connect(ua, &call, NULL, uri, NULL, VIDMODE_ON);
 		if (err) {
-			gdk_threads_enter();
-			warning_dialog("Call failed",
-					"Connecting to \"%s\" failed.\n"
-					"Error: %m", uri, err);
-			gdk_threads_leave();
+			re_snprintf(msg, sizeof msg,
+				    "Connecting to \"%s\" failed.\n"
+				    "Error: %m", uri, err);
+			update_post(mod, update_alloc(UPD_WARNING, NULL, NULL,
+						      msg));
 			break;
 		}
-		gdk_threads_enter();
-		err = new_call_window(mod, call) == NULL;
-		gdk_threads_leave();
-		if (err) {
-			ua_hangup(ua, call, 500, "Server Error");
-		}
+		update_post(mod, update_alloc(UPD_CALL, call, NULL, NULL));
 		break;
 
 	case MQ_HANGUP:
@@ -688,28 +1011,26 @@ static void mqueue_handler(int id, void *data, void *arg)
 		call = data;
 		err = ua_answer(ua, call);
 		if (err) {
-			gdk_threads_enter();
-			warning_dialog("Call failed",
-					"Answering the call "
-					"from \"%s\" failed.\n"
-					"Error: %m",
-					call_peername(call), err);
-			gdk_threads_leave();
+			re_snprintf(msg, sizeof msg,
+				    "Answering the call "
+				    "from \"%s\" failed.\n"
+				    "Error: %m",
+				    call_peername(call), err);
+			update_post(mod, update_alloc(UPD_WARNING, NULL, NULL,
+						      msg));
 			break;
 		}
-
-		gdk_threads_enter();
-		err = new_call_window(mod, call) == NULL;
-		gdk_threads_leave();
-		if (err) {
-			ua_hangup(ua, call, 500, "Server Error");
-		}
+		update_post(mod, update_alloc(UPD_CALL, call, NULL, NULL));
 		break;
 
 	case MQ_SELECT_UA:
 		ua = data;
 		uag_current_set(ua);
 		break;
+
+	case MQ_RELEASE:
+		mem_deref(data);
+		break;
 	}
 }
 
@@ -895,9 +1216,7 @@ static int vu_encode_update(struct aufilt_enc_st **stp, void **ctx,
 	if (!st)
 		return ENOMEM;
 
-	gdk_threads_enter();
-	call_window_got_vu_enc(st);
-	gdk_threads_leave();
+	update_post(&mod_obj, update_alloc(UPD_VU_ENC, NULL, st, NULL));
 
 	*stp = (struct aufilt_enc_st *)st;
 
@@ -922,9 +1241,7 @@ static int vu_decode_update(struct aufilt_dec_st **stp, void **ctx,
 	if (!st)
 		return ENOMEM;
 
-	gdk_threads_enter();
-	call_window_got_vu_dec(st);
-	gdk_threads_leave();
+	update_post(&mod_obj, update_alloc(UPD_VU_DEC, NULL, st, NULL));
 
 	*stp = (struct aufilt_dec_st *)st;
 
@@ -966,7 +1283,7 @@ static int cmd_popup_menu(struct re_printf *pf, void *unused)
 	(void)pf;
 	(void)unused;
 
-	mqueue_push(mod_obj.mq, MQ_POPUP, GUINT_TO_POINTER(GDK_CURRENT_TIME));
+	update_post(&mod_obj, update_alloc(UPD_POPUP, NULL, NULL, NULL));
 
 	return 0;
 }
@@ -979,8 +1296,19 @@ static const struct cmd cmdv[] = {
 
 static int module_init(void)
 {
+	uint32_t rate = UPDATE_RATE;
 	int err = 0;
 
+	(void)conf_get_u32(conf_cur(), "gtk_update_rate", &rate);
+
+	mod_obj.upd_interval = 1000 / max(rate, 1);
+	list_init(&mod_obj.updl);
+	tmr_init(&mod_obj.tmr_stats);
+
+	err = pthread_mutex_init(&mod_obj.upd_lock, NULL);
+	if (err)
+		return err;
+
 	err = mqueue_alloc(&mod_obj.mq, mqueue_handler, &mod_obj);
 	if (err)
 		return err;
@@ -1002,6 +1330,9 @@ static int module_init(void)
 	if (err)
 		return err;
 
+	tmr_start(&mod_obj.tmr_stats, STATS_INTERVAL, stats_handler,
+		  &mod_obj);
+
 	return err;
 }
 
@@ -1009,12 +1340,15 @@ static int module_init(void)
 static int module_close(void)
 {
 	cmd_unregister(cmdv);
+	tmr_cancel(&mod_obj.tmr_stats);
 	if (mod_obj.run) {
 		gdk_threads_enter();
 		gtk_main_quit();
 		gdk_threads_leave();
 	}
 	pthread_join(mod_obj.thread, NULL);
+	list_flush(&mod_obj.updl);
+	pthread_mutex_destroy(&mod_obj.upd_lock);
 	mem_deref(mod_obj.mq);
 	aufilt_unregister(&vumeter);
 	message_close();
@@ -21,14 +21,26 @@ struct vumeter_dec {
 	volatile bool started;
 };
 
+/** Snapshot of the call statistics, taken in the main thread */
+struct call_stats {
+	uint32_t duration;        /**< Call duration in [s]             */
+	uint32_t tx_bitrate;      /**< Audio sent [bit/s]               */
+	uint32_t rx_bitrate;      /**< Audio received [bit/s]           */
+	double mos;               /**< MOS estimate, 0 if none          */
+};
+
 /* Main menu */
 void gtk_mod_connect(struct gtk_mod *, const char *uri);
 void gtk_mod_call_window_closed(struct gtk_mod *, struct call_window *);
+void gtk_mod_window_close(struct gtk_mod *, struct call_window *);
+void gtk_mod_release(struct gtk_mod *, void *obj);
 
 /* Call Window */
 struct call_window *call_window_new(struct call *call, struct gtk_mod *mod);
-void call_window_got_vu_dec(struct vumeter_dec *);
-void call_window_got_vu_enc(struct vumeter_enc *);
+void call_window_destroy(struct call_window *);
+void call_window_got_vu_dec(struct gtk_mod *, struct vumeter_dec *);
+void call_window_got_vu_enc(struct gtk_mod *, struct vumeter_enc *);
+void call_window_stats(struct call_window *, const struct call_stats *);
 void call_window_transfer(struct call_window *, const char *uri);
 void call_window_closed(struct call_window *, const char *reason);
 void call_window_ringing(struct call_window *);
@@ -119,6 +119,28 @@ int h265_decode_update(struct viddec_state **vdsp, const struct vidcodec *vc,
 }
 
 
+/**
+ * Reset a kept decoder, for a switch back to H.265. The pictures it
+ * holds and a partly received fragmented NAL unit are dropped.
+ *
+ * @param vds H.265 decoder state
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int h265_decode_reset(struct viddec_state *vds)
+{
+	if (!vds || !vds->ctx)
+		return EINVAL;
+
+	avcodec_flush_buffers(vds->ctx);
+
+	mbuf_rewind(vds->mb);
+	vds->frag = false;
+
+	return 0;
+}
+
+
 static inline int fu_decode(struct fu *fu, struct mbuf *mb)
 {
 	uint8_t v;
@@ -211,7 +233,7 @@ int h265_decode(struct viddec_state *vds, struct vidframe *frame,
 			hdr.nal_unit_type = fu.type;
 
 			err  = mbuf_write_mem(vds->mb, nal_seq, 3);
-			err = h265_nal_encode_mbuf(vds->mb, &hdr);
+			err |= h265_nal_encode_mbuf(vds->mb, &hdr);
 			if (err)
 				goto out;
 		}
@@ -238,6 +260,25 @@ int h265_decode(struct viddec_state *vds, struct vidframe *frame,
 
 		vds->frag_seq = seq;
 	}
+	else if (H265_NAL_AP == hdr.nal_unit_type) {
+
+		while (mbuf_get_left(mb) >= 2) {
+
+			const size_t len = ntohs(mbuf_read_u16(mb));
+
+			if (mbuf_get_left(mb) < len) {
+				err = EBADMSG;
+				goto out;
+			}
+
+			err  = mbuf_write_mem(vds->mb, nal_seq, 3);
+			err |= mbuf_write_mem(vds->mb, mbuf_buf(mb), len);
+			if (err)
+				goto out;
+
+			mbuf_advance(mb, len);
+		}
+	}
 	else {
 		warning("h265: unknown NAL type %u\n", hdr.nal_unit_type);
 		return ENOSYS;
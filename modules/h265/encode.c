@@ -12,6 +12,19 @@
 #include "h265.h"
 
 
+enum {
+	PKT_POOL_SIZE = 64,  /* packets queued in the core            */
+	AP_MAX_NALS   = 16,  /* NAL units in one Aggregation Packet   */
+};
+
+/* Pending Aggregation Packet (RFC 7798 section 4.4.2) */
+struct ap {
+	const uint8_t *nalv[AP_MAX_NALS];
+	size_t lenv[AP_MAX_NALS];
+	size_t len;          /* payload with PayloadHdr and sizes     */
+	unsigned n;
+};
+
 struct videnc_state {
 	struct vidsz size;
 	x265_param *param;
@@ -21,13 +34,22 @@ struct videnc_state {
 	unsigned bitrate;
 	unsigned pktsize;
 	videnc_packet_h *pkth;
+	videnc_packet_mb_h *pkth_mb;
 	void *arg;
+	struct mbuf *mb_ap;                 /* AP sent with a copy          */
+	struct mbuf *pktv[PKT_POOL_SIZE];   /* packets passed by reference */
 };
 
 
 static void destructor(void *arg)
 {
 	struct videnc_state *st = arg;
+	unsigned i;
+
+	for (i=0; i<PKT_POOL_SIZE; i++)
+		mem_deref(st->pktv[i]);
+
+	mem_deref(st->mb_ap);
 
 	if (st->x265)
 		x265_encoder_close(st->x265);
@@ -109,6 +131,7 @@ int h265_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 	ves->pktsize = prm->pktsize;
 	ves->fps     = prm->fps;
 	ves->pkth    = pkth;
+	ves->pkth_mb = prm->pkth_mb;
 	ves->arg     = arg;
 
 	err = set_params(ves, prm->fps, prm->bitrate);
@@ -139,42 +162,234 @@ static int open_encoder(struct videnc_state *st, const struct vidsz *size)
 }
 
 
-static inline int packetize(bool marker, const uint8_t *buf, size_t len,
-			    size_t maxlen, videnc_packet_h *pkth, void *arg)
+/* Hand a packet in a buffer with headroom over to the core */
+static int pkt_send_mb(struct videnc_state *st, bool marker,
+		       struct mbuf *mb)
+{
+	int err;
+
+	mb->pos = VIDENC_PRESZ;
+
+	err = st->pkth_mb(marker, mb, st->arg);
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
+static int pkt_send(struct videnc_state *st, bool marker,
+		    const uint8_t *hdr, size_t hdr_len,
+		    const uint8_t *pld, size_t pld_len)
+{
+	struct mbuf *mb;
+	int err;
+
+	if (st->pkth_mb)
+		mb = videnc_pkt_get(st->pktv, PKT_POOL_SIZE, st->pktsize);
+	else
+		mb = NULL;
+
+	/* copied if all pooled buffers are still queued in the core */
+	if (!mb)
+		return st->pkth(marker, hdr, hdr_len, pld, pld_len, st->arg);
+
+	err  = mbuf_write_mem(mb, hdr, hdr_len);
+	err |= mbuf_write_mem(mb, pld, pld_len);
+	if (err) {
+		mem_deref(mb);
+		return err;
+	}
+
+	return pkt_send_mb(st, marker, mb);
+}
+
+
+/* Send a NAL unit alone, or in Fragmentation Units if it is too big */
+static int nal_send(struct videnc_state *st, bool marker,
+		    const uint8_t *buf, size_t len)
+{
+	struct h265_nal nal;
+	uint8_t fu_hdr[3];
+	const size_t flen = st->pktsize - sizeof(fu_hdr);
+	int err;
+
+	if (len <= st->pktsize)
+		return pkt_send(st, marker, NULL, 0, buf, len);
+
+	err = h265_nal_decode(&nal, buf);
+	if (err)
+		return err;
+
+	h265_nal_encode(fu_hdr, H265_NAL_FU, nal.nuh_temporal_id_plus1);
+
+	fu_hdr[2] = 1<<7 | nal.nal_unit_type;
+
+	buf+=2;
+	len-=2;
+
+	while (len > flen) {
+		err |= pkt_send(st, false, fu_hdr, 3, buf, flen);
+
+		buf += flen;
+		len -= flen;
+		fu_hdr[2] &= ~(1 << 7); /* clear Start bit */
+	}
+
+	fu_hdr[2] |= 1<<6;  /* set END bit */
+
+	err |= pkt_send(st, marker, fu_hdr, 3, buf, len);
+
+	return err;
+}
+
+
+static int ap_flush(struct videnc_state *st, struct ap *ap, bool marker)
 {
+	struct mbuf *mb;
+	uint8_t f = 0, tid = 7;
+	bool pooled = false;
+	unsigned i;
 	int err = 0;
 
-	if (len <= maxlen) {
-		err = pkth(marker, NULL, 0, buf, len, arg);
+	if (ap->n == 0)
+		return 0;
+
+	if (ap->n == 1) {
+		err = nal_send(st, marker, ap->nalv[0], ap->lenv[0]);
+		goto out;
+	}
+
+	if (st->pkth_mb)
+		mb = videnc_pkt_get(st->pktv, PKT_POOL_SIZE, st->pktsize);
+	else
+		mb = NULL;
+
+	if (mb) {
+		pooled = true;
 	}
 	else {
-		struct h265_nal nal;
-		uint8_t fu_hdr[3];
-		const size_t flen = maxlen - sizeof(fu_hdr);
+		if (!st->mb_ap) {
+			st->mb_ap = mbuf_alloc(st->pktsize);
+			if (!st->mb_ap) {
+				err = ENOMEM;
+				goto out;
+			}
+		}
 
-		err = h265_nal_decode(&nal, buf);
+		mb = mem_ref(st->mb_ap);
+		mbuf_rewind(mb);
+	}
 
-		h265_nal_encode(fu_hdr, H265_NAL_FU,
-				nal.nuh_temporal_id_plus1);
+	/* F is set if any NAL unit has it, TID is the lowest one */
+	for (i=0; i<ap->n; i++) {
+		f  |= ap->nalv[i][0] & 0x80;
+		tid = min(tid, ap->nalv[i][1] & 0x07);
+	}
 
-		fu_hdr[2] = 1<<7 | nal.nal_unit_type;
+	err  = mbuf_write_u8(mb, f | H265_NAL_AP << 1);
+	err |= mbuf_write_u8(mb, tid);
 
-		buf+=2;
-		len-=2;
+	for (i=0; i<ap->n; i++) {
+		err |= mbuf_write_u16(mb, htons((uint16_t)ap->lenv[i]));
+		err |= mbuf_write_mem(mb, ap->nalv[i], ap->lenv[i]);
+	}
 
-		while (len > flen) {
-			err |= pkth(false, fu_hdr, 3, buf, flen, arg);
+	if (err) {
+		mem_deref(mb);
+		goto out;
+	}
 
-			buf += flen;
-			len -= flen;
-			fu_hdr[2] &= ~(1 << 7); /* clear Start bit */
-		}
+	if (pooled) {
+		err = pkt_send_mb(st, marker, mb);
+	}
+	else {
+		err = st->pkth(marker, NULL, 0, mb->buf, mb->end, st->arg);
+		mem_deref(mb);
+	}
+
+ out:
+	ap->len = 0;
+	ap->n   = 0;
+
+	return err;
+}
 
-		fu_hdr[2] |= 1<<6;  /* set END bit */
 
-		err |= pkth(marker, fu_hdr, 3, buf, len, arg);
+/* Aggregate a small NAL unit, send a big one alone */
+static int ap_add(struct videnc_state *st, struct ap *ap, bool marker,
+		  const uint8_t *nal, size_t len)
+{
+	int err = 0;
+
+	if (ap->n && (ap->len + 2 + len > st->pktsize ||
+		      ap->n == AP_MAX_NALS))
+		err = ap_flush(st, ap, false);
+
+	if (H265_HDR_SIZE + 2 + len > st->pktsize)
+		return err | nal_send(st, marker, nal, len);
+
+	if (ap->n == 0)
+		ap->len = H265_HDR_SIZE;
+
+	ap->nalv[ap->n] = nal;
+	ap->lenv[ap->n] = len;
+	ap->len += 2 + len;
+	++ap->n;
+
+	return err;
+}
+
+
+/**
+ * Packetize a H.265 byte stream into RTP payloads, with small NAL units
+ * aggregated into Aggregation Packets
+ *
+ * @param st  Encoder state, with the packet size and handlers
+ * @param buf H.265 byte stream with start codes
+ * @param len Length of byte stream
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int h265_packetize(struct videnc_state *st, const uint8_t *buf, size_t len)
+{
+	const uint8_t *end = buf + len;
+	const uint8_t *r;
+	struct ap ap;
+	int err = 0;
+
+	if (!st || !buf)
+		return EINVAL;
+
+	ap.len = 0;
+	ap.n   = 0;
+
+	/* H.265 has the same start codes as H.264 */
+	r = h264_find_startcode(buf, end);
+
+	while (r < end) {
+		const uint8_t *r1;
+		size_t nal_len;
+
+		/* skip zeros */
+		while (!*(r++))
+			;
+
+		r1 = h264_find_startcode(r, end);
+		nal_len = r1 - r;
+
+		/* the zero of the next 4-byte start code */
+		while (nal_len && !r[nal_len-1])
+			--nal_len;
+
+		if (nal_len >= H265_HDR_SIZE)
+			err |= ap_add(st, &ap, r1 >= end, r, nal_len);
+
+		r = r1;
 	}
 
+	err |= ap_flush(st, &ap, true);
+
 	return err;
 }
 
@@ -185,6 +400,7 @@ int h265_encode(struct videnc_state *st, bool update,
 	x265_picture *pic_in = NULL, pic_out;
 	x265_nal *nalv;
 	uint32_t i, nalc = 0;
+	size_t len;
 	int colorspace;
 	int n, err = 0;
 
@@ -246,30 +462,23 @@ int h265_encode(struct videnc_state *st, bool update,
 	if (n <= 0)
 		goto out;
 
+#if 1
 	for (i=0; i<nalc; i++) {
 
-		x265_nal *nal = &nalv[i];
-		uint8_t *p = nal->payload;
-		size_t len = nal->sizeBytes;
-		bool marker;
-
-#if 1
 		debug("h265: encode: %s type=%2d  %s\n",
-			  h265_is_keyframe(nal->type) ? "<KEY>" : "     ",
-			  nal->type, h265_nalunit_name(nal->type));
+			  h265_is_keyframe(nalv[i].type) ? "<KEY>" : "     ",
+			  nalv[i].type, h265_nalunit_name(nalv[i].type));
+	}
 #endif
 
-		h265_skip_startcode(&p, &len);
-
-		/* XXX: use pic_out.pts */
+	/* XXX: use pic_out.pts */
 
-		marker = (i+1)==nalc;  /* last NAL */
+	/* the payloads of all NAL units are sequential in memory */
+	for (i=0, len=0; i<nalc; i++)
+		len += nalv[i].sizeBytes;
 
-		err = packetize(marker, p, len, st->pktsize,
-				st->pkth, st->arg);
-		if (err)
-			goto out;
-	}
+	if (nalc)
+		err = h265_packetize(st, nalv[0].payload, len);
 
  out:
 	if (pic_in)
@@ -34,6 +34,7 @@ static struct vidcodec h265 = {
 	.ench      = h265_encode,
 	.decupdh   = h265_decode_update,
 	.dech      = h265_decode,
+	.resetth   = h265_decode_reset,
 };
 
 
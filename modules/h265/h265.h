@@ -34,7 +34,8 @@ enum h265_naltype {
 	H265_NAL_PREFIX_SEI_NUT  = 39,
 	H265_NAL_SUFFIX_SEI_NUT  = 40,
 
-	/* draft-ietf-payload-rtp-h265 */
+	/* RFC 7798 */
+	H265_NAL_AP              = 48,
 	H265_NAL_FU              = 49,
 };
 
@@ -61,9 +62,11 @@ int h265_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 		       videnc_packet_h *pkth, void *arg);
 int h265_encode(struct videnc_state *ves, bool update,
 		const struct vidframe *frame);
+int h265_packetize(struct videnc_state *st, const uint8_t *buf, size_t len);
 
 /* decoder */
 int h265_decode_update(struct viddec_state **vdsp, const struct vidcodec *vc,
 		       const char *fmtp);
 int h265_decode(struct viddec_state *vds, struct vidframe *frame,
 		bool marker, uint16_t seq, struct mbuf *mb);
+int h265_decode_reset(struct viddec_state *vds);
@@ -0,0 +1,9 @@
+/**
+ * @file httpd.h  Webserver UI module -- internal API
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+int  metrics_reply(struct http_conn *conn);
+void metrics_close(void);
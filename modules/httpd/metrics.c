@@ -0,0 +1,832 @@
+/**
+ * @file metrics.c  Prometheus metrics endpoint
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "httpd.h"
+
+
+/*
+ * The body is sent with chunked transfer-encoding, a few calls per
+ * main-loop iteration, so a scrape of many calls does not block the
+ * main thread or build the whole body in one buffer.
+ *
+ * The Prometheus text format needs all samples of a metric together,
+ * so the outer loop is over the metrics and the inner loop over the
+ * calls. The calls are looked up again by AOR and Call-ID for every
+ * chunk, and calls that have ended in the meantime are skipped.
+ */
+
+
+enum {
+	SCRAPE_CALLS = 32,          /**< Calls per chunk                */
+	CHUNK_HDRSZ  = 8 + 2,       /**< Fixed-width chunk-size + CRLF  */
+};
+
+struct scrape_call {
+	char *aor;
+	char *id;
+};
+
+struct scrape {
+	struct le le;
+	struct tmr tmr;
+	struct http_conn *conn;
+	struct mbuf *mb;
+	struct scrape_call *callv;
+	size_t callc;
+	size_t fam;                 /**< Current metric family          */
+	size_t idx;                 /**< Next call for current family   */
+};
+
+/** Labels of a stream sample */
+struct labels {
+	const char *aor;
+	const char *id;
+	const char *media;
+	const char *dir;
+};
+
+struct family;
+
+typedef int (family_h)(struct re_printf *pf, const struct family *f,
+		       struct labels *l, const struct call *call,
+		       const struct stream *s);
+
+/** A metric family, printed for all streams of all calls */
+struct family {
+	const char *name;
+	const char *type;
+	const char *help;
+	family_h *h;
+	int id;
+};
+
+
+static struct list scrapel;
+
+
+/* Label values escape backslash, double-quote and newline */
+static int label_print(struct re_printf *pf, const char *str)
+{
+	int err = 0;
+
+	for (; str && *str && !err; str++) {
+
+		switch (*str) {
+
+		case '\\': err = re_hprintf(pf, "\\\\"); break;
+		case '"':  err = re_hprintf(pf, "\\\""); break;
+		case '\n': err = re_hprintf(pf, "\\n");  break;
+		default:   err = pf->vph(str, 1, pf->arg); break;
+		}
+	}
+
+	return err;
+}
+
+
+static int labels_print(struct re_printf *pf, const struct labels *l)
+{
+	int err;
+
+	err  = re_hprintf(pf, "ua=\"%H\",call=\"%H\"",
+			  label_print, l->aor, label_print, l->id);
+	if (l->media)
+		err |= re_hprintf(pf, ",media=\"%s\"", l->media);
+	if (l->dir)
+		err |= re_hprintf(pf, ",dir=\"%s\"", l->dir);
+
+	return err;
+}
+
+
+enum stat_id {
+	STAT_PACKETS,
+	STAT_BYTES,
+	STAT_ERR,
+	STAT_BITRATE,
+	STAT_PEAK,
+};
+
+static uint32_t stat_value(const struct stream_stat *st, int id)
+{
+	switch (id) {
+
+	case STAT_PACKETS: return st->n_packets;
+	case STAT_BYTES:   return st->n_bytes;
+	case STAT_ERR:     return st->n_err;
+	case STAT_BITRATE: return st->bitrate;
+	case STAT_PEAK:    return st->peak_bitrate;
+	default:           return 0;
+	}
+}
+
+
+static int stat_print(struct re_printf *pf, const struct family *f,
+		      struct labels *l, const struct call *call,
+		      const struct stream *s)
+{
+	struct stream_stat tx, rx;
+	int err;
+	(void)call;
+
+	if (stream_stats(s, &tx, &rx))
+		return 0;
+
+	l->dir = "tx";
+	err  = re_hprintf(pf, "%s{%H} %u\n", f->name, labels_print, l,
+			  stat_value(&tx, f->id));
+	l->dir = "rx";
+	err |= re_hprintf(pf, "%s{%H} %u\n", f->name, labels_print, l,
+			  stat_value(&rx, f->id));
+
+	return err;
+}
+
+
+static int lost_print(struct re_printf *pf, const struct family *f,
+		      struct labels *l, const struct call *call,
+		      const struct stream *s)
+{
+	const struct rtcp_stats *rtcp = stream_rtcp_stats(s);
+	int err;
+	(void)call;
+
+	if (!rtcp)
+		return 0;
+
+	l->dir = "tx";
+	err  = re_hprintf(pf, "%s{%H} %d\n", f->name, labels_print, l,
+			  rtcp->tx.lost);
+	l->dir = "rx";
+	err |= re_hprintf(pf, "%s{%H} %d\n", f->name, labels_print, l,
+			  rtcp->rx.lost);
+
+	return err;
+}
+
+
+static int jitter_print(struct re_printf *pf, const struct family *f,
+			struct labels *l, const struct call *call,
+			const struct stream *s)
+{
+	const struct rtcp_stats *rtcp = stream_rtcp_stats(s);
+	int err;
+	(void)call;
+
+	if (!rtcp)
+		return 0;
+
+	l->dir = "tx";
+	err  = re_hprintf(pf, "%s{%H} %.6f\n", f->name, labels_print, l,
+			  rtcp->tx.jit / 1000000.0);
+	l->dir = "rx";
+	err |= re_hprintf(pf, "%s{%H} %.6f\n", f->name, labels_print, l,
+			  rtcp->rx.jit / 1000000.0);
+
+	return err;
+}
+
+
+static int rtt_print(struct re_printf *pf, const struct family *f,
+		     struct labels *l, const struct call *call,
+		     const struct stream *s)
+{
+	const struct rtcp_stats *rtcp = stream_rtcp_stats(s);
+	(void)call;
+
+	if (!rtcp)
+		return 0;
+
+	return re_hprintf(pf, "%s{%H} %.6f\n", f->name, labels_print, l,
+			  rtcp->rtt / 1000000.0);
+}
+
+
+static int mos_print(struct re_printf *pf, const struct family *f,
+		     struct labels *l, const struct call *call,
+		     const struct stream *s)
+{
+	const struct rtcp_stats *rtcp = stream_rtcp_stats(s);
+	struct stream_quality q;
+	double r_factor, mos;
+
+	if (s != audio_strm(call_audio(call)))
+		return 0;
+
+	/* the continuous estimate, or else the one of the RTCP reports */
+	if (0 == stream_quality(s, &q)) {
+		mos = f->id ? q.mos_min : q.mos;
+	}
+	else if (rtcp && rtcp->rx.sent && !f->id) {
+		mos = mos_calculate(&r_factor, rtcp->rtt / 1000.0,
+				    rtcp->rx.jit / 1000.0,
+				    rtcp->rx.lost > 0 ? rtcp->rx.lost : 0);
+	}
+	else
+		return 0;
+
+	return re_hprintf(pf, "%s{%H} %.3f\n", f->name, labels_print, l, mos);
+}
+
+
+static int mos_alerts_print(struct re_printf *pf, const struct family *f,
+			    struct labels *l, const struct call *call,
+			    const struct stream *s)
+{
+	struct stream_quality q;
+	(void)call;
+
+	if (stream_quality(s, &q))
+		return 0;
+
+	return re_hprintf(pf, "%s{%H} %u\n", f->name, labels_print, l,
+			  q.n_alerts);
+}
+
+
+/* RTCP XR VoIP metrics from the peer, about the media we send */
+static int xr_print(struct re_printf *pf, const struct family *f,
+		    struct labels *l, const struct call *call,
+		    const struct stream *s)
+{
+	const struct rtcpxr_voip *v = stream_rtcpxr(s);
+	(void)call;
+
+	if (!v)
+		return 0;
+
+	switch (f->id) {
+
+	case 0:
+		return re_hprintf(pf, "%s{%H} %.4f\n", f->name,
+				  labels_print, l, v->loss_rate / 256.0);
+
+	case 1:
+		return re_hprintf(pf, "%s{%H} %.4f\n", f->name,
+				  labels_print, l, v->discard_rate / 256.0);
+
+	default:
+		/* 127 is unavailable */
+		if (v->mos_cq == 127)
+			return 0;
+
+		return re_hprintf(pf, "%s{%H} %.1f\n", f->name,
+				  labels_print, l, v->mos_cq / 10.0);
+	}
+}
+
+
+/* Levels from a level meter filter, such as vumeter */
+static int level_print(struct re_printf *pf, const struct family *f,
+		       struct labels *l, const struct call *call,
+		       const struct stream *s)
+{
+	const struct audio *au = call_audio(call);
+	double rmsv[2], peakv[2];
+	bool okv[2];
+	int i, err = 0;
+
+	if (s != audio_strm(au))
+		return 0;
+
+	okv[0] = !audio_level(au, true,  &rmsv[0], &peakv[0]);
+	okv[1] = !audio_level(au, false, &rmsv[1], &peakv[1]);
+
+	for (i=0; i<2; i++) {
+
+		if (!okv[i])
+			continue;
+
+		l->dir = i ? "rx" : "tx";
+		err |= re_hprintf(pf, "%s{%H} %.2f\n", f->name,
+				  labels_print, l,
+				  f->id ? peakv[i] : rmsv[i]);
+	}
+
+	return err;
+}
+
+
+/* Final counters of the sequence window, and loss bursts by length */
+static int seq_print(struct re_printf *pf, const struct family *f,
+		     struct labels *l, const struct call *call,
+		     const struct stream *s)
+{
+	static const char *lenv[SEQWIN_BURSTS] = {
+		"1", "2", "3", "4", "8", "16", "32", "+Inf"
+	};
+	const struct seqwin *w = stream_seqwin(s);
+	int i, err = 0;
+	(void)call;
+
+	if (!w || !w->n_rx)
+		return 0;
+
+	if (f->id) {
+		for (i=0; i<SEQWIN_BURSTS; i++) {
+			err |= re_hprintf(pf, "%s{%H,length=\"%s\"} %u\n",
+					  f->name, labels_print, l, lenv[i],
+					  w->burstv[i]);
+		}
+
+		return err;
+	}
+
+	err  = re_hprintf(pf, "%s{%H,event=\"lost\"} %llu\n",
+			  f->name, labels_print, l, w->n_lost);
+	err |= re_hprintf(pf, "%s{%H,event=\"duplicate\"} %u\n",
+			  f->name, labels_print, l, w->n_dup);
+	err |= re_hprintf(pf, "%s{%H,event=\"reordered\"} %u\n",
+			  f->name, labels_print, l, w->n_reorder);
+	err |= re_hprintf(pf, "%s{%H,event=\"late\"} %u\n",
+			  f->name, labels_print, l, w->n_late);
+
+	return err;
+}
+
+
+static int jbuf_print(struct re_printf *pf, const struct family *f,
+		      struct labels *l, const struct call *call,
+		      const struct stream *s)
+{
+	struct jbuf_stat stat;
+	int err;
+	(void)call;
+
+	if (stream_jbuf_stats(s, &stat))
+		return 0;
+
+	err  = re_hprintf(pf, "%s{%H,event=\"late\"} %u\n",
+			  f->name, labels_print, l, stat.n_late);
+	err |= re_hprintf(pf, "%s{%H,event=\"lost\"} %u\n",
+			  f->name, labels_print, l, stat.n_lost);
+	err |= re_hprintf(pf, "%s{%H,event=\"overflow\"} %u\n",
+			  f->name, labels_print, l, stat.n_overflow);
+	err |= re_hprintf(pf, "%s{%H,event=\"underflow\"} %u\n",
+			  f->name, labels_print, l, stat.n_underflow);
+	err |= re_hprintf(pf, "%s{%H,event=\"flush\"} %u\n",
+			  f->name, labels_print, l, stat.n_flush);
+
+	return err;
+}
+
+
+/* A histogram in [us] as a Prometheus summary in seconds */
+static int summary_print(struct re_printf *pf, const char *name,
+			 const struct labels *l, const struct histo *h)
+{
+	static const unsigned pctv[] = {50, 90, 99};
+	size_t i;
+	int err = 0;
+
+	if (!histo_count(h))
+		return 0;
+
+	for (i=0; i<ARRAY_SIZE(pctv); i++) {
+		err |= re_hprintf(pf, "%s{%H,quantile=\"0.%02u\"} %.6f\n",
+				  name, labels_print, l, pctv[i],
+				  histo_percentile(h, pctv[i]) / 1000000.0);
+	}
+
+	err |= re_hprintf(pf, "%s_sum{%H} %.6f\n", name, labels_print, l,
+			  histo_sum(h) / 1000000.0);
+	err |= re_hprintf(pf, "%s_count{%H} %llu\n", name, labels_print, l,
+			  histo_count(h));
+
+	return err;
+}
+
+
+static int iat_print(struct re_printf *pf, const struct family *f,
+		     struct labels *l, const struct call *call,
+		     const struct stream *s)
+{
+	struct stream_stat tx, rx;
+	int err;
+	(void)call;
+
+	if (stream_stats(s, &tx, &rx))
+		return 0;
+
+	l->dir = "tx";
+	err  = summary_print(pf, f->name, l, tx.iat);
+	l->dir = "rx";
+	err |= summary_print(pf, f->name, l, rx.iat);
+
+	return err;
+}
+
+
+static int jbuf_delay_print(struct re_printf *pf, const struct family *f,
+			    struct labels *l, const struct call *call,
+			    const struct stream *s)
+{
+	struct stream_stat rx;
+	(void)call;
+
+	if (stream_stats(s, NULL, &rx))
+		return 0;
+
+	return summary_print(pf, f->name, l, rx.jbuf);
+}
+
+
+static int codec_print(struct re_printf *pf, const struct family *f,
+		       struct labels *l, const struct call *call,
+		       const struct stream *s)
+{
+	struct stream_stat tx, rx;
+	int err;
+	(void)call;
+
+	if (stream_stats(s, &tx, &rx))
+		return 0;
+
+	l->dir = "tx";
+	err  = summary_print(pf, f->name, l, tx.proc);
+	l->dir = "rx";
+	err |= summary_print(pf, f->name, l, rx.proc);
+
+	return err;
+}
+
+
+static const struct family familyv[] = {
+	{"baresip_stream_packets_total", "counter",
+	 "RTP packets", stat_print, STAT_PACKETS},
+	{"baresip_stream_bytes_total", "counter",
+	 "RTP payload bytes", stat_print, STAT_BYTES},
+	{"baresip_stream_errors_total", "counter",
+	 "RTP send and receive errors", stat_print, STAT_ERR},
+	{"baresip_stream_bitrate_bps", "gauge",
+	 "Average bitrate over 3 seconds", stat_print, STAT_BITRATE},
+	{"baresip_stream_peak_bitrate_bps", "gauge",
+	 "Peak bitrate of 100 ms windows", stat_print, STAT_PEAK},
+	{"baresip_stream_rtcp_lost_packets", "gauge",
+	 "Cumulative packets lost, from RTCP", lost_print, 0},
+	{"baresip_stream_rtcp_jitter_seconds", "gauge",
+	 "Interarrival jitter, from RTCP", jitter_print, 0},
+	{"baresip_stream_rtt_seconds", "gauge",
+	 "Round-trip time, from RTCP", rtt_print, 0},
+	{"baresip_stream_mos", "gauge",
+	 "Estimated Mean Opinion Score of received audio", mos_print, 0},
+	{"baresip_stream_mos_min", "gauge",
+	 "Lowest estimated MOS of received audio", mos_print, 1},
+	{"baresip_stream_mos_alerts_total", "counter",
+	 "Times the estimated MOS fell below mos_alert", mos_alerts_print, 0},
+	{"baresip_stream_xr_loss_ratio", "gauge",
+	 "Loss of sent media, reported by the peer in RTCP XR", xr_print, 0},
+	{"baresip_stream_xr_discard_ratio", "gauge",
+	 "Discards of sent media, reported by the peer in RTCP XR",
+	 xr_print, 1},
+	{"baresip_stream_xr_mos", "gauge",
+	 "MOS of sent audio, reported by the peer in RTCP XR", xr_print, 2},
+	{"baresip_audio_rms_dbov", "gauge",
+	 "RMS audio level of the last measured frame", level_print, 0},
+	{"baresip_audio_peak_dbov", "gauge",
+	 "Peak audio level of the last measured frame", level_print, 1},
+	{"baresip_stream_rx_sequence_total", "counter",
+	 "Lost, duplicate, reordered and late RTP packets", seq_print, 0},
+	{"baresip_stream_loss_bursts_total", "counter",
+	 "Bursts of lost RTP packets, by length up to", seq_print, 1},
+	{"baresip_jbuf_events_total", "counter",
+	 "Jitter-buffer events", jbuf_print, 0},
+	{"baresip_stream_interarrival_seconds", "summary",
+	 "Time between RTP packets", iat_print, 0},
+	{"baresip_jbuf_delay_seconds", "summary",
+	 "Media buffered in the jitter-buffer", jbuf_delay_print, 0},
+	{"baresip_stream_codec_seconds", "summary",
+	 "Encode (tx) and decode (rx) time per frame", codec_print, 0},
+};
+
+
+/* A histogram in [us] as a Prometheus summary without labels */
+static int global_summary_print(struct re_printf *pf, const char *name,
+				const char *help, const struct histo *h)
+{
+	static const unsigned pctv[] = {50, 90, 99};
+	size_t i;
+	int err;
+
+	err = re_hprintf(pf, "# HELP %s %s\n# TYPE %s summary\n",
+			 name, help, name);
+
+	for (i=0; i<ARRAY_SIZE(pctv); i++) {
+		err |= re_hprintf(pf, "%s{quantile=\"0.%02u\"} %.6f\n",
+				  name, pctv[i],
+				  histo_percentile(h, pctv[i]) / 1000000.0);
+	}
+
+	err |= re_hprintf(pf, "%s_sum %.6f\n", name, histo_sum(h) / 1000000.0);
+	err |= re_hprintf(pf, "%s_count %llu\n", name, histo_count(h));
+
+	return err;
+}
+
+
+static int mainloop_print(struct re_printf *pf)
+{
+	struct lagmon_slow slowv[16];
+	size_t i, n;
+	int err;
+
+	err  = global_summary_print(pf, "baresip_mainloop_lag_seconds",
+				    "Lateness of a main loop timer",
+				    lagmon_lag());
+	err |= global_summary_print(pf, "baresip_mainloop_handler_seconds",
+				    "Run time of main loop handlers",
+				    lagmon_handlers());
+
+	n = lagmon_slowest(slowv, ARRAY_SIZE(slowv));
+
+	err |= re_hprintf(pf,
+			  "# HELP baresip_mainloop_slow_handler_seconds"
+			  " Longest run of a slow main loop handler\n"
+			  "# TYPE baresip_mainloop_slow_handler_seconds"
+			  " gauge\n");
+
+	for (i=0; i<n; i++) {
+		err |= re_hprintf(pf, "baresip_mainloop_slow_handler_seconds"
+				  "{handler=\"%H\"} %.6f\n",
+				  label_print, slowv[i].name,
+				  slowv[i].max / 1000000.0);
+	}
+
+	return err;
+}
+
+
+static int global_print(struct re_printf *pf)
+{
+	struct le *le;
+	uint32_t n_ua = 0, n_call = 0;
+	int err = 0;
+
+	for (le = list_head(uag_list()); le; le = le->next) {
+		++n_ua;
+		n_call += list_count(ua_calls(le->data));
+	}
+
+	err |= re_hprintf(pf,
+			  "# HELP baresip_uas User-Agents\n"
+			  "# TYPE baresip_uas gauge\n"
+			  "baresip_uas %u\n"
+			  "# HELP baresip_calls Active calls\n"
+			  "# TYPE baresip_calls gauge\n"
+			  "baresip_calls %u\n",
+			  n_ua, n_call);
+
+	err |= re_hprintf(pf,
+			  "# HELP baresip_ua_registered"
+			  " 1 if the User-Agent is registered\n"
+			  "# TYPE baresip_ua_registered gauge\n");
+
+	for (le = list_head(uag_list()); le; le = le->next) {
+		const struct ua *ua = le->data;
+
+		err |= re_hprintf(pf, "baresip_ua_registered{ua=\"%H\"} %d\n",
+				  label_print, ua_aor(ua),
+				  ua_isregistered(ua));
+	}
+
+	err |= mainloop_print(pf);
+
+	return err;
+}
+
+
+static int call_print(struct re_printf *pf, const struct family *f,
+		      const struct scrape_call *sc)
+{
+	struct labels l;
+	const struct call *call;
+	const struct stream *sv[2];
+	size_t i;
+	int err = 0;
+
+	call = ua_find_call(uag_find_aor(sc->aor), sc->id);
+	if (!call)
+		return 0;
+
+	sv[0] = audio_strm(call_audio(call));
+	sv[1] = video_strm(call_video(call));
+
+	for (i=0; i<ARRAY_SIZE(sv); i++) {
+
+		if (!sv[i])
+			continue;
+
+		l.aor   = sc->aor;
+		l.id    = sc->id;
+		l.media = stream_name(sv[i]);
+		l.dir   = NULL;
+
+		err |= f->h(pf, f, &l, call, sv[i]);
+	}
+
+	return err;
+}
+
+
+static int print_handler(const char *p, size_t size, void *arg)
+{
+	return mbuf_write_mem(arg, (const uint8_t *)p, size);
+}
+
+
+static int chunk_send(struct scrape *sc, bool last)
+{
+	struct mbuf *mb = sc->mb;
+	const size_t len = mb->end - CHUNK_HDRSZ;
+	int err = 0;
+
+	if (len)
+		err |= mbuf_write_str(mb, "\r\n");
+	if (last)
+		err |= mbuf_write_str(mb, "0\r\n\r\n");
+	if (err)
+		return err;
+
+	if (len) {
+		mb->pos = 0;
+		err = mbuf_printf(mb, "%08x\r\n", (unsigned)len);
+		mb->pos = 0;
+	}
+	else {
+		mb->pos = CHUNK_HDRSZ;
+	}
+	if (err || !mbuf_get_left(mb))
+		return err;
+
+	return tcp_send(http_conn_tcp(sc->conn), mb);
+}
+
+
+static void scrape_destructor(void *arg)
+{
+	struct scrape *sc = arg;
+	size_t i;
+
+	list_unlink(&sc->le);
+	tmr_cancel(&sc->tmr);
+
+	for (i=0; i<sc->callc; i++) {
+		mem_deref(sc->callv[i].aor);
+		mem_deref(sc->callv[i].id);
+	}
+
+	mem_deref(sc->callv);
+	mem_deref(sc->mb);
+	mem_deref(sc->conn);
+}
+
+
+static void scrape_handler(void *arg)
+{
+	struct scrape *sc = arg;
+	struct re_printf pf = {print_handler, NULL};
+	unsigned n = 0;
+	bool last;
+	int err = 0;
+
+	pf.arg = sc->mb;
+	sc->mb->pos = sc->mb->end = CHUNK_HDRSZ;
+
+	if (sc->fam == 0 && sc->idx == 0)
+		err |= global_print(&pf);
+
+	while (sc->fam < ARRAY_SIZE(familyv) && n < SCRAPE_CALLS && !err) {
+
+		const struct family *f = &familyv[sc->fam];
+
+		if (sc->idx == 0) {
+			err |= re_hprintf(&pf, "# HELP %s %s\n# TYPE %s %s\n",
+					  f->name, f->help, f->name, f->type);
+		}
+
+		if (sc->idx < sc->callc) {
+			err |= call_print(&pf, f, &sc->callv[sc->idx]);
+			++sc->idx;
+			++n;
+		}
+
+		if (sc->idx >= sc->callc) {
+			++sc->fam;
+			sc->idx = 0;
+		}
+	}
+
+	last = sc->fam >= ARRAY_SIZE(familyv);
+
+	if (!err)
+		err = chunk_send(sc, last);
+
+	if (err) {
+		warning("httpd: metrics: %m\n", err);
+		http_conn_close(sc->conn);
+		mem_deref(sc);
+		return;
+	}
+
+	if (last)
+		mem_deref(sc);
+	else
+		tmr_start(&sc->tmr, 0, scrape_handler, sc);
+}
+
+
+static int calls_snapshot(struct scrape *sc)
+{
+	struct le *le, *lec;
+	size_t n = 0;
+	int err = 0;
+
+	for (le = list_head(uag_list()); le; le = le->next)
+		n += list_count(ua_calls(le->data));
+
+	if (!n)
+		return 0;
+
+	sc->callv = mem_zalloc(n * sizeof(*sc->callv), NULL);
+	if (!sc->callv)
+		return ENOMEM;
+
+	for (le = list_head(uag_list()); le && !err; le = le->next) {
+
+		const struct ua *ua = le->data;
+
+		for (lec = list_head(ua_calls(ua)); lec; lec = lec->next) {
+
+			struct scrape_call *c = &sc->callv[sc->callc];
+			const char *id = call_id(lec->data);
+
+			if (sc->callc >= n || !id)
+				continue;
+
+			err |= str_dup(&c->aor, ua_aor(ua));
+			err |= str_dup(&c->id, id);
+			++sc->callc;
+		}
+	}
+
+	return err;
+}
+
+
+/**
+ * Reply to a scrape of the /metrics endpoint
+ *
+ * @param conn HTTP connection
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int metrics_reply(struct http_conn *conn)
+{
+	struct scrape *sc;
+	int err;
+
+	if (!conn)
+		return EINVAL;
+
+	sc = mem_zalloc(sizeof(*sc), scrape_destructor);
+	if (!sc)
+		return ENOMEM;
+
+	sc->conn = mem_ref(conn);
+	sc->mb = mbuf_alloc(8192);
+	if (!sc->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = calls_snapshot(sc);
+	if (err)
+		goto out;
+
+	err = http_reply(conn, 200, "OK",
+			 "Content-Type: text/plain; version=0.0.4\r\n"
+			 "Transfer-Encoding: chunked\r\n"
+			 "\r\n");
+	if (err)
+		goto out;
+
+	list_append(&scrapel, &sc->le, sc);
+	tmr_start(&sc->tmr, 0, scrape_handler, sc);
+
+ out:
+	if (err)
+		mem_deref(sc);
+
+	return err;
+}
+
+
+/** Stop all scrapes that are still in progress */
+void metrics_close(void)
+{
+	list_flush(&scrapel);
+}
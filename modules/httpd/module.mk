@@ -6,5 +6,6 @@
 
 MOD		:= httpd
 $(MOD)_SRCS	+= httpd.c
+$(MOD)_SRCS	+= metrics.c
 
 include mk/mod.mk
@@ -7,6 +7,7 @@
 #include <CoreFoundation/CoreFoundation.h>
 #include <SystemConfiguration/SCNetworkReachability.h>
 #endif
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 
@@ -25,7 +26,18 @@
   ice_debug       {yes,no}             # Enable ICE debugging/tracing
   ice_nomination  {regular,aggressive} # Regular or aggressive nomination
   ice_mode        {full,lite}          # Full ICE-mode or ICE-lite
+  ice_trickle     {yes,no}             # Send offer with host candidates
  \endverbatim
+ *
+ * With ice_trickle the SDP offer or answer is sent as soon as the host
+ * candidates are known, without waiting for the STUN or TURN server.
+ * The connectivity checks can then start on the host candidates, and
+ * the server-reflexive and relayed candidates are sent in the Re-INVITE
+ * when the checks are complete. Aggressive nomination makes the checks
+ * finish one round-trip earlier.
+ *
+ * The resolved address of the STUN/TURN server is cached, and reused
+ * by new sessions as long as the local address has not changed.
  */
 
 
@@ -37,9 +49,14 @@ struct mnat_sess {
 	struct ice *ice;
 	char *user;
 	char *pass;
+	struct tmr tmr_estab;
+	char *host;
+	uint16_t port;
+	int af;
 	int mediac;
 	bool started;
 	bool send_reinvite;
+	bool estab;
 	mnat_estab_h *estabh;
 	void *arg;
 };
@@ -53,9 +70,26 @@ struct mnat_media {
 	struct mnat_sess *sess;
 	struct sdp_media *sdpm;
 	struct icem *icem;
+	bool host;
 	bool complete;
 };
 
+/** Server lookup, reused as long as the local address is the same */
+struct srv_cache {
+	struct sa srv;
+	struct sa laddr;
+	char host[256];
+	uint16_t port;
+	int af;
+	bool turn;
+	uint64_t expires;
+};
+
+
+enum {
+	CACHE_TIME = 600000,   /**< Lifetime of a cached server in [ms] */
+};
+
 
 static struct mnat *mnat;
 static struct {
@@ -63,12 +97,15 @@ static struct {
 	enum ice_nomination nom;
 	bool turn;
 	bool debug;
+	bool trickle;
 } ice = {
 	ICE_MODE_FULL,
 	ICE_NOMINATION_REGULAR,
 	true,
+	false,
 	false
 };
+static struct srv_cache cache;
 
 
 static void gather_handler(int err, uint16_t scode, const char *reason,
@@ -117,8 +154,10 @@ static void session_destructor(void *arg)
 {
 	struct mnat_sess *sess = arg;
 
+	tmr_cancel(&sess->tmr_estab);
 	list_flush(&sess->medial);
 	mem_deref(sess->dnsq);
+	mem_deref(sess->host);
 	mem_deref(sess->user);
 	mem_deref(sess->pass);
 	mem_deref(sess->ice);
@@ -207,11 +246,22 @@ static bool if_handler(const char *ifname, const struct sa *sa, void *arg)
 }
 
 
+/* The host candidates are added once, before or after the server lookup */
+static void media_host(struct mnat_media *m)
+{
+	if (m->host)
+		return;
+
+	net_if_apply(if_handler, m);
+	m->host = true;
+}
+
+
 static int media_start(struct mnat_sess *sess, struct mnat_media *m)
 {
 	int err = 0;
 
-	net_if_apply(if_handler, m);
+	media_host(m);
 
 	switch (ice.mode) {
 
@@ -242,18 +292,60 @@ static int media_start(struct mnat_sess *sess, struct mnat_media *m)
 }
 
 
+static const struct sa *cache_lookup(int af, const char *host,
+				     uint16_t port)
+{
+	const struct sa *laddr = net_laddr_af(baresip_network(), af);
+
+	if (!sa_isset(&cache.srv, SA_ALL) || !laddr)
+		return NULL;
+
+	if (tmr_jiffies() > cache.expires)
+		return NULL;
+
+	if (af != cache.af || port != cache.port || ice.turn != cache.turn ||
+	    str_cmp(host, cache.host) ||
+	    !sa_cmp(laddr, &cache.laddr, SA_ADDR))
+		return NULL;
+
+	return &cache.srv;
+}
+
+
+static void cache_store(const struct mnat_sess *sess, const struct sa *srv)
+{
+	const struct sa *laddr = net_laddr_af(baresip_network(), sess->af);
+
+	memset(&cache, 0, sizeof(cache));
+
+	if (!laddr)
+		return;
+
+	cache.srv     = *srv;
+	cache.laddr   = *laddr;
+	cache.port    = sess->port;
+	cache.af      = sess->af;
+	cache.turn    = ice.turn;
+	cache.expires = tmr_jiffies() + CACHE_TIME;
+	str_ncpy(cache.host, sess->host, sizeof(cache.host));
+}
+
+
 static void dns_handler(int err, const struct sa *srv, void *arg)
 {
 	struct mnat_sess *sess = arg;
 	struct le *le;
 
-	if (err)
+	if (err) {
+		memset(&cache, 0, sizeof(cache));
 		goto out;
+	}
 
 	debug("ice: resolved %s-server to address %J\n",
 	      ice.turn ? "TURN" : "STUN", srv);
 
 	sess->srv = *srv;
+	cache_store(sess, srv);
 
 	for (le=sess->medial.head; le; le=le->next) {
 
@@ -267,10 +359,31 @@ static void dns_handler(int err, const struct sa *srv, void *arg)
 	return;
 
  out:
+	/* the offer with the host candidates is already sent */
+	if (sess->estab) {
+		warning("ice: server lookup failed: %m\n", err);
+		return;
+	}
+
 	sess->estabh(err, 0, NULL, sess->arg);
 }
 
 
+/* All media have their host candidates, the offer need not wait */
+static void estab_handler(void *arg)
+{
+	struct mnat_sess *sess = arg;
+
+	if (sess->estab)
+		return;
+
+	info("ice: sending host candidates, gathering the others\n");
+
+	sess->estab = true;
+	sess->estabh(0, 0, NULL, sess->arg);
+}
+
+
 static int session_alloc(struct mnat_sess **sessp, struct dnsc *dnsc,
 			 int af, const char *srv, uint16_t port,
 			 const char *user, const char *pass,
@@ -278,6 +391,7 @@ static int session_alloc(struct mnat_sess **sessp, struct dnsc *dnsc,
 			 mnat_estab_h *estabh, void *arg)
 {
 	struct mnat_sess *sess;
+	const struct sa *cached;
 	const char *usage;
 	int err;
 
@@ -295,9 +409,12 @@ static int session_alloc(struct mnat_sess **sessp, struct dnsc *dnsc,
 	sess->sdp    = mem_ref(ss);
 	sess->estabh = estabh;
 	sess->arg    = arg;
+	sess->port   = port;
+	sess->af     = af;
 
 	err  = str_dup(&sess->user, user);
 	err |= str_dup(&sess->pass, pass);
+	err |= str_dup(&sess->host, srv);
 	if (err)
 		goto out;
 
@@ -320,6 +437,14 @@ static int session_alloc(struct mnat_sess **sessp, struct dnsc *dnsc,
 	if (err)
 		goto out;
 
+	/* media_alloc starts gathering when the server is known */
+	cached = cache_lookup(af, srv, port);
+	if (cached) {
+		debug("ice: using cached server address %J\n", cached);
+		sess->srv = *cached;
+		goto out;
+	}
+
 	usage = ice.turn ? stun_usage_relay : stun_usage_binding;
 
 	err = stun_server_discover(&sess->dnsq, dnsc, usage, stun_proto_udp,
@@ -414,15 +539,23 @@ static void gather_handler(int err, uint16_t scode, const char *reason,
 			   void *arg)
 {
 	struct mnat_media *m = arg;
+	struct mnat_sess *sess = m->sess;
 
 	if (err || scode) {
 		warning("ice: gather error: %m (%u %s)\n",
 			err, scode, reason);
+
+		/* the host candidates are still usable */
+		if (sess->estab)
+			return;
 	}
 	else {
-		refresh_laddr(m,
-			      icem_cand_default(m->icem, 1),
-			      icem_cand_default(m->icem, 2));
+		/* keep the selected pair of a completed check */
+		if (!m->complete) {
+			refresh_laddr(m,
+				      icem_cand_default(m->icem, 1),
+				      icem_cand_default(m->icem, 2));
+		}
 
 		info("ice: %s: Default local candidates: %J / %J\n",
 		     sdp_media_name(m->sdpm),
@@ -430,11 +563,18 @@ static void gather_handler(int err, uint16_t scode, const char *reason,
 
 		(void)set_media_attributes(m);
 
-		if (--m->sess->mediac)
+		if (--sess->mediac)
 			return;
+
+		/* the other candidates go in the Re-INVITE */
+		if (sess->estab) {
+			sess->send_reinvite = true;
+			return;
+		}
 	}
 
-	m->sess->estabh(err, scode, reason, m->sess->arg);
+	sess->estab = true;
+	sess->estabh(err, scode, reason, sess->arg);
 }
 
 
@@ -570,6 +710,17 @@ static int media_alloc(struct mnat_media **mp, struct mnat_sess *sess,
 
 	if (sa_isset(&sess->srv, SA_ALL))
 		err |= media_start(sess, m);
+	else if (ice.trickle && ice.mode == ICE_MODE_FULL)
+		media_host(m);
+
+	if (err)
+		goto out;
+
+	/* the timer fires after the last media is allocated */
+	if (ice.trickle && ice.mode == ICE_MODE_FULL && !sess->estab) {
+		err = set_media_attributes(m);
+		tmr_start(&sess->tmr_estab, 0, estab_handler, sess);
+	}
 
  out:
 	if (err)
@@ -668,6 +819,7 @@ static int module_init(void)
 
 	conf_get_bool(conf_cur(), "ice_turn", &ice.turn);
 	conf_get_bool(conf_cur(), "ice_debug", &ice.debug);
+	conf_get_bool(conf_cur(), "ice_trickle", &ice.trickle);
 
 	if (!conf_get(conf_cur(), "ice_nomination", &pl)) {
 		if (0 == pl_strcasecmp(&pl, "regular"))
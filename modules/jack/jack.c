@@ -13,6 +13,15 @@ static struct auplay *auplay;
 static struct ausrc *ausrc;
 
 
+/* called once in the process thread, before it is used */
+void jack_thread_sched(void *arg)
+{
+	(void)arg;
+
+	(void)realtime_thread("audio_dev");
+}
+
+
 static int module_init(void)
 {
 	int err = 0;
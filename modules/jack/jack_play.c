@@ -15,6 +15,7 @@ struct auplay_st {
 
 	struct auplay_prm prm;
 	int16_t *sampv;
+	int16_t *chv;             /* one channel, when de-interleaving */
 	size_t sampc;             /* includes number of channels */
 	auplay_write_h *wh;
 	void *arg;
@@ -25,25 +26,12 @@ struct auplay_st {
 };
 
 
-static inline float ausamp_short2float(int16_t in)
-{
-	float out;
-
-	out = (float) (in / (1.0 * 0x8000));
-
-	return out;
-}
-
-
 /**
  * The process callback for this JACK application is called in a
  * special realtime thread once for each audio cycle.
  *
- * This client does nothing more than copy data from its input
- * port to its output port. It will exit when stopped by
- * the user (e.g. using Ctrl-C on a unix-ish operating system)
- *
- * XXX avoid memory allocations in this function
+ * The samples are converted to float a whole port buffer at a time,
+ * with SIMD where available. It does not allocate memory or lock.
  */
 static int process_handler(jack_nframes_t nframes, void *arg)
 {
@@ -51,22 +39,30 @@ static int process_handler(jack_nframes_t nframes, void *arg)
 	size_t sampc = nframes * st->prm.ch;
 	size_t ch, j;
 
+	/* the buffers are sized for the engine's buffer size */
+	if (nframes > st->nframes)
+		return 0;
+
 	/* 1. read data from app (signed 16-bit) interleaved */
 	st->wh(st->sampv, sampc, st->arg);
 
-	/* 2. convert from 16-bit to float and copy to Jack */
-
-	/* 3. de-interleave [LRLRLRLR] -> [LLLLL]+[RRRRR] */
+	/* 2. de-interleave [LRLRLRLR] -> [LLLLL]+[RRRRR],
+	 *    convert from 16-bit to float and copy to Jack */
 	for (ch = 0; ch < st->prm.ch; ch++) {
 
 		jack_default_audio_sample_t *buffer;
+		const int16_t *sampv = st->sampv;
 
-		buffer = jack_port_get_buffer(st->portv[ch], st->nframes);
+		buffer = jack_port_get_buffer(st->portv[ch], nframes);
 
-		for (j = 0; j < nframes; j++) {
-			int16_t samp = st->sampv[j*st->prm.ch + ch];
-			buffer[j] = ausamp_short2float(samp);
+		if (st->prm.ch > 1) {
+			for (j = 0; j < nframes; j++)
+				st->chv[j] = st->sampv[j*st->prm.ch + ch];
+
+			sampv = st->chv;
 		}
+
+		ausamp_to_float(buffer, sampv, nframes);
 	}
 
 	return 0;
@@ -83,6 +79,7 @@ static void auplay_destructor(void *arg)
 		jack_client_close(st->client);
 
 	mem_deref(st->sampv);
+	mem_deref(st->chv);
 }
 
 
@@ -118,6 +115,7 @@ static int start_jack(struct auplay_st *st)
 	}
 
 	jack_set_process_callback(st->client, process_handler, st);
+	jack_set_thread_init_callback(st->client, jack_thread_sched, NULL);
 
 	engine_srate = jack_get_sample_rate(st->client);
 	st->nframes  = jack_get_buffer_size(st->client);
@@ -147,6 +145,13 @@ static int start_jack(struct auplay_st *st)
 		}
 	}
 
+	/* the process callback must not see unallocated buffers */
+	st->sampc = st->nframes * st->prm.ch;
+	st->sampv = mem_alloc(st->sampc * sizeof(int16_t), NULL);
+	st->chv   = mem_alloc(st->nframes * sizeof(int16_t), NULL);
+	if (!st->sampv || !st->chv)
+		return ENOMEM;
+
 	/* Tell the JACK server that we are ready to roll.  Our
 	 * process() callback will start running now. */
 
@@ -212,13 +217,6 @@ int jack_play_alloc(struct auplay_st **stp, const struct auplay *ap,
 	if (err)
 		goto out;
 
-	st->sampc = st->nframes * prm->ch;
-	st->sampv = mem_alloc(st->sampc * sizeof(int16_t), NULL);
-	if (!st->sampv) {
-		err = ENOMEM;
-		goto out;
-	}
-
 	info("jack: sampc=%zu\n", st->sampc);
 
  out:
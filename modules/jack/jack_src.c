@@ -6,7 +6,6 @@
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
-#include <math.h>
 #include <jack/jack.h>
 #include "mod_jack.h"
 
@@ -16,6 +15,7 @@ struct ausrc_st {
 
 	struct ausrc_prm prm;
 	int16_t *sampv;
+	int16_t *chv;             /* one channel, when de-interleaving */
 	size_t sampc;             /* includes number of channels */
 	ausrc_read_h *rh;
 	void *arg;
@@ -26,49 +26,36 @@ struct ausrc_st {
 };
 
 
-static inline int16_t ausamp_float2short(float in)
-{
-	double scaled_value;
-	int16_t out;
-
-	scaled_value = in * (8.0 * 0x10000000);
-
-	if (scaled_value >= (1.0 * 0x7fffffff)) {
-		out = 32767;
-	}
-	else if (scaled_value <= (-8.0 * 0x10000000)) {
-		out = -32768;
-	}
-	else
-		out = (short) (lrint (scaled_value) >> 16);
-
-	return out;
-}
-
-
 static int process_handler(jack_nframes_t nframes, void *arg)
 {
 	struct ausrc_st *st = arg;
 	size_t sampc = nframes * st->prm.ch;
 	size_t ch, j;
 
-	/* 2. convert from 16-bit to float and copy to Jack */
+	/* the buffers are sized for the engine's buffer size */
+	if (nframes > st->nframes)
+		return 0;
 
-	/* 3. de-interleave [LRLRLRLR] -> [LLLLL]+[RRRRR] */
+	/* 1. convert from float to 16-bit, a whole port buffer at a time,
+	 *    and interleave [LLLLL]+[RRRRR] -> [LRLRLRLR] */
 	for (ch = 0; ch < st->prm.ch; ch++) {
 
 		const jack_default_audio_sample_t *buffer;
 
-		buffer = jack_port_get_buffer(st->portv[ch], st->nframes);
+		buffer = jack_port_get_buffer(st->portv[ch], nframes);
 
-		for (j = 0; j < nframes; j++) {
-			int16_t samp;
-			samp = ausamp_float2short(buffer[j]);
-			st->sampv[j*st->prm.ch + ch] = samp;
+		if (st->prm.ch == 1) {
+			ausamp_to_s16(st->sampv, buffer, nframes);
+			break;
 		}
+
+		ausamp_to_s16(st->chv, buffer, nframes);
+
+		for (j = 0; j < nframes; j++)
+			st->sampv[j*st->prm.ch + ch] = st->chv[j];
 	}
 
-	/* 1. read data from app (signed 16-bit) interleaved */
+	/* 2. send data to app (signed 16-bit) interleaved */
 	st->rh(st->sampv, sampc, st->arg);
 
 	return 0;
@@ -85,6 +72,7 @@ static void ausrc_destructor(void *arg)
 		jack_client_close(st->client);
 
 	mem_deref(st->sampv);
+	mem_deref(st->chv);
 }
 
 
@@ -120,6 +108,7 @@ static int start_jack(struct ausrc_st *st)
 	}
 
 	jack_set_process_callback(st->client, process_handler, st);
+	jack_set_thread_init_callback(st->client, jack_thread_sched, NULL);
 
 	engine_srate = jack_get_sample_rate(st->client);
 	st->nframes  = jack_get_buffer_size(st->client);
@@ -149,6 +138,13 @@ static int start_jack(struct ausrc_st *st)
 		}
 	}
 
+	/* the process callback must not see unallocated buffers */
+	st->sampc = st->nframes * st->prm.ch;
+	st->sampv = mem_alloc(st->sampc * sizeof(int16_t), NULL);
+	st->chv   = mem_alloc(st->nframes * sizeof(int16_t), NULL);
+	if (!st->sampv || !st->chv)
+		return ENOMEM;
+
 	/* Tell the JACK server that we are ready to roll.  Our
 	 * process() callback will start running now. */
 
@@ -205,13 +201,6 @@ int jack_src_alloc(struct ausrc_st **stp, const struct ausrc *as,
 	if (err)
 		goto out;
 
-	st->sampc = st->nframes * prm->ch;
-	st->sampv = mem_alloc(st->sampc * sizeof(int16_t), NULL);
-	if (!st->sampv) {
-		err = ENOMEM;
-		goto out;
-	}
-
 	info("jack: source sampc=%zu\n", st->sampc);
 
  out:
@@ -5,6 +5,8 @@
  */
 
 
+void jack_thread_sched(void *arg);
+
 int jack_play_alloc(struct auplay_st **stp, const struct auplay *ap,
 		    struct auplay_prm *prm, const char *device,
 		    auplay_write_h *wh, void *arg);
@@ -11,16 +11,19 @@
  * @defgroup l16 l16
  *
  * Linear 16-bit audio codec
+ *
+ * The samples are byte-swapped with the SIMD kernels of the core.
+ * 48000 Hz has no static payload type, and is negotiated with a dynamic
+ * one.
  */
 
 
-enum {NR_CODECS = 8};
+enum {NR_CODECS = 10};
 
 
 static int encode(struct auenc_state *st, uint8_t *buf, size_t *len,
 		  const int16_t *sampv, size_t sampc)
 {
-	int16_t *p = (void *)buf;
 	(void)st;
 
 	if (!buf || !len || !sampv)
@@ -31,8 +34,7 @@ static int encode(struct auenc_state *st, uint8_t *buf, size_t *len,
 
 	*len = sampc*2;
 
-	while (sampc--)
-		*p++ = htons(*sampv++);
+	l16_encode(buf, sampv, sampc);
 
 	return 0;
 }
@@ -41,7 +43,6 @@ static int encode(struct auenc_state *st, uint8_t *buf, size_t *len,
 static int decode(struct audec_state *st, int16_t *sampv, size_t *sampc,
 		  const uint8_t *buf, size_t len)
 {
-	int16_t *p = (void *)buf;
 	(void)st;
 
 	if (!buf || !len || !sampv)
@@ -52,9 +53,7 @@ static int decode(struct audec_state *st, int16_t *sampv, size_t *sampc,
 
 	*sampc = len/2;
 
-	len /= 2;
-	while (len--)
-		*sampv++ = ntohs(*p++);
+	l16_decode(sampv, buf, len/2);
 
 	return 0;
 }
@@ -63,10 +62,12 @@ static int decode(struct audec_state *st, int16_t *sampv, size_t *sampc,
 /* See RFC 3551 */
 static struct aucodec l16v[NR_CODECS] = {
 {LE_INIT, "10", "L16", 44100, 44100, 2, 0, 0, encode, 0, decode, 0, 0, 0},
+{LE_INIT,    0, "L16", 48000, 48000, 2, 0, 0, encode, 0, decode, 0, 0, 0},
 {LE_INIT,    0, "L16", 32000, 32000, 2, 0, 0, encode, 0, decode, 0, 0, 0},
 {LE_INIT,    0, "L16", 16000, 16000, 2, 0, 0, encode, 0, decode, 0, 0, 0},
 {LE_INIT,    0, "L16",  8000,  8000, 2, 0, 0, encode, 0, decode, 0, 0, 0},
 {LE_INIT, "11", "L16", 44100, 44100, 1, 0, 0, encode, 0, decode, 0, 0, 0},
+{LE_INIT,    0, "L16", 48000, 48000, 1, 0, 0, encode, 0, decode, 0, 0, 0},
 {LE_INIT,    0, "L16", 32000, 32000, 1, 0, 0, encode, 0, decode, 0, 0, 0},
 {LE_INIT,    0, "L16", 16000, 16000, 1, 0, 0, encode, 0, decode, 0, 0, 0},
 {LE_INIT,    0, "L16",  8000,  8000, 1, 0, 0, encode, 0, decode, 0, 0, 0},
@@ -0,0 +1,805 @@
+/**
+ * @file loadgen.c  SIP and RTP load generator
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+
+
+/**
+ * @defgroup loadgen loadgen
+ *
+ * Load generator, that places calls to a SIP URI and streams audio on them
+ *
+ * Calls are placed from the current User-Agent at a fixed rate, up to a
+ * number of concurrent calls, and each call is hung up after the hold
+ * time. The setup times, the failures and the RTP statistics of the
+ * calls are added up, and the MOS of each call is estimated from its
+ * RTCP statistics.
+ *
+ * The audio is encoded once, and the same encoded frames are sent on all
+ * the calls, so that a call costs no encoding. The codec that is named
+ * by loadgen_codec is replaced by a copy that sends the shared frames,
+ * and decodes as usual. Load this module after the audio codec modules.
+ *
+ * The audio source and player "loadgen" give the packet-time to the
+ * calls, from the main loop and without a sound card:
+ *
+ \verbatim
+  audio_source        loadgen,default
+  audio_player        loadgen,default
+ \endverbatim
+ *
+ * Commands:
+ *
+ \verbatim
+  K [uri]  Start the load generator
+  k        Stop the load generator
+  W        Show the statistics
+ \endverbatim
+ *
+ * The following options can be configured:
+ *
+ \verbatim
+  loadgen_uri         sip:load@127.0.0.1   # Default target
+  loadgen_cps         10                   # Calls per second
+  loadgen_max_calls   100                  # Concurrent calls
+  loadgen_hold        30                   # Hold time [s]
+  loadgen_calls       0                    # Calls to place, 0 is no limit
+  loadgen_codec       PCMU                 # Codec of the shared payload
+ \endverbatim
+ */
+
+
+enum {
+	TICK        = 10,      /* Call placing interval [ms]       */
+	PAYLOAD_DUR = 2000,    /* Length of the shared payload [ms] */
+	FRAME_MAX   = 1280,    /* Size of an encoded frame          */
+	HASH_SIZE   = 256,
+};
+
+
+struct frame {
+	size_t len;
+	uint8_t buf[FRAME_MAX];
+};
+
+struct auenc_state {
+	struct auenc_state *enc;   /* Own encoder state         */
+	size_t pos;
+	bool own;                  /* Not sharing the payload   */
+};
+
+struct ausrc_st {
+	const struct ausrc *as;    /* base class */
+	struct mclock_tmr tmr;
+	uint32_t ptime;
+	size_t sampc;
+	ausrc_read_h *rh;
+	void *arg;
+};
+
+struct auplay_st {
+	const struct auplay *ap;   /* base class */
+	struct mclock_tmr tmr;
+	uint32_t ptime;
+	size_t sampc;
+	auplay_write_h *wh;
+	void *arg;
+};
+
+struct lcall {
+	struct le he;
+	struct tmr tmr;            /* Hold time                 */
+	struct ua *ua;
+	struct call *call;         /* Owned by the User-Agent   */
+	uint64_t start;            /* When it was placed [ms]   */
+	bool established;
+};
+
+struct stats {
+	uint32_t placed;
+	uint32_t established;
+	uint32_t failed;
+	uint32_t skipped;          /* Not placed, at max_calls  */
+	uint64_t tx_packets;
+	uint64_t rx_packets;
+	uint64_t lost;
+	struct histo setup;        /* Setup time [ms]           */
+	struct histo mos;          /* MOS x 100                 */
+	struct histo jitter;       /* RX jitter [us]            */
+};
+
+
+static struct {
+	struct aucodec codec;      /* Copy of the real codec    */
+	const struct aucodec *ac;  /* Real codec                */
+	struct frame *framev;      /* Shared payload            */
+	size_t framec;
+	uint32_t ptime;            /* Packet-time of the payload */
+	int16_t *silence;          /* Samples of the source     */
+	int16_t *scratch;          /* Samples of the player     */
+	size_t sampc;
+	struct ausrc *ausrc;
+	struct auplay *auplay;
+
+	struct hash *calls;        /* struct lcall, by call     */
+	uint32_t ncalls;
+	struct tmr tmr;
+	uint64_t t0;
+	uint64_t due;              /* Calls placed or skipped   */
+	bool run;
+	struct stats st;
+
+	char uri[256];
+	char codec_name[64];
+	uint32_t cps;
+	uint32_t max_calls;
+	uint32_t hold;
+	uint32_t total;
+} lg = {
+	.uri        = "sip:load@127.0.0.1",
+	.codec_name = "PCMU",
+	.cps        = 10,
+	.max_calls  = 100,
+	.hold       = 30,
+};
+
+
+static void loadgen_stop(void);
+
+
+/*
+ * Shared payload
+ */
+
+
+static int payload_encode(struct auenc_param *prm, const char *fmtp)
+{
+	const struct aucodec *ac = lg.ac;
+	struct auenc_state *aes = NULL;
+	const uint32_t ptime = ac->ptime ? ac->ptime : prm->ptime;
+	const size_t sampc = ac->srate * ac->ch * ptime / 1000;
+	int16_t *sampv;
+	size_t i, j;
+	int err = 0;
+
+	if (!ptime || !sampc)
+		return EINVAL;
+
+	sampv = mem_alloc(sampc * sizeof(int16_t), NULL);
+	lg.framec = PAYLOAD_DUR / ptime;
+	lg.framev = mem_zalloc(lg.framec * sizeof(*lg.framev), NULL);
+	if (!sampv || !lg.framev) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	if (ac->encupdh) {
+		err = ac->encupdh(&aes, ac, prm, fmtp);
+		if (err)
+			goto out;
+	}
+
+	/* low level noise */
+	for (i=0; i<lg.framec; i++) {
+
+		struct frame *fr = &lg.framev[i];
+
+		for (j=0; j<sampc; j++)
+			sampv[j] = (int16_t)(rand_u16() >> 6) - 512;
+
+		fr->len = sizeof(fr->buf);
+
+		err = ac->ench(aes, fr->buf, &fr->len, sampv, sampc);
+		if (err)
+			goto out;
+	}
+
+	lg.ptime = prm->ptime;
+
+	info("loadgen: %zu frames of %s encoded (%u ms)\n",
+	     lg.framec, ac->name, ptime);
+
+ out:
+	if (err) {
+		lg.framev = mem_deref(lg.framev);
+		lg.framec = 0;
+	}
+	mem_deref(aes);
+	mem_deref(sampv);
+
+	return err;
+}
+
+
+static void enc_destructor(void *arg)
+{
+	struct auenc_state *aes = arg;
+
+	mem_deref(aes->enc);
+}
+
+
+static int enc_update(struct auenc_state **aesp, const struct aucodec *ac,
+		      struct auenc_param *prm, const char *fmtp)
+{
+	struct auenc_state *aes;
+	int err = 0;
+	(void)ac;
+
+	if (!aesp || !prm)
+		return EINVAL;
+
+	if (!lg.framec) {
+		err = payload_encode(prm, fmtp);
+		if (err)
+			warning("loadgen: encode of payload failed (%m)\n",
+				err);
+	}
+
+	aes = *aesp;
+	if (!aes) {
+		aes = mem_zalloc(sizeof(*aes), enc_destructor);
+		if (!aes)
+			return ENOMEM;
+
+		aes->pos = rand_u16();
+		*aesp = aes;
+	}
+
+	/* another packet-time is encoded per call */
+	if (!lg.framec || prm->ptime != lg.ptime)
+		aes->own = true;
+
+	if (aes->own && lg.ac->encupdh)
+		err = lg.ac->encupdh(&aes->enc, lg.ac, prm, fmtp);
+
+	return err;
+}
+
+
+static int enc_encode(struct auenc_state *aes, uint8_t *buf,
+		      size_t *len, const int16_t *sampv, size_t sampc)
+{
+	const struct frame *fr;
+
+	if (!aes || !buf || !len)
+		return EINVAL;
+
+	if (aes->own)
+		return lg.ac->ench(aes->enc, buf, len, sampv, sampc);
+
+	fr = &lg.framev[aes->pos++ % lg.framec];
+
+	if (*len < fr->len)
+		return ENOMEM;
+
+	memcpy(buf, fr->buf, fr->len);
+	*len = fr->len;
+
+	return 0;
+}
+
+
+/* The copy takes the place of the real codec in the codec list */
+static int codec_replace(void)
+{
+	struct list *aucodecl = aucodec_list();
+	const struct aucodec *ac;
+
+	ac = aucodec_find(lg.codec_name, 0, 0);
+	if (!ac) {
+		warning("loadgen: codec not found: %s\n", lg.codec_name);
+		return ENOENT;
+	}
+
+	if (!ac->ench) {
+		warning("loadgen: codec %s cannot encode\n", ac->name);
+		return ENOTSUP;
+	}
+
+	lg.ac            = ac;
+	lg.codec         = *ac;
+	lg.codec.encupdh = enc_update;
+	lg.codec.ench    = enc_encode;
+	memset(&lg.codec.le, 0, sizeof(lg.codec.le));
+
+	/* registered for the generation, then moved in front */
+	aucodec_register(&lg.codec);
+	list_unlink(&lg.codec.le);
+	list_insert_before(aucodecl, (struct le *)&ac->le,
+			   &lg.codec.le, &lg.codec);
+
+	return 0;
+}
+
+
+/*
+ * Audio source and player, from the media clock
+ */
+
+
+/* The sources and players share the samples, on the main loop */
+static int samples_reserve(size_t sampc)
+{
+	int16_t *silence, *scratch;
+
+	if (sampc <= lg.sampc)
+		return 0;
+
+	silence = mem_zalloc(sampc * sizeof(int16_t), NULL);
+	scratch = mem_zalloc(sampc * sizeof(int16_t), NULL);
+	if (!silence || !scratch) {
+		mem_deref(silence);
+		mem_deref(scratch);
+		return ENOMEM;
+	}
+
+	mem_deref(lg.silence);
+	mem_deref(lg.scratch);
+	lg.silence = silence;
+	lg.scratch = scratch;
+	lg.sampc   = sampc;
+
+	return 0;
+}
+
+
+static void ausrc_destructor(void *arg)
+{
+	struct ausrc_st *st = arg;
+
+	mclock_tmr_cancel(&st->tmr);
+}
+
+
+static void auplay_destructor(void *arg)
+{
+	struct auplay_st *st = arg;
+
+	mclock_tmr_cancel(&st->tmr);
+}
+
+
+static void ausrc_tmr_handler(void *arg)
+{
+	struct ausrc_st *st = arg;
+
+	mclock_tmr_start(&st->tmr, st->ptime, ausrc_tmr_handler, st);
+
+	st->rh(lg.silence, st->sampc, st->arg);
+}
+
+
+static void auplay_tmr_handler(void *arg)
+{
+	struct auplay_st *st = arg;
+
+	mclock_tmr_start(&st->tmr, st->ptime, auplay_tmr_handler, st);
+
+	st->wh(lg.scratch, st->sampc, st->arg);
+}
+
+
+static int src_alloc(struct ausrc_st **stp, const struct ausrc *as,
+		     struct media_ctx **ctx,
+		     struct ausrc_prm *prm, const char *device,
+		     ausrc_read_h *rh, ausrc_error_h *errh, void *arg)
+{
+	struct ausrc_st *st;
+	int err;
+	(void)ctx;
+	(void)device;
+	(void)errh;
+
+	if (!stp || !as || !prm || !prm->ptime || !rh)
+		return EINVAL;
+
+	st = mem_zalloc(sizeof(*st), ausrc_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->as    = as;
+	st->ptime = prm->ptime;
+	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
+	st->rh    = rh;
+	st->arg   = arg;
+
+	err = samples_reserve(st->sampc);
+	if (err) {
+		mem_deref(st);
+		return err;
+	}
+
+	mclock_tmr_start(&st->tmr, st->ptime, ausrc_tmr_handler, st);
+
+	*stp = st;
+
+	return 0;
+}
+
+
+static int play_alloc(struct auplay_st **stp, const struct auplay *ap,
+		      struct auplay_prm *prm, const char *device,
+		      auplay_write_h *wh, void *arg)
+{
+	struct auplay_st *st;
+	int err;
+	(void)device;
+
+	if (!stp || !ap || !prm || !prm->ptime || !wh)
+		return EINVAL;
+
+	st = mem_zalloc(sizeof(*st), auplay_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->ap    = ap;
+	st->ptime = prm->ptime;
+	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
+	st->wh    = wh;
+	st->arg   = arg;
+
+	err = samples_reserve(st->sampc);
+	if (err) {
+		mem_deref(st);
+		return err;
+	}
+
+	mclock_tmr_start(&st->tmr, st->ptime, auplay_tmr_handler, st);
+
+	*stp = st;
+
+	return 0;
+}
+
+
+/*
+ * Calls
+ */
+
+
+static uint32_t call_hash(const struct call *call)
+{
+	return hash_joaat((const uint8_t *)&call, sizeof(call));
+}
+
+
+static bool call_cmp_handler(struct le *le, void *arg)
+{
+	const struct lcall *lc = le->data;
+
+	return lc->call == arg;
+}
+
+
+static struct lcall *lcall_find(const struct call *call)
+{
+	return list_ledata(hash_lookup(lg.calls, call_hash(call),
+				       call_cmp_handler, (void *)call));
+}
+
+
+static void lcall_destructor(void *arg)
+{
+	struct lcall *lc = arg;
+
+	tmr_cancel(&lc->tmr);
+	hash_unlink(&lc->he);
+	--lg.ncalls;
+}
+
+
+static void call_stats(const struct call *call)
+{
+	const struct stream *s = audio_strm(call_audio(call));
+	const struct rtcp_stats *rtcp = stream_rtcp_stats(s);
+	struct stream_stat tx, rx;
+	double mos;
+
+	if (0 == stream_stats(s, &tx, &rx)) {
+		lg.st.tx_packets += tx.n_packets;
+		lg.st.rx_packets += rx.n_packets;
+	}
+
+	if (!rtcp || !(rtcp->tx.sent || rtcp->rx.sent))
+		return;
+
+	mos = mos_calculate(NULL, rtcp->rtt / 1000.0, rtcp->rx.jit / 1000.0,
+			    rtcp->rx.lost > 0 ? rtcp->rx.lost : 0);
+
+	histo_add(&lg.st.mos, (uint32_t)(mos * 100));
+	histo_add(&lg.st.jitter, rtcp->rx.jit);
+
+	if (rtcp->rx.lost > 0)
+		lg.st.lost += rtcp->rx.lost;
+}
+
+
+static void hold_handler(void *arg)
+{
+	struct lcall *lc = arg;
+
+	/* the call is closed and lc freed by the event handler */
+	ua_hangup(lc->ua, lc->call, 0, NULL);
+}
+
+
+static void call_place(void)
+{
+	struct ua *ua = uag_current();
+	struct lcall *lc;
+	int err;
+
+	lc = mem_zalloc(sizeof(*lc), lcall_destructor);
+	if (!lc) {
+		++lg.st.failed;
+		return;
+	}
+
+	++lg.ncalls;
+	lc->ua    = ua;
+	lc->start = tmr_jiffies();
+
+	err = ua_connect(ua, &lc->call, NULL, lg.uri, NULL, VIDMODE_OFF);
+	if (err) {
+		debug("loadgen: ua_connect failed (%m)\n", err);
+		++lg.st.failed;
+		mem_deref(lc);
+		return;
+	}
+
+	hash_append(lg.calls, call_hash(lc->call), &lc->he, lc);
+	++lg.st.placed;
+}
+
+
+static void tmr_handler(void *arg)
+{
+	uint64_t due;
+	(void)arg;
+
+	tmr_start(&lg.tmr, TICK, tmr_handler, NULL);
+
+	due = (tmr_jiffies() - lg.t0) * lg.cps / 1000 + 1;
+	if (lg.total)
+		due = min(due, lg.total);
+
+	for (; lg.due < due; lg.due++) {
+
+		if (lg.ncalls >= lg.max_calls) {
+			++lg.st.skipped;
+			continue;
+		}
+
+		call_place();
+	}
+
+	if (lg.total && lg.due >= lg.total && !lg.ncalls) {
+		info("loadgen: all %u calls done\n", lg.total);
+		loadgen_stop();
+	}
+}
+
+
+static void ua_event_handler(struct ua *ua, enum ua_event ev,
+			     struct call *call, const char *prm, void *arg)
+{
+	struct lcall *lc;
+	(void)ua;
+	(void)arg;
+
+	if (!call || !lg.ncalls)
+		return;
+
+	lc = lcall_find(call);
+	if (!lc)
+		return;
+
+	switch (ev) {
+
+	case UA_EVENT_CALL_ESTABLISHED:
+		lc->established = true;
+		++lg.st.established;
+		histo_add(&lg.st.setup, (uint32_t)(tmr_jiffies() - lc->start));
+		tmr_start(&lc->tmr, lg.hold * 1000, hold_handler, lc);
+		break;
+
+	case UA_EVENT_CALL_CLOSED:
+		if (lc->established) {
+			call_stats(call);
+		}
+		else {
+			debug("loadgen: call failed: %s\n", prm);
+			++lg.st.failed;
+		}
+		mem_deref(lc);
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+/*
+ * Commands
+ */
+
+
+static int print_stats(struct re_printf *pf, void *unused)
+{
+	const struct stats *st = &lg.st;
+	const struct histo *mos = &st->mos;
+	int err;
+	(void)unused;
+
+	err  = re_hprintf(pf, "loadgen: %s, %u calls to %s\n",
+			  lg.run ? "running" : "stopped", lg.ncalls, lg.uri);
+	err |= re_hprintf(pf, "  calls:  placed=%u established=%u"
+			  " failed=%u skipped=%u\n",
+			  st->placed, st->established, st->failed,
+			  st->skipped);
+	err |= re_hprintf(pf, "  setup:  p50=%u p90=%u p99=%u max=%u [ms]\n",
+			  histo_percentile(&st->setup, 50),
+			  histo_percentile(&st->setup, 90),
+			  histo_percentile(&st->setup, 99),
+			  histo_max(&st->setup));
+	err |= re_hprintf(pf, "  mos:    mean=%u.%02u p10=%u.%02u"
+			  " (%llu calls)\n",
+			  histo_mean(mos) / 100, histo_mean(mos) % 100,
+			  histo_percentile(mos, 10) / 100,
+			  histo_percentile(mos, 10) % 100,
+			  histo_count(mos));
+	err |= re_hprintf(pf, "  jitter: p50=%u p99=%u [us]\n",
+			  histo_percentile(&st->jitter, 50),
+			  histo_percentile(&st->jitter, 99));
+	err |= re_hprintf(pf, "  rtp:    tx=%llu rx=%llu lost=%llu\n",
+			  st->tx_packets, st->rx_packets, st->lost);
+
+	return err;
+}
+
+
+static bool hangup_handler(struct le *le, void *arg)
+{
+	struct lcall *lc = le->data;
+	(void)arg;
+
+	ua_hangup(lc->ua, lc->call, 0, NULL);
+
+	return false;
+}
+
+
+static void loadgen_stop(void)
+{
+	tmr_cancel(&lg.tmr);
+	lg.run = false;
+
+	/* the event handler frees the calls */
+	hash_apply(lg.calls, hangup_handler, NULL);
+
+	info("%H", print_stats, NULL);
+}
+
+
+static int cmd_start(struct re_printf *pf, void *arg)
+{
+	const struct cmd_arg *carg = arg;
+
+	if (lg.run)
+		return re_hprintf(pf, "loadgen: already running\n");
+
+	if (!uag_current())
+		return re_hprintf(pf, "loadgen: no User-Agent\n");
+
+	if (str_isset(carg->prm))
+		str_ncpy(lg.uri, carg->prm, sizeof(lg.uri));
+
+	memset(&lg.st, 0, sizeof(lg.st));
+	lg.t0  = tmr_jiffies();
+	lg.due = 0;
+	lg.run = true;
+
+	tmr_start(&lg.tmr, 0, tmr_handler, NULL);
+
+	return re_hprintf(pf, "loadgen: %u calls/s to %s, max %u calls,"
+			  " hold %u s\n",
+			  lg.cps, lg.uri, lg.max_calls, lg.hold);
+}
+
+
+static int cmd_stop(struct re_printf *pf, void *arg)
+{
+	(void)pf;
+	(void)arg;
+
+	if (lg.run)
+		loadgen_stop();
+
+	return 0;
+}
+
+
+static int cmd_stats(struct re_printf *pf, void *arg)
+{
+	return print_stats(pf, arg);
+}
+
+
+static const struct cmd cmdv[] = {
+	{'K', CMD_PRM, "Start load generator", cmd_start },
+	{'k',       0, "Stop load generator",  cmd_stop  },
+	{'W',       0, "Load generator stats", cmd_stats },
+};
+
+
+static int module_init(void)
+{
+	struct conf *conf = conf_cur();
+	int err;
+
+	conf_get_str(conf, "loadgen_uri", lg.uri, sizeof(lg.uri));
+	conf_get_str(conf, "loadgen_codec", lg.codec_name,
+		     sizeof(lg.codec_name));
+	conf_get_u32(conf, "loadgen_cps", &lg.cps);
+	conf_get_u32(conf, "loadgen_max_calls", &lg.max_calls);
+	conf_get_u32(conf, "loadgen_hold", &lg.hold);
+	conf_get_u32(conf, "loadgen_calls", &lg.total);
+
+	if (!lg.cps || !lg.max_calls) {
+		warning("loadgen: cps and max_calls must be set\n");
+		return EINVAL;
+	}
+
+	err  = hash_alloc(&lg.calls, HASH_SIZE);
+	err |= ausrc_register(&lg.ausrc, "loadgen", src_alloc);
+	err |= auplay_register(&lg.auplay, "loadgen", play_alloc);
+	err |= uag_event_register(ua_event_handler, NULL);
+	err |= cmd_register(cmdv, ARRAY_SIZE(cmdv));
+	if (err)
+		return err;
+
+	/* without it, the calls encode their own audio */
+	(void)codec_replace();
+
+	return 0;
+}
+
+
+static int module_close(void)
+{
+	if (lg.run)
+		loadgen_stop();
+
+	cmd_unregister(cmdv);
+	uag_event_unregister(ua_event_handler);
+
+	if (lg.ac) {
+		aucodec_unregister(&lg.codec);
+		lg.ac = NULL;
+	}
+
+	lg.ausrc   = mem_deref(lg.ausrc);
+	lg.auplay  = mem_deref(lg.auplay);
+	lg.calls   = mem_deref(lg.calls);
+	lg.framev  = mem_deref(lg.framev);
+	lg.framec  = 0;
+	lg.silence = mem_deref(lg.silence);
+	lg.scratch = mem_deref(lg.scratch);
+	lg.sampc   = 0;
+
+	return 0;
+}
+
+
+EXPORT_SYM const struct mod_export DECL_EXPORTS(loadgen) = {
+	"loadgen",
+	"application",
+	module_init,
+	module_close,
+};
@@ -0,0 +1,10 @@
+#
+# module.mk
+#
+# Copyright (C) 2010 Creytiv.com
+#
+
+MOD		:= loadgen
+$(MOD)_SRCS	+= loadgen.c
+
+include mk/mod.mk
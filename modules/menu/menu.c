@@ -4,6 +4,10 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <time.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 #include <re.h>
 #include <baresip.h>
 
@@ -15,9 +19,40 @@
  *
  * This module must be loaded if you want to use the interactive menu
  * to control the Baresip application.
+ *
+ * The status line of the current call is only printed again when the
+ * duration, the hold state or a bitrate of the call has changed. The
+ * formatted lines of each call are cached, also for the list of calls.
+ * Without a console on stderr the status line is off by default.
+ *
+ * Example config:
+ \verbatim
+  menu_bell               yes      # ring the bell on incoming calls
+  menu_status_interval    100      # status line check [ms], 0 is off
+ \endverbatim
  */
 
 
+enum {
+	STATUS_INTERVAL = 100,    /* [ms] */
+	LINE_SIZE       = 256,
+	KEY_STREAMS     = 4,
+	HASH_SIZE       = 64,
+};
+
+
+/** Formatted lines of a call, and the values they were formatted from */
+struct call_line {
+	struct le he;
+	const struct call *call;
+	uint32_t key[2 + 2 * KEY_STREAMS];
+	bool status_dirty;
+	bool info_dirty;
+	char status[LINE_SIZE];
+	char info[LINE_SIZE];
+};
+
+
 /** Defines the status modes */
 enum statmode {
 	STATMODE_CALL = 0,
@@ -35,6 +70,9 @@ static struct le *le_cur;             /**< Current User-Agent (struct ua) */
 
 static struct {
 	struct play *play;
+	struct hash *lines;                /**< struct call_line by call  */
+	const struct call *stat_call;      /**< Call of the status line   */
+	uint32_t stat_interval;            /**< Status line check [ms]    */
 	bool bell;
 } menu;
 
@@ -112,6 +150,116 @@ static bool have_active_calls(void)
 }
 
 
+static uint32_t call_hash(const struct call *call)
+{
+	return hash_joaat((const uint8_t *)&call, sizeof(call));
+}
+
+
+static bool line_cmp_handler(struct le *le, void *arg)
+{
+	const struct call_line *cl = le->data;
+
+	return cl->call == arg;
+}
+
+
+static void line_destructor(void *arg)
+{
+	struct call_line *cl = arg;
+
+	hash_unlink(&cl->he);
+}
+
+
+static struct call_line *call_line_find(const struct call *call)
+{
+	return list_ledata(hash_lookup(menu.lines, call_hash(call),
+				       line_cmp_handler, (void *)call));
+}
+
+
+static struct call_line *call_line_get(const struct call *call)
+{
+	struct call_line *cl = call_line_find(call);
+
+	if (cl || !menu.lines)
+		return cl;
+
+	cl = mem_zalloc(sizeof(*cl), line_destructor);
+	if (!cl)
+		return NULL;
+
+	cl->call = call;
+	cl->status_dirty = true;
+	cl->info_dirty = true;
+
+	hash_append(menu.lines, call_hash(call), &cl->he, cl);
+
+	return cl;
+}
+
+
+/*
+ * Compare the values that are printed in the lines with the cached
+ * ones, without formatting anything.
+ *
+ * @return true if the lines have changed
+ */
+static bool call_line_refresh(struct call_line *cl)
+{
+	uint32_t key[ARRAY_SIZE(cl->key)];
+	struct le *le;
+	size_t i = 2;
+
+	memset(key, 0, sizeof(key));
+
+	key[0] = call_duration(cl->call);
+	key[1] = call_is_onhold(cl->call);
+
+	for (le = list_head(call_streaml(cl->call));
+	     le && i < ARRAY_SIZE(key); le = le->next) {
+
+		struct stream_stat tx, rx;
+
+		if (stream_stats(le->data, &tx, &rx))
+			continue;
+
+		key[i++] = tx.bitrate;
+		key[i++] = rx.bitrate;
+	}
+
+	if (!memcmp(key, cl->key, sizeof(key)))
+		return false;
+
+	memcpy(cl->key, key, sizeof(key));
+	cl->status_dirty = true;
+	cl->info_dirty = true;
+
+	return true;
+}
+
+
+/* A call has changed state, or is gone */
+static void call_line_invalidate(const struct call *call, bool closed)
+{
+	struct call_line *cl = call_line_find(call);
+
+	if (!cl)
+		return;
+
+	if (closed) {
+		if (menu.stat_call == call)
+			menu.stat_call = NULL;
+		mem_deref(cl);
+		return;
+	}
+
+	cl->status_dirty = true;
+	cl->info_dirty = true;
+}
+
+
 static int print_system_info(struct re_printf *pf, void *arg)
 {
 	uint32_t uptime;
@@ -417,8 +565,41 @@ static int cmd_ua_debug(struct re_printf *pf, void *unused)
 
 static int cmd_print_calls(struct re_printf *pf, void *unused)
 {
+	struct ua *ua = uag_cur();
+	struct le *le;
+	int err = 0;
 	(void)unused;
-	return ua_print_calls(pf, uag_cur());
+
+	if (!ua || !menu.lines)
+		return ua_print_calls(pf, ua);
+
+	err |= re_hprintf(pf, "\n--- List of active calls (%u): ---\n",
+			  list_count(ua_calls(ua)));
+
+	for (le = list_head(ua_calls(ua)); le; le = le->next) {
+
+		const struct call *call = le->data;
+		struct call_line *cl = call_line_get(call);
+
+		if (!cl) {
+			err |= re_hprintf(pf, "  %H\n", call_info, call);
+			continue;
+		}
+
+		call_line_refresh(cl);
+
+		if (cl->info_dirty) {
+			(void)re_snprintf(cl->info, sizeof(cl->info), "%H",
+					  call_info, call);
+			cl->info_dirty = false;
+		}
+
+		err |= re_hprintf(pf, "  %s\n", cl->info);
+	}
+
+	err |= re_hprintf(pf, "\n");
+
+	return err;
 }
 
 
@@ -481,6 +662,13 @@ static int call_audio_debug(struct re_printf *pf, void *unused)
 }
 
 
+static int call_memory(struct re_printf *pf, void *unused)
+{
+	(void)unused;
+	return call_memstat(pf, ua_call(uag_cur()));
+}
+
+
 static int call_audioenc_cycle(struct re_printf *pf, void *unused)
 {
 	(void)pf;
@@ -698,6 +886,7 @@ static const struct cmd callcmdv[] = {
 	{'H',       0, "Hold previous call",  hold_prev_call        },
 	{'L',       0, "Resume previous call",hold_prev_call        },
 	{'A', CMD_IPRM,"Switch audio device", switch_audio_dev      },
+	{'U',       0, "Call memory usage",   call_memory           },
 
 #ifdef USE_VIDEO
 	{'E',       0, "Cycle video encoder", call_videoenc_cycle   },
@@ -737,6 +926,8 @@ static void menu_set_incall(bool incall)
 static void tmrstat_handler(void *arg)
 {
 	struct call *call;
+	struct call_line *cl;
+	bool changed;
 	(void)arg;
 
 	/* the UI will only show the current active call */
@@ -744,24 +935,42 @@ static void tmrstat_handler(void *arg)
 	if (!call)
 		return;
 
-	tmr_start(&tmr_stat, 100, tmrstat_handler, 0);
+	tmr_start(&tmr_stat, menu.stat_interval, tmrstat_handler, 0);
 
-	if (ui_isediting())
+	if (ui_isediting() || STATMODE_OFF == statmode)
 		return;
 
-	if (STATMODE_OFF != statmode) {
+	cl = call_line_get(call);
+	if (!cl) {
 		(void)re_fprintf(stderr, "%H\r", call_status, call);
+		return;
 	}
+
+	changed = call_line_refresh(cl);
+	if (!changed && !cl->status_dirty && menu.stat_call == call)
+		return;
+
+	if (cl->status_dirty) {
+		(void)re_snprintf(cl->status, sizeof(cl->status), "%H",
+				  call_status, call);
+		cl->status_dirty = false;
+	}
+
+	(void)re_fprintf(stderr, "%s\r", cl->status);
+	menu.stat_call = call;
 }
 
 
 static void update_callstatus(void)
 {
 	/* if there are any active calls, enable the call status view */
-	if (have_active_calls())
-		tmr_start(&tmr_stat, 100, tmrstat_handler, 0);
+	if (menu.stat_interval && have_active_calls())
+		tmr_start(&tmr_stat, menu.stat_interval, tmrstat_handler, 0);
 	else
 		tmr_cancel(&tmr_stat);
+
+	/* print the status line at the next check */
+	menu.stat_call = NULL;
 }
 
 
@@ -793,10 +1002,12 @@ static void alert_stop(void)
 static void ua_event_handler(struct ua *ua, enum ua_event ev,
 			     struct call *call, const char *prm, void *arg)
 {
-	(void)call;
 	(void)prm;
 	(void)arg;
 
+	if (call)
+		call_line_invalidate(call, ev == UA_EVENT_CALL_CLOSED);
+
 	switch (ev) {
 
 	case UA_EVENT_CALL_INCOMING:
@@ -893,6 +1104,19 @@ static int module_init(void)
 
 	conf_get_bool(conf_cur(), "menu_bell", &menu.bell);
 
+	/* no status line without a console, unless it was configured */
+	menu.stat_interval = STATUS_INTERVAL;
+#ifdef HAVE_UNISTD_H
+	if (!isatty(STDERR_FILENO))
+		menu.stat_interval = 0;
+#endif
+	conf_get_u32(conf_cur(), "menu_status_interval",
+		     &menu.stat_interval);
+
+	err = hash_alloc(&menu.lines, HASH_SIZE);
+	if (err)
+		return err;
+
 	dialbuf = mbuf_alloc(64);
 	if (!dialbuf)
 		return ENOMEM;
@@ -903,7 +1127,7 @@ static int module_init(void)
 	statmode = STATMODE_CALL;
 
 	err  = cmd_register(cmdv, ARRAY_SIZE(cmdv));
-	err |= uag_event_register(ua_event_handler, NULL);
+	err |= uag_event_subscribe(ua_event_handler, NULL, 0, 64);
 
 	err |= message_init(message_handler, NULL);
 
@@ -922,6 +1146,10 @@ static int module_close(void)
 	tmr_cancel(&tmr_stat);
 	dialbuf = mem_deref(dialbuf);
 
+	hash_flush(menu.lines);
+	menu.lines = mem_deref(menu.lines);
+	menu.stat_call = NULL;
+
 	le_cur = NULL;
 
 	menu.play = mem_deref(menu.play);
@@ -7,16 +7,22 @@
 #include <re.h>
 #include <baresip.h>
 #include <mpg123.h>
-#include <speex/speex_resampler.h>
 #include <string.h>
 #include "mpa.h"
 
+
+/*
+ * A packet may have several frames, and all of them are decoded. The
+ * frames are converted to 48 kHz stereo with the shared resampler, if
+ * the stream has another format.
+ */
+
+
 struct audec_state {
 	mpg123_handle *dec;
-	SpeexResamplerState *resampler;
+	struct resamp *rs;
 	int channels;
 	int16_t intermediate_buffer[MPA_FRAMESIZE*2];
-	int start;
 };
 
 
@@ -24,8 +30,7 @@ static void destructor(void *arg)
 {
 	struct audec_state *ads = arg;
 
-	if (ads->resampler)
-		speex_resampler_destroy(ads->resampler);
+	mem_deref(ads->rs);
 
 	mpg123_close(ads->dec);
 	mpg123_delete(ads->dec);
@@ -51,17 +56,13 @@ int mpa_decode_update(struct audec_state **adsp, const struct aucodec *ac,
 	debug("MPA dec created %s\n",fmtp);
 #endif
 
-	if (!ads) {
-		ads = mem_zalloc(sizeof(*ads), destructor);
-		if (!ads)
-			return ENOMEM;
-	}
-	else {
-		memset(ads,0,sizeof(*ads));
-	}
-	ads->channels = 0;
-	ads->resampler = NULL;
-	ads->start = 0;
+	/* the stream format is in the frames, nothing to update */
+	if (ads)
+		return 0;
+
+	ads = mem_zalloc(sizeof(*ads), destructor);
+	if (!ads)
+		return ENOMEM;
 
 	ads->dec = mpg123_new(NULL,&result);
 	if (!ads->dec) {
@@ -111,14 +112,35 @@ int mpa_decode_update(struct audec_state **adsp, const struct aucodec *ac,
 }
 
 
+static int format_change(struct audec_state *ads)
+{
+	int channels, encoding, err;
+	long samplerate;
+
+	mpg123_getformat(ads->dec, &samplerate, &channels, &encoding);
+	info("MPA dec format change %ld %d %04X\n",samplerate
+		,channels,encoding);
+
+	ads->channels = channels;
+	ads->rs = mem_deref(ads->rs);
+
+	if (samplerate == MPA_IORATE && channels == 2)
+		return 0;
+
+	err = resamp_alloc(&ads->rs, conf_config()->audio.resamp,
+			   (uint32_t)samplerate, channels, MPA_IORATE, 2);
+	if (err)
+		error("MPA dec resampler failed (%m)\n", err);
+
+	return err;
+}
+
+
 int mpa_decode_frm(struct audec_state *ads, int16_t *sampv, size_t *sampc,
 		    const uint8_t *buf, size_t len)
 {
-	int result, channels, encoding, i;
-	long samplerate;
-	size_t n;
-	spx_uint32_t intermediate_len;
-	spx_uint32_t out_len;
+	size_t outc = 0;
+	int result;
 
 #ifdef DEBUG
 	debug("MPA dec start %d %ld\n",len, *sampc);
@@ -133,85 +155,69 @@ int mpa_decode_frm(struct audec_state *ads, int16_t *sampv, size_t *sampc,
 		return EPROTO;
 	}
 
-	n = 0;
-	result = mpg123_decode(ads->dec, buf+4, len-4,
-				(unsigned char*)ads->intermediate_buffer,
-				sizeof(ads->intermediate_buffer), &n);
-				/* n counts bytes */
-#ifdef DEBUG
-	debug("MPA dec %d %d %d %d\n",result, len-4, n, ads->channels);
-#endif
-
-	if (result == MPG123_NEW_FORMAT) {
-		mpg123_getformat(ads->dec, &samplerate, &channels, &encoding);
-		info("MPA dec format change %d %d %04X\n",samplerate
-			,channels,encoding);
-
-		ads->channels = channels;
-		ads->start = 0;
-		if (ads->resampler)
-			speex_resampler_destroy(ads->resampler);
-		if (samplerate != MPA_IORATE) {
-			ads->resampler = speex_resampler_init(channels,
-				      (uint32_t)samplerate, MPA_IORATE,
-				      3, &result);
-			if (result!=RESAMPLER_ERR_SUCCESS
-				|| ads->resampler==NULL) {
-				error("MPA dec upsampler failed %d\n",result);
-				return EINVAL;
-			}
-		}
-		else
-			ads->resampler = NULL;
-	}
-	else if (result == MPG123_NEED_MORE)
-		;			/* workaround: do nothing */
-	else if (result != MPG123_OK) {
+	result = mpg123_feed(ads->dec, buf+4, len-4);
+	if (result != MPG123_OK) {
 		error("MPA dec feed error %d %s\n", result,
 			mpg123_plain_strerror(result));
 		return EPROTO;
 	}
 
-	if (ads->resampler)  {
-		intermediate_len = (uint32_t)(n / 2 / ads->channels);
-			/* intermediate_len counts samples per channel */
-		out_len = (uint32_t)(*sampc / 2);
-
-		result=speex_resampler_process_interleaved_int(
-			ads->resampler, ads->intermediate_buffer,
-			&intermediate_len, sampv, &out_len);
-		if (result!=RESAMPLER_ERR_SUCCESS) {
-			error("MPA dec upsample error: %s %d %d\n",
-				strerror(result), out_len, *sampc/2);
-			return EPROTO;
+	/* all frames of the packet */
+	for (;;) {
+		size_t n = 0, room = *sampc - outc;
+		int err;
+
+		result = mpg123_read(ads->dec,
+				     (unsigned char *)ads->intermediate_buffer,
+				     sizeof(ads->intermediate_buffer), &n);
+				/* n counts bytes */
+
+		if (result == MPG123_NEW_FORMAT) {
+			err = format_change(ads);
+			if (err)
+				return err;
 		}
-		if (ads->channels==1) {
-			for (i=out_len-1;i>=0;i--)
-				sampv[i+i+1]=sampv[i+i]=sampv[i];
-			*sampc = out_len * 2;
+		else if (result == MPG123_NEED_MORE) {
+			break;
 		}
-		else
-			*sampc = out_len * ads->channels;
-	}
-	else {
+		else if (result != MPG123_OK) {
+			error("MPA dec read error %d %s\n", result,
+				mpg123_plain_strerror(result));
+			return EPROTO;
+		}
+
 		n /= 2;
-		if (ads->channels!=1) {
-			for (i=0;(unsigned)i<n;i++)
-				sampv[i]=ads->intermediate_buffer[i];
-			*sampc = n;
+		if (!n)
+			continue;
+
+		if (ads->rs) {
+			err = resamp_process(ads->rs, sampv + outc, &room,
+					     ads->intermediate_buffer, n);
+			if (err) {
+				error("MPA dec resample error: %m\n", err);
+				return err;
+			}
+
+			outc += room;
 		}
 		else {
-			for (i=0;(unsigned)i<n;i++)
-				sampv[i*2]=sampv[i*2+1]=
-					ads->intermediate_buffer[i];
-			*sampc = n * 2;
+			if (n > room) {
+				error("MPA dec %zu samples, room for %zu\n",
+				      n, room);
+				return ENOMEM;
+			}
+
+			memcpy(sampv + outc, ads->intermediate_buffer,
+			       n * sizeof(int16_t));
+			outc += n;
+		}
 	}
 
+	*sampc = outc;
+
 #ifdef DEBUG
 	debug("MPA dec done %d\n",*sampc);
 #endif
-	}
 
 	return 0;
 }
-
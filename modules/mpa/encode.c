@@ -8,15 +8,28 @@
 #include <baresip.h>
 #include <twolame.h>
 #include <string.h>
-#include <speex/speex_resampler.h>
 #include "mpa.h"
 
+
+/*
+ * The encoder gets 48 kHz stereo, resampled to the MPEG sample rate if
+ * it is another one. TwoLAME writes a frame whenever it has 1152 samples
+ * per channel, so a call writes no frame, one or several of them, and
+ * all of them go into one RTP packet. The RTP duration of the frames is
+ * reported by mpa_encode_dur(), so the packets have the timestamp of
+ * their first frame.
+ */
+
+
 struct auenc_state {
 	twolame_options *enc;
 	int channels, samplerate;
-	SpeexResamplerState *resampler;
-	int16_t intermediate_buffer[MPA_FRAMESIZE*6];
-	uint32_t timestamp;
+	struct resamp *rs;
+	int16_t *rsv;                /* resampled input                  */
+	size_t rssz;                 /* size of rsv in [samples]         */
+	uint64_t n_in;               /* samples per channel to TwoLAME   */
+	uint64_t n_frames;           /* frames written                   */
+	uint32_t dur;                /* RTP duration of the last output  */
 };
 
 
@@ -24,10 +37,8 @@ static void destructor(void *arg)
 {
 	struct auenc_state *aes = arg;
 
-	if (aes->resampler) {
-		speex_resampler_destroy(aes->resampler);
-		aes->resampler = NULL;
-	}
+	mem_deref(aes->rs);
+	mem_deref(aes->rsv);
 
 	if (aes->enc)
 		twolame_close(&aes->enc);
@@ -36,6 +47,14 @@ static void destructor(void *arg)
 #endif
 }
 
+
+/* RTP timestamp of the first sample of a frame */
+static uint64_t frame_ts(const struct auenc_state *aes, uint64_t frame)
+{
+	return frame * MPA_FRAMESIZE * MPA_RTPRATE / aes->samplerate;
+}
+
+
 int mpa_encode_update(struct auenc_state **aesp, const struct aucodec *ac,
 		       struct auenc_param *param, const char *fmtp)
 {
@@ -53,22 +72,26 @@ int mpa_encode_update(struct auenc_state **aesp, const struct aucodec *ac,
 		aes = mem_zalloc(sizeof(*aes), destructor);
 		if (!aes)
 			return ENOMEM;
-
 	}
-	else
-		memset(aes,0,sizeof(*aes));
+	else {
+		/* start again with the new parameters */
+		if (aes->enc)
+			twolame_close(&aes->enc);
+		aes->rs = mem_deref(aes->rs);
+		aes->n_in = aes->n_frames = 0;
+		aes->dur = 0;
+	}
 
 	aes->enc = twolame_init();
 	if (!aes->enc) {
 		error("MPA enc create failed\n");
-		mem_deref(aes);
-		return ENOMEM;
+		err = ENOMEM;
+		goto out;
 	}
 #ifdef DEBUG
 	debug("MPA enc created %s\n",fmtp);
 #endif
 	aes->channels = ac->ch;
-	aes->timestamp = rand_u32();
 
 	prm.samplerate = 48000;
 	prm.bitrate    = 128000;
@@ -111,22 +134,18 @@ int mpa_encode_update(struct auenc_state **aesp, const struct aucodec *ac,
 	twolame_print_config(aes->enc);
 #endif
 	if (prm.samplerate != MPA_IORATE) {
-		aes->resampler = speex_resampler_init(2, MPA_IORATE,
-			prm.samplerate, 3, &result);
-		if (result!=RESAMPLER_ERR_SUCCESS) {
-			error("MPA enc resampler init failed %d\n",result);
-			err=EINVAL;
+		err = resamp_alloc(&aes->rs, conf_config()->audio.resamp,
+				   MPA_IORATE, 2, prm.samplerate, 2);
+		if (err) {
+			error("MPA enc resampler init failed (%m)\n", err);
 			goto out;
 		}
-
 	}
-	else
-		aes->resampler = NULL;
 
 out:
-	if (err)
+	if (err && aes != *aesp)
 		mem_deref(aes);
-	else
+	else if (!err)
 		*aesp = aes;
 
 	return err;
@@ -136,59 +155,71 @@ out:
 int mpa_encode_frm(struct auenc_state *aes, uint8_t *buf, size_t *len,
 		    const int16_t *sampv, size_t sampc)
 {
+	const int16_t *inv = sampv;
+	size_t inc = sampc;
+	uint64_t n_frames;
 	int n;
-	spx_uint32_t intermediate_len,in_len;
 
 	if (!aes || !buf || !len || !sampv)
 		return EINVAL;
 
-	if (aes->resampler)  {
-		in_len = (uint32_t)sampc/2;
-		intermediate_len = sizeof(aes->intermediate_buffer)
-			/ sizeof(aes->intermediate_buffer[0]);
-		n=speex_resampler_process_interleaved_int(aes->resampler,
-			sampv, &in_len, aes->intermediate_buffer,
-			&intermediate_len);
-		if (n!=RESAMPLER_ERR_SUCCESS || in_len != sampc/2) {
-			error("MPA enc downsample error: %s %d %d\n",
-				strerror(n), in_len, sampc/2);
-			return EPROTO;
+	if (*len <= 4)
+		return ENOMEM;
+
+	if (aes->rs) {
+		size_t sz = resamp_outc(aes->rs, sampc);
+		int err;
+
+		if (sz > aes->rssz) {
+			int16_t *rsv = mem_realloc(aes->rsv,
+						   sz * sizeof(*rsv));
+			if (!rsv)
+				return ENOMEM;
+
+			aes->rsv  = rsv;
+			aes->rssz = sz;
 		}
-		n = twolame_encode_buffer_interleaved(aes->enc,
-			aes->intermediate_buffer, intermediate_len,
-			buf+4, (int)(*len)-4);
-#ifdef DEBUG
-		debug("MPA enc %d %d %d %d %d %p\n",intermediate_len,sampc,
-			aes->channels,*len,n,aes->enc);
-#endif
+
+		err = resamp_process(aes->rs, aes->rsv, &sz, sampv, sampc);
+		if (err) {
+			error("MPA enc resample error: %m\n", err);
+			return err;
+		}
+
+		inv = aes->rsv;
+		inc = sz;
 	}
-	else {
-		n = twolame_encode_buffer_interleaved(aes->enc,
-			sampv, (int)(sampc/2),
-			buf+4, (int)(*len)-4);
+
+	n = twolame_encode_buffer_interleaved(aes->enc, inv, (int)(inc/2),
+					      buf+4, (int)(*len)-4);
 #ifdef DEBUG
-		debug("MPA enc %d %d %d %d\n",sampc,
-			aes->channels,*len,n);
+	debug("MPA enc %d %d %d %d\n",inc,aes->channels,*len,n);
 #endif
-	}
 	if (n < 0) {
-		error("MPA enc error %s\n", strerror((int)n));
+		error("MPA enc error %d\n", n);
 		return EPROTO;
 	}
 
+	/* TwoLAME writes each frame as soon as it is complete */
+	aes->n_in += inc / 2;
+	n_frames = aes->n_in / MPA_FRAMESIZE;
+
+	aes->dur = (uint32_t)(frame_ts(aes, n_frames) -
+			      frame_ts(aes, aes->n_frames));
+	aes->n_frames = n_frames;
+
 	if (n > 0) {
-		*(uint32_t*)(void *)buf = 0;
+		memset(buf, 0, 4);  /* MBZ and fragmentation offset */
 		*len = n+4;
 	}
 	else
 		*len = 0;
 
-#ifdef DEBUG
-	debug("MPA enc done %d %d %d %d %p\n",sampc,aes->channels,
-		*len,n,aes->enc);
-#endif
-	aes->timestamp += ((MPA_FRAMESIZE*MPA_RTPRATE)<<4) / aes->samplerate;
-
-	return 0x00010000 | ((aes->timestamp>>4) & 0x0000ffff);
+	return 0;
 }
 
+
+uint32_t mpa_encode_dur(const struct auenc_state *aes)
+{
+	return aes ? aes->dur : 0;
+}
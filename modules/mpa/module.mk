@@ -9,6 +9,6 @@ $(MOD)_SRCS	+= mpa.c
 $(MOD)_SRCS	+= decode.c
 $(MOD)_SRCS	+= sdp.c
 $(MOD)_SRCS	+= encode.c
-$(MOD)_LFLAGS	+= -ltwolame -lmpg123 -lspeexdsp -lm
+$(MOD)_LFLAGS	+= -ltwolame -lmpg123 -lm
 
 include mk/mod.mk
@@ -24,6 +24,10 @@
  *
  *    RFC 2250  RTP Payload Format for the mpa Speech and Audio Codec
  *
+ * The frames that are complete after one packet time of audio are sent
+ * in one RTP packet. For broadcast links a longer packet time, such as
+ * "ptime 100" in the config, sends about four frames per packet.
+ *
  */
 
 /*
@@ -88,6 +92,7 @@ static struct aucodec mpa = {
 	.fmtp      = "layer=2",
 	.encupdh   = mpa_encode_update,
 	.ench      = mpa_encode_frm,
+	.durh      = mpa_encode_dur,
 	.decupdh   = mpa_decode_update,
 	.dech      = mpa_decode_frm,
 };
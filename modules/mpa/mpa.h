@@ -7,7 +7,6 @@
 #define MPA_FRAMESIZE 1152
 #define MPA_IORATE 48000
 #define MPA_RTPRATE 90000
-#define BARESIP_FRAMESIZE (MPA_IORATE/50*2)
 
 #undef DEBUG
 
@@ -25,6 +24,7 @@ int mpa_encode_update(struct auenc_state **aesp, const struct aucodec *ac,
 		       struct auenc_param *prm, const char *fmtp);
 int mpa_encode_frm(struct auenc_state *aes, uint8_t *buf, size_t *len,
 		    const int16_t *sampv, size_t sampc);
+uint32_t mpa_encode_dur(const struct auenc_state *aes);
 
 
 /* Decode */
@@ -13,19 +13,37 @@
  *
  * Message Waiting Indication
  *
+ * A UA subscribes to its message summary when it has registered, or at
+ * startup if it does not register. The SUBSCRIBEs go through the
+ * registration scheduler after a random delay, so that a large number
+ * of accounts does not send them all at once. An account with ;mwi=no
+ * does not subscribe.
  */
 
 
+enum {
+	SUBSCRIBE_JITTER = 5000,  /**< Max. delay before subscribing [ms] */
+	SHUTDOWN_DELAY   = 500,   /**< Delay before un-subscribing [ms]   */
+};
+
+
 struct mwi {
-	struct le le;
+	struct le he;
 	struct sipsub *sub;
 	struct ua *ua;
+	struct regsched_job job;
 	struct tmr tmr;
 	bool shutdown;
 };
 
 static struct tmr tmr;
-static struct list mwil;
+static struct hash *mwih;
+
+
+static uint32_t ua_hash(const struct ua *ua)
+{
+	return hash_fast((const char *)&ua, sizeof(ua));
+}
 
 
 static void destructor(void *arg)
@@ -33,7 +51,8 @@ static void destructor(void *arg)
 	struct mwi *mwi = arg;
 
 	tmr_cancel(&mwi->tmr);
-	list_unlink(&mwi->le);
+	regsched_cancel(&mwi->job);
+	hash_unlink(&mwi->he);
 	mem_deref(mwi->sub);
 	mem_deref(mwi->ua);
 }
@@ -88,19 +107,13 @@ static void close_handler(int err, const struct sip_msg *msg,
 }
 
 
-static int mwi_subscribe(struct ua *ua)
+static void subscribe_handler(void *arg)
 {
+	struct mwi *mwi = arg;
+	struct ua *ua = mwi->ua;
 	const char *routev[1];
-	struct mwi *mwi;
 	int err;
 
-	mwi = mem_zalloc(sizeof(*mwi), destructor);
-	if (!mwi)
-		return ENOMEM;
-
-	list_append(&mwil, &mwi->le, mwi);
-	mwi->ua = mem_ref(ua);
-
 	routev[0] = ua_outbound(ua);
 
 	info("mwi: subscribing to messages for %s\n", ua_aor(ua));
@@ -115,28 +128,62 @@ static int mwi_subscribe(struct ua *ua)
 				 " application/simple-message-summary\r\n");
 	if (err) {
 		warning("mwi: subscribe ERROR: %m\n", err);
+		mem_deref(mwi);
 	}
+}
 
-	if (err)
-		mem_deref(mwi);
 
-	return err;
+static bool find_handler(struct le *le, void *arg)
+{
+	struct mwi *mwi = le->data;
+
+	return mwi->ua == arg;
 }
 
 
 static struct mwi *mwi_find(const struct ua *ua)
 {
-	struct le *le;
+	return list_ledata(hash_lookup(mwih, ua_hash(ua),
+				       find_handler, (void *)ua));
+}
+
+
+static int mwi_subscribe(struct ua *ua)
+{
+	struct mwi *mwi;
+
+	if (!account_mwi(ua_account(ua)) || mwi_find(ua))
+		return 0;
+
+	mwi = mem_zalloc(sizeof(*mwi), destructor);
+	if (!mwi)
+		return ENOMEM;
+
+	hash_append(mwih, ua_hash(ua), &mwi->he, mwi);
+	mwi->ua = mem_ref(ua);
+
+	regsched_start(&mwi->job, rand_u32() % SUBSCRIBE_JITTER,
+		       subscribe_handler, mwi);
+
+	return 0;
+}
+
 
-	for (le = mwil.head; le; le = le->next) {
+static bool shutdown_handler(struct le *le, void *arg)
+{
+	struct mwi *mwi = le->data;
+	(void)arg;
 
-		struct mwi *mwi = le->data;
+	mwi->shutdown = true;
 
-		if (mwi->ua == ua)
-			return mwi;
+	if (mwi->sub) {
+		mwi->sub = mem_deref(mwi->sub);
+		tmr_start(&mwi->tmr, SHUTDOWN_DELAY, deref_handler, mwi);
 	}
+	else
+		mem_deref(mwi);
 
-	return NULL;
+	return false;
 }
 
 
@@ -152,29 +199,13 @@ static void ua_event_handler(struct ua *ua,
 
 	if (ev == UA_EVENT_REGISTER_OK) {
 
-		if (!mwi_find(ua))
-			mwi_subscribe(ua);
+		(void)mwi_subscribe(ua);
 	}
 	else if (ev == UA_EVENT_SHUTDOWN) {
 
-		struct le *le;
-
 		info("mwi: shutdown\n");
 
-		le = list_head(&mwil);
-		while (le) {
-			struct mwi *mwi = le->data;
-			le = le->next;
-
-			mwi->shutdown = true;
-
-			if (mwi->sub) {
-				mwi->sub = mem_deref(mwi->sub);
-				tmr_start(&mwi->tmr, 500, deref_handler, mwi);
-			}
-			else
-				mem_deref(mwi);
-		}
+		(void)hash_apply(mwih, shutdown_handler, NULL);
 	}
 }
 
@@ -190,7 +221,7 @@ static void tmr_handler(void *arg)
 		struct account *acc = ua_account(ua);
 
 		if (account_regint(acc) == 0) {
-			mwi_subscribe(ua);
+			(void)mwi_subscribe(ua);
 		}
 	}
 }
@@ -198,7 +229,12 @@ static void tmr_handler(void *arg)
 
 static int module_init(void)
 {
-	list_init(&mwil);
+	int err;
+
+	err = hash_alloc(&mwih, 256);
+	if (err)
+		return err;
+
 	tmr_start(&tmr, 1, tmr_handler, 0);
 
 	return uag_event_register(ua_event_handler, NULL);
@@ -209,7 +245,8 @@ static int module_close(void)
 {
 	uag_event_unregister(ua_event_handler);
 	tmr_cancel(&tmr);
-	list_flush(&mwil);
+	hash_flush(mwih);
+	mwih = mem_deref(mwih);
 
 	return 0;
 }
@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 
@@ -16,9 +17,20 @@
  * the main SIP client. It uses the NATBD api in libre to detect the
  * NAT Behaviour, by sending STUN packets to a STUN server. Both
  * protocols UDP and TCP are supported.
+ *
+ * The UDP results are kept by the network for each local address, and
+ * the binding lifetime sets the interval of the media keepalives. When
+ * the local address changes to one that was seen within the last
+ * natbd_interval, the cached results are used and the tests are not
+ * run again.
  */
 
 
+enum {
+	ADDR_CHECK = 10,  /* Interval of the local address check [s] */
+};
+
+
 struct natbd {
 	struct nat_hairpinning *nh;
 	struct nat_filtering *nf;
@@ -27,7 +39,9 @@ struct natbd {
 	struct nat_genalg *ga;
 	struct stun_dns *dns;
 	struct sa stun_srv;
+	struct sa laddr;
 	struct tmr tmr;
+	struct tmr tmr_addr;
 	char host[256];
 	uint16_t port;
 	uint32_t interval;
@@ -97,6 +111,26 @@ static int natbd_status(struct re_printf *pf, void *arg)
 }
 
 
+/* Keep the UDP results for the local address */
+static void publish(const struct natbd *natbd)
+{
+	struct nat_behavior nb;
+
+	if (natbd->proto != IPPROTO_UDP || !sa_isset(&natbd->laddr, SA_ADDR))
+		return;
+
+	memset(&nb, 0, sizeof(nb));
+
+	nb.mapping        = natbd->res_nm;
+	nb.filtering      = natbd->res_nf;
+	nb.hairpinning    = natbd->res_hp;
+	nb.lifetime       = natbd->res_nl.min;
+	nb.lifetime_final = natbd->res_nl.max != 0;
+
+	(void)net_nat_set(baresip_network(), &natbd->laddr, &nb);
+}
+
+
 static void nat_hairpinning_handler(int err, bool supported, void *arg)
 {
 	struct natbd *natbd = arg;
@@ -113,6 +147,7 @@ static void nat_hairpinning_handler(int err, bool supported, void *arg)
 	}
 
 	natbd->res_hp = res_hp;
+	publish(natbd);
 
 	natbd->nh = mem_deref(natbd->nh);
 }
@@ -138,6 +173,7 @@ static void nat_mapping_handler(int err, enum nat_type type, void *arg)
 	}
 
 	natbd->res_nm = type;
+	publish(natbd);
 
  out:
 	natbd->nm = mem_deref(natbd->nm);
@@ -164,6 +200,7 @@ static void nat_filtering_handler(int err, enum nat_type type, void *arg)
 	}
 
 	natbd->res_nf = type;
+	publish(natbd);
 
  out:
 	natbd->nf = mem_deref(natbd->nf);
@@ -184,6 +221,7 @@ static void nat_lifetime_handler(int err,
 	}
 
 	natbd->res_nl = *interval;
+	publish(natbd);
 
 	info("NAT Binding lifetime for %s: min=%u cur=%u max=%u\n",
 	     net_proto2name(natbd->proto),
@@ -233,6 +271,7 @@ static void destructor(void *arg)
 	natbd->terminated = true;
 
 	tmr_cancel(&natbd->tmr);
+	tmr_cancel(&natbd->tmr_addr);
 	mem_deref(natbd->dns);
 	mem_deref(natbd->nh);
 	mem_deref(natbd->nm);
@@ -258,9 +297,10 @@ static int natbd_start(struct natbd *natbd)
 		}
 	}
 
+	sa_cpy(&natbd->laddr, net_laddr_af(net, net_af(net)));
+
 	if (!natbd->nm) {
-		err |= nat_mapping_alloc(&natbd->nm,
-					 net_laddr_af(net, net_af(net)),
+		err |= nat_mapping_alloc(&natbd->nm, &natbd->laddr,
 					 &natbd->stun_srv, natbd->proto, NULL,
 					 nat_mapping_handler, natbd);
 		err |= nat_mapping_start(natbd->nm);
@@ -316,6 +356,95 @@ static void timeout(void *arg)
 }
 
 
+/* Lifetime discovery is a special test */
+static void lifetime_start(struct natbd *natbd)
+{
+	int err;
+
+	if (natbd->proto != IPPROTO_UDP || natbd->nl)
+		return;
+
+	err  = nat_lifetime_alloc(&natbd->nl, &natbd->stun_srv, 3,
+				  NULL, nat_lifetime_handler, natbd);
+	err |= nat_lifetime_start(natbd->nl);
+	if (err) {
+		warning("natbd: nat_lifetime_start() failed (%m)\n",
+			err);
+	}
+}
+
+
+static void natbd_reset(struct natbd *natbd)
+{
+	natbd->nh = mem_deref(natbd->nh);
+	natbd->nm = mem_deref(natbd->nm);
+	natbd->nf = mem_deref(natbd->nf);
+	natbd->nl = mem_deref(natbd->nl);
+	natbd->ga = mem_deref(natbd->ga);
+
+	natbd->res_hp    = -1;
+	natbd->res_nm    = NAT_TYPE_UNKNOWN;
+	natbd->res_nf    = NAT_TYPE_UNKNOWN;
+	natbd->n_nl      = 0;
+	natbd->status_ga = 0;
+	memset(&natbd->res_nl, 0, sizeof(natbd->res_nl));
+}
+
+
+/* Use the results of the local address, if they are recent enough */
+static bool load_cached(struct natbd *natbd)
+{
+	const struct nat_behavior *nb;
+
+	if (natbd->proto != IPPROTO_UDP)
+		return false;
+
+	nb = net_nat_get(baresip_network(), &natbd->laddr);
+	if (!nb || tmr_jiffies() > nb->updated + natbd->interval * 1000)
+		return false;
+
+	natbd->res_hp     = nb->hairpinning;
+	natbd->res_nm     = nb->mapping;
+	natbd->res_nf     = nb->filtering;
+	natbd->res_nl.min = nb->lifetime;
+	natbd->res_nl.cur = nb->lifetime;
+	natbd->res_nl.max = nb->lifetime_final ? nb->lifetime : 0;
+
+	return true;
+}
+
+
+static void addr_check(void *arg)
+{
+	struct natbd *natbd = arg;
+	struct network *net = baresip_network();
+	const struct sa *laddr = net_laddr_af(net, net_af(net));
+
+	tmr_start(&natbd->tmr_addr, ADDR_CHECK * 1000, addr_check, natbd);
+
+	if (!sa_isset(laddr, SA_ADDR) ||
+	    sa_cmp(laddr, &natbd->laddr, SA_ADDR))
+		return;
+
+	info("natbd: %s local address changed from %j to %j\n",
+	     net_proto2name(natbd->proto), &natbd->laddr, laddr);
+
+	natbd_reset(natbd);
+	sa_cpy(&natbd->laddr, laddr);
+
+	if (load_cached(natbd)) {
+		info("natbd: using cached results for %j\n%H\n",
+		     laddr, natbd_status, natbd);
+		return;
+	}
+
+	natbd_start(natbd);
+	lifetime_start(natbd);
+
+	tmr_start(&natbd->tmr, natbd->interval * 1000, timeout, natbd);
+}
+
+
 static void dns_handler(int err, const struct sa *addr, void *arg)
 {
 	struct natbd *natbd = arg;
@@ -332,20 +461,10 @@ static void dns_handler(int err, const struct sa *addr, void *arg)
 	sa_cpy(&natbd->stun_srv, addr);
 
 	natbd_start(natbd);
-
-	/* Lifetime discovery is a special test */
-	if (natbd->proto == IPPROTO_UDP) {
-
-		err  = nat_lifetime_alloc(&natbd->nl, &natbd->stun_srv, 3,
-					  NULL, nat_lifetime_handler, natbd);
-		err |= nat_lifetime_start(natbd->nl);
-		if (err) {
-			warning("natbd: nat_lifetime_start() failed (%m)\n",
-				err);
-		}
-	}
+	lifetime_start(natbd);
 
 	tmr_start(&natbd->tmr, natbd->interval * 1000, timeout, natbd);
+	tmr_start(&natbd->tmr_addr, ADDR_CHECK * 1000, addr_check, natbd);
 
  out:
 	natbd->dns = mem_deref(natbd->dns);
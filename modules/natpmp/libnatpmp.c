@@ -1,5 +1,5 @@
 /**
- * @file libnatpmp.c NAT-PMP Client library
+ * @file libnatpmp.c NAT-PMP and PCP Client library
  *
  * Copyright (C) 2010 Creytiv.com
  */
@@ -12,6 +12,10 @@
 enum {
 	NATPMP_DELAY   =  250,
 	NATPMP_MAXTX   =    9,
+	PCP_OP_MAP     =    1,
+	PCP_HDR_SIZE   =   24,
+	PCP_MAP_SIZE   =   36,
+	PCP_PROTO_UDP  =   17,
 };
 
 struct natpmp_req {
@@ -85,9 +89,87 @@ static void timeout(void *arg)
 }
 
 
+/* PCP carries IPv4 addresses as IPv4-mapped IPv6 addresses */
+static int write_addr(struct mbuf *mb, uint32_t addr)
+{
+	int err;
+
+	err  = mbuf_fill(mb, 0x00, 10);
+	err |= mbuf_fill(mb, 0xff, 2);
+	err |= mbuf_write_u32(mb, htonl(addr));
+
+	return err;
+}
+
+
+static uint32_t read_addr(struct mbuf *mb)
+{
+	static const uint8_t mapped[12] = {0,0,0,0,0,0,0,0,0,0,0xff,0xff};
+	bool v4 = !memcmp(mbuf_buf(mb), mapped, sizeof(mapped));
+
+	mbuf_advance(mb, sizeof(mapped));
+
+	if (!v4) {
+		mbuf_advance(mb, 4);
+		return 0;
+	}
+
+	return ntohl(mbuf_read_u32(mb));
+}
+
+
+static int pcp_resp_decode(struct natpmp_resp *resp, struct mbuf *mb)
+{
+	uint8_t op;
+
+	if (mbuf_get_left(mb) < PCP_HDR_SIZE - 1)
+		return EBADMSG;
+
+	op            =       mbuf_read_u8(mb);
+	(void)                mbuf_read_u8(mb);
+	resp->result  =       mbuf_read_u8(mb);
+	resp->u.map.lifetime = ntohl(mbuf_read_u32(mb));
+	resp->epoch   = ntohl(mbuf_read_u32(mb));
+	mbuf_advance(mb, 12);
+
+	if (!(op & 0x80))
+		return EPROTO;
+	op &= ~0x80;
+
+	if (op != PCP_OP_MAP)
+		return EBADMSG;
+
+	resp->op = NATPMP_OP_MAPPING_UDP;
+
+	if (resp->result != NATPMP_SUCCESS)
+		return 0;
+
+	if (mbuf_get_left(mb) < PCP_MAP_SIZE)
+		return EBADMSG;
+
+	(void)mbuf_read_mem(mb, resp->u.map.nonce, PCP_NONCE_SIZE);
+	if (mbuf_read_u8(mb) != PCP_PROTO_UDP)
+		return EBADMSG;
+	mbuf_advance(mb, 3);
+	resp->u.map.int_port = ntohs(mbuf_read_u16(mb));
+	resp->u.map.ext_port = ntohs(mbuf_read_u16(mb));
+	resp->u.map.ext_addr = read_addr(mb);
+
+	return 0;
+}
+
+
 static int resp_decode(struct natpmp_resp *resp, struct mbuf *mb)
 {
+	memset(resp, 0, sizeof(*resp));
+
+	if (mbuf_get_left(mb) < 8)
+		return EBADMSG;
+
 	resp->vers   =       mbuf_read_u8(mb);
+
+	if (resp->vers == PCP_VERSION)
+		return pcp_resp_decode(resp, mb);
 	resp->op     =       mbuf_read_u8(mb);
 	resp->result = ntohs(mbuf_read_u16(mb));
 	resp->epoch  = ntohl(mbuf_read_u32(mb));
@@ -96,6 +178,10 @@ static int resp_decode(struct natpmp_resp *resp, struct mbuf *mb)
 		return EPROTO;
 	resp->op &= ~0x80;
 
+	/* e.g. the answer of a NAT-PMP server to a PCP request */
+	if (resp->result != NATPMP_SUCCESS)
+		return 0;
+
 	switch (resp->op) {
 
 	case NATPMP_OP_EXTERNAL:
@@ -134,7 +220,8 @@ static void udp_recv(const struct sa *src, struct mbuf *mb, void *arg)
 
 
 static int natpmp_init(struct natpmp_req *np, const struct sa *srv,
-		       uint8_t opcode, natpmp_resp_h *resph, void *arg)
+		       uint8_t vers, uint8_t opcode,
+		       natpmp_resp_h *resph, void *arg)
 {
 	int err;
 
@@ -156,7 +243,7 @@ static int natpmp_init(struct natpmp_req *np, const struct sa *srv,
 	if (!np->mb)
 		return ENOMEM;
 
-	err |= mbuf_write_u8(np->mb, NATPMP_VERSION);
+	err |= mbuf_write_u8(np->mb, vers);
 	err |= mbuf_write_u8(np->mb, opcode);
 
 	return err;
@@ -173,7 +260,8 @@ int natpmp_external_request(struct natpmp_req **npp, const struct sa *srv,
 	if (!np)
 		return ENOMEM;
 
-	err = natpmp_init(np, srv, NATPMP_OP_EXTERNAL, resph, arg);
+	err = natpmp_init(np, srv, NATPMP_VERSION, NATPMP_OP_EXTERNAL,
+			  resph, arg);
 	if (err)
 		goto out;
 
@@ -206,7 +294,8 @@ int natpmp_mapping_request(struct natpmp_req **npp, const struct sa *srv,
 	if (!np)
 		return ENOMEM;
 
-	err = natpmp_init(np, srv, NATPMP_OP_MAPPING_UDP, resph, arg);
+	err = natpmp_init(np, srv, NATPMP_VERSION, NATPMP_OP_MAPPING_UDP,
+			  resph, arg);
 	if (err)
 		goto out;
 
@@ -233,3 +322,69 @@ int natpmp_mapping_request(struct natpmp_req **npp, const struct sa *srv,
 
 	return err;
 }
+
+
+/**
+ * Send a PCP MAP request for UDP (RFC 6887). A NAT-PMP server answers
+ * it with NATPMP_UNSUP_VERSION.
+ *
+ * @param npp      Pointer to allocated request, or NULL
+ * @param srv      Address of the PCP server
+ * @param client   Local IPv4 address the mapping is for
+ * @param nonce    Mapping nonce, the same for refreshing the mapping
+ * @param int_port Internal UDP port
+ * @param ext_port Suggested external UDP port, or 0
+ * @param lifetime Requested lifetime in [seconds], 0 to delete
+ * @param resph    Response handler
+ * @param arg      Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int pcp_mapping_request(struct natpmp_req **npp, const struct sa *srv,
+			const struct sa *client, const uint8_t *nonce,
+			uint16_t int_port, uint16_t ext_port,
+			uint32_t lifetime, natpmp_resp_h *resph, void *arg)
+{
+	struct natpmp_req *np;
+	int err;
+
+	if (!client || sa_af(client) != AF_INET || !nonce)
+		return EINVAL;
+
+	np = mem_zalloc(sizeof(*np), destructor);
+	if (!np)
+		return ENOMEM;
+
+	err = natpmp_init(np, srv, PCP_VERSION, PCP_OP_MAP, resph, arg);
+	if (err)
+		goto out;
+
+	err |= mbuf_write_u16(np->mb, 0x0000);
+	err |= mbuf_write_u32(np->mb, htonl(lifetime));
+	err |= write_addr(np->mb, sa_in(client));
+
+	err |= mbuf_write_mem(np->mb, nonce, PCP_NONCE_SIZE);
+	err |= mbuf_write_u8(np->mb, PCP_PROTO_UDP);
+	err |= mbuf_fill(np->mb, 0x00, 3);
+	err |= mbuf_write_u16(np->mb, htons(int_port));
+	err |= mbuf_write_u16(np->mb, htons(ext_port));
+	err |= write_addr(np->mb, 0);
+	if (err)
+		goto out;
+
+	timeout(np);
+
+ out:
+	if (err)
+		mem_deref(np);
+	else if (npp) {
+		np->npp = npp;
+		*npp = np;
+	}
+	else {
+		/* Destroy the transaction now */
+		mem_deref(np);
+	}
+
+	return err;
+}
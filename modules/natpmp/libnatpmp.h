@@ -1,5 +1,5 @@
 /**
- * @file libnatpmp.h Interface to NAT-PMP Client library
+ * @file libnatpmp.h Interface to NAT-PMP and PCP Client library
  *
  * Copyright (C) 2010 Creytiv.com
  */
@@ -7,7 +7,9 @@
 
 enum {
 	NATPMP_VERSION =    0,
+	PCP_VERSION    =    2,
 	NATPMP_PORT    = 5351,
+	PCP_NONCE_SIZE =   12,
 };
 
 enum natpmp_op {
@@ -37,6 +39,8 @@ struct natpmp_resp {
 			uint16_t int_port;
 			uint16_t ext_port;
 			uint32_t lifetime;
+			uint32_t ext_addr;  /* PCP only, 0 for NAT-PMP */
+			uint8_t nonce[PCP_NONCE_SIZE];  /* PCP only */
 		} map;
 	} u;
 };
@@ -51,3 +55,7 @@ int natpmp_external_request(struct natpmp_req **npp, const struct sa *srv,
 int natpmp_mapping_request(struct natpmp_req **natpmpp, const struct sa *srv,
 			   uint16_t int_port, uint16_t ext_port,
 			   uint32_t lifetime, natpmp_resp_h *resph, void *arg);
+int pcp_mapping_request(struct natpmp_req **npp, const struct sa *srv,
+			const struct sa *client, const uint8_t *nonce,
+			uint16_t int_port, uint16_t ext_port,
+			uint32_t lifetime, natpmp_resp_h *resph, void *arg);
@@ -1,8 +1,9 @@
 /**
- * @file natpmp.c NAT-PMP Module for Media NAT-traversal
+ * @file natpmp.c NAT-PMP and PCP Module for Media NAT-traversal
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 #include "libnatpmp.h"
@@ -11,28 +12,71 @@
 /**
  * @defgroup natpmp natpmp
  *
- * NAT Port Mapping Protocol (NAT-PMP)
+ * NAT Port Mapping Protocol (NAT-PMP) and Port Control Protocol (PCP)
  *
  * https://tools.ietf.org/html/rfc6886
+ * https://tools.ietf.org/html/rfc6887
+ *
+ * The port mappings are kept in a pool, by internal port, and are not
+ * deleted when a call ends. A new call that gets a port with a mapping
+ * uses it at once, without waiting for the gateway. All mappings are
+ * refreshed by one timer. If the RTP port range is small, the whole
+ * range is mapped at startup.
+ *
+ * Example config:
+ \verbatim
+  natpmp_server   10.0.0.1       # Default: the default gateway
+  natpmp_proto    auto           # auto, pcp or natpmp
+  natpmp_pool     64             # Map the rtp_ports range at startup
+                                 # if it has no more ports, 0 is off
+  natpmp_pool_idle 600           # Keep unused mappings [seconds]
+ \endverbatim
  */
 
 enum {
-	LIFETIME = 300 /* seconds */
+	LIFETIME     = 300,    /* seconds */
+	REFRESH_TICK = 10000,  /* Refresh check interval [ms] */
+	POOL_SIZE    = 64,
+	POOL_IDLE    = 600,    /* seconds */
+	HASH_SIZE    = 64,
+};
+
+enum proto {
+	PROTO_AUTO,
+	PROTO_PCP,
+	PROTO_NATPMP,
+};
+
+/* Port mapping, shared by all components with the same internal port */
+struct mapping {
+	struct le he;
+	struct list compl;          /* Components using the mapping */
+	struct natpmp_req *req;
+	uint64_t expires;           /* [ms], 0 if not granted       */
+	uint64_t idle;              /* Last component left [ms]     */
+	uint64_t retry;             /* No request before [ms]       */
+	uint32_t lifetime;
+	uint32_t ext_addr;          /* PCP only                     */
+	uint16_t int_port;
+	uint16_t ext_port;
+	uint8_t nonce[PCP_NONCE_SIZE];
+	bool pcp;
+	bool keep;                  /* Mapped at startup            */
 };
 
 struct mnat_sess {
 	struct list medial;
+	struct tmr tmr;
 	mnat_estab_h *estabh;
 	void *arg;
+	int err;
 };
 
 struct mnat_media {
 	struct comp {
-		struct natpmp_req *natpmp;
+		struct le le;               /* in mapping->compl */
+		struct mapping *map;
 		struct mnat_media *media;   /* pointer to parent */
-		struct tmr tmr;
-		uint16_t int_port;
-		uint32_t lifetime;
 		unsigned id;
 		bool granted;
 	} compv[2];
@@ -43,20 +87,145 @@ struct mnat_media {
 	struct sdp_media *sdpm;
 };
 
+static struct {
+	struct hash *ht;            /* struct mapping, by int_port */
+	struct tmr tmr;
+	enum proto proto;
+	uint32_t idle;              /* [seconds] */
+	uint32_t n_hit;
+	uint32_t n_miss;
+} pool;
 
 static struct mnat *mnat;
 static struct sa natpmp_srv, natpmp_extaddr;
 static struct natpmp_req *natpmp_ext;
 
 
-static void natpmp_resp_handler(int err, const struct natpmp_resp *resp,
-				void *arg);
+static void mapping_resp_handler(int err, const struct natpmp_resp *resp,
+				 void *arg);
+
+
+static const struct sa *client_addr(void)
+{
+	return net_laddr_af(baresip_network(), AF_INET);
+}
+
+
+static int mapping_request(struct mapping *map, uint32_t lifetime)
+{
+	int err;
+
+	map->req = mem_deref(map->req);
+	map->pcp = pool.proto != PROTO_NATPMP;
+
+	if (map->pcp) {
+		err = pcp_mapping_request(&map->req, &natpmp_srv,
+					  client_addr(), map->nonce,
+					  map->int_port, map->ext_port,
+					  lifetime, mapping_resp_handler, map);
+	}
+	else {
+		err = natpmp_mapping_request(&map->req, &natpmp_srv,
+					     map->int_port, map->ext_port,
+					     lifetime, mapping_resp_handler,
+					     map);
+	}
+
+	if (err)
+		warning("natpmp: mapping request for port %u failed (%m)\n",
+			map->int_port, err);
+
+	return err;
+}
+
+
+static void mapping_destructor(void *arg)
+{
+	struct mapping *map = arg;
+	struct le *le;
+
+	hash_unlink(&map->he);
+
+	while ((le = list_head(&map->compl))) {
+		struct comp *comp = le->data;
+
+		list_unlink(le);
+		comp->map = NULL;
+	}
+
+	mem_deref(map->req);
+
+	/* Destroy the mapping */
+	if (map->expires) {
+		if (map->pcp) {
+			(void)pcp_mapping_request(NULL, &natpmp_srv,
+						  client_addr(), map->nonce,
+						  map->int_port, 0, 0,
+						  NULL, NULL);
+		}
+		else {
+			(void)natpmp_mapping_request(NULL, &natpmp_srv,
+						     map->int_port, 0, 0,
+						     NULL, NULL);
+		}
+	}
+}
+
+
+static bool port_cmp_handler(struct le *le, void *arg)
+{
+	const struct mapping *map = le->data;
+	const uint16_t *port = arg;
+
+	return map->int_port == *port;
+}
+
+
+static struct mapping *mapping_find(uint16_t int_port)
+{
+	return list_ledata(hash_lookup(pool.ht, int_port,
+				       port_cmp_handler, &int_port));
+}
+
+
+static int mapping_get(struct mapping **mapp, uint16_t int_port)
+{
+	struct mapping *map;
+	int err;
+
+	map = mapping_find(int_port);
+	if (map) {
+		*mapp = map;
+		return 0;
+	}
+
+	map = mem_zalloc(sizeof(*map), mapping_destructor);
+	if (!map)
+		return ENOMEM;
+
+	map->int_port = int_port;
+	map->lifetime = LIFETIME;
+	rand_bytes(map->nonce, sizeof(map->nonce));
+
+	hash_append(pool.ht, int_port, &map->he, map);
+
+	err = mapping_request(map, map->lifetime);
+	if (err) {
+		mem_deref(map);
+		return err;
+	}
+
+	*mapp = map;
+
+	return 0;
+}
 
 
 static void session_destructor(void *arg)
 {
 	struct mnat_sess *sess = arg;
 
+	tmr_cancel(&sess->tmr);
 	list_flush(&sess->medial);
 }
 
@@ -71,15 +240,10 @@ static void media_destructor(void *arg)
 	for (i=0; i<m->compc; i++) {
 		struct comp *comp = &m->compv[i];
 
-		/* Destroy the mapping */
-		if (comp->granted) {
-			(void)natpmp_mapping_request(NULL, &natpmp_srv,
-						     comp->int_port, 0, 0,
-						     NULL, NULL);
-		}
-
-		tmr_cancel(&comp->tmr);
-		mem_deref(comp->natpmp);
+		/* The mapping stays in the pool */
+		list_unlink(&comp->le);
+		if (comp->map && list_isempty(&comp->map->compl))
+			comp->map->idle = tmr_jiffies();
 	}
 
 	mem_deref(m->sdpm);
@@ -131,67 +295,183 @@ static void is_complete(struct mnat_sess *sess)
 }
 
 
-static void refresh_timeout(void *arg)
+static void sess_tmr_handler(void *arg)
+{
+	struct mnat_sess *sess = arg;
+
+	if (sess->err)
+		complete(sess, sess->err);
+	else
+		is_complete(sess);
+}
+
+
+/* The session handler is called from the timer, not from the pool */
+static void sess_update(struct mnat_sess *sess, int err)
 {
-	struct comp *comp = arg;
+	if (err && !sess->err)
+		sess->err = err;
 
-	comp->natpmp = mem_deref(comp->natpmp);
-	(void)natpmp_mapping_request(&comp->natpmp, &natpmp_srv,
-				     comp->int_port, 0, comp->lifetime,
-				     natpmp_resp_handler, comp);
+	tmr_start(&sess->tmr, 0, sess_tmr_handler, sess);
 }
 
 
-static void natpmp_resp_handler(int err, const struct natpmp_resp *resp,
-				void *arg)
+static void comp_granted(struct comp *comp)
 {
-	struct comp *comp = arg;
 	struct mnat_media *m = comp->media;
+	const struct mapping *map = comp->map;
 	struct sa map_addr;
 
+	if (map->ext_addr)
+		sa_set_in(&map_addr, map->ext_addr, map->ext_port);
+	else {
+		map_addr = natpmp_extaddr;
+		sa_set_port(&map_addr, map->ext_port);
+	}
+
+	/* Update SDP media with external IP-address mapping */
+	if (comp->id == 1)
+		sdp_media_set_laddr(m->sdpm, &map_addr);
+	else
+		sdp_media_set_laddr_rtcp(m->sdpm, &map_addr);
+
+	comp->granted = true;
+
+	sess_update(m->sess, 0);
+}
+
+
+static void mapping_failed(struct mapping *map, int err)
+{
+	struct le *le;
+
+	map->retry = tmr_jiffies() + map->lifetime * 1000;
+
+	for (le = map->compl.head; le; le = le->next) {
+		struct comp *comp = le->data;
+
+		if (!comp->granted)
+			sess_update(comp->media->sess, err);
+	}
+}
+
+
+static void mapping_resp_handler(int err, const struct natpmp_resp *resp,
+				 void *arg)
+{
+	struct mapping *map = arg;
+	bool granted = map->expires != 0;
+	struct le *le;
+
 	if (err) {
 		warning("natpmp: response error: %m\n", err);
-		complete(m->sess, err);
+		mapping_failed(map, err);
 		return;
 	}
 
-	if (resp->op != NATPMP_OP_MAPPING_UDP)
+	if (map->pcp && resp->vers == NATPMP_VERSION &&
+	    resp->result == NATPMP_UNSUP_VERSION &&
+	    pool.proto == PROTO_AUTO) {
+
+		info("natpmp: server does not support PCP,"
+		     " using NAT-PMP\n");
+
+		pool.proto = PROTO_NATPMP;
+		(void)mapping_request(map, map->lifetime);
 		return;
+	}
+
 	if (resp->result != NATPMP_SUCCESS) {
 		warning("natpmp: request failed with result code: %d\n",
 			resp->result);
-		complete(m->sess, EPROTO);
+		mapping_failed(map, EPROTO);
 		return;
 	}
 
-	if (resp->u.map.int_port != comp->int_port) {
+	if (resp->op != NATPMP_OP_MAPPING_UDP)
+		return;
+
+	if (resp->u.map.int_port != map->int_port) {
 		info("natpmp: ignoring response for internal_port=%u\n",
 		     resp->u.map.int_port);
 		return;
 	}
 
-	info("natpmp: mapping granted for comp %u:"
-	     " internal_port=%u, external_port=%u, lifetime=%u\n",
-	     comp->id,
-	     resp->u.map.int_port, resp->u.map.ext_port,
-	     resp->u.map.lifetime);
+	if (map->pcp) {
+		if (memcmp(resp->u.map.nonce, map->nonce, sizeof(map->nonce)))
+			return;
 
-	map_addr = natpmp_extaddr;
-	sa_set_port(&map_addr, resp->u.map.ext_port);
-	comp->lifetime = resp->u.map.lifetime;
+		if (pool.proto == PROTO_AUTO)
+			pool.proto = PROTO_PCP;
+	}
 
-	/* Update SDP media with external IP-address mapping */
-	if (comp->id == 1)
-		sdp_media_set_laddr(m->sdpm, &map_addr);
-	else
-		sdp_media_set_laddr_rtcp(m->sdpm, &map_addr);
+	if (granted && resp->u.map.ext_port != map->ext_port) {
+		warning("natpmp: external port of internal_port=%u"
+			" changed from %u to %u\n", map->int_port,
+			map->ext_port, resp->u.map.ext_port);
+	}
 
-	comp->granted = true;
+	if (!granted) {
+		info("natpmp: %s mapping granted:"
+		     " internal_port=%u, external_port=%u, lifetime=%u\n",
+		     map->pcp ? "PCP" : "NAT-PMP",
+		     resp->u.map.int_port, resp->u.map.ext_port,
+		     resp->u.map.lifetime);
+	}
+
+	map->ext_port = resp->u.map.ext_port;
+	map->ext_addr = resp->u.map.ext_addr;
+	map->lifetime = resp->u.map.lifetime;
+	map->expires  = tmr_jiffies() + map->lifetime * 1000;
+	map->retry    = 0;
+
+	for (le = map->compl.head; le; le = le->next) {
+		struct comp *comp = le->data;
+
+		if (!comp->granted)
+			comp_granted(comp);
+	}
+}
+
+
+static bool refresh_handler(struct le *le, void *arg)
+{
+	struct mapping *map = le->data;
+	const uint64_t now = *(uint64_t *)arg;
+
+	if (map->req)
+		return false;
+
+	if (!map->keep && list_isempty(&map->compl) &&
+	    now > map->idle + pool.idle * 1000) {
+		mem_deref(map);
+		return false;
+	}
+
+	if (map->expires && now >= map->expires)
+		map->expires = 0;
+
+	if (now < map->retry)
+		return false;
 
-	tmr_start(&comp->tmr, comp->lifetime * 1000 * 3/4,
-		  refresh_timeout, comp);
+	/* all mappings that expire within a quarter of their lifetime */
+	if (!map->expires ||
+	    map->expires - now < map->lifetime * 1000 / 4) {
+		(void)mapping_request(map, map->lifetime);
+	}
+
+	return false;
+}
+
+
+static void refresh_timeout(void *arg)
+{
+	uint64_t now = tmr_jiffies();
+	(void)arg;
 
-	is_complete(m->sess);
+	tmr_start(&pool.tmr, REFRESH_TICK, refresh_timeout, NULL);
+
+	(void)hash_apply(pool.ht, refresh_handler, &now);
 }
 
 
@@ -231,24 +511,39 @@ static int session_alloc(struct mnat_sess **sessp, struct dnsc *dnsc,
 
 static int comp_alloc(struct comp *comp, void *sock)
 {
+	struct mapping *map;
 	struct sa laddr;
+	uint16_t int_port;
 	int err;
 
 	err = udp_local_get(sock, &laddr);
 	if (err)
 		goto out;
 
-	comp->int_port = sa_port(&laddr);
+	int_port = sa_port(&laddr);
 
 	info("natpmp: `%s' stream comp %u local UDP port is %u\n",
-	     sdp_media_name(comp->media->sdpm), comp->id, comp->int_port);
+	     sdp_media_name(comp->media->sdpm), comp->id, int_port);
 
-	err = natpmp_mapping_request(&comp->natpmp, &natpmp_srv,
-				     comp->int_port, 0, comp->lifetime,
-				     natpmp_resp_handler, comp);
+	err = mapping_get(&map, int_port);
 	if (err)
 		goto out;
 
+	comp->map = map;
+	list_append(&map->compl, &comp->le, comp);
+
+	if (map->expires > tmr_jiffies()) {
+		++pool.n_hit;
+		debug("natpmp: comp %u uses pooled mapping %u -> %u\n",
+		      comp->id, map->int_port, map->ext_port);
+		comp_granted(comp);
+	}
+	else {
+		++pool.n_miss;
+		if (!map->req)
+			err = mapping_request(map, map->lifetime);
+	}
+
  out:
 	return err;
 }
@@ -284,7 +579,6 @@ static int media_alloc(struct mnat_media **mp, struct mnat_sess *sess,
 
 		comp->id = i+1;
 		comp->media = m;
-		comp->lifetime = LIFETIME;
 
 		err = comp_alloc(comp, i==0 ? sock1 : sock2);
 		if (err)
@@ -302,6 +596,38 @@ static int media_alloc(struct mnat_media **mp, struct mnat_sess *sess,
 }
 
 
+/* Map the RTP port range, if it is small enough */
+static void pool_prewarm(uint32_t size)
+{
+	const struct range *ports = &conf_config()->avt.rtp_ports;
+	uint32_t port, n = 0;
+
+	if (!size || !ports->min || ports->max < ports->min)
+		return;
+
+	if (ports->max - ports->min + 1 > size) {
+		info("natpmp: rtp_ports %u-%u has more than %u ports,"
+		     " not mapped at startup\n",
+		     ports->min, ports->max, size);
+		return;
+	}
+
+	for (port = ports->min; port <= ports->max; port++) {
+
+		struct mapping *map;
+
+		if (mapping_get(&map, port))
+			continue;
+
+		map->keep = true;
+		++n;
+	}
+
+	info("natpmp: mapping %u ports of rtp_ports %u-%u\n",
+	     n, ports->min, ports->max);
+}
+
+
 static void extaddr_handler(int err, const struct natpmp_resp *resp, void *arg)
 {
 	(void)arg;
@@ -349,6 +675,8 @@ static bool net_rt_handler(const char *ifname, const struct sa *dst,
 
 static int module_init(void)
 {
+	struct pl proto;
+	uint32_t size = POOL_SIZE;
 	int err;
 
 	sa_init(&natpmp_srv, AF_INET);
@@ -358,20 +686,64 @@ static int module_init(void)
 
 	conf_get_sa(conf_cur(), "natpmp_server", &natpmp_srv);
 
-	info("natpmp: using NAT-PMP server at %J\n", &natpmp_srv);
+	pool.proto = PROTO_AUTO;
+	pool.idle  = POOL_IDLE;
 
-	err = natpmp_external_request(&natpmp_ext, &natpmp_srv,
-				      extaddr_handler, NULL);
+	if (0 == conf_get(conf_cur(), "natpmp_proto", &proto)) {
+
+		if (0 == pl_strcasecmp(&proto, "pcp"))
+			pool.proto = PROTO_PCP;
+		else if (0 == pl_strcasecmp(&proto, "natpmp"))
+			pool.proto = PROTO_NATPMP;
+		else if (pl_strcasecmp(&proto, "auto"))
+			warning("natpmp: unknown natpmp_proto '%r'\n",
+				&proto);
+	}
+
+	(void)conf_get_u32(conf_cur(), "natpmp_pool", &size);
+	(void)conf_get_u32(conf_cur(), "natpmp_pool_idle", &pool.idle);
+
+	info("natpmp: using %s server at %J\n",
+	     pool.proto == PROTO_PCP ? "PCP" :
+	     pool.proto == PROTO_NATPMP ? "NAT-PMP" : "PCP/NAT-PMP",
+	     &natpmp_srv);
+
+	err = hash_alloc(&pool.ht, HASH_SIZE);
 	if (err)
 		return err;
 
-	return mnat_register(&mnat, "natpmp", NULL,
-			     session_alloc, media_alloc, NULL);
+	/* PCP responses have the external address */
+	if (pool.proto != PROTO_PCP) {
+		err = natpmp_external_request(&natpmp_ext, &natpmp_srv,
+					      extaddr_handler, NULL);
+		if (err)
+			return err;
+	}
+
+	err = mnat_register(&mnat, "natpmp", NULL,
+			    session_alloc, media_alloc, NULL);
+	if (err)
+		return err;
+
+	pool_prewarm(size);
+
+	tmr_start(&pool.tmr, REFRESH_TICK, refresh_timeout, NULL);
+
+	return 0;
 }
 
 
 static int module_close(void)
 {
+	if (pool.n_hit || pool.n_miss) {
+		info("natpmp: %u of %u components used a pooled mapping\n",
+		     pool.n_hit, pool.n_hit + pool.n_miss);
+	}
+
+	tmr_cancel(&pool.tmr);
+	hash_flush(pool.ht);
+	pool.ht = mem_deref(pool.ht);
+
 	mnat       = mem_deref(mnat);
 	natpmp_ext = mem_deref(natpmp_ext);
 
@@ -0,0 +1,10 @@
+#
+# module.mk
+#
+# Copyright (C) 2010 Creytiv.com
+#
+
+MOD		:= nullaudio
+$(MOD)_SRCS	+= nullaudio.c
+
+include mk/mod.mk
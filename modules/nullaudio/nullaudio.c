@@ -0,0 +1,422 @@
+/**
+ * @file nullaudio.c  Null audio driver, for load tests
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include <baresip.h>
+
+
+#if !defined (M_PI)
+#define M_PI 3.14159265358979323846264338327
+#endif
+
+
+/**
+ * @defgroup nullaudio nullaudio
+ *
+ * Audio source and player "null" that cost nothing, for headless load
+ * tests with many calls
+ *
+ * The source gives silence, or a 1 kHz tone with the device "tone". The
+ * player takes the samples into a scratch buffer and drops them. All
+ * sources and players share one buffer of silence, one scratch buffer
+ * and one tone per format, so an instance has no buffers of its own.
+ *
+ * All instances are clocked by one timer on the media clock, instead of
+ * a thread or a timer each. The packets of an instance are due on the
+ * multiples of its packet-time, so the instances with the same
+ * packet-time are handled on the same tick, in the same order. In the
+ * fast mode of the media clock the timing is the same on every run.
+ *
+ \verbatim
+  audio_source        null,silence     # or null,tone
+  audio_player        null,nil
+ \endverbatim
+ */
+
+
+enum {
+	TONE_FREQ  = 1000,    /**< Frequency of the tone [Hz]     */
+	TONE_LEVEL = 8192,    /**< Amplitude of the tone, -12 dBFS */
+};
+
+/* One period of the tone, and a packet more to read at any phase */
+struct tone {
+	struct le le;
+	int16_t *sampv;
+	size_t period;        /**< Samples of one period, all channels */
+	uint32_t srate;
+	uint8_t ch;
+};
+
+typedef void (tick_h)(void *arg, size_t sampc);
+
+/* Common part of a source and a player */
+struct inst {
+	struct le le;
+	uint64_t due;         /**< Next packet [us] of the media clock */
+	uint32_t ptime;       /**< Packet-time [ms]                    */
+	size_t sampc;         /**< Samples per packet, all channels    */
+	tick_h *tickh;
+	void *arg;            /**< The source or player                */
+};
+
+struct ausrc_st {
+	const struct ausrc *as;    /* base class */
+	struct inst in;
+	struct tone *tone;         /**< Tone, or NULL for silence */
+	size_t pos;                /**< Phase of the tone         */
+	ausrc_read_h *rh;
+	void *arg;
+};
+
+struct auplay_st {
+	const struct auplay *ap;   /* base class */
+	struct inst in;
+	auplay_write_h *wh;
+	void *arg;
+};
+
+static struct {
+	struct ausrc *ausrc;
+	struct auplay *auplay;
+	struct mclock_tmr tmr;
+	struct list instl;         /**< All sources and players */
+	struct list tonel;
+	int16_t *silence;
+	int16_t *scratch;
+	size_t sampc;              /**< Size of the shared buffers */
+} na;
+
+
+static void tick_handler(void *arg);
+
+
+static void tone_destructor(void *arg)
+{
+	struct tone *tone = arg;
+
+	list_unlink(&tone->le);
+	mem_deref(tone->sampv);
+}
+
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+	while (b) {
+		uint32_t t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+
+static int tone_get(struct tone **tp, uint32_t srate, uint8_t ch,
+		    size_t sampc)
+{
+	struct tone *tone;
+	struct le *le;
+	size_t frames, i, n;
+	uint8_t c;
+
+	for (le = na.tonel.head; le; le = le->next) {
+
+		tone = le->data;
+
+		if (tone->srate == srate && tone->ch == ch &&
+		    tone->period >= sampc) {
+			*tp = mem_ref(tone);
+			return 0;
+		}
+	}
+
+	tone = mem_zalloc(sizeof(*tone), tone_destructor);
+	if (!tone)
+		return ENOMEM;
+
+	/* the shortest whole number of periods, repeated for a packet */
+	frames = srate / gcd(srate, TONE_FREQ);
+	tone->period = frames * ch;
+	while (tone->period < sampc)
+		tone->period += frames * ch;
+
+	n = tone->period * 2;
+
+	tone->sampv = mem_alloc(n * sizeof(int16_t), NULL);
+	if (!tone->sampv) {
+		mem_deref(tone);
+		return ENOMEM;
+	}
+
+	for (i=0; i<n/ch; i++) {
+
+		const double s = sin(2 * M_PI * TONE_FREQ * i / srate);
+
+		for (c=0; c<ch; c++)
+			tone->sampv[i*ch + c] = (int16_t)(TONE_LEVEL * s);
+	}
+
+	tone->srate = srate;
+	tone->ch    = ch;
+
+	list_append(&na.tonel, &tone->le, tone);
+
+	*tp = tone;
+
+	return 0;
+}
+
+
+static int buffers_reserve(size_t sampc)
+{
+	int16_t *silence, *scratch;
+
+	if (sampc <= na.sampc)
+		return 0;
+
+	silence = mem_zalloc(sampc * sizeof(int16_t), NULL);
+	scratch = mem_zalloc(sampc * sizeof(int16_t), NULL);
+	if (!silence || !scratch) {
+		mem_deref(silence);
+		mem_deref(scratch);
+		return ENOMEM;
+	}
+
+	mem_deref(na.silence);
+	mem_deref(na.scratch);
+	na.silence = silence;
+	na.scratch = scratch;
+	na.sampc   = sampc;
+
+	return 0;
+}
+
+
+/* Restart the timer for the earliest packet of all instances */
+static void tmr_update(uint64_t now)
+{
+	uint64_t due = UINT64_MAX;
+	struct le *le;
+
+	for (le = na.instl.head; le; le = le->next) {
+		const struct inst *in = le->data;
+
+		due = min(due, in->due);
+	}
+
+	if (due == UINT64_MAX) {
+		mclock_tmr_cancel(&na.tmr);
+		return;
+	}
+
+	/* in [ms], rounded up */
+	mclock_tmr_start(&na.tmr, due > now ? (due - now + 999) / 1000 : 0,
+			 tick_handler, NULL);
+}
+
+
+static void tick_handler(void *arg)
+{
+	const uint64_t now = mclock_now();
+	struct le *le;
+	(void)arg;
+
+	le = na.instl.head;
+	while (le) {
+		struct inst *in = le->data;
+
+		le = le->next;
+
+		if (in->due > now)
+			continue;
+
+		in->due += in->ptime * 1000;
+		in->tickh(in->arg, in->sampc);
+	}
+
+	tmr_update(now);
+}
+
+
+static void inst_start(struct inst *in, uint32_t ptime, size_t sampc,
+		       tick_h *tickh, void *arg)
+{
+	const uint64_t now = mclock_now();
+	const uint64_t period = ptime * 1000;
+
+	in->ptime = ptime;
+	in->sampc = sampc;
+	in->tickh = tickh;
+	in->arg   = arg;
+
+	/* on the grid of the packet-time, shared by all instances */
+	in->due = (now / period + 1) * period;
+
+	list_append(&na.instl, &in->le, in);
+
+	tmr_update(now);
+}
+
+
+static void ausrc_destructor(void *arg)
+{
+	struct ausrc_st *st = arg;
+
+	list_unlink(&st->in.le);
+	mem_deref(st->tone);
+}
+
+
+static void auplay_destructor(void *arg)
+{
+	struct auplay_st *st = arg;
+
+	list_unlink(&st->in.le);
+}
+
+
+static void src_tick(void *arg, size_t sampc)
+{
+	struct ausrc_st *st = arg;
+
+	if (!st->tone) {
+		st->rh(na.silence, sampc, st->arg);
+		return;
+	}
+
+	st->rh(&st->tone->sampv[st->pos], sampc, st->arg);
+
+	st->pos = (st->pos + sampc) % st->tone->period;
+}
+
+
+static void play_tick(void *arg, size_t sampc)
+{
+	struct auplay_st *st = arg;
+
+	st->wh(na.scratch, sampc, st->arg);
+}
+
+
+static int src_alloc(struct ausrc_st **stp, const struct ausrc *as,
+		     struct media_ctx **ctx,
+		     struct ausrc_prm *prm, const char *device,
+		     ausrc_read_h *rh, ausrc_error_h *errh, void *arg)
+{
+	struct ausrc_st *st;
+	size_t sampc;
+	int err;
+	(void)ctx;
+	(void)errh;
+
+	if (!stp || !as || !prm || !prm->ptime || !prm->ch || !rh)
+		return EINVAL;
+
+	sampc = prm->srate * prm->ch * prm->ptime / 1000;
+
+	err = buffers_reserve(sampc);
+	if (err)
+		return err;
+
+	st = mem_zalloc(sizeof(*st), ausrc_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->as  = as;
+	st->rh  = rh;
+	st->arg = arg;
+
+	if (0 == str_casecmp(device, "tone")) {
+
+		err = tone_get(&st->tone, prm->srate, prm->ch, sampc);
+		if (err) {
+			mem_deref(st);
+			return err;
+		}
+	}
+
+	if (prm->latency)
+		*prm->latency = 0;
+
+	inst_start(&st->in, prm->ptime, sampc, src_tick, st);
+
+	*stp = st;
+
+	return 0;
+}
+
+
+static int play_alloc(struct auplay_st **stp, const struct auplay *ap,
+		      struct auplay_prm *prm, const char *device,
+		      auplay_write_h *wh, void *arg)
+{
+	struct auplay_st *st;
+	size_t sampc;
+	int err;
+	(void)device;
+
+	if (!stp || !ap || !prm || !prm->ptime || !prm->ch || !wh)
+		return EINVAL;
+
+	sampc = prm->srate * prm->ch * prm->ptime / 1000;
+
+	err = buffers_reserve(sampc);
+	if (err)
+		return err;
+
+	st = mem_zalloc(sizeof(*st), auplay_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->ap  = ap;
+	st->wh  = wh;
+	st->arg = arg;
+
+	if (prm->latency)
+		*prm->latency = 0;
+
+	inst_start(&st->in, prm->ptime, sampc, play_tick, st);
+
+	*stp = st;
+
+	return 0;
+}
+
+
+static int module_init(void)
+{
+	int err;
+
+	err  = ausrc_register(&na.ausrc, "null", src_alloc);
+	err |= auplay_register(&na.auplay, "null", play_alloc);
+
+	return err;
+}
+
+
+static int module_close(void)
+{
+	mclock_tmr_cancel(&na.tmr);
+
+	na.ausrc  = mem_deref(na.ausrc);
+	na.auplay = mem_deref(na.auplay);
+
+	na.silence = mem_deref(na.silence);
+	na.scratch = mem_deref(na.scratch);
+	na.sampc   = 0;
+
+	return 0;
+}
+
+
+EXPORT_SYM const struct mod_export DECL_EXPORTS(nullaudio) = {
+	"nullaudio",
+	"sound",
+	module_init,
+	module_close
+};
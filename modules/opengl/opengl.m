@@ -15,6 +15,11 @@
  * @defgroup opengl opengl
  *
  * Video display module for OpenGL on MacOSX
+ *
+ * YUV420P frames are converted to RGB by a fragment shader. The planes
+ * are written to one of two pixel buffer objects in turn, and the
+ * textures are updated from it, so the copy to the GPU runs while the
+ * next frame is prepared.
  */
 
 
@@ -25,6 +30,10 @@ struct vidisp_st {
 	NSWindow *win;
 	GLhandleARB PHandle;
 	char *prog;
+	GLuint tex[3];                  /**< Y, U and V textures   */
+	GLuint pbo[2];                  /**< Pixel unpack buffers  */
+	unsigned pbo_idx;
+	int linesize[3];                /**< Of the texture planes */
 };
 
 
@@ -55,11 +64,32 @@ static const char *FProgram=
   "}\n";
 
 
+static void textures_free(struct vidisp_st *st)
+{
+	if (st->tex[0]) {
+		glDeleteTextures(3, st->tex);
+		memset(st->tex, 0, sizeof(st->tex));
+	}
+
+	if (st->pbo[0]) {
+		glDeleteBuffersARB(2, st->pbo);
+		memset(st->pbo, 0, sizeof(st->pbo));
+	}
+
+	memset(st->linesize, 0, sizeof(st->linesize));
+}
+
+
 static void destructor(void *arg)
 {
 	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
 	struct vidisp_st *st = arg;
 
+	if (st->ctx) {
+		[st->ctx makeCurrentContext];
+		textures_free(st);
+	}
+
 	if (st->ctx) {
 		[st->ctx clearDrawable];
 		[st->ctx release];
@@ -115,6 +145,8 @@ static void opengl_reset(struct vidisp_st *st, const struct vidsz *sz)
 		st->prog = mem_deref(st->prog);
 	}
 
+	textures_free(st);
+
 	st->size = *sz;
 }
 
@@ -251,62 +283,95 @@ static int alloc(struct vidisp_st **stp, const struct vidisp *vd,
 }
 
 
-static inline void draw_yuv(GLhandleARB PHandle, int height,
-			    const uint8_t *Ytex, int linesizeY,
-			    const uint8_t *Utex, int linesizeU,
-			    const uint8_t *Vtex, int linesizeV)
+/* Textures are as wide as the lines, the shader only samples the picture */
+static void setup_textures(struct vidisp_st *st, const struct vidframe *frame)
 {
+	static const char *namev[3] = {"Ytex", "Utex", "Vtex"};
 	int i;
 
-	/* This might not be required, but should not hurt. */
-	glEnable(GL_TEXTURE_2D);
+	textures_free(st);
 
-	/* Select texture unit 1 as the active unit and bind the U texture. */
-	glActiveTexture(GL_TEXTURE1);
-	i = glGetUniformLocationARB(PHandle, "Utex");
-	glUniform1iARB(i,1);  /* Bind Utex to texture unit 1 */
-	glBindTexture(GL_TEXTURE_RECTANGLE_EXT,1);
+	glGenTextures(3, st->tex);
+	glGenBuffersARB(2, st->pbo);
 
-	glTexParameteri(GL_TEXTURE_RECTANGLE_EXT,
-			GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_RECTANGLE_EXT,
-			GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-	glTexEnvf(GL_TEXTURE_ENV,GL_TEXTURE_ENV_MODE,GL_DECAL);
-	glTexImage2D(GL_TEXTURE_RECTANGLE_EXT,0,GL_LUMINANCE,
-		     linesizeU, height/2, 0,
-		     GL_LUMINANCE,GL_UNSIGNED_BYTE,Utex);
-
-	/* Select texture unit 2 as the active unit and bind the V texture. */
-	glActiveTexture(GL_TEXTURE2);
-	i = glGetUniformLocationARB(PHandle, "Vtex");
-	glBindTexture(GL_TEXTURE_RECTANGLE_EXT,2);
-	glUniform1iARB(i,2);  /* Bind Vtext to texture unit 2 */
+	for (i=0; i<3; i++) {
 
-	glTexParameteri(GL_TEXTURE_RECTANGLE_EXT,
-			GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_RECTANGLE_EXT,
-			GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+		const int h = i ? frame->size.h / 2 : frame->size.h;
+
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_RECTANGLE_EXT, st->tex[i]);
 
-	glTexEnvf(GL_TEXTURE_ENV,GL_TEXTURE_ENV_MODE,GL_DECAL);
-	glTexImage2D(GL_TEXTURE_RECTANGLE_EXT,0,GL_LUMINANCE,
-		     linesizeV, height/2, 0,
-		     GL_LUMINANCE,GL_UNSIGNED_BYTE,Vtex);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_EXT,
+				GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_EXT,
+				GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+		glTexImage2D(GL_TEXTURE_RECTANGLE_EXT, 0, GL_LUMINANCE,
+			     frame->linesize[i], h, 0,
+			     GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
+
+		glUniform1iARB(glGetUniformLocationARB(st->PHandle, namev[i]),
+			       i);
+
+		st->linesize[i] = frame->linesize[i];
+	}
 
-	/* Select texture unit 0 as the active unit and bind the Y texture. */
 	glActiveTexture(GL_TEXTURE0);
-	i = glGetUniformLocationARB(PHandle,"Ytex");
-	glUniform1iARB(i,0);  /* Bind Ytex to texture unit 0 */
-	glBindTexture(GL_TEXTURE_RECTANGLE_EXT,3);
+}
 
-	glTexParameteri(GL_TEXTURE_RECTANGLE_EXT,
-			GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_RECTANGLE_EXT,
-			GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-	glTexEnvf(GL_TEXTURE_ENV,GL_TEXTURE_ENV_MODE,GL_DECAL);
 
-	glTexImage2D(GL_TEXTURE_RECTANGLE_EXT, 0, GL_LUMINANCE,
-		     linesizeY, height, 0,
-		     GL_LUMINANCE, GL_UNSIGNED_BYTE, Ytex);
+static void upload_yuv(struct vidisp_st *st, const struct vidframe *frame)
+{
+	const uint8_t *srcv[3];
+	size_t szv[3], sz = 0;
+	uint8_t *p;
+	int i;
+
+	for (i=0; i<3; i++) {
+		szv[i] = (size_t)frame->linesize[i] *
+			(i ? frame->size.h / 2 : frame->size.h);
+		sz += szv[i];
+	}
+
+	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, st->pbo[st->pbo_idx]);
+	st->pbo_idx ^= 1;
+
+	/* new storage, so that mapping does not wait for the last upload */
+	glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, sz, NULL,
+			GL_STREAM_DRAW_ARB);
+
+	p = glMapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, GL_WRITE_ONLY_ARB);
+	if (p) {
+		size_t offset = 0;
+
+		for (i=0; i<3; i++) {
+			memcpy(p + offset, frame->data[i], szv[i]);
+			srcv[i] = (const uint8_t *)(uintptr_t)offset;
+			offset += szv[i];
+		}
+
+		glUnmapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB);
+	}
+	else {
+		glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+
+		for (i=0; i<3; i++)
+			srcv[i] = frame->data[i];
+	}
+
+	for (i=0; i<3; i++) {
+
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_RECTANGLE_EXT, st->tex[i]);
+
+		glTexSubImage2D(GL_TEXTURE_RECTANGLE_EXT, 0, 0, 0,
+				frame->linesize[i],
+				i ? frame->size.h / 2 : frame->size.h,
+				GL_LUMINANCE, GL_UNSIGNED_BYTE, srcv[i]);
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
 }
 
 
@@ -398,6 +463,9 @@ static int display(struct vidisp_st *st, const char *title,
 	if (!pool)
 		return ENOMEM;
 
+	/* the GL objects of the old size are released in it */
+	[st->ctx makeCurrentContext];
+
 	if (!vidsz_cmp(&st->size, &frame->size)) {
 		if (st->size.w && st->size.h) {
 			info("opengl: reset: %u x %u  --->  %u x %u\n",
@@ -449,10 +517,13 @@ static int display(struct vidisp_st *st, const char *title,
 				goto out;
 		}
 
-		draw_yuv(st->PHandle, frame->size.h,
-			 frame->data[0], frame->linesize[0],
-			 frame->data[1], frame->linesize[1],
-			 frame->data[2], frame->linesize[2]);
+		if (!st->tex[0] ||
+		    st->linesize[0] != frame->linesize[0] ||
+		    st->linesize[1] != frame->linesize[1] ||
+		    st->linesize[2] != frame->linesize[2])
+			setup_textures(st, frame);
+
+		upload_yuv(st, frame);
 		draw_blit(frame->size.w, frame->size.h);
 	}
 	else if (frame->fmt == VID_FMT_RGB32) {
@@ -0,0 +1,243 @@
+/**
+ * @file opensles/aaudio.c  AAudio audio driver
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include <aaudio/AAudio.h>
+#include <SLES/OpenSLES.h>
+#include "SLES/OpenSLES_Android.h"
+#include "opensles.h"
+
+
+/*
+ * AAudio calls back from a real-time thread of the device, with the
+ * buffer of the device. The core reads and writes its rings straight
+ * into it. Streams are opened in the low latency mode, and the device
+ * buffer is a few bursts of the native size.
+ */
+
+
+struct auplay_st {
+	const struct auplay *ap;      /* inheritance */
+	AAudioStream *stream;
+	auplay_write_h *wh;
+	void *arg;
+	uint8_t ch;
+};
+
+struct ausrc_st {
+	const struct ausrc *as;      /* inheritance */
+	AAudioStream *stream;
+	ausrc_read_h *rh;
+	ausrc_error_h *errh;
+	void *arg;
+	uint8_t ch;
+};
+
+
+static void stream_close(AAudioStream *stream)
+{
+	if (!stream)
+		return;
+
+	(void)AAudioStream_requestStop(stream);
+	(void)AAudioStream_close(stream);
+}
+
+
+static int stream_open(AAudioStream **streamp, aaudio_direction_t dir,
+		       uint32_t srate, uint8_t ch, uint32_t *latency,
+		       AAudioStream_dataCallback datah,
+		       AAudioStream_errorCallback errorh, void *arg)
+{
+	AAudioStreamBuilder *builder;
+	AAudioStream *stream = NULL;
+	aaudio_result_t r;
+	int32_t burst, size, n = (int32_t)opensles_conf.buffers;
+
+	r = AAudio_createStreamBuilder(&builder);
+	if (r != AAUDIO_OK) {
+		warning("aaudio: createStreamBuilder: %s\n",
+			AAudio_convertResultToText(r));
+		return ENODEV;
+	}
+
+	AAudioStreamBuilder_setDirection(builder, dir);
+	AAudioStreamBuilder_setSampleRate(builder, srate);
+	AAudioStreamBuilder_setChannelCount(builder, ch);
+	AAudioStreamBuilder_setFormat(builder, AAUDIO_FORMAT_PCM_I16);
+	AAudioStreamBuilder_setPerformanceMode(builder,
+					AAUDIO_PERFORMANCE_MODE_LOW_LATENCY);
+	AAudioStreamBuilder_setSharingMode(builder,
+					   AAUDIO_SHARING_MODE_EXCLUSIVE);
+	AAudioStreamBuilder_setDataCallback(builder, datah, arg);
+	AAudioStreamBuilder_setErrorCallback(builder, errorh, arg);
+
+	r = AAudioStreamBuilder_openStream(builder, &stream);
+	AAudioStreamBuilder_delete(builder);
+	if (r != AAUDIO_OK) {
+		warning("aaudio: openStream: %s\n",
+			AAudio_convertResultToText(r));
+		return ENODEV;
+	}
+
+	/* as small as the device allows, in whole bursts */
+	burst = AAudioStream_getFramesPerBurst(stream);
+	size  = AAudioStream_setBufferSizeInFrames(stream, burst * n);
+
+	if (latency && size > 0)
+		*latency = (uint32_t)((int64_t)size * 1000000 / srate);
+
+	info("aaudio: %s %u Hz, %u ch, burst=%d frames buffer=%d frames%s\n",
+	     dir == AAUDIO_DIRECTION_OUTPUT ? "player" : "recorder",
+	     srate, ch, burst, size,
+	     AAudioStream_getSharingMode(stream) ==
+	     AAUDIO_SHARING_MODE_EXCLUSIVE ? " (exclusive)" : "");
+
+	r = AAudioStream_requestStart(stream);
+	if (r != AAUDIO_OK) {
+		warning("aaudio: requestStart: %s\n",
+			AAudio_convertResultToText(r));
+		(void)AAudioStream_close(stream);
+		return ENODEV;
+	}
+
+	*streamp = stream;
+
+	return 0;
+}
+
+
+static void auplay_destructor(void *arg)
+{
+	struct auplay_st *st = arg;
+
+	stream_close(st->stream);
+}
+
+
+static aaudio_data_callback_result_t play_handler(AAudioStream *stream,
+						  void *arg, void *data,
+						  int32_t framec)
+{
+	struct auplay_st *st = arg;
+	(void)stream;
+
+	st->wh(data, (size_t)framec * st->ch, st->arg);
+
+	return AAUDIO_CALLBACK_RESULT_CONTINUE;
+}
+
+
+static void play_error_handler(AAudioStream *stream, void *arg,
+			       aaudio_result_t error)
+{
+	(void)stream;
+	(void)arg;
+
+	warning("aaudio: player: %s\n", AAudio_convertResultToText(error));
+}
+
+
+int aaudio_player_alloc(struct auplay_st **stp, const struct auplay *ap,
+			struct auplay_prm *prm, const char *device,
+			auplay_write_h *wh, void *arg)
+{
+	struct auplay_st *st;
+	int err;
+	(void)device;
+
+	if (!stp || !ap || !prm || !wh)
+		return EINVAL;
+
+	st = mem_zalloc(sizeof(*st), auplay_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->ap  = ap;
+	st->wh  = wh;
+	st->arg = arg;
+	st->ch  = prm->ch;
+
+	err = stream_open(&st->stream, AAUDIO_DIRECTION_OUTPUT,
+			  prm->srate, prm->ch, prm->latency,
+			  play_handler, play_error_handler, st);
+	if (err)
+		mem_deref(st);
+	else
+		*stp = st;
+
+	return err;
+}
+
+
+static void ausrc_destructor(void *arg)
+{
+	struct ausrc_st *st = arg;
+
+	stream_close(st->stream);
+}
+
+
+static aaudio_data_callback_result_t rec_handler(AAudioStream *stream,
+						 void *arg, void *data,
+						 int32_t framec)
+{
+	struct ausrc_st *st = arg;
+	(void)stream;
+
+	st->rh(data, (size_t)framec * st->ch, st->arg);
+
+	return AAUDIO_CALLBACK_RESULT_CONTINUE;
+}
+
+
+/* e.g. the headset was unplugged, the stream has to be opened again */
+static void rec_error_handler(AAudioStream *stream, void *arg,
+			      aaudio_result_t error)
+{
+	struct ausrc_st *st = arg;
+	(void)stream;
+
+	warning("aaudio: recorder: %s\n", AAudio_convertResultToText(error));
+
+	if (st->errh)
+		st->errh(ENODEV, AAudio_convertResultToText(error), st->arg);
+}
+
+
+int aaudio_recorder_alloc(struct ausrc_st **stp, const struct ausrc *as,
+			  struct media_ctx **ctx,
+			  struct ausrc_prm *prm, const char *device,
+			  ausrc_read_h *rh, ausrc_error_h *errh, void *arg)
+{
+	struct ausrc_st *st;
+	int err;
+	(void)ctx;
+	(void)device;
+
+	if (!stp || !as || !prm || !rh)
+		return EINVAL;
+
+	st = mem_zalloc(sizeof(*st), ausrc_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->as   = as;
+	st->rh   = rh;
+	st->errh = errh;
+	st->arg  = arg;
+	st->ch   = prm->ch;
+
+	err = stream_open(&st->stream, AAUDIO_DIRECTION_INPUT,
+			  prm->srate, prm->ch, prm->latency,
+			  rec_handler, rec_error_handler, st);
+	if (err)
+		mem_deref(st);
+	else
+		*stp = st;
+
+	return err;
+}
@@ -4,10 +4,18 @@
 # Copyright (C) 2010 Creytiv.com
 #
 
+USE_AAUDIO := $(shell [ -f $(SYSROOT)/include/aaudio/AAudio.h ] && \
+	echo "yes")
+
 MOD		:= opensles
 $(MOD)_SRCS	+= opensles.c
 $(MOD)_SRCS	+= player.c
 $(MOD)_SRCS	+= recorder.c
 $(MOD)_LFLAGS	+= -lOpenSLES
+ifneq ($(USE_AAUDIO),)
+$(MOD)_SRCS	+= aaudio.c
+$(MOD)_CFLAGS	+= -DUSE_AAUDIO
+$(MOD)_LFLAGS	+= -laaudio
+endif
 
 include mk/mod.mk
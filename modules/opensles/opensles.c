@@ -14,15 +14,98 @@
  * @defgroup opensles opensles
  *
  * Audio driver module for Android OpenSLES
+ *
+ * For the low latency path of Android (the fast mixer), the buffers must
+ * have the native sample rate and size of the device. The application
+ * gets them from the AudioManager properties PROPERTY_OUTPUT_SAMPLE_RATE
+ * and PROPERTY_OUTPUT_FRAMES_PER_BUFFER, and sets:
+ *
+ \verbatim
+  auplay_srate            48000
+  ausrc_srate             48000
+  opensles_frames         192         # native frames per buffer
+  opensles_buffers        2           # 2 or 3 buffers in a queue
+ \endverbatim
+ *
+ * Without opensles_frames, a buffer is 10 ms. The module also has the
+ * AAudio driver "aaudio" (Android 8.1 and later), when built with
+ * <aaudio/AAudio.h>.
  */
 
 
 SLObjectItf engineObject = NULL;
 SLEngineItf engineEngine;
+struct opensles_conf opensles_conf = {0, 2};
 
 
 static struct auplay *auplay;
 static struct ausrc *ausrc;
+#ifdef USE_AAUDIO
+static struct auplay *auplay_aaudio;
+static struct ausrc *ausrc_aaudio;
+#endif
+
+
+/**
+ * Get the size of a buffer
+ *
+ * @param srate Sample rate in [Hz]
+ * @param ch    Number of channels
+ *
+ * @return Number of samples in one buffer
+ */
+size_t opensles_sampc(uint32_t srate, uint8_t ch)
+{
+	if (opensles_conf.frames)
+		return (size_t)opensles_conf.frames * ch;
+
+	return (size_t)srate * ch * OPENSLES_PTIME / 1000;
+}
+
+
+/**
+ * Tell the core the latency of a full buffer queue
+ *
+ * @param latency Latency of the device in [us], optional
+ * @param sampc   Number of samples in one buffer
+ * @param srate   Sample rate in [Hz]
+ * @param ch      Number of channels
+ */
+void opensles_latency(uint32_t *latency, size_t sampc, uint32_t srate,
+		      uint8_t ch)
+{
+	if (!latency || !srate || !ch)
+		return;
+
+	*latency = (uint32_t)((uint64_t)opensles_conf.buffers * sampc / ch *
+			      1000000 / srate);
+}
+
+
+/**
+ * Ask for the low latency path, before the object is realized
+ *
+ * @param obj Audio player or recorder
+ */
+void opensles_performance_mode(SLObjectItf obj)
+{
+#ifdef SL_ANDROID_PERFORMANCE_LATENCY
+	SLAndroidConfigurationItf cfg;
+	SLuint32 mode = SL_ANDROID_PERFORMANCE_LATENCY;
+	SLresult r;
+
+	r = (*obj)->GetInterface(obj, SL_IID_ANDROIDCONFIGURATION, &cfg);
+	if (SL_RESULT_SUCCESS != r)
+		return;
+
+	r = (*cfg)->SetConfiguration(cfg, SL_ANDROID_KEY_PERFORMANCE_MODE,
+				     &mode, sizeof(mode));
+	if (SL_RESULT_SUCCESS != r)
+		debug("opensles: no low latency mode (%d)\n", r);
+#else
+	(void)obj;
+#endif
+}
 
 
 static int module_init(void)
@@ -34,6 +117,20 @@ static int module_init(void)
 	SLresult r;
 	int err;
 
+	(void)conf_get_u32(conf_cur(), "opensles_frames",
+			   &opensles_conf.frames);
+	(void)conf_get_u32(conf_cur(), "opensles_buffers",
+			   &opensles_conf.buffers);
+
+	opensles_conf.buffers = max(opensles_conf.buffers, 2u);
+	opensles_conf.buffers = min(opensles_conf.buffers,
+				    (uint32_t)OPENSLES_MAX_BUFFERS);
+
+	if (opensles_conf.frames) {
+		info("opensles: %u buffers of %u frames\n",
+		     opensles_conf.buffers, opensles_conf.frames);
+	}
+
 	r = slCreateEngine(&engineObject, 1, engineOption, 0, NULL, NULL);
 	if (SL_RESULT_SUCCESS != r)
 		return ENODEV;
@@ -49,6 +146,10 @@ static int module_init(void)
 
 	err  = auplay_register(&auplay, "opensles", opensles_player_alloc);
 	err |= ausrc_register(&ausrc, "opensles", opensles_recorder_alloc);
+#ifdef USE_AAUDIO
+	err |= auplay_register(&auplay_aaudio, "aaudio", aaudio_player_alloc);
+	err |= ausrc_register(&ausrc_aaudio, "aaudio", aaudio_recorder_alloc);
+#endif
 
 	return err;
 }
@@ -58,6 +159,10 @@ static int module_close(void)
 {
 	auplay = mem_deref(auplay);
 	ausrc = mem_deref(ausrc);
+#ifdef USE_AAUDIO
+	auplay_aaudio = mem_deref(auplay_aaudio);
+	ausrc_aaudio = mem_deref(ausrc_aaudio);
+#endif
 
 	if (engineObject != NULL) {
 		(*engineObject)->Destroy(engineObject);
@@ -5,8 +5,26 @@
  */
 
 
+enum {
+	OPENSLES_PTIME       = 10,  /**< Buffer time w/o native size [ms]  */
+	OPENSLES_MAX_BUFFERS = 4,   /**< Max. buffers in a queue           */
+};
+
+/** Buffer queues, as the fast mixer of the device wants them */
+struct opensles_conf {
+	uint32_t frames;            /**< Native frames per buffer, or 0   */
+	uint32_t buffers;           /**< Buffers in a queue               */
+};
+
 extern SLObjectItf engineObject;
 extern SLEngineItf engineEngine;
+extern struct opensles_conf opensles_conf;
+
+
+size_t opensles_sampc(uint32_t srate, uint8_t ch);
+void   opensles_latency(uint32_t *latency, size_t sampc, uint32_t srate,
+			uint8_t ch);
+void   opensles_performance_mode(SLObjectItf obj);
 
 
 int opensles_player_alloc(struct auplay_st **stp, const struct auplay *ap,
@@ -16,3 +34,13 @@ int opensles_recorder_alloc(struct ausrc_st **stp, const struct ausrc *as,
 			    struct media_ctx **ctx,
 			    struct ausrc_prm *prm, const char *device,
 			    ausrc_read_h *rh, ausrc_error_h *errh, void *arg);
+
+#ifdef USE_AAUDIO
+int aaudio_player_alloc(struct auplay_st **stp, const struct auplay *ap,
+			struct auplay_prm *prm, const char *device,
+			auplay_write_h *wh, void *arg);
+int aaudio_recorder_alloc(struct ausrc_st **stp, const struct ausrc *as,
+			  struct media_ctx **ctx,
+			  struct ausrc_prm *prm, const char *device,
+			  ausrc_read_h *rh, ausrc_error_h *errh, void *arg);
+#endif
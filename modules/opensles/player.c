@@ -10,17 +10,21 @@
 #include "opensles.h"
 
 
-#define N_PLAY_QUEUE_BUFFERS 2
-#define PTIME 10
+/*
+ * The core writes from its ring straight into the buffer that is enqueued
+ * next. All buffers of the queue are enqueued at the start, so the device
+ * always has the next one when a buffer is played.
+ */
 
 
 struct auplay_st {
 	const struct auplay *ap;      /* inheritance */
 	auplay_write_h *wh;
 	void *arg;
-	int16_t *sampv[N_PLAY_QUEUE_BUFFERS];
+	int16_t *sampv[OPENSLES_MAX_BUFFERS];
 	size_t   sampc;
-	uint8_t  bufferId;
+	uint32_t nbuf;
+	uint32_t bufferId;
 
 	SLObjectItf outputMixObject;
 	SLObjectItf bqPlayerObject;
@@ -40,7 +44,7 @@ static void auplay_destructor(void *arg)
 		(*st->outputMixObject)->Destroy(st->outputMixObject);
 
 	st->bufferId = 0;
-	for (int i=0; i<N_PLAY_QUEUE_BUFFERS; i++) {
+	for (int i=0; i<OPENSLES_MAX_BUFFERS; i++) {
 		mem_deref(st->sampv[i]);
 	}
 }
@@ -55,18 +59,18 @@ static void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context)
 	(*st->BufferQueue)->Enqueue(bq /*st->BufferQueue*/,
 				    st->sampv[st->bufferId], st->sampc * 2);
 
-	st->bufferId = ( st->bufferId + 1 ) % N_PLAY_QUEUE_BUFFERS;
+	st->bufferId = ( st->bufferId + 1 ) % st->nbuf;
 }
 
 
+/* Effects would take the player off the fast mixer */
 static int createOutput(struct auplay_st *st)
 {
-	const SLInterfaceID ids[1] = {SL_IID_ENVIRONMENTALREVERB};
-	const SLboolean req[1] = {SL_BOOLEAN_FALSE};
 	SLresult r;
 
 	r = (*engineEngine)->CreateOutputMix(engineEngine,
-					    &st->outputMixObject, 1, ids, req);
+					    &st->outputMixObject, 0,
+					    NULL, NULL);
 	if (SL_RESULT_SUCCESS != r)
 		return ENODEV;
 
@@ -82,7 +86,7 @@ static int createOutput(struct auplay_st *st)
 static int createPlayer(struct auplay_st *st, struct auplay_prm *prm)
 {
 	SLDataLocator_AndroidSimpleBufferQueue loc_bufq = {
-		SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, 2
+		SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, st->nbuf
 	};
 	SLDataFormat_PCM format_pcm = {SL_DATAFORMAT_PCM, prm->ch,
 				       prm->srate * 1000,
@@ -95,8 +99,9 @@ static int createPlayer(struct auplay_st *st, struct auplay_prm *prm)
 		SL_DATALOCATOR_OUTPUTMIX, st->outputMixObject
 	};
 	SLDataSink audioSnk = {&loc_outmix, NULL};
-	const SLInterfaceID ids[2] = {SL_IID_BUFFERQUEUE, SL_IID_EFFECTSEND};
-	const SLboolean req[2] = {SL_BOOLEAN_TRUE, SL_BOOLEAN_TRUE};
+	const SLInterfaceID ids[2] = {SL_IID_BUFFERQUEUE,
+				      SL_IID_ANDROIDCONFIGURATION};
+	const SLboolean req[2] = {SL_BOOLEAN_TRUE, SL_BOOLEAN_FALSE};
 	SLresult r;
 
 	r = (*engineEngine)->CreateAudioPlayer(engineEngine,
@@ -108,6 +113,8 @@ static int createPlayer(struct auplay_st *st, struct auplay_prm *prm)
 		return ENODEV;
 	}
 
+	opensles_performance_mode(st->bqPlayerObject);
+
 	r = (*st->bqPlayerObject)->Realize(st->bqPlayerObject,
 					   SL_BOOLEAN_FALSE);
 	if (SL_RESULT_SUCCESS != r)
@@ -161,10 +168,11 @@ int opensles_player_alloc(struct auplay_st **stp, const struct auplay *ap,
 	st->wh  = wh;
 	st->arg = arg;
 
-	st->sampc = prm->srate * prm->ch * PTIME / 1000;
+	st->sampc = opensles_sampc(prm->srate, prm->ch);
+	st->nbuf  = opensles_conf.buffers;
 
 	st->bufferId   = 0;
-	for (int i=0; i<N_PLAY_QUEUE_BUFFERS; i++) {
+	for (uint32_t i=0; i<st->nbuf; i++) {
 		st->sampv[i] = mem_zalloc(2 * st->sampc, NULL);
 		if (!st->sampv[i]) {
 			err = ENOMEM;
@@ -180,8 +188,11 @@ int opensles_player_alloc(struct auplay_st **stp, const struct auplay *ap,
 	if (err)
 		goto out;
 
-	/* kick-start the buffer callback */
-	bqPlayerCallback(st->BufferQueue, st);
+	/* kick-start the buffer callback, with a full queue */
+	for (uint32_t i=0; i<st->nbuf; i++)
+		bqPlayerCallback(st->BufferQueue, st);
+
+	opensles_latency(prm->latency, st->sampc, prm->srate, prm->ch);
 
  out:
 	if (err)
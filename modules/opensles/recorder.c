@@ -11,16 +11,20 @@
 #include "opensles.h"
 
 
-#define N_REC_QUEUE_BUFFERS 2
-#define PTIME 10
+/*
+ * All buffers of the queue are enqueued at the start. The core reads a
+ * recorded buffer in place, and the buffer is then enqueued again at the
+ * end of the queue.
+ */
 
 
 struct ausrc_st {
 	const struct ausrc *as;      /* inheritance */
 
-	int16_t *sampv[N_REC_QUEUE_BUFFERS];
+	int16_t *sampv[OPENSLES_MAX_BUFFERS];
 	size_t   sampc;
-	uint8_t  bufferId;
+	uint32_t nbuf;
+	uint32_t bufferId;
 	ausrc_read_h *rh;
 	void *arg;
 
@@ -44,7 +48,7 @@ static void ausrc_destructor(void *arg)
 	}
 
 	st->bufferId = 0;
-	for (int i=0; i<N_REC_QUEUE_BUFFERS; i++) {
+	for (int i=0; i<OPENSLES_MAX_BUFFERS; i++) {
 		mem_deref(st->sampv[i]);
 	}
 }
@@ -58,13 +62,11 @@ static void bqRecorderCallback(SLAndroidSimpleBufferQueueItf bq, void *context)
 
 	st->rh(st->sampv[st->bufferId], st->sampc, st->arg);
 
-	st->bufferId = ( st->bufferId + 1 ) % N_REC_QUEUE_BUFFERS;
-
-	memset(st->sampv[st->bufferId], 0, st->sampc * 2);
-
 	(*st->recBufferQueue)->Enqueue(st->recBufferQueue,
 				       st->sampv[st->bufferId],
 				       st->sampc * 2);
+
+	st->bufferId = ( st->bufferId + 1 ) % st->nbuf;
 }
 
 
@@ -77,7 +79,7 @@ static int createAudioRecorder(struct ausrc_st *st, struct ausrc_prm *prm)
 	SLDataSource audioSrc = {&loc_dev, NULL};
 
 	SLDataLocator_AndroidSimpleBufferQueue loc_bq = {
-		SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, 2
+		SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, st->nbuf
 	};
 	SLDataFormat_PCM format_pcm = {SL_DATAFORMAT_PCM, prm->ch,
 				       prm->srate * 1000,
@@ -86,19 +88,23 @@ static int createAudioRecorder(struct ausrc_st *st, struct ausrc_prm *prm)
 				       SL_SPEAKER_FRONT_CENTER,
 				       SL_BYTEORDER_LITTLEENDIAN};
 	SLDataSink audioSnk = {&loc_bq, &format_pcm};
-	const SLInterfaceID id[1] = {SL_IID_ANDROIDSIMPLEBUFFERQUEUE};
-	const SLboolean req[1] = {SL_BOOLEAN_TRUE};
+	const SLInterfaceID id[2] = {SL_IID_ANDROIDSIMPLEBUFFERQUEUE,
+				     SL_IID_ANDROIDCONFIGURATION};
+	const SLboolean req[2] = {SL_BOOLEAN_TRUE, SL_BOOLEAN_FALSE};
 	SLresult r;
 
 	r = (*engineEngine)->CreateAudioRecorder(engineEngine,
 						 &st->recObject,
 						 &audioSrc,
-						 &audioSnk, 1, id, req);
+						 &audioSnk, ARRAY_SIZE(id),
+						 id, req);
 	if (SL_RESULT_SUCCESS != r) {
 		warning("opensles: CreateAudioRecorder failed: r = %d\n", r);
 		return ENODEV;
 	}
 
+	opensles_performance_mode(st->recObject);
+
 	r = (*st->recObject)->Realize(st->recObject, SL_BOOLEAN_FALSE);
 	if (SL_RESULT_SUCCESS != r)
 		return ENODEV;
@@ -133,11 +139,14 @@ static int startRecording(struct ausrc_st *st)
 	(*st->recBufferQueue)->Clear(st->recBufferQueue);
 
 	st->bufferId = 0;
-	r = (*st->recBufferQueue)->Enqueue(st->recBufferQueue,
-					   st->sampv[st->bufferId],
-					   st->sampc * 2);
-	if (SL_RESULT_SUCCESS != r)
-		return ENODEV;
+	for (uint32_t i=0; i<st->nbuf; i++) {
+
+		r = (*st->recBufferQueue)->Enqueue(st->recBufferQueue,
+						   st->sampv[i],
+						   st->sampc * 2);
+		if (SL_RESULT_SUCCESS != r)
+			return ENODEV;
+	}
 
 	r = (*st->recRecord)->SetRecordState(st->recRecord,
 					     SL_RECORDSTATE_RECORDING);
@@ -173,9 +182,10 @@ int opensles_recorder_alloc(struct ausrc_st **stp, const struct ausrc *as,
 	st->rh  = rh;
 	st->arg = arg;
 
-	st->sampc = prm->srate * prm->ch * PTIME / 1000;
+	st->sampc = opensles_sampc(prm->srate, prm->ch);
+	st->nbuf  = opensles_conf.buffers;
 	st->bufferId   = 0;
-	for (int i=0; i<N_REC_QUEUE_BUFFERS; i++) {
+	for (uint32_t i=0; i<st->nbuf; i++) {
 		st->sampv[i] = mem_zalloc(2 * st->sampc, NULL);
 		if (!st->sampv[i]) {
 			err = ENOMEM;
@@ -193,6 +203,8 @@ int opensles_recorder_alloc(struct ausrc_st **stp, const struct ausrc *as,
 		goto out;
 	}
 
+	opensles_latency(prm->latency, st->sampc, prm->srate, prm->ch);
+
  out:
 
 	if (err)
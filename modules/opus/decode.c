@@ -63,6 +63,31 @@ int opus_decode_update(struct audec_state **adsp, const struct aucodec *ac,
 }
 
 
+/**
+ * Reset a kept decoder, so that a switch back to Opus does not predict
+ * or conceal from old audio
+ *
+ * @param ads Opus decoder state
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int opus_decode_reset(struct audec_state *ads)
+{
+	int n;
+
+	if (!ads)
+		return EINVAL;
+
+	n = opus_decoder_ctl(ads->dec, OPUS_RESET_STATE);
+	if (n != OPUS_OK) {
+		warning("opus: decoder reset: %s\n", opus_strerror(n));
+		return EPROTO;
+	}
+
+	return 0;
+}
+
+
 int opus_decode_frm(struct audec_state *ads, int16_t *sampv, size_t *sampc,
 		    const uint8_t *buf, size_t len)
 {
@@ -84,6 +109,26 @@ int opus_decode_frm(struct audec_state *ads, int16_t *sampv, size_t *sampc,
 }
 
 
+/* Decode the previous, lost frame from the FEC data in this packet */
+int opus_decode_fec(struct audec_state *ads, int16_t *sampv, size_t *sampc,
+		    const uint8_t *buf, size_t len)
+{
+	int n;
+
+	if (!ads || !sampv || !sampc || !buf)
+		return EINVAL;
+
+	n = opus_decode(ads->dec, buf, (opus_int32)len,
+			sampv, (int)(*sampc/ads->ch), 1);
+	if (n < 0)
+		return EPROTO;
+
+	*sampc = n * ads->ch;
+
+	return 0;
+}
+
+
 int opus_decode_pkloss(struct audec_state *ads, int16_t *sampv, size_t *sampc)
 {
 	int n;
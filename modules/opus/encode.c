@@ -13,9 +13,24 @@
 struct auenc_state {
 	OpusEncoder *enc;
 	unsigned ch;
+	bool fec;
+	bool dtx;
+	opus_int32 bitrate;   /**< Configured bitrate, or OPUS_AUTO  */
+	opus_int32 rate_max;  /**< Bitrate the encoder chose for it  */
+	int rung;             /**< Index in ratev, -1 is configured  */
 };
 
 
+/* Reported packet loss that turns on in-band FEC [percent] */
+enum { LOSS_FEC_MIN = 1 };
+
+/* Bitrates of the rate steps, below the configured one [bit/s] */
+static const opus_int32 ratev[] = {48000, 32000, 24000, 16000, 12000, 8000};
+
+/* Encoder complexity of each complexity level, the first is the default */
+static const opus_int32 cplxv[CPLX_LEVEL_MAX + 1] = {10, 5, 1};
+
+
 static void destructor(void *arg)
 {
 	struct auenc_state *aes = arg;
@@ -82,7 +97,6 @@ int opus_encode_update(struct auenc_state **aesp, const struct aucodec *ac,
 	aes = *aesp;
 
 	if (!aes) {
-		const opus_int32 complex = 10;
 		int opuserr;
 
 		aes = mem_zalloc(sizeof(*aes), destructor);
@@ -102,7 +116,8 @@ int opus_encode_update(struct auenc_state **aesp, const struct aucodec *ac,
 			return ENOMEM;
 		}
 
-		(void)opus_encoder_ctl(aes->enc, OPUS_SET_COMPLEXITY(complex));
+		(void)opus_encoder_ctl(aes->enc,
+				       OPUS_SET_COMPLEXITY(cplxv[0]));
 
 		*aesp = aes;
 	}
@@ -135,6 +150,13 @@ int opus_encode_update(struct auenc_state **aesp, const struct aucodec *ac,
 	(void)opus_encoder_ctl(aes->enc, OPUS_SET_INBAND_FEC(prm.inband_fec));
 	(void)opus_encoder_ctl(aes->enc, OPUS_SET_DTX(prm.dtx));
 
+	aes->fec = prm.inband_fec != 0;
+	aes->dtx = prm.dtx != 0;
+
+	aes->bitrate = prm.bitrate;
+	aes->rung    = -1;
+	if (opus_encoder_ctl(aes->enc, OPUS_GET_BITRATE(&aes->rate_max)))
+		aes->rate_max = 0;
 
 #if 0
 	{
@@ -174,7 +196,85 @@ int opus_encode_frm(struct auenc_state *aes, uint8_t *buf, size_t *len,
 		return EPROTO;
 	}
 
-	*len = n;
+	/* Nothing to send during silence in DTX mode */
+	*len = (aes->dtx && n <= 2) ? 0 : n;
+
+	return 0;
+}
+
+
+/*
+ * The steps go through the bitrates of ratev that are below the
+ * configured bitrate. In-band FEC is turned on by the loss handler.
+ */
+int opus_encode_rate(struct auenc_state *aes, int step)
+{
+	int rung;
+
+	if (!aes)
+		return EINVAL;
+
+	rung = aes->rung;
+
+	if (step < 0) {
+		do {
+			++rung;
+		} while (rung < (int)ARRAY_SIZE(ratev) &&
+			 ratev[rung] >= aes->rate_max);
+
+		if (rung >= (int)ARRAY_SIZE(ratev))
+			return ERANGE;
+	}
+	else {
+		if (rung < 0)
+			return ERANGE;
+
+		--rung;
+		if (rung >= 0 && ratev[rung] >= aes->rate_max)
+			rung = -1;
+	}
+
+	aes->rung = rung;
+
+	(void)opus_encoder_ctl(aes->enc,
+			       OPUS_SET_BITRATE(rung < 0 ? aes->bitrate :
+						ratev[rung]));
+
+	debug("opus: encoder bitrate %d\n",
+	      rung < 0 ? aes->rate_max : ratev[rung]);
+
+	return 0;
+}
+
+
+int opus_encode_cplx(struct auenc_state *aes, unsigned level)
+{
+	if (!aes)
+		return EINVAL;
+
+	if (level > CPLX_LEVEL_MAX)
+		return ERANGE;
+
+	(void)opus_encoder_ctl(aes->enc, OPUS_SET_COMPLEXITY(cplxv[level]));
+
+	debug("opus: encoder complexity %d\n", cplxv[level]);
+
+	return 0;
+}
+
+
+int opus_encode_loss(struct auenc_state *aes, unsigned loss_pct)
+{
+	opus_int32 fec;
+
+	if (!aes)
+		return EINVAL;
+
+	loss_pct = min(loss_pct, 100);
+	fec = aes->fec || loss_pct >= LOSS_FEC_MIN;
+
+	(void)opus_encoder_ctl(aes->enc, OPUS_SET_PACKET_LOSS_PERC(loss_pct));
+	(void)opus_encoder_ctl(aes->enc, OPUS_SET_INBAND_FEC(fec));
 
 	return 0;
 }
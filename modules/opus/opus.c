@@ -17,6 +17,9 @@
  *
  * Supported version: libopus 1.0.0 or later
  *
+ * In-band FEC is also enabled when the peer reports packet loss in RTCP,
+ * and a lost frame is then recovered from the next packet.
+ *
  * Configuration options:
  *
  \verbatim
@@ -43,9 +46,14 @@ static struct aucodec opus = {
 	.fmtp      = "stereo=1;sprop-stereo=1",
 	.encupdh   = opus_encode_update,
 	.ench      = opus_encode_frm,
+	.lossh     = opus_encode_loss,
+	.rateh     = opus_encode_rate,
+	.cplxh     = opus_encode_cplx,
 	.decupdh   = opus_decode_update,
 	.dech      = opus_decode_frm,
 	.plch      = opus_decode_pkloss,
+	.fech      = opus_decode_fec,
+	.resetth   = opus_decode_reset,
 };
 
 
@@ -20,6 +20,9 @@ int opus_encode_update(struct auenc_state **aesp, const struct aucodec *ac,
 		       struct auenc_param *prm, const char *fmtp);
 int opus_encode_frm(struct auenc_state *aes, uint8_t *buf, size_t *len,
 		    const int16_t *sampv, size_t sampc);
+int opus_encode_loss(struct auenc_state *aes, unsigned loss_pct);
+int opus_encode_rate(struct auenc_state *aes, int step);
+int opus_encode_cplx(struct auenc_state *aes, unsigned level);
 
 
 /* Decode */
@@ -27,7 +30,10 @@ int opus_decode_update(struct audec_state **adsp, const struct aucodec *ac,
 		       const char *fmtp);
 int opus_decode_frm(struct audec_state *ads, int16_t *sampv, size_t *sampc,
 		    const uint8_t *buf, size_t len);
+int opus_decode_fec(struct audec_state *ads, int16_t *sampv, size_t *sampc,
+		    const uint8_t *buf, size_t len);
 int opus_decode_pkloss(struct audec_state *st, int16_t *sampv, size_t *sampc);
+int opus_decode_reset(struct audec_state *ads);
 
 
 /* SDP */
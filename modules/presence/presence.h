@@ -7,6 +7,17 @@
 int  subscriber_init(void);
 void subscriber_close(void);
 void subscriber_close_all(void);
+uint32_t subscriber_wait(const struct sipevent_substate *substate,
+			 unsigned failc);
+uint64_t subscriber_delay(uint32_t wait);
+enum presence_status pidf_status(const struct pl *pidf);
+
+
+int  rls_init(const char *uri, uint32_t delay);
+int  rls_add(struct contact *contact);
+uint32_t rls_count(void);
+void rls_close(void);
+void rls_close_all(void);
 
 
 int  notifier_init(void);
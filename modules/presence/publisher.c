@@ -13,7 +13,7 @@
 
 struct publisher {
 	struct le le;
-	struct tmr tmr;
+	struct twheel_tmr tmr;
 	unsigned failc;
 	char *etag;
 	unsigned int expires;
@@ -49,8 +49,9 @@ static void response_handler(int err, const struct sip_msg *msg, void *arg)
 			mem_deref(pub->etag);
 			pl_strdup(&(pub->etag), &(etag_hdr->val));
 			pub->refresh = 1;
-			tmr_start(&pub->tmr, pub->expires * 900,
-				  tmr_handler, pub);
+			twheel_tmr_start(&pub->tmr, baresip_twheel(),
+					 pub->expires * 900,
+					 tmr_handler, pub);
 		}
 		else {
 			warning("%s: publisher got 200 OK without etag\n",
@@ -189,8 +190,9 @@ static void tmr_handler(void *arg)
 	struct publisher *pub = arg;
 
 	if (publish(pub))
-		tmr_start(&pub->tmr, wait_fail(++pub->failc) * 1000,
-			  tmr_handler, pub);
+		twheel_tmr_start(&pub->tmr, baresip_twheel(),
+				 wait_fail(++pub->failc) * 1000,
+				 tmr_handler, pub);
 	else
 		pub->failc = 0;
 }
@@ -201,7 +203,7 @@ static void destructor(void *arg)
 	struct publisher *pub = arg;
 
 	list_unlink(&pub->le);
-	tmr_cancel(&pub->tmr);
+	twheel_tmr_cancel(&pub->tmr);
 	mem_deref(pub->ua);
 	mem_deref(pub->etag);
 }
@@ -234,8 +236,7 @@ static int publisher_alloc(struct ua *ua)
 	pub->ua = mem_ref(ua);
 	pub->expires = account_pubint(ua_account(ua));
 
-	tmr_init(&pub->tmr);
-	tmr_start(&pub->tmr, 10, tmr_handler, pub);
+	twheel_tmr_start(&pub->tmr, baresip_twheel(), 10, tmr_handler, pub);
 
 	list_append(&publ, &pub->le, pub);
 
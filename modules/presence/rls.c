@@ -0,0 +1,742 @@
+/**
+ * @file rls.c  Presence subscriber for a resource list (RFC 4662)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "presence.h"
+
+
+/*
+ * Contacts marked with ;presence=rls are on a resource list of the
+ * server, with the URI in presence_rls_uri. One SUBSCRIBE to the list
+ * replaces one dialog and one refresh per contact. The server answers
+ * with a multipart/related NOTIFY, with an RLMI document that lists the
+ * resources and a PIDF part for each active one.
+ *
+ * A NOTIFY with full state sets all contacts on the list, and one with
+ * partial state only the resources that it lists. A partial NOTIFY is
+ * only used if its version follows the previous one. After a gap the
+ * list is subscribed again, to get the full state.
+ */
+
+
+enum {
+	SHUTDOWN_DELAY = 500,     /**< Delay before un-subscribing [ms]  */
+	HASH_SIZE      = 256,     /**< Buckets of the resource table     */
+	BOUNDARY_MAX   = 70,      /**< Max. length of a boundary         */
+};
+
+
+struct resource {
+	struct le he;
+	struct contact *contact;
+	bool seen;
+};
+
+struct part {
+	struct pl ctype;
+	struct pl cid;
+	struct pl body;
+};
+
+struct rls {
+	struct sipsub *sub;
+	struct twheel_tmr tmr;
+	struct hash *resh;
+	struct ua *ua;
+	char *uri;
+	uint32_t version;       /**< Version of the last RLMI document   */
+	bool synced;            /**< Full state has been received        */
+	unsigned failc;
+	bool shutdown;
+};
+
+static struct rls *rls;
+
+
+static void tmr_handler(void *arg);
+
+
+/* Find a string in a pointer-length string */
+static const char *find(const struct pl *pl, const char *str)
+{
+	const size_t n = strlen(str);
+	const char *p = pl->p, *end = pl->p + pl->l;
+
+	while ((size_t)(end - p) >= n) {
+
+		p = memchr(p, str[0], end - p - n + 1);
+		if (!p)
+			return NULL;
+
+		if (!memcmp(p, str, n))
+			return p;
+
+		++p;
+	}
+
+	return NULL;
+}
+
+
+static void strip(struct pl *pl, const char *expr)
+{
+	struct pl val;
+
+	if (!re_regex(pl->p, pl->l, expr, &val))
+		*pl = val;
+}
+
+
+/* Next start tag with this name, and the rest after it */
+static int tag_next(struct pl *rest, const char *name, struct pl *tag)
+{
+	const size_t n = strlen(name);
+	const char *p, *end;
+
+	while ((p = find(rest, name))) {
+
+		struct pl pl;
+
+		pl_advance(rest, p + n - rest->p);
+
+		if (!rest->l || !strchr(" \t\r\n/>", rest->p[0]))
+			continue;
+
+		end = pl_strchr(rest, '>');
+		if (!end)
+			return EBADMSG;
+
+		pl.p = p;
+		pl.l = end + 1 - p;
+		pl_advance(rest, end + 1 - rest->p);
+
+		*tag = pl;
+
+		return 0;
+	}
+
+	return ENOENT;
+}
+
+
+static int xml_attr(const struct pl *tag, const char *name, struct pl *val)
+{
+	char expr[64];
+
+	if (re_snprintf(expr, sizeof(expr),
+			"[ \t\r\n]+%s[ \t]*=[ \t]*\"[^\"]*\"", name) < 0)
+		return ENOMEM;
+
+	return re_regex(tag->p, tag->l, expr, NULL, NULL, NULL, val);
+}
+
+
+static void part_decode(struct part *part, const char *p, size_t l)
+{
+	struct pl pl, hdrs;
+	const char *end;
+
+	memset(part, 0, sizeof(*part));
+
+	pl.p = p;
+	pl.l = l;
+
+	/* a part without headers starts with the empty line */
+	if (l >= 2 && !memcmp(p, "\r\n", 2)) {
+		pl_advance(&pl, 2);
+		part->body = pl;
+		return;
+	}
+
+	end = find(&pl, "\r\n\r\n");
+	if (!end)
+		return;
+
+	hdrs.p = p;
+	hdrs.l = end + 2 - p;
+
+	pl_advance(&pl, end + 4 - p);
+	part->body = pl;
+
+	while (hdrs.l) {
+
+		struct pl line, name, val;
+		const char *eol = find(&hdrs, "\r\n");
+
+		if (!eol)
+			break;
+
+		line.p = hdrs.p;
+		line.l = eol - hdrs.p;
+		pl_advance(&hdrs, eol + 2 - hdrs.p);
+
+		if (re_regex(line.p, line.l, "[^: \t]+[ \t]*:[ \t]*[^\r\n]*",
+			     &name, NULL, &val))
+			continue;
+
+		if (!pl_strcasecmp(&name, "Content-Type")) {
+			part->ctype = val;
+			strip(&part->ctype, "[^; \t]+");
+		}
+		else if (!pl_strcasecmp(&name, "Content-ID")) {
+			part->cid = val;
+			strip(&part->cid, "<[^>]+>");
+		}
+	}
+}
+
+
+/*
+ * Split a multipart body at the delimiter, which is CRLF, two dashes
+ * and the boundary. The parts are written to partv if it is set.
+ *
+ * @return Number of parts
+ */
+static size_t multipart_split(struct part *partv, size_t partc,
+			      const struct pl *body, const char *delim)
+{
+	const size_t dlen = strlen(delim) - 2;
+	struct pl pl = *body;
+	const char *p, *eol;
+	size_t n = 0;
+
+	/* the first delimiter may start the body, without the CRLF */
+	p = find(&pl, delim + 2);
+
+	while (p) {
+
+		pl_advance(&pl, p + dlen - pl.p);
+
+		/* the close delimiter */
+		if (pl.l >= 2 && !memcmp(pl.p, "--", 2))
+			break;
+
+		eol = find(&pl, "\r\n");
+		if (!eol)
+			break;
+
+		pl_advance(&pl, eol + 2 - pl.p);
+
+		p = find(&pl, delim);
+		if (!p)
+			break;
+
+		if (partv && n < partc)
+			part_decode(&partv[n], pl.p, p - pl.p);
+
+		++n;
+		p += 2;
+	}
+
+	return n;
+}
+
+
+/* The parts are mostly in the order of the resources */
+static const struct part *part_find(const struct part *partv, size_t partc,
+				    const struct pl *cid, size_t *cursor)
+{
+	size_t i;
+
+	for (i=0; i<partc; i++) {
+
+		const size_t idx = (*cursor + i) % partc;
+
+		if (pl_cmp(&partv[idx].cid, cid))
+			continue;
+
+		*cursor = (idx + 1) % partc;
+
+		return &partv[idx];
+	}
+
+	return NULL;
+}
+
+
+static bool find_handler(struct le *le, void *arg)
+{
+	struct resource *res = le->data;
+
+	return 0 == pl_cmp(&contact_addr(res->contact)->auri, arg);
+}
+
+
+static struct resource *resource_find(const struct rls *rl,
+				      const struct pl *uri)
+{
+	return list_ledata(hash_lookup(rl->resh, hash_joaat_pl(uri),
+				       find_handler, (void *)uri));
+}
+
+
+static bool unseen_handler(struct le *le, void *arg)
+{
+	struct resource *res = le->data;
+	(void)arg;
+
+	res->seen = false;
+
+	return false;
+}
+
+
+static bool unknown_handler(struct le *le, void *arg)
+{
+	struct resource *res = le->data;
+	bool all = *(bool *)arg;
+
+	if (all || !res->seen)
+		contact_set_presence(res->contact, PRESENCE_UNKNOWN);
+
+	return false;
+}
+
+
+static void set_unknown(struct rls *rl, bool all)
+{
+	(void)hash_apply(rl->resh, unknown_handler, &all);
+}
+
+
+static enum presence_status instance_status(const struct pl *content,
+					    const struct part *partv,
+					    size_t partc, size_t *cursor)
+{
+	struct pl rest = *content, tag, state, cid;
+
+	while (!tag_next(&rest, "<instance", &tag)) {
+
+		const struct part *part;
+
+		if (xml_attr(&tag, "state", &state) ||
+		    pl_strcasecmp(&state, "active"))
+			continue;
+
+		if (xml_attr(&tag, "cid", &cid))
+			continue;
+
+		part = part_find(partv, partc, &cid, cursor);
+		if (!part ||
+		    pl_strcasecmp(&part->ctype, "application/pidf+xml"))
+			continue;
+
+		return pidf_status(&part->body);
+	}
+
+	return PRESENCE_UNKNOWN;
+}
+
+
+static int rlmi_apply(struct rls *rl, const struct pl *rlmi,
+		      const struct part *partv, size_t partc)
+{
+	struct pl rest = *rlmi, tag, val;
+	uint32_t version;
+	size_t cursor = 0;
+	unsigned n = 0;
+	bool full;
+
+	if (tag_next(&rest, "<list", &tag) ||
+	    xml_attr(&tag, "version", &val))
+		return EBADMSG;
+
+	version = pl_u32(&val);
+	full = !xml_attr(&tag, "fullState", &val) &&
+		(!pl_strcasecmp(&val, "true") || !pl_strcmp(&val, "1"));
+
+	if (!full && (!rl->synced || version != rl->version + 1)) {
+		info("presence: rls: version %u after %u\n",
+		     version, rl->version);
+		return EAGAIN;
+	}
+
+	rl->version = version;
+	rl->synced  = true;
+
+	if (full)
+		(void)hash_apply(rl->resh, unseen_handler, NULL);
+
+	while (!tag_next(&rest, "<resource", &tag)) {
+
+		struct resource *res;
+		struct pl uri, content;
+		const char *end;
+
+		content.p = rest.p;
+		content.l = 0;
+
+		/* the content of the element, if it has any */
+		if (tag.p[tag.l - 2] != '/') {
+
+			end = find(&rest, "</resource");
+			content.l = end ? (size_t)(end - rest.p) : rest.l;
+			pl_advance(&rest, content.l);
+		}
+
+		if (xml_attr(&tag, "uri", &uri))
+			continue;
+
+		res = resource_find(rl, &uri);
+		if (!res) {
+			debug("presence: rls: not a contact <%r>\n", &uri);
+			continue;
+		}
+
+		contact_set_presence(res->contact,
+				     instance_status(&content, partv, partc,
+						     &cursor));
+		res->seen = true;
+		++n;
+	}
+
+	if (full)
+		set_unknown(rl, false);
+
+	debug("presence: rls: %s state version %u, %u resources\n",
+	      full ? "full" : "partial", version, n);
+
+	return 0;
+}
+
+
+static int notify_decode(struct rls *rl, const struct sip_msg *msg)
+{
+	struct part *partv = NULL;
+	const struct part *root = NULL;
+	struct pl body, bnd, start;
+	char delim[BOUNDARY_MAX + 8];
+	size_t partc, i;
+	int err;
+
+	if (msg_param_decode(&msg->ctyp.params, "boundary", &bnd))
+		return EBADMSG;
+
+	strip(&bnd, "\"[^\"]+\"");
+
+	if (!bnd.l || bnd.l > BOUNDARY_MAX)
+		return EBADMSG;
+
+	(void)re_snprintf(delim, sizeof(delim), "\r\n--%r", &bnd);
+
+	pl_set_mbuf(&body, msg->mb);
+
+	partc = multipart_split(NULL, 0, &body, delim);
+	if (!partc)
+		return EBADMSG;
+
+	partv = mem_zalloc(partc * sizeof(*partv), NULL);
+	if (!partv)
+		return ENOMEM;
+
+	partc = multipart_split(partv, partc, &body, delim);
+
+	/* the root part is the first one, unless there is a start */
+	if (!msg_param_decode(&msg->ctyp.params, "start", &start)) {
+
+		strip(&start, "\"[^\"]+\"");
+		strip(&start, "<[^>]+>");
+
+		for (i=0; i<partc; i++) {
+			if (!pl_cmp(&partv[i].cid, &start)) {
+				root = &partv[i];
+				break;
+			}
+		}
+	}
+	else {
+		root = &partv[0];
+	}
+
+	if (!root || pl_strcasecmp(&root->ctype, "application/rlmi+xml")) {
+		err = EBADMSG;
+		goto out;
+	}
+
+	err = rlmi_apply(rl, &root->body, partv, partc);
+
+ out:
+	mem_deref(partv);
+
+	return err;
+}
+
+
+static void resync_handler(void *arg)
+{
+	struct rls *rl = arg;
+
+	rl->sub = mem_deref(rl->sub);
+	rl->synced = false;
+
+	tmr_handler(rl);
+}
+
+
+static void notify_handler(struct sip *sip, const struct sip_msg *msg,
+			   void *arg)
+{
+	struct rls *rl = arg;
+	int err;
+
+	if (rl->shutdown || !mbuf_get_left(msg->mb))
+		goto out;
+
+	if (!msg_ctype_cmp(&msg->ctyp, "multipart", "related")) {
+
+		warning("presence: rls: unsupported content-type: '%r/%r'\n",
+			&msg->ctyp.type, &msg->ctyp.subtype);
+
+		sip_treplyf(NULL, NULL, sip, msg, false,
+			    415, "Unsupported Media Type",
+			    "Accept: multipart/related, application/rlmi+xml,"
+			    " application/pidf+xml\r\n"
+			    "Content-Length: 0\r\n"
+			    "\r\n");
+		return;
+	}
+
+	rl->failc = 0;
+
+	err = notify_decode(rl, msg);
+	if (err == EAGAIN) {
+		twheel_tmr_start(&rl->tmr, baresip_twheel(), 0,
+				 resync_handler, rl);
+	}
+	else if (err) {
+		warning("presence: rls: bad NOTIFY: %m\n", err);
+	}
+
+ out:
+	(void)sip_treply(NULL, sip, msg, 200, "OK");
+}
+
+
+static void close_handler(int err, const struct sip_msg *msg,
+			  const struct sipevent_substate *substate, void *arg)
+{
+	struct rls *rl = arg;
+	uint32_t wait;
+
+	rl->sub = mem_deref(rl->sub);
+	rl->synced = false;
+
+	info("presence: rls: list closed <%s>: ", rl->uri);
+
+	if (substate) {
+		info("%s", sipevent_reason_name(substate->reason));
+	}
+	else if (msg) {
+		info("%u %r", msg->scode, &msg->reason);
+		++rl->failc;
+	}
+	else {
+		info("%m", err);
+		++rl->failc;
+	}
+
+	wait = subscriber_wait(substate, rl->failc);
+
+	info("; will retry in %u secs (failc=%u)\n", wait, rl->failc);
+
+	twheel_tmr_start(&rl->tmr, baresip_twheel(), subscriber_delay(wait),
+			 tmr_handler, rl);
+
+	set_unknown(rl, true);
+}
+
+
+static int auth_handler(char **username, char **password,
+			const char *realm, void *arg)
+{
+	return account_auth(arg, username, password, realm);
+}
+
+
+static int subscribe(struct rls *rl)
+{
+	const char *routev[1];
+	struct ua *ua;
+	int err;
+
+	/* We use the first UA */
+	ua = uag_find_aor(NULL);
+	if (!ua) {
+		warning("presence: no UA found\n");
+		return ENOENT;
+	}
+
+	mem_deref(rl->ua);
+	rl->ua = mem_ref(ua);
+
+	routev[0] = ua_outbound(ua);
+
+	err = sipevent_subscribe(&rl->sub, uag_sipevent_sock(), rl->uri, NULL,
+				 ua_aor(ua), "presence", NULL, 600,
+				 ua_cuser(ua), routev, routev[0] ? 1 : 0,
+				 auth_handler, ua_prm(ua), true, NULL,
+				 notify_handler, close_handler, rl,
+				 "%H"
+				 "Supported: eventlist\r\n"
+				 "Accept: multipart/related,"
+				 " application/rlmi+xml,"
+				 " application/pidf+xml\r\n",
+				 ua_print_supported, ua);
+	if (err) {
+		warning("presence: rls: sipevent_subscribe failed: %m\n",
+			err);
+	}
+
+	return err;
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct rls *rl = arg;
+
+	if (subscribe(rl)) {
+		twheel_tmr_start(&rl->tmr, baresip_twheel(),
+				 subscriber_delay(subscriber_wait(NULL,
+							       ++rl->failc)),
+				 tmr_handler, rl);
+	}
+}
+
+
+static void resource_destructor(void *arg)
+{
+	struct resource *res = arg;
+
+	hash_unlink(&res->he);
+	mem_deref(res->contact);
+}
+
+
+static void destructor(void *arg)
+{
+	struct rls *rl = arg;
+
+	debug("presence: rls: subscriber destroyed\n");
+
+	twheel_tmr_cancel(&rl->tmr);
+	hash_flush(rl->resh);
+	mem_deref(rl->resh);
+	mem_deref(rl->sub);
+	mem_deref(rl->ua);
+	mem_deref(rl->uri);
+}
+
+
+static void deref_handler(void *arg)
+{
+	(void)arg;
+
+	rls = mem_deref(rls);
+}
+
+
+/**
+ * Start the subscription to a resource list
+ *
+ * @param uri   SIP URI of the resource list
+ * @param delay Delay before subscribing in [ms]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rls_init(const char *uri, uint32_t delay)
+{
+	struct rls *rl;
+	int err;
+
+	if (!uri)
+		return EINVAL;
+
+	rl = mem_zalloc(sizeof(*rl), destructor);
+	if (!rl)
+		return ENOMEM;
+
+	err  = str_dup(&rl->uri, uri);
+	err |= hash_alloc(&rl->resh, HASH_SIZE);
+	if (err) {
+		mem_deref(rl);
+		return err;
+	}
+
+	twheel_tmr_start(&rl->tmr, baresip_twheel(), delay, tmr_handler, rl);
+
+	mem_deref(rls);
+	rls = rl;
+
+	return 0;
+}
+
+
+/**
+ * Add a contact that is on the resource list
+ *
+ * @param contact Contact
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rls_add(struct contact *contact)
+{
+	struct resource *res;
+
+	if (!rls || !contact)
+		return EINVAL;
+
+	res = mem_zalloc(sizeof(*res), resource_destructor);
+	if (!res)
+		return ENOMEM;
+
+	res->contact = mem_ref(contact);
+
+	hash_append(rls->resh, hash_joaat_pl(&contact_addr(contact)->auri),
+		    &res->he, res);
+
+	return 0;
+}
+
+
+uint32_t rls_count(void)
+{
+	uint32_t n = 0;
+	uint32_t i;
+
+	if (!rls)
+		return 0;
+
+	for (i=0; i<hash_bsize(rls->resh); i++)
+		n += list_count(hash_list(rls->resh, i));
+
+	return n;
+}
+
+
+void rls_close(void)
+{
+	rls = mem_deref(rls);
+}
+
+
+void rls_close_all(void)
+{
+	if (!rls)
+		return;
+
+	rls->shutdown = true;
+
+	if (rls->sub) {
+		rls->sub = mem_deref(rls->sub);
+		twheel_tmr_start(&rls->tmr, baresip_twheel(), SHUTDOWN_DELAY,
+				 deref_handler, NULL);
+	}
+	else {
+		rls = mem_deref(rls);
+	}
+}
@@ -13,19 +13,27 @@
  *
  * For each entry in the address book marked with ;presence=p2p,
  * we send a SUBSCRIBE to that person, and expect to receive
- * a NOTIFY when her status changes.
+ * a NOTIFY when her status changes. The subscriptions are started
+ * one by one at a fixed rate, so that a large address book does not
+ * flood the server at startup.
+ *
+ * Entries marked with ;presence=rls are watched through one
+ * subscription to a resource list, see rls.c, if presence_rls_uri is
+ * set. Otherwise they are subscribed to one by one, like p2p.
  */
 
 
 enum {
-	SHUTDOWN_DELAY = 500  /**< Delay before un-registering [ms] */
+	SHUTDOWN_DELAY  = 500,  /**< Delay before un-registering [ms] */
+	STARTUP_DELAY   = 1000, /**< Delay before the first SUBSCRIBE [ms] */
+	STARTUP_SPACING = 50,   /**< Time between two SUBSCRIBEs [ms] */
 };
 
 
 struct presence {
 	struct le le;
 	struct sipsub *sub;
-	struct tmr tmr;
+	struct twheel_tmr tmr;
 	enum presence_status status;
 	unsigned failc;
 	struct contact *contact;
@@ -80,13 +88,78 @@ static uint32_t wait_fail(unsigned failc)
 }
 
 
+/**
+ * Get the time to wait before subscribing again
+ *
+ * @param substate Subscription state of a terminated subscription, or NULL
+ * @param failc    Number of failed subscriptions in a row
+ *
+ * @return Time to wait in [s]
+ */
+uint32_t subscriber_wait(const struct sipevent_substate *substate,
+			 unsigned failc)
+{
+	return substate ? wait_term(substate) : wait_fail(failc);
+}
+
+
+/**
+ * Get a randomized delay, so that the subscriptions that failed at the
+ * same time are not all retried at the same time
+ *
+ * @param wait Time to wait in [s]
+ *
+ * @return Delay in [ms], from wait up to 25% more
+ */
+uint64_t subscriber_delay(uint32_t wait)
+{
+	return wait * 1000ULL + rand_u32() % (wait * 250 + 1);
+}
+
+
+/**
+ * Get the presence status from a PIDF document
+ *
+ * @param pidf PIDF document (RFC 3863)
+ *
+ * @return Presence status
+ */
+enum presence_status pidf_status(const struct pl *pidf)
+{
+	enum presence_status status = PRESENCE_CLOSED;
+	struct pl pl;
+
+	if (!re_regex(pidf->p, pidf->l,
+		      "<basic[ \t]*>[^<]+</basic[ \t]*>", NULL, &pl, NULL)) {
+	    if (!pl_strcasecmp(&pl, "open"))
+		status = PRESENCE_OPEN;
+	}
+
+	if (!re_regex(pidf->p, pidf->l, "<rpid:away[ \t]*/>", NULL)) {
+
+		status = PRESENCE_CLOSED;
+	}
+	else if (!re_regex(pidf->p, pidf->l, "<rpid:busy[ \t]*/>", NULL)) {
+
+		status = PRESENCE_BUSY;
+	}
+	else if (!re_regex(pidf->p, pidf->l,
+			   "<rpid:on-the-phone[ \t]*/>", NULL)) {
+
+		status = PRESENCE_BUSY;
+	}
+
+	return status;
+}
+
+
 static void notify_handler(struct sip *sip, const struct sip_msg *msg,
 			   void *arg)
 {
 	enum presence_status status = PRESENCE_CLOSED;
 	struct presence *pres = arg;
 	const struct sip_hdr *type_hdr, *length_hdr;
-	struct pl pl;
+	struct pl pidf;
 
 	if (pres->shutdown)
 		goto done;
@@ -120,29 +193,9 @@ static void notify_handler(struct sip *sip, const struct sip_msg *msg,
 		return;
 	}
 
-	if (!re_regex((const char *)mbuf_buf(msg->mb), mbuf_get_left(msg->mb),
-		      "<basic[ \t]*>[^<]+</basic[ \t]*>", NULL, &pl, NULL)) {
-	    if (!pl_strcasecmp(&pl, "open"))
-		status = PRESENCE_OPEN;
-	}
-
-	if (!re_regex((const char *)mbuf_buf(msg->mb), mbuf_get_left(msg->mb),
-		      "<rpid:away[ \t]*/>", NULL)) {
-
-		status = PRESENCE_CLOSED;
-	}
-	else if (!re_regex((const char *)mbuf_buf(msg->mb),
-			   mbuf_get_left(msg->mb),
-			   "<rpid:busy[ \t]*/>", NULL)) {
-
-		status = PRESENCE_BUSY;
-	}
-	else if (!re_regex((const char *)mbuf_buf(msg->mb),
-			   mbuf_get_left(msg->mb),
-			   "<rpid:on-the-phone[ \t]*/>", NULL)) {
+	pl_set_mbuf(&pidf, msg->mb);
 
-		status = PRESENCE_BUSY;
-	}
+	status = pidf_status(&pidf);
 
 done:
 	(void)sip_treply(NULL, sip, msg, 200, "OK");
@@ -167,20 +220,22 @@ static void close_handler(int err, const struct sip_msg *msg,
 
 	if (substate) {
 		info("%s", sipevent_reason_name(substate->reason));
-		wait = wait_term(substate);
 	}
 	else if (msg) {
 		info("%u %r", msg->scode, &msg->reason);
-		wait = wait_fail(++pres->failc);
+		++pres->failc;
 	}
 	else {
 		info("%m", err);
-		wait = wait_fail(++pres->failc);
+		++pres->failc;
 	}
 
+	wait = subscriber_wait(substate, pres->failc);
+
 	info("; will retry in %u secs (failc=%u)\n", wait, pres->failc);
 
-	tmr_start(&pres->tmr, wait * 1000, tmr_handler, pres);
+	twheel_tmr_start(&pres->tmr, baresip_twheel(), subscriber_delay(wait),
+			 tmr_handler, pres);
 
 	contact_set_presence(pres->contact, PRESENCE_UNKNOWN);
 }
@@ -193,7 +248,7 @@ static void destructor(void *arg)
 	debug("presence: subscriber destroyed\n");
 
 	list_unlink(&pres->le);
-	tmr_cancel(&pres->tmr);
+	twheel_tmr_cancel(&pres->tmr);
 	mem_deref(pres->contact);
 	mem_deref(pres->sub);
 	mem_deref(pres->ua);
@@ -254,13 +309,14 @@ static void tmr_handler(void *arg)
 	struct presence *pres = arg;
 
 	if (subscribe(pres)) {
-		tmr_start(&pres->tmr, wait_fail(++pres->failc) * 1000,
-			  tmr_handler, pres);
+		twheel_tmr_start(&pres->tmr, baresip_twheel(),
+				 subscriber_delay(wait_fail(++pres->failc)),
+				 tmr_handler, pres);
 	}
 }
 
 
-static int presence_alloc(struct contact *contact)
+static int presence_alloc(struct contact *contact, uint32_t delay)
 {
 	struct presence *pres;
 
@@ -271,8 +327,8 @@ static int presence_alloc(struct contact *contact)
 	pres->status  = PRESENCE_UNKNOWN;
 	pres->contact = mem_ref(contact);
 
-	tmr_init(&pres->tmr);
-	tmr_start(&pres->tmr, 1000, tmr_handler, pres);
+	twheel_tmr_start(&pres->tmr, baresip_twheel(), delay,
+			 tmr_handler, pres);
 
 	list_append(&presencel, &pres->le, pres);
 
@@ -282,30 +338,55 @@ static int presence_alloc(struct contact *contact)
 
 int subscriber_init(void)
 {
+	char rls_uri[256] = "";
+	uint32_t delay = STARTUP_DELAY;
 	struct le *le;
 	int err = 0;
 
+	(void)conf_get_str(conf_cur(), "presence_rls_uri",
+			   rls_uri, sizeof(rls_uri));
+
+	if (str_isset(rls_uri)) {
+		err = rls_init(rls_uri, STARTUP_DELAY);
+		if (err)
+			return err;
+	}
+
 	for (le = list_head(contact_list()); le; le = le->next) {
 
 		struct contact *c = le->data;
 		struct sip_addr *addr = contact_addr(c);
 		struct pl val;
 
-		if (0 == msg_param_decode(&addr->params, "presence", &val) &&
-		    0 == pl_strcasecmp(&val, "p2p")) {
+		if (msg_param_decode(&addr->params, "presence", &val))
+			continue;
+
+		if (0 == pl_strcasecmp(&val, "rls") && str_isset(rls_uri)) {
+
+			err |= rls_add(c);
+		}
+		else if (0 == pl_strcasecmp(&val, "p2p") ||
+			 0 == pl_strcasecmp(&val, "rls")) {
 
-			err |= presence_alloc(le->data);
+			err |= presence_alloc(c, delay);
+			delay += STARTUP_SPACING;
 		}
 	}
 
 	info("Subscribing to %u contacts\n", list_count(&presencel));
 
+	if (str_isset(rls_uri)) {
+		info("Subscribing to %u contacts on resource list %s\n",
+		     rls_count(), rls_uri);
+	}
+
 	return err;
 }
 
 
 void subscriber_close(void)
 {
+	rls_close();
 	list_flush(&presencel);
 }
 
@@ -317,6 +398,8 @@ void subscriber_close_all(void)
 	info("presence: subscriber: closing %u subs\n",
 	     list_count(&presencel));
 
+	rls_close_all();
+
 	le = presencel.head;
 	while (le) {
 
@@ -328,8 +411,9 @@ void subscriber_close_all(void)
 		pres->shutdown = true;
 		if (pres->sub) {
 			pres->sub = mem_deref(pres->sub);
-			tmr_start(&pres->tmr, SHUTDOWN_DELAY,
-				  deref_handler, pres);
+			twheel_tmr_start(&pres->tmr, baresip_twheel(),
+					 SHUTDOWN_DELAY,
+					 deref_handler, pres);
 		}
 		else
 			mem_deref(pres);
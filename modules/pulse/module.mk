@@ -8,7 +8,7 @@ MOD		:= pulse
 $(MOD)_SRCS	+= pulse.c
 $(MOD)_SRCS	+= player.c
 $(MOD)_SRCS	+= recorder.c
-$(MOD)_LFLAGS	+= $(shell pkg-config --libs libpulse-simple)
-$(MOD)_CFLAGS	+= $(shell pkg-config --cflags libpulse-simple)
+$(MOD)_LFLAGS	+= $(shell pkg-config --libs libpulse)
+$(MOD)_CFLAGS	+= $(shell pkg-config --cflags libpulse)
 
 include mk/mod.mk
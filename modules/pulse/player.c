@@ -4,8 +4,6 @@
  * Copyright (C) 2010 - 2016 Creytiv.com
  */
 #include <pulse/pulseaudio.h>
-#include <pulse/simple.h>
-#include <pthread.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -15,11 +13,14 @@
 struct auplay_st {
 	const struct auplay *ap;      /* inheritance */
 
-	pa_simple *s;
-	pthread_t thread;
-	bool run;
+	struct pulse_conn *pc;
+	pa_stream *s;
+	pa_buffer_attr attr;
 	int16_t *sampv;
 	size_t sampc;
+	size_t num_bytes;             /* one packet */
+	uint32_t *latency;
+	uint32_t underrunc;
 	auplay_write_h *wh;
 	void *arg;
 };
@@ -29,38 +30,64 @@ static void auplay_destructor(void *arg)
 {
 	struct auplay_st *st = arg;
 
-	/* Wait for termination of other thread */
-	if (st->run) {
-		debug("pulse: stopping playback thread\n");
-		st->run = false;
-		(void)pthread_join(st->thread, NULL);
+	if (st->underrunc) {
+		info("pulse: player had %u underruns, buffer %u bytes\n",
+		     st->underrunc, st->attr.tlength);
 	}
 
-	if (st->s)
-		pa_simple_free(st->s);
+	if (st->pc && st->s) {
+		pa_threaded_mainloop_lock(st->pc->loop);
+		pa_stream_disconnect(st->s);
+		pa_stream_unref(st->s);
+		pa_threaded_mainloop_unlock(st->pc->loop);
+	}
 
+	mem_deref(st->pc);
 	mem_deref(st->sampv);
 }
 
 
-static void *write_thread(void *arg)
+/* called from the mainloop thread, whenever there is room for data */
+static void write_handler(pa_stream *s, size_t nbytes, void *arg)
 {
 	struct auplay_st *st = arg;
-	const size_t num_bytes = st->sampc * 2;
-	int ret, pa_error = 0;
 
-	while (st->run) {
+	while (nbytes >= st->num_bytes) {
 
 		st->wh(st->sampv, st->sampc, st->arg);
 
-		ret = pa_simple_write(st->s, st->sampv, num_bytes, &pa_error);
-		if (ret < 0) {
-			warning("pulse: pa_simple_write error (%s)\n",
-				pa_strerror(pa_error));
+		if (pa_stream_write(s, st->sampv, st->num_bytes, NULL, 0,
+				    PA_SEEK_RELATIVE) < 0) {
+			warning("pulse: pa_stream_write error (%s)\n",
+				pa_strerror(pa_context_errno(st->pc->ctx)));
+			break;
 		}
+
+		nbytes -= st->num_bytes;
 	}
 
-	return NULL;
+	pulse_latency_update(s, st->latency);
+}
+
+
+/* the server ran out of samples, make room for one more packet */
+static void underflow_handler(pa_stream *s, void *arg)
+{
+	struct auplay_st *st = arg;
+	pa_operation *op;
+
+	++st->underrunc;
+
+	if (st->attr.tlength >= pulse_max_packets * st->num_bytes)
+		return;
+
+	st->attr.tlength += (uint32_t)st->num_bytes;
+
+	debug("pulse: underrun, buffer is now %u bytes\n", st->attr.tlength);
+
+	op = pa_stream_set_buffer_attr(s, &st->attr, NULL, NULL);
+	if (op)
+		pa_operation_unref(op);
 }
 
 
@@ -70,8 +97,8 @@ int pulse_player_alloc(struct auplay_st **stp, const struct auplay *ap,
 {
 	struct auplay_st *st;
 	pa_sample_spec ss;
-	pa_buffer_attr attr;
-	int err = 0, pa_error = 0;
+	pa_stream_flags_t flags;
+	int err = 0;
 
 	if (!stp || !ap || !prm || !wh)
 		return EINVAL;
@@ -86,10 +113,12 @@ int pulse_player_alloc(struct auplay_st **stp, const struct auplay *ap,
 	st->ap  = ap;
 	st->wh  = wh;
 	st->arg = arg;
+	st->latency = prm->latency;
 
 	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
+	st->num_bytes = st->sampc * 2;
 
-	st->sampv = mem_alloc(2 * st->sampc, NULL);
+	st->sampv = mem_alloc(st->num_bytes, NULL);
 	if (!st->sampv) {
 		err = ENOMEM;
 		goto out;
@@ -99,36 +128,53 @@ int pulse_player_alloc(struct auplay_st **stp, const struct auplay *ap,
 	ss.channels = prm->ch;
 	ss.rate     = prm->srate;
 
-	attr.maxlength = (uint32_t)-1;
-	attr.tlength   = (uint32_t)pa_usec_to_bytes(prm->ptime * 1000, &ss);
-	attr.prebuf    = (uint32_t)-1;
-	attr.minreq    = (uint32_t)-1;
-	attr.fragsize  = (uint32_t)-1;
-
-	st->s = pa_simple_new(NULL,
-			      "Baresip",
-			      PA_STREAM_PLAYBACK,
-			      str_isset(device) ? device : 0,
-			      "VoIP Playback",
-			      &ss,
-			      NULL,
-			      &attr,
-			      &pa_error);
-	if (!st->s) {
-		warning("pulse: could not connect to server (%s)\n",
-			pa_strerror(pa_error));
-		err = ENODEV;
+	/* request one packet at a time, and queue only a few */
+	st->attr.maxlength = (uint32_t)-1;
+	st->attr.tlength   = (uint32_t)(pulse_packets * st->num_bytes);
+	st->attr.prebuf    = (uint32_t)-1;
+	st->attr.minreq    = (uint32_t)st->num_bytes;
+	st->attr.fragsize  = (uint32_t)-1;
+
+	flags = PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING |
+		PA_STREAM_AUTO_TIMING_UPDATE;
+
+	err = pulse_conn_alloc(&st->pc);
+	if (err)
 		goto out;
+
+	pa_threaded_mainloop_lock(st->pc->loop);
+
+	st->s = pa_stream_new(st->pc->ctx, "VoIP Playback", &ss, NULL);
+	if (!st->s) {
+		err = ENOMEM;
+		goto unlock;
 	}
 
-	st->run = true;
-	err = pthread_create(&st->thread, NULL, write_thread, st);
-	if (err) {
-		st->run = false;
-		goto out;
+	pa_stream_set_state_callback(st->s, pulse_stream_state_handler,
+				     st->pc);
+	pa_stream_set_write_callback(st->s, write_handler, st);
+	pa_stream_set_underflow_callback(st->s, underflow_handler, st);
+
+	if (pa_stream_connect_playback(st->s,
+				       str_isset(device) ? device : NULL,
+				       &st->attr, flags, NULL, NULL) < 0) {
+		warning("pulse: could not connect playback (%s)\n",
+			pa_strerror(pa_context_errno(st->pc->ctx)));
+		err = ENODEV;
+		goto unlock;
 	}
 
-	debug("pulse: playback started\n");
+	err = pulse_stream_wait(st->pc, st->s);
+	if (err)
+		goto unlock;
+
+	st->attr = *pa_stream_get_buffer_attr(st->s);
+
+	debug("pulse: playback started (buffer %u bytes, request %u)\n",
+	      st->attr.tlength, st->attr.minreq);
+
+ unlock:
+	pa_threaded_mainloop_unlock(st->pc->loop);
 
  out:
 	if (err)
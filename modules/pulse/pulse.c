@@ -3,7 +3,7 @@
  *
  * Copyright (C) 2010 - 2016 Creytiv.com
  */
-
+#include <pulse/pulseaudio.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -15,19 +15,228 @@
  *
  * Audio driver module for Pulseaudio
  *
- * This module is experimental and work-in-progress. It is using
- * the pulseaudio "simple" interface.
+ * This module is using the asynchronous interface with a threaded
+ * mainloop per stream. The server buffer is set from the packet time
+ * and the latency of the stream is reported to the audio pipeline.
+ * When the player runs out of samples its buffer is grown by one
+ * packet, up to pulse_max_packets. PipeWire is supported through its
+ * Pulseaudio server.
+ *
+ * Example config:
+ \verbatim
+  pulse_packets           2        # playback buffer in packets
+  pulse_max_packets       8        # largest buffer after underruns
+ \endverbatim
  */
 
 
+uint32_t pulse_packets = 2;
+uint32_t pulse_max_packets = 8;
+
 static struct auplay *auplay;
 static struct ausrc *ausrc;
 
 
+static void context_state_handler(pa_context *c, void *arg)
+{
+	struct pulse_conn *pc = arg;
+
+	switch (pa_context_get_state(c)) {
+
+	case PA_CONTEXT_READY:
+	case PA_CONTEXT_FAILED:
+	case PA_CONTEXT_TERMINATED:
+		pa_threaded_mainloop_signal(pc->loop, 0);
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+/* runs once in the mainloop thread, which calls the stream handlers */
+static void sched_handler(pa_mainloop_api *api, void *arg)
+{
+	(void)api;
+	(void)arg;
+
+	(void)realtime_thread("audio_dev");
+}
+
+
+static void conn_destructor(void *arg)
+{
+	struct pulse_conn *pc = arg;
+
+	if (pc->loop)
+		pa_threaded_mainloop_stop(pc->loop);
+
+	if (pc->ctx) {
+		pa_context_disconnect(pc->ctx);
+		pa_context_unref(pc->ctx);
+	}
+
+	if (pc->loop)
+		pa_threaded_mainloop_free(pc->loop);
+}
+
+
+/**
+ * Connect to the server, with a mainloop thread for one stream
+ *
+ * @param pcp Pointer to allocated connection
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int pulse_conn_alloc(struct pulse_conn **pcp)
+{
+	struct pulse_conn *pc;
+	pa_context_state_t state;
+	int err = 0;
+
+	if (!pcp)
+		return EINVAL;
+
+	pc = mem_zalloc(sizeof(*pc), conn_destructor);
+	if (!pc)
+		return ENOMEM;
+
+	pc->loop = pa_threaded_mainloop_new();
+	if (!pc->loop) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	pc->ctx = pa_context_new(pa_threaded_mainloop_get_api(pc->loop),
+				 "Baresip");
+	if (!pc->ctx) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	pa_context_set_state_callback(pc->ctx, context_state_handler, pc);
+
+	if (pa_context_connect(pc->ctx, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0) {
+		warning("pulse: could not connect to server (%s)\n",
+			pa_strerror(pa_context_errno(pc->ctx)));
+		err = ECONNREFUSED;
+		goto out;
+	}
+
+	pa_threaded_mainloop_lock(pc->loop);
+
+	if (pa_threaded_mainloop_start(pc->loop) < 0) {
+		pa_threaded_mainloop_unlock(pc->loop);
+		err = ENOMEM;
+		goto out;
+	}
+
+	pa_mainloop_api_once(pa_threaded_mainloop_get_api(pc->loop),
+			     sched_handler, NULL);
+
+	for (;;) {
+		state = pa_context_get_state(pc->ctx);
+
+		if (state == PA_CONTEXT_READY)
+			break;
+
+		if (!PA_CONTEXT_IS_GOOD(state)) {
+			warning("pulse: could not connect to server (%s)\n",
+				pa_strerror(pa_context_errno(pc->ctx)));
+			err = ECONNREFUSED;
+			break;
+		}
+
+		pa_threaded_mainloop_wait(pc->loop);
+	}
+
+	pa_threaded_mainloop_unlock(pc->loop);
+
+ out:
+	if (err)
+		mem_deref(pc);
+	else
+		*pcp = pc;
+
+	return err;
+}
+
+
+/**
+ * Stream state handler, wakes up pulse_stream_wait()
+ *
+ * @param s   Stream
+ * @param arg Connection
+ */
+void pulse_stream_state_handler(pa_stream *s, void *arg)
+{
+	struct pulse_conn *pc = arg;
+	(void)s;
+
+	pa_threaded_mainloop_signal(pc->loop, 0);
+}
+
+
+/**
+ * Wait until a stream is ready, with the mainloop locked
+ *
+ * @param pc Connection
+ * @param s  Stream
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int pulse_stream_wait(struct pulse_conn *pc, pa_stream *s)
+{
+	for (;;) {
+		pa_stream_state_t state = pa_stream_get_state(s);
+
+		if (state == PA_STREAM_READY)
+			return 0;
+
+		if (!PA_STREAM_IS_GOOD(state)) {
+			warning("pulse: stream failed (%s)\n",
+				pa_strerror(pa_context_errno(pc->ctx)));
+			return ENODEV;
+		}
+
+		pa_threaded_mainloop_wait(pc->loop);
+	}
+}
+
+
+/**
+ * Report the latency of a stream, from the mainloop thread
+ *
+ * @param s       Stream
+ * @param latency Where to store the latency in [us], may be NULL
+ */
+void pulse_latency_update(pa_stream *s, uint32_t *latency)
+{
+	pa_usec_t usec;
+	int negative = 0;
+
+	if (!latency)
+		return;
+
+	if (pa_stream_get_latency(s, &usec, &negative) < 0 || negative)
+		return;
+
+	*latency = (uint32_t)min(usec, (pa_usec_t)UINT32_MAX);
+}
+
+
 static int module_init(void)
 {
 	int err;
 
+	(void)conf_get_u32(conf_cur(), "pulse_packets", &pulse_packets);
+	(void)conf_get_u32(conf_cur(), "pulse_max_packets",
+			   &pulse_max_packets);
+
+	pulse_packets     = max(pulse_packets, 1);
+	pulse_max_packets = max(pulse_max_packets, pulse_packets);
+
 	err  = auplay_register(&auplay, "pulse", pulse_player_alloc);
 	err |= ausrc_register(&ausrc, "pulse", pulse_recorder_alloc);
 
@@ -5,6 +5,19 @@
  */
 
 
+struct pulse_conn {
+	pa_threaded_mainloop *loop;
+	pa_context *ctx;
+};
+
+extern uint32_t pulse_packets;
+extern uint32_t pulse_max_packets;
+
+int  pulse_conn_alloc(struct pulse_conn **pcp);
+void pulse_stream_state_handler(pa_stream *s, void *arg);
+int  pulse_stream_wait(struct pulse_conn *pc, pa_stream *s);
+void pulse_latency_update(pa_stream *s, uint32_t *latency);
+
 int pulse_player_alloc(struct auplay_st **stp, const struct auplay *ap,
 		       struct auplay_prm *prm, const char *device,
 		       auplay_write_h *wh, void *arg);
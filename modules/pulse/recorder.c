@@ -3,9 +3,8 @@
  *
  * Copyright (C) 2010 - 2016 Creytiv.com
  */
+#include <string.h>
 #include <pulse/pulseaudio.h>
-#include <pulse/simple.h>
-#include <pthread.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -15,11 +14,13 @@
 struct ausrc_st {
 	const struct ausrc *as;      /* inheritance */
 
-	pa_simple *s;
-	pthread_t thread;
-	bool run;
+	struct pulse_conn *pc;
+	pa_stream *s;
 	int16_t *sampv;
 	size_t sampc;
+	size_t num_bytes;            /* one packet */
+	size_t pos;                  /* bytes in sampv */
+	uint32_t *latency;
 	ausrc_read_h *rh;
 	void *arg;
 };
@@ -29,39 +30,65 @@ static void ausrc_destructor(void *arg)
 {
 	struct ausrc_st *st = arg;
 
-	/* Wait for termination of other thread */
-	if (st->run) {
-		debug("pulse: stopping record thread\n");
-		st->run = false;
-		(void)pthread_join(st->thread, NULL);
+	if (st->pc && st->s) {
+		pa_threaded_mainloop_lock(st->pc->loop);
+		pa_stream_disconnect(st->s);
+		pa_stream_unref(st->s);
+		pa_threaded_mainloop_unlock(st->pc->loop);
 	}
 
-	if (st->s)
-		pa_simple_free(st->s);
-
+	mem_deref(st->pc);
 	mem_deref(st->sampv);
 }
 
 
-static void *read_thread(void *arg)
+/* called from the mainloop thread, the fragments need not be packets */
+static void read_handler(pa_stream *s, size_t nbytes, void *arg)
 {
 	struct ausrc_st *st = arg;
-	const size_t num_bytes = st->sampc * 2;
-	int ret, pa_error = 0;
+	uint8_t *buf = (uint8_t *)st->sampv;
+	(void)nbytes;
+
+	while (pa_stream_readable_size(s) > 0) {
+
+		const uint8_t *data;
+		size_t len;
+
+		if (pa_stream_peek(s, (const void **)&data, &len) < 0) {
+			warning("pulse: pa_stream_peek error (%s)\n",
+				pa_strerror(pa_context_errno(st->pc->ctx)));
+			break;
+		}
+
+		if (!len)
+			break;
 
-	while (st->run) {
+		while (len) {
 
-		ret = pa_simple_read(st->s, st->sampv, num_bytes, &pa_error);
-		if (ret < 0) {
-			warning("pulse: pa_simple_write error (%s)\n",
-				pa_strerror(pa_error));
-			continue;
+			size_t n = min(len, st->num_bytes - st->pos);
+
+			/* a hole in the stream is silence */
+			if (data) {
+				memcpy(buf + st->pos, data, n);
+				data += n;
+			}
+			else {
+				memset(buf + st->pos, 0, n);
+			}
+
+			st->pos += n;
+			len -= n;
+
+			if (st->pos == st->num_bytes) {
+				st->rh(st->sampv, st->sampc, st->arg);
+				st->pos = 0;
+			}
 		}
 
-		st->rh(st->sampv, st->sampc, st->arg);
+		pa_stream_drop(s);
 	}
 
-	return NULL;
+	pulse_latency_update(s, st->latency);
 }
 
 
@@ -73,14 +100,13 @@ int pulse_recorder_alloc(struct ausrc_st **stp, const struct ausrc *as,
 	struct ausrc_st *st;
 	pa_sample_spec ss;
 	pa_buffer_attr attr;
-	int pa_error;
+	pa_stream_flags_t flags;
 	int err;
 
 	(void)ctx;
-	(void)device;
 	(void)errh;
 
-	if (!stp || !as || !prm)
+	if (!stp || !as || !prm || !rh)
 		return EINVAL;
 
 	debug("pulse: opening recorder (%u Hz, %d channels, device '%s')\n",
@@ -93,10 +119,12 @@ int pulse_recorder_alloc(struct ausrc_st **stp, const struct ausrc *as,
 	st->as  = as;
 	st->rh  = rh;
 	st->arg = arg;
+	st->latency = prm->latency;
 
 	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
+	st->num_bytes = st->sampc * 2;
 
-	st->sampv = mem_alloc(2 * st->sampc, NULL);
+	st->sampv = mem_alloc(st->num_bytes, NULL);
 	if (!st->sampv) {
 		err = ENOMEM;
 		goto out;
@@ -106,36 +134,50 @@ int pulse_recorder_alloc(struct ausrc_st **stp, const struct ausrc *as,
 	ss.channels = prm->ch;
 	ss.rate     = prm->srate;
 
+	/* deliver one packet at a time */
 	attr.maxlength = (uint32_t)-1;
 	attr.tlength   = (uint32_t)-1;
 	attr.prebuf    = (uint32_t)-1;
 	attr.minreq    = (uint32_t)-1;
-	attr.fragsize  = (uint32_t)pa_usec_to_bytes(prm->ptime * 1000, &ss);
-
-	st->s = pa_simple_new(NULL,
-			      "Baresip",
-			      PA_STREAM_RECORD,
-			      str_isset(device) ? device : 0,
-			      "VoIP Record",
-			      &ss,
-			      NULL,
-			      &attr,
-			      &pa_error);
-	if (!st->s) {
-		warning("pulse: could not connect to server (%s)\n",
-			pa_strerror(pa_error));
-		err = ENODEV;
+	attr.fragsize  = (uint32_t)st->num_bytes;
+
+	flags = PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING |
+		PA_STREAM_AUTO_TIMING_UPDATE;
+
+	err = pulse_conn_alloc(&st->pc);
+	if (err)
 		goto out;
+
+	pa_threaded_mainloop_lock(st->pc->loop);
+
+	st->s = pa_stream_new(st->pc->ctx, "VoIP Record", &ss, NULL);
+	if (!st->s) {
+		err = ENOMEM;
+		goto unlock;
 	}
 
-	st->run = true;
-	err = pthread_create(&st->thread, NULL, read_thread, st);
-	if (err) {
-		st->run = false;
-		goto out;
+	pa_stream_set_state_callback(st->s, pulse_stream_state_handler,
+				     st->pc);
+	pa_stream_set_read_callback(st->s, read_handler, st);
+
+	if (pa_stream_connect_record(st->s,
+				     str_isset(device) ? device : NULL,
+				     &attr, flags) < 0) {
+		warning("pulse: could not connect record (%s)\n",
+			pa_strerror(pa_context_errno(st->pc->ctx)));
+		err = ENODEV;
+		goto unlock;
 	}
 
-	debug("pulse: recording started\n");
+	err = pulse_stream_wait(st->pc, st->s);
+	if (err)
+		goto unlock;
+
+	debug("pulse: recording started (fragment %u bytes)\n",
+	      pa_stream_get_buffer_attr(st->s)->fragsize);
+
+ unlock:
+	pa_threaded_mainloop_unlock(st->pc->loop);
 
  out:
 	if (err)
@@ -16,108 +16,226 @@
 #include "rst.h"
 
 
-struct ausrc_st {
-	const struct ausrc *as;  /* pointer to base-class (inheritance) */
-	pthread_t thread;
+/*
+ * A player decodes a stream into a ring of PCM, once for all calls with
+ * the same sample rate and channels. Each call reads the ring at its own
+ * position and packet time, from the thread of the player.
+ *
+ * A call plays when the high watermark is buffered. When its buffer runs
+ * dry it plays silence, until the high watermark is buffered again. A call
+ * that falls a whole ring behind skips ahead to the high watermark.
+ */
+
+
+enum {
+	RING_MS = 5000,         /**< Size of the PCM ring in [ms]        */
+	HIGH_MS = 1000,         /**< Buffered before a call plays [ms]   */
+};
+
+
+struct player {
+	struct le le;           /**< Entry in the list of players        */
+	struct le le_rst;       /**< Entry in the shared state           */
 	struct rst *rst;
 	mpg123_handle *mp3;
-	struct aubuf *aubuf;
+	pthread_t thread;
+	pthread_mutex_t mutex;  /**< Protects the ring and the readers   */
+	struct list readerl;    /**< Calls playing (struct ausrc_st)     */
+	int16_t *ringv;         /**< Decoded PCM                         */
+	size_t ringc;           /**< Size of the ring in [samples]       */
+	size_t highc;           /**< High watermark in [samples]         */
+	uint64_t wpos;          /**< Samples written since the start     */
+	uint32_t srate;
+	uint8_t ch;
+	bool run;
+};
+
+struct ausrc_st {
+	const struct ausrc *as;  /* pointer to base-class (inheritance) */
+	struct le le;           /**< Entry in the readers of the player  */
+	struct player *pl;
+	int16_t *sampv;
 	ausrc_read_h *rh;
 	ausrc_error_h *errh;
 	void *arg;
-	bool run;
+	uint64_t rpos;          /**< Read position in [samples]          */
+	uint64_t ts;            /**< Time of the next frame in [ms]      */
 	uint32_t ptime;
 	size_t sampc;
+	bool buffering;         /**< Waiting for the high watermark      */
+	unsigned n_underrun;
+	unsigned n_skip;
 };
 
 
 static struct ausrc *ausrc;
+static struct list playerl;
+
+
+static void player_destructor(void *arg)
+{
+	struct player *pl = arg;
+
+	list_unlink(&pl->le);
+	list_unlink(&pl->le_rst);
+	mem_deref(pl->rst);
+
+	if (pl->run) {
+		pl->run = false;
+		pthread_join(pl->thread, NULL);
+	}
+
+	if (pl->mp3) {
+		mpg123_close(pl->mp3);
+		mpg123_delete(pl->mp3);
+	}
+
+	mem_deref(pl->ringv);
+}
 
 
 static void destructor(void *arg)
 {
 	struct ausrc_st *st = arg;
 
-	rst_set_audio(st->rst, NULL);
-	mem_deref(st->rst);
+	if (st->pl) {
+		pthread_mutex_lock(&st->pl->mutex);
+		list_unlink(&st->le);
+		pthread_mutex_unlock(&st->pl->mutex);
+
+		if (st->n_underrun || st->n_skip)
+			debug("rst: audio underruns=%u skips=%u\n",
+			      st->n_underrun, st->n_skip);
+
+		mem_deref(st->pl);
+	}
+
+	mem_deref(st->sampv);
+}
+
+
+static void ring_write(struct player *pl, const int16_t *sampv,
+		       size_t sampc)
+{
+	size_t pos, n;
 
-	if (st->run) {
-		st->run = false;
-		pthread_join(st->thread, NULL);
+	if (sampc > pl->ringc) {
+		sampv    += sampc - pl->ringc;
+		pl->wpos += sampc - pl->ringc;
+		sampc     = pl->ringc;
 	}
 
-	if (st->mp3) {
-		mpg123_close(st->mp3);
-		mpg123_delete(st->mp3);
+	pos = (size_t)(pl->wpos % pl->ringc);
+	n   = min(sampc, pl->ringc - pos);
+
+	memcpy(&pl->ringv[pos], sampv, n * sizeof(int16_t));
+	memcpy(pl->ringv, &sampv[n], (sampc - n) * sizeof(int16_t));
+
+	pl->wpos += sampc;
+}
+
+
+/* Read the next frame of a call from the ring, or silence */
+static void ring_read(const struct player *pl, struct ausrc_st *st)
+{
+	uint64_t fill = pl->wpos - st->rpos;
+	size_t pos, n;
+
+	if (fill > pl->ringc) {
+		st->rpos = pl->wpos - pl->highc;
+		fill     = pl->highc;
+		++st->n_skip;
+	}
+
+	if (st->buffering && fill >= pl->highc) {
+		st->buffering = false;
+	}
+	else if (!st->buffering && fill < st->sampc) {
+		st->buffering = true;
+		++st->n_underrun;
 	}
 
-	mem_deref(st->aubuf);
+	if (st->buffering) {
+		memset(st->sampv, 0, st->sampc * sizeof(int16_t));
+		return;
+	}
+
+	pos = (size_t)(st->rpos % pl->ringc);
+	n   = min(st->sampc, pl->ringc - pos);
+
+	memcpy(st->sampv, &pl->ringv[pos], n * sizeof(int16_t));
+	memcpy(&st->sampv[n], pl->ringv, (st->sampc - n) * sizeof(int16_t));
+
+	st->rpos += st->sampc;
 }
 
 
 static void *play_thread(void *arg)
 {
-	uint64_t now, ts = tmr_jiffies();
-	struct ausrc_st *st = arg;
-	int16_t *sampv;
+	struct player *pl = arg;
 
-	sampv = mem_alloc(st->sampc * 2, NULL);
-	if (!sampv)
-		return NULL;
+	while (pl->run) {
 
-	while (st->run) {
+		struct le *le;
+		uint64_t now;
 
 		sys_msleep(4);
 
 		now = tmr_jiffies();
 
-		if (ts > now)
-			continue;
-#if 1
-		if (now > ts + 100) {
-			debug("rst: cpu lagging behind (%u ms)\n",
-			      now - ts);
-		}
-#endif
+		pthread_mutex_lock(&pl->mutex);
 
-		aubuf_read_samp(st->aubuf, sampv, st->sampc);
+		for (le = pl->readerl.head; le; le = le->next) {
 
-		st->rh(sampv, st->sampc, st->arg);
+			struct ausrc_st *st = le->data;
 
-		ts += st->ptime;
-	}
+			if (st->ts > now)
+				continue;
+
+			if (now > st->ts + 100) {
+				debug("rst: cpu lagging behind (%llu ms)\n",
+				      now - st->ts);
+			}
+
+			ring_read(pl, st);
+
+			st->rh(st->sampv, st->sampc, st->arg);
 
-	mem_deref(sampv);
+			st->ts += st->ptime;
+		}
+
+		pthread_mutex_unlock(&pl->mutex);
+	}
 
 	return NULL;
 }
 
 
-static inline int decode(struct ausrc_st *st)
+static inline int decode(struct player *pl)
 {
+	int16_t buf[2048];
 	int err, ch, encoding;
-	struct mbuf *mb;
+	size_t n = 0;
 	long srate;
 
-	mb = mbuf_alloc(4096);
-	if (!mb)
-		return ENOMEM;
-
-	err = mpg123_read(st->mp3, mb->buf, mb->size, &mb->end);
+	err = mpg123_read(pl->mp3, (unsigned char *)buf, sizeof(buf), &n);
 
 	switch (err) {
 
 	case MPG123_NEW_FORMAT:
-		mpg123_getformat(st->mp3, &srate, &ch, &encoding);
+		mpg123_getformat(pl->mp3, &srate, &ch, &encoding);
 		info("rst: new format: %i hz, %i ch, encoding 0x%04x\n",
 		     srate, ch, encoding);
 		/*@fallthrough@*/
 
 	case MPG123_OK:
 	case MPG123_NEED_MORE:
-		if (mb->end == 0)
+		if (n == 0)
 			break;
-		aubuf_append(st->aubuf, mb);
+
+		pthread_mutex_lock(&pl->mutex);
+		ring_write(pl, buf, n / sizeof(int16_t));
+		pthread_mutex_unlock(&pl->mutex);
 		break;
 
 	default:
@@ -126,34 +244,116 @@ static inline int decode(struct ausrc_st *st)
 		break;
 	}
 
-	mem_deref(mb);
-
 	return err;
 }
 
 
-void rst_audio_feed(struct ausrc_st *st, const uint8_t *buf, size_t sz)
+void rst_audio_feed(struct player *pl, const uint8_t *buf, size_t sz)
 {
 	int err;
 
-	if (!st)
+	if (!pl)
 		return;
 
-	err = mpg123_feed(st->mp3, buf, sz);
+	err = mpg123_feed(pl->mp3, buf, sz);
 	if (err)
 		return;
 
-	while (MPG123_OK == decode(st))
+	while (MPG123_OK == decode(pl))
 		;
 }
 
 
+/* The player of a stream in this format, or a new one */
+static int player_get(struct player **plp, struct rst *rst,
+		      const struct ausrc_prm *prm)
+{
+	struct player *pl;
+	struct le *le;
+	int err;
+
+	for (le = playerl.head; le; le = le->next) {
+
+		pl = le->data;
+
+		if (pl->rst == rst && pl->srate == prm->srate &&
+		    pl->ch == prm->ch) {
+			*plp = mem_ref(pl);
+			return 0;
+		}
+	}
+
+	pl = mem_zalloc(sizeof(*pl), player_destructor);
+	if (!pl)
+		return ENOMEM;
+
+	pl->rst   = mem_ref(rst);
+	pl->srate = prm->srate;
+	pl->ch    = prm->ch;
+	pl->ringc = (size_t)prm->srate * prm->ch * RING_MS / 1000;
+	pl->highc = (size_t)prm->srate * prm->ch * HIGH_MS / 1000;
+
+	err = pthread_mutex_init(&pl->mutex, NULL);
+	if (err)
+		goto out;
+
+	pl->ringv = mem_zalloc(pl->ringc * sizeof(int16_t), NULL);
+	if (!pl->ringv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	pl->mp3 = mpg123_new(NULL, &err);
+	if (!pl->mp3) {
+		err = ENODEV;
+		goto out;
+	}
+
+	err = mpg123_open_feed(pl->mp3);
+	if (err != MPG123_OK) {
+		warning("rst: mpg123_open_feed: %s\n",
+			mpg123_strerror(pl->mp3));
+		err = ENODEV;
+		goto out;
+	}
+
+	/* Set wanted output format */
+	mpg123_format_none(pl->mp3);
+	mpg123_format(pl->mp3, prm->srate, prm->ch, MPG123_ENC_SIGNED_16);
+	mpg123_volume(pl->mp3, 0.3);
+
+	info("rst: audio player %u Hz, %u ch, ring=%u ms high=%u ms\n",
+	     prm->srate, prm->ch, RING_MS, HIGH_MS);
+
+	pl->run = true;
+
+	err = pthread_create(&pl->thread, NULL, play_thread, pl);
+	if (err) {
+		pl->run = false;
+		goto out;
+	}
+
+	list_append(&playerl, &pl->le, pl);
+	rst_add_audio(rst, &pl->le_rst, pl);
+
+ out:
+	if (err)
+		mem_deref(pl);
+	else
+		*plp = pl;
+
+	return err;
+}
+
+
 static int alloc_handler(struct ausrc_st **stp, const struct ausrc *as,
 			 struct media_ctx **ctx,
 			 struct ausrc_prm *prm, const char *dev,
 			 ausrc_read_h *rh, ausrc_error_h *errh, void *arg)
 {
 	struct ausrc_st *st;
+	struct rst *rst;
+	struct player *pl;
 	int err;
 
 	if (!stp || !as || !prm || !rh)
@@ -168,62 +368,44 @@ static int alloc_handler(struct ausrc_st **stp, const struct ausrc *as,
 	st->errh = errh;
 	st->arg  = arg;
 
-	st->mp3 = mpg123_new(NULL, &err);
-	if (!st->mp3) {
-		err = ENODEV;
-		goto out;
-	}
-
-	err = mpg123_open_feed(st->mp3);
-	if (err != MPG123_OK) {
-		warning("rst: mpg123_open_feed: %s\n",
-			mpg123_strerror(st->mp3));
-		err = ENODEV;
-		goto out;
-	}
-
-	/* Set wanted output format */
-	mpg123_format_none(st->mp3);
-	mpg123_format(st->mp3, prm->srate, prm->ch, MPG123_ENC_SIGNED_16);
-	mpg123_volume(st->mp3, 0.3);
-
 	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
 
 	st->ptime = prm->ptime;
 
-	info("rst: audio ptime=%u sampc=%zu aubuf=[%u:%u]\n",
-	     st->ptime, st->sampc,
-	     prm->srate * prm->ch * 2,
-	     prm->srate * prm->ch * 40);
-
-	/* 1 - 20 seconds of audio */
-	err = aubuf_alloc(&st->aubuf,
-			  prm->srate * prm->ch * 2,
-			  prm->srate * prm->ch * 40);
-	if (err)
+	st->sampv = mem_alloc(st->sampc * sizeof(int16_t), NULL);
+	if (!st->sampv) {
+		err = ENOMEM;
 		goto out;
+	}
 
 	if (ctx && *ctx && (*ctx)->id && !strcmp((*ctx)->id, "rst")) {
-		st->rst = mem_ref(*ctx);
+		rst = mem_ref(*ctx);
 	}
 	else {
-		err = rst_alloc(&st->rst, dev);
+		err = rst_alloc(&rst, dev);
 		if (err)
 			goto out;
 
 		if (ctx)
-			*ctx = (struct media_ctx *)st->rst;
+			*ctx = (struct media_ctx *)rst;
 	}
 
-	rst_set_audio(st->rst, st);
+	err = player_get(&st->pl, rst, prm);
+	mem_deref(rst);
+	if (err)
+		goto out;
+
+	info("rst: audio ptime=%u sampc=%zu\n", st->ptime, st->sampc);
 
-	st->run = true;
+	/* start with up to the high watermark of the buffered audio */
+	pl = st->pl;
 
-	err = pthread_create(&st->thread, NULL, play_thread, st);
-	if (err) {
-		st->run = false;
-		goto out;
-	}
+	pthread_mutex_lock(&pl->mutex);
+	st->rpos      = pl->wpos > pl->highc ? pl->wpos - pl->highc : 0;
+	st->buffering = true;
+	st->ts        = tmr_jiffies();
+	list_append(&pl->readerl, &st->le, st);
+	pthread_mutex_unlock(&pl->mutex);
 
  out:
 	if (err)
@@ -24,19 +24,30 @@
   audio_source        rst,http://relay.slayradio.org:8000/
   video_source        rst,http://relay.slayradio.org:8000/
  \endverbatim
+ *
+ * All calls playing the same URL share one HTTP connection, and one
+ * decoder per audio format. When the connection closes, or no data has
+ * arrived for a while, it is opened again at once, while the calls play
+ * what is buffered. Further retries back off up to 10 seconds.
  */
 
 
 enum {
-	RETRY_WAIT = 10000,
+	RETRY_MIN  =   500,   /**< Wait before the second retry [ms]  */
+	RETRY_WAIT = 10000,   /**< Max. wait between retries [ms]     */
+	STALL_WAIT =  2000,   /**< No data before reconnecting [ms]   */
 };
 
 
 struct rst {
 	const char *id;
-	struct ausrc_st *ausrc_st;
-	struct vidsrc_st *vidsrc_st;
+	struct le le;
+	char *dev;
+	struct list audl;     /**< Audio players (struct player)      */
+	struct list vidl;     /**< Video sources (struct vidsrc_st)   */
 	struct tmr tmr;
+	struct tmr tmr_stall;
+	unsigned retries;
 	struct dns_query *dnsq;
 	struct tcp_conn *tc;
 	struct mbuf *mb;
@@ -52,6 +63,9 @@ struct rst {
 };
 
 
+static struct list rstl;
+
+
 static int rst_connect(struct rst *rst);
 
 
@@ -59,10 +73,13 @@ static void destructor(void *arg)
 {
 	struct rst *rst = arg;
 
+	list_unlink(&rst->le);
 	tmr_cancel(&rst->tmr);
+	tmr_cancel(&rst->tmr_stall);
 	mem_deref(rst->dnsq);
 	mem_deref(rst->tc);
 	mem_deref(rst->mb);
+	mem_deref(rst->dev);
 	mem_deref(rst->host);
 	mem_deref(rst->path);
 	mem_deref(rst->name);
@@ -70,6 +87,46 @@ static void destructor(void *arg)
 }
 
 
+static void reconnect(void *arg);
+
+
+/* The first retry is at once, so the buffered audio covers the gap */
+static void retry(struct rst *rst)
+{
+	uint32_t wait = 0;
+
+	rst->tc = mem_deref(rst->tc);
+	tmr_cancel(&rst->tmr_stall);
+
+	if (rst->retries)
+		wait = min(RETRY_MIN << (rst->retries - 1), RETRY_WAIT);
+
+	if (wait < RETRY_WAIT)
+		++rst->retries;
+
+	tmr_start(&rst->tmr, wait, reconnect, rst);
+}
+
+
+static void stall_handler(void *arg)
+{
+	struct rst *rst = arg;
+
+	warning("rst: no data for %u ms, reconnecting\n", STALL_WAIT);
+
+	retry(rst);
+}
+
+
+static void video_update(struct rst *rst, const char *meta)
+{
+	struct le *le;
+
+	for (le = rst->vidl.head; le; le = le->next)
+		rst_video_update(le->data, rst->name, meta);
+}
+
+
 static void reconnect(void *arg)
 {
 	struct rst *rst = arg;
@@ -86,15 +143,18 @@ static void reconnect(void *arg)
 
 	err = rst_connect(rst);
 	if (err)
-		tmr_start(&rst->tmr, RETRY_WAIT, reconnect, rst);
+		retry(rst);
 }
 
 
 static void recv_handler(struct mbuf *mb, void *arg)
 {
 	struct rst *rst = arg;
+	struct le *le;
 	size_t n;
 
+	tmr_start(&rst->tmr_stall, STALL_WAIT, stall_handler, rst);
+
 	if (!rst->head_recv) {
 
 		struct pl hdr, name, metaint, eoh;
@@ -111,9 +171,7 @@ static void recv_handler(struct mbuf *mb, void *arg)
 					     mbuf_get_left(mb));
 			if (err) {
 				warning("rst: buffer write error: %m\n", err);
-				rst->tc = mem_deref(rst->tc);
-				tmr_start(&rst->tmr, RETRY_WAIT,
-					  reconnect, rst);
+				retry(rst);
 				return;
 			}
 
@@ -143,12 +201,13 @@ static void recv_handler(struct mbuf *mb, void *arg)
 
 		if (rst->metaint == 0) {
 			info("rst: icy meta interval not available\n");
-			rst->tc = mem_deref(rst->tc);
-			tmr_start(&rst->tmr, RETRY_WAIT, reconnect, rst);
+			retry(rst);
 			return;
 		}
 
-		rst_video_update(rst->vidsrc_st, rst->name, NULL);
+		rst->retries = 0;
+
+		video_update(rst, NULL);
 
 		rst->mb->pos += hdr.l;
 
@@ -184,15 +243,15 @@ static void recv_handler(struct mbuf *mb, void *arg)
 				rst->metasz = 0;
 				rst->bytec  = 0;
 
-				rst_video_update(rst->vidsrc_st, rst->name,
-						 rst->meta);
+				video_update(rst, rst->meta);
 			}
 		}
 		else if (rst->bytec < rst->metaint) {
 
 			n = min(mbuf_get_left(mb), rst->metaint - rst->bytec);
 
-			rst_audio_feed(rst->ausrc_st, mbuf_buf(mb), n);
+			for (le = rst->audl.head; le; le = le->next)
+				rst_audio_feed(le->data, mbuf_buf(mb), n);
 
 			rst->bytec += n;
 			mb->pos    += n;
@@ -222,6 +281,8 @@ static void estab_handler(void *arg)
 
 	info("rst: connection established\n");
 
+	tmr_start(&rst->tmr_stall, STALL_WAIT, stall_handler, rst);
+
 	mb = mbuf_alloc(512);
 	if (!mb) {
 		err = ENOMEM;
@@ -257,9 +318,7 @@ static void close_handler(int err, void *arg)
 
 	info("rst: tcp closed: %m\n", err);
 
-	rst->tc = mem_deref(rst->tc);
-
-	tmr_start(&rst->tmr, RETRY_WAIT, reconnect, rst);
+	retry(rst);
 }
 
 
@@ -278,7 +337,7 @@ static void dns_handler(int err, const struct dnshdr *hdr, struct list *ansl,
 	rr = dns_rrlist_find(ansl, rst->host, DNS_TYPE_A, DNS_CLASS_IN, true);
 	if (!rr) {
 		warning("rst: unable to resolve: %s\n", rst->host);
-		tmr_start(&rst->tmr, RETRY_WAIT, reconnect, rst);
+		retry(rst);
 		return;
 	}
 
@@ -288,7 +347,7 @@ static void dns_handler(int err, const struct dnshdr *hdr, struct list *ansl,
 			  close_handler, rst);
 	if (err) {
 		warning("rst: tcp connect error: %m\n", err);
-		tmr_start(&rst->tmr, RETRY_WAIT, reconnect, rst);
+		retry(rst);
 		return;
 	}
 }
@@ -320,15 +379,34 @@ static int rst_connect(struct rst *rst)
 }
 
 
+/**
+ * Allocate the shared state of a URL, or get the one that is playing it
+ *
+ * @param rstp Pointer to allocated or referenced state
+ * @param dev  HTTP URL of the stream
+ *
+ * @return 0 if success, otherwise errorcode
+ */
 int rst_alloc(struct rst **rstp, const char *dev)
 {
 	struct pl host, port, path;
 	struct rst *rst;
+	struct le *le;
 	int err;
 
 	if (!rstp || !dev)
 		return EINVAL;
 
+	for (le = rstl.head; le; le = le->next) {
+
+		rst = le->data;
+
+		if (0 == str_cmp(rst->dev, dev)) {
+			*rstp = mem_ref(rst);
+			return 0;
+		}
+	}
+
 	if (re_regex(dev, strlen(dev), "http://[^:/]+[:]*[0-9]*[^]+",
 		     &host, NULL, &port, &path)) {
 		warning("rst: bad http url: %s\n", dev);
@@ -341,6 +419,10 @@ int rst_alloc(struct rst **rstp, const char *dev)
 
 	rst->id = "rst";
 
+	err = str_dup(&rst->dev, dev);
+	if (err)
+		goto out;
+
 	err = pl_strdup(&rst->host, &host);
 	if (err)
 		goto out;
@@ -357,30 +439,37 @@ int rst_alloc(struct rst **rstp, const char *dev)
 		goto out;
 
  out:
-	if (err)
+	if (err) {
 		mem_deref(rst);
-	else
+	}
+	else {
+		list_append(&rstl, &rst->le, rst);
 		*rstp = rst;
+	}
 
 	return err;
 }
 
 
-void rst_set_audio(struct rst *rst, struct ausrc_st *st)
+/* The player unlinks its entry before it dereferences the state */
+void rst_add_audio(struct rst *rst, struct le *le, struct player *pl)
 {
-	if (!rst)
+	if (!rst || !le)
 		return;
 
-	rst->ausrc_st = st;
+	list_append(&rst->audl, le, pl);
 }
 
 
-void rst_set_video(struct rst *rst, struct vidsrc_st *st)
+void rst_add_video(struct rst *rst, struct le *le, struct vidsrc_st *st)
 {
-	if (!rst)
+	if (!rst || !le)
 		return;
 
-	rst->vidsrc_st = st;
+	list_append(&rst->vidl, le, st);
+
+	if (rst->head_recv)
+		rst_video_update(st, rst->name, NULL);
 }
 
 
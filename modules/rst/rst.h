@@ -7,14 +7,15 @@
 
 /* Shared AV state */
 struct rst;
+struct player;
 
 int  rst_alloc(struct rst **rstp, const char *dev);
-void rst_set_audio(struct rst *rst, struct ausrc_st *st);
-void rst_set_video(struct rst *rst, struct vidsrc_st *st);
+void rst_add_audio(struct rst *rst, struct le *le, struct player *pl);
+void rst_add_video(struct rst *rst, struct le *le, struct vidsrc_st *st);
 
 
 /* Audio */
-void rst_audio_feed(struct ausrc_st *st, const uint8_t *buf, size_t sz);
+void rst_audio_feed(struct player *pl, const uint8_t *buf, size_t sz);
 int  rst_audio_init(void);
 void rst_audio_close(void);
 
@@ -16,6 +16,7 @@
 
 struct vidsrc_st {
 	const struct vidsrc *vs;  /* pointer to base-class (inheritance) */
+	struct le le;
 	pthread_mutex_t mutex;
 	pthread_t thread;
 	struct vidsrc_prm prm;
@@ -37,7 +38,7 @@ static void destructor(void *arg)
 {
 	struct vidsrc_st *st = arg;
 
-	rst_set_video(st->rst, NULL);
+	list_unlink(&st->le);
 	mem_deref(st->rst);
 
 	if (st->run) {
@@ -247,7 +248,7 @@ static int alloc_handler(struct vidsrc_st **stp, const struct vidsrc *vs,
 			*ctx = (struct media_ctx *)st->rst;
 	}
 
-	rst_set_video(st->rst, st);
+	rst_add_video(st->rst, &st->le, st);
 
 	st->run = true;
 
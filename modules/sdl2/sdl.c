@@ -14,24 +14,66 @@
  * @defgroup sdl2 sdl2
  *
  * Video display using Simple DirectMedia Layer version 2 (SDL2)
+ *
+ * YUV420P, NV12 and RGB32 frames are written straight into a streaming
+ * texture of the same format; other formats are converted to YUV420P
+ * first.
+ *
+ * The renderer must be used from the thread that created it, which is
+ * the video decode thread, so presents are not waited for with vsync
+ * by default. Frames that arrive within one refresh interval of the
+ * last present are dropped instead, as they would never be seen.
+ *
+ * The pictures of several calls can be composed in one window, with
+ * one texture per call. Only the textures of calls with a new picture
+ * are written, and the renderer scales and places all of them.
+ *
+ \verbatim
+      sdl2_vsync      no       # yes to block in present until vsync
+ \endverbatim
  */
 
 
+/* The texture of one call of a composed window */
+struct tile {
+	unsigned id;                    /**< Tile of the compositor */
+	SDL_Texture *texture;
+	struct vidsz size;
+	enum vidfmt fmt;
+	SDL_Rect rect;                  /**< Area in the canvas    */
+};
+
+enum { TILE_MAX = 16 };
+
 struct vidisp_st {
 	const struct vidisp *vd;        /**< Inheritance (1st)     */
+	struct tile tilev[TILE_MAX];    /**< If composed           */
+	size_t tilec;
 	SDL_Window *window;             /**< SDL Window            */
 	SDL_Renderer *renderer;         /**< SDL Renderer          */
 	SDL_Texture *texture;           /**< Texture for pixels    */
 	struct vidsz size;              /**< Current size          */
+	enum vidfmt fmt;                /**< Format of the texture */
+	struct vidframe *conv;          /**< For other formats     */
+	uint64_t ts_present;            /**< Last present in [ms]  */
+	uint32_t refresh;               /**< Refresh interval [ms] */
+	unsigned n_drop;
 	bool fullscreen;                /**< Fullscreen flag       */
 };
 
 
 static struct vidisp *vid;
+static bool vsync;
 
 
 static void sdl_reset(struct vidisp_st *st)
 {
+	size_t i;
+
+	for (i=0; i<st->tilec; i++)
+		SDL_DestroyTexture(st->tilev[i].texture);
+	st->tilec = 0;
+
 	if (st->texture) {
 		/*SDL_DestroyTexture(st->texture);*/
 		st->texture = NULL;
@@ -53,7 +95,83 @@ static void destructor(void *arg)
 {
 	struct vidisp_st *st = arg;
 
+	if (st->n_drop)
+		debug("sdl: %u frames dropped before present\n", st->n_drop);
+
 	sdl_reset(st);
+	mem_deref(st->conv);
+}
+
+
+static Uint32 texture_format(enum vidfmt fmt)
+{
+	switch (fmt) {
+
+	case VID_FMT_YUV420P: return SDL_PIXELFORMAT_IYUV;
+#if SDL_VERSION_ATLEAST(2, 0, 4)
+	case VID_FMT_NV12:    return SDL_PIXELFORMAT_NV12;
+#endif
+	case VID_FMT_RGB32:   return SDL_PIXELFORMAT_ARGB8888;
+	default:              return SDL_PIXELFORMAT_UNKNOWN;
+	}
+}
+
+
+static void copy_plane(uint8_t *dst, int dst_pitch,
+		       const uint8_t *src, int src_pitch,
+		       size_t len, unsigned rows)
+{
+	unsigned y;
+
+	if (dst_pitch == src_pitch) {
+		memcpy(dst, src, (size_t)src_pitch * (rows - 1) + len);
+		return;
+	}
+
+	for (y = 0; y < rows; y++) {
+
+		memcpy(dst, src, len);
+
+		dst += dst_pitch;
+		src += src_pitch;
+	}
+}
+
+
+/* Write the frame into the locked texture memory, plane by plane */
+static void texture_write(uint8_t *p, int pitch, const struct vidframe *frame)
+{
+	const unsigned w = frame->size.w, h = frame->size.h;
+
+	switch (frame->fmt) {
+
+	case VID_FMT_YUV420P:
+		copy_plane(p, pitch, frame->data[0], frame->linesize[0],
+			   w, h);
+		p += (size_t)pitch * h;
+		copy_plane(p, pitch/2, frame->data[1], frame->linesize[1],
+			   w/2, h/2);
+		p += (size_t)(pitch/2) * (h/2);
+		copy_plane(p, pitch/2, frame->data[2], frame->linesize[2],
+			   w/2, h/2);
+		break;
+
+	case VID_FMT_NV12:
+		copy_plane(p, pitch, frame->data[0], frame->linesize[0],
+			   w, h);
+		p += (size_t)pitch * h;
+		copy_plane(p, pitch, frame->data[1], frame->linesize[1],
+			   w, h/2);
+		break;
+
+	case VID_FMT_RGB32:
+		copy_plane(p, pitch, frame->data[0], frame->linesize[0],
+			   w * 4, h);
+		break;
+
+	default:
+		break;
+	}
 }
 
 
@@ -85,23 +203,9 @@ static int alloc(struct vidisp_st **stp, const struct vidisp *vd,
 }
 
 
-static int display(struct vidisp_st *st, const char *title,
-		   const struct vidframe *frame)
+static int sdl_open(struct vidisp_st *st, const char *title,
+		    const struct vidsz *size)
 {
-	void *pixels;
-	uint8_t *p;
-	int pitch, ret;
-	unsigned i, h;
-
-	if (!vidsz_cmp(&st->size, &frame->size)) {
-		if (st->size.w && st->size.h) {
-			info("sdl: reset size: %u x %u ---> %u x %u\n",
-			     st->size.w, st->size.h,
-			     frame->size.w, frame->size.h);
-		}
-		sdl_reset(st);
-	}
-
 	if (!st->window) {
 		Uint32 flags = SDL_WINDOW_SHOWN | SDL_WINDOW_INPUT_FOCUS;
 		char capt[256];
@@ -111,17 +215,17 @@ static int display(struct vidisp_st *st, const char *title,
 
 		if (title) {
 			re_snprintf(capt, sizeof(capt), "%s - %u x %u",
-				    title, frame->size.w, frame->size.h);
+				    title, size->w, size->h);
 		}
 		else {
 			re_snprintf(capt, sizeof(capt), "%u x %u",
-				    frame->size.w, frame->size.h);
+				    size->w, size->h);
 		}
 
 		st->window = SDL_CreateWindow(capt,
 					      SDL_WINDOWPOS_CENTERED,
 					      SDL_WINDOWPOS_CENTERED,
-					      frame->size.w, frame->size.h,
+					      size->w, size->h,
 					      flags);
 		if (!st->window) {
 			warning("sdl: unable to create sdl window: %s\n",
@@ -129,7 +233,7 @@ static int display(struct vidisp_st *st, const char *title,
 			return ENODEV;
 		}
 
-		st->size = frame->size;
+		st->size = *size;
 
 		SDL_RaiseWindow(st->window);
 		SDL_SetWindowBordered(st->window, true);
@@ -138,10 +242,18 @@ static int display(struct vidisp_st *st, const char *title,
 
 	if (!st->renderer) {
 
+		SDL_DisplayMode mode;
 		Uint32 flags = 0;
 
 		flags |= SDL_RENDERER_ACCELERATED;
-		flags |= SDL_RENDERER_PRESENTVSYNC;
+		if (vsync)
+			flags |= SDL_RENDERER_PRESENTVSYNC;
+
+		st->refresh = 0;
+		if (!vsync &&
+		    0 == SDL_GetWindowDisplayMode(st->window, &mode) &&
+		    mode.refresh_rate > 0)
+			st->refresh = 1000 / mode.refresh_rate;
 
 		st->renderer = SDL_CreateRenderer(st->window, -1, flags);
 		if (!st->renderer) {
@@ -151,48 +263,211 @@ static int display(struct vidisp_st *st, const char *title,
 		}
 	}
 
-	if (!st->texture) {
+	return 0;
+}
+
+
+/* The frame in a format of a texture, converted if needed */
+static const struct vidframe *frame_texture(struct vidisp_st *st,
+					    const struct vidframe *frame)
+{
+	if (texture_format(frame->fmt) != SDL_PIXELFORMAT_UNKNOWN)
+		return frame;
 
-		st->texture = SDL_CreateTexture(st->renderer,
-						SDL_PIXELFORMAT_IYUV,
-						SDL_TEXTUREACCESS_STREAMING,
-						frame->size.w, frame->size.h);
-		if (!st->texture) {
+	if (!st->conv || !vidsz_cmp(&st->conv->size, &frame->size)) {
+
+		st->conv = mem_deref(st->conv);
+		if (vidframe_alloc(&st->conv, VID_FMT_YUV420P, &frame->size))
+			return NULL;
+	}
+
+	vidconv(st->conv, frame, NULL);
+
+	return st->conv;
+}
+
+
+/* Write the frame into the texture, which is created if needed */
+static int texture_update(struct vidisp_st *st, SDL_Texture **texp,
+			  enum vidfmt *fmt, struct vidsz *size,
+			  const struct vidframe *frame)
+{
+	void *pixels;
+	int pitch, ret;
+
+	if (*texp && (*fmt != frame->fmt || !vidsz_cmp(size, &frame->size))) {
+		SDL_DestroyTexture(*texp);
+		*texp = NULL;
+	}
+
+	if (!*texp) {
+
+		*texp = SDL_CreateTexture(st->renderer,
+					  texture_format(frame->fmt),
+					  SDL_TEXTUREACCESS_STREAMING,
+					  frame->size.w, frame->size.h);
+		if (!*texp) {
 			warning("sdl: unable to create texture: %s\n",
 				SDL_GetError());
 			return ENODEV;
 		}
+
+		*fmt  = frame->fmt;
+		*size = frame->size;
 	}
 
-	ret = SDL_LockTexture(st->texture, NULL, &pixels, &pitch);
+	ret = SDL_LockTexture(*texp, NULL, &pixels, &pitch);
 	if (ret != 0) {
 		warning("sdl: unable to lock texture (ret=%d)\n", ret);
 		return ENODEV;
 	}
 
-	p = pixels;
-	for (i=0; i<3; i++) {
+	texture_write(pixels, pitch, frame);
 
-		const uint8_t *s   = frame->data[i];
-		const unsigned stp = frame->linesize[0] / frame->linesize[i];
-		const unsigned sz  = frame->size.w / stp;
+	SDL_UnlockTexture(*texp);
 
-		for (h = 0; h < frame->size.h; h += stp) {
+	return 0;
+}
 
-			memcpy(p, s, sz);
 
-			s += frame->linesize[i];
-			p += (pitch / stp);
+static int display(struct vidisp_st *st, const char *title,
+		   const struct vidframe *frame)
+{
+	uint64_t now;
+	int err;
+
+	now = tmr_jiffies();
+	if (st->refresh && st->ts_present &&
+	    now < st->ts_present + st->refresh) {
+		++st->n_drop;
+		return 0;
+	}
+
+	frame = frame_texture(st, frame);
+	if (!frame)
+		return ENOMEM;
+
+	if (!vidsz_cmp(&st->size, &frame->size)) {
+		if (st->size.w && st->size.h) {
+			info("sdl: reset size: %u x %u ---> %u x %u\n",
+			     st->size.w, st->size.h,
+			     frame->size.w, frame->size.h);
 		}
+		sdl_reset(st);
 	}
 
-	SDL_UnlockTexture(st->texture);
+	err = sdl_open(st, title, &frame->size);
+	if (err)
+		return err;
+
+	err = texture_update(st, &st->texture, &st->fmt, &st->size, frame);
+	if (err)
+		return err;
 
 	/* Blit the sprite onto the screen */
 	SDL_RenderCopy(st->renderer, st->texture, NULL, NULL);
 
 	/* Update the screen! */
 	SDL_RenderPresent(st->renderer);
+	st->ts_present = now;
+
+	return 0;
+}
+
+
+static struct tile *tile_get(struct vidisp_st *st, unsigned id)
+{
+	struct tile *t;
+	size_t i;
+
+	for (i=0; i<st->tilec; i++) {
+		if (st->tilev[i].id == id)
+			return &st->tilev[i];
+	}
+
+	if (st->tilec >= ARRAY_SIZE(st->tilev))
+		return NULL;
+
+	t = &st->tilev[st->tilec++];
+	memset(t, 0, sizeof(*t));
+	t->id = id;
+
+	return t;
+}
+
+
+static int compose(struct vidisp_st *st, const char *title,
+		   const struct vidsz *canvas,
+		   const struct vidisp_tile *tilev, size_t tilec)
+{
+	size_t i, j;
+	int err;
+
+	err = sdl_open(st, title, canvas);
+	if (err)
+		return err;
+
+	/* the renderer scales the canvas to the window */
+	SDL_RenderSetLogicalSize(st->renderer, canvas->w, canvas->h);
+
+	/* drop the textures of calls that are gone */
+	for (i=0; i<st->tilec; ) {
+
+		for (j=0; j<tilec; j++) {
+			if (tilev[j].id == st->tilev[i].id)
+				break;
+		}
+
+		if (j < tilec) {
+			++i;
+			continue;
+		}
+
+		SDL_DestroyTexture(st->tilev[i].texture);
+		st->tilev[i] = st->tilev[--st->tilec];
+	}
+
+	for (j=0; j<tilec; j++) {
+
+		const struct vidframe *frame = tilev[j].frame;
+		struct tile *t = tile_get(st, tilev[j].id);
+
+		if (!t)
+			continue;
+
+		t->rect.x = tilev[j].rect->x;
+		t->rect.y = tilev[j].rect->y;
+		t->rect.w = tilev[j].rect->w;
+		t->rect.h = tilev[j].rect->h;
+
+		/* only new pictures are written to the GPU */
+		if (!frame)
+			continue;
+
+		frame = frame_texture(st, frame);
+		if (!frame)
+			return ENOMEM;
+
+		err = texture_update(st, &t->texture, &t->fmt, &t->size,
+				     frame);
+		if (err)
+			return err;
+	}
+
+	SDL_SetRenderDrawColor(st->renderer, 0, 0, 0, 255);
+	SDL_RenderClear(st->renderer);
+
+	for (i=0; i<st->tilec; i++) {
+
+		const struct tile *t = &st->tilev[i];
+
+		if (t->texture)
+			SDL_RenderCopy(st->renderer, t->texture, NULL,
+				       &t->rect);
+	}
+
+	SDL_RenderPresent(st->renderer);
+	st->ts_present = tmr_jiffies();
 
 	return 0;
 }
@@ -211,6 +486,8 @@ static int module_init(void)
 {
 	int err;
 
+	conf_get_bool(conf_cur(), "sdl2_vsync", &vsync);
+
 	if (SDL_VideoInit(NULL) < 0) {
 		warning("sdl2: unable to init Video: %s\n",
 			SDL_GetError());
@@ -221,6 +498,8 @@ static int module_init(void)
 	if (err)
 		return err;
 
+	vidisp_set_compose(vid, compose);
+
 	return 0;
 }
 
@@ -14,6 +14,11 @@
  *
  * Show a selfview of the captured video stream
  *
+ * In pip mode the captured frame is scaled down once per frame with a
+ * box filter. The receiving side keeps the self-view scaled to its
+ * corner rectangle, and only scales it again when a new self frame
+ * arrives, so a higher remote frame rate costs one copy per frame.
+ *
  * Example config:
  \verbatim
   video_selfview          pip # {window,pip}
@@ -24,19 +29,23 @@
 
 /* shared state */
 struct selfview {
-	struct lock *lock;          /**< Protect frame         */
+	struct lock *lock;          /**< Protect frame and seq */
 	struct vidframe *frame;     /**< Copy of encoded frame */
+	uint32_t seq;               /**< Bumped for each frame */
 };
 
 struct selfview_enc {
 	struct vidfilt_enc_st vf;   /**< Inheritance           */
 	struct selfview *selfview;  /**< Ref. to shared state  */
 	struct vidisp_st *disp;     /**< Selfview display      */
+	struct vidframe *spare;     /**< Next frame to fill    */
 };
 
 struct selfview_dec {
 	struct vidfilt_dec_st vf;   /**< Inheritance           */
 	struct selfview *selfview;  /**< Ref. to shared state  */
+	struct vidframe *scaled;    /**< Self-view at rect size */
+	uint32_t seq;               /**< Sequence of scaled    */
 };
 
 
@@ -61,6 +70,7 @@ static void encode_destructor(void *arg)
 	list_unlink(&st->vf.le);
 	mem_deref(st->selfview);
 	mem_deref(st->disp);
+	mem_deref(st->spare);
 }
 
 
@@ -70,6 +80,7 @@ static void decode_destructor(void *arg)
 
 	list_unlink(&st->vf.le);
 	mem_deref(st->selfview);
+	mem_deref(st->scaled);
 }
 
 
@@ -171,34 +182,90 @@ static int encode_win(struct vidfilt_enc_st *st, struct vidframe *frame)
 }
 
 
+/* scale with the box filter, or with vidconv() for other formats */
+static void scale(struct vidframe *dst, const struct vidframe *src,
+		  const struct vidrect *r)
+{
+	if (vidconv_scale(dst, src, r))
+		vidconv(dst, src, (struct vidrect *)r);
+}
+
+
+/* copy a YUV420P frame into a rectangle at an even position */
+static void blit(struct vidframe *dst, const struct vidframe *src,
+		 unsigned x, unsigned y)
+{
+	int i;
+
+	if (dst->fmt != VID_FMT_YUV420P || src->fmt != VID_FMT_YUV420P) {
+		struct vidrect rect = {x, y, src->size.w, src->size.h};
+
+		vidconv(dst, src, &rect);
+		return;
+	}
+
+	for (i=0; i<3; i++) {
+
+		const unsigned cs = i ? 1 : 0;
+		const unsigned w = (src->size.w + cs) >> cs;
+		const unsigned h = (src->size.h + cs) >> cs;
+		uint8_t *d = dst->data[i] + (y >> cs) * dst->linesize[i] +
+			(x >> cs);
+		const uint8_t *s = src->data[i];
+		unsigned j;
+
+		for (j=0; j<h; j++) {
+			memcpy(d, s, w);
+			d += dst->linesize[i];
+			s += src->linesize[i];
+		}
+	}
+}
+
+
 static int encode_pip(struct vidfilt_enc_st *st, struct vidframe *frame)
 {
 	struct selfview_enc *enc = (struct selfview_enc *)st;
 	struct selfview *selfview = enc->selfview;
+	struct vidframe *f;
+	struct vidsz sz;
 	int err = 0;
 
 	if (!frame)
 		return 0;
 
-	lock_write_get(selfview->lock);
-	if (!selfview->frame) {
-		struct vidsz sz;
+	/* Use size if configured, or else 20% of main window */
+	if (selfview_size.w && selfview_size.h) {
+		sz = selfview_size;
+	}
+	else {
+		sz.w = frame->size.w / 5;
+		sz.h = frame->size.h / 5;
+	}
 
-		/* Use size if configured, or else 20% of main window */
-		if (selfview_size.w && selfview_size.h) {
-			sz = selfview_size;
-		}
-		else {
-			sz.w = frame->size.w / 5;
-			sz.h = frame->size.h / 5;
-		}
+	if (!sz.w || !sz.h)
+		return 0;
 
-		err = vidframe_alloc(&selfview->frame, VID_FMT_YUV420P, &sz);
+	if (enc->spare && !vidsz_cmp(&enc->spare->size, &sz))
+		enc->spare = mem_deref(enc->spare);
+
+	if (!enc->spare) {
+		err = vidframe_alloc(&enc->spare, VID_FMT_YUV420P, &sz);
+		if (err)
+			return err;
 	}
-	if (!err)
-		vidconv(selfview->frame, frame, NULL);
+
+	/* scale outside the lock, then swap in the new frame */
+	scale(enc->spare, frame, NULL);
+
+	lock_write_get(selfview->lock);
+	f = selfview->frame;
+	selfview->frame = enc->spare;
+	++selfview->seq;
 	lock_rel(selfview->lock);
 
+	enc->spare = f;
+
 	return err;
 }
 
@@ -214,9 +281,10 @@ static int decode_pip(struct vidfilt_dec_st *st, struct vidframe *frame)
 	lock_read_get(sv->lock);
 	if (sv->frame) {
 		struct vidrect rect;
+		struct vidsz sz;
 
-		rect.w = min(sv->frame->size.w, frame->size.w/2);
-		rect.h = min(sv->frame->size.h, frame->size.h/2);
+		rect.w = min(sv->frame->size.w, frame->size.w/2) & ~1;
+		rect.h = min(sv->frame->size.h, frame->size.h/2) & ~1;
 		if (rect.w <= (frame->size.w - 10))
 			rect.x = frame->size.w - rect.w - 10;
 		else
@@ -226,11 +294,43 @@ static int decode_pip(struct vidfilt_dec_st *st, struct vidframe *frame)
 		else
 			rect.y = frame->size.h/2;
 
-		vidconv(frame, sv->frame, &rect);
+		rect.x &= ~1;
+		rect.y &= ~1;
+
+		if (!rect.w || !rect.h)
+			goto out;
+
+		sz.w = rect.w;
+		sz.h = rect.h;
+
+		if (vidsz_cmp(&sv->frame->size, &sz)) {
+
+			blit(frame, sv->frame, rect.x, rect.y);
+		}
+		else {
+			if (dec->scaled && !vidsz_cmp(&dec->scaled->size, &sz))
+				dec->scaled = mem_deref(dec->scaled);
+
+			if (!dec->scaled) {
+				if (vidframe_alloc(&dec->scaled,
+						   VID_FMT_YUV420P, &sz))
+					goto out;
+				dec->seq = sv->seq - 1;
+			}
+
+			/* only scaled again for a new self frame */
+			if (dec->seq != sv->seq) {
+				scale(dec->scaled, sv->frame, NULL);
+				dec->seq = sv->seq;
+			}
+
+			blit(frame, dec->scaled, rect.x, rect.y);
+		}
 
 		vidframe_draw_rect(frame, rect.x, rect.y, rect.w, rect.h,
 				   127, 127, 127);
 	}
+ out:
 	lock_rel(sv->lock);
 
 	return 0;
@@ -238,11 +338,12 @@ static int decode_pip(struct vidfilt_dec_st *st, struct vidframe *frame)
 
 
 static struct vidfilt selfview_win = {
-	LE_INIT, "selfview_window", encode_update, encode_win, NULL, NULL
+	LE_INIT, "selfview_window", encode_update, encode_win, NULL, NULL,
+	true
 };
 static struct vidfilt selfview_pip = {
 	LE_INIT, "selfview_pip",
-	encode_update, encode_pip, decode_update, decode_pip
+	encode_update, encode_pip, decode_update, decode_pip, true
 };
 
 
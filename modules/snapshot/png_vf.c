@@ -6,6 +6,7 @@
  */
 #define _DEFAULT_SOURCE 1
 #define _BSD_SOURCE 1
+#include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <png.h>
@@ -15,44 +16,67 @@
 #include "png_vf.h"
 
 
+/*
+ * The rows are handed to libpng straight from the RGB32 frame; libpng
+ * swaps BGR and strips the alpha byte itself. Snapshots favour speed
+ * over size, so the fastest zlib level is used.
+ */
+enum {
+	PNG_LEVEL = 1,   /**< zlib compression level, Z_BEST_SPEED */
+};
+
+
 static char *png_filename(const struct tm *tmx, const char *name,
 			  char *buf, unsigned int length);
-static void png_save_free(png_structp png_ptr, png_byte **png_row_pointers,
-			  int png_height);
 
 
-int png_save_vidframe(const struct vidframe *vf, const char *path)
+/**
+ * Write a video frame to a PNG-file
+ *
+ * @param vf    Video frame, in RGB32 format
+ * @param name  File name without extension
+ * @param stamp True to append the local time to the file name, false
+ *              to replace the file "<name>.png"
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int png_save_vidframe(const struct vidframe *vf, const char *name,
+		      bool stamp)
 {
 	png_byte **png_row_pointers = NULL;
-	png_byte *row;
-	const png_byte *p;
-	png_byte red, green, blue;
 	png_structp png_ptr = NULL;
 	png_infop info_ptr = NULL;
 	FILE *fp = NULL;
-	size_t x, y;
 	unsigned int width = vf->size.w & ~1;
 	unsigned int height = vf->size.h & ~1;
-	unsigned int bytes_per_pixel = 3; /* RGB format */
-	time_t tnow;
-	struct tm *tmx;
 	char filename_buf[64];
-	struct vidframe *f2 = NULL;
+	char tmp_buf[68];
+	unsigned int y;
 	int err = 0;
 
-	tnow = time(NULL);
-	tmx = localtime(&tnow);
+	if (vf->fmt != VID_FMT_RGB32)
+		return EINVAL;
 
-	if (vf->fmt != VID_FMT_RGB32) {
+	if (stamp) {
+		time_t tnow = time(NULL);
 
-		err = vidframe_alloc(&f2, VID_FMT_RGB32, &vf->size);
-		if (err)
-			goto out;
-
-		vidconv(f2, vf, NULL);
-		vf = f2;
+		png_filename(localtime(&tnow), name,
+			     filename_buf, sizeof(filename_buf));
+		if (!filename_buf[0])
+			return ENAMETOOLONG;
+	}
+	else {
+		/* written to a temporary file, so readers never see
+		   a partial image */
+		if (re_snprintf(filename_buf, sizeof(filename_buf),
+				"%s.png", name) < 0)
+			return ENAMETOOLONG;
 	}
 
+	if (re_snprintf(tmp_buf, sizeof(tmp_buf), "%s.tmp",
+			filename_buf) < 0)
+		return ENAMETOOLONG;
+
 	/* Initialize the write struct. */
 	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
 					  NULL, NULL, NULL);
@@ -85,41 +109,19 @@ int png_save_vidframe(const struct vidframe *vf, const char *path)
 		     PNG_COMPRESSION_TYPE_DEFAULT,
 		     PNG_FILTER_TYPE_DEFAULT);
 
-	/* Initialize rows of PNG
-	 *    bytes_per_row = width * bytes_per_pixel;
-	 */
+	png_set_compression_level(png_ptr, PNG_LEVEL);
+
+	/* Point the rows into the frame, no copy */
 	png_row_pointers = png_malloc(png_ptr,
 				      height * sizeof(png_byte *));
 
 	for (y = 0; y < height; ++y) {
-		png_row_pointers[y] =
-			(png_byte *) png_malloc(png_ptr,
-						width * sizeof(uint8_t) *
-						bytes_per_pixel);
-	}
-
-	p = vf->data[0];
-	for (y = 0; y < height; ++y) {
-
-		row = png_row_pointers[y];
-
-		for (x = 0; x < width; ++x) {
-
-			red   = *p++;
-			green = *p++;
-			blue  = *p++;
-
-			*row++ = blue;
-			*row++ = green;
-			*row++ = red;
-
-			++p;		/* skip alpha */
-		}
+		png_row_pointers[y] = (png_byte *)vf->data[0] +
+			(size_t)y * vf->linesize[0];
 	}
 
 	/* Write the image data. */
-	fp = fopen(png_filename(tmx, path,
-				filename_buf, sizeof(filename_buf)), "wb");
+	fp = fopen(stamp ? filename_buf : tmp_buf, "wb");
 	if (fp == NULL) {
 		err = errno;
 		goto out;
@@ -127,35 +129,34 @@ int png_save_vidframe(const struct vidframe *vf, const char *path)
 
 	png_init_io(png_ptr, fp);
 	png_set_rows(png_ptr, info_ptr, png_row_pointers);
-	png_write_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
+	png_write_png(png_ptr, info_ptr,
+		      PNG_TRANSFORM_BGR | PNG_TRANSFORM_STRIP_FILLER_AFTER,
+		      NULL);
 
-	info("png: wrote %s\n", filename_buf);
+	if (fclose(fp)) {
+		fp = NULL;
+		err = errno;
+		goto out;
+	}
+	fp = NULL;
+
+	if (!stamp && rename(tmp_buf, filename_buf)) {
+		err = errno;
+		goto out;
+	}
+
+	if (stamp)
+		info("png: wrote %s\n", filename_buf);
 
  out:
 	/* Finish writing. */
-	mem_deref(f2);
-	png_save_free(png_ptr, png_row_pointers, height);
+	if (png_ptr)
+		png_free(png_ptr, png_row_pointers);
 	png_destroy_write_struct(&png_ptr, &info_ptr);
 	if (fp)
 		fclose(fp);
 
-	return 0;
-}
-
-
-static void png_save_free(png_structp png_ptr, png_byte **png_row_pointers,
-			  int png_height)
-{
-	int y;
-
-	/* Cleanup. */
-	if (png_height == 0 || png_row_pointers == NULL)
-		return;
-
-	for (y = 0; y < png_height; y++) {
-		png_free(png_ptr, png_row_pointers[y]);
-	}
-	png_free(png_ptr, png_row_pointers);
+	return err;
 }
 
 
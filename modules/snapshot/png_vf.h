@@ -3,4 +3,5 @@
  */
 
 
-int png_save_vidframe(const struct vidframe *vf, const char *path);
+int png_save_vidframe(const struct vidframe *vf, const char *name,
+		      bool stamp);
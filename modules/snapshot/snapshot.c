@@ -4,6 +4,7 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <string.h>
+#include <pthread.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -15,16 +16,224 @@
  *
  * Take snapshot of the video stream and save it as PNG-files
  *
+ * The video threads only copy the frame into a pooled buffer; colour
+ * conversion and PNG compression are done by a worker thread. If the
+ * worker falls behind, new snapshots are dropped.
+ *
+ * Thumbnails can be taken periodically, and are written to the files
+ * snapshot-send-thumb.png and snapshot-recv-thumb.png, which are
+ * replaced every time.
+ *
  *
  * Commands:
  *
  \verbatim
  O       Take video snapshot
  \endverbatim
+ *
+ * Example configuration:
+ \verbatim
+  snapshot_interval       60      # Thumbnail interval in [s], 0 is off
+  snapshot_thumb_width    320     # Thumbnail width in [pixels]
+ \endverbatim
  */
 
 
-static bool flag_enc, flag_dec;
+enum {
+	POOL_SIZE = 2,          /**< Frames waiting for the worker, per dir */
+	THUMB_WIDTH = 320,      /**< Default thumbnail width in [pixels]    */
+};
+
+enum dir {
+	DIR_SEND = 0,
+	DIR_RECV,
+	DIR_N
+};
+
+struct job {
+	struct le le;
+	struct vidframe *frame;     /**< Pooled copy of the video frame */
+	const char *name;
+	bool thumb;
+};
+
+
+static struct {
+	pthread_mutex_t mutex;      /**< Protects jobl, run and poolv */
+	pthread_cond_t cond;
+	pthread_t thread;
+	struct list jobl;
+	bool run;
+	struct vidframe_pool *poolv[DIR_N];
+	struct vidframe *rgb;       /**< Worker only */
+	struct tmr tmr;
+	uint32_t interval;          /**< Thumbnail interval in [s] */
+	uint32_t thumb_width;
+} snap = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+};
+
+static const char *namev[DIR_N] = {"snapshot-send", "snapshot-recv"};
+static const char *thumbv[DIR_N] = {"snapshot-send-thumb",
+				    "snapshot-recv-thumb"};
+
+static bool flag_snap[DIR_N], flag_thumb[DIR_N];
+
+
+static void job_destructor(void *arg)
+{
+	struct job *job = arg;
+
+	mem_deref(job->frame);
+}
+
+
+static void write_job(const struct job *job)
+{
+	const struct vidframe *src = job->frame;
+	struct vidsz sz = src->size;
+	int err;
+
+	if (job->thumb && snap.thumb_width && snap.thumb_width < sz.w) {
+		sz.h = (sz.h * snap.thumb_width / sz.w) & ~1;
+		sz.w = snap.thumb_width & ~1;
+		if (!sz.w || !sz.h)
+			return;
+	}
+
+	if (!snap.rgb || !vidsz_cmp(&snap.rgb->size, &sz)) {
+
+		snap.rgb = mem_deref(snap.rgb);
+
+		err = vidframe_alloc(&snap.rgb, VID_FMT_RGB32, &sz);
+		if (err) {
+			warning("snapshot: frame alloc failed (%m)\n", err);
+			return;
+		}
+	}
+
+	vidconv_fast(snap.rgb, src, NULL);
+
+	err = png_save_vidframe(snap.rgb, job->name, !job->thumb);
+	if (err)
+		warning("snapshot: could not write %s (%m)\n", job->name, err);
+}
+
+
+static void *worker(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&snap.mutex);
+
+	/* pending snapshots are still written when stopping */
+	while (snap.run || !list_isempty(&snap.jobl)) {
+
+		struct job *job = list_ledata(list_head(&snap.jobl));
+
+		if (!job) {
+			pthread_cond_wait(&snap.cond, &snap.mutex);
+			continue;
+		}
+
+		list_unlink(&job->le);
+
+		pthread_mutex_unlock(&snap.mutex);
+
+		write_job(job);
+		mem_deref(job);
+
+		pthread_mutex_lock(&snap.mutex);
+	}
+
+	pthread_mutex_unlock(&snap.mutex);
+
+	snap.rgb = mem_deref(snap.rgb);
+
+	return NULL;
+}
+
+
+/* called with the mutex held */
+static int pool_get(struct vidframe **fp, enum dir dir,
+		    const struct vidframe *src)
+{
+	struct vidframe_pool **poolp = &snap.poolv[dir];
+	int err;
+
+	if (*poolp && !vidframe_pool_match(*poolp, src->fmt, &src->size) &&
+	    !vidframe_pool_match(*poolp, VID_FMT_YUV420P, &src->size))
+		*poolp = mem_deref(*poolp);
+
+	if (!*poolp) {
+		err = vidframe_pool_alloc(poolp, src->fmt, &src->size,
+					  POOL_SIZE);
+		if (err == ENOTSUP)
+			err = vidframe_pool_alloc(poolp, VID_FMT_YUV420P,
+						  &src->size, POOL_SIZE);
+		if (err)
+			return err;
+	}
+
+	return vidframe_pool_get(*poolp, fp);
+}
+
+
+static void queue_frame(enum dir dir, const struct vidframe *src,
+			bool thumb)
+{
+	struct job *job;
+	int err;
+
+	job = mem_zalloc(sizeof(*job), job_destructor);
+	if (!job)
+		return;
+
+	job->name  = thumb ? thumbv[dir] : namev[dir];
+	job->thumb = thumb;
+
+	pthread_mutex_lock(&snap.mutex);
+	err = snap.run ? pool_get(&job->frame, dir, src) : ECANCELED;
+	pthread_mutex_unlock(&snap.mutex);
+
+	if (err) {
+		if (err == EBUSY || err == ECANCELED)
+			debug("snapshot: %s dropped\n", job->name);
+		else
+			warning("snapshot: %s failed (%m)\n", job->name, err);
+		goto out;
+	}
+
+	if (job->frame->fmt == src->fmt)
+		vidframe_copy(job->frame, src);
+	else
+		vidconv_fast(job->frame, src, NULL);
+
+	pthread_mutex_lock(&snap.mutex);
+	list_append(&snap.jobl, &job->le, job);
+	pthread_cond_signal(&snap.cond);
+	pthread_mutex_unlock(&snap.mutex);
+
+	job = NULL;
+
+ out:
+	mem_deref(job);
+}
+
+
+static void process(enum dir dir, const struct vidframe *frame)
+{
+	if (flag_snap[dir]) {
+		flag_snap[dir] = false;
+		queue_frame(dir, frame, false);
+	}
+
+	if (flag_thumb[dir]) {
+		flag_thumb[dir] = false;
+		queue_frame(dir, frame, true);
+	}
+}
 
 
 static int encode(struct vidfilt_enc_st *st, struct vidframe *frame)
@@ -34,10 +243,7 @@ static int encode(struct vidfilt_enc_st *st, struct vidframe *frame)
 	if (!frame)
 		return 0;
 
-	if (flag_enc) {
-		flag_enc = false;
-		png_save_vidframe(frame, "snapshot-send");
-	}
+	process(DIR_SEND, frame);
 
 	return 0;
 }
@@ -50,29 +256,36 @@ static int decode(struct vidfilt_dec_st *st, struct vidframe *frame)
 	if (!frame)
 		return 0;
 
-	if (flag_dec) {
-		flag_dec = false;
-		png_save_vidframe(frame, "snapshot-recv");
-	}
+	process(DIR_RECV, frame);
 
 	return 0;
 }
 
 
+static void tmr_handler(void *arg)
+{
+	(void)arg;
+
+	tmr_start(&snap.tmr, snap.interval * 1000, tmr_handler, NULL);
+
+	flag_thumb[DIR_SEND] = flag_thumb[DIR_RECV] = true;
+}
+
+
 static int do_snapshot(struct re_printf *pf, void *arg)
 {
 	(void)pf;
 	(void)arg;
 
 	/* NOTE: not re-entrant */
-	flag_enc = flag_dec = true;
+	flag_snap[DIR_SEND] = flag_snap[DIR_RECV] = true;
 
 	return 0;
 }
 
 
 static struct vidfilt snapshot = {
-	LE_INIT, "snapshot", NULL, encode, NULL, decode,
+	LE_INIT, "snapshot", NULL, encode, NULL, decode, true
 };
 
 
@@ -83,6 +296,26 @@ static const struct cmd cmdv[] = {
 
 static int module_init(void)
 {
+	int err;
+
+	snap.interval    = 0;
+	snap.thumb_width = THUMB_WIDTH;
+
+	(void)conf_get_u32(conf_cur(), "snapshot_interval", &snap.interval);
+	(void)conf_get_u32(conf_cur(), "snapshot_thumb_width",
+			   &snap.thumb_width);
+
+	snap.run = true;
+	err = pthread_create(&snap.thread, NULL, worker, NULL);
+	if (err) {
+		snap.run = false;
+		return err;
+	}
+
+	tmr_init(&snap.tmr);
+	if (snap.interval)
+		tmr_start(&snap.tmr, snap.interval * 1000, tmr_handler, NULL);
+
 	vidfilt_register(&snapshot);
 	return cmd_register(cmdv, ARRAY_SIZE(cmdv));
 }
@@ -90,8 +323,23 @@ static int module_init(void)
 
 static int module_close(void)
 {
+	int i;
+
 	vidfilt_unregister(&snapshot);
 	cmd_unregister(cmdv);
+
+	tmr_cancel(&snap.tmr);
+
+	pthread_mutex_lock(&snap.mutex);
+	snap.run = false;
+	pthread_cond_signal(&snap.cond);
+	pthread_mutex_unlock(&snap.mutex);
+
+	pthread_join(snap.thread, NULL);
+
+	for (i=0; i<DIR_N; i++)
+		snap.poolv[i] = mem_deref(snap.poolv[i]);
+
 	return 0;
 }
 
@@ -4,7 +4,9 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <sndfile.h>
+#include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include <re.h>
 #include <baresip.h>
 
@@ -13,19 +15,60 @@
  * @defgroup sndfile sndfile
  *
  * Audio filter that writes audio samples to WAV-file
+ *
+ * The filters only copy the samples into a ring buffer per file, which
+ * never blocks. A writer thread drains all rings in batches, so a slow
+ * disk can not stall the audio. If the writer falls behind by more
+ * than the ring, frames are dropped and counted.
+ *
+ * Example config:
+ \verbatim
+  sndfile_format          wav      # wav, flac or opus
+ \endverbatim
  */
 
 
+enum {
+	RING_TIME = 4000,     /**< Ring buffer length in [ms]       */
+	BATCH_TIME = 200,     /**< Interval between writes in [ms]  */
+};
+
+/** One file, with a single-producer single-consumer ring */
+struct recording {
+	struct le le;         /* in the writer's list */
+	SNDFILE *sf;
+	int16_t *ringv;
+	size_t size;          /* ring size, power of two */
+	size_t head;          /* written by the filter (atomic) */
+	size_t tail;          /* written by the writer (atomic) */
+	uint32_t overflows;   /* dropped frames (atomic) */
+	bool done;            /* filter is closed (atomic) */
+	char filename[128];
+};
+
 struct sndfile_enc {
 	struct aufilt_enc_st af;  /* base class */
-	SNDFILE *enc;
+	struct recording *rec;
 };
 
 struct sndfile_dec {
 	struct aufilt_dec_st af;  /* base class */
-	SNDFILE *dec;
+	struct recording *rec;
+};
+
+
+static struct {
+	pthread_mutex_t mutex;    /* protects recl */
+	pthread_t thread;
+	struct list recl;
+	bool run;
+} writer = {
+	PTHREAD_MUTEX_INITIALIZER,
 };
 
+static int sf_format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+static const char *sf_ext = "wav";
+
 
 static int timestamp_print(struct re_printf *pf, const struct tm *tm)
 {
@@ -38,55 +81,180 @@ static int timestamp_print(struct re_printf *pf, const struct tm *tm)
 }
 
 
-static void enc_destructor(void *arg)
+static void rec_destructor(void *arg)
 {
-	struct sndfile_enc *st = arg;
+	struct recording *rec = arg;
+
+	if (rec->overflows) {
+		warning("sndfile: %s: %u frames dropped, disk too slow\n",
+			rec->filename, rec->overflows);
+	}
 
-	if (st->enc)
-		sf_close(st->enc);
+	if (rec->sf)
+		sf_close(rec->sf);
 
-	list_unlink(&st->af.le);
+	mem_deref(rec->ringv);
 }
 
 
-static void dec_destructor(void *arg)
+/* writer thread, or main thread when the writer is stopped */
+static void rec_drain(struct recording *rec)
 {
-	struct sndfile_dec *st = arg;
+	size_t tail = rec->tail;
+	size_t head = __atomic_load_n(&rec->head, __ATOMIC_ACQUIRE);
 
-	if (st->dec)
-		sf_close(st->dec);
+	while (tail != head) {
 
-	list_unlink(&st->af.le);
+		size_t i = tail & (rec->size - 1);
+		size_t n = min(head - tail, rec->size - i);
+
+		sf_write_short(rec->sf, &rec->ringv[i], n);
+
+		tail += n;
+		__atomic_store_n(&rec->tail, tail, __ATOMIC_RELEASE);
+	}
 }
 
 
-static SNDFILE *openfile(const struct aufilt_prm *prm, bool enc)
+/* filter thread, never blocks */
+static void rec_write(struct recording *rec, const int16_t *sampv,
+		      size_t sampc)
 {
-	char filename[128];
+	size_t head = rec->head;
+	size_t tail = __atomic_load_n(&rec->tail, __ATOMIC_ACQUIRE);
+	size_t i, n;
+
+	if (sampc > rec->size - (head - tail)) {
+		__atomic_fetch_add(&rec->overflows, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	i = head & (rec->size - 1);
+	n = min(sampc, rec->size - i);
+
+	memcpy(&rec->ringv[i], sampv, n * 2);
+	memcpy(rec->ringv, sampv + n, (sampc - n) * 2);
+
+	__atomic_store_n(&rec->head, head + sampc, __ATOMIC_RELEASE);
+}
+
+
+static void *writer_thread(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&writer.mutex);
+
+	while (writer.run) {
+
+		struct le *le = writer.recl.head;
+
+		while (le) {
+			struct recording *rec = le->data;
+			bool done;
+
+			le = le->next;
+
+			done = __atomic_load_n(&rec->done, __ATOMIC_ACQUIRE);
+
+			rec_drain(rec);
+
+			/* the filter is gone, the writer owns the file */
+			if (done) {
+				list_unlink(&rec->le);
+				mem_deref(rec);
+			}
+		}
+
+		pthread_mutex_unlock(&writer.mutex);
+		sys_msleep(BATCH_TIME);
+		pthread_mutex_lock(&writer.mutex);
+	}
+
+	pthread_mutex_unlock(&writer.mutex);
+
+	return NULL;
+}
+
+
+static int rec_alloc(struct recording **recp, const struct aufilt_prm *prm,
+		     bool enc)
+{
+	struct recording *rec;
 	SF_INFO sfinfo;
 	time_t tnow = time(0);
 	struct tm *tm = localtime(&tnow);
-	SNDFILE *sf;
+	size_t sampc;
+
+	rec = mem_zalloc(sizeof(*rec), rec_destructor);
+	if (!rec)
+		return ENOMEM;
+
+	(void)re_snprintf(rec->filename, sizeof(rec->filename),
+			  "dump-%H-%s.%s",
+			  timestamp_print, tm, enc ? "enc" : "dec", sf_ext);
 
-	(void)re_snprintf(filename, sizeof(filename),
-			  "dump-%H-%s.wav",
-			  timestamp_print, tm, enc ? "enc" : "dec");
+	sampc = (size_t)prm->srate * prm->ch * RING_TIME / 1000;
+	for (rec->size = 1; rec->size < sampc; rec->size <<= 1)
+		;
 
+	rec->ringv = mem_alloc(rec->size * sizeof(int16_t), NULL);
+	if (!rec->ringv) {
+		mem_deref(rec);
+		return ENOMEM;
+	}
+
+	memset(&sfinfo, 0, sizeof(sfinfo));
 	sfinfo.samplerate = prm->srate;
 	sfinfo.channels   = prm->ch;
-	sfinfo.format     = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
-
-	sf = sf_open(filename, SFM_WRITE, &sfinfo);
-	if (!sf) {
-		warning("sndfile: could not open: %s\n", filename);
-		puts(sf_strerror(NULL));
-		return NULL;
+	sfinfo.format     = sf_format;
+
+	rec->sf = sf_open(rec->filename, SFM_WRITE, &sfinfo);
+	if (!rec->sf) {
+		warning("sndfile: could not open: %s (%s)\n",
+			rec->filename, sf_strerror(NULL));
+		mem_deref(rec);
+		return ENOMEM;
 	}
 
 	info("sndfile: dumping %s audio to %s\n",
-	     enc ? "encode" : "decode", filename);
+	     enc ? "encode" : "decode", rec->filename);
+
+	pthread_mutex_lock(&writer.mutex);
+	list_append(&writer.recl, &rec->le, rec);
+	pthread_mutex_unlock(&writer.mutex);
+
+	*recp = rec;
+
+	return 0;
+}
+
+
+/* hand the recording over to the writer, which closes it */
+static void rec_close(struct recording *rec)
+{
+	if (rec)
+		__atomic_store_n(&rec->done, true, __ATOMIC_RELEASE);
+}
+
+
+static void enc_destructor(void *arg)
+{
+	struct sndfile_enc *st = arg;
 
-	return sf;
+	rec_close(st->rec);
+
+	list_unlink(&st->af.le);
+}
+
+
+static void dec_destructor(void *arg)
+{
+	struct sndfile_dec *st = arg;
+
+	rec_close(st->rec);
+
+	list_unlink(&st->af.le);
 }
 
 
@@ -94,7 +262,7 @@ static int encode_update(struct aufilt_enc_st **stp, void **ctx,
 			 const struct aufilt *af, struct aufilt_prm *prm)
 {
 	struct sndfile_enc *st;
-	int err = 0;
+	int err;
 	(void)ctx;
 	(void)af;
 
@@ -102,9 +270,7 @@ static int encode_update(struct aufilt_enc_st **stp, void **ctx,
 	if (!st)
 		return EINVAL;
 
-	st->enc = openfile(prm, true);
-	if (!st->enc)
-		err = ENOMEM;
+	err = rec_alloc(&st->rec, prm, true);
 
 	if (err)
 		mem_deref(st);
@@ -119,7 +285,7 @@ static int decode_update(struct aufilt_dec_st **stp, void **ctx,
 			 const struct aufilt *af, struct aufilt_prm *prm)
 {
 	struct sndfile_dec *st;
-	int err = 0;
+	int err;
 	(void)ctx;
 	(void)af;
 
@@ -127,9 +293,7 @@ static int decode_update(struct aufilt_dec_st **stp, void **ctx,
 	if (!st)
 		return EINVAL;
 
-	st->dec = openfile(prm, false);
-	if (!st->dec)
-		err = ENOMEM;
+	err = rec_alloc(&st->rec, prm, false);
 
 	if (err)
 		mem_deref(st);
@@ -144,7 +308,7 @@ static int encode(struct aufilt_enc_st *st, int16_t *sampv, size_t *sampc)
 {
 	struct sndfile_enc *sf = (struct sndfile_enc *)st;
 
-	sf_write_short(sf->enc, sampv, *sampc);
+	rec_write(sf->rec, sampv, *sampc);
 
 	return 0;
 }
@@ -154,7 +318,7 @@ static int decode(struct aufilt_dec_st *st, int16_t *sampv, size_t *sampc)
 {
 	struct sndfile_dec *sf = (struct sndfile_dec *)st;
 
-	sf_write_short(sf->dec, sampv, *sampc);
+	rec_write(sf->rec, sampv, *sampc);
 
 	return 0;
 }
@@ -167,6 +331,38 @@ static struct aufilt sndfile = {
 
 static int module_init(void)
 {
+	struct pl fmt;
+	int err;
+
+	if (0 == conf_get(conf_cur(), "sndfile_format", &fmt)) {
+
+		if (0 == pl_strcasecmp(&fmt, "wav")) {
+			sf_format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+			sf_ext = "wav";
+		}
+		else if (0 == pl_strcasecmp(&fmt, "flac")) {
+			sf_format = SF_FORMAT_FLAC | SF_FORMAT_PCM_16;
+			sf_ext = "flac";
+		}
+#ifdef SF_FORMAT_OPUS
+		else if (0 == pl_strcasecmp(&fmt, "opus")) {
+			sf_format = SF_FORMAT_OGG | SF_FORMAT_OPUS;
+			sf_ext = "opus";
+		}
+#endif
+		else {
+			warning("sndfile: unsupported format '%r'\n", &fmt);
+			return EINVAL;
+		}
+	}
+
+	writer.run = true;
+	err = pthread_create(&writer.thread, NULL, writer_thread, NULL);
+	if (err) {
+		writer.run = false;
+		return err;
+	}
+
 	aufilt_register(&sndfile);
 	return 0;
 }
@@ -175,6 +371,25 @@ static int module_init(void)
 static int module_close(void)
 {
 	aufilt_unregister(&sndfile);
+
+	if (writer.run) {
+		pthread_mutex_lock(&writer.mutex);
+		writer.run = false;
+		pthread_mutex_unlock(&writer.mutex);
+
+		pthread_join(writer.thread, NULL);
+	}
+
+	/* what is left was not closed by the writer */
+	while (writer.recl.head) {
+
+		struct recording *rec = writer.recl.head->data;
+
+		rec_drain(rec);
+		list_unlink(&rec->le);
+		mem_deref(rec);
+	}
+
 	return 0;
 }
 
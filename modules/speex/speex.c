@@ -374,6 +374,28 @@ static int encode(struct auenc_state *st, uint8_t *buf,
 }
 
 
+/* Halve the configured complexity for each level */
+static int encode_cplx(struct auenc_state *st, unsigned level)
+{
+	int cplx = sconf.complexity;
+	int ret;
+
+	if (!st)
+		return EINVAL;
+
+	if (level)
+		cplx = min(cplx, max(cplx >> level, 1));
+
+	ret = speex_encoder_ctl(st->enc, SPEEX_SET_COMPLEXITY, &cplx);
+	if (ret) {
+		warning("speex: SPEEX_SET_COMPLEXITY: %d\n", ret);
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+
 static int decode(struct audec_state *st, int16_t *sampv,
 		  size_t *sampc, const uint8_t *buf, size_t len)
 {
@@ -463,19 +485,25 @@ static struct aucodec speexv[] = {
 
 	/* Stereo Speex */
 	{LE_INIT, 0, "speex", 32000, 32000, 2, speex_fmtp_wb,
-	 encode_update, encode, decode_update, decode, pkloss, 0, 0},
+	 encode_update, encode, decode_update, decode, pkloss, 0, 0,
+	 0, NULL, NULL, NULL, encode_cplx},
 	{LE_INIT, 0, "speex", 16000, 16000, 2, speex_fmtp_wb,
-	 encode_update, encode, decode_update, decode, pkloss, 0, 0},
+	 encode_update, encode, decode_update, decode, pkloss, 0, 0,
+	 0, NULL, NULL, NULL, encode_cplx},
 	{LE_INIT, 0, "speex",  8000,  8000, 2, speex_fmtp_nb,
-	 encode_update, encode, decode_update, decode, pkloss, 0, 0},
+	 encode_update, encode, decode_update, decode, pkloss, 0, 0,
+	 0, NULL, NULL, NULL, encode_cplx},
 
 	/* Standard Speex */
 	{LE_INIT, 0, "speex", 32000, 32000, 1, speex_fmtp_wb,
-	 encode_update, encode, decode_update, decode, pkloss, 0, 0},
+	 encode_update, encode, decode_update, decode, pkloss, 0, 0,
+	 0, NULL, NULL, NULL, encode_cplx},
 	{LE_INIT, 0, "speex", 16000, 16000, 1, speex_fmtp_wb,
-	 encode_update, encode, decode_update, decode, pkloss, 0, 0},
+	 encode_update, encode, decode_update, decode, pkloss, 0, 0,
+	 0, NULL, NULL, NULL, encode_cplx},
 	{LE_INIT, 0, "speex",  8000,  8000, 1, speex_fmtp_nb,
-	 encode_update, encode, decode_update, decode, pkloss, 0, 0},
+	 encode_update, encode, decode_update, decode, pkloss, 0, 0,
+	 0, NULL, NULL, NULL, encode_cplx},
 };
 
 
@@ -5,12 +5,23 @@
  */
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <math.h>
 #include <speex/speex.h>
 #include <speex/speex_echo.h>
 #include <re.h>
 #include <baresip.h>
 
 
+#if defined (__GNUC__)
+#define LOAD_ACQUIRE(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define LOAD_ACQUIRE(p)     (*(volatile uint32_t *)(p))
+#define STORE_RELEASE(p, v) (*(volatile uint32_t *)(p) = (v))
+#endif
+
+
 /**
  * @defgroup speex_aec speex_aec
  *
@@ -18,9 +29,53 @@
  */
 
 
+enum {
+	FARQ_SIZE   = 16,   /**< Far-end frames in flight, power of two */
+	HIST_SIZE   = 16,   /**< Far-end frames kept, the max. delay    */
+	FE_SIZE     = 64,   /**< Far-end levels kept, power of two      */
+	EST_WINDOW  = 50,   /**< Near-end frames per delay estimate     */
+	BUF_ALIGN   = 32,   /**< Alignment of the sample buffers        */
+};
+
+/** Min. correlation of the levels for a delay estimate */
+#define EST_MIN_CORR 0.5
+
+
+/*
+ * The decoder thread hands each far-end frame to the encoder thread
+ * through a single-producer/single-consumer queue, without a lock. The
+ * encoder thread keeps the last far-end frames and cancels the echo in
+ * each near-end frame with the far-end frame of the estimated delay.
+ *
+ * The delay is estimated from the frame levels: the far-end level is
+ * correlated with the near-end level at each delay, and the best match
+ * is used if it is good enough. This leaves the echo canceller its
+ * full tail for the echo path itself.
+ */
 struct speex_st {
-	int16_t *out;
 	SpeexEchoState *state;
+	size_t sampc;                 /**< Samples per frame              */
+	size_t stride;                /**< Samples between two frames     */
+	uint32_t ptime;               /**< Frame length in [ms]           */
+	void *mem;                    /**< Storage of the aligned buffers */
+	int16_t *farv;                /**< Queue of far-end frames        */
+	int16_t *histv;               /**< Last far-end frames            */
+	int16_t *out;                 /**< Output of the echo canceller   */
+
+	/* producer, decoder thread */
+	uint32_t wpos;                /**< Far-end frames written         */
+	uint32_t n_overrun;           /**< Far-end frames dropped         */
+
+	/* consumer, encoder thread */
+	uint32_t rpos;                /**< Far-end frames read            */
+	uint32_t hpos;                /**< Far-end frames kept            */
+	uint32_t lag;                 /**< Estimated delay in [frames]    */
+	float fev[FE_SIZE];           /**< Far-end levels, by frame       */
+	float nev[EST_WINDOW];        /**< Near-end levels                */
+	uint32_t nfv[EST_WINDOW];     /**< Newest far-end frame for each  */
+	unsigned estc;                /**< Near-end levels in the window  */
+	uint64_t n_frames;            /**< Near-end frames processed      */
+	uint64_t cpu_us;              /**< CPU time of the canceller      */
 };
 
 struct enc_st {
@@ -53,14 +108,43 @@ static void dec_destructor(void *arg)
 
 
 #ifdef SPEEX_SET_VBR_MAX_BITRATE
+static uint64_t cpu_time_us(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+
+	if (0 == clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+	return 0;
+}
+
+
 static void speex_aec_destructor(void *arg)
 {
 	struct speex_st *st = arg;
 
+	if (st->n_frames) {
+		info("speex_aec: %llu frames, %.1f us/frame cpu,"
+		     " delay %u ms, %u far-end frames dropped\n",
+		     st->n_frames, (double)st->cpu_us / st->n_frames,
+		     st->lag * st->ptime, st->n_overrun);
+	}
+
 	if (st->state)
 		speex_echo_state_destroy(st->state);
 
-	mem_deref(st->out);
+	mem_deref(st->mem);
+}
+
+
+static int16_t *buf_align(uint8_t **p, size_t sz)
+{
+	int16_t *buf = (void *)*p;
+
+	*p += (sz + BUF_ALIGN - 1) & ~(size_t)(BUF_ALIGN - 1);
+
+	return buf;
 }
 
 
@@ -68,7 +152,9 @@ static int aec_alloc(struct speex_st **stp, void **ctx, struct aufilt_prm *prm)
 {
 	struct speex_st *st;
 	uint32_t sampc;
-	int err, tmp, fl;
+	size_t sz;
+	uint8_t *p;
+	int err = 0, tmp, fl;
 
 	if (!stp || !ctx || !prm)
 		return EINVAL;
@@ -84,12 +170,28 @@ static int aec_alloc(struct speex_st **stp, void **ctx, struct aufilt_prm *prm)
 
 	sampc = prm->srate * prm->ch * prm->ptime / 1000;
 
-	st->out = mem_alloc(2 * sampc, NULL);
-	if (!st->out) {
+	st->sampc = sampc;
+	st->ptime = prm->ptime;
+
+	/* all frames in one block, each on an aligned address */
+	sz = (2 * sampc + BUF_ALIGN - 1) & ~(size_t)(BUF_ALIGN - 1);
+
+	st->mem = mem_alloc(sz * (FARQ_SIZE + HIST_SIZE + 1) + BUF_ALIGN,
+			    NULL);
+	if (!st->mem) {
 		err = ENOMEM;
 		goto out;
 	}
 
+	p = (uint8_t *)(((uintptr_t)st->mem + BUF_ALIGN - 1)
+		       & ~(uintptr_t)(BUF_ALIGN - 1));
+
+	st->farv  = buf_align(&p, sz * FARQ_SIZE);
+	st->histv = buf_align(&p, sz * HIST_SIZE);
+	st->out   = buf_align(&p, sz);
+
+	st->stride = sz / sizeof(int16_t);
+
 	/* Echo canceller with 200 ms tail length */
 	fl = 10 * sampc;
 	st->state = speex_echo_state_init(sampc, fl);
@@ -103,6 +205,7 @@ static int aec_alloc(struct speex_st **stp, void **ctx, struct aufilt_prm *prm)
 	if (err < 0) {
 		warning("speex_aec: speex_echo_ctl: err=%d\n", err);
 	}
+	err = 0;
 
 	info("speex_aec: Speex AEC loaded: srate = %uHz\n", prm->srate);
 
@@ -170,16 +273,123 @@ static int decode_update(struct aufilt_dec_st **stp, void **ctx,
 }
 
 
+static float frame_level(const int16_t *sampv, size_t sampc)
+{
+	uint64_t sum = 0;
+	size_t i;
+
+	for (i=0; i<sampc; i++)
+		sum += abs(sampv[i]);
+
+	return sampc ? (float)sum / sampc : 0;
+}
+
+
+/* Correlation of the near-end levels with the far-end levels at a delay */
+static double level_corr(const struct speex_st *sp, uint32_t lag)
+{
+	double sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0, n = 0, cov, var;
+	unsigned i;
+
+	for (i=0; i<sp->estc; i++) {
+
+		const uint32_t fidx = sp->nfv[i];
+		double x, y;
+
+		/* far-end level is no longer kept */
+		if (lag > fidx || sp->hpos - 1 - fidx + lag >= FE_SIZE)
+			continue;
+
+		x = sp->fev[(fidx - lag) % FE_SIZE];
+		y = sp->nev[i];
+
+		sx  += x;
+		sy  += y;
+		sxx += x * x;
+		syy += y * y;
+		sxy += x * y;
+		++n;
+	}
+
+	if (n < EST_WINDOW / 2)
+		return 0;
+
+	cov = sxy - sx * sy / n;
+	var = (sxx - sx * sx / n) * (syy - sy * sy / n);
+
+	return var > 0 ? cov / sqrt(var) : 0;
+}
+
+
+static void delay_estimate(struct speex_st *sp)
+{
+	double best = EST_MIN_CORR;
+	uint32_t lag = sp->lag;
+	uint32_t l;
+
+	for (l=0; l<HIST_SIZE; l++) {
+
+		const double c = level_corr(sp, l);
+
+		if (c > best) {
+			best = c;
+			lag  = l;
+		}
+	}
+
+	if (lag != sp->lag) {
+		debug("speex_aec: delay %u -> %u ms (correlation %.2f)\n",
+		      sp->lag * sp->ptime, lag * sp->ptime, best);
+		sp->lag = lag;
+	}
+
+	sp->estc = 0;
+}
+
+
 static int encode(struct aufilt_enc_st *st, int16_t *sampv, size_t *sampc)
 {
 	struct enc_st *est = (struct enc_st *)st;
 	struct speex_st *sp = est->st;
+	const uint32_t w = LOAD_ACQUIRE(&sp->wpos);
+	const int16_t *ref;
+	uint64_t t0;
+	uint32_t lag;
+
+	/* move the queued far-end frames to the history */
+	while (sp->rpos != w) {
+
+		const int16_t *far = &sp->farv[(sp->rpos % FARQ_SIZE)
+					       * sp->stride];
 
-	if (*sampc) {
-		speex_echo_capture(sp->state, sampv, sp->out);
-		memcpy(sampv, sp->out, *sampc * 2);
+		memcpy(&sp->histv[(sp->hpos % HIST_SIZE) * sp->stride], far,
+		       sp->sampc * sizeof(int16_t));
+		sp->fev[sp->hpos % FE_SIZE] = frame_level(far, sp->sampc);
+
+		++sp->hpos;
+		STORE_RELEASE(&sp->rpos, sp->rpos + 1);
 	}
 
+	if (!sp->hpos || *sampc != sp->sampc)
+		return 0;
+
+	lag = min(sp->lag, sp->hpos - 1);
+	ref = &sp->histv[((sp->hpos - 1 - lag) % HIST_SIZE) * sp->stride];
+
+	t0 = cpu_time_us();
+	speex_echo_cancellation(sp->state, sampv, ref, sp->out);
+	sp->cpu_us += cpu_time_us() - t0;
+	++sp->n_frames;
+
+	/* the level before cancellation, which holds the echo */
+	sp->nev[sp->estc] = frame_level(sampv, *sampc);
+	sp->nfv[sp->estc] = sp->hpos - 1;
+
+	memcpy(sampv, sp->out, *sampc * sizeof(int16_t));
+
+	if (++sp->estc >= EST_WINDOW)
+		delay_estimate(sp);
+
 	return 0;
 }
 
@@ -188,9 +398,21 @@ static int decode(struct aufilt_dec_st *st, int16_t *sampv, size_t *sampc)
 {
 	struct dec_st *dst = (struct dec_st *)st;
 	struct speex_st *sp = dst->st;
+	const uint32_t r = LOAD_ACQUIRE(&sp->rpos);
+	const uint32_t w = sp->wpos;
+
+	if (*sampc != sp->sampc)
+		return 0;
+
+	if (w - r >= FARQ_SIZE) {
+		++sp->n_overrun;
+		return 0;
+	}
+
+	memcpy(&sp->farv[(w % FARQ_SIZE) * sp->stride], sampv,
+	       *sampc * sizeof(int16_t));
 
-	if (*sampc)
-		speex_echo_playback(sp->state, sampv);
+	STORE_RELEASE(&sp->wpos, w + 1);
 
 	return 0;
 }
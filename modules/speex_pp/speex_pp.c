@@ -5,6 +5,9 @@
  */
 #include <string.h>
 #include <stdlib.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include <speex/speex.h>
 #include <speex/speex_preprocess.h>
 #include <re.h>
@@ -18,32 +21,188 @@
  */
 
 
+/*
+ * The preprocessor can run on a worker thread, for systems where the
+ * audio thread is busy with video. All calls share the worker, which
+ * processes every frame queued since it last woke up in one batch. The
+ * filter then returns the frame processed on the previous call, so it
+ * adds one frame of delay.
+ *
+ * The VAD result of each frame is reported to the core, which does not
+ * encode silent frames if the peer accepts Comfort Noise.
+ */
+
+
+enum denoise {
+	DENOISE_NO = 0,
+	DENOISE_YES,
+	DENOISE_WIDEBAND,           /* only above 8000 Hz */
+};
+
 struct preproc {
 	struct aufilt_enc_st af;    /* base class */
 	SpeexPreprocessState *state;
+	int *vad;                   /* VAD output, optional */
+	size_t sampc;
+	int speech;                 /* VAD result of the output frame */
+#ifdef HAVE_PTHREAD
+	struct le le;               /* in the worker's job list */
+	int16_t *inv;               /* frame queued to the worker */
+	int16_t *outv;              /* frame processed by the worker */
+	bool pending;               /* inv is queued or processed */
+	bool ready;                 /* outv holds a processed frame */
+#endif
 };
 
 
 /** Speex configuration */
 static struct {
-	int denoise_enabled;
+	enum denoise denoise;
 	int agc_enabled;
 	int vad_enabled;
 	int dereverb_enabled;
 	spx_int32_t agc_level;
+	bool thread;
 } pp_conf = {
+	DENOISE_YES,
 	1,
 	1,
 	1,
-	1,
-	8000
+	8000,
+	false
 };
 
 
+#ifdef HAVE_PTHREAD
+static struct {
+	pthread_mutex_t mutex;      /* protects jobl, run and the jobs */
+	pthread_cond_t cond_job;
+	pthread_cond_t cond_done;
+	pthread_t thread;
+	struct list jobl;           /* queued frames */
+	bool run;
+} worker = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+};
+#endif
+
+
+static int preprocess(SpeexPreprocessState *state, int16_t *sampv)
+{
+	/* NOTE: Using this macro to check libspeex version */
+#ifdef SPEEX_PREPROCESS_SET_NOISE_SUPPRESS
+	/* New API */
+	return speex_preprocess_run(state, sampv);
+#else
+	/* Old API - not tested! */
+	return speex_preprocess(state, sampv, NULL);
+#endif
+}
+
+
+#ifdef HAVE_PTHREAD
+static void *worker_thread(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&worker.mutex);
+
+	while (worker.run) {
+
+		struct preproc *st;
+		int speech;
+
+		if (list_isempty(&worker.jobl)) {
+			pthread_cond_wait(&worker.cond_job, &worker.mutex);
+			continue;
+		}
+
+		st = list_ledata(worker.jobl.head);
+		list_unlink(&st->le);
+
+		/* the job is not touched by the filter while pending */
+		pthread_mutex_unlock(&worker.mutex);
+		speech = preprocess(st->state, st->inv);
+		pthread_mutex_lock(&worker.mutex);
+
+		{
+			int16_t *tmp = st->outv;
+
+			st->outv = st->inv;
+			st->inv  = tmp;
+		}
+
+		st->speech  = speech;
+		st->ready   = true;
+		st->pending = false;
+
+		pthread_cond_broadcast(&worker.cond_done);
+	}
+
+	pthread_mutex_unlock(&worker.mutex);
+
+	return NULL;
+}
+
+
+static int worker_start(void)
+{
+	int err;
+
+	worker.run = true;
+
+	err = pthread_create(&worker.thread, NULL, worker_thread, NULL);
+	if (err) {
+		worker.run = false;
+		return err;
+	}
+
+	info("speex_pp: preprocessing on a worker thread\n");
+
+	return 0;
+}
+
+
+static void worker_stop(void)
+{
+	if (!worker.run)
+		return;
+
+	pthread_mutex_lock(&worker.mutex);
+	worker.run = false;
+	pthread_cond_signal(&worker.cond_job);
+	pthread_mutex_unlock(&worker.mutex);
+
+	pthread_join(worker.thread, NULL);
+}
+
+
+/* Wait until the worker is done with the queued frame */
+static void worker_wait(struct preproc *st)
+{
+	while (st->pending)
+		pthread_cond_wait(&worker.cond_done, &worker.mutex);
+}
+#endif
+
+
 static void speexpp_destructor(void *arg)
 {
 	struct preproc *st = arg;
 
+#ifdef HAVE_PTHREAD
+	if (st->inv) {
+		pthread_mutex_lock(&worker.mutex);
+		worker_wait(st);
+		pthread_mutex_unlock(&worker.mutex);
+	}
+
+	mem_deref(st->inv);
+	mem_deref(st->outv);
+#endif
+
 	if (st->state)
 		speex_preprocess_state_destroy(st->state);
 
@@ -51,11 +210,40 @@ static void speexpp_destructor(void *arg)
 }
 
 
+static enum denoise denoise_decode(const struct pl *pl)
+{
+	if (0 == pl_strcasecmp(pl, "wideband"))
+		return DENOISE_WIDEBAND;
+
+	return pl_strcasecmp(pl, "no") ? DENOISE_YES : DENOISE_NO;
+}
+
+
+/* The account can override the denoise policy of the config */
+static int denoise_enabled(const struct aufilt_prm *prm)
+{
+	const struct sip_addr *laddr = account_laddr(prm->acc);
+	enum denoise denoise = pp_conf.denoise;
+	struct pl pl;
+
+	if (laddr && 0 == msg_param_decode(&laddr->params, "speex_denoise",
+					   &pl))
+		denoise = denoise_decode(&pl);
+
+	switch (denoise) {
+
+	case DENOISE_YES:      return 1;
+	case DENOISE_WIDEBAND: return prm->srate > 8000;
+	default:               return 0;
+	}
+}
+
+
 static int encode_update(struct aufilt_enc_st **stp, void **ctx,
 			 const struct aufilt *af, struct aufilt_prm *prm)
 {
 	struct preproc *st;
-	unsigned sampc;
+	int denoise;
 	(void)ctx;
 
 	if (!stp || !af || !prm || prm->ch != 1)
@@ -65,14 +253,26 @@ static int encode_update(struct aufilt_enc_st **stp, void **ctx,
 	if (!st)
 		return ENOMEM;
 
-	sampc = prm->srate * prm->ch * prm->ptime / 1000;
+	st->sampc  = prm->srate * prm->ch * prm->ptime / 1000;
+	st->speech = 1;
 
-	st->state = speex_preprocess_state_init(sampc, prm->srate);
+	st->state = speex_preprocess_state_init(st->sampc, prm->srate);
 	if (!st->state)
 		goto error;
 
+#ifdef HAVE_PTHREAD
+	if (worker.run) {
+		st->inv  = mem_zalloc(st->sampc * sizeof(int16_t), NULL);
+		st->outv = mem_zalloc(st->sampc * sizeof(int16_t), NULL);
+		if (!st->inv || !st->outv)
+			goto error;
+	}
+#endif
+
+	denoise = denoise_enabled(prm);
+
 	speex_preprocess_ctl(st->state, SPEEX_PREPROCESS_SET_DENOISE,
-			     &pp_conf.denoise_enabled);
+			     &denoise);
 	speex_preprocess_ctl(st->state, SPEEX_PREPROCESS_SET_AGC,
 			     &pp_conf.agc_enabled);
 
@@ -89,8 +289,11 @@ static int encode_update(struct aufilt_enc_st **stp, void **ctx,
 	speex_preprocess_ctl(st->state, SPEEX_PREPROCESS_SET_DEREVERB,
 			     &pp_conf.dereverb_enabled);
 
-	info("speex_pp: Speex preprocessor loaded: srate = %uHz\n",
-	     prm->srate);
+	if (pp_conf.vad_enabled)
+		st->vad = prm->vad;
+
+	info("speex_pp: Speex preprocessor loaded: srate = %uHz%s\n",
+	     prm->srate, denoise ? "" : " (no denoise)");
 
 	*stp = (struct aufilt_enc_st *)st;
 	return 0;
@@ -101,25 +304,53 @@ static int encode_update(struct aufilt_enc_st **stp, void **ctx,
 }
 
 
+#ifdef HAVE_PTHREAD
+/* Queue this frame, and return the frame processed on the last call */
+static int encode_queue(struct preproc *pp, int16_t *sampv)
+{
+	int speech;
+
+	pthread_mutex_lock(&worker.mutex);
+
+	worker_wait(pp);
+
+	memcpy(pp->inv, sampv, pp->sampc * sizeof(int16_t));
+
+	if (pp->ready)
+		memcpy(sampv, pp->outv, pp->sampc * sizeof(int16_t));
+	else
+		memset(sampv, 0, pp->sampc * sizeof(int16_t));
+
+	speech = pp->speech;
+
+	pp->pending = true;
+	list_append(&worker.jobl, &pp->le, pp);
+	pthread_cond_signal(&worker.cond_job);
+
+	pthread_mutex_unlock(&worker.mutex);
+
+	return speech;
+}
+#endif
+
+
 static int encode(struct aufilt_enc_st *st, int16_t *sampv, size_t *sampc)
 {
 	struct preproc *pp = (struct preproc *)st;
-	int is_speech = 1;
+	int speech;
 
-	if (!*sampc)
+	if (*sampc != pp->sampc)
 		return 0;
 
-	/* NOTE: Using this macro to check libspeex version */
-#ifdef SPEEX_PREPROCESS_SET_NOISE_SUPPRESS
-	/* New API */
-	is_speech = speex_preprocess_run(pp->state, sampv);
-#else
-	/* Old API - not tested! */
-	is_speech = speex_preprocess(pp->state, sampv, NULL);
+#ifdef HAVE_PTHREAD
+	if (pp->inv)
+		speech = encode_queue(pp, sampv);
+	else
 #endif
+		speech = preprocess(pp->state, sampv);
 
-	/* XXX: Handle is_speech and VAD */
-	(void)is_speech;
+	if (pp->vad)
+		*pp->vad = speech;
 
 	return 0;
 }
@@ -127,10 +358,16 @@ static int encode(struct aufilt_enc_st *st, int16_t *sampv, size_t *sampc)
 
 static void config_parse(struct conf *conf)
 {
+	struct pl pl;
 	uint32_t v;
 
 	if (0 == conf_get_u32(conf, "speex_agc_level", &v))
 		pp_conf.agc_level = v;
+
+	if (0 == conf_get(conf, "speex_denoise", &pl))
+		pp_conf.denoise = denoise_decode(&pl);
+
+	(void)conf_get_bool(conf, "speex_pp_thread", &pp_conf.thread);
 }
 
 
@@ -141,6 +378,16 @@ static struct aufilt preproc = {
 static int module_init(void)
 {
 	config_parse(conf_cur());
+
+#ifdef HAVE_PTHREAD
+	if (pp_conf.thread) {
+		int err = worker_start();
+		if (err) {
+			warning("speex_pp: worker thread: %m\n", err);
+		}
+	}
+#endif
+
 	aufilt_register(&preproc);
 	return 0;
 }
@@ -149,6 +396,11 @@ static int module_init(void)
 static int module_close(void)
 {
 	aufilt_unregister(&preproc);
+
+#ifdef HAVE_PTHREAD
+	worker_stop();
+#endif
+
 	return 0;
 }
 
@@ -25,37 +25,67 @@
  */
 
 
-#define SRTP_MASTER_KEY_LEN  30
+/* master key and salt of the longest suite */
+#define SRTP_MASTER_KEY_MAX  46
+
+enum {
+	BURST_MAX = 64,      /* RTP packets protected in one batch        */
+	SRTP_TAG_MAX = 16,   /* longest authentication tag of the suites  */
+};
+
+
+/** Crypto suite, with the length of the master key and salt */
+struct suite {
+	const char *name;
+	enum srtp_suite suite;
+	size_t keylen;
+};
 
 
 struct menc_st {
 	/* one SRTP session per media line */
-	uint8_t key_tx[32];
-	uint8_t key_rx[32];
+	uint8_t key_tx[SRTP_MASTER_KEY_MAX];
+	uint8_t key_rx[SRTP_MASTER_KEY_MAX];
 	struct srtp *srtp_tx, *srtp_rx;
 	bool use_srtp;
-	char *crypto_suite;
+	const struct suite *crypto_suite;
 
 	void *rtpsock;
 	void *rtcpsock;
 	struct udp_helper *uh_rtp;   /**< UDP helper for RTP encryption    */
 	struct udp_helper *uh_rtcp;  /**< UDP helper for RTCP encryption   */
 	struct sdp_media *sdpm;
-};
 
+	/* RTP packets held back during a burst, see burst_handler() */
+	struct {
+		struct lock *lock;
+		struct mbuf *mbv[BURST_MAX];
+		struct sa dstv[BURST_MAX];
+		size_t n;
+		bool active;
+	} burst;
+};
 
-static const char aes_cm_128_hmac_sha1_32[] = "AES_CM_128_HMAC_SHA1_32";
-static const char aes_cm_128_hmac_sha1_80[] = "AES_CM_128_HMAC_SHA1_80";
 
-static const char *preferred_suite = aes_cm_128_hmac_sha1_80;
+/*
+ * Offered in this order. The AEAD suites (RFC 7714) authenticate with
+ * GCM instead of an HMAC-SHA1 per packet, which the crypto backend of
+ * libre runs with AES-NI or the ARMv8 crypto extensions.
+ */
+static const struct suite suitev[] = {
+	{"AEAD_AES_128_GCM",        SRTP_AES_128_GCM,             16 + 12},
+	{"AEAD_AES_256_GCM",        SRTP_AES_256_GCM,             32 + 12},
+	{"AES_CM_128_HMAC_SHA1_80", SRTP_AES_CM_128_HMAC_SHA1_80, 16 + 14},
+	{"AES_CM_128_HMAC_SHA1_32", SRTP_AES_CM_128_HMAC_SHA1_32, 16 + 14},
+};
 
 
 static void destructor(void *arg)
 {
 	struct menc_st *st = arg;
+	size_t i;
 
 	mem_deref(st->sdpm);
-	mem_deref(st->crypto_suite);
 
 	/* note: must be done before freeing socket */
 	mem_deref(st->uh_rtp);
@@ -65,15 +95,24 @@ static void destructor(void *arg)
 
 	mem_deref(st->srtp_tx);
 	mem_deref(st->srtp_rx);
+
+	for (i=0; i<BURST_MAX; i++)
+		mem_deref(st->burst.mbv[i]);
+	mem_deref(st->burst.lock);
 }
 
 
-static bool cryptosuite_issupported(const struct pl *suite)
+static const struct suite *suite_find(const struct pl *name)
 {
-	if (0 == pl_strcasecmp(suite, aes_cm_128_hmac_sha1_32)) return true;
-	if (0 == pl_strcasecmp(suite, aes_cm_128_hmac_sha1_80)) return true;
+	size_t i;
 
-	return false;
+	for (i=0; i<ARRAY_SIZE(suitev); i++) {
+
+		if (0 == pl_strcasecmp(name, suitev[i].name))
+			return &suitev[i];
+	}
+
+	return NULL;
 }
 
 
@@ -115,27 +154,14 @@ static bool is_rtcp_packet(const struct mbuf *mb)
 }
 
 
-static enum srtp_suite resolve_suite(const char *suite)
-{
-	if (0 == str_casecmp(suite, aes_cm_128_hmac_sha1_32))
-		return SRTP_AES_CM_128_HMAC_SHA1_32;
-	if (0 == str_casecmp(suite, aes_cm_128_hmac_sha1_80))
-		return SRTP_AES_CM_128_HMAC_SHA1_80;
-
-	return -1;
-}
-
-
-static int start_srtp(struct menc_st *st, const char *suite_name)
+static int start_srtp(struct menc_st *st, const struct suite *suite)
 {
-	enum srtp_suite suite;
 	int err;
 
-	suite = resolve_suite(suite_name);
-
 	/* allocate and initialize the SRTP session */
 	if (!st->srtp_tx) {
-		err = srtp_alloc(&st->srtp_tx, suite, st->key_tx, 30, 0);
+		err = srtp_alloc(&st->srtp_tx, suite->suite, st->key_tx,
+				 suite->keylen, 0);
 		if (err) {
 			warning("srtp: srtp_alloc TX failed (%m)\n", err);
 			return err;
@@ -143,7 +169,8 @@ static int start_srtp(struct menc_st *st, const char *suite_name)
 	}
 
 	if (!st->srtp_rx) {
-		err = srtp_alloc(&st->srtp_rx, suite, st->key_rx, 30, 0);
+		err = srtp_alloc(&st->srtp_rx, suite->suite, st->key_rx,
+				 suite->keylen, 0);
 		if (err) {
 			warning("srtp: srtp_alloc RX failed (%m)\n", err);
 			return err;
@@ -157,16 +184,115 @@ static int start_srtp(struct menc_st *st, const char *suite_name)
 }
 
 
+/*
+ * Protect a vector of RTP packets with one SRTP context. A packet that
+ * fails is emptied, the others are still protected.
+ */
+static int srtp_encrypt_batch(struct srtp *srtp, struct mbuf **mbv,
+			      size_t n)
+{
+	size_t i;
+	int err = 0;
+
+	for (i=0; i<n; i++) {
+
+		int lerr = srtp_encrypt(srtp, mbv[i]);
+		if (lerr) {
+			mbv[i]->pos = mbv[i]->end;
+			err = lerr;
+		}
+	}
+
+	return err;
+}
+
+
+/* must be called with the burst lock held */
+static int burst_send(struct menc_st *st)
+{
+	size_t i;
+	int err;
+
+	if (!st->burst.n)
+		return 0;
+
+	err = srtp_encrypt_batch(st->srtp_tx, st->burst.mbv, st->burst.n);
+	if (err) {
+		warning("srtp: failed to encrypt RTP-packets in burst (%m)\n",
+			err);
+	}
+
+	/* on through the UDP helpers below SRTP */
+	for (i=0; i<st->burst.n; i++) {
+
+		struct mbuf *mb = st->burst.mbv[i];
+
+		if (mbuf_get_left(mb))
+			err |= udp_send_helper(st->rtpsock, &st->burst.dstv[i],
+					       mb, st->uh_rtp);
+	}
+
+	st->burst.n = 0;
+
+	return err;
+}
+
+
+/* copy an RTP packet into the burst, with room for the tag */
+static bool burst_queue(struct menc_st *st, const struct sa *dst,
+			const struct mbuf *mb)
+{
+	size_t len = mbuf_get_left(mb);
+	struct mbuf *pkt;
+	bool queued = false;
+
+	lock_write_get(st->burst.lock);
+
+	if (!st->burst.active)
+		goto out;
+
+	if (st->burst.n >= BURST_MAX)
+		(void)burst_send(st);
+
+	pkt = st->burst.mbv[st->burst.n];
+	if (!pkt) {
+		pkt = mbuf_alloc(len + SRTP_TAG_MAX);
+		if (!pkt)
+			goto out;
+
+		st->burst.mbv[st->burst.n] = pkt;
+	}
+
+	mbuf_rewind(pkt);
+
+	if (mbuf_write_mem(pkt, mbuf_buf(mb), len))
+		goto out;
+
+	pkt->pos = 0;
+	st->burst.dstv[st->burst.n++] = *dst;
+	queued = true;
+
+ out:
+	lock_rel(st->burst.lock);
+
+	return queued;
+}
+
+
 static bool send_handler(int *err, struct sa *dst, struct mbuf *mb, void *arg)
 {
 	struct menc_st *st = arg;
 	size_t len = mbuf_get_left(mb);
 	int lerr = 0;
-	(void)dst;
 
 	if (!st->use_srtp || !is_rtp_or_rtcp(mb))
 		return false;
 
+	if (!is_rtcp_packet(mb) && burst_queue(st, dst, mb)) {
+		*err = 0;
+		return true;  /* protected and sent when the burst ends */
+	}
+
 	if (is_rtcp_packet(mb)) {
 		lerr = srtcp_encrypt(st->srtp_tx, mb);
 	}
@@ -217,19 +343,32 @@ static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 
 
 /* a=crypto:<tag> <crypto-suite> <key-params> [<session-params>] */
-static int sdp_enc(struct menc_st *st, struct sdp_media *m,
-		   uint32_t tag, const char *suite)
+static int sdp_enc(struct menc_st *st, struct sdp_media *m, bool replace,
+		   uint32_t tag, const struct suite *suite)
 {
 	char key[128] = "";
 	size_t olen;
 	int err;
 
 	olen = sizeof(key);
-	err = base64_encode(st->key_tx, SRTP_MASTER_KEY_LEN, key, &olen);
+	err = base64_encode(st->key_tx, suite->keylen, key, &olen);
 	if (err)
 		return err;
 
-	return sdes_encode_crypto(m, tag, suite, key, olen);
+	return sdes_encode_crypto(m, replace, tag, suite->name, key, olen);
+}
+
+
+/* All suites are offered, each with a part of the same master key */
+static int sdp_offer(struct menc_st *st, struct sdp_media *m)
+{
+	size_t i;
+	int err = 0;
+
+	for (i=0; i<ARRAY_SIZE(suitev); i++)
+		err |= sdp_enc(st, m, i == 0, (uint32_t)i + 1, &suitev[i]);
+
+	return err;
 }
 
 
@@ -245,8 +384,10 @@ static int start_crypto(struct menc_st *st, const struct pl *key_info)
 	if (err)
 		return err;
 
-	if (SRTP_MASTER_KEY_LEN != olen) {
-		warning("srtp: srtp keylen is %u (should be 30)\n", olen);
+	if (st->crypto_suite->keylen != olen) {
+		warning("srtp: srtp keylen is %zu (should be %zu)\n",
+			olen, st->crypto_suite->keylen);
+		return EBADMSG;
 	}
 
 	err = start_srtp(st, st->crypto_suite);
@@ -254,7 +395,7 @@ static int start_crypto(struct menc_st *st, const struct pl *key_info)
 		return err;
 
 	info("srtp: %s: SRTP is Enabled (cryptosuite=%s)\n",
-	     sdp_media_name(st->sdpm), st->crypto_suite);
+	     sdp_media_name(st->sdpm), st->crypto_suite->name);
 
 	return 0;
 }
@@ -263,6 +404,7 @@ static int start_crypto(struct menc_st *st, const struct pl *key_info)
 static bool sdp_attr_handler(const char *name, const char *value, void *arg)
 {
 	struct menc_st *st = arg;
+	const struct suite *suite;
 	struct crypto c;
 	(void)name;
 
@@ -272,16 +414,16 @@ static bool sdp_attr_handler(const char *name, const char *value, void *arg)
 	if (0 != pl_strcmp(&c.key_method, "inline"))
 		return false;
 
-	if (!cryptosuite_issupported(&c.suite))
+	suite = suite_find(&c.suite);
+	if (!suite)
 		return false;
 
-	st->crypto_suite = mem_deref(st->crypto_suite);
-	pl_strdup(&st->crypto_suite, &c.suite);
+	st->crypto_suite = suite;
 
 	if (start_crypto(st, &c.key_info))
 		return false;
 
-	sdp_enc(st, st->sdpm, c.tag, st->crypto_suite);
+	sdp_enc(st, st->sdpm, true, c.tag, st->crypto_suite);
 
 	return true;
 }
@@ -337,12 +479,11 @@ static int alloc(struct menc_media **stp, struct menc_sess *sess,
 		if (err)
 			goto out;
 
-		/* set our preferred crypto-suite */
-		err |= str_dup(&st->crypto_suite, preferred_suite);
+		err = lock_alloc(&st->burst.lock);
 		if (err)
 			goto out;
 
-		rand_bytes(st->key_tx, SRTP_MASTER_KEY_LEN);
+		rand_bytes(st->key_tx, sizeof(st->key_tx));
 	}
 
 	/* SDP handling */
@@ -358,7 +499,7 @@ static int alloc(struct menc_media **stp, struct menc_sess *sess,
 	}
 
 	if (!rattr)
-		err = sdp_enc(st, sdpm, 0, st->crypto_suite);
+		err = sdp_offer(st, sdpm);
 
  out:
 	if (err)
@@ -370,16 +511,42 @@ static int alloc(struct menc_media **stp, struct menc_sess *sess,
 }
 
 
+/*
+ * The RTP packets of a burst are copied aside and protected together
+ * when the burst ends, so the cipher runs over them back to back
+ * instead of once per pass through the UDP helpers.
+ */
+static int burst_handler(struct menc_media *m, bool start)
+{
+	struct menc_st *st = (struct menc_st *)m;
+	int err = 0;
+
+	if (!st || !st->burst.lock)
+		return EINVAL;
+
+	lock_write_get(st->burst.lock);
+
+	st->burst.active = start;
+
+	if (!start)
+		err = burst_send(st);
+
+	lock_rel(st->burst.lock);
+
+	return err;
+}
+
+
 static struct menc menc_srtp_opt = {
-	LE_INIT, "srtp", "RTP/AVP", NULL, alloc
+	LE_INIT, "srtp", "RTP/AVP", NULL, alloc, burst_handler
 };
 
 static struct menc menc_srtp_mand = {
-	LE_INIT, "srtp-mand", "RTP/SAVP", NULL, alloc
+	LE_INIT, "srtp-mand", "RTP/SAVP", NULL, alloc, burst_handler
 };
 
 static struct menc menc_srtp_mandf = {
-	LE_INIT, "srtp-mandf", "RTP/SAVPF", NULL, alloc
+	LE_INIT, "srtp-mandf", "RTP/SAVPF", NULL, alloc, burst_handler
 };
 
 
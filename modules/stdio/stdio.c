@@ -18,18 +18,31 @@
  *
  * This module sets up the terminal in raw mode, and reads characters from the
  * input to the UI subsystem. The module is indented for Unix-based systems.
+ *
+ * In batch mode the input is read a line at a time instead, for scripts
+ * that pipe commands into baresip. Each line is a command key and its
+ * parameter, and the answers are written to stdout, each one followed
+ * by a line "OK" or "ERR <reason>":
+ *
+ \verbatim
+  stdio_batch     no                   # One command per line
+ \endverbatim
  */
 
 
 /** Local constants */
 enum {
-	RELEASE_VAL = 250  /**< Key release value in [ms] */
+	RELEASE_VAL = 250,  /**< Key release value in [ms]        */
+	READ_SIZE   = 4096, /**< Bytes read at once in batch mode */
+	LINE_MAX    = 4096, /**< Max length of an incomplete line */
 };
 
 struct ui_st {
 	struct tmr tmr;
 	struct termios term;
 	bool term_set;
+	bool batch;
+	struct mbuf *rxb;   /**< Incomplete line, batch mode      */
 };
 
 
@@ -47,6 +60,7 @@ static void ui_destructor(void *arg)
 		tcsetattr(STDIN_FILENO, TCSANOW, &st->term);
 
 	tmr_cancel(&st->tmr);
+	mem_deref(st->rxb);
 }
 
 
@@ -76,12 +90,63 @@ static void timeout(void *arg)
 }
 
 
+static int stdout_handler(const char *p, size_t size, void *arg)
+{
+	(void)arg;
+
+	return 1 == fwrite(p, size, 1, stdout) ? 0 : ENOMEM;
+}
+
+
+static void batch_read(struct ui_st *st)
+{
+	static struct re_printf pf_stdout = {stdout_handler, NULL};
+	struct pl pl;
+	bool eof = false;
+	ssize_t n;
+	int err;
+
+	err = mbuf_resize(st->rxb, st->rxb->end + READ_SIZE);
+	if (err)
+		return;
+
+	n = read(STDIN_FILENO, st->rxb->buf + st->rxb->end, READ_SIZE);
+	if (n < 0)
+		return;
+	else if (n == 0)
+		eof = true;
+
+	st->rxb->end += n;
+
+	pl_set_mem(&pl, (char *)st->rxb->buf, st->rxb->end);
+	(void)cmd_exec_lines(&pf_stdout, &pl, eof);
+
+	if (pl.l > LINE_MAX) {
+		(void)re_fprintf(stdout, "ERR line too long\n");
+		pl.l = 0;
+	}
+
+	memmove(st->rxb->buf, pl.p, pl.l);
+	st->rxb->end = pl.l;
+
+	(void)fflush(stdout);
+
+	if (eof)
+		fd_close(STDIN_FILENO);
+}
+
+
 static void ui_fd_handler(int flags, void *arg)
 {
 	struct ui_st *st = arg;
 	char key;
 	(void)flags;
 
+	if (st->batch) {
+		batch_read(st);
+		return;
+	}
+
 	if (1 != read(STDIN_FILENO, &key, 1)) {
 		return;
 	}
@@ -130,10 +195,23 @@ static int ui_alloc(struct ui_st **stp)
 
 	tmr_init(&st->tmr);
 
+	(void)conf_get_bool(conf_cur(), "stdio_batch", &st->batch);
+
+	if (st->batch) {
+		st->rxb = mbuf_alloc(READ_SIZE);
+		if (!st->rxb) {
+			err = ENOMEM;
+			goto out;
+		}
+	}
+
 	err = fd_listen(STDIN_FILENO, FD_READ, ui_fd_handler, st);
 	if (err)
 		goto out;
 
+	if (st->batch)
+		goto out;
+
 	err = term_setup(st);
 	if (err) {
 		info("stdio: could not setup terminal: %m\n", err);
@@ -109,6 +109,7 @@ static void mapped_handler2(int err, const struct sa *map_addr, void *arg)
 
 static int media_start(struct mnat_sess *sess, struct mnat_media *m)
 {
+	uint32_t interval;
 	int err = 0;
 
 	if (m->sock1) {
@@ -124,8 +125,12 @@ static int media_start(struct mnat_sess *sess, struct mnat_media *m)
 	if (err)
 		return err;
 
-	stun_keepalive_enable(m->ska1, INTERVAL);
-	stun_keepalive_enable(m->ska2, INTERVAL);
+	/* as long as the bindings of the NAT last */
+	interval = net_keepalive(baresip_network(), sa_af(&sess->srv),
+				 INTERVAL);
+
+	stun_keepalive_enable(m->ska1, interval);
+	stun_keepalive_enable(m->ska2, interval);
 
 	return 0;
 }
@@ -3,8 +3,21 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
-
+#ifdef __linux__
+#define _GNU_SOURCE 1
+#endif
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <syslog.h>
+#ifdef __linux__
+#define HAVE_SENDMMSG 1
+#endif
 #include <re.h>
 #include <baresip.h>
 
@@ -13,6 +26,35 @@
  * @defgroup syslog syslog
  *
  * This module implements a logging handler for output to syslog
+ *
+ * The handler is called from the log thread, with the records of the
+ * asynchronous logging ring. It only formats a message into the current
+ * batch. A batch is sent when it is full, or every 100 ms from the main
+ * loop, with one sendmmsg() call where available, on a non-blocking
+ * datagram socket. If the socket is not ready, the messages are dropped
+ * and counted, and the number of dropped messages is sent later as a
+ * message of its own.
+ *
+ * The messages go to the local syslog socket, or to a syslog server
+ * over UDP. In RFC 5424 format the context of a message, the Call-ID
+ * and the AOR, is sent as structured data:
+ *
+ \verbatim
+  <134>1 2026-10-14T09:12:01.250Z host baresip 4242 ua
+   [baresip@32473 callid="a1b2c3" aor="sip:alice@example.com"]
+   Call established: sip:bob@example.com
+ \endverbatim
+ *
+ * The following options can be configured:
+ *
+ \verbatim
+  syslog_server       10.0.0.1:514        # Syslog server, UDP
+  syslog_format       rfc5424             # rfc3164 or rfc5424
+  syslog_batch        32                  # Messages per batch
+ \endverbatim
+ *
+ * Without syslog_server the messages go to the local socket in RFC 3164
+ * format. If there is no local socket, syslog(3) is used.
  */
 
 
@@ -21,17 +63,279 @@
 #include <re_dbg.h>
 
 
+#ifdef _PATH_LOG
+#define LOCAL_PATH _PATH_LOG
+#else
+#define LOCAL_PATH "/dev/log"
+#endif
+
+
+enum {
+	BATCH_MAX  = 64,       /**< Max messages per batch              */
+	BATCH_SIZE = 32,       /**< Default messages per batch          */
+	MSG_SIZE   = 1024,     /**< Max length of a message             */
+	FLUSH_IVAL = 100,      /**< Flush interval [ms]                 */
+	SD_PEN     = 32473,    /**< Enterprise number of the SD-ID      */
+	MSGID_MAX  = 16,       /**< Max length of the MSGID             */
+};
+
+struct msg {
+	size_t len;
+	char buf[MSG_SIZE];
+};
+
+static struct {
+	struct lock *lock;     /**< Protects the batch and the counters */
+	struct tmr tmr;
+	int fd;
+	bool rfc5424;
+	char host[64];
+	unsigned pid;
+	uint32_t batch;
+	struct msg msgv[BATCH_MAX];
+	uint32_t msgc;
+	uint64_t n_sent;
+	uint64_t n_drop;       /**< Socket was not ready                */
+	uint64_t n_err;        /**< Send errors                         */
+	uint64_t n_reported;   /**< Dropped messages already reported   */
+} sl = {
+	.fd = -1,
+};
+
+
 static const int lmap[] = { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERR };
 
 
+/* strip the newline at the end of a log message */
+static size_t msg_len(const char *msg, size_t len)
+{
+	while (len && (msg[len-1] == '\n' || msg[len-1] == '\r'))
+		--len;
+
+	return len;
+}
+
+
+/* "ua: Call established" has the MSGID "ua" */
+static struct pl msgid(const char *msg, size_t len)
+{
+	struct pl pl = PL("-");
+	size_t i;
+
+	for (i=0; i<len && i<=MSGID_MAX; i++) {
+
+		const char c = msg[i];
+
+		if (c == ':') {
+			if (i > 0 && i + 1 < len && msg[i+1] == ' ')
+				pl_set_mem(&pl, msg, i);
+			break;
+		}
+
+		if (!(c >= 'a' && c <= 'z') && !(c >= '0' && c <= '9') &&
+		    c != '_' && c != '-')
+			break;
+	}
+
+	return pl;
+}
+
+
+static int print_param(struct re_printf *pf, const char *val)
+{
+	const char *p;
+	int err = 0;
+
+	for (p = val; *p && !err; p++) {
+
+		if (*p == '"' || *p == '\\' || *p == ']')
+			err = re_hprintf(pf, "\\%c", *p);
+		else
+			err = re_hprintf(pf, "%c", *p);
+	}
+
+	return err;
+}
+
+
+static int print_sd(struct re_printf *pf, const char *callid,
+		    const char *aor)
+{
+	int err;
+
+	if (!callid && !aor)
+		return re_hprintf(pf, "-");
+
+	err = re_hprintf(pf, "[baresip@%u", SD_PEN);
+	if (callid)
+		err |= re_hprintf(pf, " callid=\"%H\"", print_param, callid);
+	if (aor)
+		err |= re_hprintf(pf, " aor=\"%H\"", print_param, aor);
+
+	return err | re_hprintf(pf, "]");
+}
+
+
+static void format(struct msg *m, int pri, const char *msg, size_t len,
+		   const char *callid, const char *aor)
+{
+	struct timespec ts;
+	struct tm tm;
+	char tbuf[32];
+	int n;
+
+	(void)clock_gettime(CLOCK_REALTIME, &ts);
+
+	if (sl.rfc5424) {
+		const struct pl id = msgid(msg, len);
+
+		(void)gmtime_r(&ts.tv_sec, &tm);
+		(void)strftime(tbuf, sizeof(tbuf), "%Y-%m-%dT%H:%M:%S", &tm);
+
+		n = re_snprintf(m->buf, sizeof(m->buf),
+				"<%d>1 %s.%03ldZ %s baresip %u %r %H %b",
+				pri, tbuf, ts.tv_nsec / 1000000, sl.host,
+				sl.pid, &id, print_sd, callid, aor,
+				msg, len);
+	}
+	else {
+		(void)localtime_r(&ts.tv_sec, &tm);
+		(void)strftime(tbuf, sizeof(tbuf), "%b %e %H:%M:%S", &tm);
+
+		n = re_snprintf(m->buf, sizeof(m->buf),
+				"<%d>%s baresip[%u]: %b",
+				pri, tbuf, sl.pid, msg, len);
+	}
+
+	/* a long message is cut */
+	if (n < 0)
+		n = (int)str_len(m->buf);
+
+	m->len = n;
+}
+
+
+static void drop_report(void)
+{
+	const uint64_t n = sl.n_drop - sl.n_reported;
+	char note[64];
+	int len;
+
+	if (!n || sl.msgc >= BATCH_MAX)
+		return;
+
+	len = re_snprintf(note, sizeof(note),
+			  "syslog: %llu messages dropped", n);
+	if (len <= 0)
+		return;
+
+	format(&sl.msgv[sl.msgc++], LOG_LOCAL0 | LOG_WARNING,
+	       note, len, NULL, NULL);
+
+	sl.n_reported = sl.n_drop;
+}
+
+
+/* must be called with the lock held */
+static void flush(void)
+{
+	uint32_t i = 0;
+
+	drop_report();
+
+#ifdef HAVE_SENDMMSG
+	{
+		struct mmsghdr mv[BATCH_MAX];
+		struct iovec iov[BATCH_MAX];
+
+		memset(mv, 0, sl.msgc * sizeof(mv[0]));
+
+		for (i=0; i<sl.msgc; i++) {
+			iov[i].iov_base = sl.msgv[i].buf;
+			iov[i].iov_len  = sl.msgv[i].len;
+
+			mv[i].msg_hdr.msg_iov    = &iov[i];
+			mv[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		i = 0;
+		while (i < sl.msgc) {
+
+			int n = sendmmsg(sl.fd, &mv[i], sl.msgc - i,
+					 MSG_DONTWAIT);
+			if (n > 0) {
+				i += n;
+				continue;
+			}
+
+			if (n < 0 && errno == EINTR)
+				continue;
+
+			break;
+		}
+	}
+#else
+	for (; i<sl.msgc; i++) {
+
+		if (send(sl.fd, sl.msgv[i].buf, sl.msgv[i].len,
+			 MSG_DONTWAIT) < 0)
+			break;
+	}
+#endif
+
+	sl.n_sent += i;
+
+	/* the rest of the batch is lost */
+	if (i < sl.msgc) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK ||
+		    errno == ENOBUFS)
+			sl.n_drop += sl.msgc - i;
+		else
+			sl.n_err  += sl.msgc - i;
+	}
+
+	sl.msgc = 0;
+}
+
+
+static void queue(int pri, const char *msg, size_t len)
+{
+	const char *callid, *aor;
+
+	len = msg_len(msg, len);
+	if (!len)
+		return;
+
+	log_context(&callid, &aor);
+
+	lock_write_get(sl.lock);
+
+	format(&sl.msgv[sl.msgc++], pri, msg, len, callid, aor);
+
+	/* keep a slot for the drop report */
+	if (sl.msgc >= sl.batch)
+		flush();
+
+	lock_rel(sl.lock);
+}
+
+
 static void log_handler(uint32_t level, const char *msg)
 {
-	syslog(lmap[MIN(level, ARRAY_SIZE(lmap)-1)], "%s", msg);
+	const int sev = lmap[MIN(level, ARRAY_SIZE(lmap)-1)];
+
+	if (sl.fd < 0) {
+		syslog(sev, "%s", msg);
+		return;
+	}
+
+	queue(LOG_LOCAL0 | sev, msg, str_len(msg));
 }
 
 
 static struct log lg = {
 	.h = log_handler,
+	.thread_safe = true,
 };
 
 
@@ -39,13 +343,103 @@ static void syslog_handler(int level, const char *p, size_t len, void *arg)
 {
 	(void)arg;
 
-	syslog(level, "%.*s", (int)len, p);
+	if (sl.fd < 0) {
+		syslog(level, "%.*s", (int)len, p);
+		return;
+	}
+
+	queue(LOG_LOCAL0 | (level & LOG_PRIMASK), p, len);
+}
+
+
+static void tmr_handler(void *arg)
+{
+	(void)arg;
+
+	tmr_start(&sl.tmr, FLUSH_IVAL, tmr_handler, NULL);
+
+	lock_write_get(sl.lock);
+	if (sl.msgc || sl.n_drop != sl.n_reported)
+		flush();
+	lock_rel(sl.lock);
+}
+
+
+static int sock_open(void)
+{
+	struct sa srv;
+	struct pl pl;
+	int err;
+
+	if (0 == conf_get(conf_cur(), "syslog_server", &pl)) {
+
+		err = sa_decode(&srv, pl.p, pl.l);
+		if (err) {
+			warning("syslog: invalid syslog_server '%r'\n", &pl);
+			return err;
+		}
+
+		sl.fd = socket(sa_af(&srv), SOCK_DGRAM, 0);
+		if (sl.fd < 0)
+			return errno;
+
+		if (connect(sl.fd, &srv.u.sa, srv.len) < 0)
+			return errno;
+
+		sl.rfc5424 = true;
+	}
+	else {
+		struct sockaddr_un su;
+
+		memset(&su, 0, sizeof(su));
+		su.sun_family = AF_UNIX;
+		str_ncpy(su.sun_path, LOCAL_PATH, sizeof(su.sun_path));
+
+		sl.fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+		if (sl.fd < 0)
+			return errno;
+
+		if (connect(sl.fd, (struct sockaddr *)&su, sizeof(su)) < 0)
+			return errno;
+	}
+
+	return net_sockopt_blocking_set(sl.fd, false);
 }
 
 
 static int module_init(void)
 {
-	openlog("baresip", LOG_NDELAY | LOG_PID, LOG_LOCAL0);
+	char fmt[16] = "";
+	int err;
+
+	sl.batch = BATCH_SIZE;
+	(void)conf_get_u32(conf_cur(), "syslog_batch", &sl.batch);
+	sl.batch = min(max(sl.batch, 1u), (uint32_t)BATCH_MAX - 1);
+
+	sl.pid = (unsigned)getpid();
+	if (gethostname(sl.host, sizeof(sl.host)) || !sl.host[0])
+		str_ncpy(sl.host, "-", sizeof(sl.host));
+	sl.host[sizeof(sl.host) - 1] = '\0';
+
+	err = lock_alloc(&sl.lock);
+	if (err)
+		return err;
+
+	err = sock_open();
+	if (err) {
+		warning("syslog: socket: %m, using syslog(3)\n", err);
+		if (sl.fd >= 0)
+			(void)close(sl.fd);
+		sl.fd = -1;
+		openlog("baresip", LOG_NDELAY | LOG_PID, LOG_LOCAL0);
+	}
+
+	if (0 == conf_get_str(conf_cur(), "syslog_format", fmt, sizeof(fmt)))
+		sl.rfc5424 = 0 == str_casecmp(fmt, "rfc5424");
+
+	tmr_init(&sl.tmr);
+	if (sl.fd >= 0)
+		tmr_start(&sl.tmr, FLUSH_IVAL, tmr_handler, NULL);
 
 	dbg_init(DBG_INFO, DBG_NONE);
 	dbg_handler_set(syslog_handler, NULL);
@@ -62,7 +456,26 @@ static int module_close(void)
 
 	dbg_handler_set(NULL, NULL);
 
-	closelog();
+	tmr_cancel(&sl.tmr);
+
+	if (sl.fd >= 0) {
+
+		lock_write_get(sl.lock);
+		flush();
+		lock_rel(sl.lock);
+
+		if (sl.n_drop || sl.n_err)
+			info("syslog: %llu sent, %llu dropped, %llu errors\n",
+			     sl.n_sent, sl.n_drop, sl.n_err);
+
+		(void)close(sl.fd);
+		sl.fd = -1;
+	}
+	else {
+		closelog();
+	}
+
+	sl.lock = mem_deref(sl.lock);
 
 	return 0;
 }
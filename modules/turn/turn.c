@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 
@@ -13,18 +14,47 @@
  * Traversal Using Relays around NAT (TURN) for media NAT traversal
  *
  * XXX: use turn RSV_TOKEN for RTP/RTCP even/odd pair ?
+ *
+ * The allocation is made on the socket of the media stream, so it can
+ * not be made before the call. The address of the TURN server is kept
+ * instead, and looked up again in the background, so that a new call
+ * sends its Allocate request at once. A server that is not used for
+ * an hour is forgotten. Media to the peer is sent in ChannelData
+ * messages, once the remote address is known from the SDP.
  */
 
 
 enum {LAYER = 0};
 
+enum {
+	REFRESH_TIME = 300000,   /**< Server lookup interval in [ms]     */
+	IDLE_TIME    = 3600000,  /**< Unused server is dropped after [ms] */
+};
+
+
+/** A TURN server looked up before, reused by new sessions */
+struct server {
+	struct le le;
+	struct tmr tmr;
+	struct sa srv;
+	struct sa laddr;             /**< Local address of the lookup */
+	struct stun_dns *dnsq;
+	char *host;
+	uint16_t port;
+	int af;
+	uint64_t used;
+};
+
 
 struct mnat_sess {
 	struct list medial;
 	struct sa srv;
 	struct stun_dns *dnsq;
+	char *host;
 	char *user;
 	char *pass;
+	uint16_t port;
+	int af;
 	mnat_estab_h *estabh;
 	void *arg;
 	int mediac;
@@ -46,6 +76,130 @@ struct mnat_media {
 
 
 static struct mnat *mnat;
+static struct list serverl;
+
+
+static void server_destructor(void *arg)
+{
+	struct server *srv = arg;
+
+	tmr_cancel(&srv->tmr);
+	list_unlink(&srv->le);
+	mem_deref(srv->dnsq);
+	mem_deref(srv->host);
+}
+
+
+static struct server *server_find(const char *host, uint16_t port, int af)
+{
+	struct le *le;
+
+	for (le = serverl.head; le; le = le->next) {
+
+		struct server *srv = le->data;
+
+		if (srv->port == port && srv->af == af &&
+		    0 == str_cmp(srv->host, host))
+			return srv;
+	}
+
+	return NULL;
+}
+
+
+static void server_tmr_handler(void *arg);
+
+
+static void server_dns_handler(int err, const struct sa *addr, void *arg)
+{
+	struct server *srv = arg;
+	const struct sa *laddr = net_laddr_af(baresip_network(), srv->af);
+
+	if (err || !laddr) {
+		debug("turn: %s: server lookup failed (%m)\n",
+		      srv->host, err);
+		sa_init(&srv->srv, AF_UNSPEC);
+	}
+	else {
+		srv->srv   = *addr;
+		srv->laddr = *laddr;
+	}
+
+	tmr_start(&srv->tmr, REFRESH_TIME, server_tmr_handler, srv);
+}
+
+
+static void server_tmr_handler(void *arg)
+{
+	struct server *srv = arg;
+	int err;
+
+	if (tmr_jiffies() - srv->used > IDLE_TIME) {
+		mem_deref(srv);
+		return;
+	}
+
+	srv->dnsq = mem_deref(srv->dnsq);
+
+	err = stun_server_discover(&srv->dnsq, net_dnsc(baresip_network()),
+				   stun_usage_relay, stun_proto_udp,
+				   srv->af, srv->host, srv->port,
+				   server_dns_handler, srv);
+	if (err)
+		server_dns_handler(err, NULL, srv);
+}
+
+
+static void server_store(const struct mnat_sess *sess)
+{
+	const struct sa *laddr = net_laddr_af(baresip_network(), sess->af);
+	struct server *srv;
+
+	if (!laddr)
+		return;
+
+	srv = server_find(sess->host, sess->port, sess->af);
+	if (!srv) {
+		srv = mem_zalloc(sizeof(*srv), server_destructor);
+		if (!srv)
+			return;
+
+		srv->port = sess->port;
+		srv->af   = sess->af;
+
+		if (str_dup(&srv->host, sess->host)) {
+			mem_deref(srv);
+			return;
+		}
+
+		list_append(&serverl, &srv->le, srv);
+		tmr_start(&srv->tmr, REFRESH_TIME, server_tmr_handler, srv);
+	}
+
+	srv->srv   = sess->srv;
+	srv->laddr = *laddr;
+	srv->used  = tmr_jiffies();
+}
+
+
+/* A stored address is only valid on the same local address */
+static const struct sa *server_lookup(const char *host, uint16_t port,
+				      int af)
+{
+	const struct sa *laddr = net_laddr_af(baresip_network(), af);
+	struct server *srv = server_find(host, port, af);
+
+	if (!srv || !laddr)
+		return NULL;
+
+	srv->used = tmr_jiffies();
+
+	if (!sa_isset(&srv->srv, SA_ALL) ||
+	    !sa_cmp(laddr, &srv->laddr, SA_ADDR))
+		return NULL;
+
+	return &srv->srv;
+}
 
 
 static void session_destructor(void *arg)
@@ -54,6 +208,7 @@ static void session_destructor(void *arg)
 
 	list_flush(&sess->medial);
 	mem_deref(sess->dnsq);
+	mem_deref(sess->host);
 	mem_deref(sess->user);
 	mem_deref(sess->pass);
 }
@@ -158,6 +313,7 @@ static void dns_handler(int err, const struct sa *srv, void *arg)
 		goto out;
 
 	sess->srv = *srv;
+	server_store(sess);
 
 	for (le=sess->medial.head; le; le=le->next) {
 
@@ -182,6 +338,7 @@ static int session_alloc(struct mnat_sess **sessp, struct dnsc *dnsc,
 			 mnat_estab_h *estabh, void *arg)
 {
 	struct mnat_sess *sess;
+	const struct sa *addr;
 	int err;
 	(void)ss;
 	(void)offerer;
@@ -195,11 +352,21 @@ static int session_alloc(struct mnat_sess **sessp, struct dnsc *dnsc,
 
 	err  = str_dup(&sess->user, user);
 	err |= str_dup(&sess->pass, pass);
+	err |= str_dup(&sess->host, srv);
 	if (err)
 		goto out;
 
 	sess->estabh = estabh;
 	sess->arg    = arg;
+	sess->port   = port;
+	sess->af     = af;
+
+	/* media_alloc sends the Allocate requests at once */
+	addr = server_lookup(srv, port, af);
+	if (addr) {
+		sess->srv = *addr;
+		goto out;
+	}
 
 	err = stun_server_discover(&sess->dnsq, dnsc,
 				   stun_usage_relay, stun_proto_udp,
@@ -287,6 +454,7 @@ static int module_init(void)
 static int module_close(void)
 {
 	mnat = mem_deref(mnat);
+	list_flush(&serverl);
 
 	return 0;
 }
@@ -10,5 +10,9 @@ ifeq ($(HAVE_LIBV4L2),yes)
 $(MOD)_LFLAGS	+= -lv4l2
 $(MOD)_CFLAGS	+= -DHAVE_LIBV4L2
 endif
+ifeq ($(HAVE_TURBOJPEG),yes)
+$(MOD)_LFLAGS	+= -lturbojpeg
+$(MOD)_CFLAGS	+= -DHAVE_TURBOJPEG
+endif
 
 include mk/mod.mk
@@ -25,6 +25,10 @@
 #include <linux/videodev2.h>
 #endif
 
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
 #ifdef HAVE_LIBV4L2
 #include <libv4l2.h>
 #else
@@ -41,12 +45,22 @@
  * @defgroup v4l2 v4l2
  *
  * V4L2 (Video for Linux 2) video-source module
+ *
+ * Uncompressed formats are preferred. If the camera delivers a smaller
+ * size or a lower frame-rate than requested in those, and it has MJPEG,
+ * then MJPEG is captured and decoded to YUV420P. MJPEG needs the
+ * module to be built with libturbojpeg.
+ *
+ * Native YUV420 buffers are exported as DMABUF, so a hardware encoder
+ * can read the frames without a copy.
  */
 
 
 struct buffer {
 	void  *start;
 	size_t length;
+	int dmafd;              /* exported DMABUF, or -1 */
+	struct dmabuf *db;
 };
 
 struct vidsrc_st {
@@ -56,7 +70,13 @@ struct vidsrc_st {
 	pthread_t thread;
 	bool run;
 	struct vidsz sz;
+	unsigned fps;
 	u_int32_t pixfmt;
+#ifdef HAVE_TURBOJPEG
+	tjhandle tj;
+	uint8_t *yuv;             /* decoded MJPEG frame */
+	size_t yuv_sz;
+#endif
 	struct buffer *buffers;
 	unsigned int   n_buffers;
 	vidsrc_frame_h *frameh;
@@ -161,6 +181,7 @@ static int init_mmap(struct vidsrc_st *st, const char *dev_name)
 			return errno;
 		}
 
+		st->buffers[st->n_buffers].dmafd  = -1;
 		st->buffers[st->n_buffers].length = buf.length;
 		st->buffers[st->n_buffers].start =
 			v4l2_mmap(NULL /* start anywhere */,
@@ -179,6 +200,88 @@ static int init_mmap(struct vidsrc_st *st, const char *dev_name)
 }
 
 
+/* Frames are read straight from the buffers, so encoders can use them */
+static void export_dmabuf(struct vidsrc_st *st)
+{
+#ifdef VIDIOC_EXPBUF
+	unsigned int i;
+
+	for (i=0; i<st->n_buffers; i++) {
+		struct buffer *b = &st->buffers[i];
+		struct v4l2_exportbuffer expbuf;
+		int err;
+
+		memset(&expbuf, 0, sizeof(expbuf));
+
+		expbuf.type  = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		expbuf.index = i;
+		expbuf.flags = O_RDONLY | O_CLOEXEC;
+
+		if (-1 == xioctl(st->fd, VIDIOC_EXPBUF, &expbuf)) {
+			debug("v4l2: VIDIOC_EXPBUF: %m\n", errno);
+			return;
+		}
+
+		b->dmafd = expbuf.fd;
+
+		err = vidsrc_dmabuf_add(&b->db, b->start, b->length,
+					b->dmafd);
+		if (err)
+			return;
+	}
+
+	info("v4l2: %u buffers exported as DMABUF\n", st->n_buffers);
+#else
+	(void)st;
+#endif
+}
+
+
+static int set_format(struct vidsrc_st *st, struct v4l2_format *fmt,
+		      u_int32_t pixfmt, int width, int height)
+{
+	memset(fmt, 0, sizeof(*fmt));
+
+	fmt->type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt->fmt.pix.width       = width;
+	fmt->fmt.pix.height      = height;
+	fmt->fmt.pix.pixelformat = pixfmt;
+	fmt->fmt.pix.field       = V4L2_FIELD_INTERLACED;
+
+	if (-1 == xioctl(st->fd, VIDIOC_S_FMT, fmt)) {
+		warning("v4l2: VIDIOC_S_FMT: %m\n", errno);
+		return errno;
+	}
+
+	return 0;
+}
+
+
+/* Request a frame-rate, and return the one set (0 if unknown) */
+static unsigned set_fps(struct vidsrc_st *st, unsigned fps)
+{
+	struct v4l2_streamparm parm;
+	const struct v4l2_fract *tpf = &parm.parm.capture.timeperframe;
+
+	if (!fps)
+		return 0;
+
+	memset(&parm, 0, sizeof(parm));
+
+	parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	parm.parm.capture.timeperframe.numerator   = 1;
+	parm.parm.capture.timeperframe.denominator = fps;
+
+	if (-1 == xioctl(st->fd, VIDIOC_S_PARM, &parm))
+		return 0;
+
+	if (!tpf->numerator)
+		return 0;
+
+	return tpf->denominator / tpf->numerator;
+}
+
+
 static int v4l2_init_device(struct vidsrc_st *st, const char *dev_name,
 			    int width, int height)
 {
@@ -186,6 +289,9 @@ static int v4l2_init_device(struct vidsrc_st *st, const char *dev_name,
 	struct v4l2_format fmt;
 	struct v4l2_fmtdesc fmts;
 	unsigned int min;
+	unsigned fps = 0;
+	bool mjpeg = false;
+	bool emulated = false;
 	const char *pix;
 	int err;
 
@@ -217,8 +323,14 @@ static int v4l2_init_device(struct vidsrc_st *st, const char *dev_name,
 	fmts.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	for (fmts.index=0; !v4l2_ioctl(st->fd, VIDIOC_ENUM_FMT, &fmts);
 			fmts.index++) {
+#ifdef HAVE_TURBOJPEG
+		if (fmts.pixelformat == V4L2_PIX_FMT_MJPEG &&
+		    !(fmts.flags & V4L2_FMT_FLAG_EMULATED))
+			mjpeg = true;
+#endif
 		if (match_fmt(fmts.pixelformat) != VID_FMT_N) {
 			st->pixfmt = fmts.pixelformat;
+			emulated = !!(fmts.flags & V4L2_FMT_FLAG_EMULATED);
 #ifdef HAVE_LIBV4L2
 			/* Prefer native formats */
 			if (fmts.flags ^ V4L2_FMT_FLAG_EMULATED)
@@ -227,24 +339,52 @@ static int v4l2_init_device(struct vidsrc_st *st, const char *dev_name,
 		}
 	}
 
-	if (!st->pixfmt) {
+	if (!st->pixfmt && !mjpeg) {
 		warning("v4l2: format negotiation failed: %m\n", errno);
 		return errno;
 	}
 
 	/* Select video input, video standard and tune here. */
 
-	memset(&fmt, 0, sizeof(fmt));
+	if (st->pixfmt) {
+		err = set_format(st, &fmt, st->pixfmt, width, height);
+		if (err)
+			return err;
 
-	fmt.type		= V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	fmt.fmt.pix.width       = width;
-	fmt.fmt.pix.height      = height;
-	fmt.fmt.pix.pixelformat = st->pixfmt;
-	fmt.fmt.pix.field       = V4L2_FIELD_INTERLACED;
+		fps = set_fps(st, st->fps);
+	}
 
-	if (-1 == xioctl(st->fd, VIDIOC_S_FMT, &fmt)) {
-		warning("v4l2: VIDIOC_S_FMT: %m\n", errno);
-		return errno;
+	/* MJPEG if the camera is too slow or small uncompressed */
+	if (mjpeg && (!st->pixfmt ||
+		      fmt.fmt.pix.width < (unsigned)width ||
+		      fmt.fmt.pix.height < (unsigned)height ||
+		      (fps && fps < st->fps))) {
+
+		struct v4l2_format fmt_raw = fmt;
+		u_int32_t pixfmt_raw = st->pixfmt;
+		unsigned fps_mjpeg;
+
+		err = set_format(st, &fmt, V4L2_PIX_FMT_MJPEG, width, height);
+		if (err)
+			return err;
+
+		fps_mjpeg = set_fps(st, st->fps);
+
+		if (pixfmt_raw &&
+		    fmt.fmt.pix.width * fmt.fmt.pix.height <=
+		    fmt_raw.fmt.pix.width * fmt_raw.fmt.pix.height &&
+		    fps_mjpeg <= fps) {
+
+			/* no better, go back */
+			err = set_format(st, &fmt, pixfmt_raw, width, height);
+			if (err)
+				return err;
+
+			(void)set_fps(st, st->fps);
+		}
+		else {
+			st->pixfmt = V4L2_PIX_FMT_MJPEG;
+		}
 	}
 
 	/* Note VIDIOC_S_FMT may change width and height. */
@@ -264,8 +404,23 @@ static int v4l2_init_device(struct vidsrc_st *st, const char *dev_name,
 	if (err)
 		return err;
 
+	/* libv4l2 converts emulated formats into buffers of its own */
+	if (st->pixfmt == V4L2_PIX_FMT_YUV420 && !emulated)
+		export_dmabuf(st);
+
 	pix = (char *)&fmt.fmt.pix.pixelformat;
 
+#ifdef HAVE_TURBOJPEG
+	if (st->pixfmt == V4L2_PIX_FMT_MJPEG) {
+		st->tj = tjInitDecompress();
+		if (!st->tj) {
+			warning("v4l2: tjInitDecompress: %s\n",
+				tjGetErrorStr());
+			return ENOMEM;
+		}
+	}
+#endif
+
 	if (st->pixfmt != fmt.fmt.pix.pixelformat) {
 		warning("v4l2: %s: unexpectedly got %c%c%c%c\n", dev_name,
 			pix[0], pix[1], pix[2], pix[3]);
@@ -298,6 +453,9 @@ static void uninit_device(struct vidsrc_st *st)
 	unsigned int i;
 
 	for (i=0; i<st->n_buffers; ++i) {
+		mem_deref(st->buffers[i].db);
+		if (st->buffers[i].dmafd >= 0)
+			close(st->buffers[i].dmafd);
 		v4l2_munmap(st->buffers[i].start, st->buffers[i].length);
 	}
 
@@ -333,10 +491,93 @@ static int start_capturing(struct vidsrc_st *st)
 }
 
 
-static void call_frame_handler(struct vidsrc_st *st, uint8_t *buf)
+#ifdef HAVE_TURBOJPEG
+/*
+ * Decode into planes kept for the next frame. Chroma of 4:2:2 images is
+ * given to the encoder as 4:2:0 by a linesize that skips every other
+ * chroma line.
+ */
+static int mjpeg_decode(struct vidsrc_st *st, struct vidframe *frame,
+			const uint8_t *buf, size_t len)
+{
+	int w, h, subsamp, colorspace;
+	int cw, ch, strides[3];
+	unsigned char *planes[3];
+	size_t sz;
+
+	if (tjDecompressHeader3(st->tj, buf, (unsigned long)len,
+				&w, &h, &subsamp, &colorspace))
+		return EBADMSG;
+
+	if (subsamp != TJSAMP_420 && subsamp != TJSAMP_422)
+		return ENOTSUP;
+
+	cw = (w + 1) / 2;
+	ch = subsamp == TJSAMP_420 ? (h + 1) / 2 : h;
+	sz = (size_t)w * h + 2 * (size_t)cw * ch;
+
+	if (st->yuv_sz < sz) {
+
+		st->yuv = mem_deref(st->yuv);
+		st->yuv = mem_alloc(sz, NULL);
+		if (!st->yuv) {
+			st->yuv_sz = 0;
+			return ENOMEM;
+		}
+
+		st->yuv_sz = sz;
+	}
+
+	planes[0] = st->yuv;
+	planes[1] = planes[0] + (size_t)w * h;
+	planes[2] = planes[1] + (size_t)cw * ch;
+	strides[0] = w;
+	strides[1] = strides[2] = cw;
+
+	if (tjDecompressToYUVPlanes(st->tj, buf, (unsigned long)len, planes,
+				    w, strides, h, TJFLAG_FASTDCT))
+		return EBADMSG;
+
+	memset(frame, 0, sizeof(*frame));
+
+	frame->data[0]     = planes[0];
+	frame->data[1]     = planes[1];
+	frame->data[2]     = planes[2];
+	frame->linesize[0] = w;
+	frame->linesize[1] = frame->linesize[2] =
+		subsamp == TJSAMP_422 ? 2 * cw : cw;
+	frame->size.w      = w;
+	frame->size.h      = h;
+	frame->fmt         = VID_FMT_YUV420P;
+
+	return 0;
+}
+#endif
+
+
+static void call_frame_handler(struct vidsrc_st *st, uint8_t *buf,
+			       size_t len)
 {
 	struct vidframe frame;
 
+#ifdef HAVE_TURBOJPEG
+	if (st->pixfmt == V4L2_PIX_FMT_MJPEG) {
+		int err;
+
+		err = mjpeg_decode(st, &frame, buf, len);
+		if (err) {
+			debug("v4l2: MJPEG decode of %zu bytes: %m\n",
+			      len, err);
+			return;
+		}
+
+		st->frameh(&frame, st->arg);
+		return;
+	}
+#else
+	(void)len;
+#endif
+
 	vidframe_init_buf(&frame, match_fmt(st->pixfmt), &st->sz, buf);
 
 	st->frameh(&frame, st->arg);
@@ -373,7 +614,7 @@ static int read_frame(struct vidsrc_st *st)
 		warning("v4l2: index >= n_buffers\n");
 	}
 
-	call_frame_handler(st, st->buffers[buf.index].start);
+	call_frame_handler(st, st->buffers[buf.index].start, buf.bytesused);
 
 	if (-1 == xioctl (st->fd, VIDIOC_QBUF, &buf)) {
 		warning("v4l2: VIDIOC_QBUF\n");
@@ -410,6 +651,12 @@ static void destructor(void *arg)
 
 	if (st->fd >= 0)
 		v4l2_close(st->fd);
+
+#ifdef HAVE_TURBOJPEG
+	if (st->tj)
+		tjDestroy(st->tj);
+	mem_deref(st->yuv);
+#endif
 }
 
 
@@ -439,7 +686,6 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 	int err;
 
 	(void)ctx;
-	(void)prm;
 	(void)fmt;
 	(void)errorh;
 
@@ -456,6 +702,7 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 	st->vs = vs;
 	st->fd = -1;
 	st->sz = *size;
+	st->fps = prm ? (unsigned)prm->fps : 0;
 	st->frameh = frameh;
 	st->arg    = arg;
 	st->pixfmt = 0;
@@ -0,0 +1,787 @@
+/**
+ * @file m2m.c  Video4Linux2 memory-to-memory H.264 encoder
+ *
+ * Copyright (C) 2010 - 2015 Creytiv.com
+ */
+#include <unistd.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#if defined (OPENBSD) || defined (NETBSD)
+#include <sys/videoio.h>
+#else
+#include <linux/videodev2.h>
+#endif
+#include "v4l2_codec.h"
+
+
+/*
+ * A memory-to-memory encoder (e.g. /dev/video11 on a Raspberry Pi, or
+ * the VPU of an i.MX) has two queues. Raw frames are queued on the
+ * OUTPUT queue, and encoded H.264 comes back on the CAPTURE queue.
+ *
+ * Both queues have several buffers, so the encoder works on one frame
+ * while the next one is captured. A frame is queued without waiting for
+ * the previous ones, and the H.264 of all frames done is packetized
+ * straight from the mapped CAPTURE buffers.
+ *
+ * A frame that is in a DMABUF of the video source is queued by its
+ * descriptor, without a copy. The frame is only valid during the call,
+ * so the encoder waits until the buffer is released before it returns.
+ * Other frames are copied into mapped OUTPUT buffers.
+ */
+
+
+enum {
+	M2M_BUFS    = 4,        /**< Buffers on each queue              */
+	M2M_KEYINT  = 10,       /**< Key-frame interval in [seconds]    */
+};
+
+struct m2m_buf {
+	uint8_t *start;
+	size_t length;
+	bool queued;
+};
+
+struct videnc_state {
+	struct videnc_param encprm;
+	videnc_packet_h *pkth;
+	void *arg;
+
+	int fd;
+	bool mplane;
+	enum v4l2_buf_type type_out;
+	enum v4l2_buf_type type_cap;
+	enum v4l2_memory mem_out;
+
+	struct vidsz size;
+	enum vidfmt fmt;
+	uint32_t bytesperline;     /**< Of the luma plane, from driver */
+	uint32_t height;           /**< Lines of the luma plane        */
+	uint32_t sizeimage;        /**< Size of a raw frame [bytes]    */
+
+	struct m2m_buf out[M2M_BUFS];
+	struct m2m_buf cap[M2M_BUFS];
+	unsigned n_out;
+	unsigned n_cap;
+
+	struct {
+		unsigned n_frame;
+		unsigned n_dmabuf;
+		unsigned n_drop;
+	} stats;
+};
+
+
+static char m2m_device[64];
+
+
+static int xioctl(int fd, unsigned long int request, void *arg)
+{
+	int r;
+
+	do r = ioctl(fd, request, arg);
+	while (-1 == r && EINTR == errno);
+
+	return r;
+}
+
+
+static void buf_init(const struct videnc_state *st, struct v4l2_buffer *buf,
+		     struct v4l2_plane *plane, enum v4l2_buf_type type,
+		     enum v4l2_memory memory, unsigned index)
+{
+	memset(buf, 0, sizeof(*buf));
+	memset(plane, 0, sizeof(*plane));
+
+	buf->type   = type;
+	buf->memory = memory;
+	buf->index  = index;
+
+	if (st->mplane) {
+		buf->m.planes = plane;
+		buf->length   = 1;
+	}
+}
+
+
+static void set_ctrl(int fd, uint32_t id, int32_t value, const char *name)
+{
+	struct v4l2_control ctrl;
+
+	memset(&ctrl, 0, sizeof(ctrl));
+
+	ctrl.id    = id;
+	ctrl.value = value;
+
+	if (-1 == xioctl(fd, VIDIOC_S_CTRL, &ctrl))
+		debug("v4l2_codec: m2m: %s=%d not set (%m)\n",
+		      name, value, errno);
+}
+
+
+static void bufs_unmap(struct m2m_buf *bufv, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		if (bufv[i].start)
+			munmap(bufv[i].start, bufv[i].length);
+	}
+
+	memset(bufv, 0, n * sizeof(*bufv));
+}
+
+
+static void m2m_close(struct videnc_state *st)
+{
+	enum v4l2_buf_type type;
+
+	if (st->fd < 0)
+		return;
+
+	type = st->type_out;
+	(void)xioctl(st->fd, VIDIOC_STREAMOFF, &type);
+	type = st->type_cap;
+	(void)xioctl(st->fd, VIDIOC_STREAMOFF, &type);
+
+	bufs_unmap(st->out, st->n_out);
+	bufs_unmap(st->cap, st->n_cap);
+	st->n_out = 0;
+	st->n_cap = 0;
+
+	close(st->fd);
+	st->fd = -1;
+}
+
+
+static void destructor(void *arg)
+{
+	struct videnc_state *st = arg;
+
+	if (st->stats.n_frame) {
+		info("v4l2_codec: m2m: %u frames (%u dmabuf, %u dropped)\n",
+		     st->stats.n_frame, st->stats.n_dmabuf,
+		     st->stats.n_drop);
+	}
+
+	m2m_close(st);
+}
+
+
+static int set_format(struct videnc_state *st, struct v4l2_format *fmt,
+		      enum v4l2_buf_type type, uint32_t pixfmt,
+		      uint32_t sizeimage)
+{
+	memset(fmt, 0, sizeof(*fmt));
+
+	fmt->type = type;
+
+	if (st->mplane) {
+		fmt->fmt.pix_mp.width       = st->size.w;
+		fmt->fmt.pix_mp.height      = st->size.h;
+		fmt->fmt.pix_mp.pixelformat = pixfmt;
+		fmt->fmt.pix_mp.field       = V4L2_FIELD_NONE;
+		fmt->fmt.pix_mp.num_planes  = 1;
+		fmt->fmt.pix_mp.plane_fmt[0].sizeimage = sizeimage;
+	}
+	else {
+		fmt->fmt.pix.width       = st->size.w;
+		fmt->fmt.pix.height      = st->size.h;
+		fmt->fmt.pix.pixelformat = pixfmt;
+		fmt->fmt.pix.field       = V4L2_FIELD_NONE;
+		fmt->fmt.pix.sizeimage   = sizeimage;
+	}
+
+	if (-1 == xioctl(st->fd, VIDIOC_S_FMT, fmt)) {
+		warning("v4l2_codec: m2m: VIDIOC_S_FMT (%m)\n", errno);
+		return errno;
+	}
+
+	return 0;
+}
+
+
+static int request_bufs(struct videnc_state *st, struct m2m_buf *bufv,
+			unsigned *np, enum v4l2_buf_type type,
+			enum v4l2_memory memory)
+{
+	struct v4l2_requestbuffers req;
+	unsigned i;
+
+	memset(&req, 0, sizeof(req));
+
+	req.count  = M2M_BUFS;
+	req.type   = type;
+	req.memory = memory;
+
+	if (-1 == xioctl(st->fd, VIDIOC_REQBUFS, &req)) {
+		warning("v4l2_codec: m2m: VIDIOC_REQBUFS (%m)\n", errno);
+		return errno;
+	}
+
+	if (req.count < 2) {
+		warning("v4l2_codec: m2m: only %u buffers\n", req.count);
+		return ENOMEM;
+	}
+
+	*np = min(req.count, (unsigned)M2M_BUFS);
+
+	if (memory != V4L2_MEMORY_MMAP)
+		return 0;
+
+	for (i=0; i<*np; i++) {
+		struct v4l2_plane plane;
+		struct v4l2_buffer buf;
+		size_t length;
+		off_t offset;
+		void *p;
+
+		buf_init(st, &buf, &plane, type, memory, i);
+
+		if (-1 == xioctl(st->fd, VIDIOC_QUERYBUF, &buf)) {
+			warning("v4l2_codec: m2m: VIDIOC_QUERYBUF (%m)\n",
+				errno);
+			return errno;
+		}
+
+		length = st->mplane ? plane.length : buf.length;
+		offset = st->mplane ? plane.m.mem_offset : buf.m.offset;
+
+		p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 st->fd, offset);
+		if (p == MAP_FAILED) {
+			warning("v4l2_codec: m2m: mmap failed (%m)\n", errno);
+			return errno;
+		}
+
+		bufv[i].start  = p;
+		bufv[i].length = length;
+	}
+
+	return 0;
+}
+
+
+static int queue_capture(struct videnc_state *st, unsigned index)
+{
+	struct v4l2_plane plane;
+	struct v4l2_buffer buf;
+
+	buf_init(st, &buf, &plane, st->type_cap, V4L2_MEMORY_MMAP, index);
+
+	if (st->mplane)
+		plane.length = (uint32_t)st->cap[index].length;
+
+	if (-1 == xioctl(st->fd, VIDIOC_QBUF, &buf)) {
+		warning("v4l2_codec: m2m: VIDIOC_QBUF capture (%m)\n", errno);
+		return errno;
+	}
+
+	st->cap[index].queued = true;
+
+	return 0;
+}
+
+
+/* The frame can be queued by descriptor, in the layout of the driver */
+static int frame_dmabuf(const struct videnc_state *st,
+			const struct vidframe *frame, size_t *lenp)
+{
+	const size_t luma = (size_t)st->bytesperline * st->height;
+	size_t offv[4];
+	int fd;
+
+	fd = vidsrc_dmabuf_fd(frame, offv, lenp);
+	if (fd < 0)
+		return -1;
+
+	if (offv[0] != 0 || frame->linesize[0] != st->bytesperline ||
+	    offv[1] != luma || *lenp < st->sizeimage)
+		return -1;
+
+	switch (frame->fmt) {
+
+	case VID_FMT_YUV420P:
+		if (offv[2] != luma + luma / 4 ||
+		    frame->linesize[1] != st->bytesperline / 2)
+			return -1;
+		break;
+
+	case VID_FMT_NV12:
+		if (frame->linesize[1] != st->bytesperline)
+			return -1;
+		break;
+
+	default:
+		return -1;
+	}
+
+	return fd;
+}
+
+
+static int m2m_open(struct videnc_state *st, const struct vidframe *frame)
+{
+	struct v4l2_capability cap;
+	struct v4l2_streamparm parm;
+	struct v4l2_format fmt;
+	enum v4l2_buf_type type;
+	uint32_t caps, pixfmt;
+	size_t len;
+	unsigned i;
+	int err;
+
+	st->fd = open(m2m_device, O_RDWR | O_NONBLOCK);
+	if (st->fd < 0) {
+		err = errno;
+		warning("v4l2_codec: m2m: open %s (%m)\n", m2m_device, err);
+		return err;
+	}
+
+	memset(&cap, 0, sizeof(cap));
+
+	if (-1 == xioctl(st->fd, VIDIOC_QUERYCAP, &cap)) {
+		err = errno;
+		warning("v4l2_codec: m2m: VIDIOC_QUERYCAP (%m)\n", err);
+		goto out;
+	}
+
+	caps = cap.capabilities;
+#ifdef V4L2_CAP_DEVICE_CAPS
+	if (caps & V4L2_CAP_DEVICE_CAPS)
+		caps = cap.device_caps;
+#endif
+
+	if (caps & V4L2_CAP_VIDEO_M2M_MPLANE) {
+		st->mplane   = true;
+		st->type_out = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+		st->type_cap = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	}
+	else if (caps & V4L2_CAP_VIDEO_M2M) {
+		st->mplane   = false;
+		st->type_out = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		st->type_cap = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	}
+	else {
+		warning("v4l2_codec: m2m: %s is no m2m device\n", m2m_device);
+		err = ENODEV;
+		goto out;
+	}
+
+	st->size = frame->size;
+	st->fmt  = frame->fmt;
+
+	pixfmt = frame->fmt == VID_FMT_NV12 ?
+		V4L2_PIX_FMT_NV12 : V4L2_PIX_FMT_YUV420;
+
+	/* raw frames in, the driver may pad the lines */
+	err = set_format(st, &fmt, st->type_out, pixfmt, 0);
+	if (err)
+		goto out;
+
+	if (st->mplane) {
+		st->bytesperline = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+		st->height       = fmt.fmt.pix_mp.height;
+		st->sizeimage    = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
+	}
+	else {
+		st->bytesperline = fmt.fmt.pix.bytesperline;
+		st->height       = fmt.fmt.pix.height;
+		st->sizeimage    = fmt.fmt.pix.sizeimage;
+	}
+
+	if (st->bytesperline < st->size.w || st->height < st->size.h) {
+		warning("v4l2_codec: m2m: unexpected format %ux%u\n",
+			st->bytesperline, st->height);
+		err = EPROTO;
+		goto out;
+	}
+
+	/* H.264 out, one buffer holds a frame */
+	err = set_format(st, &fmt, st->type_cap, V4L2_PIX_FMT_H264,
+			 st->sizeimage);
+	if (err)
+		goto out;
+
+	memset(&parm, 0, sizeof(parm));
+
+	parm.type = st->type_out;
+	parm.parm.output.timeperframe.numerator   = 1;
+	parm.parm.output.timeperframe.denominator = st->encprm.fps;
+
+	if (-1 == xioctl(st->fd, VIDIOC_S_PARM, &parm))
+		debug("v4l2_codec: m2m: VIDIOC_S_PARM (%m)\n", errno);
+
+	set_ctrl(st->fd, V4L2_CID_MPEG_VIDEO_BITRATE,
+		 st->encprm.bitrate, "bitrate");
+	set_ctrl(st->fd, V4L2_CID_MPEG_VIDEO_H264_PROFILE,
+		 V4L2_MPEG_VIDEO_H264_PROFILE_CONSTRAINED_BASELINE,
+		 "profile");
+	set_ctrl(st->fd, V4L2_CID_MPEG_VIDEO_H264_I_PERIOD,
+		 st->encprm.fps * M2M_KEYINT, "i_period");
+#ifdef V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER
+	set_ctrl(st->fd, V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER, 1,
+		 "repeat_seq_header");
+#endif
+
+	st->mem_out = frame_dmabuf(st, frame, &len) >= 0 ?
+		V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+
+	err = request_bufs(st, st->out, &st->n_out, st->type_out,
+			   st->mem_out);
+	if (err)
+		goto out;
+
+	err = request_bufs(st, st->cap, &st->n_cap, st->type_cap,
+			   V4L2_MEMORY_MMAP);
+	if (err)
+		goto out;
+
+	for (i=0; i<st->n_cap; i++) {
+		err = queue_capture(st, i);
+		if (err)
+			goto out;
+	}
+
+	type = st->type_out;
+	if (-1 == xioctl(st->fd, VIDIOC_STREAMON, &type)) {
+		err = errno;
+		goto out;
+	}
+
+	type = st->type_cap;
+	if (-1 == xioctl(st->fd, VIDIOC_STREAMON, &type)) {
+		err = errno;
+		goto out;
+	}
+
+	info("v4l2_codec: m2m: %s (%s) %ux%u %s, %u+%u buffers%s\n",
+	     m2m_device, cap.card, st->size.w, st->size.h,
+	     vidfmt_name(st->fmt), st->n_out, st->n_cap,
+	     st->mem_out == V4L2_MEMORY_DMABUF ? ", dmabuf" : "");
+
+ out:
+	if (err) {
+		warning("v4l2_codec: m2m: could not open encoder (%m)\n",
+			err);
+		m2m_close(st);
+	}
+
+	return err;
+}
+
+
+/* Output buffers the encoder is done with */
+static void reclaim_output(struct videnc_state *st)
+{
+	for (;;) {
+		struct v4l2_plane plane;
+		struct v4l2_buffer buf;
+
+		buf_init(st, &buf, &plane, st->type_out, st->mem_out, 0);
+
+		if (-1 == xioctl(st->fd, VIDIOC_DQBUF, &buf))
+			break;
+
+		if (buf.index < st->n_out)
+			st->out[buf.index].queued = false;
+	}
+}
+
+
+/* Packetize all encoded frames, straight from the capture buffers */
+static int read_capture(struct videnc_state *st)
+{
+	int err = 0;
+
+	for (;;) {
+		struct v4l2_plane plane;
+		struct v4l2_buffer buf;
+		const uint8_t *p;
+		size_t len;
+
+		buf_init(st, &buf, &plane, st->type_cap, V4L2_MEMORY_MMAP, 0);
+
+		if (st->mplane)
+			plane.length = (uint32_t)st->cap[0].length;
+
+		if (-1 == xioctl(st->fd, VIDIOC_DQBUF, &buf)) {
+			if (errno != EAGAIN)
+				err = errno;
+			break;
+		}
+
+		if (buf.index >= st->n_cap) {
+			err = EPROTO;
+			break;
+		}
+
+		st->cap[buf.index].queued = false;
+
+		if (st->mplane) {
+			p   = st->cap[buf.index].start + plane.data_offset;
+			len = plane.bytesused - plane.data_offset;
+		}
+		else {
+			p   = st->cap[buf.index].start;
+			len = buf.bytesused;
+		}
+
+		if (len) {
+			err = h264_packetize(p, len, st->encprm.pktsize,
+					     st->pkth, st->arg);
+		}
+
+		err |= queue_capture(st, buf.index);
+		if (err)
+			break;
+	}
+
+	if (err)
+		warning("v4l2_codec: m2m: read capture (%m)\n", err);
+
+	return err;
+}
+
+
+static bool wait_fd(const struct videnc_state *st, short events, int ms)
+{
+	struct pollfd pfd;
+
+	pfd.fd      = st->fd;
+	pfd.events  = events;
+	pfd.revents = 0;
+
+	return poll(&pfd, 1, ms) > 0 && (pfd.revents & events);
+}
+
+
+static void copy_frame(struct videnc_state *st, uint8_t *dst,
+		       const struct vidframe *frame)
+{
+	const uint32_t bpl = st->bytesperline;
+	const unsigned w = frame->size.w, h = frame->size.h;
+	uint8_t *u = dst + (size_t)bpl * st->height;
+	unsigned y;
+
+	for (y=0; y<h; y++) {
+		memcpy(dst + (size_t)y * bpl,
+		       frame->data[0] + (size_t)y * frame->linesize[0], w);
+	}
+
+	if (frame->fmt == VID_FMT_NV12) {
+
+		for (y=0; y<(h+1)/2; y++) {
+			memcpy(u + (size_t)y * bpl,
+			       frame->data[1] + (size_t)y * frame->linesize[1],
+			       (w+1) & ~1u);
+		}
+	}
+	else {
+		uint8_t *v = u + (size_t)(bpl/2) * (st->height/2);
+
+		for (y=0; y<(h+1)/2; y++) {
+			memcpy(u + (size_t)y * (bpl/2),
+			       frame->data[1] + (size_t)y * frame->linesize[1],
+			       (w+1)/2);
+			memcpy(v + (size_t)y * (bpl/2),
+			       frame->data[2] + (size_t)y * frame->linesize[2],
+			       (w+1)/2);
+		}
+	}
+}
+
+
+/**
+ * Set the M2M encoder device. The H.264 encoder of the module uses it
+ * instead of the H.264 of the camera.
+ *
+ * @param device Device name, e.g. /dev/video11
+ */
+void m2m_set_device(const char *device)
+{
+	str_ncpy(m2m_device, device, sizeof(m2m_device));
+}
+
+
+int m2m_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
+		      struct videnc_param *prm, const char *fmtp,
+		      videnc_packet_h *pkth, void *arg)
+{
+	struct videnc_state *st;
+	(void)fmtp;
+
+	if (!vesp || !vc || !prm || !pkth)
+		return EINVAL;
+
+	st = *vesp;
+
+	if (st) {
+		if (st->fd >= 0 && prm->bitrate != st->encprm.bitrate) {
+			set_ctrl(st->fd, V4L2_CID_MPEG_VIDEO_BITRATE,
+				 prm->bitrate, "bitrate");
+		}
+
+		st->encprm = *prm;
+		return 0;
+	}
+
+	st = mem_zalloc(sizeof(*st), destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->encprm = *prm;
+	st->pkth   = pkth;
+	st->arg    = arg;
+	st->fd     = -1;
+
+	info("v4l2_codec: m2m encoder %s: %u fps, %u bit/s, pktsize=%u\n",
+	     vc->name, prm->fps, prm->bitrate, prm->pktsize);
+
+	*vesp = st;
+
+	return 0;
+}
+
+
+int m2m_encode(struct videnc_state *st, bool update,
+	       const struct vidframe *frame)
+{
+	const int frame_ms = 1000 / (int)max(st ? st->encprm.fps : 0, 1u);
+	struct v4l2_plane plane;
+	struct v4l2_buffer buf;
+	enum v4l2_memory mem;
+	size_t len = 0;
+	unsigned i;
+	int fd, err;
+
+	if (!st || !frame)
+		return EINVAL;
+
+	if (frame->fmt != VID_FMT_YUV420P && frame->fmt != VID_FMT_NV12)
+		return ENOTSUP;
+
+	if (st->fd >= 0 && (!vidsz_cmp(&st->size, &frame->size) ||
+			    st->fmt != frame->fmt))
+		m2m_close(st);
+
+	if (st->fd < 0) {
+		err = m2m_open(st, frame);
+		if (err)
+			return err;
+	}
+
+	fd  = frame_dmabuf(st, frame, &len);
+	mem = fd >= 0 ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+
+	/* the source changed between DMABUF and memory frames */
+	if (mem != st->mem_out) {
+		m2m_close(st);
+
+		err = m2m_open(st, frame);
+		if (err)
+			return err;
+
+		fd = frame_dmabuf(st, frame, &len);
+	}
+
+	reclaim_output(st);
+
+	for (i=0; i<st->n_out; i++) {
+		if (!st->out[i].queued)
+			break;
+	}
+
+	/* all buffers busy, give the encoder one frame interval */
+	if (i == st->n_out) {
+
+		if (wait_fd(st, POLLIN, frame_ms))
+			(void)read_capture(st);
+
+		if (wait_fd(st, POLLOUT, frame_ms))
+			reclaim_output(st);
+
+		for (i=0; i<st->n_out; i++) {
+			if (!st->out[i].queued)
+				break;
+		}
+
+		if (i == st->n_out) {
+			++st->stats.n_drop;
+			return 0;
+		}
+	}
+
+	if (update) {
+		debug("v4l2_codec: m2m: key-frame requested\n");
+		set_ctrl(st->fd, V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 1,
+			 "force_key_frame");
+	}
+
+	buf_init(st, &buf, &plane, st->type_out, st->mem_out, i);
+
+	if (st->mem_out == V4L2_MEMORY_DMABUF) {
+
+		if (st->mplane) {
+			plane.m.fd      = fd;
+			plane.length    = (uint32_t)len;
+			plane.bytesused = st->sizeimage;
+		}
+		else {
+			buf.m.fd      = fd;
+			buf.length    = (uint32_t)len;
+			buf.bytesused = st->sizeimage;
+		}
+
+		++st->stats.n_dmabuf;
+	}
+	else {
+		copy_frame(st, st->out[i].start, frame);
+
+		if (st->mplane) {
+			plane.length    = (uint32_t)st->out[i].length;
+			plane.bytesused = st->sizeimage;
+		}
+		else {
+			buf.bytesused = st->sizeimage;
+		}
+	}
+
+	if (-1 == xioctl(st->fd, VIDIOC_QBUF, &buf)) {
+		err = errno;
+		warning("v4l2_codec: m2m: VIDIOC_QBUF output (%m)\n", err);
+		return err;
+	}
+
+	st->out[i].queued = true;
+	++st->stats.n_frame;
+
+	/* wait half a frame for this one, then take all that are done */
+	(void)wait_fd(st, POLLIN, frame_ms / 2);
+
+	err = read_capture(st);
+
+	/* the buffer of the source is only valid during this call */
+	if (st->mem_out == V4L2_MEMORY_DMABUF) {
+
+		while (st->out[i].queued && wait_fd(st, POLLOUT | POLLIN,
+						    frame_ms)) {
+			reclaim_output(st);
+			err |= read_capture(st);
+		}
+
+		if (st->out[i].queued) {
+			warning("v4l2_codec: m2m: dmabuf not released\n");
+			m2m_close(st);
+		}
+	}
+
+	return err;
+}
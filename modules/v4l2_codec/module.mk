@@ -5,6 +5,7 @@
 #
 
 MOD		:= v4l2_codec
+$(MOD)_SRCS	+= m2m.c
 $(MOD)_SRCS	+= v4l2_codec.c
 $(MOD)_LFLAGS	+=
 
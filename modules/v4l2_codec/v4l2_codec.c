@@ -19,6 +19,7 @@
 #else
 #include <linux/videodev2.h>
 #endif
+#include "v4l2_codec.h"
 
 
 /**
@@ -30,6 +31,13 @@
  * for devices that supports compressed formats such as H.264.
  * The module implements both the vidsrc API and the vidcodec API.
  *
+ * With a memory-to-memory encoder device configured, the H.264 encoder
+ * takes frames from any video source instead:
+ *
+ \verbatim
+  v4l2_codec_m2m          /dev/video11
+ \endverbatim
+ *
  *
  * TODO:
  *
@@ -559,6 +567,18 @@ static struct vidcodec h264 = {
 
 static int module_init(void)
 {
+	char device[64] = "";
+
+	if (0 == conf_get_str(conf_cur(), "v4l2_codec_m2m",
+			      device, sizeof(device)) && str_isset(device)) {
+
+		m2m_set_device(device);
+
+		h264.encupdh  = m2m_encode_update;
+		h264.ench     = m2m_encode;
+		h264.enc_nv12 = true;
+	}
+
 	info("v4l2_codec inited\n");
 
 	vidcodec_register(&h264);
@@ -0,0 +1,14 @@
+/**
+ * @file v4l2_codec.h  Video4Linux2 video-codec -- internal interface
+ *
+ * Copyright (C) 2010 - 2015 Creytiv.com
+ */
+
+
+/* Memory-to-memory encoder */
+void m2m_set_device(const char *device);
+int  m2m_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
+		       struct videnc_param *prm, const char *fmtp,
+		       videnc_packet_h *pkth, void *arg);
+int  m2m_encode(struct videnc_state *st, bool update,
+		const struct vidframe *frame);
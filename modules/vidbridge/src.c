@@ -82,6 +82,10 @@ struct vidsrc_st *vidbridge_src_find(const char *device)
 }
 
 
+/*
+ * The decoded frame is passed on by reference, and is only valid during
+ * the call. The encoder reads it in place when the format matches.
+ */
 void vidbridge_src_input(const struct vidsrc_st *st,
 			 const struct vidframe *frame)
 {
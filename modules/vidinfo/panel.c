@@ -3,30 +3,48 @@
  *
  * Copyright (C) 2010 - 2015 Creytiv.com
  */
+#include <string.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
 #include "vidinfo.h"
 
 
+/*
+ * The panel is rendered into a blend mask for the luma plane, once per
+ * second when the timer updates the values. Every frame only blends
+ * the mask onto the frame with vidconv_blend().
+ */
+
+
+enum {
+	UPDATE_INTERVAL = 1000,   /* panel update interval in [ms] */
+	GRAPH_LUMA = 220,
+};
+
+
 static void rrd_append(struct panel *panel, uint64_t val)
 {
 	if (!panel)
 		return;
 
-	panel->rrdv[panel->rrdc++] = val;
+	/* the oldest value is replaced when the history is full */
+	if (panel->rrdc == panel->rrdsz)
+		panel->rrd_sum -= panel->rrdv[panel->rrdpos];
+	else
+		++panel->rrdc;
+
+	panel->rrdv[panel->rrdpos] = val;
 	panel->rrd_sum += val;
 
-	if (panel->rrdc >= panel->rrdsz) {
-		panel->rrdc = 0;
-		panel->rrd_sum = 0;
-	}
+	if (++panel->rrdpos >= panel->rrdsz)
+		panel->rrdpos = 0;
 }
 
 
 static int rrd_get_average(struct panel *panel, uint64_t *average)
 {
-	if (!panel->rrdc)
+	if (!panel->rrdc || !panel->rrd_sum)
 		return ENOENT;
 
 	*average = panel->rrd_sum / panel->rrdc;
@@ -40,7 +58,7 @@ static void tmr_handler(void *arg)
 	struct panel *panel = arg;
 	uint64_t now = tmr_jiffies();
 
-	tmr_start(&panel->tmr, 2000, tmr_handler, panel);
+	tmr_start(&panel->tmr, UPDATE_INTERVAL, tmr_handler, panel);
 
 	if (panel->ts) {
 		panel->fps = 1000.0 * panel->nframes / (now - panel->ts);
@@ -48,6 +66,7 @@ static void tmr_handler(void *arg)
 	panel->nframes = 0;
 
 	panel->ts = now;
+	panel->dirty = true;
 }
 
 
@@ -58,6 +77,8 @@ static void destructor(void *arg)
 	tmr_cancel(&panel->tmr);
 	mem_deref(panel->label);
 	mem_deref(panel->rrdv);
+	mem_deref(panel->mul);
+	mem_deref(panel->add);
 
 	if (panel->cr)
 		cairo_destroy(panel->cr);
@@ -97,7 +118,8 @@ int panel_alloc(struct panel **panelp, const char *label,
 	panel->cr = cairo_create(panel->surface);
 	if (!panel->surface || !panel->cr) {
 		warning("vidinfo: cairo error\n");
-		return ENOMEM;
+		err = ENOMEM;
+		goto out;
 	}
 
 	cairo_select_font_face (panel->cr, "Hyperfont",
@@ -106,14 +128,20 @@ int panel_alloc(struct panel **panelp, const char *label,
 	cairo_set_font_size (panel->cr, height-2);
 
 	panel->rrdc  = 0;
-	panel->rrdsz = (width - TEXT_WIDTH) / 2;
+	panel->rrdsz = max((width - TEXT_WIDTH) / 2, 1);
 	panel->rrdv  = mem_reallocarray(NULL, panel->rrdsz,
 					sizeof(*panel->rrdv), NULL);
-	if (!panel->rrdv) {
+	panel->mul   = mem_reallocarray(NULL, (size_t)width * height,
+					sizeof(*panel->mul), NULL);
+	panel->add   = mem_reallocarray(NULL, (size_t)width * height,
+					sizeof(*panel->add), NULL);
+	if (!panel->rrdv || !panel->mul || !panel->add) {
 		err = ENOMEM;
 		goto out;
 	}
 
+	panel->dirty = true;
+
 	tmr_start(&panel->tmr, 0, tmr_handler, panel);
 
 	info("new panel '%s' (%u x %u) with RRD size %u\n",
@@ -129,38 +157,38 @@ int panel_alloc(struct panel **panelp, const char *label,
 }
 
 
-static void overlay(struct vidframe *dst, unsigned yoffs, struct vidframe *src)
+/* BT.601 luma of a cairo ARGB32 pixel */
+static inline unsigned rgb2luma(uint32_t px)
 {
-	uint8_t *pdst, *psrc;
-	unsigned x, y;
-
-	pdst = dst->data[0] + yoffs * dst->linesize[0];
-	psrc = src->data[0];
+	unsigned r = (px >> 16) & 0xff;
+	unsigned g = (px >>  8) & 0xff;
+	unsigned b = (px >>  0) & 0xff;
 
-	for (y=0; y<src->size.h; y++) {
+	return ((66*r + 129*g + 25*b + 128) >> 8) + 16;
+}
 
-		for (x=0; x<src->size.w; x++) {
 
-			if (psrc[x] > 127)
-				pdst[x] = psrc[x];
-		}
+/* opaque pixel in the mask */
+static inline void mask_set(struct panel *panel, unsigned x, unsigned y,
+			    uint8_t luma)
+{
+	size_t i = (size_t)y * panel->size.w + x;
 
-		pdst += dst->linesize[0];
-		psrc += src->linesize[0];
-	}
+	panel->mul[i] = 0;
+	panel->add[i] = luma << 8;
 }
 
 
-static int draw_text(struct panel *panel, struct vidframe *frame)
+static int draw_text(struct panel *panel)
 {
 	char buf[256];
 	int width = panel->size_text.w;
 	int height = panel->size_text.h;
-	struct vidframe f;
-	struct vidframe *f2 = NULL;
 	cairo_t *cr = panel->cr;
+	const uint8_t *p;
+	unsigned x, y, w;
+	int stride;
 	double tx, ty;
-	int err;
 
 	tx = 1;
 	ty = height - 3;
@@ -182,40 +210,48 @@ static int draw_text(struct panel *panel, struct vidframe *frame)
 	cairo_set_line_width (cr, 0.6);
 	cairo_stroke (cr);
 
-	vidframe_init_buf(&f, VID_FMT_ARGB, &panel->size_text,
-			  cairo_image_surface_get_data(panel->surface));
+	cairo_surface_flush(panel->surface);
 
-	err = vidframe_alloc(&f2, frame->fmt, &panel->size_text);
-	if (err)
-		goto out;
+	p = cairo_image_surface_get_data(panel->surface);
+	stride = cairo_image_surface_get_stride(panel->surface);
+	w = min(panel->size_text.w, panel->size.w);
 
-	vidconv(f2, &f, 0);
+	/* the bright pixels of the text */
+	for (y=0; y<panel->size_text.h; y++) {
 
-	overlay(frame, panel->yoffs, f2);
+		const uint32_t *px = (const uint32_t *)(p + y * stride);
 
- out:
-	mem_deref(f2);
-	return err;
+		for (x=0; x<w; x++) {
+
+			unsigned luma = rgb2luma(px[x]);
+
+			if (luma > 127)
+				mask_set(panel, x, y, luma);
+		}
+	}
+
+	return 0;
 }
 
 
-static void dim_frame(struct vidframe *frame, unsigned yoffs, unsigned height)
+static void dim_mask(struct panel *panel)
 {
 	unsigned x, y;
-	uint8_t *p;
-	bool lower = (yoffs > 0);
+	bool lower = (panel->yoffs > 0);
 	double grade = lower ? 1.00 : (1.00 - PANEL_HEIGHT/100.0);
+	uint16_t *mul = panel->mul;
 
-	p = frame->data[0] + yoffs * frame->linesize[0];
+	memset(panel->add, 0,
+	       (size_t)panel->size.w * panel->size.h * sizeof(*panel->add));
 
-	/* first dim the background */
-	for (y = 0; y < height; y++) {
+	for (y = 0; y < panel->size.h; y++) {
 
-		for (x = 0; x < frame->size.w; x++) {
-			p[x] = p[x] * grade;
-		}
+		uint16_t m = (uint16_t)(max(grade, 0.0) * 256 + 0.5);
+
+		for (x = 0; x < panel->size.w; x++)
+			mul[x] = m;
 
-		p += frame->linesize[0];
+		mul += panel->size.w;
 
 		if (lower)
 			grade -= 0.01;
@@ -225,15 +261,17 @@ static void dim_frame(struct vidframe *frame, unsigned yoffs, unsigned height)
 }
 
 
-static void draw_graph(struct panel *panel, struct vidframe *frame)
+static void draw_graph(struct panel *panel)
 {
 	uint64_t avg;
-	unsigned y0 = panel->yoffs;
-	size_t i;
+	size_t i, start;
 
 	if (rrd_get_average(panel, &avg))
 		return;
 
+	/* oldest value first */
+	start = (panel->rrdpos + panel->rrdsz - panel->rrdc) % panel->rrdsz;
+
 	for (i=0; i<panel->rrdc; i++) {
 
 		uint64_t value;
@@ -241,7 +279,11 @@ static void draw_graph(struct panel *panel, struct vidframe *frame)
 		unsigned pixels;
 		unsigned x = panel->xoffs + (unsigned)i * 2;
 		unsigned y;
-		value = panel->rrdv[i];
+
+		if (x >= panel->size.w)
+			break;
+
+		value = panel->rrdv[(start + i) % panel->rrdsz];
 
 		ratio = (double)value / (double)avg;
 
@@ -249,13 +291,28 @@ static void draw_graph(struct panel *panel, struct vidframe *frame)
 
 		pixels = min(pixels, panel->size.h);
 
-		y = y0 + panel->size.h - pixels;
-
-		vidframe_draw_vline(frame, x, y, pixels, 220, 220, 220);
+		for (y = panel->size.h - pixels; y < panel->size.h; y++)
+			mask_set(panel, x, y, GRAPH_LUMA);
 	}
 }
 
 
+static int render(struct panel *panel)
+{
+	int err;
+
+	dim_mask(panel);
+
+	err = draw_text(panel);
+	if (err)
+		return err;
+
+	draw_graph(panel);
+
+	return 0;
+}
+
+
 int panel_draw(struct panel *panel, struct vidframe *frame)
 {
 	int err;
@@ -263,12 +320,35 @@ int panel_draw(struct panel *panel, struct vidframe *frame)
 	if (!panel || !frame)
 		return EINVAL;
 
-	dim_frame(frame, panel->yoffs, panel->size.h);
+	/* the panel is drawn on the luma plane */
+	switch (frame->fmt) {
 
-	err = draw_text(panel, frame);
-	if (err)
-		return err;
-	draw_graph(panel, frame);
+	case VID_FMT_YUV420P:
+	case VID_FMT_YUV444P:
+	case VID_FMT_NV12:
+	case VID_FMT_NV21:
+		break;
+
+	default:
+		return ENOTSUP;
+	}
+
+	if (frame->size.w < panel->size.w ||
+	    frame->size.h < panel->yoffs + panel->size.h)
+		return EINVAL;
+
+	if (panel->dirty) {
+
+		err = render(panel);
+		if (err)
+			return err;
+
+		panel->dirty = false;
+	}
+
+	vidconv_blend(frame->data[0] + panel->yoffs * frame->linesize[0],
+		      frame->linesize[0], panel->mul, panel->add,
+		      panel->size.w, panel->size.h);
 
 	return 0;
 }
@@ -149,7 +149,8 @@ static int decode(struct vidfilt_dec_st *_st, struct vidframe *frame)
 
 
 static struct vidfilt vidinfo = {
-	LE_INIT, "vidinfo", encode_update, encode, decode_update, decode
+	LE_INIT, "vidinfo", encode_update, encode, decode_update, decode,
+	false
 };
 
 
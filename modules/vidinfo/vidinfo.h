@@ -21,8 +21,9 @@ struct panel {
 
 	uint64_t *rrdv;
 	size_t rrdsz;
-	size_t rrdc;
-	uint64_t rrd_sum;
+	size_t rrdc;           /* number of values     */
+	size_t rrdpos;         /* next value to write  */
+	uint64_t rrd_sum;      /* sum of all values    */
 
 	unsigned nframes;
 	uint64_t ts;
@@ -31,6 +32,11 @@ struct panel {
 
 	uint64_t pts_prev;
 
+	/* pre-rendered panel, out = (in * mul + add) >> 8 */
+	uint16_t *mul;
+	uint16_t *add;
+	bool dirty;
+
 	/* cairo backend: */
 	cairo_surface_t *surface;
 	cairo_t *cr;
@@ -7,6 +7,7 @@
 #define _BSD_SOURCE 1
 #include <string.h>
 #include <time.h>
+#include <math.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -29,6 +30,19 @@
  \verbatim
   baresip -evv
  \endverbatim
+ *
+ * The benchmark runs a number of frames through the video filters and
+ * the first video codec, without the video source and display, as fast
+ * as possible. It prints the time per frame of each stage, the memory
+ * blocks taken per frame (if libre has MEM_DEBUG), and the PSNR of the
+ * decoded frames.
+ *
+ * The following commands are available:
+ \verbatim
+ v       Start video-loop, or switch the codec on and off
+ V       Stop video-loop
+ F [n]   Benchmark of n frames, through the filters and the codec
+ \endverbatim
  */
 
 
@@ -38,6 +52,12 @@
 #endif
 
 
+enum {
+	BENCH_FRAMES = 300,
+	BENCH_PKTS   = 1024,   /* Max packets per frame */
+};
+
+
 /** Video Statistics */
 struct vstat {
 	uint64_t tsamp;
@@ -59,6 +79,9 @@ struct video_loop {
 	struct vidsrc_st *vsrc;
 	struct list filtencl;
 	struct list filtdecl;
+	struct vidframe_pool *pool_conv;
+	struct vidframe_pool *pool_filt;
+	struct mbuf *mb;
 	struct vstat stat;
 	struct tmr tmr_bw;
 	uint16_t seq;
@@ -70,6 +93,25 @@ struct video_loop {
 static struct video_loop *gvl;
 
 
+/* Frames are reused from a pool that follows the format and size */
+static int pool_frame(struct vidframe **fp, struct vidframe_pool **poolp,
+		      enum vidfmt fmt, const struct vidsz *sz)
+{
+	int err;
+
+	if (!vidframe_pool_match(*poolp, fmt, sz)) {
+
+		*poolp = mem_deref(*poolp);
+
+		err = vidframe_pool_alloc(poolp, fmt, sz, 2);
+		if (err)
+			return err;
+	}
+
+	return vidframe_pool_get(*poolp, fp);
+}
+
+
 static int display(struct video_loop *vl, struct vidframe *frame)
 {
 	struct vidframe *frame_filt = NULL;
@@ -89,8 +131,8 @@ static int display(struct video_loop *vl, struct vidframe *frame)
 		 */
 		if (!frame_filt) {
 
-			err = vidframe_alloc(&frame_filt, frame->fmt,
-					     &frame->size);
+			err = pool_frame(&frame_filt, &vl->pool_filt,
+					 frame->fmt, &frame->size);
 			if (err)
 				return err;
 
@@ -129,9 +171,18 @@ static int packet_handler(bool marker, const uint8_t *hdr, size_t hdr_len,
 	struct mbuf *mb;
 	int err = 0;
 
-	mb = mbuf_alloc(hdr_len + pld_len);
-	if (!mb)
-		return ENOMEM;
+	/* the buffer is reused, unless the decoder kept a reference */
+	if (!vl->mb || mem_nrefs(vl->mb) > 1) {
+
+		vl->mb = mem_deref(vl->mb);
+
+		vl->mb = mbuf_alloc(hdr_len + pld_len);
+		if (!vl->mb)
+			return ENOMEM;
+	}
+
+	mb = vl->mb;
+	mbuf_rewind(mb);
 
 	if (hdr_len)
 		mbuf_write_mem(mb, hdr, hdr_len);
@@ -157,8 +208,6 @@ static int packet_handler(bool marker, const uint8_t *hdr, size_t hdr_len,
 	}
 
  out:
-	mem_deref(mb);
-
 	return 0;
 }
 
@@ -182,7 +231,8 @@ static void vidsrc_frame_handler(struct vidframe *frame, void *arg)
 			vl->need_conv = true;
 		}
 
-		if (vidframe_alloc(&f2, VIDLOOP_INTERNAL_FMT, &frame->size))
+		if (pool_frame(&f2, &vl->pool_conv, VIDLOOP_INTERNAL_FMT,
+			       &frame->size))
 			return;
 
 		vidconv(f2, frame, 0);
@@ -222,6 +272,9 @@ static void vidloop_destructor(void *arg)
 	mem_deref(vl->vidisp);
 	list_flush(&vl->filtencl);
 	list_flush(&vl->filtdecl);
+	mem_deref(vl->pool_conv);
+	mem_deref(vl->pool_filt);
+	mem_deref(vl->mb);
 }
 
 
@@ -235,6 +288,7 @@ static int enable_codec(struct video_loop *vl)
 	prm.pktsize = 1480;
 	prm.bitrate = vl->cfg.bitrate;
 	prm.max_fs  = -1;
+	prm.pkth_mb = NULL;
 
 	/* Use the first video codec */
 
@@ -255,6 +309,14 @@ static int enable_codec(struct video_loop *vl)
 
 	info("vidloop: enabled decoder %s\n", vl->vc_dec->name);
 
+	err = vidcodec_init(vl->vc_enc);
+	if (!err)
+		err = vidcodec_init(vl->vc_dec);
+	if (err) {
+		warning("vidloop: codec init failed: %m\n", err);
+		return err;
+	}
+
 	err = vl->vc_enc->encupdh(&vl->enc, vl->vc_enc, &prm, NULL,
 				  packet_handler, vl);
 	if (err) {
@@ -341,6 +403,7 @@ static int vsrc_reopen(struct video_loop *vl, const struct vidsz *sz)
 
 	prm.orient = VIDORIENT_PORTRAIT;
 	prm.fps    = vl->cfg.fps;
+	prm.pkth   = NULL;
 
 	vl->vsrc = mem_deref(vl->vsrc);
 	err = vidsrc_alloc(&vl->vsrc, vl->cfg.src_mod, NULL, &prm, sz,
@@ -468,9 +531,386 @@ static int vidloop_stop(struct re_printf *pf, void *arg)
 }
 
 
+/*
+ * Benchmark
+ */
+
+
+enum bench_stage {
+	ST_FILT_ENC = 0,
+	ST_ENCODE,
+	ST_DECODE,
+	ST_FILT_DEC,
+	ST_MAX
+};
+
+static const char *stage_namev[ST_MAX] = {
+	"filter-enc", "encode", "decode", "filter-dec"
+};
+
+/** The packets of one encoded frame */
+struct bench {
+	struct mbuf *pktv[BENCH_PKTS];
+	bool markerv[BENCH_PKTS];
+	size_t pktc;
+	uint64_t bytes;
+	int err;
+};
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Adds the time since t to a stage, and returns the time now */
+static uint64_t stage_add(uint64_t *nsv, enum bench_stage st, uint64_t t)
+{
+	const uint64_t now = now_ns();
+
+	nsv[st] += now - t;
+
+	return now;
+}
+
+
+static int bench_packet_handler(bool marker, const uint8_t *hdr,
+				size_t hdr_len, const uint8_t *pld,
+				size_t pld_len, void *arg)
+{
+	struct bench *b = arg;
+	struct mbuf *mb;
+	int err;
+
+	if (b->pktc >= BENCH_PKTS) {
+		b->err = EOVERFLOW;
+		return b->err;
+	}
+
+	/* the buffers are kept from frame to frame */
+	mb = b->pktv[b->pktc];
+	if (!mb) {
+		mb = mbuf_alloc(hdr_len + pld_len);
+		if (!mb)
+			return ENOMEM;
+
+		b->pktv[b->pktc] = mb;
+	}
+
+	mbuf_rewind(mb);
+
+	err  = mbuf_write_mem(mb, hdr, hdr_len);
+	err |= mbuf_write_mem(mb, pld, pld_len);
+	if (err)
+		return err;
+
+	mb->pos = 0;
+
+	b->markerv[b->pktc++] = marker;
+	b->bytes += hdr_len + pld_len;
+
+	return 0;
+}
+
+
+static void bench_destructor(void *arg)
+{
+	struct bench *b = arg;
+	size_t i;
+
+	for (i=0; i<BENCH_PKTS; i++)
+		mem_deref(b->pktv[i]);
+}
+
+
+/* A moving pattern, with edges and smooth parts */
+static void bench_pattern(struct vidframe *f, unsigned n)
+{
+	const unsigned w = f->size.w, h = f->size.h;
+	unsigned x, y;
+
+	for (y=0; y<h; y++) {
+		uint8_t *p = f->data[0] + y * f->linesize[0];
+
+		for (x=0; x<w; x++) {
+			p[x] = (uint8_t)(((x + n * 2) & 0x40) ?
+					 x + y : 255 - y);
+		}
+	}
+
+	for (y=0; y<(h+1)/2; y++) {
+		uint8_t *u = f->data[1] + y * f->linesize[1];
+		uint8_t *v = f->data[2] + y * f->linesize[2];
+
+		for (x=0; x<(w+1)/2; x++) {
+			u[x] = (uint8_t)(128 + (x + n) % 64 - 32);
+			v[x] = (uint8_t)(128 + y % 64 - 32);
+		}
+	}
+}
+
+
+static uint64_t plane_sse(const uint8_t *a, unsigned a_ls,
+			  const uint8_t *b, unsigned b_ls,
+			  unsigned w, unsigned h)
+{
+	uint64_t sse = 0;
+	unsigned x, y;
+
+	for (y=0; y<h; y++) {
+		for (x=0; x<w; x++) {
+			const int d = a[y * a_ls + x] - b[y * b_ls + x];
+			sse += d * d;
+		}
+	}
+
+	return sse;
+}
+
+
+/* Squared error of a YUV420P frame, returns false if not comparable */
+static bool frame_sse(uint64_t *ssep, uint64_t *np,
+		      const struct vidframe *ref, const struct vidframe *f)
+{
+	const unsigned w = ref->size.w, h = ref->size.h;
+	const unsigned cw = (w+1)/2, ch = (h+1)/2;
+	int i;
+
+	if (f->fmt != VID_FMT_YUV420P ||
+	    !vidsz_cmp(&f->size, &ref->size))
+		return false;
+
+	*ssep += plane_sse(ref->data[0], ref->linesize[0],
+			   f->data[0], f->linesize[0], w, h);
+
+	for (i=1; i<3; i++) {
+		*ssep += plane_sse(ref->data[i], ref->linesize[i],
+				   f->data[i], f->linesize[i], cw, ch);
+	}
+
+	*np += w * h + 2 * cw * ch;
+
+	return true;
+}
+
+
+static int vidloop_bench(struct re_printf *pf, uint32_t nframes)
+{
+	struct config *cfg = conf_config();
+	struct list encl = LIST_INIT, decl = LIST_INIT;
+	const struct vidcodec *vc_enc, *vc_dec;
+	struct videnc_state *enc = NULL;
+	struct viddec_state *dec = NULL;
+	struct vidframe *src = NULL, *filt = NULL;
+	struct videnc_param prm;
+	struct memstat mst0, mst1;
+	struct bench *b;
+	struct vidsz size;
+	struct le *le;
+	uint64_t nsv[ST_MAX] = {0}, total = 0, sse = 0, npix = 0;
+	uint32_t i, ncmp = 0;
+	uint16_t seq = 0;
+	bool memst;
+	int err = 0;
+
+	if (!cfg)
+		return EINVAL;
+
+	size.w = cfg->video.width;
+	size.h = cfg->video.height;
+
+	vc_enc = vidcodec_find_encoder(NULL);
+	vc_dec = vidcodec_find_decoder(NULL);
+	if (!vc_enc || !vc_dec) {
+		warning("vidloop: bench: no video codec\n");
+		return ENOENT;
+	}
+
+	b = mem_zalloc(sizeof(*b), bench_destructor);
+	if (!b)
+		return ENOMEM;
+
+	prm.fps     = cfg->video.fps;
+	prm.pktsize = 1480;
+	prm.bitrate = cfg->video.bitrate;
+	prm.max_fs  = -1;
+	prm.pkth_mb = NULL;
+
+	err = vidcodec_init(vc_enc);
+	if (!err)
+		err = vidcodec_init(vc_dec);
+	if (!err)
+		err = vc_enc->encupdh(&enc, vc_enc, &prm, NULL,
+				      bench_packet_handler, b);
+	if (!err && vc_dec->decupdh)
+		err = vc_dec->decupdh(&dec, vc_dec, NULL);
+	if (err) {
+		warning("vidloop: bench: codec update failed (%m)\n", err);
+		goto out;
+	}
+
+	for (le = list_head(vidfilt_list()); le; le = le->next) {
+		struct vidfilt *vf = le->data;
+		void *ctx = NULL;
+
+		err |= vidfilt_enc_append(&encl, &ctx, vf);
+		err |= vidfilt_dec_append(&decl, &ctx, vf);
+	}
+	if (err) {
+		warning("vidloop: bench: vidfilt error (%m)\n", err);
+		goto out;
+	}
+
+	err  = vidframe_alloc(&src, VID_FMT_YUV420P, &size);
+	err |= vidframe_alloc(&filt, VID_FMT_YUV420P, &size);
+	if (err)
+		goto out;
+
+	memst = 0 == mem_get_stat(&mst0);
+
+	for (i=0; i<nframes; i++) {
+
+		struct vidframe frame;
+		size_t j;
+		uint64_t t;
+
+		bench_pattern(src, i);
+		b->pktc = 0;
+
+		t = now_ns();
+
+		for (le = encl.head; le; le = le->next) {
+			struct vidfilt_enc_st *st = le->data;
+
+			if (st->vf->ench)
+				err |= st->vf->ench(st, src);
+		}
+		t = stage_add(nsv, ST_FILT_ENC, t);
+
+		err |= vc_enc->ench(enc, i == 0, src);
+		t = stage_add(nsv, ST_ENCODE, t);
+
+		frame.data[0] = NULL;
+		for (j=0; j<b->pktc; j++) {
+			err |= vc_dec->dech(dec, &frame, b->markerv[j],
+					    seq++, b->pktv[j]);
+		}
+		stage_add(nsv, ST_DECODE, t);
+
+		if (err || b->err) {
+			warning("vidloop: bench: frame %u failed (%m)\n",
+				i, err ? err : b->err);
+			err = err ? err : b->err;
+			goto out;
+		}
+
+		if (!vidframe_isvalid(&frame))
+			continue;
+
+		if (frame_sse(&sse, &npix, src, &frame))
+			++ncmp;
+
+		/* decoders may keep the frame, the filters get a copy */
+		if (list_isempty(&decl) ||
+		    !vidsz_cmp(&frame.size, &filt->size) ||
+		    frame.fmt != filt->fmt)
+			continue;
+
+		vidframe_copy(filt, &frame);
+
+		t = now_ns();
+
+		for (le = decl.head; le; le = le->next) {
+			struct vidfilt_dec_st *st = le->data;
+
+			if (st->vf->dech)
+				err |= st->vf->dech(st, filt);
+		}
+		stage_add(nsv, ST_FILT_DEC, t);
+	}
+
+	memst = memst && 0 == mem_get_stat(&mst1);
+
+	err = re_hprintf(pf, "vidloop bench: %s %u x %u, %u frames"
+			 " at %u bit/s\n",
+			 vc_enc->name, size.w, size.h, nframes, prm.bitrate);
+
+	for (i=0; i<ST_MAX; i++) {
+		total += nsv[i];
+		err |= re_hprintf(pf, "  %-12s %10llu ns/frame\n",
+				  stage_namev[i], nsv[i] / nframes);
+	}
+
+	err |= re_hprintf(pf, "  %-12s %10llu ns/frame (%.1f fps)\n",
+			  "total", total / nframes,
+			  total ? 1e9 * nframes / total : 0.0);
+	err |= re_hprintf(pf, "  %-12s %10llu bit/s (at %u fps)\n",
+			  "bitrate", b->bytes * 8 * prm.fps / nframes,
+			  prm.fps);
+
+	if (ncmp && sse) {
+		err |= re_hprintf(pf, "  %-12s %10.2f dB (%u frames)\n",
+				  "psnr",
+				  10 * log10(255.0 * 255.0 * npix / sse),
+				  ncmp);
+	}
+	else {
+		err |= re_hprintf(pf, "  %-12s %10s (%u frames)\n", "psnr",
+				  ncmp ? "lossless" : "n/a", ncmp);
+	}
+
+	if (memst) {
+		err |= re_hprintf(pf, "  %-12s %10.2f blocks/frame,"
+				  " peak +%zu blocks\n", "memory",
+				  ((double)mst1.blocks_cur -
+				   (double)mst0.blocks_cur) / nframes,
+				  mst1.blocks_peak - mst0.blocks_peak);
+	}
+	else {
+		err |= re_hprintf(pf, "  %-12s %10s\n", "memory",
+				  "n/a (no MEM_DEBUG)");
+	}
+
+ out:
+	list_flush(&encl);
+	list_flush(&decl);
+	mem_deref(enc);
+	mem_deref(dec);
+	mem_deref(src);
+	mem_deref(filt);
+	mem_deref(b);
+
+	return err;
+}
+
+
+static int vidloop_bench_cmd(struct re_printf *pf, void *arg)
+{
+	const struct cmd_arg *carg = arg;
+	uint32_t nframes = BENCH_FRAMES;
+	struct pl pl;
+
+	if (str_isset(carg->prm)) {
+		pl_set_str(&pl, carg->prm);
+		nframes = pl_u32(&pl);
+	}
+
+	if (!nframes)
+		return EINVAL;
+
+	return vidloop_bench(pf, nframes);
+}
+
+
 static const struct cmd cmdv[] = {
-	{'v', 0, "Start video-loop", vidloop_start },
-	{'V', 0, "Stop video-loop",  vidloop_stop  },
+	{'v',       0, "Start video-loop",     vidloop_start     },
+	{'V',       0, "Stop video-loop",      vidloop_stop      },
+	{'F', CMD_PRM, "Video-loop benchmark", vidloop_bench_cmd },
 };
 
 
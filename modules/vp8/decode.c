@@ -40,6 +40,7 @@ struct viddec_state {
 	struct mbuf *mb;
 	bool ctxup;
 	bool started;
+	bool keyframe_wait;   /* reset, the references are stale */
 	uint16_t seq;
 };
 
@@ -100,6 +101,28 @@ int vp8_decode_update(struct viddec_state **vdsp, const struct vidcodec *vc,
 }
 
 
+/**
+ * Reset a kept decoder. Its reference frames are from an earlier part
+ * of the stream, so decoding starts again at the next keyframe, which
+ * replaces all of them.
+ *
+ * @param vds VP8 decoder state
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int vp8_decode_reset(struct viddec_state *vds)
+{
+	if (!vds)
+		return EINVAL;
+
+	mbuf_rewind(vds->mb);
+	vds->started       = false;
+	vds->keyframe_wait = true;
+
+	return 0;
+}
+
+
 static inline int hdr_decode(struct hdr *hdr, struct mbuf *mb)
 {
 	uint8_t v;
@@ -237,6 +260,17 @@ int vp8_decode(struct viddec_state *vds, struct vidframe *frame,
 		return 0;
 	}
 
+	/* the P bit of the payload header is 0 for a keyframe */
+	if (vds->keyframe_wait) {
+
+		if (!vds->mb->end || vds->mb->buf[0] & 0x01) {
+			err = EPROTO;
+			goto out;
+		}
+
+		vds->keyframe_wait = false;
+	}
+
 	res = vpx_codec_decode(&vds->ctx, vds->mb->buf,
 			       (unsigned int)vds->mb->end, NULL, 1);
 	if (res) {
@@ -5,6 +5,7 @@
  */
 
 #include <string.h>
+#include <unistd.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -14,33 +15,71 @@
 
 
 enum {
-	HDR_SIZE = 4,
+	HDR_SIZE     = 4,
+	CPU_USED_MAX = 16,   /**< Fastest realtime speed            */
+	CPLX_STEP    = 4,    /**< Speed step per complexity level   */
+	PKT_POOL_SIZE = 64,  /**< Packets queued in the core        */
 };
 
 
 struct videnc_state {
 	vpx_codec_ctx_t ctx;
+	vpx_codec_enc_cfg_t cfg;
 	struct vidsz size;
 	vpx_codec_pts_t pts;
 	unsigned fps;
 	unsigned bitrate;
 	unsigned pktsize;
 	bool ctxup;
+	unsigned cplx;
 	uint16_t picid;
 	videnc_packet_h *pkth;
+	videnc_packet_mb_h *pkth_mb;
 	void *arg;
+	struct mbuf *pktv[PKT_POOL_SIZE];  /**< Packets passed by reference */
 };
 
 
 static void destructor(void *arg)
 {
 	struct videnc_state *ves = arg;
+	unsigned i;
+
+	for (i=0; i<PKT_POOL_SIZE; i++)
+		mem_deref(ves->pktv[i]);
 
 	if (ves->ctxup)
 		vpx_codec_destroy(&ves->ctx);
 }
 
 
+/* The running encoder takes the new rate, without a keyframe */
+int vp8_encode_bitrate(struct videnc_state *ves, uint32_t bitrate)
+{
+	vpx_codec_err_t res;
+
+	if (!ves)
+		return EINVAL;
+
+	ves->bitrate = bitrate;
+
+	if (!ves->ctxup)
+		return 0;
+
+	ves->cfg.rc_target_bitrate = bitrate / 1000;
+
+	res = vpx_codec_enc_config_set(&ves->ctx, &ves->cfg);
+	if (res) {
+		warning("vp8: enc config: %s\n",
+			vpx_codec_err_to_string(res));
+		vpx_codec_destroy(&ves->ctx);
+		ves->ctxup = false;
+	}
+
+	return 0;
+}
+
+
 int vp8_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 		      struct videnc_param *prm, const char *fmtp,
 		      videnc_packet_h *pkth, void *arg)
@@ -65,19 +104,21 @@ int vp8_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 
 		*vesp = ves;
 	}
-	else {
-		if (ves->ctxup && (ves->bitrate != prm->bitrate ||
-				   ves->fps     != prm->fps)) {
+	else if (ves->ctxup && ves->fps != prm->fps) {
 
-			vpx_codec_destroy(&ves->ctx);
-			ves->ctxup = false;
-		}
+		vpx_codec_destroy(&ves->ctx);
+		ves->ctxup = false;
+	}
+	else if (ves->ctxup && ves->bitrate != prm->bitrate) {
+
+		(void)vp8_encode_bitrate(ves, prm->bitrate);
 	}
 
 	ves->bitrate = prm->bitrate;
 	ves->pktsize = prm->pktsize;
 	ves->fps     = prm->fps;
 	ves->pkth    = pkth;
+	ves->pkth_mb = prm->pkth_mb;
 	ves->arg     = arg;
 
 	max_fs = vp8_max_fs(fmtp);
@@ -88,26 +129,92 @@ int vp8_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 }
 
 
+static unsigned cpu_count(void)
+{
+#if defined (_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (unsigned)n : 1;
+#else
+	return 1;
+#endif
+}
+
+
+/* Threads by picture size, as in WebRTC, unless configured */
+static unsigned encoder_threads(const struct vidsz *size)
+{
+	const unsigned pixels = size->w * size->h;
+	unsigned n;
+
+	if (vp8_conf.threads)
+		return vp8_conf.threads;
+
+	if (pixels >= 1280 * 720)
+		n = 4;
+	else if (pixels >= 640 * 360)
+		n = 2;
+	else
+		n = 1;
+
+	return min(n, cpu_count());
+}
+
+
+/* The configured speed, 4 faster for each complexity level */
+static int cpu_used(const struct videnc_state *ves)
+{
+	return (int)min(vp8_conf.cpu_used + ves->cplx * CPLX_STEP,
+			CPU_USED_MAX);
+}
+
+
+int vp8_encode_cplx(struct videnc_state *ves, unsigned level)
+{
+	vpx_codec_err_t res;
+
+	if (!ves)
+		return EINVAL;
+
+	ves->cplx = min(level, CPLX_LEVEL_MAX);
+
+	if (!ves->ctxup)
+		return 0;
+
+	res = vpx_codec_control(&ves->ctx, VP8E_SET_CPUUSED, cpu_used(ves));
+	if (res) {
+		warning("vp8: codec ctrl: %s\n", vpx_codec_err_to_string(res));
+		return EPROTO;
+	}
+
+	return 0;
+}
+
+
 static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 {
-	vpx_codec_enc_cfg_t cfg;
+	vpx_codec_enc_cfg_t *cfg = &ves->cfg;
 	vpx_codec_err_t res;
+	unsigned threads;
 
-	res = vpx_codec_enc_config_default(&vpx_codec_vp8_cx_algo, &cfg, 0);
+	res = vpx_codec_enc_config_default(&vpx_codec_vp8_cx_algo, cfg, 0);
 	if (res)
 		return EPROTO;
 
-	cfg.g_profile = 2;
-	cfg.g_w = size->w;
-	cfg.g_h = size->h;
-	cfg.g_timebase.num    = 1;
-	cfg.g_timebase.den    = ves->fps;
-	cfg.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
-	cfg.g_pass            = VPX_RC_ONE_PASS;
-	cfg.g_lag_in_frames   = 0;
-	cfg.rc_end_usage      = VPX_VBR;
-	cfg.rc_target_bitrate = ves->bitrate;
-	cfg.kf_mode           = VPX_KF_AUTO;
+	threads = encoder_threads(size);
+
+	cfg->g_profile         = 2;
+	cfg->g_w               = size->w;
+	cfg->g_h               = size->h;
+	cfg->g_threads         = threads;
+	cfg->g_timebase.num    = 1;
+	cfg->g_timebase.den    = ves->fps;
+	cfg->g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
+	cfg->g_pass            = VPX_RC_ONE_PASS;
+	cfg->g_lag_in_frames   = 0;
+	cfg->rc_end_usage      = VPX_VBR;
+	cfg->rc_target_bitrate = ves->bitrate / 1000;
+	cfg->kf_mode           = VPX_KF_AUTO;
 
 	if (ves->ctxup) {
 		debug("vp8: re-opening encoder\n");
@@ -115,7 +222,7 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 		ves->ctxup = false;
 	}
 
-	res = vpx_codec_enc_init(&ves->ctx, &vpx_codec_vp8_cx_algo, &cfg,
+	res = vpx_codec_enc_init(&ves->ctx, &vpx_codec_vp8_cx_algo, cfg,
 				 VPX_CODEC_USE_OUTPUT_PARTITION);
 	if (res) {
 		warning("vp8: enc init: %s\n", vpx_codec_err_to_string(res));
@@ -124,7 +231,16 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 
 	ves->ctxup = true;
 
-	res = vpx_codec_control(&ves->ctx, VP8E_SET_CPUUSED, 16);
+	res = vpx_codec_control(&ves->ctx, VP8E_SET_CPUUSED,
+				cpu_used(ves));
+	if (res) {
+		warning("vp8: codec ctrl: %s\n", vpx_codec_err_to_string(res));
+	}
+
+	/* one token partition per thread, for parallel encoding */
+	res = vpx_codec_control(&ves->ctx, VP8E_SET_TOKEN_PARTITIONS,
+				vp8_conf.parts >= 0 ? vp8_conf.parts
+				: threads >= 4 ? 2 : threads >= 2 ? 1 : 0);
 	if (res) {
 		warning("vp8: codec ctrl: %s\n", vpx_codec_err_to_string(res));
 	}
@@ -134,6 +250,9 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 		warning("vp8: codec ctrl: %s\n", vpx_codec_err_to_string(res));
 	}
 
+	debug("vp8: encoder opened, %u x %u, %u threads\n",
+	      size->w, size->h, threads);
+
 	return 0;
 }
 
@@ -148,30 +267,76 @@ static inline void hdr_encode(uint8_t hdr[HDR_SIZE], bool noref, bool start,
 }
 
 
-static inline int packetize(bool marker, const uint8_t *buf, size_t len,
-			    size_t maxlen, bool noref, uint8_t partid,
-			    uint16_t picid, videnc_packet_h *pkth, void *arg)
+/*
+ * Send one packet. With the handler without copy, the descriptor and
+ * the payload are written into a pooled buffer with headroom for the
+ * RTP header, so the core sends it as is. The packet is copied if all
+ * pooled buffers are still queued in the core.
+ */
+static int pkt_send(struct videnc_state *ves, bool marker,
+		    const uint8_t hdr[HDR_SIZE], const uint8_t *pld,
+		    size_t pld_len)
+{
+	struct mbuf *mb;
+	int err;
+
+	if (ves->pkth_mb)
+		mb = videnc_pkt_get(ves->pktv, PKT_POOL_SIZE, ves->pktsize);
+	else
+		mb = NULL;
+
+	if (!mb)
+		return ves->pkth(marker, hdr, HDR_SIZE, pld, pld_len,
+				 ves->arg);
+
+	err  = mbuf_write_mem(mb, hdr, HDR_SIZE);
+	err |= mbuf_write_mem(mb, pld, pld_len);
+	if (err)
+		goto out;
+
+	mb->pos = VIDENC_PRESZ;
+
+	err = ves->pkth_mb(marker, mb, ves->arg);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/*
+ * Packetize one partition. A packet never spans two partitions, so a
+ * lost packet only damages its own partition, and the packets of a
+ * partition are of equal size instead of ending with a small one.
+ */
+static int packetize(struct videnc_state *ves, bool marker,
+		     const uint8_t *buf, size_t len, bool noref,
+		     uint8_t partid)
 {
+	const size_t maxlen = ves->pktsize - HDR_SIZE;
 	uint8_t hdr[HDR_SIZE];
 	bool start = true;
+	size_t n, sz;
 	int err = 0;
 
-	maxlen -= sizeof(hdr);
+	n  = max((len + maxlen - 1) / maxlen, (size_t)1);
+	sz = (len + n - 1) / n;
 
-	while (len > maxlen) {
+	while (len > sz) {
 
-		hdr_encode(hdr, noref, start, partid, picid);
+		hdr_encode(hdr, noref, start, partid, ves->picid);
 
-		err |= pkth(false, hdr, sizeof(hdr), buf, maxlen, arg);
+		err |= pkt_send(ves, false, hdr, buf, sz);
 
-		buf  += maxlen;
-		len  -= maxlen;
+		buf  += sz;
+		len  -= sz;
 		start = false;
 	}
 
-	hdr_encode(hdr, noref, start, partid, picid);
+	hdr_encode(hdr, noref, start, partid, ves->picid);
 
-	err |= pkth(marker, hdr, sizeof(hdr), buf, len, arg);
+	err |= pkt_send(ves, marker, hdr, buf, len);
 
 	return err;
 }
@@ -244,11 +409,10 @@ int vp8_encode(struct videnc_state *ves, bool update,
 		if (pkt->data.frame.partition_id >= 0)
 			partid = pkt->data.frame.partition_id;
 
-		err = packetize(marker,
+		err = packetize(ves, marker,
 				pkt->data.frame.buf,
 				pkt->data.frame.sz,
-				ves->pktsize, !keyframe, partid, ves->picid,
-				ves->pkth, ves->arg);
+				!keyframe, partid);
 		if (err)
 			return err;
 	}
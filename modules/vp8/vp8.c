@@ -17,6 +17,16 @@
  * This module implements the VP8 video codec that is compatible
  * with the WebRTC standard.
  *
+ * Encoder settings:
+ *
+ \verbatim
+      vp8_threads       0     # 0 is by picture size and cores
+      vp8_cpu_used      16    # realtime speed 0-16, higher is faster
+      vp8_partitions    2     # log2 of token partitions, 0-3
+ \endverbatim
+ *
+ * The token partitions follow the threads unless they are set.
+ *
  * References:
  *
  *     http://www.webmproject.org/
@@ -32,14 +42,33 @@ static struct vp8_vidcodec vp8 = {
 		.ench      = vp8_encode,
 		.decupdh   = vp8_decode_update,
 		.dech      = vp8_decode,
+		.resetth   = vp8_decode_reset,
 		.fmtp_ench = vp8_fmtp_enc,
+		.cplxh     = vp8_encode_cplx,
+		.bitrateh  = vp8_encode_bitrate,
 	},
 	.max_fs   = 3600,
 };
 
 
+struct vp8_conf vp8_conf = {
+	.cpu_used = 16,
+	.parts    = -1,
+};
+
+
 static int module_init(void)
 {
+	struct conf *conf = conf_cur();
+	uint32_t parts;
+
+	conf_get_u32(conf, "vp8_threads", &vp8_conf.threads);
+	conf_get_u32(conf, "vp8_cpu_used", &vp8_conf.cpu_used);
+	if (0 == conf_get_u32(conf, "vp8_partitions", &parts))
+		vp8_conf.parts = min(parts, 3);
+
+	vp8_conf.cpu_used = min(vp8_conf.cpu_used, 16);
+
 	vidcodec_register((struct vidcodec *)&vp8);
 
 	return 0;
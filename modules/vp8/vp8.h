@@ -9,12 +9,22 @@ struct vp8_vidcodec {
 	uint32_t max_fs;
 };
 
+struct vp8_conf {
+	uint32_t threads;   /**< Encoder threads, 0 for picture size    */
+	uint32_t cpu_used;  /**< Realtime speed, higher is faster       */
+	int parts;          /**< log2 of token partitions, -1 for auto */
+};
+
+extern struct vp8_conf vp8_conf;
+
 /* Encode */
 int vp8_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 		      struct videnc_param *prm, const char *fmtp,
 		      videnc_packet_h *pkth, void *arg);
 int vp8_encode(struct videnc_state *ves, bool update,
 	       const struct vidframe *frame);
+int vp8_encode_cplx(struct videnc_state *ves, unsigned level);
+int vp8_encode_bitrate(struct videnc_state *ves, uint32_t bitrate);
 
 
 /* Decode */
@@ -22,6 +32,7 @@ int vp8_decode_update(struct viddec_state **vdsp, const struct vidcodec *vc,
 		      const char *fmtp);
 int vp8_decode(struct viddec_state *vds, struct vidframe *frame,
 	       bool marker, uint16_t seq, struct mbuf *mb);
+int vp8_decode_reset(struct viddec_state *vds);
 
 
 /* SDP */
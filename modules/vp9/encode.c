@@ -5,6 +5,7 @@
  */
 
 #include <string.h>
+#include <unistd.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -14,18 +15,22 @@
 
 
 enum {
-	HDR_SIZE = 3,
+	HDR_SIZE     = 3,
+	CPU_USED_MAX = 9,    /**< Fastest realtime speed            */
+	CPLX_STEP    = 1,    /**< Speed step per complexity level   */
 };
 
 
 struct videnc_state {
 	vpx_codec_ctx_t ctx;
+	vpx_codec_enc_cfg_t cfg;
 	struct vidsz size;
 	vpx_codec_pts_t pts;
 	unsigned fps;
 	unsigned bitrate;
 	unsigned pktsize;
 	bool ctxup;
+	unsigned cplx;
 	uint16_t picid;
 	videnc_packet_h *pkth;
 	void *arg;
@@ -59,6 +64,7 @@ int vp9_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 {
 	const struct vp9_vidcodec *vp9 = (struct vp9_vidcodec *)vc;
 	struct videnc_state *ves;
+	vpx_codec_err_t res;
 	uint32_t max_fs;
 	(void)vp9;
 
@@ -77,10 +83,20 @@ int vp9_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 
 		*vesp = ves;
 	}
-	else {
-		if (ves->ctxup && (ves->bitrate != prm->bitrate ||
-				   ves->fps     != prm->fps)) {
+	else if (ves->ctxup && ves->fps != prm->fps) {
+
+		vpx_codec_destroy(&ves->ctx);
+		ves->ctxup = false;
+	}
+	else if (ves->ctxup && ves->bitrate != prm->bitrate) {
+
+		/* the running encoder takes the new rate, no keyframe */
+		ves->cfg.rc_target_bitrate = prm->bitrate / 1000;
 
+		res = vpx_codec_enc_config_set(&ves->ctx, &ves->cfg);
+		if (res) {
+			warning("vp9: enc config: %s\n",
+				vpx_codec_err_to_string(res));
 			vpx_codec_destroy(&ves->ctx);
 			ves->ctxup = false;
 		}
@@ -100,12 +116,86 @@ int vp9_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 }
 
 
+static unsigned cpu_count(void)
+{
+#if defined (_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (unsigned)n : 1;
+#else
+	return 1;
+#endif
+}
+
+
+static unsigned log2_floor(unsigned n)
+{
+	unsigned l = 0;
+
+	while (n >>= 1)
+		++l;
+
+	return l;
+}
+
+
+/* Threads by picture size, as in WebRTC, unless configured */
+static unsigned encoder_threads(const struct vidsz *size)
+{
+	const unsigned pixels = size->w * size->h;
+	unsigned n;
+
+	if (vp9_conf.threads)
+		return vp9_conf.threads;
+
+	if (pixels >= 1280 * 720)
+		n = 4;
+	else if (pixels >= 640 * 360)
+		n = 2;
+	else
+		n = 1;
+
+	return min(n, cpu_count());
+}
+
+
+/* The configured speed, 1 faster for each complexity level */
+static int cpu_used(const struct videnc_state *ves)
+{
+	return (int)min(vp9_conf.cpu_used + ves->cplx * CPLX_STEP,
+			CPU_USED_MAX);
+}
+
+
+int vp9_encode_cplx(struct videnc_state *ves, unsigned level)
+{
+	vpx_codec_err_t res;
+
+	if (!ves)
+		return EINVAL;
+
+	ves->cplx = min(level, CPLX_LEVEL_MAX);
+
+	if (!ves->ctxup)
+		return 0;
+
+	res = vpx_codec_control(&ves->ctx, VP8E_SET_CPUUSED, cpu_used(ves));
+	if (res) {
+		warning("vp9: codec ctrl: %s\n", vpx_codec_err_to_string(res));
+		return EPROTO;
+	}
+
+	return 0;
+}
+
+
 static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 {
-	vpx_codec_enc_cfg_t cfg;
+	vpx_codec_enc_cfg_t *cfg = &ves->cfg;
 	vpx_codec_err_t res;
+	unsigned threads;
 
-	res = vpx_codec_enc_config_default(&vpx_codec_vp9_cx_algo, &cfg, 0);
+	res = vpx_codec_enc_config_default(&vpx_codec_vp9_cx_algo, cfg, 0);
 	if (res)
 		return EPROTO;
 
@@ -116,17 +206,20 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 	  Profile 3 = 10/12 bit yuv422/440/444p
 	 */
 
-	cfg.g_profile         = 0;
-	cfg.g_w               = size->w;
-	cfg.g_h               = size->h;
-	cfg.g_timebase.num    = 1;
-	cfg.g_timebase.den    = ves->fps;
-	cfg.rc_target_bitrate = ves->bitrate / 1000;
-	cfg.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
-	cfg.g_pass            = VPX_RC_ONE_PASS;
-	cfg.g_lag_in_frames   = 0;
-	cfg.rc_end_usage      = VPX_VBR;
-	cfg.kf_mode           = VPX_KF_AUTO;
+	threads = encoder_threads(size);
+
+	cfg->g_profile         = 0;
+	cfg->g_w               = size->w;
+	cfg->g_h               = size->h;
+	cfg->g_threads         = threads;
+	cfg->g_timebase.num    = 1;
+	cfg->g_timebase.den    = ves->fps;
+	cfg->rc_target_bitrate = ves->bitrate / 1000;
+	cfg->g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
+	cfg->g_pass            = VPX_RC_ONE_PASS;
+	cfg->g_lag_in_frames   = 0;
+	cfg->rc_end_usage      = VPX_VBR;
+	cfg->kf_mode           = VPX_KF_AUTO;
 
 	if (ves->ctxup) {
 		debug("vp9: re-opening encoder\n");
@@ -134,7 +227,7 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 		ves->ctxup = false;
 	}
 
-	res = vpx_codec_enc_init(&ves->ctx, &vpx_codec_vp9_cx_algo, &cfg,
+	res = vpx_codec_enc_init(&ves->ctx, &vpx_codec_vp9_cx_algo, cfg,
 				 0);
 	if (res) {
 		warning("vp9: enc init: %s\n", vpx_codec_err_to_string(res));
@@ -143,10 +236,26 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 
 	ves->ctxup = true;
 
-	res = vpx_codec_control(&ves->ctx, VP8E_SET_CPUUSED, 8);
+	res = vpx_codec_control(&ves->ctx, VP8E_SET_CPUUSED,
+				cpu_used(ves));
 	if (res) {
 		warning("vp9: codec ctrl: %s\n", vpx_codec_err_to_string(res));
 	}
+
+	/* a tile column per thread, each at least 256 pixels wide */
+	res = vpx_codec_control(&ves->ctx, VP9E_SET_TILE_COLUMNS,
+				(int)min(log2_floor(threads),
+					 log2_floor(size->w / 256)));
+	if (res) {
+		warning("vp9: codec ctrl: %s\n", vpx_codec_err_to_string(res));
+	}
+#ifdef VPX_CTRL_VP9E_SET_ROW_MT
+	res = vpx_codec_control(&ves->ctx, VP9E_SET_ROW_MT,
+				(unsigned)vp9_conf.row_mt);
+	if (res) {
+		warning("vp9: codec ctrl: %s\n", vpx_codec_err_to_string(res));
+	}
+#endif
 #ifdef VP9E_SET_NOISE_SENSITIVITY
 	res = vpx_codec_control(&ves->ctx, VP9E_SET_NOISE_SENSITIVITY, 0);
 	if (res) {
@@ -154,7 +263,8 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 	}
 #endif
 
-	info("vp9: encoder opened, picture size %u x %u\n", size->w, size->h);
+	info("vp9: encoder opened, picture size %u x %u, %u threads\n",
+	     size->w, size->h, threads);
 
 	return 0;
 }
@@ -26,6 +26,18 @@
  *     http://www.webmproject.org/
  *
  *     draft-ietf-payload-vp9-02
+ *
+ *
+ * Encoder settings:
+ *
+ \verbatim
+      vp9_threads       0     # 0 is by picture size and cores
+      vp9_cpu_used      8     # realtime speed 5-9, higher is faster
+      vp9_row_mt        yes   # row based multi-threading
+ \endverbatim
+ *
+ * The picture is split in as many tile columns as there are threads,
+ * as far as the width allows.
  */
 
 
@@ -37,13 +49,28 @@ static struct vp9_vidcodec vp9 = {
 		.decupdh   = vp9_decode_update,
 		.dech      = vp9_decode,
 		.fmtp_ench = vp9_fmtp_enc,
+		.cplxh     = vp9_encode_cplx,
 	},
 	.max_fs = 3600
 };
 
 
+struct vp9_conf vp9_conf = {
+	.cpu_used = 8,
+	.row_mt   = true,
+};
+
+
 static int module_init(void)
 {
+	struct conf *conf = conf_cur();
+
+	conf_get_u32(conf, "vp9_threads", &vp9_conf.threads);
+	conf_get_u32(conf, "vp9_cpu_used", &vp9_conf.cpu_used);
+	conf_get_bool(conf, "vp9_row_mt", &vp9_conf.row_mt);
+
+	vp9_conf.cpu_used = min(vp9_conf.cpu_used, 9);
+
 	vidcodec_register((struct vidcodec *)&vp9);
 	return 0;
 }
@@ -9,12 +9,21 @@ struct vp9_vidcodec {
 	uint32_t max_fs;
 };
 
+struct vp9_conf {
+	uint32_t threads;   /**< Encoder threads, 0 for picture size */
+	uint32_t cpu_used;  /**< Realtime speed, higher is faster    */
+	bool row_mt;        /**< Row based multi-threading           */
+};
+
+extern struct vp9_conf vp9_conf;
+
 /* Encode */
 int vp9_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 		      struct videnc_param *prm, const char *fmtp,
 		      videnc_packet_h *pkth, void *arg);
 int vp9_encode(struct videnc_state *ves, bool update,
 	       const struct vidframe *frame);
+int vp9_encode_cplx(struct videnc_state *ves, unsigned level);
 
 
 /* Decode */
@@ -4,7 +4,6 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <string.h>
-#include <stdlib.h>
 #include <re.h>
 #include <baresip.h>
 
@@ -17,24 +16,41 @@
  * The Volume unit (VU) meter module takes the audio-signal as input
  * and prints a simple ASCII-art bar for the recording and playback levels.
  * It is using the aufilt API to get the audio samples.
+ *
+ * The RMS and peak levels are published to the audio stream, where they
+ * are available with audio_level() and from the httpd /metrics page.
+ * With the console display turned off and a measure interval of a few
+ * frames, the filter can stay enabled on production calls.
+ *
+ * Example configuration:
+ \verbatim
+  vumeter_interval        1       # Measure every Nth frame
+  vumeter_display         yes     # Draw the VU-meter on the console
+ \endverbatim
  */
 
 
 struct vumeter_enc {
 	struct aufilt_enc_st af;  /* inheritance */
 	struct tmr tmr;
-	int16_t avg_rec;
-	volatile bool started;
+	struct aulevel own;       /* if the stream has no level */
+	struct aulevel *level;
+	uint32_t framec;
 };
 
 struct vumeter_dec {
 	struct aufilt_dec_st af;  /* inheritance */
 	struct tmr tmr;
-	int16_t avg_play;
-	volatile bool started;
+	struct aulevel own;       /* if the stream has no level */
+	struct aulevel *level;
+	uint32_t framec;
 };
 
 
+static uint32_t interval = 1;
+static bool display = true;
+
+
 static void enc_destructor(void *arg)
 {
 	struct vumeter_enc *st = arg;
@@ -53,44 +69,35 @@ static void dec_destructor(void *arg)
 }
 
 
-static int16_t calc_avg_s16(const int16_t *sampv, size_t sampc)
-{
-	int32_t v = 0;
-	size_t i;
-
-	if (!sampv || !sampc)
-		return 0;
-
-	for (i=0; i<sampc; i++)
-		v += abs(sampv[i]);
-
-	return v/sampc;
-}
-
-
-static int audio_print_vu(struct re_printf *pf, int16_t *avg)
+/* The bar covers -60 to 0 dBov */
+static int audio_print_vu(struct re_printf *pf, const double *rms)
 {
 	char buf[16];
 	size_t res;
 
-	res = min(2 * sizeof(buf) * (*avg)/0x8000,
-		  sizeof(buf)-1);
+	res = (size_t)max((*rms + 60.0) * (sizeof(buf)-1) / 60.0, 0.0);
+	res = min(res, sizeof(buf)-1);
 
 	memset(buf, '=', res);
 	buf[res] = '\0';
 
-	return re_hprintf(pf, "[%-16s]", buf);
+	return re_hprintf(pf, "[%-15s]", buf);
 }
 
 
-static void print_vumeter(int pos, int color, int value)
+static void print_vumeter(int pos, int color, const struct aulevel *lvl)
 {
+	double rms;
+
+	if (aulevel_get(lvl, &rms, NULL))
+		return;
+
 	/* move cursor to a fixed position */
 	re_fprintf(stderr, "\x1b[%dG", pos);
 
 	/* print VU-meter in Nice colors */
 	re_fprintf(stderr, " \x1b[%dm%H\x1b[;m\r",
-		   color, audio_print_vu, &value);
+		   color, audio_print_vu, &rms);
 }
 
 
@@ -100,8 +107,7 @@ static void enc_tmr_handler(void *arg)
 
 	tmr_start(&st->tmr, 100, enc_tmr_handler, st);
 
-	if (st->started)
-		print_vumeter(60, 31, st->avg_rec);
+	print_vumeter(60, 31, st->level);
 }
 
 
@@ -111,8 +117,7 @@ static void dec_tmr_handler(void *arg)
 
 	tmr_start(&st->tmr, 100, dec_tmr_handler, st);
 
-	if (st->started)
-		print_vumeter(80, 32, st->avg_play);
+	print_vumeter(80, 32, st->level);
 }
 
 
@@ -121,7 +126,6 @@ static int encode_update(struct aufilt_enc_st **stp, void **ctx,
 {
 	struct vumeter_enc *st;
 	(void)ctx;
-	(void)prm;
 
 	if (!stp || !af)
 		return EINVAL;
@@ -133,7 +137,10 @@ static int encode_update(struct aufilt_enc_st **stp, void **ctx,
 	if (!st)
 		return ENOMEM;
 
-	tmr_start(&st->tmr, 100, enc_tmr_handler, st);
+	st->level = (prm && prm->level) ? prm->level : &st->own;
+
+	if (display)
+		tmr_start(&st->tmr, 100, enc_tmr_handler, st);
 
 	*stp = (struct aufilt_enc_st *)st;
 
@@ -146,7 +153,6 @@ static int decode_update(struct aufilt_dec_st **stp, void **ctx,
 {
 	struct vumeter_dec *st;
 	(void)ctx;
-	(void)prm;
 
 	if (!stp || !af)
 		return EINVAL;
@@ -158,7 +164,10 @@ static int decode_update(struct aufilt_dec_st **stp, void **ctx,
 	if (!st)
 		return ENOMEM;
 
-	tmr_start(&st->tmr, 100, dec_tmr_handler, st);
+	st->level = (prm && prm->level) ? prm->level : &st->own;
+
+	if (display)
+		tmr_start(&st->tmr, 100, dec_tmr_handler, st);
 
 	*stp = (struct aufilt_dec_st *)st;
 
@@ -170,8 +179,8 @@ static int encode(struct aufilt_enc_st *st, int16_t *sampv, size_t *sampc)
 {
 	struct vumeter_enc *vu = (void *)st;
 
-	vu->avg_rec = calc_avg_s16(sampv, *sampc);
-	vu->started = true;
+	if (vu->framec++ % interval == 0)
+		aulevel_update(vu->level, sampv, *sampc);
 
 	return 0;
 }
@@ -181,8 +190,8 @@ static int decode(struct aufilt_dec_st *st, int16_t *sampv, size_t *sampc)
 {
 	struct vumeter_dec *vu = (void *)st;
 
-	vu->avg_play = calc_avg_s16(sampv, *sampc);
-	vu->started = true;
+	if (vu->framec++ % interval == 0)
+		aulevel_update(vu->level, sampv, *sampc);
 
 	return 0;
 }
@@ -195,6 +204,11 @@ static struct aufilt vumeter = {
 
 static int module_init(void)
 {
+	(void)conf_get_u32(conf_cur(), "vumeter_interval", &interval);
+	(void)conf_get_bool(conf_cur(), "vumeter_display", &display);
+
+	interval = max(interval, 1);
+
 	aufilt_register(&vumeter);
 	return 0;
 }
@@ -403,7 +403,7 @@ static int display(struct vidisp_st *st, const char *title,
 	vidframe_init_buf(&frame_rgb, st->pixfmt, &frame->size,
 			  (uint8_t *)st->shm.shmaddr);
 
-	vidconv(&frame_rgb, frame, 0);
+	vidconv_fast(&frame_rgb, frame, NULL);
 
 	/* draw */
 	if (st->xshmat)
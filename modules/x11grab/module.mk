@@ -4,9 +4,16 @@
 # Copyright (C) 2010 Creytiv.com
 #
 
+USE_XDAMAGE := $(shell [ -f $(SYSROOT)/include/X11/extensions/Xdamage.h ] || \
+	[ -f $(SYSROOT)/local/include/X11/extensions/Xdamage.h ] && echo "yes")
+
 MOD		:= x11grab
 $(MOD)_SRCS	+= x11grab.c
 $(MOD)_LFLAGS	+= -L$(SYSROOT)/X11/lib -lX11 -lXext
 $(MOD)_CFLAGS	+= -Wno-variadic-macros
+ifneq ($(USE_XDAMAGE),)
+$(MOD)_CFLAGS	+= -DUSE_XDAMAGE
+$(MOD)_LFLAGS	+= -lXdamage -lXfixes
+endif
 
 include mk/mod.mk
@@ -11,6 +11,14 @@
 #endif
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#ifdef USE_XDAMAGE
+#include <X11/extensions/Xdamage.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
 #include <pthread.h>
 #include <re.h>
 #include <rem.h>
@@ -22,18 +30,40 @@
  *
  * X11 window-grabbing video-source module
  *
+ * The device selects a window and an offset into it, as
+ * "[<window id>][+<x>,<y>]", e.g. "0x2a00007" or "+1920,0". The default
+ * is the root window from the top left corner.
  *
- * XXX: add option to select a specific X window and x,y offset
+ * Images are grabbed through MIT-SHM when the display is local. With
+ * the XDamage extension, a grab is only done when the captured area has
+ * changed; otherwise the last image is repeated once a second.
  */
 
 
+enum {
+	REPEAT_INTERVAL = 1000,  /* [ms] unchanged image is sent again */
+};
+
+
 struct vidsrc_st {
 	const struct vidsrc *vs;  /* inheritance */
 	Display *disp;
+	Window win;
 	XImage *image;
+	XShmSegmentInfo shm;
+	bool xshmat;
+#ifdef USE_XDAMAGE
+	Damage damage;
+	int damage_event;
+#endif
+	bool dirty;               /* area changed since the last grab */
+	uint64_t ts_frame;
+	unsigned n_grab;
+	unsigned n_repeat;
 	pthread_t thread;
 	bool run;
 	int fps;
+	int x, y;
 	struct vidsz size;
 	enum vidfmt pixfmt;
 	vidsrc_frame_h *frameh;
@@ -43,10 +73,121 @@ struct vidsrc_st {
 
 static struct vidsrc *vidsrc;
 
+static struct {
+	int shm_error;
+	int (*errorh) (Display *, XErrorEvent *);
+} x11;
+
+
+/* NOTE: Global handler */
+static int error_handler(Display *d, XErrorEvent *e)
+{
+	if (e->error_code == BadAccess)
+		x11.shm_error = 1;
+	else if (x11.errorh)
+		return x11.errorh(d, e);
+
+	return 0;
+}
 
-static int x11grab_open(struct vidsrc_st *st, const struct vidsz *sz)
+
+static int parse_device(struct vidsrc_st *st, const char *dev)
 {
-	int x = 0, y = 0;
+	const char *p = dev;
+
+	st->win = RootWindow(st->disp, DefaultScreen(st->disp));
+
+	if (!str_isset(dev))
+		return 0;
+
+	if (*p != '+') {
+		char *end;
+
+		st->win = strtoul(dev, &end, 0);
+		if (end == dev)
+			return EINVAL;
+
+		p = end;
+	}
+
+	if (*p && 2 != sscanf(p, "+%d,%d", &st->x, &st->y))
+		return EINVAL;
+
+	return 0;
+}
+
+
+static int shm_image_alloc(struct vidsrc_st *st, Visual *visual, int depth)
+{
+	if (!XShmQueryExtension(st->disp))
+		return ENOSYS;
+
+	st->image = XShmCreateImage(st->disp, visual, depth, ZPixmap, NULL,
+				    &st->shm, st->size.w, st->size.h);
+	if (!st->image)
+		return ENOMEM;
+
+	st->shm.shmid = shmget(IPC_PRIVATE,
+			       st->image->bytes_per_line * st->image->height,
+			       IPC_CREAT | 0600);
+	if (st->shm.shmid < 0)
+		return ENOMEM;
+
+	st->shm.shmaddr = st->image->data = shmat(st->shm.shmid, NULL, 0);
+	if (st->shm.shmaddr == (char *)-1)
+		return ENOMEM;
+
+	st->shm.readOnly = False;
+
+	x11.shm_error = 0;
+	x11.errorh = XSetErrorHandler(error_handler);
+
+	if (!XShmAttach(st->disp, &st->shm))
+		x11.shm_error = 1;
+
+	XSync(st->disp, False);
+	XSetErrorHandler(x11.errorh);
+
+	/* the segment goes away with the last detach */
+	shmctl(st->shm.shmid, IPC_RMID, NULL);
+
+	if (x11.shm_error)
+		return ENODEV;
+
+	st->xshmat = true;
+
+	return 0;
+}
+
+
+static void image_free(struct vidsrc_st *st)
+{
+	if (st->xshmat) {
+		XShmDetach(st->disp, &st->shm);
+		st->xshmat = false;
+	}
+
+	if (st->image) {
+		if (st->shm.shmaddr != (char *)-1)
+			st->image->data = NULL;
+
+		XDestroyImage(st->image);
+		st->image = NULL;
+	}
+
+	if (st->shm.shmaddr != (char *)-1) {
+		shmdt(st->shm.shmaddr);
+		st->shm.shmaddr = (char *)-1;
+	}
+}
+
+
+static int x11grab_open(struct vidsrc_st *st, const struct vidsz *sz,
+			const char *dev)
+{
+	XWindowAttributes wa;
+	bool damage = false;
+	int err;
 
 	st->disp = XOpenDisplay(NULL);
 	if (!st->disp) {
@@ -54,9 +195,37 @@ static int x11grab_open(struct vidsrc_st *st, const struct vidsz *sz)
 		return ENODEV;
 	}
 
-	st->image = XGetImage(st->disp,
-			      RootWindow(st->disp, DefaultScreen(st->disp)),
-			      x, y, sz->w, sz->h, AllPlanes, ZPixmap);
+	err = parse_device(st, dev);
+	if (err) {
+		warning("x11grab: invalid device '%s'\n", dev);
+		return err;
+	}
+
+	if (!XGetWindowAttributes(st->disp, st->win, &wa)) {
+		warning("x11grab: no window 0x%lx\n", st->win);
+		return ENODEV;
+	}
+
+	if (st->x < 0 || st->y < 0 ||
+	    st->x >= wa.width || st->y >= wa.height) {
+		warning("x11grab: offset %d,%d outside %d x %d\n",
+			st->x, st->y, wa.width, wa.height);
+		return EINVAL;
+	}
+
+	/* crop to the window, in even sizes for the converters */
+	st->size.w = min(sz->w, (unsigned)(wa.width  - st->x)) & ~1;
+	st->size.h = min(sz->h, (unsigned)(wa.height - st->y)) & ~1;
+
+	err = shm_image_alloc(st, wa.visual, wa.depth);
+	if (err) {
+		info("x11grab: shared memory disabled (%m)\n", err);
+		image_free(st);
+
+		st->image = XGetImage(st->disp, st->win, st->x, st->y,
+				      st->size.w, st->size.h,
+				      AllPlanes, ZPixmap);
+	}
 	if (!st->image) {
 		warning("x11grab: error creating Ximage\n");
 		return ENODEV;
@@ -80,23 +249,66 @@ static int x11grab_open(struct vidsrc_st *st, const struct vidsz *sz)
 		return ENOSYS;
 	}
 
+	st->dirty = true;
+
+#ifdef USE_XDAMAGE
+	if (XDamageQueryExtension(st->disp, &st->damage_event, &err)) {
+		st->damage = XDamageCreate(st->disp, st->win,
+					   XDamageReportRawRectangles);
+		damage = st->damage != 0;
+	}
+#endif
+
+	info("x11grab: window 0x%lx +%d,%d %u x %u%s%s\n",
+	     st->win, st->x, st->y, st->size.w, st->size.h,
+	     st->xshmat ? " shm" : "", damage ? " damage" : "");
+
 	return 0;
 }
 
 
-static inline uint8_t *x11grab_read(struct vidsrc_st *st)
+#ifdef USE_XDAMAGE
+/* Find out if the captured area has changed since the last grab */
+static void damage_poll(struct vidsrc_st *st)
 {
-	const int x = 0, y = 0;
-	XImage *im;
+	bool events = false;
+
+	while (XPending(st->disp)) {
+
+		const XDamageNotifyEvent *dev;
+		XEvent ev;
 
-	im = XGetSubImage(st->disp,
-			  RootWindow(st->disp, DefaultScreen(st->disp)),
-			  x, y, st->size.w, st->size.h, AllPlanes, ZPixmap,
-			  st->image, 0, 0);
-	if (!im)
-		return NULL;
+		XNextEvent(st->disp, &ev);
 
-	return (uint8_t *)st->image->data;
+		if (ev.type != st->damage_event + XDamageNotify)
+			continue;
+
+		dev = (XDamageNotifyEvent *)&ev;
+		events = true;
+
+		if (dev->area.x < st->x + (int)st->size.w &&
+		    dev->area.y < st->y + (int)st->size.h &&
+		    dev->area.x + dev->area.width  > st->x &&
+		    dev->area.y + dev->area.height > st->y)
+			st->dirty = true;
+	}
+
+	if (events)
+		XDamageSubtract(st->disp, st->damage, None, None);
+}
+#endif
+
+
+static inline bool x11grab_read(struct vidsrc_st *st)
+{
+	if (st->xshmat) {
+		return XShmGetImage(st->disp, st->win, st->image,
+				    st->x, st->y, AllPlanes);
+	}
+
+	return NULL != XGetSubImage(st->disp, st->win,
+				    st->x, st->y, st->size.w, st->size.h,
+				    AllPlanes, ZPixmap, st->image, 0, 0);
 }
 
 
@@ -106,6 +318,9 @@ static void call_frame_handler(struct vidsrc_st *st, uint8_t *buf)
 
 	vidframe_init_buf(&frame, st->pixfmt, &st->size, buf);
 
+	/* the X image may have padded lines */
+	frame.linesize[0] = st->image->bytes_per_line;
+
 	st->frameh(&frame, st->arg);
 }
 
@@ -114,22 +329,43 @@ static void *read_thread(void *arg)
 {
 	struct vidsrc_st *st = arg;
 	uint64_t ts = tmr_jiffies();
-	uint8_t *buf;
 
 	while (st->run) {
 
-		if (tmr_jiffies() < ts) {
+		uint64_t now = tmr_jiffies();
+
+		if (now < ts) {
 			sys_msleep(4);
 			continue;
 		}
 
-		buf = x11grab_read(st);
-		if (!buf)
+#ifdef USE_XDAMAGE
+		if (st->damage)
+			damage_poll(st);
+		else
+#endif
+			st->dirty = true;
+
+		if (st->dirty) {
+
+			if (!x11grab_read(st))
+				continue;
+
+			st->dirty = false;
+			++st->n_grab;
+		}
+		else if (now < st->ts_frame + REPEAT_INTERVAL) {
+			ts += (1000/st->fps);
 			continue;
+		}
+		else {
+			++st->n_repeat;
+		}
 
 		ts += (1000/st->fps);
+		st->ts_frame = now;
 
-		call_frame_handler(st, buf);
+		call_frame_handler(st, (uint8_t *)st->image->data);
 	}
 
 	return NULL;
@@ -145,8 +381,16 @@ static void destructor(void *arg)
 		pthread_join(st->thread, NULL);
 	}
 
-	if (st->image)
-		XDestroyImage(st->image);
+	debug("x11grab: %u images grabbed, %u repeated\n",
+	      st->n_grab, st->n_repeat);
+
+#ifdef USE_XDAMAGE
+	if (st->damage)
+		XDamageDestroy(st->disp, st->damage);
+#endif
+
+	if (st->disp)
+		image_free(st);
 
 	if (st->disp)
 		XCloseDisplay(st->disp);
@@ -164,7 +408,6 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 
 	(void)ctx;
 	(void)fmt;
-	(void)dev;
 	(void)errorh;
 
 	if (!stp || !prm || !size || !frameh)
@@ -175,12 +418,12 @@ static int alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
 		return ENOMEM;
 
 	st->vs     = vs;
-	st->size   = *size;
+	st->shm.shmaddr = (char *)-1;
 	st->fps    = prm->fps;
 	st->frameh = frameh;
 	st->arg    = arg;
 
-	err = x11grab_open(st, size);
+	err = x11grab_open(st, size, dev);
 	if (err)
 		goto out;
 
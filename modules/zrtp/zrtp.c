@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 #include <zrtp.h>
@@ -22,6 +23,24 @@
  *     This module is using ZRTP implementation in Freeswitch
  *     https://github.com/traviscross/libzrtp
  *
+ * Only the first stream of a session does the Diffie-Hellman exchange.
+ * The other streams, e.g. video, are started when the first one is
+ * secure, and use Multistream mode with the keys of the session. With a
+ * peer that has a retained secret in the cache, Preshared mode can be
+ * used for the first stream as well, which skips the DH computation.
+ * Preshared mode has no perfect forward secrecy of its own, so it is
+ * off by default.
+ *
+ * The SAS of the last secured peer can be verified with 'Z' and no
+ * parameter.
+ *
+ * The following options can be configured:
+ *
+ \verbatim
+  zrtp_multistream    yes     # Multistream mode for the other streams
+  zrtp_preshared      no      # Preshared mode for repeat peers
+ \endverbatim
+ *
  * Thanks:
  *
  *   Ingo Feinerer
@@ -29,24 +48,37 @@
 
 
 enum {
-	PRESZ = 36  /* Preamble size for TURN/STUN header */
+	PRESZ    = 36, /* Preamble size for TURN/STUN header */
+	OVERHEAD = 16, /* Max SRTP authentication tag        */
+	ZID_HEX  = 24, /* Length of a ZID in hex             */
 };
 
 struct menc_sess {
 	zrtp_session_t *zrtp_session;
+	struct lock *lock;       /* Protects medial and secure */
+	struct list medial;      /* Streams of the session     */
+	bool secure;             /* The first stream is secure */
 };
 
 struct menc_media {
+	struct le le;
 	const struct menc_sess *sess;
 	struct udp_helper *uh;
 	struct sa raddr;
 	void *rtpsock;
 	zrtp_stream_t *zrtp_stream;
+	uint32_t ssrc;
+	bool started;
+	bool pending;            /* Waits for the first stream */
 };
 
 
 static zrtp_global_t *zrtp_global;
 static zrtp_config_t zrtp_config;
+static zrtp_profile_t zrtp_profile;
+static bool multistream = true;
+static char last_zid[ZID_HEX + 1];   /* Last secured peer */
+static struct lock *zid_lock;
 
 
 static void session_destructor(void *arg)
@@ -55,6 +87,8 @@ static void session_destructor(void *arg)
 
 	if (st->zrtp_session)
 		zrtp_session_down(st->zrtp_session);
+
+	mem_deref(st->lock);
 }
 
 
@@ -62,6 +96,12 @@ static void media_destructor(void *arg)
 {
 	struct menc_media *st = arg;
 
+	if (st->le.list) {
+		lock_write_get(st->sess->lock);
+		list_unlink(&st->le);
+		lock_rel(st->sess->lock);
+	}
+
 	mem_deref(st->uh);
 	mem_deref(st->rtpsock);
 
@@ -80,19 +120,19 @@ static bool udp_helper_send(int *err, struct sa *dst,
 
 	length = (unsigned int)mbuf_get_left(mb);
 
+	/* the packet is protected in place, with room for the tag */
+	if (mb->size < mb->end + OVERHEAD) {
+		*err = mbuf_resize(mb, mb->end + OVERHEAD);
+		if (*err)
+			return true;
+	}
+
 	s = zrtp_process_rtp(st->zrtp_stream, (char *)mbuf_buf(mb), &length);
 	if (s != zrtp_status_ok) {
 		warning("zrtp: zrtp_process_rtp failed (status = %d)\n", s);
 		return false;
 	}
 
-	/* make sure target buffer is large enough */
-	if (length > mbuf_get_space(mb)) {
-		warning("zrtp: zrtp_process_rtp: length > space (%u > %u)\n",
-			length, mbuf_get_space(mb));
-		*err = ENOMEM;
-	}
-
 	mb->end = mb->pos + length;
 
 	return false;
@@ -141,7 +181,11 @@ static int session_alloc(struct menc_sess **sessp, struct sdp_session *sdp,
 	if (!st)
 		return ENOMEM;
 
-	s = zrtp_session_init(zrtp_global, NULL,
+	err = lock_alloc(&st->lock);
+	if (err)
+		goto out;
+
+	s = zrtp_session_init(zrtp_global, &zrtp_profile,
 			      ZRTP_SIGNALING_ROLE_UNKNOWN, &st->zrtp_session);
 	if (s != zrtp_status_ok) {
 		warning("zrtp: zrtp_session_init failed (status = %d)\n", s);
@@ -159,6 +203,56 @@ static int session_alloc(struct menc_sess **sessp, struct sdp_session *sdp,
 }
 
 
+static bool first_started(const struct menc_sess *sess,
+			  const struct menc_media *self)
+{
+	struct le *le;
+
+	for (le = sess->medial.head; le; le = le->next) {
+
+		const struct menc_media *m = le->data;
+
+		if (m != self && m->started)
+			return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * A stream is started at once if it is the first one, or if the first
+ * one is secure already, so that it can use Multistream mode. Otherwise
+ * it is started when the first stream is secure.
+ */
+static void stream_start(struct menc_media *st)
+{
+	struct menc_sess *sess = (struct menc_sess *)st->sess;
+	zrtp_status_t s;
+	bool wait;
+
+	if (st->started)
+		return;
+
+	lock_write_get(sess->lock);
+	wait = multistream && !sess->secure && first_started(sess, st);
+	st->pending = wait;
+	if (!wait)
+		st->started = true;
+	lock_rel(sess->lock);
+
+	if (wait) {
+		debug("zrtp: stream waits for the first stream\n");
+		return;
+	}
+
+	s = zrtp_stream_start(st->zrtp_stream, st->ssrc);
+	if (s != zrtp_status_ok) {
+		warning("zrtp: zrtp_stream_start: status = %d\n", s);
+	}
+}
+
+
 static int media_alloc(struct menc_media **stp, struct menc_sess *sess,
 		       struct rtp_sock *rtp,
 		       int proto, void *rtpsock, void *rtcpsock,
@@ -198,6 +292,10 @@ static int media_alloc(struct menc_media **stp, struct menc_sess *sess,
 
 	zrtp_stream_set_userdata(st->zrtp_stream, st);
 
+	lock_write_get(sess->lock);
+	list_append(&sess->medial, &st->le, st);
+	lock_rel(sess->lock);
+
  out:
 	if (err) {
 		mem_deref(st);
@@ -209,11 +307,9 @@ static int media_alloc(struct menc_media **stp, struct menc_sess *sess,
  start:
 	if (sa_isset(sdp_media_raddr(sdpm), SA_ALL)) {
 		st->raddr = *sdp_media_raddr(sdpm);
+		st->ssrc  = rtp_sess_ssrc(rtp);
 
-		s = zrtp_stream_start(st->zrtp_stream, rtp_sess_ssrc(rtp));
-		if (s != zrtp_status_ok) {
-			warning("zrtp: zrtp_stream_start: status = %d\n", s);
-		}
+		stream_start(st);
 	}
 
 	return err;
@@ -251,16 +347,63 @@ static int on_send_packet(const zrtp_stream_t *stream,
 }
 
 
+/* start the streams that waited for the first stream */
+static void pending_start(struct menc_sess *sess)
+{
+	struct menc_media *startv[8];
+	size_t i, n = 0;
+	struct le *le;
+
+	lock_write_get(sess->lock);
+
+	sess->secure = true;
+
+	for (le = sess->medial.head; le && n < ARRAY_SIZE(startv);
+	     le = le->next) {
+
+		struct menc_media *m = le->data;
+
+		if (m->pending) {
+			m->pending = false;
+			m->started = true;
+			startv[n++] = m;
+		}
+	}
+
+	lock_rel(sess->lock);
+
+	for (i=0; i<n; i++) {
+
+		zrtp_status_t s;
+
+		s = zrtp_stream_start(startv[i]->zrtp_stream, startv[i]->ssrc);
+		if (s != zrtp_status_ok)
+			warning("zrtp: multistream start: status = %d\n", s);
+	}
+}
+
+
 static void on_zrtp_secure(zrtp_stream_t *stream)
 {
 	const struct menc_media *st = zrtp_stream_get_userdata(stream);
 	const struct menc_sess *sess = st->sess;
 	zrtp_session_info_t sess_info;
 
+	pending_start((struct menc_sess *)sess);
+
 	zrtp_session_get(sess->zrtp_session, &sess_info);
+
+	if (sess_info.peer_zid.length == sizeof(zrtp_zid_t)) {
+		lock_write_get(zid_lock);
+		(void)re_snprintf(last_zid, sizeof(last_zid), "%w",
+				  sess_info.peer_zid.buffer,
+				  (size_t)sess_info.peer_zid.length);
+		lock_rel(zid_lock);
+	}
+
 	if (!sess_info.sas_is_verified && sess_info.sas_is_ready) {
 		info("zrtp: verify SAS <%s> <%s> for remote peer %w"
-		     " (press 'Z' <ZID> to verify)\n",
+		     " (press 'Z' [ZID] to verify)\n",
 		     sess_info.sas1.buffer,
 		     sess_info.sas2.buffer,
 		     sess_info.peer_zid.buffer,
@@ -274,39 +417,55 @@ static struct menc menc_zrtp = {
 };
 
 
+static int verify_zid(const char *zid)
+{
+	char rzid[ZRTP_STRING16] = "";
+	zrtp_status_t s;
+	zrtp_string16_t remote_zid = ZSTR_INIT_EMPTY(remote_zid);
+
+	if (str_len(zid) != ZID_HEX) {
+		warning("zrtp: invalid remote ZID (%s)\n", zid);
+		return EINVAL;
+	}
+
+	(void) str2hex(zid, (int) str_len(zid), rzid, sizeof(rzid));
+	zrtp_zstrncpyc(ZSTR_GV(remote_zid), (const char*)rzid,
+		       sizeof(zrtp_zid_t));
+
+	s = zrtp_cache_set_verified(zrtp_global->cache, ZSTR_GV(remote_zid),
+				    true);
+	if (s != zrtp_status_ok) {
+		warning("zrtp: zrtp_cache_set_verified"
+			" failed (status = %d)\n", s);
+		return EINVAL;
+	}
+
+	info("zrtp: SAS for peer %s verified\n", zid);
+
+	return 0;
+}
+
+
+/* 'Z' <ZID>, or 'Z' for the last secured peer */
 static int verify_sas(struct re_printf *pf, void *arg)
 {
 	const struct cmd_arg *carg = arg;
+	char zid[ZID_HEX + 1];
 	(void)pf;
 
-	if (str_isset(carg->prm)) {
-		char rzid[ZRTP_STRING16] = "";
-		zrtp_status_t s;
-		zrtp_string16_t remote_zid = ZSTR_INIT_EMPTY(remote_zid);
+	if (str_isset(carg->prm))
+		return verify_zid(carg->prm);
 
-		if (str_len(carg->prm) != 24) {
-			warning("zrtp: invalid remote ZID (%s)\n", carg->prm);
-			return EINVAL;
-		}
+	lock_write_get(zid_lock);
+	str_ncpy(zid, last_zid, sizeof(zid));
+	lock_rel(zid_lock);
 
-		(void) str2hex(carg->prm, (int) str_len(carg->prm),
-			       rzid, sizeof(rzid));
-		zrtp_zstrncpyc(ZSTR_GV(remote_zid), (const char*)rzid,
-			       sizeof(zrtp_zid_t));
-
-		s = zrtp_cache_set_verified(zrtp_global->cache,
-					    ZSTR_GV(remote_zid),
-					    true);
-		if (s == zrtp_status_ok)
-			info("zrtp: SAS for peer %s verified\n", carg->prm);
-		else {
-			warning("zrtp: zrtp_cache_set_verified"
-				" failed (status = %d)\n", s);
-			return EINVAL;
-		}
+	if (!zid[0]) {
+		warning("zrtp: no secured peer to verify\n");
+		return ENOENT;
 	}
 
-	return 0;
+	return verify_zid(zid);
 }
 
 
@@ -315,6 +474,51 @@ static const struct cmd cmdv[] = {
 };
 
 
+/*
+ * Order of the key agreement types: Preshared first if enabled, then
+ * the DH and ECDH types of the defaults, and Multistream last.
+ */
+static int profile_init(void)
+{
+	uint8_t pkv[ZRTP_MAX_COMP_COUNT + 1];
+	bool preshared = false;
+	size_t i, n = 0;
+	zrtp_status_t s;
+
+	(void)conf_get_bool(conf_cur(), "zrtp_multistream", &multistream);
+	(void)conf_get_bool(conf_cur(), "zrtp_preshared", &preshared);
+
+	zrtp_profile_defaults(&zrtp_profile, zrtp_global);
+
+	memset(pkv, 0, sizeof(pkv));
+
+	if (preshared)
+		pkv[n++] = ZRTP_PKTYPE_PRESH;
+
+	for (i=0; zrtp_profile.pk_schemes[i] && n < ZRTP_MAX_COMP_COUNT;
+	     i++) {
+
+		const uint8_t pk = zrtp_profile.pk_schemes[i];
+
+		if (pk != ZRTP_PKTYPE_PRESH && pk != ZRTP_PKTYPE_MULT)
+			pkv[n++] = pk;
+	}
+
+	if (multistream && n < ZRTP_MAX_COMP_COUNT)
+		pkv[n++] = ZRTP_PKTYPE_MULT;
+
+	memcpy(zrtp_profile.pk_schemes, pkv, sizeof(pkv));
+
+	s = zrtp_profile_check(&zrtp_profile, zrtp_global);
+	if (s != zrtp_status_ok) {
+		warning("zrtp: invalid profile (status = %d)\n", s);
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+
 static int module_init(void)
 {
 	zrtp_status_t s;
@@ -377,6 +581,14 @@ static int module_init(void)
 		return ENOSYS;
 	}
 
+	err = profile_init();
+	if (err)
+		goto out;
+
+	err = lock_alloc(&zid_lock);
+	if (err)
+		goto out;
+
 	menc_register(&menc_zrtp);
 
 	debug("zrtp:  cache_file:  %s\n",
@@ -385,7 +597,17 @@ static int module_init(void)
 	debug("       zid:         %w\n",
 	      zrtp_config.zid, sizeof(zrtp_config.zid));
 
-	return cmd_register(cmdv, ARRAY_SIZE(cmdv));
+	err = cmd_register(cmdv, ARRAY_SIZE(cmdv));
+
+ out:
+	if (err) {
+		menc_unregister(&menc_zrtp);
+		zid_lock = mem_deref(zid_lock);
+		zrtp_down(zrtp_global);
+		zrtp_global = NULL;
+	}
+
+	return err;
 }
 
 
@@ -399,6 +621,8 @@ static int module_close(void)
 		zrtp_global = NULL;
 	}
 
+	zid_lock = mem_deref(zid_lock);
+
 	return 0;
 }
 
@@ -21,6 +21,7 @@ static void destructor(void *arg)
 
 	list_clear(&acc->aucodecl);
 	list_clear(&acc->vidcodecl);
+	mem_deref(acc->auplan);
 	mem_deref(acc->auth_user);
 	mem_deref(acc->auth_pass);
 	for (i=0; i<ARRAY_SIZE(acc->outbound); i++)
@@ -269,7 +270,7 @@ static int video_codecs_decode(struct account *acc, const struct pl *prm)
 
 static int sip_params_decode(struct account *acc, const struct sip_addr *aor)
 {
-	struct pl auth_user;
+	struct pl auth_user, mwi;
 	size_t i;
 	int err = 0;
 
@@ -282,6 +283,12 @@ static int sip_params_decode(struct account *acc, const struct sip_addr *aor)
 	acc->pubint = 0;
 	err |= param_u32(&acc->pubint, &aor->params, "pubint");
 
+	err |= param_u32(&acc->max_calls, &aor->params, "max_calls");
+
+	acc->mwi = true;
+	if (0 == msg_param_decode(&aor->params, "mwi", &mwi))
+		acc->mwi = 0 != pl_strcasecmp(&mwi, "no");
+
 	err |= param_dstr(&acc->regq, &aor->params, "regq");
 
 	for (i=0; i<ARRAY_SIZE(acc->outbound); i++) {
@@ -493,6 +500,19 @@ uint32_t account_pubint(const struct account *acc)
 }
 
 
+/**
+ * Check if Message Waiting Indication is enabled for an account
+ *
+ * @param acc User-Agent account
+ *
+ * @return True if enabled, false if the account has ;mwi=no
+ */
+bool account_mwi(const struct account *acc)
+{
+	return acc ? acc->mwi : false;
+}
+
+
 enum answermode account_answermode(const struct account *acc)
 {
 	return acc ? acc->answermode : ANSWERMODE_MANUAL;
@@ -552,6 +572,8 @@ int account_debug(struct re_printf *pf, const struct account *acc)
 	err |= re_hprintf(pf, " ptime:        %u\n", acc->ptime);
 	err |= re_hprintf(pf, " regint:       %u\n", acc->regint);
 	err |= re_hprintf(pf, " pubint:       %u\n", acc->pubint);
+	err |= re_hprintf(pf, " max_calls:    %u\n", acc->max_calls);
+	err |= re_hprintf(pf, " mwi:          %s\n", acc->mwi ? "yes" : "no");
 	err |= re_hprintf(pf, " regq:         %s\n", acc->regq);
 	err |= re_hprintf(pf, " rtpkeep:      %s\n", acc->rtpkeep);
 	err |= re_hprintf(pf, " sipnat:       %s\n", acc->sipnat);
@@ -0,0 +1,257 @@
+/**
+ * @file admit.c  Admission control for incoming calls
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <time.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * An incoming INVITE is admitted before anything is allocated for the
+ * call. It is answered with 503 and a Retry-After header while too many
+ * calls are being set up, while the event loop runs late, or while the
+ * process is busy on the CPU. The lag and the load are sampled by a
+ * timer and smoothed, so that one slow handler does not turn calls
+ * away. The Retry-After grows with the overload and is randomized, so
+ * that the rejected callers do not all come back at the same time.
+ */
+
+
+enum {
+	SAMPLE_INTERVAL = 100,      /**< Sampling interval in [ms]          */
+	RATE_WINDOW     = 10000,    /**< Window of the call rates in [ms]   */
+	RETRY_MIN       = 1,        /**< Shortest Retry-After in [s]        */
+	RETRY_MAX       = 60,       /**< Longest Retry-After in [s]         */
+};
+
+
+/** Admission controller */
+struct admit {
+	struct tmr tmr;             /**< Sampling timer                     */
+	uint32_t max_setups;        /**< Max. calls being set up, 0=off     */
+	uint32_t max_lag;           /**< Max. event loop lag [ms], 0=off    */
+	uint32_t max_load;          /**< Max. CPU load [%], 0=off           */
+	uint64_t ts_sample;         /**< Time of the last sample [ms]       */
+	clock_t cpu_sample;         /**< CPU time of the last sample        */
+	uint32_t lag;               /**< Smoothed event loop lag [ms]       */
+	uint32_t load;              /**< Smoothed CPU load [%]              */
+	uint64_t ts_window;         /**< Start of the rate window [ms]      */
+	uint32_t accepted_win;      /**< Calls accepted in this window      */
+	uint32_t rejected_win;      /**< Calls rejected in this window      */
+	uint32_t accepted_rate;     /**< Calls accepted in the last window  */
+	uint32_t rejected_rate;     /**< Calls rejected in the last window  */
+	uint64_t accepted;          /**< Total calls accepted               */
+	uint64_t rejected;          /**< Total calls rejected               */
+};
+
+
+static void destructor(void *arg)
+{
+	struct admit *adm = arg;
+
+	tmr_cancel(&adm->tmr);
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct admit *adm = arg;
+	uint64_t now = tmr_jiffies();
+	clock_t cpu = clock();
+	uint64_t elapsed = now - adm->ts_sample;
+	uint32_t lag = 0, load = 0;
+
+	tmr_start(&adm->tmr, SAMPLE_INTERVAL, tmr_handler, adm);
+
+	if (elapsed > SAMPLE_INTERVAL)
+		lag = (uint32_t)(elapsed - SAMPLE_INTERVAL);
+
+	/* 100% for each busy core */
+	if (elapsed && cpu != (clock_t)-1 && adm->cpu_sample != (clock_t)-1) {
+		uint64_t ms = (uint64_t)(cpu - adm->cpu_sample) * 1000
+			/ CLOCKS_PER_SEC;
+
+		load = (uint32_t)(ms * 100 / elapsed);
+	}
+
+	adm->ts_sample  = now;
+	adm->cpu_sample = cpu;
+
+	admit_update(adm, lag, load);
+}
+
+
+static void window_update(struct admit *adm)
+{
+	uint64_t now = tmr_jiffies();
+
+	if (now - adm->ts_window < RATE_WINDOW)
+		return;
+
+	/* a window without calls in between counts as idle */
+	if (now - adm->ts_window < 2 * RATE_WINDOW) {
+		adm->accepted_rate = adm->accepted_win;
+		adm->rejected_rate = adm->rejected_win;
+	}
+	else {
+		adm->accepted_rate = 0;
+		adm->rejected_rate = 0;
+	}
+
+	adm->accepted_win = 0;
+	adm->rejected_win = 0;
+	adm->ts_window    = now;
+}
+
+
+/* Load in per mille of the limit, 0 if the limit is off */
+static uint32_t ratio(uint32_t val, uint32_t limit)
+{
+	return limit ? (uint32_t)((uint64_t)val * 1000 / limit) : 0;
+}
+
+
+/**
+ * Allocate an admission controller for incoming calls
+ *
+ * @param admp       Pointer to allocated admission controller
+ * @param max_setups Max. number of calls being set up, 0 is unlimited
+ * @param max_lag    Max. event loop lag in [ms], 0 is unlimited
+ * @param max_load   Max. CPU load in [%], 0 is unlimited
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int admit_alloc(struct admit **admp, uint32_t max_setups,
+		uint32_t max_lag, uint32_t max_load)
+{
+	struct admit *adm;
+
+	if (!admp)
+		return EINVAL;
+
+	adm = mem_zalloc(sizeof(*adm), destructor);
+	if (!adm)
+		return ENOMEM;
+
+	adm->max_setups = max_setups;
+	adm->max_lag    = max_lag;
+	adm->max_load   = max_load;
+	adm->ts_window  = tmr_jiffies();
+
+	/* nothing to sample without a limit */
+	if (max_lag || max_load) {
+		adm->ts_sample  = tmr_jiffies();
+		adm->cpu_sample = clock();
+		tmr_start(&adm->tmr, SAMPLE_INTERVAL, tmr_handler, adm);
+	}
+
+	*admp = adm;
+
+	return 0;
+}
+
+
+/**
+ * Add a sample of the event loop lag and the CPU load. This is called
+ * by the sampling timer, and can be called to feed samples by hand.
+ *
+ * @param adm  Admission controller
+ * @param lag  Event loop lag in [ms]
+ * @param load CPU load in [%]
+ */
+void admit_update(struct admit *adm, uint32_t lag, uint32_t load)
+{
+	if (!adm)
+		return;
+
+	adm->lag  = (adm->lag * 7 + lag) / 8;
+	adm->load = (adm->load * 7 + load) / 8;
+}
+
+
+/**
+ * Check if an incoming call can be admitted
+ *
+ * @param adm         Admission controller
+ * @param setups      Number of calls being set up
+ * @param retry_after Returned Retry-After in [s] if rejected
+ *
+ * @return 0 if admitted, EBUSY if overloaded
+ */
+int admit_check(struct admit *adm, uint32_t setups, uint32_t *retry_after)
+{
+	uint32_t r, retry;
+
+	if (!adm)
+		return 0;
+
+	window_update(adm);
+
+	if ((!adm->max_setups || setups < adm->max_setups) &&
+	    (!adm->max_lag    || adm->lag <= adm->max_lag) &&
+	    (!adm->max_load   || adm->load <= adm->max_load)) {
+
+		++adm->accepted;
+		++adm->accepted_win;
+		return 0;
+	}
+
+	++adm->rejected;
+	++adm->rejected_win;
+
+	r = max(ratio(setups, adm->max_setups),
+		max(ratio(adm->lag, adm->max_lag),
+		    ratio(adm->load, adm->max_load)));
+
+	/* 2 seconds at the limit, and twice that at twice the limit */
+	retry = min(max(r / 500, RETRY_MIN), RETRY_MAX);
+	retry = min(retry + rand_u32() % (retry / 2 + 1), RETRY_MAX);
+
+	if (retry_after)
+		*retry_after = retry;
+
+	return EBUSY;
+}
+
+
+/**
+ * Get the number of admitted or rejected calls
+ *
+ * @param adm      Admission controller
+ * @param rejected True for rejected calls, false for admitted calls
+ *
+ * @return Total number of calls
+ */
+uint64_t admit_count(const struct admit *adm, bool rejected)
+{
+	if (!adm)
+		return 0;
+
+	return rejected ? adm->rejected : adm->accepted;
+}
+
+
+int admit_debug(struct re_printf *pf, const struct admit *adm)
+{
+	int err;
+
+	if (!adm)
+		return 0;
+
+	err  = re_hprintf(pf, "\n--- Call admission ---\n");
+	err |= re_hprintf(pf, " limits:   setups=%u lag=%ums load=%u%%\n",
+			  adm->max_setups, adm->max_lag, adm->max_load);
+	err |= re_hprintf(pf, " lag:      %ums\n", adm->lag);
+	err |= re_hprintf(pf, " load:     %u%%\n", adm->load);
+	err |= re_hprintf(pf, " accepted: %llu (%u in %us)\n",
+			  adm->accepted, adm->accepted_rate,
+			  RATE_WINDOW / 1000);
+	err |= re_hprintf(pf, " rejected: %llu (%u in %us)\n",
+			  adm->rejected, adm->rejected_rate,
+			  RATE_WINDOW / 1000);
+
+	return err;
+}
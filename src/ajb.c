@@ -0,0 +1,271 @@
+/**
+ * @file ajb.c  Adaptive Jitter Buffer control
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The adaptive jitter buffer estimates the inter-arrival jitter of the
+ * incoming RTP packets, and computes a target playout delay from it.
+ * The actual buffering is still done by the jitter buffer in libre; this
+ * module decides how many frames the stream releases per received packet:
+ *
+ *   0 -- grow the delay by one frame
+ *   1 -- keep the current delay
+ *   2 -- shrink the delay by one frame (one frame is dropped)
+ *
+ * The delay is only changed at the boundary of a talkspurt, so that the
+ * frame that is held back or dropped is not in the middle of speech. A
+ * boundary is a packet with the RTP marker bit, or a packet after a gap
+ * in the timestamps without a gap in the sequence numbers, which is a
+ * silence period of a sender with DTX. Without either the delay stays
+ * where it is.
+ */
+
+
+enum {
+	WINDOW         = 256,    /**< Packets in the percentile window   */
+	HISTO_SIZE     = 500,    /**< Histogram buckets of 1 [ms]         */
+	PERCENTILE     = 95,     /**< Percentile used for target delay    */
+};
+
+
+struct ajb {
+	uint32_t srate;          /**< RTP clock rate [Hz]                 */
+	uint32_t max;            /**< Maximum delay [frames]              */
+	uint32_t ptime;          /**< Estimated packet time [ms]          */
+	uint32_t fill;           /**< Frames in the jitter buffer         */
+	uint32_t jitter;         /**< RFC 3550 jitter, [ms] scaled by 16  */
+	uint32_t target;         /**< Target delay [frames]               */
+	uint64_t prev_arrival;   /**< Arrival time of previous packet     */
+	uint32_t prev_ts;        /**< RTP timestamp of previous packet    */
+	uint16_t prev_seq;       /**< Sequence number of previous packet  */
+	bool started;            /**< First packet was received           */
+	bool silence;            /**< Silence before the last packet      */
+
+	uint16_t winv[WINDOW];   /**< Last |D| values [ms]                */
+	uint32_t winc;           /**< Number of values in window          */
+	uint32_t wpos;           /**< Next position in window             */
+	uint16_t histo[HISTO_SIZE]; /**< Histogram of values in window    */
+
+	uint32_t n_grow;         /**< Number of delay increases           */
+	uint32_t n_shrink;       /**< Number of delay decreases           */
+};
+
+
+/**
+ * Allocate an adaptive jitter buffer controller
+ *
+ * @param ajbp Pointer to allocated object
+ * @param max  Maximum delay in number of frames
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int ajb_alloc(struct ajb **ajbp, uint32_t max)
+{
+	struct ajb *ajb;
+
+	if (!ajbp || !max)
+		return EINVAL;
+
+	ajb = mem_zalloc(sizeof(*ajb), NULL);
+	if (!ajb)
+		return ENOMEM;
+
+	ajb->max    = max;
+	ajb->target = max;
+
+	*ajbp = ajb;
+
+	return 0;
+}
+
+
+/**
+ * Set the RTP clock rate of the incoming packets
+ *
+ * @param ajb   Adaptive jitter buffer controller
+ * @param srate RTP clock rate in [Hz]
+ */
+void ajb_set_srate(struct ajb *ajb, uint32_t srate)
+{
+	if (!ajb || srate == ajb->srate)
+		return;
+
+	ajb->srate   = srate;
+	ajb->started = false;
+}
+
+
+static void window_add(struct ajb *ajb, uint32_t d)
+{
+	d = min(d, HISTO_SIZE - 1);
+
+	if (ajb->winc == WINDOW)
+		--ajb->histo[ajb->winv[ajb->wpos]];
+	else
+		++ajb->winc;
+
+	ajb->winv[ajb->wpos] = (uint16_t)d;
+	++ajb->histo[d];
+
+	ajb->wpos = (ajb->wpos + 1) % WINDOW;
+}
+
+
+static uint32_t window_percentile(const struct ajb *ajb)
+{
+	uint32_t limit, sum = 0;
+	int i;
+
+	limit = ajb->winc * (100 - PERCENTILE) / 100;
+
+	for (i=HISTO_SIZE-1; i>0; i--) {
+
+		sum += ajb->histo[i];
+		if (sum > limit)
+			break;
+	}
+
+	return i;
+}
+
+
+/**
+ * Register a packet that was put in the jitter buffer
+ *
+ * @param ajb Adaptive jitter buffer controller
+ * @param hdr RTP header of the packet
+ * @param now Arrival time of the packet in [ms]
+ */
+void ajb_put(struct ajb *ajb, const struct rtp_header *hdr, uint64_t now)
+{
+	if (!ajb || !hdr)
+		return;
+
+	ajb->silence = false;
+
+	if (ajb->fill < ajb->max)
+		++ajb->fill;
+
+	if (!ajb->srate)
+		return;
+
+	if (ajb->started) {
+
+		int32_t dts = (int32_t)(hdr->ts - ajb->prev_ts);
+		int64_t dts_ms = (int64_t)dts * 1000 / ajb->srate;
+		int64_t d;
+
+		/* no packet is missing, but some frames are */
+		if (hdr->seq == (uint16_t)(ajb->prev_seq + 1) && dts > 0) {
+
+			if (ajb->ptime && dts_ms >= 2 * ajb->ptime)
+				ajb->silence = true;
+			else
+				ajb->ptime = (uint32_t)dts_ms;
+		}
+
+		/* RFC 3550 A.8 -- difference in relative transit time */
+		d = (int64_t)(now - ajb->prev_arrival) - dts_ms;
+		if (d < 0)
+			d = -d;
+
+		ajb->jitter += (uint32_t)d - ((ajb->jitter + 8) >> 4);
+
+		window_add(ajb, (uint32_t)d);
+	}
+
+	ajb->started      = true;
+	ajb->prev_arrival = now;
+	ajb->prev_ts      = hdr->ts;
+	ajb->prev_seq     = hdr->seq;
+}
+
+
+/**
+ * Register a frame that was taken out of the jitter buffer
+ *
+ * @param ajb Adaptive jitter buffer controller
+ */
+void ajb_get(struct ajb *ajb)
+{
+	if (!ajb || !ajb->fill)
+		return;
+
+	--ajb->fill;
+}
+
+
+/**
+ * Get the number of frames to release from the jitter buffer, after a
+ * packet was received. The delay only changes at a talkspurt boundary.
+ *
+ * @param ajb    Adaptive jitter buffer controller
+ * @param marker True if the packet starts a talkspurt
+ *
+ * @return Number of frames to release (0, 1 or 2)
+ */
+unsigned ajb_release(struct ajb *ajb, bool marker)
+{
+	uint32_t delay, cur;
+
+	if (!ajb || !ajb->ptime)
+		return 1;
+
+	if (!marker && !ajb->silence)
+		return 1;
+
+	/* one frame of margin for the arrival granularity */
+	delay = max(window_percentile(ajb), (ajb->jitter >> 4) * 2);
+	ajb->target = (delay + ajb->ptime - 1) / ajb->ptime + 1;
+	ajb->target = min(ajb->target, ajb->max);
+
+	/* frames left in the buffer after one is released */
+	cur = ajb->fill ? ajb->fill - 1 : 0;
+
+	if (cur > ajb->target) {
+		++ajb->n_shrink;
+		return 2;
+	}
+	else if (cur < ajb->target) {
+		++ajb->n_grow;
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/**
+ * Reset the state after the jitter buffer was flushed
+ *
+ * @param ajb Adaptive jitter buffer controller
+ */
+void ajb_reset(struct ajb *ajb)
+{
+	if (!ajb)
+		return;
+
+	ajb->fill    = 0;
+	ajb->started = false;
+}
+
+
+int ajb_debug(struct re_printf *pf, const struct ajb *ajb)
+{
+	if (!ajb)
+		return 0;
+
+	return re_hprintf(pf, "adaptive: target=%ums cur=%ums jitter=%ums"
+			  " p%u=%ums grow=%u shrink=%u",
+			  ajb->target * ajb->ptime, ajb->fill * ajb->ptime,
+			  ajb->jitter >> 4, PERCENTILE,
+			  window_percentile(ajb),
+			  ajb->n_grow, ajb->n_shrink);
+}
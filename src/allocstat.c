@@ -0,0 +1,134 @@
+/**
+ * @file allocstat.c  Heap allocations per media stage
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <stdlib.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * With USE_ALLOC_STATS the process-wide malloc(), calloc() and realloc()
+ * are wrapped, and every call is counted per thread. A media thread
+ * marks the start of each frame with allocstat_frame(), and the end of
+ * each stage with allocstat_stage(), which adds the allocations since the
+ * last mark to that stage. An allocstat is written by one thread only.
+ *
+ * A steady-state call should show zero allocations per frame in every
+ * stage.
+ */
+
+
+#if defined (USE_ALLOC_STATS)
+
+#ifndef __GLIBC__
+#error "USE_ALLOC_STATS needs the GNU C library"
+#endif
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static __thread uint64_t allocc;
+
+
+void *malloc(size_t size)
+{
+	++allocc;
+	return __libc_malloc(size);
+}
+
+
+void *calloc(size_t nmemb, size_t size)
+{
+	++allocc;
+	return __libc_calloc(nmemb, size);
+}
+
+
+void *realloc(void *ptr, size_t size)
+{
+	++allocc;
+	return __libc_realloc(ptr, size);
+}
+
+
+/**
+ * Mark the start of a frame, in the thread that runs the pipeline
+ *
+ * @param as Allocation statistics
+ */
+void allocstat_frame(struct allocstat *as)
+{
+	if (!as)
+		return;
+
+	as->last = allocc;
+	++as->framec;
+}
+
+
+/**
+ * Add the allocations since the last mark to a stage
+ *
+ * @param as    Allocation statistics
+ * @param stage Media stage
+ */
+void allocstat_stage(struct allocstat *as, enum alloc_stage stage)
+{
+	const uint64_t n = allocc;
+
+	if (!as || stage >= ALLOC_N)
+		return;
+
+	as->allocv[stage] += n - as->last;
+	as->last = n;
+}
+
+#endif
+
+
+static const char *stage_name(enum alloc_stage stage)
+{
+	switch (stage) {
+
+	case ALLOC_DEVICE: return "device";
+	case ALLOC_CONV:   return "conv";
+	case ALLOC_FILT:   return "filt";
+	case ALLOC_CODEC:  return "codec";
+	case ALLOC_RTP:    return "rtp";
+	default:           return "?";
+	}
+}
+
+
+/**
+ * Print the allocations per frame of all stages
+ *
+ * @param pf Print handler
+ * @param as Allocation statistics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int allocstat_debug(struct re_printf *pf, const struct allocstat *as)
+{
+	int err = 0;
+	int stage;
+
+	if (!as || !as->framec)
+		return 0;
+
+	err |= re_hprintf(pf, "   allocs/frame (%llu frames):", as->framec);
+
+	for (stage=0; stage<ALLOC_N; stage++) {
+
+		err |= re_hprintf(pf, " %s=%.2f", stage_name(stage),
+				  (double)as->allocv[stage] / as->framec);
+	}
+
+	err |= re_hprintf(pf, "\n");
+
+	return err;
+}
@@ -0,0 +1,228 @@
+/**
+ * @file aubatch.c  Audio encoders of several calls in one scheduler job
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The audio transmitters with the same encoder and packet time share
+ * one job of the media scheduler, instead of a job each. The job runs
+ * the transmitters of all calls one after the other, so the code and
+ * the tables of the codec stay in the cache of the worker, and there is
+ * one wake-up for all calls. This is worth it for the codecs that do
+ * much work per frame, like Codec2, iLBC and AMR.
+ *
+ * A transmitter is added and removed in the main thread. Its handler
+ * is not running and will not be called once it is removed.
+ */
+
+
+enum {
+	BATCH_INTERVAL = 5,     /**< Job interval [ms], as for one call */
+};
+
+struct abgroup {
+	struct le le;
+	struct list memberl;        /**< Transmitters (struct aubatch)  */
+	struct lock *lock;          /**< Protects memberl and n_run     */
+	struct msched_job *job;
+	const struct aucodec *ac;
+	uint32_t ptime;
+	uint64_t n_run;             /**< Calls of member handlers       */
+};
+
+struct aubatch {
+	struct le le;
+	struct abgroup *grp;
+	aubatch_h *h;
+	void *arg;
+};
+
+
+static struct list groupl;
+
+
+static void group_destructor(void *arg)
+{
+	struct abgroup *grp = arg;
+
+	/* waits for the job, if running */
+	mem_deref(grp->job);
+	list_unlink(&grp->le);
+	mem_deref(grp->lock);
+}
+
+
+static void member_destructor(void *arg)
+{
+	struct aubatch *ab = arg;
+	struct abgroup *grp = ab->grp;
+
+	lock_write_get(grp->lock);
+	list_unlink(&ab->le);
+	lock_rel(grp->lock);
+
+	mem_deref(grp);
+}
+
+
+static void job_handler(void *arg)
+{
+	struct abgroup *grp = arg;
+	struct le *le;
+
+	lock_write_get(grp->lock);
+
+	for (le = grp->memberl.head; le; le = le->next) {
+
+		struct aubatch *ab = le->data;
+
+		ab->h(ab->arg);
+		++grp->n_run;
+	}
+
+	lock_rel(grp->lock);
+}
+
+
+static struct abgroup *group_find(const struct aucodec *ac, uint32_t ptime)
+{
+	struct le *le;
+
+	for (le = groupl.head; le; le = le->next) {
+
+		struct abgroup *grp = le->data;
+
+		if (grp->ac == ac && grp->ptime == ptime)
+			return grp;
+	}
+
+	return NULL;
+}
+
+
+static int group_alloc(struct abgroup **grpp, const struct aucodec *ac,
+		       uint32_t ptime)
+{
+	struct abgroup *grp;
+	int err;
+
+	if (!baresip_msched())
+		return ENOSYS;
+
+	grp = mem_zalloc(sizeof(*grp), group_destructor);
+	if (!grp)
+		return ENOMEM;
+
+	err = lock_alloc(&grp->lock);
+	if (err) {
+		mem_deref(grp);
+		return err;
+	}
+
+	grp->ac    = ac;
+	grp->ptime = ptime;
+
+	list_append(&groupl, &grp->le, grp);
+
+	err = msched_job_alloc(&grp->job, baresip_msched(), BATCH_INTERVAL,
+			       job_handler, grp);
+	if (err) {
+		mem_deref(grp);
+		return err;
+	}
+
+	*grpp = grp;
+
+	return 0;
+}
+
+
+/**
+ * Add an audio transmitter to the batch of its encoder
+ *
+ * @param abp   Pointer to allocated batch member
+ * @param ac    Audio encoder
+ * @param ptime Packet time in [ms]
+ * @param h     Transmit handler, called from a worker thread
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aubatch_add(struct aubatch **abp, const struct aucodec *ac,
+		uint32_t ptime, aubatch_h *h, void *arg)
+{
+	struct abgroup *grp;
+	struct aubatch *ab;
+	int err;
+
+	if (!abp || !ac || !h)
+		return EINVAL;
+
+	grp = group_find(ac, ptime);
+	if (grp) {
+		mem_ref(grp);
+	}
+	else {
+		err = group_alloc(&grp, ac, ptime);
+		if (err)
+			return err;
+	}
+
+	ab = mem_zalloc(sizeof(*ab), member_destructor);
+	if (!ab) {
+		mem_deref(grp);
+		return ENOMEM;
+	}
+
+	ab->grp = grp;
+	ab->h   = h;
+	ab->arg = arg;
+
+	lock_write_get(grp->lock);
+	list_append(&grp->memberl, &ab->le, ab);
+	lock_rel(grp->lock);
+
+	*abp = ab;
+
+	return 0;
+}
+
+
+/**
+ * Print the batches of all audio encoders
+ *
+ * @param pf     Print function
+ * @param unused Unused parameter
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aubatch_debug(struct re_printf *pf, void *unused)
+{
+	struct le *le;
+	int err = 0;
+	(void)unused;
+
+	for (le = groupl.head; le; le = le->next) {
+
+		struct abgroup *grp = le->data;
+		uint32_t n;
+		uint64_t n_run;
+
+		lock_write_get(grp->lock);
+		n     = list_count(&grp->memberl);
+		n_run = grp->n_run;
+		lock_rel(grp->lock);
+
+		err |= re_hprintf(pf, " batch %s/%u/%u ptime=%ums"
+				  " calls=%u runs=%llu\n",
+				  grp->ac->name, grp->ac->srate, grp->ac->ch,
+				  grp->ptime, n, n_run);
+	}
+
+	return err;
+}
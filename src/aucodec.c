@@ -9,7 +9,23 @@
 #include "core.h"
 
 
+enum {
+	HASH_SIZE = 32,
+	BENCH_FRAMES    = 500,   /**< Frames per codec in the benchmark  */
+	BENCH_PTIME     = 20,    /**< Packet time of the benchmark [ms]  */
+	BENCH_DEC_PTIME = 60,    /**< Longest frame a decoder emits [ms] */
+	BENCH_PAYLOAD   = 1500,  /**< Min. size of the packet buffer     */
+};
+
+struct find {
+	uint32_t srate;
+	uint8_t ch;
+	const char *name;
+};
+
 static struct list aucodecl;
+static struct hash *ht_name;     /**< Codecs by name, in list order */
+static uint32_t gen;             /**< Changed with the codec list */
 
 
 /**
@@ -22,7 +38,14 @@ void aucodec_register(struct aucodec *ac)
 	if (!ac)
 		return;
 
+	if (!ht_name && hash_alloc(&ht_name, HASH_SIZE)) {
+		warning("aucodec: %s: out of memory\n", ac->name);
+		return;
+	}
+
 	list_append(&aucodecl, &ac->le, ac);
+	hash_append(ht_name, hash_joaat_str_ci(ac->name), &ac->le_name, ac);
+	++gen;
 
 	info("aucodec: %s/%u/%u\n", ac->name, ac->srate, ac->ch);
 }
@@ -39,31 +62,70 @@ void aucodec_unregister(struct aucodec *ac)
 		return;
 
 	list_unlink(&ac->le);
+	hash_unlink(&ac->le_name);
+	++gen;
+
+	if (list_isempty(&aucodecl))
+		ht_name = mem_deref(ht_name);
+}
+
+
+static bool find_handler(struct le *le, void *arg)
+{
+	const struct aucodec *ac = le->data;
+	const struct find *fd = arg;
+
+	if (fd->name && 0 != str_casecmp(fd->name, ac->name))
+		return false;
+
+	if (fd->srate && fd->srate != ac->srate)
+		return false;
+
+	if (fd->ch && fd->ch != ac->ch)
+		return false;
+
+	return true;
 }
 
 
+/**
+ * Find an Audio Codec, the first registered one that matches
+ *
+ * @param name  Name of the codec, or NULL for any
+ * @param srate Sample rate, or 0 for any
+ * @param ch    Number of channels, or 0 for any
+ *
+ * @return Matching Audio Codec if found, otherwise NULL
+ */
 const struct aucodec *aucodec_find(const char *name, uint32_t srate,
 				   uint8_t ch)
 {
+	struct find fd;
 	struct le *le;
 
-	for (le=aucodecl.head; le; le=le->next) {
-
-		struct aucodec *ac = le->data;
-
-		if (name && 0 != str_casecmp(name, ac->name))
-			continue;
+	fd.name  = name;
+	fd.srate = srate;
+	fd.ch    = ch;
 
-		if (srate && srate != ac->srate)
-			continue;
+	if (name)
+		le = hash_lookup(ht_name, hash_joaat_str_ci(name),
+				 find_handler, &fd);
+	else
+		le = list_apply(&aucodecl, true, find_handler, &fd);
 
-		if (ch && ch != ac->ch)
-			continue;
+	return le ? le->data : NULL;
+}
 
-		return ac;
-	}
 
-	return NULL;
+/**
+ * Get the generation of the list of Audio Codecs, which changes when a
+ * codec is registered or unregistered
+ *
+ * @return Generation number
+ */
+uint32_t aucodec_gen(void)
+{
+	return gen;
 }
 
 
@@ -74,3 +136,124 @@ struct list *aucodec_list(void)
 {
 	return &aucodecl;
 }
+
+
+/* Encode and decode frames of noise, and add up the time of each */
+static int bench_codec(struct re_printf *pf, const struct aucodec *ac)
+{
+	struct auenc_state *enc = NULL;
+	struct audec_state *dec = NULL;
+	struct auenc_param prm;
+	int16_t *sampv = NULL, *outv = NULL;
+	uint8_t *buf = NULL;
+	uint64_t t_enc = 0, t_dec = 0, ts;
+	size_t sampc, outc, bufsz, bytes = 0, i;
+	uint32_t ptime;
+	unsigned n;
+	int err = 0;
+
+	ptime = ac->ptime ? ac->ptime : BENCH_PTIME;
+	sampc = (size_t)ac->srate * ac->ch * ptime / 1000;
+	outc  = (size_t)ac->srate * ac->ch * max(ptime, BENCH_DEC_PTIME)
+		/ 1000;
+	bufsz = max(sampc * sizeof(int16_t), (size_t)BENCH_PAYLOAD);
+
+	if (!sampc || !ac->ench || !ac->dech)
+		return 0;
+
+	sampv = mem_alloc(sampc * sizeof(int16_t), NULL);
+	outv  = mem_alloc(outc * sizeof(int16_t), NULL);
+	buf   = mem_alloc(bufsz, NULL);
+	if (!sampv || !outv || !buf) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	/* noise at -12 dB, so no codec gets an easy frame */
+	for (i = 0; i < sampc; i++)
+		sampv[i] = (int16_t)rand_u16() >> 2;
+
+	prm.ptime = ptime;
+
+	if (ac->encupdh) {
+		err = ac->encupdh(&enc, ac, &prm, NULL);
+		if (err)
+			goto out;
+	}
+
+	if (ac->decupdh) {
+		err = ac->decupdh(&dec, ac, NULL);
+		if (err)
+			goto out;
+	}
+
+	for (n = 0; n < BENCH_FRAMES; n++) {
+
+		size_t len = bufsz;
+		size_t c = outc;
+
+		ts = metric_time_us();
+		err = ac->ench(enc, buf, &len, sampv, sampc);
+		t_enc += metric_time_us() - ts;
+		if (err)
+			goto out;
+
+		ts = metric_time_us();
+		err = ac->dech(dec, outv, &c, buf, len);
+		t_dec += metric_time_us() - ts;
+		if (err)
+			goto out;
+
+		bytes += len;
+	}
+
+	err = re_hprintf(pf, "%-12s %6u %u %3ums %5zu %8.1f %8.1f %8u\n",
+			 ac->name, ac->srate, ac->ch, ptime,
+			 bytes / BENCH_FRAMES,
+			 (double)t_enc / BENCH_FRAMES,
+			 (double)t_dec / BENCH_FRAMES,
+			 (unsigned)(t_enc + t_dec ?
+				    (uint64_t)ptime * 1000 * BENCH_FRAMES
+				    / (t_enc + t_dec) : 0));
+
+ out:
+	if (err)
+		(void)re_hprintf(pf, "%-12s %6u %u: %m\n",
+				 ac->name, ac->srate, ac->ch, err);
+
+	mem_deref(enc);
+	mem_deref(dec);
+	mem_deref(sampv);
+	mem_deref(outv);
+	mem_deref(buf);
+
+	return 0;
+}
+
+
+/**
+ * Benchmark all Audio Codecs, with the time to encode and decode a frame
+ * and the number of calls one CPU core can transcode in real time
+ *
+ * @param pf     Print handler
+ * @param unused Unused parameter
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aucodec_bench(struct re_printf *pf, void *unused)
+{
+	struct le *le;
+	int err;
+
+	(void)unused;
+
+	err = re_hprintf(pf, "Audio codec benchmark (%u frames):\n"
+			 "%-12s %6s %s %5s %5s %8s %8s %8s\n",
+			 BENCH_FRAMES, "codec", "srate", "ch", "ptime",
+			 "bytes", "enc [us]", "dec [us]", "calls");
+
+	for (le = aucodecl.head; le && !err; le = le->next)
+		err = bench_codec(pf, le->data);
+
+	return err;
+}
@@ -53,7 +53,25 @@
  */
 
 enum {
-	AUDIO_SAMPSZ    = 3*1920  /* Max samples, 48000Hz 2ch at 60ms */
+	AUDIO_SAMPSZ    = 3*1920, /* Max samples, 48000Hz 2ch at 60ms */
+	PKT_SIZE        = 4096,   /* Outgoing RTP payload in [bytes]   */
+	DEC_PTIME_MAX   = 60,     /* Longest decoded frame in [ms]     */
+	SID_INTERVAL    = 5000,   /* SID refresh interval in [ms]      */
+	SID_LEVEL_DIFF  = 3,      /* SID on noise level change in [dB] */
+	RATE_LOSS_HIGH  = 5,      /* Loss that lowers the rate [%]     */
+	RATE_LOSS_LOW   = 1,      /* Loss that allows raising it [%]   */
+	RATE_RTT_HIGH   = 400,    /* RTT that lowers the rate [ms]     */
+	RATE_GOOD_MIN   = 3,      /* Good reports before raising it    */
+	PLC_MAX_FRAMES  = 10,     /* Lost frames concealed in a row    */
+	TX_LATE_MAX     = 100,    /* Queued audio, dropped above [ms]  */
+};
+
+/** Class of a received RTP payload type */
+enum pt_class {
+	PTC_UNKNOWN = 0,          /* Not negotiated                    */
+	PTC_CODEC,                /* Audio codec                       */
+	PTC_TELEV,                /* Telephone event                   */
+	PTC_CN,                   /* Comfort noise                     */
 };
 
 
@@ -67,7 +85,7 @@ enum {
 
  .    .-------.   .-------.   .--------.   .--------.   .--------.
  |    |       |   |       |   |        |   |        |   |        |
- |O-->| ausrc |-->| aubuf |-->| resamp |-->| aufilt |-->| encode |---> RTP
+ |O-->| ausrc |-->| auring|-->| resamp |-->| aufilt |-->| encode |---> RTP
  |    |       |   |       |   |        |   |        |   |        |
  '    '-------'   '-------'   '--------'   '--------'   '--------'
 
@@ -79,30 +97,64 @@ struct autx {
 	struct ausrc_prm ausrc_prm;
 	const struct aucodec *ac;     /**< Current audio encoder           */
 	struct auenc_state *enc;      /**< Audio encoder state (optional)  */
-	struct aubuf *aubuf;          /**< Packetize outgoing stream       */
-	struct auresamp resamp;       /**< Optional resampler for DSP      */
+	struct auring *ring;          /**< Packetize outgoing stream       */
+	struct resamp *resamp;        /**< Optional resampler for DSP      */
 	struct list filtl;            /**< Audio filters in encoding order */
+	struct aufilt_chain *fch;     /**< Filter chain float buffer       */
+	struct aulat lat;             /**< Latency per pipeline stage      */
+	struct allocstat alloc;       /**< Allocations in the pipeline     */
+	struct allocstat alloc_src;   /**< Allocations in the source thread*/
+	struct aulevel level;         /**< Level from a level meter filter */
+	uint32_t dev_lat;             /**< Device latency in [us] (atomic) */
 	struct mbuf *mb;              /**< Buffer for outgoing RTP packets */
+	struct mbuf *mb_tel;          /**< Buffer for Telephony Events     */
+	struct lock *lock;            /**< Protects ts, marker and sending */
 	char device[64];              /**< Audio source device name        */
-	int16_t *sampv;               /**< Sample buffer                   */
-	int16_t *sampv_rs;            /**< Sample buffer for resampler     */
 	uint32_t ptime;               /**< Packet time for sending         */
 	uint32_t ts;                  /**< Timestamp for outgoing RTP      */
+	uint32_t ts_pkt;              /**< Timestamp of current packet     */
+	unsigned framec;              /**< Frames in current packet        */
 	uint32_t ts_tel;              /**< Timestamp for Telephony Events  */
 	size_t psize;                 /**< Packet size for sending         */
+	uint32_t loss_pct;            /**< Loss reported by peer (atomic)  */
+	uint32_t loss_enc;            /**< Loss last applied to encoder    */
+	uint32_t rate_step;           /**< Pending rate step, +-1 (atomic) */
+	uint32_t rate_level;          /**< Steps below configured (atomic) */
+	unsigned rate_good;           /**< Good reports since last step    */
+	uint32_t cplx;                /**< Complexity level (atomic)       */
+	uint32_t cplx_enc;            /**< Level last applied to encoder   */
+	struct vad vad;               /**< Voice activity detector         */
+	int pt_cn;                    /**< Payload type for CN, or -1      */
+	int pt_tel;                   /**< Payload type for telev, or -1   */
+	uint32_t ts_sid;              /**< Timestamp of last SID frame     */
+	uint8_t sid_level;            /**< Noise level of last SID frame   */
+	bool sid;                     /**< SID sent in this silence period */
+	uint8_t ext_level;            /**< Loudest frame of packet [-dBov] */
+	bool ext_voice;               /**< Voice in the current packet     */
+	uint32_t n_frames;            /**< Frames from the audio source    */
+	uint32_t n_silent;            /**< Frames suppressed by VAD        */
+	uint32_t n_drop;              /**< Packets dropped, sent too late  */
+	int vad_filt;                 /**< Voice from a VAD filter, or -1  */
 	bool marker;                  /**< Marker bit for outgoing RTP     */
+	bool relayed;                 /**< RTP is relayed from peer (atomic)*/
+	bool moh;                     /**< Music on hold is sent (atomic)  */
+	bool prompt;                  /**< A prompt is sent (atomic)       */
 	bool muted;                   /**< Audio source is muted           */
 	int cur_key;                  /**< Currently transmitted event     */
 
 	union {
-		struct tmr tmr;       /**< Timer for sending RTP packets   */
+		struct twheel_tmr tmr;/**< Timer for sending RTP packets   */
 #ifdef HAVE_PTHREAD
 		struct {
 			pthread_t tid;/**< Audio transmit thread           */
 			bool run;     /**< Audio transmit thread running   */
+			pthread_mutex_t mutex; /**< Protects cond (event)  */
+			pthread_cond_t cond;   /**< Frame ready (event)    */
 		} thr;
+		struct msched_job *job; /**< Media scheduler job       */
 #endif
 	} u;
+	struct aubatch *batch;        /**< Encoder job shared by calls     */
 };
 
 
@@ -115,7 +167,7 @@ struct autx {
 
        .--------.   .-------.   .--------.   .--------.   .--------.
  |\    |        |   |       |   |        |   |        |   |        |
- | |<--| auplay |<--| aubuf |<--| resamp |<--| aufilt |<--| decode |<--- RTP
+ | |<--| auplay |<--| auring|<--| resamp |<--| aufilt |<--| decode |<--- RTP
  |/    |        |   |       |   |        |   |        |   |        |
        '--------'   '-------'   '--------'   '--------'   '--------'
 
@@ -126,14 +178,33 @@ struct aurx {
 	struct auplay_prm auplay_prm;
 	const struct aucodec *ac;     /**< Current audio decoder           */
 	struct audec_state *dec;      /**< Audio decoder state (optional)  */
-	struct aubuf *aubuf;          /**< Incoming audio buffer           */
-	struct auresamp resamp;       /**< Optional resampler for DSP      */
+	struct auring *ring;          /**< Incoming audio buffer           */
+	struct resamp *resamp;        /**< Optional resampler for DSP      */
 	struct list filtl;            /**< Audio filters in decoding order */
+	struct aufilt_chain *fch;     /**< Filter chain float buffer       */
+	struct aulat lat;             /**< Latency per pipeline stage      */
+	struct allocstat alloc;       /**< Allocations in the pipeline     */
+	struct allocstat alloc_play;  /**< Allocations in the player thread*/
+	struct aulevel level;         /**< Level from a level meter filter */
+	uint32_t dev_lat;             /**< Device latency in [us] (atomic) */
 	char device[64];              /**< Audio player device name        */
-	int16_t *sampv;               /**< Sample buffer                   */
-	int16_t *sampv_rs;            /**< Sample buffer for resampler     */
+	const struct call *call;      /**< Call, for the pipeline trace    */
+	int16_t *sampv;               /**< Sample buffer of the decoder    */
+	size_t sampsz;                /**< Size of sampv in [samples]      */
+	size_t sampc_last;            /**< Samples of the last frame       */
+	size_t drain;                 /**< Samples to drain by stretching  */
 	uint32_t ptime;               /**< Packet time for receiving       */
+	uint32_t n_fec;               /**< Frames recovered by FEC         */
+	uint32_t n_late;              /**< Frames late from the jbuf       */
+	uint32_t n_plc;               /**< Frames concealed                */
+	uint32_t n_accel;             /**< Frames shortened                */
+	uint32_t n_expand;            /**< Frames lengthened               */
+	uint32_t cn_amp;              /**< Comfort noise amplitude (atomic)*/
+	uint32_t cn_seed;             /**< Comfort noise generator state   */
+	bool fec_pending;             /**< Lost frame awaits next packet   */
 	int pt;                       /**< Payload type for incoming RTP   */
+	uint8_t ptcv[128];            /**< Class of each payload type      */
+	struct deccache decc;         /**< Idle decoders, by codec         */
 };
 
 
@@ -145,6 +216,13 @@ struct audio {
 	struct stream *strm;          /**< Generic media stream            */
 	struct telev *telev;          /**< Telephony events                */
 	struct config_audio cfg;      /**< Audio configuration             */
+	struct audio *relay;          /**< Peer stream for RTP relay       */
+	struct mbuf *mb_relay;        /**< Buffer for relayed RTP packets  */
+	uint32_t relay_ts;            /**< Timestamp offset to the peer    */
+	uint32_t n_relay;             /**< Number of relayed packets       */
+	struct moh_memb *moh;         /**< Music on hold member            */
+	struct prompt_play *prompt;   /**< Prompt player                   */
+	const struct account *acc;    /**< Account of the call (optional)  */
 	bool started;                 /**< Stream is started flag          */
 	audio_event_h *eventh;        /**< Event handler                   */
 	audio_err_h *errh;            /**< Audio error handler             */
@@ -157,6 +235,8 @@ static void stop_tx(struct autx *tx, struct audio *a)
 	if (!tx || !a)
 		return;
 
+	tx->batch = mem_deref(tx->batch);
+
 	switch (a->cfg.txmode) {
 
 #ifdef HAVE_PTHREAD
@@ -167,9 +247,24 @@ static void stop_tx(struct autx *tx, struct audio *a)
 			pthread_join(tx->u.thr.tid, NULL);
 		}
 		break;
+
+	case AUDIO_MODE_EVENT:
+		if (tx->u.thr.run) {
+			pthread_mutex_lock(&tx->u.thr.mutex);
+			tx->u.thr.run = false;
+			pthread_cond_signal(&tx->u.thr.cond);
+			pthread_mutex_unlock(&tx->u.thr.mutex);
+
+			pthread_join(tx->u.thr.tid, NULL);
+		}
+		break;
+
+	case AUDIO_MODE_SCHEDULER:
+		tx->u.job = mem_deref(tx->u.job);
+		break;
 #endif
 	case AUDIO_MODE_TMR:
-		tmr_cancel(&tx->u.tmr);
+		twheel_tmr_cancel(&tx->u.tmr);
 		break;
 
 	default:
@@ -178,7 +273,7 @@ static void stop_tx(struct autx *tx, struct audio *a)
 
 	/* audio source must be stopped first */
 	tx->ausrc = mem_deref(tx->ausrc);
-	tx->aubuf = mem_deref(tx->aubuf);
+	tx->ring = mem_deref(tx->ring);
 
 	list_flush(&tx->filtl);
 }
@@ -191,7 +286,7 @@ static void stop_rx(struct aurx *rx)
 
 	/* audio player must be stopped first */
 	rx->auplay = mem_deref(rx->auplay);
-	rx->aubuf  = mem_deref(rx->aubuf);
+	rx->ring   = mem_deref(rx->ring);
 
 	list_flush(&rx->filtl);
 }
@@ -201,18 +296,34 @@ static void audio_destructor(void *arg)
 {
 	struct audio *a = arg;
 
+	a->moh = mem_deref(a->moh);
+	a->prompt = mem_deref(a->prompt);
+	(void)audio_relay(a, NULL);
+
 	stop_tx(&a->tx, a);
 	stop_rx(&a->rx);
 
+#ifdef HAVE_PTHREAD
+	if (a->cfg.txmode == AUDIO_MODE_EVENT) {
+		pthread_cond_destroy(&a->tx.u.thr.cond);
+		pthread_mutex_destroy(&a->tx.u.thr.mutex);
+	}
+#endif
+
 	mem_deref(a->tx.enc);
 	mem_deref(a->rx.dec);
-	mem_deref(a->tx.aubuf);
+	deccache_flush(&a->rx.decc);
+	mem_deref(a->tx.ring);
 	mem_deref(a->tx.mb);
-	mem_deref(a->tx.sampv);
+	mem_deref(a->tx.mb_tel);
+	mem_deref(a->tx.lock);
+	mem_deref(a->mb_relay);
 	mem_deref(a->rx.sampv);
-	mem_deref(a->rx.aubuf);
-	mem_deref(a->tx.sampv_rs);
-	mem_deref(a->rx.sampv_rs);
+	mem_deref(a->rx.ring);
+	mem_deref(a->tx.resamp);
+	mem_deref(a->rx.resamp);
+	mem_deref(a->tx.fch);
+	mem_deref(a->rx.fch);
 
 	list_flush(&a->tx.filtl);
 	list_flush(&a->rx.filtl);
@@ -238,6 +349,18 @@ static inline uint32_t calc_nsamp(uint32_t srate, uint8_t channels,
 }
 
 
+/* Duration of the samples in a ring-buffer, in [us] */
+static uint32_t ring_delay(const struct auring *ar, uint32_t srate,
+			   uint8_t ch)
+{
+	if (!srate || !ch)
+		return 0;
+
+	return (uint32_t)(1000000ULL * (auring_cur_size(ar) / 2)
+			  / (srate * ch));
+}
+
+
 /**
  * Get the DSP samplerate for an audio-codec (exception for G.722 and MPA)
  */
@@ -262,13 +385,50 @@ static inline uint32_t get_ch(const struct aucodec *ac)
 }
 
 
-static inline uint32_t get_framesize(const struct aucodec *ac,
-				     uint32_t ptime)
+/*
+ * Codec frame time for sending. Codecs with a fixed frame length send
+ * several frames per packet if the packet time is a multiple of it.
+ */
+static uint32_t autx_frame_ptime(const struct autx *tx)
 {
-	if (!ac)
+	const struct aucodec *ac = tx->ac;
+
+	if (ac && ac->ptime && tx->ptime > ac->ptime &&
+	    tx->ptime % ac->ptime == 0)
+		return ac->ptime;
+
+	return tx->ptime;
+}
+
+
+static unsigned autx_frames(const struct autx *tx)
+{
+	return tx->ptime / autx_frame_ptime(tx);
+}
+
+
+/* Number of bytes read from the ring-buffer for one codec frame */
+static void autx_update_psize(struct autx *tx)
+{
+	tx->psize = 2 * calc_nsamp(tx->ausrc_prm.srate, tx->ausrc_prm.ch,
+				   autx_frame_ptime(tx));
+	tx->framec = 0;
+}
+
+
+/*
+ * The packet buffer has room for a packet of 16-bit PCM at 48000 Hz
+ * stereo, such as L16. It is resized only while the source is stopped.
+ */
+static int autx_mb_fit(struct autx *tx)
+{
+	const size_t sz = STREAM_PRESZ +
+		max(PKT_SIZE, 2 * calc_nsamp(48000, 2, tx->ptime));
+
+	if (tx->ausrc || tx->mb->size >= sz)
 		return 0;
 
-	return calc_nsamp(get_srate(ac), get_ch(ac), ptime);
+	return mbuf_resize(tx->mb, sz);
 }
 
 
@@ -281,18 +441,59 @@ static bool aucodec_equal(const struct aucodec *a, const struct aucodec *b)
 }
 
 
-static int add_audio_codec(struct audio *a, struct sdp_media *m,
-			   struct aucodec *ac)
+/*
+ * The formats to offer only depend on the codec list and the audio
+ * config, so they are worked out once per account and kept. The plan
+ * is made again when a codec is registered or unregistered, or when
+ * the audio range or VAD setting has changed.
+ */
+struct audio_plan {
+	struct aucodec **acv;         /**< Codecs within the audio range   */
+	uint32_t *cnv;                /**< Clock rates for Comfort Noise   */
+	size_t acc;                   /**< Number of codecs                */
+	size_t cnc;                   /**< Number of Comfort Noise rates   */
+	const struct list *aucodecl;  /**< Codec list of the plan          */
+	uint32_t gen;                 /**< Generation of the codec list    */
+	struct range srate;
+	struct range channels;
+	bool vad;
+};
+
+
+static void plan_destructor(void *arg)
+{
+	struct audio_plan *plan = arg;
+
+	mem_deref(plan->acv);
+	mem_deref(plan->cnv);
+}
+
+
+static bool plan_valid(const struct audio_plan *plan,
+		       const struct config_audio *cfg,
+		       const struct list *aucodecl)
+{
+	return plan && plan->aucodecl == aucodecl &&
+		plan->gen == aucodec_gen() &&
+		plan->srate.min == cfg->srate.min &&
+		plan->srate.max == cfg->srate.max &&
+		plan->channels.min == cfg->channels.min &&
+		plan->channels.max == cfg->channels.max &&
+		plan->vad == cfg->vad;
+}
+
+
+static int plan_add_codec(struct audio_plan *plan, struct aucodec *ac)
 {
-	if (!in_range(&a->cfg.srate, get_srate(ac))) {
+	if (!in_range(&plan->srate, get_srate(ac))) {
 		debug("audio: skip %uHz codec (audio range %uHz - %uHz)\n",
-		      get_srate(ac), a->cfg.srate.min, a->cfg.srate.max);
+		      get_srate(ac), plan->srate.min, plan->srate.max);
 		return 0;
 	}
 
-	if (!in_range(&a->cfg.channels, get_ch(ac))) {
+	if (!in_range(&plan->channels, get_ch(ac))) {
 		debug("audio: skip codec with %uch (audio range %uch-%uch)\n",
-		      get_ch(ac), a->cfg.channels.min, a->cfg.channels.max);
+		      get_ch(ac), plan->channels.min, plan->channels.max);
 		return 0;
 	}
 
@@ -301,9 +502,142 @@ static int add_audio_codec(struct audio *a, struct sdp_media *m,
 		return EINVAL;
 	}
 
-	return sdp_format_add(NULL, m, false, ac->pt, ac->name, ac->crate,
-			      ac->ch, ac->fmtp_ench, ac->fmtp_cmph, ac, false,
-			      "%s", ac->fmtp);
+	plan->acv[plan->acc++] = ac;
+
+	return 0;
+}
+
+
+/* One Comfort Noise format for each RTP clock rate of the codecs */
+static void plan_add_cn(struct audio_plan *plan, const struct aucodec *ac)
+{
+	size_t i;
+
+	for (i=0; i<plan->cnc; i++) {
+		if (plan->cnv[i] == ac->crate)
+			return;
+	}
+
+	plan->cnv[plan->cnc++] = ac->crate;
+}
+
+
+/**
+ * Get the audio formats to offer for a codec list, made again only if
+ * the codec list or the audio config has changed
+ *
+ * @param planp    Pointer to the cached plan, updated
+ * @param cfg      Audio configuration
+ * @param aucodecl List of audio codecs
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int audio_plan_get(struct audio_plan **planp,
+		   const struct config_audio *cfg,
+		   const struct list *aucodecl)
+{
+	struct audio_plan *plan;
+	struct le *le;
+	size_t n;
+	int err = 0;
+
+	if (!planp || !cfg)
+		return EINVAL;
+
+	if (plan_valid(*planp, cfg, aucodecl))
+		return 0;
+
+	*planp = mem_deref(*planp);
+
+	plan = mem_zalloc(sizeof(*plan), plan_destructor);
+	if (!plan)
+		return ENOMEM;
+
+	n = list_count(aucodecl) + 1;
+
+	plan->acv = mem_zalloc(n * sizeof(*plan->acv), NULL);
+	plan->cnv = mem_zalloc(n * sizeof(*plan->cnv), NULL);
+	if (!plan->acv || !plan->cnv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	plan->aucodecl = aucodecl;
+	plan->gen      = aucodec_gen();
+	plan->srate    = cfg->srate;
+	plan->channels = cfg->channels;
+	plan->vad      = cfg->vad;
+
+	for (le = list_head(aucodecl); le; le = le->next) {
+
+		err = plan_add_codec(plan, le->data);
+		if (err)
+			goto out;
+
+		if (plan->vad)
+			plan_add_cn(plan, le->data);
+	}
+
+ out:
+	if (err)
+		mem_deref(plan);
+	else
+		*planp = plan;
+
+	return err;
+}
+
+
+static int add_audio_codecs(struct audio *a, const struct audio_plan *plan)
+{
+	struct sdp_media *m = stream_sdpmedia(audio_strm(a));
+	size_t i;
+	int err;
+
+	for (i=0; i<plan->acc; i++) {
+
+		struct aucodec *ac = plan->acv[i];
+
+		err = sdp_format_add(NULL, m, false, ac->pt, ac->name,
+				     ac->crate, ac->ch, ac->fmtp_ench,
+				     ac->fmtp_cmph, ac, false,
+				     "%s", ac->fmtp);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Send a SID frame at the start of a silence period, when the noise
+ * level changes, and every SID_INTERVAL while silent. The packet
+ * buffer is free here, since a pending packet was sent above.
+ */
+static void send_sid(struct audio *a, struct autx *tx)
+{
+	uint8_t level = vad_level(&tx->vad);
+	uint32_t interval = tx->ac->crate / 1000 * SID_INTERVAL;
+	int err;
+
+	if (tx->sid && abs(level - tx->sid_level) < SID_LEVEL_DIFF &&
+	    tx->ts - tx->ts_sid < interval)
+		return;
+
+	tx->mb->pos = tx->mb->end = STREAM_PRESZ;
+	(void)mbuf_write_u8(tx->mb, level);
+	tx->mb->pos = STREAM_PRESZ;
+
+	stream_set_audio_level(a->strm, level, false);
+
+	err = stream_send(a->strm, false, tx->pt_cn, tx->ts, tx->mb);
+	if (err)
+		return;
+
+	tx->sid       = true;
+	tx->sid_level = level;
+	tx->ts_sid    = tx->ts;
 }
 
 
@@ -323,94 +657,248 @@ static void encode_rtp_send(struct audio *a, struct autx *tx,
 	size_t frame_size;  /* number of samples per channel */
 	size_t sampc_rtp;
 	size_t len;
+	uint64_t ts, now;
+	const bool ext = stream_has_rtpext(a->strm, RTPEXT_AUDIO_LEVEL);
+	bool silent = false, voice = true, buffering;
 	int err;
 
 	if (!tx->ac)
 		return;
 
-	tx->mb->pos = tx->mb->end = STREAM_PRESZ;
+	lock_write_get(tx->lock);
+
+	/* the peer stream took over, after these samples were read */
+	if (ATOMIC_LOAD(&tx->relayed)) {
+		err = 0;
+		goto out;
+	}
+
+	/* Let the encoder adapt its redundancy to the reported loss */
+	if (tx->ac->lossh) {
+		uint32_t loss = ATOMIC_LOAD(&tx->loss_pct);
+
+		if (loss != tx->loss_enc) {
+			(void)tx->ac->lossh(tx->enc, loss);
+			tx->loss_enc = loss;
+		}
+	}
+
+	/* Step the encoder rate, as decided from the RTCP reports */
+	if (tx->ac->rateh && ATOMIC_LOAD(&tx->rate_step)) {
+		int step = (int32_t)ATOMIC_XCHG(&tx->rate_step, 0);
+		uint32_t level = ATOMIC_LOAD(&tx->rate_level);
+
+		if (step && 0 == tx->ac->rateh(tx->enc, step)) {
+			ATOMIC_STORE(&tx->rate_level, step < 0 ? level + 1 :
+				     level ? level - 1 : 0);
+		}
+	}
+
+	/* Lower the encoder complexity while the CPU is overloaded */
+	if (tx->ac->cplxh) {
+		uint32_t cplx = ATOMIC_LOAD(&tx->cplx);
+
+		if (cplx != tx->cplx_enc) {
+			(void)tx->ac->cplxh(tx->enc, cplx);
+			tx->cplx_enc = cplx;
+		}
+	}
+
+	/* First frame of a packet */
+	if (!tx->framec) {
+		tx->mb->pos = tx->mb->end = STREAM_PRESZ;
+		tx->ts_pkt = tx->ts;
+		tx->ext_level = 127;
+		tx->ext_voice = false;
+	}
+
 	len = mbuf_get_space(tx->mb);
 
-	err = tx->ac->ench(tx->enc, mbuf_buf(tx->mb), &len, sampv, sampc);
-	if ((err & 0xffff0000) == 0x00010000) {
-		/* MPA needs some special treatment here */
-		tx->ts = err & 0xffff;
+	++tx->n_frames;
+
+	if (tx->pt_cn >= 0 || ext)
+		voice = vad_process(&tx->vad, sampv, sampc,
+				    autx_frame_ptime(tx));
+
+	/* a filter with its own VAD knows better */
+	if (tx->vad_filt >= 0)
+		voice = tx->vad_filt != 0;
+
+	/* RFC 6464, so that a mixer can find the speakers without decoding */
+	if (ext) {
+		tx->ext_level = min(tx->ext_level,
+				    aulevel_dbov(sampv, sampc));
+		tx->ext_voice |= voice;
+	}
+
+	/* Silence is not encoded if the peer accepts Comfort Noise */
+	if (tx->pt_cn >= 0 && !voice) {
+		++tx->n_silent;
+		silent = true;
+		len = 0;
 		err = 0;
 	}
-	else if (err) {
+	else {
+		tx->sid = false;
+
+		ts = metric_time_us();
+		err = tx->ac->ench(tx->enc, mbuf_buf(tx->mb), &len,
+				   sampv, sampc);
+		metric_add_proc(&a->strm->metric_tx, ts);
+		now = metric_time_us();
+		aulat_add(&tx->lat, AULAT_CODEC, (uint32_t)(now - ts));
+		trace_span(a->strm->call, false, TRACE_ENCODE, ts, now);
+	}
+
+	allocstat_stage(&tx->alloc, ALLOC_CODEC);
+
+	if (err) {
 		warning("audio: %s encode error: %d samples (%m)\n",
 			tx->ac->name, sampc, err);
 		goto out;
 	}
 
-	tx->mb->pos = STREAM_PRESZ;
-	tx->mb->end = STREAM_PRESZ + len;
+	tx->mb->end += len;
+	tx->mb->pos  = tx->mb->end;
 
-	if (mbuf_get_left(tx->mb)) {
-		if (len) {
-			err = stream_send(a->strm, tx->marker, -1,
-					tx->ts, tx->mb);
-			if (err)
-				goto out;
-		}
+	PROBE4(audio_send, call_id(a->strm->call), tx->ts, sampc, len);
+
+	if (len)
+		++tx->framec;
+
+	/* A codec with variable frames writes nothing until one is full */
+	buffering = !len && !silent && tx->ac->durh;
+
+	/* Send when the packet is complete, or the codec paused (DTX) */
+	if (tx->framec &&
+	    (tx->framec >= autx_frames(tx) || (!len && !buffering))) {
+
+		tx->mb->pos = STREAM_PRESZ;
+		tx->framec  = 0;
+
+		if (ext)
+			stream_set_audio_level(a->strm, tx->ext_level,
+					       tx->ext_voice);
+
+		ts = metric_time_us();
+		err = stream_send(a->strm, tx->marker, -1,
+				  tx->ts_pkt, tx->mb);
+		now = metric_time_us();
+		aulat_add(&tx->lat, AULAT_RTP, (uint32_t)(now - ts));
+		trace_span(a->strm->call, false, TRACE_SEND, ts, now);
+		allocstat_stage(&tx->alloc, ALLOC_RTP);
+
+		tx->marker = false;
+
+		if (err)
+			goto out;
 	}
 
-	/* Convert from audio samplerate to RTP clockrate */
-	sampc_rtp = sampc * tx->ac->crate / tx->ac->srate;
+	/* The first packet of a talkspurt has the marker bit set */
+	if (!len && !buffering)
+		tx->marker = true;
+
+	if (silent)
+		send_sid(a, tx);
 
-	/* The RTP clock rate used for generating the RTP timestamp is
-	 * independent of the number of channels and the encoding
-	 * However, MPA support variable packet durations. Thus, MPA
-	 * should update the ts according to its current internal state.
-	 */
-	frame_size = sampc_rtp / get_ch(tx->ac);
+	/* The timestamp moves on by the duration of the encoded frames,
+	 * so that a packet has the timestamp of its first frame */
+	if (tx->ac->durh && !silent) {
+		tx->ts += tx->ac->durh(tx->enc);
+	}
+	else {
+		/* Convert from audio samplerate to RTP clockrate */
+		sampc_rtp = sampc * tx->ac->crate / tx->ac->srate;
 
-	tx->ts += (uint32_t)frame_size;
+		/* The RTP clock rate used for generating the RTP timestamp
+		 * is independent of the number of channels and the
+		 * encoding */
+		frame_size = sampc_rtp / get_ch(tx->ac);
+
+		tx->ts += (uint32_t)frame_size;
+	}
 
  out:
-	tx->marker = false;
+	if (err) {
+		tx->framec = 0;
+		tx->marker = false;
+	}
+
+	lock_rel(tx->lock);
 }
 
 
 /*
  * @note This function has REAL-TIME properties
  */
-static void poll_aubuf_tx(struct audio *a)
+static void poll_auring_tx(struct audio *a)
 {
 	struct autx *tx = &a->tx;
-	int16_t *sampv = tx->sampv;
+	int16_t *sampv;
 	size_t sampc;
-	struct le *le;
+	uint64_t ts, now;
 	int err = 0;
 
 	sampc = tx->psize / 2;
 
+	sampv = scratch_samp(SCRATCH_TX, sampc);
+	if (!sampv)
+		return;
+
+	allocstat_frame(&tx->alloc);
+
+	ts = metric_time_us();
+	aulat_tick(&tx->lat, ts);
+	aulat_add(&tx->lat, AULAT_AUBUF,
+		  ring_delay(tx->ring, tx->ausrc_prm.srate, tx->ausrc_prm.ch));
+	if (ATOMIC_LOAD(&tx->dev_lat))
+		aulat_add(&tx->lat, AULAT_DEVICE, ATOMIC_LOAD(&tx->dev_lat));
+
 	/* timed read from audio-buffer */
-	aubuf_read_samp(tx->aubuf, tx->sampv, sampc);
+	auring_read_samp(tx->ring, sampv, sampc);
+
+	PROBE2(audio_tx, call_id(a->strm->call), sampc);
 
 	/* optional resampler */
-	if (tx->resamp.resample) {
-		size_t sampc_rs = AUDIO_SAMPSZ;
+	if (tx->resamp) {
+		size_t sampc_rs = resamp_outc(tx->resamp, sampc);
+		int16_t *sampv_rs = scratch_samp(SCRATCH_TX_RS, sampc_rs);
+
+		if (!sampv_rs)
+			return;
 
-		err = auresamp(&tx->resamp,
-			       tx->sampv_rs, &sampc_rs,
-			       tx->sampv, sampc);
+		err = resamp_process(tx->resamp,
+				     sampv_rs, &sampc_rs,
+				     sampv, sampc);
 		if (err)
 			return;
 
-		sampv = tx->sampv_rs;
+		sampv = sampv_rs;
 		sampc = sampc_rs;
+
+		now = metric_time_us();
+		aulat_add(&tx->lat, AULAT_RESAMP, (uint32_t)(now - ts));
+		trace_span(a->strm->call, false, TRACE_CONVERT, ts, now);
+		ts = now;
+
+		allocstat_stage(&tx->alloc, ALLOC_CONV);
 	}
 
 	/* Process exactly one audio-frame in list order */
-	for (le = tx->filtl.head; le; le = le->next) {
-		struct aufilt_enc_st *st = le->data;
+	if (!list_isempty(&tx->filtl)) {
 
-		if (st->af && st->af->ench)
-			err |= st->af->ench(st, sampv, &sampc);
-	}
-	if (err) {
-		warning("audio: aufilter encode: %m\n", err);
+		tx->vad_filt = -1;
+
+		err = aufilt_chain_encode(tx->fch, &tx->filtl, sampv, &sampc);
+		if (err) {
+			warning("audio: aufilter encode: %m\n", err);
+		}
+
+		now = metric_time_us();
+		aulat_add(&tx->lat, AULAT_FILT, (uint32_t)(now - ts));
+		trace_span(a->strm->call, false, TRACE_FILTER, ts, now);
+
+		allocstat_stage(&tx->alloc, ALLOC_FILT);
 	}
 
 	/* Encode and send */
@@ -420,25 +908,28 @@ static void poll_aubuf_tx(struct audio *a)
 
 static void check_telev(struct audio *a, struct autx *tx)
 {
-	const struct sdp_format *fmt;
 	bool marker = false;
 	int err;
 
-	tx->mb->pos = tx->mb->end = STREAM_PRESZ;
+	tx->mb_tel->pos = tx->mb_tel->end = STREAM_PRESZ;
 
-	err = telev_poll(a->telev, &marker, tx->mb);
+	err = telev_poll(a->telev, &marker, tx->mb_tel);
 	if (err)
 		return;
 
+	lock_write_get(tx->lock);
+
 	if (marker)
 		tx->ts_tel = tx->ts;
 
-	fmt = sdp_media_rformat(stream_sdpmedia(audio_strm(a)), telev_rtpfmt);
-	if (!fmt)
-		return;
+	if (tx->pt_tel >= 0) {
+		tx->mb_tel->pos = STREAM_PRESZ;
+		err = stream_send(a->strm, marker, tx->pt_tel, tx->ts_tel,
+				  tx->mb_tel);
+	}
+
+	lock_rel(tx->lock);
 
-	tx->mb->pos = STREAM_PRESZ;
-	err = stream_send(a->strm, marker, fmt->pt, tx->ts_tel, tx->mb);
 	if (err) {
 		warning("audio: telev: stream_send %m\n", err);
 	}
@@ -462,8 +953,30 @@ static void check_telev(struct audio *a, struct autx *tx)
 static void auplay_write_handler(int16_t *sampv, size_t sampc, void *arg)
 {
 	struct aurx *rx = arg;
+	uint32_t amp = ATOMIC_LOAD(&rx->cn_amp);
+	uint64_t ts = 0;
+
+	/* the device thread allocated this since the previous frame */
+	if (rx->alloc_play.framec)
+		allocstat_stage(&rx->alloc_play, ALLOC_DEVICE);
+
+	allocstat_frame(&rx->alloc_play);
+
+	if (trace_active(rx->call))
+		ts = metric_time_us();
 
-	aubuf_read_samp(rx->aubuf, sampv, sampc);
+	/* Comfort noise once the last frame before silence is played */
+	if (amp && auring_cur_size(rx->ring) < sampc * 2) {
+		cn_generate(sampv, sampc, amp, &rx->cn_seed);
+		goto out;
+	}
+
+	auring_read_samp(rx->ring, sampv, sampc);
+
+ out:
+	if (ts)
+		trace_span(rx->call, false, TRACE_DISPLAY, ts,
+			   metric_time_us());
 }
 
 
@@ -482,24 +995,55 @@ static void ausrc_read_handler(const int16_t *sampv, size_t sampc, void *arg)
 {
 	struct audio *a = arg;
 	struct autx *tx = &a->tx;
+	uint64_t ts = 0;
+
+	/* the device thread allocated this since the previous frame */
+	if (tx->alloc_src.framec)
+		allocstat_stage(&tx->alloc_src, ALLOC_DEVICE);
+
+	allocstat_frame(&tx->alloc_src);
+
+	if (trace_active(a->strm->call))
+		ts = metric_time_us();
+
+	/* The peer stream, the music on hold or a prompt sends our RTP */
+	if (ATOMIC_LOAD(&tx->relayed) || ATOMIC_LOAD(&tx->moh) ||
+	    ATOMIC_LOAD(&tx->prompt))
+		goto out;
 
 	if (tx->muted)
 		memset((void *)sampv, 0, sampc*2);
 
-	(void)aubuf_write_samp(tx->aubuf, sampv, sampc);
+	(void)auring_write_samp(tx->ring, sampv, sampc);
 
-	if (a->cfg.txmode == AUDIO_MODE_POLL) {
+	if (ts)
+		trace_span(a->strm->call, false, TRACE_CAPTURE, ts,
+			   metric_time_us());
+
+	if (a->cfg.txmode == AUDIO_MODE_POLL && !tx->batch) {
 		unsigned i;
 
 		for (i=0; i<16; i++) {
 
-			if (aubuf_cur_size(tx->aubuf) < tx->psize)
+			if (auring_cur_size(tx->ring) < tx->psize)
 				break;
 
-			poll_aubuf_tx(a);
+			poll_auring_tx(a);
+		}
+	}
+#ifdef HAVE_PTHREAD
+	else if (a->cfg.txmode == AUDIO_MODE_EVENT) {
+
+		/* Wake up the transmit thread when a full frame is ready */
+		if (auring_cur_size(tx->ring) >= tx->psize) {
+			pthread_mutex_lock(&tx->u.thr.mutex);
+			pthread_cond_signal(&tx->u.thr.cond);
+			pthread_mutex_unlock(&tx->u.thr.mutex);
 		}
 	}
+#endif
 
+ out:
 	/* Exact timing: send Telephony-Events from here */
 	check_telev(a, tx);
 }
@@ -519,7 +1063,7 @@ static int pt_handler(struct audio *a, uint8_t pt_old, uint8_t pt_new)
 {
 	const struct sdp_format *lc;
 
-	lc = sdp_media_lformat(stream_sdpmedia(a->strm), pt_new);
+	lc = stream_lformat(a->strm, pt_new);
 	if (!lc)
 		return ENOENT;
 
@@ -548,70 +1092,352 @@ static void handle_telev(struct audio *a, struct mbuf *mb)
 }
 
 
-static int aurx_stream_decode(struct aurx *rx, struct mbuf *mb)
+/* Resample and buffer one frame for the player */
+static int aurx_write(struct aurx *rx, int16_t *sampv, size_t sampc,
+		      uint64_t ts)
 {
-	size_t sampc = AUDIO_SAMPSZ;
-	int16_t *sampv;
-	struct le *le;
-	int err = 0;
+	uint64_t now;
+	int err;
 
-	/* No decoder set */
-	if (!rx->ac)
-		return 0;
+	/* optional resampler */
+	if (rx->resamp) {
+		size_t sampc_rs = resamp_outc(rx->resamp, sampc);
+		int16_t *sampv_rs = scratch_samp(SCRATCH_RX_RS, sampc_rs);
 
-	if (mbuf_get_left(mb)) {
-		err = rx->ac->dech(rx->dec, rx->sampv, &sampc,
-				   mbuf_buf(mb), mbuf_get_left(mb));
-	}
-	else if (rx->ac->plch) {
-		sampc = rx->ac->srate * rx->ac->ch * rx->ptime / 1000;
+		if (!sampv_rs)
+			return ENOMEM;
 
-		err = rx->ac->plch(rx->dec, rx->sampv, &sampc);
-	}
-	else {
-		/* no PLC in the codec, might be done in filters below */
-		sampc = 0;
+		err = resamp_process(rx->resamp,
+				     sampv_rs, &sampc_rs,
+				     sampv, sampc);
+		if (err)
+			return err;
+
+		sampv = sampv_rs;
+		sampc = sampc_rs;
+
+		now = metric_time_us();
+		aulat_add(&rx->lat, AULAT_RESAMP, (uint32_t)(now - ts));
+		trace_span(rx->call, false, TRACE_CONVERT, ts, now);
 	}
 
-	if (err) {
-		warning("audio: %s codec decode %u bytes: %m\n",
-			rx->ac->name, mbuf_get_left(mb), err);
-		goto out;
-	}
+	err = auring_write_samp(rx->ring, sampv, sampc);
+	allocstat_stage(&rx->alloc, ALLOC_CONV);
+	if (err)
+		return err;
+
+	/* time until this frame is played, excluding the device buffer */
+	aulat_add(&rx->lat, AULAT_AUBUF,
+		  ring_delay(rx->ring, rx->auplay_prm.srate,
+			     rx->auplay_prm.ch));
+	if (ATOMIC_LOAD(&rx->dev_lat))
+		aulat_add(&rx->lat, AULAT_DEVICE, ATOMIC_LOAD(&rx->dev_lat));
+
+	return 0;
+}
+
+
+/* Filter and buffer one decoded frame in rx->sampv */
+static int aurx_render(struct aurx *rx, size_t sampc, uint64_t ts)
+{
+	uint64_t now;
+	int err = 0;
 
 	/* Process exactly one audio-frame in reverse list order */
-	for (le = rx->filtl.tail; le; le = le->prev) {
-		struct aufilt_dec_st *st = le->data;
+	if (!list_isempty(&rx->filtl)) {
 
-		if (st->af && st->af->dech)
-			err |= st->af->dech(st, rx->sampv, &sampc);
+		err = aufilt_chain_decode(rx->fch, &rx->filtl,
+					  rx->sampv, &sampc);
+
+		now = metric_time_us();
+		aulat_add(&rx->lat, AULAT_FILT, (uint32_t)(now - ts));
+		trace_span(rx->call, false, TRACE_FILTER, ts, now);
+		ts = now;
+
+		allocstat_stage(&rx->alloc, ALLOC_FILT);
 	}
 
-	if (!rx->aubuf)
-		goto out;
+	if (!rx->ring)
+		return err;
 
-	sampv = rx->sampv;
+	/* drain an extra frame of the jitter buffer */
+	if (rx->drain && sampc) {
 
-	/* optional resampler */
-	if (rx->resamp.resample) {
-		size_t sampc_rs = AUDIO_SAMPSZ;
+		const size_t n = tstretch_accel(rx->sampv, sampc,
+						get_srate(rx->ac),
+						get_ch(rx->ac));
 
-		err = auresamp(&rx->resamp,
-			       rx->sampv_rs, &sampc_rs,
-			       rx->sampv, sampc);
-		if (err)
+		if (n < sampc) {
+			rx->drain -= min(rx->drain, sampc - n);
+			++rx->n_accel;
+			sampc = n;
+		}
+		else if (rx->drain >= sampc) {
+			/* too short to stretch, drop it as a whole */
+			rx->drain -= sampc;
+			return 0;
+		}
+		else {
+			rx->drain = 0;
+		}
+	}
+
+	rx->sampc_last = sampc;
+
+	return aurx_write(rx, rx->sampv, sampc, ts);
+}
+
+
+/* A frame held back by the jitter buffer is filled in by stretching */
+static int aurx_expand(struct aurx *rx, uint64_t ts)
+{
+	const size_t framec = rx->ac->srate * rx->ac->ch * rx->ptime / 1000;
+	int16_t *sampv_ts;
+	size_t n;
+
+	sampv_ts = scratch_samp(SCRATCH_RX_TS, framec);
+	if (!sampv_ts)
+		return ENOMEM;
+
+	n = tstretch_expand(sampv_ts, framec,
+			    rx->sampv, rx->sampc_last,
+			    get_srate(rx->ac), get_ch(rx->ac));
+	if (!n)
+		return 0;
+
+	++rx->n_expand;
+
+	return aurx_write(rx, sampv_ts, n, ts);
+}
+
+
+/*
+ * A missing frame is concealed by the codec, or by a PLC filter if the
+ * codec has no PLC of its own
+ */
+static int aurx_conceal(struct aurx *rx, uint64_t ts)
+{
+	size_t sampc = 0;
+	int err;
+
+	if (rx->ac->plch) {
+		sampc = rx->ac->srate * rx->ac->ch * rx->ptime / 1000;
+
+		err = rx->ac->plch(rx->dec, rx->sampv, &sampc);
+		if (err) {
+			warning("audio: %s PLC: %m\n", rx->ac->name, err);
 			return err;
+		}
 
-		sampv = rx->sampv_rs;
-		sampc = sampc_rs;
+		aulat_add(&rx->lat, AULAT_CODEC,
+			  (uint32_t)(metric_time_us() - ts));
 	}
 
-	err = aubuf_write_samp(rx->aubuf, sampv, sampc);
+	++rx->n_plc;
+
+	/* with sampc 0, a PLC filter fills in the frame */
+	return aurx_render(rx, sampc, metric_time_us());
+}
+
+
+/*
+ * A lost frame is recovered from the in-band FEC data of the next
+ * packet, or concealed if that packet is lost too.
+ */
+static int aurx_fec_decode(struct aurx *rx, struct mbuf *mb, uint64_t ts)
+{
+	size_t sampc = rx->ac->srate * rx->ac->ch * rx->ptime / 1000;
+	int err;
+
+	rx->fec_pending = false;
+
+	if (mbuf_get_left(mb)) {
+		err = rx->ac->fech(rx->dec, rx->sampv, &sampc,
+				   mbuf_buf(mb), mbuf_get_left(mb));
+		if (!err)
+			++rx->n_fec;
+	}
+	else {
+		return aurx_conceal(rx, ts);
+	}
+
+	if (err) {
+		warning("audio: %s FEC decode: %m\n", rx->ac->name, err);
+		return err;
+	}
+
+	if (!sampc)
+		return 0;
+
+	aulat_add(&rx->lat, AULAT_CODEC, (uint32_t)(metric_time_us() - ts));
+
+	return aurx_render(rx, sampc, metric_time_us());
+}
+
+
+static int aurx_stream_decode(struct aurx *rx, struct mbuf *mb,
+			      struct metric *metric)
+{
+	size_t sampc = rx->sampsz;
+	uint64_t ts, now;
+	int err = 0;
+
+	/* No decoder set */
+	if (!rx->ac)
+		return 0;
+
+	allocstat_frame(&rx->alloc);
+
+	ts = metric_time_us();
+	aulat_tick(&rx->lat, ts);
+
+	/* set by the stream when the jitter-buffer released this frame */
+	if (metric->jbuf_delay) {
+		aulat_add(&rx->lat, AULAT_RTP, metric->jbuf_delay);
+		metric->jbuf_delay = 0;
+	}
+
+	if (metric->jb_shrink)
+		rx->drain += rx->ac->srate * rx->ac->ch * rx->ptime / 1000;
+
+	if (metric->jb_grow)
+		return aurx_expand(rx, ts);
+
+	if (metric->jb_late)
+		++rx->n_late;
+
+	if (rx->fec_pending) {
+		(void)aurx_fec_decode(rx, mb, ts);
+		ts = metric_time_us();
+	}
+
+	/* all but the last of the lost frames are concealed here */
+	if (metric->jb_lost > 1) {
+		const uint32_t n = min(metric->jb_lost - 1, PLC_MAX_FRAMES);
+		uint32_t i;
+
+		for (i=0; i<n; i++) {
+			(void)aurx_conceal(rx, ts);
+			ts = metric_time_us();
+		}
+	}
+
+	if (mbuf_get_left(mb)) {
+
+		err = rx->ac->dech(rx->dec, rx->sampv, &sampc,
+				   mbuf_buf(mb), mbuf_get_left(mb));
+
+		metric_add_proc(metric, ts);
+	}
+	else if (rx->ac->fech && !metric->jb_late) {
+		/* wait for the next packet */
+		rx->fec_pending = true;
+		return 0;
+	}
+	else {
+		return aurx_conceal(rx, ts);
+	}
+
+	if (err) {
+		warning("audio: %s codec decode %u bytes: %m\n",
+			rx->ac->name, mbuf_get_left(mb), err);
+		return err;
+	}
+
+	if (sampc) {
+		now = metric_time_us();
+		aulat_add(&rx->lat, AULAT_CODEC, (uint32_t)(now - ts));
+		trace_span(rx->call, false, TRACE_DECODE, ts, now);
+		ts = now;
+	}
+
+	allocstat_stage(&rx->alloc, ALLOC_CODEC);
+
+	return aurx_render(rx, sampc, ts);
+}
+
+
+/* A SID frame starts comfort noise, or updates its level */
+static void handle_cn(struct aurx *rx, struct mbuf *mb)
+{
+	uint8_t level;
+
+	if (mbuf_get_left(mb) < 1)
+		return;
+
+	level = mbuf_read_u8(mb) & 0x7f;
+
+	ATOMIC_STORE(&rx->cn_amp, max(cn_amplitude(level), 1));
+}
+
+
+static bool relay_match(const struct audio *a)
+{
+	return a->relay && a->rx.ac && a->rx.ac == a->relay->tx.ac;
+}
+
+
+/* Let the peer encode its own audio again */
+static void relay_release(struct audio *a)
+{
+	struct autx *tx = &a->relay->tx;
+
+	if (!ATOMIC_LOAD(&tx->relayed))
+		return;
+
+	lock_write_get(tx->lock);
+
+	ATOMIC_STORE(&tx->relayed, false);
+	tx->marker = true;
+
+	lock_rel(tx->lock);
+}
+
+
+/*
+ * Send a received payload on the peer stream. The peer's RTP socket
+ * sets its own SSRC and sequence number, and the timestamp continues
+ * from the last one the peer has sent. This runs on the receive side,
+ * so the packet is sent under the lock of the peer's transmitter.
+ */
+static void relay_send(struct audio *a, const struct rtp_header *hdr,
+		       struct mbuf *mb, int pt)
+{
+	struct audio *peer = a->relay;
+	struct autx *tx = &peer->tx;
+	struct mbuf *mbr = a->mb_relay;
+	bool marker = hdr->m;
+	uint32_t ts;
+	int err;
+
+	mbr->pos = mbr->end = STREAM_PRESZ;
+	err = mbuf_write_mem(mbr, mbuf_buf(mb), mbuf_get_left(mb));
 	if (err)
-		goto out;
+		return;
 
- out:
-	return err;
+	mbr->pos = STREAM_PRESZ;
+
+	lock_write_get(tx->lock);
+
+	if (!ATOMIC_LOAD(&tx->relayed)) {
+
+		a->relay_ts = tx->ts - hdr->ts;
+		ATOMIC_STORE(&tx->relayed, true);
+		tx->framec = 0;
+		marker = true;
+	}
+
+	ts = hdr->ts + a->relay_ts;
+
+	err = stream_send(peer->strm, marker, pt, ts, mbr);
+	if (!err) {
+		++a->n_relay;
+
+		/* where the peer continues if relaying stops */
+		tx->ts = ts + a->rx.ac->crate * a->rx.ptime / 1000;
+	}
+
+	lock_rel(tx->lock);
 }
 
 
@@ -623,24 +1449,41 @@ static void stream_recv_handler(const struct rtp_header *hdr,
 	struct aurx *rx = &a->rx;
 	int err;
 
-	if (!mb)
+	if (!mb) {
+		/* nothing is lost while the peer is silent */
+		if (ATOMIC_LOAD(&rx->cn_amp) || relay_match(a))
+			return;
+
 		goto out;
+	}
 
 	/* Telephone event? */
 	if (hdr->pt != rx->pt) {
-		const struct sdp_format *fmt;
 
-		fmt = sdp_media_lformat(stream_sdpmedia(a->strm), hdr->pt);
+		switch (rx->ptcv[hdr->pt & 0x7f]) {
 
-		if (fmt && !str_casecmp(fmt->name, "telephone-event")) {
+		case PTC_TELEV:
 			handle_telev(a, mb);
 			return;
+
+		/* Comfort Noise (CN) as of RFC 3389 */
+		case PTC_CN:
+			if (relay_match(a) && a->relay->tx.pt_cn >= 0)
+				relay_send(a, hdr, mb, a->relay->tx.pt_cn);
+			else
+				handle_cn(rx, mb);
+			return;
+
+		case PTC_CODEC:
+			break;
+
+		default:
+			return;
 		}
 	}
 
-	/* Comfort Noise (CN) as of RFC 3389 */
-	if (PT_CN == hdr->pt)
-		return;
+	/* the peer is talking again */
+	ATOMIC_STORE(&rx->cn_amp, 0);
 
 	/* Audio payload-type changed? */
 	/* XXX: this logic should be moved to stream.c */
@@ -651,8 +1494,131 @@ static void stream_recv_handler(const struct rtp_header *hdr,
 			return;
 	}
 
+	/* Same codec on both streams: forward the payload as it is */
+	if (relay_match(a)) {
+		relay_send(a, hdr, mb, -1);
+		return;
+	}
+	else if (a->relay) {
+		relay_release(a);
+	}
+
  out:
-	(void)aurx_stream_decode(&a->rx, mb);
+	(void)aurx_stream_decode(&a->rx, mb, &a->strm->metric_rx);
+
+	PROBE5(audio_decode, call_id(a->strm->call), hdr->seq, hdr->ts,
+	       mbuf_get_left(mb), rx->sampc_last);
+}
+
+
+/*
+ * Decide the step of the encoder rate on each report from the peer. It
+ * is lowered at once on congestion: high loss or round-trip time, or a
+ * MOS estimate below the alert threshold. It is raised by one step
+ * after RATE_GOOD_MIN good reports in a row. The encoder makes the step
+ * on the next frame, in the thread that encodes.
+ */
+static void rate_adapt(struct audio *a, uint32_t loss)
+{
+	const struct rtcp_stats *rtcp = stream_rtcp_stats(a->strm);
+	const uint32_t rtt = rtcp ? rtcp->rtt / 1000 : 0;
+	struct stream_quality q;
+	struct autx *tx = &a->tx;
+	bool alert;
+
+	alert = 0 == stream_quality(a->strm, &q) && q.alert;
+
+	if (loss >= RATE_LOSS_HIGH || rtt >= RATE_RTT_HIGH || alert) {
+
+		tx->rate_good = 0;
+		ATOMIC_STORE(&tx->rate_step, (uint32_t)-1);
+	}
+	else if (loss <= RATE_LOSS_LOW && ATOMIC_LOAD(&tx->rate_level)) {
+
+		if (++tx->rate_good >= RATE_GOOD_MIN) {
+			tx->rate_good = 0;
+			ATOMIC_STORE(&tx->rate_step, 1);
+		}
+	}
+	else {
+		tx->rate_good = 0;
+	}
+}
+
+
+/* Loss fraction of our stream, as reported by the peer */
+static void stream_rtcp_handler(struct rtcp_msg *msg, void *arg)
+{
+	struct audio *a = arg;
+	const struct rtcp_rr *rrv;
+	uint32_t ssrc;
+	unsigned i;
+
+	switch (msg->hdr.pt) {
+
+	case RTCP_SR:
+		rrv = msg->r.sr.rrv;
+		break;
+
+	case RTCP_RR:
+		rrv = msg->r.rr.rrv;
+		break;
+
+	default:
+		return;
+	}
+
+	ssrc = rtp_sess_ssrc(a->strm->rtp);
+
+	for (i=0; i<msg->hdr.count; i++) {
+
+		if (rrv[i].ssrc != ssrc)
+			continue;
+
+		ATOMIC_STORE(&a->tx.loss_pct, rrv[i].fraction * 100 / 256);
+
+		if (a->cfg.rate_adapt)
+			rate_adapt(a, rrv[i].fraction * 100 / 256);
+		break;
+	}
+}
+
+
+/*
+ * Classify the payload types once for each SDP update, so that a
+ * received packet costs one lookup. The telephone-event payload type
+ * of the peer is kept for sending.
+ */
+static void audio_pt_update(struct audio *a)
+{
+	struct sdp_media *m = stream_sdpmedia(a->strm);
+	const struct sdp_format *fmt;
+	uint8_t ptcv[128];
+	struct le *le;
+
+	memset(ptcv, PTC_UNKNOWN, sizeof(ptcv));
+	ptcv[PT_CN] = PTC_CN;
+
+	for (le = list_head(sdp_media_format_lst(m, true)); le;
+	     le = le->next) {
+
+		fmt = le->data;
+
+		if (fmt->pt < 0 || fmt->pt >= (int)sizeof(ptcv))
+			continue;
+
+		if (!str_casecmp(fmt->name, telev_rtpfmt))
+			ptcv[fmt->pt] = PTC_TELEV;
+		else if (!str_casecmp(fmt->name, "CN"))
+			ptcv[fmt->pt] = PTC_CN;
+		else if (fmt->data)
+			ptcv[fmt->pt] = PTC_CODEC;
+	}
+
+	memcpy(a->rx.ptcv, ptcv, sizeof(ptcv));
+
+	fmt = sdp_media_rformat(m, telev_rtpfmt);
+	a->tx.pt_tel = fmt ? fmt->pt : -1;
 }
 
 
@@ -674,20 +1640,41 @@ static int add_telev_codec(struct audio *a)
 }
 
 
+static int add_cn_codecs(struct audio *a, const struct audio_plan *plan)
+{
+	struct sdp_media *m = stream_sdpmedia(audio_strm(a));
+	size_t i;
+	int err;
+
+	for (i=0; i<plan->cnc; i++) {
+
+		const uint32_t crate = plan->cnv[i];
+
+		err = sdp_format_add(NULL, m, false,
+				     crate == 8000 ? "13" : NULL,
+				     "CN", crate, 1, NULL,
+				     NULL, NULL, false, NULL);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+
 int audio_alloc(struct audio **ap, const struct config *cfg,
 		struct call *call, struct sdp_session *sdp_sess, int label,
 		const struct mnat *mnat, struct mnat_sess *mnat_sess,
 		const struct menc *menc, struct menc_sess *menc_sess,
-		uint32_t ptime, const struct list *aucodecl,
+		uint32_t ptime, const struct audio_plan *plan,
 		audio_event_h *eventh, audio_err_h *errh, void *arg)
 {
 	struct audio *a;
 	struct autx *tx;
 	struct aurx *rx;
-	struct le *le;
 	int err;
 
-	if (!ap || !cfg)
+	if (!ap || !cfg || !plan)
 		return EINVAL;
 
 	a = mem_zalloc(sizeof(*a), audio_destructor);
@@ -697,14 +1684,22 @@ int audio_alloc(struct audio **ap, const struct config *cfg,
 	MAGIC_INIT(a);
 
 	a->cfg = cfg->audio;
+	a->acc = call_account(call);
 	tx = &a->tx;
 	rx = &a->rx;
 
+#ifdef HAVE_PTHREAD
+	if (a->cfg.txmode == AUDIO_MODE_EVENT) {
+		pthread_mutex_init(&tx->u.thr.mutex, NULL);
+		pthread_cond_init(&tx->u.thr.cond, NULL);
+	}
+#endif
+
 	err = stream_alloc(&a->strm, &cfg->avt, call, sdp_sess,
 			   "audio", label,
 			   mnat, mnat_sess, menc, menc_sess,
 			   call_localuri(call),
-			   stream_recv_handler, NULL, a);
+			   stream_recv_handler, stream_rtcp_handler, a);
 	if (err)
 		goto out;
 
@@ -717,21 +1712,25 @@ int audio_alloc(struct audio **ap, const struct config *cfg,
 	if (err)
 		goto out;
 
-	/* Audio codecs */
-	for (le = list_head(aucodecl); le; le = le->next) {
-		err = add_audio_codec(a, stream_sdpmedia(a->strm), le->data);
-		if (err)
-			goto out;
-	}
+	err = stream_enable_rtpext(a->strm, RTPEXT_AUDIO_LEVEL);
+	if (err)
+		goto out;
 
-	tx->mb = mbuf_alloc(STREAM_PRESZ + 4096);
-	tx->sampv = mem_zalloc(AUDIO_SAMPSZ * 2, NULL);
-	rx->sampv = mem_zalloc(AUDIO_SAMPSZ * 2, NULL);
-	if (!tx->mb || !tx->sampv || !rx->sampv) {
+	err = add_audio_codecs(a, plan);
+	if (err)
+		goto out;
+
+	tx->mb = mbuf_alloc(STREAM_PRESZ + PKT_SIZE);
+	tx->mb_tel = mbuf_alloc(STREAM_PRESZ + 64);
+	if (!tx->mb || !tx->mb_tel) {
 		err = ENOMEM;
 		goto out;
 	}
 
+	aulat_init(&tx->lat, false);
+	aulat_init(&rx->lat, true);
+	rx->call = call;
+
 	err = telev_alloc(&a->telev, TELEV_PTIME);
 	if (err)
 		goto out;
@@ -740,24 +1739,35 @@ int audio_alloc(struct audio **ap, const struct config *cfg,
 	if (err)
 		goto out;
 
-	auresamp_init(&tx->resamp);
+	err = add_cn_codecs(a, plan);
+	if (err)
+		goto out;
+
 	str_ncpy(tx->device, a->cfg.src_dev, sizeof(tx->device));
 	tx->ptime  = ptime;
+
+	err  = autx_mb_fit(tx);
+	err |= lock_alloc(&tx->lock);
+	if (err)
+		goto out;
 	tx->ts     = rand_u16();
 	tx->marker = true;
+	tx->pt_cn  = -1;
+	tx->pt_tel = -1;
+	tx->vad_filt = -1;
+	vad_init(&tx->vad);
 
-	auresamp_init(&rx->resamp);
 	str_ncpy(rx->device, a->cfg.play_dev, sizeof(rx->device));
 	rx->pt     = -1;
 	rx->ptime  = ptime;
+	rx->cn_seed = rand_u32();
+
+	audio_pt_update(a);
 
 	a->eventh  = eventh;
 	a->errh    = errh;
 	a->arg     = arg;
 
-	if (a->cfg.txmode == AUDIO_MODE_TMR)
-		tmr_init(&tx->u.tmr);
-
  out:
 	if (err)
 		mem_deref(a);
@@ -779,14 +1789,16 @@ static void *tx_thread(void *arg)
 	if (a->cfg.txmode == AUDIO_MODE_THREAD_REALTIME)
 		(void)realtime_enable(true, 1);
 
+	(void)realtime_thread("audio_tx");
+
 	while (a->tx.u.thr.run) {
 
 		for (i=0; i<16; i++) {
 
-			if (aubuf_cur_size(tx->aubuf) < tx->psize)
+			if (auring_cur_size(tx->ring) < tx->psize)
 				break;
 
-			poll_aubuf_tx(a);
+			poll_auring_tx(a);
 		}
 
 		sys_msleep(5);
@@ -794,6 +1806,99 @@ static void *tx_thread(void *arg)
 
 	return NULL;
 }
+
+
+/*
+ * Transmit thread for AUDIO_MODE_EVENT, sleeps until the audio source
+ * has buffered at least one packet of samples.
+ */
+static void *tx_event_thread(void *arg)
+{
+	struct audio *a = arg;
+	struct autx *tx = &a->tx;
+	unsigned i;
+
+	(void)realtime_thread("audio_tx");
+
+	for (;;) {
+
+		pthread_mutex_lock(&tx->u.thr.mutex);
+
+		while (tx->u.thr.run &&
+		       auring_cur_size(tx->ring) < tx->psize) {
+			pthread_cond_wait(&tx->u.thr.cond, &tx->u.thr.mutex);
+		}
+
+		pthread_mutex_unlock(&tx->u.thr.mutex);
+
+		if (!tx->u.thr.run)
+			break;
+
+		for (i=0; i<16; i++) {
+
+			if (auring_cur_size(tx->ring) < tx->psize)
+				break;
+
+			poll_auring_tx(a);
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * A frame is due on the media scheduler one frame time after it was
+ * captured. A worker that is late for longer than TX_LATE_MAX drops
+ * the oldest packets, so the call catches up instead of sending later
+ * and later audio. The peer conceals them as lost packets.
+ */
+static void autx_drop_late(struct autx *tx)
+{
+	const size_t sz = tx->psize * autx_frames(tx);
+	int16_t *sampv;
+	unsigned i;
+
+	if (tx->framec || !tx->ac || tx->ac->durh)
+		return;
+
+	while (auring_cur_size(tx->ring) >= sz &&
+	       ring_delay(tx->ring, tx->ausrc_prm.srate, tx->ausrc_prm.ch)
+	       > TX_LATE_MAX * 1000) {
+
+		sampv = scratch_samp(SCRATCH_TX, tx->psize / 2);
+		if (!sampv)
+			return;
+
+		for (i=0; i<autx_frames(tx); i++)
+			auring_read_samp(tx->ring, sampv, tx->psize / 2);
+
+		lock_write_get(tx->lock);
+		tx->ts += tx->ac->crate * tx->ptime / 1000;
+		lock_rel(tx->lock);
+
+		++tx->n_drop;
+	}
+}
+
+
+/* Media scheduler job for AUDIO_MODE_SCHEDULER, and the encoder batch */
+static void sched_tx(void *arg)
+{
+	struct audio *a = arg;
+	struct autx *tx = &a->tx;
+	unsigned i;
+
+	autx_drop_late(tx);
+
+	for (i=0; i<16; i++) {
+
+		if (auring_cur_size(tx->ring) < tx->psize)
+			break;
+
+		poll_auring_tx(a);
+	}
+}
 #endif
 
 
@@ -803,20 +1908,22 @@ static void timeout_tx(void *arg)
 	struct autx *tx = &a->tx;
 	unsigned i;
 
-	tmr_start(&a->tx.u.tmr, 5, timeout_tx, a);
+	twheel_tmr_start(&a->tx.u.tmr, baresip_twheel(), 5, timeout_tx, a);
 
 	for (i=0; i<16; i++) {
 
-		if (aubuf_cur_size(tx->aubuf) < tx->psize)
+		if (auring_cur_size(tx->ring) < tx->psize)
 			break;
 
-		poll_aubuf_tx(a);
+		poll_auring_tx(a);
 	}
 }
 
 
 static void aufilt_param_set(struct aufilt_prm *prm,
-			     const struct aucodec *ac, uint32_t ptime)
+			     const struct aucodec *ac, uint32_t ptime,
+			     struct aulevel *level, int *vad,
+			     const struct account *acc)
 {
 	if (!ac) {
 		memset(prm, 0, sizeof(*prm));
@@ -826,6 +1933,9 @@ static void aufilt_param_set(struct aufilt_prm *prm,
 	prm->srate      = get_srate(ac);
 	prm->ch         = get_ch(ac);
 	prm->ptime      = ptime;
+	prm->level      = level;
+	prm->vad        = vad;
+	prm->acc        = acc;
 }
 
 
@@ -843,7 +1953,7 @@ static int autx_print_pipeline(struct re_printf *pf, const struct autx *autx)
 	for (le = list_head(&autx->filtl); le; le = le->next) {
 		struct aufilt_enc_st *st = le->data;
 
-		if (st->af->ench)
+		if (st->af->ench || st->af->enc_floath)
 			err |= re_hprintf(pf, " ---> %s", st->af->name);
 	}
 
@@ -868,7 +1978,7 @@ static int aurx_print_pipeline(struct re_printf *pf, const struct aurx *aurx)
 	for (le = list_head(&aurx->filtl); le; le = le->next) {
 		struct aufilt_dec_st *st = le->data;
 
-		if (st->af->dech)
+		if (st->af->dech || st->af->dec_floath)
 			err |= re_hprintf(pf, " <--- %s", st->af->name);
 	}
 
@@ -903,8 +2013,10 @@ static int aufilt_setup(struct audio *a)
 	if (!list_isempty(&tx->filtl) || !list_isempty(&rx->filtl))
 		return 0;
 
-	aufilt_param_set(&encprm, tx->ac, tx->ptime);
-	aufilt_param_set(&decprm, rx->ac, rx->ptime);
+	aufilt_param_set(&encprm, tx->ac, autx_frame_ptime(tx), &tx->level,
+			 &tx->vad_filt, a->acc);
+	aufilt_param_set(&decprm, rx->ac, rx->ptime, &rx->level, NULL,
+			 a->acc);
 
 	/* Audio filters */
 	for (le = list_head(aufilt_list()); le; le = le->next) {
@@ -920,6 +2032,10 @@ static int aufilt_setup(struct audio *a)
 
 			encst->af = af;
 			list_append(&tx->filtl, &encst->le, encst);
+
+			if (af->enc_floath && !tx->fch)
+				err |= aufilt_chain_alloc(&tx->fch,
+							  AUDIO_SAMPSZ);
 		}
 
 		if (af->decupdh) {
@@ -929,6 +2045,10 @@ static int aufilt_setup(struct audio *a)
 
 			decst->af = af;
 			list_append(&rx->filtl, &decst->le, decst);
+
+			if (af->dec_floath && !rx->fch)
+				err |= aufilt_chain_alloc(&rx->fch,
+							  AUDIO_SAMPSZ);
 		}
 
 		if (err) {
@@ -942,80 +2062,168 @@ static int aufilt_setup(struct audio *a)
 }
 
 
-static int start_player(struct aurx *rx, struct audio *a)
+/*
+ * Device parameters for a codec: the configured rate and channels if
+ * set, otherwise the codec's own.
+ */
+static void device_prm(uint32_t *srate, uint32_t *ch,
+		       const struct aucodec *ac,
+		       uint32_t cfg_srate, uint32_t cfg_ch)
+{
+	*srate = cfg_srate ? cfg_srate : get_srate(ac);
+	*ch    = cfg_ch    ? cfg_ch    : get_ch(ac);
+}
+
+
+/*
+ * Setup the resampler between the codec and the audio device,
+ * or release it if the device already runs at the codec rate.
+ */
+static int resampler_setup(struct resamp **rsp,
+			   const struct audio *a, const char *dir,
+			   uint32_t irate, uint32_t ich,
+			   uint32_t orate, uint32_t och)
 {
-	const struct aucodec *ac = rx->ac;
-	uint32_t srate_dsp = get_srate(ac);
-	uint32_t channels_dsp;
-	bool resamp = false;
 	int err;
 
-	if (!ac)
+	if (irate == orate && ich == och) {
+		*rsp = mem_deref(*rsp);
 		return 0;
+	}
 
-	channels_dsp = get_ch(ac);
+	if (*rsp)
+		return 0;
 
-	if (a->cfg.srate_play && a->cfg.srate_play != srate_dsp) {
-		resamp = true;
-		srate_dsp = a->cfg.srate_play;
-	}
-	if (a->cfg.channels_play && a->cfg.channels_play != channels_dsp) {
-		resamp = true;
-		channels_dsp = a->cfg.channels_play;
+	info("audio: enable %s resampler (%s):"
+	     " %uHz/%uch --> %uHz/%uch\n",
+	     dir, resamp_backend_name(a->cfg.resamp),
+	     irate, ich, orate, och);
+
+	err = resamp_alloc(rsp, a->cfg.resamp, irate, ich, orate, och);
+	if (err) {
+		warning("audio: could not setup %s resampler (%m)\n",
+			dir, err);
+		return err;
 	}
 
-	/* Optional resampler, if configured */
-	if (resamp && !rx->sampv_rs) {
+	return 0;
+}
 
-		info("audio: enable auplay resampler:"
-		     " %uHz/%uch --> %uHz/%uch\n",
-		     get_srate(ac), get_ch(ac), srate_dsp, channels_dsp);
 
-		rx->sampv_rs = mem_zalloc(AUDIO_SAMPSZ * 2, NULL);
-		if (!rx->sampv_rs)
-			return ENOMEM;
+static int player_open(struct aurx *rx, struct audio *a,
+		       uint32_t srate, uint32_t ch)
+{
+	struct auplay_prm prm;
+	int err;
 
-		err = auresamp_setup(&rx->resamp,
-				     get_srate(ac), get_ch(ac),
-				     srate_dsp, channels_dsp);
-		if (err) {
-			warning("audio: could not setup auplay resampler"
-				" (%m)\n", err);
-			return err;
-		}
-	}
+	prm.srate      = srate;
+	prm.ch         = ch;
+	prm.ptime      = rx->ptime;
+	prm.latency    = &rx->dev_lat;
 
-	/* Start Audio Player */
-	if (!rx->auplay && auplay_find(NULL)) {
+	ATOMIC_STORE(&rx->dev_lat, 0);
 
-		struct auplay_prm prm;
+	err = auplay_alloc(&rx->auplay, a->cfg.play_mod,
+			   &prm, rx->device,
+			   auplay_write_handler, rx);
+	if (err)
+		return err;
 
-		prm.srate      = srate_dsp;
-		prm.ch         = channels_dsp;
-		prm.ptime      = rx->ptime;
+	rx->auplay_prm = prm;
 
-		if (!rx->aubuf) {
+	return 0;
+}
+
+
+static int start_player(struct aurx *rx, struct audio *a)
+{
+	const struct aucodec *ac = rx->ac;
+	uint32_t srate_dsp, channels_dsp;
+	int err;
+
+	if (!ac)
+		return 0;
+
+	device_prm(&srate_dsp, &channels_dsp, ac,
+		   a->cfg.srate_play, a->cfg.channels_play);
+
+	/* Start Audio Player */
+	if (!rx->auplay && auplay_find(NULL)) {
+
+		/* Room for either the codec or the configured format */
+		if (!rx->ring) {
 			size_t psize;
 
-			psize = 2 * calc_nsamp(prm.srate, prm.ch, prm.ptime);
+			psize = 2 * calc_nsamp(max(srate_dsp, get_srate(ac)),
+					       max(channels_dsp, get_ch(ac)),
+					       rx->ptime);
 
-			err = aubuf_alloc(&rx->aubuf, psize * 1, psize * 8);
+			err = auring_alloc(&rx->ring, psize * 1, psize * 8);
 			if (err)
 				return err;
 		}
 
-		err = auplay_alloc(&rx->auplay, a->cfg.play_mod,
-				   &prm, rx->device,
-				   auplay_write_handler, rx);
+		err = ENOENT;
+
+		/* Try the codec rate first, to avoid resampling */
+		if (a->cfg.srate_auto &&
+		    (srate_dsp != get_srate(ac) ||
+		     channels_dsp != get_ch(ac))) {
+
+			err = player_open(rx, a, get_srate(ac), get_ch(ac));
+			if (err) {
+				info("audio: auplay does not support"
+				     " %uHz/%uch (%m)\n",
+				     get_srate(ac), get_ch(ac), err);
+			}
+		}
+
 		if (err) {
-			warning("audio: start_player failed (%s.%s): %m\n",
-				a->cfg.play_mod, rx->device, err);
-			return err;
+			err = player_open(rx, a, srate_dsp, channels_dsp);
+			if (err) {
+				warning("audio: start_player failed"
+					" (%s.%s): %m\n",
+					a->cfg.play_mod, rx->device, err);
+				return err;
+			}
 		}
+	}
 
-		rx->auplay_prm = prm;
+	if (rx->auplay) {
+		srate_dsp    = rx->auplay_prm.srate;
+		channels_dsp = rx->auplay_prm.ch;
 	}
 
+	/* Optional resampler, if the device rate differs */
+	return resampler_setup(&rx->resamp, a, "auplay",
+			       get_srate(ac), get_ch(ac),
+			       srate_dsp, channels_dsp);
+}
+
+
+static int source_open(struct autx *tx, struct audio *a,
+		       uint32_t srate, uint32_t ch)
+{
+	struct ausrc_prm prm;
+	int err;
+
+	prm.srate      = srate;
+	prm.ch         = ch;
+	prm.ptime      = tx->ptime;
+	prm.latency    = &tx->dev_lat;
+
+	ATOMIC_STORE(&tx->dev_lat, 0);
+
+	/* the read handler needs the packet size from the first frame */
+	tx->ausrc_prm = prm;
+	autx_update_psize(tx);
+
+	err = ausrc_alloc(&tx->ausrc, NULL, a->cfg.src_mod,
+			  &prm, tx->device,
+			  ausrc_read_handler, ausrc_error_handler, a);
+	if (err)
+		return err;
+
 	return 0;
 }
 
@@ -1023,73 +2231,84 @@ static int start_player(struct aurx *rx, struct audio *a)
 static int start_source(struct autx *tx, struct audio *a)
 {
 	const struct aucodec *ac = tx->ac;
-	uint32_t srate_dsp = get_srate(ac);
-	uint32_t channels_dsp;
-	bool resamp = false;
+	uint32_t srate_dsp, channels_dsp;
 	int err;
 
 	if (!ac)
 		return 0;
 
-	channels_dsp = get_ch(ac);
+	device_prm(&srate_dsp, &channels_dsp, ac,
+		   a->cfg.srate_src, a->cfg.channels_src);
 
-	if (a->cfg.srate_src && a->cfg.srate_src != srate_dsp) {
-		resamp = true;
-		srate_dsp = a->cfg.srate_src;
-	}
-	if (a->cfg.channels_src && a->cfg.channels_src != channels_dsp) {
-		resamp = true;
-		channels_dsp = a->cfg.channels_src;
-	}
+	/* Start Audio Source */
+	if (!tx->ausrc && ausrc_find(NULL)) {
 
-	/* Optional resampler, if configured */
-	if (resamp && !tx->sampv_rs) {
+		/* Room for either the codec or the configured format */
+		if (!tx->ring) {
+			size_t psize;
 
-		info("audio: enable ausrc resampler:"
-		     " %uHz/%uch <-- %uHz/%uch\n",
-		     get_srate(ac), get_ch(ac), srate_dsp, channels_dsp);
+			psize = 2 * calc_nsamp(max(srate_dsp, get_srate(ac)),
+					       max(channels_dsp, get_ch(ac)),
+					       tx->ptime);
 
-		tx->sampv_rs = mem_zalloc(AUDIO_SAMPSZ * 2, NULL);
-		if (!tx->sampv_rs)
-			return ENOMEM;
+			err = auring_alloc(&tx->ring, psize * 2, psize * 30);
+			if (err)
+				return err;
+		}
 
-		err = auresamp_setup(&tx->resamp,
-				     srate_dsp, channels_dsp,
-				     get_srate(ac), get_ch(ac));
-		if (err) {
-			warning("audio: could not setup ausrc resampler"
-				" (%m)\n", err);
-			return err;
+#ifdef HAVE_PTHREAD
+		/* a heavy encoder is moved off the source thread, before
+		   the source starts to send */
+		if (a->cfg.offload && ac->heavy && !tx->batch &&
+		    (a->cfg.txmode == AUDIO_MODE_POLL ||
+		     a->cfg.txmode == AUDIO_MODE_TMR)) {
+
+			err = aubatch_add(&tx->batch, ac, tx->ptime,
+					  sched_tx, a);
+			if (err) {
+				warning("audio: encoder batch failed: %m\n",
+					err);
+			}
 		}
-	}
+#endif
 
-	/* Start Audio Source */
-	if (!tx->ausrc && ausrc_find(NULL)) {
+		err = ENOENT;
 
-		struct ausrc_prm prm;
+		/* Try the codec rate first, to avoid resampling */
+		if (a->cfg.srate_auto &&
+		    (srate_dsp != get_srate(ac) ||
+		     channels_dsp != get_ch(ac))) {
 
-		prm.srate      = srate_dsp;
-		prm.ch         = channels_dsp;
-		prm.ptime      = tx->ptime;
+			tx->resamp = mem_deref(tx->resamp);
 
-		tx->psize = 2 * calc_nsamp(prm.srate, prm.ch, prm.ptime);
+			err = source_open(tx, a, get_srate(ac), get_ch(ac));
+			if (err) {
+				info("audio: ausrc does not support"
+				     " %uHz/%uch (%m)\n",
+				     get_srate(ac), get_ch(ac), err);
+			}
+		}
 
-		if (!tx->aubuf) {
-			err = aubuf_alloc(&tx->aubuf, tx->psize * 2,
-					  tx->psize * 30);
+		if (err) {
+			/* Resampler must be ready before the first frame */
+			err = resampler_setup(&tx->resamp, a, "ausrc",
+					      srate_dsp, channels_dsp,
+					      get_srate(ac), get_ch(ac));
 			if (err)
 				return err;
-		}
 
-		err = ausrc_alloc(&tx->ausrc, NULL, a->cfg.src_mod,
-				  &prm, tx->device,
-				  ausrc_read_handler, ausrc_error_handler, a);
-		if (err) {
-			warning("audio: start_source failed (%s.%s): %m\n",
-				a->cfg.src_mod, tx->device, err);
-			return err;
+			err = source_open(tx, a, srate_dsp, channels_dsp);
+			if (err) {
+				warning("audio: start_source failed"
+					" (%s.%s): %m\n",
+					a->cfg.src_mod, tx->device, err);
+				return err;
+			}
 		}
 
+		if (tx->batch)
+			return 0;
+
 		switch (a->cfg.txmode) {
 #ifdef HAVE_PTHREAD
 		case AUDIO_MODE_THREAD:
@@ -1104,17 +2323,41 @@ static int start_source(struct autx *tx, struct audio *a)
 				}
 			}
 			break;
+
+		case AUDIO_MODE_EVENT:
+			if (!tx->u.thr.run) {
+				tx->u.thr.run = true;
+				err = pthread_create(&tx->u.thr.tid, NULL,
+						     tx_event_thread, a);
+				if (err) {
+					tx->u.thr.run = false;
+					return err;
+				}
+			}
+			break;
+
+		case AUDIO_MODE_SCHEDULER:
+			if (!tx->u.job) {
+				err = msched_job_alloc(&tx->u.job,
+						       baresip_msched(), 5,
+						       sched_tx, a);
+				if (err) {
+					warning("audio: media scheduler"
+						" job failed: %m\n", err);
+					return err;
+				}
+			}
+			break;
 #endif
 
 		case AUDIO_MODE_TMR:
-			tmr_start(&tx->u.tmr, 1, timeout_tx, a);
+			twheel_tmr_start(&tx->u.tmr, baresip_twheel(), 1,
+					 timeout_tx, a);
 			break;
 
 		default:
 			break;
 		}
-
-		tx->ausrc_prm = prm;
 	}
 
 	return 0;
@@ -1184,6 +2427,44 @@ void audio_stop(struct audio *a)
 }
 
 
+/*
+ * An open audio source is kept across a codec change only if it runs
+ * at the new codec rate without a resampler, since the resampler is
+ * used from the device thread.
+ */
+static bool source_match(const struct autx *tx, const struct aucodec *ac)
+{
+	return tx->ausrc && !tx->resamp &&
+		tx->ausrc_prm.srate == get_srate(ac) &&
+		tx->ausrc_prm.ch == get_ch(ac);
+}
+
+
+/*
+ * An open audio player is kept across a codec change if it already
+ * runs at the rate start_player() would choose for the new codec.
+ */
+static bool player_match(const struct aurx *rx, const struct audio *a,
+			 const struct aucodec *ac)
+{
+	uint32_t srate, ch;
+
+	if (!rx->auplay)
+		return false;
+
+	if (a->cfg.srate_auto) {
+		srate = get_srate(ac);
+		ch    = get_ch(ac);
+	}
+	else {
+		device_prm(&srate, &ch, ac,
+			   a->cfg.srate_play, a->cfg.channels_play);
+	}
+
+	return rx->auplay_prm.srate == srate && rx->auplay_prm.ch == ch;
+}
+
+
 int audio_encoder_set(struct audio *a, const struct aucodec *ac,
 		      int pt_tx, const char *params)
 {
@@ -1203,18 +2484,27 @@ int audio_encoder_set(struct audio *a, const struct aucodec *ac,
 		     ac->name, get_srate(ac), get_ch(ac));
 
 		/* Audio source must be stopped first */
-		if (reset) {
-			tx->ausrc = mem_deref(tx->ausrc);
+		if (reset && !source_match(tx, ac)) {
+			tx->ausrc  = mem_deref(tx->ausrc);
+			tx->resamp = mem_deref(tx->resamp);
 		}
 
 		tx->enc = mem_deref(tx->enc);
 		tx->ac = ac;
+		tx->loss_enc = UINT32_MAX;
+		tx->cplx_enc = UINT32_MAX;
+		ATOMIC_STORE(&tx->rate_level, 0);
+		ATOMIC_STORE(&tx->rate_step, 0);
+
+		/* the frame time may differ for a kept audio source */
+		if (tx->ausrc)
+			autx_update_psize(tx);
 	}
 
 	if (ac->encupdh) {
 		struct auenc_param prm;
 
-		prm.ptime = tx->ptime;
+		prm.ptime = autx_frame_ptime(tx);
 
 		err = ac->encupdh(&tx->enc, ac, &prm, params);
 		if (err) {
@@ -1223,9 +2513,36 @@ int audio_encoder_set(struct audio *a, const struct aucodec *ac,
 		}
 	}
 
-	stream_set_srate(a->strm, ac->crate, ac->crate);
-	stream_update_encoder(a->strm, pt_tx);
-
+	stream_set_srate(a->strm, ac->crate, ac->crate);
+	stream_update_encoder(a->strm, pt_tx);
+
+	/* Comfort Noise must use the RTP clock rate of the codec */
+	if (a->cfg.vad) {
+		const struct sdp_format *cn;
+
+		cn = sdp_media_format(stream_sdpmedia(a->strm), false, NULL,
+				      -1, "CN", ac->crate, -1);
+		tx->pt_cn = cn ? cn->pt : -1;
+	}
+
+	/* a prompt is encoded for the old codec */
+	if (a->prompt) {
+		a->prompt = mem_deref(a->prompt);
+		ATOMIC_STORE(&tx->prompt, false);
+	}
+
+	/* a held call follows the codec to its group */
+	if (a->moh) {
+		a->moh = mem_deref(a->moh);
+		err = moh_join(&a->moh, a, ac);
+		if (err) {
+			warning("audio: music on hold: %m\n", err);
+			ATOMIC_STORE(&tx->moh, false);
+			stream_hold_send(a->strm, false);
+			err = 0;
+		}
+	}
+
 	if (!tx->ausrc) {
 		err |= audio_start(a);
 	}
@@ -1234,6 +2551,52 @@ int audio_encoder_set(struct audio *a, const struct aucodec *ac,
 }
 
 
+/*
+ * Keep the current decoder for a later switch back to its codec, and
+ * take the decoder of the new codec if one is kept. A peer that flips
+ * between its codecs then costs no allocation and no codec init.
+ */
+/*
+ * The decoder buffer holds the longest frame of a codec, or one packet
+ * time if that is longer
+ */
+static int aurx_sampv_alloc(struct aurx *rx, const struct aucodec *ac)
+{
+	const size_t sz = calc_nsamp(get_srate(ac), get_ch(ac),
+				     max(rx->ptime, DEC_PTIME_MAX));
+	int16_t *sampv;
+
+	if (sz == rx->sampsz)
+		return 0;
+
+	sampv = mem_realloc(rx->sampv, sz * sizeof(int16_t));
+	if (!sampv)
+		return ENOMEM;
+
+	rx->sampv      = sampv;
+	rx->sampsz     = sz;
+	rx->sampc_last = 0;
+
+	return 0;
+}
+
+
+/*
+ * Keep the current decoder for a switch back to its codec, if the codec
+ * can reset it, and take a kept decoder of the new codec, reset
+ */
+static void aurx_dec_swap(struct aurx *rx, const struct aucodec *ac)
+{
+	if (rx->dec && !rx->ac->resetth)
+		rx->dec = mem_deref(rx->dec);
+
+	rx->dec = deccache_swap(&rx->decc, rx->ac, rx->dec, ac);
+
+	if (rx->dec && ac->resetth(rx->dec))
+		rx->dec = mem_deref(rx->dec);
+}
+
+
 int audio_decoder_set(struct audio *a, const struct aucodec *ac,
 		      int pt_rx, const char *params)
 {
@@ -1253,9 +2616,19 @@ int audio_decoder_set(struct audio *a, const struct aucodec *ac,
 		info("audio: Set audio decoder: %s %uHz %dch\n",
 		     ac->name, get_srate(ac), get_ch(ac));
 
+		err = aurx_sampv_alloc(rx, ac);
+		if (err)
+			return err;
+
+		/* a packet of 16-bit PCM, such as L16 */
+		stream_set_rxsz(a->strm, RTP_HEADER_SIZE + RTPEXT_PRESZ +
+				2 * calc_nsamp(get_srate(ac), get_ch(ac),
+					       rx->ptime));
+
 		rx->pt = pt_rx;
+		aurx_dec_swap(rx, ac);
 		rx->ac = ac;
-		rx->dec = mem_deref(rx->dec);
+		rx->fec_pending = false;
 	}
 
 	if (ac->decupdh) {
@@ -1270,7 +2643,13 @@ int audio_decoder_set(struct audio *a, const struct aucodec *ac,
 
 	if (reset) {
 
-		rx->auplay = mem_deref(rx->auplay);
+		/* Re-open the player only if the device rate changes */
+		if (!player_match(rx, a, ac)) {
+			rx->auplay = mem_deref(rx->auplay);
+			rx->ring   = mem_deref(rx->ring);
+		}
+
+		rx->resamp = mem_deref(rx->resamp);
 
 		/* Reset audio filter chain */
 		list_flush(&rx->filtl);
@@ -1310,6 +2689,23 @@ struct stream *audio_strm(const struct audio *a)
 }
 
 
+/**
+ * Get the current audio codec
+ *
+ * @param a  Audio object
+ * @param tx True for the encoder, false for the decoder
+ *
+ * @return Audio codec, or NULL if none
+ */
+const struct aucodec *audio_codec(const struct audio *a, bool tx)
+{
+	if (!a)
+		return NULL;
+
+	return tx ? a->tx.ac : a->rx.ac;
+}
+
+
 int audio_send_digit(struct audio *a, char key)
 {
 	int err = 0;
@@ -1372,6 +2768,8 @@ void audio_sdp_attr_decode(struct audio *a)
 	if (!a)
 		return;
 
+	audio_pt_update(a);
+
 	/* This is probably only meaningful for audio data, but
 	   may be used with other media types if it makes sense. */
 	attr = sdp_media_rattr(stream_sdpmedia(a->strm), "ptime");
@@ -1385,11 +2783,35 @@ void audio_sdp_attr_decode(struct audio *a)
 			     a->tx.ptime, ptime_tx);
 
 			tx->ptime = ptime_tx;
+			(void)autx_mb_fit(tx);
 
-			if (tx->ac) {
-				tx->psize = 2 * get_framesize(tx->ac,
-							      ptime_tx);
-			}
+			if (tx->ausrc)
+				autx_update_psize(tx);
+		}
+	}
+
+	/* The peer can not receive longer packets than maxptime */
+	attr = sdp_media_rattr(stream_sdpmedia(a->strm), "maxptime");
+	if (attr) {
+		struct autx *tx = &a->tx;
+		uint32_t maxptime = atoi(attr);
+		uint32_t fptime  = autx_frame_ptime(tx);
+
+		if (maxptime && tx->ptime > maxptime) {
+
+			uint32_t ptime_tx = maxptime;
+
+			/* whole codec frames, at least one */
+			if (fptime < tx->ptime)
+				ptime_tx = max(maxptime / fptime, 1) * fptime;
+
+			info("audio: limit ptime_tx to maxptime %ums"
+			     " -> %ums\n", maxptime, ptime_tx);
+
+			tx->ptime = ptime_tx;
+
+			if (tx->ausrc)
+				autx_update_psize(tx);
 		}
 	}
 }
@@ -1405,6 +2827,232 @@ static int aucodec_print(struct re_printf *pf, const struct aucodec *ac)
 }
 
 
+/**
+ * Relay RTP between two audio streams without transcoding
+ *
+ * While the decoder of one stream and the encoder of the other use the
+ * same codec, received payloads are sent on the other stream as they
+ * are. Otherwise the audio is decoded and encoded as usual.
+ *
+ * @param a    Audio object
+ * @param peer Other audio object, or NULL to stop relaying
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int audio_relay(struct audio *a, struct audio *peer)
+{
+	if (!a || a == peer)
+		return EINVAL;
+
+	if (a->relay) {
+		relay_release(a);
+		relay_release(a->relay);
+
+		a->relay->relay = NULL;
+		a->relay = NULL;
+	}
+
+	if (!peer)
+		return 0;
+
+	if (!a->mb_relay)
+		a->mb_relay = mbuf_alloc(STREAM_PRESZ + 4096);
+	if (!peer->mb_relay)
+		peer->mb_relay = mbuf_alloc(STREAM_PRESZ + 4096);
+	if (!a->mb_relay || !peer->mb_relay)
+		return ENOMEM;
+
+	(void)audio_relay(peer, NULL);
+
+	a->relay = peer;
+	peer->relay = a;
+
+	return 0;
+}
+
+
+/**
+ * Send an encoded music on hold or prompt packet on the stream
+ *
+ * @param a      Audio object
+ * @param mb     Encoded payload, with STREAM_PRESZ headroom
+ * @param ts_inc Timestamp increment of the packet
+ */
+void audio_moh_send(struct audio *a, struct mbuf *mb, uint32_t ts_inc)
+{
+	struct autx *tx;
+
+	if (!a || !mb)
+		return;
+
+	tx = &a->tx;
+
+	mb->pos = STREAM_PRESZ;
+
+	lock_write_get(tx->lock);
+
+	/* nothing is sent for a silent (DTX) frame */
+	if (mbuf_get_left(mb) &&
+	    0 == stream_send(a->strm, tx->marker, -1, tx->ts, mb))
+		tx->marker = false;
+
+	tx->ts += ts_inc;
+
+	lock_rel(tx->lock);
+}
+
+
+/**
+ * Send music on hold instead of the audio source
+ *
+ * The music is encoded once for all held calls with the same codec,
+ * see the audio_moh setting.
+ *
+ * @param a      Audio object
+ * @param enable True to start, false to stop music on hold
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int audio_moh(struct audio *a, bool enable)
+{
+	struct autx *tx;
+	int err;
+
+	if (!a)
+		return EINVAL;
+
+	tx = &a->tx;
+
+	a->moh = mem_deref(a->moh);
+
+	if (!enable) {
+		if (ATOMIC_LOAD(&tx->moh)) {
+			ATOMIC_STORE(&tx->moh, false);
+			stream_hold_send(a->strm, false);
+			tx->marker = true;
+		}
+		return 0;
+	}
+
+	if (!tx->ac)
+		return ENOENT;
+
+	err = moh_join(&a->moh, a, tx->ac);
+	if (err)
+		return err;
+
+	tx->marker = true;
+	ATOMIC_STORE(&tx->moh, true);
+
+	/* only the music is sent while the call is held */
+	stream_hold_send(a->strm, true);
+
+	return 0;
+}
+
+
+static void prompt_done_handler(void *arg)
+{
+	struct audio *a = arg;
+
+	info("audio: prompt done\n");
+
+	ATOMIC_STORE(&a->tx.prompt, false);
+	a->tx.marker = true;
+}
+
+
+/**
+ * Play an audio file as a prompt, instead of the audio source
+ *
+ * The prompt is encoded once per codec and packet time, and the
+ * encoded packets are shared by all calls that play it.
+ *
+ * @param a        Audio object
+ * @param filename Filename of the audio file in the play path, NULL
+ *                 to stop
+ * @param repeat   Number of times to play, -1 is forever
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int audio_prompt(struct audio *a, const char *filename, int repeat)
+{
+	struct autx *tx;
+	int err;
+
+	if (!a)
+		return EINVAL;
+
+	tx = &a->tx;
+
+	a->prompt = mem_deref(a->prompt);
+
+	if (!filename) {
+		if (ATOMIC_LOAD(&tx->prompt)) {
+			ATOMIC_STORE(&tx->prompt, false);
+			tx->marker = true;
+		}
+		return 0;
+	}
+
+	if (!tx->ac)
+		return ENOENT;
+
+	/* the music on hold sends while the call is held */
+	if (ATOMIC_LOAD(&tx->moh))
+		return EBUSY;
+
+	err = prompt_play_alloc(&a->prompt, a, tx->ac, tx->ptime, filename,
+				repeat, prompt_done_handler, a);
+	if (err)
+		return err;
+
+	tx->marker = true;
+	ATOMIC_STORE(&tx->prompt, true);
+
+	return 0;
+}
+
+
+static size_t mbuf_mem(const struct mbuf *mb)
+{
+	return mb ? mb->size : 0;
+}
+
+
+/**
+ * Add the memory of an audio stream to a memory report
+ *
+ * The states of the codecs and filters are not counted.
+ *
+ * @param ms Memory report
+ * @param a  Audio object
+ */
+void audio_memstat(struct callmem *ms, const struct audio *a)
+{
+	if (!ms || !a)
+		return;
+
+	ms->obj += sizeof(*a);
+
+	ms->buf += a->rx.sampsz * sizeof(int16_t);
+	if (a->tx.fch)
+		ms->buf += AUDIO_SAMPSZ * sizeof(float);
+	if (a->rx.fch)
+		ms->buf += AUDIO_SAMPSZ * sizeof(float);
+
+	if (a->tx.ring)
+		ms->ring += auring_mem(a->tx.ring);
+	if (a->rx.ring)
+		ms->ring += auring_mem(a->rx.ring);
+
+	ms->pkt += mbuf_mem(a->tx.mb);
+	ms->pkt += mbuf_mem(a->tx.mb_tel);
+	ms->pkt += mbuf_mem(a->mb_relay);
+
+	stream_memstat(ms, a->strm);
+}
+
 int audio_debug(struct re_printf *pf, const struct audio *a)
 {
 	const struct autx *tx;
@@ -1419,15 +3067,38 @@ int audio_debug(struct re_printf *pf, const struct audio *a)
 
 	err  = re_hprintf(pf, "\n--- Audio stream ---\n");
 
-	err |= re_hprintf(pf, " tx:   %H %H ptime=%ums\n",
+	err |= re_hprintf(pf, " tx:   %H %H ptime=%ums loss=%u%% rate=-%u"
+			  " cplx=-%u\n",
 			  aucodec_print, tx->ac,
-			  aubuf_debug, tx->aubuf,
-			  tx->ptime);
+			  auring_debug, tx->ring,
+			  tx->ptime, ATOMIC_LOAD(&tx->loss_pct),
+			  ATOMIC_LOAD(&tx->rate_level),
+			  ATOMIC_LOAD(&tx->cplx));
 
-	err |= re_hprintf(pf, " rx:   %H %H ptime=%ums pt=%d\n",
+	err |= re_hprintf(pf, " rx:   %H %H ptime=%ums pt=%d fec=%u\n",
 			  aucodec_print, rx->ac,
-			  aubuf_debug, rx->aubuf,
-			  rx->ptime, rx->pt);
+			  auring_debug, rx->ring,
+			  rx->ptime, rx->pt, rx->n_fec);
+	err |= re_hprintf(pf, "       late=%u plc=%u accel=%u expand=%u\n",
+			  rx->n_late, rx->n_plc, rx->n_accel, rx->n_expand);
+
+	if (a->relay) {
+		err |= re_hprintf(pf, " relay: %u packets%s\n", a->n_relay,
+				  relay_match(a) ? "" : " (transcoding)");
+	}
+
+	if (tx->batch || tx->n_drop) {
+		err |= re_hprintf(pf, " tx:   %u late packets dropped\n",
+				  tx->n_drop);
+	}
+
+	if (tx->pt_cn >= 0 && tx->n_frames) {
+		err |= re_hprintf(pf, " vad:  %u of %u frames suppressed"
+				  " (%u%%)\n",
+				  tx->n_silent, tx->n_frames,
+				  (uint32_t)(100ULL * tx->n_silent
+					     / tx->n_frames));
+	}
 
 	err |= re_hprintf(pf,
 			  " %H"
@@ -1435,12 +3106,119 @@ int audio_debug(struct re_printf *pf, const struct audio *a)
 			  autx_print_pipeline, tx,
 			  aurx_print_pipeline, rx);
 
+	err |= re_hprintf(pf, " tx latency:\n%H", aulat_debug, &tx->lat);
+	err |= re_hprintf(pf, " rx latency:\n%H", aulat_debug, &rx->lat);
+
+#ifdef USE_ALLOC_STATS
+	err |= re_hprintf(pf, " tx allocs:\n%H%H",
+			  allocstat_debug, &tx->alloc_src,
+			  allocstat_debug, &tx->alloc);
+	err |= re_hprintf(pf, " rx allocs:\n%H%H",
+			  allocstat_debug, &rx->alloc,
+			  allocstat_debug, &rx->alloc_play);
+#endif
+
 	err |= stream_debug(pf, a->strm);
 
+#ifdef HAVE_PTHREAD
+	if (tx->batch)
+		err |= aubatch_debug(pf, NULL);
+
+	if (a->cfg.txmode == AUDIO_MODE_SCHEDULER || tx->batch)
+		err |= msched_debug(pf, baresip_msched());
+#endif
+
 	return err;
 }
 
 
+/**
+ * Get the audio level measured by a level meter filter
+ *
+ * @param a    Audio object
+ * @param tx   True for the transmit direction, false for receive
+ * @param rms  Returned RMS level in [dBov]
+ * @param peak Returned peak level in [dBov]
+ *
+ * @return 0 if success, ENOENT if no level was measured
+ */
+int audio_level(const struct audio *a, bool tx, double *rms, double *peak)
+{
+	if (!a)
+		return EINVAL;
+
+	return aulevel_get(tx ? &a->tx.level : &a->rx.level, rms, peak);
+}
+
+
+/**
+ * Get the counters of the receive direction, of the frames that were
+ * concealed or stretched
+ *
+ * @param a  Audio object
+ * @param st Returned counters
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int audio_rx_stats(const struct audio *a, struct audio_rxstat *st)
+{
+	if (!a || !st)
+		return EINVAL;
+
+	st->n_fec    = a->rx.n_fec;
+	st->n_late   = a->rx.n_late;
+	st->n_plc    = a->rx.n_plc;
+	st->n_accel  = a->rx.n_accel;
+	st->n_expand = a->rx.n_expand;
+
+	return 0;
+}
+
+
+/**
+ * Get the audio level the peer sent in the last RTP packet (RFC 6464)
+ *
+ * @param a     Audio object
+ * @param level Returned level in [dBov]
+ * @param voice Returned voice activity, as detected by the peer
+ *
+ * @return 0 if success, ENOENT if the peer sent no level
+ */
+int audio_level_rtp(const struct audio *a, double *level, bool *voice)
+{
+	uint8_t lvl;
+	int err;
+
+	if (!a)
+		return EINVAL;
+
+	err = stream_audio_level_rx(a->strm, &lvl, voice);
+	if (err)
+		return err;
+
+	if (level)
+		*level = -(double)lvl;
+
+	return 0;
+}
+
+
+/**
+ * Set the complexity level of the audio encoder, applied with the next
+ * frame
+ *
+ * @param a     Audio object
+ * @param level Complexity level, 0 is the configured complexity
+ */
+void audio_set_cplx(struct audio *a, unsigned level)
+{
+	if (!a)
+		return;
+
+	ATOMIC_STORE(&a->tx.cplx, min(level, CPLX_LEVEL_MAX));
+}
+
+
 void audio_set_devicename(struct audio *a, const char *src, const char *play)
 {
 	if (!a)
@@ -3,9 +3,16 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <math.h>
 #include <re.h>
 #include <baresip.h>
 #include "core.h"
+#ifdef HAVE_SIMD_X86
+#include <immintrin.h>
+#endif
+#ifdef HAVE_SIMD_NEON
+#include <arm_neon.h>
+#endif
 
 
 static struct list afl;
@@ -35,3 +42,458 @@ struct list *aufilt_list(void)
 {
 	return &afl;
 }
+
+
+/*
+ * Audio filter chain
+ *
+ * The chain runs all filters of one direction on the same buffer. Runs
+ * of float filters share one float scratch buffer, so the int16/float
+ * conversion is done once at each format boundary instead of once per
+ * filter.
+ */
+
+
+enum {
+	FBUF_ALIGN = 32,  /**< Alignment of the float buffer in bytes */
+};
+
+#define S16_SCALE (1.0f / 32768.0f)
+
+
+typedef void (to_float_h)(float *dst, const int16_t *src, size_t n);
+typedef void (to_s16_h)(int16_t *dst, const float *src, size_t n);
+
+struct aufilt_chain {
+	void *mem;             /**< Memory for the float buffer        */
+	float *fbuf;           /**< Float samples, SIMD aligned        */
+	size_t maxc;           /**< Size of float buffer in samples    */
+	uint64_t convc;        /**< Number of format conversions       */
+	to_float_h *to_floath; /**< int16 to float conversion          */
+	to_s16_h *to_s16h;     /**< float to int16 conversion          */
+};
+
+
+static void to_float_c(float *dst, const int16_t *src, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++)
+		dst[i] = src[i] * S16_SCALE;
+}
+
+
+static void to_s16_c(int16_t *dst, const float *src, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+
+		float v = src[i] * 32768.0f;
+
+		if (v > 32767.0f)
+			v = 32767.0f;
+		else if (v < -32768.0f)
+			v = -32768.0f;
+
+		dst[i] = (int16_t)lrintf(v);
+	}
+}
+
+
+#ifdef HAVE_SIMD_X86
+
+#define SSE2 __attribute__((target("sse2")))
+
+
+SSE2 static void to_float_sse2(float *dst, const int16_t *src, size_t n)
+{
+	const __m128 scale = _mm_set1_ps(S16_SCALE);
+	size_t i;
+
+	for (i=0; i+8 <= n; i+=8) {
+
+		__m128i v  = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+		_mm_storeu_ps(dst + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo),
+						      scale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi),
+						      scale));
+	}
+
+	to_float_c(dst + i, src + i, n - i);
+}
+
+
+SSE2 static void to_s16_sse2(int16_t *dst, const float *src, size_t n)
+{
+	const __m128 scale = _mm_set1_ps(32768.0f);
+	const __m128 vmax  = _mm_set1_ps(32767.0f);
+	const __m128 vmin  = _mm_set1_ps(-32768.0f);
+	size_t i;
+
+	for (i=0; i+8 <= n; i+=8) {
+
+		__m128 a = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+		__m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+
+		a = _mm_min_ps(_mm_max_ps(a, vmin), vmax);
+		b = _mm_min_ps(_mm_max_ps(b, vmin), vmax);
+
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 _mm_packs_epi32(_mm_cvtps_epi32(a),
+						 _mm_cvtps_epi32(b)));
+	}
+
+	to_s16_c(dst + i, src + i, n - i);
+}
+
+#endif /* HAVE_SIMD_X86 */
+
+
+#ifdef HAVE_SIMD_NEON
+
+static void to_float_neon(float *dst, const int16_t *src, size_t n)
+{
+	const float32x4_t scale = vdupq_n_f32(S16_SCALE);
+	size_t i;
+
+	for (i=0; i+8 <= n; i+=8) {
+
+		int16x8_t v = vld1q_s16(src + i);
+
+		vst1q_f32(dst + i,
+			  vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))),
+				    scale));
+		vst1q_f32(dst + i + 4,
+			  vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))),
+				    scale));
+	}
+
+	to_float_c(dst + i, src + i, n - i);
+}
+
+
+#ifdef __aarch64__
+static void to_s16_neon(int16_t *dst, const float *src, size_t n)
+{
+	const float32x4_t vmax = vdupq_n_f32(32767.0f);
+	const float32x4_t vmin = vdupq_n_f32(-32768.0f);
+	size_t i;
+
+	for (i=0; i+8 <= n; i+=8) {
+
+		float32x4_t a = vmulq_n_f32(vld1q_f32(src + i), 32768.0f);
+		float32x4_t b = vmulq_n_f32(vld1q_f32(src + i + 4), 32768.0f);
+
+		a = vminq_f32(vmaxq_f32(a, vmin), vmax);
+		b = vminq_f32(vmaxq_f32(b, vmin), vmax);
+
+		/* round to nearest even, as lrintf() */
+		vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(a)),
+						vqmovn_s32(vcvtnq_s32_f32(b))));
+	}
+
+	to_s16_c(dst + i, src + i, n - i);
+}
+#else
+#define to_s16_neon to_s16_c
+#endif
+
+#endif /* HAVE_SIMD_NEON */
+
+
+static void select_simd(to_float_h **to_floath, to_s16_h **to_s16h,
+			enum simd_impl impl)
+{
+	*to_floath = to_float_c;
+	*to_s16h   = to_s16_c;
+
+	if (!simd_supported(impl))
+		return;
+
+	switch (impl) {
+
+#ifdef HAVE_SIMD_X86
+	case SIMD_SSE2:
+	case SIMD_AVX2:
+		*to_floath = to_float_sse2;
+		*to_s16h   = to_s16_sse2;
+		break;
+#endif
+#ifdef HAVE_SIMD_NEON
+	case SIMD_NEON:
+		*to_floath = to_float_neon;
+		*to_s16h   = to_s16_neon;
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+
+static void select_best(to_float_h **to_floath, to_s16_h **to_s16h)
+{
+	static to_float_h *best_to_float;
+	static to_s16_h *best_to_s16;
+
+	if (!best_to_float)
+		select_simd(&best_to_float, &best_to_s16, simd_best());
+
+	if (to_floath)
+		*to_floath = best_to_float;
+	if (to_s16h)
+		*to_s16h = best_to_s16;
+}
+
+
+/**
+ * Convert 16-bit samples to float samples in [-1.0, 1.0)
+ *
+ * @param dst Float samples, n samples
+ * @param src 16-bit samples
+ * @param n   Number of samples
+ */
+void ausamp_to_float(float *dst, const int16_t *src, size_t n)
+{
+	to_float_h *to_floath;
+
+	if (!dst || !src)
+		return;
+
+	select_best(&to_floath, NULL);
+
+	to_floath(dst, src, n);
+}
+
+
+/**
+ * Convert float samples to 16-bit samples, with saturation
+ *
+ * @param dst 16-bit samples, n samples
+ * @param src Float samples in [-1.0, 1.0)
+ * @param n   Number of samples
+ */
+void ausamp_to_s16(int16_t *dst, const float *src, size_t n)
+{
+	to_s16_h *to_s16h;
+
+	if (!dst || !src)
+		return;
+
+	select_best(NULL, &to_s16h);
+
+	to_s16h(dst, src, n);
+}
+
+
+static void chain_destructor(void *arg)
+{
+	struct aufilt_chain *ch = arg;
+
+	mem_deref(ch->mem);
+}
+
+
+/**
+ * Allocate an audio filter chain executor
+ *
+ * @param chp  Pointer to allocated chain
+ * @param maxc Maximum number of samples per frame
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aufilt_chain_alloc(struct aufilt_chain **chp, size_t maxc)
+{
+	struct aufilt_chain *ch;
+
+	if (!chp || !maxc)
+		return EINVAL;
+
+	ch = mem_zalloc(sizeof(*ch), chain_destructor);
+	if (!ch)
+		return ENOMEM;
+
+	ch->mem = mem_alloc(maxc * sizeof(float) + FBUF_ALIGN, NULL);
+	if (!ch->mem) {
+		mem_deref(ch);
+		return ENOMEM;
+	}
+
+	ch->fbuf = (float *)(((uintptr_t)ch->mem + FBUF_ALIGN - 1) &
+			     ~(uintptr_t)(FBUF_ALIGN - 1));
+	ch->maxc = maxc;
+
+	aufilt_chain_set_simd(ch, simd_best());
+
+	*chp = ch;
+
+	return 0;
+}
+
+
+/**
+ * Select the SIMD implementation of the sample format conversion
+ *
+ * @param ch   Audio filter chain
+ * @param impl SIMD implementation, falls back to C if not supported
+ */
+void aufilt_chain_set_simd(struct aufilt_chain *ch, enum simd_impl impl)
+{
+	if (!ch)
+		return;
+
+	select_simd(&ch->to_floath, &ch->to_s16h, impl);
+}
+
+
+/* Switch the frame to float, returns false if it does not fit */
+static bool enter_float(struct aufilt_chain *ch, const int16_t *sampv,
+			size_t sampc)
+{
+	if (!ch || sampc > ch->maxc)
+		return false;
+
+	ch->to_floath(ch->fbuf, sampv, sampc);
+	++ch->convc;
+
+	return true;
+}
+
+
+static void leave_float(struct aufilt_chain *ch, int16_t *sampv,
+			size_t sampc)
+{
+	ch->to_s16h(sampv, ch->fbuf, min(sampc, ch->maxc));
+	++ch->convc;
+}
+
+
+/**
+ * Run one audio frame through the encode filters, in list order
+ *
+ * @param ch    Audio filter chain, may be NULL if no float filters
+ * @param filtl List of filter states (struct aufilt_enc_st)
+ * @param sampv Samples, processed in-place
+ * @param sampc Number of samples, may be updated by the filters
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aufilt_chain_encode(struct aufilt_chain *ch, const struct list *filtl,
+			int16_t *sampv, size_t *sampc)
+{
+	struct le *le;
+	bool flt = false;
+	int err = 0;
+
+	if (!sampv || !sampc)
+		return EINVAL;
+
+	for (le = list_head(filtl); le; le = le->next) {
+		struct aufilt_enc_st *st = le->data;
+		const struct aufilt *af = st->af;
+
+		if (!af)
+			continue;
+
+		if (af->enc_floath && (flt || !af->ench)) {
+
+			if (!flt) {
+				flt = enter_float(ch, sampv, *sampc);
+				if (!flt) {
+					err |= ENOMEM;
+					continue;
+				}
+			}
+
+			err |= af->enc_floath(st, ch->fbuf, sampc);
+		}
+		else if (af->ench) {
+
+			if (flt) {
+				leave_float(ch, sampv, *sampc);
+				flt = false;
+			}
+
+			err |= af->ench(st, sampv, sampc);
+		}
+	}
+
+	if (flt)
+		leave_float(ch, sampv, *sampc);
+
+	return err;
+}
+
+
+/**
+ * Run one audio frame through the decode filters, in reverse list order
+ *
+ * @param ch    Audio filter chain, may be NULL if no float filters
+ * @param filtl List of filter states (struct aufilt_dec_st)
+ * @param sampv Samples, processed in-place
+ * @param sampc Number of samples, may be updated by the filters
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aufilt_chain_decode(struct aufilt_chain *ch, const struct list *filtl,
+			int16_t *sampv, size_t *sampc)
+{
+	struct le *le;
+	bool flt = false;
+	int err = 0;
+
+	if (!sampv || !sampc)
+		return EINVAL;
+
+	for (le = list_tail(filtl); le; le = le->prev) {
+		struct aufilt_dec_st *st = le->data;
+		const struct aufilt *af = st->af;
+
+		if (!af)
+			continue;
+
+		if (af->dec_floath && (flt || !af->dech)) {
+
+			if (!flt) {
+				flt = enter_float(ch, sampv, *sampc);
+				if (!flt) {
+					err |= ENOMEM;
+					continue;
+				}
+			}
+
+			err |= af->dec_floath(st, ch->fbuf, sampc);
+		}
+		else if (af->dech) {
+
+			if (flt) {
+				leave_float(ch, sampv, *sampc);
+				flt = false;
+			}
+
+			err |= af->dech(st, sampv, sampc);
+		}
+	}
+
+	if (flt)
+		leave_float(ch, sampv, *sampc);
+
+	return err;
+}
+
+
+/**
+ * Get the number of int16/float conversions done by the chain
+ *
+ * @param ch Audio filter chain
+ *
+ * @return Number of conversions
+ */
+uint64_t aufilt_chain_convc(const struct aufilt_chain *ch)
+{
+	return ch ? ch->convc : 0;
+}
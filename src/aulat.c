@@ -0,0 +1,164 @@
+/**
+ * @file aulat.c  Audio latency per pipeline stage
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * Each stage has one histogram per window. The writer (the thread that
+ * runs the pipeline) fills the current window and rotates every
+ * AULAT_WINDOW. There are three windows, so the one being reset is
+ * neither written nor the one shown by aulat_debug().
+ */
+
+enum {
+	AULAT_WINDOW = 10000000,  /**< Window length in [us] */
+};
+
+
+static const char *stage_name(enum aulat_stage stage, bool rx)
+{
+	switch (stage) {
+
+	case AULAT_DEVICE: return "device";
+	case AULAT_AUBUF:  return "aubuf";
+	case AULAT_RESAMP: return "resamp";
+	case AULAT_FILT:   return "aufilt";
+	case AULAT_CODEC:  return rx ? "decode" : "encode";
+	case AULAT_RTP:    return rx ? "jbuf" : "rtp";
+	default:           return "?";
+	}
+}
+
+
+/**
+ * Initialise the latency monitor
+ *
+ * @param al Latency monitor
+ * @param rx True for the receive direction
+ */
+void aulat_init(struct aulat *al, bool rx)
+{
+	if (!al)
+		return;
+
+	memset(al, 0, sizeof(*al));
+
+	al->rd = AULAT_WINS - 1;
+	al->rx = rx;
+}
+
+
+/**
+ * Start a new window if the current one has expired, writer only
+ *
+ * @param al  Latency monitor
+ * @param now Current time in [us]
+ */
+void aulat_tick(struct aulat *al, uint64_t now)
+{
+	unsigned wr, next;
+
+	if (!al)
+		return;
+
+	if (!al->ts_win) {
+		al->ts_win = now;
+		return;
+	}
+
+	if (now - al->ts_win < AULAT_WINDOW)
+		return;
+
+	wr   = al->wr;
+	next = (wr + 1) % AULAT_WINS;
+
+	memset(al->winv[next], 0, sizeof(al->winv[next]));
+
+	ATOMIC_STORE(&al->rd, wr);
+	ATOMIC_STORE(&al->wr, next);
+
+	al->ts_win = now;
+}
+
+
+/**
+ * Add the latency of one frame in a stage, writer only
+ *
+ * @param al    Latency monitor
+ * @param stage Pipeline stage
+ * @param usec  Latency in [us]
+ */
+void aulat_add(struct aulat *al, enum aulat_stage stage, uint32_t usec)
+{
+	if (!al || stage >= AULAT_N)
+		return;
+
+	histo_add(&al->winv[al->wr][stage], usec);
+}
+
+
+/**
+ * Get the histogram of the last complete window, or the current window
+ * if none has completed yet
+ *
+ * @param al    Latency monitor
+ * @param stage Pipeline stage
+ *
+ * @return Histogram of the stage
+ */
+const struct histo *aulat_histo(const struct aulat *al,
+				enum aulat_stage stage)
+{
+	const struct histo *h;
+
+	if (!al || stage >= AULAT_N)
+		return NULL;
+
+	h = &al->winv[ATOMIC_LOAD(&al->rd)][stage];
+	if (!histo_count(h))
+		h = &al->winv[ATOMIC_LOAD(&al->wr)][stage];
+
+	return h;
+}
+
+
+/**
+ * Print the percentiles of all stages
+ *
+ * @param pf Print handler
+ * @param al Latency monitor
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aulat_debug(struct re_printf *pf, const struct aulat *al)
+{
+	int err = 0;
+	int stage;
+
+	if (!al)
+		return 0;
+
+	for (stage=0; stage<AULAT_N; stage++) {
+
+		const struct histo *h = aulat_histo(al, stage);
+
+		if (!histo_count(h))
+			continue;
+
+		err |= re_hprintf(pf, "   %-6s [us] n=%llu"
+				  " p50=%u p95=%u p99=%u max=%u\n",
+				  stage_name(stage, al->rx), histo_count(h),
+				  histo_percentile(h, 50),
+				  histo_percentile(h, 95),
+				  histo_percentile(h, 99),
+				  histo_max(h));
+	}
+
+	return err;
+}
@@ -0,0 +1,320 @@
+/**
+ * @file src/aulevel.c  Audio level meter
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <math.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+#ifdef HAVE_SIMD_X86
+#include <immintrin.h>
+#endif
+#ifdef HAVE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+
+/**
+ * \page AudioLevel Audio level meter
+ *
+ * The sum of squares and the peak of a frame are computed 8 to 16
+ * samples at a time with SIMD, selected at runtime. The squares of two
+ * samples are added in 32 bits, which cannot overflow as unsigned, and
+ * then widened to 64 bits. All versions give exactly the same result.
+ *
+ * A level meter filter publishes the RMS and peak level of the last
+ * frame in a struct aulevel, which other threads read without locking.
+ */
+
+
+#define LEVEL_MIN  -96.0     /**< Level of digital silence in [dBov] */
+
+
+typedef void (level_h)(const int16_t *sampv, size_t sampc,
+		       uint64_t *sumsq, uint16_t *peak);
+
+
+static void level_c(const int16_t *sampv, size_t sampc,
+		    uint64_t *sumsq, uint16_t *peak)
+{
+	uint64_t sum = 0;
+	uint16_t pk = 0;
+	size_t i;
+
+	for (i=0; i<sampc; i++) {
+
+		int32_t v = sampv[i];
+		uint16_t a = v < 0 ? (uint16_t)min(-v, 32767) : (uint16_t)v;
+
+		sum += (uint32_t)(v * v);
+		pk = max(pk, a);
+	}
+
+	*sumsq += sum;
+	*peak = max(*peak, pk);
+}
+
+
+#ifdef HAVE_SIMD_X86
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+
+SSE2 static void level_sse2(const int16_t *sampv, size_t sampc,
+			    uint64_t *sumsq, uint16_t *peak)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum = zero, pk = zero;
+	uint64_t s[2];
+	int16_t p[8];
+	size_t i;
+	int j;
+
+	for (i=0; i + 8 <= sampc; i += 8) {
+
+		__m128i v  = _mm_loadu_si128((const __m128i *)&sampv[i]);
+		__m128i sq = _mm_madd_epi16(v, v);
+
+		sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(sq, zero));
+		sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(sq, zero));
+
+		/* saturating negate, so that -32768 is 32767 */
+		pk = _mm_max_epi16(pk, _mm_max_epi16(v,
+					_mm_subs_epi16(zero, v)));
+	}
+
+	_mm_storeu_si128((__m128i *)s, sum);
+	_mm_storeu_si128((__m128i *)p, pk);
+
+	*sumsq += s[0] + s[1];
+	for (j=0; j<8; j++)
+		*peak = max(*peak, (uint16_t)p[j]);
+
+	level_c(&sampv[i], sampc - i, sumsq, peak);
+}
+
+
+AVX2 static void level_avx2(const int16_t *sampv, size_t sampc,
+			    uint64_t *sumsq, uint16_t *peak)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i sum = zero, pk = zero;
+	uint64_t s[4];
+	int16_t p[16];
+	size_t i;
+	int j;
+
+	for (i=0; i + 16 <= sampc; i += 16) {
+
+		__m256i v  = _mm256_loadu_si256((const __m256i *)&sampv[i]);
+		__m256i sq = _mm256_madd_epi16(v, v);
+
+		sum = _mm256_add_epi64(sum, _mm256_unpacklo_epi32(sq, zero));
+		sum = _mm256_add_epi64(sum, _mm256_unpackhi_epi32(sq, zero));
+
+		pk = _mm256_max_epi16(pk, _mm256_max_epi16(v,
+					_mm256_subs_epi16(zero, v)));
+	}
+
+	_mm256_storeu_si256((__m256i *)s, sum);
+	_mm256_storeu_si256((__m256i *)p, pk);
+
+	*sumsq += s[0] + s[1] + s[2] + s[3];
+	for (j=0; j<16; j++)
+		*peak = max(*peak, (uint16_t)p[j]);
+
+	level_sse2(&sampv[i], sampc - i, sumsq, peak);
+}
+
+#endif /* HAVE_SIMD_X86 */
+
+
+#ifdef HAVE_SIMD_NEON
+
+static void level_neon(const int16_t *sampv, size_t sampc,
+		       uint64_t *sumsq, uint16_t *peak)
+{
+	uint64x2_t sum = vdupq_n_u64(0);
+	int16x8_t pk = vdupq_n_s16(0);
+	int16_t p[8];
+	size_t i;
+	int j;
+
+	for (i=0; i + 8 <= sampc; i += 8) {
+
+		int16x8_t v = vld1q_s16(&sampv[i]);
+		int32x4_t lo = vmull_s16(vget_low_s16(v), vget_low_s16(v));
+		int32x4_t hi = vmull_s16(vget_high_s16(v), vget_high_s16(v));
+
+		sum = vpadalq_u32(sum, vreinterpretq_u32_s32(lo));
+		sum = vpadalq_u32(sum, vreinterpretq_u32_s32(hi));
+
+		/* saturating absolute, so that -32768 is 32767 */
+		pk = vmaxq_s16(pk, vqabsq_s16(v));
+	}
+
+	vst1q_s16(p, pk);
+
+	*sumsq += vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+	for (j=0; j<8; j++)
+		*peak = max(*peak, (uint16_t)p[j]);
+
+	level_c(&sampv[i], sampc - i, sumsq, peak);
+}
+
+#endif /* HAVE_SIMD_NEON */
+
+
+static level_h *impl_level(enum simd_impl impl)
+{
+	if (!simd_supported(impl))
+		return level_c;
+
+	switch (impl) {
+
+#ifdef HAVE_SIMD_X86
+	case SIMD_SSE2: return level_sse2;
+	case SIMD_AVX2: return level_avx2;
+#endif
+#ifdef HAVE_SIMD_NEON
+	case SIMD_NEON: return level_neon;
+#endif
+	default:        return level_c;
+	}
+}
+
+
+static level_h *best_level(void)
+{
+	static level_h *levelh;
+
+	if (!levelh)
+		levelh = impl_level(simd_best());
+
+	return levelh;
+}
+
+
+static int32_t to_cdb(double ms)
+{
+	double db = ms > 0.0 ? 10.0 * log10(ms) : LEVEL_MIN;
+
+	return (int32_t)lrint(max(db, LEVEL_MIN) * 100.0);
+}
+
+
+/**
+ * Compute the sum of squares and the peak of 16-bit samples with a
+ * given implementation
+ *
+ * @param impl  SIMD implementation, falls back to C if not supported
+ * @param sampv Audio samples
+ * @param sampc Number of samples
+ * @param sumsq Sum of squares, added to
+ * @param peak  Largest absolute sample, updated
+ */
+void aulevel_calc_impl(enum simd_impl impl, const int16_t *sampv,
+		       size_t sampc, uint64_t *sumsq, uint16_t *peak)
+{
+	if (!sampv || !sumsq || !peak)
+		return;
+
+	impl_level(impl)(sampv, sampc, sumsq, peak);
+}
+
+
+/**
+ * Compute the sum of squares and the peak of 16-bit samples
+ *
+ * @param sampv Audio samples
+ * @param sampc Number of samples
+ * @param sumsq Sum of squares, added to
+ * @param peak  Largest absolute sample, updated
+ */
+void aulevel_calc(const int16_t *sampv, size_t sampc,
+		  uint64_t *sumsq, uint16_t *peak)
+{
+	if (!sampv || !sumsq || !peak)
+		return;
+
+	best_level()(sampv, sampc, sumsq, peak);
+}
+
+
+/**
+ * Measure the level of an audio frame
+ *
+ * @param lvl   Audio level, written atomically
+ * @param sampv Audio samples
+ * @param sampc Number of samples
+ */
+void aulevel_update(struct aulevel *lvl, const int16_t *sampv, size_t sampc)
+{
+	uint64_t sumsq = 0;
+	uint16_t peak = 0;
+	double fs = 32767.0 * 32767.0;
+
+	if (!lvl || !sampv || !sampc)
+		return;
+
+	best_level()(sampv, sampc, &sumsq, &peak);
+
+	ATOMIC_STORE(&lvl->rms,  to_cdb((double)sumsq / sampc / fs));
+	ATOMIC_STORE(&lvl->peak, to_cdb((double)peak * peak / fs));
+	ATOMIC_ADD(&lvl->n, 1);
+}
+
+
+/**
+ * Get the level of the last measured frame
+ *
+ * @param lvl  Audio level
+ * @param rms  Returned RMS level in [dBov]
+ * @param peak Returned peak level in [dBov]
+ *
+ * @return 0 if success, ENOENT if nothing was measured yet
+ */
+int aulevel_get(const struct aulevel *lvl, double *rms, double *peak)
+{
+	if (!lvl)
+		return EINVAL;
+
+	if (!ATOMIC_LOAD(&lvl->n))
+		return ENOENT;
+
+	if (rms)
+		*rms  = ATOMIC_LOAD(&lvl->rms) / 100.0;
+	if (peak)
+		*peak = ATOMIC_LOAD(&lvl->peak) / 100.0;
+
+	return 0;
+}
+
+
+/**
+ * Get the level of audio samples, as in the audio level header
+ * extension (RFC 6464)
+ *
+ * @param sampv Audio samples
+ * @param sampc Number of samples
+ *
+ * @return Level in [-dBov], from 0 to 127
+ */
+uint8_t aulevel_dbov(const int16_t *sampv, size_t sampc)
+{
+	uint64_t sumsq = 0;
+	uint16_t peak = 0;
+	int32_t cdb;
+
+	if (!sampv || !sampc)
+		return 127;
+
+	best_level()(sampv, sampc, &sumsq, &peak);
+
+	cdb = to_cdb((double)sumsq / sampc / (32767.0 * 32767.0));
+
+	return (uint8_t)min((-cdb + 50) / 100, 127);
+}
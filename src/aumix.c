@@ -0,0 +1,360 @@
+/**
+ * @file src/aumix.c  Audio mixing kernels
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+#ifdef HAVE_SIMD_X86
+#include <immintrin.h>
+#endif
+#ifdef HAVE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+
+/**
+ * \page AudioMix Audio mixing kernels
+ *
+ * An N-way mix is done in two steps. The frames of all talkers are
+ * added once into a 32-bit accumulator, which cannot overflow. Each
+ * output is then the accumulator plus a local signal, minus the
+ * talker's own frame if it is in the mix, saturated to 16 bits. This
+ * costs O(N) for N outputs instead of O(N^2).
+ *
+ * The kernels are computed 8 to 16 samples at a time with SIMD,
+ * selected at runtime. All versions give exactly the same result.
+ */
+
+
+typedef void (acc_h)(int32_t *accv, const int16_t *sampv, size_t n);
+typedef void (mix_h)(int16_t *dst, const int32_t *accv,
+		     const int16_t *own, size_t n);
+
+
+static void acc_c(int32_t *accv, const int16_t *sampv, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++)
+		accv[i] += sampv[i];
+}
+
+
+static void mix_c(int16_t *dst, const int32_t *accv, const int16_t *own,
+		  size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+
+		int32_t v = dst[i] + accv[i] - (own ? own[i] : 0);
+
+		dst[i] = (int16_t)min(max(v, -32768), 32767);
+	}
+}
+
+
+#ifdef HAVE_SIMD_X86
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+
+/* sign-extend the low and high 4 samples to 32 bits */
+#define WIDEN_LO(v) _mm_srai_epi32(_mm_unpacklo_epi16((v), (v)), 16)
+#define WIDEN_HI(v) _mm_srai_epi32(_mm_unpackhi_epi16((v), (v)), 16)
+
+
+SSE2 static void acc_sse2(int32_t *accv, const int16_t *sampv, size_t n)
+{
+	size_t i;
+
+	for (i=0; i + 8 <= n; i += 8) {
+
+		__m128i v  = _mm_loadu_si128((const __m128i *)&sampv[i]);
+		__m128i a0 = _mm_loadu_si128((const __m128i *)&accv[i]);
+		__m128i a1 = _mm_loadu_si128((const __m128i *)&accv[i+4]);
+
+		_mm_storeu_si128((__m128i *)&accv[i],
+				 _mm_add_epi32(a0, WIDEN_LO(v)));
+		_mm_storeu_si128((__m128i *)&accv[i+4],
+				 _mm_add_epi32(a1, WIDEN_HI(v)));
+	}
+
+	acc_c(&accv[i], &sampv[i], n - i);
+}
+
+
+SSE2 static void mix_sse2(int16_t *dst, const int32_t *accv,
+			  const int16_t *own, size_t n)
+{
+	size_t i;
+
+	for (i=0; i + 8 <= n; i += 8) {
+
+		__m128i d  = _mm_loadu_si128((const __m128i *)&dst[i]);
+		__m128i lo = _mm_loadu_si128((const __m128i *)&accv[i]);
+		__m128i hi = _mm_loadu_si128((const __m128i *)&accv[i+4]);
+
+		lo = _mm_add_epi32(lo, WIDEN_LO(d));
+		hi = _mm_add_epi32(hi, WIDEN_HI(d));
+
+		if (own) {
+			__m128i o = _mm_loadu_si128((const __m128i *)&own[i]);
+
+			lo = _mm_sub_epi32(lo, WIDEN_LO(o));
+			hi = _mm_sub_epi32(hi, WIDEN_HI(o));
+		}
+
+		/* saturating pack back to 16 bits */
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_packs_epi32(lo, hi));
+	}
+
+	mix_c(&dst[i], &accv[i], own ? &own[i] : NULL, n - i);
+}
+
+
+AVX2 static void acc_avx2(int32_t *accv, const int16_t *sampv, size_t n)
+{
+	size_t i;
+
+	for (i=0; i + 8 <= n; i += 8) {
+
+		__m128i v = _mm_loadu_si128((const __m128i *)&sampv[i]);
+		__m256i a = _mm256_loadu_si256((const __m256i *)&accv[i]);
+
+		a = _mm256_add_epi32(a, _mm256_cvtepi16_epi32(v));
+
+		_mm256_storeu_si256((__m256i *)&accv[i], a);
+	}
+
+	acc_c(&accv[i], &sampv[i], n - i);
+}
+
+
+AVX2 static void mix_avx2(int16_t *dst, const int32_t *accv,
+			  const int16_t *own, size_t n)
+{
+	size_t i;
+
+	for (i=0; i + 16 <= n; i += 16) {
+
+		__m128i d0 = _mm_loadu_si128((const __m128i *)&dst[i]);
+		__m128i d1 = _mm_loadu_si128((const __m128i *)&dst[i+8]);
+		__m256i lo = _mm256_loadu_si256((const __m256i *)&accv[i]);
+		__m256i hi = _mm256_loadu_si256((const __m256i *)&accv[i+8]);
+		__m256i r;
+
+		lo = _mm256_add_epi32(lo, _mm256_cvtepi16_epi32(d0));
+		hi = _mm256_add_epi32(hi, _mm256_cvtepi16_epi32(d1));
+
+		if (own) {
+			__m128i o0, o1;
+
+			o0 = _mm_loadu_si128((const __m128i *)&own[i]);
+			o1 = _mm_loadu_si128((const __m128i *)&own[i+8]);
+
+			lo = _mm256_sub_epi32(lo, _mm256_cvtepi16_epi32(o0));
+			hi = _mm256_sub_epi32(hi, _mm256_cvtepi16_epi32(o1));
+		}
+
+		/* the pack works per 128-bit lane, restore the order */
+		r = _mm256_packs_epi32(lo, hi);
+		r = _mm256_permute4x64_epi64(r, 0xd8);
+
+		_mm256_storeu_si256((__m256i *)&dst[i], r);
+	}
+
+	mix_sse2(&dst[i], &accv[i], own ? &own[i] : NULL, n - i);
+}
+
+#endif /* HAVE_SIMD_X86 */
+
+
+#ifdef HAVE_SIMD_NEON
+
+static void acc_neon(int32_t *accv, const int16_t *sampv, size_t n)
+{
+	size_t i;
+
+	for (i=0; i + 8 <= n; i += 8) {
+
+		int16x8_t v = vld1q_s16(&sampv[i]);
+
+		vst1q_s32(&accv[i],
+			  vaddw_s16(vld1q_s32(&accv[i]), vget_low_s16(v)));
+		vst1q_s32(&accv[i+4],
+			  vaddw_s16(vld1q_s32(&accv[i+4]), vget_high_s16(v)));
+	}
+
+	acc_c(&accv[i], &sampv[i], n - i);
+}
+
+
+static void mix_neon(int16_t *dst, const int32_t *accv, const int16_t *own,
+		     size_t n)
+{
+	size_t i;
+
+	for (i=0; i + 8 <= n; i += 8) {
+
+		int16x8_t d = vld1q_s16(&dst[i]);
+		int32x4_t lo = vaddw_s16(vld1q_s32(&accv[i]), vget_low_s16(d));
+		int32x4_t hi = vaddw_s16(vld1q_s32(&accv[i+4]),
+					 vget_high_s16(d));
+
+		if (own) {
+			int16x8_t o = vld1q_s16(&own[i]);
+
+			lo = vsubw_s16(lo, vget_low_s16(o));
+			hi = vsubw_s16(hi, vget_high_s16(o));
+		}
+
+		vst1q_s16(&dst[i], vcombine_s16(vqmovn_s32(lo),
+						vqmovn_s32(hi)));
+	}
+
+	mix_c(&dst[i], &accv[i], own ? &own[i] : NULL, n - i);
+}
+
+#endif /* HAVE_SIMD_NEON */
+
+
+static void select_simd(acc_h **acch, mix_h **mixh, enum simd_impl impl)
+{
+	*acch = acc_c;
+	*mixh = mix_c;
+
+	if (!simd_supported(impl))
+		return;
+
+	switch (impl) {
+
+#ifdef HAVE_SIMD_X86
+	case SIMD_SSE2:
+		*acch = acc_sse2;
+		*mixh = mix_sse2;
+		break;
+
+	case SIMD_AVX2:
+		*acch = acc_avx2;
+		*mixh = mix_avx2;
+		break;
+#endif
+#ifdef HAVE_SIMD_NEON
+	case SIMD_NEON:
+		*acch = acc_neon;
+		*mixh = mix_neon;
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+
+static void select_best(acc_h **acch, mix_h **mixh)
+{
+	static acc_h *best_acc;
+	static mix_h *best_mix;
+
+	if (!best_mix)
+		select_simd(&best_acc, &best_mix, simd_best());
+
+	if (acch)
+		*acch = best_acc;
+	if (mixh)
+		*mixh = best_mix;
+}
+
+
+/**
+ * Add 16-bit samples to a 32-bit mix accumulator
+ *
+ * @param accv  Accumulator, n samples
+ * @param sampv Samples to add
+ * @param n     Number of samples
+ */
+void aumix_acc(int32_t *accv, const int16_t *sampv, size_t n)
+{
+	acc_h *acch;
+
+	if (!accv || !sampv)
+		return;
+
+	select_best(&acch, NULL);
+
+	acch(accv, sampv, n);
+}
+
+
+/**
+ * Add a mix accumulator to 16-bit samples, with saturation
+ *
+ * @param dst  Samples to add to, in-place
+ * @param accv Accumulator, n samples
+ * @param own  Samples to leave out of the mix, or NULL
+ * @param n    Number of samples
+ */
+void aumix_mix(int16_t *dst, const int32_t *accv, const int16_t *own,
+	       size_t n)
+{
+	mix_h *mixh;
+
+	if (!dst || !accv)
+		return;
+
+	select_best(NULL, &mixh);
+
+	mixh(dst, accv, own, n);
+}
+
+
+/**
+ * Add samples to a mix accumulator with a given implementation
+ *
+ * @param impl  SIMD implementation, falls back to C if not supported
+ * @param accv  Accumulator, n samples
+ * @param sampv Samples to add
+ * @param n     Number of samples
+ */
+void aumix_acc_impl(enum simd_impl impl, int32_t *accv,
+		    const int16_t *sampv, size_t n)
+{
+	acc_h *acch;
+	mix_h *mixh;
+
+	if (!accv || !sampv)
+		return;
+
+	select_simd(&acch, &mixh, impl);
+
+	acch(accv, sampv, n);
+}
+
+
+/**
+ * Add a mix accumulator to samples with a given implementation
+ *
+ * @param impl SIMD implementation, falls back to C if not supported
+ * @param dst  Samples to add to, in-place
+ * @param accv Accumulator, n samples
+ * @param own  Samples to leave out of the mix, or NULL
+ * @param n    Number of samples
+ */
+void aumix_mix_impl(enum simd_impl impl, int16_t *dst, const int32_t *accv,
+		    const int16_t *own, size_t n)
+{
+	acc_h *acch;
+	mix_h *mixh;
+
+	if (!dst || !accv)
+		return;
+
+	select_simd(&acch, &mixh, impl);
+
+	mixh(dst, accv, own, n);
+}
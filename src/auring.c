@@ -0,0 +1,260 @@
+/**
+ * @file auring.c  Lock-free single-producer/single-consumer audio ring
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The write position is only modified by the producer, and the read
+ * position is only modified by the consumer. Both are free-running
+ * counters, so the fill level is always (wpos - rpos).
+ *
+ * When the fill level goes above the maximum the oldest samples are
+ * dropped, like aubuf does. The producer cannot move the read position,
+ * so it keeps writing into the spare half of the ring, and the consumer
+ * skips the oldest samples on its next read. Only if the consumer has
+ * stopped reading, and the ring is completely full, are new samples
+ * dropped.
+ *
+ * The producer and consumer fields are separated by a full cache-line
+ * of padding, so that they never share a cache-line whatever the
+ * alignment of the allocation is. This avoids false sharing between the
+ * device thread and the encoder/decoder thread.
+ */
+
+enum { CACHE_LINE = 64 };
+
+#if defined (__GNUC__)
+#define LOAD_ACQUIRE(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define LOAD_ACQUIRE(p)     (*(volatile size_t *)(p))
+#define STORE_RELEASE(p, v) (*(volatile size_t *)(p) = (v))
+#endif
+
+
+struct auring {
+	/* producer */
+	size_t wpos;                 /**< Write position in [samples]     */
+	uint32_t n_overflow;         /**< Number of writes above maximum  */
+	uint8_t pad1[CACHE_LINE];
+
+	/* consumer */
+	size_t rpos;                 /**< Read position in [samples]      */
+	uint32_t n_underrun;         /**< Number of silent reads          */
+	bool filling;                /**< Waiting for min_sz samples      */
+	uint8_t pad2[CACHE_LINE];
+
+	/* constant after allocation */
+	int16_t *sampv;              /**< Sample storage                  */
+	size_t mask;                 /**< Ring size minus one             */
+	size_t min_sz;               /**< Minimum fill level [samples]    */
+	size_t max_sz;               /**< Maximum fill level [samples]    */
+};
+
+
+static void destructor(void *arg)
+{
+	struct auring *ar = arg;
+
+	mem_deref(ar->sampv);
+}
+
+
+/**
+ * Allocate a new audio ring-buffer
+ *
+ * @param arp    Pointer to allocated ring-buffer
+ * @param min_sz Minimum number of bytes to buffer before reading
+ * @param max_sz Maximum number of bytes in the buffer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int auring_alloc(struct auring **arp, size_t min_sz, size_t max_sz)
+{
+	struct auring *ar;
+	size_t sz = 1;
+
+	if (!arp || !max_sz || min_sz > max_sz)
+		return EINVAL;
+
+	ar = mem_zalloc(sizeof(*ar), destructor);
+	if (!ar)
+		return ENOMEM;
+
+	/* use a power of two, so that the index is a simple mask, with
+	   room for twice the maximum fill level */
+	while (sz < max_sz)
+		sz <<= 1;
+
+	ar->sampv = mem_zalloc(sz * sizeof(int16_t), NULL);
+	if (!ar->sampv) {
+		mem_deref(ar);
+		return ENOMEM;
+	}
+
+	ar->mask    = sz - 1;
+	ar->min_sz  = min_sz/2;
+	ar->max_sz  = max_sz/2;
+	ar->filling = true;
+
+	*arp = ar;
+
+	return 0;
+}
+
+
+/**
+ * Write samples to the ring-buffer. If the maximum fill level is
+ * exceeded, the oldest samples are dropped by the next read.
+ *
+ * @note Must only be called from the producer thread
+ *
+ * @param ar    Audio ring-buffer
+ * @param sampv Audio samples
+ * @param sampc Number of samples
+ *
+ * @return 0 if success, ENOMEM if the consumer has stopped reading
+ */
+int auring_write_samp(struct auring *ar, const int16_t *sampv, size_t sampc)
+{
+	size_t wpos, rpos, idx, n;
+
+	if (!ar || !sampv)
+		return EINVAL;
+
+	/* only the newest samples fit */
+	if (sampc > ar->max_sz) {
+		sampv += sampc - ar->max_sz;
+		sampc  = ar->max_sz;
+	}
+
+	wpos = ar->wpos;
+	rpos = LOAD_ACQUIRE(&ar->rpos);
+
+	if (wpos - rpos + sampc > ar->max_sz)
+		++ar->n_overflow;
+
+	/* the consumer may still read the oldest samples */
+	if (wpos - rpos + sampc > ar->mask + 1)
+		return ENOMEM;
+
+	idx = wpos & ar->mask;
+	n   = min(sampc, ar->mask + 1 - idx);
+
+	memcpy(&ar->sampv[idx], sampv, n * sizeof(int16_t));
+	memcpy(ar->sampv, &sampv[n], (sampc - n) * sizeof(int16_t));
+
+	STORE_RELEASE(&ar->wpos, wpos + sampc);
+
+	return 0;
+}
+
+
+/**
+ * Read samples from the ring-buffer. On underrun the buffer is filled
+ * with silence, and reading resumes when the minimum level is reached.
+ *
+ * @note Must only be called from the consumer thread
+ *
+ * @param ar    Audio ring-buffer
+ * @param sampv Buffer for audio samples
+ * @param sampc Number of samples to read
+ */
+void auring_read_samp(struct auring *ar, int16_t *sampv, size_t sampc)
+{
+	size_t wpos, rpos, idx, n, cur;
+
+	if (!ar || !sampv)
+		return;
+
+	rpos = ar->rpos;
+	wpos = LOAD_ACQUIRE(&ar->wpos);
+	cur  = wpos - rpos;
+
+	/* drop the oldest samples above the maximum */
+	if (cur > ar->max_sz) {
+		rpos = wpos - ar->max_sz;
+		cur  = ar->max_sz;
+		STORE_RELEASE(&ar->rpos, rpos);
+	}
+
+	if (ar->filling) {
+		if (cur < ar->min_sz || cur < sampc)
+			goto silence;
+
+		ar->filling = false;
+	}
+	else if (cur < sampc) {
+		++ar->n_underrun;
+		ar->filling = true;
+		goto silence;
+	}
+
+	idx = rpos & ar->mask;
+	n   = min(sampc, ar->mask + 1 - idx);
+
+	memcpy(sampv, &ar->sampv[idx], n * sizeof(int16_t));
+	memcpy(&sampv[n], ar->sampv, (sampc - n) * sizeof(int16_t));
+
+	STORE_RELEASE(&ar->rpos, rpos + sampc);
+
+	return;
+
+ silence:
+	memset(sampv, 0, sampc * sizeof(int16_t));
+}
+
+
+/**
+ * Get the current number of bytes in the ring-buffer, at most the
+ * maximum fill level
+ *
+ * @param ar Audio ring-buffer
+ *
+ * @return Number of bytes
+ */
+size_t auring_cur_size(const struct auring *ar)
+{
+	size_t wpos, rpos;
+
+	if (!ar)
+		return 0;
+
+	rpos = LOAD_ACQUIRE(&ar->rpos);
+	wpos = LOAD_ACQUIRE(&ar->wpos);
+
+	return 2 * min(wpos - rpos, ar->max_sz);
+}
+
+
+/**
+ * Get the memory used by the ring-buffer
+ *
+ * @param ar Audio ring-buffer
+ *
+ * @return Number of bytes
+ */
+size_t auring_mem(const struct auring *ar)
+{
+	if (!ar)
+		return 0;
+
+	return sizeof(*ar) + (ar->mask + 1) * sizeof(int16_t);
+}
+
+
+int auring_debug(struct re_printf *pf, const struct auring *ar)
+{
+	if (!ar)
+		return 0;
+
+	return re_hprintf(pf, "auring: cur=%zu/%zu bytes or=%u ur=%u",
+			  auring_cur_size(ar), 2 * ar->max_sz,
+			  ar->n_overflow, ar->n_underrun);
+}
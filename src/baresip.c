@@ -14,10 +14,16 @@
  */
 static struct baresip {
 	struct network *net;
+	struct msched *msched;
+	struct twheel *wheel;
 
 } baresip;
 
 
+/* The media and refresh timers of all calls share one timer wheel */
+enum { WHEEL_RES = 1 };
+
+
 int baresip_init(struct config *cfg, bool prefer_ipv6)
 {
 	int err;
@@ -26,6 +32,19 @@ int baresip_init(struct config *cfg, bool prefer_ipv6)
 		return EINVAL;
 
 	baresip.net = mem_deref(baresip.net);
+	baresip.wheel = mem_deref(baresip.wheel);
+
+	g711_batch_init();
+
+	mclock_set_mode(cfg->avt.media_fast ? MCLOCK_FAST : MCLOCK_REAL);
+
+	err = twheel_alloc(&baresip.wheel, WHEEL_RES);
+	if (err)
+		return err;
+
+	err = lagmon_init();
+	if (err)
+		return err;
 
 	/* Initialise Network */
 	err = net_alloc(&baresip.net, &cfg->net,
@@ -35,13 +54,31 @@ int baresip_init(struct config *cfg, bool prefer_ipv6)
 		return err;
 	}
 
+#ifdef HAVE_PTHREAD
+	baresip.msched = mem_deref(baresip.msched);
+
+	/* Initialise Media scheduler */
+	if (cfg->audio.txmode == AUDIO_MODE_SCHEDULER || cfg->audio.offload) {
+
+		err = msched_alloc(&baresip.msched, cfg->avt.media_threads);
+		if (err) {
+			warning("ua: media scheduler init failed: %m\n", err);
+			return err;
+		}
+	}
+#endif
+
 	return 0;
 }
 
 
 void baresip_close(void)
 {
+	lagmon_close();
+	trace_close();
+	baresip.msched = mem_deref(baresip.msched);
 	baresip.net = mem_deref(baresip.net);
+	baresip.wheel = mem_deref(baresip.wheel);
 }
 
 
@@ -49,3 +86,21 @@ struct network *baresip_network(void)
 {
 	return baresip.net;
 }
+
+
+struct msched *baresip_msched(void)
+{
+	return baresip.msched;
+}
+
+
+/**
+ * Get the timer wheel of the media and refresh timers. The timers run
+ * in the main thread, like a struct tmr.
+ *
+ * @return Timer wheel
+ */
+struct twheel *baresip_twheel(void)
+{
+	return baresip.wheel;
+}
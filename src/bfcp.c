@@ -15,6 +15,13 @@ struct bfcp {
 	struct mnat_media *mnat_st;
 	bool active;
 
+	/* client */
+	bfcp_floor_h *floorh;
+	void *arg;
+	uint16_t floorid;       /**< Floor of the presentation stream */
+	uint16_t floorreqid;    /**< Pending or granted floor request  */
+	bool granted;
+
 	/* server */
 	uint32_t lconfid;
 	uint16_t luserid;
@@ -55,10 +62,67 @@ static enum bfcp_transp str2tp(const char *proto)
 }
 
 
+/*
+ * The status of our floor request, from a FloorRequestStatus or a
+ * FloorStatus. The floor handler is called only when the floor is
+ * granted or lost, not for the states in between.
+ */
+static void floor_status(struct bfcp *bfcp, const struct bfcp_msg *msg)
+{
+	const struct bfcp_attr *fri, *ors, *rs;
+	enum bfcp_reqstat status;
+	bool granted;
+
+	fri = bfcp_msg_attr(msg, BFCP_FLOOR_REQ_INFO);
+	if (!fri)
+		return;
+
+	ors = bfcp_attr_subattr(fri, BFCP_OVERALL_REQ_STATUS);
+	rs  = bfcp_attr_subattr(ors, BFCP_REQUEST_STATUS);
+	if (!rs)
+		return;
+
+	if (bfcp->floorreqid && fri->v.u16 != bfcp->floorreqid)
+		return;
+
+	status = rs->v.reqstatus.status;
+
+	info("bfcp: floor request %u: %s\n", fri->v.u16,
+	     bfcp_reqstatus_name(status));
+
+	switch (status) {
+
+	case BFCP_GRANTED:
+		bfcp->floorreqid = fri->v.u16;
+		granted = true;
+		break;
+
+	case BFCP_DENIED:
+	case BFCP_CANCELLED:
+	case BFCP_RELEASED:
+	case BFCP_REVOKED:
+		bfcp->floorreqid = 0;
+		granted = false;
+		break;
+
+	default:
+		bfcp->floorreqid = fri->v.u16;
+		return;
+	}
+
+	if (granted == bfcp->granted)
+		return;
+
+	bfcp->granted = granted;
+
+	if (bfcp->floorh)
+		bfcp->floorh(granted, bfcp->arg);
+}
+
+
 static void bfcp_resp_handler(int err, const struct bfcp_msg *msg, void *arg)
 {
 	struct bfcp *bfcp = arg;
-	(void)bfcp;
 
 	if (err) {
 		warning("bfcp: error response: %m\n", err);
@@ -67,6 +131,17 @@ static void bfcp_resp_handler(int err, const struct bfcp_msg *msg, void *arg)
 
 	info("bfcp: received BFCP response: '%s'\n",
 	     bfcp_prim_name(msg->prim));
+
+	switch (msg->prim) {
+
+	case BFCP_FLOOR_REQUEST_STATUS:
+	case BFCP_FLOOR_STATUS:
+		floor_status(bfcp, msg);
+		break;
+
+	default:
+		break;
+	}
 }
 
 
@@ -82,6 +157,17 @@ static void bfcp_msg_handler(const struct bfcp_msg *msg, void *arg)
 		(void)bfcp_reply(bfcp->conn, msg, BFCP_HELLO_ACK, 0);
 		break;
 
+	case BFCP_FLOOR_REQUEST_STATUS:
+		(void)bfcp_reply(bfcp->conn, msg,
+				 BFCP_FLOOR_REQ_STATUS_ACK, 0);
+		floor_status(bfcp, msg);
+		break;
+
+	case BFCP_FLOOR_STATUS:
+		(void)bfcp_reply(bfcp->conn, msg, BFCP_FLOOR_STATUS_ACK, 0);
+		floor_status(bfcp, msg);
+		break;
+
 	default:
 		(void)bfcp_ereply(bfcp->conn, msg, BFCP_UNKNOWN_PRIM);
 		break;
@@ -91,7 +177,8 @@ static void bfcp_msg_handler(const struct bfcp_msg *msg, void *arg)
 
 int bfcp_alloc(struct bfcp **bfcpp, struct sdp_session *sdp_sess,
 	       const char *proto, bool offerer,
-	       const struct mnat *mnat, struct mnat_sess *mnat_sess)
+	       const struct mnat *mnat, struct mnat_sess *mnat_sess,
+	       bfcp_floor_h *floorh, void *arg)
 {
 	struct bfcp *bfcp;
 	struct sa laddr;
@@ -108,6 +195,8 @@ int bfcp_alloc(struct bfcp **bfcpp, struct sdp_session *sdp_sess,
 		return ENOMEM;
 
 	bfcp->active = offerer;
+	bfcp->floorh = floorh;
+	bfcp->arg    = arg;
 
 	sa_init(&laddr, AF_INET);
 
@@ -193,7 +282,56 @@ int bfcp_start(struct bfcp *bfcp)
 
 		err = bfcp_request(bfcp->conn, paddr, BFCP_VER2, BFCP_HELLO,
 				   confid, userid, bfcp_resp_handler, bfcp, 0);
+
+		/* a=floorid:<id> [mstrm:<label>] of the floor server */
+		bfcp->floorid = sdp_media_rattr_u32(bfcp->sdpm, "floorid");
 	}
 
 	return err;
 }
+
+
+/**
+ * Request or release the floor of the presentation stream. The floor
+ * handler is called when the floor server has granted or revoked it.
+ *
+ * @param bfcp    BFCP client
+ * @param request True to request the floor, false to release it
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int bfcp_floor(struct bfcp *bfcp, bool request)
+{
+	const struct sa *paddr;
+	uint32_t confid;
+	uint16_t userid;
+
+	if (!bfcp)
+		return EINVAL;
+
+	if (!bfcp->active || !sdp_media_rport(bfcp->sdpm))
+		return ENOTSUP;
+
+	paddr  = sdp_media_raddr(bfcp->sdpm);
+	confid = sdp_media_rattr_u32(bfcp->sdpm, "confid");
+	userid = sdp_media_rattr_u32(bfcp->sdpm, "userid");
+
+	if (request) {
+		if (bfcp->floorreqid)
+			return 0;
+
+		return bfcp_request(bfcp->conn, paddr, BFCP_VER2,
+				    BFCP_FLOOR_REQUEST, confid, userid,
+				    bfcp_resp_handler, bfcp, 1,
+				    BFCP_FLOOR_ID | BFCP_MANDATORY, 0,
+				    &bfcp->floorid);
+	}
+
+	if (!bfcp->floorreqid)
+		return 0;
+
+	return bfcp_request(bfcp->conn, paddr, BFCP_VER2, BFCP_FLOOR_RELEASE,
+			    confid, userid, bfcp_resp_handler, bfcp, 1,
+			    BFCP_FLOOR_REQUEST_ID | BFCP_MANDATORY, 0,
+			    &bfcp->floorreqid);
+}
@@ -0,0 +1,437 @@
+/**
+ * @file src/bwe.c  Delay-based receive bandwidth estimation
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/**
+ * \page BandwidthEstimation Receive bandwidth estimation
+ *
+ * Packets with the same RTP timestamp form a group, usually one video
+ * frame. For each new group the change of the one-way delay is the
+ * difference between the arrival times and the RTP timestamps of the
+ * last two groups. A trendline over the accumulated delay of the last
+ * BWE_WINDOW groups shows whether a queue is building up on the path
+ * (overuse), draining (underuse), or neither. The detection threshold
+ * adapts to the delay noise of the path, as in draft-ietf-rmcat-gcc.
+ *
+ * The estimate grows by 8% per second while the path is normal, drops
+ * to 85% of the received rate on overuse, and is held on underuse. It
+ * is sent to the sender in REMB messages (draft-alvestrand-rmcat-remb).
+ */
+
+
+enum {
+	BWE_WINDOW     = 20,      /**< Groups in the trendline         */
+	BWE_DELTAS_MAX = 60,      /**< Cap of the trend gain by count  */
+	RATE_WINDOW    = 500000,  /**< Received rate window in [us]    */
+	OVERUSE_TIME   = 10,      /**< Overuse before decreasing [ms]  */
+	DECREASE_MIN   = 200,     /**< Min time between decreases [ms] */
+	UPDATE_MAX     = 1000,    /**< Max time between updates [ms]   */
+};
+
+#define SMOOTHING    0.9      /**< Smoothing of the accumulated delay */
+#define TREND_GAIN   4.0      /**< Gain of the delay trend            */
+#define THRESH_INIT  12.5     /**< Initial threshold                  */
+#define THRESH_MIN   6.0
+#define THRESH_MAX   600.0
+#define K_UP         0.0087   /**< Threshold adaptation, trend above  */
+#define K_DOWN       0.039    /**< Threshold adaptation, trend below  */
+#define BETA         0.85     /**< Decrease factor of received rate   */
+#define ETA          1.08     /**< Increase factor per second         */
+
+
+enum bwe_state {
+	BWE_NORMAL = 0,
+	BWE_OVERUSE,
+	BWE_UNDERUSE,
+};
+
+struct bwe {
+	uint32_t srate;           /**< RTP clock rate [Hz]              */
+	uint32_t rate_min;        /**< Lowest estimate [bit/s]          */
+	uint32_t rate_max;        /**< Highest estimate [bit/s]         */
+	double estimate;          /**< Estimated bandwidth [bit/s]      */
+
+	/* packet groups */
+	bool grp;                 /**< A group was started              */
+	bool prev;                /**< The previous group is complete   */
+	uint32_t grp_ts;          /**< RTP timestamp of current group   */
+	uint64_t grp_us;          /**< Last arrival in current group    */
+	uint32_t prev_ts;
+	uint64_t prev_us;
+
+	/* trendline */
+	uint64_t first_us;        /**< Arrival of the first group       */
+	double acc;               /**< Accumulated delay [ms]           */
+	double smoothed;          /**< Smoothed accumulated delay [ms]  */
+	double xv[BWE_WINDOW];    /**< Arrival times [ms]               */
+	double yv[BWE_WINDOW];    /**< Smoothed delays [ms]             */
+	unsigned n;               /**< Points in the window             */
+	unsigned pos;             /**< Next point in the window         */
+	unsigned deltac;          /**< Number of delay deltas           */
+	double trend;             /**< Last modified trend              */
+
+	/* overuse detector */
+	double thresh;            /**< Adaptive threshold               */
+	uint64_t thresh_us;       /**< Last threshold update            */
+	double overuse_ms;        /**< Time above the threshold         */
+	unsigned overusec;        /**< Groups above the threshold       */
+	enum bwe_state state;
+
+	/* received rate */
+	uint64_t win_us;          /**< Start of rate window             */
+	uint64_t win_bytes;       /**< Bytes in rate window             */
+	uint32_t rate_rx;         /**< Received rate [bit/s]            */
+
+	/* rate control */
+	uint64_t update_us;       /**< Last estimate update             */
+	uint64_t decrease_us;     /**< Last decrease                    */
+	uint32_t n_decrease;      /**< Number of decreases              */
+};
+
+
+static const char *state_name(enum bwe_state st)
+{
+	switch (st) {
+
+	case BWE_NORMAL:   return "normal";
+	case BWE_OVERUSE:  return "overuse";
+	case BWE_UNDERUSE: return "underuse";
+	default:           return "?";
+	}
+}
+
+
+/**
+ * Allocate a receive bandwidth estimator
+ *
+ * @param bwep     Pointer to allocated estimator
+ * @param srate    RTP clock rate in [Hz]
+ * @param rate_min Lowest estimate in [bit/s]
+ * @param rate_max Highest estimate in [bit/s], also the initial one
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int bwe_alloc(struct bwe **bwep, uint32_t srate, uint32_t rate_min,
+	      uint32_t rate_max)
+{
+	struct bwe *bwe;
+
+	if (!bwep || !srate || !rate_max || rate_min > rate_max)
+		return EINVAL;
+
+	bwe = mem_zalloc(sizeof(*bwe), NULL);
+	if (!bwe)
+		return ENOMEM;
+
+	bwe->srate    = srate;
+	bwe->rate_min = rate_min;
+	bwe->rate_max = rate_max;
+	bwe->estimate = rate_max;
+	bwe->thresh   = THRESH_INIT;
+
+	*bwep = bwe;
+
+	return 0;
+}
+
+
+static void rate_update(struct bwe *bwe, uint64_t now, size_t size)
+{
+	if (!bwe->win_us)
+		bwe->win_us = now;
+
+	/* the window ends before this packet */
+	if (now - bwe->win_us >= RATE_WINDOW) {
+
+		bwe->rate_rx = (uint32_t)(8000000ULL * bwe->win_bytes /
+					  (now - bwe->win_us));
+		bwe->win_us    = now;
+		bwe->win_bytes = 0;
+	}
+
+	bwe->win_bytes += size;
+}
+
+
+/* Slope of the smoothed delay over the arrival time */
+static double trendline(struct bwe *bwe, double delta, uint64_t arrival)
+{
+	double xm = 0.0, ym = 0.0, num = 0.0, den = 0.0;
+	unsigned i;
+
+	++bwe->deltac;
+
+	bwe->acc += delta;
+	bwe->smoothed = SMOOTHING * bwe->smoothed +
+		(1.0 - SMOOTHING) * bwe->acc;
+
+	bwe->xv[bwe->pos] = (double)(arrival - bwe->first_us) / 1000.0;
+	bwe->yv[bwe->pos] = bwe->smoothed;
+	bwe->pos = (bwe->pos + 1) % BWE_WINDOW;
+	bwe->n   = min(bwe->n + 1, (unsigned)BWE_WINDOW);
+
+	if (bwe->n < BWE_WINDOW)
+		return bwe->trend;
+
+	for (i=0; i<bwe->n; i++) {
+		xm += bwe->xv[i];
+		ym += bwe->yv[i];
+	}
+	xm /= bwe->n;
+	ym /= bwe->n;
+
+	for (i=0; i<bwe->n; i++) {
+		num += (bwe->xv[i] - xm) * (bwe->yv[i] - ym);
+		den += (bwe->xv[i] - xm) * (bwe->xv[i] - xm);
+	}
+
+	if (den == 0.0)
+		return bwe->trend;
+
+	return num / den * min(bwe->deltac, (unsigned)BWE_DELTAS_MAX) *
+		TREND_GAIN;
+}
+
+
+static void detect(struct bwe *bwe, double trend, double dt, uint64_t now)
+{
+	double t = fabs(trend);
+
+	if (trend > bwe->thresh) {
+
+		bwe->overuse_ms += bwe->overusec ? dt : dt / 2;
+		++bwe->overusec;
+
+		if (bwe->overuse_ms > OVERUSE_TIME && bwe->overusec > 1 &&
+		    trend >= bwe->trend) {
+			bwe->overuse_ms = 0;
+			bwe->overusec   = 0;
+			bwe->state      = BWE_OVERUSE;
+		}
+	}
+	else if (trend < -bwe->thresh) {
+		bwe->overuse_ms = 0;
+		bwe->overusec   = 0;
+		bwe->state      = BWE_UNDERUSE;
+	}
+	else {
+		bwe->overuse_ms = 0;
+		bwe->overusec   = 0;
+		bwe->state      = BWE_NORMAL;
+	}
+
+	bwe->trend = trend;
+
+	/* spikes far above the threshold do not move it */
+	if (bwe->thresh_us && t <= bwe->thresh + 15.0) {
+
+		double k  = t < bwe->thresh ? K_DOWN : K_UP;
+		double ms = min((double)(now - bwe->thresh_us) / 1000.0,
+				100.0);
+
+		bwe->thresh += k * (t - bwe->thresh) * ms;
+		bwe->thresh  = min(max(bwe->thresh, THRESH_MIN), THRESH_MAX);
+	}
+
+	bwe->thresh_us = now;
+}
+
+
+static void rate_control(struct bwe *bwe, uint64_t now)
+{
+	double ms;
+
+	if (!bwe->update_us)
+		bwe->update_us = now;
+
+	ms = min((double)(now - bwe->update_us) / 1000.0,
+		 (double)UPDATE_MAX);
+	bwe->update_us = now;
+
+	switch (bwe->state) {
+
+	case BWE_OVERUSE:
+		if (!bwe->rate_rx)
+			break;
+
+		if (bwe->decrease_us &&
+		    now - bwe->decrease_us < DECREASE_MIN * 1000)
+			break;
+
+		bwe->estimate = min(bwe->estimate, BETA * bwe->rate_rx);
+		bwe->decrease_us = now;
+		++bwe->n_decrease;
+		break;
+
+	case BWE_UNDERUSE:
+		break;
+
+	case BWE_NORMAL:
+		bwe->estimate *= pow(ETA, ms / 1000.0);
+
+		/* do not run away from what is actually received */
+		if (bwe->rate_rx) {
+			bwe->estimate = min(bwe->estimate,
+					    1.5 * bwe->rate_rx + 10000.0);
+		}
+		break;
+	}
+
+	bwe->estimate = min(max(bwe->estimate, (double)bwe->rate_min),
+			    (double)bwe->rate_max);
+}
+
+
+/**
+ * Add a received RTP packet to the estimator
+ *
+ * @param bwe  Receive bandwidth estimator
+ * @param now  Arrival time in [us]
+ * @param ts   RTP timestamp
+ * @param size Size of the packet in [bytes]
+ */
+void bwe_packet(struct bwe *bwe, uint64_t now, uint32_t ts, size_t size)
+{
+	double d_arr, d_ts;
+
+	if (!bwe)
+		return;
+
+	rate_update(bwe, now, size);
+
+	if (!bwe->grp) {
+		bwe->grp      = true;
+		bwe->grp_ts   = ts;
+		bwe->grp_us   = now;
+		bwe->first_us = now;
+		return;
+	}
+
+	if (ts == bwe->grp_ts) {
+		bwe->grp_us = now;
+		return;
+	}
+
+	/* late packet of an older group */
+	if ((int32_t)(ts - bwe->grp_ts) < 0)
+		return;
+
+	if (bwe->prev) {
+		d_arr = (double)(bwe->grp_us - bwe->prev_us) / 1000.0;
+		d_ts  = (double)(bwe->grp_ts - bwe->prev_ts) * 1000.0 /
+			bwe->srate;
+
+		detect(bwe, trendline(bwe, d_arr - d_ts, bwe->grp_us),
+		       d_ts, now);
+		rate_control(bwe, now);
+	}
+
+	bwe->prev    = true;
+	bwe->prev_ts = bwe->grp_ts;
+	bwe->prev_us = bwe->grp_us;
+	bwe->grp_ts  = ts;
+	bwe->grp_us  = now;
+}
+
+
+/**
+ * Get the estimated receive bandwidth
+ *
+ * @param bwe Receive bandwidth estimator
+ *
+ * @return Estimated bandwidth in [bit/s]
+ */
+uint32_t bwe_estimate(const struct bwe *bwe)
+{
+	return bwe ? (uint32_t)bwe->estimate : 0;
+}
+
+
+/**
+ * Encode the FCI of a REMB message (draft-alvestrand-rmcat-remb)
+ *
+ * @param mb      Buffer to encode into
+ * @param bitrate Maximum bitrate in [bit/s]
+ * @param ssrc    SSRC the bitrate applies to
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int bwe_remb_encode(struct mbuf *mb, uint32_t bitrate, uint32_t ssrc)
+{
+	uint32_t exp = 0;
+	int err;
+
+	if (!mb)
+		return EINVAL;
+
+	/* 6-bit exponent and 18-bit mantissa, rounded down */
+	while (bitrate >= (1u << 18)) {
+		bitrate >>= 1;
+		++exp;
+	}
+
+	err  = mbuf_write_mem(mb, (const uint8_t *)"REMB", 4);
+	err |= mbuf_write_u32(mb, htonl(1u << 24 | exp << 18 | bitrate));
+	err |= mbuf_write_u32(mb, htonl(ssrc));
+
+	return err;
+}
+
+
+/**
+ * Decode the FCI of a REMB message
+ *
+ * @param bitrate Returned maximum bitrate in [bit/s]
+ * @param mb      Buffer with the FCI
+ *
+ * @return 0 if success, EBADMSG if not a REMB message
+ */
+int bwe_remb_decode(uint32_t *bitrate, struct mbuf *mb)
+{
+	uint32_t v, exp;
+	size_t pos;
+
+	if (!bitrate || !mb)
+		return EINVAL;
+
+	pos = mb->pos;
+
+	if (mbuf_get_left(mb) < 8 ||
+	    0 != memcmp(mbuf_buf(mb), "REMB", 4))
+		return EBADMSG;
+
+	mb->pos += 4;
+	v = ntohl(mbuf_read_u32(mb));
+	mb->pos = pos;
+
+	exp = (v >> 18) & 0x3f;
+
+	/* an exponent that does not fit saturates */
+	if (exp > 14)
+		*bitrate = UINT32_MAX;
+	else
+		*bitrate = (v & 0x3ffff) << exp;
+
+	return 0;
+}
+
+
+int bwe_debug(struct re_printf *pf, const struct bwe *bwe)
+{
+	if (!bwe)
+		return 0;
+
+	return re_hprintf(pf, "bwe: estimate=%u bit/s received=%u bit/s"
+			  " %s (trend=%.1f threshold=%.1f) decreases=%u",
+			  bwe_estimate(bwe), bwe->rate_rx,
+			  state_name(bwe->state), bwe->trend, bwe->thresh,
+			  bwe->n_decrease);
+}
@@ -6,7 +6,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <time.h>
 #include <re.h>
 #include <baresip.h>
@@ -42,6 +41,8 @@ enum state {
 struct call {
 	MAGIC_DECL                /**< Magic number for debugging           */
 	struct le le;             /**< Linked list element                  */
+	struct le le_id;          /**< Entry in the Call-ID index           */
+	struct hash *idht;        /**< Call-ID index (optional)             */
 	struct ua *ua;            /**< SIP User-agent                       */
 	struct account *acc;      /**< Account (ref.)                       */
 	struct sipsess *sess;     /**< SIP Session                          */
@@ -52,8 +53,11 @@ struct call {
 	struct audio *audio;      /**< Audio stream                         */
 #ifdef USE_VIDEO
 	struct video *video;      /**< Video stream                         */
+	struct sdp_media *sdp_video;/**< Video m-line after teardown        */
 	struct bfcp *bfcp;        /**< BFCP Client                          */
+	bool use_video;           /**< Video may be added to the call       */
 #endif
+	int label;                /**< Label of the last media stream       */
 	enum state state;         /**< Call state                           */
 	char *local_uri;          /**< Local SIP uri                        */
 	char *local_name;         /**< Local display name                   */
@@ -64,13 +68,18 @@ struct call {
 	time_t time_start;        /**< Time when call started               */
 	time_t time_conn;         /**< Time when call initiated             */
 	time_t time_stop;         /**< Time when call stopped               */
+	uint64_t ts_conn;         /**< Call initiated [ms]                  */
+	uint32_t setup_ms;        /**< Call setup time [ms]                 */
 	bool outgoing;
 	bool got_offer;           /**< Got SDP Offer from Peer              */
 	bool on_hold;             /**< True if call is on hold              */
 	struct mnat_sess *mnats;  /**< Media NAT session                    */
 	bool mnat_wait;           /**< Waiting for MNAT to establish        */
+	bool counted;             /**< Counted as active call of the UA     */
 	struct menc_sess *mencs;  /**< Media encryption session state       */
 	int af;                   /**< Preferred Address Family             */
+	int prio;                 /**< Priority, lowest is degraded first   */
+	unsigned cplx;            /**< Codec complexity level               */
 	uint16_t scode;           /**< Termination status code              */
 	call_event_h *eh;         /**< Event handler                        */
 	call_dtmf_h *dtmfh;       /**< DTMF handler                         */
@@ -156,10 +165,20 @@ static void call_stream_start(struct call *call, bool active)
 	}
 
 	if (call->bfcp) {
+		const struct config_bfcp *cfg = &conf_config()->bfcp;
+
 		err = bfcp_start(call->bfcp);
 		if (err) {
 			warning("call: could not start BFCP: %m\n", err);
 		}
+
+		/* warm, so the floor is used without waiting for it */
+		if (call->video && str_isset(cfg->present_mod)) {
+			(void)video_present_open(call->video,
+						 cfg->present_mod,
+						 cfg->present_dev,
+						 cfg->present_fps);
+		}
 	}
 #endif
 
@@ -168,6 +187,9 @@ static void call_stream_start(struct call *call, bool active)
 
 		tmr_cancel(&call->tmr_inv);
 		call->time_start = time(NULL);
+		if (call->ts_conn && !call->setup_ms)
+			call->setup_ms = (uint32_t)(tmr_jiffies() -
+						    call->ts_conn);
 
 		FOREACH_STREAM {
 			stream_reset(le->data);
@@ -210,6 +232,8 @@ static void call_event_handler(struct call *call, enum call_event ev,
 	(void)re_vsnprintf(buf, sizeof(buf), fmt, ap);
 	va_end(ap);
 
+	PROBE3(call_event, call_id(call), ev, buf);
+
 	eh(call, ev, buf, eh_arg);
 }
 
@@ -270,6 +294,134 @@ static void mnat_handler(int err, uint16_t scode, const char *reason,
 }
 
 
+/* The tagged media line of the remote BUNDLE group has the transport */
+static void bundle_update(struct call *call)
+{
+	struct stream *bundle = NULL;
+	struct le *le;
+	int err;
+
+	if (!call->config_avt.bundle || !call->config_avt.rtcp_mux)
+		return;
+
+	FOREACH_STREAM {
+		struct stream *strm = le->data;
+
+		if (0 == sdp_bundle_index(call->sdp, stream_sdpmedia(strm)))
+			bundle = strm;
+	}
+
+	if (!bundle)
+		return;
+
+	FOREACH_STREAM {
+		struct stream *strm = le->data;
+
+		if (strm == bundle ||
+		    sdp_bundle_index(call->sdp, stream_sdpmedia(strm)) < 0)
+			continue;
+
+		err = stream_bundle(strm, bundle);
+		if (err) {
+			warning("call: %s: could not bundle (%m)\n",
+				sdp_media_name(stream_sdpmedia(strm)), err);
+		}
+	}
+
+	err = sdp_session_set_lattr(call->sdp, true, "group", "%H",
+				    stream_bundle_print, bundle);
+	if (err) {
+		warning("call: BUNDLE group: %m\n", err);
+	}
+}
+
+
+#ifdef USE_VIDEO
+static void video_error_handler(int err, const char *str, void *arg)
+{
+	struct call *call = arg;
+	MAGIC_CHECK(call);
+
+	warning("call: video device error: %m (%s)\n", err, str);
+
+	call_stream_stop(call);
+	call_event_handler(call, CALL_EVENT_CLOSED, str);
+}
+
+
+/* True if an SDP offer has a video m-line that is not disabled */
+static bool offer_has_video(const struct mbuf *mb)
+{
+	struct pl pl, port;
+
+	if (!mb)
+		return false;
+
+	pl.p = (const char *)mbuf_buf(mb);
+	pl.l = mbuf_get_left(mb);
+
+	while (!re_regex(pl.p, pl.l, "\nm=video [0-9]+", &port)) {
+
+		if (pl_u32(&port))
+			return true;
+
+		pl.l -= port.p + port.l - pl.p;
+		pl.p  = port.p + port.l;
+	}
+
+	return false;
+}
+
+
+/*
+ * The video stream is allocated only when video is offered by us, or
+ * when the offer of the peer has video
+ */
+static int video_setup(struct call *call, const struct config *cfg)
+{
+	int err;
+
+	if (call->video || call->sdp_video || !call->use_video)
+		return 0;
+
+	err = video_alloc(&call->video, cfg,
+			  call, call->sdp, ++call->label,
+			  call->acc->mnat, call->mnats,
+			  call->acc->menc, call->mencs,
+			  "main",
+			  account_vidcodecl(call->acc),
+			  video_error_handler, call);
+	if (err)
+		return err;
+
+	video_set_cplx(call->video, call->cplx);
+
+	return 0;
+}
+
+
+/*
+ * A video stream that the peer disabled is released. Its m-line is kept
+ * in the SDP session, disabled, so that the m-lines keep their order.
+ */
+static void video_teardown(struct call *call)
+{
+	struct sdp_media *m = stream_sdpmedia(video_strm(call->video));
+
+	if (!m || sdp_media_rport(m))
+		return;
+
+	info("call: video stream removed by peer\n");
+
+	call->sdp_video = mem_ref(m);
+	sdp_media_set_disabled(call->sdp_video, true);
+
+	video_stop(call->video);
+	call->video = mem_deref(call->video);
+}
+#endif
+
+
 static int update_media(struct call *call)
 {
 	const struct sdp_format *sc;
@@ -280,6 +432,8 @@ static int update_media(struct call *call)
 	audio_sdp_attr_decode(call->audio);
 
 #ifdef USE_VIDEO
+	video_teardown(call);
+
 	if (call->video)
 		video_sdp_attr_decode(call->video);
 #endif
@@ -289,6 +443,8 @@ static int update_media(struct call *call)
 		stream_update(le->data);
 	}
 
+	bundle_update(call);
+
 	if (call->acc->mnat && call->acc->mnat->updateh && call->mnats)
 		err = call->acc->mnat->updateh(call->mnats);
 
@@ -338,6 +494,25 @@ static void print_summary(const struct call *call)
 }
 
 
+/**
+ * Detach a call from its User-Agent, it is no longer counted as active
+ *
+ * @param call Call object
+ */
+void call_detach(struct call *call)
+{
+	if (!call)
+		return;
+
+	list_unlink(&call->le);
+
+	if (call->counted) {
+		call->counted = false;
+		ua_call_closed(call->ua);
+	}
+}
+
+
 static void call_destructor(void *arg)
 {
 	struct call *call = arg;
@@ -346,7 +521,8 @@ static void call_destructor(void *arg)
 		print_summary(call);
 
 	call_stream_stop(call);
-	list_unlink(&call->le);
+	hash_unlink(&call->le_id);
+	call_detach(call);
 	tmr_cancel(&call->tmr_dtmf);
 
 	mem_deref(call->sess);
@@ -357,6 +533,7 @@ static void call_destructor(void *arg)
 	mem_deref(call->audio);
 #ifdef USE_VIDEO
 	mem_deref(call->video);
+	mem_deref(call->sdp_video);
 	mem_deref(call->bfcp);
 #endif
 	mem_deref(call->sdp);
@@ -394,30 +571,40 @@ static void audio_error_handler(int err, const char *str, void *arg)
 }
 
 
-#ifdef USE_VIDEO
-static void video_error_handler(int err, const char *str, void *arg)
+static void menc_error_handler(int err, void *arg)
 {
 	struct call *call = arg;
 	MAGIC_CHECK(call);
 
-	warning("call: video device error: %m (%s)\n", err, str);
+	warning("call: mediaenc '%s' error: %m\n", call->acc->mencid, err);
 
 	call_stream_stop(call);
-	call_event_handler(call, CALL_EVENT_CLOSED, str);
+	call_event_handler(call, CALL_EVENT_CLOSED, "mediaenc failed");
 }
-#endif
 
 
-static void menc_error_handler(int err, void *arg)
+static int print_mids(struct re_printf *pf, const struct call *call)
+{
+	struct le *le;
+	int err = 0;
+
+	FOREACH_STREAM
+		err |= re_hprintf(pf, " %s", stream_mid(le->data));
+
+	return err;
+}
+
+
+#ifdef USE_VIDEO
+static void bfcp_floor_handler(bool granted, void *arg)
 {
 	struct call *call = arg;
-	MAGIC_CHECK(call);
 
-	warning("call: mediaenc '%s' error: %m\n", call->acc->mencid, err);
+	info("call: floor %s\n", granted ? "granted" : "released");
 
-	call_stream_stop(call);
-	call_event_handler(call, CALL_EVENT_CLOSED, "mediaenc failed");
+	video_present(call->video, granted);
 }
+#endif
 
 
 /**
@@ -426,6 +613,7 @@ static void menc_error_handler(int err, void *arg)
  * @param callp       Pointer to allocated Call state object
  * @param cfg         Global configuration
  * @param lst         List of call objects
+ * @param idht        Hash table of calls by Call-ID (optional)
  * @param local_name  Local display name (optional)
  * @param local_uri   Local SIP uri
  * @param acc         Account parameters
@@ -439,15 +627,14 @@ static void menc_error_handler(int err, void *arg)
  * @return 0 if success, otherwise errorcode
  */
 int call_alloc(struct call **callp, const struct config *cfg, struct list *lst,
-	       const char *local_name, const char *local_uri,
+	       struct hash *idht, const char *local_name, const char *local_uri,
 	       struct account *acc, struct ua *ua, const struct call_prm *prm,
 	       const struct sip_msg *msg, struct call *xcall,
 	       call_event_h *eh, void *arg)
 {
 	struct call *call;
 	enum vidmode vidmode = prm ? prm->vidmode : VIDMODE_OFF;
-	bool use_video = true, got_offer = false;
-	int label = 0;
+	bool got_offer = false;
 	int err = 0;
 
 	if (!cfg || !local_uri || !acc || !ua)
@@ -465,6 +652,7 @@ int call_alloc(struct call **callp, const struct config *cfg, struct list *lst,
 	tmr_init(&call->tmr_inv);
 
 	call->acc    = mem_ref(acc);
+	call->idht   = idht;
 	call->ua     = ua;
 	call->state  = STATE_IDLE;
 	call->eh     = eh;
@@ -521,10 +709,15 @@ int call_alloc(struct call **callp, const struct config *cfg, struct list *lst,
 	}
 
 	/* Audio stream */
+	err = audio_plan_get(&acc->auplan, &cfg->audio,
+			     account_aucodecl(acc));
+	if (err)
+		goto out;
+
 	err = audio_alloc(&call->audio, cfg, call,
-			  call->sdp, ++label,
+			  call->sdp, ++call->label,
 			  acc->mnat, call->mnats, acc->menc, call->mencs,
-			  acc->ptime, account_aucodecl(call->acc),
+			  acc->ptime, acc->auplan,
 			  audio_event_handler, audio_error_handler, call);
 	if (err)
 		goto out;
@@ -532,42 +725,46 @@ int call_alloc(struct call **callp, const struct config *cfg, struct list *lst,
 #ifdef USE_VIDEO
 	/* We require at least one video codec, and at least one
 	   video source or video display */
-	use_video = (vidmode != VIDMODE_OFF)
+	call->use_video = (vidmode != VIDMODE_OFF)
 		&& (list_head(account_vidcodecl(call->acc)) != NULL)
 		&& (NULL != vidsrc_find(NULL) || NULL != vidisp_find(NULL));
 
-	/* Video stream */
-	if (use_video) {
- 		err = video_alloc(&call->video, cfg,
-				  call, call->sdp, ++label,
-				  acc->mnat, call->mnats,
-				  acc->menc, call->mencs,
-				  "main",
-				  account_vidcodecl(call->acc),
-				  video_error_handler, call);
+	/* Video stream, unless the offer of the peer has no video */
+	if (!got_offer || offer_has_video(msg->mb)) {
+		err = video_setup(call, cfg);
 		if (err)
 			goto out;
- 	}
+	}
 
 	if (str_isset(cfg->bfcp.proto)) {
 
 		err = bfcp_alloc(&call->bfcp, call->sdp,
 				 cfg->bfcp.proto, !got_offer,
-				 acc->mnat, call->mnats);
+				 acc->mnat, call->mnats,
+				 bfcp_floor_handler, call);
 		if (err)
 			goto out;
 	}
 #else
-	(void)use_video;
 	(void)vidmode;
 #endif
 
+	/* RFC 8843, offered with all media */
+	if (cfg->avt.bundle && cfg->avt.rtcp_mux && !got_offer) {
+		err = sdp_session_set_lattr(call->sdp, true, "group",
+					    "BUNDLE%H", print_mids, call);
+		if (err)
+			goto out;
+	}
+
 	/* inherit certain properties from original call */
 	if (xcall) {
 		call->not = mem_ref(xcall->not);
 	}
 
 	list_append(lst, &call->le, call);
+	call->counted = true;
+	ua_call_opened(ua);
 
  out:
 	if (err)
@@ -801,10 +998,39 @@ int call_hold(struct call *call, bool hold)
 	FOREACH_STREAM
 		stream_hold(le->data, hold);
 
+	/* the held party hears the shared music, if configured */
+	(void)audio_moh(call->audio, hold);
+
 	return call_modify(call);
 }
 
 
+/**
+ * Start or stop presenting, the presentation source is sent on the video
+ * stream while the floor is granted
+ *
+ * @param call Call object
+ * @param on   True to request the floor, false to release it
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int call_present(struct call *call, bool on)
+{
+	if (!call)
+		return EINVAL;
+
+#ifdef USE_VIDEO
+	if (!call->bfcp)
+		return ENOTSUP;
+
+	return bfcp_floor(call->bfcp, on);
+#else
+	(void)on;
+	return ENOTSUP;
+#endif
+}
+
+
 int call_sdp_get(const struct call *call, struct mbuf **descp, bool offer)
 {
 	return sdp_encode(descp, call->sdp, offer);
@@ -823,6 +1049,34 @@ const char *call_localuri(const struct call *call)
 }
 
 
+/**
+ * Get the SIP Call-ID of a call
+ *
+ * @param call Call object
+ *
+ * @return Call-ID, or NULL if the SIP session is not created yet
+ */
+const char *call_id(const struct call *call)
+{
+	if (!call || !call->sess)
+		return NULL;
+
+	return sip_dialog_callid(sipsess_dialog(call->sess));
+}
+
+
+/* Add the call to the Call-ID index, once the SIP session exists */
+static void call_index(struct call *call)
+{
+	const char *id = call_id(call);
+
+	if (!id || call->le_id.list)
+		return;
+
+	hash_append(call->idht, hash_joaat_str(id), &call->le_id, call);
+}
+
+
 /**
  * Get the name of the peer
  *
@@ -864,6 +1118,50 @@ int call_debug(struct re_printf *pf, const struct call *call)
 }
 
 
+/**
+ * Print the memory of a call, by component
+ *
+ * @param pf   Print handler
+ * @param call Call object
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int call_memstat(struct re_printf *pf, const struct call *call)
+{
+	struct callmem ms;
+	size_t total;
+	int err;
+
+	if (!call)
+		return EINVAL;
+
+	memset(&ms, 0, sizeof(ms));
+
+	ms.obj += sizeof(*call);
+
+	audio_memstat(&ms, call->audio);
+	video_memstat(&ms, call->video);
+
+	total = ms.obj + ms.buf + ms.ring + ms.pkt + ms.jbuf;
+
+	err  = re_hprintf(pf, "===== Call memory (%s) =====\n",
+			  call->peer_uri);
+	err |= re_hprintf(pf, " objects:       %8zu bytes\n", ms.obj);
+	err |= re_hprintf(pf, " buffers:       %8zu bytes\n", ms.buf);
+	err |= re_hprintf(pf, " audio rings:   %8zu bytes\n", ms.ring);
+	err |= re_hprintf(pf, " packets:       %8zu bytes\n", ms.pkt);
+	err |= re_hprintf(pf, " jitter-buffer: %8zu bytes (full)\n",
+			  ms.jbuf);
+	err |= re_hprintf(pf, " total:         %8zu bytes\n", total);
+	err |= re_hprintf(pf, " shared scratch buffers: %zu bytes\n",
+			  scratch_mem());
+	err |= re_hprintf(pf, " (codec, filter and SIP states"
+			  " are not counted)\n");
+
+	return err;
+}
+
+
 static int print_duration(struct re_printf *pf, const struct call *call)
 {
 	const uint32_t dur = call_duration(call);
@@ -908,6 +1206,75 @@ int call_status(struct re_printf *pf, const struct call *call)
 }
 
 
+static void dirstat_get(struct call_dirstat *ds, const struct stream_stat *s)
+{
+	ds->n_packets    = s->n_packets;
+	ds->n_bytes      = s->n_bytes;
+	ds->n_err        = s->n_err;
+	ds->bitrate      = s->bitrate;
+	ds->peak_bitrate = s->peak_bitrate;
+}
+
+
+static void mediastat_get(struct call_mediastat *ms, const struct stream *s)
+{
+	const struct rtcp_stats *rtcp = stream_rtcp_stats(s);
+	struct stream_stat tx, rx;
+
+	if (!s)
+		return;
+
+	ms->active = true;
+
+	(void)stream_stats(s, &tx, &rx);
+	dirstat_get(&ms->tx, &tx);
+	dirstat_get(&ms->rx, &rx);
+
+	if (rtcp)
+		ms->rtcp = *rtcp;
+
+	(void)stream_jbuf_stats(s, &ms->jbuf);
+}
+
+
+/**
+ * Get a snapshot of the counters of a call and its media streams. Only
+ * counters are copied, without formatting, so it is cheap enough to
+ * poll many calls often.
+ *
+ * @param call Call object
+ * @param st   Returned statistics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int call_stats_get(const struct call *call, struct call_stats *st)
+{
+	if (!call || !st)
+		return EINVAL;
+
+	memset(st, 0, sizeof(*st));
+
+	st->duration = call_duration(call);
+
+	if (call->audio) {
+		struct stream *s = audio_strm(call->audio);
+
+		mediastat_get(&st->audio, s);
+		(void)audio_rx_stats(call->audio, &st->audio_rx);
+		st->quality_valid = 0 == stream_quality(s, &st->quality);
+	}
+
+#ifdef USE_VIDEO
+	if (call->video) {
+		mediastat_get(&st->video, video_strm(call->video));
+		(void)video_stats(call->video, &st->vid);
+	}
+#endif
+
+	return 0;
+}
+
+
 int call_jbuf_stat(struct re_printf *pf, const struct call *call)
 {
 	struct le *le;
@@ -958,6 +1325,12 @@ struct ua *call_get_ua(const struct call *call)
 }
 
 
+struct account *call_account(const struct call *call)
+{
+	return call ? call->acc : NULL;
+}
+
+
 static int auth_handler(char **username, char **password,
 			const char *realm, void *arg)
 {
@@ -979,6 +1352,15 @@ static int sipsess_offer_handler(struct mbuf **descp,
 
 	if (got_offer) {
 
+#ifdef USE_VIDEO
+		/* The peer adds video to the call */
+		if (offer_has_video(msg->mb)) {
+			err = video_setup(call, conf_config());
+			if (err)
+				return err;
+		}
+#endif
+
 		/* Decode SDP Offer */
 		err = sdp_decode(call->sdp, msg->mb, true);
 		if (err)
@@ -1047,20 +1429,15 @@ static void sipsess_estab_handler(const struct sip_msg *msg, void *arg)
 static void call_handle_info_req(struct call *call, const struct sip_msg *req)
 {
 	struct pl body;
-	bool pfu;
-	int err;
-
-	(void)call;
+	bool pfu = false;
 
 	pl_set_mbuf(&body, req->mb);
 
-	err = mctrl_handle_media_control(&body, &pfu);
-	if (err)
-		return;
+	(void)mctrl_handle_media_control(&body, &pfu);
 
-	if (pfu) {
+	/* merged with the RTCP FIR and PLI into one key frame */
+	if (pfu)
 		video_update_picture(call->video);
-	}
 }
 #endif
 
@@ -1081,22 +1458,20 @@ static void sipsess_info_handler(struct sip *sip, const struct sip_msg *msg,
 
 	if (msg_ctype_cmp(&msg->ctyp, "application", "dtmf-relay")) {
 
-		struct pl body, sig, dur;
+		struct pl body;
+		uint32_t duration;
+		char s;
 		int err;
 
 		pl_set_mbuf(&body, msg->mb);
 
-		err  = re_regex(body.p, body.l, "Signal=[0-9*#a-d]+", &sig);
-		err |= re_regex(body.p, body.l, "Duration=[0-9]+", &dur);
-
-		if (err || !pl_isset(&sig) || sig.l == 0) {
+		err = mctrl_dtmf_relay(&body, &s, &duration);
+		if (err) {
 			(void)sip_reply(sip, msg, 400, "Bad Request");
 		}
 		else {
-			char s = toupper(sig.p[0]);
-			uint32_t duration = pl_u32(&dur);
-
-			info("received DTMF: '%c' (duration=%r)\n", s, &dur);
+			info("received DTMF: '%c' (duration=%u)\n",
+			     s, duration);
 
 			(void)sip_reply(sip, msg, 200, "OK");
 
@@ -1236,6 +1611,7 @@ int call_accept(struct call *call, struct sipsess_sock *sess_sock,
 		return EINVAL;
 
 	call->outgoing = false;
+	call->ts_conn  = tmr_jiffies();
 
 	got_offer = (mbuf_get_left(msg->mb) > 0);
 
@@ -1311,6 +1687,8 @@ int call_accept(struct call *call, struct sipsess_sock *sess_sock,
 		return err;
 	}
 
+	call_index(call);
+
 	set_state(call, STATE_INCOMING);
 
 	/* New call */
@@ -1414,8 +1792,11 @@ static int send_invite(struct call *call)
 		warning("call: sipsess_connect: %m\n", err);
 	}
 
+	call_index(call);
+
 	/* save call setup timer */
 	call->time_conn = time(NULL);
+	call->ts_conn   = tmr_jiffies();
 
 	mem_deref(desc);
 
@@ -1455,6 +1836,20 @@ uint32_t call_setup_duration(const struct call *call)
 }
 
 
+/**
+ * Get the call setup time in milliseconds, from the INVITE to the
+ * start of the media
+ *
+ * @param call  Call object
+ *
+ * @return Call setup in [ms], or 0 if the call was not set up
+ */
+uint32_t call_setup_ms(const struct call *call)
+{
+	return call ? call->setup_ms : 0;
+}
+
+
 /**
  * Get the audio object for the current call
  *
@@ -1695,6 +2090,31 @@ void call_set_handlers(struct call *call, call_event_h *eh,
 }
 
 
+/* The quality of a received stream crossed the alert threshold */
+void call_quality_event(struct call *call, const struct stream *s)
+{
+	struct stream_quality q;
+
+	if (!call || stream_quality(s, &q))
+		return;
+
+	if (q.alert) {
+		warning("%s: %s quality alert: MOS %.2f (loss %.1f%%,"
+			" jitter %.1f ms)\n", call->peer_uri,
+			stream_name(s), q.mos, q.loss, q.jitter);
+	}
+	else {
+		info("%s: %s quality recovered: MOS %.2f\n",
+		     call->peer_uri, stream_name(s), q.mos);
+	}
+
+	call_event_handler(call, CALL_EVENT_QUALITY,
+			   "%s %s mos=%.2f loss=%.1f jitter=%.1f",
+			   stream_name(s), q.alert ? "alert" : "ok",
+			   q.mos, q.loss, q.jitter);
+}
+
+
 void call_set_xrtpstat(struct call *call)
 {
 	if (!call)
@@ -1716,3 +2136,92 @@ bool call_is_outgoing(const struct call *call)
 {
 	return call ? call->outgoing : false;
 }
+
+
+/**
+ * Set the priority of a call. Under CPU pressure, the codecs of the
+ * calls with the lowest priority are degraded first.
+ *
+ * @param call Call object
+ * @param prio Priority, default 0
+ */
+void call_set_prio(struct call *call, int prio)
+{
+	if (!call)
+		return;
+
+	call->prio = prio;
+}
+
+
+int call_prio(const struct call *call)
+{
+	return call ? call->prio : 0;
+}
+
+
+/**
+ * Set the codec complexity level of all media streams of a call
+ *
+ * @param call  Call object
+ * @param level Complexity level, 0 is the configured complexity
+ */
+void call_set_cplx(struct call *call, unsigned level)
+{
+	if (!call)
+		return;
+
+	call->cplx = min(level, CPLX_LEVEL_MAX);
+
+	audio_set_cplx(call->audio, call->cplx);
+#ifdef USE_VIDEO
+	video_set_cplx(call->video, call->cplx);
+#endif
+}
+
+
+unsigned call_cplx(const struct call *call)
+{
+	return call ? call->cplx : 0;
+}
+
+
+/**
+ * Check if a call is established
+ *
+ * @param call Call object
+ *
+ * @return True if established, otherwise false
+ */
+bool call_is_established(const struct call *call)
+{
+	return call && call->state == STATE_ESTABLISHED;
+}
+
+
+/**
+ * Check if a call is being set up, that is not yet established
+ *
+ * @param call Call object
+ *
+ * @return True if being set up, otherwise false
+ */
+bool call_is_setup(const struct call *call)
+{
+	if (!call)
+		return false;
+
+	return call->state != STATE_ESTABLISHED &&
+		call->state != STATE_TERMINATED;
+}
+
+
+/**
+ * Stop the audio and video pipelines of a call, before it is hung up
+ *
+ * @param call Call object
+ */
+void call_media_stop(struct call *call)
+{
+	call_stream_stop(call);
+}
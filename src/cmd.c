@@ -17,6 +17,21 @@ enum {
 };
 
 
+/* Commands run on the main loop, timed by the lag monitor */
+static int cmd_run(const struct cmd *cmd, struct re_printf *pf,
+		   struct cmd_arg *arg)
+{
+	uint64_t ts = lagmon_begin();
+	int err;
+
+	err = cmd->h(pf, arg);
+
+	lagmon_end(cmd->desc ? cmd->desc : "command", ts);
+
+	return err;
+}
+
+
 struct cmds {
 	struct le le;
 	const struct cmd *cmdv;
@@ -30,6 +45,7 @@ struct cmd_ctx {
 
 
 static struct list cmdl;           /**< List of command blocks (struct cmds) */
+static const struct cmd *keyv[256]; /**< Command of each key              */
 
 
 static void destructor(void *arg)
@@ -88,25 +104,38 @@ static struct cmds *cmds_find(const struct cmd *cmdv)
 }
 
 
-static const struct cmd *cmd_find_by_key(char key)
+/*
+ * The key index is rebuilt when a command block is added or removed, in
+ * the order of registration, so that the last block registered for a
+ * key has it, and a key that was taken over comes back when the block
+ * that took it is removed.
+ */
+static void index_update(void)
 {
 	struct le *le;
 
-	for (le = cmdl.tail; le; le = le->prev) {
+	memset(keyv, 0, sizeof(keyv));
+
+	for (le = cmdl.head; le; le = le->next) {
 
 		struct cmds *cmds = le->data;
 		size_t i;
 
-		for (i=0; i<cmds->cmdc; i++) {
+		/* backwards, so that the first of a block has the key */
+		for (i=cmds->cmdc; i>0; i--) {
 
-			const struct cmd *cmd = &cmds->cmdv[i];
+			const struct cmd *cmd = &cmds->cmdv[i-1];
 
-			if (cmd->key == key && cmd->h)
-				return cmd;
+			if (cmd->h)
+				keyv[(uint8_t)cmd->key] = cmd;
 		}
 	}
+}
 
-	return NULL;
+
+static const struct cmd *cmd_find_by_key(char key)
+{
+	return keyv[(uint8_t)key];
 }
 
 
@@ -178,7 +207,7 @@ static int cmd_report(const struct cmd *cmd, struct re_printf *pf,
 	arg.key      = cmd->key;
 	arg.complete = compl;
 
-	err = cmd->h(pf, &arg);
+	err = cmd_run(cmd, pf, &arg);
 
 	mem_deref(arg.prm);
 
@@ -239,6 +268,7 @@ int cmd_register(const struct cmd *cmdv, size_t cmdc)
 	cmds->cmdc = cmdc;
 
 	list_append(&cmdl, &cmds->le, cmds);
+	index_update();
 
 	return 0;
 }
@@ -251,7 +281,13 @@ int cmd_register(const struct cmd *cmdv, size_t cmdc)
  */
 void cmd_unregister(const struct cmd *cmdv)
 {
-	mem_deref(cmds_find(cmdv));
+	struct cmds *cmds = cmds_find(cmdv);
+
+	if (!cmds)
+		return;
+
+	mem_deref(cmds);
+	index_update();
 }
 
 
@@ -299,7 +335,7 @@ int cmd_process(struct cmd_ctx **ctxp, char key, struct re_printf *pf)
 		arg.prm      = NULL;
 		arg.complete = true;
 
-		return cmd->h(pf, &arg);
+		return cmd_run(cmd, pf, &arg);
 	}
 
 	if (key == REL)
@@ -309,6 +345,151 @@ int cmd_process(struct cmd_ctx **ctxp, char key, struct re_printf *pf)
 }
 
 
+/**
+ * Run the command of a key, with the whole parameter at once instead of
+ * one character at a time from the editor
+ *
+ * @param key Command key
+ * @param prm Command parameter (optional)
+ * @param pf  Print function
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int cmd_exec(char key, const char *prm, struct re_printf *pf)
+{
+	const struct cmd *cmd;
+	struct cmd_arg arg;
+	int err;
+
+	cmd = cmd_find_by_key(key);
+	if (!cmd)
+		return ENOENT;
+
+	arg.key      = key;
+	arg.prm      = NULL;
+	arg.complete = true;
+
+	if (cmd->flags & CMD_PRM) {
+		err = str_dup(&arg.prm, prm ? prm : "");
+		if (err)
+			return err;
+	}
+
+	err = cmd_run(cmd, pf, &arg);
+
+	mem_deref(arg.prm);
+
+	return err;
+}
+
+
+/* Remembers if the output of a command ended its last line */
+struct line_pf {
+	struct re_printf *pf;
+	bool open;
+};
+
+
+static int line_print_handler(const char *p, size_t size, void *arg)
+{
+	struct line_pf *lpf = arg;
+
+	if (!size)
+		return 0;
+
+	lpf->open = p[size-1] != '\n';
+
+	return lpf->pf->vph(p, size, lpf->pf->arg);
+}
+
+
+/* Returns true if the line was a command */
+static bool exec_line(struct re_printf *pf, const char *p, size_t len)
+{
+	struct line_pf lpf = {pf, false};
+	struct re_printf pf_line = {line_print_handler, &lpf};
+	char prm[512];
+	size_t i = 1;
+	int err;
+
+	while (len && (p[len-1] == '\r' || p[len-1] == ' '))
+		--len;
+	while (len && *p == ' ') {
+		++p;
+		--len;
+	}
+
+	/* empty lines and comments */
+	if (!len || *p == '#')
+		return false;
+
+	while (i < len && p[i] == ' ')
+		++i;
+
+	if (len - i >= sizeof(prm)) {
+		(void)re_hprintf(pf, "ERR parameter too long\n");
+		return true;
+	}
+
+	memcpy(prm, &p[i], len - i);
+	prm[len - i] = '\0';
+
+	err = cmd_exec(*p, prm, &pf_line);
+
+	if (lpf.open)
+		(void)re_hprintf(pf, "\n");
+
+	if (err == ENOENT)
+		(void)re_hprintf(pf, "ERR unknown command '%c'\n", *p);
+	else if (err)
+		(void)re_hprintf(pf, "ERR %m\n", err);
+	else
+		(void)re_hprintf(pf, "OK\n");
+
+	return true;
+}
+
+
+/**
+ * Run the commands in a buffer, one command per line. A line is the key
+ * of a command and its parameter, for example "d sip:bob@example.com".
+ * Empty lines and lines starting with '#' are skipped.
+ *
+ * The output of each command is followed by a line "OK" or
+ * "ERR <reason>", in the order of the commands, so that a client can
+ * send many commands at once and match the answers by position.
+ *
+ * @param pf  Print function for the answers
+ * @param pl  Buffer with the commands, returns the incomplete last line
+ * @param eof True if the last line is complete without a newline
+ *
+ * @return Number of commands that were run
+ */
+unsigned cmd_exec_lines(struct re_printf *pf, struct pl *pl, bool eof)
+{
+	unsigned n = 0;
+
+	if (!pf || !pl)
+		return 0;
+
+	while (pl->l) {
+
+		const char *eol = memchr(pl->p, '\n', pl->l);
+		const size_t len = eol ? (size_t)(eol - pl->p) : pl->l;
+
+		if (!eol && !eof)
+			break;
+
+		if (exec_line(pf, pl->p, len))
+			++n;
+
+		pl_advance(pl, eol ? len + 1 : len);
+	}
+
+	return n;
+}
+
+
 /**
  * Print a list of available commands
  *
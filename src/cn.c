@@ -0,0 +1,160 @@
+/**
+ * @file cn.c  Voice Activity Detection and Comfort Noise (RFC 3389)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The detector compares the energy of each frame against a running
+ * estimate of the background noise. The estimate follows the energy
+ * down immediately and rises by VAD_RISE per frame at most, so it
+ * settles on the quiet parts of the signal. Speech keeps the detector
+ * active for VAD_HANGOVER after the last loud frame, to avoid clipping
+ * word endings.
+ *
+ * Only the noise level is carried in SID frames; the spectral
+ * coefficients are neither sent nor used, which RFC 3389 allows.
+ */
+
+#define VAD_FULLSCALE  (32767.0f * 32767.0f)  /**< 0 dBov mean square */
+#define VAD_THRESHOLD  4.0f      /**< Speech is 6 dB above the floor  */
+#define VAD_MIN_LEVEL  1.0e-6f   /**< Always silent below -60 dBov    */
+#define VAD_RISE       1.02f     /**< Noise floor rise, ~0.09 dB      */
+
+enum {
+	VAD_HANGOVER = 200,      /**< Hangover time in [ms]          */
+	CN_LEVEL_MAX = 127,      /**< Quietest level in [-dBov]      */
+};
+
+
+/**
+ * Initialise the voice activity detector
+ *
+ * @param vad Voice activity detector
+ */
+void vad_init(struct vad *vad)
+{
+	if (!vad)
+		return;
+
+	memset(vad, 0, sizeof(*vad));
+}
+
+
+/**
+ * Process one audio frame
+ *
+ * @param vad   Voice activity detector
+ * @param sampv Audio samples
+ * @param sampc Number of samples
+ * @param ptime Frame duration in [ms]
+ *
+ * @return True if the frame carries speech, false for silence
+ */
+bool vad_process(struct vad *vad, const int16_t *sampv, size_t sampc,
+		 uint32_t ptime)
+{
+	float ms = 0.0f;
+	size_t i;
+
+	if (!vad || !sampv || !sampc)
+		return false;
+
+	for (i=0; i<sampc; i++)
+		ms += (float)sampv[i] * (float)sampv[i];
+
+	ms /= sampc * VAD_FULLSCALE;
+
+	vad->floor = min(ms, max(vad->floor, VAD_MIN_LEVEL) * VAD_RISE);
+
+	if (ms >= VAD_MIN_LEVEL && ms > vad->floor * VAD_THRESHOLD) {
+		vad->hang = VAD_HANGOVER;
+		return true;
+	}
+
+	if (vad->hang) {
+		vad->hang -= min(vad->hang, ptime);
+		return true;
+	}
+
+	/* the noise level sent in SID frames */
+	vad->noise = ms;
+
+	return false;
+}
+
+
+/**
+ * Get the background noise level of the last silent frame
+ *
+ * @param vad Voice activity detector
+ *
+ * @return Noise level in [-dBov], as in a SID frame
+ */
+uint8_t vad_level(const struct vad *vad)
+{
+	float level;
+
+	if (!vad || vad->noise <= 0.0f)
+		return CN_LEVEL_MAX;
+
+	level = -10.0f * log10f(vad->noise);
+
+	return (uint8_t)min(max(lrintf(level), 0), CN_LEVEL_MAX);
+}
+
+
+/**
+ * Get the amplitude of comfort noise at a given level
+ *
+ * @param level Noise level in [-dBov], from a SID frame
+ *
+ * @return Peak amplitude of uniform noise with that power
+ */
+uint32_t cn_amplitude(uint8_t level)
+{
+	float amp;
+
+	level = min(level, CN_LEVEL_MAX);
+
+	/* uniform noise in [-a, a] has a power of a^2/3 */
+	amp = 32767.0f * sqrtf(3.0f) * powf(10.0f, -level / 20.0f);
+
+	return (uint32_t)min(lrintf(amp), 32767);
+}
+
+
+/**
+ * Generate comfort noise
+ *
+ * @param sampv Buffer for generated samples
+ * @param sampc Number of samples
+ * @param amp   Peak amplitude, from cn_amplitude()
+ * @param seed  Random generator state
+ */
+void cn_generate(int16_t *sampv, size_t sampc, uint32_t amp, uint32_t *seed)
+{
+	uint32_t x;
+	size_t i;
+
+	if (!sampv || !seed)
+		return;
+
+	x = *seed;
+
+	for (i=0; i<sampc; i++) {
+
+		x = x * 1664525 + 1013904223;
+
+		sampv[i] = (int16_t)(((int32_t)(x >> 16) - 32768) *
+				     (int32_t)amp / 32768);
+	}
+
+	*seed = x;
+}
@@ -74,18 +74,22 @@ static void print_populated(const char *what, uint32_t n)
 
 
 /**
- * Parse a config file, calling handler for each line
+ * Load a file into a memory buffer
  *
- * @param filename Config file
- * @param ch       Line handler
+ * @param mbp      Pointer to allocated memory buffer
+ * @param filename File to load
  *
  * @return 0 if success, otherwise errorcode
  */
-int conf_parse(const char *filename, confline_h *ch)
+int conf_load(struct mbuf **mbp, const char *filename)
 {
-	struct pl pl, val;
 	struct mbuf *mb;
-	int err = 0, fd = open(filename, O_RDONLY);
+	int err = 0, fd;
+
+	if (!mbp || !filename)
+		return EINVAL;
+
+	fd = open(filename, O_RDONLY);
 	if (fd < 0)
 		return errno;
 
@@ -109,6 +113,38 @@ int conf_parse(const char *filename, confline_h *ch)
 		err |= mbuf_write_mem(mb, buf, n);
 	}
 
+	mb->pos = 0;
+
+ out:
+	if (err)
+		mem_deref(mb);
+	else
+		*mbp = mb;
+
+	(void)close(fd);
+
+	return err;
+}
+
+
+/**
+ * Parse a config file, calling handler for each line
+ *
+ * @param filename Config file
+ * @param ch       Line handler
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int conf_parse(const char *filename, confline_h *ch)
+{
+	struct pl pl, val;
+	struct mbuf *mb;
+	int err;
+
+	err = conf_load(&mb, filename);
+	if (err)
+		return err;
+
 	pl.p = (const char *)mb->buf;
 	pl.l = mb->end;
 
@@ -125,14 +161,78 @@ int conf_parse(const char *filename, confline_h *ch)
 		err = ch(&val);
 	}
 
- out:
 	mem_deref(mb);
-	(void)close(fd);
 
 	return err;
 }
 
 
+/**
+ * Copy the lines of a config file that have a value, without comments,
+ * empty lines and indentation. The config is searched line by line for
+ * each value that is read, so a shorter file is faster to read.
+ *
+ * @param mbp Pointer to allocated memory buffer
+ * @param buf Config file
+ * @param sz  Size of the config file
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int conf_compact(struct mbuf **mbp, const uint8_t *buf, size_t sz)
+{
+	struct mbuf *mb;
+	struct pl pl;
+	int err;
+
+	if (!mbp || (!buf && sz))
+		return EINVAL;
+
+	mb = mbuf_alloc(sz + 1);
+	if (!mb)
+		return ENOMEM;
+
+	/* a value is found after a line break */
+	err = mbuf_write_u8(mb, '\n');
+
+	pl.p = (const char *)buf;
+	pl.l = sz;
+
+	while (pl.l && !err) {
+
+		const char *lb = pl_strchr(&pl, '\n');
+		struct pl line;
+
+		line.p = pl.p;
+		line.l = lb ? (size_t)(lb - pl.p) : pl.l;
+		pl_advance(&pl, line.l + (lb ? 1 : 0));
+
+		while (line.l && (line.p[0] == ' ' || line.p[0] == '\t'))
+			pl_advance(&line, 1);
+
+		while (line.l && (line.p[line.l-1] == ' ' ||
+				  line.p[line.l-1] == '\t' ||
+				  line.p[line.l-1] == '\r'))
+			--line.l;
+
+		if (!line.l || line.p[0] == '#')
+			continue;
+
+		err  = mbuf_write_pl(mb, &line);
+		err |= mbuf_write_u8(mb, '\n');
+	}
+
+	if (err) {
+		mem_deref(mb);
+		return err;
+	}
+
+	mb->pos = 0;
+	*mbp = mb;
+
+	return 0;
+}
+
+
 /**
  * Set the path to configuration files
  *
@@ -296,6 +396,7 @@ int conf_get_sa(const struct conf *conf, const char *name, struct sa *sa)
 int conf_configure(void)
 {
 	char path[256], file[256];
+	struct mbuf *mb = NULL, *cmb = NULL;
 	int err;
 
 #if defined (WIN32)
@@ -320,8 +421,17 @@ int conf_configure(void)
 			goto out;
 	}
 
+	/* the file is read once, and all values are read from memory */
+	err = conf_load(&mb, file);
+	if (err)
+		goto out;
+
+	err = conf_compact(&cmb, mb->buf, mb->end);
+	if (err)
+		goto out;
+
 	conf_obj = mem_deref(conf_obj);
-	err = conf_alloc(&conf_obj, file);
+	err = conf_alloc_buf(&conf_obj, cmb->buf, cmb->end);
 	if (err)
 		goto out;
 
@@ -330,6 +440,9 @@ int conf_configure(void)
 		goto out;
 
  out:
+	mem_deref(cmb);
+	mem_deref(mb);
+
 	return err;
 }
 
@@ -345,6 +458,8 @@ int conf_modules(void)
 {
 	int err;
 
+	startup_phase("modules");
+
 	err = module_init(conf_obj);
 	if (err) {
 		warning("conf: configure module parse error (%m)\n", err);
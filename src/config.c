@@ -27,12 +27,26 @@ static struct config core_config = {
 		16,
 		"",
 		"",
-		""
+		"",
+		32,
+		10,
+		4,
+		256,
+		0,
+		0,
+		1000,
+		10
 	},
 
 	/** Call config */
 	{
-		120
+		120,
+		4,
+		0,
+		0,
+		0,
+		0,
+		0
 	},
 
 	/** Audio */
@@ -49,6 +63,12 @@ static struct config core_config = {
 		0,
 		false,
 		AUDIO_MODE_POLL,
+		RESAMP_POLYPHASE,
+		false,
+		false,
+		"","",
+		8000,
+		false,
 	},
 
 #ifdef USE_VIDEO
@@ -59,6 +79,12 @@ static struct config core_config = {
 		352, 288,
 		500000,
 		25,
+		200,
+		8192,
+		1024,
+		false,
+		1,
+		0,
 	},
 #endif
 
@@ -69,7 +95,13 @@ static struct config core_config = {
 		{0, 0},
 		true,
 		false,
+		false,
 		{5, 10},
+		false,
+		false,
+		0,
+		false,
+		0.0,
 		false
 	},
 
@@ -77,7 +109,17 @@ static struct config core_config = {
 	{
 		"",
 		{ {""} },
-		0
+		0,
+		false
+	},
+
+	/* Scheduling */
+	{
+		{SCHED_POLICY_DEFAULT, 0, 0},
+		{SCHED_POLICY_DEFAULT, 0, 0},
+		{SCHED_POLICY_DEFAULT, 0, 0},
+		{SCHED_POLICY_DEFAULT, 0, 0},
+		false
 	},
 
 #ifdef USE_VIDEO
@@ -125,9 +167,237 @@ static int dns_server_handler(const struct pl *pl, void *arg)
 }
 
 
+static const char *txmode_name(enum audio_mode mode)
+{
+	switch (mode) {
+
+	case AUDIO_MODE_POLL:            return "poll";
+	case AUDIO_MODE_THREAD:          return "thread";
+	case AUDIO_MODE_THREAD_REALTIME: return "thread_realtime";
+	case AUDIO_MODE_TMR:             return "tmr";
+	case AUDIO_MODE_EVENT:           return "event";
+	case AUDIO_MODE_SCHEDULER:       return "scheduler";
+	default:                         return "?";
+	}
+}
+
+
+static int txmode_decode(enum audio_mode *modep, const struct pl *pl)
+{
+	static const enum audio_mode modev[] = {
+		AUDIO_MODE_POLL,
+		AUDIO_MODE_THREAD,
+		AUDIO_MODE_THREAD_REALTIME,
+		AUDIO_MODE_TMR,
+		AUDIO_MODE_EVENT,
+		AUDIO_MODE_SCHEDULER,
+	};
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(modev); i++) {
+
+		if (0 == pl_strcasecmp(pl, txmode_name(modev[i]))) {
+			*modep = modev[i];
+			return 0;
+		}
+	}
+
+	return ENOENT;
+}
+
+
+/* CPUs as a list of numbers and ranges, e.g. "0,2-3" */
+static int cpus_decode(uint64_t *cpusp, const struct pl *pl)
+{
+	struct pl v = *pl;
+	uint64_t cpus = 0;
+
+	while (v.l) {
+		const char *sep = pl_strchr(&v, ',');
+		const char *dash;
+		struct pl tok, lo, hi;
+		uint32_t i;
+
+		tok.p = v.p;
+		tok.l = sep ? (size_t)(sep - v.p) : v.l;
+
+		dash = pl_strchr(&tok, '-');
+
+		lo.p = tok.p;
+		lo.l = dash ? (size_t)(dash - tok.p) : tok.l;
+		hi.p = dash ? dash + 1 : lo.p;
+		hi.l = dash ? tok.l - lo.l - 1 : lo.l;
+
+		if (!lo.l || !hi.l || pl_u32(&lo) > pl_u32(&hi) ||
+		    pl_u32(&hi) >= 64)
+			return EINVAL;
+
+		for (i=pl_u32(&lo); i<=pl_u32(&hi); i++)
+			cpus |= 1ULL << i;
+
+		pl_advance(&v, tok.l + (sep ? 1 : 0));
+	}
+
+	*cpusp = cpus;
+
+	return 0;
+}
+
+
+/* Thread scheduling, e.g. "fifo:40 2-3" */
+static int thread_decode(struct config_thread *ct, const struct pl *pl)
+{
+	static const enum sched_policy policyv[] = {
+		SCHED_POLICY_DEFAULT,
+		SCHED_POLICY_OTHER,
+		SCHED_POLICY_FIFO,
+		SCHED_POLICY_RR,
+	};
+	struct pl policy, prio, cpus;
+	size_t i;
+
+	if (re_regex(pl->p, pl->l, "[a-z]+[:]*[0-9]*[ \t]*[^ \t]*",
+		     &policy, NULL, &prio, NULL, &cpus))
+		return EINVAL;
+
+	for (i=0; i<ARRAY_SIZE(policyv); i++) {
+
+		if (0 == pl_strcasecmp(&policy,
+				       sched_policy_name(policyv[i])))
+			break;
+	}
+
+	if (i >= ARRAY_SIZE(policyv))
+		return ENOENT;
+
+	ct->policy = policyv[i];
+	ct->prio   = prio.l ? (int)pl_u32(&prio) : 0;
+	ct->cpus   = 0;
+
+	return cpus.l ? cpus_decode(&ct->cpus, &cpus) : 0;
+}
+
+
+static int thread_print(struct re_printf *pf, const struct config_thread *ct)
+{
+	int err;
+	unsigned i;
+
+	if (!ct)
+		return 0;
+
+	err = re_hprintf(pf, "%s", sched_policy_name(ct->policy));
+
+	if (ct->policy == SCHED_POLICY_FIFO || ct->policy == SCHED_POLICY_RR)
+		err |= re_hprintf(pf, ":%d", ct->prio);
+
+	for (i=0; i<64 && ct->cpus >> i; i++) {
+
+		if (ct->cpus & (1ULL << i)) {
+			err |= re_hprintf(pf, "%s%u",
+					  (ct->cpus & ((1ULL << i) - 1))
+					  ? "," : " ", i);
+		}
+	}
+
+	return err;
+}
+
+
+static void conf_get_thread(const struct conf *conf, const char *name,
+			    struct config_thread *ct)
+{
+	struct pl pl;
+
+	if (conf_get(conf, name, &pl))
+		return;
+
+	if (thread_decode(ct, &pl))
+		warning("config: invalid %s (%r)\n", name, &pl);
+}
+
+
+static int resamp_decode(enum resamp_backend *bep, const struct pl *pl)
+{
+	static const enum resamp_backend bev[] = {
+		RESAMP_POLYPHASE,
+		RESAMP_LIBREM,
+	};
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(bev); i++) {
+
+		if (0 == pl_strcasecmp(pl, resamp_backend_name(bev[i]))) {
+			*bep = bev[i];
+			return 0;
+		}
+	}
+
+	return ENOENT;
+}
+
+
+#ifdef USE_VIDEO
+static int layout_decode(enum vidcomp_layout *layoutp, const struct pl *pl)
+{
+	static const enum vidcomp_layout layoutv[] = {
+		VIDCOMP_NONE,
+		VIDCOMP_GRID,
+		VIDCOMP_SPEAKER,
+	};
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(layoutv); i++) {
+
+		if (0 == pl_strcasecmp(pl, vidcomp_layout_name(layoutv[i]))) {
+			*layoutp = layoutv[i];
+			return 0;
+		}
+	}
+
+	return ENOENT;
+}
+
+
+static const char *degrade_name(enum video_degrade degrade)
+{
+	switch (degrade) {
+
+	case VIDEO_DEGRADE_OFF:        return "off";
+	case VIDEO_DEGRADE_AUTO:       return "auto";
+	case VIDEO_DEGRADE_FRAMERATE:  return "framerate";
+	case VIDEO_DEGRADE_RESOLUTION: return "resolution";
+	default:                       return "?";
+	}
+}
+
+
+static int degrade_decode(enum video_degrade *degradep, const struct pl *pl)
+{
+	static const enum video_degrade degradev[] = {
+		VIDEO_DEGRADE_OFF,
+		VIDEO_DEGRADE_AUTO,
+		VIDEO_DEGRADE_FRAMERATE,
+		VIDEO_DEGRADE_RESOLUTION,
+	};
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(degradev); i++) {
+
+		if (0 == pl_strcasecmp(pl, degrade_name(degradev[i]))) {
+			*degradep = degradev[i];
+			return 0;
+		}
+	}
+
+	return ENOENT;
+}
+#endif
+
+
 int config_parse_conf(struct config *cfg, const struct conf *conf)
 {
-	struct pl pollm, as, ap;
+	struct pl pollm, as, ap, txmode, resamp, mclock, mos, layout, degrade;
 	enum poll_method method;
 	struct vidsz size = {0, 0};
 	uint32_t v;
@@ -156,10 +426,26 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 			   sizeof(cfg->sip.local));
 	(void)conf_get_str(conf, "sip_certificate", cfg->sip.cert,
 			   sizeof(cfg->sip.cert));
+	(void)conf_get_u32(conf, "sip_reg_inflight", &cfg->sip.reg_inflight);
+	(void)conf_get_u32(conf, "sip_reg_rate", &cfg->sip.reg_rate);
+	(void)conf_get_u32(conf, "sip_msg_inflight", &cfg->sip.msg_inflight);
+	(void)conf_get_u32(conf, "sip_msg_queue", &cfg->sip.msg_queue);
+	(void)conf_get_u32(conf, "sip_msg_rxq", &cfg->sip.msg_rxq);
+	(void)conf_get_u32(conf, "sip_keepalive", &cfg->sip.keepalive);
+	(void)conf_get_u32(conf, "sip_stop_rate", &cfg->sip.stop_rate);
+	(void)conf_get_u32(conf, "sip_stop_timeout", &cfg->sip.stop_timeout);
 
 	/* Call */
 	(void)conf_get_u32(conf, "call_local_timeout",
 			   &cfg->call.local_timeout);
+	(void)conf_get_u32(conf, "call_max_calls", &cfg->call.max_calls);
+	(void)conf_get_u32(conf, "call_max_calls_total",
+			   &cfg->call.max_calls_total);
+	(void)conf_get_u32(conf, "call_max_setups", &cfg->call.max_setups);
+	(void)conf_get_u32(conf, "call_max_lag", &cfg->call.max_lag);
+	(void)conf_get_u32(conf, "call_max_load", &cfg->call.max_load);
+	(void)conf_get_u32(conf, "call_degrade_load",
+			   &cfg->call.degrade_load);
 
 	/* Audio */
 	(void)conf_get_str(conf, "audio_path", cfg->audio.audio_path,
@@ -186,11 +472,36 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 	(void)conf_get_u32(conf, "auplay_srate", &cfg->audio.srate_play);
 	(void)conf_get_u32(conf, "ausrc_channels", &cfg->audio.channels_src);
 	(void)conf_get_u32(conf, "auplay_channels", &cfg->audio.channels_play);
+	(void)conf_get_bool(conf, "audio_srate_auto", &cfg->audio.srate_auto);
+	(void)conf_get_bool(conf, "audio_vad", &cfg->audio.vad);
+
+	(void)conf_get_csv(conf, "audio_moh",
+			   cfg->audio.moh_mod, sizeof(cfg->audio.moh_mod),
+			   cfg->audio.moh_dev, sizeof(cfg->audio.moh_dev));
+	(void)conf_get_u32(conf, "audio_moh_srate", &cfg->audio.moh_srate);
+	if (!cfg->audio.moh_srate)
+		cfg->audio.moh_srate = 8000;
+	(void)conf_get_bool(conf, "audio_rate_adapt", &cfg->audio.rate_adapt);
+	(void)conf_get_bool(conf, "audio_offload", &cfg->audio.offload);
 
 	if (0 == conf_get(conf, "audio_source", &as) &&
 	    0 == conf_get(conf, "audio_player", &ap))
 		cfg->audio.src_first = as.p < ap.p;
 
+	if (0 == conf_get(conf, "audio_txmode", &txmode)) {
+		if (txmode_decode(&cfg->audio.txmode, &txmode)) {
+			warning("config: unknown audio_txmode (%r)\n",
+				&txmode);
+		}
+	}
+
+	if (0 == conf_get(conf, "audio_resampler", &resamp)) {
+		if (resamp_decode(&cfg->audio.resamp, &resamp)) {
+			warning("config: unknown audio_resampler (%r)\n",
+				&resamp);
+		}
+	}
+
 #ifdef USE_VIDEO
 	/* Video */
 	(void)conf_get_csv(conf, "video_source",
@@ -205,8 +516,30 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 	}
 	(void)conf_get_u32(conf, "video_bitrate", &cfg->video.bitrate);
 	(void)conf_get_u32(conf, "video_fps", &cfg->video.fps);
+	(void)conf_get_u32(conf, "video_pacing_factor",
+			   &cfg->video.pacing_factor);
+	(void)conf_get_u32(conf, "video_burst_max", &cfg->video.burst_max);
+	(void)conf_get_u32(conf, "video_pktsize", &cfg->video.pktsize);
+	(void)conf_get_bool(conf, "video_encode_thread",
+			    &cfg->video.enc_thread);
+	(void)conf_get_u32(conf, "video_simulcast", &cfg->video.simulcast);
+	(void)conf_get_u32(conf, "video_fec", &cfg->video.fec);
+	if (0 == conf_get(conf, "video_layout", &layout)) {
+		if (layout_decode(&cfg->video.layout, &layout)) {
+			warning("config: unknown video_layout (%r)\n",
+				&layout);
+		}
+	}
+	if (0 == conf_get(conf, "video_degrade", &degrade)) {
+		if (degrade_decode(&cfg->video.degrade, &degrade)) {
+			warning("config: unknown video_degrade (%r)\n",
+				&degrade);
+		}
+	}
 #else
 	(void)size;
+	(void)layout;
+	(void)degrade;
 #endif
 
 	/* AVT - Audio/Video Transport */
@@ -220,9 +553,26 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 	}
 	(void)conf_get_bool(conf, "rtcp_enable", &cfg->avt.rtcp_enable);
 	(void)conf_get_bool(conf, "rtcp_mux", &cfg->avt.rtcp_mux);
+	(void)conf_get_bool(conf, "rtp_bundle", &cfg->avt.bundle);
 	(void)conf_get_range(conf, "jitter_buffer_delay",
 			     &cfg->avt.jbuf_del);
+	(void)conf_get_bool(conf, "jitter_buffer_adaptive",
+			    &cfg->avt.jbuf_adaptive);
 	(void)conf_get_bool(conf, "rtp_stats", &cfg->avt.rtp_stats);
+	(void)conf_get_u32(conf, "media_threads", &cfg->avt.media_threads);
+	if (0 == conf_get(conf, "media_clock", &mclock))
+		cfg->avt.media_fast = 0 == pl_strcasecmp(&mclock, "fast");
+	if (0 == conf_get(conf, "mos_alert", &mos))
+		cfg->avt.mos_alert = pl_float(&mos);
+	(void)conf_get_bool(conf, "rtcp_xr", &cfg->avt.rtcp_xr);
+	(void)conf_get_u32(conf, "rtp_busy_poll", &cfg->avt.busy_poll);
+
+	/* Scheduling */
+	conf_get_thread(conf, "sched_main", &cfg->sched.main);
+	conf_get_thread(conf, "sched_audio_tx", &cfg->sched.audio_tx);
+	conf_get_thread(conf, "sched_audio_dev", &cfg->sched.audio_dev);
+	conf_get_thread(conf, "sched_video_enc", &cfg->sched.video_enc);
+	(void)conf_get_bool(conf, "sched_mlockall", &cfg->sched.mlockall);
 
 	if (err) {
 		warning("config: configure parse error (%m)\n", err);
@@ -232,11 +582,18 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 	(void)conf_apply(conf, "dns_server", dns_server_handler, &cfg->net);
 	(void)conf_get_str(conf, "net_interface",
 			   cfg->net.ifname, sizeof(cfg->net.ifname));
+	(void)conf_get_bool(conf, "dns_cache", &cfg->net.dns_cache);
 
 #ifdef USE_VIDEO
 	/* BFCP */
 	(void)conf_get_str(conf, "bfcp_proto", cfg->bfcp.proto,
 			   sizeof(cfg->bfcp.proto));
+	(void)conf_get_csv(conf, "bfcp_present",
+			   cfg->bfcp.present_mod,
+			   sizeof(cfg->bfcp.present_mod),
+			   cfg->bfcp.present_dev,
+			   sizeof(cfg->bfcp.present_dev));
+	(void)conf_get_u32(conf, "bfcp_present_fps", &cfg->bfcp.present_fps);
 #endif
 
 	return err;
@@ -256,9 +613,23 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "sip_trans_bsize\t\t%u\n"
 			 "sip_listen\t\t%s\n"
 			 "sip_certificate\t%s\n"
+			 "sip_reg_inflight\t%u\n"
+			 "sip_reg_rate\t\t%u\n"
+			 "sip_msg_inflight\t%u\n"
+			 "sip_msg_queue\t\t%u\n"
+			 "sip_msg_rxq\t\t%u\n"
+			 "sip_keepalive\t\t%u\n"
+			 "sip_stop_rate\t\t%u\n"
+			 "sip_stop_timeout\t%u\n"
 			 "\n"
 			 "# Call\n"
 			 "call_local_timeout\t%u\n"
+			 "call_max_calls\t\t%u\n"
+			 "call_max_calls_total\t%u\n"
+			 "call_max_setups\t%u\n"
+			 "call_max_lag\t\t%u\n"
+			 "call_max_load\t\t%u\n"
+			 "call_degrade_load\t%u\n"
 			 "\n"
 			 "# Audio\n"
 			 "audio_path\t\t%s\n"
@@ -271,6 +642,14 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "ausrc_srate\t\t%u\n"
 			 "auplay_channels\t\t%u\n"
 			 "ausrc_channels\t\t%u\n"
+			 "audio_srate_auto\t%s\n"
+			 "audio_vad\t\t%s\n"
+			 "audio_txmode\t\t%s\n"
+			 "audio_resampler\t\t%s\n"
+			 "audio_moh\t\t%s,%s\n"
+			 "audio_moh_srate\t\t%u\n"
+			 "audio_rate_adapt\t%s\n"
+			 "audio_offload\t\t%s\n"
 			 "\n"
 #ifdef USE_VIDEO
 			 "# Video\n"
@@ -279,6 +658,14 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "video_size\t\t\"%ux%u\"\n"
 			 "video_bitrate\t\t%u\n"
 			 "video_fps\t\t%u\n"
+			 "video_pacing_factor\t%u\n"
+			 "video_burst_max\t\t%u\n"
+			 "video_pktsize\t\t%u\n"
+			 "video_encode_thread\t%s\n"
+			 "video_simulcast\t\t%u\n"
+			 "video_fec\t\t%u\n"
+			 "video_layout\t\t%s\n"
+			 "video_degrade\t\t%s\n"
 			 "\n"
 #endif
 			 "# AVT\n"
@@ -287,22 +674,47 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "rtp_bandwidth\t\t%H\n"
 			 "rtcp_enable\t\t%s\n"
 			 "rtcp_mux\t\t%s\n"
+			 "rtp_bundle\t\t%s\n"
 			 "jitter_buffer_delay\t%H\n"
+			 "jitter_buffer_adaptive\t%s\n"
 			 "rtp_stats\t\t%s\n"
+			 "media_threads\t\t%u\n"
+			 "media_clock\t\t%s\n"
+			 "mos_alert\t\t%.2f\n"
+			 "rtcp_xr\t\t\t%s\n"
+			 "rtp_busy_poll\t\t%u\n"
 			 "\n"
 			 "# Network\n"
 			 "net_interface\t\t%s\n"
+			 "dns_cache\t\t%s\n"
+			 "\n"
+			 "# Scheduling\n"
+			 "sched_main\t\t%H\n"
+			 "sched_audio_tx\t\t%H\n"
+			 "sched_audio_dev\t\t%H\n"
+			 "sched_video_enc\t\t%H\n"
+			 "sched_mlockall\t\t%s\n"
 			 "\n"
 #ifdef USE_VIDEO
 			 "# BFCP\n"
 			 "bfcp_proto\t\t%s\n"
+			 "bfcp_present\t\t%s,%s\n"
+			 "bfcp_present_fps\t%u\n"
 			 "\n"
 #endif
 			 ,
 
 			 cfg->sip.trans_bsize, cfg->sip.local, cfg->sip.cert,
+			 cfg->sip.reg_inflight, cfg->sip.reg_rate,
+			 cfg->sip.msg_inflight, cfg->sip.msg_queue,
+			 cfg->sip.msg_rxq, cfg->sip.keepalive,
+			 cfg->sip.stop_rate, cfg->sip.stop_timeout,
 
 			 cfg->call.local_timeout,
+			 cfg->call.max_calls, cfg->call.max_calls_total,
+			 cfg->call.max_setups, cfg->call.max_lag,
+			 cfg->call.max_load,
+			 cfg->call.degrade_load,
 
 			 cfg->audio.audio_path,
 			 cfg->audio.play_mod,  cfg->audio.play_dev,
@@ -312,12 +724,27 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 range_print, &cfg->audio.channels,
 			 cfg->audio.srate_play, cfg->audio.srate_src,
 			 cfg->audio.channels_play, cfg->audio.channels_src,
+			 cfg->audio.srate_auto ? "yes" : "no",
+			 cfg->audio.vad ? "yes" : "no",
+			 txmode_name(cfg->audio.txmode),
+			 resamp_backend_name(cfg->audio.resamp),
+			 cfg->audio.moh_mod, cfg->audio.moh_dev,
+			 cfg->audio.moh_srate,
+			 cfg->audio.rate_adapt ? "yes" : "no",
+			 cfg->audio.offload ? "yes" : "no",
 
 #ifdef USE_VIDEO
 			 cfg->video.src_mod, cfg->video.src_dev,
 			 cfg->video.disp_mod, cfg->video.disp_dev,
 			 cfg->video.width, cfg->video.height,
 			 cfg->video.bitrate, cfg->video.fps,
+			 cfg->video.pacing_factor, cfg->video.burst_max,
+			 cfg->video.pktsize,
+			 cfg->video.enc_thread ? "yes" : "no",
+			 cfg->video.simulcast,
+			 cfg->video.fec,
+			 vidcomp_layout_name(cfg->video.layout),
+			 degrade_name(cfg->video.degrade),
 #endif
 
 			 cfg->avt.rtp_tos,
@@ -325,13 +752,29 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 range_print, &cfg->avt.rtp_bw,
 			 cfg->avt.rtcp_enable ? "yes" : "no",
 			 cfg->avt.rtcp_mux ? "yes" : "no",
+			 cfg->avt.bundle ? "yes" : "no",
 			 range_print, &cfg->avt.jbuf_del,
+			 cfg->avt.jbuf_adaptive ? "yes" : "no",
 			 cfg->avt.rtp_stats ? "yes" : "no",
+			 cfg->avt.media_threads,
+			 cfg->avt.media_fast ? "fast" : "real",
+			 cfg->avt.mos_alert,
+			 cfg->avt.rtcp_xr ? "yes" : "no",
+			 cfg->avt.busy_poll,
 
-			 cfg->net.ifname
+			 cfg->net.ifname,
+			 cfg->net.dns_cache ? "yes" : "no",
+
+			 thread_print, &cfg->sched.main,
+			 thread_print, &cfg->sched.audio_tx,
+			 thread_print, &cfg->sched.audio_dev,
+			 thread_print, &cfg->sched.video_enc,
+			 cfg->sched.mlockall ? "yes" : "no"
 
 #ifdef USE_VIDEO
 			 ,cfg->bfcp.proto
+			 ,cfg->bfcp.present_mod, cfg->bfcp.present_dev
+			 ,cfg->bfcp.present_fps
 #endif
 		   );
 
@@ -418,9 +861,23 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "sip_trans_bsize\t\t128\n"
 			  "#sip_listen\t\t0.0.0.0:5060\n"
 			  "#sip_certificate\tcert.pem\n"
+			  "sip_reg_inflight\t32\t\t# 0 is unlimited\n"
+			  "sip_reg_rate\t\t10\t\t# REGISTERs per second\n"
+			  "#sip_msg_inflight\t4\t\t# MESSAGEs per peer\n"
+			  "#sip_msg_queue\t\t256\t\t# 0 is unlimited\n"
+			  "#sip_msg_rxq\t\t0\t\t# 0 is synchronous\n"
+			  "#sip_keepalive\t\t120\t\t# TCP/TLS CRLF ping [s]\n"
+			  "#sip_stop_rate\t\t1000\t\t# hangups per second\n"
+			  "#sip_stop_timeout\t10\t\t# forced exit [s]\n"
 			  "\n"
 			  "# Call\n"
 			  "call_local_timeout\t%u\n"
+			  "call_max_calls\t\t4\t\t# per account\n"
+			  "#call_max_calls_total\t0\t\t# 0 is unlimited\n"
+			  "#call_max_setups\t32\t\t# calls being set up\n"
+			  "#call_max_lag\t\t100\t\t# event loop lag [ms]\n"
+			  "#call_max_load\t\t90\t\t# CPU load [%%]\n"
+			  "#call_degrade_load\t80\t\t# degrade codecs [%%]\n"
 			  "\n"
 			  "# Audio\n"
 			  "#audio_path\t\t/usr/share/baresip\n"
@@ -433,6 +890,16 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "#auplay_srate\t\t48000\n"
 			  "#ausrc_channels\t\t0\n"
 			  "#auplay_channels\t\t0\n"
+			  "#audio_srate_auto\tno\t\t# use codec rate\n"
+			  "#audio_vad\t\tno\t\t# comfort noise (RFC 3389)\n"
+			  "#audio_txmode\t\tpoll\t\t# poll, thread, event,\n"
+			  "\t\t\t\t\t# scheduler\n"
+			  "#audio_resampler\tpolyphase\t# polyphase, librem\n"
+			  "#audio_moh\t\taufile,moh.wav\t# music on hold\n"
+			  "#audio_moh_srate\t8000\n"
+			  "#audio_rate_adapt\tno\t\t# to loss and RTT\n"
+			  "#audio_offload\t\tno\t\t# heavy codecs on the\n"
+			  "\t\t\t\t\t# media scheduler\n"
 			  ,
 			  poll_method_name(poll_method_best()),
 			  cfg->call.local_timeout,
@@ -449,7 +916,16 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "#video_display\t\t%s\n"
 			  "video_size\t\t%dx%d\n"
 			  "video_bitrate\t\t%u\n"
-			  "video_fps\t\t%u\n",
+			  "video_fps\t\t%u\n"
+			  "#video_pacing_factor\t200\t\t# percent of bitrate\n"
+			  "#video_burst_max\t8192\t\t# bytes\n"
+			  "#video_pktsize\t\t1024\t\t# bytes\n"
+			  "#video_encode_thread\tno\n"
+			  "#video_simulcast\t1\t\t# layers, 1 to 3\n"
+			  "#video_fec\t\t0\t\t# percent of packets, 0 is off\n"
+			  "#video_layout\t\tnone\t\t# none, grid, speaker\n"
+			  "#video_degrade\t\toff\t\t"
+			  "# {off,auto,framerate,resolution}\n",
 			  default_video_device(),
 			  default_video_display(),
 			  cfg->video.width, cfg->video.height,
@@ -463,18 +939,34 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "#rtp_bandwidth\t\t512-1024 # [kbit/s]\n"
 			  "rtcp_enable\t\tyes\n"
 			  "rtcp_mux\t\tno\n"
+			  "rtp_bundle\t\tno\t\t# needs rtcp_mux\n"
 			  "jitter_buffer_delay\t%u-%u\t\t# frames\n"
+			  "#jitter_buffer_adaptive\tno\n"
 			  "rtp_stats\t\tno\n"
+			  "#media_threads\t\t0\t\t# 0 is one per CPU\n"
+			  "#media_clock\t\treal\t\t# {real,fast}\n"
+			  "#mos_alert\t\t3.5\t\t# 0 is off\n"
+			  "#rtcp_xr\t\tno\t\t# RFC 3611 VoIP metrics\n"
+			  "#rtp_busy_poll\t\t0\t\t# [us], 0 is off\n"
 			  "\n# Network\n"
 			  "#dns_server\t\t10.0.0.1:53\n"
-			  "#net_interface\t\t%H\n",
+			  "#net_interface\t\t%H\n"
+			  "#dns_cache\t\tyes\n"
+			  "\n# Scheduling - policy[:priority] [cpus]\n"
+			  "#sched_main\t\tdefault\n"
+			  "#sched_audio_tx\t\tfifo:40 2-3\n"
+			  "#sched_audio_dev\tfifo:45 2-3\n"
+			  "#sched_video_enc\tother 4-7\n"
+			  "#sched_mlockall\t\tno\n",
 			  cfg->avt.jbuf_del.min, cfg->avt.jbuf_del.max,
 			  default_interface_print, NULL);
 
 #ifdef USE_VIDEO
 	err |= re_hprintf(pf,
 			  "\n# BFCP\n"
-			  "#bfcp_proto\t\tudp\n");
+			  "#bfcp_proto\t\tudp\n"
+			  "#bfcp_present\t\tx11grab,+0,0\n"
+			  "#bfcp_present_fps\t5\n");
 #endif
 
 	return err;
@@ -579,6 +1071,7 @@ int config_write_template(const char *file, const struct config *cfg)
 	modpath = detect_module_path(&modpath_valid);
 	(void)re_fprintf(f, "%smodule_path\t\t%s\n",
 			 modpath_valid ? "" : "#", modpath);
+	(void)re_fprintf(f, "#module_slow\t\t100\t\t# [ms]\n");
 
 	(void)re_fprintf(f, "\n# UI Modules\n");
 #if defined (WIN32)
@@ -589,6 +1082,7 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "cons" MOD_EXT "\n");
 	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "evdev" MOD_EXT "\n");
 	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "httpd" MOD_EXT "\n");
+	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "ctrl_tcp" MOD_EXT "\n");
 
 	(void)re_fprintf(f, "\n# Audio codec Modules (in order)\n");
 	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "opus" MOD_EXT "\n");
@@ -610,6 +1104,7 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "speex_aec" MOD_EXT "\n");
 	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "speex_pp" MOD_EXT "\n");
 	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "plc" MOD_EXT "\n");
+	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "conference" MOD_EXT "\n");
 
 	(void)re_fprintf(f, "\n# Audio driver Modules\n");
 #if defined (ANDROID)
@@ -628,6 +1123,8 @@ int config_write_template(const char *file, const struct config *cfg)
 #endif
 	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "portaudio" MOD_EXT "\n");
 	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "aubridge" MOD_EXT "\n");
+	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "loadgen" MOD_EXT "\n");
+	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "nullaudio" MOD_EXT "\n");
 
 #ifdef USE_VIDEO
 
@@ -699,6 +1196,7 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "# Application Modules\n");
 	(void)re_fprintf(f, "\n");
 	(void)re_fprintf(f, "module_app\t\t" MOD_PRE "auloop"MOD_EXT"\n");
+	(void)re_fprintf(f, "#module_app\t\t" MOD_PRE "cdr"MOD_EXT"\n");
 	(void)re_fprintf(f, "module_app\t\t"  MOD_PRE "contact"MOD_EXT"\n");
 	(void)re_fprintf(f, "module_app\t\t"  MOD_PRE "menu"MOD_EXT"\n");
 	(void)re_fprintf(f, "#module_app\t\t"  MOD_PRE "mwi"MOD_EXT"\n");
@@ -710,6 +1208,13 @@ int config_write_template(const char *file, const struct config *cfg)
 #endif
 	(void)re_fprintf(f, "\n");
 
+	(void)re_fprintf(f, "\n#------------------------------------"
+			 "------------------------------------------\n");
+	(void)re_fprintf(f, "# Lazy Modules (loaded after startup)\n");
+	(void)re_fprintf(f, "\n");
+	(void)re_fprintf(f, "#module_lazy\t\t" MOD_PRE "g722"MOD_EXT"\n");
+	(void)re_fprintf(f, "\n");
+
 	(void)re_fprintf(f, "\n#------------------------------------"
 			 "------------------------------------------\n");
 	(void)re_fprintf(f, "# Module parameters\n");
@@ -717,10 +1222,42 @@ int config_write_template(const char *file, const struct config *cfg)
 
 	(void)re_fprintf(f, "\n");
 	(void)re_fprintf(f, "cons_listen\t\t0.0.0.0:5555\n");
+	(void)re_fprintf(f, "#cons_batch\t\tno # one command per line\n");
+	(void)re_fprintf(f, "#stdio_batch\t\tno # one command per line\n");
 
 	(void)re_fprintf(f, "\n");
 	(void)re_fprintf(f, "http_listen\t\t0.0.0.0:8000\n");
 
+	(void)re_fprintf(f, "\n");
+	(void)re_fprintf(f, "ctrl_tcp_listen\t\t127.0.0.1:4444\n");
+
+	(void)re_fprintf(f, "\n# Load generator\n");
+	(void)re_fprintf(f, "#loadgen_uri\t\tsip:load@127.0.0.1\n");
+	(void)re_fprintf(f, "#loadgen_cps\t\t10\n");
+	(void)re_fprintf(f, "#loadgen_max_calls\t100\n");
+	(void)re_fprintf(f, "#loadgen_hold\t\t30 # [s]\n");
+	(void)re_fprintf(f, "#loadgen_calls\t\t0 # 0 is no limit\n");
+	(void)re_fprintf(f, "#loadgen_codec\t\tPCMU\n");
+
+	(void)re_fprintf(f, "\n# Test video sources\n");
+	(void)re_fprintf(f, "#fakevideo_loop\t\t60 # frames, 0 is a still"
+			 " frame\n");
+	(void)re_fprintf(f, "#fakevideo_encoded\tno # replay in H.264\n");
+	(void)re_fprintf(f, "#cairo_loop\t\t50 # frames, 0 draws all\n");
+
+	(void)re_fprintf(f, "\n# Call Detail Records\n");
+	(void)re_fprintf(f, "#cdr_format\t\tjsonl # jsonl or csv\n");
+	(void)re_fprintf(f, "#cdr_file\t\t/var/log/baresip/cdr.jsonl\n");
+	(void)re_fprintf(f, "#cdr_udp\t\t127.0.0.1:514\n");
+	(void)re_fprintf(f, "#cdr_syslog\t\tno\n");
+	(void)re_fprintf(f, "#cdr_batch\t\t256 # records per batch\n");
+	(void)re_fprintf(f, "#cdr_flush\t\t1000 # [ms]\n");
+
+	(void)re_fprintf(f, "\n# Syslog\n");
+	(void)re_fprintf(f, "#syslog_server\t\t10.0.0.1:514\n");
+	(void)re_fprintf(f, "#syslog_format\t\trfc5424 # or rfc3164\n");
+	(void)re_fprintf(f, "#syslog_batch\t\t32 # messages per batch\n");
+
 	(void)re_fprintf(f, "\n");
 	(void)re_fprintf(f, "evdev_device\t\t/dev/input/event0\n");
 
@@ -733,10 +1270,34 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "speex_vbr\t\t0 # Variable Bit Rate 0-1\n");
 	(void)re_fprintf(f, "speex_vad\t\t0 # Voice Activity Detection 0-1\n");
 	(void)re_fprintf(f, "speex_agc_level\t\t8000\n");
+	(void)re_fprintf(f, "speex_denoise\t\tyes # {yes,no,wideband}\n");
+	(void)re_fprintf(f, "speex_pp_thread\t\tno\n");
 
 	(void)re_fprintf(f, "\n# Opus codec parameters\n");
 	(void)re_fprintf(f, "opus_bitrate\t\t28000 # 6000-510000\n");
 
+	(void)re_fprintf(f,
+			"\n# avcodec\n"
+			"#avcodec_hwaccel\tvaapi\t# {vaapi,cuda,qsv,..}\n"
+			"#avcodec_hwdevice\t/dev/dri/renderD128\n"
+			"#avcodec_h264dec\th264_v4l2m2m\n"
+			"#avcodec_h264enc\th264_vaapi\n"
+			"avcodec_dec_threads\t0\t# 0 is one per core\n"
+			"avcodec_dec_threading\tslice\t# {slice,frame,auto}\n"
+			"avcodec_enc_threads\t0\n"
+			"avcodec_low_delay\tno\t# send and decode slices\n");
+
+	(void)re_fprintf(f,
+			"\n# avformat\n"
+			"#avformat_hwaccel\tvaapi\t# {vaapi,cuda,qsv,..}\n"
+			"#avformat_hwdevice\t/dev/dri/renderD128\n"
+			"avformat_passthrough\tyes\t# send H.264 undecoded\n");
+
+	(void)re_fprintf(f,
+			"\n# gst_video1\n"
+			"#gst_video_encoder\tauto\t"
+			"# {auto,vaapih264enc,omxh264enc,..}\n");
+
 	(void)re_fprintf(f,
 			"\n# Selfview\n"
 			"video_selfview\t\twindow # {window,pip}\n"
@@ -747,7 +1308,23 @@ int config_write_template(const char *file, const struct config *cfg)
 			"ice_turn\t\tno\n"
 			"ice_debug\t\tno\n"
 			"ice_nomination\t\tregular\t# {regular,aggressive}\n"
-			"ice_mode\t\tfull\t# {full,lite}\n");
+			"ice_mode\t\tfull\t# {full,lite}\n"
+			"ice_trickle\t\tno\n");
+
+	(void)re_fprintf(f,
+			"\n# NAT-PMP / PCP\n"
+			"#natpmp_server\t\t10.0.0.1\n"
+			"#natpmp_proto\t\tauto\t# {auto,pcp,natpmp}\n"
+			"#natpmp_pool\t\t64\t# mapped rtp_ports, max.\n"
+			"#natpmp_pool_idle\t600\t# keep unused maps [s]\n");
+
+	(void)re_fprintf(f,
+			"\n# DTLS-SRTP\n"
+			"dtls_srtp_resumption\tno\n");
+
+	(void)re_fprintf(f,
+			"\n# Presence\n"
+			"#presence_rls_uri\tsip:buddies@example.com\n");
 
 	if (f)
 		(void)fclose(f);
@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 
@@ -13,26 +14,228 @@ enum access {
 	ACCESS_ALLOW
 };
 
+enum {
+	HASH_MIN  = 32,        /**< Initial buckets of the index         */
+	HASH_MAX  = 16384,     /**< Max. buckets of the index            */
+	HASH_LOAD = 4,         /**< Contacts per bucket before growing   */
+};
+
+/*
+ * The index key is the address without parameters. The scheme and the
+ * host are not case-sensitive, the user part is.
+ */
+struct key {
+	struct pl scheme;
+	struct pl user;
+	struct pl host;
+};
+
 struct contact {
 	struct le le;
-	struct le he;          /* hash-element with key 'auri' */
-	struct sip_addr addr;
+	struct le he;          /* hash-element with the key of 'auri' */
+	struct key key;
+	struct sip_addr addr;  /* decoded on first use */
 	char *buf;
-	enum presence_status status;
-	enum access access;
+	struct mbuf *mb;       /* shared buffer of a bulk load */
+	uint8_t status;        /* enum presence_status */
+	uint8_t access;        /* enum access */
+	bool decoded;
 };
 
 static struct list cl;
 static struct hash *cht;
+static uint32_t cht_size;
+static uint32_t contactc;
+static struct contact *catch_all;  /* the <sip:*@*> contact */
 
 
 static void destructor(void *arg)
 {
 	struct contact *c = arg;
 
+	if (c->le.list)
+		--contactc;
+
 	hash_unlink(&c->he);
 	list_unlink(&c->le);
-	mem_deref(c->buf);
+
+	if (c == catch_all)
+		catch_all = contact_find("sip:*@*");
+
+	if (c->mb)
+		mem_deref(c->mb);
+	else
+		mem_deref(c->buf);
+}
+
+
+/* The addr-spec and the header parameters of a SIP address */
+static int addr_scan(const struct pl *addr, struct pl *auri,
+		     struct pl *params)
+{
+	const char *lt, *gt, *semi;
+
+	lt = pl_strchr(addr, '<');
+	if (lt) {
+		struct pl rest;
+
+		rest.p = lt + 1;
+		rest.l = addr->p + addr->l - rest.p;
+
+		gt = pl_strchr(&rest, '>');
+		if (!gt)
+			return EBADMSG;
+
+		auri->p = rest.p;
+		auri->l = gt - rest.p;
+
+		params->p = gt + 1;
+		params->l = addr->p + addr->l - params->p;
+	}
+	else {
+		*auri = *addr;
+
+		semi = pl_strchr(addr, ';');
+		if (semi)
+			auri->l = semi - addr->p;
+
+		params->p = auri->p + auri->l;
+		params->l = addr->l - auri->l;
+	}
+
+	while (auri->l && (auri->p[0] == ' ' || auri->p[0] == '\t'))
+		pl_advance(auri, 1);
+
+	while (auri->l && strchr(" \t\r", auri->p[auri->l - 1]))
+		--auri->l;
+
+	return 0;
+}
+
+
+static int key_decode(struct key *key, const struct pl *auri)
+{
+	struct pl rest;
+	const char *at;
+
+	if (re_regex(auri->p, auri->l, "[^:]+:[^;?]+",
+		     &key->scheme, &rest))
+		return EBADMSG;
+
+	at = pl_strrchr(&rest, '@');
+	if (at) {
+		key->user.p = rest.p;
+		key->user.l = at - rest.p;
+		pl_advance(&rest, at + 1 - rest.p);
+	}
+	else {
+		key->user = pl_null;
+	}
+
+	key->host = rest;
+
+	return key->host.l ? 0 : EBADMSG;
+}
+
+
+static uint32_t key_hash(const struct key *key)
+{
+	return hash_joaat_pl(&key->user) ^ hash_joaat_pl_ci(&key->host);
+}
+
+
+static bool key_cmp(const struct key *a, const struct key *b)
+{
+	return 0 == pl_casecmp(&a->scheme, &b->scheme) &&
+		0 == pl_cmp(&a->user, &b->user) &&
+		0 == pl_casecmp(&a->host, &b->host);
+}
+
+
+static int access_decode(enum access *access, const struct pl *params)
+{
+	struct pl pl;
+
+	if (msg_param_decode(params, "access", &pl)) {
+		*access = ACCESS_UNKNOWN;
+		return 0;
+	}
+
+	if (0 == pl_strcasecmp(&pl, "block"))
+		*access = ACCESS_BLOCK;
+	else if (0 == pl_strcasecmp(&pl, "allow"))
+		*access = ACCESS_ALLOW;
+	else
+		return EINVAL;
+
+	return 0;
+}
+
+
+/* Grow the index with the number of contacts, to keep the chains short */
+static int index_grow(void)
+{
+	struct hash *ht;
+	struct le *le;
+	uint32_t size = cht_size;
+	int err;
+
+	while (size < HASH_MAX && contactc > size * HASH_LOAD)
+		size *= 4;
+
+	if (size == cht_size)
+		return 0;
+
+	err = hash_alloc(&ht, size);
+	if (err)
+		return err;
+
+	for (le = list_head(&cl); le; le = le->next) {
+
+		struct contact *c = le->data;
+
+		hash_unlink(&c->he);
+		hash_append(ht, key_hash(&c->key), &c->he, c);
+	}
+
+	mem_deref(cht);
+	cht = ht;
+	cht_size = size;
+
+	return 0;
+}
+
+
+static int contact_insert(struct contact *c, const struct pl *auri,
+			  const struct pl *params)
+{
+	enum access access;
+	int err;
+
+	err = key_decode(&c->key, auri);
+	if (err) {
+		warning("contact: invalid address '%s'\n", c->buf);
+		return err;
+	}
+
+	err = access_decode(&access, params);
+	if (err) {
+		warning("contact: unknown 'access' for '%s'\n", c->buf);
+		return err;
+	}
+
+	c->access = access;
+	c->status = PRESENCE_UNKNOWN;
+
+	list_append(&cl, &c->le, c);
+	hash_append(cht, key_hash(&c->key), &c->he, c);
+	++contactc;
+
+	if (!catch_all && !pl_strcasecmp(&c->key.scheme, "sip") &&
+	    !pl_strcmp(&c->key.user, "*") && !pl_strcmp(&c->key.host, "*"))
+		catch_all = c;
+
+	return index_grow();
 }
 
 
@@ -69,28 +272,9 @@ int contact_add(struct contact **contactp, const struct pl *addr)
 		goto out;
 	}
 
-	if (0 == msg_param_decode(&c->addr.params, "access", &pl)) {
-
-		if (0 == pl_strcasecmp(&pl, "block")) {
-			c->access = ACCESS_BLOCK;
-		}
-		else if (0 == pl_strcasecmp(&pl, "allow")) {
-			c->access = ACCESS_ALLOW;
-		}
-		else {
-			warning("contact: unknown 'access=%r' for '%r'\n",
-				&pl, addr);
-			err = EINVAL;
-			goto out;
-		}
-	}
-	else
-		c->access = ACCESS_UNKNOWN;
-
-	c->status = PRESENCE_UNKNOWN;
+	c->decoded = true;
 
-	list_append(&cl, &c->le, c);
-	hash_append(cht, hash_joaat_pl(&c->addr.auri), &c->he, c);
+	err = contact_insert(c, &c->addr.auri, &c->addr.params);
 
  out:
 	if (err)
@@ -102,6 +286,76 @@ int contact_add(struct contact **contactp, const struct pl *addr)
 }
 
 
+/**
+ * Add the contacts from a buffer with one contact per line. The lines
+ * are only scanned for the address and the access parameter; the full
+ * SIP address is decoded when it is first used. The buffer is shared
+ * by the contacts, and is changed to hold their strings.
+ *
+ * @param mb Buffer with contacts in SIP address format
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int contact_load(struct mbuf *mb)
+{
+	struct pl pl;
+	char *end;
+	int err = 0;
+
+	if (!cht || !mb)
+		return EINVAL;
+
+	pl.p = (const char *)mbuf_buf(mb);
+	pl.l = mbuf_get_left(mb);
+	end  = (char *)pl.p + pl.l;
+
+	while (pl.l && !err) {
+
+		const char *lb = pl_strchr(&pl, '\n');
+		struct pl line, auri, params;
+		struct contact *c;
+
+		line.p = pl.p;
+		line.l = lb ? (size_t)(lb - pl.p) : pl.l;
+		pl_advance(&pl, line.l + (lb ? 1 : 0));
+
+		while (line.l && strchr(" \t\r", line.p[line.l - 1]))
+			--line.l;
+
+		if (!line.l || line.p[0] == '#')
+			continue;
+
+		/* the last line has no room for the NUL */
+		if (line.p + line.l == end) {
+			struct pl copy = line;
+
+			err = contact_add(NULL, &copy);
+			continue;
+		}
+
+		err = addr_scan(&line, &auri, &params);
+		if (err) {
+			warning("contact: decode error '%r'\n", &line);
+			break;
+		}
+
+		c = mem_zalloc(sizeof(*c), destructor);
+		if (!c)
+			return ENOMEM;
+
+		c->buf = (char *)line.p;
+		c->buf[line.l] = '\0';
+		c->mb  = mem_ref(mb);
+
+		err = contact_insert(c, &auri, &params);
+		if (err)
+			mem_deref(c);
+	}
+
+	return err;
+}
+
+
 /**
  * Get the SIP address of a contact
  *
@@ -111,7 +365,25 @@ int contact_add(struct contact **contactp, const struct pl *addr)
  */
 struct sip_addr *contact_addr(const struct contact *c)
 {
-	return c ? (struct sip_addr *)&c->addr : NULL;
+	struct contact *cm = (struct contact *)c;
+	struct pl pl;
+
+	if (!c)
+		return NULL;
+
+	if (!c->decoded) {
+
+		cm->decoded = true;
+
+		pl_set_str(&pl, c->buf);
+
+		if (sip_addr_decode(&cm->addr, &pl)) {
+			warning("contact: decode error '%s'\n", c->buf);
+			memset(&cm->addr, 0, sizeof(cm->addr));
+		}
+	}
+
+	return &cm->addr;
 }
 
 
@@ -146,7 +418,8 @@ void contact_set_presence(struct contact *c, enum presence_status status)
 
 	if (c->status != PRESENCE_UNKNOWN && c->status != status) {
 
-		info("<%r> changed status from %s to %s\n", &c->addr.auri,
+		info("<%r> changed status from %s to %s\n",
+		     &contact_addr(c)->auri,
 		     contact_presence_str(c->status),
 		     contact_presence_str(status));
 	}
@@ -180,7 +453,7 @@ int contacts_print(struct re_printf *pf, void *unused)
 
 	for (le = list_head(contact_list()); le && !err; le = le->next) {
 		const struct contact *c = le->data;
-		const struct sip_addr *addr = &c->addr;
+		const struct sip_addr *addr = contact_addr(c);
 
 		err = re_hprintf(pf, "%20s  %r <%r>\n",
 				 contact_presence_str(c->status),
@@ -202,8 +475,10 @@ int contact_init(void)
 {
 	int err = 0;
 
-	if (!cht)
-		err = hash_alloc(&cht, 32);
+	if (!cht) {
+		err = hash_alloc(&cht, HASH_MIN);
+		cht_size = HASH_MIN;
+	}
 
 	return err;
 }
@@ -224,12 +499,13 @@ static bool find_handler(struct le *le, void *arg)
 {
 	struct contact *c = le->data;
 
-	return 0 == pl_strcmp(&c->addr.auri, arg);
+	return key_cmp(&c->key, arg);
 }
 
 
 /**
- * Lookup a SIP uri in all registered contacts
+ * Lookup a SIP uri in all registered contacts. The scheme and the host
+ * are compared without case, and URI parameters are ignored.
  *
  * @param uri SIP uri to lookup
  *
@@ -237,8 +513,19 @@ static bool find_handler(struct le *le, void *arg)
  */
 struct contact *contact_find(const char *uri)
 {
-	return list_ledata(hash_lookup(cht, hash_joaat_str(uri),
-				       find_handler, (void *)uri));
+	struct pl pl, auri, params;
+	struct key key;
+
+	if (!uri)
+		return NULL;
+
+	pl_set_str(&pl, uri);
+
+	if (addr_scan(&pl, &auri, &params) || key_decode(&key, &auri))
+		return NULL;
+
+	return list_ledata(hash_lookup(cht, key_hash(&key),
+				       find_handler, &key));
 }
 
 
@@ -260,7 +547,7 @@ bool contact_block_access(const char *uri)
 	if (c && c->access != ACCESS_UNKNOWN)
 		return c->access == ACCESS_BLOCK;
 
-	c = contact_find("sip:*@*");
+	c = catch_all;
 	if (c && c->access != ACCESS_UNKNOWN)
 		return c->access == ACCESS_BLOCK;
 
@@ -52,6 +52,8 @@ struct account {
 	uint32_t ptime;              /**< Configured packet time in [ms]     */
 	uint32_t regint;             /**< Registration interval in [seconds] */
 	uint32_t pubint;             /**< Publication interval in [seconds]  */
+	uint32_t max_calls;          /**< Maximum number of calls, 0=global  */
+	bool mwi;                    /**< Subscribe to message-summary       */
 	char *regq;                  /**< Registration Q-value               */
 	char *rtpkeep;               /**< RTP Keepalive mechanism            */
 	char *sipnat;                /**< SIP Nat mechanism                  */
@@ -61,9 +63,17 @@ struct account {
 	uint16_t stun_port;          /**< STUN Port number                   */
 	struct le vcv[4];            /**< List elements for vidcodecl        */
 	struct list vidcodecl;       /**< List of preferred video-codecs     */
+	struct audio_plan *auplan;   /**< Cached audio formats to offer      */
 };
 
 
+/*
+ * Audio Codec
+ */
+
+uint32_t aucodec_gen(void);
+
+
 /*
  * Audio Player
  */
@@ -94,20 +104,231 @@ struct ausrc {
 };
 
 
+/*
+ * Audio latency per pipeline stage
+ */
+
+enum aulat_stage {
+	AULAT_DEVICE = 0, /**< Device buffer, if the driver tells */
+	AULAT_AUBUF,      /**< Audio ring-buffer                  */
+	AULAT_RESAMP,     /**< Resampler                          */
+	AULAT_FILT,       /**< Audio filters                      */
+	AULAT_CODEC,      /**< Encoder or decoder                 */
+	AULAT_RTP,        /**< RTP send, or jitter-buffer delay   */
+	AULAT_N
+};
+
+enum { AULAT_WINS = 3 };
+
+struct aulat {
+	struct histo winv[AULAT_WINS][AULAT_N]; /**< Rolling windows  */
+	unsigned wr;                  /**< Window being written        */
+	unsigned rd;                  /**< Last complete window        */
+	uint64_t ts_win;              /**< Start of current window [us] */
+	bool rx;                      /**< Receive direction           */
+};
+
+void aulat_init(struct aulat *al, bool rx);
+void aulat_tick(struct aulat *al, uint64_t now);
+void aulat_add(struct aulat *al, enum aulat_stage stage, uint32_t usec);
+const struct histo *aulat_histo(const struct aulat *al,
+				enum aulat_stage stage);
+int  aulat_debug(struct re_printf *pf, const struct aulat *al);
+
+
+/*
+ * Heap allocations per media stage (debug builds with USE_ALLOC_STATS)
+ */
+
+enum alloc_stage {
+	ALLOC_DEVICE = 0, /**< Device read or write handler       */
+	ALLOC_CONV,       /**< Resampler and format conversion    */
+	ALLOC_FILT,       /**< Audio or video filters             */
+	ALLOC_CODEC,      /**< Encoder or decoder                 */
+	ALLOC_RTP,        /**< RTP send or receive                */
+	ALLOC_N
+};
+
+struct allocstat {
+	uint64_t framec;              /**< Number of frames            */
+	uint64_t allocv[ALLOC_N];     /**< Allocations per stage       */
+	uint64_t last;                /**< Thread count at last mark   */
+};
+
+#ifdef USE_ALLOC_STATS
+void allocstat_frame(struct allocstat *as);
+void allocstat_stage(struct allocstat *as, enum alloc_stage stage);
+#else
+#define allocstat_frame(as)        (void)(as)
+#define allocstat_stage(as, stage) (void)(as)
+#endif
+int  allocstat_debug(struct re_printf *pf, const struct allocstat *as);
+
+
+/*
+ * Static tracepoints (USDT) for perf, bpftrace and SystemTap, with
+ * USE_USDT. A probe that is not traced is a single nop instruction,
+ * only its arguments are evaluated. The probes of provider "baresip":
+ *
+ *   stream_send     call-id, ssrc, seq, ts, bytes
+ *   rtp_recv        call-id, ssrc, seq, ts, bytes
+ *   jbuf_put        call-id, ssrc, seq, ts, err
+ *   jbuf_get        call-id, ssrc, seq, ts
+ *   audio_tx        call-id, samples
+ *   audio_send      call-id, ts, samples, bytes
+ *   audio_decode    call-id, seq, ts, bytes, samples
+ *   video_encode    call-id, width, height
+ *   video_send      call-id, ts, bytes, retransmission
+ *   sip_conn        call-id, length, from, length (not terminated)
+ *   call_event      call-id, event, text
+ */
+
+#ifdef USE_USDT
+#include <sys/sdt.h>
+#define PROBE2(name, a, b)             DTRACE_PROBE2(baresip, name, a, b)
+#define PROBE3(name, a, b, c)          DTRACE_PROBE3(baresip, name, a, b, c)
+#define PROBE4(name, a, b, c, d) \
+	DTRACE_PROBE4(baresip, name, a, b, c, d)
+#define PROBE5(name, a, b, c, d, e) \
+	DTRACE_PROBE5(baresip, name, a, b, c, d, e)
+#define PROBE6(name, a, b, c, d, e, f) \
+	DTRACE_PROBE6(baresip, name, a, b, c, d, e, f)
+#else
+#define PROBE2(name, a, b)
+#define PROBE3(name, a, b, c)
+#define PROBE4(name, a, b, c, d)
+#define PROBE5(name, a, b, c, d, e)
+#define PROBE6(name, a, b, c, d, e, f)
+#endif
+
+
+/*
+ * Trace of the media pipelines
+ */
+
+enum trace_span {
+	TRACE_CAPTURE = 0,  /**< Source device                      */
+	TRACE_CONVERT,      /**< Resampler or pixel conversion      */
+	TRACE_FILTER,       /**< Audio or video filters             */
+	TRACE_ENCODE,       /**< Encoder                            */
+	TRACE_PACKETIZE,    /**< RTP packets of a frame             */
+	TRACE_SEND,         /**< RTP send                           */
+	TRACE_RECEIVE,      /**< RTP receive                        */
+	TRACE_JBUF,         /**< Jitter-buffer                      */
+	TRACE_DECODE,       /**< Decoder                            */
+	TRACE_DISPLAY,      /**< Player or display device           */
+	TRACE_N
+};
+
+bool trace_active(const struct call *call);
+void trace_span(const struct call *call, bool video, enum trace_span span,
+		uint64_t start, uint64_t end);
+int  trace_start(const struct call *call);
+int  trace_stop(const char *path);
+int  trace_command(struct re_printf *pf, void *arg);
+void trace_close(void);
+
+
+/*
+ * Voice Activity Detection and Comfort Noise (RFC 3389)
+ */
+
+struct vad {
+	float floor;                  /**< Background noise estimate     */
+	float noise;                  /**< Power of last silent frame    */
+	uint32_t hang;                /**< Remaining hangover in [ms]    */
+};
+
+void     vad_init(struct vad *vad);
+bool     vad_process(struct vad *vad, const int16_t *sampv, size_t sampc,
+		     uint32_t ptime);
+uint8_t  vad_level(const struct vad *vad);
+uint32_t cn_amplitude(uint8_t level);
+void     cn_generate(int16_t *sampv, size_t sampc, uint32_t amp,
+		     uint32_t *seed);
+
+
+/*
+ * Time-stretch
+ */
+
+size_t tstretch_accel(int16_t *sampv, size_t sampc, uint32_t srate,
+		      uint8_t ch);
+size_t tstretch_expand(int16_t *outv, size_t maxc, const int16_t *sampv,
+		       size_t sampc, uint32_t srate, uint8_t ch);
+
+
+/*
+ * Scratch buffers, per thread
+ */
+
+enum scratch_slot {
+	SCRATCH_TX = 0,   /**< Frame read from the source ring  */
+	SCRATCH_TX_RS,    /**< Resampled frame for the encoder  */
+	SCRATCH_RX_TS,    /**< Time-stretched decoded frame     */
+	SCRATCH_RX_RS,    /**< Resampled frame for the player   */
+	SCRATCH_N
+};
+
+int16_t *scratch_samp(enum scratch_slot slot, size_t sampc);
+void     scratch_close(void);
+size_t   scratch_mem(void);
+
+
+/*
+ * Decoder cache
+ */
+
+enum {
+	DECCACHE_SIZE = 4,  /**< Idle decoders kept for PT flips */
+};
+
+/** Idle decoders, by codec */
+struct deccache {
+	struct {
+		const void *codec;
+		void *dec;
+	} v[DECCACHE_SIZE];
+	unsigned next;      /**< Next slot to replace            */
+};
+
+void *deccache_swap(struct deccache *dc, const void *cur, void *dec,
+		    const void *codec);
+void  deccache_flush(struct deccache *dc);
+
+
+/*
+ * Memory of a call
+ */
+
+/** Memory of a call by component, in [bytes] */
+struct callmem {
+	size_t obj;       /**< Call and stream objects             */
+	size_t buf;       /**< Sample, float and frame buffers     */
+	size_t ring;      /**< Audio ring-buffers                  */
+	size_t pkt;       /**< Packet buffers                      */
+	size_t jbuf;      /**< Jitter-buffer, when full            */
+};
+
+
 /*
  * Audio Stream
  */
 
 struct audio;
+struct audio_plan;
 
 typedef void (audio_event_h)(int key, bool end, void *arg);
 typedef void (audio_err_h)(int err, const char *str, void *arg);
 
+int audio_plan_get(struct audio_plan **planp,
+		   const struct config_audio *cfg,
+		   const struct list *aucodecl);
 int audio_alloc(struct audio **ap, const struct config *cfg,
 		struct call *call, struct sdp_session *sdp_sess, int label,
 		const struct mnat *mnat, struct mnat_sess *mnat_sess,
 		const struct menc *menc, struct menc_sess *menc_sess,
-		uint32_t ptime, const struct list *aucodecl,
+		uint32_t ptime, const struct audio_plan *plan,
 		audio_event_h *eventh, audio_err_h *errh, void *arg);
 int  audio_start(struct audio *a);
 void audio_stop(struct audio *a);
@@ -115,10 +336,10 @@ int  audio_encoder_set(struct audio *a, const struct aucodec *ac,
 		       int pt_tx, const char *params);
 int  audio_decoder_set(struct audio *a, const struct aucodec *ac,
 		       int pt_rx, const char *params);
-struct stream *audio_strm(const struct audio *a);
 int  audio_send_digit(struct audio *a, char key);
 void audio_sdp_attr_decode(struct audio *a);
 int  audio_print_rtpstat(struct re_printf *pf, const struct audio *au);
+void audio_memstat(struct callmem *ms, const struct audio *a);
 
 
 /*
@@ -126,10 +347,15 @@ int  audio_print_rtpstat(struct re_printf *pf, const struct audio *au);
  */
 
 struct bfcp;
+
+typedef void (bfcp_floor_h)(bool granted, void *arg);
+
 int bfcp_alloc(struct bfcp **bfcpp, struct sdp_session *sdp_sess,
 	       const char *proto, bool offerer,
-	       const struct mnat *mnat, struct mnat_sess *mnat_sess);
+	       const struct mnat *mnat, struct mnat_sess *mnat_sess,
+	       bfcp_floor_h *floorh, void *arg);
 int bfcp_start(struct bfcp *bfcp);
+int bfcp_floor(struct bfcp *bfcp, bool request);
 
 
 /*
@@ -145,11 +371,12 @@ struct call_prm {
 };
 
 int  call_alloc(struct call **callp, const struct config *cfg,
-		struct list *lst,
+		struct list *lst, struct hash *idht,
 		const char *local_name, const char *local_uri,
 		struct account *acc, struct ua *ua, const struct call_prm *prm,
 		const struct sip_msg *msg, struct call *xcall,
 		call_event_h *eh, void *arg);
+void call_detach(struct call *call);
 int  call_connect(struct call *call, const struct pl *paddr);
 int  call_accept(struct call *call, struct sipsess_sock *sess_sock,
 		 const struct sip_msg *msg);
@@ -158,12 +385,15 @@ int  call_progress(struct call *call);
 int  call_answer(struct call *call, uint16_t scode);
 int  call_sdp_get(const struct call *call, struct mbuf **descp, bool offer);
 int  call_jbuf_stat(struct re_printf *pf, const struct call *call);
-int  call_info(struct re_printf *pf, const struct call *call);
 int  call_reset_transp(struct call *call);
 int  call_notify_sipfrag(struct call *call, uint16_t scode,
 			 const char *reason, ...);
 int  call_af(const struct call *call);
+bool call_is_setup(const struct call *call);
+bool call_is_established(const struct call *call);
+void call_media_stop(struct call *call);
 void call_set_xrtpstat(struct call *call);
+void call_quality_event(struct call *call, const struct stream *s);
 
 
 /*
@@ -180,7 +410,38 @@ int conf_get_csv(const struct conf *conf, const char *name,
  * Media control
  */
 
-int mctrl_handle_media_control(struct pl *body, bool *pfu);
+int mctrl_handle_media_control(const struct pl *body, bool *pfu);
+int mctrl_dtmf_relay(const struct pl *body, char *sig, uint32_t *dur);
+
+
+/*
+ * Media scheduler
+ */
+
+struct msched;
+struct msched_job;
+
+typedef void (msched_h)(void *arg);
+
+int msched_alloc(struct msched **msp, uint32_t nthreads);
+int msched_job_alloc(struct msched_job **jobp, struct msched *ms,
+		     uint32_t interval, msched_h *h, void *arg);
+int msched_debug(struct re_printf *pf, const struct msched *ms);
+int msched_load(struct msched *ms, uint32_t *load_max, uint32_t *late);
+struct msched *baresip_msched(void);
+
+
+/*
+ * Audio encoder batch
+ */
+
+struct aubatch;
+
+typedef void (aubatch_h)(void *arg);
+
+int aubatch_add(struct aubatch **abp, const struct aucodec *ac,
+		uint32_t ptime, aubatch_h *h, void *arg);
+int aubatch_debug(struct re_printf *pf, void *unused);
 
 
 /*
@@ -199,17 +460,82 @@ struct mnat {
 const struct mnat *mnat_find(const char *id);
 
 
+/*
+ * Music on hold
+ */
+
+struct moh_memb;
+
+int  moh_join(struct moh_memb **membp, struct audio *a,
+	      const struct aucodec *ac);
+void audio_moh_send(struct audio *a, struct mbuf *mb, uint32_t ts_inc);
+
+
+/*
+ * Audio-file player
+ */
+
+/** Decoded samples of an audio file */
+struct play_pcm {
+	const int16_t *sampv;
+	size_t sampc;
+	uint32_t srate;
+	uint8_t ch;
+};
+
+int play_pcm_get(void **tonep, struct play_pcm *pcm, const char *filename);
+
+
+/*
+ * Pre-encoded prompts
+ */
+
+struct prompt_play;
+
+typedef void (prompt_done_h)(void *arg);
+
+int  prompt_play_alloc(struct prompt_play **ppp, struct audio *a,
+		       const struct aucodec *ac, uint32_t ptime,
+		       const char *filename, int repeat,
+		       prompt_done_h *doneh, void *arg);
+void prompt_close(void);
+
+
 /*
  * Metric
  */
 
+/* Relaxed atomics for counters and other lock-free shared state */
+#if defined (__GNUC__)
+#define ATOMIC_ADD(p, v)    __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(p)      __atomic_load_n((p), __ATOMIC_RELAXED)
+#define ATOMIC_STORE(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define ATOMIC_XCHG(p, v)   __atomic_exchange_n((p), (v), __ATOMIC_RELAXED)
+#define ATOMIC_CAS(p, e, v) __atomic_compare_exchange_n((p), (e), (v), \
+				false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#else
+/* the old value, like __atomic_fetch_add() */
+#define ATOMIC_ADD(p, v)    ((*(p) += (v)) - (v))
+#define ATOMIC_LOAD(p)      (*(p))
+#define ATOMIC_STORE(p, v)  (*(p) = (v))
+#define ATOMIC_XCHG(p, v)   atomic_xchg_u32((p), (v))
+#define ATOMIC_CAS(p, e, v) (*(p) == *(e) ? (*(p) = (v), true) \
+				 : (*(e) = *(p), false))
+static inline uint32_t atomic_xchg_u32(volatile uint32_t *p, uint32_t v)
+{
+	uint32_t old = *p;
+	*p = v;
+	return old;
+}
+#endif
+
 struct metric {
 	/* internal stuff: */
-	struct tmr tmr;
+	struct twheel_tmr tmr;
 	uint64_t ts_start;
 	bool started;
 
-	/* counters: */
+	/* counters, updated with ATOMIC_ADD: */
 	uint32_t n_packets;
 	uint32_t n_bytes;
 	uint32_t n_err;
@@ -218,12 +544,43 @@ struct metric {
 	uint32_t cur_bitrate;
 	uint64_t ts_last;
 	uint32_t n_bytes_last;
+
+	/* peak bitrate over short windows */
+	uint64_t win_start;      /**< Start of current window [us]       */
+	uint32_t win_bytes;      /**< Bytes in current window            */
+	uint32_t win_peak;       /**< Peak since last timer [bit/s]      */
+	uint32_t peak_bitrate;   /**< Peak in last timer interval [bit/s] */
+
+	/* histograms in [us] */
+	uint64_t ts_packet;      /**< Time of previous packet [us]       */
+	struct histo h_iat;      /**< Packet inter-arrival time          */
+	struct histo h_jbuf;     /**< Jitter-buffer delay (receive only) */
+	uint32_t jbuf_delay;     /**< Delay of the last released frame   */
+
+	/* set by the stream while it passes a frame on (receive only) */
+	uint32_t jb_lost;        /**< Frames lost before this one        */
+	bool jb_late;            /**< No frame was ready to be released  */
+	bool jb_shrink;          /**< Extra frame, to shrink the delay   */
+	bool jb_grow;            /**< No frame, to grow the delay        */
+	struct histo h_proc;     /**< Encode or decode time per frame    */
 };
 
 void     metric_init(struct metric *metric);
 void     metric_reset(struct metric *metric);
 void     metric_add_packet(struct metric *metric, size_t packetsize);
+void     metric_add_err(struct metric *metric);
+void     metric_add_proc(struct metric *metric, uint64_t ts_start);
 uint32_t metric_avg_bitrate(const struct metric *metric);
+uint64_t metric_time_us(void);
+int      metric_debug(struct re_printf *pf, const struct metric *metric);
+
+
+/*
+ * Main loop lag monitor
+ */
+
+int  lagmon_init(void);
+void lagmon_close(void);
 
 
 /*
@@ -234,6 +591,32 @@ int module_init(const struct conf *conf);
 void module_app_unload(void);
 
 
+/*
+ * Network change monitor
+ */
+
+struct netmon;
+
+typedef void (netmon_h)(void *arg);
+
+int netmon_alloc(struct netmon **nmp, netmon_h *h, void *arg);
+
+
+/*
+ * Pacer
+ */
+
+struct pacer;
+
+int      pacer_alloc(struct pacer **pacerp, uint32_t bitrate,
+		     uint32_t factor, size_t burst);
+void     pacer_set_bitrate(struct pacer *p, uint32_t bitrate);
+bool     pacer_allow(struct pacer *p);
+void     pacer_sent(struct pacer *p, size_t len);
+uint32_t pacer_delay(const struct pacer *p, size_t len);
+int      pacer_debug(struct re_printf *pf, const struct pacer *p);
+
+
 /*
  * Register client
  */
@@ -246,8 +629,10 @@ int  reg_register(struct reg *reg, const char *reg_uri,
 void reg_unregister(struct reg *reg);
 bool reg_isok(const struct reg *reg);
 int  reg_sipfd(const struct reg *reg);
+bool reg_rebind_needed(const struct reg *reg, bool v4, bool v6);
 int  reg_debug(struct re_printf *pf, const struct reg *reg);
 int  reg_status(struct re_printf *pf, const struct reg *reg);
+int  reg_sched_debug(struct re_printf *pf);
 
 
 /*
@@ -259,6 +644,7 @@ struct rtpkeep;
 int  rtpkeep_alloc(struct rtpkeep **rkp, const char *method, int proto,
 		   struct rtp_sock *rtp, struct sdp_media *sdp);
 void rtpkeep_refresh(struct rtpkeep *rk, uint32_t ts);
+int  rtpkeep_debug(struct re_printf *pf, const struct rtpkeep *rk);
 
 
 /*
@@ -268,6 +654,18 @@ void rtpkeep_refresh(struct rtpkeep *rk, uint32_t ts);
 int sdp_decode_multipart(const struct pl *ctype_prm, struct mbuf *mb);
 const struct sdp_format *sdp_media_format_cycle(struct sdp_media *m);
 
+/** Header extension mapping from a=extmap */
+struct sdp_extmap {
+	struct pl name;          /**< URI of the header extension    */
+	struct pl attrs;         /**< Extension attributes           */
+	enum sdp_dir dir;        /**< Direction                      */
+	uint32_t id;             /**< Local identifier               */
+};
+
+int sdp_extmap_decode(struct sdp_extmap *ext, const char *val);
+int sdp_bundle_index(const struct sdp_session *sess,
+		     const struct sdp_media *m);
+
 
 /*
  * Stream
@@ -275,7 +673,15 @@ const struct sdp_format *sdp_media_format_cycle(struct sdp_media *m);
 
 struct rtp_header;
 
-enum {STREAM_PRESZ = 4+12}; /* same as RTP_HEADER_SIZE */
+enum {STREAM_PRESZ = 4+12+RTPEXT_PRESZ}; /* TURN, RTP and extensions */
+enum {STREAM_PTC = 8};                   /* Cached payload types     */
+
+/** Local format of a payload type, cached by the stream */
+struct ptcache {
+	const struct sdp_format *fmt; /**< Local format, NULL if none   */
+	uint8_t pt;                   /**< Payload type                 */
+	bool valid;                   /**< Entry is set                 */
+};
 
 typedef void (stream_rtp_h)(const struct rtp_header *hdr, struct mbuf *mb,
 			    void *arg);
@@ -289,21 +695,66 @@ struct stream {
 	struct sdp_media *sdp;   /**< SDP Media line                        */
 	struct rtp_sock *rtp;    /**< RTP Socket                            */
 	struct rtpkeep *rtpkeep; /**< RTP Keepalive                         */
+	struct udpbatch *batch;  /**< Batched sending of RTP, optional      */
+	struct impair *impair;   /**< Network impairment, for testing       */
 	struct rtcp_stats rtcp_stats;/**< RTCP statistics                   */
 	struct jbuf *jbuf;       /**< Jitter Buffer for incoming RTP        */
+	struct ajb *ajb;         /**< Adaptive jitter buffer, optional      */
 	struct mnat_media *mns;  /**< Media NAT traversal state             */
 	const struct menc *menc; /**< Media encryption module               */
 	struct menc_sess *mencs; /**< Media encryption session state        */
 	struct menc_media *mes;  /**< Media Encryption media state          */
 	struct metric metric_tx; /**< Metrics for transmit                  */
 	struct metric metric_rx; /**< Metrics for receiving                 */
+	struct allocstat alloc_rx;/**< Allocations in RTP receive           */
+	struct mosq mosq;        /**< Quality estimate of received audio    */
+	struct twheel_tmr tmr_mosq;/**< Updates the quality estimate        */
+	struct seqwin rxwin;     /**< Loss, reordering and duplicates       */
+	struct rtcpxr xr;        /**< Receive statistics for RTCP XR        */
+	struct rtcpxr_voip xr_peer;/**< Last VoIP metrics from the peer     */
+	bool xr_peer_valid;      /**< xr_peer has been received             */
+	struct twheel_tmr tmr_xr;/**< Sends RTCP XR VoIP metrics            */
+	struct udp_helper *uh_xr;/**< Reads RTCP XR on the RTP socket       */
+	struct udp_helper *uh_xr_rtcp;/**< Reads RTCP XR on the RTCP socket */
+	struct bwe *bwe;         /**< Receive bandwidth estimator, optional */
+	uint64_t bwe_ts;         /**< Time of last REMB [us]                */
+	uint32_t bwe_sent;       /**< Bitrate in last REMB [bit/s]          */
+	struct mbuf *mb_remb;    /**< Buffer for outgoing REMB              */
+	struct rtx *rtx;         /**< RTP send history, optional            */
+	uint32_t rtx_ssrc;       /**< Synchronization source of RTX         */
+	uint16_t rtx_seq;        /**< Next RTX sequence number              */
+	int rtx_pt;              /**< RTX payload type, for pt_enc          */
+	bool nack;               /**< Send NACK for lost packets            */
+	struct fecenc *fecenc;   /**< FEC encoder, optional                 */
+	struct fecdec *fecdec;   /**< FEC decoder, optional                 */
+	uint32_t fec_ssrc;       /**< Synchronization source of FEC         */
+	uint16_t fec_seq;        /**< Next FEC sequence number              */
+	int fec_pt;              /**< FEC payload type of the peer          */
+	struct udp_helper *uh_ext;/**< Sets the X bit of extended packets   */
+	uint8_t extmap[RTPEXT_MAX];/**< Negotiated extension IDs, 0 is off  */
+	uint32_t ext_offer;      /**< Offered extensions, one bit each      */
+	bool ext_answered;       /**< Remote extensions are known           */
+	bool ext_send;           /**< Next RTP packet has extensions        */
+	uint8_t ext_level;       /**< Audio level to send, with the V bit   */
+	uint16_t ext_twcc;       /**< Next transport-wide sequence number   */
+	uint32_t ext_level_rx;   /**< Received audio level + 0x100 (atomic) */
+	struct stream *bundle;   /**< Stream with the BUNDLE transport      */
+	struct list bundlel;     /**< Streams bundled onto this one         */
+	struct le le_bundle;     /**< Member of the bundlel of bundle       */
+	struct udp_helper *uh_bundle;/**< Sends on the BUNDLE transport     */
 	char *cname;             /**< RTCP Canonical end-point identifier   */
 	uint32_t ssrc_rx;        /**< Incoming syncronizing source          */
+	struct rtpdemux *demux;  /**< Sources received on the RTP socket    */
 	uint32_t pseq;           /**< Sequence number for incoming RTP      */
+	uint32_t srate_rx;       /**< RTP clock rate for incoming RTP [Hz]  */
+	size_t rxsz;             /**< Buffer for a received packet [bytes]  */
+	size_t rx_maxsz;         /**< Largest packet in the jitter-buffer   */
 	int pt_enc;              /**< Payload type for encoding             */
+	struct ptcache ptcv[STREAM_PTC];/**< Recent received payload types  */
 	bool rtcp;               /**< Enable RTCP                           */
 	bool rtcp_mux;           /**< RTP/RTCP multiplex supported by peer  */
 	bool jbuf_started;       /**< True if jitter-buffer was started     */
+	bool hold_send;          /**< Send while on hold (music on hold)    */
 	stream_rtp_h *rtph;      /**< Stream RTP handler                    */
 	stream_rtcp_h *rtcph;    /**< Stream RTCP handler                   */
 	void *arg;               /**< Handler argument                      */
@@ -317,18 +768,55 @@ int  stream_alloc(struct stream **sp, const struct config_avt *cfg,
 		  const char *cname,
 		  stream_rtp_h *rtph, stream_rtcp_h *rtcph, void *arg);
 struct sdp_media *stream_sdpmedia(const struct stream *s);
+const struct sdp_format *stream_lformat(struct stream *s, uint8_t pt);
+void stream_set_rxsz(struct stream *s, size_t sz);
 int  stream_send(struct stream *s, bool marker, int pt, uint32_t ts,
 		 struct mbuf *mb);
+int  stream_send_ssrc(struct stream *s, uint32_t ssrc, uint16_t seq,
+		      bool marker, int pt, uint32_t ts, struct mbuf *mb);
+void stream_send_batch_start(struct stream *s);
+int  stream_bundle(struct stream *s, struct stream *bundle);
+int  stream_bundle_print(struct re_printf *pf, const struct stream *s);
+const char *stream_mid(const struct stream *s);
+int  stream_send_batch_flush(struct stream *s);
 void stream_update(struct stream *s);
 void stream_update_encoder(struct stream *s, int pt_enc);
 int  stream_jbuf_stat(struct re_printf *pf, const struct stream *s);
 void stream_hold(struct stream *s, bool hold);
+void stream_hold_send(struct stream *s, bool enable);
 void stream_set_srate(struct stream *s, uint32_t srate_tx, uint32_t srate_rx);
 void stream_send_fir(struct stream *s, bool pli);
+int  stream_enable_bwe(struct stream *s, uint32_t srate, uint32_t rate_max);
+int  stream_enable_rtx(struct stream *s, uint32_t rate);
+void stream_enable_nack(struct stream *s, bool enable);
+int  stream_enable_fec(struct stream *s, uint32_t ratio);
+int  stream_enable_rtpext(struct stream *s, enum rtpext_type type);
+bool stream_has_rtpext(const struct stream *s, enum rtpext_type type);
+void stream_set_audio_level(struct stream *s, uint8_t level, bool voice);
+int  stream_audio_level_rx(const struct stream *s, uint8_t *level,
+			   bool *voice);
+int  stream_rtx_encode(struct stream *s, uint16_t seq, size_t presz,
+		       struct mbuf **mbp, bool *marker, uint32_t *ts);
+int  stream_send_rtx(struct stream *s, bool marker, uint32_t ts,
+		     struct mbuf *mb);
 void stream_reset(struct stream *s);
 void stream_set_bw(struct stream *s, uint32_t bps);
 int  stream_debug(struct re_printf *pf, const struct stream *s);
 int  stream_print(struct re_printf *pf, const struct stream *s);
+void stream_memstat(struct callmem *ms, const struct stream *s);
+
+
+/*
+ * SIMD
+ */
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define HAVE_SIMD_X86 1
+#endif
+
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#define HAVE_SIMD_NEON 1
+#endif
 
 
 /*
@@ -340,6 +828,8 @@ struct ua;
 void         ua_event(struct ua *ua, enum ua_event ev, struct call *call,
 		      const char *fmt, ...);
 void         ua_printf(const struct ua *ua, const char *fmt, ...);
+void         ua_call_opened(struct ua *ua);
+void         ua_call_closed(struct ua *ua);
 
 struct tls  *uag_tls(void);
 const char  *uag_allowed_methods(void);
@@ -356,6 +846,7 @@ struct vidisp {
 	vidisp_update_h *updateh;
 	vidisp_disp_h   *disph;
 	vidisp_hide_h   *hideh;
+	vidisp_compose_h *composeh;  /**< Optional, tiles of calls */
 };
 
 struct vidisp *vidisp_get(struct vidisp_st *st);
@@ -395,7 +886,10 @@ int  video_encoder_set(struct video *v, struct vidcodec *vc,
 		       int pt_tx, const char *params);
 int  video_decoder_set(struct video *v, struct vidcodec *vc, int pt_rx,
 		       const char *fmtp);
-struct stream *video_strm(const struct video *v);
 void video_update_picture(struct video *v);
+int  video_present_open(struct video *v, const char *mod, const char *dev,
+			unsigned fps);
+void video_present(struct video *v, bool on);
 void video_sdp_attr_decode(struct video *v);
 int  video_print(struct re_printf *pf, const struct video *v);
+void video_memstat(struct callmem *ms, const struct video *v);
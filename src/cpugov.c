@@ -0,0 +1,227 @@
+/**
+ * @file cpugov.c  CPU governor for the codec complexity of all calls
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <time.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The CPU load is sampled once a second, as the load of the busiest
+ * media scheduler worker or the load of the whole process, whichever is
+ * higher. While the smoothed load is above the limit, or while media
+ * jobs miss their deadlines, the codec complexity of one call is lowered
+ * by one level each few samples. The calls with the lowest priority are
+ * degraded first, and of those the newest call. When the load has been
+ * well below the limit for a while, the complexity is restored one level
+ * at a time, starting with the call of the highest priority.
+ */
+
+
+enum {
+	SAMPLE_INTERVAL = 1000,     /**< Sampling interval in [ms]          */
+	HOLD_SAMPLES    = 3,        /**< Samples between two degrade steps  */
+	RESTORE_SAMPLES = 5,        /**< Calm samples before a restore step */
+};
+
+
+/** CPU governor */
+struct cpugov {
+	struct tmr tmr;             /**< Sampling timer                     */
+	uint32_t max_load;          /**< Max. CPU load [%], 0=off           */
+	uint64_t ts_sample;         /**< Time of the last sample [ms]       */
+	clock_t cpu_sample;         /**< CPU time of the last sample        */
+	uint32_t load;              /**< Smoothed CPU load [%]              */
+	unsigned hold;              /**< Samples until the next degrade     */
+	unsigned calm;              /**< Samples well below the limit       */
+	uint64_t n_late;            /**< Total missed deadlines             */
+	uint64_t n_degrade;         /**< Total degrade steps                */
+	uint64_t n_restore;         /**< Total restore steps                */
+};
+
+
+static void destructor(void *arg)
+{
+	struct cpugov *gov = arg;
+
+	tmr_cancel(&gov->tmr);
+}
+
+
+/* The call to degrade, or to restore, by one complexity level */
+static struct call *call_pick(int step)
+{
+	struct call *pick = NULL;
+	struct le *le, *lec;
+
+	for (le = list_head(uag_list()); le; le = le->next) {
+
+		for (lec = list_head(ua_calls(le->data)); lec;
+		     lec = lec->next) {
+
+			struct call *call = lec->data;
+			unsigned cplx = call_cplx(call);
+			int prio = call_prio(call);
+
+			/* lowest priority, then newest */
+			if (step < 0 && cplx < CPLX_LEVEL_MAX &&
+			    (!pick || prio <= call_prio(pick)))
+				pick = call;
+
+			/* highest priority, then oldest */
+			if (step > 0 && cplx > 0 &&
+			    (!pick || prio > call_prio(pick)))
+				pick = call;
+		}
+	}
+
+	return pick;
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct cpugov *gov = arg;
+	uint64_t now = tmr_jiffies();
+	clock_t cpu = clock();
+	uint64_t elapsed = now - gov->ts_sample;
+	uint32_t load = 0, wload = 0, late = 0;
+	struct call *call;
+	int step;
+
+	tmr_start(&gov->tmr, SAMPLE_INTERVAL, tmr_handler, gov);
+
+	/* 100% for each busy core */
+	if (elapsed && cpu != (clock_t)-1 && gov->cpu_sample != (clock_t)-1) {
+		uint64_t ms = (uint64_t)(cpu - gov->cpu_sample) * 1000
+			/ CLOCKS_PER_SEC;
+
+		load = (uint32_t)(ms * 100 / elapsed);
+	}
+
+	gov->ts_sample  = now;
+	gov->cpu_sample = cpu;
+
+	if (0 == msched_load(baresip_msched(), &wload, &late))
+		load = max(load, wload);
+
+	step = cpugov_update(gov, load, late);
+	if (!step)
+		return;
+
+	call = call_pick(step);
+	if (!call)
+		return;
+
+	call_set_cplx(call, step < 0 ? call_cplx(call) + 1 :
+		      call_cplx(call) - 1);
+
+	info("cpugov: load %u%% (%u late): call %s complexity -%u\n",
+	     gov->load, late, call_id(call), call_cplx(call));
+}
+
+
+/**
+ * Allocate a CPU governor, which lowers the codec complexity of the
+ * calls while the CPU is overloaded
+ *
+ * @param govp     Pointer to allocated CPU governor
+ * @param max_load Max. CPU load in [%], 0 is off
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int cpugov_alloc(struct cpugov **govp, uint32_t max_load)
+{
+	struct cpugov *gov;
+
+	if (!govp)
+		return EINVAL;
+
+	gov = mem_zalloc(sizeof(*gov), destructor);
+	if (!gov)
+		return ENOMEM;
+
+	gov->max_load = max_load;
+
+	if (max_load) {
+		gov->ts_sample  = tmr_jiffies();
+		gov->cpu_sample = clock();
+		(void)msched_load(baresip_msched(), NULL, NULL);
+		tmr_start(&gov->tmr, SAMPLE_INTERVAL, tmr_handler, gov);
+	}
+
+	*govp = gov;
+
+	return 0;
+}
+
+
+/**
+ * Add a sample of the CPU load. This is called by the sampling timer,
+ * and can be called to feed samples by hand.
+ *
+ * @param gov  CPU governor
+ * @param load CPU load in [%]
+ * @param late Number of missed media deadlines since the last sample
+ *
+ * @return -1 to degrade a call, 1 to restore a call, otherwise 0
+ */
+int cpugov_update(struct cpugov *gov, uint32_t load, uint32_t late)
+{
+	if (!gov || !gov->max_load)
+		return 0;
+
+	gov->load = (gov->load * 3 + load) / 4;
+	gov->n_late += late;
+
+	if (gov->hold)
+		--gov->hold;
+
+	if (late || gov->load > gov->max_load) {
+
+		gov->calm = 0;
+
+		/* give the last step time to take effect */
+		if (gov->hold)
+			return 0;
+
+		gov->hold = HOLD_SAMPLES;
+		++gov->n_degrade;
+		return -1;
+	}
+
+	if (gov->load < gov->max_load * 2 / 3) {
+
+		if (++gov->calm >= RESTORE_SAMPLES) {
+			gov->calm = 0;
+			++gov->n_restore;
+			return 1;
+		}
+	}
+	else {
+		gov->calm = 0;
+	}
+
+	return 0;
+}
+
+
+int cpugov_debug(struct re_printf *pf, const struct cpugov *gov)
+{
+	int err;
+
+	if (!gov || !gov->max_load)
+		return 0;
+
+	err  = re_hprintf(pf, "\n--- CPU governor ---\n");
+	err |= re_hprintf(pf, " limit:    load=%u%%\n", gov->max_load);
+	err |= re_hprintf(pf, " load:     %u%%\n", gov->load);
+	err |= re_hprintf(pf, " late:     %llu\n", gov->n_late);
+	err |= re_hprintf(pf, " degraded: %llu\n", gov->n_degrade);
+	err |= re_hprintf(pf, " restored: %llu\n", gov->n_restore);
+
+	return err;
+}
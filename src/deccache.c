@@ -0,0 +1,83 @@
+/**
+ * @file deccache.c  Idle decoders, kept for payload type flips
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * A peer may flip between its negotiated codecs. The receivers keep the
+ * decoders of the last codecs, so a switch back takes the kept state
+ * instead of allocating and initialising a new one. The caller resets a
+ * state it takes back, the cache only holds the references.
+ */
+
+
+/**
+ * Keep the current decoder for a later switch back to its codec, and
+ * take the decoder of the new codec if one is kept
+ *
+ * @param dc    Decoder cache
+ * @param cur   Codec of the current decoder
+ * @param dec   Current decoder, or NULL. The cache takes the reference
+ * @param codec New codec
+ *
+ * @return Kept decoder of the new codec, or NULL
+ */
+void *deccache_swap(struct deccache *dc, const void *cur, void *dec,
+		    const void *codec)
+{
+	void *kept = NULL;
+	unsigned i, slot = DECCACHE_SIZE;
+
+	if (!dc)
+		return mem_deref(dec);
+
+	for (i=0; i<DECCACHE_SIZE; i++) {
+
+		if (dc->v[i].codec == codec && dc->v[i].dec) {
+			kept = dc->v[i].dec;
+			dc->v[i].codec = NULL;
+			dc->v[i].dec   = NULL;
+		}
+
+		if (!dc->v[i].dec && slot == DECCACHE_SIZE)
+			slot = i;
+	}
+
+	if (dec) {
+
+		/* all slots taken, replace them in turn */
+		if (slot == DECCACHE_SIZE) {
+			slot = dc->next++ % DECCACHE_SIZE;
+			mem_deref(dc->v[slot].dec);
+		}
+
+		dc->v[slot].codec = cur;
+		dc->v[slot].dec   = dec;
+	}
+
+	return kept;
+}
+
+
+/**
+ * Free all kept decoders
+ *
+ * @param dc Decoder cache
+ */
+void deccache_flush(struct deccache *dc)
+{
+	unsigned i;
+
+	if (!dc)
+		return;
+
+	for (i=0; i<DECCACHE_SIZE; i++) {
+		dc->v[i].codec = NULL;
+		dc->v[i].dec   = mem_deref(dc->v[i].dec);
+	}
+}
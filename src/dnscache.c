@@ -0,0 +1,920 @@
+/**
+ * @file dnscache.c  Caching DNS forwarder
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <ctype.h>
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The DNS client of the SIP stack and the modules sends its queries to
+ * this forwarder on the loopback interface. It answers from a cache,
+ * and forwards the misses to the name servers:
+ *
+ * - An answer is cached for its lowest TTL, at most TTL_MAX. NXDOMAIN
+ *   and empty answers are cached for the TTL of the SOA record, at
+ *   most NEG_TTL_MAX (RFC 2308).
+ *
+ * - A query after PREFETCH percent of the TTL is answered from the
+ *   cache, and the entry is refreshed in the background. A name that
+ *   is in use, such as a registrar, does not expire.
+ *
+ * - An expired entry is served for STALE_TIME more with a TTL of
+ *   STALE_TTL while it is refreshed, and when all name servers fail
+ *   (RFC 8767). A slow name server then does not delay a call.
+ *
+ * - A miss for an A or AAAA record queries the other type too, so
+ *   both are cached by the time the client asks for the second one.
+ *
+ * - Queries for the same name and type are sent upstream only once.
+ *
+ * Truncated answers are passed on without caching. There is no TCP
+ * listener, so the client cannot retry them over TCP. Name servers of
+ * another address family than the first one are not used.
+ */
+
+
+enum {
+	HDR_SIZE       = 12,
+	QNAME_MAX      = 255,
+
+	TYPE_A         = 1,
+	TYPE_AAAA      = 28,
+	TYPE_OPT       = 41,
+
+	FLAG_QR        = 0x8000,
+	FLAG_TC        = 0x0200,
+	FLAG_RD        = 0x0100,
+	FLAG_RA        = 0x0080,
+	OPCODE_MASK    = 0x7800,
+	RCODE_MASK     = 0x000f,
+
+	RCODE_OK       = 0,
+	RCODE_SERVFAIL = 2,
+	RCODE_NXDOMAIN = 3,
+	RCODE_REFUSED  = 5,
+};
+
+enum {
+	TTL_MAX        = 3600,      /**< Longest TTL of an answer [s]      */
+	NEG_TTL        = 60,        /**< TTL of an answer without SOA [s]  */
+	NEG_TTL_MAX    = 300,       /**< Longest negative TTL [s]          */
+	STALE_TIME     = 3600,      /**< Time to serve expired entries [s] */
+	STALE_TTL      = 30,        /**< TTL of an expired answer [s]      */
+	PREFETCH       = 80,        /**< Refresh after this % of the TTL   */
+	QUERY_TIMEOUT  = 800,       /**< Time to wait for a server [ms]    */
+	QUERY_TRIES    = 3,         /**< Tries before a query fails        */
+	WAIT_MAX       = 8,         /**< Client queries waiting per query  */
+	ENTRY_MAX      = 4096,      /**< Max. number of cache entries      */
+	GC_INTERVAL    = 60000,     /**< Expired entry removal [ms]        */
+	HASH_SIZE      = 256,
+};
+
+
+/** Question of a DNS message, the name in lowercase wire format */
+struct question {
+	uint16_t id;
+	uint16_t flags;
+	uint8_t qname[QNAME_MAX];
+	size_t qlen;
+	uint16_t type;
+	uint16_t cls;
+	size_t end;                 /**< Offset after the question          */
+};
+
+/** Caching DNS forwarder */
+struct dnscache {
+	struct udp_sock *us_cli;    /**< Listener for the DNS client        */
+	struct udp_sock *us_srv;    /**< Socket to the name servers         */
+	struct sa laddr;            /**< Address of the listener            */
+	struct sa srvv[NET_MAX_NS]; /**< Name servers                       */
+	uint32_t srvc;              /**< Number of name servers             */
+	struct hash *ht;            /**< Cache entries (struct entry)       */
+	struct list pendl;          /**< Upstream queries (struct pending)  */
+	struct tmr tmr;             /**< Removal of expired entries         */
+	uint32_t entc;              /**< Number of cache entries            */
+	struct {
+		uint64_t hit;
+		uint64_t prefetch;
+		uint64_t stale;
+		uint64_t miss;
+		uint64_t fail;
+	} stat;
+};
+
+/** A cached answer */
+struct entry {
+	struct le he;
+	struct dnscache *dc;
+	struct question q;
+	uint8_t *msg;               /**< Answer as received                 */
+	size_t len;
+	uint64_t ts;                /**< Time of the answer [ms]            */
+	uint32_t ttl;               /**< Time to live [s]                   */
+};
+
+/** A client query waiting for an upstream answer */
+struct waiter {
+	struct sa src;
+	uint16_t id;
+};
+
+/** A query sent to the name servers */
+struct pending {
+	struct le le;
+	struct dnscache *dc;
+	struct tmr tmr;
+	struct question q;
+	uint16_t id;                /**< ID of the upstream query           */
+	uint32_t srv;               /**< Index of the current name server   */
+	unsigned tries;
+	struct waiter waitv[WAIT_MAX];
+	size_t waitc;
+};
+
+
+static uint16_t rd16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+
+static uint32_t rd32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 | p[3];
+}
+
+
+static void wr16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+
+static void wr32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = (v >> 16) & 0xff;
+	p[2] = (v >> 8) & 0xff;
+	p[3] = v & 0xff;
+}
+
+
+/* The name of the question is never compressed */
+static int question_decode(struct question *q, const uint8_t *p, size_t len)
+{
+	size_t pos = HDR_SIZE;
+
+	if (len < HDR_SIZE || rd16(p + 4) != 1)
+		return EBADMSG;
+
+	q->id    = rd16(p);
+	q->flags = rd16(p + 2);
+	q->qlen  = 0;
+
+	for (;;) {
+		uint8_t c;
+		size_t i;
+
+		if (pos >= len)
+			return EBADMSG;
+
+		c = p[pos++];
+
+		if (c & 0xc0 || pos + c > len || q->qlen + c + 1 > QNAME_MAX)
+			return EBADMSG;
+
+		q->qname[q->qlen++] = c;
+
+		for (i=0; i<c; i++)
+			q->qname[q->qlen++] = (uint8_t)tolower(p[pos++]);
+
+		if (!c)
+			break;
+	}
+
+	if (pos + 4 > len)
+		return EBADMSG;
+
+	q->type = rd16(p + pos);
+	q->cls  = rd16(p + pos + 2);
+	q->end  = pos + 4;
+
+	return 0;
+}
+
+
+static bool question_equal(const struct question *a,
+			   const struct question *b)
+{
+	return a->type == b->type && a->cls == b->cls &&
+		a->qlen == b->qlen && !memcmp(a->qname, b->qname, a->qlen);
+}
+
+
+static int name_skip(const uint8_t *p, size_t len, size_t *pos)
+{
+	for (;;) {
+		uint8_t c;
+
+		if (*pos >= len)
+			return EBADMSG;
+
+		c = p[*pos];
+
+		if (!c) {
+			++*pos;
+			return 0;
+		}
+
+		if ((c & 0xc0) == 0xc0) {
+			*pos += 2;
+			return *pos <= len ? 0 : EBADMSG;
+		}
+
+		if (c & 0xc0)
+			return EBADMSG;
+
+		*pos += c + 1;
+	}
+}
+
+
+enum ttl_op {
+	TTL_KEEP,     /**< Leave the TTLs as they are                    */
+	TTL_MIN,      /**< Get the lowest TTL of answers and authorities */
+	TTL_AGE,      /**< Subtract the age from all TTLs                */
+	TTL_CAP,      /**< Limit all TTLs                                */
+};
+
+/* The TTL of an OPT record holds flags, and is left alone */
+static int ttl_walk(uint8_t *p, size_t len, enum ttl_op op, uint32_t *val)
+{
+	struct question q;
+	unsigned i, n, an_ns;
+	size_t pos;
+	int err;
+
+	err = question_decode(&q, p, len);
+	if (err)
+		return err;
+
+	an_ns = rd16(p + 6) + rd16(p + 8);
+	n     = an_ns + rd16(p + 10);
+	pos   = q.end;
+
+	if (op == TTL_MIN)
+		*val = UINT32_MAX;
+
+	for (i=0; i<n; i++) {
+
+		uint32_t ttl;
+
+		if (name_skip(p, len, &pos) || pos + 10 > len)
+			return EBADMSG;
+
+		ttl = rd32(p + pos + 4);
+
+		if (rd16(p + pos) != TYPE_OPT) {
+
+			switch (op) {
+
+			case TTL_KEEP:
+				break;
+
+			case TTL_MIN:
+				if (i < an_ns)
+					*val = min(*val, ttl);
+				break;
+
+			case TTL_AGE:
+				wr32(p + pos + 4, ttl > *val ? ttl - *val : 0);
+				break;
+
+			case TTL_CAP:
+				wr32(p + pos + 4, min(ttl, *val));
+				break;
+			}
+		}
+
+		pos += 10 + rd16(p + pos + 8);
+		if (pos > len)
+			return EBADMSG;
+	}
+
+	return 0;
+}
+
+
+static uint32_t key_hash(const struct question *q)
+{
+	return hash_joaat(q->qname, q->qlen) ^ q->type;
+}
+
+
+static bool entry_cmp_handler(struct le *le, void *arg)
+{
+	const struct entry *e = le->data;
+
+	return question_equal(&e->q, arg);
+}
+
+
+static struct entry *entry_find(const struct dnscache *dc,
+				const struct question *q)
+{
+	return list_ledata(hash_lookup(dc->ht, key_hash(q),
+				       entry_cmp_handler, (void *)q));
+}
+
+
+static void entry_destructor(void *arg)
+{
+	struct entry *e = arg;
+
+	hash_unlink(&e->he);
+	mem_deref(e->msg);
+	--e->dc->entc;
+}
+
+
+/* Fresh, stale or too old to be served */
+static bool entry_usable(const struct entry *e, uint64_t now)
+{
+	return e && now - e->ts < (e->ttl + STALE_TIME) * 1000ULL;
+}
+
+
+static bool entry_fresh(const struct entry *e, uint64_t now)
+{
+	return e && now - e->ts < e->ttl * 1000ULL;
+}
+
+
+static bool gc_handler(struct le *le, void *arg)
+{
+	struct entry *e = le->data;
+	const uint64_t *now = arg;
+
+	if (!entry_usable(e, *now))
+		mem_deref(e);
+
+	return false;
+}
+
+
+static void gc(struct dnscache *dc)
+{
+	uint64_t now = tmr_jiffies();
+
+	(void)hash_apply(dc->ht, gc_handler, &now);
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct dnscache *dc = arg;
+
+	tmr_start(&dc->tmr, GC_INTERVAL, tmr_handler, dc);
+
+	gc(dc);
+}
+
+
+static void cache_store(struct dnscache *dc, const struct question *q,
+			uint8_t *p, size_t len)
+{
+	struct entry *e;
+	uint16_t rcode = q->flags & RCODE_MASK;
+	uint32_t ttl;
+	uint8_t *msg;
+
+	if (q->flags & FLAG_TC)
+		return;
+
+	if (rcode != RCODE_OK && rcode != RCODE_NXDOMAIN)
+		return;
+
+	if (ttl_walk(p, len, TTL_MIN, &ttl))
+		return;
+
+	if (rcode == RCODE_NXDOMAIN || !rd16(p + 6))
+		ttl = ttl == UINT32_MAX ? NEG_TTL : min(ttl, NEG_TTL_MAX);
+	else
+		ttl = min(ttl, TTL_MAX);
+
+	if (!ttl)
+		return;
+
+	e = entry_find(dc, q);
+	if (!e) {
+
+		if (dc->entc >= ENTRY_MAX)
+			gc(dc);
+		if (dc->entc >= ENTRY_MAX)
+			return;
+
+		e = mem_zalloc(sizeof(*e), entry_destructor);
+		if (!e)
+			return;
+
+		e->dc = dc;
+		e->q  = *q;
+		++dc->entc;
+
+		hash_append(dc->ht, key_hash(q), &e->he, e);
+	}
+
+	msg = mem_alloc(len, NULL);
+	if (!msg) {
+		mem_deref(e);
+		return;
+	}
+
+	memcpy(msg, p, len);
+
+	mem_deref(e->msg);
+	e->msg = msg;
+	e->len = len;
+	e->ts  = tmr_jiffies();
+	e->ttl = ttl;
+}
+
+
+static void send_msg(struct dnscache *dc, const struct sa *dst, uint16_t id,
+		     const uint8_t *p, size_t len, enum ttl_op op,
+		     uint32_t val)
+{
+	struct mbuf *mb;
+
+	mb = mbuf_alloc(len);
+	if (!mb)
+		return;
+
+	(void)mbuf_write_mem(mb, p, len);
+	wr16(mb->buf, id);
+
+	if (op != TTL_KEEP)
+		(void)ttl_walk(mb->buf, mb->end, op, &val);
+
+	mb->pos = 0;
+	(void)udp_send(dc->us_cli, dst, mb);
+
+	mem_deref(mb);
+}
+
+
+static void send_cached(struct dnscache *dc, const struct entry *e,
+			const struct sa *dst, uint16_t id, uint64_t now)
+{
+	if (entry_fresh(e, now)) {
+		send_msg(dc, dst, id, e->msg, e->len, TTL_AGE,
+			 (uint32_t)((now - e->ts) / 1000));
+	}
+	else {
+		send_msg(dc, dst, id, e->msg, e->len, TTL_CAP, STALE_TTL);
+	}
+}
+
+
+static void send_servfail(struct dnscache *dc, const struct sa *dst,
+			  uint16_t id, const struct question *q)
+{
+	uint8_t buf[HDR_SIZE + QNAME_MAX + 4];
+	uint8_t *p = buf;
+
+	memset(buf, 0, HDR_SIZE);
+	wr16(p + 2, FLAG_QR | FLAG_RD | FLAG_RA | RCODE_SERVFAIL);
+	wr16(p + 4, 1);
+
+	memcpy(p + HDR_SIZE, q->qname, q->qlen);
+	wr16(p + HDR_SIZE + q->qlen, q->type);
+	wr16(p + HDR_SIZE + q->qlen + 2, q->cls);
+
+	send_msg(dc, dst, id, buf, HDR_SIZE + q->qlen + 4, TTL_KEEP, 0);
+}
+
+
+static void pending_destructor(void *arg)
+{
+	struct pending *pq = arg;
+
+	list_unlink(&pq->le);
+	tmr_cancel(&pq->tmr);
+}
+
+
+static void pending_timeout(void *arg);
+
+
+static void pending_send(struct pending *pq)
+{
+	struct dnscache *dc = pq->dc;
+	struct mbuf *mb;
+	int err;
+
+	/* a new ID for every try, so a late answer is not mistaken */
+	pq->id = rand_u16();
+
+	tmr_start(&pq->tmr, QUERY_TIMEOUT, pending_timeout, pq);
+
+	if (!dc->srvc)
+		return;
+
+	mb = mbuf_alloc(HDR_SIZE + pq->q.qlen + 4);
+	if (!mb)
+		return;
+
+	err  = mbuf_write_u16(mb, htons(pq->id));
+	err |= mbuf_write_u16(mb, htons(FLAG_RD));
+	err |= mbuf_write_u16(mb, htons(1));
+	err |= mbuf_fill(mb, 0, 6);
+	err |= mbuf_write_mem(mb, pq->q.qname, pq->q.qlen);
+	err |= mbuf_write_u16(mb, htons(pq->q.type));
+	err |= mbuf_write_u16(mb, htons(pq->q.cls));
+
+	if (!err) {
+		mb->pos = 0;
+		(void)udp_send(dc->us_srv, &dc->srvv[pq->srv % dc->srvc], mb);
+	}
+
+	mem_deref(mb);
+}
+
+
+/* The waiting clients get a stale answer if there is one */
+static void pending_fail(struct pending *pq)
+{
+	struct dnscache *dc = pq->dc;
+	const struct entry *e = entry_find(dc, &pq->q);
+	uint64_t now = tmr_jiffies();
+	size_t i;
+
+	++dc->stat.fail;
+
+	for (i=0; i<pq->waitc; i++) {
+
+		const struct waiter *w = &pq->waitv[i];
+
+		if (entry_usable(e, now))
+			send_cached(dc, e, &w->src, w->id, now);
+		else
+			send_servfail(dc, &w->src, w->id, &pq->q);
+	}
+
+	mem_deref(pq);
+}
+
+
+static void pending_retry(struct pending *pq)
+{
+	if (++pq->tries >= QUERY_TRIES || !pq->dc->srvc) {
+		pending_fail(pq);
+		return;
+	}
+
+	++pq->srv;
+	pending_send(pq);
+}
+
+
+static void pending_timeout(void *arg)
+{
+	pending_retry(arg);
+}
+
+
+static struct pending *pending_find(const struct dnscache *dc,
+				    const struct question *q)
+{
+	struct le *le;
+
+	for (le = list_head(&dc->pendl); le; le = le->next) {
+
+		struct pending *pq = le->data;
+
+		if (question_equal(&pq->q, q))
+			return pq;
+	}
+
+	return NULL;
+}
+
+
+/* Send a query upstream, unless the same one is already sent */
+static void query(struct dnscache *dc, const struct question *q,
+		  const struct sa *src, uint16_t id)
+{
+	struct pending *pq;
+	size_t i;
+
+	pq = pending_find(dc, q);
+	if (!pq) {
+
+		if (!dc->srvc) {
+			if (src)
+				send_servfail(dc, src, id, q);
+			return;
+		}
+
+		pq = mem_zalloc(sizeof(*pq), pending_destructor);
+		if (!pq)
+			return;
+
+		pq->dc  = dc;
+		pq->q   = *q;
+		pq->srv = rand_u32() % dc->srvc;
+
+		list_append(&dc->pendl, &pq->le, pq);
+
+		pending_send(pq);
+	}
+
+	if (!src)
+		return;
+
+	/* the client sends the query again if it times out */
+	for (i=0; i<pq->waitc; i++) {
+
+		const struct waiter *w = &pq->waitv[i];
+
+		if (w->id == id && sa_cmp(&w->src, src, SA_ALL))
+			return;
+	}
+
+	if (pq->waitc < WAIT_MAX) {
+		pq->waitv[pq->waitc].src = *src;
+		pq->waitv[pq->waitc].id  = id;
+		++pq->waitc;
+	}
+}
+
+
+static void cli_recv_handler(const struct sa *src, struct mbuf *mb,
+			     void *arg)
+{
+	struct dnscache *dc = arg;
+	struct question q;
+	struct entry *e;
+	uint64_t now = tmr_jiffies();
+
+	if (question_decode(&q, mbuf_buf(mb), mbuf_get_left(mb)))
+		return;
+
+	if (q.flags & (FLAG_QR | OPCODE_MASK))
+		return;
+
+	e = entry_find(dc, &q);
+	if (entry_usable(e, now)) {
+
+		if (entry_fresh(e, now))
+			++dc->stat.hit;
+		else
+			++dc->stat.stale;
+
+		send_cached(dc, e, src, q.id, now);
+
+		if (now - e->ts >= e->ttl * 10ULL * PREFETCH &&
+		    !pending_find(dc, &q)) {
+
+			++dc->stat.prefetch;
+			query(dc, &q, NULL, 0);
+		}
+
+		return;
+	}
+
+	++dc->stat.miss;
+
+	query(dc, &q, src, q.id);
+
+	if (q.type == TYPE_A || q.type == TYPE_AAAA) {
+
+		struct question q2 = q;
+
+		q2.type = q.type == TYPE_A ? TYPE_AAAA : TYPE_A;
+
+		if (!entry_fresh(entry_find(dc, &q2), now))
+			query(dc, &q2, NULL, 0);
+	}
+}
+
+
+static void srv_recv_handler(const struct sa *src, struct mbuf *mb,
+			     void *arg)
+{
+	struct dnscache *dc = arg;
+	struct pending *pq;
+	struct question q;
+	uint8_t *p = mbuf_buf(mb);
+	size_t i, len = mbuf_get_left(mb);
+	uint16_t rcode;
+
+	if (question_decode(&q, p, len) || !(q.flags & FLAG_QR))
+		return;
+
+	pq = pending_find(dc, &q);
+	if (!pq || pq->id != q.id || !dc->srvc ||
+	    !sa_cmp(src, &dc->srvv[pq->srv % dc->srvc], SA_ALL))
+		return;
+
+	rcode = q.flags & RCODE_MASK;
+	if (rcode == RCODE_SERVFAIL || rcode == RCODE_REFUSED) {
+		pending_retry(pq);
+		return;
+	}
+
+	cache_store(dc, &q, p, len);
+
+	for (i=0; i<pq->waitc; i++) {
+
+		const struct waiter *w = &pq->waitv[i];
+
+		send_msg(dc, &w->src, w->id, p, len, TTL_KEEP, 0);
+	}
+
+	mem_deref(pq);
+}
+
+
+static void destructor(void *arg)
+{
+	struct dnscache *dc = arg;
+
+	tmr_cancel(&dc->tmr);
+	list_flush(&dc->pendl);
+	hash_flush(dc->ht);
+	mem_deref(dc->ht);
+	mem_deref(dc->us_srv);
+	mem_deref(dc->us_cli);
+}
+
+
+/**
+ * Set the name servers of a caching DNS forwarder
+ *
+ * @param dc   Caching DNS forwarder
+ * @param srvv Name servers
+ * @param srvc Number of name servers
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dnscache_srv_set(struct dnscache *dc, const struct sa *srvv,
+		     uint32_t srvc)
+{
+	struct udp_sock *us = NULL;
+	struct sa local;
+	uint32_t i;
+	int err;
+
+	if (!dc || (srvc && !srvv))
+		return EINVAL;
+
+	dc->srvc = 0;
+
+	for (i=0; i<srvc && dc->srvc < ARRAY_SIZE(dc->srvv); i++) {
+
+		if (sa_af(&srvv[i]) != sa_af(&srvv[0]))
+			continue;
+
+		dc->srvv[dc->srvc++] = srvv[i];
+	}
+
+	if (!dc->srvc)
+		return 0;
+
+	if (dc->us_srv && 0 == udp_local_get(dc->us_srv, &local) &&
+	    sa_af(&local) == sa_af(&dc->srvv[0]))
+		return 0;
+
+	sa_init(&local, sa_af(&dc->srvv[0]));
+
+	err = udp_listen(&us, &local, srv_recv_handler, dc);
+	if (err)
+		return err;
+
+	/* queries on the old socket time out and are sent again */
+	mem_deref(dc->us_srv);
+	dc->us_srv = us;
+
+	return 0;
+}
+
+
+/**
+ * Allocate a caching DNS forwarder on the loopback interface
+ *
+ * @param dcp  Pointer to allocated caching DNS forwarder
+ * @param srvv Name servers
+ * @param srvc Number of name servers
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dnscache_alloc(struct dnscache **dcp, const struct sa *srvv,
+		   uint32_t srvc)
+{
+	struct dnscache *dc;
+	int err;
+
+	if (!dcp)
+		return EINVAL;
+
+	dc = mem_zalloc(sizeof(*dc), destructor);
+	if (!dc)
+		return ENOMEM;
+
+	err = hash_alloc(&dc->ht, HASH_SIZE);
+	if (err)
+		goto out;
+
+	err = sa_set_str(&dc->laddr, "127.0.0.1", 0);
+	if (err)
+		goto out;
+
+	err = udp_listen(&dc->us_cli, &dc->laddr, cli_recv_handler, dc);
+	if (err)
+		goto out;
+
+	err = udp_local_get(dc->us_cli, &dc->laddr);
+	if (err)
+		goto out;
+
+	err = dnscache_srv_set(dc, srvv, srvc);
+	if (err)
+		goto out;
+
+	tmr_start(&dc->tmr, GC_INTERVAL, tmr_handler, dc);
+
+ out:
+	if (err)
+		mem_deref(dc);
+	else
+		*dcp = dc;
+
+	return err;
+}
+
+
+/**
+ * Get the address of a caching DNS forwarder, for the DNS client
+ *
+ * @param dc Caching DNS forwarder
+ *
+ * @return Address on the loopback interface
+ */
+const struct sa *dnscache_laddr(const struct dnscache *dc)
+{
+	return dc ? &dc->laddr : NULL;
+}
+
+
+/**
+ * Remove all entries of a caching DNS forwarder
+ *
+ * @param dc Caching DNS forwarder
+ */
+void dnscache_flush(struct dnscache *dc)
+{
+	if (!dc)
+		return;
+
+	hash_flush(dc->ht);
+}
+
+
+/**
+ * Get the number of entries of a caching DNS forwarder
+ *
+ * @param dc Caching DNS forwarder
+ *
+ * @return Number of cache entries
+ */
+uint32_t dnscache_count(const struct dnscache *dc)
+{
+	return dc ? dc->entc : 0;
+}
+
+
+int dnscache_debug(struct re_printf *pf, const struct dnscache *dc)
+{
+	int err;
+
+	if (!dc)
+		return 0;
+
+	err  = re_hprintf(pf, " DNS cache on %J: %u entries,"
+			  " %u queries upstream\n",
+			  &dc->laddr, dc->entc, list_count(&dc->pendl));
+	err |= re_hprintf(pf, "   hit=%llu stale=%llu miss=%llu"
+			  " prefetch=%llu fail=%llu\n",
+			  dc->stat.hit, dc->stat.stale, dc->stat.miss,
+			  dc->stat.prefetch, dc->stat.fail);
+
+	return err;
+}
@@ -0,0 +1,612 @@
+/**
+ * @file src/fec.c  Forward error correction with XOR parity (RFC 8627)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The encoder protects blocks of consecutive packets with one repair
+ * packet each. A block ends with the frame, or when it has as many
+ * packets as the protection ratio allows, at most 15 so that the short
+ * mask of the flexible FEC header is enough. The repair packet carries
+ * the XOR of the protected headers and payloads.
+ *
+ * The decoder keeps the last FEC_RX_HIST received packets. When a repair
+ * packet protects exactly one missing packet, that packet is the XOR of
+ * the repair packet and all the other protected packets.
+ */
+
+
+enum {
+	FEC_PKTSIZE   = 1500,  /**< Largest protected payload [bytes]     */
+	FEC_BLOCK_MAX = 15,    /**< Packets per repair, short mask        */
+	FEC_RATIO_MAX = 50,    /**< Highest protection [%]                */
+	FEC_HDR_SIZE  = 12,    /**< FEC header with the short mask        */
+	FEC_MASK_MAX  = 110,   /**< Packets in the longest mask           */
+	FEC_RX_HIST   = 64,    /**< Received packets kept for recovery    */
+	FEC_RX_REPAIR = 8,     /**< Repair packets waiting for recovery   */
+};
+
+
+struct fecenc {
+	uint32_t ratio;            /**< Protection without loss [%]        */
+	uint32_t loss;             /**< Loss reported by the peer (atomic) */
+
+	/* packet between fecenc_store() and fecenc_commit() */
+	uint8_t pbuf[FEC_PKTSIZE];
+	uint16_t plen;
+	uint8_t pb1;               /**< Marker bit and payload type        */
+	uint32_t pts;
+	bool pending;
+	bool pmarker;
+
+	/* current block */
+	uint8_t buf[FEC_PKTSIZE];  /**< XOR of payloads                    */
+	uint16_t len_max;          /**< Longest payload in the block       */
+	uint16_t len;              /**< XOR of payload lengths             */
+	uint8_t b1;                /**< XOR of marker bits and types       */
+	uint32_t ts;               /**< XOR of timestamps                  */
+	uint16_t base;             /**< First sequence number              */
+	uint16_t mask;             /**< Protected packets, short mask      */
+	unsigned n;                /**< Packets in the block               */
+	struct mbuf *mb;           /**< Repair packet, reused when free    */
+	uint32_t n_repair;         /**< Repair packets sent                */
+};
+
+struct fec_src {
+	uint32_t ts;
+	uint16_t seq;
+	uint16_t len;
+	uint8_t b0;                /**< Padding, extension and CSRC count  */
+	uint8_t b1;                /**< Marker bit and payload type        */
+	bool valid;
+	uint8_t buf[FEC_PKTSIZE];
+};
+
+struct fec_repair {
+	uint8_t mask[(FEC_MASK_MAX + 7) / 8];  /**< Bit i is base + i     */
+	uint32_t ts;
+	uint16_t base;
+	uint16_t len;
+	uint16_t plen;             /**< Length of the repair payload       */
+	uint8_t b0;
+	uint8_t b1;
+	bool valid;
+	uint8_t buf[FEC_PKTSIZE];
+};
+
+struct fecdec {
+	struct fec_src srcv[FEC_RX_HIST];     /**< By sequence number    */
+	struct fec_repair repv[FEC_RX_REPAIR];
+	unsigned rep_next;         /**< Next slot for a repair packet      */
+	uint16_t seq_max;          /**< Highest received sequence number   */
+	bool started;
+	uint32_t n_repair;         /**< Repair packets received            */
+	uint32_t n_recovered;      /**< Packets recovered                  */
+};
+
+
+static inline void xor_mem(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++)
+		dst[i] ^= src[i];
+}
+
+
+static void fecenc_destructor(void *arg)
+{
+	struct fecenc *enc = arg;
+
+	mem_deref(enc->mb);
+}
+
+
+/**
+ * Allocate a FEC encoder
+ *
+ * @param encp  Pointer to allocated encoder
+ * @param ratio Repair packets in [%] of the media packets, without loss
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int fecenc_alloc(struct fecenc **encp, uint32_t ratio)
+{
+	struct fecenc *enc;
+
+	if (!encp || !ratio)
+		return EINVAL;
+
+	enc = mem_zalloc(sizeof(*enc), fecenc_destructor);
+	if (!enc)
+		return ENOMEM;
+
+	enc->ratio = min(ratio, (uint32_t)FEC_RATIO_MAX);
+
+	*encp = enc;
+
+	return 0;
+}
+
+
+/**
+ * Set the packet loss reported by the peer, which raises the protection
+ *
+ * @param enc  FEC encoder
+ * @param loss Fraction of lost packets in [%]
+ */
+void fecenc_set_loss(struct fecenc *enc, uint32_t loss)
+{
+	if (!enc)
+		return;
+
+	ATOMIC_STORE(&enc->loss, loss);
+}
+
+
+/**
+ * Get the current protection of a FEC encoder
+ *
+ * @param enc FEC encoder
+ *
+ * @return Repair packets in [%] of the media packets
+ */
+uint32_t fecenc_ratio(const struct fecenc *enc)
+{
+	if (!enc)
+		return 0;
+
+	return min(enc->ratio + 2 * ATOMIC_LOAD(&enc->loss),
+		   (uint32_t)FEC_RATIO_MAX);
+}
+
+
+/**
+ * Store an RTP packet to protect, before it is sent
+ *
+ * @param enc    FEC encoder
+ * @param marker RTP marker bit
+ * @param pt     RTP payload type
+ * @param ts     RTP timestamp
+ * @param mb     Buffer with RTP payload, from mb->pos
+ */
+void fecenc_store(struct fecenc *enc, bool marker, uint8_t pt, uint32_t ts,
+		  const struct mbuf *mb)
+{
+	size_t len;
+
+	if (!enc || !mb)
+		return;
+
+	len = mbuf_get_left(mb);
+
+	enc->pmarker = marker;
+	enc->pending = len <= sizeof(enc->pbuf);
+	if (!enc->pending)
+		return;
+
+	memcpy(enc->pbuf, mbuf_buf(mb), len);
+	enc->plen = (uint16_t)len;
+	enc->pb1  = (marker ? 0x80 : 0x00) | (pt & 0x7f);
+	enc->pts  = ts;
+}
+
+
+static int repair_encode(struct fecenc *enc, struct mbuf **mbp,
+			 size_t presz)
+{
+	struct mbuf *mb;
+	int err;
+
+	/* the caller normally releases it before the next block ends */
+	if (!enc->mb || mem_nrefs(enc->mb) > 1) {
+
+		mem_deref(enc->mb);
+
+		enc->mb = mbuf_alloc(presz + FEC_HDR_SIZE + FEC_PKTSIZE);
+		if (!enc->mb)
+			return ENOMEM;
+	}
+
+	mb = enc->mb;
+	mb->pos = mb->end = presz;
+
+	/* R and F are 0, no P, X or CC in the protected packets */
+	err  = mbuf_write_u8(mb, 0);
+	err |= mbuf_write_u8(mb, enc->b1);
+	err |= mbuf_write_u16(mb, htons(enc->len));
+	err |= mbuf_write_u32(mb, htonl(enc->ts));
+	err |= mbuf_write_u16(mb, htons(enc->base));
+	err |= mbuf_write_u16(mb, htons(0x8000 | enc->mask));
+	err |= mbuf_write_mem(mb, enc->buf, enc->len_max);
+	if (err)
+		return err;
+
+	mb->pos = presz;
+	*mbp = mem_ref(mb);
+
+	++enc->n_repair;
+
+	return 0;
+}
+
+
+/**
+ * Add the last stored packet to the block, after it was sent. At the
+ * end of a block the repair packet is returned.
+ *
+ * @param enc   FEC encoder
+ * @param seq   RTP sequence number of the sent packet
+ * @param presz Headroom in front of the repair payload
+ * @param mbp   Returned repair payload, NULL if the block continues
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int fecenc_commit(struct fecenc *enc, uint16_t seq, size_t presz,
+		  struct mbuf **mbp)
+{
+	unsigned block;
+	int err = 0;
+
+	if (!enc || !mbp)
+		return EINVAL;
+
+	*mbp = NULL;
+
+	if (!enc->pending)
+		goto out;
+
+	enc->pending = false;
+
+	/* e.g. a keepalive packet used a sequence number */
+	if (enc->n && (uint16_t)(seq - enc->base) >= FEC_BLOCK_MAX)
+		enc->n = 0;
+
+	if (!enc->n) {
+		memset(enc->buf, 0, sizeof(enc->buf));
+		enc->len_max = 0;
+		enc->len     = 0;
+		enc->b1      = 0;
+		enc->ts      = 0;
+		enc->base    = seq;
+		enc->mask    = 0;
+	}
+
+	xor_mem(enc->buf, enc->pbuf, enc->plen);
+	enc->len_max = max(enc->len_max, enc->plen);
+	enc->len    ^= enc->plen;
+	enc->b1     ^= enc->pb1;
+	enc->ts     ^= enc->pts;
+	enc->mask   |= 1 << (FEC_BLOCK_MAX - 1 - (uint16_t)(seq - enc->base));
+	++enc->n;
+
+ out:
+	block = fecenc_ratio(enc);
+	block = min(max(100 / max(block, 1u), 1u), (unsigned)FEC_BLOCK_MAX);
+
+	if (enc->n && (enc->n >= block || enc->pmarker ||
+		       (uint16_t)(seq + 1 - enc->base) >= FEC_BLOCK_MAX)) {
+
+		err = repair_encode(enc, mbp, presz);
+		enc->n = 0;
+	}
+
+	return err;
+}
+
+
+/**
+ * Allocate a FEC decoder
+ *
+ * @param decp Pointer to allocated decoder
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int fecdec_alloc(struct fecdec **decp)
+{
+	struct fecdec *dec;
+
+	if (!decp)
+		return EINVAL;
+
+	dec = mem_zalloc(sizeof(*dec), NULL);
+	if (!dec)
+		return ENOMEM;
+
+	*decp = dec;
+
+	return 0;
+}
+
+
+static void src_store(struct fecdec *dec, uint8_t b0, uint8_t b1,
+		      uint16_t seq, uint32_t ts, const uint8_t *p, size_t len)
+{
+	struct fec_src *src = &dec->srcv[seq % FEC_RX_HIST];
+
+	if (len > sizeof(src->buf))
+		return;
+
+	if (!dec->started || (int16_t)(seq - dec->seq_max) > 0) {
+		dec->seq_max = seq;
+		dec->started = true;
+	}
+
+	src->b0    = b0;
+	src->b1    = b1;
+	src->seq   = seq;
+	src->ts    = ts;
+	src->len   = (uint16_t)len;
+	src->valid = true;
+	memcpy(src->buf, p, len);
+}
+
+
+static const struct fec_src *src_find(const struct fecdec *dec,
+				      uint16_t seq)
+{
+	const struct fec_src *src = &dec->srcv[seq % FEC_RX_HIST];
+
+	return src->valid && src->seq == seq ? src : NULL;
+}
+
+
+/**
+ * Keep a received RTP packet, to recover others with it
+ *
+ * @param dec FEC decoder
+ * @param hdr RTP header
+ * @param mb  Buffer with RTP payload, from mb->pos
+ */
+void fecdec_source(struct fecdec *dec, const struct rtp_header *hdr,
+		   const struct mbuf *mb)
+{
+	uint8_t b0, b1;
+
+	if (!dec || !hdr || !mb)
+		return;
+
+	b0 = (hdr->pad ? 0x20 : 0) | (hdr->ext ? 0x10 : 0) | (hdr->cc & 0x0f);
+	b1 = (hdr->m ? 0x80 : 0) | (hdr->pt & 0x7f);
+
+	src_store(dec, b0, b1, hdr->seq, hdr->ts,
+		  mbuf_buf(mb), mbuf_get_left(mb));
+}
+
+
+/**
+ * Decode a received repair packet
+ *
+ * @param dec FEC decoder
+ * @param mb  Buffer with repair payload, from mb->pos
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int fecdec_repair(struct fecdec *dec, struct mbuf *mb)
+{
+	struct fec_repair *rep;
+	unsigned i, nbits = 0;
+	size_t plen;
+	uint8_t b0;
+
+	if (!dec || !mb)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) < FEC_HDR_SIZE)
+		return EBADMSG;
+
+	/* retransmissions (R) and fixed masks (F) are not supported */
+	b0 = mbuf_buf(mb)[0];
+	if (b0 & 0xc0)
+		return ENOTSUP;
+
+	rep = &dec->repv[dec->rep_next];
+	memset(rep->mask, 0, sizeof(rep->mask));
+
+	rep->b0   = mbuf_read_u8(mb) & 0x3f;
+	rep->b1   = mbuf_read_u8(mb);
+	rep->len  = ntohs(mbuf_read_u16(mb));
+	rep->ts   = ntohl(mbuf_read_u32(mb));
+	rep->base = ntohs(mbuf_read_u16(mb));
+
+	/* the mask is 15, 46 or 110 bits, each part starts with k */
+	for (;;) {
+		static const unsigned partv[] = {16, 32, 64};
+		unsigned part = partv[nbits == 0 ? 0 : nbits == 15 ? 1 : 2];
+		unsigned j;
+		bool k = false;
+
+		if (mbuf_get_left(mb) < part / 8)
+			return EBADMSG;
+
+		for (j=0; j<part/8; j++) {
+
+			uint8_t v = mbuf_read_u8(mb);
+			unsigned b;
+
+			for (b=0; b<8; b++) {
+
+				bool set = v & (0x80 >> b);
+
+				/* the k bit of a part */
+				if (part != 64 && j == 0 && b == 0) {
+					k = set;
+					continue;
+				}
+
+				if (set)
+					rep->mask[nbits / 8] |= 1 << nbits % 8;
+				++nbits;
+			}
+		}
+
+		if (part == 64 || k)
+			break;
+	}
+
+	plen = mbuf_get_left(mb);
+	if (plen > sizeof(rep->buf) || rep->len > plen)
+		return EBADMSG;
+
+	memcpy(rep->buf, mbuf_buf(mb), plen);
+	rep->plen  = (uint16_t)plen;
+	rep->valid = true;
+
+	dec->rep_next = (dec->rep_next + 1) % FEC_RX_REPAIR;
+	++dec->n_repair;
+
+	for (i=nbits; i<FEC_MASK_MAX; i++)
+		rep->mask[i / 8] &= ~(1 << i % 8);
+
+	return 0;
+}
+
+
+static int recover(struct fecdec *dec, struct fec_repair *rep,
+		   uint16_t seq, struct rtp_header *hdr, struct mbuf **mbp)
+{
+	uint8_t b0 = rep->b0, b1 = rep->b1;
+	uint16_t len = rep->len;
+	uint32_t ts = rep->ts;
+	uint8_t buf[FEC_PKTSIZE];
+	struct mbuf *mb;
+	unsigned i;
+
+	memcpy(buf, rep->buf, rep->plen);
+
+	for (i=0; i<FEC_MASK_MAX; i++) {
+
+		const struct fec_src *src;
+
+		if (!(rep->mask[i / 8] & (1 << i % 8)))
+			continue;
+
+		src = src_find(dec, rep->base + i);
+		if (!src)
+			continue;
+
+		b0  ^= src->b0;
+		b1  ^= src->b1;
+		len ^= src->len;
+		ts  ^= src->ts;
+		xor_mem(buf, src->buf, min(src->len, rep->plen));
+	}
+
+	/* only plain packets can be restored */
+	if (b0 || len > rep->plen)
+		return EBADMSG;
+
+	mb = mbuf_alloc(len);
+	if (!mb)
+		return ENOMEM;
+
+	(void)mbuf_write_mem(mb, buf, len);
+	mb->pos = 0;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->ver = RTP_VERSION;
+	hdr->m   = (b1 & 0x80) != 0;
+	hdr->pt  = b1 & 0x7f;
+	hdr->seq = seq;
+	hdr->ts  = ts;
+
+	/* it may help to recover another packet */
+	src_store(dec, b0, b1, seq, ts, buf, len);
+
+	++dec->n_recovered;
+	*mbp = mb;
+
+	return 0;
+}
+
+
+/**
+ * Recover a lost packet, if a repair packet allows it
+ *
+ * @param dec FEC decoder
+ * @param hdr Returned RTP header, without the SSRC
+ * @param mbp Returned buffer with RTP payload
+ *
+ * @return 0 if a packet was recovered, ENOENT if none can be
+ */
+int fecdec_recover(struct fecdec *dec, struct rtp_header *hdr,
+		   struct mbuf **mbp)
+{
+	unsigned r;
+
+	if (!dec || !hdr || !mbp)
+		return EINVAL;
+
+	for (r=0; r<FEC_RX_REPAIR; r++) {
+
+		struct fec_repair *rep = &dec->repv[r];
+		unsigned i, missing = 0;
+		uint16_t seq = 0;
+		int err;
+
+		if (!rep->valid)
+			continue;
+
+		for (i=0; i<FEC_MASK_MAX; i++) {
+
+			const uint16_t s = rep->base + i;
+
+			if (!(rep->mask[i / 8] & (1 << i % 8)))
+				continue;
+
+			if (src_find(dec, s))
+				continue;
+
+			/* too old, it is not known if it was received */
+			if ((uint16_t)(dec->seq_max - s) >= FEC_RX_HIST &&
+			    (int16_t)(dec->seq_max - s) > 0) {
+				missing = 2;
+				rep->valid = false;
+				break;
+			}
+
+			seq = s;
+			++missing;
+		}
+
+		if (missing != 1) {
+			if (!missing)
+				rep->valid = false;
+			continue;
+		}
+
+		rep->valid = false;
+
+		err = recover(dec, rep, seq, hdr, mbp);
+		if (!err)
+			return 0;
+	}
+
+	return ENOENT;
+}
+
+
+int fecenc_debug(struct re_printf *pf, const struct fecenc *enc)
+{
+	if (!enc)
+		return 0;
+
+	return re_hprintf(pf, "fec tx: ratio=%u%% repair=%u",
+			  fecenc_ratio(enc), enc->n_repair);
+}
+
+
+int fecdec_debug(struct re_printf *pf, const struct fecdec *dec)
+{
+	if (!dec)
+		return 0;
+
+	return re_hprintf(pf, "fec rx: repair=%u recovered=%u",
+			  dec->n_repair, dec->n_recovered);
+}
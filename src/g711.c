@@ -0,0 +1,514 @@
+/**
+ * @file src/g711.c  G.711 batch kernels
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+#ifdef HAVE_SIMD_X86
+#include <immintrin.h>
+#endif
+#ifdef HAVE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+
+/**
+ * \page G711 G.711 batch kernels
+ *
+ * Encoding uses a table for every 16-bit sample, built once from the
+ * per-sample librem helpers. This makes it one load per sample, and
+ * bit-exact with librem.
+ *
+ * Decoding is done 8 to 32 samples at a time with SIMD, where the
+ * segment shift is done with masks. The SIMD implementation is
+ * selected at runtime.
+ */
+
+
+typedef void (g711_dec_h)(int16_t *dst, const uint8_t *src, size_t n);
+
+struct g711_ops {
+	g711_dec_h *ulawh;
+	g711_dec_h *alawh;
+};
+
+
+static uint8_t l2u[65536];
+static uint8_t l2a[65536];
+static bool inited;
+
+
+/**
+ * Initialise the G.711 encoding tables
+ */
+void g711_batch_init(void)
+{
+	uint32_t i;
+
+	if (inited)
+		return;
+
+	for (i=0; i<65536; i++) {
+		l2u[i] = g711_pcm2ulaw((int16_t)i);
+		l2a[i] = g711_pcm2alaw((int16_t)i);
+	}
+
+	inited = true;
+}
+
+
+static void encode_table(const uint8_t *tab, uint8_t *dst,
+			 const int16_t *src, size_t n)
+{
+	size_t i;
+
+	for (i=0; i + 4 <= n; i += 4) {
+		dst[i]   = tab[(uint16_t)src[i]];
+		dst[i+1] = tab[(uint16_t)src[i+1]];
+		dst[i+2] = tab[(uint16_t)src[i+2]];
+		dst[i+3] = tab[(uint16_t)src[i+3]];
+	}
+
+	for (; i<n; i++)
+		dst[i] = tab[(uint16_t)src[i]];
+}
+
+
+static void ulaw_c(int16_t *dst, const uint8_t *src, size_t n)
+{
+	while (n--)
+		*dst++ = g711_ulaw2pcm(*src++);
+}
+
+
+static void alaw_c(int16_t *dst, const uint8_t *src, size_t n)
+{
+	while (n--)
+		*dst++ = g711_alaw2pcm(*src++);
+}
+
+
+static const struct g711_ops ops_c = {
+	ulaw_c, alaw_c
+};
+
+
+#ifdef HAVE_SIMD_X86
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+
+/* select a where the mask is set, otherwise b */
+#define SEL128(m, a, b) \
+	_mm_or_si128(_mm_and_si128((m), (a)), _mm_andnot_si128((m), (b)))
+
+#define SEL256(m, a, b) \
+	_mm256_or_si256(_mm256_and_si256((m), (a)), \
+			_mm256_andnot_si256((m), (b)))
+
+
+/* one 16-bit lane per sample, value 0-255 */
+SSE2 static inline __m128i ulaw_dec_sse2(__m128i u)
+{
+	const __m128i b1 = _mm_set1_epi16(0x10);
+	const __m128i b2 = _mm_set1_epi16(0x20);
+	const __m128i b4 = _mm_set1_epi16(0x40);
+	const __m128i sb = _mm_set1_epi16(0x80);
+	const __m128i bias = _mm_set1_epi16(0x84);
+	__m128i t, m, s;
+
+	u = _mm_xor_si128(u, _mm_set1_epi16(0xff));
+
+	t = _mm_slli_epi16(_mm_and_si128(u, _mm_set1_epi16(0x0f)), 3);
+	t = _mm_add_epi16(t, bias);
+
+	m = _mm_cmpeq_epi16(_mm_and_si128(u, b1), b1);
+	t = SEL128(m, _mm_slli_epi16(t, 1), t);
+	m = _mm_cmpeq_epi16(_mm_and_si128(u, b2), b2);
+	t = SEL128(m, _mm_slli_epi16(t, 2), t);
+	m = _mm_cmpeq_epi16(_mm_and_si128(u, b4), b4);
+	t = SEL128(m, _mm_slli_epi16(t, 4), t);
+
+	t = _mm_sub_epi16(t, bias);
+
+	/* negative if the sign bit is set */
+	s = _mm_cmpeq_epi16(_mm_and_si128(u, sb), sb);
+
+	return _mm_sub_epi16(_mm_xor_si128(t, s), s);
+}
+
+
+SSE2 static inline __m128i alaw_dec_sse2(__m128i a)
+{
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i b2 = _mm_set1_epi16(2);
+	const __m128i b4 = _mm_set1_epi16(4);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i t, e, m, s;
+
+	a = _mm_xor_si128(a, _mm_set1_epi16(0x55));
+
+	e = _mm_srli_epi16(_mm_and_si128(a, _mm_set1_epi16(0x70)), 4);
+
+	t = _mm_slli_epi16(_mm_and_si128(a, _mm_set1_epi16(0x0f)), 4);
+	t = _mm_add_epi16(t, _mm_set1_epi16(8));
+
+	/* segments above 0 add 0x100 and shift by segment - 1 */
+	m = _mm_cmpgt_epi16(e, zero);
+	t = _mm_add_epi16(t, _mm_and_si128(m, _mm_set1_epi16(0x100)));
+	e = _mm_subs_epu16(e, one);
+
+	m = _mm_cmpeq_epi16(_mm_and_si128(e, one), one);
+	t = SEL128(m, _mm_slli_epi16(t, 1), t);
+	m = _mm_cmpeq_epi16(_mm_and_si128(e, b2), b2);
+	t = SEL128(m, _mm_slli_epi16(t, 2), t);
+	m = _mm_cmpeq_epi16(_mm_and_si128(e, b4), b4);
+	t = SEL128(m, _mm_slli_epi16(t, 4), t);
+
+	/* negative if the sign bit is clear */
+	s = _mm_cmpeq_epi16(_mm_and_si128(a, _mm_set1_epi16(0x80)), zero);
+
+	return _mm_sub_epi16(_mm_xor_si128(t, s), s);
+}
+
+
+SSE2 static void ulaw_sse2(int16_t *dst, const uint8_t *src, size_t n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t i;
+
+	for (i=0; i + 16 <= n; i += 16) {
+
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 ulaw_dec_sse2(_mm_unpacklo_epi8(v, zero)));
+		_mm_storeu_si128((__m128i *)(dst + i + 8),
+				 ulaw_dec_sse2(_mm_unpackhi_epi8(v, zero)));
+	}
+
+	ulaw_c(dst + i, src + i, n - i);
+}
+
+
+SSE2 static void alaw_sse2(int16_t *dst, const uint8_t *src, size_t n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t i;
+
+	for (i=0; i + 16 <= n; i += 16) {
+
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 alaw_dec_sse2(_mm_unpacklo_epi8(v, zero)));
+		_mm_storeu_si128((__m128i *)(dst + i + 8),
+				 alaw_dec_sse2(_mm_unpackhi_epi8(v, zero)));
+	}
+
+	alaw_c(dst + i, src + i, n - i);
+}
+
+
+AVX2 static inline __m256i ulaw_dec_avx2(__m256i u)
+{
+	const __m256i b1 = _mm256_set1_epi16(0x10);
+	const __m256i b2 = _mm256_set1_epi16(0x20);
+	const __m256i b4 = _mm256_set1_epi16(0x40);
+	const __m256i sb = _mm256_set1_epi16(0x80);
+	const __m256i bias = _mm256_set1_epi16(0x84);
+	__m256i t, m, s;
+
+	u = _mm256_xor_si256(u, _mm256_set1_epi16(0xff));
+
+	t = _mm256_slli_epi16(_mm256_and_si256(u, _mm256_set1_epi16(0x0f)),
+			      3);
+	t = _mm256_add_epi16(t, bias);
+
+	m = _mm256_cmpeq_epi16(_mm256_and_si256(u, b1), b1);
+	t = SEL256(m, _mm256_slli_epi16(t, 1), t);
+	m = _mm256_cmpeq_epi16(_mm256_and_si256(u, b2), b2);
+	t = SEL256(m, _mm256_slli_epi16(t, 2), t);
+	m = _mm256_cmpeq_epi16(_mm256_and_si256(u, b4), b4);
+	t = SEL256(m, _mm256_slli_epi16(t, 4), t);
+
+	t = _mm256_sub_epi16(t, bias);
+
+	s = _mm256_cmpeq_epi16(_mm256_and_si256(u, sb), sb);
+
+	return _mm256_sub_epi16(_mm256_xor_si256(t, s), s);
+}
+
+
+AVX2 static inline __m256i alaw_dec_avx2(__m256i a)
+{
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i b2 = _mm256_set1_epi16(2);
+	const __m256i b4 = _mm256_set1_epi16(4);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i t, e, m, s;
+
+	a = _mm256_xor_si256(a, _mm256_set1_epi16(0x55));
+
+	e = _mm256_srli_epi16(_mm256_and_si256(a, _mm256_set1_epi16(0x70)),
+			      4);
+
+	t = _mm256_slli_epi16(_mm256_and_si256(a, _mm256_set1_epi16(0x0f)),
+			      4);
+	t = _mm256_add_epi16(t, _mm256_set1_epi16(8));
+
+	m = _mm256_cmpgt_epi16(e, zero);
+	t = _mm256_add_epi16(t, _mm256_and_si256(m,
+						 _mm256_set1_epi16(0x100)));
+	e = _mm256_subs_epu16(e, one);
+
+	m = _mm256_cmpeq_epi16(_mm256_and_si256(e, one), one);
+	t = SEL256(m, _mm256_slli_epi16(t, 1), t);
+	m = _mm256_cmpeq_epi16(_mm256_and_si256(e, b2), b2);
+	t = SEL256(m, _mm256_slli_epi16(t, 2), t);
+	m = _mm256_cmpeq_epi16(_mm256_and_si256(e, b4), b4);
+	t = SEL256(m, _mm256_slli_epi16(t, 4), t);
+
+	s = _mm256_cmpeq_epi16(_mm256_and_si256(a, _mm256_set1_epi16(0x80)),
+			       zero);
+
+	return _mm256_sub_epi16(_mm256_xor_si256(t, s), s);
+}
+
+
+AVX2 static void ulaw_avx2(int16_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i;
+
+	for (i=0; i + 32 <= n; i += 32) {
+
+		__m128i lo = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(src + i + 16));
+
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    ulaw_dec_avx2(_mm256_cvtepu8_epi16(lo)));
+		_mm256_storeu_si256((__m256i *)(dst + i + 16),
+				    ulaw_dec_avx2(_mm256_cvtepu8_epi16(hi)));
+	}
+
+	ulaw_sse2(dst + i, src + i, n - i);
+}
+
+
+AVX2 static void alaw_avx2(int16_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i;
+
+	for (i=0; i + 32 <= n; i += 32) {
+
+		__m128i lo = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(src + i + 16));
+
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    alaw_dec_avx2(_mm256_cvtepu8_epi16(lo)));
+		_mm256_storeu_si256((__m256i *)(dst + i + 16),
+				    alaw_dec_avx2(_mm256_cvtepu8_epi16(hi)));
+	}
+
+	alaw_sse2(dst + i, src + i, n - i);
+}
+
+
+static const struct g711_ops ops_sse2 = {
+	ulaw_sse2, alaw_sse2
+};
+
+static const struct g711_ops ops_avx2 = {
+	ulaw_avx2, alaw_avx2
+};
+
+#endif /* HAVE_SIMD_X86 */
+
+
+#ifdef HAVE_SIMD_NEON
+
+static inline int16x8_t ulaw_dec_neon(uint16x8_t u)
+{
+	const uint16x8_t bias = vdupq_n_u16(0x84);
+	uint16x8_t t, e, s;
+	int16x8_t r;
+
+	u = veorq_u16(u, vdupq_n_u16(0xff));
+
+	e = vshrq_n_u16(vandq_u16(u, vdupq_n_u16(0x70)), 4);
+	t = vshlq_n_u16(vandq_u16(u, vdupq_n_u16(0x0f)), 3);
+	t = vaddq_u16(t, bias);
+	t = vshlq_u16(t, vreinterpretq_s16_u16(e));
+
+	r = vreinterpretq_s16_u16(vsubq_u16(t, bias));
+
+	s = vtstq_u16(u, vdupq_n_u16(0x80));
+
+	return vbslq_s16(s, vnegq_s16(r), r);
+}
+
+
+static inline int16x8_t alaw_dec_neon(uint16x8_t a)
+{
+	uint16x8_t t, e, nz, s;
+	int16x8_t r;
+
+	a = veorq_u16(a, vdupq_n_u16(0x55));
+
+	e = vshrq_n_u16(vandq_u16(a, vdupq_n_u16(0x70)), 4);
+	t = vshlq_n_u16(vandq_u16(a, vdupq_n_u16(0x0f)), 4);
+	t = vaddq_u16(t, vdupq_n_u16(8));
+
+	nz = vcgtq_u16(e, vdupq_n_u16(0));
+	t = vaddq_u16(t, vandq_u16(nz, vdupq_n_u16(0x100)));
+	e = vqsubq_u16(e, vdupq_n_u16(1));
+	t = vshlq_u16(t, vreinterpretq_s16_u16(e));
+
+	r = vreinterpretq_s16_u16(t);
+
+	s = vtstq_u16(a, vdupq_n_u16(0x80));
+
+	return vbslq_s16(s, r, vnegq_s16(r));
+}
+
+
+static void ulaw_neon(int16_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i;
+
+	for (i=0; i + 16 <= n; i += 16) {
+
+		uint8x16_t v = vld1q_u8(src + i);
+
+		vst1q_s16(dst + i, ulaw_dec_neon(vmovl_u8(vget_low_u8(v))));
+		vst1q_s16(dst + i + 8,
+			  ulaw_dec_neon(vmovl_u8(vget_high_u8(v))));
+	}
+
+	ulaw_c(dst + i, src + i, n - i);
+}
+
+
+static void alaw_neon(int16_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i;
+
+	for (i=0; i + 16 <= n; i += 16) {
+
+		uint8x16_t v = vld1q_u8(src + i);
+
+		vst1q_s16(dst + i, alaw_dec_neon(vmovl_u8(vget_low_u8(v))));
+		vst1q_s16(dst + i + 8,
+			  alaw_dec_neon(vmovl_u8(vget_high_u8(v))));
+	}
+
+	alaw_c(dst + i, src + i, n - i);
+}
+
+
+static const struct g711_ops ops_neon = {
+	ulaw_neon, alaw_neon
+};
+
+#endif /* HAVE_SIMD_NEON */
+
+
+static const struct g711_ops *impl_ops(enum simd_impl impl)
+{
+	if (!simd_supported(impl))
+		return &ops_c;
+
+	switch (impl) {
+
+#ifdef HAVE_SIMD_X86
+	case SIMD_SSE2: return &ops_sse2;
+	case SIMD_AVX2: return &ops_avx2;
+#endif
+#ifdef HAVE_SIMD_NEON
+	case SIMD_NEON: return &ops_neon;
+#endif
+	default:        return &ops_c;
+	}
+}
+
+
+static const struct g711_ops *best_ops(void)
+{
+	static const struct g711_ops *ops;
+
+	if (!ops)
+		ops = impl_ops(simd_best());
+
+	return ops;
+}
+
+
+/**
+ * Encode a block of 16-bit PCM samples to G.711
+ *
+ * @param law  U-law or A-law
+ * @param dst  Destination buffer, n bytes
+ * @param src  Source samples
+ * @param n    Number of samples
+ *
+ * @note g711_batch_init() must have been called
+ */
+void g711_encode_batch(enum g711_law law, uint8_t *dst, const int16_t *src,
+		       size_t n)
+{
+	if (!dst || !src)
+		return;
+
+	encode_table(law == G711_ALAW ? l2a : l2u, dst, src, n);
+}
+
+
+/**
+ * Decode a block of G.711 bytes to 16-bit PCM with a given implementation
+ *
+ * @param impl SIMD implementation, falls back to C if not supported
+ * @param law  U-law or A-law
+ * @param dst  Destination samples, n samples
+ * @param src  Source buffer
+ * @param n    Number of bytes
+ */
+void g711_decode_batch_impl(enum simd_impl impl, enum g711_law law,
+			    int16_t *dst, const uint8_t *src, size_t n)
+{
+	const struct g711_ops *ops = impl_ops(impl);
+
+	if (!dst || !src)
+		return;
+
+	if (law == G711_ALAW)
+		ops->alawh(dst, src, n);
+	else
+		ops->ulawh(dst, src, n);
+}
+
+
+/**
+ * Decode a block of G.711 bytes to 16-bit PCM
+ *
+ * @param law  U-law or A-law
+ * @param dst  Destination samples, n samples
+ * @param src  Source buffer
+ * @param n    Number of bytes
+ */
+void g711_decode_batch(enum g711_law law, int16_t *dst, const uint8_t *src,
+		       size_t n)
+{
+	const struct g711_ops *ops = best_ops();
+
+	if (!dst || !src)
+		return;
+
+	if (law == G711_ALAW)
+		ops->alawh(dst, src, n);
+	else
+		ops->ulawh(dst, src, n);
+}
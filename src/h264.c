@@ -7,6 +7,13 @@
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
+#include "core.h"
+#ifdef HAVE_SIMD_X86
+#include <immintrin.h>
+#endif
+#ifdef HAVE_SIMD_NEON
+#include <arm_neon.h>
+#endif
 
 
 int h264_hdr_encode(const struct h264_hdr *hdr, struct mbuf *mb)
@@ -61,12 +68,24 @@ int h264_fu_hdr_decode(struct h264_fu *fu, struct mbuf *mb)
 }
 
 
+/* Byte-wise scan, for the head and tail of the SIMD versions */
+static const uint8_t *startcode_bytes(const uint8_t *p, const uint8_t *end)
+{
+	for (end -= 2; p < end; p++) {
+		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+			return p;
+	}
+
+	return NULL;
+}
+
+
 /*
- * Find the NAL start sequence in a H.264 byte stream
+ * Word-at-a-time scan
  *
  * @note: copied from ffmpeg source
  */
-const uint8_t *h264_find_startcode(const uint8_t *p, const uint8_t *end)
+static const uint8_t *startcode_c(const uint8_t *p, const uint8_t *end)
 {
 	const uint8_t *a = p + 4 - ((long)p & 3);
 
@@ -93,12 +112,159 @@ const uint8_t *h264_find_startcode(const uint8_t *p, const uint8_t *end)
 		}
 	}
 
-	for (end += 3; p < end; p++) {
+	/* the tail includes a start code ending at the last byte */
+	for (end += 4; p < end; p++) {
 		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
 			return p;
 	}
 
-	return end + 3;
+	return end + 2;
+}
+
+
+/*
+ * The SIMD versions compare 16 or 32 positions at a time, using three
+ * overlapping loads for the bytes at offset 0, 1 and 2.
+ */
+
+#ifdef HAVE_SIMD_X86
+
+__attribute__((target("sse2")))
+static const uint8_t *startcode_sse2(const uint8_t *p, const uint8_t *end)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one  = _mm_set1_epi8(1);
+	const uint8_t *r;
+
+	for (; p + 18 <= end; p += 16) {
+
+		__m128i b0 = _mm_loadu_si128((const __m128i *)(p + 0));
+		__m128i b1 = _mm_loadu_si128((const __m128i *)(p + 1));
+		__m128i b2 = _mm_loadu_si128((const __m128i *)(p + 2));
+		__m128i m;
+		int mask;
+
+		m = _mm_and_si128(_mm_cmpeq_epi8(b0, zero),
+				  _mm_cmpeq_epi8(b1, zero));
+		m = _mm_and_si128(m, _mm_cmpeq_epi8(b2, one));
+
+		mask = _mm_movemask_epi8(m);
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+
+	r = startcode_bytes(p, end);
+
+	return r ? r : end;
+}
+
+
+__attribute__((target("avx2")))
+static const uint8_t *startcode_avx2(const uint8_t *p, const uint8_t *end)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one  = _mm256_set1_epi8(1);
+
+	for (; p + 34 <= end; p += 32) {
+
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)(p + 0));
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+		__m256i b2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+		__m256i m;
+		uint32_t mask;
+
+		m = _mm256_and_si256(_mm256_cmpeq_epi8(b0, zero),
+				     _mm256_cmpeq_epi8(b1, zero));
+		m = _mm256_and_si256(m, _mm256_cmpeq_epi8(b2, one));
+
+		mask = (uint32_t)_mm256_movemask_epi8(m);
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+
+	return startcode_sse2(p, end);
+}
+
+#endif /* HAVE_SIMD_X86 */
+
+
+#ifdef HAVE_SIMD_NEON
+
+static const uint8_t *startcode_neon(const uint8_t *p, const uint8_t *end)
+{
+	const uint8x16_t zero = vdupq_n_u8(0);
+	const uint8x16_t one  = vdupq_n_u8(1);
+	const uint8_t *r;
+
+	for (; p + 18 <= end; p += 16) {
+
+		uint8x16_t m;
+		uint64x2_t m64;
+
+		m = vandq_u8(vceqq_u8(vld1q_u8(p + 0), zero),
+			     vceqq_u8(vld1q_u8(p + 1), zero));
+		m = vandq_u8(m, vceqq_u8(vld1q_u8(p + 2), one));
+
+		/* no movemask on NEON, locate the match byte-wise */
+		m64 = vreinterpretq_u64_u8(m);
+		if (vgetq_lane_u64(m64, 0) | vgetq_lane_u64(m64, 1))
+			return startcode_bytes(p, p + 18);
+	}
+
+	r = startcode_bytes(p, end);
+
+	return r ? r : end;
+}
+
+#endif /* HAVE_SIMD_NEON */
+
+
+/**
+ * Find the NAL start sequence in a H.264 byte stream, with a specific
+ * SIMD implementation
+ *
+ * @param impl SIMD implementation
+ * @param p    Start of byte stream
+ * @param end  End of byte stream
+ *
+ * @return Pointer to start sequence, or end if not found
+ */
+const uint8_t *h264_find_startcode_impl(enum simd_impl impl,
+					const uint8_t *p, const uint8_t *end)
+{
+	if (!simd_supported(impl))
+		impl = SIMD_C;
+
+	switch (impl) {
+
+#ifdef HAVE_SIMD_X86
+	case SIMD_SSE2: return startcode_sse2(p, end);
+	case SIMD_AVX2: return startcode_avx2(p, end);
+#endif
+#ifdef HAVE_SIMD_NEON
+	case SIMD_NEON: return startcode_neon(p, end);
+#endif
+	default:        return startcode_c(p, end);
+	}
+}
+
+
+/**
+ * Find the NAL start sequence in a H.264 byte stream
+ *
+ * @param p    Start of byte stream
+ * @param end  End of byte stream
+ *
+ * @return Pointer to start sequence, or end if not found
+ */
+const uint8_t *h264_find_startcode(const uint8_t *p, const uint8_t *end)
+{
+	static enum simd_impl impl = SIMD_N;
+
+	if (impl == SIMD_N)
+		impl = simd_best();
+
+	return h264_find_startcode_impl(impl, p, end);
 }
 
 
@@ -150,30 +316,160 @@ int h264_nal_send(bool first, bool last,
 }
 
 
-int h264_packetize(const uint8_t *buf, size_t len, size_t pktsize,
-		   videnc_packet_h *pkth, void *arg)
+enum { STAP_MAX = 1500 };  /* largest STAP-A payload, on the stack */
+
+/* Pending STAP-A aggregation (RFC 6184 section 5.7.1) */
+struct stap {
+	uint8_t buf[STAP_MAX]; /* NAL units with 16-bit size prefix   */
+	size_t len;
+	const uint8_t *nal;    /* first NAL unit, sent alone if n = 1 */
+	size_t nal_len;
+	uint8_t hdr;           /* F and max NRI of all NAL units      */
+	unsigned n;
+};
+
+
+static int stap_append(struct stap *stap, const uint8_t *nal, size_t len)
+{
+	if (stap->len + 2 + len > sizeof(stap->buf))
+		return EOVERFLOW;
+
+	stap->buf[stap->len++] = (uint8_t)(len >> 8);
+	stap->buf[stap->len++] = (uint8_t)len;
+	memcpy(&stap->buf[stap->len], nal, len);
+	stap->len += len;
+
+	return 0;
+}
+
+
+static int stap_add(struct stap *stap, const uint8_t *nal, size_t len)
+{
+	const uint8_t f   = (stap->hdr | nal[0]) & 0x80;
+	const uint8_t nri = max(stap->hdr & 0x60, nal[0] & 0x60);
+	int err = 0;
+
+	if (stap->n == 0) {
+		stap->nal = nal;
+		stap->nal_len = len;
+	}
+	else {
+		/* copy only when there is something to aggregate */
+		if (stap->n == 1)
+			err = stap_append(stap, stap->nal, stap->nal_len);
+
+		err |= stap_append(stap, nal, len);
+	}
+
+	stap->hdr = f | nri | H264_NAL_STAP_A;
+	++stap->n;
+
+	return err;
+}
+
+
+static int stap_flush(struct stap *stap, bool marker, size_t pktsize,
+		      videnc_packet_h *pkth, void *arg)
+{
+	int err;
+
+	if (stap->n == 0)
+		return 0;
+
+	if (stap->n == 1) {
+		err = h264_nal_send(true, true, marker, stap->nal[0],
+				    stap->nal + 1, stap->nal_len - 1, pktsize,
+				    pkth, arg);
+	}
+	else {
+		err = rtp_send_data(&stap->hdr, 1, stap->buf, stap->len,
+				    marker, pkth, arg);
+	}
+
+	stap->len = 0;
+	stap->hdr = 0;
+	stap->n = 0;
+
+	return err;
+}
+
+
+/**
+ * Packetize a H.264 byte stream into RTP payloads
+ *
+ * @param buf     H.264 byte stream with start codes
+ * @param len     Length of byte stream
+ * @param pktsize Maximum RTP payload size
+ * @param flags   Packetization flags (H264_PKT_*)
+ * @param pkth    Packet handler
+ * @param arg     Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note H264_PKT_STAP_A requires packetization-mode=1
+ */
+int h264_packetize_ext(const uint8_t *buf, size_t len, size_t pktsize,
+		       unsigned flags, videnc_packet_h *pkth, void *arg)
 {
+	struct stap stap;
 	const uint8_t *start = buf;
 	const uint8_t *end   = buf + len;
+	const size_t stap_max = min(pktsize, (size_t)STAP_MAX);
 	const uint8_t *r;
+	size_t stap_len = 1;
 	int err = 0;
 
+	stap.len = 0;
+	stap.hdr = 0;
+	stap.n   = 0;
+
 	r = h264_find_startcode(start, end);
 
 	while (r < end) {
 		const uint8_t *r1;
+		size_t nal_len;
 
 		/* skip zeros */
 		while (!*(r++))
 			;
 
 		r1 = h264_find_startcode(r, end);
+		nal_len = r1 - r;
+
+		if (!(flags & H264_PKT_STAP_A)) {
+			err |= h264_nal_send(true, true, (r1 >= end), r[0],
+					     r+1, nal_len-1, pktsize,
+					     pkth, arg);
+			r = r1;
+			continue;
+		}
+
+		if (stap_len + 2 + nal_len > stap_max) {
+			err |= stap_flush(&stap, false, pktsize, pkth, arg);
+			stap_len = 1;
+		}
+
+		if (stap_len + 2 + nal_len <= stap_max) {
+			err |= stap_add(&stap, r, nal_len);
+			stap_len += 2 + nal_len;
+		}
+		else {
+			err |= h264_nal_send(true, true, (r1 >= end), r[0],
+					     r+1, nal_len-1, pktsize,
+					     pkth, arg);
+		}
 
-		err |= h264_nal_send(true, true, (r1 >= end), r[0],
-				     r+1, r1-r-1, pktsize,
-				     pkth, arg);
 		r = r1;
 	}
 
+	err |= stap_flush(&stap, true, pktsize, pkth, arg);
+
 	return err;
 }
+
+
+int h264_packetize(const uint8_t *buf, size_t len, size_t pktsize,
+		   videnc_packet_h *pkth, void *arg)
+{
+	return h264_packetize_ext(buf, len, pktsize, 0, pkth, arg);
+}
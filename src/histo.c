@@ -0,0 +1,211 @@
+/**
+ * @file histo.c  Log-linear histogram, lock-free to read
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * Values below 2*HISTO_SUB have one bucket each. Above that, every
+ * power of two is split in HISTO_SUB buckets, so a value is known
+ * within 1/(2*HISTO_SUB) of its size (like a HDR histogram with
+ * 1.5 significant digits).
+ *
+ * There is one writer per histogram. The counters are updated with
+ * relaxed atomics, so a reader on another thread sees each counter
+ * whole, but not necessarily all counters from the same moment.
+ */
+
+enum { SUB_BITS = 4 };
+
+
+static unsigned bucket_index(uint32_t v)
+{
+	unsigned msb, shift;
+
+	if (v < 2*HISTO_SUB)
+		return v;
+
+#if defined (__GNUC__)
+	msb = 31 - __builtin_clz(v);
+#else
+	for (msb = 31; !(v >> msb); msb--)
+		;
+#endif
+	shift = msb - SUB_BITS;
+
+	return shift * HISTO_SUB + (v >> shift);
+}
+
+
+/* Middle of the bucket */
+static uint32_t bucket_value(unsigned idx)
+{
+	unsigned shift;
+
+	if (idx < 2*HISTO_SUB)
+		return idx;
+
+	shift = idx / HISTO_SUB - 1;
+
+	return ((uint32_t)(idx - shift * HISTO_SUB) << shift)
+		+ ((1u << shift) - 1) / 2;
+}
+
+
+/**
+ * Add a value to the histogram
+ *
+ * @param h Histogram
+ * @param v Value
+ */
+void histo_add(struct histo *h, uint32_t v)
+{
+	if (!h)
+		return;
+
+	ATOMIC_ADD(&h->bucketv[bucket_index(v)], 1);
+	ATOMIC_ADD(&h->count, 1);
+	ATOMIC_ADD(&h->sum, v);
+
+	if (v > ATOMIC_LOAD(&h->max))
+		ATOMIC_STORE(&h->max, v);
+}
+
+
+/**
+ * Reset the histogram, must not be called while a writer is active
+ *
+ * @param h Histogram
+ */
+void histo_reset(struct histo *h)
+{
+	if (!h)
+		return;
+
+	memset(h, 0, sizeof(*h));
+}
+
+
+/**
+ * Get the number of values in the histogram
+ *
+ * @param h Histogram
+ *
+ * @return Number of values
+ */
+uint64_t histo_count(const struct histo *h)
+{
+	return h ? ATOMIC_LOAD(&h->count) : 0;
+}
+
+
+/**
+ * Get the sum of all values
+ *
+ * @param h Histogram
+ *
+ * @return Sum of values
+ */
+uint64_t histo_sum(const struct histo *h)
+{
+	return h ? ATOMIC_LOAD(&h->sum) : 0;
+}
+
+
+/**
+ * Get the mean value
+ *
+ * @param h Histogram
+ *
+ * @return Mean value, or 0 if empty
+ */
+uint32_t histo_mean(const struct histo *h)
+{
+	uint64_t n;
+
+	if (!h)
+		return 0;
+
+	n = ATOMIC_LOAD(&h->count);
+
+	return n ? (uint32_t)(ATOMIC_LOAD(&h->sum) / n) : 0;
+}
+
+
+/**
+ * Get the maximum value
+ *
+ * @param h Histogram
+ *
+ * @return Maximum value
+ */
+uint32_t histo_max(const struct histo *h)
+{
+	return h ? ATOMIC_LOAD(&h->max) : 0;
+}
+
+
+/**
+ * Get a percentile of the values
+ *
+ * @param h   Histogram
+ * @param pct Percentile, 0-100
+ *
+ * @return Value at the percentile, or 0 if empty
+ */
+uint32_t histo_percentile(const struct histo *h, unsigned pct)
+{
+	uint32_t bucketv[HISTO_BUCKETS];
+	uint64_t total = 0, rank, n = 0;
+	unsigned i;
+
+	if (!h)
+		return 0;
+
+	/* take a snapshot, the writer may add values meanwhile */
+	for (i=0; i<HISTO_BUCKETS; i++) {
+		bucketv[i] = ATOMIC_LOAD(&h->bucketv[i]);
+		total += bucketv[i];
+	}
+
+	if (!total)
+		return 0;
+
+	rank = (total * min(pct, 100) + 99) / 100;
+	if (!rank)
+		rank = 1;
+
+	for (i=0; i<HISTO_BUCKETS; i++) {
+
+		n += bucketv[i];
+		if (n >= rank)
+			return min(bucket_value(i), histo_max(h));
+	}
+
+	return histo_max(h);
+}
+
+
+/**
+ * Print the histogram summary
+ *
+ * @param pf Print handler
+ * @param h  Histogram
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int histo_debug(struct re_printf *pf, const struct histo *h)
+{
+	if (!h)
+		return 0;
+
+	return re_hprintf(pf, "n=%llu p50=%u p99=%u max=%u",
+			  histo_count(h),
+			  histo_percentile(h, 50), histo_percentile(h, 99),
+			  histo_max(h));
+}
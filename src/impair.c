@@ -0,0 +1,333 @@
+/**
+ * @file impair.c  Network impairment of sent UDP datagrams, for testing
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The impairment is a UDP helper just above the batch sender, so it sees
+ * the datagrams after SRTP and the other helpers, as they would go out
+ * on the wire. Each datagram goes through a Gilbert-Elliott loss model,
+ * with a good and a bad state and a loss rate in each, and the ones that
+ * are not lost are queued with a delivery time:
+ *
+ *   due = now + delay + random(0..jitter) + queueing at the rate cap
+ *
+ * The delivery time is at least the one of the previous datagram, so
+ * the order is kept, except for a share of datagrams that may overtake
+ * the others. With a rate cap the datagrams are serialized on a link of
+ * that rate, and a datagram that would wait longer than the queue limit
+ * is dropped, like at a full router queue.
+ *
+ * The random numbers come from a seeded generator, so a run with the
+ * same parameters loses the same datagrams. The datagrams are sent from
+ * any thread, but delivered by a timer in the main thread.
+ */
+
+
+enum {
+	LAYER_IMPAIR  = -900,   /**< Above the batch sender            */
+	IMPAIR_TICK   = 1,      /**< Delivery timer [ms]               */
+	IMPAIR_QUEUE  = 200,    /**< Default queue limit [ms]          */
+};
+
+struct impair_pkt {
+	struct le le;
+	struct sa dst;
+	struct mbuf *mb;
+	uint64_t due;           /**< Delivery time [ms]                */
+	uint32_t seq;           /**< Order in which it was sent        */
+};
+
+struct impair {
+	struct impair_prm prm;
+	struct impair_stat stat;
+	struct udp_sock *us;
+	struct udp_helper *uh;
+	struct lock *lock;      /**< Protects all fields below         */
+	struct list pktl;       /**< Queued datagrams, by delivery     */
+	struct tmr tmr;
+	uint64_t last_due;      /**< Latest delivery time [ms]         */
+	uint64_t link_free;     /**< Rate cap link is busy until [us]  */
+	uint32_t rand;          /**< State of the random numbers       */
+	uint32_t seq_in;        /**< Next sent datagram                */
+	uint32_t seq_out;       /**< Next datagram in order            */
+	bool bad;               /**< Loss model is in the bad state    */
+};
+
+
+static void pkt_destructor(void *arg)
+{
+	struct impair_pkt *pkt = arg;
+
+	list_unlink(&pkt->le);
+	mem_deref(pkt->mb);
+}
+
+
+static void destructor(void *arg)
+{
+	struct impair *im = arg;
+
+	tmr_cancel(&im->tmr);
+	mem_deref(im->uh);
+	list_flush(&im->pktl);
+	mem_deref(im->us);
+	mem_deref(im->lock);
+}
+
+
+/* xorshift32, the state must not be zero */
+static uint32_t rnd(struct impair *im)
+{
+	uint32_t x = im->rand;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return im->rand = x;
+}
+
+
+/* True with the probability p */
+static bool chance(struct impair *im, double p)
+{
+	if (p <= 0.0)
+		return false;
+	if (p >= 1.0)
+		return true;
+
+	return rnd(im) < p * 4294967296.0;
+}
+
+
+static bool lost(struct impair *im)
+{
+	if (im->bad) {
+		if (chance(im, im->prm.p_good))
+			im->bad = false;
+	}
+	else if (chance(im, im->prm.p_bad)) {
+		im->bad = true;
+	}
+
+	return chance(im, im->bad ? im->prm.loss_bad : im->prm.loss_good);
+}
+
+
+/* must be called with the lock held, returns false to drop */
+static bool schedule(struct impair *im, uint64_t *due, uint64_t now,
+		     size_t len)
+{
+	const struct impair_prm *prm = &im->prm;
+
+	*due = now + prm->delay;
+
+	if (prm->jitter)
+		*due += rnd(im) % (prm->jitter + 1);
+
+	if (prm->rate) {
+
+		const uint64_t now_us = now * 1000;
+		const uint32_t queue = prm->queue ? prm->queue : IMPAIR_QUEUE;
+		uint64_t start = max(im->link_free, now_us);
+
+		if (start - now_us > (uint64_t)queue * 1000)
+			return false;
+
+		im->link_free = start + len * 8 * 1000000ULL / prm->rate;
+		*due += (im->link_free - now_us) / 1000;
+	}
+
+	if (!chance(im, prm->reorder))
+		*due = max(*due, im->last_due);
+
+	im->last_due = max(im->last_due, *due);
+
+	return true;
+}
+
+
+/* Insert after all datagrams with the same delivery time */
+static void enqueue(struct impair *im, struct impair_pkt *pkt)
+{
+	struct le *le;
+
+	for (le = im->pktl.tail; le; le = le->prev) {
+
+		const struct impair_pkt *p = le->data;
+
+		if (p->due <= pkt->due)
+			break;
+	}
+
+	if (le)
+		list_insert_after(&im->pktl, le, &pkt->le, pkt);
+	else
+		list_prepend(&im->pktl, &pkt->le, pkt);
+}
+
+
+static bool send_handler(int *err, struct sa *dst, struct mbuf *mb,
+			 void *arg)
+{
+	struct impair *im = arg;
+	struct impair_pkt *pkt = NULL;
+	const size_t len = mbuf_get_left(mb);
+	uint64_t due;
+	int e = 0;
+
+	lock_write_get(im->lock);
+
+	++im->stat.n_pkt;
+
+	if (lost(im)) {
+		++im->stat.n_lost;
+		goto out;
+	}
+
+	if (!schedule(im, &due, tmr_jiffies(), len)) {
+		++im->stat.n_drop;
+		goto out;
+	}
+
+	pkt = mem_zalloc(sizeof(*pkt), pkt_destructor);
+	if (!pkt) {
+		e = ENOMEM;
+		goto out;
+	}
+
+	pkt->mb = mbuf_alloc(len);
+	if (!pkt->mb) {
+		mem_deref(pkt);
+		e = ENOMEM;
+		goto out;
+	}
+
+	(void)mbuf_write_mem(pkt->mb, mbuf_buf(mb), len);
+	pkt->mb->pos = 0;
+
+	pkt->dst = *dst;
+	pkt->due = due;
+	pkt->seq = im->seq_in++;
+
+	enqueue(im, pkt);
+
+ out:
+	lock_rel(im->lock);
+
+	/* a lost datagram is sent, as far as the sender can tell */
+	*err = e;
+
+	return true;
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct impair *im = arg;
+	const uint64_t now = tmr_jiffies();
+
+	tmr_start(&im->tmr, IMPAIR_TICK, tmr_handler, im);
+
+	for (;;) {
+		struct impair_pkt *pkt;
+
+		lock_write_get(im->lock);
+
+		pkt = list_ledata(im->pktl.head);
+		if (!pkt || pkt->due > now) {
+			lock_rel(im->lock);
+			break;
+		}
+
+		list_unlink(&pkt->le);
+
+		if (pkt->seq < im->seq_out)
+			++im->stat.n_reorder;
+		else
+			im->seq_out = pkt->seq + 1;
+
+		lock_rel(im->lock);
+
+		(void)udp_send_helper(im->us, &pkt->dst, pkt->mb, im->uh);
+		mem_deref(pkt);
+	}
+}
+
+
+/**
+ * Impair the datagrams sent on a UDP socket. The impairment ends when
+ * the object is freed, and the datagrams still queued are dropped.
+ *
+ * @param imp Pointer to allocated impairment
+ * @param us  UDP socket
+ * @param prm Impairment parameters
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int impair_alloc(struct impair **imp, struct udp_sock *us,
+		 const struct impair_prm *prm)
+{
+	struct impair *im;
+	int err;
+
+	if (!imp || !us || !prm)
+		return EINVAL;
+
+	im = mem_zalloc(sizeof(*im), destructor);
+	if (!im)
+		return ENOMEM;
+
+	im->prm  = *prm;
+	im->us   = mem_ref(us);
+	im->rand = prm->seed ? prm->seed : 1;
+	tmr_init(&im->tmr);
+
+	err = lock_alloc(&im->lock);
+	if (err)
+		goto out;
+
+	err = udp_register_helper(&im->uh, us, LAYER_IMPAIR,
+				  send_handler, NULL, im);
+	if (err)
+		goto out;
+
+	tmr_start(&im->tmr, IMPAIR_TICK, tmr_handler, im);
+
+ out:
+	if (err)
+		mem_deref(im);
+	else
+		*imp = im;
+
+	return err;
+}
+
+
+/**
+ * Get the statistics of an impairment
+ *
+ * @param im   Impairment
+ * @param stat Returned statistics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int impair_stats(const struct impair *im, struct impair_stat *stat)
+{
+	if (!im || !stat)
+		return EINVAL;
+
+	lock_read_get(im->lock);
+	*stat = im->stat;
+	stat->n_queued = list_count(&im->pktl);
+	lock_rel(im->lock);
+
+	return 0;
+}
@@ -0,0 +1,192 @@
+/**
+ * @file src/l16.c  L16 byte-order kernels
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+#ifdef HAVE_SIMD_X86
+#include <immintrin.h>
+#endif
+#ifdef HAVE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+
+/**
+ * \page L16 L16 byte-order kernels
+ *
+ * L16 is 16-bit PCM in network byte order (RFC 3551). On a little-endian
+ * host every sample is byte-swapped, 8 to 16 samples at a time with SIMD.
+ * On a big-endian host the samples are copied as they are.
+ *
+ * The payload is read and written as bytes, so it does not have to be
+ * aligned. The SIMD implementation is selected at runtime.
+ */
+
+
+#if defined (__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_ORDER_IS_NET 1
+#endif
+
+
+typedef void (swap_h)(uint8_t *dst, const uint8_t *src, size_t n);
+
+
+static void swap_c(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	while (n--) {
+		const uint8_t b0 = src[0];
+
+		dst[0] = src[1];
+		dst[1] = b0;
+
+		dst += 2;
+		src += 2;
+	}
+}
+
+
+#ifdef HAVE_SIMD_X86
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+
+SSE2 static void swap_sse2(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i;
+
+	for (i=0; i + 8 <= n; i += 8) {
+
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + 2*i));
+
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+
+		_mm_storeu_si128((__m128i *)(dst + 2*i), v);
+	}
+
+	swap_c(dst + 2*i, src + 2*i, n - i);
+}
+
+
+AVX2 static void swap_avx2(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	const __m256i shuf = _mm256_setr_epi8(
+		1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+		1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	size_t i;
+
+	for (i=0; i + 16 <= n; i += 16) {
+
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + 2*i));
+
+		_mm256_storeu_si256((__m256i *)(dst + 2*i),
+				    _mm256_shuffle_epi8(v, shuf));
+	}
+
+	swap_sse2(dst + 2*i, src + 2*i, n - i);
+}
+
+#endif /* HAVE_SIMD_X86 */
+
+
+#ifdef HAVE_SIMD_NEON
+
+static void swap_neon(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i;
+
+	for (i=0; i + 8 <= n; i += 8)
+		vst1q_u8(dst + 2*i, vrev16q_u8(vld1q_u8(src + 2*i)));
+
+	swap_c(dst + 2*i, src + 2*i, n - i);
+}
+
+#endif /* HAVE_SIMD_NEON */
+
+
+static swap_h *impl_swap(enum simd_impl impl)
+{
+	if (!simd_supported(impl))
+		return swap_c;
+
+	switch (impl) {
+
+#ifdef HAVE_SIMD_X86
+	case SIMD_SSE2: return swap_sse2;
+	case SIMD_AVX2: return swap_avx2;
+#endif
+#ifdef HAVE_SIMD_NEON
+	case SIMD_NEON: return swap_neon;
+#endif
+	default:        return swap_c;
+	}
+}
+
+
+static void swap(uint8_t *dst, const uint8_t *src, size_t n)
+{
+#ifdef HOST_ORDER_IS_NET
+	memmove(dst, src, n * 2);
+#else
+	static swap_h *swaph;
+
+	if (!swaph)
+		swaph = impl_swap(simd_best());
+
+	swaph(dst, src, n);
+#endif
+}
+
+
+/**
+ * Byte-swap 16-bit samples with a given implementation
+ *
+ * @param impl SIMD implementation, falls back to C if not supported
+ * @param dst  Destination, 2*n bytes
+ * @param src  Source, 2*n bytes, may be the same as dst
+ * @param n    Number of samples
+ */
+void l16_swap_impl(enum simd_impl impl, uint8_t *dst, const uint8_t *src,
+		   size_t n)
+{
+	if (!dst || !src)
+		return;
+
+	impl_swap(impl)(dst, src, n);
+}
+
+
+/**
+ * Encode 16-bit PCM samples to L16, in network byte order
+ *
+ * @param dst  Destination buffer, 2*n bytes
+ * @param src  Source samples
+ * @param n    Number of samples
+ */
+void l16_encode(uint8_t *dst, const int16_t *src, size_t n)
+{
+	if (!dst || !src)
+		return;
+
+	swap(dst, (const uint8_t *)src, n);
+}
+
+
+/**
+ * Decode L16 to 16-bit PCM samples, in host byte order
+ *
+ * @param dst  Destination samples, n samples
+ * @param src  Source buffer, 2*n bytes
+ * @param n    Number of samples
+ */
+void l16_decode(int16_t *dst, const uint8_t *src, size_t n)
+{
+	if (!dst || !src)
+		return;
+
+	swap((uint8_t *)dst, src, n);
+}
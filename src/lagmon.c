@@ -0,0 +1,287 @@
+/**
+ * @file lagmon.c  Main loop lag monitor
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * SIP and most timers run on the main loop, so one handler that blocks
+ * it delays all calls. A probe timer measures how late it fires, and
+ * main-loop handlers that are wrapped in lagmon_begin() and lagmon_end()
+ * measure how long they run. Both go into histograms. A handler that
+ * runs longer than the threshold is kept in a table of the slowest
+ * handlers, and logged at most once per second, as logging can block
+ * too. A late probe is logged with the slowest handler since the
+ * previous probe, if any.
+ *
+ * The monitor is not locked, and is only used from the main thread.
+ */
+
+
+enum {
+	PROBE_INTERVAL = 100,       /**< Probe timer interval in [ms]      */
+	SLOW_THRESHOLD = 20000,     /**< Slow handler threshold in [us]    */
+	LOG_INTERVAL   = 1000000,   /**< Min. time between warnings [us]   */
+	SLOW_MAX       = 16,        /**< Slowest handlers kept             */
+};
+
+
+static struct {
+	struct tmr tmr;                  /**< Probe timer                  */
+	uint64_t ts_due;                 /**< Expected probe time [us]     */
+	uint64_t ts_log;                 /**< Time of the last warning     */
+	struct histo lag;                /**< Probe lateness [us]          */
+	struct histo hdl;                /**< Handler run time [us]        */
+	struct lagmon_slow slowv[SLOW_MAX]; /**< Slowest handlers          */
+	const char *win_name;            /**< Slowest since last probe     */
+	uint32_t win_max;                /**< Its run time [us]            */
+} lm;
+
+
+static bool log_allow(uint64_t now)
+{
+	if (lm.ts_log && now - lm.ts_log < LOG_INTERVAL)
+		return false;
+
+	/* set first, the warning may come back here */
+	lm.ts_log = now;
+
+	return true;
+}
+
+
+static void slow_add(const char *name, uint32_t d)
+{
+	struct lagmon_slow *slow = NULL, *victim = NULL;
+	size_t i;
+
+	for (i=0; i<SLOW_MAX; i++) {
+
+		struct lagmon_slow *s = &lm.slowv[i];
+
+		if (s->name && !strcmp(s->name, name)) {
+			slow = s;
+			break;
+		}
+
+		/* a free entry, or else the one with the shortest run */
+		if (!victim || (victim->name &&
+				(!s->name || s->max < victim->max)))
+			victim = s;
+	}
+
+	if (!slow) {
+
+		if (victim->name && victim->max >= d)
+			return;
+
+		slow = victim;
+		slow->name  = name;
+		slow->count = 0;
+		slow->max   = 0;
+	}
+
+	++slow->count;
+	slow->max = max(slow->max, d);
+}
+
+
+static void probe_handler(void *arg)
+{
+	uint64_t now = metric_time_us();
+	uint32_t lag = 0;
+	(void)arg;
+
+	tmr_start(&lm.tmr, PROBE_INTERVAL, probe_handler, NULL);
+
+	if (now > lm.ts_due)
+		lag = (uint32_t)min(now - lm.ts_due, UINT32_MAX);
+
+	histo_add(&lm.lag, lag);
+
+	if (lag > SLOW_THRESHOLD && log_allow(now)) {
+
+		if (lm.win_name) {
+			warning("lagmon: main loop was %u ms late"
+				" (%s ran for %u ms)\n", lag / 1000,
+				lm.win_name, lm.win_max / 1000);
+		}
+		else {
+			warning("lagmon: main loop was %u ms late\n",
+				lag / 1000);
+		}
+	}
+
+	lm.ts_due   = now + PROBE_INTERVAL * 1000;
+	lm.win_name = NULL;
+	lm.win_max  = 0;
+}
+
+
+int lagmon_init(void)
+{
+	lagmon_reset();
+
+	lm.ts_due = metric_time_us() + PROBE_INTERVAL * 1000;
+	tmr_start(&lm.tmr, PROBE_INTERVAL, probe_handler, NULL);
+
+	return 0;
+}
+
+
+void lagmon_close(void)
+{
+	tmr_cancel(&lm.tmr);
+}
+
+
+/**
+ * Reset the histograms and the slowest handlers of the lag monitor
+ */
+void lagmon_reset(void)
+{
+	histo_reset(&lm.lag);
+	histo_reset(&lm.hdl);
+	memset(lm.slowv, 0, sizeof(lm.slowv));
+
+	lm.ts_log   = 0;
+	lm.win_name = NULL;
+	lm.win_max  = 0;
+}
+
+
+/**
+ * Get the start time of a main-loop handler, for lagmon_end()
+ *
+ * @return Start time in [us]
+ */
+uint64_t lagmon_begin(void)
+{
+	return metric_time_us();
+}
+
+
+/**
+ * Record the run time of a main-loop handler
+ *
+ * @param name Handler name, must be a static string
+ * @param ts   Start time from lagmon_begin()
+ */
+void lagmon_end(const char *name, uint64_t ts)
+{
+	uint64_t now = metric_time_us();
+	uint32_t d;
+
+	if (!name)
+		return;
+
+	d = now > ts ? (uint32_t)min(now - ts, UINT32_MAX) : 0;
+
+	histo_add(&lm.hdl, d);
+
+	if (d <= SLOW_THRESHOLD)
+		return;
+
+	slow_add(name, d);
+
+	if (d > lm.win_max) {
+		lm.win_name = name;
+		lm.win_max  = d;
+	}
+
+	if (log_allow(now)) {
+		warning("lagmon: %s blocked the main loop for %u ms\n",
+			name, d / 1000);
+	}
+}
+
+
+/**
+ * Get the histogram of the main loop lag, in [us]
+ *
+ * @return Histogram of the lateness of the probe timer
+ */
+const struct histo *lagmon_lag(void)
+{
+	return &lm.lag;
+}
+
+
+/**
+ * Get the histogram of the run time of main-loop handlers, in [us]
+ *
+ * @return Histogram of the handler run time
+ */
+const struct histo *lagmon_handlers(void)
+{
+	return &lm.hdl;
+}
+
+
+static int slow_cmp(const void *a, const void *b)
+{
+	const struct lagmon_slow *sa = a, *sb = b;
+
+	return (sa->max < sb->max) - (sa->max > sb->max);
+}
+
+
+/**
+ * Get the slowest main-loop handlers, longest run first
+ *
+ * @param slowv Returned slowest handlers
+ * @param slowc Size of slowv
+ *
+ * @return Number of handlers returned
+ */
+size_t lagmon_slowest(struct lagmon_slow *slowv, size_t slowc)
+{
+	struct lagmon_slow v[SLOW_MAX];
+	size_t i, n = 0;
+
+	if (!slowv)
+		return 0;
+
+	for (i=0; i<SLOW_MAX; i++) {
+		if (lm.slowv[i].name)
+			v[n++] = lm.slowv[i];
+	}
+
+	qsort(v, n, sizeof(v[0]), slow_cmp);
+
+	n = min(n, slowc);
+	memcpy(slowv, v, n * sizeof(v[0]));
+
+	return n;
+}
+
+
+int lagmon_debug(struct re_printf *pf, void *unused)
+{
+	struct lagmon_slow slowv[SLOW_MAX];
+	size_t i, n;
+	int err;
+	(void)unused;
+
+	n = lagmon_slowest(slowv, ARRAY_SIZE(slowv));
+
+	err  = re_hprintf(pf, "\n--- Main loop lag [us] ---\n");
+	err |= re_hprintf(pf, " lag:      %H\n", histo_debug, &lm.lag);
+	err |= re_hprintf(pf, " handlers: %H\n", histo_debug, &lm.hdl);
+	err |= re_hprintf(pf, " slowest handlers (above %u ms):\n",
+			  SLOW_THRESHOLD / 1000);
+
+	for (i=0; i<n; i++) {
+		err |= re_hprintf(pf, "  %-24s %6u ms  (%u times)\n",
+				  slowv[i].name, slowv[i].max / 1000,
+				  slowv[i].count);
+	}
+
+	return err;
+}
@@ -3,9 +3,80 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
-
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include <re.h>
 #include <baresip.h>
+#include "core.h"
+
+
+/**
+ * \page Logging Logging
+ *
+ * Log messages are formatted on the calling thread. In synchronous mode
+ * (the default) they are written to stderr and the log handlers right
+ * away. In asynchronous mode the caller only copies the formatted record
+ * into a lock-free ring, and a log thread writes it out. If the ring is
+ * full the record is dropped and counted, so a media thread never blocks
+ * on a slow stderr or syslog.
+ *
+ * Handlers that are not thread-safe are called from the main thread,
+ * via a message queue.
+ *
+ * A thread can set a context, the Call-ID and the AOR its messages are
+ * about. The context travels with each record, and a handler can get
+ * the context of the message it was called with, for structured output.
+ * The handlers on the main thread get no context.
+ *
+ * Each call site, identified by its format string, may log a burst of
+ * messages per second. Messages above that are suppressed and counted,
+ * and the count is reported with the next message from that call site.
+ */
+
+
+#if defined (HAVE_PTHREAD) && defined (__GNUC__)
+#define LOG_ASYNC 1
+#endif
+
+
+enum {
+	RATE_BURST  = 50,    /**< Default messages per call site per window */
+	RATE_WINDOW = 1000,  /**< Rate-limit window [ms]                    */
+	SITE_SIZE   = 128,   /**< Number of call sites, power of two        */
+	SITE_PROBE  = 4,     /**< Max probes for a call site slot           */
+	RING_SIZE   = 256,   /**< Number of records, power of two           */
+	RECORD_SIZE = 1024,  /**< Max length of one record                  */
+	IDLE_WAIT   = 5,     /**< Idle wait of the log thread [ms]          */
+	CTX_CALLID  = 64,    /**< Max length of the Call-ID in a context    */
+	CTX_AOR     = 128,   /**< Max length of the AOR in a context        */
+};
+
+
+#ifdef __GNUC__
+#define LOG_TLS __thread
+#else
+#define LOG_TLS
+#endif
+
+
+struct log_ctx {
+	char callid[CTX_CALLID];
+	char aor[CTX_AOR];
+};
+
+/* context of the calling thread, and of the message being handled */
+static LOG_TLS struct log_ctx ctx_cur;
+static LOG_TLS const struct log_ctx *ctx_msg;
+
+
+struct site {
+	const char *fmt;      /**< Format string, identifies the call site */
+	uint64_t window;      /**< Start of current window [ms]            */
+	uint32_t count;       /**< Messages in current window              */
+	uint32_t suppressed;  /**< Suppressed messages, not yet reported   */
+};
 
 
 static struct {
@@ -13,20 +84,58 @@ static struct {
 	bool debug;
 	bool info;
 	bool stder;
+	uint32_t burst;
+	uint64_t n_suppressed;
+	struct site sitev[SITE_SIZE];
 } lg = {
 	LIST_INIT,
 	false,
 	true,
-	true
+	true,
+	RATE_BURST,
+	0,
+	{{NULL, 0, 0, 0}}
+};
+
+
+#ifdef LOG_ASYNC
+struct record {
+	uint32_t seq;              /**< Sequence number of the slot */
+	uint32_t level;            /**< Log level                   */
+	struct log_ctx ctx;        /**< Context of the caller       */
+	char msg[RECORD_SIZE];     /**< Formatted message           */
 };
 
 
+/* Bounded MPSC ring, producers claim slots with a CAS on the tail */
+static struct {
+	struct record ringv[RING_SIZE];
+	uint32_t tail;             /**< Next slot to write, producers */
+	uint32_t head;             /**< Next slot to read, log thread */
+	uint64_t n_drops;          /**< Records dropped, ring full    */
+	pthread_mutex_t mutex;     /**< Protects the handler list     */
+	pthread_t tid;
+	struct mqueue *mq;
+	bool run;
+	bool async;
+} lq = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+#endif
+
+
 void log_register_handler(struct log *log)
 {
 	if (!log)
 		return;
 
+#ifdef LOG_ASYNC
+	pthread_mutex_lock(&lq.mutex);
+#endif
 	list_append(&lg.logl, &log->le, log);
+#ifdef LOG_ASYNC
+	pthread_mutex_unlock(&lq.mutex);
+#endif
 }
 
 
@@ -35,7 +144,13 @@ void log_unregister_handler(struct log *log)
 	if (!log)
 		return;
 
+#ifdef LOG_ASYNC
+	pthread_mutex_lock(&lq.mutex);
+#endif
 	list_unlink(&log->le);
+#ifdef LOG_ASYNC
+	pthread_mutex_unlock(&lq.mutex);
+#endif
 }
 
 
@@ -57,27 +172,96 @@ void log_enable_stderr(bool enable)
 }
 
 
-void vlog(enum log_level level, const char *fmt, va_list ap)
+/**
+ * Set the rate limit of each call site
+ *
+ * @param burst Max messages per call site per second, 0 for no limit
+ */
+void log_set_ratelimit(uint32_t burst)
 {
-	char buf[4096];
-	struct le *le;
+	ATOMIC_STORE(&lg.burst, burst);
+}
 
-	if (re_vsnprintf(buf, sizeof(buf), fmt, ap) < 0)
-		return;
 
-	if (lg.stder) {
+static struct site *site_lookup(const char *fmt)
+{
+	size_t h = ((uintptr_t)fmt >> 3) * 2654435761u;
+	size_t i;
+
+	for (i=0; i<SITE_PROBE; i++) {
+
+		struct site *site = &lg.sitev[(h + i) & (SITE_SIZE-1)];
+		const char *cur = ATOMIC_LOAD(&site->fmt);
+
+		if (!cur && ATOMIC_CAS(&site->fmt, &cur, fmt))
+			cur = fmt;
+
+		if (cur == fmt)
+			return site;
+	}
+
+	/* table is full, this call site is not limited */
+	return NULL;
+}
+
+
+/*
+ * Returns false if the message should be suppressed. The number of
+ * messages suppressed in the previous window is returned once.
+ */
+static bool site_allow(const char *fmt, uint32_t *suppressed)
+{
+	uint32_t burst = ATOMIC_LOAD(&lg.burst);
+	struct site *site;
+	uint64_t now, win;
+
+	if (!burst || !fmt)
+		return true;
+
+	site = site_lookup(fmt);
+	if (!site)
+		return true;
 
-		bool color = level == LEVEL_WARN || level == LEVEL_ERROR;
+	now = tmr_jiffies();
+	win = ATOMIC_LOAD(&site->window);
 
-		if (color)
-			(void)re_fprintf(stderr, "\x1b[31m"); /* Red */
+	if (now - win >= RATE_WINDOW &&
+	    ATOMIC_CAS(&site->window, &win, now)) {
 
-		(void)re_fprintf(stderr, "%s", buf);
+		ATOMIC_STORE(&site->count, 0);
+		*suppressed = ATOMIC_XCHG(&site->suppressed, 0);
+	}
 
-		if (color)
-			(void)re_fprintf(stderr, "\x1b[;m");
+	if (ATOMIC_ADD(&site->count, 1) >= burst) {
+		ATOMIC_ADD(&site->suppressed, 1);
+		ATOMIC_ADD(&lg.n_suppressed, 1);
+		return false;
 	}
 
+	return true;
+}
+
+
+static void stderr_print(enum log_level level, const char *msg)
+{
+	bool color = level == LEVEL_WARN || level == LEVEL_ERROR;
+
+	if (color)
+		(void)re_fprintf(stderr, "\x1b[31m"); /* Red */
+
+	(void)re_fprintf(stderr, "%s", msg);
+
+	if (color)
+		(void)re_fprintf(stderr, "\x1b[;m");
+}
+
+
+/* call the handlers, all of them or only the thread-safe ones */
+static bool handler_call(enum log_level level, const char *msg, bool all)
+{
+	bool pending = false;
+	struct le *le;
+
 	le = lg.logl.head;
 
 	while (le) {
@@ -85,9 +269,297 @@ void vlog(enum log_level level, const char *fmt, va_list ap)
 		struct log *log = le->data;
 		le = le->next;
 
-		if (log->h)
-			log->h(level, buf);
+		if (!log->h)
+			continue;
+
+		if (all || log->thread_safe)
+			log->h(level, msg);
+		else
+			pending = true;
+	}
+
+	return pending;
+}
+
+
+static void output(enum log_level level, const char *msg)
+{
+	if (lg.stder)
+		stderr_print(level, msg);
+
+	ctx_msg = &ctx_cur;
+	(void)handler_call(level, msg, true);
+	ctx_msg = NULL;
+}
+
+
+#ifdef LOG_ASYNC
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	struct le *le;
+	(void)arg;
+
+	/* main thread: the thread-safe handlers were already called */
+	for (le = lg.logl.head; le; le = le->next) {
+
+		struct log *log = le->data;
+
+		if (log->h && !log->thread_safe)
+			log->h(id, data);
+	}
+
+	mem_deref(data);
+}
+
+
+static bool ring_push(enum log_level level, const char *msg)
+{
+	struct record *rec;
+	uint32_t pos = ATOMIC_LOAD(&lq.tail);
+	size_t len;
+
+	for (;;) {
+		int32_t dif;
+
+		rec = &lq.ringv[pos & (RING_SIZE-1)];
+		dif = (int32_t)(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE)
+				- pos);
+
+		if (dif == 0) {
+			if (ATOMIC_CAS(&lq.tail, &pos, pos + 1))
+				break;
+		}
+		else if (dif < 0) {
+			ATOMIC_ADD(&lq.n_drops, 1);
+			return false;
+		}
+		else {
+			pos = ATOMIC_LOAD(&lq.tail);
+		}
+	}
+
+	len = str_len(msg);
+	if (len >= sizeof(rec->msg)) {
+		len = sizeof(rec->msg) - 1;
+		memcpy(rec->msg, msg, len);
+		rec->msg[len - 1] = '\n';
+	}
+	else {
+		memcpy(rec->msg, msg, len);
+	}
+	rec->msg[len] = '\0';
+	rec->level = level;
+	rec->ctx   = ctx_cur;
+
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+
+/* log thread, or main thread after the log thread has stopped */
+static size_t ring_drain(bool all)
+{
+	size_t n = 0;
+
+	for (;;) {
+		struct record *rec = &lq.ringv[lq.head & (RING_SIZE-1)];
+		bool pending;
+
+		if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE)
+		    != lq.head + 1)
+			break;
+
+		if (lg.stder)
+			stderr_print(rec->level, rec->msg);
+
+		pthread_mutex_lock(&lq.mutex);
+		ctx_msg = &rec->ctx;
+		pending = handler_call(rec->level, rec->msg, all);
+		ctx_msg = NULL;
+		pthread_mutex_unlock(&lq.mutex);
+
+		if (pending) {
+			char *msg;
+
+			if (!str_dup(&msg, rec->msg) &&
+			    mqueue_push(lq.mq, rec->level, msg))
+				mem_deref(msg);
+		}
+
+		__atomic_store_n(&rec->seq, lq.head + RING_SIZE,
+				 __ATOMIC_RELEASE);
+		++lq.head;
+		++n;
+	}
+
+	return n;
+}
+
+
+static void *log_thread(void *arg)
+{
+	(void)arg;
+
+	while (__atomic_load_n(&lq.run, __ATOMIC_ACQUIRE)) {
+
+		if (!ring_drain(false))
+			sys_msleep(IDLE_WAIT);
+	}
+
+	return NULL;
+}
+#endif
+
+
+/**
+ * Set the context of the messages logged by the calling thread
+ *
+ * @param callid Call-ID, or NULL
+ * @param aor    Address of Record, or NULL
+ */
+void log_set_context(const char *callid, const char *aor)
+{
+	str_ncpy(ctx_cur.callid, callid ? callid : "",
+		 sizeof(ctx_cur.callid));
+	str_ncpy(ctx_cur.aor, aor ? aor : "", sizeof(ctx_cur.aor));
+}
+
+
+/**
+ * Get the context of the message a log handler was called with
+ *
+ * @param callid Returns the Call-ID, or NULL if not set
+ * @param aor    Returns the Address of Record, or NULL if not set
+ */
+void log_context(const char **callid, const char **aor)
+{
+	const struct log_ctx *ctx = ctx_msg;
+
+	if (callid)
+		*callid = ctx && ctx->callid[0] ? ctx->callid : NULL;
+	if (aor)
+		*aor = ctx && ctx->aor[0] ? ctx->aor : NULL;
+}
+
+
+/**
+ * Enable or disable asynchronous logging
+ *
+ * Must be called from the main thread. When disabled, all pending
+ * records are written out before returning.
+ *
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int log_enable_async(bool enable)
+{
+#ifdef LOG_ASYNC
+	uint32_t i;
+	int err;
+
+	if (enable == lq.async)
+		return 0;
+
+	if (!enable) {
+
+		__atomic_store_n(&lq.async, false, __ATOMIC_RELEASE);
+		__atomic_store_n(&lq.run, false, __ATOMIC_RELEASE);
+		pthread_join(lq.tid, NULL);
+
+		/* the log thread has stopped, call all handlers here */
+		(void)ring_drain(true);
+
+		lq.mq = mem_deref(lq.mq);
+
+		return 0;
+	}
+
+	err = mqueue_alloc(&lq.mq, mqueue_handler, NULL);
+	if (err)
+		return err;
+
+	for (i=0; i<RING_SIZE; i++)
+		lq.ringv[(lq.head + i) & (RING_SIZE-1)].seq = lq.head + i;
+	lq.tail = lq.head;
+
+	lq.run = true;
+
+	err = pthread_create(&lq.tid, NULL, log_thread, NULL);
+	if (err) {
+		lq.run = false;
+		lq.mq = mem_deref(lq.mq);
+		return err;
 	}
+
+	__atomic_store_n(&lq.async, true, __ATOMIC_RELEASE);
+
+	return 0;
+#else
+	return enable ? ENOSYS : 0;
+#endif
+}
+
+
+int log_debug(struct re_printf *pf, void *unused)
+{
+	int err = 0;
+	(void)unused;
+
+	err |= re_hprintf(pf, "--- Log ---\n");
+#ifdef LOG_ASYNC
+	err |= re_hprintf(pf, " mode:       %s\n",
+			  lq.async ? "async" : "sync");
+	err |= re_hprintf(pf, " dropped:    %llu\n",
+			  ATOMIC_LOAD(&lq.n_drops));
+#endif
+	err |= re_hprintf(pf, " rate limit: %u/s\n", ATOMIC_LOAD(&lg.burst));
+	err |= re_hprintf(pf, " suppressed: %llu\n",
+			  ATOMIC_LOAD(&lg.n_suppressed));
+
+	return err;
+}
+
+
+void vlog(enum log_level level, const char *fmt, va_list ap)
+{
+	char buf[4096];
+	uint32_t suppressed = 0;
+
+	if (!site_allow(fmt, &suppressed))
+		return;
+
+	if (re_vsnprintf(buf, sizeof(buf), fmt, ap) < 0)
+		return;
+
+#ifdef LOG_ASYNC
+	if (__atomic_load_n(&lq.async, __ATOMIC_ACQUIRE)) {
+
+		if (suppressed) {
+			char note[64];
+
+			(void)re_snprintf(note, sizeof(note),
+					  "(%u similar messages suppressed)\n",
+					  suppressed);
+			(void)ring_push(level, note);
+		}
+
+		(void)ring_push(level, buf);
+		return;
+	}
+#endif
+
+	if (suppressed) {
+		char note[64];
+
+		(void)re_snprintf(note, sizeof(note),
+				  "(%u similar messages suppressed)\n",
+				  suppressed);
+		output(level, note);
+	}
+
+	output(level, buf);
 }
 
 
@@ -152,6 +152,8 @@ int main(int argc, char *argv[])
 	(void)argv;
 #endif
 
+	startup_phase("config");
+
 	err = conf_configure();
 	if (err) {
 		warning("main: configure failed: %m\n", err);
@@ -168,6 +170,8 @@ int main(int argc, char *argv[])
 	 * Initialise the top-level baresip struct, must be
 	 * done AFTER configuration is complete.
 	 */
+	startup_phase("init");
+
 	err = baresip_init(conf_config(), prefer_ipv6);
 	if (err) {
 		warning("main: baresip init failed (%m)\n", err);
@@ -192,6 +196,8 @@ int main(int argc, char *argv[])
 	}
 
 	/* Initialise User Agents */
+	startup_phase("ua");
+
 	err = ua_init("baresip v" BARESIP_VERSION " (" ARCH "/" OS ")",
 		      true, true, true, prefer_ipv6);
 	if (err)
@@ -221,14 +227,32 @@ int main(int argc, char *argv[])
 		log_enable_stderr(false);
 	}
 
-	info("baresip is ready.\n");
+	startup_phase(NULL);
+
+	info("baresip is ready (%H).\n", startup_debug, NULL);
 
 	if (exec)
 		ui_input_str(exec);
 
+	/* Media threads must not block on stderr or syslog */
+	err = log_enable_async(true);
+	if (err && err != ENOSYS)
+		warning("main: async logging failed (%m)\n", err);
+
+	/* Keep the media paths out of page faults */
+	if (conf_config()->sched.mlockall) {
+		err = realtime_mlockall();
+		if (err)
+			warning("main: mlockall failed (%m)\n", err);
+	}
+
+	(void)realtime_thread("main");
+
 	/* Main loop */
 	err = re_main(signal_handler);
 
+	(void)log_enable_async(false);
+
  out:
 	if (err)
 		ua_stop_all(true);
@@ -0,0 +1,268 @@
+/**
+ * @file mclock.c  Media clock
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * Media sources and pacers take their time from the media clock. It is
+ * the wall clock by default. In the fast mode it is a virtual clock that
+ * jumps ahead to the next deadline, so media runs as fast as the CPU
+ * allows, for tests and batch processing.
+ *
+ * A media clock timer runs on the main loop. In the fast mode the
+ * timers are kept in the order of their deadlines, and one of them runs
+ * on each turn of the main loop, with the clock set to its deadline.
+ * They run in the same order as in real time, whatever the CPU load.
+ *
+ * A media thread waits with mclock_sleep_until(). In the fast mode it
+ * does not wait, and moves the clock forward instead. The clock can be
+ * read from any thread.
+ */
+
+
+static struct {
+	enum mclock_mode mode;
+	uint64_t vnow;            /**< Virtual time in [us] (atomic)     */
+	struct list tmrl;         /**< Running timers                    */
+	struct tmr tmr;           /**< Runs the fast mode timers         */
+} mc;
+
+
+static void vnow_advance(uint64_t ts)
+{
+	uint64_t now = __atomic_load_n(&mc.vnow, __ATOMIC_RELAXED);
+
+	while (ts > now &&
+	       !__atomic_compare_exchange_n(&mc.vnow, &now, ts, true,
+					    __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;
+}
+
+
+static void real_handler(void *arg)
+{
+	struct mclock_tmr *t = arg;
+
+	list_unlink(&t->le);
+
+	t->h(t->arg);
+}
+
+
+static void fast_handler(void *arg)
+{
+	struct mclock_tmr *t = list_ledata(list_head(&mc.tmrl));
+	(void)arg;
+
+	if (!t)
+		return;
+
+	list_unlink(&t->le);
+
+	if (!list_isempty(&mc.tmrl))
+		tmr_start(&mc.tmr, 0, fast_handler, NULL);
+
+	vnow_advance(t->ts);
+
+	t->h(t->arg);
+}
+
+
+/* After the last timer with the same or an earlier deadline */
+static void fast_insert(struct mclock_tmr *t)
+{
+	struct le *le;
+
+	for (le = mc.tmrl.tail; le; le = le->prev) {
+
+		const struct mclock_tmr *t2 = le->data;
+
+		if (t2->ts <= t->ts)
+			break;
+	}
+
+	if (le)
+		list_insert_after(&mc.tmrl, le, &t->le, t);
+	else
+		list_prepend(&mc.tmrl, &t->le, t);
+
+	if (!tmr_isrunning(&mc.tmr))
+		tmr_start(&mc.tmr, 0, fast_handler, NULL);
+}
+
+
+static void real_start(struct mclock_tmr *t, uint64_t now)
+{
+	tmr_start(&t->tmr, t->ts > now ? (t->ts - now + 999) / 1000 : 0,
+		  real_handler, t);
+}
+
+
+static bool ts_cmp(struct le *le1, struct le *le2, void *arg)
+{
+	const struct mclock_tmr *t1 = le1->data, *t2 = le2->data;
+	(void)arg;
+
+	return t1->ts <= t2->ts;
+}
+
+
+/**
+ * Set the mode of the media clock. The running timers keep the time
+ * that is left to their deadlines.
+ *
+ * @param mode Media clock mode
+ */
+void mclock_set_mode(enum mclock_mode mode)
+{
+	const uint64_t now = mclock_now();
+	struct le *le;
+
+	if (mode == mc.mode)
+		return;
+
+	mc.mode = mode;
+
+	if (mode == MCLOCK_FAST) {
+
+		__atomic_store_n(&mc.vnow, now, __ATOMIC_RELAXED);
+
+		for (le = mc.tmrl.head; le; le = le->next) {
+			struct mclock_tmr *t = le->data;
+
+			tmr_cancel(&t->tmr);
+		}
+
+		list_sort(&mc.tmrl, ts_cmp, NULL);
+
+		if (!list_isempty(&mc.tmrl))
+			tmr_start(&mc.tmr, 0, fast_handler, NULL);
+	}
+	else {
+		const uint64_t real = metric_time_us();
+
+		tmr_cancel(&mc.tmr);
+
+		for (le = mc.tmrl.head; le; le = le->next) {
+			struct mclock_tmr *t = le->data;
+
+			t->ts = t->ts - now + real;
+			real_start(t, real);
+		}
+	}
+}
+
+
+/**
+ * Get the mode of the media clock
+ *
+ * @return Media clock mode
+ */
+enum mclock_mode mclock_mode(void)
+{
+	return mc.mode;
+}
+
+
+/**
+ * Get the time of the media clock
+ *
+ * @return Media time in [us]
+ */
+uint64_t mclock_now(void)
+{
+	if (mc.mode == MCLOCK_FAST)
+		return __atomic_load_n(&mc.vnow, __ATOMIC_RELAXED);
+
+	return metric_time_us();
+}
+
+
+/**
+ * Wait until a time of the media clock, from a media thread
+ *
+ * @param ts Media time in [us]
+ */
+void mclock_sleep_until(uint64_t ts)
+{
+	uint64_t now;
+
+	if (mc.mode == MCLOCK_FAST) {
+		vnow_advance(ts);
+		return;
+	}
+
+	now = metric_time_us();
+	if (ts > now)
+		sys_usleep((unsigned)(ts - now));
+}
+
+
+/**
+ * Start a media clock timer, or restart it if it is running
+ *
+ * @param t     Media clock timer
+ * @param delay Timeout in [ms] of the media clock
+ * @param h     Timeout handler
+ * @param arg   Handler argument
+ */
+void mclock_tmr_start(struct mclock_tmr *t, uint64_t delay,
+		      mclock_h *h, void *arg)
+{
+	uint64_t now;
+
+	if (!t || !h)
+		return;
+
+	mclock_tmr_cancel(t);
+
+	now    = mclock_now();
+	t->ts  = now + delay * 1000;
+	t->h   = h;
+	t->arg = arg;
+
+	if (mc.mode == MCLOCK_FAST) {
+		fast_insert(t);
+	}
+	else {
+		list_append(&mc.tmrl, &t->le, t);
+		real_start(t, now);
+	}
+}
+
+
+/**
+ * Cancel a media clock timer
+ *
+ * @param t Media clock timer
+ */
+void mclock_tmr_cancel(struct mclock_tmr *t)
+{
+	if (!t || !t->le.list)
+		return;
+
+	list_unlink(&t->le);
+	tmr_cancel(&t->tmr);
+
+	if (list_isempty(&mc.tmrl))
+		tmr_cancel(&mc.tmr);
+}
+
+
+/**
+ * Check if a media clock timer is running
+ *
+ * @param t Media clock timer
+ *
+ * @return True if running, False if not
+ */
+bool mclock_tmr_isrunning(const struct mclock_tmr *t)
+{
+	return t && t->le.list;
+}
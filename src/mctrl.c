@@ -3,11 +3,48 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
+#include <ctype.h>
 #include <re.h>
 #include <baresip.h>
 #include "core.h"
 
 
+enum {
+	DTMF_DURATION = 250,  /**< Default duration of a key [ms] */
+};
+
+
+/* Find a string in a body, without the regex engine */
+static bool pl_find(const struct pl *pl, const char *str)
+{
+	const size_t n = strlen(str);
+	const char *p = pl->p, *end = pl->p + pl->l;
+
+	while (p && (size_t)(end - p) >= n) {
+
+		if (0 == memcmp(p, str, n))
+			return true;
+
+		p = memchr(p + 1, str[0], end - p - 1);
+	}
+
+	return false;
+}
+
+
+static void trim(struct pl *pl)
+{
+	while (pl->l && isspace((unsigned char)pl->p[0])) {
+		++pl->p;
+		--pl->l;
+	}
+
+	while (pl->l && isspace((unsigned char)pl->p[pl->l - 1]))
+		--pl->l;
+}
+
+
 /*
  * RFC 5168 XML Schema for Media Control
  * note: deprecated, use RTCP FIR instead
@@ -29,16 +66,76 @@
 
   </pre>
  */
-int mctrl_handle_media_control(struct pl *body, bool *pfu)
+int mctrl_handle_media_control(const struct pl *body, bool *pfu)
 {
 	if (!body)
 		return EINVAL;
 
-	/* XXX: Poor-mans XML parsing (use xml-parser instead) */
-	if (0 == re_regex(body->p, body->l, "picture_fast_update")) {
-		if (pfu)
-			*pfu = true;
-	}
+	/* the only primitive of the schema, the XML is not parsed */
+	if (pfu)
+		*pfu = pl_find(body, "picture_fast_update");
 
 	return 0;
 }
+
+
+/*
+ * Body of an INFO request with the content type application/dtmf-relay,
+ * one key per line, the Duration is optional:
+ *
+ * <pre>
+   Signal=5
+   Duration=160
+ * </pre>
+ */
+int mctrl_dtmf_relay(const struct pl *body, char *sig, uint32_t *dur)
+{
+	const char *p, *end;
+	bool got_sig = false;
+
+	if (!body || !sig || !dur)
+		return EINVAL;
+
+	*dur = DTMF_DURATION;
+
+	for (p = body->p, end = body->p + body->l; p < end; ) {
+
+		const char *eol = memchr(p, '\n', end - p);
+		struct pl key, val;
+
+		if (!eol)
+			eol = end;
+
+		key.p = p;
+		val.p = memchr(p, '=', eol - p);
+		p = eol + 1;
+
+		if (!val.p)
+			continue;
+
+		key.l = val.p - key.p;
+		++val.p;
+		val.l = eol - val.p;
+		trim(&key);
+		trim(&val);
+
+		if (!val.l)
+			continue;
+
+		if (0 == pl_strcasecmp(&key, "Signal")) {
+
+			const char c = toupper((unsigned char)val.p[0]);
+
+			if (val.l != 1 || !c || !strchr("0123456789*#ABCD", c))
+				return EBADMSG;
+
+			*sig = c;
+			got_sig = true;
+		}
+		else if (0 == pl_strcasecmp(&key, "Duration")) {
+			*dur = pl_u32(&val);
+		}
+	}
+
+	return got_sig ? 0 : EBADMSG;
+}
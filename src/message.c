@@ -3,72 +3,346 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 #include "core.h"
 
 
-static struct sip_lsnr *lsnr;
-static message_recv_h *recvh;
-static void *recvarg;
+/*
+ * Outgoing MESSAGEs are queued per User-Agent and peer, with at most
+ * `sip_msg_inflight' requests to a peer waiting for a final response and
+ * at most `sip_msg_queue' waiting to be sent. The requests to a peer are
+ * sent on the same transport, so over TCP and TLS they share the
+ * connection of the SIP stack to that peer.
+ *
+ * Incoming MESSAGEs are passed to the handler right away, or with
+ * `sip_msg_rxq' they are answered at once and queued, and passed to the
+ * handler in batches from the main loop. When the queue is full they
+ * are rejected with 503 and Retry-After.
+ */
+
+
+enum {
+	HASH_SIZE = 64,
+	RX_BATCH  = 32,       /**< Received MESSAGEs handled per batch */
+	RX_RETRY  = 1,        /**< Retry-After of a full queue [s]     */
+};
+
+
+/** Outgoing MESSAGEs to one peer */
+struct msg_peer {
+	struct le he;
+	struct ua *ua;
+	char *uri;
+	struct list txl;      /**< Queued MESSAGEs (struct msg_tx)     */
+	uint32_t txc;
+	uint32_t inflight;
+};
+
+struct msg_tx {
+	struct le le;
+	struct msg_peer *peer;
+	char *body;
+};
+
+/** Received MESSAGE, waiting for the handler */
+struct msg_rx {
+	struct le le;
+	char *from;
+	struct mbuf *mb;
+};
+
+static struct {
+	struct sip_lsnr *lsnr;
+	message_recv_h *recvh;
+	void *recvarg;
+	struct hash *peers;
+	uint32_t peerc;
+	struct list rxl;
+	uint32_t rxc;
+	struct tmr tmr_rx;
+} msg;
+
+
+static void rx_destructor(void *arg)
+{
+	struct msg_rx *rx = arg;
+
+	list_unlink(&rx->le);
+	mem_deref(rx->from);
+	mem_deref(rx->mb);
+}
 
 
-static void handle_message(struct ua *ua, const struct sip_msg *msg)
+static void rx_handler(void *arg)
 {
 	static const char ctype_text[] = "text/plain";
 	struct pl ctype_pl = {ctype_text, sizeof(ctype_text)-1};
-	(void)ua;
+	unsigned n = 0;
+	(void)arg;
+
+	while (msg.rxc && n++ < RX_BATCH) {
+
+		struct msg_rx *rx = list_ledata(list_head(&msg.rxl));
+		struct pl from;
+
+		--msg.rxc;
+		list_unlink(&rx->le);
+
+		pl_set_str(&from, rx->from);
 
-	if (msg_ctype_cmp(&msg->ctyp, "text", "plain") && recvh) {
-		recvh(&msg->from.auri, &ctype_pl, msg->mb, recvarg);
-		(void)sip_reply(uag_sip(), msg, 200, "OK");
+		if (msg.recvh)
+			msg.recvh(&from, &ctype_pl, rx->mb, msg.recvarg);
+
+		mem_deref(rx);
 	}
-	else {
-		(void)sip_replyf(uag_sip(), msg, 415, "Unsupported Media Type",
+
+	if (msg.rxc)
+		tmr_start(&msg.tmr_rx, 0, rx_handler, NULL);
+}
+
+
+static int rx_queue(const struct sip_msg *sipmsg)
+{
+	const uint32_t rxq = conf_config()->sip.msg_rxq;
+	struct msg_rx *rx;
+	int err;
+
+	if (msg.rxc >= rxq)
+		return EOVERFLOW;
+
+	rx = mem_zalloc(sizeof(*rx), rx_destructor);
+	if (!rx)
+		return ENOMEM;
+
+	err = pl_strdup(&rx->from, &sipmsg->from.auri);
+	if (err)
+		goto out;
+
+	rx->mb = mbuf_alloc(mbuf_get_left(sipmsg->mb));
+	if (!rx->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mbuf_write_mem(rx->mb, mbuf_buf(sipmsg->mb),
+			     mbuf_get_left(sipmsg->mb));
+	if (err)
+		goto out;
+
+	rx->mb->pos = 0;
+
+	list_append(&msg.rxl, &rx->le, rx);
+	++msg.rxc;
+
+	if (!tmr_isrunning(&msg.tmr_rx))
+		tmr_start(&msg.tmr_rx, 0, rx_handler, NULL);
+
+ out:
+	if (err)
+		mem_deref(rx);
+
+	return err;
+}
+
+
+static void handle_message(struct ua *ua, const struct sip_msg *sipmsg)
+{
+	static const char ctype_text[] = "text/plain";
+	struct pl ctype_pl = {ctype_text, sizeof(ctype_text)-1};
+	int err;
+	(void)ua;
+
+	if (!msg_ctype_cmp(&sipmsg->ctyp, "text", "plain") || !msg.recvh) {
+		(void)sip_replyf(uag_sip(), sipmsg, 415,
+				 "Unsupported Media Type",
 				 "Accept: %s\r\n"
 				 "Content-Length: 0\r\n"
 				 "\r\n",
 				 ctype_text);
+		return;
+	}
+
+	if (!conf_config()->sip.msg_rxq) {
+		msg.recvh(&sipmsg->from.auri, &ctype_pl, sipmsg->mb,
+			  msg.recvarg);
+		(void)sip_reply(uag_sip(), sipmsg, 200, "OK");
+		return;
+	}
+
+	err = rx_queue(sipmsg);
+	if (err == EOVERFLOW) {
+		(void)sip_replyf(uag_sip(), sipmsg, 503,
+				 "Service Unavailable",
+				 "Retry-After: %u\r\n"
+				 "Content-Length: 0\r\n"
+				 "\r\n",
+				 RX_RETRY);
+	}
+	else if (err) {
+		(void)sip_reply(uag_sip(), sipmsg, 500, "Server Error");
+	}
+	else {
+		(void)sip_reply(uag_sip(), sipmsg, 200, "OK");
 	}
 }
 
 
-static bool request_handler(const struct sip_msg *msg, void *arg)
+static bool request_handler(const struct sip_msg *sipmsg, void *arg)
 {
 	struct ua *ua;
 
 	(void)arg;
 
-	if (pl_strcmp(&msg->met, "MESSAGE"))
+	if (pl_strcmp(&sipmsg->met, "MESSAGE"))
 		return false;
 
-	ua = uag_find(&msg->uri.user);
+	ua = uag_find(&sipmsg->uri.user);
 	if (!ua) {
-		(void)sip_treply(NULL, uag_sip(), msg, 404, "Not Found");
+		(void)sip_treply(NULL, uag_sip(), sipmsg, 404, "Not Found");
 		return true;
 	}
 
-	handle_message(ua, msg);
+	handle_message(ua, sipmsg);
 
 	return true;
 }
 
 
-static void resp_handler(int err, const struct sip_msg *msg, void *arg)
+static void peer_destructor(void *arg)
 {
-	struct ua *ua = arg;
+	struct msg_peer *peer = arg;
 
-	(void)ua;
+	hash_unlink(&peer->he);
+	list_flush(&peer->txl);
+	mem_deref(peer->uri);
+	mem_deref(peer->ua);
+
+	if (--msg.peerc == 0)
+		msg.peers = mem_deref(msg.peers);
+}
 
+
+static void tx_destructor(void *arg)
+{
+	struct msg_tx *tx = arg;
+
+	list_unlink(&tx->le);
+	mem_deref(tx->body);
+}
+
+
+static bool peer_cmp_handler(struct le *le, void *arg)
+{
+	const struct msg_peer *peer = le->data;
+	const struct msg_peer *key = arg;
+
+	return peer->ua == key->ua && 0 == str_cmp(peer->uri, key->uri);
+}
+
+
+static struct msg_peer *peer_find(struct ua *ua, const char *uri)
+{
+	struct msg_peer key;
+
+	key.ua  = ua;
+	key.uri = (char *)uri;
+
+	return list_ledata(hash_lookup(msg.peers, hash_joaat_str(uri),
+				       peer_cmp_handler, &key));
+}
+
+
+static int peer_alloc(struct msg_peer **peerp, struct ua *ua,
+		      const struct pl *uri)
+{
+	struct msg_peer *peer;
+	int err;
+
+	if (!msg.peers) {
+		err = hash_alloc(&msg.peers, HASH_SIZE);
+		if (err)
+			return err;
+	}
+
+	peer = mem_zalloc(sizeof(*peer), peer_destructor);
+	if (!peer)
+		return ENOMEM;
+
+	++msg.peerc;
+
+	peer->ua = mem_ref(ua);
+
+	err = pl_strdup(&peer->uri, uri);
 	if (err) {
-		(void)re_fprintf(stderr, " \x1b[31m%m\x1b[;m\n", err);
-		return;
+		mem_deref(peer);
+		return err;
 	}
 
-	if (msg->scode >= 300) {
+	hash_append(msg.peers, hash_joaat_str(peer->uri), &peer->he, peer);
+
+	*peerp = peer;
+
+	return 0;
+}
+
+
+static void peer_poll(struct msg_peer *peer);
+
+
+static void resp_handler(int err, const struct sip_msg *sipmsg, void *arg)
+{
+	struct msg_tx *tx = arg;
+	struct msg_peer *peer = tx->peer;
+
+	if (err) {
+		(void)re_fprintf(stderr, " \x1b[31m%m\x1b[;m\n", err);
+	}
+	else if (sipmsg->scode >= 300) {
 		(void)re_fprintf(stderr, " \x1b[31m%u %r\x1b[;m\n",
-				 msg->scode, &msg->reason);
+				 sipmsg->scode, &sipmsg->reason);
 	}
+
+	mem_deref(tx);
+
+	--peer->inflight;
+	peer_poll(peer);
+}
+
+
+/* Send the queued MESSAGEs, and free the peer when it is idle */
+static void peer_poll(struct msg_peer *peer)
+{
+	const uint32_t limit = conf_config()->sip.msg_inflight;
+
+	while (peer->txc && (!limit || peer->inflight < limit)) {
+
+		struct msg_tx *tx = list_ledata(list_head(&peer->txl));
+		int err;
+
+		list_unlink(&tx->le);
+		--peer->txc;
+
+		err = sip_req_send(peer->ua, "MESSAGE", peer->uri,
+				   resp_handler, tx,
+				   "Accept: text/plain\r\n"
+				   "Content-Type: text/plain\r\n"
+				   "Content-Length: %zu\r\n"
+				   "\r\n%s",
+				   str_len(tx->body), tx->body);
+		if (err) {
+			warning("message: send to %s failed: %m\n",
+				peer->uri, err);
+			mem_deref(tx);
+			continue;
+		}
+
+		++peer->inflight;
+	}
+
+	if (!peer->txc && !peer->inflight)
+		mem_deref(peer);
 }
 
 
@@ -76,12 +350,12 @@ int message_init(message_recv_h *h, void *arg)
 {
 	int err;
 
-	err = sip_listen(&lsnr, uag_sip(), true, request_handler, NULL);
+	err = sip_listen(&msg.lsnr, uag_sip(), true, request_handler, NULL);
 	if (err)
 		return err;
 
-	recvh   = h;
-	recvarg = arg;
+	msg.recvh   = h;
+	msg.recvarg = arg;
 
 	return 0;
 }
@@ -89,27 +363,37 @@ int message_init(message_recv_h *h, void *arg)
 
 void message_close(void)
 {
-	lsnr = mem_deref(lsnr);
+	tmr_cancel(&msg.tmr_rx);
+	list_flush(&msg.rxl);
+	msg.rxc = 0;
+
+	msg.lsnr = mem_deref(msg.lsnr);
 }
 
 
 /**
- * Send SIP instant MESSAGE to a peer
+ * Send SIP instant MESSAGE to a peer. The MESSAGE is queued, and sent
+ * when there are less than `sip_msg_inflight' MESSAGEs in progress to
+ * the peer.
  *
  * @param ua    User-Agent object
  * @param peer  Peer SIP Address
- * @param msg   Message to send
+ * @param body  Message to send
  *
- * @return 0 if success, otherwise errorcode
+ * @return 0 if success, ENOBUFS if the queue of the peer is full,
+ *         otherwise errorcode
  */
-int message_send(struct ua *ua, const char *peer, const char *msg)
+int message_send(struct ua *ua, const char *peer, const char *body)
 {
+	const uint32_t qmax = conf_config()->sip.msg_queue;
+	struct msg_peer *mp;
+	struct msg_tx *tx;
 	struct sip_addr addr;
 	struct pl pl;
 	char *uri = NULL;
 	int err = 0;
 
-	if (!ua || !peer || !msg)
+	if (!ua || !peer || !body)
 		return EINVAL;
 
 	pl_set_str(&pl, peer);
@@ -122,14 +406,37 @@ int message_send(struct ua *ua, const char *peer, const char *msg)
 	if (err)
 		return err;
 
-	err = sip_req_send(ua, "MESSAGE", uri, resp_handler, ua,
-			   "Accept: text/plain\r\n"
-			   "Content-Type: text/plain\r\n"
-			   "Content-Length: %zu\r\n"
-			   "\r\n%s",
-			   str_len(msg), msg);
-
+	mp = peer_find(ua, uri);
 	mem_deref(uri);
 
+	if (!mp) {
+		err = peer_alloc(&mp, ua, &addr.auri);
+		if (err)
+			return err;
+	}
+	else if (qmax && mp->txc >= qmax) {
+		return ENOBUFS;
+	}
+
+	tx = mem_zalloc(sizeof(*tx), tx_destructor);
+	if (!tx) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	tx->peer = mp;
+
+	err = str_dup(&tx->body, body);
+	if (err) {
+		mem_deref(tx);
+		goto out;
+	}
+
+	list_append(&mp->txl, &tx->le, tx);
+	++mp->txc;
+
+ out:
+	peer_poll(mp);
+
 	return err;
 }
@@ -3,19 +3,33 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <time.h>
 #include <re.h>
 #include <baresip.h>
 #include "core.h"
 
 
-enum {TMR_INTERVAL = 3};
+/*
+ * The counters and histograms are written from the media thread of the
+ * stream, and read from the main thread without locking.
+ */
+
+
+enum {
+	TMR_INTERVAL = 3,
+	PEAK_WINDOW  = 100000,  /**< Window for peak bitrate [us] */
+};
+
+
 static void tmr_handler(void *arg)
 {
 	struct metric *metric = arg;
 	const uint64_t now = tmr_jiffies();
+	uint32_t n_bytes;
 	uint32_t diff;
 
-	tmr_start(&metric->tmr, TMR_INTERVAL * 1000, tmr_handler, metric);
+	twheel_tmr_start(&metric->tmr, baresip_twheel(), TMR_INTERVAL * 1000,
+			 tmr_handler, metric);
 
 	if (!metric->started)
 		return;
@@ -23,15 +37,19 @@ static void tmr_handler(void *arg)
  	if (now <= metric->ts_last)
 		return;
 
+	n_bytes = ATOMIC_LOAD(&metric->n_bytes);
+
 	if (metric->ts_last) {
-		uint32_t bytes = metric->n_bytes - metric->n_bytes_last;
+		uint32_t bytes = n_bytes - metric->n_bytes_last;
 		diff = (uint32_t)(now - metric->ts_last);
 		metric->cur_bitrate = 1000 * 8 * bytes / diff;
 	}
 
+	metric->peak_bitrate = ATOMIC_XCHG(&metric->win_peak, 0);
+
 	/* Update counters */
 	metric->ts_last = now;
-	metric->n_bytes_last = metric->n_bytes;
+	metric->n_bytes_last = n_bytes;
 }
 
 
@@ -46,12 +64,28 @@ static void metric_start(struct metric *metric)
 }
 
 
+/**
+ * Get a monotonic time with microsecond resolution
+ *
+ * @return Time in [us]
+ */
+uint64_t metric_time_us(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
 void metric_init(struct metric *metric)
 {
 	if (!metric)
 		return;
 
-	tmr_start(&metric->tmr, 100, tmr_handler, metric);
+	twheel_tmr_start(&metric->tmr, baresip_twheel(), 100,
+			 tmr_handler, metric);
 }
 
 
@@ -60,20 +94,68 @@ void metric_reset(struct metric *metric)
 	if (!metric)
 		return;
 
-	tmr_cancel(&metric->tmr);
+	twheel_tmr_cancel(&metric->tmr);
 }
 
 
 void metric_add_packet(struct metric *metric, size_t packetsize)
 {
+	uint64_t now;
+
 	if (!metric)
 		return;
 
 	if (!metric->started)
 		metric_start(metric);
 
-	metric->n_bytes += (uint32_t)packetsize;
-	metric->n_packets++;
+	now = metric_time_us();
+
+	if (metric->ts_packet)
+		histo_add(&metric->h_iat, (uint32_t)(now - metric->ts_packet));
+	metric->ts_packet = now;
+
+	if (now - metric->win_start >= PEAK_WINDOW) {
+
+		if (metric->win_start) {
+			uint64_t rate = 8000000ULL * metric->win_bytes
+				/ (now - metric->win_start);
+
+			if (rate > ATOMIC_LOAD(&metric->win_peak))
+				ATOMIC_STORE(&metric->win_peak,
+					     (uint32_t)rate);
+		}
+
+		metric->win_start = now;
+		metric->win_bytes = 0;
+	}
+	metric->win_bytes += (uint32_t)packetsize;
+
+	ATOMIC_ADD(&metric->n_bytes, (uint32_t)packetsize);
+	ATOMIC_ADD(&metric->n_packets, 1);
+}
+
+
+void metric_add_err(struct metric *metric)
+{
+	if (!metric)
+		return;
+
+	ATOMIC_ADD(&metric->n_err, 1);
+}
+
+
+/**
+ * Add the time spent encoding or decoding one frame
+ *
+ * @param metric   Metric object
+ * @param ts_start Start time from metric_time_us()
+ */
+void metric_add_proc(struct metric *metric, uint64_t ts_start)
+{
+	if (!metric)
+		return;
+
+	histo_add(&metric->h_proc, (uint32_t)(metric_time_us() - ts_start));
 }
 
 
@@ -86,5 +168,26 @@ uint32_t metric_avg_bitrate(const struct metric *metric)
 
 	diff = (int)(tmr_jiffies() - metric->ts_start);
 
-	return 1000 * 8 * (metric->n_bytes / diff);
+	return 1000 * 8 * (ATOMIC_LOAD(&metric->n_bytes) / diff);
+}
+
+
+int metric_debug(struct re_printf *pf, const struct metric *metric)
+{
+	int err;
+
+	if (!metric)
+		return 0;
+
+	err  = re_hprintf(pf, "   bitrate=%u peak=%u bit/s\n",
+			  metric->cur_bitrate, metric->peak_bitrate);
+	err |= re_hprintf(pf, "   iat  [us] %H\n",
+			  histo_debug, &metric->h_iat);
+	if (histo_count(&metric->h_jbuf))
+		err |= re_hprintf(pf, "   jbuf [us] %H\n",
+				  histo_debug, &metric->h_jbuf);
+	err |= re_hprintf(pf, "   proc [us] %H\n",
+			  histo_debug, &metric->h_proc);
+
+	return err;
 }
@@ -8,13 +8,51 @@
 #include "core.h"
 
 
+/*
+ * Modules listed with module_lazy are loaded after the startup, one
+ * per run of the main loop, so that the UI and the registrations do
+ * not wait for them. This suits modules that only register codecs or
+ * drivers, which are not used before the first call.
+ *
+ * The time to load and initialise each module is kept for the 'N'
+ * command, and a module slower than `module_slow' is warned about.
+ * The shared object is opened and initialised in one call, so the
+ * time of a dynamic module includes both.
+ */
+
+
+enum {
+	SLOW_LOAD = 10000,     /**< Log module loads slower than this [us] */
+	SLOW_WARN = 100,       /**< Default of module_slow [ms]            */
+};
+
+
 struct modapp {
 	struct mod *mod;
 	struct le le;
 };
 
+struct modlazy {
+	struct le le;
+	char *name;
+	char *path;
+};
+
+/** Load time of a module */
+struct modtime {
+	struct le le;
+	char *name;
+	const char *type;     /**< module, module_app, ...        */
+	uint64_t usec;        /**< Time to load and init [us]     */
+	int err;
+};
+
 
 static struct list modappl;
+static struct list modlazyl;
+static struct list modtimel;
+static struct tmr tmr_lazy;
+static uint32_t slow_ms = SLOW_WARN;
 
 
 static void modapp_destructor(void *arg)
@@ -25,6 +63,45 @@ static void modapp_destructor(void *arg)
 }
 
 
+static void modlazy_destructor(void *arg)
+{
+	struct modlazy *ml = arg;
+	list_unlink(&ml->le);
+	mem_deref(ml->name);
+	mem_deref(ml->path);
+}
+
+
+static void modtime_destructor(void *arg)
+{
+	struct modtime *mt = arg;
+	list_unlink(&mt->le);
+	mem_deref(mt->name);
+}
+
+
+static void modtime_add(const struct pl *name, const char *type,
+			uint64_t usec, int err)
+{
+	struct modtime *mt;
+
+	mt = mem_zalloc(sizeof(*mt), modtime_destructor);
+	if (!mt)
+		return;
+
+	if (pl_strdup(&mt->name, name)) {
+		mem_deref(mt);
+		return;
+	}
+
+	mt->type = type;
+	mt->usec = usec;
+	mt->err  = err;
+
+	list_append(&modtimel, &mt->le, mt);
+}
+
+
 #ifdef STATIC
 
 /* Declared in static.c */
@@ -52,10 +129,11 @@ static const struct mod_export *find_module(const struct pl *pl)
 
 
 static int load_module(struct mod **modp, const struct pl *modpath,
-		       const struct pl *name)
+		       const struct pl *name, const char *type)
 {
 	char file[256];
 	struct mod *m = NULL;
+	uint64_t ts = metric_time_us();
 	int err = 0;
 
 	if (!name)
@@ -78,10 +156,23 @@ static int load_module(struct mod **modp, const struct pl *modpath,
 		goto out;
 
  out:
+	ts = metric_time_us() - ts;
+	modtime_add(name, type, ts, err);
+
 	if (err) {
 		warning("module %r: %m\n", name, err);
+		return err;
 	}
-	else if (modp)
+
+	if (slow_ms && ts > slow_ms * 1000ULL) {
+		warning("module %r: slow to load, %llu ms\n",
+			name, ts / 1000);
+	}
+	else if (ts > SLOW_LOAD) {
+		info("module %r: loaded in %llu ms\n", name, ts / 1000);
+	}
+
+	if (modp)
 		*modp = m;
 
 	return err;
@@ -90,7 +181,7 @@ static int load_module(struct mod **modp, const struct pl *modpath,
 
 static int module_handler(const struct pl *val, void *arg)
 {
-	(void)load_module(NULL, arg, val);
+	(void)load_module(NULL, arg, val, "module");
 	return 0;
 }
 
@@ -98,7 +189,7 @@ static int module_handler(const struct pl *val, void *arg)
 static int module_tmp_handler(const struct pl *val, void *arg)
 {
 	struct mod *mod = NULL;
-	(void)load_module(&mod, arg, val);
+	(void)load_module(&mod, arg, val, "module_tmp");
 	mem_deref(mod);
 	return 0;
 }
@@ -112,7 +203,7 @@ static int module_app_handler(const struct pl *val, void *arg)
 	if (!modapp)
 		return ENOMEM;
 
-	if (load_module(&modapp->mod, arg, val)) {
+	if (load_module(&modapp->mod, arg, val, "module_app")) {
 		mem_deref(modapp);
 		return 0;
 	}
@@ -123,6 +214,85 @@ static int module_app_handler(const struct pl *val, void *arg)
 }
 
 
+static void lazy_handler(void *arg)
+{
+	struct modlazy *ml = list_ledata(list_head(&modlazyl));
+	struct pl path, name;
+	(void)arg;
+
+	if (!ml)
+		return;
+
+	pl_set_str(&path, ml->path);
+	pl_set_str(&name, ml->name);
+
+	(void)load_module(NULL, &path, &name, "module_lazy");
+
+	mem_deref(ml);
+
+	if (!list_isempty(&modlazyl))
+		tmr_start(&tmr_lazy, 0, lazy_handler, NULL);
+	else
+		info("module: lazy modules loaded\n");
+}
+
+
+static int module_lazy_handler(const struct pl *val, void *arg)
+{
+	struct modlazy *ml;
+	int err;
+
+	ml = mem_zalloc(sizeof(*ml), modlazy_destructor);
+	if (!ml)
+		return ENOMEM;
+
+	err  = pl_strdup(&ml->name, val);
+	err |= pl_strdup(&ml->path, arg);
+	if (err) {
+		mem_deref(ml);
+		return err;
+	}
+
+	list_append(&modlazyl, &ml->le, ml);
+
+	return 0;
+}
+
+
+static int cmd_modtime(struct re_printf *pf, void *unused)
+{
+	uint64_t total = 0;
+	struct le *le;
+	int err;
+	(void)unused;
+
+	err = re_hprintf(pf, "\n--- Module load times ---\n");
+
+	for (le = modtimel.head; le; le = le->next) {
+
+		const struct modtime *mt = le->data;
+
+		err |= re_hprintf(pf, "  %-16s %-12s %6llu.%03llu ms%s%s\n",
+				  mt->name, mt->type,
+				  mt->usec / 1000, mt->usec % 1000,
+				  slow_ms && mt->usec > slow_ms * 1000ULL ?
+				  "  (slow)" : "",
+				  mt->err ? "  (failed)" : "");
+
+		total += mt->usec;
+	}
+
+	err |= re_hprintf(pf, "  total: %llu ms in %u modules\n",
+			  total / 1000, list_count(&modtimel));
+
+	return err;
+}
+
+
+static const struct cmd cmdv[] = {
+	{'N', 0, "Module load times", cmd_modtime},
+};
+
 int module_init(const struct conf *conf)
 {
 	struct pl path;
@@ -134,6 +304,12 @@ int module_init(const struct conf *conf)
 	if (conf_get(conf, "module_path", &path))
 		pl_set_str(&path, ".");
 
+	(void)conf_get_u32(conf, "module_slow", &slow_ms);
+
+	err = cmd_register(cmdv, ARRAY_SIZE(cmdv));
+	if (err)
+		return err;
+
 	err = conf_apply(conf, "module", module_handler, &path);
 	if (err)
 		return err;
@@ -146,13 +322,24 @@ int module_init(const struct conf *conf)
 	if (err)
 		return err;
 
+	err = conf_apply(conf, "module_lazy", module_lazy_handler, &path);
+	if (err)
+		return err;
+
+	if (!list_isempty(&modlazyl))
+		tmr_start(&tmr_lazy, 0, lazy_handler, NULL);
+
 	return 0;
 }
 
 
 void module_app_unload(void)
 {
+	cmd_unregister(cmdv);
+	tmr_cancel(&tmr_lazy);
+	list_flush(&modlazyl);
 	list_flush(&modappl);
+	list_flush(&modtimel);
 }
 
 
@@ -166,5 +353,6 @@ int module_preload(const char *module)
 	pl_set_str(&path, ".");
 	pl_set_str(&name, module);
 
-	return load_module(NULL, &path, &name);
+	return load_module(NULL, &path, &name, "preload");
 }
+
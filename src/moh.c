@@ -0,0 +1,343 @@
+/**
+ * @file moh.c  Music on hold
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * Held calls get their music from one shared audio source. Each frame
+ * is encoded once per codec in use, and the packet is sent on the
+ * streams of all held calls with that codec, so the work grows with
+ * the number of codecs and not with the number of calls. The source is
+ * opened with the first held call, closed with the last, and restarted
+ * at the end of the file.
+ *
+ * The source thread holds the lock while sending; members and groups
+ * are only added and removed by the main thread, under the lock.
+ */
+
+enum {
+	MOH_PTIME = 20,          /**< Packet time in [ms]            */
+	MOH_RESTART = 1000,      /**< Pause before the music repeats */
+};
+
+/** One encoder per codec */
+struct moh_group {
+	struct le le;
+	struct list membl;
+	const struct aucodec *ac;
+	struct auenc_state *enc;
+	struct resamp *rs;
+	int16_t *sampv;          /**< Resampled to the codec format */
+	size_t sampc;
+	struct mbuf *mb;
+};
+
+/** Held call, sent the packets of a group */
+struct moh_memb {
+	struct le le;
+	struct moh_group *grp;
+	struct audio *a;
+};
+
+static struct {
+	struct lock *lock;
+	struct list grpl;
+	struct ausrc_st *ausrc;
+	struct tmr tmr;
+} moh;
+
+
+static void group_send(struct moh_group *grp, const int16_t *sampv,
+		       size_t sampc)
+{
+	const struct aucodec *ac = grp->ac;
+	struct mbuf *mb = grp->mb;
+	size_t len;
+	struct le *le;
+	int err;
+
+	if (grp->rs) {
+		size_t sampc_rs = grp->sampc;
+
+		err = resamp_process(grp->rs, grp->sampv, &sampc_rs,
+				     sampv, sampc);
+		if (err)
+			return;
+
+		sampv = grp->sampv;
+		sampc = sampc_rs;
+	}
+
+	mb->pos = mb->end = STREAM_PRESZ;
+	len = mbuf_get_space(mb);
+
+	err = ac->ench(grp->enc, mbuf_buf(mb), &len, sampv, sampc);
+	if (err || !len)
+		return;
+
+	mb->end += len;
+
+	for (le = grp->membl.head; le; le = le->next) {
+
+		struct moh_memb *memb = le->data;
+
+		audio_moh_send(memb->a, mb, ac->crate * MOH_PTIME / 1000);
+	}
+}
+
+
+static void ausrc_read_handler(const int16_t *sampv, size_t sampc, void *arg)
+{
+	struct le *le;
+	(void)arg;
+
+	lock_write_get(moh.lock);
+
+	for (le = moh.grpl.head; le; le = le->next)
+		group_send(le->data, sampv, sampc);
+
+	lock_rel(moh.lock);
+}
+
+
+static int source_open(void);
+
+
+static void tmr_restart(void *arg)
+{
+	int err;
+	(void)arg;
+
+	moh.ausrc = mem_deref(moh.ausrc);
+
+	if (list_isempty(&moh.grpl))
+		return;
+
+	err = source_open();
+	if (err)
+		warning("moh: could not restart source (%m)\n", err);
+}
+
+
+static void ausrc_error_handler(int err, const char *str, void *arg)
+{
+	(void)arg;
+
+	info("moh: source stopped: %s (%m)\n", str, err);
+
+	/* the source can not be closed from its own handler */
+	tmr_start(&moh.tmr, MOH_RESTART, tmr_restart, NULL);
+}
+
+
+static int source_open(void)
+{
+	const struct config *cfg = conf_config();
+	struct ausrc_prm prm;
+
+	if (!cfg)
+		return ENOENT;
+
+	prm.srate   = cfg->audio.moh_srate;
+	prm.ch      = 1;
+	prm.ptime   = MOH_PTIME;
+	prm.latency = NULL;
+
+	return ausrc_alloc(&moh.ausrc, NULL, cfg->audio.moh_mod, &prm,
+			   cfg->audio.moh_dev, ausrc_read_handler,
+			   ausrc_error_handler, NULL);
+}
+
+
+static void group_destructor(void *arg)
+{
+	struct moh_group *grp = arg;
+
+	mem_deref(grp->enc);
+	mem_deref(grp->rs);
+	mem_deref(grp->sampv);
+	mem_deref(grp->mb);
+}
+
+
+static int group_alloc(struct moh_group **grpp, const struct aucodec *ac)
+{
+	const struct config *cfg = conf_config();
+	struct moh_group *grp;
+	int err = 0;
+
+	grp = mem_zalloc(sizeof(*grp), group_destructor);
+	if (!grp)
+		return ENOMEM;
+
+	grp->ac = ac;
+
+	grp->mb = mbuf_alloc(STREAM_PRESZ + 4096);
+	if (!grp->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	if (ac->encupdh) {
+		struct auenc_param prm;
+
+		prm.ptime = MOH_PTIME;
+
+		err = ac->encupdh(&grp->enc, ac, &prm, NULL);
+		if (err)
+			goto out;
+	}
+
+	if (ac->srate != cfg->audio.moh_srate || ac->ch != 1) {
+
+		grp->sampc = ac->srate * ac->ch * MOH_PTIME / 1000;
+
+		grp->sampv = mem_alloc(grp->sampc * sizeof(int16_t), NULL);
+		if (!grp->sampv) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		err = resamp_alloc(&grp->rs, cfg->audio.resamp,
+				   cfg->audio.moh_srate, 1,
+				   ac->srate, ac->ch);
+		if (err)
+			goto out;
+	}
+
+ out:
+	if (err)
+		mem_deref(grp);
+	else
+		*grpp = grp;
+
+	return err;
+}
+
+
+static void memb_destructor(void *arg)
+{
+	struct moh_memb *memb = arg;
+	struct moh_group *grp = memb->grp;
+	bool empty;
+
+	if (!grp)
+		return;
+
+	lock_write_get(moh.lock);
+
+	list_unlink(&memb->le);
+
+	empty = list_isempty(&grp->membl);
+	if (empty)
+		list_unlink(&grp->le);
+
+	lock_rel(moh.lock);
+
+	if (empty)
+		mem_deref(grp);
+
+	/* the last held call stops the music */
+	if (list_isempty(&moh.grpl)) {
+		tmr_cancel(&moh.tmr);
+		moh.ausrc = mem_deref(moh.ausrc);
+		moh.lock  = mem_deref(moh.lock);
+	}
+}
+
+
+static struct moh_group *group_find(const struct aucodec *ac)
+{
+	struct le *le;
+
+	for (le = moh.grpl.head; le; le = le->next) {
+
+		struct moh_group *grp = le->data;
+
+		if (grp->ac == ac)
+			return grp;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Start sending music on hold on an audio stream
+ *
+ * @param membp Pointer to allocated member, dereference to stop
+ * @param a     Audio object
+ * @param ac    Audio encoder of the stream
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int moh_join(struct moh_memb **membp, struct audio *a,
+	     const struct aucodec *ac)
+{
+	const struct config *cfg = conf_config();
+	struct moh_group *grp;
+	struct moh_memb *memb;
+	int err = 0;
+
+	if (!membp || !a || !ac || !ac->ench)
+		return EINVAL;
+
+	if (!cfg || !str_isset(cfg->audio.moh_mod))
+		return ENOENT;
+
+	if (!moh.lock) {
+		err = lock_alloc(&moh.lock);
+		if (err)
+			return err;
+	}
+
+	grp = group_find(ac);
+	if (!grp) {
+		err = group_alloc(&grp, ac);
+		if (err)
+			goto out;
+	}
+
+	memb = mem_zalloc(sizeof(*memb), memb_destructor);
+	if (!memb) {
+		if (!grp->le.list)
+			mem_deref(grp);
+		err = ENOMEM;
+		goto out;
+	}
+
+	memb->grp = grp;
+	memb->a   = a;
+
+	lock_write_get(moh.lock);
+
+	list_append(&grp->membl, &memb->le, memb);
+	if (!grp->le.list)
+		list_append(&moh.grpl, &grp->le, grp);
+
+	lock_rel(moh.lock);
+
+	if (!moh.ausrc && !tmr_isrunning(&moh.tmr)) {
+		err = source_open();
+		if (err) {
+			warning("moh: could not open source %s,%s (%m)\n",
+				cfg->audio.moh_mod, cfg->audio.moh_dev, err);
+			mem_deref(memb);
+			return err;
+		}
+	}
+
+	*membp = memb;
+
+ out:
+	if (err && list_isempty(&moh.grpl))
+		moh.lock = mem_deref(moh.lock);
+
+	return err;
+}
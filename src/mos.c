@@ -21,6 +21,30 @@ static double rfactor_to_mos(double r)
 }
 
 
+/* R-factor from the round-trip time, jitter in [ms] and the loss */
+static double rfactor_calc(double rtt, double jitter, double loss)
+{
+	double effective_latency = rtt + (jitter * 2) + 10;
+	double r;
+
+	if (effective_latency < 160) {
+		r = 93.2 - (effective_latency / 40);
+	}
+	else {
+		r = 93.2 - (effective_latency - 120) / 10;
+	}
+
+	r = r - (loss * 2.5);
+
+	if (r > 100)
+		r = 100;
+	else if (r < 0)
+		r = 0;
+
+	return r;
+}
+
+
 /**
  * Calculate Pseudo-MOS (Mean Opinion Score)
  *
@@ -36,28 +60,131 @@ static double rfactor_to_mos(double r)
 double mos_calculate(double *r_factor, double rtt,
 		     double jitter, uint32_t num_packets_lost)
 {
-	double effective_latency = rtt + (jitter * 2) + 10;
-	double mos_val;
-	double r;
+	double r = rfactor_calc(rtt, jitter, num_packets_lost);
 
-	if (effective_latency < 160) {
-		r = 93.2 - (effective_latency / 40);
+	if (r_factor)
+		*r_factor = r;
+
+	return rfactor_to_mos(r);
+}
+
+
+/*
+ * The continuous estimate of a received stream is updated every second
+ * from counters, so it costs the same whatever the packet rate:
+ *
+ *   loss    lost packets in [%] of the expected ones in that second,
+ *           smoothed with a weight of 1/MOSQ_WEIGHT for the new value
+ *   jitter  the interarrival jitter of RFC 3550 A.8, per packet
+ *   rtt     the round-trip time from the last RTCP report
+ *
+ * The alert is raised when the MOS falls below the threshold, and
+ * cleared when it is MOSQ_HYST above it again.
+ */
+
+#define MOSQ_WEIGHT 4
+#define MOSQ_HYST   0.1
+
+
+/**
+ * Add the arrival of an RTP packet to the jitter estimate
+ *
+ * @param mq    Quality estimate
+ * @param now   Arrival time in [us]
+ * @param ts    RTP timestamp of the packet
+ * @param srate RTP clock rate in [Hz]
+ */
+void mosq_packet(struct mosq *mq, uint64_t now, uint32_t ts, uint32_t srate)
+{
+	uint32_t transit;
+	int32_t d;
+
+	if (!mq || !srate)
+		return;
+
+	if (!mq->ts_base) {
+		mq->ts_base = now;
+		mq->srate   = srate;
 	}
-	else {
-		r = 93.2 - (effective_latency - 120) / 10;
+
+	transit = (uint32_t)((now - mq->ts_base) * mq->srate / 1000000) - ts;
+
+	if (mq->started) {
+		d = (int32_t)(transit - mq->transit);
+		if (d < 0)
+			d = -d;
+
+		/* J += (|D| - J) / 16, with J scaled by 16 */
+		mq->jit += (uint32_t)d - ((mq->jit + 8) >> 4);
 	}
 
-	r = r - (num_packets_lost * 2.5);
+	mq->transit = transit;
+	mq->started = true;
+}
 
-	if (r > 100)
-		r = 100;
-	else if (r < 0)
-		r = 0;
 
-	mos_val = rfactor_to_mos(r);
+/**
+ * Update the quality estimate, once per interval
+ *
+ * @param mq    Quality estimate
+ * @param rx    Packets received, in total
+ * @param lost  Packets lost, in total
+ * @param rtt   Round-trip time in [ms]
+ * @param alert MOS alert threshold, 0 is off
+ *
+ * @return True if the alert was raised or cleared
+ */
+bool mosq_update(struct mosq *mq, uint32_t rx, uint32_t lost, double rtt,
+		 double alert)
+{
+	struct stream_quality *q;
+	uint32_t d_rx, d_lost;
+	double loss;
+	bool was;
+
+	if (!mq)
+		return false;
 
-	if (r_factor)
-		*r_factor = r;
+	q      = &mq->q;
+	d_rx   = rx - mq->rx_prev;
+	d_lost = lost - mq->lost_prev;
+
+	mq->rx_prev   = rx;
+	mq->lost_prev = lost;
+
+	/* nothing was sent, e.g. on hold or with silence suppression */
+	if (!d_rx && !d_lost)
+		return false;
+
+	loss = 100.0 * d_lost / (d_rx + d_lost);
+
+	if (mq->valid)
+		q->loss += (loss - q->loss) / MOSQ_WEIGHT;
+	else
+		q->loss = loss;
+
+	q->jitter = mq->srate ? 1000.0 * (mq->jit >> 4) / mq->srate : 0;
+
+	q->r_factor = rfactor_calc(rtt, q->jitter, q->loss);
+	q->mos      = rfactor_to_mos(q->r_factor);
+
+	if (!mq->valid || q->mos < q->mos_min)
+		q->mos_min = q->mos;
+
+	mq->valid = true;
+
+	if (alert <= 0)
+		return false;
+
+	was = q->alert;
+
+	if (!q->alert && q->mos < alert) {
+		q->alert = true;
+		++q->n_alerts;
+	}
+	else if (q->alert && q->mos >= alert + MOSQ_HYST) {
+		q->alert = false;
+	}
 
-	return mos_val;
+	return q->alert != was;
 }
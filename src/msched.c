@@ -0,0 +1,522 @@
+/**
+ * @file msched.c  Shared media scheduler with a pool of worker threads
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#ifdef __linux__
+#define _GNU_SOURCE 1
+#endif
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/**
+ * \page MediaScheduler Media Scheduler
+ *
+ * The media scheduler runs periodic media jobs (e.g. audio encode and
+ * send) on a small pool of worker threads, instead of one thread per
+ * call. Each job has its own deadline and is owned by a home worker,
+ * which sleeps until its earliest deadline. A worker without any due
+ * jobs will steal overdue jobs from the other workers.
+ */
+
+
+enum {
+	IDLE_WAIT = 100,   /**< Max time to sleep without jobs [ms] */
+};
+
+
+struct msched_worker {
+	struct msched *ms;          /**< Parent                          */
+	pthread_t tid;              /**< Worker thread                   */
+	pthread_mutex_t mutex;      /**< Protects jobl and job state     */
+	pthread_cond_t cond;        /**< Job list changed / job finished */
+	struct list jobl;           /**< Jobs owned by this worker       */
+	unsigned idx;               /**< Worker index                    */
+	int cpu;                    /**< Pinned to CPU, -1 if not pinned */
+	bool started;               /**< Thread was started              */
+
+	/* statistics */
+	uint64_t n_run;             /**< Number of jobs executed         */
+	uint64_t n_steal;           /**< Number of jobs stolen           */
+	uint64_t n_late;            /**< Number of missed deadlines      */
+	uint64_t busy_us;           /**< Time spent running jobs [us]    */
+	uint64_t ts_start;          /**< Start time [us]                 */
+
+	/* last sample of msched_load() */
+	uint64_t busy_sample;       /**< Busy time at the sample [us]    */
+	uint64_t late_sample;       /**< Missed deadlines at the sample  */
+	uint64_t ts_sample;         /**< Time of the sample [us]         */
+};
+
+struct msched {
+	struct msched_worker *workerv;  /**< Worker threads              */
+	unsigned workerc;               /**< Number of worker threads    */
+	unsigned next;                  /**< Next worker for a new job   */
+	volatile bool run;              /**< Workers are running         */
+};
+
+struct msched_job {
+	struct le le;               /**< Member of worker job list       */
+	struct msched_worker *w;    /**< Home worker                     */
+	msched_h *h;                /**< Job handler                     */
+	void *arg;                  /**< Handler argument                */
+	uint64_t deadline;          /**< Next deadline [ms]              */
+	uint32_t interval;          /**< Job interval [ms]               */
+	bool running;               /**< Job handler is executing        */
+};
+
+
+static uint64_t time_us(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static uint64_t time_ms(void)
+{
+	return time_us() / 1000;
+}
+
+
+static void cond_wait_ms(struct msched_worker *w, uint32_t ms)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_REALTIME, &ts);
+
+	ts.tv_sec  += ms / 1000;
+	ts.tv_nsec += (long)(ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec  += 1;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	(void)pthread_cond_timedwait(&w->cond, &w->mutex, &ts);
+}
+
+
+/* must be called with the home worker's mutex held */
+static struct msched_job *earliest_job(const struct msched_worker *w)
+{
+	struct msched_job *best = NULL;
+	struct le *le;
+
+	for (le = w->jobl.head; le; le = le->next) {
+
+		struct msched_job *job = le->data;
+
+		if (job->running)
+			continue;
+
+		if (!best || job->deadline < best->deadline)
+			best = job;
+	}
+
+	return best;
+}
+
+
+/*
+ * Execute one job on worker `w`. The job's home worker mutex must be held
+ * on entry, and is held again on return.
+ */
+static void run_job(struct msched_worker *w, struct msched_job *job)
+{
+	struct msched_worker *home = job->w;
+	uint64_t t0, now;
+
+	job->running = true;
+	pthread_mutex_unlock(&home->mutex);
+
+	t0 = time_us();
+	job->h(job->arg);
+	now = time_us();
+
+	w->busy_us += now - t0;
+	++w->n_run;
+
+	pthread_mutex_lock(&home->mutex);
+
+	job->running = false;
+
+	/* Schedule next deadline, skip missed periods */
+	job->deadline += job->interval;
+	if (job->deadline <= now / 1000) {
+		++w->n_late;
+		job->deadline = now / 1000 + job->interval;
+	}
+
+	pthread_cond_broadcast(&home->cond);
+}
+
+
+/* Steal one overdue job from another worker, returns true if stolen */
+static bool steal_job(struct msched_worker *w, uint64_t now)
+{
+	struct msched *ms = w->ms;
+	unsigned i;
+
+	for (i=1; i<ms->workerc; i++) {
+
+		struct msched_worker *victim;
+		struct msched_job *job;
+
+		victim = &ms->workerv[(w->idx + i) % ms->workerc];
+
+		if (pthread_mutex_trylock(&victim->mutex))
+			continue;
+
+		job = earliest_job(victim);
+		if (job && job->deadline < now) {
+
+			++w->n_steal;
+			run_job(w, job);
+			pthread_mutex_unlock(&victim->mutex);
+
+			return true;
+		}
+
+		pthread_mutex_unlock(&victim->mutex);
+	}
+
+	return false;
+}
+
+
+static void *worker_thread(void *arg)
+{
+	struct msched_worker *w = arg;
+	struct msched *ms = w->ms;
+
+#ifdef __linux__
+	if (w->cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(w->cpu, &set);
+
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+			w->cpu = -1;
+	}
+#endif
+
+	w->ts_start = time_us();
+
+	pthread_mutex_lock(&w->mutex);
+
+	while (ms->run) {
+
+		struct msched_job *job;
+		uint64_t now = time_ms();
+
+		job = earliest_job(w);
+		if (job && job->deadline <= now) {
+			run_job(w, job);
+			continue;
+		}
+
+		/* Nothing due locally, help the other workers */
+		pthread_mutex_unlock(&w->mutex);
+		if (steal_job(w, now)) {
+			pthread_mutex_lock(&w->mutex);
+			continue;
+		}
+		pthread_mutex_lock(&w->mutex);
+
+		if (!ms->run)
+			break;
+
+		job = earliest_job(w);
+		if (job) {
+			now = time_ms();
+			if (job->deadline > now)
+				cond_wait_ms(w, (uint32_t)(job->deadline - now));
+		}
+		else {
+			cond_wait_ms(w, IDLE_WAIT);
+		}
+	}
+
+	pthread_mutex_unlock(&w->mutex);
+
+	return NULL;
+}
+
+
+static void msched_destructor(void *arg)
+{
+	struct msched *ms = arg;
+	unsigned i;
+
+	ms->run = false;
+
+	for (i=0; i<ms->workerc; i++) {
+
+		struct msched_worker *w = &ms->workerv[i];
+
+		if (!w->started)
+			continue;
+
+		pthread_mutex_lock(&w->mutex);
+		pthread_cond_broadcast(&w->cond);
+		pthread_mutex_unlock(&w->mutex);
+
+		pthread_join(w->tid, NULL);
+	}
+
+	for (i=0; i<ms->workerc; i++) {
+
+		struct msched_worker *w = &ms->workerv[i];
+
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->mutex);
+	}
+
+	mem_deref(ms->workerv);
+}
+
+
+static int cpu_count(void)
+{
+#if defined (_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (int)n : 1;
+#else
+	return 1;
+#endif
+}
+
+
+/**
+ * Allocate a media scheduler and start the worker threads
+ *
+ * @param msp      Pointer to allocated media scheduler
+ * @param nthreads Number of worker threads, 0 for one per CPU
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int msched_alloc(struct msched **msp, uint32_t nthreads)
+{
+	struct msched *ms;
+	int ncpu = cpu_count();
+	unsigned i;
+	int err = 0;
+
+	if (!msp)
+		return EINVAL;
+
+	if (!nthreads)
+		nthreads = ncpu;
+
+	ms = mem_zalloc(sizeof(*ms), msched_destructor);
+	if (!ms)
+		return ENOMEM;
+
+	ms->workerv = mem_zalloc(nthreads * sizeof(*ms->workerv), NULL);
+	if (!ms->workerv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	ms->workerc = nthreads;
+	ms->run     = true;
+
+	for (i=0; i<ms->workerc; i++) {
+
+		struct msched_worker *w = &ms->workerv[i];
+
+		w->ms  = ms;
+		w->idx = i;
+		w->cpu = (nthreads <= (unsigned)ncpu) ? (int)i : -1;
+
+		pthread_mutex_init(&w->mutex, NULL);
+		pthread_cond_init(&w->cond, NULL);
+	}
+
+	for (i=0; i<ms->workerc; i++) {
+
+		struct msched_worker *w = &ms->workerv[i];
+
+		err = pthread_create(&w->tid, NULL, worker_thread, w);
+		if (err)
+			goto out;
+
+		w->started = true;
+	}
+
+	info("msched: started %u media worker threads\n", ms->workerc);
+
+ out:
+	if (err)
+		mem_deref(ms);
+	else
+		*msp = ms;
+
+	return err;
+}
+
+
+static void job_destructor(void *arg)
+{
+	struct msched_job *job = arg;
+	struct msched_worker *w = job->w;
+
+	pthread_mutex_lock(&w->mutex);
+
+	/* wait for the handler to complete, if running */
+	while (job->running)
+		pthread_cond_wait(&w->cond, &w->mutex);
+
+	list_unlink(&job->le);
+
+	pthread_mutex_unlock(&w->mutex);
+
+	mem_deref(w->ms);
+}
+
+
+/**
+ * Add a periodic job to the media scheduler
+ *
+ * @param jobp     Pointer to allocated job
+ * @param ms       Media scheduler
+ * @param interval Job interval in [ms]
+ * @param h        Job handler, called from a worker thread
+ * @param arg      Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note The job must not be dereferenced from its own handler
+ */
+int msched_job_alloc(struct msched_job **jobp, struct msched *ms,
+		     uint32_t interval, msched_h *h, void *arg)
+{
+	struct msched_job *job;
+	struct msched_worker *w;
+
+	if (!jobp || !ms || !interval || !h)
+		return EINVAL;
+
+	job = mem_zalloc(sizeof(*job), job_destructor);
+	if (!job)
+		return ENOMEM;
+
+	/* distribute jobs evenly over the workers */
+	w = &ms->workerv[ms->next++ % ms->workerc];
+
+	job->w        = w;
+	job->h        = h;
+	job->arg      = arg;
+	job->interval = interval;
+	job->deadline = time_ms() + interval;
+
+	mem_ref(ms);
+
+	pthread_mutex_lock(&w->mutex);
+	list_append(&w->jobl, &job->le, job);
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+
+	*jobp = job;
+
+	return 0;
+}
+
+
+int msched_debug(struct re_printf *pf, const struct msched *ms)
+{
+	uint64_t now = time_us();
+	unsigned i;
+	int err;
+
+	if (!ms)
+		return 0;
+
+	err = re_hprintf(pf, " media scheduler: %u workers\n", ms->workerc);
+
+	for (i=0; i<ms->workerc; i++) {
+
+		struct msched_worker *w = &ms->workerv[i];
+		uint64_t elapsed = now - w->ts_start;
+		double load = 0.0;
+		uint32_t jobs;
+
+		pthread_mutex_lock(&w->mutex);
+		jobs = list_count(&w->jobl);
+		pthread_mutex_unlock(&w->mutex);
+
+		if (w->ts_start && elapsed)
+			load = 100.0 * w->busy_us / elapsed;
+
+		err |= re_hprintf(pf, "  worker %u: cpu=%d jobs=%u run=%llu"
+				  " stolen=%llu late=%llu load=%.2f%%\n",
+				  i, w->cpu, jobs, w->n_run, w->n_steal,
+				  w->n_late, load);
+	}
+
+	return err;
+}
+
+
+/**
+ * Sample the load of the media scheduler since the last sample
+ *
+ * @param ms       Media scheduler
+ * @param load_max Returned load of the busiest worker in [%]
+ * @param late     Returned number of missed deadlines of all workers
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int msched_load(struct msched *ms, uint32_t *load_max, uint32_t *late)
+{
+	uint64_t now = time_us();
+	uint32_t lmax = 0, nlate = 0;
+	unsigned i;
+
+	if (!ms)
+		return EINVAL;
+
+	for (i=0; i<ms->workerc; i++) {
+
+		struct msched_worker *w = &ms->workerv[i];
+		uint64_t busy = w->busy_us;
+		uint64_t n_late = w->n_late;
+		uint64_t since = w->ts_sample ? w->ts_sample : w->ts_start;
+
+		if (since && now > since) {
+			uint64_t load = (busy - w->busy_sample) * 100
+				/ (now - since);
+
+			lmax = max(lmax, (uint32_t)min(load, 100));
+		}
+
+		nlate += (uint32_t)(n_late - w->late_sample);
+
+		w->busy_sample = busy;
+		w->late_sample = n_late;
+		w->ts_sample   = now;
+	}
+
+	if (load_max)
+		*load_max = lmax;
+	if (late)
+		*late = nlate;
+
+	return 0;
+}
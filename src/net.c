@@ -8,6 +8,14 @@
 #include "core.h"
 
 
+enum {
+	NETMON_DELAY  = 100, /**< Wait for more changes [ms]        */
+	NAT_MAX       =   8, /**< Cached NAT behaviours             */
+	KEEPALIVE_MIN =   5, /**< Shortest keepalive interval [s]   */
+	KEEPALIVE_MAX = 600, /**< Longest keepalive interval [s]    */
+};
+
+
 struct network {
 	struct config_net cfg;
 	struct sa laddr;
@@ -17,12 +25,16 @@ struct network {
 	char ifname6[16];
 #endif
 	struct tmr tmr;
+	struct tmr tmr_mon;  /**< Coalesces the monitor events      */
+	struct netmon *mon;  /**< Event-driven change detection     */
 	struct dnsc *dnsc;
+	struct dnscache *dnscache; /**< Caching forwarder, optional   */
 	struct sa nsv[NET_MAX_NS];/**< Configured name servers      */
 	uint32_t nsn;        /**< Number of configured name servers */
 	uint32_t interval;
 	int af;              /**< Preferred address family          */
 	char domain[64];     /**< DNS domain from network           */
+	struct list natl;    /**< NAT behaviour by local address    */
 	net_change_h *ch;
 	void *arg;
 };
@@ -101,7 +113,10 @@ static void dns_refresh(struct network *net)
 	if (err)
 		return;
 
-	(void)dnsc_srv_set(net->dnsc, nsv, nsn);
+	if (net->dnscache)
+		(void)dnscache_srv_set(net->dnscache, nsv, nsn);
+	else
+		(void)dnsc_srv_set(net->dnsc, nsv, nsn);
 }
 
 
@@ -124,6 +139,26 @@ static void ipchange_handler(void *arg)
 }
 
 
+static void mon_tmr_handler(void *arg)
+{
+	struct network *net = arg;
+
+	dns_refresh(net);
+
+	if (net_check(net) && net->ch)
+		net->ch(net->arg);
+}
+
+
+/* An address or a route changed, check when the burst is over */
+static void netmon_handler(void *arg)
+{
+	struct network *net = arg;
+
+	tmr_start(&net->tmr_mon, NETMON_DELAY, mon_tmr_handler, net);
+}
+
+
 /**
  * Check if local IP address(es) changed
  *
@@ -189,6 +224,17 @@ static int dns_init(struct network *net)
 	if (err)
 		return err;
 
+	/* the DNS client asks the cache, which asks the name servers */
+	if (net->cfg.dns_cache) {
+
+		err = dnscache_alloc(&net->dnscache, nsv, nsn);
+		if (err)
+			return err;
+
+		return dnsc_alloc(&net->dnsc, NULL,
+				  dnscache_laddr(net->dnscache), 1);
+	}
+
 	return dnsc_alloc(&net->dnsc, NULL, nsv, nsn);
 }
 
@@ -209,7 +255,11 @@ static void net_destructor(void *data)
 	struct network *net = data;
 
 	tmr_cancel(&net->tmr);
+	tmr_cancel(&net->tmr_mon);
+	mem_deref(net->mon);
 	mem_deref(net->dnsc);
+	mem_deref(net->dnscache);
+	list_flush(&net->natl);
 }
 
 
@@ -391,6 +441,11 @@ int net_use_nameserver(struct network *net, const struct sa *ns)
 	if (!net || !ns)
 		return EINVAL;
 
+	if (net->dnscache) {
+		dnscache_flush(net->dnscache);
+		return dnscache_srv_set(net->dnscache, ns, 1);
+	}
+
 	err = dnsc_alloc(&dnsc, NULL, ns, 1);
 	if (err)
 		return err;
@@ -403,7 +458,9 @@ int net_use_nameserver(struct network *net, const struct sa *ns)
 
 
 /**
- * Check for networking changes with a regular interval
+ * Check for networking changes with a regular interval. Where the
+ * system tells about changes of the addresses and routes, they are
+ * also checked right after such a change.
  *
  * @param net       Network instance
  * @param interval  Interval in seconds
@@ -413,6 +470,8 @@ int net_use_nameserver(struct network *net, const struct sa *ns)
 void net_change(struct network *net, uint32_t interval,
 		net_change_h *ch, void *arg)
 {
+	int err;
+
 	if (!net)
 		return;
 
@@ -424,6 +483,16 @@ void net_change(struct network *net, uint32_t interval,
 		tmr_start(&net->tmr, interval * 1000, ipchange_handler, net);
 	else
 		tmr_cancel(&net->tmr);
+
+	if (ch && !net->mon) {
+		err = netmon_alloc(&net->mon, netmon_handler, net);
+		if (err && err != ENOSYS)
+			warning("net: network monitor: %m\n", err);
+	}
+	else if (!ch) {
+		tmr_cancel(&net->tmr_mon);
+		net->mon = mem_deref(net->mon);
+	}
 }
 
 
@@ -454,6 +523,8 @@ static int dns_debug(struct re_printf *pf, const struct network *net)
 	for (i=0; i<nsn; i++)
 		err |= re_hprintf(pf, "   %u: %J\n", i, &nsv[i]);
 
+	err |= dnscache_debug(pf, net->dnscache);
+
 	return err;
 }
 
@@ -467,6 +538,178 @@ int net_af(const struct network *net)
 }
 
 
+/*
+ * NAT behaviour, as found by NAT Behavior Discovery, is cached by local
+ * address, so that it is still known when the host moves back to a
+ * network it was in before. The keepalive interval of the media is
+ * derived from the binding lifetime of the NAT.
+ */
+
+struct natent {
+	struct le le;
+	struct sa laddr;
+	struct nat_behavior nb;
+};
+
+
+static void natent_destructor(void *arg)
+{
+	struct natent *ne = arg;
+
+	list_unlink(&ne->le);
+}
+
+
+static struct natent *natent_find(const struct network *net,
+				  const struct sa *laddr)
+{
+	struct le *le;
+
+	for (le = list_head(&net->natl); le; le = le->next) {
+
+		struct natent *ne = le->data;
+
+		if (sa_cmp(&ne->laddr, laddr, SA_ADDR))
+			return ne;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Set the NAT behaviour of a local address
+ *
+ * @param net   Network instance
+ * @param laddr Local address
+ * @param nb    NAT behaviour
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int net_nat_set(struct network *net, const struct sa *laddr,
+		const struct nat_behavior *nb)
+{
+	struct natent *ne;
+
+	if (!net || !sa_isset(laddr, SA_ADDR) || !nb)
+		return EINVAL;
+
+	ne = natent_find(net, laddr);
+	if (!ne) {
+		/* forget the address that was updated first */
+		if (list_count(&net->natl) >= NAT_MAX) {
+
+			struct natent *old = NULL;
+			struct le *le;
+
+			for (le = list_head(&net->natl); le; le = le->next) {
+
+				struct natent *e = le->data;
+
+				if (!old || e->nb.updated < old->nb.updated)
+					old = e;
+			}
+
+			mem_deref(old);
+		}
+
+		ne = mem_zalloc(sizeof(*ne), natent_destructor);
+		if (!ne)
+			return ENOMEM;
+
+		sa_cpy(&ne->laddr, laddr);
+		sa_set_port(&ne->laddr, 0);
+		list_append(&net->natl, &ne->le, ne);
+	}
+
+	ne->nb = *nb;
+	ne->nb.updated = tmr_jiffies();
+
+	return 0;
+}
+
+
+/**
+ * Get the NAT behaviour of a local address
+ *
+ * @param net   Network instance
+ * @param laddr Local address
+ *
+ * @return NAT behaviour, or NULL if not known
+ */
+const struct nat_behavior *net_nat_get(const struct network *net,
+				       const struct sa *laddr)
+{
+	const struct natent *ne;
+
+	if (!net || !sa_isset(laddr, SA_ADDR))
+		return NULL;
+
+	ne = natent_find(net, laddr);
+
+	return ne ? &ne->nb : NULL;
+}
+
+
+/**
+ * Get the interval of UDP keepalives that holds the NAT bindings of the
+ * local address of an address family. It is shorter than the binding
+ * lifetime, or the default if the lifetime is not known.
+ *
+ * @param net  Network instance
+ * @param af   Address family
+ * @param dflt Default interval in [seconds]
+ *
+ * @return Keepalive interval in [seconds]
+ */
+uint32_t net_keepalive(const struct network *net, int af, uint32_t dflt)
+{
+	const struct nat_behavior *nb;
+	uint32_t ka;
+
+	nb = net_nat_get(net, net_laddr_af(net, af));
+	if (!nb || !nb->lifetime)
+		return dflt;
+
+	/* a margin for timer and NAT inaccuracy */
+	ka = nb->lifetime * 4 / 5;
+
+	/* while probing, the lifetime is only a lower bound */
+	if (!nb->lifetime_final && ka < dflt)
+		return dflt;
+
+	return min(max(ka, (uint32_t)KEEPALIVE_MIN), (uint32_t)KEEPALIVE_MAX);
+}
+
+
+static int nat_debug(struct re_printf *pf, const struct network *net)
+{
+	struct le *le;
+	int err = 0;
+
+	if (list_isempty(&net->natl))
+		return 0;
+
+	err |= re_hprintf(pf, " NAT behaviour:\n");
+
+	for (le = list_head(&net->natl); le; le = le->next) {
+
+		const struct natent *ne = le->data;
+
+		err |= re_hprintf(pf, "  %j: mapping=%s filtering=%s"
+				  " lifetime=%u%s (%llu seconds ago)\n",
+				  &ne->laddr,
+				  nat_type_str(ne->nb.mapping),
+				  nat_type_str(ne->nb.filtering),
+				  ne->nb.lifetime,
+				  ne->nb.lifetime_final ? "" : "+",
+				  (tmr_jiffies() - ne->nb.updated) / 1000);
+	}
+
+	return err;
+}
+
+
 /**
  * Print networking debug information
  *
@@ -498,6 +741,8 @@ int net_debug(struct re_printf *pf, const struct network *net)
 
 	err |= dns_debug(pf, net);
 
+	err |= nat_debug(pf, net);
+
 	return err;
 }
 
@@ -556,3 +801,4 @@ const char *net_domain(const struct network *net)
 
 	return net->domain[0] ? net->domain : NULL;
 }
+
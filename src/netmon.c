@@ -0,0 +1,227 @@
+/**
+ * @file netmon.c  Network change monitor
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#ifdef LINUX
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+#if defined(DARWIN) || defined(FREEBSD) || defined(OPENBSD) || \
+	defined(NETBSD)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <net/route.h>
+#define HAVE_ROUTE_SOCKET 1
+#endif
+#if defined(LINUX) || defined(HAVE_ROUTE_SOCKET)
+#include <unistd.h>
+#include <errno.h>
+#endif
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The kernel sends a message when an address or a route is added or
+ * removed, on a netlink socket on Linux and on a routing socket on the
+ * BSDs and macOS. The socket is read from the main loop, and the
+ * handler is called once for each batch of messages.
+ */
+
+
+enum {
+	BUF_SIZE = 8192,
+};
+
+struct netmon {
+	int fd;
+	netmon_h *h;
+	void *arg;
+};
+
+
+static void destructor(void *arg)
+{
+	struct netmon *nm = arg;
+
+#if defined(LINUX) || defined(HAVE_ROUTE_SOCKET)
+	if (nm->fd >= 0) {
+		fd_close(nm->fd);
+		(void)close(nm->fd);
+	}
+#else
+	(void)nm;
+#endif
+}
+
+
+#ifdef LINUX
+static bool is_change(const uint8_t *buf, size_t len)
+{
+	const struct nlmsghdr *nlh = (const struct nlmsghdr *)(void *)buf;
+	int n = (int)len;
+
+	for (; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n)) {
+
+		switch (nlh->nlmsg_type) {
+
+		case RTM_NEWADDR:
+		case RTM_DELADDR:
+		case RTM_NEWROUTE:
+		case RTM_DELROUTE:
+			return true;
+
+		default:
+			break;
+		}
+	}
+
+	return false;
+}
+
+
+static int sock_open(void)
+{
+	struct sockaddr_nl sa;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if (fd < 0)
+		return -1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+		RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		(void)close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+#elif defined(HAVE_ROUTE_SOCKET)
+static bool is_change(const uint8_t *buf, size_t len)
+{
+	const struct rt_msghdr *rtm;
+	size_t pos = 0;
+
+	while (pos + sizeof(*rtm) <= len) {
+
+		rtm = (const struct rt_msghdr *)(void *)&buf[pos];
+		if (!rtm->rtm_msglen)
+			break;
+
+		switch (rtm->rtm_type) {
+
+		case RTM_NEWADDR:
+		case RTM_DELADDR:
+		case RTM_ADD:
+		case RTM_DELETE:
+		case RTM_IFINFO:
+			return true;
+
+		default:
+			break;
+		}
+
+		pos += rtm->rtm_msglen;
+	}
+
+	return false;
+}
+
+
+static int sock_open(void)
+{
+	return socket(PF_ROUTE, SOCK_RAW, AF_UNSPEC);
+}
+#endif
+
+
+#if defined(LINUX) || defined(HAVE_ROUTE_SOCKET)
+static void read_handler(int flags, void *arg)
+{
+	struct netmon *nm = arg;
+	uint8_t buf[BUF_SIZE];
+	bool change = false;
+	ssize_t n;
+	(void)flags;
+
+	for (;;) {
+		n = read(nm->fd, buf, sizeof(buf));
+		if (n <= 0)
+			break;
+
+		if (is_change(buf, (size_t)n))
+			change = true;
+	}
+
+	if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		warning("netmon: read: %m\n", errno);
+		fd_close(nm->fd);
+	}
+
+	if (change)
+		nm->h(nm->arg);
+}
+#endif
+
+
+/**
+ * Monitor the local addresses and routes
+ *
+ * @param nmp Pointer to allocated network monitor
+ * @param h   Handler called after a change
+ * @param arg Handler argument
+ *
+ * @return 0 if success, ENOSYS if not supported, otherwise errorcode
+ */
+int netmon_alloc(struct netmon **nmp, netmon_h *h, void *arg)
+{
+	struct netmon *nm;
+	int err = 0;
+
+	if (!nmp || !h)
+		return EINVAL;
+
+	nm = mem_zalloc(sizeof(*nm), destructor);
+	if (!nm)
+		return ENOMEM;
+
+	nm->fd  = -1;
+	nm->h   = h;
+	nm->arg = arg;
+
+#if defined(LINUX) || defined(HAVE_ROUTE_SOCKET)
+	nm->fd = sock_open();
+	if (nm->fd < 0) {
+		err = errno;
+		goto out;
+	}
+
+	err = net_sockopt_blocking_set(nm->fd, false);
+	if (err)
+		goto out;
+
+	err = fd_listen(nm->fd, FD_READ, read_handler, nm);
+	if (err)
+		goto out;
+#else
+	err = ENOSYS;
+	goto out;
+#endif
+
+ out:
+	if (err)
+		mem_deref(nm);
+	else
+		*nmp = nm;
+
+	return err;
+}
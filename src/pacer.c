@@ -0,0 +1,180 @@
+/**
+ * @file pacer.c  Token-bucket pacer for outgoing media packets
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <time.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The bucket is refilled with tokens (bytes) at the pacing rate, which is
+ * the target bitrate multiplied by the pacing factor, and holds at most
+ * `burst' bytes. A packet may be sent as long as the bucket is not empty;
+ * the bucket goes into debt for the part of the packet that exceeds it.
+ */
+
+struct pacer {
+	uint64_t rate;           /**< Pacing rate [bit/s]                */
+	uint32_t bitrate;        /**< Target bitrate [bit/s]             */
+	uint32_t factor;         /**< Pacing factor [percent]            */
+	int64_t burst;           /**< Bucket size [bytes]                */
+	int64_t tokens;          /**< Current tokens [bytes]             */
+	int64_t frac;            /**< Remainder of refill [bit*us]       */
+	uint64_t ts;             /**< Time of last refill [us]           */
+	uint64_t n_bytes;        /**< Total bytes sent                   */
+	uint32_t n_block;        /**< Number of times the bucket was empty */
+};
+
+
+static uint64_t pacer_time_us(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void refill(struct pacer *p)
+{
+	uint64_t now = pacer_time_us();
+	uint64_t dt = now - p->ts;
+	int64_t bits;
+
+	p->ts = now;
+
+	/* keep the sub-byte remainder for the next refill */
+	bits     = (int64_t)(dt * p->rate) + p->frac;
+	p->frac  = bits % (8 * 1000000);
+	p->tokens += bits / (8 * 1000000);
+
+	if (p->tokens > p->burst) {
+		p->tokens = p->burst;
+		p->frac   = 0;
+	}
+}
+
+
+/**
+ * Allocate a new token-bucket pacer
+ *
+ * @param pacerp  Pointer to allocated pacer
+ * @param bitrate Target bitrate in [bit/s]
+ * @param factor  Pacing factor in percent of the target bitrate
+ * @param burst   Maximum burst size in [bytes]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int pacer_alloc(struct pacer **pacerp, uint32_t bitrate, uint32_t factor,
+		size_t burst)
+{
+	struct pacer *p;
+
+	if (!pacerp || !factor || !burst)
+		return EINVAL;
+
+	p = mem_zalloc(sizeof(*p), NULL);
+	if (!p)
+		return ENOMEM;
+
+	p->factor = factor;
+	p->burst  = burst;
+	p->tokens = burst;
+	p->ts     = pacer_time_us();
+
+	pacer_set_bitrate(p, bitrate);
+
+	*pacerp = p;
+
+	return 0;
+}
+
+
+/**
+ * Set the target bitrate of the pacer
+ *
+ * @param p       Pacer
+ * @param bitrate Target bitrate in [bit/s]
+ */
+void pacer_set_bitrate(struct pacer *p, uint32_t bitrate)
+{
+	if (!p)
+		return;
+
+	refill(p);
+
+	p->bitrate = bitrate;
+	p->rate    = (uint64_t)bitrate * p->factor / 100;
+}
+
+
+/**
+ * Check if a packet may be sent now
+ *
+ * @param p Pacer
+ *
+ * @return True if sending is allowed, otherwise false
+ */
+bool pacer_allow(struct pacer *p)
+{
+	if (!p)
+		return true;
+
+	refill(p);
+
+	if (p->tokens > 0)
+		return true;
+
+	++p->n_block;
+
+	return false;
+}
+
+
+/**
+ * Account for a packet that was sent
+ *
+ * @param p   Pacer
+ * @param len Packet length in [bytes]
+ */
+void pacer_sent(struct pacer *p, size_t len)
+{
+	if (!p)
+		return;
+
+	p->tokens  -= len;
+	p->n_bytes += len;
+}
+
+
+/**
+ * Get the time it takes to send a number of bytes at the target bitrate
+ *
+ * @param p   Pacer
+ * @param len Number of bytes
+ *
+ * @return Send duration in [ms]
+ */
+uint32_t pacer_delay(const struct pacer *p, size_t len)
+{
+	if (!p || !p->bitrate)
+		return 0;
+
+	return (uint32_t)((uint64_t)len * 8 * 1000 / p->bitrate);
+}
+
+
+int pacer_debug(struct re_printf *pf, const struct pacer *p)
+{
+	if (!p)
+		return 0;
+
+	return re_hprintf(pf, "pacer: rate=%llu bit/s (%u%%) burst=%lld"
+			  " tokens=%lld sent=%llu blocked=%u",
+			  p->rate, p->factor, p->burst, p->tokens,
+			  p->n_bytes, p->n_block);
+}
@@ -5,24 +5,83 @@
  */
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
 #include "core.h"
 
 
+/*
+ * All players of one device and format are mixed into one audio
+ * stream, opened by the first player and closed by the last. The
+ * player thread advances the players and repeats them after a pause;
+ * a player that is done is stopped from the main thread, woken up
+ * through a message queue.
+ *
+ * Tones played from files are decoded once and kept in a cache, keyed
+ * by path, which all players of the same file share. The samples of a
+ * cached tone are never written after loading, so players read them
+ * without locking. A tone is loaded again when the modification time
+ * or size of its file changes; players of the old tone keep it until
+ * they stop.
+ *
+ * Large 16-bit WAV files on a little-endian host are not decoded, but
+ * mapped into memory and played from the page cache.
+ */
+
 enum {SILENCE_DUR = 2000, PTIME = 40};
 
+enum {TONE_MMAP_MIN = 65536};  /**< Smallest file to map, in [bytes] */
+
+/** Decoded audio file, shared by players */
+struct tone {
+	struct le le;
+	char *path;
+	struct mbuf *mb;          /**< Decoded samples, if not mapped */
+	void *map;                /**< Mapped file, if not decoded    */
+	size_t maplen;
+	const int16_t *sampv;
+	size_t sampc;
+	uint32_t srate;
+	uint8_t ch;
+	time_t mtime;
+	off_t size;
+};
+
+/** Mixer of the players on one device, with one audio stream */
+struct mixer {
+	struct le le;
+	struct list playl;        /**< Players, changed under the lock */
+	struct lock *lock;
+	struct auplay_st *auplay;
+	char mod[16];
+	char dev[128];
+	uint32_t srate;
+	uint8_t ch;
+};
+
 /** Audio file player */
 struct play {
 	struct le le;
+	struct le le_mix;
 	struct play **playp;
-	struct lock *lock;
-	struct mbuf *mb;
-	struct auplay_st *auplay;
-	struct tmr tmr;
+	struct mixer *mix;
+	void *data;               /**< Owner of the samples */
+	const int16_t *sampv;
+	size_t sampc;
+	size_t pos;               /**< Next sample, player thread only */
+	size_t silence;           /**< Samples of silence before repeat */
 	int repeat;
-	bool eof;
+	bool done;                /**< Finished playing (atomic)  */
 };
 
 
@@ -31,52 +90,61 @@ struct play {
 #endif
 static char play_path[256] = PREFIX "/share/baresip";
 static struct list playl;
+static struct list mixl;        /**< Open mixers */
+static struct list tonel;       /**< Cached tones */
+static struct mqueue *mq;       /**< Players done, from player threads */
 
 
-static void tmr_polling(void *arg);
-
-
-static void tmr_stop(void *arg)
+static inline int16_t saturate(int32_t v)
 {
-	struct play *play = arg;
-	mem_deref(play);
+	return (int16_t)min(max(v, -32768), 32767);
 }
 
 
-static void tmr_repeat(void *arg)
+/* mix the next samples of a player into sampv, player thread only */
+static void play_mix(struct play *play, int16_t *sampv, size_t sampc)
 {
-	struct play *play = arg;
-
-	lock_write_get(play->lock);
+	while (sampc && !ATOMIC_LOAD(&play->done)) {
 
-	play->mb->pos = 0;
-	play->eof = false;
+		const int16_t *tone = play->sampv + play->pos;
+		size_t i, n;
 
-	tmr_start(&play->tmr, 1000, tmr_polling, arg);
+		if (play->silence) {
+			n = min(sampc, play->silence);
 
-	lock_rel(play->lock);
-}
+			play->silence -= n;
+			sampv += n;
+			sampc -= n;
+			continue;
+		}
 
+		n = min(sampc, play->sampc - play->pos);
 
-static void tmr_polling(void *arg)
-{
-	struct play *play = arg;
+		for (i=0; i<n; i++)
+			sampv[i] = saturate(sampv[i] + tone[i]);
 
-	lock_write_get(play->lock);
+		play->pos += n;
+		sampv += n;
+		sampc -= n;
 
-	tmr_start(&play->tmr, 1000, tmr_polling, arg);
+		if (play->pos < play->sampc)
+			continue;
 
-	if (play->eof) {
 		if (play->repeat > 0)
 			play->repeat--;
 
-		if (play->repeat == 0)
-			tmr_start(&play->tmr, 1, tmr_stop, arg);
-		else
-			tmr_start(&play->tmr, SILENCE_DUR, tmr_repeat, arg);
-	}
+		if (play->repeat == 0) {
+			ATOMIC_STORE(&play->done, true);
+			(void)mqueue_push(mq, 0, NULL);
+		}
+		else {
+			const struct mixer *mix = play->mix;
 
-	lock_rel(play->lock);
+			play->pos = 0;
+			play->silence = (size_t)SILENCE_DUR * mix->srate *
+				mix->ch / 1000;
+		}
+	}
 }
 
 
@@ -85,31 +153,107 @@ static void tmr_polling(void *arg)
  */
 static void write_handler(int16_t *sampv, size_t sampc, void *arg)
 {
-	struct play *play = arg;
-	size_t sz = sampc * 2;
+	struct mixer *mix = arg;
+	struct le *le;
+
+	memset(sampv, 0, sampc * 2);
+
+	lock_write_get(mix->lock);
+
+	for (le = mix->playl.head; le; le = le->next)
+		play_mix(le->data, sampv, sampc);
+
+	lock_rel(mix->lock);
+}
 
-	lock_write_get(play->lock);
 
-	if (play->eof)
-		goto silence;
+/* stop the players that are done, in the main thread */
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	struct le *le;
+	(void)id;
+	(void)data;
+	(void)arg;
 
-	if (mbuf_get_left(play->mb) < sz) {
+	le = playl.head;
+	while (le) {
+		struct play *play = le->data;
 
-		memset(sampv, 0, sz);
-		(void)mbuf_read_mem(play->mb, (void *)sampv,
-				    mbuf_get_left(play->mb));
+		le = le->next;
 
-		play->eof = true;
+		if (ATOMIC_LOAD(&play->done))
+			mem_deref(play);
 	}
-	else {
-		(void)mbuf_read_mem(play->mb, (void *)sampv, sz);
+}
+
+
+static void mixer_destructor(void *arg)
+{
+	struct mixer *mix = arg;
+
+	list_unlink(&mix->le);
+
+	mem_deref(mix->auplay);
+	mem_deref(mix->lock);
+}
+
+
+static int mixer_get(struct mixer **mixp, uint32_t srate, uint8_t ch)
+{
+	const struct config *cfg = conf_config();
+	struct auplay_prm wprm;
+	struct mixer *mix;
+	struct le *le;
+	int err;
+
+	if (!cfg)
+		return ENOENT;
+
+	for (le = mixl.head; le; le = le->next) {
+
+		mix = le->data;
+
+		if (mix->srate == srate && mix->ch == ch &&
+		    !str_cmp(mix->mod, cfg->audio.alert_mod) &&
+		    !str_cmp(mix->dev, cfg->audio.alert_dev)) {
+
+			*mixp = mem_ref(mix);
+			return 0;
+		}
 	}
 
- silence:
-	if (play->eof)
-		memset(sampv, 0, sz);
+	mix = mem_zalloc(sizeof(*mix), mixer_destructor);
+	if (!mix)
+		return ENOMEM;
+
+	str_ncpy(mix->mod, cfg->audio.alert_mod, sizeof(mix->mod));
+	str_ncpy(mix->dev, cfg->audio.alert_dev, sizeof(mix->dev));
+	mix->srate = srate;
+	mix->ch    = ch;
+
+	err = lock_alloc(&mix->lock);
+	if (err)
+		goto out;
+
+	wprm.ch         = ch;
+	wprm.srate      = srate;
+	wprm.ptime      = PTIME;
+	wprm.latency    = NULL;
+
+	err = auplay_alloc(&mix->auplay, mix->mod, &wprm, mix->dev,
+			   write_handler, mix);
+	if (err)
+		goto out;
+
+	list_append(&mixl, &mix->le, mix);
+
+ out:
+	if (err)
+		mem_deref(mix);
+	else
+		*mixp = mix;
 
-	lock_rel(play->lock);
+	return err;
 }
 
 
@@ -118,31 +262,26 @@ static void destructor(void *arg)
 	struct play *play = arg;
 
 	list_unlink(&play->le);
-	tmr_cancel(&play->tmr);
 
-	lock_write_get(play->lock);
-	play->eof = true;
-	lock_rel(play->lock);
+	if (play->mix) {
+		lock_write_get(play->mix->lock);
+		list_unlink(&play->le_mix);
+		lock_rel(play->mix->lock);
+	}
 
-	mem_deref(play->auplay);
-	mem_deref(play->mb);
-	mem_deref(play->lock);
+	/* the last player closes the device */
+	mem_deref(play->mix);
+	mem_deref(play->data);
 
 	if (play->playp)
 		*play->playp = NULL;
 }
 
 
-static int aufile_load(struct mbuf *mb, const char *filename,
-		       uint32_t *srate, uint8_t *channels)
+static int aufile_load(struct mbuf *mb, struct aufile *af,
+		       const struct aufile_prm *prm)
 {
-	struct aufile_prm prm;
-	struct aufile *af;
-	int err;
-
-	err = aufile_open(&af, &prm, filename, AUFILE_READ);
-	if (err)
-		return err;
+	int err = 0;
 
 	while (!err) {
 		uint8_t buf[4096];
@@ -155,7 +294,7 @@ static int aufile_load(struct mbuf *mb, const char *filename,
 		if (err || !n)
 			break;
 
-		switch (prm.fmt) {
+		switch (prm->fmt) {
 
 		case AUFMT_S16LE:
 			/* convert from Little-Endian to Native-Endian */
@@ -186,68 +325,229 @@ static int aufile_load(struct mbuf *mb, const char *filename,
 		}
 	}
 
-	mem_deref(af);
-
-	if (!err) {
+	if (!err)
 		mb->pos = 0;
 
-		*srate    = prm.srate;
-		*channels = prm.channels;
+	return err;
+}
+
+
+static void tone_destructor(void *arg)
+{
+	struct tone *tone = arg;
+
+	list_unlink(&tone->le);
+
+#ifndef WIN32
+	if (tone->map)
+		(void)munmap(tone->map, tone->maplen);
+#endif
+	mem_deref(tone->mb);
+	mem_deref(tone->path);
+}
+
+
+static uint32_t le32(const uint8_t *p)
+{
+	return (uint32_t)p[0]       | (uint32_t)p[1] << 8 |
+	       (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+/* find the samples of a WAV file, which are word aligned */
+static bool wav_data(const uint8_t *p, size_t len, size_t *offp,
+		     size_t *sizep)
+{
+	size_t pos = 12;
+
+	if (len < 12 || memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4))
+		return false;
+
+	while (pos + 8 <= len) {
+
+		uint32_t sz = le32(p + pos + 4);
+
+		if (0 == memcmp(p + pos, "data", 4)) {
+			*offp  = pos + 8;
+			*sizep = min((size_t)sz, len - pos - 8);
+			return true;
+		}
+
+		if (sz > len - pos - 8)
+			break;
+
+		pos += 8 + sz + (sz & 1);
 	}
 
+	return false;
+}
+
+
+static int tone_map(struct tone *tone)
+{
+#ifndef WIN32
+	size_t off, sz;
+	void *map;
+	int fd;
+
+	fd = open(tone->path, O_RDONLY);
+	if (fd < 0)
+		return errno;
+
+	map = mmap(NULL, (size_t)tone->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	(void)close(fd);
+	if (map == MAP_FAILED)
+		return errno;
+
+	if (!wav_data(map, (size_t)tone->size, &off, &sz) || (off & 1)) {
+		(void)munmap(map, (size_t)tone->size);
+		return EBADMSG;
+	}
+
+	tone->map    = map;
+	tone->maplen = (size_t)tone->size;
+	tone->sampv  = (const int16_t *)(void *)((uint8_t *)map + off);
+	tone->sampc  = sz / 2;
+
+	return 0;
+#else
+	(void)tone;
+	return ENOSYS;
+#endif
+}
+
+
+static int tone_load(struct tone **tonep, const char *path,
+		     const struct stat *sb)
+{
+	struct aufile_prm prm;
+	struct aufile *af = NULL;
+	struct tone *tone;
+	int err;
+
+	tone = mem_zalloc(sizeof(*tone), tone_destructor);
+	if (!tone)
+		return ENOMEM;
+
+	tone->mtime = sb->st_mtime;
+	tone->size  = sb->st_size;
+
+	err = str_dup(&tone->path, path);
+	if (err)
+		goto out;
+
+	err = aufile_open(&af, &prm, path, AUFILE_READ);
+	if (err)
+		goto out;
+
+	tone->srate = prm.srate;
+	tone->ch    = prm.channels;
+
+	/* native-endian samples can be played from the file */
+	if (prm.fmt == AUFMT_S16LE && sys_ltohs(1) == 1 &&
+	    tone->size >= TONE_MMAP_MIN) {
+
+		err = tone_map(tone);
+		if (!err)
+			goto out;
+
+		debug("play: %s: not mapped (%m)\n", path, err);
+	}
+
+	tone->mb = mbuf_alloc(1024);
+	if (!tone->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = aufile_load(tone->mb, af, &prm);
+	if (err)
+		goto out;
+
+	tone->sampv = (const int16_t *)(void *)tone->mb->buf;
+	tone->sampc = tone->mb->end / 2;
+
+ out:
+	mem_deref(af);
+
+	if (err)
+		mem_deref(tone);
+	else
+		*tonep = tone;
+
 	return err;
 }
 
 
-/**
- * Play a tone from a PCM buffer
- *
- * @param playp    Pointer to allocated player object
- * @param tone     PCM buffer to play
- * @param srate    Sampling rate
- * @param ch       Number of channels
- * @param repeat   Number of times to repeat
- *
- * @return 0 if success, otherwise errorcode
- */
-int play_tone(struct play **playp, struct mbuf *tone, uint32_t srate,
-	      uint8_t ch, int repeat)
+/* get a cached tone, loading it if the file is new or has changed */
+static int tone_get(struct tone **tonep, const char *path)
 {
-	struct auplay_prm wprm;
-	struct play *play;
-	struct config *cfg;
+	struct stat sb;
+	struct le *le;
 	int err;
 
-	if (playp && *playp)
-		return EALREADY;
+	if (stat(path, &sb) < 0)
+		return errno;
 
-	cfg = conf_config();
-	if (!cfg)
-		return ENOENT;
+	for (le = tonel.head; le; le = le->next) {
+
+		struct tone *tone = le->data;
+
+		if (str_cmp(tone->path, path))
+			continue;
+
+		if (tone->mtime == sb.st_mtime && tone->size == sb.st_size) {
+			*tonep = mem_ref(tone);
+			return 0;
+		}
+
+		/* players of the old tone still hold a reference */
+		list_unlink(&tone->le);
+		mem_deref(tone);
+		break;
+	}
+
+	err = tone_load(tonep, path, &sb);
+	if (err)
+		return err;
+
+	list_append(&tonel, &(*tonep)->le, mem_ref(*tonep));
+
+	return 0;
+}
+
+
+static int play_alloc(struct play **playp, void *data,
+		      const int16_t *sampv, size_t sampc,
+		      uint32_t srate, uint8_t ch, int repeat)
+{
+	struct play *play;
+	int err;
+
+	if (!mq) {
+		err = mqueue_alloc(&mq, mqueue_handler, NULL);
+		if (err)
+			return err;
+	}
 
 	play = mem_zalloc(sizeof(*play), destructor);
 	if (!play)
 		return ENOMEM;
 
-	tmr_init(&play->tmr);
 	play->repeat = repeat;
-	play->mb     = mem_ref(tone);
+	play->data   = mem_ref(data);
+	play->sampv  = sampv;
+	play->sampc  = sampc;
 
-	err = lock_alloc(&play->lock);
-	if (err)
-		goto out;
-
-	wprm.ch         = ch;
-	wprm.srate      = srate;
-	wprm.ptime      = PTIME;
-
-	err = auplay_alloc(&play->auplay, cfg->audio.alert_mod, &wprm,
-			   cfg->audio.alert_dev, write_handler, play);
+	err = mixer_get(&play->mix, srate, ch);
 	if (err)
 		goto out;
 
 	list_append(&playl, &play->le, play);
-	tmr_start(&play->tmr, 1000, tmr_polling, play);
+
+	lock_write_get(play->mix->lock);
+	list_append(&play->mix->playl, &play->le_mix, play);
+	lock_rel(play->mix->lock);
 
  out:
 	if (err) {
@@ -262,6 +562,31 @@ int play_tone(struct play **playp, struct mbuf *tone, uint32_t srate,
 }
 
 
+/**
+ * Play a tone from a PCM buffer
+ *
+ * @param playp    Pointer to allocated player object
+ * @param tone     PCM buffer to play
+ * @param srate    Sampling rate
+ * @param ch       Number of channels
+ * @param repeat   Number of times to repeat
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int play_tone(struct play **playp, struct mbuf *tone, uint32_t srate,
+	      uint8_t ch, int repeat)
+{
+	if (!tone)
+		return EINVAL;
+
+	if (playp && *playp)
+		return EALREADY;
+
+	return play_alloc(playp, tone, (const int16_t *)(void *)tone->buf,
+			  tone->end / 2, srate, ch, repeat);
+}
+
+
 /**
  * Play an audio file in WAV format
  *
@@ -273,10 +598,8 @@ int play_tone(struct play **playp, struct mbuf *tone, uint32_t srate,
  */
 int play_file(struct play **playp, const char *filename, int repeat)
 {
-	struct mbuf *mb;
+	struct tone *tone;
 	char path[512];
-	uint32_t srate = 0;
-	uint8_t ch = 0;
 	int err;
 
 	if (playp && *playp)
@@ -286,28 +609,63 @@ int play_file(struct play **playp, const char *filename, int repeat)
 			play_path, filename) < 0)
 		return ENOMEM;
 
-	mb = mbuf_alloc(1024);
-	if (!mb)
-		return ENOMEM;
-
-	err = aufile_load(mb, path, &srate, &ch);
+	err = tone_get(&tone, path);
 	if (err) {
 		warning("play: %s: %m\n", path, err);
-		goto out;
+		return err;
 	}
 
-	err = play_tone(playp, mb, srate, ch, repeat);
+	err = play_alloc(playp, tone, tone->sampv, tone->sampc,
+			 tone->srate, tone->ch, repeat);
 
- out:
-	mem_deref(mb);
+	mem_deref(tone);
 
 	return err;
 }
 
 
+/**
+ * Get the decoded samples of an audio file, from the cache of tones
+ *
+ * @param tonep    Returned tone, dereference when the samples are done
+ * @param pcm      Returned samples of the tone
+ * @param filename Filename of the audio file, in the play path
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int play_pcm_get(void **tonep, struct play_pcm *pcm, const char *filename)
+{
+	struct tone *tone;
+	char path[512];
+	int err;
+
+	if (!tonep || !pcm || !filename)
+		return EINVAL;
+
+	if (re_snprintf(path, sizeof(path), "%s/%s",
+			play_path, filename) < 0)
+		return ENOMEM;
+
+	err = tone_get(&tone, path);
+	if (err)
+		return err;
+
+	pcm->sampv = tone->sampv;
+	pcm->sampc = tone->sampc;
+	pcm->srate = tone->srate;
+	pcm->ch    = tone->ch;
+
+	*tonep = tone;
+
+	return 0;
+}
+
+
 void play_init(void)
 {
 	list_init(&playl);
+	list_init(&mixl);
+	list_init(&tonel);
 }
 
 
@@ -317,6 +675,9 @@ void play_init(void)
 void play_close(void)
 {
 	list_flush(&playl);
+	list_flush(&tonel);
+
+	mq = mem_deref(mq);
 }
 
 
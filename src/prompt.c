@@ -0,0 +1,343 @@
+/**
+ * @file prompt.c  Pre-encoded audio prompts
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * A prompt is an audio file that is played into many calls, e.g. by an
+ * IVR. It is decoded, resampled and encoded once per codec and packet
+ * time, and the encoded packets are kept in a cache. A call plays the
+ * prompt by sending the cached packets on its stream from a media clock
+ * timer, with no codec work per call.
+ *
+ * The cache holds a reference to the decoded tone of the file. When the
+ * file changes, the player gets a new tone, and the prompt is encoded
+ * again. Playing prompts keep their old encoding until they stop.
+ *
+ * Codecs with a fixed frame length send one frame per packet.
+ */
+
+
+enum {
+	MAX_PAYLOAD = 1500,      /**< Max. encoded frame in [bytes] */
+};
+
+/** Prompt encoded for one codec and packet time */
+struct prompt {
+	struct le le;
+	char *filename;
+	void *tone;              /**< Decoded samples (ref)          */
+	const struct aucodec *ac;
+	uint32_t ptime;          /**< Packet time in [ms]            */
+	uint32_t ts_inc;         /**< Timestamp increment per packet */
+	struct mbuf *mb;         /**< Packets, 16-bit length+payload */
+	size_t n;                /**< Number of packets              */
+};
+
+/** Prompt playing on an audio stream */
+struct prompt_play {
+	struct mclock_tmr tmr;
+	struct prompt *pr;       /**< Encoded prompt (ref)           */
+	struct audio *a;
+	struct mbuf *mb;         /**< Packet, with STREAM_PRESZ      */
+	size_t pos;              /**< Next packet in the prompt      */
+	int repeat;              /**< Plays left, -1 is forever      */
+	prompt_done_h *doneh;
+	void *arg;
+};
+
+static struct list promptl;  /**< Cached prompts */
+
+
+static void prompt_destructor(void *arg)
+{
+	struct prompt *pr = arg;
+
+	list_unlink(&pr->le);
+	mem_deref(pr->filename);
+	mem_deref(pr->tone);
+	mem_deref(pr->mb);
+}
+
+
+static int prompt_encode(struct prompt *pr, const struct play_pcm *pcm)
+{
+	const struct config *cfg = conf_config();
+	const struct aucodec *ac = pr->ac;
+	struct auenc_state *enc = NULL;
+	struct resamp *rs = NULL;
+	int16_t *inv = NULL, *outv = NULL;
+	size_t inc, outc, pos;
+	int err = 0;
+
+	inc  = (size_t)pcm->srate * pcm->ch * pr->ptime / 1000;
+	outc = (size_t)ac->srate * ac->ch * pr->ptime / 1000;
+
+	if (!inc || !outc)
+		return EINVAL;
+
+	inv = mem_alloc(inc * sizeof(int16_t), NULL);
+	if (!inv)
+		return ENOMEM;
+
+	if (ac->encupdh) {
+		struct auenc_param prm;
+
+		prm.ptime = pr->ptime;
+
+		err = ac->encupdh(&enc, ac, &prm, NULL);
+		if (err)
+			goto out;
+	}
+
+	if (ac->srate != pcm->srate || ac->ch != pcm->ch) {
+
+		outv = mem_alloc(outc * sizeof(int16_t), NULL);
+		if (!outv) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		err = resamp_alloc(&rs, cfg ? cfg->audio.resamp : 0,
+				   pcm->srate, pcm->ch, ac->srate, ac->ch);
+		if (err)
+			goto out;
+	}
+
+	for (pos = 0; pos < pcm->sampc; pos += inc) {
+
+		const size_t n = min(inc, pcm->sampc - pos);
+		uint8_t buf[MAX_PAYLOAD];
+		const int16_t *sampv = inv;
+		size_t sampc = inc;
+		size_t len = sizeof(buf);
+
+		/* the last frame is padded with silence */
+		memcpy(inv, &pcm->sampv[pos], n * sizeof(int16_t));
+		memset(&inv[n], 0, (inc - n) * sizeof(int16_t));
+
+		if (rs) {
+			sampc = outc;
+
+			err = resamp_process(rs, outv, &sampc, inv, inc);
+			if (err)
+				goto out;
+
+			sampv = outv;
+		}
+
+		err = ac->ench(enc, buf, &len, sampv, sampc);
+		if (err)
+			goto out;
+
+		err  = mbuf_write_u16(pr->mb, htons((uint16_t)len));
+		err |= mbuf_write_mem(pr->mb, buf, len);
+		if (err)
+			goto out;
+
+		++pr->n;
+	}
+
+	debug("prompt: %s: %zu packets of %ums for %s (%zu bytes)\n",
+	      pr->filename, pr->n, pr->ptime, ac->name, pr->mb->end);
+
+ out:
+	mem_deref(enc);
+	mem_deref(rs);
+	mem_deref(inv);
+	mem_deref(outv);
+
+	return err;
+}
+
+
+static int prompt_alloc(struct prompt **prp, const char *filename,
+			const struct aucodec *ac, uint32_t ptime)
+{
+	struct play_pcm pcm;
+	struct prompt *pr;
+	struct le *le;
+	void *tone;
+	int err;
+
+	err = play_pcm_get(&tone, &pcm, filename);
+	if (err)
+		return err;
+
+	for (le = promptl.head; le; le = le->next) {
+
+		pr = le->data;
+
+		if (pr->ac != ac || pr->ptime != ptime ||
+		    str_cmp(pr->filename, filename))
+			continue;
+
+		/* the file has not changed */
+		if (pr->tone == tone) {
+			mem_deref(tone);
+			*prp = mem_ref(pr);
+			return 0;
+		}
+
+		/* players of the old prompt still hold a reference */
+		list_unlink(&pr->le);
+		mem_deref(pr);
+		break;
+	}
+
+	pr = mem_zalloc(sizeof(*pr), prompt_destructor);
+	if (!pr) {
+		mem_deref(tone);
+		return ENOMEM;
+	}
+
+	pr->tone   = tone;
+	pr->ac     = ac;
+	pr->ptime  = ptime;
+	pr->ts_inc = ac->crate * ptime / 1000;
+
+	err = str_dup(&pr->filename, filename);
+	if (err)
+		goto out;
+
+	pr->mb = mbuf_alloc(4096);
+	if (!pr->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = prompt_encode(pr, &pcm);
+	if (err)
+		goto out;
+
+	list_append(&promptl, &pr->le, pr);
+
+	*prp = mem_ref(pr);
+
+ out:
+	if (err)
+		mem_deref(pr);
+
+	return err;
+}
+
+
+static void play_destructor(void *arg)
+{
+	struct prompt_play *pp = arg;
+
+	mclock_tmr_cancel(&pp->tmr);
+	mem_deref(pp->pr);
+	mem_deref(pp->mb);
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct prompt_play *pp = arg;
+	struct mbuf *pmb = pp->pr->mb;
+	size_t len;
+
+	if (pp->pos >= pmb->end) {
+
+		if (pp->repeat > 0)
+			pp->repeat--;
+
+		if (pp->repeat == 0) {
+			if (pp->doneh)
+				pp->doneh(pp->arg);
+			return;
+		}
+
+		pp->pos = 0;
+	}
+
+	mclock_tmr_start(&pp->tmr, pp->pr->ptime, tmr_handler, pp);
+
+	pmb->pos = pp->pos;
+	len = ntohs(mbuf_read_u16(pmb));
+
+	pp->mb->pos = pp->mb->end = STREAM_PRESZ;
+	(void)mbuf_write_mem(pp->mb, mbuf_buf(pmb), len);
+
+	pp->pos = pmb->pos + len;
+
+	audio_moh_send(pp->a, pp->mb, pp->pr->ts_inc);
+}
+
+
+/**
+ * Play a prompt on an audio stream, from the cache of encoded prompts
+ *
+ * @param ppp      Pointer to allocated player, dereference to stop
+ * @param a        Audio object
+ * @param ac       Audio encoder of the stream
+ * @param ptime    Packet time in [ms]
+ * @param filename Filename of the audio file, in the play path
+ * @param repeat   Number of times to play, -1 is forever
+ * @param doneh    Optional handler called when the prompt is done
+ * @param arg      Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int prompt_play_alloc(struct prompt_play **ppp, struct audio *a,
+		      const struct aucodec *ac, uint32_t ptime,
+		      const char *filename, int repeat,
+		      prompt_done_h *doneh, void *arg)
+{
+	struct prompt_play *pp;
+	int err;
+
+	if (!ppp || !a || !ac || !ac->ench || !filename)
+		return EINVAL;
+
+	if (ac->ptime)
+		ptime = ac->ptime;
+
+	if (!ptime)
+		return EINVAL;
+
+	pp = mem_zalloc(sizeof(*pp), play_destructor);
+	if (!pp)
+		return ENOMEM;
+
+	err = prompt_alloc(&pp->pr, filename, ac, ptime);
+	if (err)
+		goto out;
+
+	pp->mb = mbuf_alloc(STREAM_PRESZ + MAX_PAYLOAD);
+	if (!pp->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	pp->a      = a;
+	pp->repeat = repeat ? repeat : 1;
+	pp->doneh  = doneh;
+	pp->arg    = arg;
+
+	mclock_tmr_start(&pp->tmr, 0, tmr_handler, pp);
+
+ out:
+	if (err)
+		mem_deref(pp);
+	else
+		*ppp = pp;
+
+	return err;
+}
+
+
+/**
+ * Flush the cache of encoded prompts
+ */
+void prompt_close(void)
+{
+	list_flush(&promptl);
+}
@@ -3,6 +3,18 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#if defined(LINUX) && defined(HAVE_PTHREAD)
+#define _GNU_SOURCE 1
+#endif
+#include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 #include <re.h>
 #include <baresip.h>
 #ifdef DARWIN
@@ -92,9 +104,192 @@ int realtime_enable(bool enable, int fps)
 
 		return 0;
 	}
+#elif defined(LINUX) && defined(HAVE_PTHREAD)
+	struct sched_param param;
+	int policy = enable ? SCHED_FIFO : SCHED_OTHER;
+	(void)fps;
+
+	memset(&param, 0, sizeof(param));
+
+	/* above other threads, below the kernel's own and JACK's */
+	if (enable)
+		param.sched_priority = sched_get_priority_max(policy) / 2;
+
+	return pthread_setschedparam(pthread_self(), policy, &param);
 #else
 	(void)enable;
 	(void)fps;
 	return ENOSYS;
 #endif
 }
+
+
+/*
+ * The scheduling of a media thread is configured by its name, and
+ * applied by the thread itself when it starts:
+ *
+ *   main       the main loop (re_main)
+ *   audio_tx   the audio transmit thread
+ *   audio_dev  the threads of the audio device modules
+ *   video_enc  the video encoder thread
+ */
+
+
+static const struct config_thread *thread_config(const char *name)
+{
+	const struct config *cfg = conf_config();
+
+	if (!cfg || !name)
+		return NULL;
+
+	if (0 == str_casecmp(name, "main"))
+		return &cfg->sched.main;
+	else if (0 == str_casecmp(name, "audio_tx"))
+		return &cfg->sched.audio_tx;
+	else if (0 == str_casecmp(name, "audio_dev"))
+		return &cfg->sched.audio_dev;
+	else if (0 == str_casecmp(name, "video_enc"))
+		return &cfg->sched.video_enc;
+
+	return NULL;
+}
+
+
+#ifdef HAVE_PTHREAD
+static int set_policy(const struct config_thread *ct)
+{
+	struct sched_param param;
+	int policy;
+
+	switch (ct->policy) {
+
+	case SCHED_POLICY_OTHER: policy = SCHED_OTHER; break;
+	case SCHED_POLICY_FIFO:  policy = SCHED_FIFO;  break;
+	case SCHED_POLICY_RR:    policy = SCHED_RR;    break;
+	default:                 return 0;
+	}
+
+	memset(&param, 0, sizeof(param));
+
+	if (policy != SCHED_OTHER) {
+		param.sched_priority = max(ct->prio,
+					   sched_get_priority_min(policy));
+		param.sched_priority = min(param.sched_priority,
+					   sched_get_priority_max(policy));
+	}
+
+	return pthread_setschedparam(pthread_self(), policy, &param);
+}
+#else
+static int set_policy(const struct config_thread *ct)
+{
+	return ct->policy == SCHED_POLICY_DEFAULT ? 0 : ENOSYS;
+}
+#endif
+
+
+#if defined(LINUX) && defined(HAVE_PTHREAD)
+static int set_affinity(uint64_t cpus)
+{
+	cpu_set_t set;
+	unsigned i;
+
+	if (!cpus)
+		return 0;
+
+	CPU_ZERO(&set);
+
+	for (i=0; i<64; i++) {
+		if (cpus & (1ULL << i))
+			CPU_SET(i, &set);
+	}
+
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+#else
+static int set_affinity(uint64_t cpus)
+{
+	return cpus ? ENOSYS : 0;
+}
+#endif
+
+
+/**
+ * Get the name of a scheduling policy
+ *
+ * @param policy Scheduling policy
+ *
+ * @return Name of the policy
+ */
+const char *sched_policy_name(enum sched_policy policy)
+{
+	switch (policy) {
+
+	case SCHED_POLICY_DEFAULT: return "default";
+	case SCHED_POLICY_OTHER:   return "other";
+	case SCHED_POLICY_FIFO:    return "fifo";
+	case SCHED_POLICY_RR:      return "rr";
+	default:                   return "?";
+	}
+}
+
+
+/**
+ * Apply the configured scheduling policy and CPU affinity to the
+ * calling thread
+ *
+ * @param name Name of the thread (main, audio_tx, audio_dev, video_enc)
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int realtime_thread(const char *name)
+{
+	const struct config_thread *ct = thread_config(name);
+	int err, err2;
+
+	if (!ct)
+		return EINVAL;
+
+	if (ct->policy == SCHED_POLICY_DEFAULT && !ct->cpus)
+		return 0;
+
+	err = set_policy(ct);
+	if (err) {
+		warning("realtime: %s thread: could not set policy %s:%d"
+			" (%m)\n", name, sched_policy_name(ct->policy),
+			ct->prio, err);
+	}
+
+	err2 = set_affinity(ct->cpus);
+	if (err2) {
+		warning("realtime: %s thread: could not set CPU affinity"
+			" 0x%llx (%m)\n", name, ct->cpus, err2);
+	}
+
+	if (!err && !err2) {
+		info("realtime: %s thread: policy=%s:%d cpus=0x%llx\n",
+		     name, sched_policy_name(ct->policy), ct->prio,
+		     ct->cpus);
+	}
+
+	return err ? err : err2;
+}
+
+
+/**
+ * Lock all current and future memory of the process in RAM, so that
+ * the media threads never wait for a page fault
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int realtime_mlockall(void)
+{
+#ifndef WIN32
+	if (mlockall(MCL_CURRENT | MCL_FUTURE))
+		return errno;
+
+	return 0;
+#else
+	return ENOSYS;
+#endif
+}
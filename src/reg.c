@@ -3,11 +3,40 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <stdlib.h>
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 #include "core.h"
 
 
+/*
+ * Registration scheduler
+ *
+ * REGISTER requests are queued and started at most `sip_reg_rate' times
+ * per second, with at most `sip_reg_inflight' requests waiting for a final
+ * response. The requested expiry is randomized between 50% and 100% of the
+ * registration interval. The SIP stack refreshes at 90% of the expiry,
+ * so refreshes are spread over 45% to 90% of the registration interval.
+ *
+ * Other requests to the registrar, such as the subscriptions of the
+ * MWI module, are queued with regsched_start() and share the same rate.
+ *
+ * All User-Agents with the same registrar share one connection of the
+ * SIP stack on TCP and TLS. With `sip_keepalive' that connection is kept
+ * alive with CRLF pings (RFC 5626), also without SIP outbound. When the
+ * connection is lost, the REGISTER is queued again after a random delay
+ * of up to RECONNECT_SPREAD, so the User-Agents do not reconnect at once.
+ */
+
+
+enum {
+	LATENCY_SAMPLES = 256,       /**< REGISTER latencies kept for stats  */
+	RECONNECT_SPREAD = 30000,    /**< Max. delay of a reconnect [ms]     */
+	EXPIRES_FLOOR    = 60,       /**< Lowest jittered expiry [seconds]   */
+};
+
+
 /** Register client */
 struct reg {
 	struct le le;                /**< Linked list element                */
@@ -20,16 +49,91 @@ struct reg {
 	char *srv;                   /**< SIP Server id                      */
 	int sipfd;                   /**< Cached file-descr. for SIP conn    */
 	int af;                      /**< Cached address family for SIP conn */
+	enum sip_transp tp;          /**< Cached transport for SIP conn      */
+	struct sip_keepalive *ka;    /**< CRLF keepalive of the connection   */
+	int ka_fd;                   /**< Connection of the keepalive        */
+
+	/* scheduler: */
+	struct regsched_job job;     /**< Entry in the scheduler queue       */
+	char *reg_uri;               /**< Registrar URI                      */
+	char *params;                /**< Contact parameters                 */
+	char *outbound;              /**< Outbound proxy (optional)          */
+	uint32_t regint;             /**< Registration interval [seconds]    */
+	uint32_t min_expires;        /**< Min-Expires of the registrar       */
+	uint64_t ts_start;           /**< Time REGISTER was started [ms]     */
+	bool inflight;               /**< Waiting for the first response     */
 };
 
 
+static struct {
+	struct list jobl;            /**< Queued requests                    */
+	struct tmr tmr;              /**< Timer for the next token           */
+	uint32_t inflight;           /**< REGISTERs waiting for a response   */
+	uint64_t tokens;             /**< Token bucket, 1000 per REGISTER    */
+	uint64_t ts_token;           /**< Time of last token refill [ms]     */
+	uint32_t latv[LATENCY_SAMPLES]; /**< Latency samples [ms]           */
+	uint32_t latc;               /**< Number of latency samples          */
+	uint32_t latpos;             /**< Next position in latv              */
+	uint32_t n_started;          /**< Total REGISTERs started            */
+} sched;
+
+
+static void sched_poll(void);
+
+
+static void sched_tmr_handler(void *arg)
+{
+	(void)arg;
+
+	sched_poll();
+}
+
+
+/* Called when the REGISTER is done, or the client is stopped */
+static void sched_done(struct reg *reg, bool completed)
+{
+	if (!reg->inflight)
+		return;
+
+	reg->inflight = false;
+	--sched.inflight;
+
+	if (completed) {
+		sched.latv[sched.latpos] = (uint32_t)(tmr_jiffies() -
+						      reg->ts_start);
+		sched.latpos = (sched.latpos + 1) % LATENCY_SAMPLES;
+		sched.latc   = min(sched.latc + 1, LATENCY_SAMPLES);
+	}
+
+	/* the next REGISTER is started from the main loop */
+	if (!list_isempty(&sched.jobl))
+		tmr_start(&sched.tmr, 0, sched_tmr_handler, NULL);
+}
+
+
+static void sched_unlink(struct regsched_job *job)
+{
+	list_unlink(&job->le);
+
+	if (list_isempty(&sched.jobl))
+		tmr_cancel(&sched.tmr);
+}
+
+
 static void destructor(void *arg)
 {
 	struct reg *reg = arg;
 
+	regsched_cancel(&reg->job);
+	sched_done(reg, false);
+
 	list_unlink(&reg->le);
+	mem_deref(reg->ka);
 	mem_deref(reg->sipreg);
 	mem_deref(reg->srv);
+	mem_deref(reg->reg_uri);
+	mem_deref(reg->params);
+	mem_deref(reg->outbound);
 }
 
 
@@ -114,11 +218,60 @@ static bool contact_handler(const struct sip_hdr *hdr,
 }
 
 
+static void reg_start(void *arg);
+
+
+/* The connection to the registrar is lost, register again later */
+static void keepalive_handler(int err, void *arg)
+{
+	struct reg *reg = arg;
+	uint64_t delay;
+
+	warning("reg: %s: keepalive failed: %m\n", ua_aor(reg->ua), err);
+
+	reg->sipfd = -1;
+	reg->ka_fd = -1;
+
+	delay = rand_u32() % RECONNECT_SPREAD;
+
+	regsched_start(&reg->job, delay, reg_start, reg);
+}
+
+
+/* RFC 5626 CRLF keepalive, the SIP stack does it with SIP outbound */
+static void keepalive_update(struct reg *reg, const struct sip_msg *msg)
+{
+	const uint32_t interval = conf_config()->sip.keepalive;
+	int err;
+
+	if (!interval || reg->id)
+		return;
+
+	if (msg->tp != SIP_TRANSP_TCP && msg->tp != SIP_TRANSP_TLS)
+		return;
+
+	if (reg->ka && reg->ka_fd == reg->sipfd)
+		return;
+
+	reg->ka = mem_deref(reg->ka);
+	reg->ka_fd = reg->sipfd;
+
+	err = sip_keepalive_start(&reg->ka, uag_sip(), msg, interval,
+				  keepalive_handler, reg);
+	if (err) {
+		warning("reg: %s: keepalive: %m\n", ua_aor(reg->ua), err);
+		reg->ka_fd = -1;
+	}
+}
+
+
 static void register_handler(int err, const struct sip_msg *msg, void *arg)
 {
 	struct reg *reg = arg;
 	const struct sip_hdr *hdr;
 
+	sched_done(reg, true);
+
 	if (err) {
 		warning("reg: %s: Register: %m\n", ua_aor(reg->ua), err);
 
@@ -134,6 +287,11 @@ static void register_handler(int err, const struct sip_msg *msg, void *arg)
 		(void)pl_strdup(&reg->srv, &hdr->val);
 	}
 
+	/* the next REGISTER does not ask for less */
+	hdr = sip_msg_hdr(msg, SIP_HDR_MIN_EXPIRES);
+	if (hdr)
+		reg->min_expires = pl_u32(&hdr->val);
+
 	if (200 <= msg->scode && msg->scode <= 299) {
 
 		uint32_t n_bindings;
@@ -141,6 +299,9 @@ static void register_handler(int err, const struct sip_msg *msg, void *arg)
 		n_bindings = sip_msg_hdr_count(msg, SIP_HDR_CONTACT);
 		reg->sipfd = sipmsg_fd(msg);
 		reg->af    = sipmsg_af(msg);
+		reg->tp    = msg->tp;
+
+		keepalive_update(reg, msg);
 
 		if (msg->scode != reg->scode) {
 			ua_printf(reg->ua, "{%d/%s/%s} %u %r (%s)"
@@ -197,6 +358,7 @@ int reg_add(struct list *lst, struct ua *ua, int regid)
 	reg->ua    = ua;
 	reg->id    = regid;
 	reg->sipfd = -1;
+	reg->ka_fd = -1;
 
 	list_append(lst, &reg->le, reg);
 
@@ -204,32 +366,214 @@ int reg_add(struct list *lst, struct ua *ua, int regid)
 }
 
 
-int reg_register(struct reg *reg, const char *reg_uri, const char *params,
-		 uint32_t regint, const char *outbound)
+/*
+ * Random expiry between 50% and 100% of the registration interval. It
+ * is not below the floor, unless the interval is, and not below the
+ * Min-Expires of the registrar.
+ */
+static uint32_t regint_jitter(const struct reg *reg)
+{
+	const uint32_t regint = reg->regint;
+	uint32_t lo = max(regint / 2, min(regint, EXPIRES_FLOOR));
+	uint32_t expires;
+
+	expires = lo + rand_u32() % (regint - lo + 1);
+
+	return max(expires, reg->min_expires);
+}
+
+
+static void reg_start(void *arg)
 {
+	struct reg *reg = arg;
 	const char *routev[1];
 	int err;
 
-	if (!reg || !reg_uri)
-		return EINVAL;
-
-	reg->scode = 0;
-	routev[0] = outbound;
+	routev[0] = reg->outbound;
 
+	reg->ka = mem_deref(reg->ka);
 	reg->sipreg = mem_deref(reg->sipreg);
-	err = sipreg_register(&reg->sipreg, uag_sip(), reg_uri,
+	err = sipreg_register(&reg->sipreg, uag_sip(), reg->reg_uri,
 			      ua_aor(reg->ua), ua_aor(reg->ua),
-			      regint, ua_local_cuser(reg->ua),
+			      regint_jitter(reg),
+			      ua_local_cuser(reg->ua),
 			      routev[0] ? routev : NULL,
 			      routev[0] ? 1 : 0,
 			      reg->id,
 			      sip_auth_handler, ua_prm(reg->ua), true,
 			      register_handler, reg,
-			      params[0] ? &params[1] : NULL,
+			      reg->params ? &reg->params[1] : NULL,
 			      "Allow: %s\r\n", uag_allowed_methods());
+	if (err) {
+		warning("reg: %s: SIP register failed: %m\n",
+			ua_aor(reg->ua), err);
+
+		reg->scode = 999;
+
+		ua_event(reg->ua, UA_EVENT_REGISTER_FAIL, NULL, "%m", err);
+		return;
+	}
+
+	reg->ts_start = tmr_jiffies();
+	reg->inflight = true;
+	++sched.inflight;
+	++sched.n_started;
+}
+
+
+/* Take one token, or get the time until the next token in [ms] */
+static uint32_t sched_token(uint32_t rate)
+{
+	uint64_t now = tmr_jiffies();
+	uint64_t cap = (uint64_t)rate * 1000;
+
+	sched.tokens  += (now - sched.ts_token) * rate;
+	sched.tokens   = min(sched.tokens, cap);
+	sched.ts_token = now;
+
+	if (sched.tokens >= 1000) {
+		sched.tokens -= 1000;
+		return 0;
+	}
+
+	return (uint32_t)((1000 - sched.tokens + rate - 1) / rate);
+}
+
+
+static void sched_poll(void)
+{
+	const struct config_sip *cfg = &conf_config()->sip;
+
+	while (!list_isempty(&sched.jobl)) {
+
+		struct regsched_job *job = list_ledata(list_head(&sched.jobl));
+		uint32_t wait;
+
+		/* resumed when a REGISTER is done */
+		if (cfg->reg_inflight && sched.inflight >= cfg->reg_inflight)
+			return;
+
+		if (cfg->reg_rate) {
+
+			wait = sched_token(cfg->reg_rate);
+			if (wait) {
+				tmr_start(&sched.tmr, wait,
+					  sched_tmr_handler, NULL);
+				return;
+			}
+		}
+
+		sched_unlink(job);
+		job->h(job->arg);
+	}
+}
+
+
+static void sched_queue(struct regsched_job *job)
+{
+	if (!job->le.list)
+		list_append(&sched.jobl, &job->le, job);
+
+	sched_poll();
+}
+
+
+static void delay_handler(void *arg)
+{
+	sched_queue(arg);
+}
+
+
+/**
+ * Queue a request to the registrar on the registration scheduler. The
+ * handler is called when the request can be sent. A request that is
+ * queued keeps its place in the queue.
+ *
+ * @param job   Scheduler job
+ * @param delay Delay before the request is queued in [ms]
+ * @param h     Handler that sends the request
+ * @param arg   Handler argument
+ */
+void regsched_start(struct regsched_job *job, uint64_t delay,
+		    regsched_h *h, void *arg)
+{
+	if (!job || !h)
+		return;
+
+	twheel_tmr_cancel(&job->tmr);
+
+	job->h   = h;
+	job->arg = arg;
+
+	if (delay && !job->le.list) {
+		twheel_tmr_start(&job->tmr, baresip_twheel(), delay,
+				 delay_handler, job);
+		return;
+	}
+
+	sched_queue(job);
+}
+
+
+/**
+ * Remove a request from the registration scheduler
+ *
+ * @param job Scheduler job
+ */
+void regsched_cancel(struct regsched_job *job)
+{
+	if (!job)
+		return;
+
+	twheel_tmr_cancel(&job->tmr);
+	sched_unlink(job);
+}
+
+
+/**
+ * Check if a request is waiting on the registration scheduler
+ *
+ * @param job Scheduler job
+ *
+ * @return True if waiting, false if not
+ */
+bool regsched_isqueued(const struct regsched_job *job)
+{
+	if (!job)
+		return false;
+
+	return job->le.list || twheel_tmr_isrunning(&job->tmr);
+}
+
+
+int reg_register(struct reg *reg, const char *reg_uri, const char *params,
+		 uint32_t regint, const char *outbound)
+{
+	int err;
+
+	if (!reg || !reg_uri)
+		return EINVAL;
+
+	reg->reg_uri  = mem_deref(reg->reg_uri);
+	reg->params   = mem_deref(reg->params);
+	reg->outbound = mem_deref(reg->outbound);
+
+	err = str_dup(&reg->reg_uri, reg_uri);
+	if (str_isset(params))
+		err |= str_dup(&reg->params, params);
+	if (outbound)
+		err |= str_dup(&reg->outbound, outbound);
 	if (err)
 		return err;
 
+	reg->scode  = 0;
+	reg->regint = regint;
+
+	/* a new REGISTER replaces the one in progress */
+	sched_done(reg, false);
+
+	regsched_start(&reg->job, 0, reg_start, reg);
+
 	return 0;
 }
 
@@ -239,10 +583,15 @@ void reg_unregister(struct reg *reg)
 	if (!reg)
 		return;
 
+	regsched_cancel(&reg->job);
+	sched_done(reg, false);
+
 	reg->scode = 0;
 	reg->sipfd = -1;
 	reg->af    = 0;
 
+	reg->ka = mem_deref(reg->ka);
+	reg->ka_fd = -1;
 	reg->sipreg = mem_deref(reg->sipreg);
 }
 
@@ -262,6 +611,34 @@ int reg_sipfd(const struct reg *reg)
 }
 
 
+/**
+ * Check if a registration must be renewed after the SIP transports were
+ * created again
+ *
+ * @param reg Register client
+ * @param v4  True if the local IPv4 address changed
+ * @param v6  True if the local IPv6 address changed
+ *
+ * @return True to register again, false if the binding still works
+ */
+bool reg_rebind_needed(const struct reg *reg, bool v4, bool v6)
+{
+	if (!reg_isok(reg))
+		return true;
+
+	/* the connection of the binding was closed */
+	if (reg->tp == SIP_TRANSP_TCP || reg->tp == SIP_TRANSP_TLS)
+		return true;
+
+	switch (reg->af) {
+
+	case AF_INET:  return v4;
+	case AF_INET6: return v6;
+	default:       return true;
+	}
+}
+
+
 static const char *print_scode(uint16_t scode)
 {
 	if (0 == scode)        return "\x1b[33m" "zzz" "\x1b[;m";
@@ -295,3 +672,44 @@ int reg_status(struct re_printf *pf, const struct reg *reg)
 
 	return re_hprintf(pf, " %s %s", print_scode(reg->scode), reg->srv);
 }
+
+
+static int latency_cmp(const void *a, const void *b)
+{
+	const uint32_t *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+
+/**
+ * Print the status of the registration scheduler
+ *
+ * @param pf Print handler
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int reg_sched_debug(struct re_printf *pf)
+{
+	uint32_t latv[LATENCY_SAMPLES];
+	uint32_t p50 = 0, p99 = 0;
+	int err;
+
+	if (sched.latc) {
+
+		memcpy(latv, sched.latv, sched.latc * sizeof(latv[0]));
+		qsort(latv, sched.latc, sizeof(latv[0]), latency_cmp);
+
+		p50 = latv[(sched.latc - 1) * 50 / 100];
+		p99 = latv[(sched.latc - 1) * 99 / 100];
+	}
+
+	err  = re_hprintf(pf, "\n--- Registration scheduler ---\n");
+	err |= re_hprintf(pf, " queued:   %u\n", list_count(&sched.jobl));
+	err |= re_hprintf(pf, " inflight: %u\n", sched.inflight);
+	err |= re_hprintf(pf, " started:  %u\n", sched.n_started);
+	err |= re_hprintf(pf, " latency:  p50=%ums p99=%ums (%u samples)\n",
+			  p50, p99, sched.latc);
+
+	return err;
+}
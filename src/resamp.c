@@ -0,0 +1,616 @@
+/**
+ * @file src/resamp.c  Audio resampler with polyphase filter banks
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+#ifdef HAVE_SIMD_X86
+#include <immintrin.h>
+#endif
+#ifdef HAVE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+
+/**
+ * \page Resampler Audio resampler
+ *
+ * The polyphase backend converts between any two sample rates with the
+ * ratio L/M in lowest terms. A Kaiser-windowed sinc prototype filter is
+ * designed once per resampler and split into L phases of Q15 taps. Each
+ * output sample is then a single dot product of one phase with the input
+ * history, done with SIMD.
+ *
+ * Integer ratios (M=1 or L=1, e.g. 8k/16k/48k) have their own loops
+ * without the phase arithmetic. The librem auresamp is available as an
+ * alternative backend.
+ */
+
+
+enum {
+	ZERO_CROSS = 16,    /**< Sinc zero-crossings per side, lowest rate */
+	TAP_ALIGN  = 16,    /**< Taps per phase are a multiple of this    */
+	MAX_PHASES = 1024,  /**< Max interpolation factor L               */
+	MAX_CH     = 2,     /**< Max number of channels                   */
+};
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define KAISER_BETA 7.0     /**< About 75 dB stopband attenuation */
+#define ROLLOFF     0.85    /**< Cutoff relative to the lower Nyquist */
+
+
+typedef int32_t (dot_h)(const int16_t *a, const int16_t *b, size_t n);
+
+struct resamp {
+	enum resamp_backend be;   /**< Resampler backend               */
+	struct auresamp ars;      /**< librem resampler                */
+	int16_t *bankv;           /**< L phases of tapc Q15 taps       */
+	size_t tapc;              /**< Number of taps per phase        */
+	uint32_t up;              /**< Interpolation factor L          */
+	uint32_t down;            /**< Decimation factor M             */
+	uint32_t phase;           /**< Phase of next output, 0 to L-1  */
+	size_t pos;               /**< Input frame of next output      */
+	unsigned ich;             /**< Input channels                  */
+	unsigned och;             /**< Output channels                 */
+	unsigned ch;              /**< Resampled channels              */
+	int16_t *workv[MAX_CH];   /**< History and input per channel   */
+	size_t workc;             /**< Size of work buffers in samples */
+	dot_h *doth;              /**< Dot product                     */
+};
+
+
+static int32_t dot_c(const int16_t *a, const int16_t *b, size_t n)
+{
+	int32_t acc = 0;
+	size_t i;
+
+	for (i=0; i<n; i++)
+		acc += (int32_t)a[i] * b[i];
+
+	return acc;
+}
+
+
+#ifdef HAVE_SIMD_X86
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+
+SSE2 static int32_t dot_sse2(const int16_t *a, const int16_t *b, size_t n)
+{
+	__m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+	size_t i;
+
+	for (i=0; i<n; i+=16) {
+
+		__m128i a0 = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i a1 = _mm_loadu_si128((const __m128i *)(a + i + 8));
+		__m128i b0 = _mm_loadu_si128((const __m128i *)(b + i));
+		__m128i b1 = _mm_loadu_si128((const __m128i *)(b + i + 8));
+
+		acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(a0, b0));
+		acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(a1, b1));
+	}
+
+	acc0 = _mm_add_epi32(acc0, acc1);
+	acc0 = _mm_add_epi32(acc0, _mm_shuffle_epi32(acc0, 0x4e));
+	acc0 = _mm_add_epi32(acc0, _mm_shuffle_epi32(acc0, 0xb1));
+
+	return _mm_cvtsi128_si32(acc0);
+}
+
+
+AVX2 static int32_t dot_avx2(const int16_t *a, const int16_t *b, size_t n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	__m128i s;
+	size_t i;
+
+	for (i=0; i<n; i+=16) {
+
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+	}
+
+	s = _mm_add_epi32(_mm256_castsi256_si128(acc),
+			  _mm256_extracti128_si256(acc, 1));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+
+	return _mm_cvtsi128_si32(s);
+}
+
+#endif /* HAVE_SIMD_X86 */
+
+
+#ifdef HAVE_SIMD_NEON
+
+static int32_t dot_neon(const int16_t *a, const int16_t *b, size_t n)
+{
+	int32x4_t acc0 = vdupq_n_s32(0), acc1 = vdupq_n_s32(0);
+	int32x2_t s;
+	size_t i;
+
+	for (i=0; i<n; i+=8) {
+
+		int16x8_t va = vld1q_s16(a + i);
+		int16x8_t vb = vld1q_s16(b + i);
+
+		acc0 = vmlal_s16(acc0, vget_low_s16(va), vget_low_s16(vb));
+		acc1 = vmlal_s16(acc1, vget_high_s16(va), vget_high_s16(vb));
+	}
+
+	acc0 = vaddq_s32(acc0, acc1);
+	s = vadd_s32(vget_low_s32(acc0), vget_high_s32(acc0));
+
+	return vget_lane_s32(vpadd_s32(s, s), 0);
+}
+
+#endif /* HAVE_SIMD_NEON */
+
+
+static dot_h *impl_dot(enum simd_impl impl)
+{
+	if (!simd_supported(impl))
+		return dot_c;
+
+	switch (impl) {
+
+#ifdef HAVE_SIMD_X86
+	case SIMD_SSE2: return dot_sse2;
+	case SIMD_AVX2: return dot_avx2;
+#endif
+#ifdef HAVE_SIMD_NEON
+	case SIMD_NEON: return dot_neon;
+#endif
+	default:        return dot_c;
+	}
+}
+
+
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	unsigned k;
+
+	for (k=1; k<32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum  += term;
+	}
+
+	return sum;
+}
+
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+	while (b) {
+		uint32_t t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+
+/*
+ * Design the prototype lowpass at L times the input rate, and split it
+ * into L phases. The taps of each phase are stored in reverse order, so
+ * that they line up with the input history, and scaled to a DC gain of 1.
+ */
+static int bank_alloc(struct resamp *rs)
+{
+	const uint32_t L = rs->up, M = rs->down;
+	const size_t N = rs->tapc * L;
+	const double fc = 0.5 * ROLLOFF / max(L, M);
+	const double c = (N - 1) / 2.0;
+	const double i0b = bessel_i0(KAISER_BETA);
+	double *hv;
+	uint32_t p;
+	size_t i, j;
+
+	hv = mem_alloc(N * sizeof(*hv), NULL);
+	rs->bankv = mem_alloc(N * sizeof(*rs->bankv), NULL);
+	if (!hv || !rs->bankv) {
+		mem_deref(hv);
+		return ENOMEM;
+	}
+
+	for (i=0; i<N; i++) {
+
+		double x = i - c;
+		double r = 2.0 * x / (N - 1);
+		double w = bessel_i0(KAISER_BETA * sqrt(max(0.0, 1.0 - r*r)));
+		double s = x == 0 ? 1.0 : sin(2*M_PI*fc*x) / (2*M_PI*fc*x);
+
+		hv[i] = s * w / i0b;
+	}
+
+	for (p=0; p<L; p++) {
+
+		int16_t *tapv = &rs->bankv[p * rs->tapc];
+		double sum = 0;
+
+		for (j=0; j<rs->tapc; j++)
+			sum += hv[p + j*L];
+
+		for (j=0; j<rs->tapc; j++) {
+
+			double v = hv[p + (rs->tapc - 1 - j)*L] / sum;
+			long q = lrint(v * 32768.0);
+
+			tapv[j] = (int16_t)max(-32768L, min(q, 32767L));
+		}
+	}
+
+	mem_deref(hv);
+
+	return 0;
+}
+
+
+static void destructor(void *arg)
+{
+	struct resamp *rs = arg;
+	unsigned i;
+
+	for (i=0; i<MAX_CH; i++)
+		mem_deref(rs->workv[i]);
+
+	mem_deref(rs->bankv);
+}
+
+
+/**
+ * Allocate a resampler
+ *
+ * @param rsp   Pointer to allocated resampler
+ * @param be    Resampler backend
+ * @param irate Input sample rate
+ * @param ich   Input channels (1 or 2)
+ * @param orate Output sample rate
+ * @param och   Output channels (1 or 2)
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int resamp_alloc(struct resamp **rsp, enum resamp_backend be,
+		 uint32_t irate, unsigned ich, uint32_t orate, unsigned och)
+{
+	struct resamp *rs;
+	uint32_t g;
+	int err = 0;
+
+	if (!rsp || !irate || !orate)
+		return EINVAL;
+
+	if (!ich || ich > MAX_CH || !och || och > MAX_CH)
+		return ENOTSUP;
+
+	rs = mem_zalloc(sizeof(*rs), destructor);
+	if (!rs)
+		return ENOMEM;
+
+	rs->be  = be;
+	rs->ich = ich;
+	rs->och = och;
+	rs->ch  = min(ich, och);
+
+	g = gcd(irate, orate);
+	rs->up   = orate / g;
+	rs->down = irate / g;
+
+	/* too many phases for a filter bank */
+	if (rs->up > MAX_PHASES)
+		rs->be = RESAMP_LIBREM;
+
+	if (rs->be == RESAMP_LIBREM) {
+		auresamp_init(&rs->ars);
+		err = auresamp_setup(&rs->ars, irate, ich, orate, och);
+		goto out;
+	}
+
+	rs->doth = impl_dot(simd_best());
+
+	/* only channel conversion */
+	if (rs->up == rs->down)
+		goto out;
+
+	rs->tapc = 2 * ZERO_CROSS * max(rs->up, rs->down);
+	rs->tapc = (rs->tapc + rs->up - 1) / rs->up;
+	rs->tapc = (rs->tapc + TAP_ALIGN - 1) & ~(size_t)(TAP_ALIGN - 1);
+
+	err = bank_alloc(rs);
+
+ out:
+	if (err)
+		mem_deref(rs);
+	else
+		*rsp = rs;
+
+	return err;
+}
+
+
+/**
+ * Select the SIMD implementation of a polyphase resampler
+ *
+ * @param rs   Resampler
+ * @param impl SIMD implementation, falls back to C if not supported
+ */
+void resamp_set_simd(struct resamp *rs, enum simd_impl impl)
+{
+	if (!rs)
+		return;
+
+	rs->doth = impl_dot(impl);
+}
+
+
+/* copy the input frames after the history, one buffer per channel */
+static int work_fill(struct resamp *rs, const int16_t *inv, size_t frames)
+{
+	const size_t hist = rs->tapc - 1;
+	size_t i;
+	unsigned c;
+
+	if (hist + frames > rs->workc) {
+
+		for (c=0; c<rs->ch; c++) {
+
+			const size_t sz = (hist + frames) * sizeof(int16_t);
+			int16_t *w;
+
+			if (rs->workv[c])
+				w = mem_realloc(rs->workv[c], sz);
+			else
+				w = mem_zalloc(sz, NULL);
+			if (!w)
+				return ENOMEM;
+
+			rs->workv[c] = w;
+		}
+
+		rs->workc = hist + frames;
+	}
+
+	if (rs->ich == rs->ch) {
+
+		for (c=0; c<rs->ch; c++) {
+
+			int16_t *w = rs->workv[c] + hist;
+
+			for (i=0; i<frames; i++)
+				w[i] = inv[i * rs->ich + c];
+		}
+	}
+	else {
+		int16_t *w = rs->workv[0] + hist;
+
+		/* stereo to mono */
+		for (i=0; i<frames; i++)
+			w[i] = (inv[2*i] + inv[2*i + 1]) / 2;
+	}
+
+	return 0;
+}
+
+
+static size_t output_count(const struct resamp *rs, size_t frames)
+{
+	uint64_t span;
+
+	if (rs->pos >= frames)
+		return 0;
+
+	span = (uint64_t)(frames - rs->pos) * rs->up;
+	if (span <= rs->phase)
+		return 0;
+
+	return (size_t)((span - rs->phase + rs->down - 1) / rs->down);
+}
+
+
+static inline int16_t q15_sat(int32_t acc)
+{
+	acc = (acc + (1 << 14)) >> 15;
+
+	if (acc > 32767)
+		return 32767;
+	else if (acc < -32768)
+		return -32768;
+
+	return (int16_t)acc;
+}
+
+
+static void filter_channel(const struct resamp *rs, int16_t *outv,
+			   size_t outc, const int16_t *w)
+{
+	const size_t step = rs->och;
+	size_t pos = rs->pos;
+	uint32_t phase = rs->phase;
+	size_t k;
+
+	if (rs->up == 1) {
+
+		/* integer decimation, single phase */
+		for (k=0; k<outc; k++, pos += rs->down)
+			outv[k * step] = q15_sat(rs->doth(rs->bankv, &w[pos],
+							  rs->tapc));
+	}
+	else if (rs->down == 1) {
+
+		/* integer interpolation, all phases for each input */
+		for (k=0; k<outc; ) {
+
+			for (; phase < rs->up && k < outc; phase++, k++) {
+
+				const int16_t *tapv;
+
+				tapv = &rs->bankv[phase * rs->tapc];
+				outv[k * step] = q15_sat(rs->doth(tapv, &w[pos],
+								  rs->tapc));
+			}
+
+			if (phase == rs->up) {
+				phase = 0;
+				++pos;
+			}
+		}
+	}
+	else {
+		for (k=0; k<outc; k++) {
+
+			const int16_t *tapv = &rs->bankv[phase * rs->tapc];
+
+			outv[k * step] = q15_sat(rs->doth(tapv, &w[pos],
+							  rs->tapc));
+
+			phase += rs->down;
+			pos   += phase / rs->up;
+			phase %= rs->up;
+		}
+	}
+}
+
+
+static void advance(struct resamp *rs, size_t outc, size_t frames)
+{
+	uint64_t t = (uint64_t)rs->phase + (uint64_t)outc * rs->down;
+
+	rs->pos  += (size_t)(t / rs->up);
+	rs->phase = (uint32_t)(t % rs->up);
+	rs->pos  -= frames;
+}
+
+
+static int channels_convert(const struct resamp *rs, int16_t *outv,
+			    size_t *outc, const int16_t *inv, size_t frames)
+{
+	size_t i;
+
+	if (*outc < frames * rs->och)
+		return ENOMEM;
+
+	for (i=0; i<frames; i++) {
+
+		if (rs->ich == rs->och) {
+			memcpy(&outv[i * rs->och], &inv[i * rs->ich],
+			       rs->och * sizeof(int16_t));
+		}
+		else if (rs->och == 1) {
+			outv[i] = (inv[2*i] + inv[2*i + 1]) / 2;
+		}
+		else {
+			outv[2*i] = outv[2*i + 1] = inv[i];
+		}
+	}
+
+	*outc = frames * rs->och;
+
+	return 0;
+}
+
+
+/**
+ * Resample a block of interleaved samples
+ *
+ * @param rs    Resampler
+ * @param outv  Output samples
+ * @param outc  Size of output buffer on entry, number of samples on return
+ * @param inv   Input samples
+ * @param inc   Number of input samples
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int resamp_process(struct resamp *rs, int16_t *outv, size_t *outc,
+		   const int16_t *inv, size_t inc)
+{
+	size_t frames, n;
+	unsigned c;
+	int err;
+
+	if (!rs || !outv || !outc || !inv)
+		return EINVAL;
+
+	if (rs->be == RESAMP_LIBREM)
+		return auresamp(&rs->ars, outv, outc, inv, inc);
+
+	frames = inc / rs->ich;
+
+	if (rs->up == rs->down)
+		return channels_convert(rs, outv, outc, inv, frames);
+
+	n = output_count(rs, frames);
+	if (*outc < n * rs->och)
+		return ENOMEM;
+
+	err = work_fill(rs, inv, frames);
+	if (err)
+		return err;
+
+	for (c=0; c<rs->ch; c++) {
+
+		int16_t *w = rs->workv[c];
+
+		filter_channel(rs, outv + c, n, w);
+
+		/* keep the last input as history */
+		memmove(w, w + frames, (rs->tapc - 1) * sizeof(int16_t));
+	}
+
+	/* mono to stereo */
+	if (rs->och > rs->ch) {
+		size_t k;
+
+		for (k=0; k<n; k++)
+			outv[2*k + 1] = outv[2*k];
+	}
+
+	advance(rs, n, frames);
+
+	*outc = n * rs->och;
+
+	return 0;
+}
+
+
+/**
+ * Get the max. number of output samples for a number of input samples
+ *
+ * @param rs    Resampler
+ * @param inc   Number of input samples
+ *
+ * @return Size of the output buffer in [samples]
+ */
+size_t resamp_outc(const struct resamp *rs, size_t inc)
+{
+	if (!rs || !rs->ich)
+		return 0;
+
+	return (size_t)((uint64_t)(inc / rs->ich) * rs->up / rs->down + 1)
+		* rs->och;
+}
+
+
+const char *resamp_backend_name(enum resamp_backend be)
+{
+	switch (be) {
+
+	case RESAMP_POLYPHASE: return "polyphase";
+	case RESAMP_LIBREM:    return "librem";
+	default:               return "?";
+	}
+}
@@ -0,0 +1,437 @@
+/**
+ * @file src/rtcpxr.c  RTCP XR VoIP Metrics (RFC 3611)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/**
+ * \page RtcpXr RTCP XR VoIP Metrics
+ *
+ * The receiver of a stream counts the received and lost packets by
+ * sequence number as they arrive. Losses are split into bursts and gaps
+ * with the Markov model of RFC 3611 Appendix A.2: a gap is a run of at
+ * least Gmin received packets, with isolated losses only. The state is
+ * a handful of transition counters, updated per packet in O(1).
+ *
+ * The VoIP Metrics report block (RFC 3611 section 4.7) is computed from
+ * these counters, the discards of the jitter buffer, and the MOS
+ * estimate of the stream, and is sent to the peer. The block that the
+ * peer sends tells how the media that we send is received.
+ */
+
+
+enum {
+	XR_GMIN       = 16,    /**< Gap threshold, as recommended      */
+	XR_BT_VOIP    = 7,     /**< VoIP Metrics Report Block type     */
+	XR_VOIP_WORDS = 9,     /**< Words of a VoIP Metrics block      */
+	XR_SEQ_JUMP   = 3000,  /**< Larger jumps restart the counting  */
+	XR_NA         = 127,   /**< Value is unavailable               */
+};
+
+
+static uint8_t fraction(uint64_t num, uint64_t den)
+{
+	uint64_t v;
+
+	if (!den)
+		return 0;
+
+	v = num * 256 / den;
+
+	return v > 255 ? 255 : (uint8_t)v;
+}
+
+
+static uint8_t u8_sat(double v)
+{
+	if (v <= 0)
+		return 0;
+
+	return v >= 255.0 ? 255 : (uint8_t)v;
+}
+
+
+static uint16_t u16_sat(double v)
+{
+	if (v <= 0)
+		return 0;
+
+	return v >= 65535.0 ? 65535 : (uint16_t)v;
+}
+
+
+/* One packet of the loss model of RFC 3611 A.2 */
+static void model_update(struct rtcpxr *xr, bool received)
+{
+	if (received) {
+		++xr->pkt;
+		return;
+	}
+
+	if (xr->pkt >= XR_GMIN) {
+
+		/* the losses since the last gap, none at the start */
+		if (xr->lost == 1)
+			++xr->c14;
+		else if (xr->lost > 1)
+			++xr->c13;
+
+		xr->lost = 1;
+		xr->c11 += xr->pkt;
+	}
+	else {
+		++xr->lost;
+
+		if (xr->pkt == 0) {
+			++xr->c33;
+		}
+		else {
+			++xr->c23;
+			xr->c22 += xr->pkt - 1;
+		}
+	}
+
+	xr->pkt = 0;
+}
+
+
+/**
+ * Count an arriving RTP packet
+ *
+ * @param xr    XR receive statistics
+ * @param seq   RTP sequence number
+ * @param ts    RTP timestamp
+ * @param srate RTP clock rate in [Hz]
+ */
+void rtcpxr_packet(struct rtcpxr *xr, uint16_t seq, uint32_t ts,
+		   uint32_t srate)
+{
+	uint16_t delta;
+
+	if (!xr)
+		return;
+
+	if (!xr->started) {
+		xr->started = true;
+		xr->seq_max = seq;
+		xr->ts_prev = ts;
+		++xr->n_rx;
+		model_update(xr, true);
+		return;
+	}
+
+	delta = seq - xr->seq_max;
+
+	/* duplicate, or late after the gap was counted */
+	if (delta == 0 || delta >= 0x8000)
+		return;
+
+	if (delta < XR_SEQ_JUMP) {
+
+		uint16_t i;
+
+		for (i=1; i<delta; i++) {
+			++xr->n_lost;
+			model_update(xr, false);
+		}
+
+		if (srate && ts != xr->ts_prev)
+			xr->ptime = (uint32_t)((uint64_t)(ts - xr->ts_prev)
+					       * 1000 / srate / delta);
+	}
+
+	xr->seq_max = seq;
+	xr->ts_prev = ts;
+	++xr->n_rx;
+	model_update(xr, true);
+}
+
+
+/**
+ * Count a reordered packet, that rtcpxr_packet() counted as lost when
+ * a newer packet arrived
+ *
+ * @param xr XR receive statistics
+ */
+void rtcpxr_reorder(struct rtcpxr *xr)
+{
+	if (!xr || !xr->n_lost)
+		return;
+
+	--xr->n_lost;
+	++xr->n_rx;
+}
+
+
+/**
+ * Compute the loss and burst metrics of a VoIP Metrics block. The
+ * other fields are left as they are.
+ *
+ * @param v       VoIP metrics
+ * @param xr      XR receive statistics
+ * @param discard Packets discarded by the jitter buffer
+ */
+void rtcpxr_voip_calc(struct rtcpxr_voip *v, const struct rtcpxr *xr,
+		      uint32_t discard)
+{
+	uint64_t c11, c13, c14, c31, c32, c33, ctotal;
+	double p23, p32, m, lgap, lburst;
+	uint64_t expected;
+
+	if (!v || !xr)
+		return;
+
+	expected = (uint64_t)xr->n_rx + xr->n_lost;
+
+	v->loss_rate    = fraction(xr->n_lost, expected);
+	v->discard_rate = fraction(discard, expected);
+	v->gmin         = XR_GMIN;
+
+	c11 = xr->c11;
+	c13 = xr->c13;
+	c14 = xr->c14;
+	c33 = xr->c33;
+
+	/* a current gap ends here, as if the next packet was lost */
+	if (xr->pkt >= XR_GMIN) {
+
+		if (xr->lost == 1)
+			++c14;
+		else if (xr->lost > 1)
+			++c13;
+
+		c11 += xr->pkt;
+	}
+
+	c31    = c13;
+	c32    = xr->c23;
+	ctotal = c11 + c14 + c13 + xr->c22 + xr->c23 + c31 + c32 + c33;
+
+	p32 = (c31 + c32 + c33) ? (double)c32 / (c31 + c32 + c33) : 0;
+	p23 = (xr->c22 + xr->c23) ?
+		1.0 - (double)xr->c22 / (xr->c22 + xr->c23) : 1.0;
+
+	v->gap_density = fraction(c14, c11 + c14);
+
+	m = xr->ptime;
+
+	if (c13) {
+		lgap   = m * (c11 + c14 + c13) / c13;
+		lburst = m * ctotal / c13 - lgap;
+
+		v->burst_density  = u8_sat(256 * p23 / (p23 + p32));
+		v->gap_duration   = u16_sat(lgap);
+		v->burst_duration = u16_sat(lburst);
+	}
+	else {
+		/* no bursts, the whole stream is one gap */
+		v->burst_density  = 0;
+		v->gap_duration   = u16_sat(m * ctotal);
+		v->burst_duration = 0;
+	}
+}
+
+
+/**
+ * Initialize a VoIP Metrics block with all metrics unavailable
+ *
+ * @param v    VoIP metrics
+ * @param ssrc SSRC of the reported source
+ */
+void rtcpxr_voip_init(struct rtcpxr_voip *v, uint32_t ssrc)
+{
+	if (!v)
+		return;
+
+	memset(v, 0, sizeof(*v));
+
+	v->ssrc         = ssrc;
+	v->signal_level = XR_NA;
+	v->noise_level  = XR_NA;
+	v->rerl         = XR_NA;
+	v->gmin         = XR_GMIN;
+	v->r_factor     = XR_NA;
+	v->ext_r_factor = XR_NA;
+	v->mos_lq       = XR_NA;
+	v->mos_cq       = XR_NA;
+}
+
+
+/**
+ * Encode an RTCP XR packet with one VoIP Metrics block
+ *
+ * @param mb   Buffer to encode into
+ * @param ssrc SSRC of the sender of the packet
+ * @param v    VoIP metrics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtcpxr_voip_encode(struct mbuf *mb, uint32_t ssrc,
+		       const struct rtcpxr_voip *v)
+{
+	int err;
+
+	if (!mb || !v)
+		return EINVAL;
+
+	/* header: V=2, one word of SSRC and the block */
+	err  = mbuf_write_u8(mb, 2 << 6);
+	err |= mbuf_write_u8(mb, RTCP_XR);
+	err |= mbuf_write_u16(mb, htons(1 + XR_VOIP_WORDS));
+	err |= mbuf_write_u32(mb, htonl(ssrc));
+
+	err |= mbuf_write_u8(mb, XR_BT_VOIP);
+	err |= mbuf_write_u8(mb, 0);
+	err |= mbuf_write_u16(mb, htons(XR_VOIP_WORDS - 1));
+	err |= mbuf_write_u32(mb, htonl(v->ssrc));
+
+	err |= mbuf_write_u8(mb, v->loss_rate);
+	err |= mbuf_write_u8(mb, v->discard_rate);
+	err |= mbuf_write_u8(mb, v->burst_density);
+	err |= mbuf_write_u8(mb, v->gap_density);
+	err |= mbuf_write_u16(mb, htons(v->burst_duration));
+	err |= mbuf_write_u16(mb, htons(v->gap_duration));
+	err |= mbuf_write_u16(mb, htons(v->rtd));
+	err |= mbuf_write_u16(mb, htons(v->esd));
+
+	err |= mbuf_write_u8(mb, (uint8_t)v->signal_level);
+	err |= mbuf_write_u8(mb, (uint8_t)v->noise_level);
+	err |= mbuf_write_u8(mb, v->rerl);
+	err |= mbuf_write_u8(mb, v->gmin);
+	err |= mbuf_write_u8(mb, v->r_factor);
+	err |= mbuf_write_u8(mb, v->ext_r_factor);
+	err |= mbuf_write_u8(mb, v->mos_lq);
+	err |= mbuf_write_u8(mb, v->mos_cq);
+
+	err |= mbuf_write_u8(mb, v->rx_config);
+	err |= mbuf_write_u8(mb, 0);
+	err |= mbuf_write_u16(mb, htons(v->jb_nominal));
+	err |= mbuf_write_u16(mb, htons(v->jb_max));
+	err |= mbuf_write_u16(mb, htons(v->jb_abs_max));
+
+	return err;
+}
+
+
+static void voip_decode(struct rtcpxr_voip *v, struct mbuf *mb)
+{
+	v->ssrc           = ntohl(mbuf_read_u32(mb));
+	v->loss_rate      = mbuf_read_u8(mb);
+	v->discard_rate   = mbuf_read_u8(mb);
+	v->burst_density  = mbuf_read_u8(mb);
+	v->gap_density    = mbuf_read_u8(mb);
+	v->burst_duration = ntohs(mbuf_read_u16(mb));
+	v->gap_duration   = ntohs(mbuf_read_u16(mb));
+	v->rtd            = ntohs(mbuf_read_u16(mb));
+	v->esd            = ntohs(mbuf_read_u16(mb));
+	v->signal_level   = (int8_t)mbuf_read_u8(mb);
+	v->noise_level    = (int8_t)mbuf_read_u8(mb);
+	v->rerl           = mbuf_read_u8(mb);
+	v->gmin           = mbuf_read_u8(mb);
+	v->r_factor       = mbuf_read_u8(mb);
+	v->ext_r_factor   = mbuf_read_u8(mb);
+	v->mos_lq         = mbuf_read_u8(mb);
+	v->mos_cq         = mbuf_read_u8(mb);
+	v->rx_config      = mbuf_read_u8(mb);
+	(void)mbuf_read_u8(mb);
+	v->jb_nominal     = ntohs(mbuf_read_u16(mb));
+	v->jb_max         = ntohs(mbuf_read_u16(mb));
+	v->jb_abs_max     = ntohs(mbuf_read_u16(mb));
+}
+
+
+/**
+ * Find the first VoIP Metrics block in a compound RTCP packet. The
+ * buffer position is not changed.
+ *
+ * @param v  Returned VoIP metrics
+ * @param mb Buffer with the compound RTCP packet
+ *
+ * @return 0 if found, ENOENT if there is none, EBADMSG if malformed
+ */
+int rtcpxr_voip_decode(struct rtcpxr_voip *v, struct mbuf *mb)
+{
+	const size_t start = mb ? mb->pos : 0;
+	int err = ENOENT;
+
+	if (!v || !mb)
+		return EINVAL;
+
+	while (mbuf_get_left(mb) >= 4) {
+
+		const uint8_t *p = mbuf_buf(mb);
+		size_t len = 4 * ((size_t)(p[2] << 8 | p[3]) + 1);
+		size_t end;
+
+		if ((p[0] >> 6) != 2 || len > mbuf_get_left(mb)) {
+			err = EBADMSG;
+			break;
+		}
+
+		end = mb->pos + len;
+
+		if (p[1] != RTCP_XR || len < 8) {
+			mb->pos = end;
+			continue;
+		}
+
+		mb->pos += 8;
+
+		while (end - mb->pos >= 4) {
+
+			const uint8_t *b = mbuf_buf(mb);
+			size_t blen = 4 * ((size_t)(b[2] << 8 | b[3]) + 1);
+
+			if (blen > end - mb->pos)
+				break;
+
+			if (b[0] == XR_BT_VOIP && blen == 4 * XR_VOIP_WORDS) {
+				mb->pos += 4;
+				voip_decode(v, mb);
+				err = 0;
+				goto out;
+			}
+
+			mb->pos += blen;
+		}
+
+		mb->pos = end;
+	}
+
+ out:
+	mb->pos = start;
+
+	return err;
+}
+
+
+/**
+ * Print a VoIP Metrics block
+ *
+ * @param pf Print handler
+ * @param v  VoIP metrics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtcpxr_voip_debug(struct re_printf *pf, const struct rtcpxr_voip *v)
+{
+	if (!v)
+		return 0;
+
+	return re_hprintf(pf, "loss=%.1f%% discard=%.1f%%"
+			  " burst=%.1f%%/%ums gap=%.1f%%/%ums"
+			  " rtd=%ums esd=%ums R=%u MOS=%.1f"
+			  " jb=%u/%u/%ums",
+			  v->loss_rate * 100.0 / 256,
+			  v->discard_rate * 100.0 / 256,
+			  v->burst_density * 100.0 / 256, v->burst_duration,
+			  v->gap_density * 100.0 / 256, v->gap_duration,
+			  v->rtd, v->esd, v->r_factor,
+			  v->mos_cq == XR_NA ? 0.0 : v->mos_cq / 10.0,
+			  v->jb_nominal, v->jb_max, v->jb_abs_max);
+}
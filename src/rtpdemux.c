@@ -0,0 +1,295 @@
+/**
+ * @file src/rtpdemux.c  Demultiplexing of received RTP by SSRC
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * Each RTP socket has a table of the synchronization sources received
+ * on it, with the stream and the role (primary, RTX or FEC) of each
+ * source. The role depends on the payload type, and is looked up again
+ * when the payload type of a source changes.
+ *
+ * The table is a small open-addressing hash with linear probing, so a
+ * lookup is O(1) and nothing is allocated per packet. When the table is
+ * full, the source that was silent for the longest time is removed.
+ */
+
+
+enum {
+	DEMUX_SIZE  = 32,              /**< Slots, a power of two       */
+	DEMUX_BITS  = 5,               /**< log2 of DEMUX_SIZE          */
+	DEMUX_MAX   = 24,              /**< Max. sources in the table   */
+	IVAL_MAX    = 10000,           /**< Longest interval [ms]       */
+};
+
+struct rtpdemux {
+	struct rtpdemux_entry v[DEMUX_SIZE];
+	uint32_t n;                    /**< Sources in the table        */
+	uint32_t n_evict;              /**< Sources removed when full   */
+};
+
+
+static inline uint32_t slot(uint32_t ssrc)
+{
+	return (ssrc * 2654435761u) >> (32 - DEMUX_BITS);
+}
+
+
+/* Remove the entry in slot i, and move up the entries after it */
+static void remove_at(struct rtpdemux *dm, uint32_t i)
+{
+	uint32_t j = i;
+
+	for (;;) {
+		uint32_t k;
+
+		j = (j + 1) & (DEMUX_SIZE - 1);
+		if (!dm->v[j].used)
+			break;
+
+		k = slot(dm->v[j].ssrc);
+
+		/* the entry can move if its home slot is not in (i, j] */
+		if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+			dm->v[i] = dm->v[j];
+			i = j;
+		}
+	}
+
+	memset(&dm->v[i], 0, sizeof(dm->v[i]));
+	--dm->n;
+}
+
+
+static void evict(struct rtpdemux *dm)
+{
+	uint32_t i, oldest = DEMUX_SIZE;
+
+	for (i=0; i<DEMUX_SIZE; i++) {
+
+		if (!dm->v[i].used)
+			continue;
+
+		if (oldest == DEMUX_SIZE || dm->v[i].last < dm->v[oldest].last)
+			oldest = i;
+	}
+
+	if (oldest == DEMUX_SIZE)
+		return;
+
+	remove_at(dm, oldest);
+	++dm->n_evict;
+}
+
+
+/**
+ * Allocate an RTP demultiplexing table
+ *
+ * @param dmp Pointer to allocated table
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpdemux_alloc(struct rtpdemux **dmp)
+{
+	struct rtpdemux *dm;
+
+	if (!dmp)
+		return EINVAL;
+
+	dm = mem_zalloc(sizeof(*dm), NULL);
+	if (!dm)
+		return ENOMEM;
+
+	*dmp = dm;
+
+	return 0;
+}
+
+
+/**
+ * Find a synchronization source
+ *
+ * @param dm   RTP demultiplexing table
+ * @param ssrc Synchronization source
+ *
+ * @return Entry of the source, or NULL if not found
+ */
+struct rtpdemux_entry *rtpdemux_lookup(const struct rtpdemux *dm,
+				       uint32_t ssrc)
+{
+	uint32_t i, n;
+
+	if (!dm)
+		return NULL;
+
+	i = slot(ssrc);
+
+	for (n=0; n<DEMUX_SIZE; n++) {
+
+		const struct rtpdemux_entry *e = &dm->v[i];
+
+		if (!e->used)
+			return NULL;
+
+		if (e->ssrc == ssrc)
+			return (struct rtpdemux_entry *)e;
+
+		i = (i + 1) & (DEMUX_SIZE - 1);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Add a synchronization source, or update it if it is known. The entry
+ * is valid until the next call to rtpdemux_add() or rtpdemux_remove().
+ *
+ * @param dm   RTP demultiplexing table
+ * @param ssrc Synchronization source
+ * @param pt   Payload type
+ * @param role Role of the source
+ * @param arg  Stream of the source
+ *
+ * @return Entry of the source, or NULL if no table
+ */
+struct rtpdemux_entry *rtpdemux_add(struct rtpdemux *dm, uint32_t ssrc,
+				    uint8_t pt, enum rtp_role role,
+				    void *arg)
+{
+	struct rtpdemux_entry *e;
+	uint32_t i;
+
+	if (!dm)
+		return NULL;
+
+	e = rtpdemux_lookup(dm, ssrc);
+	if (!e) {
+		if (dm->n >= DEMUX_MAX)
+			evict(dm);
+
+		for (i = slot(ssrc); dm->v[i].used;
+		     i = (i + 1) & (DEMUX_SIZE - 1))
+			;
+
+		e = &dm->v[i];
+		e->used = true;
+		e->ssrc = ssrc;
+		++dm->n;
+	}
+
+	e->pt   = pt;
+	e->role = role;
+	e->arg  = arg;
+
+	return e;
+}
+
+
+/**
+ * Count a received packet of a synchronization source
+ *
+ * @param e   Entry of the source
+ * @param len Length of the packet in [bytes]
+ * @param now Current time in [ms]
+ */
+void rtpdemux_packet(struct rtpdemux_entry *e, size_t len, uint64_t now)
+{
+	if (!e)
+		return;
+
+	if (e->last && now >= e->last) {
+
+		const uint32_t d = (uint32_t)min(now - e->last,
+						 (uint64_t)IVAL_MAX);
+
+		e->ival = e->n_pkt > 1 ? (7 * e->ival + d) / 8 : d;
+	}
+
+	e->last = now;
+	++e->n_pkt;
+	e->n_bytes += len;
+}
+
+
+/**
+ * Remove all synchronization sources of a stream
+ *
+ * @param dm  RTP demultiplexing table
+ * @param arg Stream of the sources
+ */
+void rtpdemux_remove(struct rtpdemux *dm, const void *arg)
+{
+	uint32_t i = 0;
+
+	if (!dm)
+		return;
+
+	while (i < DEMUX_SIZE) {
+
+		/* another entry may have moved into the slot */
+		if (dm->v[i].used && dm->v[i].arg == arg)
+			remove_at(dm, i);
+		else
+			++i;
+	}
+}
+
+
+/**
+ * Get the number of synchronization sources in the table
+ *
+ * @param dm RTP demultiplexing table
+ *
+ * @return Number of sources
+ */
+uint32_t rtpdemux_count(const struct rtpdemux *dm)
+{
+	return dm ? dm->n : 0;
+}
+
+
+static const char *role_name(enum rtp_role role)
+{
+	switch (role) {
+
+	case RTP_ROLE_PRIMARY: return "primary";
+	case RTP_ROLE_RTX:     return "rtx";
+	case RTP_ROLE_FEC:     return "fec";
+	default:               return "?";
+	}
+}
+
+
+int rtpdemux_debug(struct re_printf *pf, const struct rtpdemux *dm)
+{
+	uint32_t i;
+	int err;
+
+	if (!dm)
+		return 0;
+
+	err = re_hprintf(pf, " sources: %u (%u evicted)\n",
+			 dm->n, dm->n_evict);
+
+	for (i=0; i<DEMUX_SIZE; i++) {
+
+		const struct rtpdemux_entry *e = &dm->v[i];
+
+		if (!e->used)
+			continue;
+
+		err |= re_hprintf(pf, "  ssrc=%08x pt=%u %-7s packets=%llu"
+				  " bytes=%llu dropped=%u interval=%ums\n",
+				  e->ssrc, e->pt, role_name(e->role),
+				  e->n_pkt, e->n_bytes, e->n_drop, e->ival);
+	}
+
+	return err;
+}
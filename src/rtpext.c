@@ -0,0 +1,160 @@
+/**
+ * @file src/rtpext.c  RTP Header Extensions (RFC 8285)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * Only the one-byte header form is sent. Each element has a 4-bit ID
+ * and a 4-bit length minus one, followed by its data. The elements are
+ * padded with zero bytes to a multiple of 32 bits.
+ */
+
+
+static const char *uriv[RTPEXT_MAX] = {
+	"urn:ietf:params:rtp-hdrext:ssrc-audio-level",
+	"http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time",
+	"http://www.ietf.org/id/"
+	"draft-holmer-rmcat-transport-wide-cc-extensions-01",
+};
+
+
+/**
+ * Get the URI of a built-in header extension, as in a=extmap
+ *
+ * @param type Header extension
+ *
+ * @return URI, or NULL if not known
+ */
+const char *rtpext_uri(enum rtpext_type type)
+{
+	return (unsigned)type < RTPEXT_MAX ? uriv[type] : NULL;
+}
+
+
+/**
+ * Find a built-in header extension by its URI
+ *
+ * @param uri URI from a=extmap
+ *
+ * @return Header extension type, or -1 if not known
+ */
+int rtpext_find(const struct pl *uri)
+{
+	int i;
+
+	for (i=0; i<RTPEXT_MAX; i++) {
+
+		if (0 == pl_strcmp(uri, uriv[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+
+/**
+ * Encode the header of a header extension
+ *
+ * @param mb        Buffer to encode into
+ * @param num_bytes Length of the elements, without padding
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpext_hdr_encode(struct mbuf *mb, size_t num_bytes)
+{
+	int err;
+
+	if (!mb || !num_bytes)
+		return EINVAL;
+
+	err  = mbuf_write_u16(mb, htons(RTPEXT_TYPE_MAGIC));
+	err |= mbuf_write_u16(mb, htons((uint16_t)((num_bytes + 3) / 4)));
+
+	return err;
+}
+
+
+/**
+ * Encode one element of a header extension
+ *
+ * @param mb   Buffer to encode into
+ * @param id   Local identifier, 1-14
+ * @param len  Length of data, 1-16
+ * @param data Element data
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpext_encode(struct mbuf *mb, unsigned id, size_t len,
+		  const uint8_t *data)
+{
+	int err;
+
+	if (!mb || !data)
+		return EINVAL;
+
+	if (id < RTPEXT_ID_MIN || id > RTPEXT_ID_MAX)
+		return EINVAL;
+	if (len < 1 || len > RTPEXT_LEN_MAX)
+		return EINVAL;
+
+	err  = mbuf_write_u8(mb, (uint8_t)(id << 4 | (len - 1)));
+	err |= mbuf_write_mem(mb, data, len);
+
+	return err;
+}
+
+
+/**
+ * Decode the next element of a header extension, skipping padding
+ *
+ * @param ext Returned element
+ * @param mb  Buffer with the elements, from mb->pos
+ *
+ * @return 0 if success, ENOENT at the end, otherwise errorcode
+ */
+int rtpext_decode(struct rtpext *ext, struct mbuf *mb)
+{
+	uint8_t v;
+
+	if (!ext || !mb)
+		return EINVAL;
+
+	do {
+		if (!mbuf_get_left(mb))
+			return ENOENT;
+
+		v = mbuf_read_u8(mb);
+
+	} while (v == 0);
+
+	ext->id  = v >> 4;
+	ext->len = (v & 0x0f) + 1;
+
+	/* reserved, the rest must be ignored */
+	if (ext->id == 15)
+		return ENOENT;
+
+	if (mbuf_get_left(mb) < ext->len)
+		return EBADMSG;
+
+	return mbuf_read_mem(mb, ext->data, ext->len);
+}
+
+
+/**
+ * Get the 24-bit abs-send-time value, 6.18 fixed point seconds
+ *
+ * @param us Time in [us]
+ *
+ * @return abs-send-time value
+ */
+uint32_t rtpext_abs_send_time(uint64_t us)
+{
+	/* wraps every 64 seconds */
+	return (uint32_t)(((us % 64000000) << 18) / 1000000);
+}
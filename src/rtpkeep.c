@@ -27,7 +27,7 @@ enum {
 struct rtpkeep {
 	struct rtp_sock *rtp;
 	struct sdp_media *sdp;
-	struct tmr tmr;
+	struct twheel_tmr tmr;
 	char *method;
 	uint32_t ts;
 	bool flag;
@@ -38,7 +38,7 @@ static void destructor(void *arg)
 {
 	struct rtpkeep *rk = arg;
 
-	tmr_cancel(&rk->tmr);
+	twheel_tmr_cancel(&rk->tmr);
 	mem_deref(rk->method);
 }
 
@@ -102,14 +102,20 @@ static int send_keepalive(struct rtpkeep *rk)
  * last period of 0 - 15 seconds. Start transmitting RTP keepalives
  * now and every 15 seconds after that.
  *
+ * When the binding lifetime of the NAT is known, the period follows
+ * it instead of 15 seconds.
+ *
  * @param arg Handler argument
  */
 static void timeout(void *arg)
 {
 	struct rtpkeep *rk = arg;
+	const int af = sa_af(sdp_media_raddr(rk->sdp));
 	int err;
 
-	tmr_start(&rk->tmr, Tr_UDP * 1000, timeout, rk);
+	twheel_tmr_start(&rk->tmr, baresip_twheel(),
+			 net_keepalive(baresip_network(), af, Tr_UDP) * 1000,
+			 timeout, rk);
 
 	if (rk->flag) {
 		rk->flag = false;
@@ -143,7 +149,7 @@ int rtpkeep_alloc(struct rtpkeep **rkp, const char *method, int proto,
 	if (err)
 		goto out;
 
-	tmr_start(&rk->tmr, 20, timeout, rk);
+	twheel_tmr_start(&rk->tmr, baresip_twheel(), 20, timeout, rk);
 
  out:
 	if (err)
@@ -163,3 +169,21 @@ void rtpkeep_refresh(struct rtpkeep *rk, uint32_t ts)
 	rk->ts = ts;
 	rk->flag = true;
 }
+
+
+/**
+ * Print the keepalive method, and the timer wheel it shares
+ *
+ * @param pf Print handler
+ * @param rk RTP Keepalive
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpkeep_debug(struct re_printf *pf, const struct rtpkeep *rk)
+{
+	if (!rk)
+		return 0;
+
+	return re_hprintf(pf, " rtpkeep: %s, %H\n",
+			  rk->method, twheel_debug, baresip_twheel());
+}
@@ -0,0 +1,340 @@
+/**
+ * @file src/rtx.c  RTP send history and retransmission (RFC 4588)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The payload of each sent RTP packet is copied into a ring, before it
+ * is encrypted. The sequence number is only known after the packet is
+ * sent, so a packet is stored in two steps, rtx_store() and then
+ * rtx_commit(). A NACKed packet is encoded as an RTX packet, with the
+ * original sequence number in front of the payload.
+ *
+ * Retransmissions are limited by a token bucket, and a packet is not
+ * resent twice within RTX_RESEND_MIN, so that a NACK which crossed the
+ * retransmission does not send it again.
+ */
+
+
+enum {
+	RTX_PKTSIZE    = 1500,  /**< Largest stored payload [bytes]        */
+	RTX_RESEND_MIN = 50,    /**< Min time between resends [ms]         */
+	RTX_BURST      = 250,   /**< Bucket size in time at the rate [ms]  */
+};
+
+struct rtx_pkt {
+	uint64_t ts_sent;       /**< Time when last sent [ms]              */
+	uint32_t ts;            /**< RTP timestamp                         */
+	uint16_t seq;           /**< RTP sequence number                   */
+	uint16_t len;           /**< Payload length                        */
+	bool marker;            /**< RTP marker bit                        */
+	bool valid;             /**< Committed                             */
+	uint8_t buf[RTX_PKTSIZE];
+};
+
+struct rtx {
+	struct lock *lock;      /**< Sender and RTCP handler threads       */
+	struct rtx_pkt *pktv;   /**< Ring of sent packets                  */
+	uint32_t pktc;          /**< Size of the ring                      */
+	uint32_t head;          /**< Next slot in the ring                 */
+	uint32_t rate;          /**< Retransmission rate limit [bit/s]     */
+	uint32_t tokens;        /**< Token bucket [bytes]                  */
+	uint64_t ts_tokens;     /**< Last refill of the bucket [ms]        */
+	uint32_t n_resent;      /**< Packets retransmitted                 */
+	uint32_t n_missing;     /**< NACKed, not in the history            */
+	uint32_t n_limited;     /**< NACKed, dropped by the rate limit     */
+};
+
+
+/* Bytes sent at a rate in [bit/s] during a time in [ms] */
+static inline uint32_t rate_bytes(uint32_t rate, uint64_t ms)
+{
+	return (uint32_t)min((uint64_t)rate * ms / 8000, (uint64_t)UINT32_MAX);
+}
+
+
+static void destructor(void *arg)
+{
+	struct rtx *rtx = arg;
+
+	mem_deref(rtx->pktv);
+	mem_deref(rtx->lock);
+}
+
+
+/**
+ * Allocate an RTP send history
+ *
+ * @param rtxp Pointer to allocated send history
+ * @param pktc Number of packets in the history
+ * @param rate Retransmission rate limit in [bit/s]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtx_alloc(struct rtx **rtxp, uint32_t pktc, uint32_t rate)
+{
+	struct rtx *rtx;
+	int err;
+
+	if (!rtxp || !pktc || !rate)
+		return EINVAL;
+
+	rtx = mem_zalloc(sizeof(*rtx), destructor);
+	if (!rtx)
+		return ENOMEM;
+
+	rtx->pktv = mem_zalloc(pktc * sizeof(*rtx->pktv), NULL);
+	if (!rtx->pktv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = lock_alloc(&rtx->lock);
+	if (err)
+		goto out;
+
+	rtx->pktc   = pktc;
+	rtx->rate   = rate;
+	rtx->tokens = rate_bytes(rate, RTX_BURST);
+
+ out:
+	if (err)
+		mem_deref(rtx);
+	else
+		*rtxp = rtx;
+
+	return err;
+}
+
+
+/**
+ * Store the payload of an RTP packet before it is sent
+ *
+ * @param rtx    RTP send history
+ * @param marker RTP marker bit
+ * @param ts     RTP timestamp
+ * @param mb     Buffer with RTP payload, from mb->pos
+ */
+void rtx_store(struct rtx *rtx, bool marker, uint32_t ts,
+	       const struct mbuf *mb)
+{
+	struct rtx_pkt *pkt;
+	size_t len;
+
+	if (!rtx || !mb)
+		return;
+
+	len = mbuf_get_left(mb);
+
+	lock_write_get(rtx->lock);
+
+	pkt = &rtx->pktv[rtx->head];
+	pkt->valid  = false;
+	pkt->marker = marker;
+	pkt->ts     = ts;
+	pkt->len    = (uint16_t)min(len, sizeof(pkt->buf));
+	memcpy(pkt->buf, mbuf_buf(mb), pkt->len);
+
+	/* a larger packet is not committed */
+	if (len > sizeof(pkt->buf))
+		pkt->len = 0;
+
+	lock_rel(rtx->lock);
+}
+
+
+/**
+ * Commit the last stored packet, after it was sent
+ *
+ * @param rtx RTP send history
+ * @param seq RTP sequence number of the sent packet
+ * @param now Current time in [ms]
+ */
+void rtx_commit(struct rtx *rtx, uint16_t seq, uint64_t now)
+{
+	struct rtx_pkt *pkt;
+
+	if (!rtx)
+		return;
+
+	lock_write_get(rtx->lock);
+
+	pkt = &rtx->pktv[rtx->head];
+
+	if (pkt->len) {
+		pkt->seq     = seq;
+		pkt->ts_sent = now;
+		pkt->valid   = true;
+		rtx->head    = (rtx->head + 1) % rtx->pktc;
+	}
+
+	lock_rel(rtx->lock);
+}
+
+
+static struct rtx_pkt *pkt_find(struct rtx *rtx, uint16_t seq)
+{
+	uint32_t newest = (rtx->head + rtx->pktc - 1) % rtx->pktc;
+	struct rtx_pkt *pkt = &rtx->pktv[newest];
+	uint16_t d;
+	uint32_t i;
+
+	if (!pkt->valid)
+		return NULL;
+
+	/* the sequence numbers are usually contiguous */
+	d = pkt->seq - seq;
+	if (d < rtx->pktc) {
+		pkt = &rtx->pktv[(newest + rtx->pktc - d) % rtx->pktc];
+		if (pkt->valid && pkt->seq == seq)
+			return pkt;
+	}
+
+	for (i=0; i<rtx->pktc; i++) {
+
+		pkt = &rtx->pktv[i];
+
+		if (pkt->valid && pkt->seq == seq)
+			return pkt;
+	}
+
+	return NULL;
+}
+
+
+static void tokens_refill(struct rtx *rtx, uint64_t now)
+{
+	const uint32_t burst = rate_bytes(rtx->rate, RTX_BURST);
+	uint64_t ms;
+
+	if (!rtx->ts_tokens)
+		rtx->ts_tokens = now;
+
+	ms = now - rtx->ts_tokens;
+	if (!ms)
+		return;
+
+	rtx->tokens = (uint32_t)min((uint64_t)rtx->tokens +
+				    rate_bytes(rtx->rate, ms), burst);
+	rtx->ts_tokens = now;
+}
+
+
+/**
+ * Encode the RTX payload of a packet in the send history
+ *
+ * @param rtx    RTP send history
+ * @param mbp    Returned buffer with RTX payload from mb->pos
+ * @param presz  Headroom in front of the payload
+ * @param seq    RTP sequence number of the lost packet
+ * @param now    Current time in [ms]
+ * @param marker Returned RTP marker bit of the packet
+ * @param ts     Returned RTP timestamp of the packet
+ *
+ * @return 0 if success, ENOENT if not in the history, EALREADY if it
+ *         was sent very recently, ENOSPC if above the rate limit
+ */
+int rtx_encode(struct rtx *rtx, struct mbuf **mbp, size_t presz,
+	       uint16_t seq, uint64_t now, bool *marker, uint32_t *ts)
+{
+	struct rtx_pkt *pkt;
+	struct mbuf *mb = NULL;
+	int err = 0;
+
+	if (!rtx || !mbp || !marker || !ts)
+		return EINVAL;
+
+	lock_write_get(rtx->lock);
+
+	pkt = pkt_find(rtx, seq);
+	if (!pkt) {
+		++rtx->n_missing;
+		err = ENOENT;
+		goto out;
+	}
+
+	if (now - pkt->ts_sent < RTX_RESEND_MIN) {
+		err = EALREADY;
+		goto out;
+	}
+
+	tokens_refill(rtx, now);
+
+	if (rtx->tokens < pkt->len) {
+		++rtx->n_limited;
+		err = ENOSPC;
+		goto out;
+	}
+
+	mb = mbuf_alloc(presz + 2 + pkt->len);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	mb->pos = mb->end = presz;
+
+	err  = mbuf_write_u16(mb, htons(pkt->seq));
+	err |= mbuf_write_mem(mb, pkt->buf, pkt->len);
+	if (err)
+		goto out;
+
+	mb->pos = presz;
+
+	rtx->tokens -= pkt->len;
+	pkt->ts_sent = now;
+	++rtx->n_resent;
+
+	*marker = pkt->marker;
+	*ts     = pkt->ts;
+
+ out:
+	lock_rel(rtx->lock);
+
+	if (err)
+		mem_deref(mb);
+	else
+		*mbp = mb;
+
+	return err;
+}
+
+
+/**
+ * Decode the payload of an RTX packet in place
+ *
+ * @param mb  Buffer with RTX payload, mb->pos is moved past the OSN
+ * @param seq Returned original sequence number
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtx_decode(struct mbuf *mb, uint16_t *seq)
+{
+	if (!mb || !seq)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) < 2)
+		return EBADMSG;
+
+	*seq = ntohs(mbuf_read_u16(mb));
+
+	return 0;
+}
+
+
+int rtx_debug(struct re_printf *pf, const struct rtx *rtx)
+{
+	if (!rtx)
+		return 0;
+
+	return re_hprintf(pf, "rtx: history=%u packets limit=%u bit/s"
+			  " resent=%u missing=%u limited=%u",
+			  rtx->pktc, rtx->rate, rtx->n_resent,
+			  rtx->n_missing, rtx->n_limited);
+}
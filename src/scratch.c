@@ -0,0 +1,157 @@
+/**
+ * @file scratch.c  Scratch buffers shared by the streams of a thread
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * A stream needs its resampler and time-stretch buffers only while it
+ * processes one frame. The buffers are kept per thread instead of per
+ * stream, so all calls handled by one media thread share them. They only
+ * grow, and are freed when the thread exits.
+ */
+
+
+struct scratch {
+	int16_t *sampv[SCRATCH_N];    /**< Buffer of each slot         */
+	size_t sampc[SCRATCH_N];      /**< Size of each slot [samples] */
+};
+
+static size_t scratch_bytes;      /**< Total of all threads (atomic) */
+
+
+static void destructor(void *arg)
+{
+	struct scratch *sc = arg;
+	unsigned i;
+
+	for (i=0; i<SCRATCH_N; i++) {
+		ATOMIC_ADD(&scratch_bytes, -(sc->sampc[i] * sizeof(int16_t)));
+		mem_deref(sc->sampv[i]);
+	}
+}
+
+
+#ifdef HAVE_PTHREAD
+static pthread_key_t key;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+
+static void key_destructor(void *arg)
+{
+	mem_deref(arg);
+}
+
+
+static void key_init(void)
+{
+	(void)pthread_key_create(&key, key_destructor);
+}
+
+
+static struct scratch *scratch_get(void)
+{
+	struct scratch *sc;
+
+	(void)pthread_once(&once, key_init);
+
+	sc = pthread_getspecific(key);
+	if (sc)
+		return sc;
+
+	sc = mem_zalloc(sizeof(*sc), destructor);
+	if (!sc)
+		return NULL;
+
+	if (pthread_setspecific(key, sc)) {
+		mem_deref(sc);
+		return NULL;
+	}
+
+	return sc;
+}
+#else
+static struct scratch *cur;
+
+
+static struct scratch *scratch_get(void)
+{
+	if (!cur)
+		cur = mem_zalloc(sizeof(*cur), destructor);
+
+	return cur;
+}
+#endif
+
+
+/**
+ * Get a scratch buffer of the calling thread. The buffer is valid until
+ * the next call with the same slot on this thread.
+ *
+ * @param slot  Slot of the buffer, one for each buffer in use at a time
+ * @param sampc Minimum size in [samples]
+ *
+ * @return Scratch buffer, or NULL if out of memory
+ */
+int16_t *scratch_samp(enum scratch_slot slot, size_t sampc)
+{
+	struct scratch *sc;
+	int16_t *sampv;
+
+	if (slot >= SCRATCH_N)
+		return NULL;
+
+	sc = scratch_get();
+	if (!sc)
+		return NULL;
+
+	if (sampc <= sc->sampc[slot])
+		return sc->sampv[slot];
+
+	sampv = mem_realloc(sc->sampv[slot], sampc * sizeof(int16_t));
+	if (!sampv)
+		return NULL;
+
+	ATOMIC_ADD(&scratch_bytes,
+		   (sampc - sc->sampc[slot]) * sizeof(int16_t));
+
+	sc->sampv[slot] = sampv;
+	sc->sampc[slot] = sampc;
+
+	return sampv;
+}
+
+
+/**
+ * Free the scratch buffers of the calling thread. Other threads free
+ * their buffers when they exit.
+ */
+void scratch_close(void)
+{
+#ifdef HAVE_PTHREAD
+	(void)pthread_once(&once, key_init);
+
+	mem_deref(pthread_getspecific(key));
+	(void)pthread_setspecific(key, NULL);
+#else
+	cur = mem_deref(cur);
+#endif
+}
+
+
+/**
+ * Get the size of the scratch buffers of all threads
+ *
+ * @return Size in [bytes]
+ */
+size_t scratch_mem(void)
+{
+	return ATOMIC_LOAD(&scratch_bytes);
+}
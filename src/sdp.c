@@ -4,6 +4,7 @@
  * Copyright (C) 2011 Creytiv.com
  */
 #include <stdlib.h>
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 #include "core.h"
@@ -67,6 +68,127 @@ int sdp_fingerprint_decode(const char *attr, struct pl *hash,
 }
 
 
+/**
+ * Decode an a=extmap attribute (RFC 8285)
+ *
+ * @param ext Returned header extension mapping
+ * @param val Attribute value
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sdp_extmap_decode(struct sdp_extmap *ext, const char *val)
+{
+	struct pl id, dir;
+
+	if (!ext || !val)
+		return EINVAL;
+
+	memset(ext, 0, sizeof(*ext));
+
+	if (re_regex(val, str_len(val), "[0-9]+[/]*[a-z]* [^ ]+",
+		     &id, NULL, &dir, &ext->name))
+		return EBADMSG;
+
+	ext->id = pl_u32(&id);
+
+	/* the extension attributes are the rest of the line */
+	ext->attrs.p = ext->name.p + ext->name.l;
+	ext->attrs.l = str_len(val) - (ext->attrs.p - val);
+	while (ext->attrs.l && *ext->attrs.p == ' ') {
+		++ext->attrs.p;
+		--ext->attrs.l;
+	}
+
+	if (pl_isset(&dir)) {
+		if (!pl_strcmp(&dir, "sendonly"))
+			ext->dir = SDP_SENDONLY;
+		else if (!pl_strcmp(&dir, "recvonly"))
+			ext->dir = SDP_RECVONLY;
+		else if (!pl_strcmp(&dir, "inactive"))
+			ext->dir = SDP_INACTIVE;
+		else
+			return EBADMSG;
+	}
+	else {
+		ext->dir = SDP_SENDRECV;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Find a media identification tag in an a=group:BUNDLE value (RFC 8843)
+ *
+ * @param val Attribute value, e.g. "BUNDLE audio video"
+ * @param mid Media identification tag
+ *
+ * @return Position of the tag, 0 for the tagged media, -1 if not found
+ */
+int sdp_bundle_find(const char *val, const char *mid)
+{
+	struct pl pl, tag;
+	int i;
+
+	if (!val || !mid || strncmp(val, "BUNDLE ", 7))
+		return -1;
+
+	pl_set_str(&pl, val + 7);
+
+	for (i=0; !re_regex(pl.p, pl.l, "[^ ]+", &tag); i++) {
+
+		if (0 == pl_strcmp(&tag, mid))
+			return i;
+
+		pl_advance(&pl, tag.p + tag.l - pl.p);
+	}
+
+	return -1;
+}
+
+
+struct bundle_arg {
+	const char *mid;
+	int pos;
+};
+
+
+static bool bundle_handler(const char *name, const char *value, void *arg)
+{
+	struct bundle_arg *ba = arg;
+	(void)name;
+
+	ba->pos = sdp_bundle_find(value, ba->mid);
+
+	return ba->pos >= 0;
+}
+
+
+/**
+ * Get the position of a media line in the remote BUNDLE group
+ *
+ * @param sess SDP Session
+ * @param m    SDP Media, with a remote a=mid attribute
+ *
+ * @return Position in the group, 0 for the tagged media, -1 if not bundled
+ */
+int sdp_bundle_index(const struct sdp_session *sess,
+		     const struct sdp_media *m)
+{
+	struct bundle_arg ba;
+
+	ba.mid = sdp_media_rattr(m, "mid");
+	ba.pos = -1;
+
+	if (!sess || !ba.mid)
+		return -1;
+
+	(void)sdp_session_rattr_apply(sess, "group", bundle_handler, &ba);
+
+	return ba.pos;
+}
+
+
 bool sdp_media_has_media(const struct sdp_media *m)
 {
 	bool has;
@@ -117,7 +239,9 @@ const struct sdp_format *sdp_media_format_cycle(struct sdp_media *m)
 	list_append(lst, &sf->le, sf);
 
 	sf = (struct sdp_format *)sdp_media_rformat(m, NULL);
-	if (!str_casecmp(sf->name, telev_rtpfmt))
+	if (!str_casecmp(sf->name, telev_rtpfmt) ||
+	    !str_casecmp(sf->name, "rtx") ||
+	    !str_casecmp(sf->name, "flexfec"))
 		goto again;
 
 	return sf;
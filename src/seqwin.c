@@ -0,0 +1,264 @@
+/**
+ * @file src/seqwin.c  Window of received RTP sequence numbers
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The window is a bitmap of the last SEQWIN_SIZE sequence numbers, bit 0
+ * is the highest one received. A packet older than the highest sets its
+ * bit, so a reordered packet is not counted as lost, and a packet that
+ * has its bit set already is a duplicate. When the window moves on, the
+ * sequence numbers that leave it are final: a missing one is lost, and
+ * consecutive missing ones are a loss burst. The counters of the final
+ * sequence numbers only grow, so they can be sampled for intervals.
+ *
+ * Each sequence number leaves the window once, so an update is O(1)
+ * on average.
+ */
+
+
+enum {
+	SEQWIN_SIZE = 64,       /**< Sequence numbers in the window      */
+	SEQWIN_JUMP = 3000,     /**< Larger jumps restart the window     */
+};
+
+
+static unsigned burst_bucket(uint32_t len)
+{
+	if (len <= 4)
+		return len - 1;
+	else if (len <= 8)
+		return 4;
+	else if (len <= 16)
+		return 5;
+	else if (len <= 32)
+		return 6;
+	else
+		return 7;
+}
+
+
+static void burst_end(struct seqwin *w)
+{
+	if (!w->burst)
+		return;
+
+	++w->burstv[burst_bucket(w->burst)];
+	w->burst = 0;
+}
+
+
+/* A sequence number leaves the window */
+static inline void leave(struct seqwin *w, bool received)
+{
+	++w->n_final;
+
+	if (received) {
+		burst_end(w);
+	}
+	else {
+		++w->n_lost;
+		++w->burst;
+	}
+}
+
+
+/* Move the n oldest sequence numbers out of the window */
+static void shift(struct seqwin *w, uint32_t n)
+{
+	uint32_t i, k = min(n, (uint32_t)SEQWIN_SIZE);
+
+	for (i=0; i<k; i++) {
+
+		const uint32_t pos = SEQWIN_SIZE - 1 - i;
+
+		if (pos < w->valid)
+			leave(w, (w->bits >> pos) & 1);
+	}
+
+	/* these were never in the window */
+	if (n > SEQWIN_SIZE) {
+		w->n_final += n - SEQWIN_SIZE;
+		w->n_lost  += n - SEQWIN_SIZE;
+		w->burst   += n - SEQWIN_SIZE;
+	}
+
+	w->bits  = n < SEQWIN_SIZE ? w->bits << n : 0;
+	w->valid = min(w->valid + n, (uint32_t)SEQWIN_SIZE);
+}
+
+
+/**
+ * Start the window again with the next packet, for example after the
+ * synchronization source changed. The counters are kept.
+ *
+ * @param w Sequence window
+ */
+void seqwin_restart(struct seqwin *w)
+{
+	uint32_t pos;
+
+	if (!w || !w->started)
+		return;
+
+	for (pos = w->valid; pos-- > 0; )
+		leave(w, (w->bits >> pos) & 1);
+
+	burst_end(w);
+
+	w->bits    = 0;
+	w->valid   = 0;
+	w->started = false;
+}
+
+
+/**
+ * Add a received sequence number to the window
+ *
+ * @param w   Sequence window
+ * @param seq RTP sequence number
+ *
+ * @return What the packet is, see enum seqwin_res
+ */
+enum seqwin_res seqwin_update(struct seqwin *w, uint16_t seq)
+{
+	int16_t d;
+	uint32_t back;
+
+	if (!w)
+		return SEQWIN_NEW;
+
+	w->gap = 0;
+
+	if (!w->started) {
+		w->started = true;
+		w->max     = seq;
+		w->bits    = 1;
+		w->valid   = 1;
+		++w->n_rx;
+		return SEQWIN_NEW;
+	}
+
+	d = (int16_t)(seq - w->max);
+
+	if (d > SEQWIN_JUMP || d < -SEQWIN_JUMP) {
+		seqwin_restart(w);
+		(void)seqwin_update(w, seq);
+		++w->n_restart;
+		return SEQWIN_RESTART;
+	}
+
+	if (d > 0) {
+		shift(w, d);
+		w->bits |= 1;
+		w->max   = seq;
+		w->gap   = d - 1;
+		++w->n_rx;
+		return SEQWIN_NEW;
+	}
+
+	if (d == 0) {
+		++w->n_dup;
+		return SEQWIN_DUP;
+	}
+
+	back = -d;
+
+	if (back >= w->valid) {
+		++w->n_late;
+		return SEQWIN_LATE;
+	}
+
+	if ((w->bits >> back) & 1) {
+		++w->n_dup;
+		return SEQWIN_DUP;
+	}
+
+	w->bits |= (uint64_t)1 << back;
+	w->reorder_max = max(w->reorder_max, back);
+	++w->n_reorder;
+	++w->n_rx;
+
+	return SEQWIN_REORDER;
+}
+
+
+/**
+ * Get the number of packets that are missing, including the ones in
+ * the window that may still arrive
+ *
+ * @param w Sequence window
+ *
+ * @return Number of missing packets
+ */
+uint64_t seqwin_lost(const struct seqwin *w)
+{
+	uint64_t lost;
+	uint32_t pos;
+
+	if (!w)
+		return 0;
+
+	lost = w->n_lost;
+
+	for (pos=0; pos<w->valid; pos++) {
+		if (!((w->bits >> pos) & 1))
+			++lost;
+	}
+
+	return lost;
+}
+
+
+/**
+ * Get the loss since the previous call, of the sequence numbers that
+ * left the window
+ *
+ * @param w        Sequence window
+ * @param expected Returns the number of expected packets
+ * @param lost     Returns the number of lost packets
+ */
+void seqwin_interval(struct seqwin *w, uint64_t *expected, uint64_t *lost)
+{
+	if (!w)
+		return;
+
+	if (expected)
+		*expected = w->n_final - w->iv_final;
+	if (lost)
+		*lost = w->n_lost - w->iv_lost;
+
+	w->iv_final = w->n_final;
+	w->iv_lost  = w->n_lost;
+}
+
+
+int seqwin_debug(struct re_printf *pf, const struct seqwin *w)
+{
+	static const char *bucketv[SEQWIN_BURSTS] = {
+		"1", "2", "3", "4", "5-8", "9-16", "17-32", "33+"
+	};
+	unsigned i;
+	int err;
+
+	if (!w)
+		return 0;
+
+	err = re_hprintf(pf, "received=%llu lost=%llu dup=%u reorder=%u"
+			 " (max depth %u) late=%u restart=%u\n",
+			 w->n_rx, seqwin_lost(w), w->n_dup, w->n_reorder,
+			 w->reorder_max, w->n_late, w->n_restart);
+
+	err |= re_hprintf(pf, " loss bursts:");
+	for (i=0; i<SEQWIN_BURSTS; i++)
+		err |= re_hprintf(pf, " %s=%u", bucketv[i], w->burstv[i]);
+	err |= re_hprintf(pf, "\n");
+
+	return err;
+}
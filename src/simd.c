@@ -0,0 +1,72 @@
+/**
+ * @file src/simd.c  Runtime detection of SIMD instruction sets
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/**
+ * Check if a SIMD implementation can be used on this CPU
+ *
+ * @param impl SIMD implementation
+ *
+ * @return True if supported, otherwise false
+ */
+bool simd_supported(enum simd_impl impl)
+{
+	switch (impl) {
+
+	case SIMD_C:
+		return true;
+
+#ifdef HAVE_SIMD_X86
+	case SIMD_SSE2:
+		return __builtin_cpu_supports("sse2");
+
+	case SIMD_AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+
+#ifdef HAVE_SIMD_NEON
+	case SIMD_NEON:
+		return true;
+#endif
+
+	default:
+		return false;
+	}
+}
+
+
+/**
+ * Get the best SIMD implementation for this CPU
+ *
+ * @return SIMD implementation
+ */
+enum simd_impl simd_best(void)
+{
+	if (simd_supported(SIMD_AVX2))
+		return SIMD_AVX2;
+	else if (simd_supported(SIMD_SSE2))
+		return SIMD_SSE2;
+	else if (simd_supported(SIMD_NEON))
+		return SIMD_NEON;
+	else
+		return SIMD_C;
+}
+
+
+const char *simd_name(enum simd_impl impl)
+{
+	switch (impl) {
+
+	case SIMD_C:    return "c";
+	case SIMD_SSE2: return "sse2";
+	case SIMD_AVX2: return "avx2";
+	case SIMD_NEON: return "neon";
+	default:        return "?";
+	}
+}
@@ -5,33 +5,69 @@
 #
 
 SRCS	+= account.c
+SRCS	+= admit.c
+SRCS	+= ajb.c
+SRCS	+= allocstat.c
 SRCS	+= aucodec.c
 SRCS	+= audio.c
+SRCS	+= auring.c
 SRCS	+= aufilt.c
+SRCS	+= aulat.c
+SRCS	+= aulevel.c
+SRCS	+= aumix.c
 SRCS	+= auplay.c
 SRCS	+= ausrc.c
 SRCS	+= baresip.c
+SRCS	+= bwe.c
 SRCS	+= call.c
 SRCS	+= cmd.c
+SRCS	+= cn.c
 SRCS	+= conf.c
 SRCS	+= config.c
 SRCS	+= contact.c
+SRCS	+= cpugov.c
+SRCS	+= deccache.c
+SRCS	+= dnscache.c
+SRCS	+= fec.c
+SRCS	+= g711.c
+SRCS	+= histo.c
+SRCS	+= impair.c
+SRCS	+= l16.c
+SRCS	+= lagmon.c
 SRCS	+= log.c
+SRCS	+= mclock.c
 SRCS	+= menc.c
 SRCS	+= message.c
 SRCS	+= metric.c
 SRCS	+= mnat.c
 SRCS	+= module.c
+SRCS	+= moh.c
 SRCS	+= mos.c
 SRCS	+= net.c
+SRCS	+= netmon.c
+SRCS	+= pacer.c
 SRCS	+= play.c
+SRCS	+= prompt.c
 SRCS	+= realtime.c
 SRCS	+= reg.c
+SRCS	+= resamp.c
+SRCS	+= rtcpxr.c
+SRCS	+= rtpdemux.c
+SRCS	+= rtpext.c
 SRCS	+= rtpkeep.c
+SRCS	+= rtx.c
 SRCS	+= sdp.c
+SRCS	+= scratch.c
+SRCS	+= seqwin.c
+SRCS	+= simd.c
 SRCS	+= sipreq.c
+SRCS	+= startup.c
 SRCS	+= stream.c
+SRCS	+= trace.c
+SRCS	+= tstretch.c
+SRCS	+= twheel.c
 SRCS	+= ua.c
+SRCS	+= udpbatch.c
 SRCS	+= ui.c
 
 ifneq ($(USE_VIDEO),)
@@ -40,11 +76,20 @@ SRCS	+= h264.c
 SRCS	+= mctrl.c
 SRCS	+= video.c
 SRCS	+= vidcodec.c
+SRCS	+= vidcomp.c
+SRCS	+= vidconv.c
 SRCS	+= vidfilt.c
+SRCS	+= vidhub.c
 SRCS	+= vidisp.c
+SRCS	+= vidpool.c
 SRCS	+= vidsrc.c
 endif
 
+ifneq ($(HAVE_PTHREAD),)
+SRCS	+= aubatch.c
+SRCS	+= msched.c
+endif
+
 ifneq ($(STATIC),)
 SRCS	+= static.c
 endif
@@ -0,0 +1,113 @@
+/**
+ * @file startup.c  Startup timing
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The startup is cut into named phases, such as loading the config and
+ * the modules. Each phase ends when the next one begins, and the time
+ * spent in each is kept for the report.
+ */
+
+
+enum {
+	PHASE_MAX = 16,
+};
+
+
+static struct {
+	struct {
+		const char *name;
+		uint64_t us;
+	} phasev[PHASE_MAX];
+	size_t phasec;
+	uint64_t ts;            /**< Start of the current phase [us]  */
+	bool running;
+} su;
+
+
+/**
+ * Begin a startup phase, and end the previous one
+ *
+ * @param name Phase name, must be a static string. NULL ends the last
+ *             phase.
+ */
+void startup_phase(const char *name)
+{
+	uint64_t now = metric_time_us();
+
+	if (su.running)
+		su.phasev[su.phasec - 1].us = now - su.ts;
+
+	su.running = false;
+
+	if (!name || su.phasec >= PHASE_MAX)
+		return;
+
+	su.phasev[su.phasec].name = name;
+	su.phasev[su.phasec].us   = 0;
+	++su.phasec;
+
+	su.ts      = now;
+	su.running = true;
+}
+
+
+/**
+ * Get the time spent in a startup phase
+ *
+ * @param name Phase name
+ *
+ * @return Time in [us], 0 if the phase is unknown or still running
+ */
+uint64_t startup_time(const char *name)
+{
+	uint64_t us = 0;
+	size_t i;
+
+	if (!name)
+		return 0;
+
+	for (i=0; i<su.phasec; i++) {
+		if (!str_cmp(su.phasev[i].name, name))
+			us += su.phasev[i].us;
+	}
+
+	return us;
+}
+
+
+/**
+ * Forget all startup phases
+ */
+void startup_reset(void)
+{
+	memset(&su, 0, sizeof(su));
+}
+
+
+int startup_debug(struct re_printf *pf, void *unused)
+{
+	uint64_t total = 0;
+	size_t i;
+	int err = 0;
+	(void)unused;
+
+	for (i=0; i<su.phasec; i++) {
+
+		err |= re_hprintf(pf, "%s%s %llu ms", i ? ", " : "",
+				  su.phasev[i].name, su.phasev[i].us / 1000);
+
+		total += su.phasev[i].us;
+	}
+
+	err |= re_hprintf(pf, " (total %llu ms)", total / 1000);
+
+	return err;
+}
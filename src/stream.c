@@ -5,6 +5,10 @@
  */
 #include <string.h>
 #include <time.h>
+#ifdef __linux__
+#include <stdio.h>
+#include <sys/socket.h>
+#endif
 #include <re.h>
 #include <baresip.h>
 #include "core.h"
@@ -12,6 +16,21 @@
 
 enum {
 	RTP_RECV_SIZE = 8192,
+	RTP_SOCKBUF_SIZE = 262144,  /* absorb bursts between socket reads */
+	BUSY_POLL_BUDGET = 64,      /* packets per busy poll             */
+	JBUF_TRIM = 512,            /* [bytes] unused tail given back    */
+	REMB_INTERVAL = 1000000,    /* [us] between REMB messages        */
+	REMB_DROP = 3,              /* [%] decrease that is sent at once */
+	BWE_RATE_MIN = 50000,       /* [bit/s] lowest estimate           */
+	RTX_HISTORY = 256,          /* packets in the send history       */
+	NACK_MAX = 17,              /* lost packets in one generic NACK  */
+	SSRC_HOLD_MIN = 60,         /* [ms] silence before a new source  */
+	SSRC_HOLD_MAX = 500,        /* [ms] takes over the stream        */
+	LAYER_RTPEXT = 1000,        /* above SRTP, before encryption     */
+	LAYER_BUNDLE = 500,         /* after RTPEXT, above SRTP and ICE  */
+	MOSQ_INTERVAL = 1000,       /* [ms] between quality estimates    */
+	XR_INTERVAL = 5000,         /* [ms] between RTCP XR reports      */
+	LAYER_RTCPXR = 800,         /* above SRTP, below BUNDLE demux    */
 };
 
 
@@ -69,6 +88,120 @@ static void print_rtp_stats(const struct stream *s)
 }
 
 
+static void mosq_handler(void *arg)
+{
+	struct stream *s = arg;
+
+	twheel_tmr_start(&s->tmr_mosq, baresip_twheel(), MOSQ_INTERVAL,
+			 mosq_handler, s);
+
+	/* the final counters of the window, they only grow */
+	if (mosq_update(&s->mosq,
+			(uint32_t)(s->rxwin.n_final - s->rxwin.n_lost),
+			(uint32_t)s->rxwin.n_lost,
+			s->rtcp_stats.rtt / 1000.0, s->cfg.mos_alert))
+		call_quality_event(s->call, s);
+}
+
+
+/* RFC 3611: VoIP metrics of the received stream, for the sender */
+static void xr_handler(void *arg)
+{
+	struct stream *s = arg;
+	const struct stream_quality *q = &s->mosq.q;
+	const uint32_t ptime = s->xr.ptime;
+	struct rtcpxr_voip v;
+	struct jbuf_stat jstat;
+	uint32_t discard = 0;
+	struct mbuf *mb;
+	int err;
+
+	twheel_tmr_start(&s->tmr_xr, baresip_twheel(), XR_INTERVAL,
+			 xr_handler, s);
+
+	if (!s->ssrc_rx || !s->xr.started ||
+	    !sdp_media_rattr(s->sdp, "rtcp-xr"))
+		return;
+
+	if (0 == jbuf_stats(s->jbuf, &jstat))
+		discard = jstat.n_late + jstat.n_overflow;
+
+	rtcpxr_voip_init(&v, s->ssrc_rx);
+	rtcpxr_voip_calc(&v, &s->xr, discard);
+
+	v.rtd = s->rtcp_stats.rtt / 1000;
+	v.esd = s->metric_rx.jbuf_delay / 1000 + ptime;
+
+	if (s->mosq.valid) {
+		v.r_factor = (uint8_t)(q->r_factor + 0.5);
+		v.mos_cq   = (uint8_t)(q->mos * 10 + 0.5);
+	}
+
+	/* jitter-buffer adaptive (3) or non-adaptive (2) */
+	v.rx_config  = (s->ajb ? 3 : 2) << 4;
+	v.jb_nominal = s->metric_rx.jbuf_delay / 1000;
+	v.jb_max     = s->cfg.jbuf_del.max * ptime;
+	v.jb_abs_max = v.jb_max;
+
+	mb = mbuf_alloc(64);
+	if (!mb)
+		return;
+
+	err = rtcpxr_voip_encode(mb, rtp_sess_ssrc(s->rtp), &v);
+	if (!err) {
+		mb->pos = 0;
+		err = rtcp_send(s->rtp, mb);
+	}
+	if (err)
+		metric_add_err(&s->metric_tx);
+
+	mem_deref(mb);
+}
+
+
+/* The peer of a stream reports on the SSRC that the stream sends */
+static void xr_recv(struct stream *s, struct mbuf *mb)
+{
+	struct rtcpxr_voip v;
+	struct le *le;
+
+	if (rtcpxr_voip_decode(&v, mb))
+		return;
+
+	if (v.ssrc == rtp_sess_ssrc(s->rtp)) {
+		s->xr_peer = v;
+		s->xr_peer_valid = true;
+		return;
+	}
+
+	for (le = s->bundlel.head; le; le = le->next) {
+
+		struct stream *b = le->data;
+
+		if (v.ssrc == rtp_sess_ssrc(b->rtp)) {
+			b->xr_peer = v;
+			b->xr_peer_valid = true;
+			return;
+		}
+	}
+}
+
+
+/* libre skips the payload of XR packets, so they are read here */
+static bool xr_recv_handler(struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct stream *s = arg;
+	(void)src;
+
+	/* RTCP on the RTP socket, RFC 5761 */
+	if (mbuf_get_left(mb) >= 8 &&
+	    mbuf_buf(mb)[1] >= 192 && mbuf_buf(mb)[1] <= 223)
+		xr_recv(s, mb);
+
+	return false;
+}
+
+
 static void stream_destructor(void *arg)
 {
 	struct stream *s = arg;
@@ -76,62 +209,244 @@ static void stream_destructor(void *arg)
 	if (s->cfg.rtp_stats)
 		print_rtp_stats(s);
 
+	twheel_tmr_cancel(&s->tmr_mosq);
+	twheel_tmr_cancel(&s->tmr_xr);
+	mem_deref(s->uh_xr);
+	mem_deref(s->uh_xr_rtcp);
+
 	metric_reset(&s->metric_tx);
 	metric_reset(&s->metric_rx);
 
 	list_unlink(&s->le);
+	stream_bundle(s, NULL);
+	while (s->bundlel.head)
+		stream_bundle(s->bundlel.head->data, NULL);
+	mem_deref(s->uh_ext);
 	mem_deref(s->rtpkeep);
+	mem_deref(s->impair);
+	mem_deref(s->batch);
 	mem_deref(s->sdp);
 	mem_deref(s->mes);
 	mem_deref(s->mencs);
 	mem_deref(s->mns);
+	mem_deref(s->ajb);
 	mem_deref(s->jbuf);
+	mem_deref(s->bwe);
+	mem_deref(s->mb_remb);
+	mem_deref(s->rtx);
+	mem_deref(s->fecenc);
+	mem_deref(s->fecdec);
 	mem_deref(s->rtp);
+	mem_deref(s->demux);
 	mem_deref(s->cname);
 }
 
 
-static void rtp_recv(const struct sa *src, const struct rtp_header *hdr,
-		     struct mbuf *mb, void *arg)
+static int remb_encode_handler(struct mbuf *mb, void *arg)
 {
 	struct stream *s = arg;
-	bool flush = false;
+
+	return bwe_remb_encode(mb, s->bwe_sent, s->ssrc_rx);
+}
+
+
+static void bwe_update(struct stream *s, const struct rtp_header *hdr,
+		       size_t size)
+{
+	uint64_t now = metric_time_us();
+	uint32_t rate;
+	struct mbuf *mb;
 	int err;
 
-	if (!mbuf_get_left(mb))
+	bwe_packet(s->bwe, now, hdr->ts, size + RTP_HEADER_SIZE);
+
+	if (!s->rtcp || !s->ssrc_rx)
 		return;
 
-	if (!(sdp_media_ldir(s->sdp) & SDP_RECVONLY))
+	rate = bwe_estimate(s->bwe);
+
+	/* periodically, and at once when the estimate drops */
+	if (now - s->bwe_ts < REMB_INTERVAL &&
+	    (uint64_t)rate * 100 >
+	    (uint64_t)s->bwe_sent * (100 - REMB_DROP))
 		return;
 
-	metric_add_packet(&s->metric_rx, mbuf_get_left(mb));
+	/* the buffer is reused, unless a lower layer still holds it */
+	if (!s->mb_remb || mem_nrefs(s->mb_remb) > 1) {
+		mem_deref(s->mb_remb);
+		s->mb_remb = mbuf_alloc(32);
+		if (!s->mb_remb)
+			return;
+	}
 
-	if (hdr->ssrc != s->ssrc_rx) {
-		if (s->ssrc_rx) {
-			flush = true;
-			info("stream: %s: SSRC changed %x -> %x"
-			     " (%u bytes from %J)\n",
-			     sdp_media_name(s->sdp), s->ssrc_rx, hdr->ssrc,
-			     mbuf_get_left(mb), src);
-		}
-		s->ssrc_rx = hdr->ssrc;
+	mb = s->mb_remb;
+	mbuf_rewind(mb);
+
+	s->bwe_sent = rate;
+	s->bwe_ts   = now;
+
+	err = rtcp_encode(mb, RTCP_PSFB, RTCP_PSFB_AFB,
+			  rtp_sess_ssrc(s->rtp), 0,
+			  remb_encode_handler, s);
+	if (!err) {
+		mb->pos = 0;
+		err = rtcp_send(s->rtp, mb);
+	}
+	if (err)
+		metric_add_err(&s->metric_tx);
+}
+
+
+/* The associated payload type of an RTX format, or -1 if not RTX */
+static int rtx_apt(const struct sdp_format *fmt)
+{
+	struct pl params, apt;
+
+	if (!fmt || 0 != str_casecmp(fmt->name, "rtx"))
+		return -1;
+
+	pl_set_str(&params, fmt->params);
+
+	if (!fmt_param_get(&params, "apt", &apt))
+		return -1;
+
+	return (int)pl_u32(&apt);
+}
+
+
+/* Restore the original packet from an RTX packet (RFC 4588) */
+static bool rtx_recv(struct stream *s, struct rtp_header *hdr,
+		     struct mbuf *mb)
+{
+	uint16_t seq;
+	int apt;
+
+	apt = rtx_apt(stream_lformat(s, hdr->pt));
+	if (apt < 0)
+		return false;
+
+	if (rtx_decode(mb, &seq))
+		return false;
+
+	hdr->pt   = apt;
+	hdr->seq  = seq;
+	hdr->ssrc = s->ssrc_rx;
+
+	return true;
+}
+
+
+/* Send a generic NACK for the gap before the newest sequence number */
+static void nack_update(struct stream *s, uint16_t seq)
+{
+	const uint32_t gap = s->rxwin.gap;
+	const uint16_t fsn = seq - gap;
+	uint16_t blp = 0;
+	uint32_t i;
+	int err;
+
+	/* larger gaps are left to a picture update */
+	if (gap == 0 || gap > NACK_MAX)
+		return;
+
+	for (i=1; i<gap; i++)
+		blp |= 1 << (i-1);
+
+	err = rtcp_send_nack(s->rtp, fsn, blp);
+	if (err)
+		metric_add_err(&s->metric_tx);
+}
+
+
+/*
+ * Pass a frame on to the media, after telling it how many frames were
+ * lost before this one
+ */
+static void rx_frame(struct stream *s, const struct rtp_header *hdr,
+		     struct mbuf *mb, bool shrink)
+{
+	const int lost = lostcalc(s, hdr->seq);
+
+	/* the frames to conceal, the statistics are in rxwin */
+	if (lost > 0) {
+		s->metric_rx.jb_lost = lost;
+		s->rtph(hdr, NULL, s->arg);
+		s->metric_rx.jb_lost = 0;
 	}
 
+	s->metric_rx.jb_shrink = shrink;
+	s->rtph(hdr, mb, s->arg);
+	s->metric_rx.jb_shrink = false;
+}
+
+
+/* The type of the stream, only for the pipeline trace */
+static bool trace_video(const struct stream *s)
+{
+	return 0 == str_casecmp(sdp_media_name(s->sdp), "video");
+}
+
+
+static void rtp_handle(struct stream *s, const struct rtp_header *hdr,
+		       struct mbuf *mb, bool flush, const struct sa *src)
+{
+	int err;
+
 	if (s->jbuf) {
 
 		struct rtp_header hdr2;
 		void *mb2 = NULL;
+		unsigned n = 1;
+		uint64_t ts = 0;
+
+		if (trace_active(s->call))
+			ts = metric_time_us();
 
 		/* Put frame in Jitter Buffer */
-		if (flush)
+		if (flush) {
 			jbuf_flush(s->jbuf);
+			ajb_reset(s->ajb);
+		}
+
+		/* The jitter-buffer keeps the receive buffer of the socket,
+		   which is much larger than the packet. The unused tail is
+		   given back to the allocator, and the packet is not
+		   copied. */
+		if (mb->size > mb->end + JBUF_TRIM)
+			(void)mbuf_resize(mb, mb->end);
+
+		s->rx_maxsz = max(s->rx_maxsz, mb->end);
 
 		err = jbuf_put(s->jbuf, hdr, mb);
+		PROBE5(jbuf_put, call_id(s->call), hdr->ssrc, hdr->seq,
+		       hdr->ts, err);
 		if (err) {
 			info("%s: dropping %u bytes from %J (%m)\n",
 			     sdp_media_name(s->sdp), mb->end,
 			     src, err);
-			s->metric_rx.n_err++;
+			metric_add_err(&s->metric_rx);
+		}
+		else if (s->ajb) {
+			ajb_put(s->ajb, hdr, tmr_jiffies());
+			n = ajb_release(s->ajb, hdr->m);
+		}
+
+		/* Shrink the delay by passing on an extra frame, which
+		   the receiver drains by time-stretching */
+		if (n > 1 && 0 == jbuf_get(s->jbuf, &hdr2, &mb2)) {
+			PROBE4(jbuf_get, call_id(s->call), hdr2.ssrc,
+			       hdr2.seq, hdr2.ts);
+			ajb_get(s->ajb);
+			rx_frame(s, &hdr2, mb2, true);
+			mb2 = mem_deref(mb2);
+		}
+
+		/* Grow the delay by holding back this frame */
+		if (n == 0 && s->jbuf_started) {
+			s->metric_rx.jb_grow = true;
+			s->rtph(hdr, NULL, s->arg);
+			s->metric_rx.jb_grow = false;
+			return;
 		}
 
 		if (jbuf_get(s->jbuf, &hdr2, &mb2)) {
@@ -139,315 +454,1582 @@ static void rtp_recv(const struct sa *src, const struct rtp_header *hdr,
 			if (!s->jbuf_started)
 				return;
 
-			memset(&hdr2, 0, sizeof(hdr2));
+			/* the frame is late, and might still arrive */
+			s->metric_rx.jb_late = true;
+			s->rtph(hdr, NULL, s->arg);
+			s->metric_rx.jb_late = false;
+			return;
+		}
+		else {
+			PROBE4(jbuf_get, call_id(s->call), hdr2.ssrc,
+			       hdr2.seq, hdr2.ts);
+			ajb_get(s->ajb);
+
+			/* buffered media between newest and released frame */
+			if (s->srate_rx) {
+				const uint32_t d = hdr->ts - hdr2.ts;
+
+				if (d < s->srate_rx * 10) {
+					s->metric_rx.jbuf_delay =
+						(uint32_t)(1000000ULL * d
+							   / s->srate_rx);
+					histo_add(&s->metric_rx.h_jbuf,
+						  s->metric_rx.jbuf_delay);
+				}
+			}
 		}
 
 		s->jbuf_started = true;
 
-		if (lostcalc(s, hdr2.seq) > 0)
-			s->rtph(hdr, NULL, s->arg);
+		allocstat_stage(&s->alloc_rx, ALLOC_RTP);
+
+		if (ts)
+			trace_span(s->call, trace_video(s), TRACE_JBUF, ts,
+				   metric_time_us());
 
-		s->rtph(&hdr2, mb2, s->arg);
+		rx_frame(s, &hdr2, mb2, false);
 
 		mem_deref(mb2);
 	}
 	else {
-		if (lostcalc(s, hdr->seq) > 0)
-			s->rtph(hdr, NULL, s->arg);
+		allocstat_stage(&s->alloc_rx, ALLOC_RTP);
 
-		s->rtph(hdr, mb, s->arg);
+		rx_frame(s, hdr, mb, false);
 	}
 }
 
 
-static void rtcp_handler(const struct sa *src, struct rtcp_msg *msg, void *arg)
+/* Pass packets recovered with FEC on as if they were received */
+static void fec_recover(struct stream *s, const struct sa *src)
 {
-	struct stream *s = arg;
-	(void)src;
+	struct rtp_header hdr;
+	struct mbuf *mb;
 
-	if (s->rtcph)
-		s->rtcph(msg, s->arg);
-
-	switch (msg->hdr.pt) {
+	while (0 == fecdec_recover(s->fecdec, &hdr, &mb)) {
 
-	case RTCP_SR:
-		(void)rtcp_stats(s->rtp, msg->r.sr.ssrc, &s->rtcp_stats);
+		hdr.ssrc = s->ssrc_rx;
 
-		if (s->cfg.rtp_stats)
-			call_set_xrtpstat(s->call);
+		rtp_handle(s, &hdr, mb, false, src);
 
-		break;
+		mem_deref(mb);
 	}
 }
 
 
-static int stream_sock_alloc(struct stream *s, int af)
+/* A repair packet has its own SSRC and the local FlexFEC payload type */
+static void fec_repair_recv(struct stream *s, struct mbuf *mb,
+			    const struct sa *src)
 {
-	struct sa laddr;
-	int tos, err;
+	if (fecdec_repair(s->fecdec, mb)) {
+		metric_add_err(&s->metric_rx);
+		return;
+	}
 
-	if (!s)
-		return EINVAL;
+	fec_recover(s, src);
+}
 
-	/* we listen on all interfaces */
-	sa_init(&laddr, af);
 
-	err = rtp_listen(&s->rtp, IPPROTO_UDP, &laddr,
-			 s->cfg.rtp_ports.min, s->cfg.rtp_ports.max,
-			 s->rtcp, rtp_recv, rtcp_handler, s);
-	if (err) {
-		warning("stream: rtp_listen failed: af=%s ports=%u-%u"
-			" (%m)\n", net_af2name(af),
-			s->cfg.rtp_ports.min, s->cfg.rtp_ports.max, err);
-		return err;
-	}
+/* The elements are in front of the payload, libre skips them */
+static void rtpext_recv(struct stream *s, const struct rtp_header *hdr,
+			const struct mbuf *mb)
+{
+	const size_t len = hdr->x.len * 4;
+	struct rtpext ext;
+	struct mbuf mbx;
 
-	tos = s->cfg.rtp_tos;
-	(void)udp_setsockopt(rtp_sock(s->rtp), IPPROTO_IP, IP_TOS,
-			     &tos, sizeof(tos));
-	(void)udp_setsockopt(rtcp_sock(s->rtp), IPPROTO_IP, IP_TOS,
-			     &tos, sizeof(tos));
+	if (hdr->x.type != RTPEXT_TYPE_MAGIC || mb->pos < len)
+		return;
 
-	udp_rxsz_set(rtp_sock(s->rtp), RTP_RECV_SIZE);
+	mbuf_init(&mbx);
+	mbx.buf  = mb->buf + mb->pos - len;
+	mbx.size = len;
+	mbx.end  = len;
 
-	return 0;
+	while (0 == rtpext_decode(&ext, &mbx)) {
+
+		if (ext.id == s->extmap[RTPEXT_AUDIO_LEVEL] && ext.len == 1)
+			ATOMIC_STORE(&s->ext_level_rx, 0x100 | ext.data[0]);
+	}
 }
 
 
-int stream_alloc(struct stream **sp, const struct config_avt *cfg,
-		 struct call *call, struct sdp_session *sdp_sess,
-		 const char *name, int label,
-		 const struct mnat *mnat, struct mnat_sess *mnat_sess,
-		 const struct menc *menc, struct menc_sess *menc_sess,
-		 const char *cname,
-		 stream_rtp_h *rtph, stream_rtcp_h *rtcph, void *arg)
+/*
+ * The stream of a BUNDLE that an RTP packet belongs to: by the SSRC
+ * that was received or announced with a=ssrc, else by payload type.
+ */
+static struct stream *bundle_demux(struct stream *s,
+				   const struct rtp_header *hdr)
 {
-	struct stream *s;
-	int err;
+	struct le *le;
 
-	if (!sp || !cfg || !call || !rtph)
-		return EINVAL;
+	if (hdr->ssrc == s->ssrc_rx)
+		return s;
 
-	s = mem_zalloc(sizeof(*s), stream_destructor);
-	if (!s)
-		return ENOMEM;
+	for (le = s->bundlel.head; le; le = le->next) {
 
-	s->cfg   = *cfg;
-	s->call  = call;
-	s->rtph  = rtph;
-	s->rtcph = rtcph;
-	s->arg   = arg;
-	s->pseq  = -1;
-	s->rtcp  = s->cfg.rtcp_enable;
+		struct stream *b = le->data;
 
-	err = stream_sock_alloc(s, call_af(call));
-	if (err) {
-		warning("stream: failed to create socket for media '%s'"
-			" (%m)\n", name, err);
-		goto out;
+		if (hdr->ssrc == b->ssrc_rx ||
+		    hdr->ssrc == sdp_media_rattr_u32(b->sdp, "ssrc"))
+			return b;
 	}
 
-	err = str_dup(&s->cname, cname);
-	if (err)
-		goto out;
+	if (stream_lformat(s, hdr->pt))
+		return s;
 
-	/* Jitter buffer */
-	if (cfg->jbuf_del.min && cfg->jbuf_del.max) {
+	for (le = s->bundlel.head; le; le = le->next) {
 
-		err = jbuf_alloc(&s->jbuf, cfg->jbuf_del.min,
-				 cfg->jbuf_del.max);
-		if (err)
-			goto out;
+		struct stream *b = le->data;
+
+		if (stream_lformat(b, hdr->pt))
+			return b;
 	}
 
-	err = sdp_media_add(&s->sdp, sdp_sess, name,
-			    sa_port(rtp_local(s->rtp)),
-			    (menc && menc->sdp_proto) ? menc->sdp_proto :
-			    sdp_proto_rtpavp);
-	if (err)
-		goto out;
+	return s;
+}
 
-	if (label) {
-		err |= sdp_media_set_lattr(s->sdp, true,
-					   "label", "%d", label);
-	}
 
-	/* RFC 5506 */
-	if (s->rtcp)
-		err |= sdp_media_set_lattr(s->sdp, true, "rtcp-rsize", NULL);
+static enum rtp_role rtp_role(struct stream *s, uint8_t pt)
+{
+	const struct sdp_format *fmt = stream_lformat(s, pt);
+
+	if (!fmt)
+		return RTP_ROLE_PRIMARY;
+	else if (0 == str_casecmp(fmt->name, "rtx"))
+		return RTP_ROLE_RTX;
+	else if (0 == str_casecmp(fmt->name, "flexfec"))
+		return RTP_ROLE_FEC;
+	else
+		return RTP_ROLE_PRIMARY;
+}
 
-	/* RFC 5576 */
-	if (s->rtcp) {
-		err |= sdp_media_set_lattr(s->sdp, true,
-					   "ssrc", "%u cname:%s",
-					   rtp_sess_ssrc(s->rtp), cname);
-	}
 
-	/* RFC 5761 */
-	if (cfg->rtcp_mux)
-		err |= sdp_media_set_lattr(s->sdp, true, "rtcp-mux", NULL);
+static struct rtpdemux *stream_demux(const struct stream *s)
+{
+	return s->bundle ? s->bundle->demux : s->demux;
+}
 
-	if (err)
-		goto out;
 
-	if (mnat) {
-		err = mnat->mediah(&s->mns, mnat_sess, IPPROTO_UDP,
-				   rtp_sock(s->rtp),
-				   s->rtcp ? rtcp_sock(s->rtp) : NULL,
-				   s->sdp);
-		if (err)
-			goto out;
-	}
+/*
+ * A second media source, such as a simulcast layer, does not take over
+ * the stream and flush the jitter-buffer while the current source is
+ * still sending. The current source is gone when it was silent for a
+ * few of its packet intervals.
+ */
+static bool ssrc_takeover(const struct stream *s, uint64_t now)
+{
+	const struct rtpdemux_entry *cur;
+	uint32_t hold;
 
-	if (menc) {
-		s->menc  = menc;
-		s->mencs = mem_ref(menc_sess);
-		err = menc->mediah(&s->mes, menc_sess,
-				   s->rtp,
-				   IPPROTO_UDP,
-				   rtp_sock(s->rtp),
-				   s->rtcp ? rtcp_sock(s->rtp) : NULL,
-				   s->sdp);
-		if (err)
-			goto out;
+	cur = rtpdemux_lookup(stream_demux(s), s->ssrc_rx);
+	if (!cur || !cur->last)
+		return true;
+
+	hold = min(max(4 * cur->ival, (uint32_t)SSRC_HOLD_MIN),
+		   (uint32_t)SSRC_HOLD_MAX);
+
+	return now > cur->last + hold;
+}
+
+
+static void stream_rtp_recv(struct stream *s, struct rtpdemux_entry *e,
+			    enum rtp_role role, const struct sa *src,
+			    const struct rtp_header *hdr, struct mbuf *mb,
+			    uint64_t now)
+{
+	struct rtp_header hdr_rtx;
+	bool flush = false;
+	uint64_t ts = 0;
+
+	if (!(sdp_media_ldir(s->sdp) & SDP_RECVONLY))
+		return;
+
+	metric_add_packet(&s->metric_rx, mbuf_get_left(mb));
+	allocstat_frame(&s->alloc_rx);
+
+	if (trace_active(s->call))
+		ts = metric_time_us();
+
+	PROBE5(rtp_recv, call_id(s->call), hdr->ssrc, hdr->seq, hdr->ts,
+	       mbuf_get_left(mb));
+
+	if (role == RTP_ROLE_FEC) {
+		if (s->fecdec)
+			fec_repair_recv(s, mb, src);
+		return;
+	}
+
+	if (hdr->ext && s->ext_answered)
+		rtpext_recv(s, hdr, mb);
+
+	/* a retransmission has its own SSRC */
+	if (role == RTP_ROLE_RTX) {
+
+		hdr_rtx = *hdr;
+
+		if (!s->ssrc_rx || !rtx_recv(s, &hdr_rtx, mb)) {
+			if (e)
+				++e->n_drop;
+			return;
+		}
+
+		/* padding only, e.g. to probe the bandwidth */
+		if (!mbuf_get_left(mb))
+			return;
+
+		hdr = &hdr_rtx;
+	}
+
+	if (hdr->ssrc != s->ssrc_rx) {
+
+		if (s->ssrc_rx && !ssrc_takeover(s, now)) {
+			if (e)
+				++e->n_drop;
+			return;
+		}
+
+		if (s->ssrc_rx) {
+			flush = true;
+			info("stream: %s: SSRC changed %x -> %x"
+			     " (%u bytes from %J)\n",
+			     sdp_media_name(s->sdp), s->ssrc_rx, hdr->ssrc,
+			     mbuf_get_left(mb), src);
+		}
+		s->ssrc_rx = hdr->ssrc;
+		seqwin_restart(&s->rxwin);
+		s->mosq.started = false;
+	}
+
+	/* a retransmission arrives late, by design */
+	if (hdr != &hdr_rtx) {
+
+		const enum seqwin_res res = seqwin_update(&s->rxwin,
+							  hdr->seq);
+
+		mosq_packet(&s->mosq, metric_time_us(), hdr->ts, s->srate_rx);
+
+		if (res == SEQWIN_REORDER)
+			rtcpxr_reorder(&s->xr);
+		else
+			rtcpxr_packet(&s->xr, hdr->seq, hdr->ts, s->srate_rx);
+
+		if (s->nack && res == SEQWIN_NEW)
+			nack_update(s, hdr->seq);
+	}
+
+	if (s->bwe)
+		bwe_update(s, hdr, mbuf_get_left(mb));
+
+	/* before the handlers consume the payload */
+	if (s->fecdec)
+		fecdec_source(s->fecdec, hdr, mb);
+
+	if (ts)
+		trace_span(s->call, trace_video(s), TRACE_RECEIVE, ts,
+			   metric_time_us());
+
+	rtp_handle(s, hdr, mb, flush, src);
+
+	if (s->fecdec)
+		fec_recover(s, src);
+}
+
+
+/* All RTP packets of the socket, of this stream and bundled streams */
+static void rtp_recv(const struct sa *src, const struct rtp_header *hdr,
+		     struct mbuf *mb, void *arg)
+{
+	struct stream *s = arg;
+	struct stream *b;
+	struct rtpdemux_entry *e;
+	enum rtp_role role;
+	uint64_t now;
+
+	if (!mbuf_get_left(mb))
+		return;
+
+	now = tmr_jiffies();
+
+	e = rtpdemux_lookup(s->demux, hdr->ssrc);
+	if (!e) {
+		b = s->bundlel.head ? bundle_demux(s, hdr) : s;
+		e = rtpdemux_add(s->demux, hdr->ssrc, hdr->pt,
+				 rtp_role(b, hdr->pt), b);
+	}
+	else if (e->pt != hdr->pt) {
+		e->pt   = hdr->pt;
+		e->role = rtp_role(e->arg, hdr->pt);
+	}
+
+	if (e) {
+		b    = e->arg;
+		role = e->role;
+		rtpdemux_packet(e, mbuf_get_left(mb), now);
+	}
+	else {
+		b    = s->bundlel.head ? bundle_demux(s, hdr) : s;
+		role = rtp_role(b, hdr->pt);
+	}
+
+	stream_rtp_recv(b, e, role, src, hdr, mb, now);
+}
+
+
+/* The peer's loss of our packets raises the FEC protection */
+static void fec_loss(struct stream *s, const struct rtcp_rr *rrv, int n)
+{
+	int i;
+
+	if (!s->fecenc || !rrv)
+		return;
+
+	for (i=0; i<n; i++) {
+
+		if (rrv[i].ssrc != rtp_sess_ssrc(s->rtp))
+			continue;
+
+		fecenc_set_loss(s->fecenc, rrv[i].fraction * 100 / 256);
+	}
+}
+
+
+/* Feedback goes to the stream of the media source, the rest to all */
+static bool bundle_rtcp_match(const struct stream *s,
+			      const struct rtcp_msg *msg)
+{
+	switch (msg->hdr.pt) {
+
+	case RTCP_RTPFB:
+	case RTCP_PSFB:
+		return !msg->r.fb.ssrc_media ||
+			msg->r.fb.ssrc_media == rtp_sess_ssrc(s->rtp);
+
+	default:
+		return true;
+	}
+}
+
+
+static void rtcp_handle(struct stream *s, struct rtcp_msg *msg)
+{
+	/* the RTCP session of a BUNDLE has the statistics */
+	struct rtp_sock *rtp = s->bundle ? s->bundle->rtp : s->rtp;
+
+	if (s->rtcph)
+		s->rtcph(msg, s->arg);
+
+	switch (msg->hdr.pt) {
+
+	case RTCP_RR:
+		fec_loss(s, msg->r.rr.rrv, msg->hdr.count);
+		break;
+
+	case RTCP_SR:
+		fec_loss(s, msg->r.sr.rrv, msg->hdr.count);
+
+		(void)rtcp_stats(rtp, msg->r.sr.ssrc, &s->rtcp_stats);
+
+		if (s->cfg.rtp_stats)
+			call_set_xrtpstat(s->call);
+
+		break;
+	}
+}
+
+
+static void rtcp_handler(const struct sa *src, struct rtcp_msg *msg, void *arg)
+{
+	struct stream *s = arg;
+	struct le *le;
+	(void)src;
+
+	if (!s->bundlel.head) {
+		rtcp_handle(s, msg);
+		return;
+	}
+
+	if (bundle_rtcp_match(s, msg))
+		rtcp_handle(s, msg);
+
+	for (le = s->bundlel.head; le; le = le->next) {
+
+		struct stream *b = le->data;
+
+		if (bundle_rtcp_match(b, msg))
+			rtcp_handle(b, msg);
+	}
+}
+
+
+/*
+ * With busy polling, the kernel polls the device queue of the socket
+ * for up to the given time instead of waiting for the interrupt. The
+ * main loop waits in epoll, which only busy polls when the sysctl
+ * net.core.busy_poll is set too. With SO_PREFER_BUSY_POLL the device
+ * interrupts stay off while the application keeps polling.
+ */
+static void sock_busy_poll(struct udp_sock *us, uint32_t usec)
+{
+#ifdef SO_BUSY_POLL
+	static bool checked;
+	int v = (int)usec;
+	int err;
+
+	if (!us || !usec)
+		return;
+
+	err = udp_setsockopt(us, SOL_SOCKET, SO_BUSY_POLL, &v, sizeof(v));
+	if (err) {
+		warning("stream: busy poll %u us: %m\n", usec, err);
+		return;
+	}
+
+#ifdef SO_PREFER_BUSY_POLL
+	v = 1;
+	(void)udp_setsockopt(us, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+			     &v, sizeof(v));
+#endif
+#ifdef SO_BUSY_POLL_BUDGET
+	v = BUSY_POLL_BUDGET;
+	(void)udp_setsockopt(us, SOL_SOCKET, SO_BUSY_POLL_BUDGET,
+			     &v, sizeof(v));
+#endif
+
+	if (!checked) {
+		FILE *f = fopen("/proc/sys/net/core/busy_poll", "r");
+		unsigned val = 0;
+
+		checked = true;
+
+		if (f) {
+			if (fscanf(f, "%u", &val) != 1)
+				val = 0;
+			(void)fclose(f);
+		}
+
+		if (!val) {
+			warning("stream: rtp_busy_poll needs the sysctl"
+				" net.core.busy_poll for the main loop\n");
+		}
+	}
+#else
+	static bool warned;
+
+	if (usec && !warned) {
+		warning("stream: busy poll is not supported\n");
+		warned = true;
+	}
+	(void)us;
+#endif
+}
+
+
+static int stream_sock_alloc(struct stream *s, int af)
+{
+	struct sa laddr;
+	int tos, err;
+
+	if (!s)
+		return EINVAL;
+
+	/* we listen on all interfaces */
+	sa_init(&laddr, af);
+
+	err = rtp_listen(&s->rtp, IPPROTO_UDP, &laddr,
+			 s->cfg.rtp_ports.min, s->cfg.rtp_ports.max,
+			 s->rtcp, rtp_recv, rtcp_handler, s);
+	if (err) {
+		warning("stream: rtp_listen failed: af=%s ports=%u-%u"
+			" (%m)\n", net_af2name(af),
+			s->cfg.rtp_ports.min, s->cfg.rtp_ports.max, err);
+		return err;
+	}
+
+	tos = s->cfg.rtp_tos;
+	(void)udp_setsockopt(rtp_sock(s->rtp), IPPROTO_IP, IP_TOS,
+			     &tos, sizeof(tos));
+	(void)udp_setsockopt(rtcp_sock(s->rtp), IPPROTO_IP, IP_TOS,
+			     &tos, sizeof(tos));
+
+	/* The socket is read by libre, one datagram per wakeup, and the
+	   datagrams must pass the UDP helpers (SRTP, ICE, TURN) and the
+	   RTCP statistics. A recvmmsg() batch read here could not be
+	   handed to them, so receive stays per datagram. A large socket
+	   buffer keeps bursts from being dropped between two reads. */
+	s->rxsz = RTP_RECV_SIZE;
+	udp_rxsz_set(rtp_sock(s->rtp), s->rxsz);
+	(void)udp_sockbuf_set(rtp_sock(s->rtp), RTP_SOCKBUF_SIZE);
+
+	sock_busy_poll(rtp_sock(s->rtp), s->cfg.busy_poll);
+	sock_busy_poll(rtcp_sock(s->rtp), s->cfg.busy_poll);
+
+	/* optional, fallback is one send per packet */
+	err = udpbatch_alloc(&s->batch, rtp_sock(s->rtp));
+	if (err && err != ENOSYS) {
+		warning("stream: udpbatch_alloc failed (%m)\n", err);
+	}
+
+	return 0;
+}
+
+
+int stream_alloc(struct stream **sp, const struct config_avt *cfg,
+		 struct call *call, struct sdp_session *sdp_sess,
+		 const char *name, int label,
+		 const struct mnat *mnat, struct mnat_sess *mnat_sess,
+		 const struct menc *menc, struct menc_sess *menc_sess,
+		 const char *cname,
+		 stream_rtp_h *rtph, stream_rtcp_h *rtcph, void *arg)
+{
+	struct stream *s;
+	int err;
+
+	if (!sp || !cfg || !call || !rtph)
+		return EINVAL;
+
+	s = mem_zalloc(sizeof(*s), stream_destructor);
+	if (!s)
+		return ENOMEM;
+
+	s->cfg   = *cfg;
+	s->call  = call;
+	s->rtph  = rtph;
+	s->rtcph = rtcph;
+	s->arg   = arg;
+	s->pseq  = -1;
+	s->rtx_pt = -1;
+	s->fec_pt = -1;
+	s->rtcp  = s->cfg.rtcp_enable;
+
+	err = rtpdemux_alloc(&s->demux);
+	if (err)
+		goto out;
+
+	err = stream_sock_alloc(s, call_af(call));
+	if (err) {
+		warning("stream: failed to create socket for media '%s'"
+			" (%m)\n", name, err);
+		goto out;
 	}
 
+	err = str_dup(&s->cname, cname);
 	if (err)
 		goto out;
 
-	s->pt_enc = -1;
+	/* Jitter buffer */
+	if (cfg->jbuf_del.min && cfg->jbuf_del.max) {
 
-	metric_init(&s->metric_tx);
-	metric_init(&s->metric_rx);
+		/* The adaptive delay is computed from the packet rate,
+		   which is only constant for audio */
+		bool adaptive = cfg->jbuf_adaptive &&
+			0 == str_casecmp(name, "audio");
 
-	list_append(call_streaml(call), &s->le, s);
+		err = jbuf_alloc(&s->jbuf, adaptive ? 1 : cfg->jbuf_del.min,
+				 cfg->jbuf_del.max);
+		if (err)
+			goto out;
 
- out:
+		if (adaptive) {
+			err = ajb_alloc(&s->ajb, cfg->jbuf_del.max);
+			if (err)
+				goto out;
+		}
+	}
+
+	err = sdp_media_add(&s->sdp, sdp_sess, name,
+			    sa_port(rtp_local(s->rtp)),
+			    (menc && menc->sdp_proto) ? menc->sdp_proto :
+			    sdp_proto_rtpavp);
 	if (err)
-		mem_deref(s);
-	else
-		*sp = s;
+		goto out;
 
-	return err;
+	if (label) {
+		err |= sdp_media_set_lattr(s->sdp, true,
+					   "label", "%d", label);
+	}
+
+	/* RFC 5506 */
+	if (s->rtcp)
+		err |= sdp_media_set_lattr(s->sdp, true, "rtcp-rsize", NULL);
+
+	/* RFC 5576 */
+	if (s->rtcp) {
+		err |= sdp_media_set_lattr(s->sdp, true,
+					   "ssrc", "%u cname:%s",
+					   rtp_sess_ssrc(s->rtp), cname);
+	}
+
+	/* RFC 5761 */
+	if (cfg->rtcp_mux)
+		err |= sdp_media_set_lattr(s->sdp, true, "rtcp-mux", NULL);
+
+	/* RFC 8843 */
+	if (cfg->bundle && cfg->rtcp_mux)
+		err |= sdp_media_set_lattr(s->sdp, true, "mid", "%s", name);
+
+	/* RFC 3611 */
+	if (s->rtcp && cfg->rtcp_xr && 0 == str_casecmp(name, "audio")) {
+		err |= sdp_media_set_lattr(s->sdp, true, "rtcp-xr",
+					   "voip-metrics");
+		err |= udp_register_helper(&s->uh_xr, rtp_sock(s->rtp),
+					   LAYER_RTCPXR, NULL,
+					   xr_recv_handler, s);
+		err |= udp_register_helper(&s->uh_xr_rtcp,
+					   rtcp_sock(s->rtp),
+					   LAYER_RTCPXR, NULL,
+					   xr_recv_handler, s);
+		twheel_tmr_start(&s->tmr_xr, baresip_twheel(), XR_INTERVAL,
+				 xr_handler, s);
+	}
+
+	if (err)
+		goto out;
+
+	if (mnat) {
+		err = mnat->mediah(&s->mns, mnat_sess, IPPROTO_UDP,
+				   rtp_sock(s->rtp),
+				   s->rtcp ? rtcp_sock(s->rtp) : NULL,
+				   s->sdp);
+		if (err)
+			goto out;
+	}
+
+	if (menc) {
+		s->menc  = menc;
+		s->mencs = mem_ref(menc_sess);
+		err = menc->mediah(&s->mes, menc_sess,
+				   s->rtp,
+				   IPPROTO_UDP,
+				   rtp_sock(s->rtp),
+				   s->rtcp ? rtcp_sock(s->rtp) : NULL,
+				   s->sdp);
+		if (err)
+			goto out;
+	}
+
+	if (err)
+		goto out;
+
+	s->pt_enc = -1;
+
+	metric_init(&s->metric_tx);
+	metric_init(&s->metric_rx);
+
+	if (0 == str_casecmp(name, "audio"))
+		twheel_tmr_start(&s->tmr_mosq, baresip_twheel(), MOSQ_INTERVAL,
+				 mosq_handler, s);
+
+	list_append(call_streaml(call), &s->le, s);
+
+ out:
+	if (err)
+		mem_deref(s);
+	else
+		*sp = s;
+
+	return err;
+}
+
+
+struct sdp_media *stream_sdpmedia(const struct stream *s)
+{
+	return s ? s->sdp : NULL;
+}
+
+
+/**
+ * Set the size of the buffer for a received RTP packet, if it is larger
+ * than the default size
+ *
+ * @param s  Stream object
+ * @param sz Size in [bytes]
+ */
+void stream_set_rxsz(struct stream *s, size_t sz)
+{
+	if (!s)
+		return;
+
+	sz = max(sz, (size_t)RTP_RECV_SIZE);
+	if (sz == s->rxsz)
+		return;
+
+	s->rxsz = sz;
+	udp_rxsz_set(rtp_sock(s->rtp), sz);
+}
+
+
+/**
+ * Get the local format of a received payload type. The formats of the
+ * recent payload types are cached, until the stream is updated.
+ *
+ * @param s  Stream object
+ * @param pt Payload type
+ *
+ * @return Local format, or NULL if not found
+ */
+const struct sdp_format *stream_lformat(struct stream *s, uint8_t pt)
+{
+	struct ptcache *pc;
+
+	if (!s)
+		return NULL;
+
+	pc = &s->ptcv[pt % STREAM_PTC];
+
+	if (!pc->valid || pc->pt != pt) {
+		pc->fmt   = sdp_media_lformat(s->sdp, pt);
+		pc->pt    = pt;
+		pc->valid = true;
+	}
+
+	return pc->fmt;
+}
+
+
+static void stream_start_keepalive(struct stream *s)
+{
+	const char *rtpkeep;
+
+	if (!s)
+		return;
+
+	rtpkeep = ua_prm(call_get_ua(s->call))->rtpkeep;
+
+	s->rtpkeep = mem_deref(s->rtpkeep);
+
+	if (rtpkeep && sdp_media_rformat(s->sdp, NULL)) {
+		int err;
+		err = rtpkeep_alloc(&s->rtpkeep, rtpkeep,
+				    IPPROTO_UDP, s->rtp, s->sdp);
+		if (err) {
+			warning("stream: rtpkeep_alloc failed: %m\n", err);
+		}
+	}
+}
+
+
+/* Send a payload with a given RTP header, written into the headroom */
+static int rtp_send_hdr(struct stream *s, const struct rtp_header *hdr,
+			struct mbuf *mb)
+{
+	const size_t hdrsz = RTP_HEADER_SIZE + 4 * hdr->cc;
+	size_t pos;
+	int err;
+
+	if (mb->pos < hdrsz)
+		return EINVAL;
+
+	metric_add_packet(&s->metric_tx, mbuf_get_left(mb));
+
+	pos = mb->pos - hdrsz;
+	mb->pos = pos;
+
+	err = rtp_hdr_encode(mb, hdr);
+	mb->pos = pos;
+	if (err)
+		goto out;
+
+	err = udp_send(rtp_sock(s->rtp), sdp_media_raddr(s->sdp), mb);
+
+ out:
+	if (err)
+		metric_add_err(&s->metric_tx);
+
+	mb->pos = pos + hdrsz;
+
+	return err;
+}
+
+
+/* Send the repair packet of a FEC block that ended with this packet */
+static void fec_send(struct stream *s, uint16_t seq, uint32_t ts)
+{
+	struct rtp_header hdr;
+	struct mbuf *mb;
+
+	if (fecenc_commit(s->fecenc, seq, STREAM_PRESZ + 4, &mb) || !mb)
+		return;
+
+	/* the CSRC is the protected source, as in RFC 8627 */
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ver     = RTP_VERSION;
+	hdr.cc      = 1;
+	hdr.pt      = s->fec_pt;
+	hdr.seq     = s->fec_seq++;
+	hdr.ts      = ts;
+	hdr.ssrc    = s->fec_ssrc;
+	hdr.csrc[0] = rtp_sess_ssrc(s->rtp);
+
+	(void)rtp_send_hdr(s, &hdr, mb);
+
+	mem_deref(mb);
+}
+
+
+/* Write the negotiated header extensions in front of the payload */
+static size_t rtpext_write(struct stream *s, struct mbuf *mb)
+{
+	static const size_t lenv[RTPEXT_MAX] = {1, 3, 2};
+	size_t num_bytes = 0, sz, pos;
+	uint8_t data[3];
+	uint32_t ast;
+	int i, err;
+
+	for (i=0; i<RTPEXT_MAX; i++) {
+		if (s->extmap[i])
+			num_bytes += 1 + lenv[i];
+	}
+
+	sz = RTPEXT_HDR_SIZE + (num_bytes + 3) / 4 * 4;
+
+	if (!num_bytes || mb->pos < RTP_HEADER_SIZE + sz)
+		return 0;
+
+	pos = mb->pos;
+	mb->pos -= sz;
+
+	err = rtpext_hdr_encode(mb, num_bytes);
+
+	for (i=0; i<RTPEXT_MAX; i++) {
+
+		if (!s->extmap[i])
+			continue;
+
+		switch (i) {
+
+		case RTPEXT_AUDIO_LEVEL:
+			data[0] = s->ext_level;
+			break;
+
+		case RTPEXT_ABS_SEND_TIME:
+			ast = rtpext_abs_send_time(metric_time_us());
+			data[0] = ast >> 16;
+			data[1] = ast >> 8;
+			data[2] = ast;
+			break;
+
+		case RTPEXT_TRANSPORT_CC:
+			data[0] = s->ext_twcc >> 8;
+			data[1] = s->ext_twcc & 0xff;
+			++s->ext_twcc;
+			break;
+		}
+
+		err |= rtpext_encode(mb, s->extmap[i], lenv[i], data);
+	}
+
+	while (!err && mb->pos < pos)
+		err = mbuf_write_u8(mb, 0);
+
+	mb->pos = pos - sz;
+
+	return err ? 0 : sz;
+}
+
+
+/* libre does not set the X bit, so it is set before SRTP sees it */
+static bool rtpext_send_handler(int *err, struct sa *dst, struct mbuf *mb,
+				void *arg)
+{
+	struct stream *s = arg;
+	uint8_t *p = mbuf_buf(mb);
+	(void)err;
+	(void)dst;
+
+	if (!s->ext_send ||
+	    mbuf_get_left(mb) < RTP_HEADER_SIZE + RTPEXT_HDR_SIZE)
+		return false;
+
+	/* version 2, no CSRC, and not RTCP on a multiplexed socket */
+	if ((p[0] & 0xdf) != 0x80 ||
+	    ((p[1] & 0x7f) >= 64 && (p[1] & 0x7f) < 96))
+		return false;
+
+	if (p[12] != RTPEXT_TYPE_MAGIC >> 8 ||
+	    p[13] != (RTPEXT_TYPE_MAGIC & 0xff))
+		return false;
+
+	p[0] |= 0x10;
+	s->ext_send = false;
+
+	return false;
+}
+
+
+/* The sequence number in the RTP header in front of the payload */
+static uint16_t rtp_seq(const struct mbuf *mb, size_t pos)
+{
+	const uint8_t *p = mb->buf + pos - RTP_HEADER_SIZE + 2;
+
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+
+int stream_send(struct stream *s, bool marker, int pt, uint32_t ts,
+		struct mbuf *mb)
+{
+	int err = 0;
+
+	if (!s)
+		return EINVAL;
+
+	if (!sa_isset(sdp_media_raddr(s->sdp), SA_ALL))
+		return 0;
+	if (sdp_media_dir(s->sdp) != SDP_SENDRECV &&
+	    !(s->hold_send && sdp_media_dir(s->sdp) == SDP_SENDONLY))
+		return 0;
+
+	metric_add_packet(&s->metric_tx, mbuf_get_left(mb));
+
+	if (pt < 0)
+		pt = s->pt_enc;
+
+	if (pt >= 0) {
+		const bool hist = s->rtx && s->rtx_pt >= 0;
+		const bool fec = s->fecenc && s->fec_pt >= 0;
+		size_t pos;
+
+		/* before the payload is encrypted */
+		if (hist)
+			rtx_store(s->rtx, marker, ts, mb);
+		if (fec)
+			fecenc_store(s->fecenc, marker, pt, ts, mb);
+
+		s->ext_send = s->ext_answered && rtpext_write(s, mb);
+		pos = mb->pos;
+
+		err = rtp_send(s->rtp, sdp_media_raddr(s->sdp),
+			       marker, pt, ts, mb);
+		s->ext_send = false;
+		if (err) {
+			metric_add_err(&s->metric_tx);
+		}
+		else {
+			const uint16_t seq = rtp_seq(mb, pos);
+
+			PROBE5(stream_send, call_id(s->call),
+			       rtp_sess_ssrc(s->rtp), seq, ts,
+			       mbuf_get_left(mb));
+
+			if (hist)
+				rtx_commit(s->rtx, seq, tmr_jiffies());
+			if (fec)
+				fec_send(s, seq, ts);
+		}
+	}
+
+	rtpkeep_refresh(s->rtpkeep, ts);
+
+	return err;
+}
+
+
+/**
+ * Send an RTP packet with another SSRC than the stream's own, for
+ * simulcast layers. The RTP header is written into the headroom of
+ * the buffer, so mb->pos must be at least RTP_HEADER_SIZE.
+ *
+ * @param s      Stream object
+ * @param ssrc   Synchronization source of the packet
+ * @param seq    Sequence number of the packet
+ * @param marker RTP marker bit
+ * @param pt     Payload type, or -1 for the encoder payload type
+ * @param ts     RTP timestamp
+ * @param mb     Buffer with RTP payload
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_send_ssrc(struct stream *s, uint32_t ssrc, uint16_t seq,
+		     bool marker, int pt, uint32_t ts, struct mbuf *mb)
+{
+	struct rtp_header hdr;
+
+	if (!s || !mb)
+		return EINVAL;
+
+	if (mb->pos < RTP_HEADER_SIZE)
+		return EINVAL;
+
+	if (!sa_isset(sdp_media_raddr(s->sdp), SA_ALL))
+		return 0;
+	if (sdp_media_dir(s->sdp) != SDP_SENDRECV)
+		return 0;
+
+	if (pt < 0)
+		pt = s->pt_enc;
+	if (pt < 0)
+		return 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ver  = RTP_VERSION;
+	hdr.m    = marker;
+	hdr.pt   = pt;
+	hdr.seq  = seq;
+	hdr.ts   = ts;
+	hdr.ssrc = ssrc;
+
+	return rtp_send_hdr(s, &hdr, mb);
+}
+
+
+/**
+ * Start a batch of outgoing RTP packets. The packets sent with
+ * stream_send() are queued until stream_send_batch_flush() is called.
+ * The media encryption, if any, may then protect them as one burst.
+ *
+ * @param s Stream object
+ */
+void stream_send_batch_start(struct stream *s)
+{
+	if (!s)
+		return;
+
+	udpbatch_start(s->batch);
+
+	if (s->mes && s->menc && s->menc->bursth)
+		(void)s->menc->bursth(s->mes, true);
+}
+
+
+/**
+ * Send all RTP packets queued since stream_send_batch_start()
+ *
+ * @param s Stream object
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_send_batch_flush(struct stream *s)
+{
+	int err = 0;
+
+	if (!s)
+		return 0;
+
+	/* the encrypted burst goes into the UDP batch, if any */
+	if (s->mes && s->menc && s->menc->bursth)
+		err |= s->menc->bursth(s->mes, false);
+
+	if (s->batch)
+		err |= udpbatch_flush(s->batch);
+
+	if (err)
+		metric_add_err(&s->metric_tx);
+
+	return err;
+}
+
+
+/* The datagrams of a bundled stream go out on the BUNDLE transport */
+static bool bundle_send_handler(int *err, struct sa *dst, struct mbuf *mb,
+				void *arg)
+{
+	struct stream *s = arg;
+	struct stream *b = s->bundle;
+	(void)dst;
+
+	if (!b)
+		return false;
+
+	*err = udp_send(rtp_sock(b->rtp), sdp_media_raddr(b->sdp), mb);
+
+	return true;
+}
+
+
+static bool bundle_recv_handler(struct sa *src, struct mbuf *mb, void *arg)
+{
+	(void)src;
+	(void)mb;
+	(void)arg;
+
+	return false;
+}
+
+
+/**
+ * Bundle a stream onto the transport of another stream (RFC 8843).
+ * The bundled stream then sends on the RTP socket of the other stream,
+ * which receives and demultiplexes for both; the media encryption and
+ * NAT traversal of the bundled stream are stopped.
+ *
+ * @param s      Stream object
+ * @param bundle Stream with the BUNDLE transport, NULL to unbundle
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_bundle(struct stream *s, struct stream *bundle)
+{
+	int err;
+
+	if (!s || s == bundle)
+		return EINVAL;
+
+	if (s->bundle == bundle)
+		return 0;
+
+	if (!bundle) {
+		if (s->bundle)
+			rtpdemux_remove(s->bundle->demux, s);
+		list_unlink(&s->le_bundle);
+		s->uh_bundle = mem_deref(s->uh_bundle);
+		s->bundle = NULL;
+		return 0;
+	}
+
+	if (bundle->bundle || s->bundlel.head)
+		return EINVAL;
+
+	if (!s->rtcp_mux || !bundle->rtcp_mux)
+		return EPROTO;
+
+	stream_bundle(s, NULL);
+
+	err = udp_register_helper(&s->uh_bundle, rtp_sock(s->rtp),
+				  LAYER_BUNDLE, bundle_send_handler,
+				  bundle_recv_handler, s);
+	if (err)
+		return err;
+
+	s->bundle = bundle;
+	list_append(&bundle->bundlel, &s->le_bundle, s);
+
+	/* one transport: one DTLS handshake and one ICE check list */
+	s->mes = mem_deref(s->mes);
+	s->mns = mem_deref(s->mns);
+	sdp_media_del_lattr(s->sdp, "candidate");
+
+	sdp_media_set_lport(s->sdp, sa_port(rtp_local(bundle->rtp)));
+
+	info("stream: %s: bundled with %s\n",
+	     sdp_media_name(s->sdp), sdp_media_name(bundle->sdp));
+
+	return 0;
+}
+
+
+/**
+ * Print the BUNDLE group of a stream and the streams bundled onto it
+ *
+ * @param pf Print function
+ * @param s  Stream with the BUNDLE transport
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_bundle_print(struct re_printf *pf, const struct stream *s)
+{
+	struct le *le;
+	int err;
+
+	if (!s)
+		return 0;
+
+	err = re_hprintf(pf, "BUNDLE %s", stream_mid(s));
+
+	for (le = s->bundlel.head; le; le = le->next)
+		err |= re_hprintf(pf, " %s", stream_mid(le->data));
+
+	return err;
+}
+
+
+/**
+ * Get the media identification tag of a stream, as in a=mid
+ *
+ * @param s Stream object
+ *
+ * @return Remote tag if any, otherwise the media name
+ */
+const char *stream_mid(const struct stream *s)
+{
+	const char *mid;
+
+	if (!s)
+		return NULL;
+
+	mid = sdp_media_rattr(s->sdp, "mid");
+
+	return mid ? mid : sdp_media_name(s->sdp);
+}
+
+
+static void stream_remote_set(struct stream *s)
+{
+	struct sa rtcp;
+
+	if (!s)
+		return;
+
+	/* RFC 5761 */
+	if (s->cfg.rtcp_mux && sdp_media_rattr(s->sdp, "rtcp-mux")) {
+
+		if (!s->rtcp_mux)
+			info("%s: RTP/RTCP multiplexing enabled\n",
+			     sdp_media_name(s->sdp));
+		s->rtcp_mux = true;
+	}
+
+	rtcp_enable_mux(s->rtp, s->rtcp_mux);
+
+	sdp_media_raddr_rtcp(s->sdp, &rtcp);
+
+	rtcp_start(s->rtp, s->cname,
+		   s->rtcp_mux ? sdp_media_raddr(s->sdp): &rtcp);
+}
+
+
+/* The RTX payload type of the peer for the encoder payload type */
+static void rtx_update_pt(struct stream *s)
+{
+	struct le *le;
+
+	s->rtx_pt = -1;
+
+	if (!s->rtx || s->pt_enc < 0)
+		return;
+
+	for (le = list_head(sdp_media_format_lst(s->sdp, false)); le;
+	     le = le->next) {
+
+		const struct sdp_format *fmt = le->data;
+
+		if (rtx_apt(fmt) == s->pt_enc) {
+			s->rtx_pt = fmt->pt;
+			break;
+		}
+	}
+}
+
+
+/*
+ * Offer the extensions with their default IDs, one more than the type.
+ * Once the peer has answered, only the ones both sides have are kept,
+ * with the IDs of the peer.
+ */
+static int extmap_sdp(struct stream *s)
+{
+	bool replace = true;
+	int i, err = 0;
+
+	for (i=0; i<RTPEXT_MAX; i++) {
+
+		unsigned id = s->extmap[i] ? s->extmap[i] : (unsigned)i + 1;
+
+		if (!(s->ext_offer & 1u << i))
+			continue;
+		if (s->ext_answered && !s->extmap[i])
+			continue;
+
+		err |= sdp_media_set_lattr(s->sdp, replace, "extmap", "%u %s",
+					   id, rtpext_uri(i));
+		replace = false;
+	}
+
+	if (replace)
+		sdp_media_del_lattr(s->sdp, "extmap");
+
+	return err;
+}
+
+
+static bool extmap_handler(const char *name, const char *value, void *arg)
+{
+	struct stream *s = arg;
+	struct sdp_extmap ext;
+	int type;
+	(void)name;
+
+	if (sdp_extmap_decode(&ext, value))
+		return false;
+
+	type = rtpext_find(&ext.name);
+	if (type < 0 || !(s->ext_offer & 1u << type))
+		return false;
+
+	if (ext.id < RTPEXT_ID_MIN || ext.id > RTPEXT_ID_MAX)
+		return false;
+
+	s->extmap[type] = ext.id;
+
+	return false;
+}
+
+
+static void extmap_update(struct stream *s)
+{
+	if (!s->ext_offer || !sdp_media_has_media(s->sdp))
+		return;
+
+	memset(s->extmap, 0, sizeof(s->extmap));
+	(void)sdp_media_rattr_apply(s->sdp, "extmap", extmap_handler, s);
+	s->ext_answered = true;
+
+	if (extmap_sdp(s))
+		warning("stream: %s: extmap failed\n", sdp_media_name(s->sdp));
+}
+
+
+/* The FlexFEC payload type of the peer */
+static void fec_update_pt(struct stream *s)
+{
+	const struct sdp_format *fmt;
+
+	s->fec_pt = -1;
+
+	if (!s->fecenc)
+		return;
+
+	fmt = sdp_media_format(s->sdp, false, NULL, -1, "flexfec", -1, -1);
+	if (fmt)
+		s->fec_pt = fmt->pt;
+}
+
+
+void stream_update(struct stream *s)
+{
+	const struct sdp_format *fmt;
+	int err = 0;
+
+	if (!s)
+		return;
+
+	fmt = sdp_media_rformat(s->sdp, NULL);
+
+	memset(s->ptcv, 0, sizeof(s->ptcv));
+
+	s->pt_enc = fmt ? fmt->pt : -1;
+	rtx_update_pt(s);
+	fec_update_pt(s);
+	extmap_update(s);
+
+	if (sdp_media_has_media(s->sdp))
+		stream_remote_set(s);
+
+	if (s->cfg.bundle && s->cfg.rtcp_mux)
+		(void)sdp_media_set_lattr(s->sdp, true, "mid", "%s",
+					  stream_mid(s));
+
+	/* a bundled stream is protected by the BUNDLE transport */
+	if (s->menc && s->menc->mediah && !s->bundle) {
+		err = s->menc->mediah(&s->mes, s->mencs, s->rtp,
+				      IPPROTO_UDP,
+				      rtp_sock(s->rtp),
+				      s->rtcp ? rtcp_sock(s->rtp) : NULL,
+				      s->sdp);
+		if (err) {
+			warning("stream: mediaenc update: %m\n", err);
+		}
+	}
+}
+
+
+void stream_update_encoder(struct stream *s, int pt_enc)
+{
+	if (pt_enc >= 0) {
+		s->pt_enc = pt_enc;
+		rtx_update_pt(s);
+	}
+}
+
+
+static void stat_get(struct stream_stat *st, const struct metric *m)
+{
+	st->n_packets    = ATOMIC_LOAD(&m->n_packets);
+	st->n_bytes      = ATOMIC_LOAD(&m->n_bytes);
+	st->n_err        = ATOMIC_LOAD(&m->n_err);
+	st->bitrate      = m->cur_bitrate;
+	st->peak_bitrate = m->peak_bitrate;
+	st->iat          = &m->h_iat;
+	st->jbuf         = &m->h_jbuf;
+	st->proc         = &m->h_proc;
+}
+
+
+/**
+ * Get the name of a media stream
+ *
+ * @param s Stream object
+ *
+ * @return Media name, e.g. "audio"
+ */
+const char *stream_name(const struct stream *s)
+{
+	return s ? sdp_media_name(s->sdp) : NULL;
+}
+
+
+/**
+ * Get the continuous quality estimate of a received audio stream
+ *
+ * @param s Stream object
+ * @param q Returned quality estimate
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_quality(const struct stream *s, struct stream_quality *q)
+{
+	if (!s || !q)
+		return EINVAL;
+
+	if (!s->mosq.valid)
+		return ENOENT;
+
+	*q = s->mosq.q;
+
+	return 0;
+}
+
+
+/**
+ * Get the last RTCP XR VoIP metrics from the peer, which tell how the
+ * media sent on a stream is received
+ *
+ * @param s Stream object
+ *
+ * @return VoIP metrics, NULL if none were received
+ */
+const struct rtcpxr_voip *stream_rtcpxr(const struct stream *s)
+{
+	return s && s->xr_peer_valid ? &s->xr_peer : NULL;
+}
+
+
+/**
+ * Get the loss, reordering and duplicates of the received RTP packets
+ *
+ * @param s Stream object
+ *
+ * @return Sequence window, NULL if no stream
+ */
+const struct seqwin *stream_seqwin(const struct stream *s)
+{
+	return s ? &s->rxwin : NULL;
+}
+
+
+/**
+ * Get the statistics of a media stream, without locking
+ *
+ * @param s  Stream object
+ * @param tx Transmit statistics, optional
+ * @param rx Receive statistics, optional
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_stats(const struct stream *s, struct stream_stat *tx,
+		 struct stream_stat *rx)
+{
+	if (!s)
+		return EINVAL;
+
+	if (tx)
+		stat_get(tx, &s->metric_tx);
+	if (rx)
+		stat_get(rx, &s->metric_rx);
+
+	return 0;
 }
 
 
-struct sdp_media *stream_sdpmedia(const struct stream *s)
+/**
+ * Get the RTCP statistics of a media stream
+ *
+ * @param s Stream object
+ *
+ * @return RTCP statistics from the last report
+ */
+const struct rtcp_stats *stream_rtcp_stats(const struct stream *s)
 {
-	return s ? s->sdp : NULL;
+	return s ? &s->rtcp_stats : NULL;
 }
 
 
-static void stream_start_keepalive(struct stream *s)
+/**
+ * Get the jitter-buffer statistics of a media stream
+ *
+ * @param s    Stream object
+ * @param stat Returned statistics
+ *
+ * @return 0 if success, ENOENT if the stream has no jitter-buffer
+ */
+int stream_jbuf_stats(const struct stream *s, struct jbuf_stat *stat)
 {
-	const char *rtpkeep;
-
-	if (!s)
-		return;
-
-	rtpkeep = ua_prm(call_get_ua(s->call))->rtpkeep;
+	if (!s || !stat)
+		return EINVAL;
 
-	s->rtpkeep = mem_deref(s->rtpkeep);
+	if (!s->jbuf)
+		return ENOENT;
 
-	if (rtpkeep && sdp_media_rformat(s->sdp, NULL)) {
-		int err;
-		err = rtpkeep_alloc(&s->rtpkeep, rtpkeep,
-				    IPPROTO_UDP, s->rtp, s->sdp);
-		if (err) {
-			warning("stream: rtpkeep_alloc failed: %m\n", err);
-		}
-	}
+	return jbuf_stats(s->jbuf, stat);
 }
 
 
-int stream_send(struct stream *s, bool marker, int pt, uint32_t ts,
-		struct mbuf *mb)
+/**
+ * Impair the RTP packets sent on a media stream, for testing. The loss,
+ * delay and reordering are applied below SRTP, as on the network.
+ *
+ * @param s   Stream object
+ * @param prm Impairment parameters, or NULL to stop the impairment
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_impair(struct stream *s, const struct impair_prm *prm)
 {
-	int err = 0;
-
 	if (!s)
 		return EINVAL;
 
-	if (!sa_isset(sdp_media_raddr(s->sdp), SA_ALL))
-		return 0;
-	if (sdp_media_dir(s->sdp) != SDP_SENDRECV)
-		return 0;
-
-	metric_add_packet(&s->metric_tx, mbuf_get_left(mb));
-
-	if (pt < 0)
-		pt = s->pt_enc;
-
-	if (pt >= 0) {
-		err = rtp_send(s->rtp, sdp_media_raddr(s->sdp),
-			       marker, pt, ts, mb);
-		if (err)
-			s->metric_tx.n_err++;
-	}
+	s->impair = mem_deref(s->impair);
 
-	rtpkeep_refresh(s->rtpkeep, ts);
+	if (!prm)
+		return 0;
 
-	return err;
+	return impair_alloc(&s->impair, rtp_sock(s->rtp), prm);
 }
 
 
-static void stream_remote_set(struct stream *s)
+/**
+ * Get the statistics of the impairment of a media stream
+ *
+ * @param s    Stream object
+ * @param stat Returned statistics
+ *
+ * @return 0 if success, ENOENT if the stream is not impaired
+ */
+int stream_impair_stats(const struct stream *s, struct impair_stat *stat)
 {
-	struct sa rtcp;
-
-	if (!s)
-		return;
-
-	/* RFC 5761 */
-	if (s->cfg.rtcp_mux && sdp_media_rattr(s->sdp, "rtcp-mux")) {
-
-		if (!s->rtcp_mux)
-			info("%s: RTP/RTCP multiplexing enabled\n",
-			     sdp_media_name(s->sdp));
-		s->rtcp_mux = true;
-	}
-
-	rtcp_enable_mux(s->rtp, s->rtcp_mux);
+	if (!s || !stat)
+		return EINVAL;
 
-	sdp_media_raddr_rtcp(s->sdp, &rtcp);
+	if (!s->impair)
+		return ENOENT;
 
-	rtcp_start(s->rtp, s->cname,
-		   s->rtcp_mux ? sdp_media_raddr(s->sdp): &rtcp);
+	return impair_stats(s->impair, stat);
 }
 
 
-void stream_update(struct stream *s)
+/**
+ * Add the memory of a stream to a memory report
+ *
+ * The jitter-buffer is counted when it is full, with one frame of the
+ * largest packet received so far, or one receive buffer before the
+ * first packet. The RTP send history is not counted.
+ *
+ * @param ms Memory report
+ * @param s  Stream object
+ */
+void stream_memstat(struct callmem *ms, const struct stream *s)
 {
-	const struct sdp_format *fmt;
-	int err = 0;
-
-	if (!s)
+	if (!ms || !s)
 		return;
 
-	fmt = sdp_media_rformat(s->sdp, NULL);
-
-	s->pt_enc = fmt ? fmt->pt : -1;
-
-	if (sdp_media_has_media(s->sdp))
-		stream_remote_set(s);
-
-	if (s->menc && s->menc->mediah) {
-		err = s->menc->mediah(&s->mes, s->mencs, s->rtp,
-				      IPPROTO_UDP,
-				      rtp_sock(s->rtp),
-				      s->rtcp ? rtcp_sock(s->rtp) : NULL,
-				      s->sdp);
-		if (err) {
-			warning("stream: mediaenc update: %m\n", err);
-		}
-	}
-}
+	ms->obj += sizeof(*s);
 
+	if (s->mb_remb)
+		ms->pkt += s->mb_remb->size;
 
-void stream_update_encoder(struct stream *s, int pt_enc)
-{
-	if (pt_enc >= 0)
-		s->pt_enc = pt_enc;
+	if (s->jbuf)
+		ms->jbuf += (size_t)s->cfg.jbuf_del.max *
+			((s->rx_maxsz ? s->rx_maxsz : s->rxsz) +
+			 sizeof(struct mbuf));
 }
 
 
@@ -471,6 +2053,9 @@ int stream_jbuf_stat(struct re_printf *pf, const struct stream *s)
 				  stat.n_overflow, stat.n_underflow);
 	}
 
+	if (s->ajb)
+		err |= re_hprintf(pf, " %H", ajb_debug, s->ajb);
+
 	return err;
 }
 
@@ -484,12 +2069,29 @@ void stream_hold(struct stream *s, bool hold)
 }
 
 
+/**
+ * Keep sending RTP while the stream is on hold, for music on hold
+ *
+ * @param s      Stream object
+ * @param enable True to send while on hold
+ */
+void stream_hold_send(struct stream *s, bool enable)
+{
+	if (!s)
+		return;
+
+	s->hold_send = enable;
+}
+
+
 void stream_set_srate(struct stream *s, uint32_t srate_tx, uint32_t srate_rx)
 {
 	if (!s)
 		return;
 
 	rtcp_set_srate(s->rtp, srate_tx, srate_rx);
+	ajb_set_srate(s->ajb, srate_rx);
+	s->srate_rx = srate_rx;
 }
 
 
@@ -506,7 +2108,7 @@ void stream_send_fir(struct stream *s, bool pli)
 		err = rtcp_send_fir(s->rtp, rtp_sess_ssrc(s->rtp));
 
 	if (err) {
-		s->metric_tx.n_err++;
+		metric_add_err(&s->metric_tx);
 
 		warning("stream: failed to send RTCP %s: %m\n",
 			pli ? "PLI" : "FIR", err);
@@ -514,12 +2116,259 @@ void stream_send_fir(struct stream *s, bool pli)
 }
 
 
+/**
+ * Estimate the receive bandwidth and send it to the peer in REMB
+ *
+ * @param s        Stream object
+ * @param srate    RTP clock rate of incoming RTP in [Hz]
+ * @param rate_max Highest bitrate to ask for in [bit/s]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_enable_bwe(struct stream *s, uint32_t srate, uint32_t rate_max)
+{
+	if (!s)
+		return EINVAL;
+
+	if (s->bwe)
+		return 0;
+
+	return bwe_alloc(&s->bwe, srate, min(BWE_RATE_MIN, rate_max),
+			 rate_max);
+}
+
+
+/**
+ * Keep a history of sent RTP packets, for retransmission with RTX
+ *
+ * @param s    Stream object
+ * @param rate Retransmission rate limit in [bit/s]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_enable_rtx(struct stream *s, uint32_t rate)
+{
+	int err;
+
+	if (!s)
+		return EINVAL;
+
+	if (s->rtx)
+		return 0;
+
+	err = rtx_alloc(&s->rtx, RTX_HISTORY, rate);
+	if (err)
+		return err;
+
+	s->rtx_ssrc = rand_u32();
+	s->rtx_seq  = rand_u16();
+	rtx_update_pt(s);
+
+	return 0;
+}
+
+
+/**
+ * Send a generic NACK (RFC 4585) for lost packets
+ *
+ * @param s      Stream object
+ * @param enable True to send NACK
+ */
+void stream_enable_nack(struct stream *s, bool enable)
+{
+	if (!s)
+		return;
+
+	s->nack = enable && s->rtcp;
+}
+
+
+/**
+ * Encode a retransmission of a sent packet, in the thread handling
+ * RTCP. It is sent with stream_send_rtx() in the sending thread.
+ *
+ * @param s      Stream object
+ * @param seq    Sequence number of the lost packet
+ * @param presz  Headroom in front of the payload
+ * @param mbp    Returned buffer with RTX payload
+ * @param marker Returned RTP marker bit
+ * @param ts     Returned RTP timestamp
+ *
+ * @return 0 if success, ENOTSUP if the peer does not support RTX,
+ *         otherwise an errorcode from rtx_encode()
+ */
+int stream_rtx_encode(struct stream *s, uint16_t seq, size_t presz,
+		      struct mbuf **mbp, bool *marker, uint32_t *ts)
+{
+	if (!s)
+		return EINVAL;
+
+	if (!s->rtx || s->rtx_pt < 0)
+		return ENOTSUP;
+
+	return rtx_encode(s->rtx, mbp, presz, seq, tmr_jiffies(),
+			  marker, ts);
+}
+
+
+/**
+ * Send a retransmission from stream_rtx_encode()
+ *
+ * @param s      Stream object
+ * @param marker RTP marker bit
+ * @param ts     RTP timestamp
+ * @param mb     Buffer with RTX payload
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_send_rtx(struct stream *s, bool marker, uint32_t ts,
+		    struct mbuf *mb)
+{
+	if (!s)
+		return EINVAL;
+
+	if (s->rtx_pt < 0)
+		return ENOTSUP;
+
+	return stream_send_ssrc(s, s->rtx_ssrc, s->rtx_seq++, marker,
+				s->rtx_pt, ts, mb);
+}
+
+
+/**
+ * Protect the sent RTP packets with FlexFEC (RFC 8627), and recover lost
+ * packets with the received repair packets
+ *
+ * @param s     Stream object
+ * @param ratio Repair packets in [%] of the media packets, without loss
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_enable_fec(struct stream *s, uint32_t ratio)
+{
+	int err;
+
+	if (!s || !ratio)
+		return EINVAL;
+
+	if (s->fecenc)
+		return 0;
+
+	err  = fecenc_alloc(&s->fecenc, ratio);
+	err |= fecdec_alloc(&s->fecdec);
+	if (err) {
+		s->fecenc = mem_deref(s->fecenc);
+		s->fecdec = mem_deref(s->fecdec);
+		return err;
+	}
+
+	s->fec_ssrc = rand_u32();
+	s->fec_seq  = rand_u16();
+	fec_update_pt(s);
+
+	return 0;
+}
+
+
+/**
+ * Offer an RTP header extension, it is sent once the peer accepts it
+ *
+ * @param s    Stream object
+ * @param type Header extension
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_enable_rtpext(struct stream *s, enum rtpext_type type)
+{
+	int err;
+
+	if (!s || (unsigned)type >= RTPEXT_MAX)
+		return EINVAL;
+
+	if (!s->uh_ext) {
+		err = udp_register_helper(&s->uh_ext, rtp_sock(s->rtp),
+					  LAYER_RTPEXT, rtpext_send_handler,
+					  NULL, s);
+		if (err)
+			return err;
+	}
+
+	s->ext_offer |= 1u << type;
+
+	return extmap_sdp(s);
+}
+
+
+/**
+ * Check if an RTP header extension was negotiated
+ *
+ * @param s    Stream object
+ * @param type Header extension
+ *
+ * @return True if the extension is sent
+ */
+bool stream_has_rtpext(const struct stream *s, enum rtpext_type type)
+{
+	if (!s || (unsigned)type >= RTPEXT_MAX)
+		return false;
+
+	return s->ext_answered && s->extmap[type] != 0;
+}
+
+
+/**
+ * Set the audio level of the next sent packets (RFC 6464)
+ *
+ * @param s     Stream object
+ * @param level Audio level in [-dBov], 0-127
+ * @param voice True if the packets have voice
+ */
+void stream_set_audio_level(struct stream *s, uint8_t level, bool voice)
+{
+	if (!s)
+		return;
+
+	s->ext_level = (voice ? 0x80 : 0x00) | min(level, 127);
+}
+
+
+/**
+ * Get the audio level of the last received packet (RFC 6464)
+ *
+ * @param s     Stream object
+ * @param level Returned audio level in [-dBov], 0-127
+ * @param voice Returned voice activity
+ *
+ * @return 0 if success, ENOENT if no level was received
+ */
+int stream_audio_level_rx(const struct stream *s, uint8_t *level,
+			  bool *voice)
+{
+	uint32_t v;
+
+	if (!s)
+		return EINVAL;
+
+	v = ATOMIC_LOAD(&s->ext_level_rx);
+	if (!v)
+		return ENOENT;
+
+	if (level)
+		*level = v & 0x7f;
+	if (voice)
+		*voice = (v & 0x80) != 0;
+
+	return 0;
+}
+
+
 void stream_reset(struct stream *s)
 {
 	if (!s)
 		return;
 
 	jbuf_flush(s->jbuf);
+	ajb_reset(s->ajb);
 
 	stream_start_keepalive(s);
 }
@@ -552,7 +2401,39 @@ int stream_debug(struct re_printf *pf, const struct stream *s)
 			  sdp_media_raddr(s->sdp), &rrtcp);
 
 	err |= rtp_debug(pf, s->rtp);
+	err |= rtpdemux_debug(pf, s->demux);
+	err |= re_hprintf(pf, " sequence: %H", seqwin_debug, &s->rxwin);
 	err |= jbuf_debug(pf, s->jbuf);
+	if (s->bwe)
+		err |= re_hprintf(pf, " %H\n", bwe_debug, s->bwe);
+	if (s->rtx)
+		err |= re_hprintf(pf, " %H (pt=%d)\n", rtx_debug, s->rtx,
+				  s->rtx_pt);
+	if (s->fecenc)
+		err |= re_hprintf(pf, " %H (pt=%d), %H\n",
+				  fecenc_debug, s->fecenc, s->fec_pt,
+				  fecdec_debug, s->fecdec);
+	err |= rtpkeep_debug(pf, s->rtpkeep);
+	if (s->bundle)
+		err |= re_hprintf(pf, " bundled with %s\n",
+				  sdp_media_name(s->bundle->sdp));
+	err |= re_hprintf(pf, " tx:\n%H", metric_debug, &s->metric_tx);
+	err |= re_hprintf(pf, " rx:\n%H", metric_debug, &s->metric_rx);
+	if (s->mosq.valid) {
+		const struct stream_quality *q = &s->mosq.q;
+
+		err |= re_hprintf(pf, " quality: MOS %.2f (min %.2f)"
+				  " loss=%.1f%% jitter=%.1fms alerts=%u%s\n",
+				  q->mos, q->mos_min, q->loss, q->jitter,
+				  q->n_alerts, q->alert ? " (alert)" : "");
+	}
+	if (s->xr_peer_valid) {
+		err |= re_hprintf(pf, " xr from peer: %H\n",
+				  rtcpxr_voip_debug, &s->xr_peer);
+	}
+#ifdef USE_ALLOC_STATS
+	err |= allocstat_debug(pf, &s->alloc_rx);
+#endif
 
 	return err;
 }
@@ -0,0 +1,500 @@
+/**
+ * @file trace.c  Trace of the media pipelines, in Chrome trace format
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef LINUX
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * While a trace is running, every pipeline stage records a span with
+ * its start time and duration. Each thread writes to a ring of its own,
+ * so the writers take no lock, and the oldest spans are overwritten when
+ * a ring is full. The rings are only read after the trace was stopped,
+ * and written out as Chrome trace-event JSON, which can be opened in
+ * chrome://tracing or https://ui.perfetto.dev.
+ *
+ * A ring is kept when its thread exits, and reused by the next thread,
+ * so the writers never see a ring being freed.
+ */
+
+
+enum {
+	TRACE_EVENTS = 16384,   /**< Spans per thread, a power of two */
+};
+
+struct trace_event {
+	uint64_t ts;            /**< Start time [us]             */
+	uint32_t dur;           /**< Duration [us]               */
+	uint16_t span;          /**< enum trace_span             */
+	uint16_t video;         /**< True for the video pipeline */
+	const struct call *call;
+};
+
+struct trace_ring {
+	struct le le;
+	struct trace_event *ev;
+	uint32_t head;          /**< Spans written (atomic)      */
+	uint32_t gen;           /**< Trace the ring belongs to   */
+	uint64_t tid;           /**< Thread of the ring          */
+	bool idle;              /**< Thread exited (atomic)      */
+};
+
+static struct {
+	struct list ringl;      /**< All rings (struct trace_ring) */
+	uint32_t active;        /**< Trace running (atomic)        */
+	uint32_t gen;           /**< Number of the trace           */
+	const struct call *call; /**< Only this call, or NULL      */
+	uint64_t ts_start;      /**< Start of the trace [us]       */
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+} trace = {
+	LIST_INIT,
+	0,
+	0,
+	NULL,
+	0,
+#ifdef HAVE_PTHREAD
+	PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+
+
+static const char *span_name(enum trace_span span)
+{
+	switch (span) {
+
+	case TRACE_CAPTURE:   return "capture";
+	case TRACE_CONVERT:   return "convert";
+	case TRACE_FILTER:    return "filter";
+	case TRACE_ENCODE:    return "encode";
+	case TRACE_PACKETIZE: return "packetize";
+	case TRACE_SEND:      return "send";
+	case TRACE_RECEIVE:   return "receive";
+	case TRACE_JBUF:      return "jbuf";
+	case TRACE_DECODE:    return "decode";
+	case TRACE_DISPLAY:   return "display";
+	default:              return "?";
+	}
+}
+
+
+static void ring_destructor(void *arg)
+{
+	struct trace_ring *ring = arg;
+
+	list_unlink(&ring->le);
+	mem_deref(ring->ev);
+}
+
+
+static uint64_t thread_id(void)
+{
+#if defined (LINUX) && defined (SYS_gettid)
+	return (uint64_t)syscall(SYS_gettid);
+#elif defined (HAVE_PTHREAD)
+	return (uint64_t)(uintptr_t)pthread_self();
+#else
+	return 0;
+#endif
+}
+
+
+static void lock(void)
+{
+#ifdef HAVE_PTHREAD
+	(void)pthread_mutex_lock(&trace.lock);
+#endif
+}
+
+
+static void unlock(void)
+{
+#ifdef HAVE_PTHREAD
+	(void)pthread_mutex_unlock(&trace.lock);
+#endif
+}
+
+
+/* A ring for the calling thread, an idle one or a new one */
+static struct trace_ring *ring_alloc(void)
+{
+	struct trace_ring *ring = NULL;
+	struct le *le;
+
+	lock();
+
+	for (le = trace.ringl.head; le; le = le->next) {
+
+		struct trace_ring *r = le->data;
+
+		if (ATOMIC_LOAD(&r->idle) &&
+		    (r->gen != trace.gen || !ATOMIC_LOAD(&r->head))) {
+			ring = r;
+			break;
+		}
+	}
+
+	if (ring) {
+		ATOMIC_STORE(&ring->head, 0);
+		ATOMIC_STORE(&ring->idle, false);
+	}
+	else {
+		ring = mem_zalloc(sizeof(*ring), ring_destructor);
+		if (!ring)
+			goto out;
+
+		ring->ev = mem_alloc(TRACE_EVENTS * sizeof(*ring->ev), NULL);
+		if (!ring->ev) {
+			ring = mem_deref(ring);
+			goto out;
+		}
+
+		list_append(&trace.ringl, &ring->le, ring);
+	}
+
+	ring->gen = trace.gen;
+	ring->tid = thread_id();
+
+ out:
+	unlock();
+
+	return ring;
+}
+
+
+#ifdef HAVE_PTHREAD
+static pthread_key_t key;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+
+static void key_destructor(void *arg)
+{
+	struct trace_ring *ring = arg;
+
+	ATOMIC_STORE(&ring->idle, true);
+}
+
+
+static void key_init(void)
+{
+	(void)pthread_key_create(&key, key_destructor);
+}
+
+
+static struct trace_ring *ring_get(void)
+{
+	struct trace_ring *ring;
+
+	(void)pthread_once(&once, key_init);
+
+	ring = pthread_getspecific(key);
+	if (ring)
+		return ring;
+
+	ring = ring_alloc();
+	if (!ring)
+		return NULL;
+
+	if (pthread_setspecific(key, ring)) {
+		ATOMIC_STORE(&ring->idle, true);
+		return NULL;
+	}
+
+	return ring;
+}
+#else
+static struct trace_ring *cur;
+
+
+static struct trace_ring *ring_get(void)
+{
+	if (!cur)
+		cur = ring_alloc();
+
+	return cur;
+}
+#endif
+
+
+/**
+ * Check if the spans of a call are recorded
+ *
+ * @param call Call object
+ *
+ * @return True if a trace of the call is running
+ */
+bool trace_active(const struct call *call)
+{
+	if (!ATOMIC_LOAD(&trace.active))
+		return false;
+
+	return !trace.call || trace.call == call;
+}
+
+
+/**
+ * Record a span of a pipeline stage, in the thread that ran it
+ *
+ * @param call  Call of the stream
+ * @param video True for the video pipeline
+ * @param span  Pipeline stage
+ * @param start Start time in [us], from metric_time_us()
+ * @param end   End time in [us]
+ */
+void trace_span(const struct call *call, bool video, enum trace_span span,
+		uint64_t start, uint64_t end)
+{
+	struct trace_ring *ring;
+	struct trace_event *ev;
+	uint32_t head;
+
+	if (!trace_active(call))
+		return;
+
+	ring = ring_get();
+	if (!ring)
+		return;
+
+	/* the ring still holds a stopped trace */
+	if (ring->gen != trace.gen) {
+		ATOMIC_STORE(&ring->head, 0);
+		ring->gen = trace.gen;
+	}
+
+	head = ATOMIC_LOAD(&ring->head);
+	ev = &ring->ev[head & (TRACE_EVENTS - 1)];
+
+	ev->ts    = start;
+	ev->dur   = end > start ? (uint32_t)(end - start) : 0;
+	ev->span  = span;
+	ev->video = video;
+	ev->call  = call;
+
+	ATOMIC_STORE(&ring->head, head + 1);
+}
+
+
+/**
+ * Start recording the spans of the media pipelines
+ *
+ * @param call Only record this call, or NULL for all calls
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int trace_start(const struct call *call)
+{
+	lock();
+
+	ATOMIC_STORE(&trace.active, 0);
+
+	trace.call     = call;
+	trace.ts_start = metric_time_us();
+	++trace.gen;
+
+	ATOMIC_STORE(&trace.active, 1);
+
+	unlock();
+
+	return 0;
+}
+
+
+/* A call that is still there, by object or by Call-ID */
+static struct call *call_find(const struct call *call, const struct pl *id)
+{
+	struct le *le;
+
+	for (le = list_head(uag_list()); le; le = le->next) {
+
+		struct le *lec;
+
+		for (lec = list_head(ua_calls(le->data)); lec;
+		     lec = lec->next) {
+
+			if (call ? lec->data == call :
+			    !pl_strcmp(id, call_id(lec->data)))
+				return lec->data;
+		}
+	}
+
+	return NULL;
+}
+
+
+static int print_event(FILE *f, const struct trace_event *ev, uint64_t tid,
+		       const char *callid, bool first)
+{
+	return re_fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"%s\","
+			  "\"ph\":\"X\",\"ts\":%llu,\"dur\":%u,"
+			  "\"pid\":1,\"tid\":%llu,"
+			  "\"args\":{\"call\":\"%s\"}}",
+			  first ? "" : ",",
+			  span_name(ev->span),
+			  ev->video ? "video" : "audio",
+			  ev->ts - trace.ts_start, ev->dur, tid,
+			  callid ? callid : "?");
+}
+
+
+/**
+ * Stop recording, and write the spans to a file in Chrome trace format
+ *
+ * @param path Filename of the trace
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int trace_stop(const char *path)
+{
+	const struct call *call = NULL;
+	const char *callid = NULL;
+	struct le *le;
+	uint32_t n = 0;
+	bool first = true;
+	FILE *f;
+	int err = 0;
+
+	if (!path)
+		return EINVAL;
+
+	ATOMIC_STORE(&trace.active, 0);
+
+	f = fopen(path, "w");
+	if (!f)
+		return errno;
+
+	lock();
+
+	err = re_fprintf(f, "{\"traceEvents\":[");
+
+	for (le = trace.ringl.head; le && err >= 0; le = le->next) {
+
+		const struct trace_ring *ring = le->data;
+		uint32_t head = ATOMIC_LOAD(&ring->head);
+		uint32_t i;
+
+		if (ring->gen != trace.gen)
+			continue;
+
+		i = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+
+		for (; i < head && err >= 0; i++) {
+
+			const struct trace_event *ev;
+
+			ev = &ring->ev[i & (TRACE_EVENTS - 1)];
+			if (ev->ts < trace.ts_start)
+				continue;
+
+			if (ev->call != call) {
+				call   = ev->call;
+				callid = call_id(call_find(call, NULL));
+			}
+
+			err = print_event(f, ev, ring->tid, callid, first);
+			first = false;
+			++n;
+		}
+	}
+
+	unlock();
+
+	if (err >= 0)
+		err = re_fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	err = err < 0 ? EIO : 0;
+
+	if (fclose(f) && !err)
+		err = errno;
+
+	if (!err)
+		info("trace: %u spans written to %s\n", n, path);
+
+	return err;
+}
+
+
+/**
+ * Free the rings of all threads, after the media threads were stopped
+ */
+void trace_close(void)
+{
+	ATOMIC_STORE(&trace.active, 0);
+
+	lock();
+	list_flush(&trace.ringl);
+	unlock();
+
+#ifndef HAVE_PTHREAD
+	cur = NULL;
+#endif
+}
+
+
+/**
+ * Trace command: "start", "start <call-id>" for one call only, or
+ * "stop <file>"
+ *
+ * @param pf  Print handler
+ * @param arg Command arguments
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int trace_command(struct re_printf *pf, void *arg)
+{
+	static const char usage[] = "usage: start [call-id] | stop [file]\n";
+	const struct cmd_arg *carg = arg;
+	struct pl cmd, prm = PL_INIT;
+	char path[256] = "trace.json";
+	struct call *call = NULL;
+	int err;
+
+	if (!str_isset(carg->prm) ||
+	    re_regex(carg->prm, strlen(carg->prm), "[a-z]+[ ]*[^\r\n]*",
+		     &cmd, NULL, &prm)) {
+		return re_hprintf(pf, "%s", usage);
+	}
+
+	if (0 == pl_strcmp(&cmd, "start")) {
+
+		if (pl_isset(&prm)) {
+			call = call_find(NULL, &prm);
+			if (!call)
+				return re_hprintf(pf, "trace: no call %r\n",
+						  &prm);
+		}
+
+		err = trace_start(call);
+		if (err)
+			return err;
+
+		return re_hprintf(pf, "trace: started (%s)\n",
+				  call ? call_id(call) : "all calls");
+	}
+	else if (0 == pl_strcmp(&cmd, "stop")) {
+
+		if (pl_isset(&prm))
+			(void)pl_strcpy(&prm, path, sizeof(path));
+
+		err = trace_stop(path);
+		if (err)
+			return re_hprintf(pf, "trace: %s: %m\n", path, err);
+
+		return 0;
+	}
+
+	return re_hprintf(pf, "%s", usage);
+}
@@ -0,0 +1,147 @@
+/**
+ * @file tstretch.c  Time-stretching of decoded audio
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * Buffered audio is drained or grown by whole pitch periods, so the
+ * stretch is not heard as a gap or a click. The period is the lag with
+ * the best match of the last two periods of a frame, searched on the
+ * first channel at about 8000 Hz.
+ *
+ * Accelerate cross-fades the last two periods of a frame into one.
+ * Expand repeats the last period of a frame, which continues the frame
+ * that was already played and ends on its last sample again.
+ */
+
+enum {
+	PITCH_MIN   = 2500,     /**< Shortest pitch period in [us] */
+	PITCH_MAX   = 10000,    /**< Longest pitch period in [us]  */
+	SEARCH_RATE = 8000,     /**< Sample rate of the search     */
+};
+
+
+/* Pitch period in [frames], or 0 if the frame is too short */
+static size_t pitch_period(const int16_t *sampv, size_t framec,
+			   uint32_t srate, uint8_t ch)
+{
+	const size_t step = max(srate / SEARCH_RATE, 1u);
+	const size_t pmin = (size_t)srate * PITCH_MIN / 1000000;
+	size_t pmax = (size_t)srate * PITCH_MAX / 1000000;
+	double best = -2.0;
+	size_t p, bestp = 0;
+
+	pmax = min(pmax, framec / 2);
+	if (!pmin || pmax < pmin)
+		return 0;
+
+	for (p = pmin; p <= pmax; p += step) {
+
+		const int16_t *x = &sampv[(framec - 2 * p) * ch];
+		const int16_t *y = &sampv[(framec - p) * ch];
+		double xy = 0, xx = 0, yy = 0, c;
+		size_t i;
+
+		for (i = 0; i < p; i += step) {
+			xy += (double)x[i * ch] * y[i * ch];
+			xx += (double)x[i * ch] * x[i * ch];
+			yy += (double)y[i * ch] * y[i * ch];
+		}
+
+		c = (xx > 0 && yy > 0) ? xy / sqrt(xx * yy) : 0;
+		if (c > best) {
+			best  = c;
+			bestp = p;
+		}
+	}
+
+	return bestp;
+}
+
+
+/**
+ * Shorten a frame by one pitch period
+ *
+ * @param sampv Audio samples, shortened in place
+ * @param sampc Number of samples
+ * @param srate Sample rate in [Hz]
+ * @param ch    Number of channels
+ *
+ * @return Number of samples left, sampc if the frame is too short
+ */
+size_t tstretch_accel(int16_t *sampv, size_t sampc, uint32_t srate,
+		      uint8_t ch)
+{
+	size_t framec, p, i, s;
+	int16_t *x, *y;
+
+	if (!sampv || !srate || !ch)
+		return sampc;
+
+	framec = sampc / ch;
+
+	p = pitch_period(sampv, framec, srate, ch);
+	if (!p)
+		return sampc;
+
+	x = &sampv[(framec - 2 * p) * ch];
+	y = &sampv[(framec - p) * ch];
+
+	/* fade from the first period into the second */
+	for (i = 0; i < p; i++) {
+
+		const int32_t w = (int32_t)(i * 32768 / p);
+
+		for (s = 0; s < ch; s++) {
+			const size_t k = i * ch + s;
+
+			x[k] = (int16_t)((x[k] * (32768 - w) + y[k] * w)
+					 >> 15);
+		}
+	}
+
+	return sampc - p * ch;
+}
+
+
+/**
+ * Continue a frame by repeating its last pitch period
+ *
+ * @param outv  Buffer for the extra samples
+ * @param maxc  Max. number of extra samples
+ * @param sampv Audio samples of the last frame
+ * @param sampc Number of samples in the last frame
+ * @param srate Sample rate in [Hz]
+ * @param ch    Number of channels
+ *
+ * @return Number of extra samples, 0 if the frame is too short
+ */
+size_t tstretch_expand(int16_t *outv, size_t maxc, const int16_t *sampv,
+		       size_t sampc, uint32_t srate, uint8_t ch)
+{
+	size_t framec, p, n = 0;
+
+	if (!outv || !sampv || !srate || !ch)
+		return 0;
+
+	framec = sampc / ch;
+
+	p = pitch_period(sampv, framec, srate, ch) * ch;
+	if (!p || p > maxc)
+		return 0;
+
+	while (n + p <= maxc) {
+
+		memcpy(&outv[n], &sampv[framec * ch - p], p * sizeof(int16_t));
+		n += p;
+	}
+
+	return n;
+}
@@ -0,0 +1,366 @@
+/**
+ * @file twheel.c  Hierarchical timer wheel
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * Time is cut in ticks of a fixed resolution. Level 0 has one slot per
+ * tick, and each higher level has one slot per round of the level
+ * below. A timer is put in the lowest level that reaches its tick, and
+ * moved down a level when the wheel below comes round to it. Starting
+ * and stopping a timer is O(1) whatever the number of timers, and all
+ * timers of the same tick run from one libre timer. That timer sleeps
+ * until the next slot with timers, so a wheel with a fine resolution
+ * does not wake up on every tick.
+ *
+ * A timer never runs before its time, and at most one tick after it.
+ * Timers beyond the reach of the top level wait in its last slot.
+ */
+
+
+enum {
+	WHEEL_BITS   = 6,
+	WHEEL_SLOTS  = 1 << WHEEL_BITS,
+	WHEEL_MASK   = WHEEL_SLOTS - 1,
+	WHEEL_LEVELS = 4,
+};
+
+#define WHEEL_SPAN (1ULL << (WHEEL_BITS * WHEEL_LEVELS))
+
+
+struct twheel {
+	struct list slotv[WHEEL_LEVELS][WHEEL_SLOTS];
+	struct tmr tmr;
+	uint64_t tick;       /**< Last tick that has run            */
+	uint64_t next;       /**< Tick of the next wakeup           */
+	uint32_t res;        /**< Resolution of a tick in [ms]      */
+	uint32_t count;      /**< Number of running timers          */
+};
+
+
+static void destructor(void *arg)
+{
+	struct twheel *tw = arg;
+	unsigned i, j;
+
+	tmr_cancel(&tw->tmr);
+
+	for (i=0; i<WHEEL_LEVELS; i++) {
+		for (j=0; j<WHEEL_SLOTS; j++) {
+
+			struct le *le;
+
+			while ((le = list_head(&tw->slotv[i][j]))) {
+
+				struct twheel_tmr *t = le->data;
+
+				list_unlink(le);
+				t->tw = NULL;
+			}
+		}
+	}
+}
+
+
+/* The earliest tick is the next one, or this one if it has not run yet */
+static void insert(struct twheel *tw, struct twheel_tmr *t, uint64_t first)
+{
+	uint64_t when = max(t->tick, first);
+	unsigned lvl;
+
+	if (when - tw->tick >= WHEEL_SPAN)
+		when = tw->tick + WHEEL_SPAN - 1;
+
+	for (lvl=0; lvl<WHEEL_LEVELS-1; lvl++) {
+		if (when - tw->tick < 1ULL << (WHEEL_BITS * (lvl+1)))
+			break;
+	}
+
+	list_append(&tw->slotv[lvl][(when >> (WHEEL_BITS*lvl)) & WHEEL_MASK],
+		    &t->le, t);
+}
+
+
+/* Move the timers of the slot that has come round down one level */
+static void cascade(struct twheel *tw)
+{
+	unsigned lvl;
+
+	for (lvl=1; lvl<WHEEL_LEVELS; lvl++) {
+
+		struct list *slot;
+		struct list tmp = LIST_INIT;
+		struct le *le;
+
+		if (tw->tick & ((1ULL << (WHEEL_BITS*lvl)) - 1))
+			break;
+
+		slot = &tw->slotv[lvl][(tw->tick >> (WHEEL_BITS*lvl))
+				       & WHEEL_MASK];
+
+		while ((le = list_head(slot))) {
+			list_unlink(le);
+			list_append(&tmp, le, le->data);
+		}
+
+		while ((le = list_head(&tmp))) {
+			list_unlink(le);
+			insert(tw, le->data, tw->tick);
+		}
+	}
+}
+
+
+static void expire(struct twheel *tw)
+{
+	struct list *slot = &tw->slotv[0][tw->tick & WHEEL_MASK];
+	struct le *le;
+
+	/* a handler may start or cancel any timer, including this one */
+	while ((le = list_head(slot))) {
+
+		struct twheel_tmr *t = le->data;
+		twheel_h *th = t->th;
+
+		list_unlink(le);
+		t->tw = NULL;
+		--tw->count;
+
+		if (th)
+			th(t->arg);
+	}
+}
+
+
+/* First tick after the current one that has a slot to run or cascade */
+static uint64_t next_tick(const struct twheel *tw)
+{
+	uint64_t next = UINT64_MAX;
+	unsigned lvl;
+
+	for (lvl=0; lvl<WHEEL_LEVELS; lvl++) {
+
+		const unsigned shift = WHEEL_BITS * lvl;
+		const uint64_t idx = tw->tick >> shift;
+		const struct list *slotv = tw->slotv[lvl];
+		unsigned k;
+
+		/* a higher level cannot come round earlier */
+		if ((idx + 1) << shift >= next)
+			break;
+
+		for (k=1; k<=WHEEL_SLOTS; k++) {
+
+			if (list_isempty(&slotv[(idx + k) & WHEEL_MASK]))
+				continue;
+
+			next = min(next, (idx + k) << shift);
+			break;
+		}
+	}
+
+	return next;
+}
+
+
+static void tmr_handler(void *arg);
+
+
+static void schedule(struct twheel *tw)
+{
+	uint64_t now, due;
+
+	if (!tw->count) {
+		tmr_cancel(&tw->tmr);
+		return;
+	}
+
+	tw->next = next_tick(tw);
+
+	now = tmr_jiffies();
+	due = tw->next * tw->res;
+
+	tmr_start(&tw->tmr, due > now ? due - now : 0, tmr_handler, tw);
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct twheel *tw = arg;
+	uint64_t ts = lagmon_begin();
+
+	twheel_poll(tw, tmr_jiffies());
+	schedule(tw);
+
+	lagmon_end("timer wheel", ts);
+}
+
+
+/**
+ * Allocate a timer wheel
+ *
+ * @param twp Pointer to allocated timer wheel
+ * @param res Resolution of a tick in [ms]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int twheel_alloc(struct twheel **twp, uint32_t res)
+{
+	struct twheel *tw;
+
+	if (!twp || !res)
+		return EINVAL;
+
+	tw = mem_zalloc(sizeof(*tw), destructor);
+	if (!tw)
+		return ENOMEM;
+
+	tw->res  = res;
+	tw->tick = tmr_jiffies() / res;
+
+	*twp = tw;
+
+	return 0;
+}
+
+
+/**
+ * Run all timers that are due at a given time. This is called by the
+ * timer of the wheel, and can be called to run the wheel by hand.
+ *
+ * @param tw  Timer wheel
+ * @param jfs Current time in [ms], see tmr_jiffies()
+ */
+void twheel_poll(struct twheel *tw, uint64_t jfs)
+{
+	uint64_t tick;
+
+	if (!tw)
+		return;
+
+	tick = jfs / tw->res;
+
+	/* the ticks in between have nothing to run or cascade */
+	while (tw->count) {
+
+		const uint64_t next = next_tick(tw);
+
+		if (next > tick)
+			break;
+
+		tw->tick = next;
+
+		cascade(tw);
+		expire(tw);
+	}
+
+	if (tw->tick < tick)
+		tw->tick = tick;
+}
+
+
+/**
+ * Get the number of running timers of a timer wheel
+ *
+ * @param tw Timer wheel
+ *
+ * @return Number of running timers
+ */
+uint32_t twheel_count(const struct twheel *tw)
+{
+	return tw ? tw->count : 0;
+}
+
+
+int twheel_debug(struct re_printf *pf, const struct twheel *tw)
+{
+	size_t slots = 0;
+	unsigned i, j;
+
+	if (!tw)
+		return 0;
+
+	for (i=0; i<WHEEL_LEVELS; i++) {
+		for (j=0; j<WHEEL_SLOTS; j++)
+			slots += !list_isempty(&tw->slotv[i][j]);
+	}
+
+	return re_hprintf(pf, "timer wheel: %u timers in %zu slots"
+			  " (resolution %u ms)",
+			  tw->count, slots, tw->res);
+}
+
+
+/**
+ * Start a timer on a timer wheel, or restart it if it is running
+ *
+ * @param t     Timer
+ * @param tw    Timer wheel
+ * @param delay Timeout in [ms]
+ * @param th    Timeout handler
+ * @param arg   Handler argument
+ */
+void twheel_tmr_start(struct twheel_tmr *t, struct twheel *tw,
+		      uint64_t delay, twheel_h *th, void *arg)
+{
+	if (!t || !tw)
+		return;
+
+	twheel_tmr_cancel(t);
+
+	/* an idle wheel has not counted the ticks since it stopped */
+	if (!tw->count) {
+		uint64_t tick = tmr_jiffies() / tw->res;
+
+		if (tw->tick < tick)
+			tw->tick = tick;
+	}
+
+	t->tw   = tw;
+	t->th   = th;
+	t->arg  = arg;
+	t->tick = (tmr_jiffies() + delay + tw->res - 1) / tw->res;
+
+	insert(tw, t, tw->tick + 1);
+
+	if (!tw->count++ || t->tick < tw->next)
+		schedule(tw);
+}
+
+
+/**
+ * Cancel a timer on a timer wheel
+ *
+ * @param t Timer
+ */
+void twheel_tmr_cancel(struct twheel_tmr *t)
+{
+	if (!t || !t->tw)
+		return;
+
+	list_unlink(&t->le);
+
+	/* an early wakeup is harmless, it only runs nothing */
+	if (!--t->tw->count)
+		tmr_cancel(&t->tw->tmr);
+
+	t->tw = NULL;
+}
+
+
+/**
+ * Check if a timer on a timer wheel is running
+ *
+ * @param t Timer
+ *
+ * @return True if running, False if not
+ */
+bool twheel_tmr_isrunning(const struct twheel_tmr *t)
+{
+	return t && t->tw;
+}
@@ -4,6 +4,9 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include <re.h>
 #include <baresip.h>
 #include "core.h"
@@ -16,7 +19,9 @@
 
 
 enum {
-	MAX_CALLS       =    4
+	UA_HASH_SIZE    = 1024,
+	DRAIN_RETRY     = 60,      /**< Retry-After while draining [s]   */
+	DRAIN_REPORT    = 5000,    /**< Interval of the drain report [ms] */
 };
 
 
@@ -25,9 +30,13 @@ struct ua {
 	MAGIC_DECL                   /**< Magic number for struct ua         */
 	struct ua **uap;             /**< Pointer to application's ua        */
 	struct le le;                /**< Linked list element                */
+	struct le le_cuser;          /**< Hash element, by contact username  */
+	struct le le_user;           /**< Hash element, by local username    */
+	struct le le_aor;            /**< Hash element, by AOR               */
 	struct account *acc;         /**< Account Parameters                 */
 	struct list regl;            /**< List of Register clients           */
 	struct list calls;           /**< List of active calls (struct call) */
+	uint32_t callc;              /**< Number of active calls             */
 	struct pl extensionv[8];     /**< Vector of SIP extensions           */
 	size_t    extensionc;        /**< Number of SIP extensions           */
 	char *cuser;                 /**< SIP Contact username               */
@@ -41,6 +50,22 @@ struct ua_eh {
 	struct le le;
 	ua_event_h *h;
 	void *arg;
+	uint32_t mask;                 /**< Events to deliver, 0 for all    */
+	uint32_t qmax;                 /**< Queue size, 0 for synchronous   */
+	struct list evl;               /**< Queued events (struct ua_evq)   */
+	uint32_t qlen;                 /**< Events in the queue             */
+	uint32_t qlen_max;             /**< Longest queue                   */
+	uint64_t n_ev;                 /**< Events delivered                */
+	uint64_t n_drop;               /**< Events dropped, queue was full  */
+};
+
+/** Event waiting for an asynchronous handler */
+struct ua_evq {
+	struct le le;
+	struct ua *ua;
+	struct call *call;
+	enum ua_event ev;
+	char *prm;
 };
 
 static struct {
@@ -60,9 +85,26 @@ static struct {
 	ua_exit_h *exith;              /**< UA Exit handler                 */
 	void *arg;                     /**< UA Exit handler argument        */
 	char *eprm;                    /**< Extra UA parameters             */
+	struct hash *ht_cuser;         /**< User-Agents by contact username */
+	struct hash *ht_user;          /**< User-Agents by local username   */
+	struct hash *ht_aor;           /**< User-Agents by AOR              */
+	struct hash *ht_call;          /**< Calls by Call-ID                */
+	uint32_t callc;                /**< Number of calls, all UAs        */
+	struct admit *admit;           /**< Admission of incoming calls     */
+	struct cpugov *cpugov;         /**< Codec complexity under load     */
 #ifdef USE_TLS
 	struct tls *tls;               /**< TLS Context                     */
 #endif
+	struct sa laddr4;              /**< Address of the IPv4 transports  */
+	struct sa laddr6;              /**< Address of the IPv6 transports  */
+	struct mqueue *evmq;           /**< Wakes up the event delivery     */
+	bool ev_kick;                  /**< Delivery is pending             */
+	struct tmr tmr_stop;           /**< Paces the hangups at exit       */
+	struct tmr tmr_deadline;       /**< Forced exit                     */
+	uint64_t ts_report;            /**< Last progress report [ms]       */
+	bool draining;                 /**< New calls are rejected          */
+	char *drain_uri;               /**< Calls are transferred here      */
+	struct tmr tmr_drain;          /**< Progress of the drain           */
 } uag = {
 	NULL,
 	LIST_INIT,
@@ -80,12 +122,63 @@ static struct {
 	NULL,
 	NULL,
 	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	0,
+	NULL,
 #ifdef USE_TLS
 	NULL,
 #endif
 };
 
 
+#ifdef HAVE_PTHREAD
+/*
+ * The event handlers can be registered, unregistered and called from
+ * any thread. The lock is only held to walk the list of handlers, never
+ * while a handler is called. It is recursive, so that the destructor of
+ * a handler may run while the list is walked.
+ */
+static pthread_once_t eh_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t eh_mutex;
+
+
+static void eh_lock_init(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&eh_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+
+static void eh_lock(void)
+{
+	pthread_once(&eh_once, eh_lock_init);
+	pthread_mutex_lock(&eh_mutex);
+}
+
+
+static void eh_unlock(void)
+{
+	pthread_mutex_unlock(&eh_mutex);
+}
+#else
+static void eh_lock(void)
+{
+}
+
+
+static void eh_unlock(void)
+{
+}
+#endif
+
+
 /* prototypes */
 static int  ua_call_alloc(struct call **callp, struct ua *ua,
 			  enum vidmode vidmode, const struct sip_msg *msg,
@@ -119,25 +212,251 @@ void ua_printf(const struct ua *ua, const char *fmt, ...)
 }
 
 
+/*
+ * A handler registered with a queue gets its events from the main loop,
+ * at most EV_BATCH per run, so a slow handler does not hold up the
+ * signalling that raised the event. The queued events keep a reference
+ * to the User-Agent and the call. When the queue is full the event is
+ * dropped and counted.
+ */
+
+enum {
+	EV_BATCH = 16,
+	EV_SYNC  = 16,   /**< Synchronous handlers without allocation */
+};
+
+
+static void evq_destructor(void *arg)
+{
+	struct ua_evq *evq = arg;
+
+	list_unlink(&evq->le);
+	mem_deref(evq->ua);
+	mem_deref(evq->call);
+	mem_deref(evq->prm);
+}
+
+
+static void eh_queue(struct ua_eh *eh, struct ua *ua, enum ua_event ev,
+		     struct call *call, const char *prm)
+{
+	struct ua_evq *evq;
+
+	if (eh->qlen >= eh->qmax) {
+		++eh->n_drop;
+		return;
+	}
+
+	evq = mem_zalloc(sizeof(*evq), evq_destructor);
+	if (!evq) {
+		++eh->n_drop;
+		return;
+	}
+
+	evq->ua   = mem_ref(ua);
+	evq->call = mem_ref(call);
+	evq->ev   = ev;
+
+	if (str_dup(&evq->prm, prm)) {
+		mem_deref(evq);
+		++eh->n_drop;
+		return;
+	}
+
+	list_append(&eh->evl, &evq->le, evq);
+	eh->qlen_max = max(eh->qlen_max, ++eh->qlen);
+
+	if (!uag.ev_kick) {
+		uag.ev_kick = true;
+		(void)mqueue_push(uag.evmq, 0, NULL);
+	}
+}
+
+
+/*
+ * Deliver a batch of the queued events of a handler. The lock is only
+ * held to take an event from the queue, so the threads raising events
+ * do not wait for the handler.
+ */
+static bool eh_deliver(struct ua_eh *eh)
+{
+	unsigned n = 0;
+
+	while (eh->h && eh->qlen && n++ < EV_BATCH) {
+
+		struct ua_evq *evq = list_ledata(list_head(&eh->evl));
+		ua_event_h *h = eh->h;
+
+		list_unlink(&evq->le);
+		--eh->qlen;
+		++eh->n_ev;
+
+		eh_unlock();
+
+		h(evq->ua, evq->ev, evq->call, evq->prm, eh->arg);
+		mem_deref(evq);
+
+		eh_lock();
+	}
+
+	return eh->qlen != 0;
+}
+
+
+static void ev_mqueue_handler(int id, void *data, void *arg)
+{
+	struct le *le;
+	bool more = false;
+	(void)id;
+	(void)data;
+	(void)arg;
+
+	eh_lock();
+
+	uag.ev_kick = false;
+
+	le = uag.ehl.head;
+	while (le) {
+		struct ua_eh *eh = mem_ref(le->data);
+
+		more |= eh_deliver(eh);
+
+		/* the list may have changed while the lock was released */
+		le = eh->le.list ? eh->le.next : uag.ehl.head;
+
+		mem_deref(eh);
+	}
+
+	if (more && !uag.ev_kick) {
+		uag.ev_kick = true;
+		(void)mqueue_push(uag.evmq, 0, NULL);
+	}
+
+	eh_unlock();
+}
+
+
+static int ev_debug(struct re_printf *pf)
+{
+	struct le *le;
+	unsigned i = 0;
+	int err = 0;
+
+	eh_lock();
+
+	for (le = uag.ehl.head; le && !err; le = le->next, ++i) {
+
+		const struct ua_eh *eh = le->data;
+
+		if (!eh->qmax)
+			continue;
+
+		err = re_hprintf(pf, "event handler %u: queued %u/%u"
+				 " (max %u), delivered %llu, dropped %llu\n",
+				 i, eh->qlen, eh->qmax, eh->qlen_max,
+				 eh->n_ev, eh->n_drop);
+	}
+
+	eh_unlock();
+
+	return err;
+}
+
+
 void ua_event(struct ua *ua, enum ua_event ev, struct call *call,
 	      const char *fmt, ...)
 {
+	struct ua_eh *ehv_stack[EV_SYNC], **ehv = ehv_stack;
 	struct le *le;
 	char buf[256];
+	size_t i, n = 0;
 	va_list ap;
 
 	va_start(ap, fmt);
 	(void)re_vsnprintf(buf, sizeof(buf), fmt, ap);
 	va_end(ap);
 
-	/* send event to all clients */
-	le = uag.ehl.head;
-	while (le) {
+	/* queue the event, or take a reference to the handler */
+	eh_lock();
+
+	if (list_count(&uag.ehl) > EV_SYNC) {
+		ehv = mem_alloc(list_count(&uag.ehl) * sizeof(*ehv), NULL);
+		if (!ehv) {
+			eh_unlock();
+			return;
+		}
+	}
+
+	for (le = uag.ehl.head; le; le = le->next) {
+
 		struct ua_eh *eh = le->data;
-		le = le->next;
 
-		eh->h(ua, ev, call, buf, eh->arg);
+		if (eh->mask && !(eh->mask & (1u << ev)))
+			continue;
+
+		if (eh->qmax && uag.evmq)
+			eh_queue(eh, ua, ev, call, buf);
+		else
+			ehv[n++] = mem_ref(eh);
+	}
+
+	eh_unlock();
+
+	/* call the other handlers in the thread of the caller, without
+	   the lock. A handler may unregister handlers or raise events. */
+	for (i=0; i<n; i++) {
+
+		ua_event_h *h;
+
+		eh_lock();
+		h = ehv[i]->h;
+		eh_unlock();
+
+		if (h)
+			h(ua, ev, call, buf, ehv[i]->arg);
+
+		eh_lock();
+		mem_deref(ehv[i]);
+		eh_unlock();
+	}
+
+	if (ehv != ehv_stack)
+		mem_deref(ehv);
+}
+
+
+/*
+ * The Register clients are allocated by the first REGISTER, so that
+ * accounts that never register do not have them
+ */
+static int reg_alloc(struct ua *ua)
+{
+	struct account *acc = ua->acc;
+	size_t i;
+	int err = 0;
+
+	if (!list_isempty(&ua->regl))
+		return 0;
+
+	if (0 == str_casecmp(acc->sipnat, "outbound")) {
+
+		for (i=0; i<ARRAY_SIZE(acc->outbound); i++) {
+
+			if (acc->outbound[i] && acc->regint) {
+				err = reg_add(&ua->regl, ua, (int)i+1);
+				if (err)
+					break;
+			}
+		}
+	}
+	else if (acc->regint) {
+		err = reg_add(&ua->regl, ua, 0);
 	}
+
+	if (err)
+		list_flush(&ua->regl);
+
+	return err;
 }
 
 
@@ -188,6 +507,10 @@ int ua_register(struct ua *ua)
 			return ENOMEM;
 	}
 
+	err = reg_alloc(ua);
+	if (err)
+		return err;
+
 	ua_event(ua, UA_EVENT_REGISTERING, NULL, NULL);
 
 	for (le = ua->regl.head, i=0; le; le = le->next, i++) {
@@ -292,6 +615,8 @@ static void call_event_handler(struct call *call, enum call_event ev,
 
 	peeruri = call_peeruri(call);
 
+	log_set_context(call_id(call), ua_aor(ua));
+
 	switch (ev) {
 
 	case CALL_EVENT_INCOMING:
@@ -334,6 +659,10 @@ static void call_event_handler(struct call *call, enum call_event ev,
 	case CALL_EVENT_ESTABLISHED:
 		ua_printf(ua, "Call established: %s\n", peeruri);
 		ua_event(ua, UA_EVENT_CALL_ESTABLISHED, call, peeruri);
+
+		/* a call set up while draining is handed over as well */
+		if (uag.drain_uri)
+			(void)call_transfer(call, uag.drain_uri);
 		break;
 
 	case CALL_EVENT_CLOSED:
@@ -377,7 +706,13 @@ static void call_event_handler(struct call *call, enum call_event ev,
 	case CALL_EVENT_TRANSFER_FAILED:
 		ua_event(ua, UA_EVENT_CALL_TRANSFER_FAILED, call, str);
 		break;
+
+	case CALL_EVENT_QUALITY:
+		ua_event(ua, UA_EVENT_CALL_QUALITY, call, str);
+		break;
 	}
+
+	log_set_context(NULL, NULL);
 }
 
 
@@ -427,7 +762,7 @@ static int ua_call_alloc(struct call **callp, struct ua *ua,
 	cprm.vidmode = vidmode;
 	cprm.af      = af;
 
-	err = call_alloc(callp, conf_config(), &ua->calls,
+	err = call_alloc(callp, conf_config(), &ua->calls, uag.ht_call,
 			 ua->acc->dispname,
 			 local_uri ? local_uri : ua->acc->aor,
 			 ua->acc, ua, &cprm,
@@ -441,6 +776,51 @@ static int ua_call_alloc(struct call **callp, struct ua *ua,
 }
 
 
+/**
+ * Called by a call when it is linked to the UA
+ *
+ * @param ua User-Agent
+ */
+void ua_call_opened(struct ua *ua)
+{
+	if (!ua)
+		return;
+
+	++ua->callc;
+	++uag.callc;
+}
+
+
+/**
+ * Called by a call that was linked to the UA, when it is detached
+ *
+ * @param ua User-Agent
+ */
+void ua_call_closed(struct ua *ua)
+{
+	if (!ua)
+		return;
+
+	--ua->callc;
+	--uag.callc;
+}
+
+
+/* Detach and release all calls, they may have other references */
+static void calls_flush(struct ua *ua)
+{
+	struct le *le;
+
+	while ((le = list_head(&ua->calls))) {
+
+		struct call *call = le->data;
+
+		call_detach(call);
+		mem_deref(call);
+	}
+}
+
+
 static void handle_options(struct ua *ua, const struct sip_msg *msg)
 {
 	struct sip_contact contact;
@@ -498,11 +878,14 @@ static void ua_destructor(void *arg)
 	}
 
 	list_unlink(&ua->le);
+	hash_unlink(&ua->le_cuser);
+	hash_unlink(&ua->le_user);
+	hash_unlink(&ua->le_aor);
 
 	if (!list_isempty(&ua->regl))
 		ua_event(ua, UA_EVENT_UNREGISTERING, NULL, NULL);
 
-	list_flush(&ua->calls);
+	calls_flush(ua);
 	list_flush(&ua->regl);
 	mem_deref(ua->cuser);
 	mem_deref(ua->pub_gruu);
@@ -517,24 +900,67 @@ static void ua_destructor(void *arg)
 static bool request_handler(const struct sip_msg *msg, void *arg)
 {
 	struct ua *ua;
+	uint64_t ts;
 
 	(void)arg;
 
 	if (pl_strcmp(&msg->met, "OPTIONS"))
 		return false;
 
+	/* takes the node out of the rotation of a load balancer */
+	if (uag.draining) {
+		(void)sip_treply(NULL, uag_sip(), msg, 503,
+				 "Service Unavailable");
+		return true;
+	}
+
 	ua = uag_find(&msg->uri.user);
 	if (!ua) {
 		(void)sip_treply(NULL, uag_sip(), msg, 404, "Not Found");
 		return true;
 	}
 
+	ts = lagmon_begin();
 	handle_options(ua, msg);
+	lagmon_end("SIP OPTIONS", ts);
 
 	return true;
 }
 
 
+static void uag_hash_close(void)
+{
+	/* unlink the entries, in case a UA outlives the UA stack */
+	hash_clear(uag.ht_cuser);
+	hash_clear(uag.ht_user);
+	hash_clear(uag.ht_aor);
+	hash_clear(uag.ht_call);
+
+	uag.ht_cuser = mem_deref(uag.ht_cuser);
+	uag.ht_user  = mem_deref(uag.ht_user);
+	uag.ht_aor   = mem_deref(uag.ht_aor);
+	uag.ht_call  = mem_deref(uag.ht_call);
+}
+
+
+static int uag_hash_init(void)
+{
+	int err;
+
+	if (uag.ht_cuser)
+		return 0;
+
+	err  = hash_alloc(&uag.ht_cuser, UA_HASH_SIZE);
+	err |= hash_alloc(&uag.ht_user, UA_HASH_SIZE);
+	err |= hash_alloc(&uag.ht_aor, UA_HASH_SIZE);
+	err |= hash_alloc(&uag.ht_call, UA_HASH_SIZE);
+	if (err)
+		uag_hash_close();
+
+	return err;
+}
+
+
 static void add_extension(struct ua *ua, const char *extension)
 {
 	struct pl e;
@@ -567,6 +993,10 @@ int ua_alloc(struct ua **uap, const char *aor)
 	if (!aor)
 		return EINVAL;
 
+	err = uag_hash_init();
+	if (err)
+		return err;
+
 	ua = mem_zalloc(sizeof(*ua), ua_destructor);
 	if (!ua)
 		return ENOMEM;
@@ -616,14 +1046,12 @@ int ua_alloc(struct ua **uap, const char *aor)
 			  ua->acc->menc->id);
 	}
 
-	/* Register clients */
+	/* the Register clients are allocated by ua_register() */
 	if (uag.cfg && str_isset(uag.cfg->uuid))
 	        add_extension(ua, "gruu");
 
 	if (0 == str_casecmp(ua->acc->sipnat, "outbound")) {
 
-		size_t i;
-
 		add_extension(ua, "path");
 		add_extension(ua, "outbound");
 
@@ -633,23 +1061,15 @@ int ua_alloc(struct ua **uap, const char *aor)
 			err = ENOSYS;
 			goto out;
 		}
-
-		for (i=0; i<ARRAY_SIZE(ua->acc->outbound); i++) {
-
-			if (ua->acc->outbound[i] && ua->acc->regint) {
-				err = reg_add(&ua->regl, ua, (int)i+1);
-				if (err)
-					break;
-			}
-		}
-	}
-	else if (ua->acc->regint) {
-		err = reg_add(&ua->regl, ua, 0);
 	}
-	if (err)
-		goto out;
 
 	list_append(&uag.ual, &ua->le, ua);
+	hash_append(uag.ht_cuser, hash_joaat_str_ci(ua->cuser),
+		    &ua->le_cuser, ua);
+	hash_append(uag.ht_user, hash_joaat_pl_ci(&ua->acc->luri.user),
+		    &ua->le_user, ua);
+	hash_append(uag.ht_aor, hash_joaat_str(ua->acc->aor),
+		    &ua->le_aor, ua);
 
 	if (ua->acc->regint) {
 		err = ua_register(ua);
@@ -1007,46 +1427,71 @@ const char *ua_outbound(const struct ua *ua)
  */
 struct call *ua_call(const struct ua *ua)
 {
-	struct le *le;
-
 	if (!ua)
 		return NULL;
 
-	for (le = ua->calls.tail; le; le = le->prev) {
+	/* todo: check if call is on-hold */
 
-		struct call *call = le->data;
+	return list_ledata(list_tail(&ua->calls));
+}
 
-		/* todo: check if call is on-hold */
 
-		return call;
-	}
+struct call_key {
+	const struct ua *ua;
+	const char *id;
+};
 
-	return NULL;
+
+static bool call_id_cmp_handler(struct le *le, void *arg)
+{
+	const struct call_key *key = arg;
+	const struct call *call = le->data;
+
+	return call_get_ua(call) == key->ua &&
+		0 == str_cmp(call_id(call), key->id);
 }
 
 
-struct call *ua_prev_call(const struct ua *ua)
+/**
+ * Find a call of a User-Agent (UA) from its SIP Call-ID
+ *
+ * @param ua User-Agent
+ * @param id SIP Call-ID
+ *
+ * @return Call if found, otherwise NULL
+ */
+struct call *ua_find_call(const struct ua *ua, const char *id)
 {
+	struct call_key key;
 	struct le *le;
-	int prev = 0;
 
-	if (!ua)
+	if (!ua || !id)
 		return NULL;
 
-	for (le = ua->calls.tail; le; le = le->prev) {
-		if ( prev == 1) {
-			struct call *call = le->data;
-			return call;
-		}
-		if ( prev == 0)
-			prev = 1;
-	}
+	key.ua = ua;
+	key.id = id;
 
-	return NULL;
+	le = hash_lookup(uag.ht_call, hash_joaat_str(id),
+			 call_id_cmp_handler, &key);
+
+	return le ? le->data : NULL;
 }
 
 
-int ua_debug(struct re_printf *pf, const struct ua *ua)
+struct call *ua_prev_call(const struct ua *ua)
+{
+	struct le *le;
+
+	if (!ua)
+		return NULL;
+
+	le = list_tail(&ua->calls);
+
+	return le ? list_ledata(le->prev) : NULL;
+}
+
+
+int ua_debug(struct re_printf *pf, const struct ua *ua)
 {
 	struct le *le;
 	int err;
@@ -1073,9 +1518,44 @@ int ua_debug(struct re_printf *pf, const struct ua *ua)
 /* One instance */
 
 
-static int add_transp_af(const struct sa *laddr)
+/* The port of a transport, or a port to keep if it was not configured */
+static const struct sa *transp_local(struct sa *sa, const struct sa *local,
+				     const uint16_t *portv,
+				     enum sip_transp tp)
+{
+	if (!portv || !portv[tp] || sa_port(local))
+		return local;
+
+	sa_cpy(sa, local);
+	sa_set_port(sa, portv[tp]);
+
+	return sa;
+}
+
+
+/* Get the ports of the transports of an address */
+static void transp_ports(uint16_t portv[SIP_TRANSPC], const struct sa *laddr)
+{
+	int tp;
+
+	for (tp=0; tp<SIP_TRANSPC; tp++) {
+		struct sa sa;
+
+		portv[tp] = 0;
+
+		if (!sa_isset(laddr, SA_ADDR))
+			continue;
+
+		if (0 == sip_transp_laddr(uag.sip, &sa, tp, laddr) &&
+		    sa_cmp(&sa, laddr, SA_ADDR))
+			portv[tp] = sa_port(&sa);
+	}
+}
+
+
+static int add_transp_af(const struct sa *laddr, const uint16_t *portv)
 {
-	struct sa local;
+	struct sa local, sa;
 	int err = 0;
 
 	if (str_isset(uag.cfg->local)) {
@@ -1105,9 +1585,13 @@ static int add_transp_af(const struct sa *laddr)
 	}
 
 	if (uag.use_udp)
-		err |= sip_transp_add(uag.sip, SIP_TRANSP_UDP, &local);
+		err |= sip_transp_add(uag.sip, SIP_TRANSP_UDP,
+				      transp_local(&sa, &local, portv,
+						   SIP_TRANSP_UDP));
 	if (uag.use_tcp)
-		err |= sip_transp_add(uag.sip, SIP_TRANSP_TCP, &local);
+		err |= sip_transp_add(uag.sip, SIP_TRANSP_TCP,
+				      transp_local(&sa, &local, portv,
+						   SIP_TRANSP_TCP));
 	if (err) {
 		warning("ua: SIP Transport failed: %m\n", err);
 		return err;
@@ -1135,7 +1619,10 @@ static int add_transp_af(const struct sa *laddr)
 		if (sa_isset(&local, SA_PORT))
 			sa_set_port(&local, sa_port(&local) + 1);
 
-		err = sip_transp_add(uag.sip, SIP_TRANSP_TLS, &local, uag.tls);
+		err = sip_transp_add(uag.sip, SIP_TRANSP_TLS,
+				     transp_local(&sa, &local, portv,
+						  SIP_TRANSP_TLS),
+				     uag.tls);
 		if (err) {
 			warning("ua: SIP/TLS transport failed: %m\n", err);
 			return err;
@@ -1147,18 +1634,32 @@ static int add_transp_af(const struct sa *laddr)
 }
 
 
-static int ua_add_transp(struct network *net)
+/*
+ * Add the transports of the local addresses. The ports of portv4 and
+ * portv6 are used for the transports without a configured port.
+ */
+static int ua_add_transp(struct network *net, const uint16_t *portv4,
+			 const uint16_t *portv6)
 {
 	int err = 0;
 
+	sa_init(&uag.laddr4, AF_UNSPEC);
+	sa_init(&uag.laddr6, AF_UNSPEC);
+
 	if (!uag.prefer_ipv6) {
-		if (sa_isset(net_laddr_af(net, AF_INET), SA_ADDR))
-			err |= add_transp_af(net_laddr_af(net, AF_INET));
+		if (sa_isset(net_laddr_af(net, AF_INET), SA_ADDR)) {
+			sa_cpy(&uag.laddr4, net_laddr_af(net, AF_INET));
+			err |= add_transp_af(&uag.laddr4, portv4);
+		}
 	}
 
 #if HAVE_INET6
-	if (sa_isset(net_laddr_af(net, AF_INET6), SA_ADDR))
-		err |= add_transp_af(net_laddr_af(net, AF_INET6));
+	if (sa_isset(net_laddr_af(net, AF_INET6), SA_ADDR)) {
+		sa_cpy(&uag.laddr6, net_laddr_af(net, AF_INET6));
+		err |= add_transp_af(&uag.laddr6, portv6);
+	}
+#else
+	(void)portv6;
 #endif
 
 	return err;
@@ -1185,17 +1686,66 @@ static bool require_handler(const struct sip_hdr *hdr,
 }
 
 
+/* Number of calls being set up, in all UAs */
+static uint32_t setups_count(void)
+{
+	struct le *le, *lec;
+	uint32_t n = 0;
+
+	for (le = list_head(&uag.ual); le; le = le->next) {
+
+		struct ua *ua = le->data;
+
+		for (lec = list_head(&ua->calls); lec; lec = lec->next)
+			n += call_is_setup(lec->data);
+	}
+
+	return n;
+}
+
+
 /* Handle incoming calls */
 static void sipsess_conn_handler(const struct sip_msg *msg, void *arg)
 {
+	const struct config *cfg = conf_config();
 	const struct sip_hdr *hdr;
 	struct ua *ua;
 	struct call *call = NULL;
 	char to_uri[256];
+	uint32_t max_calls, retry = 0;
+	uint64_t ts;
 	int err;
 
 	(void)arg;
 
+	PROBE4(sip_conn, msg->callid.p, msg->callid.l,
+	       msg->from.auri.p, msg->from.auri.l);
+
+	if (uag.draining) {
+		debug("ua: rejected call from %r (draining)\n",
+		      &msg->from.auri);
+		(void)sip_treplyf(NULL, NULL, uag.sip, msg, false,
+				  503, "Service Unavailable",
+				  "Retry-After: %u\r\n"
+				  "Content-Length: 0\r\n\r\n",
+				  DRAIN_RETRY);
+		return;
+	}
+
+	/* nothing is allocated for a call that is turned away, and the
+	   calls are only counted if their number is limited */
+	if (admit_check(uag.admit,
+			cfg->call.max_setups ? setups_count() : 0, &retry)) {
+		debug("ua: rejected call from %r (overload, retry in %us)\n",
+		      &msg->from.auri, retry);
+		(void)sip_treplyf(NULL, NULL, uag.sip, msg, false,
+				  503, "Service Unavailable",
+				  "Retry-After: %u\r\n"
+				  "Content-Length: 0\r\n\r\n",
+				  retry);
+		return;
+	}
+
 	ua = uag_find(&msg->uri.user);
 	if (!ua) {
 		warning("ua: %r: UA not found: %r\n",
@@ -1205,9 +1755,20 @@ static void sipsess_conn_handler(const struct sip_msg *msg, void *arg)
 	}
 
 	/* handle multiple calls */
-	if (list_count(&ua->calls) + 1 > MAX_CALLS) {
-		info("ua: rejected call from %r (maximum %d calls)\n",
-		     &msg->from.auri, MAX_CALLS);
+	max_calls = ua->acc->max_calls ? ua->acc->max_calls
+		: cfg->call.max_calls;
+
+	if (max_calls && ua->callc >= max_calls) {
+		info("ua: rejected call from %r (maximum %u calls)\n",
+		     &msg->from.auri, max_calls);
+		(void)sip_treply(NULL, uag.sip, msg, 486, "Max Calls");
+		return;
+	}
+
+	if (cfg->call.max_calls_total &&
+	    uag.callc >= cfg->call.max_calls_total) {
+		info("ua: rejected call from %r (maximum %u calls in total)\n",
+		     &msg->from.auri, cfg->call.max_calls_total);
 		(void)sip_treply(NULL, uag.sip, msg, 486, "Max Calls");
 		return;
 	}
@@ -1230,6 +1791,8 @@ static void sipsess_conn_handler(const struct sip_msg *msg, void *arg)
 
 	(void)pl_strcpy(&msg->to.auri, to_uri, sizeof(to_uri));
 
+	ts = lagmon_begin();
+
 	err = ua_call_alloc(&call, ua, VIDMODE_ON, msg, NULL, to_uri);
 	if (err) {
 		warning("ua: call_alloc: %m\n", err);
@@ -1237,6 +1800,7 @@ static void sipsess_conn_handler(const struct sip_msg *msg, void *arg)
 	}
 
 	err = call_accept(call, uag.sock, msg);
+	lagmon_end("SIP INVITE", ts);
 	if (err)
 		goto error;
 
@@ -1248,14 +1812,219 @@ static void sipsess_conn_handler(const struct sip_msg *msg, void *arg)
 }
 
 
+static bool laddr_changed(const struct sa *laddr, const struct sa *cur)
+{
+	if (!sa_isset(laddr, SA_ADDR) && !sa_isset(cur, SA_ADDR))
+		return false;
+
+	return !sa_cmp(laddr, cur, SA_ADDR);
+}
+
+
+static bool ua_rebind_needed(const struct ua *ua, bool v4, bool v6)
+{
+	struct le *le;
+
+	for (le = ua->regl.head; le; le = le->next) {
+
+		if (reg_rebind_needed(le->data, v4, v6))
+			return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * Create the SIP transports again after the address of one family
+ * changed. The transports of the other family keep their ports, so
+ * that their UDP registrations and calls stay as they are. Only the
+ * User-Agents and calls of the changed family, and the registrations
+ * over TCP and TLS, are updated.
+ */
+static int uag_rebind(bool v4, bool v6)
+{
+	struct network *net = baresip_network();
+	uint16_t portv4[SIP_TRANSPC], portv6[SIP_TRANSPC];
+	uint32_t n_reg = 0, n_call = 0;
+	struct le *le;
+	int err;
+
+	transp_ports(portv4, v4 ? NULL : &uag.laddr4);
+	transp_ports(portv6, v6 ? NULL : &uag.laddr6);
+
+	/* the SIP stack can only remove all transports */
+	sip_transp_flush(uag.sip);
+
+	err = ua_add_transp(net, portv4, portv6);
+	if (err)
+		return err;
+
+	for (le = uag.ual.head; le; le = le->next) {
+		struct ua *ua = le->data;
+		struct le *lec;
+
+		if (ua->acc->regint && ua_rebind_needed(ua, v4, v6)) {
+			err |= ua_register(ua);
+			++n_reg;
+		}
+
+		for (lec = ua->calls.head; lec; lec = lec->next) {
+			struct call *call = lec->data;
+			int af = call_af(call);
+
+			if ((af == AF_INET && v4) || (af == AF_INET6 && v6)) {
+				err |= call_reset_transp(call);
+				++n_call;
+			}
+		}
+	}
+
+	info("ua: transports updated (%s%s), %u registrations and"
+	     " %u calls\n", v4 ? "IPv4 " : "", v6 ? "IPv6" : "",
+	     n_reg, n_call);
+
+	return err;
+}
+
+
 static void net_change_handler(void *arg)
 {
+	struct network *net = baresip_network();
+	const struct sa *laddr4 = net_laddr_af(net, AF_INET);
+	const struct sa *laddr6 = net_laddr_af(net, AF_INET6);
+	bool v4, v6;
 	(void)arg;
 
-	info("IP-address changed: %j\n",
-	     net_laddr_af(baresip_network(), AF_INET));
+	v4 = !uag.prefer_ipv6 && laddr_changed(laddr4, &uag.laddr4);
+	v6 = false;
+#if HAVE_INET6
+	v6 = laddr_changed(laddr6, &uag.laddr6);
+#else
+	(void)laddr6;
+#endif
+
+	info("IP-address changed: %j\n", laddr4);
+
+	if (!v4 && !v6)
+		return;
 
-	(void)uag_reset_transp(true, true);
+	(void)uag_rebind(v4, v6);
+}
+
+
+/*
+ * Drain
+ *
+ * While draining, new INVITEs are rejected with 503 before anything is
+ * allocated, and OPTIONS are answered with 503, so that the load
+ * balancers stop sending new calls. The existing calls are left to
+ * finish, or they are transferred with REFER to another instance. The
+ * number of remaining calls is reported until there are none, and the
+ * instance can then be stopped without dropping calls.
+ */
+
+static void drain_tmr_handler(void *arg)
+{
+	(void)arg;
+
+	if (uag.callc == 0) {
+		info("ua: drained, no calls left\n");
+		return;
+	}
+
+	info("ua: draining: %u calls left\n", uag.callc);
+
+	tmr_start(&uag.tmr_drain, DRAIN_REPORT, drain_tmr_handler, NULL);
+}
+
+
+/**
+ * Start or stop draining. While draining, new calls are rejected and
+ * the existing calls are left to finish.
+ *
+ * @param enable True to start draining, false to accept calls again
+ * @param uri    Transfer the established calls to this URI (optional)
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uag_drain(bool enable, const char *uri)
+{
+	struct le *le;
+	uint32_t n = 0;
+	int err;
+
+	uag.drain_uri = mem_deref(uag.drain_uri);
+
+	if (!enable) {
+		if (uag.draining)
+			info("ua: draining stopped, accepting calls\n");
+
+		uag.draining = false;
+		tmr_cancel(&uag.tmr_drain);
+		return 0;
+	}
+
+	uag.draining = true;
+
+	if (str_isset(uri)) {
+
+		err = str_dup(&uag.drain_uri, uri);
+		if (err)
+			return err;
+
+		for (le = uag.ual.head; le; le = le->next) {
+
+			struct ua *ua = le->data;
+			struct le *lec;
+
+			for (lec = ua->calls.head; lec; lec = lec->next) {
+
+				struct call *call = lec->data;
+
+				if (!call_is_established(call))
+					continue;
+
+				if (!call_transfer(call, uri))
+					++n;
+			}
+		}
+	}
+
+	info("ua: draining, %u calls left%s%s (%u transferred)\n",
+	     uag.callc, uag.drain_uri ? ", transfer to " : "",
+	     uag.drain_uri ? uag.drain_uri : "", n);
+
+	drain_tmr_handler(NULL);
+
+	return 0;
+}
+
+
+/**
+ * Check if the User-Agents are draining
+ *
+ * @return True if new calls are rejected
+ */
+bool uag_draining(void)
+{
+	return uag.draining;
+}
+
+
+static int cmd_drain(struct re_printf *pf, void *arg)
+{
+	const struct cmd_arg *carg = arg;
+	int err;
+
+	if (0 == str_casecmp(carg->prm, "off"))
+		return uag_drain(false, NULL);
+
+	err = uag_drain(true, carg->prm);
+	if (err)
+		return re_hprintf(pf, "drain: %m\n", err);
+
+	return 0;
 }
 
 
@@ -1275,6 +2044,10 @@ static int cmd_quit(struct re_printf *pf, void *unused)
 
 static const struct cmd cmdv[] = {
 	{'q',       0, "Quit",                     cmd_quit             },
+	{'w',       0, "Main loop lag",            lagmon_debug         },
+	{'P',       0, "Audio codec benchmark",    aucodec_bench        },
+	{'Y', CMD_PRM, "Pipeline trace",           trace_command        },
+	{'f', CMD_PRM, "Drain calls [off|uri]",    cmd_drain            },
 };
 
 
@@ -1338,6 +2111,10 @@ int ua_init(const char *software, bool udp, bool tcp, bool tls,
 
 	list_init(&uag.ual);
 
+	err = mqueue_alloc(&uag.evmq, ev_mqueue_handler, NULL);
+	if (err)
+		goto out;
+
 	err = sip_alloc(&uag.sip, net_dnsc(net), bsize, bsize, bsize,
 			software, exit_handler, NULL);
 	if (err) {
@@ -1345,7 +2122,7 @@ int ua_init(const char *software, bool udp, bool tcp, bool tls,
 		goto out;
 	}
 
-	err = ua_add_transp(net);
+	err = ua_add_transp(net, NULL, NULL);
 	if (err)
 		goto out;
 
@@ -1353,6 +2130,15 @@ int ua_init(const char *software, bool udp, bool tcp, bool tls,
 	if (err)
 		goto out;
 
+	err = admit_alloc(&uag.admit, cfg->call.max_setups,
+			  cfg->call.max_lag, cfg->call.max_load);
+	if (err)
+		goto out;
+
+	err = cpugov_alloc(&uag.cpugov, cfg->call.degrade_load);
+	if (err)
+		goto out;
+
 	err = sipsess_listen(&uag.sock, uag.sip, bsize,
 			     sipsess_conn_handler, NULL);
 	if (err)
@@ -1383,29 +2169,144 @@ int ua_init(const char *software, bool udp, bool tcp, bool tls,
  */
 void ua_close(void)
 {
+	struct le *le;
+
 	cmd_unregister(cmdv);
 	play_close();
+	prompt_close();
+	scratch_close();
 	ui_reset();
 	contact_close();
 
+	tmr_cancel(&uag.tmr_stop);
+	tmr_cancel(&uag.tmr_deadline);
+	tmr_cancel(&uag.tmr_drain);
+	uag.drain_uri = mem_deref(uag.drain_uri);
+	uag.draining  = false;
+
+	/* the queued events hold references to the User-Agents */
+	eh_lock();
+	uag.evmq = mem_deref(uag.evmq);
+	uag.ev_kick = false;
+	for (le = uag.ehl.head; le; le = le->next) {
+		struct ua_eh *eh = le->data;
+
+		list_flush(&eh->evl);
+		eh->qlen = 0;
+	}
+	eh_unlock();
+
 	uag.evsock   = mem_deref(uag.evsock);
 	uag.sock     = mem_deref(uag.sock);
 	uag.lsnr     = mem_deref(uag.lsnr);
 	uag.sip      = mem_deref(uag.sip);
 	uag.eprm     = mem_deref(uag.eprm);
+	uag.admit    = mem_deref(uag.admit);
+	uag.cpugov   = mem_deref(uag.cpugov);
 
 #ifdef USE_TLS
 	uag.tls = mem_deref(uag.tls);
 #endif
 
 	list_flush(&uag.ual);
+
+	eh_lock();
 	list_flush(&uag.ehl);
+	eh_unlock();
+
+	uag_hash_close();
 
 	/* note: must be done before mod_close() */
 	module_app_unload();
 }
 
 
+/*
+ * Shutdown
+ *
+ * The media of all calls is stopped first, so the audio and video
+ * threads are idle before the signalling starts. Then at most
+ * `sip_stop_rate' calls per second are hung up, followed by the
+ * User-Agents and their registrations. The SIP stack keeps all the
+ * BYEs and unREGISTERs in progress at the same time. If the SIP stack
+ * has not exited after `sip_stop_timeout' seconds, the rest is closed
+ * without waiting for the responses.
+ */
+
+enum {
+	STOP_TICK   = 100,     /**< Interval of the hangups [ms]   */
+	STOP_REPORT = 1000,    /**< Interval of the progress [ms]  */
+};
+
+
+static void stop_report(bool force)
+{
+	const uint64_t now = tmr_jiffies();
+
+	if (!force && now < uag.ts_report + STOP_REPORT)
+		return;
+
+	uag.ts_report = now;
+
+	info("ua: stopping: %u calls and %u useragents left\n",
+	     uag.callc, list_count(&uag.ual));
+}
+
+
+static void stop_tmr_handler(void *arg)
+{
+	const uint32_t rate = uag.cfg->stop_rate;
+	uint32_t budget = max(rate * STOP_TICK / 1000, 1);
+	struct le *le;
+	(void)arg;
+
+	for (le = uag.ual.head; le && budget; le = le->next) {
+
+		struct ua *ua = le->data;
+
+		while (budget && !list_isempty(&ua->calls)) {
+
+			struct call *call = list_ledata(list_head(&ua->calls));
+
+			/* the call may have other references */
+			call_detach(call);
+			mem_deref(call);
+			--budget;
+		}
+	}
+
+	/* all calls are hung up, now the registrations */
+	while (budget && uag.callc == 0 && !list_isempty(&uag.ual)) {
+
+		struct ua *ua = list_ledata(list_head(&uag.ual));
+
+		budget -= min(budget, max(list_count(&ua->regl), 1));
+		list_unlink(&ua->le);
+		mem_deref(ua);
+	}
+
+	stop_report(list_isempty(&uag.ual));
+
+	if (!list_isempty(&uag.ual))
+		tmr_start(&uag.tmr_stop, STOP_TICK, stop_tmr_handler, NULL);
+}
+
+
+static void deadline_handler(void *arg)
+{
+	(void)arg;
+
+	warning("ua: not stopped after %u seconds, closing %u calls\n",
+		uag.cfg->stop_timeout, uag.callc);
+
+	tmr_cancel(&uag.tmr_stop);
+
+	sipsess_close_all(uag.sock);
+	list_flush(&uag.ual);
+	sip_close(uag.sip, true);
+}
+
+
 /**
  * Stop all User-Agents
  *
@@ -1428,7 +2329,7 @@ void ua_stop_all(bool forced)
 		if (mem_nrefs(ua) > 1) {
 
 			list_unlink(&ua->le);
-			list_flush(&ua->calls);
+			calls_flush(ua);
 			mem_deref(ua);
 
 			ext_ref = true;
@@ -1451,12 +2352,37 @@ void ua_stop_all(bool forced)
 		     n, n==1 ? "" : "s", forced ? "(Forced)" : "");
 	}
 
-	if (forced)
+	if (forced) {
+		tmr_cancel(&uag.tmr_stop);
+		tmr_cancel(&uag.tmr_deadline);
 		sipsess_close_all(uag.sock);
-	else
-		list_flush(&uag.ual);
+		sip_close(uag.sip, true);
+		return;
+	}
+
+	for (le = uag.ual.head; le; le = le->next) {
+
+		struct ua *ua = le->data;
+		struct le *lec;
 
-	sip_close(uag.sip, forced);
+		for (lec = ua->calls.head; lec; lec = lec->next)
+			call_media_stop(lec->data);
+	}
+
+	if (uag.cfg->stop_timeout && !tmr_isrunning(&uag.tmr_deadline)) {
+		tmr_start(&uag.tmr_deadline, uag.cfg->stop_timeout * 1000,
+			  deadline_handler, NULL);
+	}
+
+	if (uag.cfg->stop_rate && !list_isempty(&uag.ual)) {
+		stop_report(true);
+		stop_tmr_handler(NULL);
+		return;
+	}
+
+	list_flush(&uag.ual);
+
+	sip_close(uag.sip, false);
 }
 
 
@@ -1492,7 +2418,7 @@ int uag_reset_transp(bool reg, bool reinvite)
 	sip_transp_flush(uag.sip);
 
 	(void)net_check(net);
-	err = ua_add_transp(net);
+	err = ua_add_transp(net, NULL, NULL);
 	if (err)
 		return err;
 
@@ -1530,8 +2456,17 @@ int uag_reset_transp(bool reg, bool reinvite)
  */
 int ua_print_sip_status(struct re_printf *pf, void *unused)
 {
+	int err;
+
 	(void)unused;
-	return sip_debug(pf, uag.sip);
+
+	err  = sip_debug(pf, uag.sip);
+	err |= reg_sched_debug(pf);
+	err |= admit_debug(pf, uag.admit);
+	err |= cpugov_debug(pf, uag.cpugov);
+	err |= ev_debug(pf);
+
+	return err;
 }
 
 
@@ -1548,7 +2483,7 @@ int ua_print_calls(struct re_printf *pf, const struct ua *ua)
 	}
 
 	err |= re_hprintf(pf, "\n--- List of active calls (%u): ---\n",
-			  list_count(&ua->calls));
+			  ua->callc);
 
 	for (le = ua->calls.head; le; le = le->next) {
 
@@ -1631,6 +2566,7 @@ const char *uag_event_str(enum ua_event ev)
 	case UA_EVENT_CALL_TRANSFER_FAILED: return "TRANSFER_FAILED";
 	case UA_EVENT_CALL_DTMF_START:      return "CALL_DTMF_START";
 	case UA_EVENT_CALL_DTMF_END:        return "CALL_DTMF_END";
+	case UA_EVENT_CALL_QUALITY:         return "CALL_QUALITY";
 	default: return "?";
 	}
 }
@@ -1664,6 +2600,30 @@ int ua_sipfd(const struct ua *ua)
 }
 
 
+static bool cuser_cmp_handler(struct le *le, void *arg)
+{
+	const struct ua *ua = le->data;
+
+	return 0 == pl_strcasecmp(arg, ua->cuser);
+}
+
+
+static bool user_cmp_handler(struct le *le, void *arg)
+{
+	const struct ua *ua = le->data;
+
+	return 0 == pl_casecmp(arg, &ua->acc->luri.user);
+}
+
+
+static bool aor_cmp_handler(struct le *le, void *arg)
+{
+	const struct ua *ua = le->data;
+
+	return 0 == str_cmp(ua->acc->aor, arg);
+}
+
+
 /**
  * Find the correct UA from the contact user
  *
@@ -1675,22 +2635,19 @@ struct ua *uag_find(const struct pl *cuser)
 {
 	struct le *le;
 
-	for (le = uag.ual.head; le; le = le->next) {
-		struct ua *ua = le->data;
+	if (!cuser)
+		return NULL;
 
-		if (0 == pl_strcasecmp(cuser, ua->cuser))
-			return ua;
-	}
+	le = hash_lookup(uag.ht_cuser, hash_joaat_pl_ci(cuser),
+			 cuser_cmp_handler, (void *)cuser);
+	if (le)
+		return le->data;
 
 	/* Try also matching by AOR, for better interop */
-	for (le = uag.ual.head; le; le = le->next) {
-		struct ua *ua = le->data;
-
-		if (0 == pl_casecmp(cuser, &ua->acc->luri.user))
-			return ua;
-	}
+	le = hash_lookup(uag.ht_user, hash_joaat_pl_ci(cuser),
+			 user_cmp_handler, (void *)cuser);
 
-	return NULL;
+	return le ? le->data : NULL;
 }
 
 
@@ -1705,16 +2662,13 @@ struct ua *uag_find_aor(const char *aor)
 {
 	struct le *le;
 
-	for (le = uag.ual.head; le; le = le->next) {
-		struct ua *ua = le->data;
-
-		if (str_isset(aor) && str_cmp(ua->acc->aor, aor))
-			continue;
+	if (!str_isset(aor))
+		return list_ledata(list_head(&uag.ual));
 
-		return ua;
-	}
+	le = hash_lookup(uag.ht_aor, hash_joaat_str(aor),
+			 aor_cmp_handler, (void *)aor);
 
-	return NULL;
+	return le ? le->data : NULL;
 }
 
 
@@ -1862,26 +2816,59 @@ static void eh_destructor(void *arg)
 {
 	struct ua_eh *eh = arg;
 	list_unlink(&eh->le);
+	list_flush(&eh->evl);
 }
 
 
+/**
+ * Register a User-Agent event handler, called for every event in the
+ * thread that raised it
+ *
+ * @param h   Event handler
+ * @param arg Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
 int uag_event_register(ua_event_h *h, void *arg)
+{
+	return uag_event_subscribe(h, arg, 0, 0);
+}
+
+
+/**
+ * Register a User-Agent event handler for some events, optionally with
+ * a queue. A handler with a queue is called later from the main loop,
+ * and the events that do not fit in the queue are dropped.
+ *
+ * @param h    Event handler
+ * @param arg  Handler argument
+ * @param mask Events to deliver, bit (1 << ev) for each, or 0 for all
+ * @param qmax Size of the queue, or 0 to call the handler in the thread
+ *             that raised the event
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uag_event_subscribe(ua_event_h *h, void *arg, uint32_t mask,
+			uint32_t qmax)
 {
 	struct ua_eh *eh;
 
 	if (!h)
 		return EINVAL;
 
-	uag_event_unregister(h);
-
 	eh = mem_zalloc(sizeof(*eh), eh_destructor);
 	if (!eh)
 		return ENOMEM;
 
-	eh->h = h;
-	eh->arg = arg;
+	eh->h    = h;
+	eh->arg  = arg;
+	eh->mask = mask;
+	eh->qmax = qmax;
 
+	eh_lock();
+	uag_event_unregister(h);
 	list_append(&uag.ehl, &eh->le, eh);
+	eh_unlock();
 
 	return 0;
 }
@@ -1891,15 +2878,24 @@ void uag_event_unregister(ua_event_h *h)
 {
 	struct le *le;
 
+	eh_lock();
+
 	for (le = uag.ehl.head; le; le = le->next) {
 
 		struct ua_eh *eh = le->data;
 
 		if (eh->h == h) {
+			/* a delivery in progress may hold a reference */
+			list_unlink(&eh->le);
+			list_flush(&eh->evl);
+			eh->qlen = 0;
+			eh->h = NULL;
 			mem_deref(eh);
 			break;
 		}
 	}
+
+	eh_unlock();
 }
 
 
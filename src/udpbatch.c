@@ -0,0 +1,460 @@
+/**
+ * @file udpbatch.c  Batched sending of UDP datagrams
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#ifdef __linux__
+#define _GNU_SOURCE 1
+#endif
+#include <string.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#define HAVE_SENDMMSG 1
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103  /* linux/udp.h, Linux 4.18 */
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#endif
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The batch is a UDP helper on the lowest layer, so it sees each
+ * datagram after all other helpers (SRTP, ICE, TURN, ...) have processed
+ * it. While a batch is active the datagrams are queued instead of sent,
+ * and udpbatch_flush() sends all of them with a single sendmmsg() call.
+ *
+ * Adjacent datagrams of the same size to the same destination, such as
+ * the packets of a video frame, are sent as one message with UDP
+ * segmentation (UDP_SEGMENT), so the kernel builds one large datagram
+ * and splits it late, in the device if it can. Segmentation is turned
+ * off for the batch when the kernel or the path does not support it.
+ */
+
+#ifdef HAVE_SENDMMSG
+
+enum {
+	BATCH_MAX    = 64,     /**< Max datagrams per batch               */
+	LAYER_BATCH  = -1000,  /**< Below all other UDP helpers           */
+	GSO_SEGS_MAX = 64,     /**< Max segments per message              */
+	GSO_SEG_MIN  = 512,    /**< Smaller datagrams are not segmented   */
+	GSO_SIZE_MAX = 65000,  /**< Max size of a segmented message       */
+};
+
+struct udpbatch {
+	struct udp_sock *us;         /**< UDP socket                      */
+	struct udp_helper *uh;       /**< UDP helper for capturing        */
+	struct lock *lock;           /**< Protects the batch              */
+	struct mbuf *mb;             /**< Payload of queued datagrams     */
+	struct {
+		struct sa dst;       /**< Destination address             */
+		size_t pos;          /**< Position in mb                  */
+		size_t len;          /**< Datagram length                 */
+	} pktv[BATCH_MAX];
+	size_t pktc;                 /**< Number of queued datagrams      */
+	bool active;                 /**< Batch is collecting datagrams   */
+	bool gso;                    /**< UDP segmentation is possible    */
+};
+
+/** The messages of a batch */
+struct msgs {
+	struct mmsghdr msgv[BATCH_MAX];
+	struct iovec iov[BATCH_MAX];
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(uint16_t))];
+	} ctrlv[BATCH_MAX];          /**< UDP_SEGMENT of each message     */
+	size_t firstv[BATCH_MAX];    /**< First datagram of each message  */
+	size_t segv[BATCH_MAX];      /**< Datagrams in each message       */
+	size_t msgc;                 /**< Number of messages              */
+};
+
+
+static void destructor(void *arg)
+{
+	struct udpbatch *ub = arg;
+
+	mem_deref(ub->uh);
+	mem_deref(ub->us);
+	mem_deref(ub->mb);
+	mem_deref(ub->lock);
+}
+
+
+#ifdef UDP_SEGMENT
+/* Number of datagrams from i that can be sent as one segmented message */
+static size_t gso_run(const struct udpbatch *ub, size_t i)
+{
+	const size_t seg = ub->pktv[i].len;
+	size_t j, total = seg;
+
+	if (!ub->gso || seg < GSO_SEG_MIN)
+		return 1;
+
+	for (j=i+1; j<ub->pktc && j-i < GSO_SEGS_MAX; j++) {
+
+		const size_t len = ub->pktv[j].len;
+
+		if (len > seg || total + len > GSO_SIZE_MAX)
+			break;
+		if (ub->pktv[j].pos != ub->pktv[j-1].pos + ub->pktv[j-1].len)
+			break;
+		if (!sa_cmp(&ub->pktv[j].dst, &ub->pktv[i].dst, SA_ALL))
+			break;
+
+		total += len;
+
+		/* only the last segment can be shorter */
+		if (len < seg) {
+			++j;
+			break;
+		}
+	}
+
+	return j - i;
+}
+#endif
+
+
+/* The messages of the datagrams from start */
+static void msgs_build(struct msgs *m, const struct udpbatch *ub,
+		       size_t start)
+{
+	size_t i, j, k;
+
+	m->msgc = 0;
+
+	for (i=start; i<ub->pktc; i+=k) {
+
+		struct msghdr *hdr = &m->msgv[m->msgc].msg_hdr;
+		struct iovec *iov = &m->iov[m->msgc];
+		size_t total = 0;
+
+#ifdef UDP_SEGMENT
+		k = gso_run(ub, i);
+#else
+		k = 1;
+#endif
+
+		for (j=i; j<i+k; j++)
+			total += ub->pktv[j].len;
+
+		/* the datagrams of a run are adjacent in the buffer */
+		iov->iov_base = ub->mb->buf + ub->pktv[i].pos;
+		iov->iov_len  = total;
+
+		memset(hdr, 0, sizeof(*hdr));
+		hdr->msg_name    = (void *)&ub->pktv[i].dst.u.sa;
+		hdr->msg_namelen = ub->pktv[i].dst.len;
+		hdr->msg_iov     = iov;
+		hdr->msg_iovlen  = 1;
+
+#ifdef UDP_SEGMENT
+		if (k > 1) {
+			const uint16_t seg = (uint16_t)ub->pktv[i].len;
+			struct cmsghdr *cm;
+
+			hdr->msg_control    = m->ctrlv[m->msgc].buf;
+			hdr->msg_controllen = sizeof(m->ctrlv[m->msgc].buf);
+
+			cm = CMSG_FIRSTHDR(hdr);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type  = UDP_SEGMENT;
+			cm->cmsg_len   = CMSG_LEN(sizeof(seg));
+			memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+		}
+#endif
+
+		m->firstv[m->msgc] = i;
+		m->segv[m->msgc]   = k;
+		++m->msgc;
+	}
+}
+
+
+/*
+ * Send the messages, one sendmmsg() per run of messages with the same
+ * address family. Returns the datagram to build the messages again
+ * from, if segmentation failed, otherwise the number of datagrams.
+ */
+static size_t send_msgs(struct udpbatch *ub, struct msgs *m, int *errp)
+{
+	size_t i, j;
+
+	for (i=0; i<m->msgc; ) {
+
+		int af = sa_af(&ub->pktv[m->firstv[i]].dst);
+		int fd = udp_sock_fd(ub->us, af);
+		int n;
+
+		for (j=i+1; j<m->msgc; j++) {
+			if (sa_af(&ub->pktv[m->firstv[j]].dst) != af)
+				break;
+		}
+
+		n = sendmmsg(fd, &m->msgv[i], (unsigned)(j - i), 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			/* the path cannot segment, e.g. no checksum offload */
+			if (errno == EIO && m->segv[i] > 1) {
+				warning("udpbatch: UDP segmentation failed,"
+					" disabled\n");
+				ub->gso = false;
+				return m->firstv[i];
+			}
+
+			/* drop the rest of this run */
+			*errp = errno;
+			i = j;
+		}
+		else if (n == 0) {
+			*errp = EAGAIN;
+			i = j;
+		}
+		else {
+			i += n;
+		}
+	}
+
+	return ub->pktc;
+}
+
+
+/* must be called with the lock held */
+static int send_pending(struct udpbatch *ub)
+{
+	struct msgs m;
+	size_t start = 0;
+	int err = 0;
+
+	while (start < ub->pktc) {
+
+		msgs_build(&m, ub, start);
+
+		start = send_msgs(ub, &m, &err);
+	}
+
+	ub->pktc = 0;
+	mbuf_rewind(ub->mb);
+
+	return err;
+}
+
+
+static bool batch_send_handler(int *err, struct sa *dst, struct mbuf *mb,
+			       void *arg)
+{
+	struct udpbatch *ub = arg;
+	size_t len = mbuf_get_left(mb);
+	bool handled = false;
+
+	lock_write_get(ub->lock);
+
+	if (!ub->active)
+		goto out;
+
+	if (ub->pktc >= BATCH_MAX)
+		(void)send_pending(ub);
+
+	ub->mb->pos = ub->mb->end;
+
+	if (mbuf_write_mem(ub->mb, mbuf_buf(mb), len))
+		goto out;  /* send it directly */
+
+	ub->pktv[ub->pktc].dst = *dst;
+	ub->pktv[ub->pktc].pos = ub->mb->end - len;
+	ub->pktv[ub->pktc].len = len;
+	++ub->pktc;
+
+	*err = 0;
+	handled = true;
+
+ out:
+	lock_rel(ub->lock);
+
+	return handled;
+}
+
+
+static bool batch_recv_handler(struct sa *src, struct mbuf *mb, void *arg)
+{
+	(void)src;
+	(void)mb;
+	(void)arg;
+
+	return false;
+}
+
+
+/**
+ * Allocate a UDP batch sender for a UDP socket
+ *
+ * @param ubp Pointer to allocated UDP batch
+ * @param us  UDP socket
+ *
+ * @return 0 if success, ENOSYS if not supported, otherwise errorcode
+ */
+int udpbatch_alloc(struct udpbatch **ubp, struct udp_sock *us)
+{
+	struct udpbatch *ub;
+	int gso_off = 0;
+	int err;
+
+	if (!ubp || !us)
+		return EINVAL;
+
+	ub = mem_zalloc(sizeof(*ub), destructor);
+	if (!ub)
+		return ENOMEM;
+
+	ub->us = mem_ref(us);
+
+	err = lock_alloc(&ub->lock);
+	if (err)
+		goto out;
+
+	ub->mb = mbuf_alloc(BATCH_MAX * 1500);
+	if (!ub->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = udp_register_helper(&ub->uh, us, LAYER_BATCH,
+				  batch_send_handler, batch_recv_handler, ub);
+	if (err)
+		goto out;
+
+	/* setting a zero segment size only checks the kernel support */
+	ub->gso = 0 == udp_setsockopt(us, SOL_UDP, UDP_SEGMENT,
+				      &gso_off, sizeof(gso_off));
+
+ out:
+	if (err)
+		mem_deref(ub);
+	else
+		*ubp = ub;
+
+	return err;
+}
+
+
+/**
+ * Start collecting datagrams sent on the UDP socket
+ *
+ * @param ub UDP batch
+ */
+void udpbatch_start(struct udpbatch *ub)
+{
+	if (!ub)
+		return;
+
+	lock_write_get(ub->lock);
+	ub->active = true;
+	lock_rel(ub->lock);
+}
+
+
+/**
+ * Send all collected datagrams and stop collecting
+ *
+ * @param ub UDP batch
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udpbatch_flush(struct udpbatch *ub)
+{
+	int err = 0;
+
+	if (!ub)
+		return EINVAL;
+
+	lock_write_get(ub->lock);
+
+	ub->active = false;
+
+	if (ub->pktc)
+		err = send_pending(ub);
+
+	lock_rel(ub->lock);
+
+	return err;
+}
+
+
+/**
+ * Enable or disable UDP segmentation of the batches. It stays disabled
+ * if the kernel does not support it.
+ *
+ * @param ub     UDP batch
+ * @param enable True to enable
+ *
+ * @return True if UDP segmentation is enabled
+ */
+bool udpbatch_set_gso(struct udpbatch *ub, bool enable)
+{
+	int gso_off = 0;
+	bool gso;
+
+	if (!ub)
+		return false;
+
+	lock_write_get(ub->lock);
+
+	ub->gso = enable &&
+		0 == udp_setsockopt(ub->us, SOL_UDP, UDP_SEGMENT,
+				    &gso_off, sizeof(gso_off));
+	gso = ub->gso;
+
+	lock_rel(ub->lock);
+
+	return gso;
+}
+
+
+#else
+
+
+int udpbatch_alloc(struct udpbatch **ubp, struct udp_sock *us)
+{
+	(void)ubp;
+	(void)us;
+
+	return ENOSYS;
+}
+
+
+void udpbatch_start(struct udpbatch *ub)
+{
+	(void)ub;
+}
+
+
+int udpbatch_flush(struct udpbatch *ub)
+{
+	(void)ub;
+
+	return ENOSYS;
+}
+
+
+bool udpbatch_set_gso(struct udpbatch *ub, bool enable)
+{
+	(void)ub;
+	(void)enable;
+
+	return false;
+}
+
+
+#endif
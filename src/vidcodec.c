@@ -3,12 +3,71 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
-
+#ifdef LINUX
+#include <stdio.h>
+#include <unistd.h>
+#endif
 #include <re.h>
 #include <baresip.h>
 
 
+/*
+ * A codec with an init handler has its library initialised when the
+ * first encoder or decoder is set up, and not when its module is
+ * loaded. A box that never negotiates video then never pays for it.
+ */
+
+
+enum {
+	HASH_SIZE = 16,
+};
+
+/** Init handler that was called */
+struct vcinit {
+	struct le le;
+	vidcodec_init_h *inith;
+	int err;
+};
+
+struct find {
+	const char *name;
+	const char *variant;
+	bool enc;
+	bool dec;
+};
+
 static struct list vidcodecl;
+static struct list initl;        /**< Init handlers (struct vcinit)  */
+static struct hash *ht_name;     /**< Codecs by name, in list order */
+
+
+static void vcinit_destructor(void *arg)
+{
+	struct vcinit *vi = arg;
+
+	list_unlink(&vi->le);
+}
+
+
+/* Resident set size of the process [kB], or 0 if not known */
+static size_t rss_kb(void)
+{
+	size_t kb = 0;
+#ifdef LINUX
+	unsigned long pages = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+
+	if (1 == fscanf(f, "%*u %lu", &pages))
+		kb = pages * (size_t)sysconf(_SC_PAGESIZE) / 1024;
+
+	(void)fclose(f);
+#endif
+	return kb;
+}
 
 
 /**
@@ -21,7 +80,13 @@ void vidcodec_register(struct vidcodec *vc)
 	if (!vc)
 		return;
 
+	if (!ht_name && hash_alloc(&ht_name, HASH_SIZE)) {
+		warning("vidcodec: %s: out of memory\n", vc->name);
+		return;
+	}
+
 	list_append(&vidcodecl, &vc->le, vc);
+	hash_append(ht_name, hash_joaat_str_ci(vc->name), &vc->le_name, vc);
 
 	info("vidcodec: %s\n", vc->name);
 }
@@ -38,6 +103,47 @@ void vidcodec_unregister(struct vidcodec *vc)
 		return;
 
 	list_unlink(&vc->le);
+	hash_unlink(&vc->le_name);
+
+	if (list_isempty(&vidcodecl)) {
+		ht_name = mem_deref(ht_name);
+		list_flush(&initl);
+	}
+}
+
+
+static bool find_handler(struct le *le, void *arg)
+{
+	const struct vidcodec *vc = le->data;
+	const struct find *fd = arg;
+
+	if (fd->name && 0 != str_casecmp(fd->name, vc->name))
+		return false;
+
+	if (fd->variant && 0 != str_casecmp(fd->variant, vc->variant))
+		return false;
+
+	if (fd->enc && !vc->ench)
+		return false;
+
+	if (fd->dec && !vc->dech)
+		return false;
+
+	return true;
+}
+
+
+static const struct vidcodec *find(const struct find *fd)
+{
+	struct le *le;
+
+	if (fd->name)
+		le = hash_lookup(ht_name, hash_joaat_str_ci(fd->name),
+				 find_handler, (void *)fd);
+	else
+		le = list_apply(&vidcodecl, true, find_handler, (void *)fd);
+
+	return le ? le->data : NULL;
 }
 
 
@@ -51,22 +157,9 @@ void vidcodec_unregister(struct vidcodec *vc)
  */
 const struct vidcodec *vidcodec_find(const char *name, const char *variant)
 {
-	struct le *le;
-
-	for (le=vidcodecl.head; le; le=le->next) {
-
-		struct vidcodec *vc = le->data;
-
-		if (name && 0 != str_casecmp(name, vc->name))
-			continue;
+	struct find fd = {name, variant, false, false};
 
-		if (variant && 0 != str_casecmp(variant, vc->variant))
-			continue;
-
-		return vc;
-	}
-
-	return NULL;
+	return find(&fd);
 }
 
 
@@ -79,20 +172,9 @@ const struct vidcodec *vidcodec_find(const char *name, const char *variant)
  */
 const struct vidcodec *vidcodec_find_encoder(const char *name)
 {
-	struct le *le;
+	struct find fd = {name, NULL, true, false};
 
-	for (le=vidcodecl.head; le; le=le->next) {
-
-		struct vidcodec *vc = le->data;
-
-		if (name && 0 != str_casecmp(name, vc->name))
-			continue;
-
-		if (vc->ench)
-			return vc;
-	}
-
-	return NULL;
+	return find(&fd);
 }
 
 
@@ -105,20 +187,69 @@ const struct vidcodec *vidcodec_find_encoder(const char *name)
  */
 const struct vidcodec *vidcodec_find_decoder(const char *name)
 {
-	struct le *le;
+	struct find fd = {name, NULL, false, true};
 
-	for (le=vidcodecl.head; le; le=le->next) {
+	return find(&fd);
+}
 
-		struct vidcodec *vc = le->data;
 
-		if (name && 0 != str_casecmp(name, vc->name))
-			continue;
+static bool init_handler(struct le *le, void *arg)
+{
+	const struct vcinit *vi = le->data;
+
+	return vi->inith == arg;
+}
+
+
+/**
+ * Initialise the library of a Video Codec, if not done yet. This is
+ * called before its first encoder or decoder is allocated.
+ *
+ * @param vc Video Codec
+ *
+ * @return 0 if success, otherwise errorcode of the init handler
+ */
+int vidcodec_init(const struct vidcodec *vc)
+{
+	struct vcinit *vi;
+	uint64_t ts;
+	size_t rss;
+
+	if (!vc)
+		return EINVAL;
+
+	if (!vc->inith)
+		return 0;
+
+	vi = list_ledata(list_apply(&initl, true, init_handler,
+				    (void *)vc->inith));
+	if (vi)
+		return vi->err;
+
+	vi = mem_zalloc(sizeof(*vi), vcinit_destructor);
+	if (!vi)
+		return ENOMEM;
 
-		if (vc->dech)
-			return vc;
+	vi->inith = vc->inith;
+
+	rss = rss_kb();
+	ts  = tmr_jiffies();
+
+	vi->err = vc->inith();
+
+	if (vi->err) {
+		warning("vidcodec: %s: init failed: %m\n",
+			vc->name, vi->err);
+	}
+	else {
+		info("vidcodec: %s: initialised in %llu ms"
+		     " (RSS %zu -> %zu kB)\n", vc->name,
+		     tmr_jiffies() - ts, rss, rss_kb());
 	}
 
-	return NULL;
+	list_append(&initl, &vi->le, vi);
+
+	return vi->err;
 }
 
 
@@ -131,3 +262,50 @@ struct list *vidcodec_list(void)
 {
 	return &vidcodecl;
 }
+
+
+/**
+ * Get a packet buffer for the handler without copy from a pool of
+ * buffers owned by an encoder. A buffer is free again when only the
+ * pool holds a reference to it, i.e. when the core has sent it.
+ *
+ * @param pktv Pool of buffers, NULL entries are allocated on demand
+ * @param pktc Number of entries in the pool
+ * @param size Maximum size of the packet, without headroom or tailroom
+ *
+ * @return Buffer with pos and end at VIDENC_PRESZ, or NULL if all
+ *         buffers are still queued and the packet should be copied
+ */
+struct mbuf *videnc_pkt_get(struct mbuf **pktv, size_t pktc, size_t size)
+{
+	size_t i;
+
+	if (!pktv)
+		return NULL;
+
+	size += VIDENC_PRESZ + VIDENC_TRAILSZ;
+
+	for (i=0; i<pktc; i++) {
+
+		struct mbuf *mb = pktv[i];
+
+		if (!mb) {
+			mb = pktv[i] = mbuf_alloc(size);
+			if (!mb)
+				return NULL;
+		}
+		else if (mem_nrefs(mb) > 1) {
+			continue;
+		}
+		else if (mb->size < size && mbuf_resize(mb, size)) {
+			/* the packet size was raised */
+			return NULL;
+		}
+
+		mb->pos = mb->end = VIDENC_PRESZ;
+
+		return mem_ref(mb);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,560 @@
+/**
+ * @file src/vidcomp.c  Video display compositor
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/**
+ * \page VideoCompositor Video display compositor
+ *
+ * The pictures of all calls are laid out in one display, instead of one
+ * window per call. Each call gets a tile, which is a video display of
+ * its own for the call, and the tiles are placed in a canvas as a grid,
+ * or as one large tile of the active speaker and a row of small ones.
+ *
+ * If the display has a compose handler, the tiles are composed by the
+ * display, e.g. as one texture per tile on the GPU, and only the tiles
+ * with a new picture are uploaded. Otherwise the new picture of a tile
+ * is scaled into its area of the canvas, and the canvas is displayed.
+ *
+ * The tiles are written from the threads of the calls, and the display
+ * is drawn from the main thread, as one draw for all tiles that
+ * changed since the last one.
+ */
+
+
+enum {
+	CANVAS_W  = 1280,     /**< Width of the canvas in [pixels]  */
+	CANVAS_H  = 720,      /**< Height of the canvas in [pixels] */
+	TILE_MAX  = 16,       /**< Most tiles in one display        */
+};
+
+
+struct vidcomp {
+	struct lock *lock;          /**< Protects tilel and canvas     */
+	struct vidisp_st *disp;     /**< The display of all tiles      */
+	const struct vidisp *vd;    /**< Video display                 */
+	struct mqueue *mq;          /**< Draws from the main thread    */
+	struct list tilel;          /**< Tiles (struct vidisp_st)      */
+	struct vidframe *canvas;    /**< If composed here              */
+	struct vidsz size;          /**< Size of the canvas            */
+	enum vidcomp_layout layout;
+	unsigned focus;             /**< Tile of the active speaker    */
+	unsigned next_id;
+	bool relayout;              /**< Tiles were added or moved     */
+	bool pending;               /**< A draw is queued              */
+	bool fullscreen;
+};
+
+/* One tile of the compositor */
+struct vidisp_st {
+	const struct vidisp *vd;    /**< Inheritance (1st)             */
+	struct le le;
+	struct vidcomp *comp;
+	struct vidframe *frame;     /**< Last picture, composed by disp */
+	struct vidsz size;          /**< Size of the last picture      */
+	struct vidrect rect;        /**< Area in the canvas            */
+	char *title;
+	unsigned id;
+	bool dirty;                 /**< New picture since last draw   */
+	bool hidden;
+};
+
+
+static int  tile_update(struct vidisp_st *st, bool fullscreen, int orient,
+			const struct vidrect *window);
+static int  tile_display(struct vidisp_st *st, const char *title,
+			 const struct vidframe *frame);
+static void tile_hide(struct vidisp_st *st);
+
+static struct vidisp compd = {
+	LE_INIT, "composite", NULL, tile_update, tile_display, tile_hide,
+	NULL
+};
+
+static struct vidcomp *comp_cur;
+
+
+static void comp_destructor(void *arg)
+{
+	struct vidcomp *comp = arg;
+
+	mem_deref(comp->mq);
+	mem_deref(comp->disp);
+	mem_deref(comp->canvas);
+	mem_deref(comp->lock);
+
+	if (comp_cur == comp)
+		comp_cur = NULL;
+}
+
+
+/* The largest area in the cell with the aspect ratio of the picture */
+static void tile_fit(struct vidrect *r, const struct vidsz *sz,
+		     unsigned x, unsigned y, unsigned w, unsigned h)
+{
+	unsigned tw = w, th = h;
+
+	if (sz->w && sz->h) {
+
+		if ((uint64_t)w * sz->h > (uint64_t)h * sz->w)
+			tw = (unsigned)((uint64_t)h * sz->w / sz->h);
+		else
+			th = (unsigned)((uint64_t)w * sz->h / sz->w);
+	}
+
+	/* even, for the chroma planes */
+	r->w = max(tw & ~1u, 2);
+	r->h = max(th & ~1u, 2);
+	r->x = (x + (w - r->w) / 2) & ~1u;
+	r->y = (y + (h - r->h) / 2) & ~1u;
+}
+
+
+static void layout(struct vidcomp *comp)
+{
+	const unsigned W = comp->size.w, H = comp->size.h;
+	unsigned n = 0, cols, rows, i = 0, small = 0;
+	struct le *le;
+
+	for (le = comp->tilel.head; le; le = le->next) {
+		struct vidisp_st *st = le->data;
+
+		if (!st->hidden)
+			++n;
+	}
+
+	if (!n)
+		goto out;
+
+	cols = 1;
+	while (cols * cols < n)
+		++cols;
+	rows = (n + cols - 1) / cols;
+
+	for (le = comp->tilel.head; le; le = le->next) {
+
+		struct vidisp_st *st = le->data;
+
+		if (st->hidden)
+			continue;
+
+		if (comp->layout == VIDCOMP_SPEAKER && n > 1) {
+
+			const unsigned h = H * 3 / 4;
+
+			if (st->id == comp->focus) {
+				tile_fit(&st->rect, &st->size, 0, 0, W, h);
+			}
+			else {
+				const unsigned w = W / (n - 1);
+
+				tile_fit(&st->rect, &st->size,
+					 small * w, h, w, H - h);
+				++small;
+			}
+		}
+		else {
+			const unsigned w = W / cols, h = H / rows;
+
+			tile_fit(&st->rect, &st->size,
+				 (i % cols) * w, (i / cols) * h, w, h);
+		}
+
+		++i;
+	}
+
+ out:
+	/* pictures are redrawn into the new areas */
+	if (comp->canvas)
+		vidframe_fill(comp->canvas, 0, 0, 0);
+
+	comp->relayout = false;
+}
+
+
+static struct vidisp_st *focus_tile(const struct vidcomp *comp)
+{
+	struct le *le;
+
+	for (le = comp->tilel.head; le; le = le->next) {
+		struct vidisp_st *st = le->data;
+
+		if (st->id == comp->focus && !st->hidden)
+			return st;
+	}
+
+	return NULL;
+}
+
+
+static void draw(struct vidcomp *comp)
+{
+	struct vidisp_tile tilev[TILE_MAX];
+	const char *title = NULL;
+	size_t tilec = 0;
+	struct le *le;
+	char buf[64];
+	int err;
+
+	lock_write_get(comp->lock);
+
+	comp->pending = false;
+
+	if (comp->relayout)
+		layout(comp);
+
+	for (le = comp->tilel.head; le; le = le->next) {
+
+		struct vidisp_st *st = le->data;
+
+		if (st->hidden || tilec >= ARRAY_SIZE(tilev))
+			continue;
+
+		if (!title)
+			title = st->title;
+
+		tilev[tilec].id    = st->id;
+		tilev[tilec].rect  = &st->rect;
+		tilev[tilec].frame = st->dirty ? st->frame : NULL;
+		++tilec;
+
+		st->dirty = false;
+	}
+
+	if (tilec > 1) {
+		const struct vidisp_st *st = focus_tile(comp);
+
+		if (comp->layout == VIDCOMP_SPEAKER && st && st->title) {
+			re_snprintf(buf, sizeof(buf), "%s (%zu calls)",
+				    st->title, tilec);
+		}
+		else {
+			re_snprintf(buf, sizeof(buf), "%zu calls", tilec);
+		}
+
+		title = buf;
+	}
+
+	if (!tilec) {
+		if (comp->vd->hideh)
+			comp->vd->hideh(comp->disp);
+		err = 0;
+	}
+	else if (comp->vd->composeh) {
+		err = comp->vd->composeh(comp->disp, title, &comp->size,
+					 tilev, tilec);
+	}
+	else {
+		err = comp->vd->disph(comp->disp, title, comp->canvas);
+	}
+
+	lock_rel(comp->lock);
+
+	if (err)
+		warning("vidcomp: %s: draw failed (%m)\n",
+			comp->vd->name, err);
+}
+
+
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	struct vidcomp *comp = arg;
+	(void)id;
+	(void)data;
+
+	draw(comp);
+}
+
+
+/* Called with the compositor locked */
+static void draw_later(struct vidcomp *comp)
+{
+	if (comp->pending)
+		return;
+
+	if (0 == mqueue_push(comp->mq, 0, NULL))
+		comp->pending = true;
+}
+
+
+static int comp_alloc(struct vidcomp **compp, const struct vidisp *vd,
+		      struct vidisp_prm *prm, const char *dev,
+		      enum vidcomp_layout layout)
+{
+	struct vidcomp *comp;
+	int err;
+
+	comp = mem_zalloc(sizeof(*comp), comp_destructor);
+	if (!comp)
+		return ENOMEM;
+
+	comp->vd     = vd;
+	comp->layout = layout;
+	comp->size.w = CANVAS_W;
+	comp->size.h = CANVAS_H;
+
+	err  = lock_alloc(&comp->lock);
+	err |= mqueue_alloc(&comp->mq, mqueue_handler, comp);
+	if (err)
+		goto out;
+
+	if (!vd->composeh) {
+		err = vidframe_alloc(&comp->canvas, VID_FMT_YUV420P,
+				     &comp->size);
+		if (err)
+			goto out;
+
+		vidframe_fill(comp->canvas, 0, 0, 0);
+	}
+
+	err = vd->alloch(&comp->disp, vd, prm, dev, NULL, NULL);
+	if (err)
+		goto out;
+
+	info("vidcomp: %s, %s composed %ux%u, layout %s\n", vd->name,
+	     vd->composeh ? "display" : "canvas",
+	     comp->size.w, comp->size.h, vidcomp_layout_name(layout));
+
+ out:
+	if (err)
+		mem_deref(comp);
+	else
+		*compp = comp;
+
+	return err;
+}
+
+
+static void tile_destructor(void *arg)
+{
+	struct vidisp_st *st = arg;
+	struct vidcomp *comp = st->comp;
+
+	if (comp) {
+		lock_write_get(comp->lock);
+
+		list_unlink(&st->le);
+
+		if (comp->focus == st->id && comp->tilel.head) {
+			const struct vidisp_st *first = comp->tilel.head->data;
+
+			comp->focus = first->id;
+		}
+
+		comp->relayout = true;
+		draw_later(comp);
+
+		lock_rel(comp->lock);
+	}
+
+	mem_deref(st->frame);
+	mem_deref(st->title);
+	mem_deref(comp);
+}
+
+
+/**
+ * Allocate a tile of the shared video display of all calls
+ *
+ * The display is opened with the first tile, and closed with the last.
+ *
+ * @param stp    Pointer to allocated tile, a video display state
+ * @param name   Name of the video display
+ * @param prm    Video display parameters
+ * @param dev    Video display device
+ * @param layout Layout of the tiles, if the display is not open yet
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int vidcomp_alloc(struct vidisp_st **stp, const char *name,
+		  struct vidisp_prm *prm, const char *dev,
+		  enum vidcomp_layout layout)
+{
+	const struct vidisp *vd;
+	struct vidisp_st *st;
+	int err = 0;
+
+	if (!stp)
+		return EINVAL;
+
+	vd = vidisp_find(name);
+	if (!vd)
+		return ENOENT;
+
+	st = mem_zalloc(sizeof(*st), tile_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->vd = &compd;
+
+	/* no tile is larger than the canvas */
+	if (prm && !prm->width) {
+		prm->width  = CANVAS_W;
+		prm->height = CANVAS_H;
+	}
+
+	if (comp_cur && comp_cur->vd == vd) {
+		st->comp = mem_ref(comp_cur);
+	}
+	else {
+		err = comp_alloc(&st->comp, vd, prm, dev, layout);
+		if (err)
+			goto out;
+
+		comp_cur = st->comp;
+	}
+
+	lock_write_get(st->comp->lock);
+
+	st->id = ++st->comp->next_id;
+
+	if (!st->comp->tilel.head)
+		st->comp->focus = st->id;
+
+	list_append(&st->comp->tilel, &st->le, st);
+	st->comp->relayout = true;
+
+	lock_rel(st->comp->lock);
+
+ out:
+	if (err)
+		mem_deref(st);
+	else
+		*stp = st;
+
+	return err;
+}
+
+
+/**
+ * Make a tile the active speaker, the large tile of the speaker layout
+ *
+ * @param st Tile of the compositor, other displays are ignored
+ */
+void vidcomp_set_focus(struct vidisp_st *st)
+{
+	struct vidcomp *comp;
+
+	if (!st || st->vd != &compd)
+		return;
+
+	comp = st->comp;
+
+	lock_write_get(comp->lock);
+
+	if (comp->focus != st->id) {
+		comp->focus = st->id;
+		comp->relayout = true;
+		draw_later(comp);
+	}
+
+	lock_rel(comp->lock);
+}
+
+
+/**
+ * Get the name of a layout of the video display compositor
+ *
+ * @param layout Layout
+ *
+ * @return Name of the layout
+ */
+const char *vidcomp_layout_name(enum vidcomp_layout layout)
+{
+	switch (layout) {
+
+	case VIDCOMP_NONE:    return "none";
+	case VIDCOMP_GRID:    return "grid";
+	case VIDCOMP_SPEAKER: return "speaker";
+	default:              return "?";
+	}
+}
+
+
+static int tile_update(struct vidisp_st *st, bool fullscreen, int orient,
+		       const struct vidrect *window)
+{
+	struct vidcomp *comp = st->comp;
+	(void)window;
+
+	if (!comp->vd->updateh || fullscreen == comp->fullscreen)
+		return 0;
+
+	comp->fullscreen = fullscreen;
+
+	return comp->vd->updateh(comp->disp, fullscreen, orient, NULL);
+}
+
+
+static int tile_display(struct vidisp_st *st, const char *title,
+			const struct vidframe *frame)
+{
+	struct vidcomp *comp = st->comp;
+	int err = 0;
+
+	lock_write_get(comp->lock);
+
+	if (st->hidden || !vidsz_cmp(&st->size, &frame->size)) {
+		st->hidden = false;
+		st->size = frame->size;
+		comp->relayout = true;
+	}
+
+	if (title && str_cmp(st->title, title)) {
+		st->title = mem_deref(st->title);
+		(void)str_dup(&st->title, title);
+	}
+
+	if (comp->canvas) {
+		/* only the area of this tile is drawn again */
+		if (comp->relayout)
+			layout(comp);
+
+		if (vidconv_scale(comp->canvas, frame, &st->rect))
+			vidconv(comp->canvas, frame, &st->rect);
+	}
+	else {
+		if (st->frame && (st->frame->fmt != frame->fmt ||
+				  !vidsz_cmp(&st->frame->size,
+					     &frame->size)))
+			st->frame = mem_deref(st->frame);
+
+		if (!st->frame)
+			err = vidframe_alloc(&st->frame, frame->fmt,
+					     &frame->size);
+		if (err)
+			goto out;
+
+		vidframe_copy(st->frame, frame);
+	}
+
+	st->dirty = true;
+	draw_later(comp);
+
+ out:
+	lock_rel(comp->lock);
+
+	return err;
+}
+
+
+static void tile_hide(struct vidisp_st *st)
+{
+	struct vidcomp *comp = st->comp;
+
+	lock_write_get(comp->lock);
+
+	if (!st->hidden) {
+		st->hidden = true;
+		comp->relayout = true;
+		draw_later(comp);
+	}
+
+	lock_rel(comp->lock);
+}
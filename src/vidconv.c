@@ -0,0 +1,1680 @@
+/**
+ * @file src/vidconv.c  Accelerated video colour-space conversion
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <limits.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+#ifdef HAVE_SIMD_X86
+#include <immintrin.h>
+#endif
+#ifdef HAVE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+
+/**
+ * \page VideoConversion Accelerated video conversion
+ *
+ * Converters for the most common pixel format pairs, with SIMD versions
+ * selected at runtime by CPU feature. All versions give exactly the same
+ * output as the scalar version. Frames with other formats, odd sizes or
+ * scaling are passed on to vidconv() in librem.
+ *
+ * Supported conversions:
+ *
+ *   YUYV422 -> YUV420P
+ *   NV12    -> YUV420P
+ *   RGB32   -> YUV420P
+ *   YUV420P -> RGB32
+ *
+ * Chroma is averaged over each 2x2 block when subsampling, and
+ * YUV420P -> RGB32 uses BT.601 coefficients with 6 bits of precision.
+ *
+ * vidconv_scale() resizes YUV420P, NV12 or NV21 into a rectangle of a
+ * frame in one of these formats. Downscaling uses a box filter: each
+ * destination pixel is the rounded mean of the source pixels it covers.
+ * The source rows of a box are summed into a 16-bit accumulator row with
+ * SIMD, then the columns are summed and divided, so the cost is mostly
+ * one pass over the source. Planes scaled by exactly 2:1 or 4:1 have
+ * fast paths with the same result, which average the blocks with SIMD.
+ *
+ * Planes that grow in both directions are interpolated bilinearly, with
+ * 8 bits of weight and the pixel centres aligned. Each source row is
+ * interpolated horizontally once, and the two rows around a destination
+ * row are blended with SIMD.
+ *
+ * Sources of 4K and larger are split into horizontal bands, which are
+ * scaled by several threads with the same result.
+ *
+ * vidconv_blend() composites a pre-rendered mask onto one plane, as
+ * out = (in * mul + add) >> 8 per pixel. A mask pixel can keep, dim or
+ * replace the frame pixel, so overlays are rendered into the mask only
+ * when they change, and each frame costs one multiply-add pass.
+ */
+
+
+/* Convert two rows of YUYV422 to two Y rows and one U and V row */
+typedef void (yuyv_row_h)(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+			  const uint8_t *s0, const uint8_t *s1, unsigned w);
+
+/* Split one row of interleaved UV into planar U and V */
+typedef void (uv_row_h)(uint8_t *u, uint8_t *v, const uint8_t *uv,
+			unsigned n);
+
+/* Convert two rows of RGB32 to two Y rows and one U and V row */
+typedef void (rgb32_row_h)(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+			   const uint8_t *s0, const uint8_t *s1,
+			   unsigned w);
+
+/* Convert one row of YUV420P (and its chroma row) to RGB32 */
+typedef void (torgb_row_h)(uint8_t *d, const uint8_t *y, const uint8_t *u,
+			   const uint8_t *v, unsigned w);
+
+/* Add one row of 8-bit samples to a row of 16-bit sums */
+typedef void (acc_row_h)(uint16_t *acc, const uint8_t *s, unsigned w);
+
+/* Average the 2x2 blocks of two rows into one row of w pixels */
+typedef void (half_row_h)(uint8_t *d, const uint8_t *s0, const uint8_t *s1,
+			  unsigned w);
+
+/* Average each 4 columns of a row of 4-row sums into one row of w pixels */
+typedef void (quad_row_h)(uint8_t *d, const uint16_t *acc, unsigned w);
+
+/* Blend two rows as (a * (256 - f) + b * f) / 256, with 0 < f < 256 */
+typedef void (lerp_row_h)(uint8_t *d, const uint8_t *a, const uint8_t *b,
+			  unsigned f, unsigned w);
+
+/* Blend one row with a mask row */
+typedef void (blend_row_h)(uint8_t *d, const uint16_t *mul,
+			   const uint16_t *add, unsigned w);
+
+struct vidconv_ops {
+	yuyv_row_h *yuyvh;
+	uv_row_h *uvh;
+	rgb32_row_h *rgb32h;
+	torgb_row_h *torgbh;
+	acc_row_h *acch;
+	half_row_h *halfh;
+	quad_row_h *quadh;
+	lerp_row_h *lerph;
+	blend_row_h *blendh;
+};
+
+
+enum {
+	BOX_MAX = 256,   /**< Rows per box, so that the sums fit 16 bits */
+	SCALE_THREADS = 4,             /**< Bands of a large source    */
+	SCALE_MT_MIN  = 3840 * 2160,   /**< Source pixels for threads  */
+};
+
+
+static inline uint8_t avg2(uint8_t a, uint8_t b)
+{
+	return (a + b + 1) >> 1;
+}
+
+
+static inline uint8_t clip8(int v)
+{
+	if (v < 0)
+		return 0;
+	else if (v > 255)
+		return 255;
+	else
+		return v;
+}
+
+
+/*
+ * Scalar versions, also used for the tail of each row by the SIMD
+ * versions. `x' is the first pixel to convert.
+ */
+
+static void yuyv_row_c(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+		       const uint8_t *s0, const uint8_t *s1,
+		       unsigned x, unsigned w)
+{
+	for (; x < w; x += 2) {
+
+		y0[x]   = s0[2*x];
+		y0[x+1] = s0[2*x + 2];
+		y1[x]   = s1[2*x];
+		y1[x+1] = s1[2*x + 2];
+
+		u[x/2] = avg2(s0[2*x + 1], s1[2*x + 1]);
+		v[x/2] = avg2(s0[2*x + 3], s1[2*x + 3]);
+	}
+}
+
+
+static void uv_row_c(uint8_t *u, uint8_t *v, const uint8_t *uv,
+		     unsigned i, unsigned n)
+{
+	for (; i < n; i++) {
+		u[i] = uv[2*i];
+		v[i] = uv[2*i + 1];
+	}
+}
+
+
+static void rgb32_row_c(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+			const uint8_t *s0, const uint8_t *s1,
+			unsigned x, unsigned w)
+{
+	for (; x < w; x += 2) {
+
+		const uint8_t *p0 = &s0[4*x], *p1 = &s1[4*x];
+		uint8_t r, g, b;
+
+		y0[x]   = rgb2y(p0[2], p0[1], p0[0]);
+		y0[x+1] = rgb2y(p0[6], p0[5], p0[4]);
+		y1[x]   = rgb2y(p1[2], p1[1], p1[0]);
+		y1[x+1] = rgb2y(p1[6], p1[5], p1[4]);
+
+		b = (p0[0] + p0[4] + p1[0] + p1[4] + 2) >> 2;
+		g = (p0[1] + p0[5] + p1[1] + p1[5] + 2) >> 2;
+		r = (p0[2] + p0[6] + p1[2] + p1[6] + 2) >> 2;
+
+		u[x/2] = rgb2u(r, g, b);
+		v[x/2] = rgb2v(r, g, b);
+	}
+}
+
+
+static void torgb_row_c(uint8_t *d, const uint8_t *y, const uint8_t *u,
+			const uint8_t *v, unsigned x, unsigned w)
+{
+	for (; x < w; x++) {
+
+		int c = y[x] - 16;
+		int du = u[x/2] - 128;
+		int dv = v[x/2] - 128;
+
+		d[4*x + 0] = clip8((74*c + 129*du + 32) >> 6);
+		d[4*x + 1] = clip8((74*c - 25*du - 52*dv + 32) >> 6);
+		d[4*x + 2] = clip8((74*c + 102*dv + 32) >> 6);
+		d[4*x + 3] = 0xff;
+	}
+}
+
+
+static void acc_row_c(uint16_t *acc, const uint8_t *s, unsigned x,
+		      unsigned w)
+{
+	for (; x < w; x++)
+		acc[x] += s[x];
+}
+
+
+static void half_row_c(uint8_t *d, const uint8_t *s0, const uint8_t *s1,
+		       unsigned x, unsigned w)
+{
+	for (; x < w; x++)
+		d[x] = (s0[2*x] + s0[2*x + 1] +
+			s1[2*x] + s1[2*x + 1] + 2) >> 2;
+}
+
+
+static void quad_row_c(uint8_t *d, const uint16_t *acc, unsigned x,
+		       unsigned w)
+{
+	for (; x < w; x++)
+		d[x] = (acc[4*x] + acc[4*x + 1] + acc[4*x + 2] + acc[4*x + 3] +
+			8) >> 4;
+}
+
+
+static void lerp_row_c(uint8_t *d, const uint8_t *a, const uint8_t *b,
+		       unsigned f, unsigned x, unsigned w)
+{
+	for (; x < w; x++)
+		d[x] = (a[x] * (256 - f) + b[x] * f + 128) >> 8;
+}
+
+
+static void yuyv_c(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+		   const uint8_t *s0, const uint8_t *s1, unsigned w)
+{
+	yuyv_row_c(y0, y1, u, v, s0, s1, 0, w);
+}
+
+
+static void uv_c(uint8_t *u, uint8_t *v, const uint8_t *uv, unsigned n)
+{
+	uv_row_c(u, v, uv, 0, n);
+}
+
+
+static void rgb32_c(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+		    const uint8_t *s0, const uint8_t *s1, unsigned w)
+{
+	rgb32_row_c(y0, y1, u, v, s0, s1, 0, w);
+}
+
+
+static void torgb_c(uint8_t *d, const uint8_t *y, const uint8_t *u,
+		    const uint8_t *v, unsigned w)
+{
+	torgb_row_c(d, y, u, v, 0, w);
+}
+
+
+static void blend_row_c(uint8_t *d, const uint16_t *mul,
+			const uint16_t *add, unsigned x, unsigned w)
+{
+	for (; x < w; x++)
+		d[x] = (d[x] * mul[x] + add[x]) >> 8;
+}
+
+
+static void acc_c(uint16_t *acc, const uint8_t *s, unsigned w)
+{
+	acc_row_c(acc, s, 0, w);
+}
+
+
+static void half_c(uint8_t *d, const uint8_t *s0, const uint8_t *s1,
+		   unsigned w)
+{
+	half_row_c(d, s0, s1, 0, w);
+}
+
+
+static void quad_c(uint8_t *d, const uint16_t *acc, unsigned w)
+{
+	quad_row_c(d, acc, 0, w);
+}
+
+
+static void lerp_c(uint8_t *d, const uint8_t *a, const uint8_t *b,
+		   unsigned f, unsigned w)
+{
+	lerp_row_c(d, a, b, f, 0, w);
+}
+
+
+static void blend_c(uint8_t *d, const uint16_t *mul, const uint16_t *add,
+		    unsigned w)
+{
+	blend_row_c(d, mul, add, 0, w);
+}
+
+
+static const struct vidconv_ops ops_c = {
+	yuyv_c, uv_c, rgb32_c, torgb_c, acc_c, half_c, quad_c, lerp_c,
+	blend_c
+};
+
+
+#ifdef HAVE_SIMD_X86
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+
+SSE2 static void yuyv_sse2(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+			   const uint8_t *s0, const uint8_t *s1, unsigned w)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	const __m128i zero = _mm_setzero_si128();
+	unsigned x;
+
+	for (x=0; x + 16 <= w; x += 16) {
+
+		__m128i a0 = _mm_loadu_si128((const __m128i *)&s0[2*x]);
+		__m128i a1 = _mm_loadu_si128((const __m128i *)&s0[2*x + 16]);
+		__m128i b0 = _mm_loadu_si128((const __m128i *)&s1[2*x]);
+		__m128i b1 = _mm_loadu_si128((const __m128i *)&s1[2*x + 16]);
+		__m128i c0, c1, ch;
+
+		_mm_storeu_si128((__m128i *)&y0[x],
+				 _mm_packus_epi16(_mm_and_si128(a0, mask),
+						  _mm_and_si128(a1, mask)));
+		_mm_storeu_si128((__m128i *)&y1[x],
+				 _mm_packus_epi16(_mm_and_si128(b0, mask),
+						  _mm_and_si128(b1, mask)));
+
+		/* U0 V0 U1 V1 .. averaged over the two rows */
+		c0 = _mm_srli_epi16(_mm_avg_epu8(a0, b0), 8);
+		c1 = _mm_srli_epi16(_mm_avg_epu8(a1, b1), 8);
+		ch = _mm_packus_epi16(c0, c1);
+
+		_mm_storel_epi64((__m128i *)&u[x/2],
+				 _mm_packus_epi16(_mm_and_si128(ch, mask),
+						  zero));
+		_mm_storel_epi64((__m128i *)&v[x/2],
+				 _mm_packus_epi16(_mm_srli_epi16(ch, 8),
+						  zero));
+	}
+
+	yuyv_row_c(y0, y1, u, v, s0, s1, x, w);
+}
+
+
+SSE2 static void uv_sse2(uint8_t *u, uint8_t *v, const uint8_t *uv,
+			 unsigned n)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	unsigned i;
+
+	for (i=0; i + 16 <= n; i += 16) {
+
+		__m128i a = _mm_loadu_si128((const __m128i *)&uv[2*i]);
+		__m128i b = _mm_loadu_si128((const __m128i *)&uv[2*i + 16]);
+
+		_mm_storeu_si128((__m128i *)&u[i],
+				 _mm_packus_epi16(_mm_and_si128(a, mask),
+						  _mm_and_si128(b, mask)));
+		_mm_storeu_si128((__m128i *)&v[i],
+				 _mm_packus_epi16(_mm_srli_epi16(a, 8),
+						  _mm_srli_epi16(b, 8)));
+	}
+
+	uv_row_c(u, v, uv, i, n);
+}
+
+
+/* Split 8 RGB32 pixels into 16-bit B, G and R */
+SSE2 static inline void rgb32_load_sse2(__m128i *b, __m128i *g, __m128i *r,
+					const uint8_t *p)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	__m128i lo = _mm_loadu_si128((const __m128i *)&p[0]);
+	__m128i hi = _mm_loadu_si128((const __m128i *)&p[16]);
+
+	*b = _mm_packs_epi32(_mm_and_si128(lo, mask),
+			     _mm_and_si128(hi, mask));
+	*g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), mask),
+			     _mm_and_si128(_mm_srli_epi32(hi, 8), mask));
+	*r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), mask),
+			     _mm_and_si128(_mm_srli_epi32(hi, 16), mask));
+}
+
+
+/* Y for 8 pixels, fits in unsigned 16-bit */
+SSE2 static inline __m128i rgb2y_sse2(__m128i b, __m128i g, __m128i r)
+{
+	__m128i y;
+
+	y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+			  _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+	y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+	y = _mm_add_epi16(y, _mm_set1_epi16(128));
+
+	return _mm_add_epi16(_mm_srli_epi16(y, 8), _mm_set1_epi16(16));
+}
+
+
+/* Average of horizontal pairs over two rows, 4 values in 16-bit */
+SSE2 static inline __m128i avg4_sse2(__m128i a, __m128i b)
+{
+	const __m128i one = _mm_set1_epi16(1);
+	__m128i s;
+
+	s = _mm_add_epi32(_mm_madd_epi16(a, one), _mm_madd_epi16(b, one));
+	s = _mm_srai_epi32(_mm_add_epi32(s, _mm_set1_epi32(2)), 2);
+
+	return _mm_packs_epi32(s, s);
+}
+
+
+SSE2 static inline __m128i rgb2c_sse2(__m128i b, __m128i g, __m128i r,
+				      short cr, short cg, short cb)
+{
+	__m128i c;
+
+	c = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(cr)),
+			  _mm_mullo_epi16(g, _mm_set1_epi16(cg)));
+	c = _mm_add_epi16(c, _mm_mullo_epi16(b, _mm_set1_epi16(cb)));
+	c = _mm_add_epi16(c, _mm_set1_epi16(128));
+
+	return _mm_add_epi16(_mm_srai_epi16(c, 8), _mm_set1_epi16(128));
+}
+
+
+SSE2 static void rgb32_sse2(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+			    const uint8_t *s0, const uint8_t *s1, unsigned w)
+{
+	unsigned x;
+
+	for (x=0; x + 8 <= w; x += 8) {
+
+		__m128i b0, g0, r0, b1, g1, r1, b, g, r, c;
+
+		rgb32_load_sse2(&b0, &g0, &r0, &s0[4*x]);
+		rgb32_load_sse2(&b1, &g1, &r1, &s1[4*x]);
+
+		c = rgb2y_sse2(b0, g0, r0);
+		_mm_storel_epi64((__m128i *)&y0[x], _mm_packus_epi16(c, c));
+		c = rgb2y_sse2(b1, g1, r1);
+		_mm_storel_epi64((__m128i *)&y1[x], _mm_packus_epi16(c, c));
+
+		b = avg4_sse2(b0, b1);
+		g = avg4_sse2(g0, g1);
+		r = avg4_sse2(r0, r1);
+
+		c = rgb2c_sse2(b, g, r, -38, -74, 112);
+		*(uint32_t *)(void *)&u[x/2] =
+			(uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(c, c));
+
+		c = rgb2c_sse2(b, g, r, 112, -94, -18);
+		*(uint32_t *)(void *)&v[x/2] =
+			(uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(c, c));
+	}
+
+	rgb32_row_c(y0, y1, u, v, s0, s1, x, w);
+}
+
+
+SSE2 static void torgb_sse2(uint8_t *d, const uint8_t *y, const uint8_t *u,
+			    const uint8_t *v, unsigned w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alpha = _mm_set1_epi8((char)0xff);
+	unsigned x, i;
+
+	for (x=0; x + 16 <= w; x += 16) {
+
+		__m128i yy = _mm_loadu_si128((const __m128i *)&y[x]);
+		__m128i uu = _mm_loadl_epi64((const __m128i *)&u[x/2]);
+		__m128i vv = _mm_loadl_epi64((const __m128i *)&v[x/2]);
+		__m128i rv[2], gv[2], bv[2], r8, g8, b8, bg, ra;
+
+		/* one chroma sample for two pixels */
+		uu = _mm_unpacklo_epi8(uu, uu);
+		vv = _mm_unpacklo_epi8(vv, vv);
+
+		for (i=0; i<2; i++) {
+
+			__m128i c, du, dv, t;
+
+			if (i == 0) {
+				c  = _mm_unpacklo_epi8(yy, zero);
+				du = _mm_unpacklo_epi8(uu, zero);
+				dv = _mm_unpacklo_epi8(vv, zero);
+			}
+			else {
+				c  = _mm_unpackhi_epi8(yy, zero);
+				du = _mm_unpackhi_epi8(uu, zero);
+				dv = _mm_unpackhi_epi8(vv, zero);
+			}
+
+			c  = _mm_sub_epi16(c, _mm_set1_epi16(16));
+			du = _mm_sub_epi16(du, _mm_set1_epi16(128));
+			dv = _mm_sub_epi16(dv, _mm_set1_epi16(128));
+
+			c = _mm_add_epi16(_mm_mullo_epi16(c,
+							  _mm_set1_epi16(74)),
+					  _mm_set1_epi16(32));
+
+			/* saturation only happens when the result is > 255 */
+			t = _mm_mullo_epi16(du, _mm_set1_epi16(129));
+			bv[i] = _mm_srai_epi16(_mm_adds_epi16(c, t), 6);
+
+			t = _mm_adds_epi16(_mm_mullo_epi16(du,
+							   _mm_set1_epi16(25)),
+					   _mm_mullo_epi16(dv,
+							   _mm_set1_epi16(52)));
+			gv[i] = _mm_srai_epi16(_mm_subs_epi16(c, t), 6);
+
+			t = _mm_mullo_epi16(dv, _mm_set1_epi16(102));
+			rv[i] = _mm_srai_epi16(_mm_adds_epi16(c, t), 6);
+		}
+
+		b8 = _mm_packus_epi16(bv[0], bv[1]);
+		g8 = _mm_packus_epi16(gv[0], gv[1]);
+		r8 = _mm_packus_epi16(rv[0], rv[1]);
+
+		bg = _mm_unpacklo_epi8(b8, g8);
+		ra = _mm_unpacklo_epi8(r8, alpha);
+		_mm_storeu_si128((__m128i *)&d[4*x],
+				 _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128((__m128i *)&d[4*x + 16],
+				 _mm_unpackhi_epi16(bg, ra));
+
+		bg = _mm_unpackhi_epi8(b8, g8);
+		ra = _mm_unpackhi_epi8(r8, alpha);
+		_mm_storeu_si128((__m128i *)&d[4*x + 32],
+				 _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128((__m128i *)&d[4*x + 48],
+				 _mm_unpackhi_epi16(bg, ra));
+	}
+
+	torgb_row_c(d, y, u, v, x, w);
+}
+
+
+SSE2 static void acc_sse2(uint16_t *acc, const uint8_t *s, unsigned w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned x;
+
+	for (x=0; x + 16 <= w; x += 16) {
+
+		__m128i a  = _mm_loadu_si128((const __m128i *)&s[x]);
+		__m128i lo = _mm_loadu_si128((const __m128i *)&acc[x]);
+		__m128i hi = _mm_loadu_si128((const __m128i *)&acc[x + 8]);
+
+		lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(a, zero));
+		hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(a, zero));
+
+		_mm_storeu_si128((__m128i *)&acc[x], lo);
+		_mm_storeu_si128((__m128i *)&acc[x + 8], hi);
+	}
+
+	acc_row_c(acc, s, x, w);
+}
+
+
+SSE2 static void half_sse2(uint8_t *d, const uint8_t *s0, const uint8_t *s1,
+			   unsigned w)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	const __m128i two  = _mm_set1_epi16(2);
+	unsigned x;
+
+	for (x=0; x + 16 <= w; x += 16) {
+
+		__m128i a0 = _mm_loadu_si128((const __m128i *)&s0[2*x]);
+		__m128i a1 = _mm_loadu_si128((const __m128i *)&s0[2*x + 16]);
+		__m128i b0 = _mm_loadu_si128((const __m128i *)&s1[2*x]);
+		__m128i b1 = _mm_loadu_si128((const __m128i *)&s1[2*x + 16]);
+		__m128i lo, hi;
+
+		/* even plus odd bytes, of both rows */
+		lo = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a0, mask),
+						 _mm_srli_epi16(a0, 8)),
+				   _mm_add_epi16(_mm_and_si128(b0, mask),
+						 _mm_srli_epi16(b0, 8)));
+		hi = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a1, mask),
+						 _mm_srli_epi16(a1, 8)),
+				   _mm_add_epi16(_mm_and_si128(b1, mask),
+						 _mm_srli_epi16(b1, 8)));
+
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+
+		_mm_storeu_si128((__m128i *)&d[x], _mm_packus_epi16(lo, hi));
+	}
+
+	half_row_c(d, s0, s1, x, w);
+}
+
+
+SSE2 static void quad_sse2(uint8_t *d, const uint16_t *acc, unsigned w)
+{
+	const __m128i ones  = _mm_set1_epi16(1);
+	const __m128i eight = _mm_set1_epi16(8);
+	unsigned x;
+
+	for (x=0; x + 8 <= w; x += 8) {
+
+		const __m128i *p = (const __m128i *)&acc[4*x];
+		__m128i p0, p1, p2, p3, q0, q1, t;
+
+		/* the sums are at most 1020, so the signed pair sums fit */
+		p0 = _mm_madd_epi16(_mm_loadu_si128(p), ones);
+		p1 = _mm_madd_epi16(_mm_loadu_si128(p + 1), ones);
+		p2 = _mm_madd_epi16(_mm_loadu_si128(p + 2), ones);
+		p3 = _mm_madd_epi16(_mm_loadu_si128(p + 3), ones);
+
+		q0 = _mm_madd_epi16(_mm_packs_epi32(p0, p1), ones);
+		q1 = _mm_madd_epi16(_mm_packs_epi32(p2, p3), ones);
+
+		t = _mm_add_epi16(_mm_packs_epi32(q0, q1), eight);
+		t = _mm_srli_epi16(t, 4);
+
+		_mm_storel_epi64((__m128i *)&d[x], _mm_packus_epi16(t, t));
+	}
+
+	quad_row_c(d, acc, x, w);
+}
+
+
+SSE2 static void lerp_sse2(uint8_t *d, const uint8_t *a, const uint8_t *b,
+			   unsigned f, unsigned w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i wa   = _mm_set1_epi16((short)(256 - f));
+	const __m128i wb   = _mm_set1_epi16((short)f);
+	const __m128i half = _mm_set1_epi16(128);
+	unsigned x;
+
+	for (x=0; x + 16 <= w; x += 16) {
+
+		__m128i va = _mm_loadu_si128((const __m128i *)&a[x]);
+		__m128i vb = _mm_loadu_si128((const __m128i *)&b[x]);
+		__m128i lo, hi;
+
+		/* at most 255 * 256 + 128, which fits 16 bits */
+		lo = _mm_add_epi16(
+			_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+			_mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+		hi = _mm_add_epi16(
+			_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+			_mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, half), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, half), 8);
+
+		_mm_storeu_si128((__m128i *)&d[x], _mm_packus_epi16(lo, hi));
+	}
+
+	lerp_row_c(d, a, b, f, x, w);
+}
+
+
+SSE2 static void blend_sse2(uint8_t *d, const uint16_t *mul,
+			    const uint16_t *add, unsigned w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned x;
+
+	for (x=0; x + 16 <= w; x += 16) {
+
+		__m128i a  = _mm_loadu_si128((const __m128i *)&d[x]);
+		__m128i lo = _mm_unpacklo_epi8(a, zero);
+		__m128i hi = _mm_unpackhi_epi8(a, zero);
+
+		lo = _mm_mullo_epi16(lo,
+			     _mm_loadu_si128((const __m128i *)&mul[x]));
+		hi = _mm_mullo_epi16(hi,
+			     _mm_loadu_si128((const __m128i *)&mul[x + 8]));
+		lo = _mm_add_epi16(lo,
+			   _mm_loadu_si128((const __m128i *)&add[x]));
+		hi = _mm_add_epi16(hi,
+			   _mm_loadu_si128((const __m128i *)&add[x + 8]));
+
+		_mm_storeu_si128((__m128i *)&d[x],
+				 _mm_packus_epi16(_mm_srli_epi16(lo, 8),
+						  _mm_srli_epi16(hi, 8)));
+	}
+
+	blend_row_c(d, mul, add, x, w);
+}
+
+
+static const struct vidconv_ops ops_sse2 = {
+	yuyv_sse2, uv_sse2, rgb32_sse2, torgb_sse2, acc_sse2, half_sse2,
+	quad_sse2, lerp_sse2, blend_sse2
+};
+
+
+AVX2 static void yuyv_avx2(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+			   const uint8_t *s0, const uint8_t *s1, unsigned w)
+{
+	const __m256i mask = _mm256_set1_epi16(0x00ff);
+	const __m256i zero = _mm256_setzero_si256();
+	unsigned x;
+
+	for (x=0; x + 32 <= w; x += 32) {
+
+		__m256i a0 = _mm256_loadu_si256((const __m256i *)&s0[2*x]);
+		__m256i a1 = _mm256_loadu_si256((const __m256i *)&s0[2*x+32]);
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)&s1[2*x]);
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)&s1[2*x+32]);
+		__m256i t, ch;
+
+		/* packus works per 128-bit lane, permute restores order */
+		t = _mm256_packus_epi16(_mm256_and_si256(a0, mask),
+					_mm256_and_si256(a1, mask));
+		_mm256_storeu_si256((__m256i *)&y0[x],
+				    _mm256_permute4x64_epi64(t, 0xd8));
+
+		t = _mm256_packus_epi16(_mm256_and_si256(b0, mask),
+					_mm256_and_si256(b1, mask));
+		_mm256_storeu_si256((__m256i *)&y1[x],
+				    _mm256_permute4x64_epi64(t, 0xd8));
+
+		ch = _mm256_packus_epi16(
+			_mm256_srli_epi16(_mm256_avg_epu8(a0, b0), 8),
+			_mm256_srli_epi16(_mm256_avg_epu8(a1, b1), 8));
+		ch = _mm256_permute4x64_epi64(ch, 0xd8);
+
+		t = _mm256_packus_epi16(_mm256_and_si256(ch, mask), zero);
+		t = _mm256_permute4x64_epi64(t, 0xd8);
+		_mm_storeu_si128((__m128i *)&u[x/2],
+				 _mm256_castsi256_si128(t));
+
+		t = _mm256_packus_epi16(_mm256_srli_epi16(ch, 8), zero);
+		t = _mm256_permute4x64_epi64(t, 0xd8);
+		_mm_storeu_si128((__m128i *)&v[x/2],
+				 _mm256_castsi256_si128(t));
+	}
+
+	yuyv_sse2(&y0[x], &y1[x], &u[x/2], &v[x/2], &s0[2*x], &s1[2*x],
+		  w - x);
+}
+
+
+AVX2 static void uv_avx2(uint8_t *u, uint8_t *v, const uint8_t *uv,
+			 unsigned n)
+{
+	const __m256i mask = _mm256_set1_epi16(0x00ff);
+	unsigned i;
+
+	for (i=0; i + 32 <= n; i += 32) {
+
+		__m256i a = _mm256_loadu_si256((const __m256i *)&uv[2*i]);
+		__m256i b = _mm256_loadu_si256((const __m256i *)&uv[2*i+32]);
+		__m256i t;
+
+		t = _mm256_packus_epi16(_mm256_and_si256(a, mask),
+					_mm256_and_si256(b, mask));
+		_mm256_storeu_si256((__m256i *)&u[i],
+				    _mm256_permute4x64_epi64(t, 0xd8));
+
+		t = _mm256_packus_epi16(_mm256_srli_epi16(a, 8),
+					_mm256_srli_epi16(b, 8));
+		_mm256_storeu_si256((__m256i *)&v[i],
+				    _mm256_permute4x64_epi64(t, 0xd8));
+	}
+
+	uv_sse2(&u[i], &v[i], &uv[2*i], n - i);
+}
+
+
+AVX2 static void acc_avx2(uint16_t *acc, const uint8_t *s, unsigned w)
+{
+	unsigned x;
+
+	for (x=0; x + 32 <= w; x += 32) {
+
+		__m256i a0 = _mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i *)&s[x]));
+		__m256i a1 = _mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i *)&s[x + 16]));
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)&acc[x]);
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)&acc[x+16]);
+
+		_mm256_storeu_si256((__m256i *)&acc[x],
+				    _mm256_add_epi16(b0, a0));
+		_mm256_storeu_si256((__m256i *)&acc[x + 16],
+				    _mm256_add_epi16(b1, a1));
+	}
+
+	acc_sse2(&acc[x], &s[x], w - x);
+}
+
+
+AVX2 static void half_avx2(uint8_t *d, const uint8_t *s0, const uint8_t *s1,
+			   unsigned w)
+{
+	const __m256i mask = _mm256_set1_epi16(0x00ff);
+	const __m256i two  = _mm256_set1_epi16(2);
+	unsigned x;
+
+	for (x=0; x + 32 <= w; x += 32) {
+
+		__m256i a0 = _mm256_loadu_si256((const __m256i *)&s0[2*x]);
+		__m256i a1 = _mm256_loadu_si256((const __m256i *)&s0[2*x+32]);
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)&s1[2*x]);
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)&s1[2*x+32]);
+		__m256i lo, hi;
+
+		lo = _mm256_add_epi16(
+			_mm256_add_epi16(_mm256_and_si256(a0, mask),
+					 _mm256_srli_epi16(a0, 8)),
+			_mm256_add_epi16(_mm256_and_si256(b0, mask),
+					 _mm256_srli_epi16(b0, 8)));
+		hi = _mm256_add_epi16(
+			_mm256_add_epi16(_mm256_and_si256(a1, mask),
+					 _mm256_srli_epi16(a1, 8)),
+			_mm256_add_epi16(_mm256_and_si256(b1, mask),
+					 _mm256_srli_epi16(b1, 8)));
+
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+
+		/* packus works per 128-bit lane, permute restores order */
+		_mm256_storeu_si256((__m256i *)&d[x],
+			_mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi),
+						 0xd8));
+	}
+
+	half_sse2(&d[x], &s0[2*x], &s1[2*x], w - x);
+}
+
+
+AVX2 static void lerp_avx2(uint8_t *d, const uint8_t *a, const uint8_t *b,
+			   unsigned f, unsigned w)
+{
+	const __m256i wa   = _mm256_set1_epi16((short)(256 - f));
+	const __m256i wb   = _mm256_set1_epi16((short)f);
+	const __m256i half = _mm256_set1_epi16(128);
+	unsigned x;
+
+	for (x=0; x + 16 <= w; x += 16) {
+
+		__m256i va = _mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i *)&a[x]));
+		__m256i vb = _mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i *)&b[x]));
+		__m256i t;
+
+		t = _mm256_add_epi16(_mm256_mullo_epi16(va, wa),
+				     _mm256_mullo_epi16(vb, wb));
+		t = _mm256_srli_epi16(_mm256_add_epi16(t, half), 8);
+
+		t = _mm256_permute4x64_epi64(_mm256_packus_epi16(t, t), 0xd8);
+		_mm_storeu_si128((__m128i *)&d[x], _mm256_castsi256_si128(t));
+	}
+
+	lerp_sse2(&d[x], &a[x], &b[x], f, w - x);
+}
+
+
+AVX2 static void blend_avx2(uint8_t *d, const uint16_t *mul,
+			    const uint16_t *add, unsigned w)
+{
+	unsigned x;
+
+	for (x=0; x + 16 <= w; x += 16) {
+
+		__m256i a = _mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i *)&d[x]));
+		__m256i t;
+
+		a = _mm256_mullo_epi16(a,
+			_mm256_loadu_si256((const __m256i *)&mul[x]));
+		a = _mm256_add_epi16(a,
+			_mm256_loadu_si256((const __m256i *)&add[x]));
+		a = _mm256_srli_epi16(a, 8);
+
+		/* packus works per 128-bit lane, permute restores order */
+		t = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, a), 0xd8);
+		_mm_storeu_si128((__m128i *)&d[x], _mm256_castsi256_si128(t));
+	}
+
+	blend_sse2(&d[x], &mul[x], &add[x], w - x);
+}
+
+
+static const struct vidconv_ops ops_avx2 = {
+	yuyv_avx2, uv_avx2, rgb32_sse2, torgb_sse2, acc_avx2, half_avx2,
+	quad_sse2, lerp_avx2, blend_avx2
+};
+
+#endif /* HAVE_SIMD_X86 */
+
+
+#ifdef HAVE_SIMD_NEON
+
+static void yuyv_neon(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+		      const uint8_t *s0, const uint8_t *s1, unsigned w)
+{
+	unsigned x;
+
+	for (x=0; x + 32 <= w; x += 32) {
+
+		/* val[0]=Y even, val[1]=U, val[2]=Y odd, val[3]=V */
+		uint8x16x4_t a = vld4q_u8(&s0[2*x]);
+		uint8x16x4_t b = vld4q_u8(&s1[2*x]);
+		uint8x16x2_t ya, yb;
+
+		ya.val[0] = a.val[0];
+		ya.val[1] = a.val[2];
+		yb.val[0] = b.val[0];
+		yb.val[1] = b.val[2];
+
+		vst2q_u8(&y0[x], ya);
+		vst2q_u8(&y1[x], yb);
+
+		vst1q_u8(&u[x/2], vrhaddq_u8(a.val[1], b.val[1]));
+		vst1q_u8(&v[x/2], vrhaddq_u8(a.val[3], b.val[3]));
+	}
+
+	yuyv_row_c(y0, y1, u, v, s0, s1, x, w);
+}
+
+
+static void uv_neon(uint8_t *u, uint8_t *v, const uint8_t *uv, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i + 16 <= n; i += 16) {
+
+		uint8x16x2_t t = vld2q_u8(&uv[2*i]);
+
+		vst1q_u8(&u[i], t.val[0]);
+		vst1q_u8(&v[i], t.val[1]);
+	}
+
+	uv_row_c(u, v, uv, i, n);
+}
+
+
+static void acc_neon(uint16_t *acc, const uint8_t *s, unsigned w)
+{
+	unsigned x;
+
+	for (x=0; x + 16 <= w; x += 16) {
+
+		uint8x16_t a = vld1q_u8(&s[x]);
+
+		vst1q_u16(&acc[x], vaddw_u8(vld1q_u16(&acc[x]),
+					     vget_low_u8(a)));
+		vst1q_u16(&acc[x + 8], vaddw_u8(vld1q_u16(&acc[x + 8]),
+						 vget_high_u8(a)));
+	}
+
+	acc_row_c(acc, s, x, w);
+}
+
+
+static void half_neon(uint8_t *d, const uint8_t *s0, const uint8_t *s1,
+		      unsigned w)
+{
+	unsigned x;
+
+	for (x=0; x + 8 <= w; x += 8) {
+
+		uint16x8_t t = vpaddlq_u8(vld1q_u8(&s0[2*x]));
+
+		t = vpadalq_u8(t, vld1q_u8(&s1[2*x]));
+
+		/* rounding shift, (t + 2) >> 2 */
+		vst1_u8(&d[x], vrshrn_n_u16(t, 2));
+	}
+
+	half_row_c(d, s0, s1, x, w);
+}
+
+
+static void quad_neon(uint8_t *d, const uint16_t *acc, unsigned w)
+{
+	unsigned x;
+
+	for (x=0; x + 8 <= w; x += 8) {
+
+		uint16x8x4_t a = vld4q_u16(&acc[4*x]);
+		uint16x8_t t = vaddq_u16(vaddq_u16(a.val[0], a.val[1]),
+					 vaddq_u16(a.val[2], a.val[3]));
+
+		vst1_u8(&d[x], vrshrn_n_u16(t, 4));
+	}
+
+	quad_row_c(d, acc, x, w);
+}
+
+
+static void lerp_neon(uint8_t *d, const uint8_t *a, const uint8_t *b,
+		      unsigned f, unsigned w)
+{
+	const uint8x8_t wa = vdup_n_u8((uint8_t)(256 - f));
+	const uint8x8_t wb = vdup_n_u8((uint8_t)f);
+	unsigned x;
+
+	for (x=0; x + 8 <= w; x += 8) {
+
+		uint16x8_t t = vmull_u8(vld1_u8(&a[x]), wa);
+
+		t = vmlal_u8(t, vld1_u8(&b[x]), wb);
+
+		vst1_u8(&d[x], vrshrn_n_u16(t, 8));
+	}
+
+	lerp_row_c(d, a, b, f, x, w);
+}
+
+
+static void blend_neon(uint8_t *d, const uint16_t *mul,
+		       const uint16_t *add, unsigned w)
+{
+	unsigned x;
+
+	for (x=0; x + 8 <= w; x += 8) {
+
+		uint16x8_t a = vmovl_u8(vld1_u8(&d[x]));
+
+		a = vmlaq_u16(vld1q_u16(&add[x]), a, vld1q_u16(&mul[x]));
+
+		vst1_u8(&d[x], vshrn_n_u16(a, 8));
+	}
+
+	blend_row_c(d, mul, add, x, w);
+}
+
+
+static const struct vidconv_ops ops_neon = {
+	yuyv_neon, uv_neon, rgb32_c, torgb_c, acc_neon, half_neon, quad_neon,
+	lerp_neon, blend_neon
+};
+
+#endif /* HAVE_SIMD_NEON */
+
+
+static const struct vidconv_ops *impl_ops(enum simd_impl impl)
+{
+	if (!simd_supported(impl))
+		return NULL;
+
+	switch (impl) {
+
+#ifdef HAVE_SIMD_X86
+	case SIMD_SSE2: return &ops_sse2;
+	case SIMD_AVX2: return &ops_avx2;
+#endif
+#ifdef HAVE_SIMD_NEON
+	case SIMD_NEON: return &ops_neon;
+#endif
+	default:        return &ops_c;
+	}
+}
+
+
+static const struct vidconv_ops *best_ops(void)
+{
+	static const struct vidconv_ops *ops;
+
+	if (!ops)
+		ops = impl_ops(simd_best());
+
+	return ops;
+}
+
+
+static int convert(const struct vidconv_ops *ops, struct vidframe *dst,
+		   const struct vidframe *src)
+{
+	const unsigned w = src->size.w, h = src->size.h;
+	unsigned j;
+
+	if (!vidsz_cmp(&dst->size, &src->size) || (w & 1) || (h & 1))
+		return ENOTSUP;
+
+	if (dst->fmt == VID_FMT_YUV420P) {
+
+		for (j=0; j<h; j+=2) {
+
+			uint8_t *y0 = dst->data[0] + j * dst->linesize[0];
+			uint8_t *y1 = y0 + dst->linesize[0];
+			uint8_t *u  = dst->data[1] + j/2 * dst->linesize[1];
+			uint8_t *v  = dst->data[2] + j/2 * dst->linesize[2];
+			const uint8_t *s0 = src->data[0] + j*src->linesize[0];
+			const uint8_t *s1 = s0 + src->linesize[0];
+
+			switch (src->fmt) {
+
+			case VID_FMT_YUYV422:
+				ops->yuyvh(y0, y1, u, v, s0, s1, w);
+				break;
+
+			case VID_FMT_NV12:
+				memcpy(y0, s0, w);
+				memcpy(y1, s1, w);
+				ops->uvh(u, v, src->data[1] +
+					 j/2 * src->linesize[1], w/2);
+				break;
+
+			case VID_FMT_RGB32:
+				ops->rgb32h(y0, y1, u, v, s0, s1, w);
+				break;
+
+			default:
+				return ENOTSUP;
+			}
+		}
+
+		return 0;
+	}
+	else if (dst->fmt == VID_FMT_RGB32 && src->fmt == VID_FMT_YUV420P) {
+
+		for (j=0; j<h; j++) {
+
+			ops->torgbh(dst->data[0] + j * dst->linesize[0],
+				    src->data[0] + j * src->linesize[0],
+				    src->data[1] + j/2 * src->linesize[1],
+				    src->data[2] + j/2 * src->linesize[2],
+				    w);
+		}
+
+		return 0;
+	}
+
+	return ENOTSUP;
+}
+
+
+/**
+ * Convert a video frame, using the fastest available converter. Other
+ * conversions and scaling are handled by vidconv().
+ *
+ * @param dst Destination video frame
+ * @param src Source video frame
+ * @param r   Destination rectangle, or NULL for the whole frame
+ */
+void vidconv_fast(struct vidframe *dst, const struct vidframe *src,
+		  struct vidrect *r)
+{
+	if (!dst || !src)
+		return;
+
+	if (!r && !convert(best_ops(), dst, src))
+		return;
+
+	vidconv(dst, src, r);
+}
+
+
+/**
+ * Convert a video frame with a specific converter
+ *
+ * @param impl SIMD implementation
+ * @param dst  Destination video frame
+ * @param src  Source video frame
+ *
+ * @return 0 if success, ENOTSUP if not supported, otherwise errorcode
+ */
+int vidconv_fast_impl(enum simd_impl impl, struct vidframe *dst,
+		      const struct vidframe *src)
+{
+	const struct vidconv_ops *ops = impl_ops(impl);
+
+	if (!dst || !src)
+		return EINVAL;
+
+	if (!ops)
+		return ENOTSUP;
+
+	return convert(ops, dst, src);
+}
+
+
+/* One component of a frame: the Y, U or V samples */
+struct plane {
+	uint8_t *d;
+	const uint8_t *s;
+	unsigned dls, dw, dh, dstep;   /**< Step is 2 for interleaved UV  */
+	unsigned sls, sw, sh, sstep;
+};
+
+/* A band of rows of all planes, with its own buffers */
+struct band {
+	const struct vidconv_ops *ops;
+	const struct plane *pv;
+	unsigned k, n;                 /**< Band k of n                   */
+	unsigned *xv;                  /**< dw+1 columns                  */
+	uint16_t *fx;                  /**< dw horizontal weights         */
+	uint16_t *acc;                 /**< One row of 16-bit sums        */
+	uint8_t *rowv[2];              /**< Interpolated source rows      */
+	unsigned rowy[2];              /**< Source row of rowv, or none   */
+	uint8_t *tmp;                  /**< Row for an interleaved output */
+};
+
+
+static bool scale_fmt(enum vidfmt fmt)
+{
+	return fmt == VID_FMT_YUV420P || fmt == VID_FMT_NV12 ||
+		fmt == VID_FMT_NV21;
+}
+
+
+/* Plane, first byte and step of component i */
+static void comp_layout(enum vidfmt fmt, int i, int *plane,
+			unsigned *offs, unsigned *step)
+{
+	if (fmt == VID_FMT_YUV420P || !i) {
+		*plane = i;
+		*offs  = 0;
+		*step  = 1;
+	}
+	else {
+		*plane = 1;
+		*offs  = fmt == VID_FMT_NV12 ? i - 1 : 2 - i;
+		*step  = 2;
+	}
+}
+
+
+/* Box filter of the rows j0 to j1 of a plane */
+static void box_rows(struct band *b, const struct plane *p,
+		     unsigned j0, unsigned j1)
+{
+	const unsigned aw = (p->sw - 1) * p->sstep + 1;
+	uint16_t *acc = b->acc;
+	unsigned *xv = b->xv;
+	unsigned i, j;
+
+	for (i=0; i<=p->dw; i++)
+		xv[i] = (unsigned)((uint64_t)i * p->sw / p->dw);
+
+	for (j=j0; j<j1; j++) {
+
+		unsigned y0 = (unsigned)((uint64_t)j * p->sh / p->dh);
+		unsigned y1 = (unsigned)((uint64_t)(j+1) * p->sh / p->dh);
+		uint8_t *d = p->d + (size_t)j * p->dls;
+		unsigned y, ny;
+
+		y1 = min(max(y1, y0 + 1), y0 + BOX_MAX);
+		ny = y1 - y0;
+
+		memset(acc, 0, aw * sizeof(*acc));
+
+		for (y=y0; y<y1; y++)
+			b->ops->acch(acc, p->s + (size_t)y * p->sls, aw);
+
+		for (i=0; i<p->dw; i++) {
+
+			unsigned x0 = xv[i], x1 = max(xv[i+1], x0 + 1);
+			unsigned x, n = (x1 - x0) * ny;
+			uint32_t sum = 0;
+
+			for (x=x0; x<x1; x++)
+				sum += acc[x * p->sstep];
+
+			d[i * p->dstep] = (sum + n/2) / n;
+		}
+	}
+}
+
+
+/* Exactly 2:1, the same as the box filter */
+static void half_rows(struct band *b, const struct plane *p,
+		      unsigned j0, unsigned j1)
+{
+	unsigned j;
+
+	for (j=j0; j<j1; j++) {
+
+		const uint8_t *s = p->s + (size_t)2 * j * p->sls;
+
+		b->ops->halfh(p->d + (size_t)j * p->dls, s, s + p->sls,
+			      p->dw);
+	}
+}
+
+
+/* Exactly 4:1, the same as the box filter */
+static void quad_rows(struct band *b, const struct plane *p,
+		      unsigned j0, unsigned j1)
+{
+	unsigned j, y;
+
+	for (j=j0; j<j1; j++) {
+
+		const uint8_t *s = p->s + (size_t)4 * j * p->sls;
+
+		memset(b->acc, 0, p->sw * sizeof(*b->acc));
+
+		for (y=0; y<4; y++)
+			b->ops->acch(b->acc, s + (size_t)y * p->sls, p->sw);
+
+		b->ops->quadh(p->d + (size_t)j * p->dls, b->acc, p->dw);
+	}
+}
+
+
+/*
+ * Source position of destination pixel i in 1/256 pixel, with the pixel
+ * centres aligned. The last source pixel gets the full weight f=256 of
+ * the second one, so that both can always be read.
+ */
+static void lin_pos(unsigned *x0, unsigned *f, unsigned i, unsigned sn,
+		    unsigned dn)
+{
+	int64_t pos = (int64_t)(2*i + 1) * sn * 128 / dn - 128;
+
+	pos = max(pos, 0);
+
+	*x0 = (unsigned)(pos >> 8);
+	*f  = (unsigned)(pos & 255);
+
+	if (sn == 1) {
+		*x0 = 0;
+		*f  = 0;
+	}
+	else if (*x0 >= sn - 1) {
+		*x0 = sn - 2;
+		*f  = 256;
+	}
+}
+
+
+static const uint8_t *lin_row(struct band *b, const struct plane *p,
+			      unsigned y, unsigned keep)
+{
+	const unsigned next = p->sw > 1 ? p->sstep : 0;
+	const uint8_t *s = p->s + (size_t)y * p->sls;
+	uint8_t *d;
+	unsigned i;
+	int k;
+
+	for (k=0; k<2; k++) {
+		if (b->rowy[k] == y)
+			return b->rowv[k];
+	}
+
+	k = b->rowy[0] == keep ? 1 : 0;
+	d = b->rowv[k];
+
+	for (i=0; i<p->dw; i++) {
+
+		const uint8_t *t = s + b->xv[i];
+		const unsigned f = b->fx[i];
+
+		d[i] = (t[0] * (256 - f) + t[next] * f + 128) >> 8;
+	}
+
+	b->rowy[k] = y;
+
+	return d;
+}
+
+
+/* Bilinear upscaling of the rows j0 to j1 of a plane */
+static void lin_rows(struct band *b, const struct plane *p,
+		     unsigned j0, unsigned j1)
+{
+	unsigned i, j, x, f;
+
+	for (i=0; i<p->dw; i++) {
+
+		lin_pos(&x, &f, i, p->sw, p->dw);
+
+		b->xv[i] = x * p->sstep;
+		b->fx[i] = f;
+	}
+
+	b->rowy[0] = b->rowy[1] = UINT_MAX;
+
+	for (j=j0; j<j1; j++) {
+
+		uint8_t *d = p->d + (size_t)j * p->dls;
+		uint8_t *out = p->dstep == 1 ? d : b->tmp;
+		const uint8_t *r0, *r1;
+		unsigned y0, y1;
+
+		lin_pos(&y0, &f, j, p->sh, p->dh);
+		y1 = p->sh > 1 ? y0 + 1 : y0;
+
+		if (f == 0) {
+			memcpy(out, lin_row(b, p, y0, y1), p->dw);
+		}
+		else if (f == 256) {
+			memcpy(out, lin_row(b, p, y1, y0), p->dw);
+		}
+		else {
+			r0 = lin_row(b, p, y0, y1);
+			r1 = lin_row(b, p, y1, y0);
+
+			b->ops->lerph(out, r0, r1, f, p->dw);
+		}
+
+		if (out != d) {
+			for (i=0; i<p->dw; i++)
+				d[i * p->dstep] = out[i];
+		}
+	}
+}
+
+
+static void scale_band(struct band *b)
+{
+	int i;
+
+	for (i=0; i<3; i++) {
+
+		const struct plane *p = &b->pv[i];
+		const unsigned j0 = p->dh * b->k / b->n;
+		const unsigned j1 = p->dh * (b->k + 1) / b->n;
+		const bool packed = p->sstep == 1 && p->dstep == 1;
+
+		if (j0 == j1)
+			continue;
+
+		if (p->dw >= p->sw && p->dh >= p->sh &&
+		    (p->dw > p->sw || p->dh > p->sh))
+			lin_rows(b, p, j0, j1);
+		else if (packed && p->sw == 2*p->dw && p->sh == 2*p->dh)
+			half_rows(b, p, j0, j1);
+		else if (packed && p->sw == 4*p->dw && p->sh == 4*p->dh)
+			quad_rows(b, p, j0, j1);
+		else
+			box_rows(b, p, j0, j1);
+	}
+}
+
+
+#ifdef HAVE_PTHREAD
+static void *band_thread(void *arg)
+{
+	scale_band(arg);
+
+	return NULL;
+}
+#endif
+
+
+static int scale(const struct vidconv_ops *ops, struct vidframe *dst,
+		 const struct vidframe *src, const struct vidrect *r)
+{
+	struct band bv[SCALE_THREADS];
+	struct plane pv[3];
+	struct vidrect rect;
+	unsigned k, n = 1;
+	size_t bsz;
+	uint8_t *buf;
+	int i;
+#ifdef HAVE_PTHREAD
+	pthread_t tidv[SCALE_THREADS];
+	bool run[SCALE_THREADS];
+#endif
+
+	if (!scale_fmt(dst->fmt) || !scale_fmt(src->fmt))
+		return ENOTSUP;
+
+	if (r) {
+		rect = *r;
+	}
+	else {
+		rect.x = rect.y = 0;
+		rect.w = dst->size.w;
+		rect.h = dst->size.h;
+	}
+
+	if (!rect.w || !rect.h || !src->size.w || !src->size.h ||
+	    rect.x + rect.w > dst->size.w || rect.y + rect.h > dst->size.h)
+		return EINVAL;
+
+	for (i=0; i<3; i++) {
+
+		/* chroma planes are half size, rounded up */
+		const unsigned cs = i ? 1 : 0;
+		struct plane *p = &pv[i];
+		unsigned doffs, soffs;
+		int dp, sp;
+
+		comp_layout(dst->fmt, i, &dp, &doffs, &p->dstep);
+		comp_layout(src->fmt, i, &sp, &soffs, &p->sstep);
+
+		p->dls = dst->linesize[dp];
+		p->dw  = (rect.w + cs) >> cs;
+		p->dh  = (rect.h + cs) >> cs;
+		p->d   = dst->data[dp] + (rect.y >> cs) * p->dls +
+			(rect.x >> cs) * p->dstep + doffs;
+
+		p->sls = src->linesize[sp];
+		p->sw  = (src->size.w + cs) >> cs;
+		p->sh  = (src->size.h + cs) >> cs;
+		p->s   = src->data[sp] + soffs;
+	}
+
+#ifdef HAVE_PTHREAD
+	if ((uint64_t)src->size.w * src->size.h >= SCALE_MT_MIN)
+		n = SCALE_THREADS;
+#endif
+
+	/* xv, fx, acc and three rows, aligned for the next band */
+	bsz = (rect.w + 1) * sizeof(unsigned) + rect.w * sizeof(uint16_t) +
+		(src->size.w + 1) * sizeof(uint16_t) + 3 * rect.w;
+	bsz = (bsz + 7) & ~(size_t)7;
+
+	buf = mem_alloc(n * bsz, NULL);
+	if (!buf)
+		return ENOMEM;
+
+	for (k=0; k<n; k++) {
+
+		struct band *b = &bv[k];
+
+		b->ops = ops;
+		b->pv  = pv;
+		b->k   = k;
+		b->n   = n;
+
+		b->xv      = (unsigned *)(buf + k * bsz);
+		b->fx      = (uint16_t *)(b->xv + rect.w + 1);
+		b->acc     = b->fx + rect.w;
+		b->rowv[0] = (uint8_t *)(b->acc + src->size.w + 1);
+		b->rowv[1] = b->rowv[0] + rect.w;
+		b->tmp     = b->rowv[1] + rect.w;
+	}
+
+#ifdef HAVE_PTHREAD
+	for (k=1; k<n; k++) {
+
+		run[k] = 0 == pthread_create(&tidv[k], NULL, band_thread,
+					     &bv[k]);
+		if (!run[k])
+			scale_band(&bv[k]);
+	}
+#endif
+
+	scale_band(&bv[0]);
+
+#ifdef HAVE_PTHREAD
+	for (k=1; k<n; k++) {
+		if (run[k])
+			pthread_join(tidv[k], NULL);
+	}
+#endif
+
+	mem_deref(buf);
+
+	return 0;
+}
+
+
+/**
+ * Resize a YUV420P, NV12 or NV21 video frame into a rectangle of another
+ * frame in one of these formats, with a box filter when shrinking and
+ * bilinear interpolation when growing
+ *
+ * @param dst Destination video frame
+ * @param src Source video frame
+ * @param r   Destination rectangle, or NULL for the whole frame. The
+ *            position should be even, to align with the chroma planes.
+ *
+ * @return 0 if success, ENOTSUP if another format, otherwise errorcode
+ */
+int vidconv_scale(struct vidframe *dst, const struct vidframe *src,
+		  const struct vidrect *r)
+{
+	if (!dst || !src)
+		return EINVAL;
+
+	return scale(best_ops(), dst, src, r);
+}
+
+
+/**
+ * Resize a video frame with specific SIMD versions, see vidconv_scale()
+ *
+ * @param impl SIMD implementation
+ * @param dst  Destination video frame
+ * @param src  Source video frame
+ * @param r    Destination rectangle, or NULL for the whole frame
+ *
+ * @return 0 if success, ENOTSUP if not supported, otherwise errorcode
+ */
+int vidconv_scale_impl(enum simd_impl impl, struct vidframe *dst,
+		       const struct vidframe *src, const struct vidrect *r)
+{
+	const struct vidconv_ops *ops = impl_ops(impl);
+
+	if (!dst || !src)
+		return EINVAL;
+
+	if (!ops)
+		return ENOTSUP;
+
+	return scale(ops, dst, src, r);
+}
+
+
+static void blend(const struct vidconv_ops *ops, uint8_t *d, size_t ls,
+		  const uint16_t *mul, const uint16_t *add,
+		  unsigned w, unsigned h)
+{
+	unsigned j;
+
+	for (j=0; j<h; j++) {
+
+		ops->blendh(d, mul, add, w);
+
+		d   += ls;
+		mul += w;
+		add += w;
+	}
+}
+
+
+/**
+ * Blend a mask onto a plane of a video frame, out = (in * mul + add) >> 8
+ *
+ * @param d   First pixel of the plane to blend
+ * @param ls  Line size of the plane in [bytes]
+ * @param mul Weight of the frame pixel, 0-256, per pixel
+ * @param add Premultiplied overlay pixel, at most (256 - mul) * 255
+ * @param w   Width of the mask in [pixels], which is also its line size
+ * @param h   Height of the mask in [pixels]
+ */
+void vidconv_blend(uint8_t *d, size_t ls, const uint16_t *mul,
+		   const uint16_t *add, unsigned w, unsigned h)
+{
+	if (!d || !mul || !add)
+		return;
+
+	blend(best_ops(), d, ls, mul, add, w, h);
+}
+
+
+/**
+ * Blend a mask with a specific blender, see vidconv_blend()
+ *
+ * @param impl SIMD implementation
+ * @param d    First pixel of the plane to blend
+ * @param ls   Line size of the plane in [bytes]
+ * @param mul  Weight of the frame pixel, 0-256, per pixel
+ * @param add  Premultiplied overlay pixel
+ * @param w    Width of the mask in [pixels]
+ * @param h    Height of the mask in [pixels]
+ *
+ * @return 0 if success, ENOTSUP if not supported, otherwise errorcode
+ */
+int vidconv_blend_impl(enum simd_impl impl, uint8_t *d, size_t ls,
+		       const uint16_t *mul, const uint16_t *add,
+		       unsigned w, unsigned h)
+{
+	const struct vidconv_ops *ops = impl_ops(impl);
+
+	if (!d || !mul || !add)
+		return EINVAL;
+
+	if (!ops)
+		return ENOTSUP;
+
+	blend(ops, d, ls, mul, add, w, h);
+
+	return 0;
+}
@@ -7,6 +7,9 @@
  */
 #include <string.h>
 #include <stdlib.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -29,12 +32,56 @@ enum {
 	MAX_MUTED_FRAMES = 3,
 };
 
+/** Frame admission and encoder rate adaptation */
+enum {
+	QUEUE_MAX_MS      = 200,   /**< Skip frames above this queue delay */
+	QUEUE_CONG_MS     = 60,    /**< Queue delay considered congested   */
+	QUEUE_IDLE_MS     = 10,    /**< Queue delay considered idle        */
+	RATE_INTERVAL     = 2000,  /**< Min time between rate changes [ms] */
+	RATE_RECOVER      = 5000,  /**< Idle time before rate increase     */
+	RATE_MIN_PERCENT  = 25,    /**< Lowest encoder rate in [%]         */
+};
+
+/** Degradation of resolution and frame-rate */
+enum {
+	DEG_STEPS       = 4,       /**< Steps, including no degradation    */
+	DEG_SCALE_FULL  = 4,       /**< Unscaled size in [1/4]             */
+	DEG_INTERVAL    = 4000,    /**< Min time between steps [ms]        */
+	DEG_RECOVER     = 10000,   /**< Time without pressure to step up   */
+	DEG_BPKP_MIN    = 30,      /**< Lowest bits per 1000 pixels        */
+};
+
+/** Simulcast */
+enum {
+	SIMULCAST_MAX = 3,         /**< Max layers, including the full one */
+};
+
+/** Forward error correction */
+enum {
+	FEC_REPAIR_WINDOW = 200000, /**< Signalled repair window [us]      */
+};
+
+/** Picture updates */
+enum {
+	FIR_MIN = 500,             /**< Min time between sent FIR [ms]     */
+	PICUP_HOLD = 1000,         /**< Min time for signalled updates [ms]*/
+};
+
+/** Asynchronous encoder */
+enum {
+	ENCQ_SIZE = 2,             /**< Max frames waiting for the encoder */
+};
+
 /** Video transmit parameters */
 enum {
 	MEDIA_POLL_RATE = 250,                 /**< in [Hz]             */
-	BURST_MAX       = 8192,                /**< in bytes            */
-	RTP_PRESZ       = 4 + RTP_HEADER_SIZE, /**< TURN and RTP header */
-	RTP_TRAILSZ     = 12 + 4,              /**< SRTP/SRTCP trailer  */
+	RTP_PRESZ       = VIDENC_PRESZ,        /**< TURN and RTP header */
+	RTP_TRAILSZ     = VIDENC_TRAILSZ,      /**< SRTP/SRTCP trailer  */
+	QENT_MTU        = 1500,                /**< Pooled payload size */
+	QENT_POOL_MAX   = 256,                 /**< Max pooled entries  */
+	PKTSIZE_DEFAULT = 1024,                /**< Encoder packet size */
+	PACING_DEFAULT  = 200,                 /**< Pacing rate in [%]  */
+	BURST_DEFAULT   = 8192,                /**< Pacer burst [bytes] */
 };
 
 
@@ -66,6 +113,21 @@ enum {
  *</pre>
  */
 
+/**
+ * Simulcast layer. The filtered frame of the full layer is scaled down
+ * and encoded again, and sent with its own SSRC on the same stream.
+ */
+struct vlayer {
+	struct vtx *vtx;                   /**< Parent                    */
+	struct videnc_state *enc;          /**< Encoder of the layer      */
+	struct vidframe *frame;            /**< Scaled frame              */
+	uint32_t ssrc;                     /**< SSRC of the layer         */
+	uint16_t seq;                      /**< Next RTP sequence number  */
+	unsigned shift;                    /**< Size is full size >> shift*/
+	unsigned framec;                   /**< Number of frames encoded  */
+};
+
+
 /**
  * Video stream - transmitter/encoder direction
 
@@ -87,19 +149,79 @@ struct vtx {
 	struct videnc_state *enc;          /**< Video encoder state       */
 	struct vidsrc_prm vsrc_prm;        /**< Video source parameters   */
 	struct vidsz vsrc_size;            /**< Video source size         */
-	struct vidsrc_st *vsrc;            /**< Video source              */
+	struct vidhub_st *vsrc;            /**< Video source, shared      */
+	struct vidhub_st *vpres;           /**< Presentation source, warm */
+	struct vidsrc_prm vpres_prm;       /**< Presentation parameters   */
+	struct lock *lock_src;             /**< One source to the encoder */
+	bool present;                      /**< Sending the presentation  */
+	uint64_t ts_pres;                  /**< Last presentation [ms]    */
+	uint32_t ts_gap;                   /**< Unsent frames [1/SRATE]   */
 	struct lock *lock;                 /**< Lock for encoder          */
 	struct vidframe *frame;            /**< Source frame              */
 	struct vidframe *mute_frame;       /**< Frame with muted video    */
 	struct lock *lock_tx;              /**< Protect the sendq */
 	struct list sendq;                 /**< Tx-Queue (struct vidqent) */
-	struct tmr tmr_rtp;                /**< Timer for sending RTP     */
+	struct list rtxq;                  /**< Retransmissions, first    */
+	struct list freeq;                 /**< Pool of unused vidqent    */
+	unsigned freec;                    /**< Number of entries in pool */
+	struct twheel_tmr tmr_rtp;         /**< Timer for sending RTP     */
+	struct msched_job *job;            /**< Media scheduler job       */
+	struct pacer *pacer;               /**< Pacer for sending RTP     */
+	size_t sendq_bytes;                /**< Bytes in the sendq        */
+	uint32_t qdelay;                   /**< Last queue delay [ms]     */
+	uint32_t qdelay_max;               /**< Max queue delay [ms]      */
 	unsigned skipc;                    /**< Number of frames skipped */
+	unsigned skipc_queue;              /**< Skipped, queue too long   */
+	unsigned skipc_err;                /**< Skipped, processing error */
+	unsigned framec_copy;              /**< Frames copied for encoder */
+	char *enc_params;                  /**< Encoder format parameters */
+	uint32_t enc_bitrate;              /**< Current encoder bitrate   */
+	uint64_t ts_rate;                  /**< Last bitrate change [ms]  */
+	uint64_t ts_cong;                  /**< Last congested frame [ms] */
+	unsigned n_rate_down;              /**< Number of rate decreases  */
+	uint32_t remb;                     /**< Bitrate from REMB (atomic)*/
+	uint32_t cplx;                     /**< Complexity level (atomic) */
+	uint32_t cplx_enc;                 /**< Level applied to encoder  */
+	bool screen;                       /**< Content is slides         */
+	unsigned deg;                      /**< Degradation step          */
+	uint64_t ts_deg;                   /**< Last step change [ms]     */
+	uint64_t ts_press;                 /**< Last pressure [ms]        */
+	unsigned deg_skipq;                /**< skipc_queue at last check */
+	unsigned deg_framec;               /**< Frames, for decimation    */
+	unsigned n_deg_down;               /**< Number of steps down      */
+	unsigned n_deg_drop;               /**< Frames left out           */
+	struct vidframe *frame_deg;        /**< Frame at lower resolution */
+	struct allocstat alloc;            /**< Allocations per frame     */
+	struct allocstat alloc_send;       /**< Allocations per send poll */
+#ifdef HAVE_PTHREAD
+	struct {
+		pthread_t tid;             /**< Encoder thread            */
+		pthread_mutex_t mutex;     /**< Protects the queue        */
+		pthread_cond_t cond;       /**< Frame queued              */
+		struct vidframe *framev[ENCQ_SIZE]; /**< Queue, oldest first */
+		uint64_t tsv[ENCQ_SIZE];   /**< Queue time of frames [ms] */
+		struct vidframe *cur;      /**< Frame being encoded       */
+		unsigned n;                /**< Number of queued frames   */
+		bool run;                  /**< Encoder thread is running */
+		unsigned drops;            /**< Frames dropped, queue full*/
+		uint32_t lat;              /**< Last encode latency [ms]  */
+		uint32_t lat_max;          /**< Max encode latency [ms]   */
+	} ethr;
+#endif
 	struct list filtl;                 /**< Filters in encoding order */
+	struct vlayer layerv[SIMULCAST_MAX-1]; /**< Simulcast layers      */
+	unsigned layerc;                   /**< Number of extra layers    */
 	char device[64];
 	int muted_frames;                  /**< # of muted frames sent    */
 	uint32_t ts_tx;                    /**< Outgoing RTP timestamp    */
 	bool picup;                        /**< Send picture update       */
+	uint64_t ts_picup;                 /**< Last picup [ms] (atomic)  */
+	uint32_t n_picup;                  /**< Picture updates sent      */
+	uint32_t n_picup_merged;           /**< Requests merged into one  */
+	bool forwarded;                    /**< Sending forwarded (atomic)*/
+	bool pthru;                        /**< Sending source packets    */
+	uint32_t pthru_ts;                 /**< Timestamp offset to source*/
+	uint32_t n_pthru;                  /**< Access units passed on    */
 	bool muted;                        /**< Muted flag                */
 	int frames;                        /**< Number of frames sent     */
 	int efps;                          /**< Estimated frame-rate      */
@@ -130,10 +252,18 @@ struct vrx {
 	struct vidisp_st *vidisp;          /**< Video display             */
 	struct lock *lock;                 /**< Lock for decoder          */
 	struct list filtl;                 /**< Filters in decoding order */
+	struct vidframe *frame_filt;       /**< Decoded frame for filters */
+	struct vidframe *frame_small;      /**< Downscaled for display    */
+	uint64_t ts_disp;                  /**< Last frame displayed [ms] */
+	unsigned n_decim;                  /**< Frames not displayed      */
+	unsigned lowres;                   /**< Decoder size is 1/2^lowres*/
+	bool skip_nonref;                  /**< Decoder skips non-refs    */
 	enum vidorient orient;             /**< Display orientation       */
 	char device[64];
 	bool fullscreen;                   /**< Fullscreen flag           */
 	int pt_rx;                         /**< Incoming RTP payload type */
+	struct deccache decc;              /**< Idle decoders, by codec   */
+	struct allocstat alloc;            /**< Allocations per packet    */
 	int frames;                        /**< Number of frames received */
 	int efps;                          /**< Estimated frame-rate      */
 };
@@ -146,9 +276,18 @@ struct video {
 	struct stream *strm;    /**< Generic media stream                 */
 	struct vtx vtx;         /**< Transmit/encoder direction           */
 	struct vrx vrx;         /**< Receive/decoder direction            */
-	struct tmr tmr;         /**< Timer for frame-rate estimation      */
+	struct twheel_tmr tmr;  /**< Timer for frame-rate estimation      */
 	char *peer;             /**< Peer URI                             */
 	bool nack_pli;          /**< Send NACK/PLI to peer                */
+	struct video *fwd;      /**< Stream whose video is forwarded      */
+	struct le le_fwd;       /**< Entry in the forwarded stream        */
+	struct list fwdl;       /**< Streams that forward our video       */
+	uint32_t fwd_ts;        /**< Timestamp offset to the forwarded    */
+	uint32_t n_fwd;         /**< Number of forwarded packets sent     */
+	struct twheel_tmr tmr_fir;/**< Timer for aggregated FIR requests  */
+	uint64_t ts_fir;        /**< Last FIR sent [ms]                   */
+	uint32_t n_fir;         /**< FIRs sent                            */
+	uint32_t n_fir_merged;  /**< FIR requests merged into one         */
 	video_err_h *errh;
 	void *arg;
 };
@@ -156,11 +295,15 @@ struct video {
 
 struct vidqent {
 	struct le le;
+	struct vlayer *layer;   /**< Simulcast layer, NULL for the full one */
+	bool rtx;               /**< Retransmission, sent with RTX          */
 	struct sa dst;
 	bool marker;
 	uint8_t pt;
 	uint32_t ts;
 	struct mbuf *mb;
+	struct mbuf *mb_pool;   /**< Pooled buffer, mb unless handed over */
+	uint64_t ts_queued;     /**< Time when queued [ms] */
 };
 
 
@@ -169,32 +312,60 @@ static void vidqent_destructor(void *arg)
 	struct vidqent *qent = arg;
 
 	list_unlink(&qent->le);
-	mem_deref(qent->mb);
+	if (qent->mb != qent->mb_pool)
+		mem_deref(qent->mb);
+	mem_deref(qent->mb_pool);
 }
 
 
-static int vidqent_alloc(struct vidqent **qentp,
+/*
+ * Get a send-queue entry from the pool of the transmitter,
+ * or allocate a new one if the pool is empty.
+ *
+ * The packet is either copied from hdr/pld, or the entry takes
+ * a reference to mb which has RTP_PRESZ bytes of headroom.
+ */
+static int vidqent_alloc(struct vtx *vtx, struct vidqent **qentp,
 			 bool marker, uint8_t pt, uint32_t ts,
 			 const uint8_t *hdr, size_t hdr_len,
-			 const uint8_t *pld, size_t pld_len)
+			 const uint8_t *pld, size_t pld_len,
+			 struct mbuf *mb)
 {
-	struct vidqent *qent;
+	struct vidqent *qent = NULL;
 	int err = 0;
 
-	if (!qentp || !pld)
+	if (!qentp || (!pld && !mb))
 		return EINVAL;
 
-	qent = mem_zalloc(sizeof(*qent), vidqent_destructor);
-	if (!qent)
-		return ENOMEM;
+	lock_write_get(vtx->lock_tx);
+	if (vtx->freeq.head) {
+		qent = vtx->freeq.head->data;
+		list_unlink(&qent->le);
+		--vtx->freec;
+	}
+	lock_rel(vtx->lock_tx);
 
+	if (!qent) {
+		qent = mem_zalloc(sizeof(*qent), vidqent_destructor);
+		if (!qent)
+			return ENOMEM;
+
+		qent->mb_pool = mbuf_alloc(RTP_PRESZ + QENT_MTU + RTP_TRAILSZ);
+		if (!qent->mb_pool) {
+			err = ENOMEM;
+			goto out;
+		}
+		qent->mb = qent->mb_pool;
+	}
+
+	qent->layer  = NULL;
+	qent->rtx    = false;
 	qent->marker = marker;
 	qent->pt     = pt;
 	qent->ts     = ts;
 
-	qent->mb = mbuf_alloc(RTP_PRESZ + hdr_len + pld_len + RTP_TRAILSZ);
-	if (!qent->mb) {
-		err = ENOMEM;
+	if (mb) {
+		qent->mb = mem_ref(mb);
 		goto out;
 	}
 
@@ -217,10 +388,29 @@ static int vidqent_alloc(struct vidqent **qentp,
 }
 
 
-static void vidqueue_poll(struct vtx *vtx, uint64_t jfs, uint64_t prev_jfs)
+/* Return a sent entry to the pool, must be called with lock_tx held */
+static void vidqent_recycle(struct vtx *vtx, struct vidqent *qent)
+{
+	list_unlink(&qent->le);
+
+	if (qent->mb != qent->mb_pool) {
+		mem_deref(qent->mb);
+		qent->mb = qent->mb_pool;
+	}
+
+	if (vtx->freec >= QENT_POOL_MAX) {
+		mem_deref(qent);
+		return;
+	}
+
+	list_append(&vtx->freeq, &qent->le, qent);
+	++vtx->freec;
+}
+
+
+static void vidqueue_poll(struct vtx *vtx)
 {
-	size_t burst, sent;
-	uint64_t bandwidth_kbps;
+	uint64_t now = tmr_jiffies();
 	struct le *le;
 
 	if (!vtx)
@@ -228,36 +418,62 @@ static void vidqueue_poll(struct vtx *vtx, uint64_t jfs, uint64_t prev_jfs)
 
 	lock_write_get(vtx->lock_tx);
 
-	le = vtx->sendq.head;
-	if (!le)
+	if (!vtx->sendq.head && !vtx->rtxq.head)
 		goto out;
 
-	/*
-	 * time [ms] * bitrate [kbps] / 8 = bytes
-	 */
-	bandwidth_kbps = vtx->video->cfg.bitrate / 1000;
-	burst = (1 + jfs - prev_jfs) * bandwidth_kbps / 4;
+	allocstat_frame(&vtx->alloc_send);
 
-	burst = min(burst, BURST_MAX);
-	sent  = 0;
+	stream_send_batch_start(vtx->video->strm);
 
-	while (le) {
+	/* retransmissions first, they are late already */
+	while ((le = vtx->rtxq.head ? vtx->rtxq.head : vtx->sendq.head)) {
 
 		struct vidqent *qent = le->data;
+		size_t len = mbuf_get_left(qent->mb);
+		uint64_t ts = 0;
 
-		sent += mbuf_get_left(qent->mb);
+		if (!pacer_allow(vtx->pacer))
+			break;
 
-		stream_send(vtx->video->strm, qent->marker, qent->pt,
-			    qent->ts, qent->mb);
+		if (trace_active(vtx->video->strm->call))
+			ts = metric_time_us();
 
-		le = le->next;
-		mem_deref(qent);
+		PROBE4(video_send, call_id(vtx->video->strm->call), qent->ts,
+		       len, qent->rtx);
 
-		if (sent > burst) {
-			break;
+		if (qent->rtx) {
+			stream_send_rtx(vtx->video->strm, qent->marker,
+					qent->ts, qent->mb);
+		}
+		else if (qent->layer) {
+			stream_send_ssrc(vtx->video->strm, qent->layer->ssrc,
+					 qent->layer->seq++, qent->marker,
+					 qent->pt, qent->ts, qent->mb);
+		}
+		else {
+			stream_send(vtx->video->strm, qent->marker, qent->pt,
+				    qent->ts, qent->mb);
+		}
+
+		if (!qent->rtx) {
+			vtx->qdelay = (uint32_t)(now - qent->ts_queued);
+			vtx->qdelay_max = max(vtx->qdelay_max, vtx->qdelay);
 		}
+
+		if (ts)
+			trace_span(vtx->video->strm->call, true, TRACE_SEND,
+				   ts, metric_time_us());
+
+		pacer_sent(vtx->pacer, len);
+		vtx->sendq_bytes -= min(len, vtx->sendq_bytes);
+
+		vidqent_recycle(vtx, qent);
 	}
 
+	(void)stream_send_batch_flush(vtx->video->strm);
+
+	allocstat_stage(&vtx->alloc_send, ALLOC_RTP);
+
  out:
 	lock_rel(vtx->lock_tx);
 }
@@ -266,14 +482,46 @@ static void vidqueue_poll(struct vtx *vtx, uint64_t jfs, uint64_t prev_jfs)
 static void rtp_tmr_handler(void *arg)
 {
 	struct vtx *vtx = arg;
-	uint64_t pjfs;
 
-	pjfs = vtx->tmr_rtp.jfs;
+	twheel_tmr_start(&vtx->tmr_rtp, baresip_twheel(),
+			 1000/MEDIA_POLL_RATE, rtp_tmr_handler, vtx);
+
+	vidqueue_poll(vtx);
+}
+
+
+/* Media scheduler job, used instead of the RTP timer */
+static void rtp_job_handler(void *arg)
+{
+	struct vtx *vtx = arg;
+
+	vidqueue_poll(vtx);
+}
+
+
+#ifdef HAVE_PTHREAD
+static void enc_thread_stop(struct vtx *vtx)
+{
+	unsigned i;
+
+	if (!vtx->ethr.run)
+		return;
+
+	pthread_mutex_lock(&vtx->ethr.mutex);
+	vtx->ethr.run = false;
+	pthread_cond_signal(&vtx->ethr.cond);
+	pthread_mutex_unlock(&vtx->ethr.mutex);
+
+	pthread_join(vtx->ethr.tid, NULL);
 
-	tmr_start(&vtx->tmr_rtp, 1000/MEDIA_POLL_RATE, rtp_tmr_handler, vtx);
+	pthread_cond_destroy(&vtx->ethr.cond);
+	pthread_mutex_destroy(&vtx->ethr.mutex);
 
-	vidqueue_poll(vtx, vtx->tmr_rtp.jfs, pjfs);
+	for (i=0; i<ENCQ_SIZE; i++)
+		vtx->ethr.framev[i] = mem_deref(vtx->ethr.framev[i]);
+	vtx->ethr.cur = mem_deref(vtx->ethr.cur);
 }
+#endif
 
 
 static void video_destructor(void *arg)
@@ -281,32 +529,56 @@ static void video_destructor(void *arg)
 	struct video *v = arg;
 	struct vtx *vtx = &v->vtx;
 	struct vrx *vrx = &v->vrx;
+	unsigned i;
+
+	(void)video_forward(v, NULL);
+	while (v->fwdl.head)
+		(void)video_forward(v->fwdl.head->data, NULL);
+	twheel_tmr_cancel(&v->tmr_fir);
 
 	/* transmit */
+	mem_deref(vtx->vsrc);
+	mem_deref(vtx->vpres);
+#ifdef HAVE_PTHREAD
+	enc_thread_stop(vtx);
+#endif
+	mem_deref(vtx->job);
 	lock_write_get(vtx->lock_tx);
 	list_flush(&vtx->sendq);
+	list_flush(&vtx->rtxq);
+	list_flush(&vtx->freeq);
 	lock_rel(vtx->lock_tx);
 	mem_deref(vtx->lock_tx);
+	mem_deref(vtx->pacer);
 
-	tmr_cancel(&vtx->tmr_rtp);
-	mem_deref(vtx->vsrc);
+	twheel_tmr_cancel(&vtx->tmr_rtp);
 	lock_write_get(vtx->lock);
 	mem_deref(vtx->frame);
+	mem_deref(vtx->frame_deg);
 	mem_deref(vtx->mute_frame);
 	mem_deref(vtx->enc);
+	mem_deref(vtx->enc_params);
+	for (i=0; i<vtx->layerc; i++) {
+		mem_deref(vtx->layerv[i].enc);
+		mem_deref(vtx->layerv[i].frame);
+	}
 	list_flush(&vtx->filtl);
 	lock_rel(vtx->lock);
 	mem_deref(vtx->lock);
+	mem_deref(vtx->lock_src);
 
 	/* receive */
 	lock_write_get(vrx->lock);
 	mem_deref(vrx->dec);
+	deccache_flush(&vrx->decc);
 	mem_deref(vrx->vidisp);
+	mem_deref(vrx->frame_filt);
+	mem_deref(vrx->frame_small);
 	list_flush(&vrx->filtl);
 	lock_rel(vrx->lock);
 	mem_deref(vrx->lock);
 
-	tmr_cancel(&v->tmr);
+	twheel_tmr_cancel(&v->tmr);
 	mem_deref(v->strm);
 	mem_deref(v->peer);
 }
@@ -328,199 +600,1203 @@ static int get_fps(const struct video *v)
 }
 
 
-static int packet_handler(bool marker, const uint8_t *hdr, size_t hdr_len,
-			  const uint8_t *pld, size_t pld_len, void *arg)
+static uint32_t get_pktsize(const struct video *v)
 {
-	struct vtx *vtx = arg;
-	struct stream *strm = vtx->video->strm;
-	struct vidqent *qent;
-	int err;
+	return v->cfg.pktsize ? v->cfg.pktsize : PKTSIZE_DEFAULT;
+}
 
-	err = vidqent_alloc(&qent, marker, strm->pt_enc, vtx->ts_tx,
-			    hdr, hdr_len, pld, pld_len);
-	if (err)
-		return err;
+
+static void vidqueue_append(struct vtx *vtx, struct vidqent *qent)
+{
+	struct stream *strm = vtx->video->strm;
 
 	lock_write_get(vtx->lock_tx);
 	qent->dst = *sdp_media_raddr(strm->sdp);
+	qent->ts_queued = tmr_jiffies();
 	list_append(&vtx->sendq, &qent->le, qent);
+	vtx->sendq_bytes += mbuf_get_left(qent->mb);
 	lock_rel(vtx->lock_tx);
-
-	return err;
 }
 
 
-/**
- * Encode video and send via RTP stream
- *
- * @note This function has REAL-TIME properties
- *
- * @param vtx   Video transmit object
- * @param frame Video frame to send
- */
-static void encode_rtp_send(struct vtx *vtx, struct vidframe *frame)
+static int packet_handler(bool marker, const uint8_t *hdr, size_t hdr_len,
+			  const uint8_t *pld, size_t pld_len, void *arg)
 {
-	struct le *le;
-	int err = 0;
-	bool sendq_empty;
+	struct vtx *vtx = arg;
+	const struct call *call = vtx->video->strm->call;
+	struct vidqent *qent;
+	uint64_t ts = 0;
+	int err;
 
-	if (!vtx->enc)
-		return;
+	if (trace_active(call))
+		ts = metric_time_us();
 
-	lock_write_get(vtx->lock_tx);
-	sendq_empty = (vtx->sendq.head == NULL);
-	lock_rel(vtx->lock_tx);
+	err = vidqent_alloc(vtx, &qent, marker, vtx->video->strm->pt_enc,
+			    vtx->ts_tx, hdr, hdr_len, pld, pld_len, NULL);
+	if (err)
+		return err;
 
-	if (!sendq_empty) {
-		++vtx->skipc;
-		return;
-	}
+	vidqueue_append(vtx, qent);
 
-	lock_write_get(vtx->lock);
+	if (ts)
+		trace_span(call, true, TRACE_PACKETIZE, ts, metric_time_us());
 
-	/* Convert image */
-	if (frame->fmt != VIDENC_INTERNAL_FMT) {
+	return 0;
+}
 
-		vtx->vsrc_size = frame->size;
 
-		if (!vtx->frame) {
+/* Queue a packet built by the encoder, without copying it */
+static int packet_mb_handler(bool marker, struct mbuf *mb, void *arg)
+{
+	struct vtx *vtx = arg;
+	struct vidqent *qent;
+	int err;
 
-			err = vidframe_alloc(&vtx->frame, VIDENC_INTERNAL_FMT,
-					     &vtx->vsrc_size);
-			if (err)
-				goto unlock;
-		}
+	if (!mb)
+		return EINVAL;
 
-		vidconv(vtx->frame, frame, 0);
-		frame = vtx->frame;
+	if (mb->pos < RTP_PRESZ) {
+		return packet_handler(marker, NULL, 0,
+				      mbuf_buf(mb), mbuf_get_left(mb), arg);
 	}
 
-	/* Process video frame through all Video Filters */
-	for (le = vtx->filtl.head; le; le = le->next) {
+	err = vidqent_alloc(vtx, &qent, marker, vtx->video->strm->pt_enc,
+			    vtx->ts_tx, NULL, 0, NULL, 0, mb);
+	if (err)
+		return err;
 
-		struct vidfilt_enc_st *st = le->data;
+	vidqueue_append(vtx, qent);
 
-		if (st->vf && st->vf->ench)
-			err |= st->vf->ench(st, frame);
-	}
+	return 0;
+}
 
- unlock:
-	lock_rel(vtx->lock);
 
-	if (err)
-		return;
+/* Queue a packet of a simulcast layer */
+static int layer_packet_handler(bool marker, const uint8_t *hdr,
+				size_t hdr_len, const uint8_t *pld,
+				size_t pld_len, void *arg)
+{
+	struct vlayer *ly = arg;
+	struct vtx *vtx = ly->vtx;
+	struct vidqent *qent;
+	int err;
 
-	/* Encode the whole picture frame */
-	err = vtx->vc->ench(vtx->enc, vtx->picup, frame);
+	err = vidqent_alloc(vtx, &qent, marker, vtx->video->strm->pt_enc,
+			    vtx->ts_tx, hdr, hdr_len, pld, pld_len, NULL);
 	if (err)
-		return;
+		return err;
 
-	vtx->ts_tx += (SRATE/vtx->vsrc_prm.fps);
-	vtx->picup = false;
+	qent->layer = ly;
+
+	vidqueue_append(vtx, qent);
+
+	return 0;
 }
 
 
-/**
- * Read frames from video source
- *
- * @param frame Video frame
- * @param arg   Handler argument
- *
- * @note This function has REAL-TIME properties
+/*
+ * Update the encoders of the simulcast layers. Each layer has half
+ * the size and a quarter of the bitrate of the layer above it.
  */
-static void vidsrc_frame_handler(struct vidframe *frame, void *arg)
+static int layers_update(struct vtx *vtx, const struct vidcodec *vc,
+			 uint32_t bitrate)
 {
-	struct vtx *vtx = arg;
+	unsigned i;
+	int err = 0;
 
-	++vtx->frames;
+	for (i=0; i<vtx->layerc; i++) {
 
-	/* Is the video muted? If so insert video mute image */
-	if (vtx->muted)
-		frame = vtx->mute_frame;
+		struct vlayer *ly = &vtx->layerv[i];
+		struct videnc_param prm;
 
-	if (vtx->muted && vtx->muted_frames >= MAX_MUTED_FRAMES)
-		return;
+		prm.bitrate = bitrate >> (2 * ly->shift);
+		prm.pktsize = get_pktsize(vtx->video);
+		prm.fps     = get_fps(vtx->video);
+		prm.max_fs  = -1;
+		prm.pkth_mb = NULL;
 
-	/* Encode and send */
-	encode_rtp_send(vtx, frame);
-	vtx->muted_frames++;
+		if (vc != vtx->vc)
+			ly->enc = mem_deref(ly->enc);
+
+		err = vc->encupdh(&ly->enc, vc, &prm, vtx->enc_params,
+				  layer_packet_handler, ly);
+		if (err) {
+			warning("video: simulcast layer %u encoder: %m\n",
+				ly->shift, err);
+			break;
+		}
+	}
+
+	return err;
 }
 
 
-static void vidsrc_error_handler(int err, void *arg)
+/* Scale the frame of the full layer, and encode it for each layer */
+static void layers_encode(struct vtx *vtx, const struct vidframe *frame)
 {
-	struct vtx *vtx = arg;
+	unsigned i;
 
-	warning("video: video-source error: %m\n", err);
+	for (i=0; i<vtx->layerc; i++) {
 
-	vtx->vsrc = mem_deref(vtx->vsrc);
-}
+		struct vlayer *ly = &vtx->layerv[i];
+		struct vidsz sz;
+		int err;
 
+		if (!ly->enc)
+			continue;
 
-static int vtx_alloc(struct vtx *vtx, struct video *video)
-{
-	int err;
+		sz.w = (frame->size.w >> ly->shift) & ~1u;
+		sz.h = (frame->size.h >> ly->shift) & ~1u;
+		if (!sz.w || !sz.h)
+			continue;
 
-	err = lock_alloc(&vtx->lock);
-	err |= lock_alloc(&vtx->lock_tx);
-	if (err)
-		return err;
+		if (ly->frame && !vidsz_cmp(&ly->frame->size, &sz))
+			ly->frame = mem_deref(ly->frame);
 
-	tmr_init(&vtx->tmr_rtp);
+		if (!ly->frame) {
+			err = vidframe_alloc(&ly->frame, VIDENC_INTERNAL_FMT,
+					     &sz);
+			if (err)
+				continue;
+		}
 
-	vtx->video = video;
-	vtx->ts_tx = 160;
+		err = vidconv_scale(ly->frame, frame, NULL);
+		if (err)
+			continue;
 
-	str_ncpy(vtx->device, video->cfg.src_dev, sizeof(vtx->device));
+		err = vtx->vc->ench(ly->enc, vtx->picup, ly->frame);
+		if (!err)
+			++ly->framec;
+	}
+}
 
-	tmr_start(&vtx->tmr_rtp, 1, rtp_tmr_handler, vtx);
 
-	return err;
+/* Framerate of the source being sent */
+static int vtx_fps(const struct vtx *vtx)
+{
+	const int fps = vtx->present ? vtx->vpres_prm.fps : vtx->vsrc_prm.fps;
+
+	return max(fps, 1);
 }
 
 
-static int vrx_alloc(struct vrx *vrx, struct video *video)
+/* A step of degradation, the size in [1/4] and the frame-rate divisor */
+struct deg_step {
+	uint8_t scale;
+	uint8_t div;
+};
+
+
+/*
+ * Camera video keeps its frame-rate and loses resolution first. A screen
+ * keeps its resolution, so that text stays sharp, and loses frames.
+ */
+static const struct deg_step deg_motion[DEG_STEPS] = {
+	{4, 1}, {3, 1}, {2, 1}, {2, 2}
+};
+static const struct deg_step deg_screen[DEG_STEPS] = {
+	{4, 1}, {4, 2}, {4, 4}, {3, 4}
+};
+static const struct deg_step deg_framerate[DEG_STEPS] = {
+	{4, 1}, {4, 2}, {4, 3}, {4, 4}
+};
+static const struct deg_step deg_resolution[DEG_STEPS] = {
+	{4, 1}, {3, 1}, {2, 1}, {1, 1}
+};
+
+
+/* The steps of the configured policy, and of the content being sent */
+static const struct deg_step *vtx_deg_steps(const struct vtx *vtx)
 {
-	int err;
+	switch (vtx->video->cfg.degrade) {
 
-	err = lock_alloc(&vrx->lock);
-	if (err)
-		return err;
+	case VIDEO_DEGRADE_FRAMERATE:  return deg_framerate;
+	case VIDEO_DEGRADE_RESOLUTION: return deg_resolution;
+	default:
+		break;
+	}
 
-	vrx->video  = video;
-	vrx->pt_rx  = -1;
-	vrx->orient = VIDORIENT_PORTRAIT;
+	return vtx->screen || vtx->present ? deg_screen : deg_motion;
+}
 
-	str_ncpy(vrx->device, video->cfg.disp_dev, sizeof(vrx->device));
 
-	return err;
+static const struct deg_step *vtx_deg(const struct vtx *vtx)
+{
+	return &vtx_deg_steps(vtx)[vtx->deg];
 }
 
 
-/**
- * Decode incoming RTP packets using the Video decoder
- *
- * NOTE: mb=NULL if no packet received
- *
- * @param vrx Video receive object
- * @param hdr RTP Header
- * @param mb  Buffer with RTP payload
- *
- * @return 0 if success, otherwise errorcode
- */
-static int video_stream_decode(struct vrx *vrx, const struct rtp_header *hdr,
-			       struct mbuf *mb)
+static void vtx_set_enc_bitrate(struct vtx *vtx, uint32_t bitrate)
 {
-	struct video *v = vrx->video;
-	struct vidframe *frame_filt = NULL;
-	struct vidframe frame_store, *frame = &frame_store;
-	struct le *le;
-	int err = 0;
+	const unsigned div = vtx_deg(vtx)->div;
+	struct videnc_param prm;
+	int err;
 
-	if (!hdr || !mbuf_get_left(mb))
-		return 0;
+	prm.bitrate = bitrate;
+	prm.pktsize = get_pktsize(vtx->video);
+	prm.fps     = max(get_fps(vtx->video) / (int)div, 1);
+	prm.max_fs  = -1;
+	prm.pkth_mb = packet_mb_handler;
 
-	lock_write_get(vrx->lock);
+	lock_write_get(vtx->lock);
+
+	/* without restarting the encoder, if it can. It keeps its frame-rate,
+	   and gets the bits of div frames for each frame that is sent. */
+	if (vtx->vc->bitrateh && vtx->enc) {
+		err = vtx->vc->bitrateh(vtx->enc, bitrate * div);
+	}
+	else {
+		err = vtx->vc->encupdh(&vtx->enc, vtx->vc, &prm,
+				       vtx->enc_params, packet_handler, vtx);
+	}
+	if (!err) {
+		(void)layers_update(vtx, vtx->vc, bitrate * div);
+
+		/* the layers, or the encoder, may be new */
+		vtx->cplx_enc = UINT32_MAX;
+	}
+
+	lock_rel(vtx->lock);
+
+	if (err) {
+		warning("video: encoder update: %m\n", err);
+		return;
+	}
+
+	debug("video: encoder bitrate %u -> %u bit/s\n",
+	      vtx->enc_bitrate, bitrate);
+
+	vtx->enc_bitrate = bitrate;
+}
+
+
+/*
+ * Lower the encoder bitrate while the send queue stays congested,
+ * and raise it again slowly when the queue has been idle for a while.
+ * The receiver may limit the bitrate further with REMB.
+ */
+static void vtx_adapt_bitrate(struct vtx *vtx, uint32_t qdelay)
+{
+	const uint32_t remb = ATOMIC_LOAD(&vtx->remb);
+	uint32_t max_rate = vtx->video->cfg.bitrate;
+	const uint32_t min_rate = max_rate * RATE_MIN_PERCENT / 100;
+	uint64_t now = tmr_jiffies();
+
+	if (!vtx->enc_bitrate)
+		return;
+
+	if (remb)
+		max_rate = max(min(max_rate, remb), min_rate);
+
+	/* follow a lower REMB at once */
+	if (vtx->enc_bitrate > max_rate) {
+
+		vtx->ts_rate = now;
+		++vtx->n_rate_down;
+		vtx_set_enc_bitrate(vtx, max_rate);
+		return;
+	}
+
+	if (qdelay > QUEUE_CONG_MS)
+		vtx->ts_cong = now;
+
+	if (now - vtx->ts_rate < RATE_INTERVAL)
+		return;
+
+	if (qdelay > QUEUE_CONG_MS && vtx->enc_bitrate > min_rate) {
+
+		vtx->ts_rate = now;
+		++vtx->n_rate_down;
+		vtx_set_enc_bitrate(vtx, max(vtx->enc_bitrate * 3 / 4,
+					     min_rate));
+	}
+	else if (qdelay < QUEUE_IDLE_MS && vtx->enc_bitrate < max_rate &&
+		 now - vtx->ts_cong > RATE_RECOVER) {
+
+		vtx->ts_rate = now;
+		vtx_set_enc_bitrate(vtx, min(vtx->enc_bitrate * 11 / 10,
+					     max_rate));
+	}
+}
+
+
+/* Bits per 1000 pixels of a step, at the current encoder bitrate */
+static uint32_t deg_bpkp(const struct vtx *vtx, const struct vidsz *sz,
+			 const struct deg_step *step, int fps)
+{
+	const uint64_t px = (uint64_t)sz->w * step->scale * sz->h *
+		step->scale * fps / (DEG_SCALE_FULL * DEG_SCALE_FULL *
+				     step->div);
+
+	return px ? (uint32_t)((uint64_t)vtx->enc_bitrate * 1000 / px) :
+		UINT32_MAX;
+}
+
+
+/*
+ * Step the degradation of resolution and frame-rate down when the
+ * bitrate is too low for the pixel rate, the send queue has overflowed,
+ * the CPU governor has the encoder at its lowest complexity, or the
+ * encoder thread lags behind the frames. It steps up again
+ * after a while without pressure, if the bitrate is enough for the step
+ * above, with some margin. Below the last step the bitrate lowers the
+ * quality only. The frame-rate is changed without an encoder restart,
+ * and a new size restarts the encoder itself, so the steps are slow.
+ */
+static void vtx_degrade(struct vtx *vtx, const struct vidsz *sz)
+{
+	const struct deg_step *stepv = vtx_deg_steps(vtx);
+	const unsigned div = stepv[vtx->deg].div;
+	const int fps = vtx_fps(vtx);
+	const uint64_t now = tmr_jiffies();
+	bool press;
+
+	if (vtx->video->cfg.degrade == VIDEO_DEGRADE_OFF || !vtx->enc_bitrate)
+		return;
+
+	press = deg_bpkp(vtx, sz, &stepv[vtx->deg], fps) < DEG_BPKP_MIN ||
+		vtx->skipc_queue != vtx->deg_skipq;
+
+	if (ATOMIC_LOAD(&vtx->cplx) >= CPLX_LEVEL_MAX)
+		press = true;
+#ifdef HAVE_PTHREAD
+	/* set by the encoder thread, which is this one */
+	if (vtx->ethr.run && vtx->ethr.lat * (uint32_t)fps > 1000 * div)
+		press = true;
+#endif
+
+	vtx->deg_skipq = vtx->skipc_queue;
+
+	if (press)
+		vtx->ts_press = now;
+
+	if (now - vtx->ts_deg < DEG_INTERVAL)
+		return;
+
+	if (press && vtx->deg + 1 < DEG_STEPS) {
+
+		++vtx->deg;
+		++vtx->n_deg_down;
+	}
+	else if (!press && vtx->deg && now - vtx->ts_press > DEG_RECOVER &&
+		 deg_bpkp(vtx, sz, &stepv[vtx->deg - 1], fps) >=
+		 DEG_BPKP_MIN * 3 / 2) {
+
+		--vtx->deg;
+	}
+	else {
+		return;
+	}
+
+	vtx->ts_deg = now;
+
+	info("video: degradation step %u: %u/%u size, 1/%u frames\n",
+	     vtx->deg, stepv[vtx->deg].scale, DEG_SCALE_FULL,
+	     stepv[vtx->deg].div);
+
+	if (stepv[vtx->deg].div != div)
+		vtx_set_enc_bitrate(vtx, vtx->enc_bitrate);
+}
+
+
+/* Scale the frame to the size of the degradation step */
+static int vtx_scale(struct vtx *vtx, const struct vidframe *frame,
+		     unsigned scale)
+{
+	struct vidsz sz;
+	int err;
+
+	sz.w = (frame->size.w * scale / DEG_SCALE_FULL) & ~1u;
+	sz.h = (frame->size.h * scale / DEG_SCALE_FULL) & ~1u;
+	if (!sz.w || !sz.h)
+		return EINVAL;
+
+	if (vtx->frame_deg && !vidsz_cmp(&vtx->frame_deg->size, &sz))
+		vtx->frame_deg = mem_deref(vtx->frame_deg);
+
+	if (!vtx->frame_deg) {
+		err = vidframe_alloc(&vtx->frame_deg, VIDENC_INTERNAL_FMT,
+				     &sz);
+		if (err)
+			return err;
+	}
+
+	return vidconv_scale(vtx->frame_deg, frame, NULL);
+}
+
+
+/* Apply the complexity level to the encoder and the simulcast layers */
+static void vtx_apply_cplx(struct vtx *vtx)
+{
+	uint32_t cplx = ATOMIC_LOAD(&vtx->cplx);
+	unsigned i;
+
+	lock_write_get(vtx->lock);
+
+	if (!vtx->enc || !vtx->vc->cplxh || cplx == vtx->cplx_enc)
+		goto out;
+
+	(void)vtx->vc->cplxh(vtx->enc, cplx);
+
+	for (i=0; i<vtx->layerc; i++) {
+
+		if (vtx->layerv[i].enc)
+			(void)vtx->vc->cplxh(vtx->layerv[i].enc, cplx);
+	}
+
+	vtx->cplx_enc = cplx;
+
+ out:
+	lock_rel(vtx->lock);
+}
+
+
+/* True if no encode filter modifies the frame */
+static bool filters_readonly(const struct list *filtl)
+{
+	struct le *le;
+
+	for (le = list_head(filtl); le; le = le->next) {
+
+		struct vidfilt_enc_st *st = le->data;
+
+		if (st->vf && st->vf->ench && !st->vf->enc_readonly)
+			return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * True if the encoder takes frames of the format as they are. Filters
+ * and the scaling of simulcast layers work on the internal format.
+ */
+static bool enc_takes_fmt(const struct vtx *vtx, enum vidfmt fmt)
+{
+	if (fmt == VIDENC_INTERNAL_FMT)
+		return true;
+
+	return fmt == VID_FMT_NV12 && vtx->vc && vtx->vc->enc_nv12 &&
+		list_isempty(&vtx->filtl) && !vtx->layerc;
+}
+
+
+/* Format wanted from the source, VID_FMT_N for any */
+static enum vidfmt vtx_src_fmt(const struct vtx *vtx)
+{
+	/* native frames, only the ones the encoder can't take are
+	   converted in encode_rtp_send */
+	if (vtx->vc && vtx->vc->enc_nv12)
+		return VID_FMT_N;
+
+	return VIDENC_INTERNAL_FMT;
+}
+
+
+/**
+ * Encode video and send via RTP stream
+ *
+ * @note This function has REAL-TIME properties
+ *
+ * @param vtx   Video transmit object
+ * @param frame Video frame to send
+ * @param owned True if the frame is private and may be modified in place
+ */
+static void encode_rtp_send(struct vtx *vtx, struct vidframe *frame,
+			    bool owned)
+{
+	const struct call *call = vtx->video->strm->call;
+	const struct deg_step *deg;
+	struct le *le;
+	int err = 0;
+	uint32_t qdelay;
+	uint64_t ts, tt = 0;
+
+	PROBE3(video_encode, call_id(vtx->video->strm->call),
+	       frame->size.w, frame->size.h);
+
+	/* Time needed to send what is still queued */
+	lock_write_get(vtx->lock_tx);
+	qdelay = pacer_delay(vtx->pacer, vtx->sendq_bytes);
+	lock_rel(vtx->lock_tx);
+
+	vtx_adapt_bitrate(vtx, qdelay);
+	vtx_degrade(vtx, &frame->size);
+	vtx_apply_cplx(vtx);
+
+	/* a lower frame-rate, the timestamp goes on for the frames left out */
+	deg = vtx_deg(vtx);
+	if (deg->div > 1 && vtx->deg_framec++ % deg->div) {
+		++vtx->n_deg_drop;
+		ATOMIC_ADD(&vtx->ts_gap, SRATE / vtx_fps(vtx));
+		return;
+	}
+
+	if (qdelay > QUEUE_MAX_MS) {
+		++vtx->skipc;
+		++vtx->skipc_queue;
+		return;
+	}
+
+	lock_write_get(vtx->lock);
+
+	/* the encoder is gone if an update of it failed */
+	if (!vtx->enc) {
+		lock_rel(vtx->lock);
+		return;
+	}
+
+	allocstat_frame(&vtx->alloc);
+
+	if (trace_active(call))
+		tt = metric_time_us();
+
+	/* a lower resolution, scaled from the source frame */
+	if (deg->scale < DEG_SCALE_FULL && 0 == vtx_scale(vtx, frame,
+							  deg->scale)) {
+		frame = vtx->frame_deg;
+		owned = true;
+	}
+
+	/* Convert image, or copy it if a filter will modify the pixels.
+	 * Otherwise the source frame is passed on by reference. */
+	if (!enc_takes_fmt(vtx, frame->fmt) ||
+	    (!owned && !filters_readonly(&vtx->filtl))) {
+
+		vtx->vsrc_size = frame->size;
+
+		if (vtx->frame && !vidsz_cmp(&vtx->frame->size, &frame->size))
+			vtx->frame = mem_deref(vtx->frame);
+
+		if (!vtx->frame) {
+
+			err = vidframe_alloc(&vtx->frame, VIDENC_INTERNAL_FMT,
+					     &vtx->vsrc_size);
+			if (err)
+				goto unlock;
+		}
+
+		if (frame->fmt == VIDENC_INTERNAL_FMT)
+			vidframe_copy(vtx->frame, frame);
+		else
+			vidconv_fast(vtx->frame, frame, NULL);
+
+		frame = vtx->frame;
+		++vtx->framec_copy;
+
+		if (tt) {
+			ts = metric_time_us();
+			trace_span(call, true, TRACE_CONVERT, tt, ts);
+			tt = ts;
+		}
+
+		/* or from the converted frame, for the other formats */
+		if (deg->scale < DEG_SCALE_FULL &&
+		    0 == vtx_scale(vtx, frame, deg->scale))
+			frame = vtx->frame_deg;
+	}
+
+	allocstat_stage(&vtx->alloc, ALLOC_CONV);
+
+	/* Process video frame through all Video Filters */
+	for (le = vtx->filtl.head; le; le = le->next) {
+
+		struct vidfilt_enc_st *st = le->data;
+
+		if (st->vf && st->vf->ench)
+			err |= st->vf->ench(st, frame);
+	}
+
+	allocstat_stage(&vtx->alloc, ALLOC_FILT);
+
+	if (tt && !list_isempty(&vtx->filtl))
+		trace_span(call, true, TRACE_FILTER, tt, metric_time_us());
+
+	if (err)
+		goto unlock;
+
+	/* Encode the whole picture frame, the encoder may be updated
+	   from other threads */
+	ts = metric_time_us();
+	err = vtx->vc->ench(vtx->enc, vtx->picup, frame);
+	if (!err)
+		layers_encode(vtx, frame);
+	metric_add_proc(&vtx->video->strm->metric_tx, ts);
+	allocstat_stage(&vtx->alloc, ALLOC_CODEC);
+	trace_span(call, true, TRACE_ENCODE, ts, metric_time_us());
+
+ unlock:
+	lock_rel(vtx->lock);
+
+	if (err)
+		goto skip;
+
+	vtx->ts_tx += SRATE / vtx_fps(vtx) + ATOMIC_XCHG(&vtx->ts_gap, 0);
+	if (vtx->picup) {
+		ATOMIC_STORE(&vtx->ts_picup, tmr_jiffies());
+		vtx->picup = false;
+	}
+
+	return;
+
+ skip:
+	++vtx->skipc;
+	++vtx->skipc_err;
+}
+
+
+#ifdef HAVE_PTHREAD
+/* Encode the queued frames, outside the thread of the video source */
+static void *enc_thread(void *arg)
+{
+	struct vtx *vtx = arg;
+	unsigned i;
+
+	(void)realtime_thread("video_enc");
+
+	pthread_mutex_lock(&vtx->ethr.mutex);
+
+	while (vtx->ethr.run) {
+
+		struct vidframe *frame;
+		uint64_t ts;
+
+		if (!vtx->ethr.n) {
+			pthread_cond_wait(&vtx->ethr.cond, &vtx->ethr.mutex);
+			continue;
+		}
+
+		/* take the oldest frame, and keep the old one as spare */
+		frame = vtx->ethr.framev[0];
+		ts    = vtx->ethr.tsv[0];
+
+		for (i=1; i<ENCQ_SIZE; i++) {
+			vtx->ethr.framev[i-1] = vtx->ethr.framev[i];
+			vtx->ethr.tsv[i-1]    = vtx->ethr.tsv[i];
+		}
+		vtx->ethr.framev[ENCQ_SIZE-1] = vtx->ethr.cur;
+		vtx->ethr.cur = frame;
+		--vtx->ethr.n;
+
+		pthread_mutex_unlock(&vtx->ethr.mutex);
+
+		encode_rtp_send(vtx, frame, true);
+
+		pthread_mutex_lock(&vtx->ethr.mutex);
+
+		vtx->ethr.lat = (uint32_t)(tmr_jiffies() - ts);
+		vtx->ethr.lat_max = max(vtx->ethr.lat_max, vtx->ethr.lat);
+	}
+
+	pthread_mutex_unlock(&vtx->ethr.mutex);
+
+	return NULL;
+}
+
+
+static int enc_thread_start(struct vtx *vtx)
+{
+	int err;
+
+	pthread_mutex_init(&vtx->ethr.mutex, NULL);
+	pthread_cond_init(&vtx->ethr.cond, NULL);
+
+	vtx->ethr.run = true;
+
+	err = pthread_create(&vtx->ethr.tid, NULL, enc_thread, vtx);
+	if (err) {
+		vtx->ethr.run = false;
+		pthread_cond_destroy(&vtx->ethr.cond);
+		pthread_mutex_destroy(&vtx->ethr.mutex);
+	}
+
+	return err;
+}
+
+
+/* Copy the frame to the encoder queue, drop the oldest frame if full */
+static int enc_thread_queue(struct vtx *vtx, const struct vidframe *frame)
+{
+	struct vidframe **fp;
+	unsigned i;
+	int err = 0;
+
+	pthread_mutex_lock(&vtx->ethr.mutex);
+
+	if (vtx->ethr.n == ENCQ_SIZE) {
+
+		struct vidframe *oldest = vtx->ethr.framev[0];
+
+		for (i=1; i<ENCQ_SIZE; i++) {
+			vtx->ethr.framev[i-1] = vtx->ethr.framev[i];
+			vtx->ethr.tsv[i-1]    = vtx->ethr.tsv[i];
+		}
+		vtx->ethr.framev[ENCQ_SIZE-1] = oldest;
+		--vtx->ethr.n;
+		++vtx->ethr.drops;
+	}
+
+	fp = &vtx->ethr.framev[vtx->ethr.n];
+
+	if (*fp && ((*fp)->fmt != frame->fmt ||
+		    !vidsz_cmp(&(*fp)->size, &frame->size)))
+		*fp = mem_deref(*fp);
+
+	if (!*fp) {
+		err = vidframe_alloc(fp, frame->fmt, &frame->size);
+		if (err)
+			goto out;
+	}
+
+	vidframe_copy(*fp, frame);
+
+	vtx->ethr.tsv[vtx->ethr.n] = tmr_jiffies();
+	++vtx->ethr.n;
+
+	pthread_cond_signal(&vtx->ethr.cond);
+
+ out:
+	pthread_mutex_unlock(&vtx->ethr.mutex);
+
+	return err;
+}
+#endif
+
+
+/* A frame of the camera or the presentation, called with lock_src */
+static void vtx_frame(struct vtx *vtx, struct vidframe *frame)
+{
+	const struct call *call = vtx->video->strm->call;
+	uint64_t ts = 0;
+
+	++vtx->frames;
+
+	if (trace_active(call))
+		ts = metric_time_us();
+
+	/* Another stream's video is sent instead */
+	if (ATOMIC_LOAD(&vtx->forwarded))
+		return;
+
+	/* Is the video muted? If so insert video mute image */
+	if (vtx->muted)
+		frame = vtx->mute_frame;
+
+	if (vtx->muted && vtx->muted_frames >= MAX_MUTED_FRAMES)
+		return;
+
+	/* Encode and send */
+#ifdef HAVE_PTHREAD
+	if (vtx->ethr.run)
+		(void)enc_thread_queue(vtx, frame);
+	else
+#endif
+		encode_rtp_send(vtx, frame, false);
+	vtx->muted_frames++;
+
+	if (ts)
+		trace_span(call, true, TRACE_CAPTURE, ts, metric_time_us());
+}
+
+
+/**
+ * Read frames from video source
+ *
+ * @param frame Video frame
+ * @param arg   Handler argument
+ *
+ * @note This function has REAL-TIME properties
+ */
+static void vidsrc_frame_handler(struct vidframe *frame, void *arg)
+{
+	struct vtx *vtx = arg;
+
+	lock_write_get(vtx->lock_src);
+
+	if (!vtx->present)
+		vtx_frame(vtx, frame);
+
+	lock_rel(vtx->lock_src);
+}
+
+
+/*
+ * A source that only sends changed pictures, like x11grab with damage,
+ * leaves gaps between the frames. The timestamp of the next frame is
+ * moved on by the frames that were not sent.
+ */
+static void vidpres_frame_handler(struct vidframe *frame, void *arg)
+{
+	struct vtx *vtx = arg;
+	const uint64_t now = tmr_jiffies();
+
+	lock_write_get(vtx->lock_src);
+
+	if (vtx->present) {
+
+		const int fps = vtx_fps(vtx);
+		uint64_t n = 0;
+
+		if (vtx->ts_pres)
+			n = ((now - vtx->ts_pres) * fps + 500) / 1000;
+
+		if (n > 1) {
+			ATOMIC_ADD(&vtx->ts_gap,
+				   (uint32_t)(n - 1) * SRATE / fps);
+		}
+
+		vtx->ts_pres = now;
+
+		vtx_frame(vtx, frame);
+	}
+
+	lock_rel(vtx->lock_src);
+}
+
+
+/*
+ * Send an access unit of an encoded source as it is, if it is in the
+ * codec of the encoder. The timestamp continues from the last one the
+ * encoder has sent, and the encoder continues from the last access unit.
+ */
+static int vidsrc_packet_handler(const char *codec, const uint8_t *buf,
+				 size_t len, uint32_t ts, void *arg)
+{
+	struct vtx *vtx = arg;
+	int err;
+
+	/* the presentation is sent instead */
+	if (vtx->present) {
+		vtx->pthru = false;
+		return 0;
+	}
+
+	if (!vtx->vc || vtx->muted || str_casecmp(codec, "H264") ||
+	    str_casecmp(codec, vtx->vc->name)) {
+		vtx->pthru = false;
+		return ENOTSUP;
+	}
+
+	++vtx->frames;
+
+	/* Another stream's video is sent instead */
+	if (ATOMIC_LOAD(&vtx->forwarded)) {
+		vtx->pthru = false;
+		return 0;
+	}
+
+	if (!vtx->pthru) {
+		vtx->pthru_ts = vtx->ts_tx - ts;
+		vtx->pthru = true;
+	}
+
+	vtx->ts_tx = ts + vtx->pthru_ts;
+
+	err = h264_packetize(buf, len, get_pktsize(vtx->video),
+			     packet_handler, vtx);
+
+	vtx->ts_tx += SRATE / max(get_fps(vtx->video), 1);
+
+	if (err)
+		return err;
+
+	++vtx->n_pthru;
+
+	return 0;
+}
+
+
+static void vidsrc_error_handler(int err, void *arg)
+{
+	struct vtx *vtx = arg;
+
+	warning("video: video-source error: %m\n", err);
+
+	vtx->vsrc = mem_deref(vtx->vsrc);
+}
+
+
+static void vidpres_error_handler(int err, void *arg)
+{
+	struct vtx *vtx = arg;
+
+	warning("video: presentation source error: %m\n", err);
+
+	vtx->vpres = mem_deref(vtx->vpres);
+}
+
+
+static int vtx_alloc(struct vtx *vtx, struct video *video)
+{
+	uint32_t bitrate = video->cfg.bitrate;
+	uint32_t pacing = video->cfg.pacing_factor;
+	uint32_t burst  = video->cfg.burst_max;
+	unsigned i;
+	int err;
+
+	err = lock_alloc(&vtx->lock);
+	err |= lock_alloc(&vtx->lock_tx);
+	err |= lock_alloc(&vtx->lock_src);
+	if (err)
+		return err;
+
+	vtx->video = video;
+	vtx->ts_tx = 160;
+	vtx->vsrc_prm.pkth = vidsrc_packet_handler;
+
+	vtx->layerc = min(max(video->cfg.simulcast, 1), SIMULCAST_MAX) - 1;
+
+	for (i=0; i<vtx->layerc; i++) {
+
+		struct vlayer *ly = &vtx->layerv[i];
+
+		ly->vtx   = vtx;
+		ly->ssrc  = rand_u32();
+		ly->seq   = rand_u16();
+		ly->shift = i + 1;
+
+		/* the pacer sends all layers */
+		bitrate += video->cfg.bitrate >> (2 * ly->shift);
+	}
+
+	str_ncpy(vtx->device, video->cfg.src_dev, sizeof(vtx->device));
+
+	/* the pacer needs both, and a bad value must not fail the call */
+	if (!pacing || !burst) {
+		warning("video: video_pacing_factor and video_burst_max"
+			" must not be 0, using %u%% and %u bytes\n",
+			pacing ? pacing : PACING_DEFAULT,
+			burst ? burst : BURST_DEFAULT);
+
+		if (!pacing)
+			pacing = PACING_DEFAULT;
+		if (!burst)
+			burst = BURST_DEFAULT;
+	}
+
+	err = pacer_alloc(&vtx->pacer, bitrate, pacing, burst);
+	if (err)
+		return err;
+
+#ifdef HAVE_PTHREAD
+	if (video->cfg.enc_thread) {
+		err = enc_thread_start(vtx);
+		if (err)
+			return err;
+	}
+#endif
+
+#ifdef HAVE_PTHREAD
+	if (baresip_msched()) {
+		return msched_job_alloc(&vtx->job, baresip_msched(),
+					1000/MEDIA_POLL_RATE,
+					rtp_job_handler, vtx);
+	}
+#endif
+
+	twheel_tmr_start(&vtx->tmr_rtp, baresip_twheel(), 1,
+			 rtp_tmr_handler, vtx);
+
+	return err;
+}
+
+
+static int vrx_alloc(struct vrx *vrx, struct video *video)
+{
+	int err;
+
+	err = lock_alloc(&vrx->lock);
+	if (err)
+		return err;
+
+	vrx->video  = video;
+	vrx->pt_rx  = -1;
+	vrx->orient = VIDORIENT_PORTRAIT;
+
+	str_ncpy(vrx->device, video->cfg.disp_dev, sizeof(vrx->device));
+
+	return err;
+}
+
+
+static void fir_tmr_handler(void *arg);
+
+
+/*
+ * Ask the peer for a key frame. Requests from decode errors and from
+ * all streams that forward this one are combined into one per FIR_MIN,
+ * the last of them is sent when the interval has passed.
+ */
+static void fir_request(struct video *v)
+{
+	uint64_t now = tmr_jiffies();
+
+	if (now - v->ts_fir < FIR_MIN) {
+
+		++v->n_fir_merged;
+
+		if (!twheel_tmr_isrunning(&v->tmr_fir)) {
+			twheel_tmr_start(&v->tmr_fir, baresip_twheel(),
+					 FIR_MIN - (now - v->ts_fir),
+					 fir_tmr_handler, v);
+		}
+		return;
+	}
+
+	twheel_tmr_cancel(&v->tmr_fir);
+
+	v->ts_fir = now;
+	++v->n_fir;
+
+	stream_send_fir(v->strm, v->nack_pli);
+}
+
+
+static void fir_tmr_handler(void *arg)
+{
+	struct video *v = arg;
+
+	/* the timer stands for a merged request */
+	--v->n_fir_merged;
+
+	fir_request(v);
+}
+
+
+/*
+ * Ask the decoder for a smaller picture, and to skip pictures that are
+ * not references, if the display shows less than is decoded
+ */
+static void vrx_decoder_limit(struct vrx *vrx, const struct vidsz *size)
+{
+	const struct vidisp_prm *prm = &vrx->vidisp_prm;
+	unsigned lowres = 0, w, h;
+	bool skip;
+
+	if (!vrx->vc->lowresh)
+		return;
+
+	/* the size of the full picture */
+	w = size->w << vrx->lowres;
+	h = size->h << vrx->lowres;
+
+	while (prm->width && prm->height && lowres < 3 &&
+	       (w >> (lowres + 1)) >= prm->width &&
+	       (h >> (lowres + 1)) >= prm->height)
+		++lowres;
+
+	skip = prm->fps && vrx->efps > (int)prm->fps;
+
+	if (lowres == vrx->lowres && skip == vrx->skip_nonref)
+		return;
+
+	if (vrx->vc->lowresh(vrx->dec, lowres, skip))
+		return;
+
+	debug("video: decoding at 1/%u size%s\n", 1u << lowres,
+	      skip ? ", reference pictures only" : "");
+
+	vrx->lowres      = lowres;
+	vrx->skip_nonref = skip;
+}
+
+
+/* True if the frame comes too early for the framerate of the display */
+static bool vrx_decimate(struct vrx *vrx)
+{
+	const unsigned fps = vrx->vidisp_prm.fps;
+	uint64_t now, interval;
+
+	if (!fps)
+		return false;
+
+	now = tmr_jiffies();
+	interval = 1000 / fps;
+
+	/* a quarter of an interval early is on time, for jitter */
+	if (vrx->ts_disp && now + interval/4 < vrx->ts_disp + interval)
+		return true;
+
+	vrx->ts_disp = now;
+
+	return false;
+}
+
+
+/*
+ * Scale the frame down to the largest size of the display, before the
+ * filters and the display convert it in full size
+ */
+static int vrx_downscale(struct vrx *vrx, struct vidframe **framep)
+{
+	const struct vidisp_prm *prm = &vrx->vidisp_prm;
+	const struct vidframe *frame = *framep;
+	struct vidsz sz;
+	int err;
+
+	if (!prm->width || !prm->height ||
+	    (frame->size.w <= prm->width && frame->size.h <= prm->height))
+		return ENOENT;
+
+	/* keep the aspect ratio, even for the chroma planes */
+	if ((uint64_t)frame->size.w * prm->height >
+	    (uint64_t)frame->size.h * prm->width) {
+		sz.w = prm->width;
+		sz.h = (unsigned)((uint64_t)frame->size.h * prm->width /
+				  frame->size.w);
+	}
+	else {
+		sz.h = prm->height;
+		sz.w = (unsigned)((uint64_t)frame->size.w * prm->height /
+				  frame->size.h);
+	}
+
+	sz.w = max(sz.w & ~1u, 2);
+	sz.h = max(sz.h & ~1u, 2);
+
+	if (vrx->frame_small && !vidsz_cmp(&vrx->frame_small->size, &sz))
+		vrx->frame_small = mem_deref(vrx->frame_small);
+
+	if (!vrx->frame_small) {
+		err = vidframe_alloc(&vrx->frame_small, VID_FMT_YUV420P, &sz);
+		if (err)
+			return err;
+	}
+
+	if (vidconv_scale(vrx->frame_small, frame, NULL))
+		vidconv(vrx->frame_small, frame, NULL);
+
+	*framep = vrx->frame_small;
+
+	return 0;
+}
+
+
+/**
+ * Decode incoming RTP packets using the Video decoder
+ *
+ * NOTE: mb=NULL if no packet received
+ *
+ * @param vrx Video receive object
+ * @param hdr RTP Header
+ * @param mb  Buffer with RTP payload
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+static int video_stream_decode(struct vrx *vrx, const struct rtp_header *hdr,
+			       struct mbuf *mb)
+{
+	struct video *v = vrx->video;
+	struct vidframe frame_store, *frame = &frame_store;
+	struct le *le;
+	uint64_t ts, now;
+	int err = 0;
+
+	if (!hdr || !mbuf_get_left(mb))
+		return 0;
+
+	lock_write_get(vrx->lock);
 
 	/* No decoder set */
 	if (!vrx->dec) {
@@ -528,8 +1804,20 @@ static int video_stream_decode(struct vrx *vrx, const struct rtp_header *hdr,
 		goto out;
 	}
 
+	allocstat_frame(&vrx->alloc);
+
 	frame->data[0] = NULL;
+	ts = metric_time_us();
 	err = vrx->vc->dech(vrx->dec, frame, hdr->m, hdr->seq, mb);
+	allocstat_stage(&vrx->alloc, ALLOC_CODEC);
+
+	now = metric_time_us();
+	trace_span(v->strm->call, true, TRACE_DECODE, ts, now);
+	ts = now;
+
+	/* the decoder only assembles packets until the marker */
+	if (hdr->m)
+		metric_add_proc(&v->strm->metric_rx, ts);
 	if (err) {
 
 		if (err != EPROTO) {
@@ -540,7 +1828,7 @@ static int video_stream_decode(struct vrx *vrx, const struct rtp_header *hdr,
 		}
 
 		/* send RTCP FIR to peer */
-		stream_send_fir(v->strm, v->nack_pli);
+		fir_request(v);
 
 		/* XXX: if RTCP is not enabled, send XML in SIP INFO ? */
 
@@ -551,15 +1839,34 @@ static int video_stream_decode(struct vrx *vrx, const struct rtp_header *hdr,
 	if (!vidframe_isvalid(frame))
 		goto out;
 
-	if (!list_isempty(&vrx->filtl)) {
+	vrx_decoder_limit(vrx, &frame->size);
 
-		err = vidframe_alloc(&frame_filt, frame->fmt, &frame->size);
-		if (err)
-			goto out;
+	if (vrx_decimate(vrx)) {
+		++vrx->frames;
+		++vrx->n_decim;
+		goto out;
+	}
+
+	/* The filters get a copy, which is kept for the next frame,
+	 * or the downscaled frame, which is a copy already */
+	if (vrx_downscale(vrx, &frame) && !list_isempty(&vrx->filtl)) {
+
+		struct vidframe *ff = vrx->frame_filt;
+
+		if (ff && (ff->fmt != frame->fmt ||
+			   !vidsz_cmp(&ff->size, &frame->size)))
+			vrx->frame_filt = mem_deref(vrx->frame_filt);
 
-		vidframe_copy(frame_filt, frame);
+		if (!vrx->frame_filt) {
+			err = vidframe_alloc(&vrx->frame_filt, frame->fmt,
+					     &frame->size);
+			if (err)
+				goto out;
+		}
 
-		frame = frame_filt;
+		vidframe_copy(vrx->frame_filt, frame);
+
+		frame = vrx->frame_filt;
 	}
 
 	/* Process video frame through all Video Filters */
@@ -571,8 +1878,16 @@ static int video_stream_decode(struct vrx *vrx, const struct rtp_header *hdr,
 			err |= st->vf->dech(st, frame);
 	}
 
+	allocstat_stage(&vrx->alloc, ALLOC_FILT);
+
+	now = metric_time_us();
+	trace_span(v->strm->call, true, TRACE_FILTER, ts, now);
+	ts = now;
+
 	err = vidisp_display(vrx->vidisp, v->peer, frame);
-	frame_filt = mem_deref(frame_filt);
+	allocstat_stage(&vrx->alloc, ALLOC_DEVICE);
+
+	trace_span(v->strm->call, true, TRACE_DISPLAY, ts, metric_time_us());
 	if (err == ENODEV) {
 		warning("video: video-display was closed\n");
 		vrx->vidisp = mem_deref(vrx->vidisp);
@@ -599,7 +1914,7 @@ static int pt_handler(struct video *v, uint8_t pt_old, uint8_t pt_new)
 {
 	const struct sdp_format *lc;
 
-	lc = sdp_media_lformat(stream_sdpmedia(v->strm), pt_new);
+	lc = stream_lformat(v->strm, pt_new);
 	if (!lc)
 		return ENOENT;
 
@@ -614,6 +1929,74 @@ static int pt_handler(struct video *v, uint8_t pt_old, uint8_t pt_new)
 }
 
 
+static bool fwd_match(const struct video *v)
+{
+	const struct vidcodec *dec = v->fwd->vrx.vc;
+	const struct vidcodec *enc = v->vtx.vc;
+
+	return dec && enc && 0 == str_casecmp(dec->name, enc->name);
+}
+
+
+/* Let the stream encode its own video again */
+static void fwd_release(struct video *v)
+{
+	struct vtx *vtx = &v->vtx;
+
+	if (!ATOMIC_LOAD(&vtx->forwarded))
+		return;
+
+	ATOMIC_STORE(&vtx->forwarded, false);
+	vtx->picup = true;
+}
+
+
+/*
+ * Send a received packet on the streams that forward it. The RTP
+ * socket of each stream sets its own SSRC and sequence number, and
+ * the timestamp continues from the last one the stream has sent.
+ */
+static void fwd_send(struct video *src, const struct rtp_header *hdr,
+		     struct mbuf *mb)
+{
+	struct le *le;
+
+	for (le = src->fwdl.head; le; le = le->next) {
+
+		struct video *v = le->data;
+		struct vtx *vtx = &v->vtx;
+		struct vidqent *qent;
+		uint32_t ts;
+		int err;
+
+		if (!fwd_match(v)) {
+			fwd_release(v);
+			continue;
+		}
+
+		if (!ATOMIC_LOAD(&vtx->forwarded)) {
+			v->fwd_ts = vtx->ts_tx - hdr->ts;
+			ATOMIC_STORE(&vtx->forwarded, true);
+		}
+
+		ts = hdr->ts + v->fwd_ts;
+
+		err = vidqent_alloc(vtx, &qent, hdr->m, v->strm->pt_enc, ts,
+				    NULL, 0, mbuf_buf(mb), mbuf_get_left(mb),
+				    NULL);
+		if (err)
+			continue;
+
+		vidqueue_append(vtx, qent);
+		++v->n_fwd;
+
+		/* where the encoder continues if forwarding stops */
+		if (hdr->m)
+			vtx->ts_tx = ts + SRATE / max(get_fps(v), 1);
+	}
+}
+
+
 /* Handle incoming stream data from the network */
 static void stream_recv_handler(const struct rtp_header *hdr,
 				struct mbuf *mb, void *arg)
@@ -624,6 +2007,9 @@ static void stream_recv_handler(const struct rtp_header *hdr,
 	if (!mb)
 		goto out;
 
+	if (v->fwdl.head && mbuf_get_left(mb))
+		fwd_send(v, hdr, mb);
+
 	/* Video payload-type changed? */
 	if (hdr->pt == v->vrx.pt_rx)
 		goto out;
@@ -632,8 +2018,102 @@ static void stream_recv_handler(const struct rtp_header *hdr,
 	if (err)
 		return;
 
- out:
-	(void)video_stream_decode(&v->vrx, hdr, mb);
+ out:
+	(void)video_stream_decode(&v->vrx, hdr, mb);
+}
+
+
+/*
+ * A picture update for forwarded video is requested from its source.
+ * Requests while one is pending, or within one frame interval of the
+ * last one, are served by the same key frame. A signalling request is
+ * held off longer, since it is not sent for a lost packet and a peer
+ * may repeat it.
+ */
+static void picup_request(struct video *v, uint32_t hold)
+{
+	struct vtx *vtx = &v->vtx;
+	uint64_t now;
+
+	if (ATOMIC_LOAD(&vtx->forwarded)) {
+		fir_request(v->fwd);
+		return;
+	}
+
+	now = tmr_jiffies();
+
+	hold = max(hold, 1000u / (unsigned)max(get_fps(v), 1));
+
+	if (vtx->picup || now - ATOMIC_LOAD(&vtx->ts_picup) < hold) {
+		++vtx->n_picup_merged;
+		return;
+	}
+
+	++vtx->n_picup;
+	vtx->picup = true;
+}
+
+
+/* Queue a retransmission of a sent packet */
+static int rtx_queue(struct vtx *vtx, uint16_t seq)
+{
+	struct vidqent *qent;
+	struct mbuf *mb;
+	uint32_t ts;
+	bool marker;
+	int err;
+
+	err = stream_rtx_encode(vtx->video->strm, seq, RTP_PRESZ, &mb,
+				&marker, &ts);
+	if (err)
+		return err;
+
+	err = vidqent_alloc(vtx, &qent, marker, 0, ts, NULL, 0, NULL, 0, mb);
+	mem_deref(mb);
+	if (err)
+		return err;
+
+	qent->rtx = true;
+
+	lock_write_get(vtx->lock_tx);
+	qent->ts_queued = tmr_jiffies();
+	list_append(&vtx->rtxq, &qent->le, qent);
+	vtx->sendq_bytes += mbuf_get_left(qent->mb);
+	lock_rel(vtx->lock_tx);
+
+	return 0;
+}
+
+
+/*
+ * Retransmit the packets of a generic NACK (RFC 4585). A picture update
+ * is sent instead if the peer has no RTX, or a packet is too old.
+ */
+static void nack_handler(struct video *v, const struct rtcp_msg *msg)
+{
+	bool picup = false;
+	uint32_t i;
+
+	for (i=0; i<msg->r.fb.n; i++) {
+
+		const struct gnack *nack = &msg->r.fb.fci.gnackv[i];
+		int j;
+
+		for (j=-1; j<16; j++) {
+
+			int err;
+
+			if (j >= 0 && !(nack->blp & (1 << j)))
+				continue;
+
+			err = rtx_queue(&v->vtx, nack->pid + j + 1);
+			if (err == ENOTSUP || err == ENOENT || err == ENOMEM)
+				picup = true;
+		}
+	}
+
+	if (picup)
+		picup_request(v, 0);
 }
 
 
@@ -644,17 +2124,24 @@ static void rtcp_handler(struct rtcp_msg *msg, void *arg)
 	switch (msg->hdr.pt) {
 
 	case RTCP_FIR:
-		v->vtx.picup = true;
+		picup_request(v, 0);
 		break;
 
 	case RTCP_PSFB:
-		if (msg->hdr.count == RTCP_PSFB_PLI)
-			v->vtx.picup = true;
+		if (msg->hdr.count == RTCP_PSFB_PLI) {
+			picup_request(v, 0);
+		}
+		else if (msg->hdr.count == RTCP_PSFB_AFB) {
+			uint32_t bitrate;
+
+			if (0 == bwe_remb_decode(&bitrate, msg->r.fb.fci.afb))
+				ATOMIC_STORE(&v->vtx.remb, bitrate);
+		}
 		break;
 
 	case RTCP_RTPFB:
 		if (msg->hdr.count == RTCP_RTPFB_GNACK)
-			v->vtx.picup = true;
+			nack_handler(v, msg);
 		break;
 
 	default:
@@ -666,13 +2153,13 @@ static void rtcp_handler(struct rtcp_msg *msg, void *arg)
 static int vtx_print_pipeline(struct re_printf *pf, const struct vtx *vtx)
 {
 	struct le *le;
-	struct vidsrc *vs;
+	const struct vidsrc *vs;
 	int err;
 
 	if (!vtx)
 		return 0;
 
-	vs = vidsrc_get(vtx->vsrc);
+	vs = vidhub_vidsrc(vtx->vsrc);
 
 	err = re_hprintf(pf, "video tx pipeline: %10s",
 			 vs ? vs->name : "src");
@@ -719,6 +2206,88 @@ static int vrx_print_pipeline(struct re_printf *pf, const struct vrx *vrx)
 }
 
 
+/* Add an RTX format for each video codec, and the FID group (RFC 4588) */
+static int rtx_sdp(struct video *v)
+{
+	struct sdp_media *sdp = stream_sdpmedia(v->strm);
+	struct le *le;
+	int err = 0;
+
+	for (le = list_head(sdp_media_format_lst(sdp, true)); le;
+	     le = le->next) {
+
+		const struct sdp_format *fmt = le->data;
+
+		/* the new formats are appended to this list */
+		if (!fmt->data)
+			continue;
+
+		err |= sdp_format_add(NULL, sdp, false, NULL, "rtx", SRATE, 1,
+				      NULL, NULL, NULL, false,
+				      "apt=%s", fmt->id);
+	}
+
+	err |= sdp_media_set_lattr(sdp, false, "ssrc", "%u cname:%s",
+				   v->strm->rtx_ssrc, v->strm->cname);
+	err |= sdp_media_set_lattr(sdp, false, "ssrc-group", "FID %u %u",
+				   rtp_sess_ssrc(v->strm->rtp),
+				   v->strm->rtx_ssrc);
+
+	return err;
+}
+
+
+/* Add the FlexFEC format and the FEC-FR group (RFC 8627) */
+static int fec_sdp(struct video *v)
+{
+	struct sdp_media *sdp = stream_sdpmedia(v->strm);
+	int err;
+
+	err  = sdp_format_add(NULL, sdp, false, NULL, "flexfec", SRATE, 1,
+			      NULL, NULL, NULL, false,
+			      "repair-window=%u", FEC_REPAIR_WINDOW);
+	err |= sdp_media_set_lattr(sdp, false, "ssrc", "%u cname:%s",
+				   v->strm->fec_ssrc, v->strm->cname);
+	err |= sdp_media_set_lattr(sdp, false, "ssrc-group", "FEC-FR %u %u",
+				   rtp_sess_ssrc(v->strm->rtp),
+				   v->strm->fec_ssrc);
+
+	return err;
+}
+
+
+/*
+ * Signal the SSRCs of the layers as a simulcast group (RFC 5576),
+ * lowest resolution first
+ */
+static int simulcast_sdp(struct video *v)
+{
+	struct sdp_media *sdp = stream_sdpmedia(v->strm);
+	const struct vtx *vtx = &v->vtx;
+	char group[64] = "SIM";
+	size_t n = 3;
+	int i, err = 0;
+
+	for (i=(int)vtx->layerc-1; i>=0; i--) {
+
+		const struct vlayer *ly = &vtx->layerv[i];
+
+		err |= sdp_media_set_lattr(sdp, false, "ssrc", "%u cname:%s",
+					   ly->ssrc, v->strm->cname);
+
+		n += re_snprintf(group + n, sizeof(group) - n, " %u",
+				 ly->ssrc);
+	}
+
+	(void)re_snprintf(group + n, sizeof(group) - n, " %u",
+			  rtp_sess_ssrc(v->strm->rtp));
+
+	err |= sdp_media_set_lattr(sdp, true, "ssrc-group", "%s", group);
+
+	return err;
+}
+
+
 int video_alloc(struct video **vp, const struct config *cfg,
 		struct call *call, struct sdp_session *sdp_sess, int label,
 		const struct mnat *mnat, struct mnat_sess *mnat_sess,
@@ -740,7 +2309,6 @@ int video_alloc(struct video **vp, const struct config *cfg,
 	MAGIC_INIT(v);
 
 	v->cfg = cfg->video;
-	tmr_init(&v->tmr);
 
 	err = stream_alloc(&v->strm, &cfg->avt, call, sdp_sess, "video", label,
 			   mnat, mnat_sess, menc, menc_sess,
@@ -760,7 +2328,12 @@ int video_alloc(struct video **vp, const struct config *cfg,
 	err |= sdp_media_set_lattr(stream_sdpmedia(v->strm), true,
 				   "rtcp-fb", "* nack pli");
 
+	/* draft-alvestrand-rmcat-remb */
+	err |= sdp_media_set_lattr(stream_sdpmedia(v->strm), false,
+				   "rtcp-fb", "* goog-remb");
+
 	/* RFC 4796 */
+	v->vtx.screen = content && 0 == str_casecmp(content, "slides");
 	if (content) {
 		err |= sdp_media_set_lattr(stream_sdpmedia(v->strm), true,
 					   "content", "%s", content);
@@ -777,6 +2350,12 @@ int video_alloc(struct video **vp, const struct config *cfg,
 	if (err)
 		goto out;
 
+	if (v->vtx.layerc) {
+		err = simulcast_sdp(v);
+		if (err)
+			goto out;
+	}
+
 	/* Video codecs */
 	for (le = list_head(vidcodecl); le; le = le->next) {
 		struct vidcodec *vc = le->data;
@@ -786,6 +2365,28 @@ int video_alloc(struct video **vp, const struct config *cfg,
 				      "%s", vc->fmtp);
 	}
 
+	/* RFC 4588, the history is only used when the peer has RTX */
+	if (!err && cfg->avt.rtcp_enable) {
+
+		err = stream_enable_rtx(v->strm, v->cfg.bitrate / 4);
+		if (!err)
+			err = rtx_sdp(v);
+	}
+
+	/* the send time and sequence number for bandwidth estimation */
+	if (!err)
+		err = stream_enable_rtpext(v->strm, RTPEXT_ABS_SEND_TIME);
+	if (!err)
+		err = stream_enable_rtpext(v->strm, RTPEXT_TRANSPORT_CC);
+
+	/* RFC 8627, repair packets are only sent when the peer has FEC */
+	if (!err && v->cfg.fec) {
+
+		err = stream_enable_fec(v->strm, v->cfg.fec);
+		if (!err)
+			err = fec_sdp(v);
+	}
+
 	/* Video filters */
 	for (le = list_head(vidfilt_list()); le; le = le->next) {
 		struct vidfilt *vf = le->data;
@@ -829,6 +2430,13 @@ static int set_vidisp(struct vrx *vrx)
 	vrx->vidisp = mem_deref(vrx->vidisp);
 	vrx->vidisp_prm.view = NULL;
 
+	/* one display for all calls */
+	if (vrx->video->cfg.layout != VIDCOMP_NONE) {
+		return vidcomp_alloc(&vrx->vidisp, vrx->video->cfg.disp_mod,
+				     &vrx->vidisp_prm, vrx->device,
+				     vrx->video->cfg.layout);
+	}
+
 	vd = (struct vidisp *)vidisp_find(vrx->video->cfg.disp_mod);
 	if (!vd)
 		return ENOENT;
@@ -842,21 +2450,17 @@ static int set_vidisp(struct vrx *vrx)
 static int set_encoder_format(struct vtx *vtx, const char *src,
 			      const char *dev, struct vidsz *size)
 {
-	struct vidsrc *vs = (struct vidsrc *)vidsrc_find(src);
 	int err;
 
-	if (!vs)
-		return ENOENT;
-
 	vtx->vsrc_size       = *size;
 	vtx->vsrc_prm.fps    = get_fps(vtx->video);
 	vtx->vsrc_prm.orient = VIDORIENT_PORTRAIT;
 
 	vtx->vsrc = mem_deref(vtx->vsrc);
 
-	err = vs->alloch(&vtx->vsrc, vs, NULL, &vtx->vsrc_prm,
-			 &vtx->vsrc_size, NULL, dev, vidsrc_frame_handler,
-			 vidsrc_error_handler, vtx);
+	err = vidhub_alloc(&vtx->vsrc, src, &vtx->vsrc_prm, &vtx->vsrc_size,
+			   dev, vtx_src_fmt(vtx), vidsrc_frame_handler,
+			   vidsrc_error_handler, vtx);
 	if (err) {
 		info("video: no video source '%s': %m\n", src, err);
 		return err;
@@ -878,7 +2482,8 @@ static void tmr_handler(void *arg)
 {
 	struct video *v = arg;
 
-	tmr_start(&v->tmr, TMR_INTERVAL * 1000, tmr_handler, v);
+	twheel_tmr_start(&v->tmr, baresip_twheel(), TMR_INTERVAL * 1000,
+			 tmr_handler, v);
 
 	/* Estimate framerates */
 	v->vtx.efps = v->vtx.frames / TMR_INTERVAL;
@@ -922,7 +2527,8 @@ int video_start(struct video *v, const char *peer)
 			size.w, size.h, err);
 	}
 
-	tmr_start(&v->tmr, TMR_INTERVAL * 1000, tmr_handler, v);
+	twheel_tmr_start(&v->tmr, baresip_twheel(), TMR_INTERVAL * 1000,
+			 tmr_handler, v);
 
 	if (v->vtx.vc && v->vrx.vc) {
 		info("%H%H",
@@ -939,7 +2545,93 @@ void video_stop(struct video *v)
 	if (!v)
 		return;
 
-	v->vtx.vsrc = mem_deref(v->vtx.vsrc);
+	v->vtx.vsrc  = mem_deref(v->vtx.vsrc);
+	v->vtx.vpres = mem_deref(v->vtx.vpres);
+}
+
+
+/**
+ * Open the presentation source of a video stream. The source runs from
+ * now on, but its frames are dropped until the presentation is switched
+ * on, so the switch does not wait for the source to start. A source that
+ * is open already is kept.
+ *
+ * @param v   Video stream
+ * @param mod Video source module
+ * @param dev Video source device
+ * @param fps Framerate of the presentation
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int video_present_open(struct video *v, const char *mod, const char *dev,
+		       unsigned fps)
+{
+	struct vtx *vtx;
+	int err;
+
+	if (!v || !str_isset(mod))
+		return EINVAL;
+
+	vtx = &v->vtx;
+
+	if (vtx->vpres)
+		return 0;
+
+	vtx->vpres_prm.fps    = fps ? (int)fps : vtx->vsrc_prm.fps;
+	vtx->vpres_prm.orient = VIDORIENT_PORTRAIT;
+
+	err = vidhub_alloc(&vtx->vpres, mod, &vtx->vpres_prm,
+			   &vtx->vsrc_size, dev, vtx_src_fmt(vtx),
+			   vidpres_frame_handler, vidpres_error_handler, vtx);
+	if (err) {
+		warning("video: no presentation source '%s': %m\n",
+			mod, err);
+		return err;
+	}
+
+	info("video: presentation source '%s,%s' at %d fps\n",
+	     mod, dev, vtx->vpres_prm.fps);
+
+	return 0;
+}
+
+
+/**
+ * Send the presentation instead of the camera, or the camera again. The
+ * encoder and the RTP stream stay the same, the first picture after the
+ * switch is a keyframe.
+ *
+ * @param v  Video stream
+ * @param on True to send the presentation, false for the camera
+ */
+void video_present(struct video *v, bool on)
+{
+	struct vtx *vtx;
+
+	if (!v)
+		return;
+
+	vtx = &v->vtx;
+
+	if (on && !vtx->vpres) {
+		warning("video: no presentation source\n");
+		return;
+	}
+
+	lock_write_get(vtx->lock_src);
+
+	if (vtx->present == on) {
+		lock_rel(vtx->lock_src);
+		return;
+	}
+
+	vtx->present = on;
+	vtx->ts_pres = 0;
+	vtx->picup   = true;
+
+	lock_rel(vtx->lock_src);
+
+	info("video: sending %s\n", on ? "presentation" : "camera");
 }
 
 
@@ -961,8 +2653,6 @@ void video_mute(struct video *v, bool muted)
 	vtx->muted        = muted;
 	vtx->muted_frames = 0;
 	vtx->picup        = true;
-
-	video_update_picture(v);
 }
 
 
@@ -999,12 +2689,51 @@ int video_set_fullscreen(struct video *v, bool fs)
 }
 
 
-static void vidsrc_update(struct vtx *vtx, const char *dev)
+/**
+ * Set the largest size and framerate that the video display shows, e.g.
+ * for a thumbnail of a call in the background. Frames are then skipped
+ * and scaled down before the filters and the display, and decoded at a
+ * reduced size if the decoder supports it.
+ *
+ * @param v      Video stream
+ * @param width  Largest width, 0 for any
+ * @param height Largest height, 0 for any
+ * @param fps    Highest framerate, 0 for any
+ */
+void video_set_display_limit(struct video *v, unsigned width,
+			     unsigned height, unsigned fps)
+{
+	if (!v)
+		return;
+
+	lock_write_get(v->vrx.lock);
+
+	v->vrx.vidisp_prm.width  = width;
+	v->vrx.vidisp_prm.height = height;
+	v->vrx.vidisp_prm.fps    = fps;
+
+	lock_rel(v->vrx.lock);
+}
+
+
+/**
+ * Make the video display the active speaker, if the displays of the
+ * calls are composed in one
+ *
+ * @param v Video stream
+ */
+void video_set_focus(struct video *v)
 {
-	struct vidsrc *vs = vidsrc_get(vtx->vsrc);
+	if (!v)
+		return;
+
+	vidcomp_set_focus(v->vrx.vidisp);
+}
 
-	if (vs && vs->updateh)
-		vs->updateh(vtx->vsrc, &vtx->vsrc_prm, dev);
+
+static void vidsrc_update(struct vtx *vtx, const char *dev)
+{
+	vidhub_update(vtx->vsrc, &vtx->vsrc_prm, dev);
 }
 
 
@@ -1043,22 +2772,40 @@ int video_encoder_set(struct video *v, struct vidcodec *vc,
 		struct videnc_param prm;
 
 		prm.bitrate = v->cfg.bitrate;
-		prm.pktsize = 1024;
+		prm.pktsize = get_pktsize(v);
 		prm.fps     = get_fps(v);
 		prm.max_fs  = -1;
+		prm.pkth_mb = packet_mb_handler;
 
 		info("Set video encoder: %s %s (%u bit/s, %u fps)\n",
 		     vc->name, vc->variant, prm.bitrate, prm.fps);
 
+		err = vidcodec_init(vc);
+		if (err)
+			return err;
+
+		lock_write_get(vtx->lock);
+
 		vtx->enc = mem_deref(vtx->enc);
 		err = vc->encupdh(&vtx->enc, vc, &prm, params,
 				  packet_handler, vtx);
 		if (err) {
+			lock_rel(vtx->lock);
 			warning("video: encoder alloc: %m\n", err);
 			return err;
 		}
 
+		vtx->enc_params = mem_deref(vtx->enc_params);
+		if (params)
+			err = str_dup(&vtx->enc_params, params);
+
+		err |= layers_update(vtx, vc, prm.bitrate);
+
 		vtx->vc = vc;
+		vtx->enc_bitrate = prm.bitrate;
+		vtx->cplx_enc = UINT32_MAX;
+
+		lock_rel(vtx->lock);
 	}
 
 	stream_update_encoder(v->strm, pt_tx);
@@ -1067,6 +2814,29 @@ int video_encoder_set(struct video *v, struct vidcodec *vc,
 }
 
 
+/*
+ * Keep the current decoder for a switch back to its codec, if the codec
+ * can reset it, and take a kept decoder of the new codec, reset
+ */
+static void vrx_dec_swap(struct vrx *vrx, const struct vidcodec *vc)
+{
+	if (vrx->dec && !vrx->vc->resetth)
+		vrx->dec = mem_deref(vrx->dec);
+
+	vrx->dec = deccache_swap(&vrx->decc, vrx->vc, vrx->dec, vc);
+
+	if (vrx->dec && vc->resetth(vrx->dec))
+		vrx->dec = mem_deref(vrx->dec);
+
+	/* the limits are set again for the next picture */
+	if (vrx->dec && vc->lowresh && (vrx->lowres || vrx->skip_nonref))
+		vc->lowresh(vrx->dec, 0, false);
+
+	vrx->lowres      = 0;
+	vrx->skip_nonref = false;
+}
+
+
 int video_decoder_set(struct video *v, struct vidcodec *vc, int pt_rx,
 		      const char *fmtp)
 {
@@ -1100,8 +2870,13 @@ int video_decoder_set(struct video *v, struct vidcodec *vc, int pt_rx,
 
 		info("Set video decoder: %s %s\n", vc->name, vc->variant);
 
-		vrx->dec = mem_deref(vrx->dec);
+		err = vidcodec_init(vc);
+		if (err)
+			return err;
 
+		vrx_dec_swap(vrx, vc);
+
+		/* a kept decoder is only updated */
 		err = vc->decupdh(&vrx->dec, vc, fmtp);
 		if (err) {
 			warning("video: decoder alloc: %m\n", err);
@@ -1143,11 +2918,18 @@ struct stream *video_strm(const struct video *v)
 }
 
 
+/**
+ * Request a picture update from outside of RTCP, like a SIP INFO with
+ * a picture_fast_update. The request is merged with the other ones.
+ *
+ * @param v Video stream
+ */
 void video_update_picture(struct video *v)
 {
 	if (!v)
 		return;
-	v->vtx.picup = true;
+
+	picup_request(v, PICUP_HOLD);
 }
 
 
@@ -1182,11 +2964,20 @@ void video_vidsrc_set_device(struct video *v, const char *dev)
 }
 
 
+static bool attr_handler(const char *name, const char *value, void *arg)
+{
+	(void)name;
+
+	return value && NULL != strstr(value, arg);
+}
+
+
+/* True if any of the remote attributes with that name contains str */
 static bool sdprattr_contains(struct stream *s, const char *name,
 			      const char *str)
 {
-	const char *attr = sdp_media_rattr(stream_sdpmedia(s), name);
-	return attr ? (NULL != strstr(attr, str)) : false;
+	return NULL != sdp_media_rattr_apply(stream_sdpmedia(s), name,
+					     attr_handler, (void *)str);
 }
 
 
@@ -1197,6 +2988,66 @@ void video_sdp_attr_decode(struct video *v)
 
 	/* RFC 4585 */
 	v->nack_pli = sdprattr_contains(v->strm, "rtcp-fb", "nack");
+	stream_enable_nack(v->strm, v->nack_pli);
+
+	if (sdprattr_contains(v->strm, "rtcp-fb", "goog-remb")) {
+
+		int err = stream_enable_bwe(v->strm, SRATE, v->cfg.bitrate);
+		if (err)
+			warning("video: bandwidth estimation: %m\n", err);
+	}
+}
+
+
+/**
+ * Get the counters of a video stream, without formatting
+ *
+ * @param v  Video object
+ * @param st Returned counters
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int video_stats(const struct video *v, struct video_stat *st)
+{
+	const struct vtx *vtx;
+	const struct vrx *vrx;
+
+	if (!v || !st)
+		return EINVAL;
+
+	vtx = &v->vtx;
+	vrx = &v->vrx;
+
+	st->n_frames_tx  = (uint32_t)vtx->frames;
+	st->n_frames_rx  = (uint32_t)vrx->frames;
+	st->efps_tx      = vtx->efps;
+	st->efps_rx      = vrx->efps;
+	st->n_skip       = vtx->skipc;
+	st->n_skip_queue = vtx->skipc_queue;
+	st->n_decim      = vrx->n_decim;
+	st->n_picup      = vtx->n_picup;
+	st->bitrate      = vtx->enc_bitrate;
+	st->width        = vtx->vsrc_size.w;
+	st->height       = vtx->vsrc_size.h;
+	st->deg          = vtx->deg;
+
+	return 0;
+}
+
+
+/**
+ * Set the complexity level of the video encoder, applied with the next
+ * frame
+ *
+ * @param v     Video object
+ * @param level Complexity level, 0 is the configured complexity
+ */
+void video_set_cplx(struct video *v, unsigned level)
+{
+	if (!v)
+		return;
+
+	ATOMIC_STORE(&v->vtx.cplx, min(level, CPLX_LEVEL_MAX));
 }
 
 
@@ -1204,6 +3055,7 @@ int video_debug(struct re_printf *pf, const struct video *v)
 {
 	const struct vtx *vtx;
 	const struct vrx *vrx;
+	unsigned i;
 	int err;
 
 	if (!v)
@@ -1216,8 +3068,91 @@ int video_debug(struct re_printf *pf, const struct video *v)
 	err |= re_hprintf(pf, " tx: %u x %u, fps=%d\n",
 			  vtx->vsrc_size.w,
 			  vtx->vsrc_size.h, vtx->vsrc_prm.fps);
-	err |= re_hprintf(pf, "     skipc=%u\n", vtx->skipc);
+	err |= re_hprintf(pf, "     skipc=%u (queue=%u error=%u)"
+			  " bitrate=%u bit/s (%u decreases) cplx=-%u\n",
+			  vtx->skipc, vtx->skipc_queue, vtx->skipc_err,
+			  vtx->enc_bitrate, vtx->n_rate_down,
+			  ATOMIC_LOAD(&vtx->cplx));
+	err |= re_hprintf(pf, "     frames=%d (%u converted or copied)\n",
+			  vtx->frames, vtx->framec_copy);
+	if (v->cfg.degrade != VIDEO_DEGRADE_OFF) {
+		const struct deg_step *deg = vtx_deg(vtx);
+
+		err |= re_hprintf(pf, "     degradation: %s step=%u"
+				  " size=%u/%u frames=1/%u"
+				  " (%u decreases, %u left out)\n",
+				  vtx->screen || vtx->present ?
+				  "screen" : "motion", vtx->deg,
+				  deg->scale, DEG_SCALE_FULL, deg->div,
+				  vtx->n_deg_down, vtx->n_deg_drop);
+	}
+	err |= re_hprintf(pf, "     sendq=%zu bytes (%u ms) qdelay=%u ms"
+			  " (max %u ms)\n",
+			  vtx->sendq_bytes,
+			  pacer_delay(vtx->pacer, vtx->sendq_bytes),
+			  vtx->qdelay, vtx->qdelay_max);
+	err |= re_hprintf(pf, "     %H\n", pacer_debug, vtx->pacer);
+	for (i=0; i<vtx->layerc; i++) {
+		const struct vlayer *ly = &vtx->layerv[i];
+
+		err |= re_hprintf(pf, "     simulcast 1/%u: ssrc=%08x"
+				  " frames=%u\n",
+				  1u << ly->shift, ly->ssrc, ly->framec);
+	}
+#ifdef HAVE_PTHREAD
+	if (vtx->ethr.run) {
+		err |= re_hprintf(pf, "     encoder thread: queued=%u"
+				  " dropped=%u latency=%u ms (max %u ms)\n",
+				  vtx->ethr.n, vtx->ethr.drops,
+				  vtx->ethr.lat, vtx->ethr.lat_max);
+	}
+#endif
+	if (vtx->enc && vtx->vc && vtx->vc->encdebugh) {
+		err |= re_hprintf(pf, "     encoder: %H\n",
+				  vtx->vc->encdebugh, vtx->enc);
+	}
+	if (vtx->n_pthru) {
+		err |= re_hprintf(pf, "     passthrough: %s,"
+				  " %u access units\n",
+				  vtx->pthru ? "active" : "stopped",
+				  vtx->n_pthru);
+	}
+	if (v->fwd) {
+		err |= re_hprintf(pf, "     forwarding %s: %s, %u packets\n",
+				  v->fwd->peer,
+				  vtx->forwarded ? "active" : "codec mismatch",
+				  v->n_fwd);
+	}
+	err |= re_hprintf(pf, "     picture updates: %u (%u merged)\n",
+			  vtx->n_picup, vtx->n_picup_merged);
+#ifdef USE_ALLOC_STATS
+	err |= re_hprintf(pf, "%H%H",
+			  allocstat_debug, &vtx->alloc,
+			  allocstat_debug, &vtx->alloc_send);
+#endif
 	err |= re_hprintf(pf, " rx: pt=%d\n", vrx->pt_rx);
+	if (vrx->vidisp_prm.width || vrx->vidisp_prm.fps) {
+		err |= re_hprintf(pf, "     display limit: %ux%u %u fps,"
+				  " %u frames skipped, decoded at 1/%u%s\n",
+				  vrx->vidisp_prm.width,
+				  vrx->vidisp_prm.height,
+				  vrx->vidisp_prm.fps, vrx->n_decim,
+				  1u << vrx->lowres,
+				  vrx->skip_nonref ? " (refs only)" : "");
+	}
+	err |= re_hprintf(pf, "     FIR sent: %u (%u merged)\n",
+			  v->n_fir, v->n_fir_merged);
+	if (!list_isempty(&v->fwdl)) {
+		err |= re_hprintf(pf, "     forwarded to %u streams\n",
+				  list_count(&v->fwdl));
+	}
+	if (vrx->dec && vrx->vc && vrx->vc->decdebugh) {
+		err |= re_hprintf(pf, "     decoder: %H\n",
+				  vrx->vc->decdebugh, vrx->dec);
+	}
+#ifdef USE_ALLOC_STATS
+	err |= re_hprintf(pf, "%H", allocstat_debug, &vrx->alloc);
+#endif
 
 	if (!list_isempty(vidfilt_list())) {
 		err |= vtx_print_pipeline(pf, vtx);
@@ -1230,6 +3165,88 @@ int video_debug(struct re_printf *pf, const struct video *v)
 }
 
 
+/**
+ * Forward the video received on another stream, without transcoding
+ *
+ * While the decoder of the other stream and the encoder of this stream
+ * use the same codec, received packets are sent on this stream instead
+ * of the own video. Many streams can forward one, for a small
+ * conference without an MCU. Their picture update requests are sent
+ * to the forwarded stream, at most one per FIR_MIN.
+ *
+ * @param v   Video object
+ * @param src Stream to forward, or NULL to send the own video again
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int video_forward(struct video *v, struct video *src)
+{
+	if (!v || v == src)
+		return EINVAL;
+
+	if (v->fwd) {
+		fwd_release(v);
+		list_unlink(&v->le_fwd);
+		v->fwd = NULL;
+	}
+
+	if (!src)
+		return 0;
+
+	v->fwd = src;
+	list_append(&src->fwdl, &v->le_fwd, v);
+
+	/* the new receiver needs a key frame */
+	fir_request(src);
+
+	return 0;
+}
+
+
+static size_t frame_mem(const struct vidframe *f)
+{
+	return f ? sizeof(*f) + vidframe_size(f->fmt, &f->size) : 0;
+}
+
+
+/**
+ * Add the memory of a video stream to a memory report
+ *
+ * The states of the codecs and filters, and the frames in the encoder
+ * queue, are not counted.
+ *
+ * @param ms Memory report
+ * @param v  Video object
+ */
+void video_memstat(struct callmem *ms, const struct video *v)
+{
+	const struct vtx *vtx;
+
+	if (!ms || !v)
+		return;
+
+	vtx = &v->vtx;
+
+	ms->obj += sizeof(*v);
+
+	lock_read_get(vtx->lock);
+	ms->buf += frame_mem(vtx->frame);
+	ms->buf += frame_mem(vtx->mute_frame);
+	lock_rel(vtx->lock);
+
+	lock_read_get(v->vrx.lock);
+	ms->buf += frame_mem(v->vrx.frame_filt);
+	lock_rel(v->vrx.lock);
+
+	lock_read_get(vtx->lock_tx);
+	ms->pkt += vtx->sendq_bytes;
+	ms->pkt += vtx->freec * (sizeof(struct vidqent) +
+				 RTP_PRESZ + QENT_MTU + RTP_TRAILSZ);
+	lock_rel(vtx->lock_tx);
+
+	stream_memstat(ms, v->strm);
+}
+
 int video_print(struct re_printf *pf, const struct video *v)
 {
 	if (!v)
@@ -1241,22 +3258,18 @@ int video_print(struct re_printf *pf, const struct video *v)
 
 int video_set_source(struct video *v, const char *name, const char *dev)
 {
-	struct vidsrc *vs = (struct vidsrc *)vidsrc_find(name);
 	struct vtx *vtx;
 
 	if (!v)
 		return EINVAL;
 
-	if (!vs)
-		return ENOENT;
-
 	vtx = &v->vtx;
 
 	vtx->vsrc = mem_deref(vtx->vsrc);
 
-	return vs->alloch(&vtx->vsrc, vs, NULL, &vtx->vsrc_prm,
-			  &vtx->vsrc_size, NULL, dev,
-			  vidsrc_frame_handler, vidsrc_error_handler, vtx);
+	return vidhub_alloc(&vtx->vsrc, name, &vtx->vsrc_prm,
+			    &vtx->vsrc_size, dev, vtx_src_fmt(vtx),
+			    vidsrc_frame_handler, vidsrc_error_handler, vtx);
 }
 
 
@@ -0,0 +1,515 @@
+/**
+ * @file src/vidhub.c  Shared video capture
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/**
+ * \page VideoHub Shared video capture
+ *
+ * A hub opens a video source and device once, and fans out its frames
+ * to all users of the same source and device, e.g. two calls, or a
+ * call and a local preview. A device that can only be opened once is
+ * then usable by several calls, and is not captured twice.
+ *
+ * The source is opened with the size of the first user and the highest
+ * framerate of all users. Each user gets frames at its own framerate,
+ * by dropping frames that come before its next due time.
+ *
+ * A user can ask for a pixel format; the frame is then converted once
+ * per format, into a frame from a pool, and the same reference-counted
+ * frame is passed to all users of that format. The frames are read-only
+ * for the users, as the source frames are.
+ *
+ * The frame handlers are called from the thread of the source, with
+ * the hub locked.
+ */
+
+
+enum {
+	CONV_FRAMES = 3,    /**< Number of converted frames in the pool */
+};
+
+
+/** One capture device, shared by all its users */
+struct vidhub {
+	struct le le;
+	struct lock *lock;          /**< Protects userl and convl      */
+	struct vidsrc_st *src;      /**< The opened video source       */
+	const struct vidsrc *vs;    /**< Video source                  */
+	char *dev;                  /**< Video device                  */
+	struct vidsrc_prm prm;      /**< Parameters of the source      */
+	struct vidsz size;          /**< Size of the source            */
+	struct list userl;          /**< Users (struct vidhub_st)      */
+	struct list convl;          /**< Converted frames (struct conv) */
+	uint64_t framec;            /**< Number of captured frames     */
+	int err;                    /**< Source error, no new users    */
+};
+
+/** Frame of the current capture, in the format of some users */
+struct conv {
+	struct le le;
+	struct vidframe_pool *pool;
+	struct vidframe *frame;     /**< Converted frame, or NULL      */
+	uint64_t framec;            /**< Capture number of the frame   */
+	enum vidfmt fmt;
+};
+
+/** A user of a shared capture */
+struct vidhub_st {
+	struct le le;
+	struct vidhub *hub;
+	enum vidfmt fmt;            /**< Wanted format, or VID_FMT_N   */
+	int fps;                    /**< Wanted framerate              */
+	uint64_t next;              /**< Due time of next frame [ms]   */
+	uint64_t framec;            /**< Number of passed frames       */
+	bool errdone;               /**< Error handler was called      */
+	vidsrc_frame_h *frameh;
+	vidsrc_packet_h *pkth;
+	vidsrc_error_h *errorh;
+	void *arg;
+};
+
+
+static struct list hubl = LIST_INIT;
+
+
+static void conv_destructor(void *arg)
+{
+	struct conv *cv = arg;
+
+	list_unlink(&cv->le);
+	mem_deref(cv->frame);
+	mem_deref(cv->pool);
+}
+
+
+static void hub_destructor(void *arg)
+{
+	struct vidhub *hub = arg;
+
+	list_unlink(&hub->le);
+
+	/* stops the thread of the source, the lock is not held */
+	mem_deref(hub->src);
+
+	list_flush(&hub->convl);
+	mem_deref(hub->dev);
+	mem_deref(hub->lock);
+}
+
+
+static void user_destructor(void *arg)
+{
+	struct vidhub_st *st = arg;
+	struct vidhub *hub = st->hub;
+
+	if (hub) {
+		lock_write_get(hub->lock);
+		list_unlink(&st->le);
+		lock_rel(hub->lock);
+	}
+
+	mem_deref(hub);
+}
+
+
+static int hub_fps(const struct vidhub *hub)
+{
+	const struct le *le;
+	int fps = 1;
+
+	for (le = hub->userl.head; le; le = le->next) {
+		const struct vidhub_st *st = le->data;
+
+		fps = max(fps, st->fps);
+	}
+
+	return fps;
+}
+
+
+/* The frame of the current capture in format fmt, converted once */
+static struct vidframe *conv_frame(struct vidhub *hub,
+				   struct vidframe *frame, enum vidfmt fmt)
+{
+	struct conv *cv = NULL;
+	struct vidframe *f = NULL;
+	struct le *le;
+
+	for (le = hub->convl.head; le; le = le->next) {
+
+		cv = le->data;
+
+		if (cv->fmt == fmt)
+			break;
+
+		cv = NULL;
+	}
+
+	if (cv && cv->framec == hub->framec && cv->frame)
+		return cv->frame;
+
+	if (!cv) {
+		cv = mem_zalloc(sizeof(*cv), conv_destructor);
+		if (!cv)
+			return NULL;
+
+		cv->fmt = fmt;
+		list_append(&hub->convl, &cv->le, cv);
+	}
+
+	if (!vidframe_pool_match(cv->pool, fmt, &frame->size)) {
+
+		cv->frame = mem_deref(cv->frame);
+		cv->pool  = mem_deref(cv->pool);
+
+		if (vidframe_pool_alloc(&cv->pool, fmt, &frame->size,
+					CONV_FRAMES))
+			return NULL;
+	}
+
+	/* the frame of the last capture goes back to the pool,
+	 * once all its users are done with it */
+	cv->frame = mem_deref(cv->frame);
+
+	if (vidframe_pool_get(cv->pool, &f))
+		return NULL;
+
+	vidconv_fast(f, frame, NULL);
+
+	cv->frame  = f;
+	cv->framec = hub->framec;
+
+	return f;
+}
+
+
+static bool frame_due(struct vidhub_st *st, int fps, uint64_t now)
+{
+	uint64_t interval;
+
+	if (st->fps >= fps)
+		return true;
+
+	interval = 1000 / max(st->fps, 1);
+
+	/* half an interval early is still on time, for frame jitter */
+	if (st->next && now + interval/2 < st->next)
+		return false;
+
+	if (st->next && now < st->next + interval)
+		st->next += interval;
+	else
+		st->next = now + interval;
+
+	return true;
+}
+
+
+static void frame_handler(struct vidframe *frame, void *arg)
+{
+	struct vidhub *hub = arg;
+	uint64_t now = tmr_jiffies();
+	struct le *le;
+
+	lock_write_get(hub->lock);
+
+	++hub->framec;
+
+	for (le = hub->userl.head; le; le = le->next) {
+
+		struct vidhub_st *st = le->data;
+		struct vidframe *f = frame;
+
+		if (!st->frameh || !frame_due(st, hub->prm.fps, now))
+			continue;
+
+		if (st->fmt != VID_FMT_N && st->fmt != frame->fmt) {
+
+			/* else the user converts it */
+			f = conv_frame(hub, frame, st->fmt);
+			if (!f)
+				f = frame;
+		}
+
+		++st->framec;
+		st->frameh(f, st->arg);
+	}
+
+	lock_rel(hub->lock);
+}
+
+
+static int packet_handler(const char *codec, const uint8_t *buf,
+			  size_t len, uint32_t ts, void *arg)
+{
+	struct vidhub *hub = arg;
+	struct le *le;
+	int err = ENOTSUP;
+
+	lock_write_get(hub->lock);
+
+	for (le = hub->userl.head; le; le = le->next) {
+
+		struct vidhub_st *st = le->data;
+
+		/* the source decodes, if any user wants frames */
+		if (!st->pkth) {
+			err = ENOTSUP;
+			break;
+		}
+
+		err = st->pkth(codec, buf, len, ts, st->arg);
+		if (err)
+			break;
+	}
+
+	lock_rel(hub->lock);
+
+	return err;
+}
+
+
+static void error_handler(int err, void *arg)
+{
+	struct vidhub *hub = arg;
+
+	mem_ref(hub);
+
+	lock_write_get(hub->lock);
+	hub->err = err;
+	lock_rel(hub->lock);
+
+	/* a user may dereference itself, call it with the hub unlocked */
+	for (;;) {
+		struct vidhub_st *st = NULL;
+		struct le *le;
+
+		lock_write_get(hub->lock);
+
+		for (le = hub->userl.head; le; le = le->next) {
+
+			struct vidhub_st *u = le->data;
+
+			if (!u->errdone) {
+				u->errdone = true;
+				st = mem_ref(u);
+				break;
+			}
+		}
+
+		lock_rel(hub->lock);
+
+		if (!st)
+			break;
+
+		if (st->errorh)
+			st->errorh(err, st->arg);
+
+		mem_deref(st);
+	}
+
+	mem_deref(hub);
+}
+
+
+static struct vidhub *hub_find(const struct vidsrc *vs, const char *dev)
+{
+	struct le *le;
+
+	for (le = hubl.head; le; le = le->next) {
+
+		struct vidhub *hub = le->data;
+
+		if (hub->vs == vs && !hub->err && !str_cmp(hub->dev, dev))
+			return hub;
+	}
+
+	return NULL;
+}
+
+
+static int hub_alloc(struct vidhub **hubp, struct vidsrc *vs,
+		     struct vidsrc_prm *prm, const struct vidsz *size,
+		     const char *dev)
+{
+	struct vidhub *hub;
+	int err;
+
+	hub = mem_zalloc(sizeof(*hub), hub_destructor);
+	if (!hub)
+		return ENOMEM;
+
+	hub->vs   = vs;
+	hub->prm  = *prm;
+	hub->size = *size;
+	hub->prm.pkth = packet_handler;
+
+	err  = lock_alloc(&hub->lock);
+	err |= str_dup(&hub->dev, dev ? dev : "");
+	if (err)
+		goto out;
+
+	err = vs->alloch(&hub->src, vs, NULL, &hub->prm, &hub->size,
+			 NULL, dev, frame_handler, error_handler, hub);
+	if (err)
+		goto out;
+
+	list_append(&hubl, &hub->le, hub);
+
+ out:
+	if (err)
+		mem_deref(hub);
+	else
+		*hubp = hub;
+
+	return err;
+}
+
+
+/**
+ * Open a video source and device, shared with the other users of it
+ *
+ * @param stp    Pointer to allocated user state
+ * @param name   Name of the video source
+ * @param prm    Video source parameters of the user
+ * @param size   Wanted video size, if the device is not open yet
+ * @param dev    Video device
+ * @param fmt    Wanted pixel format, or VID_FMT_N for any
+ * @param frameh Video frame handler
+ * @param errorh Error handler (optional)
+ * @param arg    Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int vidhub_alloc(struct vidhub_st **stp, const char *name,
+		 struct vidsrc_prm *prm, const struct vidsz *size,
+		 const char *dev, enum vidfmt fmt,
+		 vidsrc_frame_h *frameh, vidsrc_error_h *errorh, void *arg)
+{
+	struct vidsrc *vs = (struct vidsrc *)vidsrc_find(name);
+	struct vidhub_st *st;
+	struct vidhub *hub;
+	int err = 0;
+
+	if (!stp || !prm || !size)
+		return EINVAL;
+
+	if (!vs)
+		return ENOENT;
+
+	st = mem_zalloc(sizeof(*st), user_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->fmt    = fmt;
+	st->fps    = max(prm->fps, 1);
+	st->frameh = frameh;
+	st->pkth   = prm->pkth;
+	st->errorh = errorh;
+	st->arg    = arg;
+
+	hub = hub_find(vs, dev ? dev : "");
+	if (hub) {
+		st->hub = mem_ref(hub);
+	}
+	else {
+		err = hub_alloc(&st->hub, vs, prm, size, dev);
+		if (err)
+			goto out;
+	}
+
+	hub = st->hub;
+
+	lock_write_get(hub->lock);
+
+	list_append(&hub->userl, &st->le, st);
+
+	if (st->fps > hub->prm.fps) {
+		hub->prm.fps = st->fps;
+
+		if (vs->updateh)
+			vs->updateh(hub->src, &hub->prm, NULL);
+	}
+
+	lock_rel(hub->lock);
+
+	if (list_count(&hub->userl) > 1) {
+		info("vidhub: %s,%s shared by %u users (%d fps)\n",
+		     vs->name, hub->dev, list_count(&hub->userl),
+		     hub->prm.fps);
+	}
+
+ out:
+	if (err)
+		mem_deref(st);
+	else
+		*stp = st;
+
+	return err;
+}
+
+
+/**
+ * Update the parameters of a user of a shared video source
+ *
+ * The device is changed only if the user is the only one of the source.
+ *
+ * @param st  User state
+ * @param prm Video source parameters of the user
+ * @param dev New video device, or NULL for no change
+ */
+void vidhub_update(struct vidhub_st *st, struct vidsrc_prm *prm,
+		   const char *dev)
+{
+	struct vidhub *hub;
+
+	if (!st || !prm)
+		return;
+
+	hub = st->hub;
+
+	lock_write_get(hub->lock);
+
+	st->fps  = max(prm->fps, 1);
+	st->pkth = prm->pkth;
+
+	hub->prm.orient = prm->orient;
+	hub->prm.fps    = hub_fps(hub);
+
+	if (dev && list_count(&hub->userl) > 1) {
+		info("vidhub: %s,%s is shared, device not changed\n",
+		     hub->vs->name, hub->dev);
+		dev = NULL;
+	}
+
+	if (dev) {
+		hub->dev = mem_deref(hub->dev);
+		(void)str_dup(&hub->dev, dev);
+	}
+
+	if (hub->vs->updateh)
+		hub->vs->updateh(hub->src, &hub->prm, dev);
+
+	lock_rel(hub->lock);
+}
+
+
+/**
+ * Get the video source of a shared video source user
+ *
+ * @param st User state
+ *
+ * @return Video source, or NULL
+ */
+const struct vidsrc *vidhub_vidsrc(const struct vidhub_st *st)
+{
+	return st ? st->hub->vs : NULL;
+}
+
@@ -65,6 +65,22 @@ int vidisp_register(struct vidisp **vp, const char *name,
 }
 
 
+/**
+ * Set the compose handler of a Video Display, which draws the pictures
+ * of several calls as tiles of one display
+ *
+ * @param vd       Video Display
+ * @param composeh Compose handler
+ */
+void vidisp_set_compose(struct vidisp *vd, vidisp_compose_h *composeh)
+{
+	if (!vd)
+		return;
+
+	vd->composeh = composeh;
+}
+
+
 const struct vidisp *vidisp_find(const char *name)
 {
 	struct le *le;
@@ -0,0 +1,299 @@
+/**
+ * @file src/vidpool.c  Pool of reference-counted video frames
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/**
+ * \page VideoFramePool Video frame pool
+ *
+ * A pool hands out video frames of one format and size. Each frame is a
+ * mem object; the user releases it with mem_deref() and the pool keeps
+ * its own reference, so the buffer is reused by the next
+ * vidframe_pool_get() instead of being freed. Frames still in use when
+ * the pool is destroyed are freed on their last mem_deref().
+ *
+ * All planes start on a BUF_ALIGN boundary and every line is padded to
+ * a multiple of BUF_ALIGN bytes, as needed by SIMD code.
+ */
+
+
+enum {
+	BUF_ALIGN = 32,        /**< Plane and line alignment in [bytes] */
+};
+
+
+struct vidframe_pool {
+	struct lock *lock;          /**< Protects framev                 */
+	struct vidframe **framev;   /**< All frames owned by the pool    */
+	unsigned framec;            /**< Number of allocated frames      */
+	unsigned max;               /**< Maximum number of frames        */
+	enum vidfmt fmt;            /**< Pixel format of all frames      */
+	struct vidsz size;          /**< Size of all frames              */
+
+	/* statistics */
+	uint32_t n_get;             /**< Frames handed out               */
+	uint32_t n_exhausted;       /**< Requests with all frames in use */
+};
+
+
+static void destructor(void *arg)
+{
+	struct vidframe_pool *pool = arg;
+	unsigned i;
+
+	for (i=0; i<pool->framec; i++)
+		mem_deref(pool->framev[i]);
+
+	mem_deref(pool->framev);
+	mem_deref(pool->lock);
+}
+
+
+static inline size_t align(size_t n)
+{
+	return (n + BUF_ALIGN - 1) & ~(size_t)(BUF_ALIGN - 1);
+}
+
+
+/* Line size and number of lines for each plane */
+static int plane_layout(unsigned linesize[4], unsigned linec[4],
+			enum vidfmt fmt, const struct vidsz *sz)
+{
+	const unsigned w = sz->w, h = sz->h;
+
+	memset(linesize, 0, 4 * sizeof(*linesize));
+	memset(linec, 0, 4 * sizeof(*linec));
+
+	switch (fmt) {
+
+	case VID_FMT_YUV420P:
+		linesize[0] = (unsigned)align(w);
+		linesize[1] = linesize[2] = (unsigned)align((w + 1) / 2);
+		linec[0] = h;
+		linec[1] = linec[2] = (h + 1) / 2;
+		break;
+
+	case VID_FMT_YUV444P:
+		linesize[0] = linesize[1] = linesize[2] = (unsigned)align(w);
+		linec[0] = linec[1] = linec[2] = h;
+		break;
+
+	case VID_FMT_NV12:
+	case VID_FMT_NV21:
+		linesize[0] = (unsigned)align(w);
+		linesize[1] = (unsigned)align((w + 1) & ~1u);
+		linec[0] = h;
+		linec[1] = (h + 1) / 2;
+		break;
+
+	case VID_FMT_YUYV422:
+	case VID_FMT_UYVY422:
+	case VID_FMT_RGB565:
+	case VID_FMT_RGB555:
+		linesize[0] = (unsigned)align(w * 2);
+		linec[0] = h;
+		break;
+
+	case VID_FMT_RGB32:
+	case VID_FMT_ARGB:
+		linesize[0] = (unsigned)align(w * 4);
+		linec[0] = h;
+		break;
+
+	default:
+		return ENOTSUP;
+	}
+
+	return 0;
+}
+
+
+static int frame_alloc(struct vidframe **fp, enum vidfmt fmt,
+		       const struct vidsz *sz)
+{
+	unsigned linesize[4], linec[4];
+	struct vidframe *f;
+	size_t total = 0;
+	uint8_t *p;
+	int i, err;
+
+	err = plane_layout(linesize, linec, fmt, sz);
+	if (err)
+		return err;
+
+	for (i=0; i<4; i++)
+		total += (size_t)linesize[i] * linec[i];
+
+	f = mem_zalloc(sizeof(*f) + BUF_ALIGN + total, NULL);
+	if (!f)
+		return ENOMEM;
+
+	p = (uint8_t *)align((size_t)(f + 1));
+
+	for (i=0; i<4; i++) {
+
+		if (!linec[i])
+			continue;
+
+		f->data[i]     = p;
+		f->linesize[i] = linesize[i];
+
+		p += (size_t)linesize[i] * linec[i];
+	}
+
+	f->size = *sz;
+	f->fmt  = fmt;
+
+	*fp = f;
+
+	return 0;
+}
+
+
+/**
+ * Allocate a video frame pool
+ *
+ * @param poolp Pointer to allocated pool
+ * @param fmt   Pixel format of the frames
+ * @param sz    Size of the frames
+ * @param max   Maximum number of frames in the pool
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int vidframe_pool_alloc(struct vidframe_pool **poolp, enum vidfmt fmt,
+			const struct vidsz *sz, unsigned max)
+{
+	struct vidframe_pool *pool;
+	unsigned linesize[4], linec[4];
+	int err;
+
+	if (!poolp || !sz || !sz->w || !sz->h || !max)
+		return EINVAL;
+
+	err = plane_layout(linesize, linec, fmt, sz);
+	if (err)
+		return err;
+
+	pool = mem_zalloc(sizeof(*pool), destructor);
+	if (!pool)
+		return ENOMEM;
+
+	pool->framev = mem_zalloc(max * sizeof(*pool->framev), NULL);
+	if (!pool->framev) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = lock_alloc(&pool->lock);
+	if (err)
+		goto out;
+
+	pool->max  = max;
+	pool->fmt  = fmt;
+	pool->size = *sz;
+
+ out:
+	if (err)
+		mem_deref(pool);
+	else
+		*poolp = pool;
+
+	return err;
+}
+
+
+/**
+ * Get a free frame from the pool. Release it with mem_deref().
+ *
+ * @param pool Video frame pool
+ * @param fp   Pointer to the frame, which is not cleared
+ *
+ * @return 0 if success, EBUSY if all frames are in use
+ */
+int vidframe_pool_get(struct vidframe_pool *pool, struct vidframe **fp)
+{
+	struct vidframe *f = NULL;
+	unsigned i;
+	int err = 0;
+
+	if (!pool || !fp)
+		return EINVAL;
+
+	lock_write_get(pool->lock);
+
+	/* only the pool holds a reference to a free frame */
+	for (i=0; i<pool->framec; i++) {
+
+		if (mem_nrefs(pool->framev[i]) == 1) {
+			f = pool->framev[i];
+			break;
+		}
+	}
+
+	if (!f && pool->framec < pool->max) {
+
+		err = frame_alloc(&f, pool->fmt, &pool->size);
+		if (err)
+			goto out;
+
+		pool->framev[pool->framec++] = f;
+	}
+
+	if (!f) {
+		if (pool->n_exhausted++ == 0) {
+			warning("vidframe_pool: all %u frames of %s %ux%u"
+				" are in use\n", pool->max,
+				vidfmt_name(pool->fmt),
+				pool->size.w, pool->size.h);
+		}
+		err = EBUSY;
+		goto out;
+	}
+
+	++pool->n_get;
+	*fp = mem_ref(f);
+
+ out:
+	lock_rel(pool->lock);
+
+	return err;
+}
+
+
+/**
+ * Check if the pool has frames of a given format and size
+ *
+ * @param pool Video frame pool
+ * @param fmt  Pixel format
+ * @param sz   Frame size
+ *
+ * @return True if matching, otherwise false
+ */
+bool vidframe_pool_match(const struct vidframe_pool *pool, enum vidfmt fmt,
+			 const struct vidsz *sz)
+{
+	if (!pool || !sz)
+		return false;
+
+	return pool->fmt == fmt && vidsz_cmp(&pool->size, sz);
+}
+
+
+int vidframe_pool_debug(struct re_printf *pf,
+			const struct vidframe_pool *pool)
+{
+	if (!pool)
+		return 0;
+
+	return re_hprintf(pf, "%s %ux%u frames=%u/%u get=%u exhausted=%u\n",
+			  vidfmt_name(pool->fmt), pool->size.w, pool->size.h,
+			  pool->framec, pool->max, pool->n_get,
+			  pool->n_exhausted);
+}
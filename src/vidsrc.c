@@ -4,7 +4,11 @@
  * Copyright (C) 2010 Creytiv.com
  */
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include <re.h>
+#include <rem.h>
 #include <baresip.h>
 #include "core.h"
 
@@ -15,7 +19,20 @@ struct vidsrc_st {
 };
 
 
+/** Frame buffer of a source, exported as DMABUF */
+struct dmabuf {
+	struct le le;
+	const void *data;   /**< Start of the buffer in memory */
+	size_t len;         /**< Size of the buffer [bytes]    */
+	int fd;             /**< DMABUF file descriptor        */
+};
+
+
 static struct list vidsrcl = LIST_INIT;
+static struct list dmabufl = LIST_INIT;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t dmabuf_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 
 static void destructor(void *arg)
@@ -132,3 +149,119 @@ struct vidsrc *vidsrc_get(struct vidsrc_st *st)
 {
 	return st ? st->vs : NULL;
 }
+
+
+static void dmabuf_lock(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&dmabuf_mutex);
+#endif
+}
+
+
+static void dmabuf_unlock(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&dmabuf_mutex);
+#endif
+}
+
+
+static void dmabuf_destructor(void *arg)
+{
+	struct dmabuf *db = arg;
+
+	dmabuf_lock();
+	list_unlink(&db->le);
+	dmabuf_unlock();
+}
+
+
+/**
+ * Tell the encoders that a frame buffer of a video source is exported
+ * as DMABUF. Frames that start in the buffer can then be passed to a
+ * hardware encoder by descriptor, instead of being copied.
+ *
+ * @param dbp  Pointer to allocated entry, dereference to remove it
+ * @param data Start of the buffer in memory
+ * @param len  Size of the buffer in [bytes]
+ * @param fd   DMABUF file descriptor, owned by the caller
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int vidsrc_dmabuf_add(struct dmabuf **dbp, const void *data, size_t len,
+		      int fd)
+{
+	struct dmabuf *db;
+
+	if (!dbp || !data || fd < 0)
+		return EINVAL;
+
+	db = mem_zalloc(sizeof(*db), dmabuf_destructor);
+	if (!db)
+		return ENOMEM;
+
+	db->data = data;
+	db->len  = len;
+	db->fd   = fd;
+
+	dmabuf_lock();
+	list_append(&dmabufl, &db->le, db);
+	dmabuf_unlock();
+
+	*dbp = db;
+
+	return 0;
+}
+
+
+/**
+ * Find the DMABUF of a video frame
+ *
+ * @param frame Video frame
+ * @param offv  Offset of each plane in the buffer, optional
+ * @param lenp  Size of the buffer in [bytes], optional
+ *
+ * @return DMABUF file descriptor, or -1 if the frame is not in one
+ */
+int vidsrc_dmabuf_fd(const struct vidframe *frame, size_t offv[4],
+		     size_t *lenp)
+{
+	const uint8_t *data;
+	struct le *le;
+	int fd = -1;
+
+	if (!frame || !frame->data[0])
+		return -1;
+
+	data = frame->data[0];
+
+	dmabuf_lock();
+
+	for (le = dmabufl.head; le; le = le->next) {
+
+		const struct dmabuf *db = le->data;
+		const uint8_t *start = db->data;
+		unsigned i;
+
+		if (data < start || data >= start + db->len)
+			continue;
+
+		for (i=0; i<4 && offv; i++) {
+			const uint8_t *p = frame->data[i];
+
+			offv[i] = (p >= start && p < start + db->len) ?
+				(size_t)(p - start) : 0;
+		}
+
+		if (lenp)
+			*lenp = db->len;
+
+		fd = db->fd;
+		break;
+	}
+
+	dmabuf_unlock();
+
+	return fd;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file test/admit.c  Test the admission control of incoming calls
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "admit"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+int test_admit(void)
+{
+	struct admit *adm = NULL;
+	uint32_t retry = 0;
+	int i, err;
+
+	/* no controller, no limits */
+	ASSERT_EQ(0, admit_check(NULL, 1000, &retry));
+
+	err = admit_alloc(&adm, 0, 0, 0);
+	TEST_ERR(err);
+
+	ASSERT_EQ(0, admit_check(adm, 1000, &retry));
+	adm = mem_deref(adm);
+
+	/* concurrent call setups */
+	err = admit_alloc(&adm, 4, 0, 0);
+	TEST_ERR(err);
+
+	ASSERT_EQ(0, admit_check(adm, 3, &retry));
+	ASSERT_EQ(EBUSY, admit_check(adm, 4, &retry));
+	ASSERT_TRUE(retry >= 2 && retry <= 3);
+
+	/* the Retry-After grows with the overload */
+	ASSERT_EQ(EBUSY, admit_check(adm, 40, &retry));
+	ASSERT_TRUE(retry >= 20 && retry <= 30);
+
+	ASSERT_EQ(EBUSY, admit_check(adm, 4000, &retry));
+	ASSERT_EQ(60, retry);
+
+	ASSERT_EQ(1, admit_count(adm, false));
+	ASSERT_EQ(3, admit_count(adm, true));
+	adm = mem_deref(adm);
+
+	/* event loop lag and CPU load are smoothed */
+	err = admit_alloc(&adm, 0, 100, 90);
+	TEST_ERR(err);
+
+	admit_update(adm, 400, 0);
+	ASSERT_EQ(0, admit_check(adm, 0, &retry));
+
+	for (i=0; i<32; i++)
+		admit_update(adm, 1000, 0);
+	ASSERT_EQ(EBUSY, admit_check(adm, 0, &retry));
+
+	for (i=0; i<32; i++)
+		admit_update(adm, 0, 100);
+	ASSERT_EQ(EBUSY, admit_check(adm, 0, &retry));
+
+	for (i=0; i<32; i++)
+		admit_update(adm, 0, 0);
+	ASSERT_EQ(0, admit_check(adm, 0, &retry));
+
+	ASSERT_EQ(2, admit_count(adm, false));
+	ASSERT_EQ(2, admit_count(adm, true));
+
+ out:
+	mem_deref(adm);
+
+	return err;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file test/ajb.c  Test the adaptive jitter buffer control
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "ajb"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	SRATE = 8000,
+	PTIME = 20,
+	FRAME = SRATE * PTIME / 1000,
+	MAX   = 10,
+};
+
+
+struct sender {
+	struct ajb *ajb;
+	uint16_t seq;
+	uint32_t ts;
+	uint64_t t;          /* send time [ms] */
+};
+
+
+/* One packet, taken out of the buffer the way the stream does it */
+static unsigned packet(struct sender *snd, bool marker, uint32_t delay)
+{
+	struct rtp_header hdr;
+	unsigned n, i;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.m   = marker;
+	hdr.seq = snd->seq++;
+	hdr.ts  = snd->ts;
+
+	ajb_put(snd->ajb, &hdr, snd->t + delay);
+	n = ajb_release(snd->ajb, marker);
+
+	for (i=0; i<n; i++)
+		ajb_get(snd->ajb);
+
+	snd->ts += FRAME;
+	snd->t  += PTIME;
+
+	return n;
+}
+
+
+int test_ajb(void)
+{
+	struct sender snd;
+	unsigned i;
+	int err;
+
+	memset(&snd, 0, sizeof(snd));
+
+	err = ajb_alloc(&snd.ajb, MAX);
+	TEST_ERR(err);
+
+	ajb_set_srate(snd.ajb, SRATE);
+
+	/* a talkspurt with jitter keeps the delay */
+	for (i=0; i<100; i++)
+		ASSERT_EQ(1, packet(&snd, i == 0, i % 2 ? 40 : 0));
+
+	/* the next talkspurt starts with a grown delay */
+	ASSERT_EQ(0, packet(&snd, true, 0));
+
+	/* and so does the first packet after silence (DTX) */
+	snd.ts += 10 * FRAME;
+	snd.t  += 10 * PTIME;
+	ASSERT_EQ(0, packet(&snd, false, 40));
+
+	/* no jitter for a while, not changed in the talkspurt */
+	for (i=0; i<300; i++)
+		ASSERT_EQ(1, packet(&snd, false, 0));
+
+	/* the next talkspurt starts with a shrunk delay */
+	ASSERT_EQ(2, packet(&snd, true, 0));
+
+ out:
+	mem_deref(snd.ajb);
+
+	return err;
+}
@@ -0,0 +1,296 @@
+/**
+ * @file test/aufilt.c  Test the audio filter chain
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "aufilt"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum { SAMPC = 960 };
+
+
+struct flt_st {
+	struct aufilt_enc_st af;  /* inheritance */
+	const float *bufp;        /* buffer seen by the float handler */
+	unsigned calls;
+};
+
+
+/* int16: add 100 */
+static int enc_add(struct aufilt_enc_st *st, int16_t *sampv, size_t *sampc)
+{
+	size_t i;
+	(void)st;
+
+	for (i=0; i<*sampc; i++)
+		sampv[i] += 100;
+
+	return 0;
+}
+
+
+/* float: halve */
+static int enc_half(struct aufilt_enc_st *st, float *sampv, size_t *sampc)
+{
+	struct flt_st *fs = (struct flt_st *)st;
+	size_t i;
+
+	for (i=0; i<*sampc; i++)
+		sampv[i] *= 0.5f;
+
+	fs->bufp = sampv;
+	++fs->calls;
+
+	return 0;
+}
+
+
+/* int16 or float: negate */
+static int enc_neg(struct aufilt_enc_st *st, int16_t *sampv, size_t *sampc)
+{
+	size_t i;
+	(void)st;
+
+	for (i=0; i<*sampc; i++)
+		sampv[i] = -sampv[i];
+
+	return 0;
+}
+
+
+static int enc_neg_flt(struct aufilt_enc_st *st, float *sampv, size_t *sampc)
+{
+	struct flt_st *fs = (struct flt_st *)st;
+	size_t i;
+
+	for (i=0; i<*sampc; i++)
+		sampv[i] = -sampv[i];
+
+	fs->bufp = sampv;
+	++fs->calls;
+
+	return 0;
+}
+
+
+static int dec_add(struct aufilt_dec_st *st, int16_t *sampv, size_t *sampc)
+{
+	return enc_add((struct aufilt_enc_st *)st, sampv, sampc);
+}
+
+
+static int dec_half(struct aufilt_dec_st *st, float *sampv, size_t *sampc)
+{
+	return enc_half((struct aufilt_enc_st *)st, sampv, sampc);
+}
+
+
+static struct aufilt af_add = {
+	LE_INIT, "add", NULL, enc_add, NULL, dec_add, NULL, NULL
+};
+
+static struct aufilt af_half = {
+	LE_INIT, "half", NULL, NULL, NULL, NULL, enc_half, dec_half
+};
+
+static struct aufilt af_neg = {
+	LE_INIT, "neg", NULL, enc_neg, NULL, NULL, enc_neg_flt, NULL
+};
+
+
+/* float: double, for saturation */
+static int enc_double(struct aufilt_enc_st *st, float *sampv, size_t *sampc)
+{
+	size_t i;
+	(void)st;
+
+	for (i=0; i<*sampc; i++)
+		sampv[i] *= 2.0f;
+
+	return 0;
+}
+
+
+static int enc_nop(struct aufilt_enc_st *st, float *sampv, size_t *sampc)
+{
+	struct flt_st *fs = (struct flt_st *)st;
+	(void)sampc;
+
+	fs->bufp = sampv;
+
+	return 0;
+}
+
+
+/* all int16 values survive a float round-trip, and saturate */
+static int test_roundtrip(enum simd_impl impl)
+{
+	static struct aufilt af_nop = {
+		LE_INIT, "nop", NULL, NULL, NULL, NULL, enc_nop, NULL
+	};
+	static struct aufilt af_double = {
+		LE_INIT, "double", NULL, NULL, NULL, NULL, enc_double, NULL
+	};
+	struct aufilt_chain *ch = NULL;
+	struct flt_st st;
+	struct list filtl = LIST_INIT;
+	int16_t *sampv = NULL;
+	size_t i, sampc = 65536;
+	int err;
+
+	err = aufilt_chain_alloc(&ch, sampc);
+	if (err)
+		return err;
+
+	aufilt_chain_set_simd(ch, impl);
+
+	sampv = mem_alloc(sampc * sizeof(*sampv), NULL);
+	if (!sampv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	memset(&st, 0, sizeof(st));
+	st.af.af = &af_nop;
+	list_append(&filtl, &st.af.le, &st);
+
+	for (i=0; i<sampc; i++)
+		sampv[i] = (int16_t)(i - 32768);
+
+	err = aufilt_chain_encode(ch, &filtl, sampv, &sampc);
+	TEST_ERR(err);
+
+	ASSERT_EQ(2, aufilt_chain_convc(ch));
+	ASSERT_TRUE(((uintptr_t)st.bufp & 31) == 0);
+
+	for (i=0; i<sampc; i++)
+		ASSERT_EQ((int)i - 32768, sampv[i]);
+
+	st.af.af = &af_double;
+
+	err = aufilt_chain_encode(ch, &filtl, sampv, &sampc);
+	TEST_ERR(err);
+
+	for (i=0; i<sampc; i++) {
+
+		int v = 2 * ((int)i - 32768);
+
+		ASSERT_EQ(v < -32768 ? -32768 : v > 32767 ? 32767 : v,
+			  sampv[i]);
+	}
+
+ out:
+	if (err)
+		warning("aufilt: %s round-trip failed\n", simd_name(impl));
+
+	list_clear(&filtl);
+	mem_deref(sampv);
+	mem_deref(ch);
+
+	return err;
+}
+
+
+int test_aufilt(void)
+{
+	struct aufilt_chain *ch = NULL;
+	struct flt_st stv[4];
+	struct list filtl = LIST_INIT;
+	int16_t sampv[SAMPC];
+	size_t sampc = SAMPC, i;
+	int impl;
+	int err;
+
+	err = aufilt_chain_alloc(&ch, SAMPC);
+	TEST_ERR(err);
+
+	/* add -> half -> neg -> add: neg stays in float */
+	memset(stv, 0, sizeof(stv));
+	stv[0].af.af = &af_add;
+	stv[1].af.af = &af_half;
+	stv[2].af.af = &af_neg;
+	stv[3].af.af = &af_add;
+	for (i=0; i<ARRAY_SIZE(stv); i++)
+		list_append(&filtl, &stv[i].af.le, &stv[i]);
+
+	for (i=0; i<SAMPC; i++)
+		sampv[i] = (int16_t)(i * 10);
+
+	err = aufilt_chain_encode(ch, &filtl, sampv, &sampc);
+	TEST_ERR(err);
+
+	ASSERT_EQ(SAMPC, sampc);
+	ASSERT_EQ(1, stv[1].calls);
+	ASSERT_EQ(1, stv[2].calls);
+	ASSERT_TRUE(stv[1].bufp == stv[2].bufp);
+	ASSERT_EQ(2, aufilt_chain_convc(ch));
+
+	for (i=0; i<SAMPC; i++)
+		ASSERT_EQ(100 - (int)(i * 10 + 100) / 2, sampv[i]);
+
+	/* decode runs in reverse order: add -> half -> add */
+	list_clear(&filtl);
+	memset(stv, 0, sizeof(stv));
+	stv[0].af.af = &af_add;
+	stv[1].af.af = &af_half;
+	stv[2].af.af = &af_add;
+	for (i=0; i<3; i++)
+		list_append(&filtl, &stv[i].af.le, &stv[i]);
+
+	for (i=0; i<SAMPC; i++)
+		sampv[i] = (int16_t)(i * 10);
+
+	err = aufilt_chain_decode(ch, &filtl, sampv, &sampc);
+	TEST_ERR(err);
+
+	ASSERT_EQ(4, aufilt_chain_convc(ch));
+	for (i=0; i<SAMPC; i++)
+		ASSERT_EQ((int)(i * 10 + 100) / 2 + 100, sampv[i]);
+
+	/* int16 filters need no float buffer */
+	list_clear(&filtl);
+	stv[0].af.af = &af_add;
+	list_append(&filtl, &stv[0].af.le, &stv[0]);
+
+	err = aufilt_chain_encode(NULL, &filtl, sampv, &sampc);
+	TEST_ERR(err);
+
+	for (impl=SIMD_C; impl<SIMD_N; impl++) {
+
+		if (!simd_supported(impl))
+			continue;
+
+		err = test_roundtrip(impl);
+		TEST_ERR(err);
+	}
+
+	/* the direct converters accept any alignment */
+	{
+		float flt[SAMPC + 1];
+		int16_t out[SAMPC + 1];
+
+		for (i=0; i<SAMPC; i++)
+			sampv[i] = (int16_t)(i * 331 - 32768);
+
+		ausamp_to_float(&flt[1], sampv, SAMPC);
+		ausamp_to_s16(&out[1], &flt[1], SAMPC);
+
+		ASSERT_TRUE(flt[1] == -1.0f);
+		for (i=0; i<SAMPC; i++)
+			ASSERT_EQ(sampv[i], out[1 + i]);
+	}
+
+ out:
+	list_clear(&filtl);
+	mem_deref(ch);
+
+	return err;
+}
@@ -0,0 +1,98 @@
+/**
+ * @file test/aulevel.c  Test the audio level meter
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "aulevel"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum { SAMPC = 65536 + 13 };
+
+
+int test_aulevel(void)
+{
+	struct aulevel lvl;
+	int16_t *sampv;
+	uint64_t ref_sum = 0;
+	uint16_t ref_peak = 0;
+	double rms, peak;
+	size_t i;
+	int impl;
+	int err = 0;
+
+	sampv = mem_alloc(SAMPC * sizeof(*sampv), NULL);
+	if (!sampv)
+		return ENOMEM;
+
+	/* every sample value, with an odd length to cover the tails */
+	for (i=0; i<SAMPC; i++)
+		sampv[i] = (int16_t)(i * 7);
+
+	aulevel_calc_impl(SIMD_C, sampv, SAMPC, &ref_sum, &ref_peak);
+
+	ASSERT_EQ(32767, ref_peak);
+
+	for (impl=SIMD_C+1; impl<SIMD_N; impl++) {
+
+		uint64_t sum = 0;
+		uint16_t pk = 0;
+
+		if (!simd_supported(impl))
+			continue;
+
+		aulevel_calc_impl(impl, sampv, SAMPC, &sum, &pk);
+
+		if (sum != ref_sum || pk != ref_peak) {
+			warning("aulevel: %s differs\n", simd_name(impl));
+			err = EBADMSG;
+			goto out;
+		}
+	}
+
+	/* nothing measured yet */
+	memset(&lvl, 0, sizeof(lvl));
+	ASSERT_EQ(ENOENT, aulevel_get(&lvl, &rms, &peak));
+
+	/* full-scale square wave is 0 dBov */
+	for (i=0; i<160; i++)
+		sampv[i] = (i & 1) ? 32767 : -32767;
+
+	aulevel_update(&lvl, sampv, 160);
+	err = aulevel_get(&lvl, &rms, &peak);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(rms > -0.01 && rms < 0.01);
+	ASSERT_TRUE(peak > -0.01 && peak < 0.01);
+
+	/* half amplitude is -6 dBov, silence is the floor */
+	for (i=0; i<160; i++)
+		sampv[i] /= 2;
+
+	aulevel_update(&lvl, sampv, 160);
+	err = aulevel_get(&lvl, &rms, &peak);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(rms > -6.03 && rms < -6.01);
+
+	memset(sampv, 0, 160 * sizeof(*sampv));
+
+	aulevel_update(&lvl, sampv, 160);
+	err = aulevel_get(&lvl, &rms, &peak);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(rms == -96.0);
+	ASSERT_EQ(3, lvl.n);
+
+ out:
+	mem_deref(sampv);
+
+	return err;
+}
@@ -0,0 +1,135 @@
+/**
+ * @file test/aumix.c  Test the audio mixing kernels
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "aumix"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum { SAMPC = 4096 + 13 };
+
+
+static int16_t samp(uint32_t *x)
+{
+	*x = *x * 1664525 + 1013904223;
+
+	return (int16_t)(*x >> 16);
+}
+
+
+int test_aumix(void)
+{
+	int16_t *own, *ref, *dst;
+	int32_t *acc;
+	uint32_t x = 1;
+	size_t i;
+	int impl, k;
+	int err = 0;
+
+	own = mem_alloc(SAMPC * sizeof(*own), NULL);
+	ref = mem_alloc(SAMPC * sizeof(*ref), NULL);
+	dst = mem_alloc(SAMPC * sizeof(*dst), NULL);
+	acc = mem_zalloc(SAMPC * sizeof(*acc), NULL);
+	if (!own || !ref || !dst || !acc) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	/* three full-scale talkers saturate the mix */
+	for (k=0; k<3; k++) {
+
+		for (i=0; i<SAMPC; i++)
+			own[i] = samp(&x);
+
+		aumix_acc_impl(SIMD_C, acc, own, SAMPC);
+	}
+
+	for (i=0; i<SAMPC; i++)
+		ref[i] = samp(&x);
+
+	memcpy(dst, ref, SAMPC * sizeof(*dst));
+	aumix_mix_impl(SIMD_C, dst, acc, own, SAMPC);
+
+	for (i=0; i<SAMPC; i++) {
+
+		int32_t v = ref[i] + acc[i] - own[i];
+
+		ASSERT_EQ(min(max(v, -32768), 32767), dst[i]);
+	}
+
+	/* the local signal alone, minus itself, is silence */
+	memset(acc, 0, SAMPC * sizeof(*acc));
+	aumix_acc_impl(SIMD_C, acc, ref, SAMPC);
+	memset(dst, 0, SAMPC * sizeof(*dst));
+	aumix_mix_impl(SIMD_C, dst, acc, ref, SAMPC);
+
+	for (i=0; i<SAMPC; i++)
+		ASSERT_EQ(0, dst[i]);
+
+	for (impl=SIMD_C+1; impl<SIMD_N; impl++) {
+
+		int32_t *acc2;
+		int16_t *dst2;
+
+		if (!simd_supported(impl))
+			continue;
+
+		acc2 = mem_zalloc(SAMPC * sizeof(*acc2), NULL);
+		dst2 = mem_alloc(SAMPC * sizeof(*dst2), NULL);
+		if (!acc2 || !dst2) {
+			mem_deref(acc2);
+			mem_deref(dst2);
+			err = ENOMEM;
+			goto out;
+		}
+
+		/* odd offsets cover unaligned access and the tails */
+		memset(acc, 0, SAMPC * sizeof(*acc));
+		aumix_acc_impl(SIMD_C, acc + 1, own + 1, SAMPC - 1);
+		aumix_acc_impl(SIMD_C, acc + 1, ref + 1, SAMPC - 1);
+		aumix_acc_impl(impl, acc2 + 1, own + 1, SAMPC - 1);
+		aumix_acc_impl(impl, acc2 + 1, ref + 1, SAMPC - 1);
+
+		memcpy(dst, ref, SAMPC * sizeof(*dst));
+		memcpy(dst2, ref, SAMPC * sizeof(*dst2));
+		aumix_mix_impl(SIMD_C, dst + 1, acc + 1, own + 1, SAMPC - 1);
+		aumix_mix_impl(impl, dst2 + 1, acc2 + 1, own + 1, SAMPC - 1);
+
+		if (memcmp(acc, acc2, SAMPC * sizeof(*acc)) ||
+		    memcmp(dst, dst2, SAMPC * sizeof(*dst))) {
+			warning("aumix: %s differs\n", simd_name(impl));
+			err = EBADMSG;
+		}
+
+		/* without an own signal */
+		aumix_mix_impl(SIMD_C, dst, acc, NULL, SAMPC);
+		aumix_mix_impl(impl, dst2, acc2, NULL, SAMPC);
+
+		if (memcmp(dst, dst2, SAMPC * sizeof(*dst))) {
+			warning("aumix: %s differs\n", simd_name(impl));
+			err = EBADMSG;
+		}
+
+		mem_deref(acc2);
+		mem_deref(dst2);
+
+		if (err)
+			goto out;
+	}
+
+ out:
+	mem_deref(acc);
+	mem_deref(dst);
+	mem_deref(ref);
+	mem_deref(own);
+
+	return err;
+}
@@ -0,0 +1,147 @@
+/**
+ * @file test/auring.c  Test the audio ring-buffer
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "auring"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	MIN_SAMP = 4,
+	MAX_SAMP = 16,
+};
+
+
+static void ramp(int16_t *sampv, size_t sampc, int16_t first)
+{
+	size_t i;
+
+	for (i=0; i<sampc; i++)
+		sampv[i] = first + (int16_t)i;
+}
+
+
+static bool is_ramp(const int16_t *sampv, size_t sampc, int16_t first)
+{
+	size_t i;
+
+	for (i=0; i<sampc; i++) {
+		if (sampv[i] != first + (int16_t)i)
+			return false;
+	}
+
+	return true;
+}
+
+
+static bool is_silence(const int16_t *sampv, size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i<sampc; i++) {
+		if (sampv[i])
+			return false;
+	}
+
+	return true;
+}
+
+
+int test_auring(void)
+{
+	struct auring *ar = NULL;
+	int16_t in[2 * MAX_SAMP], out[2 * MAX_SAMP];
+	int16_t wr = 1, rd = 1;
+	int i, err;
+
+	err = auring_alloc(&ar, MIN_SAMP * 2, MAX_SAMP * 2);
+	TEST_ERR(err);
+
+	/* silence until the minimum level is reached */
+	ramp(in, 3, wr);
+	wr += 3;
+	err = auring_write_samp(ar, in, 3);
+	TEST_ERR(err);
+	auring_read_samp(ar, out, 2);
+	ASSERT_TRUE(is_silence(out, 2));
+	ASSERT_EQ(6, auring_cur_size(ar));
+
+	ramp(in, 2, wr);
+	wr += 2;
+	err = auring_write_samp(ar, in, 2);
+	TEST_ERR(err);
+	auring_read_samp(ar, out, 2);
+	ASSERT_TRUE(is_ramp(out, 2, rd));
+	rd += 2;
+
+	/* wrap around the end of the ring, in odd sizes */
+	for (i=0; i<50; i++) {
+
+		ramp(in, 5, wr);
+		wr += 5;
+		err = auring_write_samp(ar, in, 5);
+		TEST_ERR(err);
+
+		auring_read_samp(ar, out, 5);
+		ASSERT_TRUE(is_ramp(out, 5, rd));
+		rd += 5;
+	}
+
+	ASSERT_EQ(6, auring_cur_size(ar));
+
+	/* overflow drops the oldest samples */
+	ramp(in, MAX_SAMP, wr);
+	wr += MAX_SAMP;
+	err = auring_write_samp(ar, in, MAX_SAMP);
+	TEST_ERR(err);
+	ASSERT_EQ(MAX_SAMP * 2, auring_cur_size(ar));
+
+	rd = wr - MAX_SAMP;
+	auring_read_samp(ar, out, MAX_SAMP);
+	ASSERT_TRUE(is_ramp(out, MAX_SAMP, rd));
+	rd += MAX_SAMP;
+	ASSERT_EQ(0, auring_cur_size(ar));
+
+	/* a write larger than the maximum keeps the newest samples */
+	ramp(in, 2 * MAX_SAMP, wr);
+	wr += 2 * MAX_SAMP;
+	err = auring_write_samp(ar, in, 2 * MAX_SAMP);
+	TEST_ERR(err);
+	ASSERT_EQ(MAX_SAMP * 2, auring_cur_size(ar));
+
+	rd = wr - MAX_SAMP;
+	auring_read_samp(ar, out, MAX_SAMP);
+	ASSERT_TRUE(is_ramp(out, MAX_SAMP, rd));
+
+	/* underflow gives silence, and waits for the minimum again */
+	ramp(in, 2, wr);
+	wr += 2;
+	rd = wr - 2;
+	err = auring_write_samp(ar, in, 2);
+	TEST_ERR(err);
+	auring_read_samp(ar, out, 3);
+	ASSERT_TRUE(is_silence(out, 3));
+
+	auring_read_samp(ar, out, 2);
+	ASSERT_TRUE(is_silence(out, 2));
+
+	ramp(in, 2, wr);
+	err = auring_write_samp(ar, in, 2);
+	TEST_ERR(err);
+	auring_read_samp(ar, out, 4);
+	ASSERT_TRUE(is_ramp(out, 4, rd));
+	ASSERT_EQ(0, auring_cur_size(ar));
+
+ out:
+	mem_deref(ar);
+
+	return err;
+}
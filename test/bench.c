@@ -0,0 +1,946 @@
+/**
+ * @file test/bench.c  Baresip selftest -- benchmarks
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <time.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+/*
+ * The benchmarks print one JSON object on stdout, so that the results
+ * of two commits can be compared by a script. Micro-benchmarks time one
+ * function in a loop. The call benchmark sets up a number of calls from
+ * one UA to another over loopback, with mock audio devices and a cheap
+ * codec, holds them, and reports the setup time, the CPU per call, the
+ * packet rate and the latency from encoder to decoder.
+ */
+
+
+enum {
+	BENCH_CALLS   = 20,
+	BENCH_HOLD    = 5000,     /**< Time the calls are held in [ms] */
+	BENCH_TIMEOUT = 30000,
+	FRAME         = 160,
+	PAYLOAD_SIZE  = 160,
+	RTP_HDR_SIZE  = 12,
+	TS_SIZE       = 8,
+};
+
+struct bench {
+	struct re_printf *pf;
+	bool first;
+	int err;
+};
+
+struct bench_call {
+	struct call *call;
+	uint64_t ts;
+};
+
+struct bench_calls {
+	struct ua *a, *b;
+	struct bench_call callv[BENCH_CALLS];
+	struct tmr tmr;
+	struct histo setup;       /**< Call setup time [us]           */
+	struct histo latency;     /**< Encoder to decoder [us]        */
+	unsigned n_established;
+	unsigned n_failed;
+	uint64_t ts_hold;
+	clock_t cpu_hold;
+	uint64_t pkts_tx, pkts_rx;
+	double cpu_percent;       /**< CPU per call in [%]            */
+	int err;
+};
+
+
+static struct bench_calls *bcalls;
+
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void bench_report(struct bench *b, const char *name,
+			 const char *unit, uint64_t ops, uint64_t usec)
+{
+	usec = max(usec, 1);
+
+	b->err |= re_hprintf(b->pf, "%s\n    {\"name\":\"%s\",\"unit\":\"%s\""
+			     ",\"ops\":%llu,\"ns_per_op\":%.2f"
+			     ",\"ops_per_sec\":%llu}",
+			     b->first ? "" : ",", name, unit, ops,
+			     (double)usec * 1000 / ops,
+			     ops * 1000000 / usec);
+
+	b->first = false;
+}
+
+
+static void bench_g711(struct bench *b)
+{
+#define G711_FRAMES 100000
+	int16_t pcm[FRAME];
+	uint8_t enc[FRAME];
+	char name[64];
+	uint64_t t0;
+	size_t i;
+	int impl;
+
+	g711_batch_init();
+
+	for (i=0; i<FRAME; i++)
+		pcm[i] = (int16_t)(rand_u16() >> 1) - 16384;
+
+	t0 = now_us();
+	for (i=0; i<G711_FRAMES; i++)
+		g711_encode_batch(G711_ULAW, enc, pcm, FRAME);
+	bench_report(b, "g711_encode_ulaw", "sample",
+		     (uint64_t)G711_FRAMES * FRAME, now_us() - t0);
+
+	t0 = now_us();
+	for (i=0; i<G711_FRAMES; i++)
+		g711_decode_batch(G711_ULAW, pcm, enc, FRAME);
+	bench_report(b, "g711_decode_ulaw", "sample",
+		     (uint64_t)G711_FRAMES * FRAME, now_us() - t0);
+
+	t0 = now_us();
+	for (i=0; i<G711_FRAMES; i++)
+		g711_encode_batch(G711_ALAW, enc, pcm, FRAME);
+	bench_report(b, "g711_encode_alaw", "sample",
+		     (uint64_t)G711_FRAMES * FRAME, now_us() - t0);
+
+	t0 = now_us();
+	for (i=0; i<G711_FRAMES; i++)
+		g711_decode_batch(G711_ALAW, pcm, enc, FRAME);
+	bench_report(b, "g711_decode_alaw", "sample",
+		     (uint64_t)G711_FRAMES * FRAME, now_us() - t0);
+
+	/* each implementation of the decoder */
+	for (impl=SIMD_C; impl<SIMD_N; impl++) {
+
+		if (!simd_supported(impl))
+			continue;
+
+		re_snprintf(name, sizeof(name), "g711_decode_alaw_%s",
+			    simd_name(impl));
+
+		t0 = now_us();
+		for (i=0; i<G711_FRAMES; i++)
+			g711_decode_batch_impl(impl, G711_ALAW, pcm, enc,
+					       FRAME);
+		bench_report(b, name, "sample",
+			     (uint64_t)G711_FRAMES * FRAME, now_us() - t0);
+	}
+}
+
+
+static void bench_resamp(struct bench *b)
+{
+#define RESAMP_FRAMES 2000
+	static const struct {
+		uint32_t irate, orate;
+	} ratev[] = {
+		{ 8000, 48000},
+		{16000, 48000},
+		{44100, 48000},
+		{48000, 16000},
+	};
+	enum { RESAMP_MAXC = 48000 * 20 / 1000 * 8 };
+	int16_t *inv, *outv;
+	char name[64];
+	size_t i, n;
+	uint64_t t0;
+	int be, impl;
+	int err = 0;
+
+	inv  = mem_zalloc(RESAMP_MAXC * sizeof(int16_t), NULL);
+	outv = mem_zalloc(RESAMP_MAXC * sizeof(int16_t), NULL);
+	if (!inv || !outv) {
+		b->err = ENOMEM;
+		goto out;
+	}
+
+	for (i=0; i<RESAMP_MAXC; i++)
+		inv[i] = (int16_t)(rand_u16() >> 2) - 8192;
+
+	for (i=0; i<ARRAY_SIZE(ratev) && !err; i++) {
+
+		const uint32_t irate = ratev[i].irate, orate = ratev[i].orate;
+		const size_t frames = irate * 20 / 1000;
+
+		for (be=RESAMP_POLYPHASE; be<=RESAMP_LIBREM; be++) {
+
+			for (impl=SIMD_C; impl<SIMD_N; impl++) {
+
+				struct resamp *rs = NULL;
+
+				if (!simd_supported(impl))
+					continue;
+
+				if (be == RESAMP_LIBREM && impl != SIMD_C)
+					break;
+
+				/* librem handles some ratios only */
+				if (resamp_alloc(&rs, be, irate, 1, orate, 1))
+					break;
+
+				resamp_set_simd(rs, impl);
+
+				if (be == RESAMP_LIBREM) {
+					re_snprintf(name, sizeof(name),
+						    "resamp_%u_%u_%s",
+						    irate, orate,
+						    resamp_backend_name(be));
+				}
+				else {
+					re_snprintf(name, sizeof(name),
+						    "resamp_%u_%u_%s_%s",
+						    irate, orate,
+						    resamp_backend_name(be),
+						    simd_name(impl));
+				}
+
+				t0 = now_us();
+
+				for (n=0; n<RESAMP_FRAMES && !err; n++) {
+					size_t outc = RESAMP_MAXC;
+
+					err = resamp_process(rs, outv, &outc,
+							     inv, frames);
+				}
+
+				if (!err)
+					bench_report(b, name, "sample",
+						     (uint64_t)frames *
+						     RESAMP_FRAMES,
+						     now_us() - t0);
+
+				mem_deref(rs);
+			}
+		}
+	}
+
+ out:
+	if (err)
+		warning("bench: resamp: %m\n", err);
+	mem_deref(outv);
+	mem_deref(inv);
+}
+
+
+static void udp_recv_handler(const struct sa *src, struct mbuf *mb,
+			     void *arg)
+{
+	(void)src;
+	(void)mb;
+	(void)arg;
+}
+
+
+/* Bursts of video-sized packets, batched and with UDP segmentation */
+static void bench_udpbatch(struct bench *b)
+{
+#define UDP_BURSTS 2000
+#define UDP_BURST    32
+	struct udp_sock *tx = NULL, *rx = NULL;
+	struct udpbatch *ub = NULL;
+	struct mbuf *mb = NULL;
+	struct sa laddr, dst;
+	uint64_t t0;
+	size_t i, j;
+	int mode;
+
+	if (sa_set_str(&laddr, "127.0.0.1", 0))
+		return;
+
+	if (udp_listen(&rx, &laddr, udp_recv_handler, NULL) ||
+	    udp_local_get(rx, &dst) ||
+	    udp_listen(&tx, &laddr, udp_recv_handler, NULL) ||
+	    udpbatch_alloc(&ub, tx))
+		goto out;
+
+	mb = mbuf_alloc(1200);
+	if (!mb || mbuf_fill(mb, 0x5a, 1200))
+		goto out;
+
+	for (mode=0; mode<2; mode++) {
+
+		const bool gso = udpbatch_set_gso(ub, mode == 1);
+
+		if (mode == 1 && !gso)
+			break;
+
+		t0 = now_us();
+		for (i=0; i<UDP_BURSTS; i++) {
+
+			udpbatch_start(ub);
+
+			for (j=0; j<UDP_BURST; j++) {
+				mb->pos = 0;
+				(void)udp_send(tx, &dst, mb);
+			}
+
+			(void)udpbatch_flush(ub);
+		}
+		bench_report(b, gso ? "udp_send_gso" : "udp_send_batch",
+			     "packet", (uint64_t)UDP_BURSTS * UDP_BURST,
+			     now_us() - t0);
+	}
+
+ out:
+	mem_deref(ub);
+	mem_deref(tx);
+	mem_deref(rx);
+	mem_deref(mb);
+}
+
+
+static int srtp_packet(struct mbuf *mb, const uint8_t *payload,
+		       uint16_t seq)
+{
+	struct rtp_header hdr;
+	int err;
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	hdr.ver  = RTP_VERSION;
+	hdr.pt   = 0;
+	hdr.seq  = seq;
+	hdr.ts   = seq * FRAME;
+	hdr.ssrc = 0x01020304;
+
+	mbuf_rewind(mb);
+
+	err  = rtp_hdr_encode(mb, &hdr);
+	err |= mbuf_write_mem(mb, payload, PAYLOAD_SIZE);
+	mb->pos = 0;
+
+	return err;
+}
+
+
+static void bench_srtp(struct bench *b)
+{
+#define SRTP_PACKETS 100000
+	uint8_t key[16 + 14], payload[PAYLOAD_SIZE];
+	struct srtp *tx = NULL, *rx = NULL;
+	struct mbuf *mb;
+	uint64_t t_enc = 0, t_dec = 0, t0;
+	uint32_t n;
+	int err;
+
+	mb = mbuf_alloc(RTP_HDR_SIZE + PAYLOAD_SIZE + 16);
+	if (!mb) {
+		b->err = ENOMEM;
+		return;
+	}
+
+	rand_bytes(key, sizeof(key));
+	rand_bytes(payload, sizeof(payload));
+
+	err  = srtp_alloc(&tx, SRTP_AES_CM_128_HMAC_SHA1_80, key,
+			  sizeof(key), 0);
+	err |= srtp_alloc(&rx, SRTP_AES_CM_128_HMAC_SHA1_80, key,
+			  sizeof(key), 0);
+	if (err)
+		goto out;
+
+	for (n=0; n<SRTP_PACKETS && !err; n++) {
+
+		err = srtp_packet(mb, payload, (uint16_t)n);
+
+		t0 = now_us();
+		err |= srtp_encrypt(tx, mb);
+		t_enc += now_us() - t0;
+
+		mb->pos = 0;
+
+		t0 = now_us();
+		err |= srtp_decrypt(rx, mb);
+		t_dec += now_us() - t0;
+	}
+	if (err)
+		goto out;
+
+	bench_report(b, "srtp_encrypt_aes128_sha1_80", "packet",
+		     SRTP_PACKETS, t_enc);
+	bench_report(b, "srtp_decrypt_aes128_sha1_80", "packet",
+		     SRTP_PACKETS, t_dec);
+
+ out:
+	if (err)
+		warning("bench: srtp: %m\n", err);
+	mem_deref(rx);
+	mem_deref(tx);
+	mem_deref(mb);
+}
+
+
+static void bench_jbuf(struct bench *b)
+{
+#define JBUF_PACKETS 200000
+	struct jbuf *jb = NULL;
+	struct rtp_header hdr;
+	uint64_t t0;
+	uint32_t n;
+	int err;
+
+	err = jbuf_alloc(&jb, 1, 10);
+	if (err)
+		goto out;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ssrc = 0x01020304;
+
+	t0 = now_us();
+
+	for (n=0; n<JBUF_PACKETS; n++) {
+
+		struct rtp_header hdr2;
+		void *mem = mem_zalloc(PAYLOAD_SIZE, NULL);
+		void *out = NULL;
+
+		if (!mem) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		hdr.seq = (uint16_t)n;
+		hdr.ts  = n * FRAME;
+
+		err = jbuf_put(jb, &hdr, mem);
+		mem_deref(mem);
+		if (err)
+			goto out;
+
+		/* keep the buffer at its minimum, as in a call */
+		if (0 == jbuf_get(jb, &hdr2, &out))
+			mem_deref(out);
+	}
+
+	bench_report(b, "jbuf_put_get", "packet", JBUF_PACKETS,
+		     now_us() - t0);
+
+ out:
+	if (err)
+		warning("bench: jbuf: %m\n", err);
+	mem_deref(jb);
+}
+
+
+#ifdef USE_VIDEO
+static int packet_handler(bool marker, const uint8_t *hdr, size_t hdr_len,
+			  const uint8_t *pld, size_t pld_len, void *arg)
+{
+	size_t *bytes = arg;
+	(void)marker;
+	(void)hdr;
+
+	*bytes += hdr_len + pld_len;
+
+	return 0;
+}
+
+
+static void bench_h264(struct bench *b)
+{
+#define H264_FRAMES 2000
+	enum { FRAME_SIZE = 50000, NAL_SIZE = 5000 };
+	uint8_t *frame;
+	size_t i, bytes = 0;
+	char name[64];
+	uint64_t t0;
+	int impl;
+	int err = 0;
+
+	frame = mem_alloc(FRAME_SIZE, NULL);
+	if (!frame) {
+		b->err = ENOMEM;
+		return;
+	}
+
+	rand_bytes(frame, FRAME_SIZE);
+
+	/* NAL units with start codes, no start code in the payload */
+	for (i=0; i<FRAME_SIZE; i++) {
+		if (frame[i] == 0)
+			frame[i] = 1;
+	}
+	for (i=0; i+4<FRAME_SIZE; i+=NAL_SIZE) {
+		frame[i] = frame[i+1] = frame[i+2] = 0;
+		frame[i+3] = 1;
+		frame[i+4] = H264_NAL_SLICE;
+	}
+
+	t0 = now_us();
+
+	for (i=0; i<H264_FRAMES && !err; i++)
+		err = h264_packetize(frame, FRAME_SIZE, 1200,
+				     packet_handler, &bytes);
+
+	if (!err)
+		bench_report(b, "h264_packetize", "frame", H264_FRAMES,
+			     now_us() - t0);
+
+	/* each start code scanner, on a buffer without start codes */
+	for (i=0; i<FRAME_SIZE; i++) {
+		if (frame[i] == 0)
+			frame[i] = 1;
+	}
+
+	for (impl=SIMD_C; impl<SIMD_N; impl++) {
+
+		if (!simd_supported(impl))
+			continue;
+
+		re_snprintf(name, sizeof(name), "h264_startcode_%s",
+			    simd_name(impl));
+
+		t0 = now_us();
+		for (i=0; i<H264_FRAMES; i++)
+			(void)h264_find_startcode_impl(impl, frame,
+						       frame + FRAME_SIZE);
+		bench_report(b, name, "frame", H264_FRAMES, now_us() - t0);
+	}
+
+	mem_deref(frame);
+}
+
+
+static void bench_vidconv(struct bench *b)
+{
+#define VIDCONV_FRAMES 50
+	static const struct {
+		enum vidfmt src, dst;
+		const char *name;
+	} pairv[] = {
+		{VID_FMT_YUYV422, VID_FMT_YUV420P, "vidconv_yuyv422_yuv420p"},
+		{VID_FMT_NV12,    VID_FMT_YUV420P, "vidconv_nv12_yuv420p"},
+		{VID_FMT_YUV420P, VID_FMT_RGB32,   "vidconv_yuv420p_rgb32"},
+	};
+	static const struct {
+		enum vidfmt fmt;
+		struct vidsz src, dst;
+		const char *name;
+	} scalev[] = {
+		{VID_FMT_YUV420P, {1280, 720},  {640, 360},
+		 "vidconv_scale_720p_360p"},
+		{VID_FMT_YUV420P, {1280, 720},  {320, 180},
+		 "vidconv_scale_720p_180p"},
+		{VID_FMT_YUV420P, {1280, 720},  {352, 288},
+		 "vidconv_scale_720p_cif"},
+		{VID_FMT_NV12,    {1280, 720},  {640, 360},
+		 "vidconv_scale_nv12_720p_360p"},
+		{VID_FMT_YUV420P, {640, 360},   {1280, 720},
+		 "vidconv_scale_360p_720p"},
+		{VID_FMT_YUV420P, {3840, 2160}, {1920, 1080},
+		 "vidconv_scale_2160p_1080p"},
+	};
+	const struct vidsz sz = {1280, 720};
+	struct vidframe *src = NULL, *dst = NULL;
+	char name[64];
+	uint64_t t0;
+	size_t i;
+	int impl, n;
+	int err = 0;
+
+	for (i=0; i<ARRAY_SIZE(pairv); i++) {
+
+		err |= vidframe_alloc(&src, pairv[i].src, &sz);
+		err |= vidframe_alloc(&dst, pairv[i].dst, &sz);
+		if (err)
+			goto out;
+
+		vidframe_fill_color(src, 0x40, 0x80, 0xc0);
+
+		t0 = now_us();
+		for (n=0; n<VIDCONV_FRAMES; n++)
+			vidconv_fast(dst, src, NULL);
+		bench_report(b, pairv[i].name, "frame", VIDCONV_FRAMES,
+			     now_us() - t0);
+
+		/* each implementation of the converter */
+		for (impl=SIMD_C; impl<SIMD_N && !err; impl++) {
+
+			if (!simd_supported(impl))
+				continue;
+
+			re_snprintf(name, sizeof(name), "%s_%s",
+				    pairv[i].name, simd_name(impl));
+
+			t0 = now_us();
+			for (n=0; n<VIDCONV_FRAMES && !err; n++)
+				err = vidconv_fast_impl(impl, dst, src);
+			if (!err)
+				bench_report(b, name, "frame",
+					     VIDCONV_FRAMES, now_us() - t0);
+		}
+
+		src = mem_deref(src);
+		dst = mem_deref(dst);
+	}
+
+	for (i=0; i<ARRAY_SIZE(scalev) && !err; i++) {
+
+		err |= vidframe_alloc(&src, scalev[i].fmt, &scalev[i].src);
+		err |= vidframe_alloc(&dst, VID_FMT_YUV420P, &scalev[i].dst);
+		if (err)
+			goto out;
+
+		vidframe_fill_color(src, 0x40, 0x80, 0xc0);
+
+		t0 = now_us();
+		for (n=0; n<VIDCONV_FRAMES && !err; n++)
+			err = vidconv_scale(dst, src, NULL);
+		if (!err)
+			bench_report(b, scalev[i].name, "frame",
+				     VIDCONV_FRAMES, now_us() - t0);
+
+		src = mem_deref(src);
+		dst = mem_deref(dst);
+	}
+
+ out:
+	if (err)
+		warning("bench: vidconv: %m\n", err);
+	mem_deref(src);
+	mem_deref(dst);
+}
+#endif
+
+
+/*
+ * The codec of the call benchmark sends the time of the encoder with
+ * each frame, and the decoder records the latency.
+ */
+static int bench_encode(struct auenc_state *aes, uint8_t *buf, size_t *len,
+			const int16_t *sampv, size_t sampc)
+{
+	uint64_t ts = now_us();
+	(void)aes;
+
+	if (*len < TS_SIZE + sampc)
+		return ENOMEM;
+
+	memcpy(buf, &ts, TS_SIZE);
+	g711_encode_batch(G711_ALAW, buf + TS_SIZE, sampv, sampc);
+
+	*len = TS_SIZE + sampc;
+
+	return 0;
+}
+
+
+static int bench_decode(struct audec_state *ads, int16_t *sampv,
+			size_t *sampc, const uint8_t *buf, size_t len)
+{
+	uint64_t ts;
+	(void)ads;
+
+	if (len < TS_SIZE || *sampc < len - TS_SIZE)
+		return EINVAL;
+
+	memcpy(&ts, buf, TS_SIZE);
+
+	if (bcalls && bcalls->ts_hold)
+		histo_add(&bcalls->latency, (uint32_t)(now_us() - ts));
+
+	g711_decode_batch(G711_ALAW, sampv, buf + TS_SIZE, len - TS_SIZE);
+
+	*sampc = len - TS_SIZE;
+
+	return 0;
+}
+
+
+static struct aucodec bench_codec = {
+	.pt    = "96",
+	.name  = "X-BENCH",
+	.srate = 8000,
+	.crate = 8000,
+	.ch    = 1,
+	.ench  = bench_encode,
+	.dech  = bench_decode,
+};
+
+
+static void packets_count(const struct ua *ua, uint64_t *tx, uint64_t *rx)
+{
+	struct le *le;
+
+	for (le = list_head(ua_calls(ua)); le; le = le->next) {
+
+		struct le *les;
+
+		for (les = list_head(call_streaml(le->data)); les;
+		     les = les->next) {
+
+			struct stream_stat stx, srx;
+
+			if (stream_stats(les->data, &stx, &srx))
+				continue;
+
+			*tx += stx.n_packets;
+			*rx += srx.n_packets;
+		}
+	}
+}
+
+
+static void hold_handler(void *arg)
+{
+	struct bench_calls *bc = arg;
+	uint64_t tx = 0, rx = 0, usec;
+	clock_t cpu;
+
+	usec = max(now_us() - bc->ts_hold, 1);
+	cpu  = clock() - bc->cpu_hold;
+
+	packets_count(bc->a, &tx, &rx);
+	packets_count(bc->b, &tx, &rx);
+
+	bc->pkts_tx = (tx - bc->pkts_tx) * 1000000 / usec;
+	bc->pkts_rx = (rx - bc->pkts_rx) * 1000000 / usec;
+
+	if (bc->n_established) {
+		bc->cpu_percent = (double)cpu / CLOCKS_PER_SEC * 1e8
+			/ usec / bc->n_established;
+	}
+
+	re_cancel();
+}
+
+
+static void hold_start(struct bench_calls *bc)
+{
+	bc->pkts_tx = bc->pkts_rx = 0;
+
+	packets_count(bc->a, &bc->pkts_tx, &bc->pkts_rx);
+	packets_count(bc->b, &bc->pkts_tx, &bc->pkts_rx);
+
+	bc->ts_hold  = now_us();
+	bc->cpu_hold = clock();
+
+	tmr_start(&bc->tmr, BENCH_HOLD, hold_handler, bc);
+}
+
+
+static void bench_event_handler(struct ua *ua, enum ua_event ev,
+				struct call *call, const char *prm,
+				void *arg)
+{
+	struct bench_calls *bc = arg;
+	size_t i;
+	(void)prm;
+
+	switch (ev) {
+
+	case UA_EVENT_CALL_INCOMING:
+		if (ua == bc->b) {
+			bc->err = ua_answer(ua, call);
+			if (bc->err)
+				re_cancel();
+		}
+		return;
+
+	case UA_EVENT_CALL_ESTABLISHED:
+		if (ua != bc->a)
+			return;
+
+		for (i=0; i<ARRAY_SIZE(bc->callv); i++) {
+
+			if (bc->callv[i].call != call)
+				continue;
+
+			histo_add(&bc->setup,
+				  (uint32_t)(now_us() - bc->callv[i].ts));
+			break;
+		}
+
+		++bc->n_established;
+		break;
+
+	case UA_EVENT_CALL_CLOSED:
+		if (ua != bc->a || bc->ts_hold)
+			return;
+
+		++bc->n_failed;
+		break;
+
+	default:
+		return;
+	}
+
+	if (!bc->ts_hold &&
+	    bc->n_established + bc->n_failed == ARRAY_SIZE(bc->callv))
+		hold_start(bc);
+}
+
+
+static int histo_print(struct re_printf *pf, const struct histo *h)
+{
+	return re_hprintf(pf, "{\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}",
+			  histo_percentile(h, 50), histo_percentile(h, 90),
+			  histo_percentile(h, 99), histo_max(h));
+}
+
+
+static void bench_calls(struct bench *b)
+{
+	struct config *cfg = conf_config();
+	struct config_call call_cfg = cfg->call;
+	struct config_audio audio_cfg = cfg->audio;
+	struct ausrc *ausrc = NULL;
+	struct auplay *auplay = NULL;
+	struct bench_calls *bc;
+	struct sa laddr;
+	char uri[256];
+	size_t i;
+	int err;
+
+	bc = mem_zalloc(sizeof(*bc), NULL);
+	if (!bc) {
+		b->err = ENOMEM;
+		return;
+	}
+
+	bcalls = bc;
+	tmr_init(&bc->tmr);
+
+	/* no limits on the number of calls */
+	memset(&cfg->call, 0, sizeof(cfg->call));
+
+	str_ncpy(cfg->audio.src_mod, "mock-ausrc",
+		 sizeof(cfg->audio.src_mod));
+	str_ncpy(cfg->audio.play_mod, "mock-auplay",
+		 sizeof(cfg->audio.play_mod));
+
+	err  = mock_ausrc_register(&ausrc);
+	err |= mock_auplay_register(&auplay);
+	if (err)
+		goto out;
+
+	g711_batch_init();
+	aucodec_register(&bench_codec);
+
+	err = ua_init("bench", true, false, false, false);
+	if (err)
+		goto out;
+
+	err  = ua_alloc(&bc->a, "A <sip:a@127.0.0.1>;regint=0");
+	err |= ua_alloc(&bc->b, "B <sip:b@127.0.0.1>;regint=0");
+	if (err)
+		goto out;
+
+	err = uag_event_register(bench_event_handler, bc);
+	if (err)
+		goto out;
+
+	err = sip_transp_laddr(uag_sip(), &laddr, SIP_TRANSP_UDP, NULL);
+	if (err)
+		goto out;
+
+	re_snprintf(uri, sizeof(uri), "sip:b@%J", &laddr);
+
+	for (i=0; i<ARRAY_SIZE(bc->callv); i++) {
+
+		bc->callv[i].ts = now_us();
+
+		err = ua_connect(bc->a, &bc->callv[i].call, NULL, uri,
+				 NULL, VIDMODE_OFF);
+		if (err)
+			goto out;
+	}
+
+	err = re_main_timeout(BENCH_TIMEOUT);
+	if (err)
+		goto out;
+	if (bc->err) {
+		err = bc->err;
+		goto out;
+	}
+
+	b->err |= re_hprintf(b->pf,
+			     "\n  ],\n  \"calls\":{\"count\":%zu"
+			     ",\"hold_ms\":%u,\"established\":%u"
+			     ",\"failed\":%u,\n    \"setup_us\":%H"
+			     ",\n    \"media_latency_us\":%H"
+			     ",\n    \"cpu_percent_per_call\":%.2f"
+			     ",\"packets_per_sec_tx\":%llu"
+			     ",\"packets_per_sec_rx\":%llu}",
+			     ARRAY_SIZE(bc->callv), BENCH_HOLD,
+			     bc->n_established, bc->n_failed,
+			     histo_print, &bc->setup,
+			     histo_print, &bc->latency,
+			     bc->cpu_percent,
+			     bc->pkts_tx, bc->pkts_rx);
+
+ out:
+	if (err) {
+		warning("bench: calls: %m\n", err);
+		b->err |= re_hprintf(b->pf, "\n  ]");
+		b->err |= err;
+	}
+
+	tmr_cancel(&bc->tmr);
+	uag_event_unregister(bench_event_handler);
+
+	mem_deref(bc->b);
+	mem_deref(bc->a);
+	ua_stop_all(true);
+	ua_close();
+
+	aucodec_unregister(&bench_codec);
+	mem_deref(auplay);
+	mem_deref(ausrc);
+
+	cfg->call  = call_cfg;
+	cfg->audio = audio_cfg;
+
+	bcalls = NULL;
+	mem_deref(bc);
+}
+
+
+/**
+ * Run all benchmarks, and print the results as JSON
+ *
+ * @param pf Print function for the results
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int bench_run(struct re_printf *pf)
+{
+	struct bench b = {pf, true, 0};
+
+	b.err |= re_hprintf(pf, "{\n  \"version\":\"%s\",\n  \"micro\":[",
+			    BARESIP_VERSION);
+
+	bench_g711(&b);
+	bench_resamp(&b);
+	bench_srtp(&b);
+	bench_jbuf(&b);
+	bench_udpbatch(&b);
+#ifdef USE_VIDEO
+	bench_h264(&b);
+	bench_vidconv(&b);
+#endif
+
+	/* closes the list of micro-benchmarks */
+	bench_calls(&b);
+
+	b.err |= re_hprintf(pf, "\n}\n");
+
+	return b.err;
+}
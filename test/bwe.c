@@ -0,0 +1,151 @@
+/**
+ * @file test/bwe.c  Test the receive bandwidth estimation
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "bwe"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	SRATE   = 90000,
+	FPS     = 30,
+	PKTC    = 5,         /* packets per frame    */
+	PKTSIZE = 1200,      /* bytes per packet     */
+	RATE    = FPS * PKTC * PKTSIZE * 8,
+};
+
+
+/*
+ * Send frames at a fixed rate over a path that delays each frame by
+ * extra [us] more than the one before, which is a growing queue
+ */
+static void path(struct bwe *bwe, uint64_t *now, uint32_t *ts,
+		 unsigned framec, uint64_t extra)
+{
+	unsigned i, j;
+
+	for (i=0; i<framec; i++) {
+
+		for (j=0; j<PKTC; j++)
+			bwe_packet(bwe, *now + j * 1000, *ts, PKTSIZE);
+
+		*now += 1000000 / FPS + extra;
+		*ts  += SRATE / FPS;
+	}
+}
+
+
+static int test_bwe_estimate(void)
+{
+	struct bwe *bwe = NULL;
+	uint64_t now = 1000000;
+	uint32_t ts = 0x12345678, rate;
+	int err;
+
+	err = bwe_alloc(&bwe, SRATE, 50000, 4000000);
+	TEST_ERR(err);
+
+	ASSERT_EQ(4000000, bwe_estimate(bwe));
+
+	/* a steady path follows the received rate */
+	path(bwe, &now, &ts, 5 * FPS, 0);
+
+	rate = bwe_estimate(bwe);
+	ASSERT_TRUE(rate >= RATE);
+	ASSERT_TRUE(rate < RATE * 2);
+
+	/* a growing queue decreases the estimate below the rate */
+	path(bwe, &now, &ts, 3 * FPS, 5000);
+
+	rate = bwe_estimate(bwe);
+	ASSERT_TRUE(rate < RATE * 9 / 10);
+	ASSERT_TRUE(rate >= 50000);
+
+	/* and it rises again when the queue is gone */
+	path(bwe, &now, &ts, 10 * FPS, 0);
+
+	ASSERT_TRUE(bwe_estimate(bwe) > rate);
+
+ out:
+	mem_deref(bwe);
+
+	return err;
+}
+
+
+static int test_bwe_remb(void)
+{
+	static const uint32_t ratev[] = {
+		0, 1, 262143, 262144, 1500000, 123456789
+	};
+	struct mbuf *mb;
+	uint32_t rate;
+	size_t i;
+	int err = 0;
+
+	mb = mbuf_alloc(64);
+	if (!mb)
+		return ENOMEM;
+
+	for (i=0; i<ARRAY_SIZE(ratev); i++) {
+
+		uint32_t exp = 0;
+
+		mbuf_rewind(mb);
+
+		err = bwe_remb_encode(mb, ratev[i], 0xdeadbeef);
+		TEST_ERR(err);
+
+		ASSERT_EQ(12, mb->end);
+		ASSERT_TRUE(0 == memcmp(mb->buf, "REMB", 4));
+		ASSERT_EQ(1, mb->buf[4]);
+
+		mb->pos = 0;
+		err = bwe_remb_decode(&rate, mb);
+		TEST_ERR(err);
+
+		/* rounded down to 18 bits of mantissa */
+		while ((ratev[i] >> exp) >= (1u << 18))
+			++exp;
+
+		ASSERT_EQ(ratev[i] >> exp << exp, rate);
+		ASSERT_EQ(0, mb->pos);
+	}
+
+	/* other application layer feedback */
+	mbuf_rewind(mb);
+	err = mbuf_write_str(mb, "ABCD1234");
+	TEST_ERR(err);
+
+	mb->pos = 0;
+	ASSERT_EQ(EBADMSG, bwe_remb_decode(&rate, mb));
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+int test_bwe(void)
+{
+	int err;
+
+	err = test_bwe_estimate();
+	if (err)
+		return err;
+
+	err = test_bwe_remb();
+	if (err)
+		return err;
+
+	return 0;
+}
@@ -224,7 +224,46 @@ int test_call_answer(void)
 	ASSERT_EQ(1, fix.b.n_established);
 	ASSERT_EQ(0, fix.b.n_closed);
 
+	/* both UAs have a call with the same Call-ID */
+	ASSERT_TRUE(ua_call(f->a.ua) ==
+		    ua_find_call(f->a.ua, call_id(ua_call(f->a.ua))));
+	ASSERT_TRUE(ua_call(f->b.ua) ==
+		    ua_find_call(f->b.ua, call_id(ua_call(f->a.ua))));
+	ASSERT_TRUE(NULL == ua_find_call(f->a.ua, "not-found"));
+
+ out:
+	fixture_close(f);
+
+	return err;
+}
+
+
+int test_call_max_calls(void)
+{
+	struct config *cfg = conf_config();
+	uint32_t max_total = cfg->call.max_calls_total;
+	struct fixture fix, *f = &fix;
+	int err = 0;
+
+	fixture_init(f);
+
+	/* the outgoing call of A uses the only call slot */
+	cfg->call.max_calls_total = 1;
+	f->b.failed = true;
+
+	err = ua_connect(f->a.ua, 0, NULL, f->buri, NULL, VIDMODE_OFF);
+	TEST_ERR(err);
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_EQ(1, fix.a.n_closed);
+	ASSERT_EQ(486, fix.a.close_scode);
+	ASSERT_EQ(0, fix.b.n_incoming);
+
  out:
+	cfg->call.max_calls_total = max_total;
 	fixture_close(f);
 
 	return err;
@@ -364,3 +403,50 @@ int test_call_answer_hangup_b(void)
 
 	return err;
 }
+
+
+int test_call_stats(void)
+{
+	struct fixture fix, *f = &fix;
+	struct call_stats st;
+	struct stream_stat rx;
+	struct call *call;
+	int err = 0;
+
+	fixture_init(f);
+
+	f->behaviour = BEHAVIOUR_ANSWER;
+
+	err = ua_connect(f->a.ua, 0, NULL, f->buri, NULL, VIDMODE_OFF);
+	TEST_ERR(err);
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	call = ua_call(f->a.ua);
+	ASSERT_TRUE(call != NULL);
+
+	ASSERT_EQ(EINVAL, call_stats_get(NULL, &st));
+	ASSERT_EQ(EINVAL, call_stats_get(call, NULL));
+
+	err = call_stats_get(call, &st);
+	TEST_ERR(err);
+
+	/* the counters are the ones of the stream */
+	ASSERT_TRUE(st.audio.active);
+	ASSERT_TRUE(!st.video.active);
+	ASSERT_TRUE(st.duration <= 5);
+	ASSERT_EQ(0, st.vid.n_frames_tx);
+
+	err = stream_stats(audio_strm(call_audio(call)), NULL, &rx);
+	TEST_ERR(err);
+
+	ASSERT_EQ(rx.n_packets, st.audio.rx.n_packets);
+	ASSERT_EQ(rx.n_bytes, st.audio.rx.n_bytes);
+
+ out:
+	fixture_close(f);
+
+	return err;
+}
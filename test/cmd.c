@@ -75,3 +75,152 @@ int test_cmd(void)
  out:
 	return err;
 }
+
+
+static int cmd_other(struct re_printf *pf, void *arg)
+{
+	(void)pf;
+	(void)arg;
+
+	return EPROTO;
+}
+
+
+static const struct cmd cmdv_other[] = {
+	{'@',       0, "Other command", cmd_other},
+};
+
+
+int test_cmd_override(void)
+{
+	int err = 0;
+
+	cmd_called = false;
+
+	err = cmd_register(cmdv, ARRAY_SIZE(cmdv));
+	ASSERT_EQ(0, err);
+	err = cmd_register(cmdv_other, ARRAY_SIZE(cmdv_other));
+	ASSERT_EQ(0, err);
+
+	/* the last block registered for a key has it */
+	err = cmd_process(NULL, '@', &pf_null);
+	ASSERT_EQ(EPROTO, err);
+	ASSERT_EQ(false, cmd_called);
+
+	/* and gives it back when it is unregistered */
+	cmd_unregister(cmdv_other);
+
+	err = cmd_process(NULL, '@', &pf_null);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(true, cmd_called);
+
+ out:
+	cmd_unregister(cmdv_other);
+	cmd_unregister(cmdv);
+
+	return err;
+}
+
+
+static int cmd_prm(struct re_printf *pf, void *arg)
+{
+	struct cmd_arg *carg = arg;
+	int err = 0;
+	(void)pf;
+
+	ASSERT_EQ('/', carg->key);
+	ASSERT_STREQ("hello world", carg->prm);
+	ASSERT_EQ(true, carg->complete);
+
+	cmd_called = true;
+
+ out:
+	return err;
+}
+
+
+static const struct cmd cmdv_prm[] = {
+	{'/', CMD_PRM, "Command with parameter", cmd_prm},
+};
+
+
+int test_cmd_exec(void)
+{
+	int err = 0;
+
+	cmd_called = false;
+
+	err = cmd_register(cmdv_prm, ARRAY_SIZE(cmdv_prm));
+	ASSERT_EQ(0, err);
+
+	err = cmd_exec('/', "hello world", &pf_null);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(true, cmd_called);
+
+	err = cmd_exec('%', NULL, &pf_null);
+	ASSERT_EQ(ENOENT, err);
+	err = 0;
+
+ out:
+	cmd_unregister(cmdv_prm);
+
+	return err;
+}
+
+
+static int vprintf_mbuf(const char *p, size_t size, void *arg)
+{
+	return mbuf_write_mem(arg, (const uint8_t *)p, size);
+}
+
+
+int test_cmd_exec_lines(void)
+{
+	static const char in[] =
+		"/   hello world\r\n"
+		"# a comment\n"
+		"\n"
+		"%\n"
+		"/ hello world";
+	struct mbuf *mb;
+	struct re_printf pf;
+	struct pl pl = PL(in);
+	unsigned n;
+	int err = 0;
+
+	mb = mbuf_alloc(64);
+	if (!mb)
+		return ENOMEM;
+
+	pf.vph = vprintf_mbuf;
+	pf.arg = mb;
+
+	err = cmd_register(cmdv_prm, ARRAY_SIZE(cmdv_prm));
+	TEST_ERR(err);
+
+	/* the last line is not complete yet */
+	cmd_called = false;
+	n = cmd_exec_lines(&pf, &pl, false);
+	ASSERT_EQ(2, n);
+	ASSERT_EQ(true, cmd_called);
+	err = mbuf_write_u8(mb, 0);
+	TEST_ERR(err);
+	ASSERT_STREQ("OK\nERR unknown command '%'\n", (char *)mb->buf);
+	ASSERT_EQ(13, pl.l);
+
+	mbuf_rewind(mb);
+	cmd_called = false;
+	n = cmd_exec_lines(&pf, &pl, true);
+	ASSERT_EQ(1, n);
+	ASSERT_EQ(true, cmd_called);
+	ASSERT_EQ(0, pl.l);
+	err = mbuf_write_u8(mb, 0);
+	TEST_ERR(err);
+	ASSERT_STREQ("OK\n", (char *)mb->buf);
+
+ out:
+	cmd_unregister(cmdv_prm);
+	mem_deref(mb);
+
+	return err;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file test/conf.c  Test the config utils
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "testconf"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+int test_conf_compact(void)
+{
+	static const char *text =
+		"sip_listen\t0.0.0.0:5060\n"
+		"# a comment\n"
+		"\n"
+		"  audio_player\talsa,default  \r\n"
+		"#module\t\tg722.so\n"
+		"module\t\tg711.so\n"
+		"module\t\topus.so";
+	static const char *expected =
+		"\n"
+		"sip_listen\t0.0.0.0:5060\n"
+		"audio_player\talsa,default\n"
+		"module\t\tg711.so\n"
+		"module\t\topus.so\n";
+	struct mbuf *mb = NULL;
+	struct conf *conf = NULL;
+	char str[64];
+	int err;
+
+	err = conf_compact(&mb, (const uint8_t *)text, strlen(text));
+	TEST_ERR(err);
+
+	ASSERT_EQ(strlen(expected), mb->end);
+	ASSERT_TRUE(0 == memcmp(expected, mb->buf, mb->end));
+
+	/* the first line is found too */
+	err = conf_alloc_buf(&conf, mb->buf, mb->end);
+	TEST_ERR(err);
+
+	err = conf_get_str(conf, "sip_listen", str, sizeof(str));
+	TEST_ERR(err);
+	ASSERT_STREQ("0.0.0.0:5060", str);
+
+	err = conf_get_str(conf, "audio_player", str, sizeof(str));
+	TEST_ERR(err);
+	ASSERT_STREQ("alsa,default", str);
+
+ out:
+	mem_deref(conf);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+int test_conf_sched(void)
+{
+	static const char *text =
+		"sched_main\t\tother\n"
+		"sched_audio_tx\t\tfifo:40 2-3\n"
+		"sched_audio_dev\t\trr:45 0,5-6\n"
+		"sched_video_enc\t\tdefault 4\n"
+		"sched_mlockall\t\tyes\n";
+	struct config *cfg;
+	struct conf *conf = NULL;
+	int err;
+
+	cfg = mem_zalloc(sizeof(*cfg), NULL);
+	if (!cfg)
+		return ENOMEM;
+
+	err = conf_alloc_buf(&conf, (const uint8_t *)text, strlen(text));
+	TEST_ERR(err);
+
+	err = config_parse_conf(cfg, conf);
+	TEST_ERR(err);
+
+	ASSERT_EQ(SCHED_POLICY_OTHER, cfg->sched.main.policy);
+	ASSERT_EQ(0, cfg->sched.main.cpus);
+
+	ASSERT_EQ(SCHED_POLICY_FIFO, cfg->sched.audio_tx.policy);
+	ASSERT_EQ(40, cfg->sched.audio_tx.prio);
+	ASSERT_EQ(0x0c, cfg->sched.audio_tx.cpus);
+
+	ASSERT_EQ(SCHED_POLICY_RR, cfg->sched.audio_dev.policy);
+	ASSERT_EQ(45, cfg->sched.audio_dev.prio);
+	ASSERT_EQ(0x61, cfg->sched.audio_dev.cpus);
+
+	ASSERT_EQ(SCHED_POLICY_DEFAULT, cfg->sched.video_enc.policy);
+	ASSERT_EQ(0x10, cfg->sched.video_enc.cpus);
+
+	ASSERT_TRUE(cfg->sched.mlockall);
+
+	/* an unknown thread name is an error */
+	ASSERT_EQ(EINVAL, realtime_thread("nosuch"));
+
+ out:
+	mem_deref(conf);
+	mem_deref(cfg);
+
+	return err;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file test/contact.c  Test the contacts
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "testcontact"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+int test_contact(void)
+{
+	static const char *text =
+		"# comment\n"
+		"\"Alice\" <sip:alice@Example.com>;access=allow\n"
+		"\n"
+		"<sip:bob@example.com;transport=tcp>;access=block\r\n"
+		"\"Catch All\" <sip:*@*>;access=block";
+	struct mbuf *mb = NULL;
+	struct contact *c;
+	char buf[64];
+	struct pl pl;
+	unsigned i;
+	int err;
+
+	err = contact_init();
+	TEST_ERR(err);
+
+	mb = mbuf_alloc(256);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mbuf_write_str(mb, text);
+	TEST_ERR(err);
+	mb->pos = 0;
+
+	err = contact_load(mb);
+	TEST_ERR(err);
+	ASSERT_EQ(3, list_count(contact_list()));
+
+	/* the scheme and the host are not case-sensitive, the user is */
+	c = contact_find("SIP:alice@example.COM");
+	ASSERT_TRUE(c != NULL);
+	ASSERT_STREQ("\"Alice\" <sip:alice@Example.com>;access=allow",
+		     contact_str(c));
+	ASSERT_TRUE(0 == pl_strcmp(&contact_addr(c)->dname, "Alice"));
+	ASSERT_TRUE(contact_find("sip:Alice@example.com") == NULL);
+
+	/* URI parameters are ignored */
+	ASSERT_TRUE(contact_find("sip:bob@example.com") != NULL);
+	ASSERT_STREQ("<sip:bob@example.com;transport=tcp>;access=block",
+		     contact_str(contact_find("sip:bob@example.com;lr")));
+
+	ASSERT_TRUE(!contact_block_access("sip:alice@example.com"));
+	ASSERT_TRUE(contact_block_access("sip:bob@example.com"));
+	ASSERT_TRUE(contact_block_access("sip:carol@example.com"));
+
+	/* the index grows with the contacts */
+	for (i=0; i<1000; i++) {
+
+		(void)re_snprintf(buf, sizeof(buf),
+				  "<sip:user%u@example.com>;access=allow", i);
+		pl_set_str(&pl, buf);
+
+		err = contact_add(NULL, &pl);
+		TEST_ERR(err);
+	}
+
+	ASSERT_EQ(1003, list_count(contact_list()));
+	ASSERT_TRUE(contact_find("sip:user0@example.com") != NULL);
+	ASSERT_TRUE(!contact_block_access("sip:user999@example.com"));
+	ASSERT_TRUE(contact_block_access("sip:user1000@example.com"));
+
+	/* an unknown access value is an error */
+	pl_set_str(&pl, "<sip:dave@example.com>;access=maybe");
+	err = contact_add(NULL, &pl);
+	ASSERT_EQ(EINVAL, err);
+	err = 0;
+
+ out:
+	mem_deref(mb);
+	contact_close();
+
+	return err;
+}
@@ -0,0 +1,58 @@
+/**
+ * @file test/cpugov.c  Test the CPU governor for the codec complexity
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "cpugov"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+int test_cpugov(void)
+{
+	struct cpugov *gov = NULL;
+	int i, n, err;
+
+	/* no governor, or no limit */
+	ASSERT_EQ(0, cpugov_update(NULL, 100, 10));
+
+	err = cpugov_alloc(&gov, 0);
+	TEST_ERR(err);
+
+	ASSERT_EQ(0, cpugov_update(gov, 100, 10));
+	gov = mem_deref(gov);
+
+	err = cpugov_alloc(&gov, 80);
+	TEST_ERR(err);
+
+	/* the load is smoothed */
+	for (i=0; i<5; i++)
+		ASSERT_EQ(0, cpugov_update(gov, 100, 0));
+
+	/* one step, then a hold of a few samples between the steps */
+	ASSERT_EQ(-1, cpugov_update(gov, 100, 0));
+	ASSERT_EQ(0, cpugov_update(gov, 100, 0));
+
+	for (i=0, n=0; i<9; i++)
+		n += (-1 == cpugov_update(gov, 100, 0));
+	ASSERT_EQ(3, n);
+
+	/* restored after a while well below the limit */
+	for (i=0, n=0; i<8; i++)
+		n += (1 == cpugov_update(gov, 0, 0));
+	ASSERT_EQ(1, n);
+
+	/* missed deadlines degrade at any load */
+	ASSERT_EQ(-1, cpugov_update(gov, 0, 1));
+	ASSERT_EQ(0, cpugov_update(gov, 0, 1));
+
+ out:
+	mem_deref(gov);
+
+	return err;
+}
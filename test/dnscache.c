@@ -0,0 +1,131 @@
+/**
+ * @file test/dnscache.c  Test the caching DNS forwarder
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "dnscache"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+struct fixture {
+	struct dnsc *dnsc;
+	unsigned n_answers;
+	uint32_t addr;
+	int err;
+};
+
+
+static void query_handler(int err, const struct dnshdr *hdr,
+			  struct list *ansl, struct list *authl,
+			  struct list *addl, void *arg)
+{
+	struct fixture *f = arg;
+	struct dnsrr *rr = list_ledata(list_head(ansl));
+	(void)hdr;
+	(void)authl;
+	(void)addl;
+
+	if (err)
+		f->err = err;
+
+	f->n_answers = list_count(ansl);
+	f->addr = (rr && rr->type == DNS_TYPE_A) ? rr->rdata.a.addr : 0;
+
+	re_cancel();
+}
+
+
+static int lookup(struct fixture *f, const char *name, uint16_t type)
+{
+	struct dns_query *q = NULL;
+	int err;
+
+	f->n_answers = 0;
+	f->addr = 0;
+
+	err = dnsc_query(&q, f->dnsc, name, type, DNS_CLASS_IN, true,
+			 query_handler, f);
+	if (err)
+		return err;
+
+	err = re_main_timeout(5000);
+	mem_deref(q);
+
+	return err ? err : f->err;
+}
+
+
+int test_dnscache(void)
+{
+	struct dns_server *srv = NULL;
+	struct dnscache *dc = NULL;
+	struct fixture f;
+	unsigned n;
+	int err;
+
+	memset(&f, 0, sizeof(f));
+
+	err = dns_server_alloc(&srv, false);
+	TEST_ERR(err);
+
+	err = dns_server_add_a(srv, "sip.test.invalid", 0x7f000001);
+	TEST_ERR(err);
+
+	err = dnscache_alloc(&dc, &srv->addr, 1);
+	TEST_ERR(err);
+
+	err = dnsc_alloc(&f.dnsc, NULL, dnscache_laddr(dc), 1);
+	TEST_ERR(err);
+
+	/* a miss for A also asks for AAAA */
+	err = lookup(&f, "sip.test.invalid", DNS_TYPE_A);
+	TEST_ERR(err);
+	ASSERT_EQ(1, f.n_answers);
+	ASSERT_EQ(0x7f000001, f.addr);
+	ASSERT_EQ(2, srv->n_queries);
+
+	/* the empty AAAA answer is cached too */
+	err = lookup(&f, "sip.test.invalid", DNS_TYPE_AAAA);
+	TEST_ERR(err);
+	ASSERT_EQ(0, f.n_answers);
+	ASSERT_EQ(2, srv->n_queries);
+	ASSERT_EQ(2, dnscache_count(dc));
+
+	/* answered from the cache, the name is not case sensitive */
+	err = lookup(&f, "SIP.test.invalid", DNS_TYPE_A);
+	TEST_ERR(err);
+	ASSERT_EQ(0x7f000001, f.addr);
+	ASSERT_EQ(2, srv->n_queries);
+
+	/* an unknown name is sent upstream once */
+	err = lookup(&f, "nx.test.invalid", DNS_TYPE_SRV);
+	TEST_ERR(err);
+	ASSERT_EQ(0, f.n_answers);
+	n = srv->n_queries;
+
+	err = lookup(&f, "nx.test.invalid", DNS_TYPE_SRV);
+	TEST_ERR(err);
+	ASSERT_EQ(n, srv->n_queries);
+
+	dnscache_flush(dc);
+	ASSERT_EQ(0, dnscache_count(dc));
+
+	err = lookup(&f, "sip.test.invalid", DNS_TYPE_A);
+	TEST_ERR(err);
+	ASSERT_EQ(0x7f000001, f.addr);
+	ASSERT_TRUE(srv->n_queries > n);
+
+ out:
+	mem_deref(f.dnsc);
+	mem_deref(dc);
+	mem_deref(srv);
+
+	return err;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file test/fec.c  Test the forward error correction
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "fec"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	RATIO = 20,          /* one repair packet for 5 media packets */
+	BLOCK = 100 / RATIO,
+	PRESZ = 16,
+	PT    = 96,
+};
+
+
+static size_t pkt_size(uint16_t seq)
+{
+	return 100 + seq % 7 * 10;
+}
+
+
+static int make_packet(struct mbuf *mb, struct rtp_header *hdr,
+		       uint16_t seq)
+{
+	size_t i;
+	int err = 0;
+
+	mbuf_rewind(mb);
+
+	for (i=0; i<pkt_size(seq); i++)
+		err |= mbuf_write_u8(mb, (uint8_t)(seq ^ i));
+
+	mb->pos = 0;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->ver = RTP_VERSION;
+	hdr->m   = seq % 3 == 0;
+	hdr->pt  = PT;
+	hdr->seq = seq;
+	hdr->ts  = seq * 3000u;
+
+	return err;
+}
+
+
+int test_fec(void)
+{
+	struct fecenc *enc = NULL;
+	struct fecdec *dec = NULL;
+	struct mbuf *mb, *mb_fec = NULL, *mb_rec = NULL;
+	struct rtp_header hdr;
+	const uint16_t seq0 = 65533, lost = 65535;
+	uint16_t seq;
+	size_t i;
+	int err;
+
+	mb = mbuf_alloc(256);
+	if (!mb)
+		return ENOMEM;
+
+	err  = fecenc_alloc(&enc, RATIO);
+	err |= fecdec_alloc(&dec);
+	TEST_ERR(err);
+
+	ASSERT_EQ(RATIO, fecenc_ratio(enc));
+
+	/* one block, across the sequence number wrap */
+	for (seq=seq0; seq!=(uint16_t)(seq0 + BLOCK); seq++) {
+
+		err = make_packet(mb, &hdr, seq);
+		TEST_ERR(err);
+
+		/* markers are not set, so the block is full */
+		fecenc_store(enc, false, PT, hdr.ts, mb);
+		err = fecenc_commit(enc, seq, PRESZ, &mb_fec);
+		TEST_ERR(err);
+
+		if (seq != (uint16_t)(seq0 + BLOCK - 1))
+			ASSERT_TRUE(mb_fec == NULL);
+
+		hdr.m = false;
+		if (seq != lost)
+			fecdec_source(dec, &hdr, mb);
+	}
+
+	ASSERT_TRUE(mb_fec != NULL);
+	ASSERT_EQ(PRESZ, mb_fec->pos);
+
+	ASSERT_EQ(ENOENT, fecdec_recover(dec, &hdr, &mb_rec));
+
+	err = fecdec_repair(dec, mb_fec);
+	TEST_ERR(err);
+
+	err = fecdec_recover(dec, &hdr, &mb_rec);
+	TEST_ERR(err);
+
+	ASSERT_EQ(lost, hdr.seq);
+	ASSERT_EQ(lost * 3000u, hdr.ts);
+	ASSERT_EQ(PT, hdr.pt);
+	ASSERT_TRUE(!hdr.m);
+	ASSERT_EQ(pkt_size(lost), mbuf_get_left(mb_rec));
+
+	for (i=0; i<pkt_size(lost); i++)
+		ASSERT_EQ((uint8_t)(lost ^ i), mb_rec->buf[mb_rec->pos + i]);
+
+	mb_rec = mem_deref(mb_rec);
+
+	/* the repair packet is used once */
+	ASSERT_EQ(ENOENT, fecdec_recover(dec, &hdr, &mb_rec));
+
+	/* loss reported by the peer shortens the blocks */
+	fecenc_set_loss(enc, 15);
+	ASSERT_EQ(50, fecenc_ratio(enc));
+
+	mb_fec = mem_deref(mb_fec);
+
+	for (i=0; i<2; i++) {
+
+		err = make_packet(mb, &hdr, seq);
+		TEST_ERR(err);
+
+		fecenc_store(enc, false, PT, hdr.ts, mb);
+		err = fecenc_commit(enc, seq++, PRESZ, &mb_fec);
+		TEST_ERR(err);
+
+		ASSERT_EQ(i == 1, mb_fec != NULL);
+	}
+
+ out:
+	mem_deref(mb_rec);
+	mem_deref(mb_fec);
+	mem_deref(dec);
+	mem_deref(enc);
+	mem_deref(mb);
+
+	return err;
+}
@@ -0,0 +1,107 @@
+/**
+ * @file test/g711.c  Test the G.711 batch kernels
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "g711"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum { FRAME = 160 };
+
+
+static const char *law_name(enum g711_law law)
+{
+	return law == G711_ALAW ? "alaw" : "ulaw";
+}
+
+
+int test_g711(void)
+{
+	int16_t *pcm = NULL, *ref = NULL, *dst = NULL;
+	uint8_t *enc = NULL;
+	enum g711_law law;
+	uint32_t i;
+	int impl;
+	int err = 0;
+
+	pcm = mem_alloc(65536 * sizeof(*pcm), NULL);
+	ref = mem_alloc(65536 * sizeof(*ref), NULL);
+	dst = mem_alloc(65536 * sizeof(*dst), NULL);
+	enc = mem_alloc(65536, NULL);
+	if (!pcm || !ref || !dst || !enc) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	g711_batch_init();
+
+	for (i=0; i<65536; i++)
+		pcm[i] = (int16_t)i;
+
+	for (law=G711_ULAW; law<=G711_ALAW; law++) {
+
+		/* every sample gives the same code as librem */
+		g711_encode_batch(law, enc, pcm, 65536);
+
+		for (i=0; i<65536; i++) {
+
+			uint8_t code = law == G711_ALAW
+				? g711_pcm2alaw(pcm[i])
+				: g711_pcm2ulaw(pcm[i]);
+
+			ASSERT_EQ(code, enc[i]);
+		}
+
+		/* every code, with an odd length to cover the tails */
+		for (i=0; i<65536; i++) {
+
+			enc[i] = (uint8_t)(i * 7 + i / 256);
+
+			ref[i] = law == G711_ALAW
+				? g711_alaw2pcm(enc[i])
+				: g711_ulaw2pcm(enc[i]);
+		}
+
+		for (impl=SIMD_C; impl<SIMD_N; impl++) {
+
+			if (!simd_supported(impl))
+				continue;
+
+			memset(dst, 0, 65536 * sizeof(*dst));
+
+			g711_decode_batch_impl(impl, law, dst, enc, 65535);
+
+			for (i=0; i<65535; i++) {
+
+				if (dst[i] == ref[i])
+					continue;
+
+				warning("g711: %s %s: code 0x%02x:"
+					" %d != %d\n",
+					law_name(law), simd_name(impl),
+					enc[i], dst[i], ref[i]);
+				err = EBADMSG;
+				goto out;
+			}
+
+			ASSERT_EQ(0, dst[65535]);
+		}
+	}
+
+ out:
+	mem_deref(enc);
+	mem_deref(dst);
+	mem_deref(ref);
+	mem_deref(pcm);
+
+	return err;
+}
@@ -0,0 +1,274 @@
+/**
+ * @file test/h264.c  Test the H.264 start-code scanner
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "h264"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/* Reference version, one byte at a time */
+static const uint8_t *startcode_ref(const uint8_t *p, const uint8_t *end)
+{
+	for (; p + 3 <= end; p++) {
+		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+			return p;
+	}
+
+	return end;
+}
+
+
+/* Random bytes with a bias towards zeros and start codes */
+static void buf_random(uint8_t *buf, size_t len)
+{
+	size_t i, n;
+
+	rand_bytes(buf, len);
+
+	for (i=0; i<len; i++) {
+		if (buf[i] < 0x60)
+			buf[i] = 0;
+		else if (buf[i] < 0x68)
+			buf[i] = 1;
+	}
+
+	n = len ? rand_u16() % 4 : 0;
+	while (n--) {
+		size_t pos = rand_u32() % len;
+
+		memcpy(buf + pos, "\x00\x00\x01", min(3, len - pos));
+	}
+}
+
+
+static int scan_compare(enum simd_impl impl, const uint8_t *buf, size_t len)
+{
+	const uint8_t *end = buf + len;
+	const uint8_t *p = buf, *q = buf;
+
+	for (;;) {
+		const uint8_t *a = startcode_ref(p, end);
+		const uint8_t *b = h264_find_startcode_impl(impl, q, end);
+
+		if (a != b) {
+			warning("h264: %s: len=%zu offset=%zu:"
+				" expected %zd, got %zd\n",
+				simd_name(impl), len, (size_t)(p - buf),
+				a - buf, b - buf);
+			return EBADMSG;
+		}
+
+		if (a == end)
+			break;
+
+		p = q = a + 1;
+	}
+
+	return 0;
+}
+
+
+int test_h264_startcode(void)
+{
+#define FUZZ_ROUNDS 2000
+#define FUZZ_MAXLEN 300
+	uint8_t *buf;
+	int impl, i;
+	int err = 0;
+
+	buf = mem_alloc(FUZZ_MAXLEN + 32, NULL);
+	if (!buf)
+		return ENOMEM;
+
+	for (i=0; i<FUZZ_ROUNDS; i++) {
+
+		size_t len = rand_u16() % FUZZ_MAXLEN;
+		size_t offset = rand_u16() % 32;
+
+		buf_random(buf + offset, len);
+
+		for (impl=SIMD_C; impl<SIMD_N; impl++) {
+
+			if (!simd_supported(impl))
+				continue;
+
+			err = scan_compare(impl, buf + offset, len);
+			if (err)
+				goto out;
+		}
+	}
+
+	/* the public function must agree with the scalar version */
+	buf_random(buf, FUZZ_MAXLEN);
+	ASSERT_TRUE(h264_find_startcode(buf, buf + FUZZ_MAXLEN) ==
+		    startcode_ref(buf, buf + FUZZ_MAXLEN));
+
+ out:
+	mem_deref(buf);
+
+	return err;
+}
+
+
+struct pkt_test {
+	struct mbuf *mb;     /* depacketized byte stream */
+	unsigned n_pkt;
+	unsigned n_stap;
+	bool marker;
+	int err;
+};
+
+
+/* Minimal depacketizer, rebuilds the byte stream with 3-byte start codes */
+static int packet_handler(bool marker, const uint8_t *hdr, size_t hdr_len,
+			  const uint8_t *pld, size_t pld_len, void *arg)
+{
+	static const uint8_t nal_seq[3] = {0, 0, 1};
+	struct pkt_test *pt = arg;
+	const uint8_t type = hdr[0] & 0x1f;
+	int err = 0;
+
+	++pt->n_pkt;
+
+	if (pt->marker) {
+		warning("h264: packet after marker\n");
+		err = EPROTO;
+		goto out;
+	}
+	pt->marker = marker;
+
+	if (hdr_len + pld_len > 1200) {
+		warning("h264: packet too large (%zu)\n", hdr_len + pld_len);
+		err = EOVERFLOW;
+		goto out;
+	}
+
+	if (type == H264_NAL_STAP_A) {
+
+		++pt->n_stap;
+
+		while (pld_len >= 2) {
+			const size_t len = pld[0]<<8 | pld[1];
+
+			if (len > pld_len - 2) {
+				err = EBADMSG;
+				goto out;
+			}
+
+			err |= mbuf_write_mem(pt->mb, nal_seq, 3);
+			err |= mbuf_write_mem(pt->mb, pld + 2, len);
+
+			pld     += 2 + len;
+			pld_len -= 2 + len;
+		}
+	}
+	else if (type == H264_NAL_FU_A) {
+
+		if (hdr[1] & 0x80) {
+			const uint8_t nal = (hdr[0] & 0xe0) | (hdr[1] & 0x1f);
+
+			err |= mbuf_write_mem(pt->mb, nal_seq, 3);
+			err |= mbuf_write_u8(pt->mb, nal);
+		}
+
+		err |= mbuf_write_mem(pt->mb, pld, pld_len);
+	}
+	else {
+		err |= mbuf_write_mem(pt->mb, nal_seq, 3);
+		err |= mbuf_write_mem(pt->mb, hdr, hdr_len);
+		err |= mbuf_write_mem(pt->mb, pld, pld_len);
+	}
+
+ out:
+	if (err)
+		pt->err = err;
+
+	return err;
+}
+
+
+static int packetize_frame(const size_t *nalv, size_t naln, unsigned flags,
+			   unsigned exp_pkt, unsigned exp_stap)
+{
+	struct pkt_test pt;
+	struct mbuf *mb;
+	size_t i, j;
+	int err = 0;
+
+	memset(&pt, 0, sizeof(pt));
+
+	mb = mbuf_alloc(4096);
+	pt.mb = mbuf_alloc(4096);
+	if (!mb || !pt.mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (i=0; i<naln; i++) {
+
+		err |= mbuf_write_mem(mb, (uint8_t *)"\x00\x00\x01", 3);
+		err |= mbuf_write_u8(mb, 0x60 | H264_NAL_SLICE);
+
+		for (j=1; j<nalv[i]; j++)
+			err |= mbuf_write_u8(mb, 0x80 | (rand_u16() & 0x7f));
+	}
+	if (err)
+		goto out;
+
+	err = h264_packetize_ext(mb->buf, mb->end, 1200, flags,
+				 packet_handler, &pt);
+	TEST_ERR(err);
+	TEST_ERR(pt.err);
+
+	ASSERT_TRUE(pt.marker);
+	ASSERT_EQ(exp_pkt, pt.n_pkt);
+	ASSERT_EQ(exp_stap, pt.n_stap);
+	ASSERT_EQ(mb->end, pt.mb->end);
+	ASSERT_TRUE(0 == memcmp(mb->buf, pt.mb->buf, mb->end));
+
+ out:
+	mem_deref(pt.mb);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+int test_h264_stap_a(void)
+{
+	static const size_t keyframe[] = {12, 5, 30, 3000};
+	static const size_t slices[]   = {100, 200, 300, 400, 500};
+	static const size_t single[]   = {1000};
+	int err;
+
+	/* without aggregation every NAL unit is sent on its own */
+	err = packetize_frame(keyframe, ARRAY_SIZE(keyframe), 0, 6, 0);
+	TEST_ERR(err);
+
+	/* SPS, PPS and SEI in one STAP-A, then 3 FU-A */
+	err = packetize_frame(keyframe, ARRAY_SIZE(keyframe),
+			      H264_PKT_STAP_A, 4, 1);
+	TEST_ERR(err);
+
+	/* 100+200+300+400 bytes fit in 1200, 500 goes in a single packet */
+	err = packetize_frame(slices, ARRAY_SIZE(slices),
+			      H264_PKT_STAP_A, 2, 1);
+	TEST_ERR(err);
+
+	/* one NAL unit is never wrapped in a STAP-A */
+	err = packetize_frame(single, ARRAY_SIZE(single),
+			      H264_PKT_STAP_A, 1, 0);
+	TEST_ERR(err);
+
+ out:
+	return err;
+}
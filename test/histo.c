@@ -0,0 +1,83 @@
+/**
+ * @file test/histo.c  Test the log-linear histogram
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "histo"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+static bool within(uint32_t expected, uint32_t actual)
+{
+	const uint64_t tol = expected / (2*HISTO_SUB) + 1;
+
+	return actual + tol >= expected && actual <= expected + tol;
+}
+
+
+int test_histo(void)
+{
+	static const struct {
+		unsigned pct;
+		uint32_t value;
+	} testv[] = {
+		{  0,      1},
+		{  1,   1000},
+		{ 50,  50000},
+		{ 90,  90000},
+		{ 99,  99000},
+		{100, 100000},
+	};
+	struct histo *h;
+	uint32_t v;
+	size_t i;
+	int err = 0;
+
+	h = mem_zalloc(sizeof(*h), NULL);
+	if (!h)
+		return ENOMEM;
+
+	ASSERT_EQ(0, histo_percentile(h, 50));
+	ASSERT_EQ(0, histo_mean(h));
+
+	/* exact for small values */
+	histo_add(h, 7);
+	ASSERT_EQ(7, histo_percentile(h, 50));
+	histo_reset(h);
+
+	/* uniform 1..100000 */
+	for (v=1; v<=100000; v++)
+		histo_add(h, v);
+
+	ASSERT_EQ(100000, histo_count(h));
+	ASSERT_EQ(100000, histo_max(h));
+	ASSERT_EQ(50000, histo_mean(h));
+
+	for (i=0; i<ARRAY_SIZE(testv); i++) {
+
+		uint32_t p = histo_percentile(h, testv[i].pct);
+
+		if (!within(testv[i].value, p)) {
+			warning("histo: p%u expected %u, got %u\n",
+				testv[i].pct, testv[i].value, p);
+			err = EINVAL;
+			goto out;
+		}
+	}
+
+	/* the largest values do not overflow */
+	histo_reset(h);
+	histo_add(h, 0xffffffff);
+	ASSERT_TRUE(within(0xffffffff, histo_percentile(h, 50)));
+
+ out:
+	mem_deref(h);
+
+	return err;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file test/impair.c  Test the network impairment
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum {
+	N_PKT = 400,
+};
+
+struct impair_test {
+	uint32_t seqv[N_PKT];   /* received, in order of arrival */
+	uint32_t n;
+	uint32_t expected;
+};
+
+
+static void recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct impair_test *t = arg;
+	(void)src;
+
+	if (mbuf_get_left(mb) < 4 || t->n >= N_PKT)
+		return;
+
+	t->seqv[t->n++] = ntohl(mbuf_read_u32(mb));
+
+	if (t->n == t->expected)
+		re_cancel();
+}
+
+
+static void dummy_handler(const struct sa *src, struct mbuf *mb, void *arg)
+{
+	(void)src;
+	(void)mb;
+	(void)arg;
+}
+
+
+static int run(const struct impair_prm *prm, struct impair_test *t,
+	       struct impair_stat *stat)
+{
+	struct udp_sock *tx = NULL, *rx = NULL;
+	struct impair *im = NULL;
+	struct mbuf *mb = NULL;
+	struct sa laddr, dst;
+	uint32_t i;
+	int err;
+
+	memset(t, 0, sizeof(*t));
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	err  = udp_listen(&rx, &laddr, recv_handler, t);
+	err |= udp_local_get(rx, &dst);
+	err |= udp_listen(&tx, &laddr, dummy_handler, NULL);
+	TEST_ERR(err);
+
+	err = impair_alloc(&im, tx, prm);
+	TEST_ERR(err);
+
+	mb = mbuf_alloc(160);
+	ASSERT_TRUE(mb != NULL);
+
+	for (i=0; i<N_PKT; i++) {
+
+		mb->pos = mb->end = 0;
+		err  = mbuf_write_u32(mb, htonl(i));
+		err |= mbuf_fill(mb, 0, 156);
+		TEST_ERR(err);
+
+		mb->pos = 0;
+		err = udp_send(tx, &dst, mb);
+		TEST_ERR(err);
+	}
+
+	err = impair_stats(im, stat);
+	TEST_ERR(err);
+
+	ASSERT_EQ(N_PKT, stat->n_pkt);
+	ASSERT_EQ(N_PKT, stat->n_lost + stat->n_drop + stat->n_queued);
+
+	t->expected = stat->n_queued;
+
+	if (t->expected) {
+		err = re_main_timeout(5000);
+		TEST_ERR(err);
+	}
+
+	err = impair_stats(im, stat);
+	TEST_ERR(err);
+
+	ASSERT_EQ(0, stat->n_queued);
+	ASSERT_EQ(N_PKT - stat->n_lost - stat->n_drop, t->n);
+
+ out:
+	mem_deref(im);
+	mem_deref(tx);
+	mem_deref(rx);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+static bool in_order(const struct impair_test *t)
+{
+	uint32_t i;
+
+	for (i=1; i<t->n; i++) {
+		if (t->seqv[i] <= t->seqv[i-1])
+			return false;
+	}
+
+	return true;
+}
+
+
+/* Longest run of consecutive lost sequence numbers */
+static uint32_t burst_max(const struct impair_test *t)
+{
+	uint32_t i, prev = 0, burst = 0;
+
+	for (i=0; i<t->n; i++) {
+		burst = max(burst, t->seqv[i] - prev);
+		prev  = t->seqv[i] + 1;
+	}
+
+	return burst;
+}
+
+
+int test_impair(void)
+{
+	struct impair_test *t, *t2;
+	struct impair_stat stat, stat2;
+	struct impair_prm prm;
+	int err;
+
+	t  = mem_zalloc(sizeof(*t), NULL);
+	t2 = mem_zalloc(sizeof(*t2), NULL);
+	if (!t || !t2) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	/* random loss and jitter, the order is kept */
+	memset(&prm, 0, sizeof(prm));
+	prm.loss_good = 0.1;
+	prm.delay     = 5;
+	prm.jitter    = 20;
+	prm.seed      = 42;
+
+	err = run(&prm, t, &stat);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(stat.n_lost > N_PKT / 20 && stat.n_lost < N_PKT / 5);
+	ASSERT_EQ(0, stat.n_drop);
+	ASSERT_EQ(0, stat.n_reorder);
+	ASSERT_TRUE(in_order(t));
+
+	/* the same seed loses the same packets */
+	err = run(&prm, t2, &stat2);
+	TEST_ERR(err);
+
+	ASSERT_EQ(stat.n_lost, stat2.n_lost);
+	ASSERT_EQ(t->n, t2->n);
+	ASSERT_TRUE(0 == memcmp(t->seqv, t2->seqv, t->n * sizeof(t->seqv[0])));
+
+	/* bursty loss, long stays in the bad state */
+	memset(&prm, 0, sizeof(prm));
+	prm.p_bad    = 0.02;
+	prm.p_good   = 0.2;
+	prm.loss_bad = 1.0;
+	prm.seed     = 7;
+
+	err = run(&prm, t, &stat);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(stat.n_lost > 0);
+	ASSERT_TRUE(burst_max(t) >= 3);
+
+	/* reordering */
+	memset(&prm, 0, sizeof(prm));
+	prm.delay   = 20;
+	prm.jitter  = 20;
+	prm.reorder = 0.2;
+	prm.seed    = 1234;
+
+	err = run(&prm, t, &stat);
+	TEST_ERR(err);
+
+	ASSERT_EQ(0, stat.n_lost);
+	ASSERT_EQ(N_PKT, t->n);
+	ASSERT_TRUE(stat.n_reorder > 0);
+	ASSERT_TRUE(!in_order(t));
+
+	/* 400 packets of 160 bytes are 0.5 s at 1 Mbit/s, the tail is
+	   dropped at the 100 ms queue */
+	memset(&prm, 0, sizeof(prm));
+	prm.rate  = 1000000;
+	prm.queue = 100;
+	prm.seed  = 1;
+
+	err = run(&prm, t, &stat);
+	TEST_ERR(err);
+
+	ASSERT_EQ(0, stat.n_lost);
+	ASSERT_TRUE(stat.n_drop > N_PKT / 2);
+	ASSERT_TRUE(in_order(t));
+
+ out:
+	mem_deref(t2);
+	mem_deref(t);
+
+	return err;
+}
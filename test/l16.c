@@ -0,0 +1,85 @@
+/**
+ * @file test/l16.c  Test the L16 byte-order kernels
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "l16"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum { SAMPC = 1001 };
+
+
+int test_l16(void)
+{
+	uint8_t src[2*SAMPC + 1], dst[2*SAMPC + 2];
+	int16_t pcm[SAMPC], out[SAMPC];
+	const uint8_t one[2] = {0x12, 0x34};
+	size_t i;
+	int impl;
+	int err = 0;
+
+	for (i=0; i<sizeof(src); i++)
+		src[i] = (uint8_t)(i * 7 + i / 256);
+
+	/* every length, with the source and destination unaligned */
+	for (impl=SIMD_C; impl<SIMD_N; impl++) {
+
+		size_t n;
+
+		if (!simd_supported(impl))
+			continue;
+
+		for (n=0; n<=64; n++) {
+
+			memset(dst, 0xa5, sizeof(dst));
+
+			l16_swap_impl(impl, dst + 1, src + 1, n);
+
+			for (i=0; i<n; i++) {
+
+				if (dst[1 + 2*i] == src[2 + 2*i] &&
+				    dst[2 + 2*i] == src[1 + 2*i])
+					continue;
+
+				warning("l16: %s: n=%zu sample %zu\n",
+					simd_name(impl), n, i);
+				err = EBADMSG;
+				goto out;
+			}
+
+			ASSERT_EQ(0xa5, dst[0]);
+			ASSERT_EQ(0xa5, dst[1 + 2*n]);
+		}
+
+		/* in place */
+		memcpy(dst, src, 2*SAMPC);
+		l16_swap_impl(impl, dst, dst, SAMPC);
+		l16_swap_impl(impl, dst, dst, SAMPC);
+		ASSERT_TRUE(0 == memcmp(src, dst, 2*SAMPC));
+	}
+
+	/* network byte order */
+	l16_decode(out, one, 1);
+	ASSERT_EQ(0x1234, out[0]);
+
+	for (i=0; i<SAMPC; i++)
+		pcm[i] = (int16_t)(i * 131 - 32768);
+
+	l16_encode(dst, pcm, SAMPC);
+	ASSERT_EQ((uint8_t)((uint16_t)pcm[3] >> 8), dst[6]);
+	ASSERT_EQ((uint8_t)pcm[3], dst[7]);
+
+	l16_decode(out, dst, SAMPC);
+	ASSERT_TRUE(0 == memcmp(pcm, out, sizeof(pcm)));
+
+ out:
+	return err;
+}
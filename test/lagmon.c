@@ -0,0 +1,71 @@
+/**
+ * @file test/lagmon.c  Test the main loop lag monitor
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "lagmon"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+int test_lagmon(void)
+{
+	static const char *namev[] = {
+		"h0",  "h1",  "h2",  "h3",  "h4",  "h5",  "h6",  "h7",
+		"h8",  "h9",  "h10", "h11", "h12", "h13", "h14", "h15",
+		"h16", "h17", "h18", "h19",
+	};
+	struct lagmon_slow slowv[32];
+	uint64_t now;
+	size_t i, n;
+	int err = 0;
+
+	lagmon_reset();
+
+	/* a fast handler is only counted */
+	lagmon_end("fast", lagmon_begin());
+	ASSERT_EQ(1, histo_count(lagmon_handlers()));
+	ASSERT_EQ(0, lagmon_slowest(slowv, ARRAY_SIZE(slowv)));
+
+	/* slow handlers, longest run first */
+	now = lagmon_begin();
+	lagmon_end("a", now - 30000);
+	lagmon_end("b", now - 50000);
+	lagmon_end("a", now - 40000);
+
+	n = lagmon_slowest(slowv, ARRAY_SIZE(slowv));
+	ASSERT_EQ(2, n);
+	ASSERT_STREQ("b", slowv[0].name);
+	ASSERT_EQ(1, slowv[0].count);
+	ASSERT_TRUE(slowv[0].max >= 50000);
+	ASSERT_STREQ("a", slowv[1].name);
+	ASSERT_EQ(2, slowv[1].count);
+	ASSERT_TRUE(slowv[1].max >= 40000 && slowv[1].max < 50000);
+
+	ASSERT_EQ(4, histo_count(lagmon_handlers()));
+
+	/* the table keeps the slowest handlers */
+	lagmon_reset();
+
+	now = lagmon_begin();
+	for (i=0; i<ARRAY_SIZE(namev); i++)
+		lagmon_end(namev[i], now - 30000 - 1000 * i);
+
+	n = lagmon_slowest(slowv, ARRAY_SIZE(slowv));
+	ASSERT_EQ(16, n);
+	ASSERT_STREQ("h19", slowv[0].name);
+	ASSERT_STREQ("h4", slowv[n-1].name);
+
+	ASSERT_EQ(1, lagmon_slowest(slowv, 1));
+	ASSERT_STREQ("h19", slowv[0].name);
+
+ out:
+	lagmon_reset();
+
+	return err;
+}
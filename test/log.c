@@ -0,0 +1,118 @@
+/**
+ * @file test/log.c  Test the logging backend
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+struct logtest {
+	struct log log;
+	uint32_t n_msg;
+	uint32_t n_note;
+	uint32_t n_ctx;
+	char callid[64];
+	char aor[64];
+};
+
+
+static struct logtest lt;
+
+
+static void log_handler(uint32_t level, const char *msg)
+{
+	const char *callid, *aor;
+	(void)level;
+
+	log_context(&callid, &aor);
+	if (callid && aor) {
+		str_ncpy(lt.callid, callid, sizeof(lt.callid));
+		str_ncpy(lt.aor, aor, sizeof(lt.aor));
+		++lt.n_ctx;
+	}
+
+	if (0 == re_regex(msg, str_len(msg), "similar messages suppressed"))
+		++lt.n_note;
+	else
+		++lt.n_msg;
+}
+
+
+static void log_burst(unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++)
+		warning("test: same call site %u\n", i);
+}
+
+
+int test_log(void)
+{
+	int err = 0;
+
+	memset(&lt, 0, sizeof(lt));
+	lt.log.h = log_handler;
+	lt.log.thread_safe = true;
+
+	log_enable_stderr(false);
+	log_register_handler(&lt.log);
+
+	/* rate limit per call site */
+	log_set_ratelimit(5);
+
+	log_burst(20);
+	ASSERT_EQ(5, lt.n_msg);
+	ASSERT_EQ(0, lt.n_note);
+
+	/* no limit */
+	log_set_ratelimit(0);
+	lt.n_msg = 0;
+
+	log_burst(20);
+	ASSERT_EQ(20, lt.n_msg);
+	ASSERT_EQ(0, lt.n_ctx);
+
+	/* the context goes with the message */
+	log_set_context("abc123", "sip:alice@example.com");
+	warning("test: with context\n");
+	log_set_context(NULL, NULL);
+	warning("test: without context\n");
+
+	ASSERT_EQ(1, lt.n_ctx);
+	ASSERT_STREQ("abc123", lt.callid);
+	ASSERT_STREQ("sip:alice@example.com", lt.aor);
+
+	/* async: all records are written out when disabled */
+	err = log_enable_async(true);
+	if (err == ENOSYS) {
+		err = 0;
+		goto out;
+	}
+	TEST_ERR(err);
+
+	lt.n_msg = 0;
+	lt.n_ctx = 0;
+	log_set_context("def456", "sip:bob@example.com");
+	log_burst(100);
+	log_set_context(NULL, NULL);
+
+	err = log_enable_async(false);
+	TEST_ERR(err);
+
+	ASSERT_EQ(100, lt.n_msg);
+	ASSERT_EQ(100, lt.n_ctx);
+	ASSERT_STREQ("def456", lt.callid);
+
+ out:
+	log_enable_async(false);
+	log_set_context(NULL, NULL);
+	log_set_ratelimit(50);
+	log_unregister_handler(&lt.log);
+	log_enable_stderr(true);
+
+	return err;
+}
@@ -4,6 +4,7 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <getopt.h>
+#include <stdio.h>
 #include <re.h>
 #include <baresip.h>
 #include "test.h"
@@ -19,22 +20,72 @@ struct test {
 #define TEST(a) {a, #a}
 
 static const struct test tests[] = {
+	TEST(test_admit),
+	TEST(test_ajb),
+	TEST(test_aufilt),
+	TEST(test_aulevel),
+	TEST(test_aumix),
+	TEST(test_auring),
+	TEST(test_bwe),
 	TEST(test_call_af_mismatch),
 	TEST(test_call_answer),
 	TEST(test_call_answer_hangup_a),
 	TEST(test_call_answer_hangup_b),
+	TEST(test_call_max_calls),
 	TEST(test_call_reject),
+	TEST(test_call_stats),
 	TEST(test_cmd),
+	TEST(test_cmd_exec),
+	TEST(test_cmd_exec_lines),
+	TEST(test_cmd_override),
+	TEST(test_conf_compact),
+	TEST(test_conf_sched),
+	TEST(test_contact),
 	TEST(test_cplusplus),
+	TEST(test_cpugov),
+	TEST(test_dnscache),
+	TEST(test_fec),
+	TEST(test_g711),
+	TEST(test_histo),
+	TEST(test_impair),
+	TEST(test_l16),
+	TEST(test_lagmon),
+	TEST(test_log),
+	TEST(test_mclock),
+	TEST(test_message),
 	TEST(test_mos),
+	TEST(test_mos_continuous),
 	TEST(test_network),
+	TEST(test_network_keepalive),
+	TEST(test_network_nat),
+	TEST(test_resamp),
+	TEST(test_rtcpxr),
+	TEST(test_rtpdemux),
+	TEST(test_rtpext),
+	TEST(test_rtx),
+	TEST(test_sdp_bundle),
+	TEST(test_seqwin),
+	TEST(test_srtp),
+	TEST(test_twheel),
 	TEST(test_ua_alloc),
 	TEST(test_ua_options),
 	TEST(test_ua_register),
 	TEST(test_ua_register_dns),
 	TEST(test_ua_register_auth),
 	TEST(test_ua_register_auth_dns),
+	TEST(test_uag_find),
 	TEST(test_uag_find_param),
+#ifdef USE_VIDEO
+	TEST(test_h264_startcode),
+	TEST(test_h264_stap_a),
+	TEST(test_vidcomp),
+	TEST(test_vidconv_blend),
+	TEST(test_vidconv_fast),
+	TEST(test_vidconv_scale),
+	TEST(test_vidpool),
+	TEST(test_vidsrc_dmabuf),
+	TEST(test_vidsrc_hub),
+#endif
 };
 
 
@@ -113,6 +164,20 @@ static const struct test *find_test(const char *name)
 }
 
 
+static int stdout_handler(const char *p, size_t size, void *arg)
+{
+	(void)arg;
+
+	if (size && 1 != fwrite(p, size, 1, stdout))
+		return ENOMEM;
+
+	return 0;
+}
+
+
+static struct re_printf pf_stdout = {stdout_handler, NULL};
+
+
 static void ua_exit_handler(void *arg)
 {
 	(void)arg;
@@ -127,7 +192,10 @@ static void usage(void)
 	(void)re_fprintf(stderr,
 			 "Usage: selftest [options] <testcases..>\n"
 			 "options:\n"
+			 "\t-b               Run benchmarks, JSON output\n"
 			 "\t-l               List all testcases and exit\n"
+			 "\t-q               Run media quality scenarios, JSON"
+			 " output\n"
 			 "\t-v               Verbose output (INFO level)\n"
 			 );
 }
@@ -138,6 +206,8 @@ int main(int argc, char *argv[])
 	struct config *config;
 	size_t i, ntests;
 	bool verbose = false;
+	bool bench = false;
+	bool quality = false;
 	int err;
 
 	err = libre_init();
@@ -147,12 +217,16 @@ int main(int argc, char *argv[])
 	log_enable_info(false);
 
 	for (;;) {
-		const int c = getopt(argc, argv, "hlv");
+		const int c = getopt(argc, argv, "bhlqv");
 		if (0 > c)
 			break;
 
 		switch (c) {
 
+		case 'b':
+			bench = true;
+			break;
+
 		case '?':
 		case 'h':
 			usage();
@@ -162,6 +236,10 @@ int main(int argc, char *argv[])
 			test_listcases();
 			return 0;
 
+		case 'q':
+			quality = true;
+			break;
+
 		case 'v':
 			if (verbose)
 				log_enable_debug(true);
@@ -180,8 +258,10 @@ int main(int argc, char *argv[])
 	else
 		ntests = ARRAY_SIZE(tests);
 
-	re_printf("running baresip selftest version %s with %zu tests\n",
-		  BARESIP_VERSION, ntests);
+	if (!bench && !quality) {
+		re_printf("running baresip selftest version %s"
+			  " with %zu tests\n", BARESIP_VERSION, ntests);
+	}
 
 	/* note: run SIP-traffic on localhost */
 	config = conf_config();
@@ -198,6 +278,16 @@ int main(int argc, char *argv[])
 
 	uag_set_exit_handler(ua_exit_handler, NULL);
 
+	if (bench) {
+		err = bench_run(&pf_stdout);
+		goto out;
+	}
+
+	if (quality) {
+		err = quality_run(&pf_stdout);
+		goto out;
+	}
+
 	if (argc >= (optind + 1)) {
 
 		for (i=0; i<ntests; i++) {
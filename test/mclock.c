@@ -0,0 +1,94 @@
+/**
+ * @file test/mclock.c  Test the media clock
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "mclock"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	PTIME    = 20,
+	DURATION = 60000,
+};
+
+
+struct fixture {
+	struct mclock_tmr tick;
+	struct mclock_tmr stop;
+	uint64_t last;
+	unsigned n;
+	bool order;
+};
+
+
+static void tick_handler(void *arg)
+{
+	struct fixture *f = arg;
+	const uint64_t now = mclock_now();
+
+	if (f->n && now != f->last + PTIME * 1000)
+		f->order = false;
+
+	f->last = now;
+	++f->n;
+
+	mclock_tmr_start(&f->tick, PTIME, tick_handler, f);
+}
+
+
+static void stop_handler(void *arg)
+{
+	(void)arg;
+
+	re_cancel();
+}
+
+
+int test_mclock(void)
+{
+	struct fixture f = { .order = true };
+	uint64_t t0, ts;
+	int err;
+
+	mclock_set_mode(MCLOCK_FAST);
+	ASSERT_EQ(MCLOCK_FAST, mclock_mode());
+
+	/* a media thread does not wait */
+	t0 = mclock_now();
+	ts = t0 + 3600 * 1000000ULL;
+	mclock_sleep_until(ts);
+	ASSERT_TRUE(mclock_now() >= ts);
+
+	/* one minute of packet-times, much faster than real time */
+	t0 = mclock_now();
+	mclock_tmr_start(&f.tick, PTIME, tick_handler, &f);
+	mclock_tmr_start(&f.stop, DURATION, stop_handler, NULL);
+	ASSERT_TRUE(mclock_tmr_isrunning(&f.tick));
+
+	err = re_main_timeout(5000);
+	if (err)
+		goto out;
+
+	ASSERT_TRUE(f.order);
+	ASSERT_TRUE(f.n >= DURATION / PTIME - 1);
+	ASSERT_TRUE(f.n <= DURATION / PTIME);
+	ASSERT_TRUE(mclock_now() - t0 >= DURATION * 1000ULL);
+	ASSERT_TRUE(!mclock_tmr_isrunning(&f.stop));
+
+	mclock_tmr_cancel(&f.tick);
+	ASSERT_TRUE(!mclock_tmr_isrunning(&f.tick));
+
+ out:
+	mclock_tmr_cancel(&f.tick);
+	mclock_tmr_cancel(&f.stop);
+	mclock_set_mode(MCLOCK_REAL);
+
+	return err;
+}
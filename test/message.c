@@ -0,0 +1,124 @@
+/**
+ * @file test/message.c  Baresip selftest -- SIP MESSAGE
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum {
+	N_SEND   = 12,
+	INFLIGHT = 2,
+	QUEUE    = 8,
+};
+
+
+struct test {
+	struct ua *ua;
+	unsigned n_recv;
+	unsigned n_expect;
+	int err;
+};
+
+
+static void recv_handler(const struct pl *peer, const struct pl *ctype,
+			 struct mbuf *body, void *arg)
+{
+	struct test *t = arg;
+	(void)peer;
+
+	if (pl_strcmp(ctype, "text/plain") ||
+	    0 != memcmp(mbuf_buf(body), "hello", 5)) {
+		t->err = EPROTO;
+		re_cancel();
+		return;
+	}
+
+	if (++t->n_recv >= t->n_expect)
+		re_cancel();
+}
+
+
+static int send_recv(uint32_t rxq)
+{
+	struct config_sip *cfg = &conf_config()->sip;
+	struct config_sip saved = *cfg;
+	struct test t;
+	struct sa laddr;
+	char uri[256];
+	unsigned i, n_ok = 0;
+	int n, err = 0;
+
+	memset(&t, 0, sizeof(t));
+
+	cfg->msg_inflight = INFLIGHT;
+	cfg->msg_queue    = QUEUE;
+	cfg->msg_rxq      = rxq;
+
+	err = ua_init("test", true, false, false, false);
+	TEST_ERR(err);
+
+	err = sip_transp_laddr(uag_sip(), &laddr, SIP_TRANSP_UDP, NULL);
+	TEST_ERR(err);
+
+	err = ua_alloc(&t.ua, "Foo <sip:user:pass@127.0.0.1>;regint=0");
+	TEST_ERR(err);
+
+	err = message_init(recv_handler, &t);
+	TEST_ERR(err);
+
+	n = re_snprintf(uri, sizeof(uri),
+			"sip:user@127.0.0.1:%u", sa_port(&laddr));
+	ASSERT_TRUE(n > 0);
+
+	/* the first ones are sent, then the queue fills up */
+	for (i=0; i<N_SEND; i++) {
+
+		err = message_send(t.ua, uri, "hello");
+		if (err == ENOBUFS)
+			continue;
+		TEST_ERR(err);
+
+		++n_ok;
+	}
+	err = 0;
+
+	ASSERT_EQ(INFLIGHT + QUEUE, n_ok);
+
+	t.n_expect = n_ok;
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(t.err);
+
+	ASSERT_EQ(n_ok, t.n_recv);
+
+ out:
+	message_close();
+	mem_deref(t.ua);
+
+	ua_stop_all(true);
+	ua_close();
+
+	*cfg = saved;
+
+	return err;
+}
+
+
+int test_message(void)
+{
+	int err;
+
+	err = send_recv(0);
+	TEST_ERR(err);
+
+	err = send_recv(4);
+	TEST_ERR(err);
+
+ out:
+	return err;
+}
@@ -0,0 +1,161 @@
+/**
+ * @file mock/audev.c Mock audio devices
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "../test.h"
+
+
+/*
+ * The source sends a frame of noise, and the player takes a frame, each
+ * packet-time, from a media clock timer on the main loop, so that calls
+ * have media without a sound card.
+ */
+
+
+struct ausrc_st {
+	const struct ausrc *as;  /* base class */
+	struct mclock_tmr tmr;
+	struct ausrc_prm prm;
+	int16_t *sampv;
+	size_t sampc;
+	ausrc_read_h *rh;
+	void *arg;
+};
+
+struct auplay_st {
+	const struct auplay *ap;  /* base class */
+	struct mclock_tmr tmr;
+	struct auplay_prm prm;
+	int16_t *sampv;
+	size_t sampc;
+	auplay_write_h *wh;
+	void *arg;
+};
+
+
+static void ausrc_destructor(void *arg)
+{
+	struct ausrc_st *st = arg;
+
+	mclock_tmr_cancel(&st->tmr);
+	mem_deref(st->sampv);
+}
+
+
+static void auplay_destructor(void *arg)
+{
+	struct auplay_st *st = arg;
+
+	mclock_tmr_cancel(&st->tmr);
+	mem_deref(st->sampv);
+}
+
+
+static void ausrc_tmr_handler(void *arg)
+{
+	struct ausrc_st *st = arg;
+
+	mclock_tmr_start(&st->tmr, st->prm.ptime, ausrc_tmr_handler, st);
+
+	st->rh(st->sampv, st->sampc, st->arg);
+}
+
+
+static void auplay_tmr_handler(void *arg)
+{
+	struct auplay_st *st = arg;
+
+	mclock_tmr_start(&st->tmr, st->prm.ptime, auplay_tmr_handler, st);
+
+	st->wh(st->sampv, st->sampc, st->arg);
+}
+
+
+static int mock_ausrc_alloc(struct ausrc_st **stp, const struct ausrc *as,
+			    struct media_ctx **ctx,
+			    struct ausrc_prm *prm, const char *device,
+			    ausrc_read_h *rh, ausrc_error_h *errh, void *arg)
+{
+	struct ausrc_st *st;
+	size_t i;
+	(void)ctx;
+	(void)device;
+	(void)errh;
+
+	if (!stp || !as || !prm || !prm->ptime || !rh)
+		return EINVAL;
+
+	st = mem_zalloc(sizeof(*st), ausrc_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->as    = as;
+	st->prm   = *prm;
+	st->rh    = rh;
+	st->arg   = arg;
+	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
+
+	st->sampv = mem_alloc(st->sampc * sizeof(int16_t), NULL);
+	if (!st->sampv) {
+		mem_deref(st);
+		return ENOMEM;
+	}
+
+	for (i=0; i<st->sampc; i++)
+		st->sampv[i] = (int16_t)(rand_u16() >> 4) - 2048;
+
+	mclock_tmr_start(&st->tmr, prm->ptime, ausrc_tmr_handler, st);
+
+	*stp = st;
+
+	return 0;
+}
+
+
+static int mock_auplay_alloc(struct auplay_st **stp, const struct auplay *ap,
+			     struct auplay_prm *prm, const char *device,
+			     auplay_write_h *wh, void *arg)
+{
+	struct auplay_st *st;
+	(void)device;
+
+	if (!stp || !ap || !prm || !prm->ptime || !wh)
+		return EINVAL;
+
+	st = mem_zalloc(sizeof(*st), auplay_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->ap    = ap;
+	st->prm   = *prm;
+	st->wh    = wh;
+	st->arg   = arg;
+	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
+
+	st->sampv = mem_zalloc(st->sampc * sizeof(int16_t), NULL);
+	if (!st->sampv) {
+		mem_deref(st);
+		return ENOMEM;
+	}
+
+	mclock_tmr_start(&st->tmr, prm->ptime, auplay_tmr_handler, st);
+
+	*stp = st;
+
+	return 0;
+}
+
+
+int mock_ausrc_register(struct ausrc **ausrcp)
+{
+	return ausrc_register(ausrcp, "mock-ausrc", mock_ausrc_alloc);
+}
+
+
+int mock_auplay_register(struct auplay **auplayp)
+{
+	return auplay_register(auplayp, "mock-auplay", mock_auplay_alloc);
+}
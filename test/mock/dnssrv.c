@@ -125,6 +125,8 @@ static void udp_recv(const struct sa *src, struct mbuf *mb, void *arg)
 {
 	struct dns_server *srv = arg;
 
+	++srv->n_queries;
+
 	decode_dns_query(srv, src, mb);
 }
 
@@ -51,3 +51,63 @@ int test_mos(void)
  out:
 	return err;
 }
+
+
+int test_mos_continuous(void)
+{
+	struct mosq mq;
+	uint32_t rx = 0, lost = 0, ts = 0;
+	uint64_t now = 1000000;
+	int i, j, err = 0;
+
+	memset(&mq, 0, sizeof(mq));
+
+	/* one second of 20 ms packets, without jitter or loss */
+	for (i=0; i<50; i++) {
+		mosq_packet(&mq, now, ts, 8000);
+		now += 20000;
+		ts  += 160;
+		++rx;
+	}
+
+	ASSERT_TRUE(!mosq_update(&mq, rx, lost, 0.0, 3.5));
+	ASSERT_TRUE(mq.valid);
+	ASSERT_DOUBLE_EQ(4.404, mq.q.mos, 0.001);
+	ASSERT_DOUBLE_EQ(0.0, mq.q.jitter, 0.001);
+	ASSERT_TRUE(!mq.q.alert);
+
+	/* heavy loss raises the alert, once */
+	for (i=0; i<3; i++) {
+		rx   += 25;
+		lost += 25;
+
+		ASSERT_EQ(i == 0, mosq_update(&mq, rx, lost, 0.0, 3.5));
+	}
+	ASSERT_TRUE(mq.q.alert);
+	ASSERT_EQ(1, mq.q.n_alerts);
+	ASSERT_TRUE(mq.q.mos_min < 3.5);
+
+	/* and it is cleared when the loss is gone */
+	for (i=0, j=0; i<20; i++) {
+		rx += 50;
+		if (mosq_update(&mq, rx, lost, 0.0, 3.5))
+			++j;
+	}
+	ASSERT_EQ(1, j);
+	ASSERT_TRUE(!mq.q.alert);
+	ASSERT_EQ(1, mq.q.n_alerts);
+
+	/* every other packet 5 ms late gives a jitter of 5 ms */
+	for (i=0; i<500; i++) {
+		mosq_packet(&mq, now + (i & 1 ? 5000 : 0), ts, 8000);
+		now += 20000;
+		ts  += 160;
+	}
+	rx += 500;
+
+	(void)mosq_update(&mq, rx, lost, 0.0, 3.5);
+	ASSERT_DOUBLE_EQ(5.0, mq.q.jitter, 0.5);
+
+ out:
+	return err;
+}
@@ -44,3 +44,103 @@ int test_network(void)
 	mem_deref(net);
 	return err;
 }
+
+
+int test_network_nat(void)
+{
+	struct network *net = NULL;
+	struct nat_behavior nb;
+	const struct nat_behavior *nbp;
+	struct sa laddr, other;
+	int err;
+
+	memset(&nb, 0, sizeof(nb));
+
+	err = net_alloc(&net, &default_config, AF_INET);
+	TEST_ERR(err);
+
+	err  = sa_set_str(&laddr, "10.0.0.2", 5060);
+	err |= sa_set_str(&other, "10.0.0.3", 0);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(NULL == net_nat_get(net, &laddr));
+
+	nb.mapping  = NAT_TYPE_ENDP_INDEP;
+	nb.lifetime = 100;
+
+	err = net_nat_set(net, &laddr, &nb);
+	TEST_ERR(err);
+
+	/* cached by address, the port does not matter */
+	sa_set_port(&laddr, 0);
+	nbp = net_nat_get(net, &laddr);
+	ASSERT_TRUE(nbp != NULL);
+	ASSERT_EQ(NAT_TYPE_ENDP_INDEP, nbp->mapping);
+	ASSERT_EQ(100, nbp->lifetime);
+	ASSERT_TRUE(NULL == net_nat_get(net, &other));
+
+	nb.lifetime = 10;
+	nb.lifetime_final = true;
+	err = net_nat_set(net, &laddr, &nb);
+	TEST_ERR(err);
+	ASSERT_EQ(10, net_nat_get(net, &laddr)->lifetime);
+
+	ASSERT_EQ(EINVAL, net_nat_set(net, NULL, &nb));
+
+ out:
+	mem_deref(net);
+	return err;
+}
+
+
+int test_network_keepalive(void)
+{
+	struct network *net = NULL;
+	struct nat_behavior nb;
+	const struct sa *laddr;
+	int err;
+
+	memset(&nb, 0, sizeof(nb));
+
+	err = net_alloc(&net, &default_config, AF_INET);
+	TEST_ERR(err);
+
+	/* unknown lifetime */
+	ASSERT_EQ(15, net_keepalive(net, AF_INET, 15));
+
+	laddr = net_laddr_af(net, AF_INET);
+	if (!sa_isset(laddr, SA_ADDR))
+		goto out;
+
+	/* lower bound, still probing */
+	nb.lifetime = 10;
+	err = net_nat_set(net, laddr, &nb);
+	TEST_ERR(err);
+	ASSERT_EQ(15, net_keepalive(net, AF_INET, 15));
+
+	nb.lifetime = 100;
+	err = net_nat_set(net, laddr, &nb);
+	TEST_ERR(err);
+	ASSERT_EQ(80, net_keepalive(net, AF_INET, 15));
+
+	/* the binding expired after 10 seconds */
+	nb.lifetime = 10;
+	nb.lifetime_final = true;
+	err = net_nat_set(net, laddr, &nb);
+	TEST_ERR(err);
+	ASSERT_EQ(8, net_keepalive(net, AF_INET, 15));
+
+	nb.lifetime = 2;
+	err = net_nat_set(net, laddr, &nb);
+	TEST_ERR(err);
+	ASSERT_EQ(5, net_keepalive(net, AF_INET, 15));
+
+	nb.lifetime = 7200;
+	err = net_nat_set(net, laddr, &nb);
+	TEST_ERR(err);
+	ASSERT_EQ(600, net_keepalive(net, AF_INET, 15));
+
+ out:
+	mem_deref(net);
+	return err;
+}
@@ -0,0 +1,498 @@
+/**
+ * @file test/quality.c  Baresip selftest -- media quality under impairment
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <time.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+/*
+ * The quality harness makes one call over loopback for each scenario,
+ * with mock audio devices and a cheap codec, and impairs the audio that
+ * A sends to B with the network impairment of the stream. The loss,
+ * jitter, reordering and rate cap of a scenario come from a seeded
+ * generator, so two runs lose the same packets, and no tc or netem is
+ * needed.
+ *
+ * After a warmup the receiver B is measured for a while: the latency
+ * from encoder to decoder, the MOS estimate, the jitter-buffer counters
+ * and the time that was concealed. The results are printed as one JSON
+ * object, so that the quality of two commits can be compared by a
+ * script.
+ *
+ * The codec sends the time of the encoder with each frame. In the FEC
+ * scenarios a second codec also sends the previous frame, so that the
+ * decoder can recover a lost frame from the next packet.
+ */
+
+
+enum {
+	QUALITY_WARMUP  = 1000,   /**< Before measuring [ms]         */
+	QUALITY_HOLD    = 5000,   /**< Measured part of a call [ms]  */
+	QUALITY_TIMEOUT = 30000,
+	PTIME           = 20,
+	FRAME           = 160,
+	TS_SIZE         = 8,
+};
+
+struct scenario {
+	const char *name;
+	struct impair_prm prm;
+	bool adaptive;            /**< Adaptive jitter-buffer        */
+	bool fec;                 /**< Codec with in-band FEC        */
+};
+
+struct quality {
+	const struct scenario *sc;
+	struct ua *a, *b;
+	struct tmr tmr;
+	struct histo latency;     /**< Encoder to decoder [us]       */
+	bool measuring;
+	bool done;
+	struct audio_rxstat rx0, rx;
+	struct jbuf_stat jb0, jb;
+	struct stream_quality q;
+	struct impair_stat imp;
+	int err;
+};
+
+
+static const struct scenario scenariov[] = {
+	{"clean",      {.seed = 1},                         false, false},
+	{"loss_2",     {.loss_good = 0.02, .seed = 2},      false, false},
+	{"loss_10",    {.loss_good = 0.10, .seed = 3},      false, false},
+	{"burst_loss", {.p_bad = 0.02, .p_good = 0.25,
+			.loss_bad = 0.8, .seed = 4},        false, false},
+	{"loss_2_fec", {.loss_good = 0.02, .seed = 2},      false, true},
+	{"burst_fec",  {.p_bad = 0.02, .p_good = 0.25,
+			.loss_bad = 0.8, .seed = 4},        false, true},
+	{"jitter_40",  {.delay = 20, .jitter = 40,
+			.seed = 5},                         false, false},
+	{"jitter_40_adaptive",
+		       {.delay = 20, .jitter = 40,
+			.seed = 5},                         true,  false},
+	{"jitter_100_adaptive",
+		       {.delay = 50, .jitter = 100,
+			.seed = 6},                         true,  false},
+	{"reorder_10", {.delay = 10, .jitter = 20,
+			.reorder = 0.1, .seed = 7},         false, false},
+	{"rate_64k",   {.rate = 64000, .queue = 100,
+			.seed = 8},                         false, false},
+};
+
+static struct quality *cur;
+static uint8_t prev_frame[FRAME];  /* one call at a time */
+
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static int quality_encode(struct auenc_state *aes, uint8_t *buf, size_t *len,
+			  const int16_t *sampv, size_t sampc)
+{
+	uint64_t ts = now_us();
+	(void)aes;
+
+	if (*len < TS_SIZE + sampc)
+		return ENOMEM;
+
+	memcpy(buf, &ts, TS_SIZE);
+	g711_encode_batch(G711_ALAW, buf + TS_SIZE, sampv, sampc);
+
+	*len = TS_SIZE + sampc;
+
+	return 0;
+}
+
+
+static int quality_encode_fec(struct auenc_state *aes, uint8_t *buf,
+			      size_t *len, const int16_t *sampv, size_t sampc)
+{
+	int err;
+
+	if (sampc != FRAME || *len < TS_SIZE + 2 * FRAME)
+		return ENOMEM;
+
+	err = quality_encode(aes, buf, len, sampv, sampc);
+	if (err)
+		return err;
+
+	memcpy(buf + *len, prev_frame, FRAME);
+	memcpy(prev_frame, buf + TS_SIZE, FRAME);
+
+	*len += FRAME;
+
+	return 0;
+}
+
+
+static int quality_decode(struct audec_state *ads, int16_t *sampv,
+			  size_t *sampc, const uint8_t *buf, size_t len)
+{
+	uint64_t ts;
+	size_t n;
+	(void)ads;
+
+	if (len < TS_SIZE + FRAME)
+		return EINVAL;
+
+	/* the FEC codec has the previous frame behind the current one */
+	n = min(len - TS_SIZE, (size_t)FRAME);
+	if (*sampc < n)
+		return EINVAL;
+
+	memcpy(&ts, buf, TS_SIZE);
+
+	if (cur && cur->measuring)
+		histo_add(&cur->latency, (uint32_t)(now_us() - ts));
+
+	g711_decode_batch(G711_ALAW, sampv, buf + TS_SIZE, n);
+
+	*sampc = n;
+
+	return 0;
+}
+
+
+static int quality_fec(struct audec_state *ads, int16_t *sampv,
+		       size_t *sampc, const uint8_t *buf, size_t len)
+{
+	(void)ads;
+
+	if (len < TS_SIZE + 2 * FRAME || *sampc < FRAME)
+		return EINVAL;
+
+	g711_decode_batch(G711_ALAW, sampv, buf + TS_SIZE + FRAME, FRAME);
+
+	*sampc = FRAME;
+
+	return 0;
+}
+
+
+static int quality_plc(struct audec_state *ads, int16_t *sampv,
+		       size_t *sampc)
+{
+	(void)ads;
+
+	memset(sampv, 0, *sampc * sizeof(*sampv));
+
+	return 0;
+}
+
+
+static struct aucodec quality_codec = {
+	.pt    = "96",
+	.name  = "X-QUALITY",
+	.srate = 8000,
+	.crate = 8000,
+	.ch    = 1,
+	.ench  = quality_encode,
+	.dech  = quality_decode,
+	.plch  = quality_plc,
+};
+
+static struct aucodec quality_codec_fec = {
+	.pt    = "96",
+	.name  = "X-QUALITY",
+	.srate = 8000,
+	.crate = 8000,
+	.ch    = 1,
+	.ench  = quality_encode_fec,
+	.dech  = quality_decode,
+	.plch  = quality_plc,
+	.fech  = quality_fec,
+};
+
+
+static struct audio *call_audio_of(const struct ua *ua)
+{
+	return call_audio(list_ledata(list_head(ua_calls(ua))));
+}
+
+
+/* must be called on the receiver B */
+static void sample(struct audio *au, struct audio_rxstat *rx,
+		   struct jbuf_stat *jb)
+{
+	memset(rx, 0, sizeof(*rx));
+	memset(jb, 0, sizeof(*jb));
+
+	(void)audio_rx_stats(au, rx);
+	(void)stream_jbuf_stats(audio_strm(au), jb);
+}
+
+
+static void measure_end(void *arg)
+{
+	struct quality *qc = arg;
+	struct audio *au = call_audio_of(qc->b);
+	struct audio *au_a = call_audio_of(qc->a);
+
+	qc->measuring = false;
+	qc->done      = true;
+
+	sample(au, &qc->rx, &qc->jb);
+	(void)stream_quality(audio_strm(au), &qc->q);
+	(void)stream_impair_stats(audio_strm(au_a), &qc->imp);
+
+	re_cancel();
+}
+
+
+static void measure_start(void *arg)
+{
+	struct quality *qc = arg;
+
+	sample(call_audio_of(qc->b), &qc->rx0, &qc->jb0);
+
+	qc->measuring = true;
+
+	tmr_start(&qc->tmr, QUALITY_HOLD, measure_end, qc);
+}
+
+
+static void event_handler(struct ua *ua, enum ua_event ev,
+			  struct call *call, const char *prm, void *arg)
+{
+	struct quality *qc = arg;
+	(void)prm;
+
+	switch (ev) {
+
+	case UA_EVENT_CALL_INCOMING:
+		if (ua != qc->b)
+			return;
+
+		qc->err = ua_answer(ua, call);
+		break;
+
+	case UA_EVENT_CALL_ESTABLISHED:
+		if (ua != qc->a)
+			return;
+
+		qc->err = stream_impair(audio_strm(call_audio(call)),
+					&qc->sc->prm);
+		if (!qc->err) {
+			tmr_start(&qc->tmr, QUALITY_WARMUP,
+				  measure_start, qc);
+		}
+		break;
+
+	case UA_EVENT_CALL_CLOSED:
+		if (ua != qc->a || qc->done)
+			return;
+
+		qc->err = ECONNRESET;
+		break;
+
+	default:
+		return;
+	}
+
+	if (qc->err)
+		re_cancel();
+}
+
+
+static int histo_print(struct re_printf *pf, const struct histo *h)
+{
+	return re_hprintf(pf, "{\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}",
+			  histo_percentile(h, 50), histo_percentile(h, 90),
+			  histo_percentile(h, 99), histo_max(h));
+}
+
+
+static int prm_print(struct re_printf *pf, const struct scenario *sc)
+{
+	const struct impair_prm *prm = &sc->prm;
+
+	return re_hprintf(pf, "{\"p_bad\":%.3f,\"p_good\":%.3f"
+			  ",\"loss_good\":%.3f,\"loss_bad\":%.3f"
+			  ",\"delay_ms\":%u,\"jitter_ms\":%u"
+			  ",\"reorder\":%.3f,\"rate\":%u,\"seed\":%u"
+			  ",\"adaptive\":%s,\"fec\":%s}",
+			  prm->p_bad, prm->p_good,
+			  prm->loss_good, prm->loss_bad,
+			  prm->delay, prm->jitter,
+			  prm->reorder, prm->rate, prm->seed,
+			  sc->adaptive ? "true" : "false",
+			  sc->fec ? "true" : "false");
+}
+
+
+static int result_print(struct re_printf *pf, const struct quality *qc)
+{
+	const struct audio_rxstat *rx = &qc->rx, *rx0 = &qc->rx0;
+	const struct jbuf_stat *jb = &qc->jb, *jb0 = &qc->jb0;
+	const struct impair_stat *imp = &qc->imp;
+
+	return re_hprintf(pf, "\n    {\"name\":\"%s\",\"prm\":%H"
+			  ",\n     \"latency_us\":%H"
+			  ",\n     \"mos\":%.2f,\"mos_min\":%.2f"
+			  ",\"loss_percent\":%.2f,\"jitter_ms\":%.1f"
+			  ",\n     \"concealed_ms\":%u,\"fec_frames\":%u"
+			  ",\"late_frames\":%u,\"accel\":%u,\"expand\":%u"
+			  ",\n     \"jbuf\":{\"lost\":%u,\"late\":%u"
+			  ",\"underflow\":%u,\"overflow\":%u}"
+			  ",\n     \"impair\":{\"sent\":%u,\"lost\":%u"
+			  ",\"dropped\":%u,\"reordered\":%u}}",
+			  qc->sc->name, prm_print, qc->sc,
+			  histo_print, &qc->latency,
+			  qc->q.mos, qc->q.mos_min,
+			  qc->q.loss, qc->q.jitter,
+			  (rx->n_plc - rx0->n_plc) * PTIME,
+			  rx->n_fec - rx0->n_fec,
+			  rx->n_late - rx0->n_late,
+			  rx->n_accel - rx0->n_accel,
+			  rx->n_expand - rx0->n_expand,
+			  jb->n_lost - jb0->n_lost,
+			  jb->n_late - jb0->n_late,
+			  jb->n_underflow - jb0->n_underflow,
+			  jb->n_overflow - jb0->n_overflow,
+			  imp->n_pkt, imp->n_lost,
+			  imp->n_drop, imp->n_reorder);
+}
+
+
+static int quality_scenario(struct re_printf *pf, const struct scenario *sc,
+			    bool first)
+{
+	struct config *cfg = conf_config();
+	struct aucodec *ac = sc->fec ? &quality_codec_fec : &quality_codec;
+	struct quality *qc;
+	struct call *call;
+	struct sa laddr;
+	char uri[256];
+	int err;
+
+	qc = mem_zalloc(sizeof(*qc), NULL);
+	if (!qc)
+		return ENOMEM;
+
+	qc->sc = sc;
+	tmr_init(&qc->tmr);
+	memset(prev_frame, 0xd5, sizeof(prev_frame));  /* A-law silence */
+
+	cfg->avt.jbuf_adaptive = sc->adaptive;
+
+	aucodec_register(ac);
+	cur = qc;
+
+	err = ua_init("quality", true, false, false, false);
+	if (err)
+		goto out;
+
+	err  = ua_alloc(&qc->a, "A <sip:a@127.0.0.1>;regint=0");
+	err |= ua_alloc(&qc->b, "B <sip:b@127.0.0.1>;regint=0");
+	if (err)
+		goto out;
+
+	err = uag_event_register(event_handler, qc);
+	if (err)
+		goto out;
+
+	err = sip_transp_laddr(uag_sip(), &laddr, SIP_TRANSP_UDP, NULL);
+	if (err)
+		goto out;
+
+	re_snprintf(uri, sizeof(uri), "sip:b@%J", &laddr);
+
+	err = ua_connect(qc->a, &call, NULL, uri, NULL, VIDMODE_OFF);
+	if (err)
+		goto out;
+
+	err = re_main_timeout(QUALITY_TIMEOUT);
+	if (err)
+		goto out;
+	if (qc->err) {
+		err = qc->err;
+		goto out;
+	}
+
+	err = re_hprintf(pf, "%s%H", first ? "" : ",", result_print, qc);
+
+ out:
+	if (err)
+		warning("quality: %s: %m\n", sc->name, err);
+
+	tmr_cancel(&qc->tmr);
+	uag_event_unregister(event_handler);
+
+	mem_deref(qc->b);
+	mem_deref(qc->a);
+	ua_stop_all(true);
+	ua_close();
+
+	cur = NULL;
+	aucodec_unregister(ac);
+
+	mem_deref(qc);
+
+	return err;
+}
+
+
+/**
+ * Run all quality scenarios, and print the results as JSON
+ *
+ * @param pf Print function for the results
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int quality_run(struct re_printf *pf)
+{
+	struct config *cfg = conf_config();
+	struct config_call call_cfg = cfg->call;
+	struct config_audio audio_cfg = cfg->audio;
+	struct config_avt avt_cfg = cfg->avt;
+	struct ausrc *ausrc = NULL;
+	struct auplay *auplay = NULL;
+	size_t i;
+	int err;
+
+	memset(&cfg->call, 0, sizeof(cfg->call));
+
+	str_ncpy(cfg->audio.src_mod, "mock-ausrc",
+		 sizeof(cfg->audio.src_mod));
+	str_ncpy(cfg->audio.play_mod, "mock-auplay",
+		 sizeof(cfg->audio.play_mod));
+
+	err  = mock_ausrc_register(&ausrc);
+	err |= mock_auplay_register(&auplay);
+	if (err)
+		goto out;
+
+	g711_batch_init();
+
+	err = re_hprintf(pf, "{\n  \"version\":\"%s\",\n  \"hold_ms\":%u"
+			 ",\n  \"scenarios\":[",
+			 BARESIP_VERSION, QUALITY_HOLD);
+
+	for (i=0; i<ARRAY_SIZE(scenariov) && !err; i++)
+		err = quality_scenario(pf, &scenariov[i], i == 0);
+
+	err |= re_hprintf(pf, "\n  ]\n}\n");
+
+ out:
+	mem_deref(auplay);
+	mem_deref(ausrc);
+
+	cfg->call  = call_cfg;
+	cfg->audio = audio_cfg;
+	cfg->avt   = avt_cfg;
+
+	return err;
+}
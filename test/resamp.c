@@ -0,0 +1,231 @@
+/**
+ * @file test/resamp.c  Test the audio resampler
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "resamp"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum { PTIME = 20, MAX_SAMPC = 48000 * 2 * PTIME / 1000 * 2 };
+
+
+static const struct {
+	uint32_t irate;
+	uint32_t orate;
+} ratev[] = {
+	{ 8000, 48000},
+	{48000,  8000},
+	{16000, 48000},
+	{48000, 16000},
+	{ 8000, 16000},
+	{44100, 48000},
+	{48000, 44100},
+};
+
+
+static void sine(int16_t *sampv, size_t frames, unsigned ch,
+		 uint32_t srate, uint32_t freq, size_t *t)
+{
+	size_t i;
+	unsigned c;
+
+	for (i=0; i<frames; i++, (*t)++) {
+
+		double v = 16000 * sin(2 * M_PI * freq * (*t) / srate);
+
+		for (c=0; c<ch; c++)
+			sampv[i*ch + c] = (int16_t)v;
+	}
+}
+
+
+static double rms(const int16_t *sampv, size_t n)
+{
+	double sum = 0;
+	size_t i;
+
+	for (i=0; i<n; i++)
+		sum += (double)sampv[i] * sampv[i];
+
+	return n ? sqrt(sum / n) : 0;
+}
+
+
+/* resample 1s of a tone, compare output size and level */
+static int run_tone(enum simd_impl impl, uint32_t irate, uint32_t orate,
+		    unsigned ich, unsigned och, uint32_t freq,
+		    size_t *totalp, double *rmsp, int16_t *ref)
+{
+	const size_t frames = irate * PTIME / 1000;
+	int16_t inv[MAX_SAMPC], outv[MAX_SAMPC];
+	struct resamp *rs = NULL;
+	size_t t = 0, total = 0, i;
+	double level = 0;
+	unsigned n = 0;
+	int err;
+
+	err = resamp_alloc(&rs, RESAMP_POLYPHASE, irate, ich, orate, och);
+	if (err)
+		return err;
+
+	resamp_set_simd(rs, impl);
+
+	for (i=0; i<1000/PTIME; i++) {
+
+		size_t outc = ARRAY_SIZE(outv);
+
+		sine(inv, frames, ich, irate, freq, &t);
+
+		err = resamp_process(rs, outv, &outc, inv, frames * ich);
+		if (err)
+			goto out;
+
+		/* the output fits the size from resamp_outc() */
+		ASSERT_TRUE(outc <= resamp_outc(rs, frames * ich));
+
+		/* SIMD and C give the same samples */
+		if (ref) {
+			if (memcmp(ref + total, outv, outc * sizeof(*outv))) {
+				err = EBADMSG;
+				goto out;
+			}
+		}
+
+		/* skip the filter delay */
+		if (i >= 5) {
+			level += rms(outv, outc);
+			++n;
+		}
+
+		total += outc;
+	}
+
+	*totalp = total;
+	*rmsp = n ? level / n : 0;
+
+ out:
+	mem_deref(rs);
+
+	return err;
+}
+
+
+int test_resamp(void)
+{
+	int16_t *ref = NULL;
+	size_t i;
+	int impl;
+	int err = 0;
+
+	ref = mem_zalloc(48000 * 2 * sizeof(*ref), NULL);
+	if (!ref)
+		return ENOMEM;
+
+	for (i=0; i<ARRAY_SIZE(ratev); i++) {
+
+		const uint32_t irate = ratev[i].irate, orate = ratev[i].orate;
+		const uint32_t low = min(irate, orate);
+		size_t total;
+		double pass, stop;
+
+		/* passband tone keeps its level (16000/sqrt(2)) */
+		err = run_tone(SIMD_C, irate, orate, 1, 1, low / 8,
+			       &total, &pass, NULL);
+		TEST_ERR(err);
+
+		ASSERT_EQ(orate, total);
+		ASSERT_TRUE(pass > 11000 && pass < 11600);
+
+		/* a tone between the two Nyquist rates is filtered out */
+		if (irate > orate) {
+			err = run_tone(SIMD_C, irate, orate, 1, 1,
+				       (irate + orate) / 4,
+				       &total, &stop, NULL);
+			TEST_ERR(err);
+
+			ASSERT_TRUE(stop < pass / 1000);
+		}
+	}
+
+	/* SIMD implementations are bit-exact with C, also in stereo */
+	for (i=0; i<ARRAY_SIZE(ratev); i++) {
+
+		const uint32_t irate = ratev[i].irate, orate = ratev[i].orate;
+		struct resamp *rs = NULL;
+		size_t total, t = 0, n, outc;
+		double level;
+
+		/* keep the C output as reference */
+		err = resamp_alloc(&rs, RESAMP_POLYPHASE, irate, 2, orate, 2);
+		TEST_ERR(err);
+
+		resamp_set_simd(rs, SIMD_C);
+
+		for (n=0, total=0; n<1000/PTIME; n++) {
+
+			int16_t inv[MAX_SAMPC];
+			const size_t frames = irate * PTIME / 1000;
+
+			sine(inv, frames, 2, irate, 1000, &t);
+
+			outc = 48000 * 2 - total;
+			err = resamp_process(rs, ref + total, &outc,
+					     inv, frames * 2);
+			if (err)
+				break;
+
+			total += outc;
+		}
+		mem_deref(rs);
+		TEST_ERR(err);
+
+		for (impl=SIMD_C+1; impl<SIMD_N; impl++) {
+
+			if (!simd_supported(impl))
+				continue;
+
+			err = run_tone(impl, irate, orate, 2, 2, 1000,
+				       &total, &level, ref);
+			if (err == EBADMSG) {
+				warning("resamp: %u -> %u: %s differs\n",
+					irate, orate, simd_name(impl));
+			}
+			TEST_ERR(err);
+
+			ASSERT_EQ(orate * 2, total);
+		}
+	}
+
+	/* channel conversion only */
+	{
+		struct resamp *rs = NULL;
+		int16_t inv[4] = {100, 300, -100, -300}, outv[4];
+		size_t outc = ARRAY_SIZE(outv);
+
+		err = resamp_alloc(&rs, RESAMP_POLYPHASE, 8000, 2, 8000, 1);
+		TEST_ERR(err);
+
+		err = resamp_process(rs, outv, &outc, inv, 4);
+		mem_deref(rs);
+		TEST_ERR(err);
+
+		ASSERT_EQ(2, outc);
+		ASSERT_EQ(200, outv[0]);
+		ASSERT_EQ(-200, outv[1]);
+	}
+
+ out:
+	mem_deref(ref);
+
+	return err;
+}
@@ -0,0 +1,129 @@
+/**
+ * @file test/rtcpxr.c  Test the RTCP XR VoIP Metrics
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "rtcpxr"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	SRATE = 8000,
+	PTIME = 20,
+	PKTC  = 1000,
+};
+
+
+/* Receive PKTC packets of 20 ms, less the ones lost */
+static void receive(struct rtcpxr *xr, bool (*lost)(uint16_t seq))
+{
+	uint16_t seq;
+
+	memset(xr, 0, sizeof(*xr));
+
+	for (seq=0; seq<PKTC; seq++) {
+
+		if (!lost(seq))
+			rtcpxr_packet(xr, seq, seq * SRATE * PTIME / 1000,
+				      SRATE);
+	}
+}
+
+
+static bool lost_isolated(uint16_t seq)
+{
+	return seq && (seq % 50) == 0;
+}
+
+
+/* a burst of 9 packets with 5 of them lost, at 500 */
+static bool lost_burst(uint16_t seq)
+{
+	return seq >= 500 && seq < 510 && (seq & 1) == 0;
+}
+
+
+int test_rtcpxr(void)
+{
+	struct rtcpxr xr;
+	struct rtcpxr_voip v, v2;
+	struct mbuf *mb;
+	int err = 0;
+
+	mb = mbuf_alloc(128);
+	if (!mb)
+		return ENOMEM;
+
+	/* isolated losses are in the gaps */
+	receive(&xr, lost_isolated);
+
+	ASSERT_EQ(PKTC - 19, xr.n_rx);
+	ASSERT_EQ(19, xr.n_lost);
+	ASSERT_EQ(PTIME, xr.ptime);
+
+	rtcpxr_voip_init(&v, 0x01020304);
+	rtcpxr_voip_calc(&v, &xr, 0);
+
+	ASSERT_EQ(19 * 256 / PKTC, v.loss_rate);
+	ASSERT_EQ(0, v.discard_rate);
+	ASSERT_EQ(19 * 256 / PKTC, v.gap_density);
+	ASSERT_EQ(0, v.burst_density);
+	ASSERT_EQ(PKTC * PTIME, v.gap_duration);
+	ASSERT_EQ(16, v.gmin);
+
+	/* a burst has a higher loss density than the gaps around it */
+	receive(&xr, lost_burst);
+
+	ASSERT_EQ(5, xr.n_lost);
+
+	rtcpxr_voip_calc(&v, &xr, 10);
+
+	ASSERT_EQ(10 * 256 / PKTC, v.discard_rate);
+	ASSERT_TRUE(v.burst_density > 64);
+	ASSERT_EQ(0, v.gap_density);
+	ASSERT_EQ(9 * PTIME, v.burst_duration);
+	ASSERT_TRUE(v.gap_duration >= (PKTC - 9) * PTIME);
+	ASSERT_TRUE(v.gap_duration <= (PKTC - 8) * PTIME);
+
+	/* duplicates and late packets are not counted */
+	rtcpxr_packet(&xr, PKTC - 1, 0, SRATE);
+	rtcpxr_packet(&xr, 500, 0, SRATE);
+	ASSERT_EQ(PKTC - 5, xr.n_rx);
+	ASSERT_EQ(5, xr.n_lost);
+
+	/* the block is found after another packet of a compound */
+	v.rtd    = 150;
+	v.esd    = 60;
+	v.mos_cq = 42;
+
+	err  = mbuf_write_u32(mb, htonl(0x80c90001));  /* RR without blocks */
+	err |= mbuf_write_u32(mb, htonl(0x11223344));
+	err |= rtcpxr_voip_encode(mb, 0x11223344, &v);
+	TEST_ERR(err);
+
+	ASSERT_EQ(8 + 44, mb->end);
+
+	memset(&v2, 0, sizeof(v2));
+	mb->pos = 0;
+	err = rtcpxr_voip_decode(&v2, mb);
+	TEST_ERR(err);
+
+	ASSERT_EQ(0, mb->pos);
+	ASSERT_TRUE(0 == memcmp(&v, &v2, sizeof(v)));
+
+	/* none in a packet without XR */
+	mb->end = 8;
+	ASSERT_EQ(ENOENT, rtcpxr_voip_decode(&v2, mb));
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
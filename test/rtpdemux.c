@@ -0,0 +1,88 @@
+/**
+ * @file test/rtpdemux.c  Test the demultiplexing of received RTP by SSRC
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "rtpdemux"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+int test_rtpdemux(void)
+{
+	struct rtpdemux *dm = NULL;
+	struct rtpdemux_entry *e;
+	int a, b;
+	uint32_t i;
+	int err;
+
+	err = rtpdemux_alloc(&dm);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(NULL == rtpdemux_lookup(dm, 0x1234));
+
+	/* a media source and its retransmissions */
+	e = rtpdemux_add(dm, 0x1234, 96, RTP_ROLE_PRIMARY, &a);
+	ASSERT_TRUE(e != NULL);
+	e = rtpdemux_add(dm, 0x5678, 97, RTP_ROLE_RTX, &a);
+	ASSERT_TRUE(e != NULL);
+	e = rtpdemux_add(dm, 0x9abc, 100, RTP_ROLE_PRIMARY, &b);
+	ASSERT_TRUE(e != NULL);
+	ASSERT_EQ(3, rtpdemux_count(dm));
+
+	e = rtpdemux_lookup(dm, 0x5678);
+	ASSERT_TRUE(e != NULL);
+	ASSERT_EQ(RTP_ROLE_RTX, e->role);
+	ASSERT_EQ(97, e->pt);
+	ASSERT_TRUE(e->arg == &a);
+
+	/* the interval of the packets */
+	e = rtpdemux_lookup(dm, 0x1234);
+	ASSERT_TRUE(e != NULL);
+	for (i=0; i<10; i++)
+		rtpdemux_packet(e, 160, 1000 + i * 20);
+	ASSERT_EQ(10, e->n_pkt);
+	ASSERT_EQ(1600, e->n_bytes);
+	ASSERT_EQ(20, e->ival);
+	ASSERT_EQ(1180, e->last);
+
+	/* adding a known source updates it */
+	e = rtpdemux_add(dm, 0x1234, 96, RTP_ROLE_PRIMARY, &a);
+	ASSERT_EQ(10, e->n_pkt);
+	ASSERT_EQ(3, rtpdemux_count(dm));
+
+	rtpdemux_remove(dm, &a);
+	ASSERT_EQ(1, rtpdemux_count(dm));
+	ASSERT_TRUE(NULL == rtpdemux_lookup(dm, 0x1234));
+	ASSERT_TRUE(NULL == rtpdemux_lookup(dm, 0x5678));
+	ASSERT_TRUE(NULL != rtpdemux_lookup(dm, 0x9abc));
+
+	/* when full, the source that was silent longest is removed */
+	for (i=0; i<64; i++) {
+		e = rtpdemux_add(dm, i * 0x01000193, 96, RTP_ROLE_PRIMARY,
+				 &a);
+		ASSERT_TRUE(e != NULL);
+		rtpdemux_packet(e, 100, 2000 + i);
+	}
+	ASSERT_TRUE(rtpdemux_count(dm) < 32);
+	ASSERT_TRUE(NULL == rtpdemux_lookup(dm, 0x9abc));
+	ASSERT_TRUE(NULL != rtpdemux_lookup(dm, 63 * 0x01000193));
+
+	/* all remaining sources can still be found */
+	for (i=64 - rtpdemux_count(dm); i<64; i++)
+		ASSERT_TRUE(NULL != rtpdemux_lookup(dm, i * 0x01000193));
+
+	rtpdemux_remove(dm, &a);
+	ASSERT_EQ(0, rtpdemux_count(dm));
+
+ out:
+	mem_deref(dm);
+
+	return err;
+}
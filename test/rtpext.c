@@ -0,0 +1,95 @@
+/**
+ * @file test/rtpext.c  Test the RTP Header Extensions
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "rtpext"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+int test_rtpext(void)
+{
+	static const uint8_t level[1] = {0x80 | 42};
+	static const uint8_t seq[2] = {0x12, 0x34};
+	static const uint8_t expected[] = {
+		0xbe, 0xde, 0x00, 0x02,
+		0x10, 0xaa,
+		0x31, 0x12, 0x34,
+		0x00, 0x00, 0x00
+	};
+	int16_t sampv[160];
+	struct rtpext ext;
+	struct mbuf *mb;
+	struct pl uri;
+	size_t i;
+	int err;
+
+	mb = mbuf_alloc(64);
+	if (!mb)
+		return ENOMEM;
+
+	/* 5 bytes of elements are padded to 8 */
+	err  = rtpext_hdr_encode(mb, 5);
+	err |= rtpext_encode(mb, 1, sizeof(level), level);
+	err |= rtpext_encode(mb, 3, sizeof(seq), seq);
+	err |= mbuf_fill(mb, 0x00, 3);
+	TEST_ERR(err);
+
+	ASSERT_EQ(sizeof(expected), mb->end);
+	ASSERT_TRUE(0 == memcmp(expected, mb->buf, mb->end));
+
+	ASSERT_EQ(EINVAL, rtpext_encode(mb, 15, 1, level));
+	ASSERT_EQ(EINVAL, rtpext_encode(mb, 1, 17, level));
+
+	mb->pos = RTPEXT_HDR_SIZE;
+	mb->end = sizeof(expected);
+
+	err = rtpext_decode(&ext, mb);
+	TEST_ERR(err);
+	ASSERT_EQ(1, ext.id);
+	ASSERT_EQ(1, ext.len);
+	ASSERT_EQ(level[0], ext.data[0]);
+
+	err = rtpext_decode(&ext, mb);
+	TEST_ERR(err);
+	ASSERT_EQ(3, ext.id);
+	ASSERT_EQ(2, ext.len);
+	ASSERT_TRUE(0 == memcmp(seq, ext.data, ext.len));
+
+	/* the padding is skipped */
+	ASSERT_EQ(ENOENT, rtpext_decode(&ext, mb));
+
+	pl_set_str(&uri, rtpext_uri(RTPEXT_ABS_SEND_TIME));
+	ASSERT_EQ(RTPEXT_ABS_SEND_TIME, rtpext_find(&uri));
+	pl_set_str(&uri, "urn:example:unknown");
+	ASSERT_EQ(-1, rtpext_find(&uri));
+
+	/* 6.18 fixed point seconds, wrapping every 64 seconds */
+	ASSERT_EQ(0, rtpext_abs_send_time(0));
+	ASSERT_EQ(1u << 18, rtpext_abs_send_time(1000000));
+	ASSERT_EQ(1u << 17, rtpext_abs_send_time(64500000));
+
+	/* a full scale square wave is 0 dBov, -20 dB is 20 */
+	for (i=0; i<ARRAY_SIZE(sampv); i++)
+		sampv[i] = i & 1 ? 32767 : -32767;
+	ASSERT_EQ(0, aulevel_dbov(sampv, ARRAY_SIZE(sampv)));
+
+	for (i=0; i<ARRAY_SIZE(sampv); i++)
+		sampv[i] = i & 1 ? 3277 : -3277;
+	ASSERT_EQ(20, aulevel_dbov(sampv, ARRAY_SIZE(sampv)));
+
+	memset(sampv, 0, sizeof(sampv));
+	ASSERT_EQ(96, aulevel_dbov(sampv, ARRAY_SIZE(sampv)));
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
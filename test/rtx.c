@@ -0,0 +1,125 @@
+/**
+ * @file test/rtx.c  Test the RTP send history and retransmission
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "rtx"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	PKTC    = 16,
+	PRESZ   = 16,
+	PKTSIZE = 1000,
+};
+
+
+/* Send a packet with a payload that depends on the sequence number */
+static int send_packet(struct rtx *rtx, struct mbuf *mb, uint16_t seq,
+		       uint64_t now)
+{
+	size_t i;
+	int err = 0;
+
+	mbuf_rewind(mb);
+
+	for (i=0; i<PKTSIZE; i++)
+		err |= mbuf_write_u8(mb, (uint8_t)(seq + i));
+
+	mb->pos = 0;
+
+	rtx_store(rtx, seq % 8 == 0, seq * 3000u, mb);
+	rtx_commit(rtx, seq, now);
+
+	return err;
+}
+
+
+int test_rtx(void)
+{
+	struct rtx *rtx = NULL;
+	struct mbuf *mb, *mb_rtx = NULL;
+	uint64_t now = 1000;
+	uint16_t seq, osn;
+	uint32_t ts;
+	bool marker;
+	size_t i;
+	int err;
+
+	mb = mbuf_alloc(PKTSIZE);
+	if (!mb)
+		return ENOMEM;
+
+	/* enough for 8 packets in RTX_BURST */
+	err = rtx_alloc(&rtx, PKTC, 8 * PKTSIZE * 8 * 4);
+	TEST_ERR(err);
+
+	/* the history wraps, and so do the sequence numbers */
+	for (seq=65530; seq!=(uint16_t)(65530 + 2*PKTC); seq++) {
+		err = send_packet(rtx, mb, seq, now);
+		TEST_ERR(err);
+	}
+
+	now += 1000;
+
+	/* too old */
+	ASSERT_EQ(ENOENT, rtx_encode(rtx, &mb_rtx, PRESZ, 65530, now,
+				     &marker, &ts));
+
+	seq = (uint16_t)(65530 + 2*PKTC - 3);
+	err = rtx_encode(rtx, &mb_rtx, PRESZ, seq, now, &marker, &ts);
+	TEST_ERR(err);
+
+	ASSERT_EQ(PRESZ, mb_rtx->pos);
+	ASSERT_EQ(2 + PKTSIZE, mbuf_get_left(mb_rtx));
+	ASSERT_EQ(seq % 8 == 0, marker);
+	ASSERT_EQ(seq * 3000u, ts);
+
+	err = rtx_decode(mb_rtx, &osn);
+	TEST_ERR(err);
+	ASSERT_EQ(seq, osn);
+	ASSERT_EQ(PKTSIZE, mbuf_get_left(mb_rtx));
+
+	for (i=0; i<PKTSIZE; i++)
+		ASSERT_EQ((uint8_t)(seq + i), mb_rtx->buf[mb_rtx->pos + i]);
+
+	mb_rtx = mem_deref(mb_rtx);
+
+	/* a NACK that crossed the retransmission */
+	ASSERT_EQ(EALREADY, rtx_encode(rtx, &mb_rtx, PRESZ, seq, now,
+				       &marker, &ts));
+
+	/* the rate limit stops a burst of retransmissions */
+	for (i=0; i<PKTC; i++) {
+
+		seq = 65530 + PKTC + i;
+
+		err = rtx_encode(rtx, &mb_rtx, PRESZ, seq, now,
+				 &marker, &ts);
+		mb_rtx = mem_deref(mb_rtx);
+		if (err)
+			break;
+	}
+
+	ASSERT_EQ(ENOSPC, err);
+	ASSERT_TRUE(i >= 6 && i <= 8);
+
+	/* and allows them again after a while */
+	now += 1000;
+	err = rtx_encode(rtx, &mb_rtx, PRESZ, seq, now, &marker, &ts);
+	TEST_ERR(err);
+
+ out:
+	mem_deref(mb_rtx);
+	mem_deref(rtx);
+	mem_deref(mb);
+
+	return err;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file test/sdp.c  Test the SDP functions
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "sdp"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+int test_sdp_bundle(void)
+{
+	static const struct {
+		const char *val;
+		const char *mid;
+		int pos;
+	} testv[] = {
+		{"BUNDLE audio video",  "audio",  0},
+		{"BUNDLE audio video",  "video",  1},
+		{"BUNDLE 0 1 2",        "2",      2},
+		{"BUNDLE  0   1",       "1",      1},
+		{"BUNDLE audio video",  "vid",   -1},
+		{"BUNDLE audio video",  "data",  -1},
+		{"BUNDLE",              "audio", -1},
+		{"LS audio video",      "audio", -1},
+		{"bundle audio",        "audio", -1},
+	};
+	size_t i;
+	int err = 0;
+
+	for (i=0; i<ARRAY_SIZE(testv); i++) {
+
+		ASSERT_EQ(testv[i].pos,
+			  sdp_bundle_find(testv[i].val, testv[i].mid));
+	}
+
+	ASSERT_EQ(-1, sdp_bundle_find(NULL, "audio"));
+	ASSERT_EQ(-1, sdp_bundle_find("BUNDLE audio", NULL));
+
+ out:
+	return err;
+}
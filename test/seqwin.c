@@ -0,0 +1,80 @@
+/**
+ * @file test/seqwin.c  Test the window of received RTP sequence numbers
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "seqwin"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+int test_seqwin(void)
+{
+	struct seqwin w;
+	uint64_t expected, lost;
+	uint16_t seq;
+	int err = 0;
+
+	memset(&w, 0, sizeof(w));
+
+	/* in order, across the wrap of the sequence numbers */
+	for (seq=65500; seq!=100; seq++)
+		ASSERT_EQ(SEQWIN_NEW, seqwin_update(&w, seq));
+
+	ASSERT_EQ(136, w.n_rx);
+	ASSERT_EQ(0, seqwin_lost(&w));
+	ASSERT_EQ(0, w.gap);
+
+	/* a gap of 2, filled by a reordered packet */
+	ASSERT_EQ(SEQWIN_NEW, seqwin_update(&w, 102));
+	ASSERT_EQ(2, w.gap);
+	ASSERT_EQ(2, seqwin_lost(&w));
+
+	ASSERT_EQ(SEQWIN_REORDER, seqwin_update(&w, 100));
+	ASSERT_EQ(1, seqwin_lost(&w));
+	ASSERT_EQ(2, w.reorder_max);
+
+	ASSERT_EQ(SEQWIN_DUP, seqwin_update(&w, 100));
+	ASSERT_EQ(SEQWIN_DUP, seqwin_update(&w, 102));
+	ASSERT_EQ(2, w.n_dup);
+
+	/* older than the window */
+	ASSERT_EQ(SEQWIN_LATE, seqwin_update(&w, 102 - 100));
+	ASSERT_EQ(1, w.n_late);
+
+	/* a burst of 5, then the lost ones leave the window */
+	for (seq=103; seq<110; seq++)
+		ASSERT_EQ(SEQWIN_NEW, seqwin_update(&w, seq));
+	ASSERT_EQ(SEQWIN_NEW, seqwin_update(&w, 115));
+	ASSERT_EQ(5, w.gap);
+
+	for (seq=116; seq<200; seq++)
+		ASSERT_EQ(SEQWIN_NEW, seqwin_update(&w, seq));
+
+	ASSERT_EQ(6, w.n_lost);
+	ASSERT_EQ(6, seqwin_lost(&w));
+	ASSERT_EQ(1, w.burstv[0]);
+	ASSERT_EQ(1, w.burstv[4]);
+
+	seqwin_interval(&w, &expected, &lost);
+	ASSERT_EQ(w.n_final, expected);
+	ASSERT_EQ(6, lost);
+
+	/* a jump restarts the window, and is not counted as loss */
+	ASSERT_EQ(SEQWIN_RESTART, seqwin_update(&w, 30000));
+	ASSERT_EQ(SEQWIN_NEW, seqwin_update(&w, 30001));
+	ASSERT_EQ(6, seqwin_lost(&w));
+	ASSERT_EQ(1, w.n_restart);
+
+	seqwin_interval(&w, &expected, &lost);
+	ASSERT_EQ(0, lost);
+
+ out:
+	return err;
+}
@@ -8,17 +8,57 @@
 #
 # Test-cases:
 #
+TEST_SRCS	+= admit.c
+TEST_SRCS	+= ajb.c
+TEST_SRCS	+= aufilt.c
+TEST_SRCS	+= aulevel.c
+TEST_SRCS	+= aumix.c
+TEST_SRCS	+= auring.c
+TEST_SRCS	+= bench.c
+TEST_SRCS	+= bwe.c
 TEST_SRCS	+= cmd.c
+TEST_SRCS	+= conf.c
 TEST_SRCS	+= ua.c
+TEST_SRCS	+= contact.c
 TEST_SRCS	+= cplusplus.c
+TEST_SRCS	+= cpugov.c
+TEST_SRCS	+= dnscache.c
+TEST_SRCS	+= fec.c
+TEST_SRCS	+= g711.c
+TEST_SRCS	+= histo.c
+TEST_SRCS	+= impair.c
+TEST_SRCS	+= l16.c
+TEST_SRCS	+= lagmon.c
+TEST_SRCS	+= log.c
+TEST_SRCS	+= mclock.c
+TEST_SRCS	+= message.c
 TEST_SRCS	+= call.c
 TEST_SRCS	+= mos.c
 TEST_SRCS	+= net.c
+TEST_SRCS	+= quality.c
+TEST_SRCS	+= resamp.c
+TEST_SRCS	+= rtcpxr.c
+TEST_SRCS	+= rtpdemux.c
+TEST_SRCS	+= rtpext.c
+TEST_SRCS	+= rtx.c
+TEST_SRCS	+= sdp.c
+TEST_SRCS	+= seqwin.c
+TEST_SRCS	+= srtp.c
+TEST_SRCS	+= twheel.c
+
+ifneq ($(USE_VIDEO),)
+TEST_SRCS	+= h264.c
+TEST_SRCS	+= vidcomp.c
+TEST_SRCS	+= vidconv.c
+TEST_SRCS	+= vidpool.c
+TEST_SRCS	+= vidsrc.c
+endif
 
 
 #
 # Mocks
 #
+TEST_SRCS	+= mock/audev.c
 TEST_SRCS	+= mock/dnssrv.c
 
 TEST_SRCS	+= sip/aor.c
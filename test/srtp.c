@@ -0,0 +1,127 @@
+/**
+ * @file test/srtp.c  SRTP round-trip of the crypto suites
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "srtp"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	PACKETS      = 100,
+	PAYLOAD_SIZE = 1200,
+};
+
+
+static const struct {
+	const char *name;
+	enum srtp_suite suite;
+	size_t keylen;
+} suitev[] = {
+	{"AES_CM_128_HMAC_SHA1_32", SRTP_AES_CM_128_HMAC_SHA1_32, 16 + 14},
+	{"AES_CM_128_HMAC_SHA1_80", SRTP_AES_CM_128_HMAC_SHA1_80, 16 + 14},
+	{"AEAD_AES_128_GCM",        SRTP_AES_128_GCM,             16 + 12},
+	{"AEAD_AES_256_GCM",        SRTP_AES_256_GCM,             32 + 12},
+};
+
+
+static int packet_encrypt(struct srtp *tx, struct mbuf *mb,
+			  const uint8_t *payload, uint16_t seq)
+{
+	struct rtp_header hdr;
+	int err;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ver  = RTP_VERSION;
+	hdr.pt   = 96;
+	hdr.seq  = seq;
+	hdr.ts   = seq * 3000u;
+	hdr.ssrc = 0x01020304;
+
+	mb->pos = mb->end = 0;
+
+	err  = rtp_hdr_encode(mb, &hdr);
+	err |= mbuf_write_mem(mb, payload, PAYLOAD_SIZE);
+	if (err)
+		return err;
+
+	mb->pos = 0;
+
+	return srtp_encrypt(tx, mb);
+}
+
+
+/* Each packet is decrypted by the peer, and a modified one is rejected */
+int test_srtp(void)
+{
+	uint8_t key[32 + 12], payload[PAYLOAD_SIZE];
+	struct srtp *tx = NULL, *rx = NULL;
+	struct mbuf *mb;
+	size_t i, n;
+	int err = 0;
+
+	mb = mbuf_alloc(RTP_HEADER_SIZE + PAYLOAD_SIZE + 16);
+	if (!mb)
+		return ENOMEM;
+
+	rand_bytes(payload, sizeof(payload));
+
+	for (i=0; i<ARRAY_SIZE(suitev); i++) {
+
+		rand_bytes(key, sizeof(key));
+
+		err  = srtp_alloc(&tx, suitev[i].suite, key,
+				  suitev[i].keylen, 0);
+		err |= srtp_alloc(&rx, suitev[i].suite, key,
+				  suitev[i].keylen, 0);
+		if (err) {
+			/* the suites depend on the crypto library */
+			tx = mem_deref(tx);
+			rx = mem_deref(rx);
+			err = 0;
+			continue;
+		}
+
+		for (n=0; n<PACKETS; n++) {
+
+			err = packet_encrypt(tx, mb, payload, (uint16_t)n);
+			TEST_ERR(err);
+
+			ASSERT_TRUE(mb->end > RTP_HEADER_SIZE + PAYLOAD_SIZE);
+
+			mb->pos = 0;
+			err = srtp_decrypt(rx, mb);
+			TEST_ERR(err);
+
+			ASSERT_EQ(RTP_HEADER_SIZE + PAYLOAD_SIZE, mb->end);
+			ASSERT_TRUE(0 == memcmp(payload,
+						mb->buf + RTP_HEADER_SIZE,
+						PAYLOAD_SIZE));
+		}
+
+		/* one bit of the payload changed */
+		err = packet_encrypt(tx, mb, payload, (uint16_t)n);
+		TEST_ERR(err);
+
+		mb->buf[RTP_HEADER_SIZE] ^= 0x01;
+		mb->pos = 0;
+		ASSERT_TRUE(0 != srtp_decrypt(rx, mb));
+
+		tx = mem_deref(tx);
+		rx = mem_deref(rx);
+	}
+
+ out:
+	mem_deref(tx);
+	mem_deref(rx);
+	mem_deref(mb);
+
+	return err;
+}
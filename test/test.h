@@ -74,6 +74,7 @@ struct dns_server {
 	struct sa addr;
 	struct list rrl;
 	bool rotate;
+	unsigned n_queries;
 };
 
 int dns_server_alloc(struct dns_server **srvp, bool rotate);
@@ -84,31 +85,100 @@ int dns_server_add_srv(struct dns_server *srv, const char *name,
 		       const char *target);
 
 
+/*
+ * Mock Audio-devices
+ */
+
+int mock_ausrc_register(struct ausrc **ausrcp);
+int mock_auplay_register(struct auplay **auplayp);
+
+
+/* benchmarks */
+
+int bench_run(struct re_printf *pf);
+
+
+/* media quality */
+
+int quality_run(struct re_printf *pf);
+
+
 /* test cases */
 
+int test_admit(void);
+int test_ajb(void);
+int test_aufilt(void);
+int test_aulevel(void);
+int test_aumix(void);
+int test_auring(void);
+int test_bwe(void);
 int test_cmd(void);
+int test_cmd_exec(void);
+int test_cmd_exec_lines(void);
+int test_cmd_override(void);
+int test_conf_compact(void);
+int test_conf_sched(void);
+int test_cpugov(void);
 int test_ua_alloc(void);
+int test_uag_find(void);
 int test_uag_find_param(void);
 int test_ua_register(void);
 int test_ua_register_dns(void);
 int test_ua_register_auth(void);
 int test_ua_register_auth_dns(void);
 int test_ua_options(void);
+int test_fec(void);
+int test_g711(void);
+int test_histo(void);
+int test_impair(void);
+int test_l16(void);
+int test_lagmon(void);
+int test_log(void);
+int test_mclock(void);
+int test_message(void);
 int test_mos(void);
+int test_mos_continuous(void);
 int test_network(void);
+int test_network_nat(void);
+int test_network_keepalive(void);
+int test_resamp(void);
+int test_rtcpxr(void);
+int test_rtpdemux(void);
+int test_rtpext(void);
+int test_rtx(void);
+int test_sdp_bundle(void);
+int test_seqwin(void);
+int test_srtp(void);
+int test_twheel(void);
 
 int test_call_answer(void);
 int test_call_reject(void);
 int test_call_af_mismatch(void);
 int test_call_answer_hangup_a(void);
 int test_call_answer_hangup_b(void);
+int test_call_max_calls(void);
+int test_call_stats(void);
+
+#ifdef USE_VIDEO
+int test_h264_startcode(void);
+int test_h264_stap_a(void);
+int test_vidcomp(void);
+int test_vidconv_blend(void);
+int test_vidconv_fast(void);
+int test_vidconv_scale(void);
+int test_vidpool(void);
+int test_vidsrc_dmabuf(void);
+int test_vidsrc_hub(void);
+#endif
 
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+int test_contact(void);
 int test_cplusplus(void);
+int test_dnscache(void);
 
 #ifdef __cplusplus
 }
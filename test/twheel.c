@@ -0,0 +1,135 @@
+/**
+ * @file test/twheel.c  Test the hierarchical timer wheel
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "twheel"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum { RES = 10 };
+
+
+struct entry {
+	struct twheel_tmr tmr;
+	uint64_t delay;
+	unsigned fired;
+	struct entry *cancel;         /* cancelled by the handler */
+};
+
+
+static void timeout(void *arg)
+{
+	struct entry *e = arg;
+
+	++e->fired;
+
+	if (e->cancel)
+		twheel_tmr_cancel(&e->cancel->tmr);
+}
+
+
+int test_twheel(void)
+{
+	/* level 0, level 1, level 2, level 3 and beyond the top level */
+	struct entry ev[] = {
+		{ .delay = 0         },
+		{ .delay = 50        },
+		{ .delay = 5000      },
+		{ .delay = 300000    },
+		{ .delay = 30000000  },
+		{ .delay = 200000000 },
+	};
+	struct entry ec = { .delay = 200 };
+	struct entry ek = { .delay = 100 };
+	struct twheel *tw;
+	uint64_t base;
+	size_t i;
+	int err;
+
+	err = twheel_alloc(&tw, RES);
+	if (err)
+		return err;
+
+	base = tmr_jiffies();
+
+	for (i=0; i<ARRAY_SIZE(ev); i++)
+		twheel_tmr_start(&ev[i].tmr, tw, ev[i].delay, timeout, &ev[i]);
+
+	ASSERT_EQ(ARRAY_SIZE(ev), twheel_count(tw));
+
+	/* each timer runs after its delay, and not one tick before */
+	for (i=0; i<ARRAY_SIZE(ev) - 1; i++) {
+
+		size_t j;
+
+		if (ev[i].delay >= RES) {
+			twheel_poll(tw, base + ev[i].delay - RES);
+			ASSERT_EQ(0, ev[i].fired);
+		}
+
+		twheel_poll(tw, base + ev[i].delay + 2*RES);
+		ASSERT_EQ(1, ev[i].fired);
+		ASSERT_TRUE(!twheel_tmr_isrunning(&ev[i].tmr));
+
+		for (j=i+1; j<ARRAY_SIZE(ev); j++)
+			ASSERT_EQ(0, ev[j].fired);
+	}
+
+	/* the last one is past the span of the wheel */
+	ASSERT_EQ(1, twheel_count(tw));
+	twheel_poll(tw, base + ev[ARRAY_SIZE(ev)-1].delay + RES * 1000);
+	ASSERT_EQ(1, ev[ARRAY_SIZE(ev)-1].fired);
+	ASSERT_EQ(0, twheel_count(tw));
+
+	/* the wheel is now far ahead of tmr_jiffies() */
+	tw = mem_deref(tw);
+	err = twheel_alloc(&tw, RES);
+	if (err)
+		goto out;
+
+	/* a handler cancels a later timer */
+	base = tmr_jiffies();
+	ek.cancel = &ec;
+	twheel_tmr_start(&ec.tmr, tw, ec.delay, timeout, &ec);
+	twheel_tmr_start(&ek.tmr, tw, ek.delay, timeout, &ek);
+	ASSERT_EQ(2, twheel_count(tw));
+
+	twheel_poll(tw, base + 1000);
+	ASSERT_EQ(1, ek.fired);
+	ASSERT_EQ(0, ec.fired);
+	ASSERT_EQ(0, twheel_count(tw));
+
+	tw = mem_deref(tw);
+	err = twheel_alloc(&tw, RES);
+	if (err)
+		goto out;
+
+	/* restart moves the timer */
+	base = tmr_jiffies();
+	ek.cancel = NULL;
+	twheel_tmr_start(&ek.tmr, tw, 100, timeout, &ek);
+	twheel_tmr_start(&ek.tmr, tw, 500, timeout, &ek);
+	ASSERT_EQ(1, twheel_count(tw));
+	twheel_poll(tw, base + 300);
+	ASSERT_EQ(1, ek.fired);
+	twheel_poll(tw, base + 600);
+	ASSERT_EQ(2, ek.fired);
+
+	/* the timers of a freed wheel are stopped */
+	twheel_tmr_start(&ec.tmr, tw, 100, timeout, &ec);
+	tw = mem_deref(tw);
+	ASSERT_TRUE(!twheel_tmr_isrunning(&ec.tmr));
+	twheel_tmr_cancel(&ec.tmr);
+
+ out:
+	mem_deref(tw);
+
+	return err;
+}
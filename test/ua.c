@@ -192,6 +192,47 @@ int test_ua_alloc(void)
 }
 
 
+int test_uag_find(void)
+{
+	struct ua *ua1 = NULL, *ua2 = NULL;
+	struct pl pl;
+	int err = 0;
+
+	err  = ua_alloc(&ua1, "<sip:alice@127.0.0.1>;regint=0");
+	err |= ua_alloc(&ua2, "<sip:bob@127.0.0.1>;regint=0");
+	if (err)
+		goto out;
+
+	/* by contact username */
+	pl_set_str(&pl, ua_local_cuser(ua2));
+	ASSERT_TRUE(ua2 == uag_find(&pl));
+
+	/* by local username, case-insensitive */
+	pl_set_str(&pl, "alice");
+	ASSERT_TRUE(ua1 == uag_find(&pl));
+	pl_set_str(&pl, "BOB");
+	ASSERT_TRUE(ua2 == uag_find(&pl));
+	pl_set_str(&pl, "carol");
+	ASSERT_TRUE(NULL == uag_find(&pl));
+
+	ASSERT_TRUE(ua1 == uag_find_aor("sip:alice@127.0.0.1"));
+	ASSERT_TRUE(ua2 == uag_find_aor("sip:bob@127.0.0.1"));
+
+	/* removed from the index when destroyed */
+	ua2 = mem_deref(ua2);
+
+	pl_set_str(&pl, "bob");
+	ASSERT_TRUE(NULL == uag_find(&pl));
+	ASSERT_TRUE(NULL == uag_find_aor("sip:bob@127.0.0.1"));
+
+ out:
+	mem_deref(ua2);
+	mem_deref(ua1);
+
+	return err;
+}
+
+
 int test_uag_find_param(void)
 {
 	struct ua *ua1 = NULL, *ua2 = NULL;
@@ -0,0 +1,137 @@
+/**
+ * @file test/vidcomp.c  Test the video display compositor
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "vidcomp"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+struct vidisp_st {
+	const struct vidisp *vd;
+	struct vidrect rectv[2];
+	size_t tilec;
+	unsigned framec;
+	unsigned drawc;
+};
+
+static struct vidisp_st *mock_disp;
+
+
+static int mock_alloc(struct vidisp_st **stp, const struct vidisp *vd,
+		      struct vidisp_prm *prm, const char *dev,
+		      vidisp_resize_h *resizeh, void *arg)
+{
+	struct vidisp_st *st;
+	(void)prm;
+	(void)dev;
+	(void)resizeh;
+	(void)arg;
+
+	st = mem_zalloc(sizeof(*st), NULL);
+	if (!st)
+		return ENOMEM;
+
+	st->vd = vd;
+	mock_disp = st;
+
+	*stp = st;
+
+	return 0;
+}
+
+
+static int mock_display(struct vidisp_st *st, const char *title,
+			const struct vidframe *frame)
+{
+	(void)st;
+	(void)title;
+	(void)frame;
+
+	return ENOTSUP;
+}
+
+
+static int mock_compose(struct vidisp_st *st, const char *title,
+			const struct vidsz *canvas,
+			const struct vidisp_tile *tilev, size_t tilec)
+{
+	size_t i;
+	(void)title;
+	(void)canvas;
+
+	st->tilec = tilec;
+	++st->drawc;
+
+	for (i=0; i<tilec && i<ARRAY_SIZE(st->rectv); i++) {
+
+		st->rectv[i] = *tilev[i].rect;
+		if (tilev[i].frame)
+			++st->framec;
+	}
+
+	if (tilec == 2 && st->framec == 2)
+		re_cancel();
+
+	return 0;
+}
+
+
+int test_vidcomp(void)
+{
+	struct vidisp_st *a = NULL, *b = NULL;
+	const struct vidsz sz = {64, 32};
+	struct vidframe *frame = NULL;
+	struct vidisp *vd = NULL;
+	const struct vidrect *ra, *rb;
+	int err;
+
+	err = vidisp_register(&vd, "mock-comp", mock_alloc, NULL,
+			      mock_display, NULL);
+	TEST_ERR(err);
+
+	vidisp_set_compose(vd, mock_compose);
+
+	err = vidframe_alloc(&frame, VID_FMT_YUV420P, &sz);
+	TEST_ERR(err);
+
+	/* both calls get a tile of the same display */
+	err  = vidcomp_alloc(&a, "mock-comp", NULL, NULL, VIDCOMP_GRID);
+	err |= vidcomp_alloc(&b, "mock-comp", NULL, NULL, VIDCOMP_GRID);
+	TEST_ERR(err);
+
+	err  = vidisp_display(a, "a", frame);
+	err |= vidisp_display(b, "b", frame);
+	TEST_ERR(err);
+
+	/* drawn once, from the main loop */
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+
+	ASSERT_EQ(1, mock_disp->drawc);
+	ASSERT_EQ(2, mock_disp->tilec);
+
+	/* side by side, with the aspect ratio of the picture */
+	ra = &mock_disp->rectv[0];
+	rb = &mock_disp->rectv[1];
+	ASSERT_EQ(2 * ra->h, ra->w);
+	ASSERT_EQ(ra->w, rb->w);
+	ASSERT_EQ(ra->y, rb->y);
+	ASSERT_TRUE(ra->x + ra->w <= rb->x);
+
+ out:
+	mem_deref(b);
+	mem_deref(a);
+	mem_deref(frame);
+	mem_deref(vd);
+
+	return err;
+}
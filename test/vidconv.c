@@ -0,0 +1,394 @@
+/**
+ * @file test/vidconv.c  Test the accelerated video conversion
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "vidconv"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+static const struct {
+	enum vidfmt src;
+	enum vidfmt dst;
+} pairv[] = {
+	{VID_FMT_YUYV422, VID_FMT_YUV420P},
+	{VID_FMT_NV12,    VID_FMT_YUV420P},
+	{VID_FMT_RGB32,   VID_FMT_YUV420P},
+	{VID_FMT_YUV420P, VID_FMT_RGB32  },
+};
+
+
+static size_t plane_width(const struct vidframe *vf, int i)
+{
+	switch (vf->fmt) {
+
+	case VID_FMT_YUV420P: return i ? vf->size.w/2 : vf->size.w;
+	case VID_FMT_NV12:    return vf->size.w;
+	case VID_FMT_YUYV422: return vf->size.w * 2;
+	case VID_FMT_RGB32:   return vf->size.w * 4;
+	default:              return 0;
+	}
+}
+
+
+static void frame_random(struct vidframe *vf)
+{
+	int i;
+
+	for (i=0; i<4; i++) {
+
+		unsigned h = i ? vf->size.h/2 : vf->size.h;
+
+		if (!vf->data[i] || !vf->linesize[i])
+			continue;
+
+		rand_bytes(vf->data[i], vf->linesize[i] * h);
+	}
+}
+
+
+static bool frame_equal(const struct vidframe *a, const struct vidframe *b)
+{
+	int i;
+
+	for (i=0; i<4; i++) {
+
+		unsigned j, h = i ? a->size.h/2 : a->size.h;
+		size_t w = plane_width(a, i);
+
+		if (!a->data[i] || !a->linesize[i])
+			continue;
+
+		for (j=0; j<h; j++) {
+
+			if (memcmp(a->data[i] + j * a->linesize[i],
+				   b->data[i] + j * b->linesize[i], w))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+
+int test_vidconv_fast(void)
+{
+	struct vidsz sz = {330, 94};
+	struct vidframe *src = NULL, *ref = NULL, *dst = NULL;
+	size_t i;
+	int impl;
+	int err = 0;
+
+	for (i=0; i<ARRAY_SIZE(pairv); i++) {
+
+		err |= vidframe_alloc(&src, pairv[i].src, &sz);
+		err |= vidframe_alloc(&ref, pairv[i].dst, &sz);
+		err |= vidframe_alloc(&dst, pairv[i].dst, &sz);
+		if (err)
+			goto out;
+
+		frame_random(src);
+
+		err = vidconv_fast_impl(SIMD_C, ref, src);
+		TEST_ERR(err);
+
+		for (impl=SIMD_C+1; impl<SIMD_N; impl++) {
+
+			if (!simd_supported(impl))
+				continue;
+
+			frame_random(dst);
+
+			err = vidconv_fast_impl(impl, dst, src);
+			TEST_ERR(err);
+
+			if (!frame_equal(ref, dst)) {
+				warning("vidconv: %s -> %s: %s differs\n",
+					vidfmt_name(pairv[i].src),
+					vidfmt_name(pairv[i].dst),
+					simd_name(impl));
+				err = EBADMSG;
+				goto out;
+			}
+		}
+
+		src = mem_deref(src);
+		ref = mem_deref(ref);
+		dst = mem_deref(dst);
+	}
+
+	/* odd sizes are not handled by the fast path */
+	sz.w = 33;
+	err  = vidframe_alloc(&src, VID_FMT_NV12, &sz);
+	err |= vidframe_alloc(&dst, VID_FMT_YUV420P, &sz);
+	if (err)
+		goto out;
+
+	ASSERT_EQ(ENOTSUP, vidconv_fast_impl(SIMD_C, dst, src));
+	err = 0;
+
+ out:
+	mem_deref(src);
+	mem_deref(ref);
+	mem_deref(dst);
+
+	return err;
+}
+
+
+/* All SIMD versions give the same output as the scalar one */
+static int scale_impls(enum vidfmt sfmt, const struct vidsz *ssz,
+		       enum vidfmt dfmt, const struct vidsz *dsz)
+{
+	struct vidframe *src = NULL, *ref = NULL, *dst = NULL;
+	int impl;
+	int err;
+
+	err  = vidframe_alloc(&src, sfmt, ssz);
+	err |= vidframe_alloc(&ref, dfmt, dsz);
+	err |= vidframe_alloc(&dst, dfmt, dsz);
+	if (err)
+		goto out;
+
+	frame_random(src);
+
+	err = vidconv_scale_impl(SIMD_C, ref, src, NULL);
+	TEST_ERR(err);
+
+	for (impl=SIMD_C+1; impl<SIMD_N; impl++) {
+
+		if (!simd_supported(impl))
+			continue;
+
+		frame_random(dst);
+
+		err = vidconv_scale_impl(impl, dst, src, NULL);
+		TEST_ERR(err);
+
+		if (!frame_equal(ref, dst)) {
+			warning("vidconv: scale %ux%u -> %ux%u: %s differs\n",
+				ssz->w, ssz->h, dsz->w, dsz->h,
+				simd_name(impl));
+			err = EBADMSG;
+			goto out;
+		}
+	}
+
+ out:
+	mem_deref(src);
+	mem_deref(ref);
+	mem_deref(dst);
+
+	return err;
+}
+
+
+/* Box filter, into a rectangle and the whole frame */
+int test_vidconv_scale(void)
+{
+	static const struct {
+		enum vidfmt sfmt, dfmt;
+		struct vidsz ssz, dsz;
+	} sizev[] = {
+		{VID_FMT_YUV420P, VID_FMT_YUV420P, {1280, 720}, {640, 360}},
+		{VID_FMT_YUV420P, VID_FMT_YUV420P, {1280, 720}, {320, 180}},
+		{VID_FMT_YUV420P, VID_FMT_YUV420P, {320, 180},  {1280, 720}},
+		{VID_FMT_NV12,    VID_FMT_YUV420P, {640, 360},  {352, 288}},
+		{VID_FMT_NV12,    VID_FMT_NV12,    {640, 360},  {320, 180}},
+		{VID_FMT_YUV420P, VID_FMT_NV12,    {176, 144},  {354, 290}},
+		{VID_FMT_YUV420P, VID_FMT_YUV420P, {3840, 2160}, {960, 540}},
+	};
+	size_t k;
+	const struct vidsz ssz = {1280, 720}, dsz = {352, 288};
+	const struct vidrect rect = {20, 10, 214, 121};
+	struct vidframe *src = NULL, *ref = NULL, *dst = NULL;
+	struct vidsz sz = {4, 2};
+	int impl;
+	int err;
+
+	err  = vidframe_alloc(&src, VID_FMT_YUV420P, &ssz);
+	err |= vidframe_alloc(&ref, VID_FMT_YUV420P, &dsz);
+	err |= vidframe_alloc(&dst, VID_FMT_YUV420P, &dsz);
+	if (err)
+		goto out;
+
+	/* a flat frame stays flat, outside the rectangle is untouched */
+	vidframe_fill(src, 77, 77, 77);
+	vidframe_fill(ref, 0, 0, 0);
+
+	err = vidconv_scale_impl(SIMD_C, ref, src, &rect);
+	TEST_ERR(err);
+
+	ASSERT_EQ(0, ref->data[0][0]);
+	ASSERT_EQ(ref->data[0][rect.y * ref->linesize[0] + rect.x + 1],
+		  src->data[0][0]);
+	ASSERT_EQ(ref->data[0][(rect.y + rect.h - 1) * ref->linesize[0] +
+			       rect.x + rect.w - 1], src->data[0][0]);
+	ASSERT_EQ(0, ref->data[0][(rect.y + rect.h) * ref->linesize[0] +
+				 rect.x + rect.w]);
+
+	frame_random(src);
+
+	err = vidconv_scale_impl(SIMD_C, ref, src, NULL);
+	TEST_ERR(err);
+
+	for (impl=SIMD_C+1; impl<SIMD_N; impl++) {
+
+		if (!simd_supported(impl))
+			continue;
+
+		frame_random(dst);
+
+		err = vidconv_scale_impl(impl, dst, src, NULL);
+		TEST_ERR(err);
+
+		if (!frame_equal(ref, dst)) {
+			warning("vidconv: scale: %s differs\n",
+				simd_name(impl));
+			err = EBADMSG;
+			goto out;
+		}
+	}
+
+	src = mem_deref(src);
+	dst = mem_deref(dst);
+
+	/* the 2:1 and 4:1 paths, bilinear, NV12 and bands of 4K */
+	for (k=0; k<ARRAY_SIZE(sizev); k++) {
+
+		err = scale_impls(sizev[k].sfmt, &sizev[k].ssz,
+				  sizev[k].dfmt, &sizev[k].dsz);
+		TEST_ERR(err);
+	}
+
+	/* 2x2 boxes are averaged with rounding */
+	err = vidframe_alloc(&src, VID_FMT_YUV420P, &sz);
+	sz.w = 2;
+	sz.h = 1;
+	err |= vidframe_alloc(&dst, VID_FMT_YUV420P, &sz);
+	if (err)
+		goto out;
+
+	src->data[0][0] = 10;
+	src->data[0][1] = 20;
+	src->data[0][2] = 30;
+	src->data[0][3] = 41;
+	src->data[0][src->linesize[0] + 0] = 50;
+	src->data[0][src->linesize[0] + 1] = 60;
+	src->data[0][src->linesize[0] + 2] = 70;
+	src->data[0][src->linesize[0] + 3] = 80;
+
+	err = vidconv_scale(dst, src, NULL);
+	TEST_ERR(err);
+
+	ASSERT_EQ(35, dst->data[0][0]);
+	ASSERT_EQ(55, dst->data[0][1]);
+
+	/* growing is bilinear, with the pixel centres aligned */
+	ref = mem_deref(ref);
+	sz.w = 4;
+	err = vidframe_alloc(&ref, VID_FMT_YUV420P, &sz);
+	if (err)
+		goto out;
+
+	dst->data[0][0] = 0;
+	dst->data[0][1] = 255;
+
+	err = vidconv_scale(ref, dst, NULL);
+	TEST_ERR(err);
+
+	ASSERT_EQ(0,   ref->data[0][0]);
+	ASSERT_EQ(64,  ref->data[0][1]);
+	ASSERT_EQ(191, ref->data[0][2]);
+	ASSERT_EQ(255, ref->data[0][3]);
+
+	/* only YUV420P, NV12 and NV21 are handled */
+	ref = mem_deref(ref);
+	err = vidframe_alloc(&ref, VID_FMT_RGB32, &sz);
+	if (err)
+		goto out;
+
+	ASSERT_EQ(ENOTSUP, vidconv_scale(ref, src, NULL));
+	err = 0;
+
+ out:
+	mem_deref(src);
+	mem_deref(ref);
+	mem_deref(dst);
+
+	return err;
+}
+
+
+/* Mask blending keeps, dims and replaces, and all versions agree */
+int test_vidconv_blend(void)
+{
+	enum { W = 75, H = 3, LS = 80 };
+	uint16_t mul[W*H], add[W*H];
+	uint8_t ref[LS*H], buf[LS*H];
+	int impl;
+	unsigned i;
+	int err = 0;
+
+	for (i=0; i<W*H; i++) {
+		mul[i] = rand_u16() % 257;
+		add[i] = rand_u16() % ((256 - mul[i]) * 255 + 1);
+	}
+
+	rand_bytes(ref, sizeof(ref));
+	memcpy(buf, ref, sizeof(buf));
+
+	err = vidconv_blend_impl(SIMD_C, ref, LS, mul, add, W, H);
+	TEST_ERR(err);
+
+	for (i=0; i<W*H; i++) {
+		unsigned v = buf[i/W*LS + i%W];
+
+		ASSERT_EQ((v * mul[i] + add[i]) >> 8, ref[i/W*LS + i%W]);
+	}
+
+	for (impl=SIMD_C+1; impl<SIMD_N; impl++) {
+
+		uint8_t dst[LS*H];
+
+		if (!simd_supported(impl))
+			continue;
+
+		memcpy(dst, buf, sizeof(dst));
+
+		err = vidconv_blend_impl(impl, dst, LS, mul, add, W, H);
+		TEST_ERR(err);
+
+		if (memcmp(ref, dst, sizeof(dst))) {
+			warning("vidconv: blend: %s differs\n",
+				simd_name(impl));
+			err = EBADMSG;
+			goto out;
+		}
+	}
+
+	/* keep, replace and dim by half */
+	buf[0] = buf[1] = buf[2] = 100;
+	mul[0] = 256; add[0] = 0;
+	mul[1] = 0;   add[1] = 200 << 8;
+	mul[2] = 128; add[2] = 0;
+
+	vidconv_blend(buf, LS, mul, add, 3, 1);
+
+	ASSERT_EQ(100, buf[0]);
+	ASSERT_EQ(200, buf[1]);
+	ASSERT_EQ(50,  buf[2]);
+
+ out:
+	return err;
+}
+
+
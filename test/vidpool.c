@@ -0,0 +1,72 @@
+/**
+ * @file test/vidpool.c  Test the video frame pool
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "vidpool"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+int test_vidpool(void)
+{
+	struct vidframe_pool *pool = NULL;
+	struct vidframe *f1 = NULL, *f2 = NULL, *f3 = NULL;
+	const struct vidsz sz = {35, 17};
+	uint8_t *data;
+	int i, err;
+
+	err = vidframe_pool_alloc(&pool, VID_FMT_YUV420P, &sz, 2);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(vidframe_pool_match(pool, VID_FMT_YUV420P, &sz));
+	ASSERT_TRUE(!vidframe_pool_match(pool, VID_FMT_RGB32, &sz));
+
+	err  = vidframe_pool_get(pool, &f1);
+	err |= vidframe_pool_get(pool, &f2);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(f1 != f2);
+	ASSERT_TRUE(vidsz_cmp(&sz, &f1->size));
+	ASSERT_EQ(VID_FMT_YUV420P, f1->fmt);
+
+	/* aligned and padded planes */
+	for (i=0; i<3; i++) {
+		ASSERT_TRUE(((uintptr_t)f1->data[i] & 31) == 0);
+		ASSERT_TRUE((f1->linesize[i] & 31) == 0);
+	}
+	ASSERT_TRUE(f1->linesize[0] >= sz.w);
+	ASSERT_TRUE(f1->linesize[1] >= (sz.w + 1) / 2);
+	ASSERT_TRUE(f1->data[3] == NULL);
+
+	/* all frames in use */
+	err = vidframe_pool_get(pool, &f3);
+	ASSERT_EQ(EBUSY, err);
+
+	/* a released frame is handed out again */
+	data = f1->data[0];
+	f1 = mem_deref(f1);
+
+	err = vidframe_pool_get(pool, &f3);
+	TEST_ERR(err);
+	ASSERT_TRUE(data == f3->data[0]);
+
+	/* frames outlive the pool */
+	pool = mem_deref(pool);
+	memset(f2->data[0], 0xff, f2->linesize[0] * sz.h);
+
+ out:
+	mem_deref(f3);
+	mem_deref(f2);
+	mem_deref(f1);
+	mem_deref(pool);
+
+	return err;
+}
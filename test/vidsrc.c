@@ -0,0 +1,204 @@
+/**
+ * @file test/vidsrc.c  Test the video source DMABUF registry and capture
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "vidsrc"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+int test_vidsrc_dmabuf(void)
+{
+	struct dmabuf *db1 = NULL, *db2 = NULL;
+	const struct vidsz sz = {64, 32};
+	uint8_t buf1[64 * 32 * 3 / 2], buf2[64 * 32 * 3 / 2];
+	struct vidframe frame;
+	size_t offv[4], len = 0;
+	int err;
+
+	err  = vidsrc_dmabuf_add(&db1, buf1, sizeof(buf1), 11);
+	err |= vidsrc_dmabuf_add(&db2, buf2, sizeof(buf2), 12);
+	TEST_ERR(err);
+
+	/* a frame in the first buffer */
+	vidframe_init_buf(&frame, VID_FMT_YUV420P, &sz, buf1);
+
+	ASSERT_EQ(11, vidsrc_dmabuf_fd(&frame, offv, &len));
+	ASSERT_EQ(sizeof(buf1), len);
+	ASSERT_EQ(0, offv[0]);
+	ASSERT_EQ(64 * 32, offv[1]);
+	ASSERT_EQ(64 * 32 * 5 / 4, offv[2]);
+	ASSERT_EQ(0, offv[3]);
+
+	/* a frame in the second buffer */
+	vidframe_init_buf(&frame, VID_FMT_YUV420P, &sz, buf2);
+	ASSERT_EQ(12, vidsrc_dmabuf_fd(&frame, NULL, NULL));
+
+	/* a removed buffer is not found */
+	db2 = mem_deref(db2);
+	ASSERT_EQ(-1, vidsrc_dmabuf_fd(&frame, NULL, NULL));
+
+	ASSERT_EQ(-1, vidsrc_dmabuf_fd(NULL, NULL, NULL));
+
+	err = vidsrc_dmabuf_add(&db2, NULL, 0, 1);
+	ASSERT_EQ(EINVAL, err);
+	err = 0;
+
+ out:
+	mem_deref(db2);
+	mem_deref(db1);
+
+	return err;
+}
+
+
+struct vidsrc_st {
+	const struct vidsrc *vs;
+	vidsrc_frame_h *frameh;
+	vidsrc_error_h *errorh;
+	void *arg;
+};
+
+struct hub_user {
+	struct vidhub_st *st;
+	struct vidframe *frame;   /* last frame, not referenced */
+	unsigned framec;
+	int err;
+};
+
+static struct vidsrc_st *mock_src;
+static unsigned mock_openc;
+
+
+static void mock_destructor(void *arg)
+{
+	(void)arg;
+
+	mock_src = NULL;
+}
+
+
+static int mock_alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
+		      struct media_ctx **ctx, struct vidsrc_prm *prm,
+		      const struct vidsz *size, const char *fmt,
+		      const char *dev, vidsrc_frame_h *frameh,
+		      vidsrc_error_h *errorh, void *arg)
+{
+	struct vidsrc_st *st;
+	(void)ctx;
+	(void)prm;
+	(void)size;
+	(void)fmt;
+	(void)dev;
+
+	st = mem_zalloc(sizeof(*st), mock_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->vs     = vs;
+	st->frameh = frameh;
+	st->errorh = errorh;
+	st->arg    = arg;
+
+	mock_src = st;
+	++mock_openc;
+
+	*stp = st;
+
+	return 0;
+}
+
+
+static void user_frame_handler(struct vidframe *frame, void *arg)
+{
+	struct hub_user *u = arg;
+
+	u->frame = frame;
+	++u->framec;
+}
+
+
+static void user_error_handler(int err, void *arg)
+{
+	struct hub_user *u = arg;
+
+	u->err = err;
+	u->st = mem_deref(u->st);
+}
+
+
+int test_vidsrc_hub(void)
+{
+	struct hub_user a = {0}, b = {0}, c = {0};
+	struct vidsrc_prm prm = {0, 30, NULL};
+	const struct vidsz sz = {64, 32};
+	struct vidframe *frame = NULL;
+	struct vidsrc *vs = NULL;
+	int err;
+
+	mock_openc = 0;
+
+	err = vidsrc_register(&vs, "mock-hub", mock_alloc, NULL);
+	TEST_ERR(err);
+
+	err = vidframe_alloc(&frame, VID_FMT_NV12, &sz);
+	TEST_ERR(err);
+
+	/* three users of one device, the source is opened once */
+	err  = vidhub_alloc(&a.st, "mock-hub", &prm, &sz, "cam0",
+			    VID_FMT_YUV420P, user_frame_handler,
+			    user_error_handler, &a);
+	err |= vidhub_alloc(&b.st, "mock-hub", &prm, &sz, "cam0",
+			    VID_FMT_YUV420P, user_frame_handler,
+			    user_error_handler, &b);
+	err |= vidhub_alloc(&c.st, "mock-hub", &prm, &sz, "cam0",
+			    VID_FMT_N, user_frame_handler,
+			    user_error_handler, &c);
+	TEST_ERR(err);
+
+	ASSERT_EQ(1, mock_openc);
+	ASSERT_TRUE(vidhub_vidsrc(a.st) == vs);
+
+	/* converted once, the same frame for both users of the format */
+	mock_src->frameh(frame, mock_src->arg);
+
+	ASSERT_EQ(1, a.framec);
+	ASSERT_EQ(1, b.framec);
+	ASSERT_EQ(1, c.framec);
+	ASSERT_EQ(VID_FMT_YUV420P, a.frame->fmt);
+	ASSERT_TRUE(a.frame == b.frame);
+	ASSERT_TRUE(c.frame == frame);
+
+	/* the source is closed with the last user */
+	b.st = mem_deref(b.st);
+	c.st = mem_deref(c.st);
+	ASSERT_TRUE(mock_src != NULL);
+
+	/* errors go to all users */
+	mock_src->errorh(EPIPE, mock_src->arg);
+	ASSERT_EQ(EPIPE, a.err);
+	ASSERT_TRUE(a.st == NULL);
+	ASSERT_TRUE(mock_src == NULL);
+
+	err = vidhub_alloc(&a.st, "none", &prm, &sz, "cam0", VID_FMT_N,
+			   user_frame_handler, NULL, &a);
+	ASSERT_EQ(ENOENT, err);
+	err = 0;
+
+ out:
+	mem_deref(c.st);
+	mem_deref(b.st);
+	mem_deref(a.st);
+	mem_deref(frame);
+	mem_deref(vs);
+
+	return err;
+}